@@ -15,6 +15,8 @@
 #include "commit.h"
 #include "tag.h"
 #include "alloc.h"
+#include "json-writer.h"
+#include "repository.h"
 
 #define BLOCKING 1024
 
@@ -36,6 +38,13 @@ struct alloc_state {
 	int slab_nr, slab_alloc;
 };
 
+static int alloc_report_atexit_registered;
+
+static void alloc_report_atexit(void)
+{
+	alloc_report(the_repository);
+}
+
 struct alloc_state *allocate_alloc_state(void)
 {
 	return xcalloc(1, sizeof(struct alloc_state));
@@ -61,6 +70,11 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 
 		ALLOC_GROW(s->slabs, s->slab_nr + 1, s->slab_alloc);
 		s->slabs[s->slab_nr++] = s->p;
+
+		if (trace2_is_enabled() && !alloc_report_atexit_registered) {
+			atexit(alloc_report_atexit);
+			alloc_report_atexit_registered = 1;
+		}
 	}
 	s->nr--;
 	s->count++;
@@ -119,21 +133,44 @@ void *alloc_commit_node(struct repository *r)
 	return c;
 }
 
-static void report(const char *name, unsigned int count, size_t size)
+static void report(struct json_writer *jw, const char *name,
+		   struct alloc_state *s, size_t node_size)
 {
-	fprintf(stderr, "%10s: %8u (%"PRIuMAX" kB)\n",
-			name, count, (uintmax_t) size);
+	jw_object_inline_begin_object(jw, name);
+	jw_object_intmax(jw, "nodes", s->count);
+	jw_object_intmax(jw, "slabs", s->slab_nr);
+	jw_object_intmax(jw, "used_kb", (s->count * node_size) >> 10);
+	jw_object_intmax(jw, "allocated_kb",
+			 ((size_t)s->slab_nr * BLOCKING * node_size) >> 10);
+	jw_end(jw);
 }
 
 #define REPORT(name, type)	\
-    report(#name, r->parsed_objects->name##_state->count, \
-		  r->parsed_objects->name##_state->count * sizeof(type) >> 10)
+    report(&jw, #name, r->parsed_objects->name##_state, sizeof(type))
 
+/*
+ * Emit how many nodes of each type were allocated, in how many slabs,
+ * and how full the object hash is, as trace2 data.
+ */
 void alloc_report(struct repository *r)
 {
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	/* the pool may be gone already */
+	if (!r->parsed_objects || !r->parsed_objects->blob_state)
+		return;
+
+	jw_object_begin(&jw, 0);
 	REPORT(blob, struct blob);
 	REPORT(tree, struct tree);
 	REPORT(commit, struct commit);
 	REPORT(tag, struct tag);
 	REPORT(object, union any_object);
+	jw_object_intmax(&jw, "obj_hash_nr", r->parsed_objects->nr_objs);
+	jw_object_intmax(&jw, "obj_hash_size", r->parsed_objects->obj_hash_size);
+	jw_end(&jw);
+
+	trace2_data_json("alloc", r, "statistics", &jw);
+
+	jw_release(&jw);
 }
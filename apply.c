@@ -21,6 +21,7 @@
 #include "quote.h"
 #include "rerere.h"
 #include "apply.h"
+#include "thread-utils.h"
 
 struct gitdiff_data {
 	struct strbuf *root;
@@ -106,6 +107,13 @@ int init_apply_state(struct apply_state *state,
 	strbuf_init(&state->root, 0);
 
 	git_apply_config();
+	if (git_config_get_int("apply.threads", &state->threads) ||
+	    state->threads < 0)
+		state->threads = 1;
+	else if (!state->threads)
+		state->threads = online_cpus();
+	if (!HAVE_THREADS)
+		state->threads = 1;
 	if (apply_default_whitespace && parse_whitespace_option(state, apply_default_whitespace))
 		return -1;
 	if (apply_default_ignorewhitespace && parse_ignorewhitespace_option(state, apply_default_ignorewhitespace))
@@ -218,6 +226,20 @@ static void free_fragment_list(struct fragment *list)
 	}
 }
 
+struct apply_speculation {
+	char *preimage, *result;
+	size_t preimage_len, result_len;
+};
+
+static void free_speculation(struct patch *patch)
+{
+	if (!patch->speculation)
+		return;
+	free(patch->speculation->preimage);
+	free(patch->speculation->result);
+	FREE_AND_NULL(patch->speculation);
+}
+
 static void free_patch(struct patch *patch)
 {
 	free_fragment_list(patch->fragments);
@@ -225,6 +247,7 @@ static void free_patch(struct patch *patch)
 	free(patch->old_name);
 	free(patch->new_name);
 	free(patch->result);
+	free_speculation(patch);
 	free(patch);
 }
 
@@ -3021,6 +3044,10 @@ static int apply_one_fragment(struct apply_state *state,
 		    preimage.nr + applied_pos >= img->nr &&
 		    (ws_rule & WS_BLANK_AT_EOF) &&
 		    state->ws_error_action != nowarn_ws_error) {
+			if (state->speculative) {
+				applied_pos = -1;
+				goto out;
+			}
 			record_ws_error(state, WS_BLANK_AT_EOF, "+", 1,
 					found_new_blank_lines_at_end);
 			if (state->ws_error_action == correct_ws_error) {
@@ -3053,11 +3080,16 @@ static int apply_one_fragment(struct apply_state *state,
 		 * Warn if it was necessary to reduce the number
 		 * of context lines.
 		 */
-		if ((leading != frag->leading ||
-		     trailing != frag->trailing) && state->apply_verbosity > verbosity_silent)
-			fprintf_ln(stderr, _("Context reduced to (%ld/%ld)"
-					     " to apply fragment at %d"),
-				   leading, trailing, applied_pos+1);
+		if (leading != frag->leading || trailing != frag->trailing) {
+			if (state->speculative) {
+				applied_pos = -1;
+				goto out;
+			}
+			if (state->apply_verbosity > verbosity_silent)
+				fprintf_ln(stderr, _("Context reduced to (%ld/%ld)"
+						     " to apply fragment at %d"),
+					   leading, trailing, applied_pos+1);
+		}
 		update_image(state, img, applied_pos, &preimage, &postimage);
 	} else {
 		if (state->apply_verbosity > verbosity_normal)
@@ -3616,6 +3648,27 @@ static int try_threeway(struct apply_state *state,
 	return 0;
 }
 
+/*
+ * If the fragments of "patch" were applied ahead of time to exactly
+ * the preimage we have in "image", take that result.
+ */
+static int use_speculation(struct patch *patch, struct image *image)
+{
+	struct apply_speculation *s = patch->speculation;
+	int used = 0;
+
+	if (s && s->result && s->preimage_len == image->len &&
+	    !memcmp(s->preimage, image->buf, image->len)) {
+		clear_image(image);
+		image->buf = s->result;
+		image->len = s->result_len;
+		s->result = NULL;
+		used = 1;
+	}
+	free_speculation(patch);
+	return used;
+}
+
 static int apply_data(struct apply_state *state, struct patch *patch,
 		      struct stat *st, const struct cache_entry *ce)
 {
@@ -3625,7 +3678,8 @@ static int apply_data(struct apply_state *state, struct patch *patch,
 		return -1;
 
 	if (patch->direct_to_threeway ||
-	    apply_fragments(state, &image, patch) < 0) {
+	    (!use_speculation(patch, &image) &&
+	     apply_fragments(state, &image, patch) < 0)) {
 		/* Note: with --reject, apply_fragments() returns 0 */
 		if (!state->threeway || try_threeway(state, &image, patch, st, ce) < 0)
 			return -1;
@@ -3977,23 +4031,203 @@ static int check_patch(struct apply_state *state, struct patch *patch)
 	return 0;
 }
 
+/*
+ * With "apply.threads", the fragments of the next few patches are
+ * applied on worker threads before check_patch() gets to them. Only
+ * patches to a regular file that no other patch in the series
+ * touches, and that is read without any conversion, are tried, and
+ * only a result that needed nothing to be said about it is kept.
+ * apply_data() still makes sure that it loads the same preimage and
+ * otherwise applies the patch itself, so what is reported and in
+ * which order does not change.
+ */
+#define SPECULATION_WINDOW 256
+
+struct speculation_thread {
+	pthread_t pthread;
+	struct apply_state *state;
+	struct patch **patches;
+	int nr, offset, step;
+};
+
+static void speculate_one(struct apply_state *state, struct patch *patch)
+{
+	struct apply_speculation *s = patch->speculation;
+	struct fragment *frag;
+	struct image image;
+	int nth = 0;
+
+	prepare_image(&image, xmemdupz(s->preimage, s->preimage_len),
+		      s->preimage_len, 1);
+	for (frag = patch->fragments; frag; frag = frag->next) {
+		if (apply_one_fragment(state, &image, frag,
+				       patch->inaccurate_eof, patch->ws_rule,
+				       ++nth)) {
+			clear_image(&image);
+			return;
+		}
+	}
+	s->result = image.buf;
+	s->result_len = image.len;
+	free(image.line_allocated);
+}
+
+static void *speculate_thread(void *data)
+{
+	struct speculation_thread *t = data;
+	int i;
+
+	for (i = t->offset; i < t->nr; i += t->step)
+		speculate_one(t->state, t->patches[i]);
+	return NULL;
+}
+
+/* Paths that more than one patch in "list" touches. */
+static void find_shared_paths(struct patch *list, struct string_list *shared)
+{
+	struct string_list all = STRING_LIST_INIT_NODUP;
+	struct patch *patch;
+	int i;
+
+	for (patch = list; patch; patch = patch->next) {
+		if (patch->old_name)
+			string_list_append(&all, patch->old_name);
+		if (patch->new_name &&
+		    (!patch->old_name || strcmp(patch->old_name, patch->new_name)))
+			string_list_append(&all, patch->new_name);
+	}
+	string_list_sort(&all);
+	for (i = 1; i < all.nr; i++)
+		if (!strcmp(all.items[i - 1].string, all.items[i].string))
+			string_list_append(shared, all.items[i].string);
+	string_list_clear(&all, 0);
+}
+
+/*
+ * Read what load_preimage() will read for "patch", without saying
+ * anything; return -1 if the patch is not one to try.
+ */
+static int read_speculative_preimage(struct apply_state *state,
+				     struct patch *patch,
+				     const struct string_list *shared,
+				     struct strbuf *buf)
+{
+	const char *name = patch->old_name;
+	struct stat st;
+
+	if (!name || patch->is_new > 0 || patch->is_binary ||
+	    !patch->fragments || (patch->old_mode && !S_ISREG(patch->old_mode)) ||
+	    string_list_has_string(shared, name) ||
+	    (patch->new_name && string_list_has_string(shared, patch->new_name)))
+		return -1;
+
+	if (state->cached || state->check_index) {
+		int pos = index_name_pos(state->repo->index, name, strlen(name));
+		const struct cache_entry *ce;
+
+		if (pos < 0)
+			return -1;
+		ce = state->repo->index->cache[pos];
+		if (!S_ISREG(ce->ce_mode))
+			return -1;
+		return read_blob_object(buf, &ce->oid, ce->ce_mode);
+	}
+
+	if (lstat(name, &st) || !S_ISREG(st.st_mode) ||
+	    has_symlink_leading_path(name, strlen(name)) ||
+	    would_convert_to_git(NULL, name))
+		return -1;
+	if (strbuf_read_file(buf, name, st.st_size) != st.st_size)
+		return -1;
+	return 0;
+}
+
+/*
+ * Apply the fragments of the patches in a window starting at "patch"
+ * ahead of time, and return the first patch after the window.
+ */
+static struct patch *speculate_patches(struct apply_state *state,
+				       struct patch *patch,
+				       const struct string_list *shared)
+{
+	struct apply_state trial;
+	struct speculation_thread *threads;
+	struct patch **patches;
+	int i, nr = 0, nr_threads, ok;
+
+	ALLOC_ARRAY(patches, SPECULATION_WINDOW);
+	for (i = 0; patch && i < SPECULATION_WINDOW; i++, patch = patch->next) {
+		struct strbuf buf = STRBUF_INIT;
+
+		if (read_speculative_preimage(state, patch, shared, &buf)) {
+			strbuf_release(&buf);
+			continue;
+		}
+		patch->speculation = xcalloc(1, sizeof(*patch->speculation));
+		patch->speculation->preimage =
+			strbuf_detach(&buf, &patch->speculation->preimage_len);
+		patches[nr++] = patch;
+	}
+
+	trial = *state;
+	trial.speculative = 1;
+	nr_threads = state->threads < nr ? state->threads : nr;
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		struct speculation_thread *t = &threads[i];
+
+		t->state = &trial;
+		t->patches = patches;
+		t->nr = nr;
+		t->offset = i;
+		t->step = nr_threads;
+		if (pthread_create(&t->pthread, NULL, speculate_thread, t))
+			die(_("unable to create threaded apply"));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die(_("unable to join threaded apply"));
+	for (i = ok = 0; i < nr; i++)
+		if (patches[i]->speculation->result)
+			ok++;
+	trace2_data_intmax("apply", state->repo, "speculated", ok);
+
+	free(threads);
+	free(patches);
+	return patch;
+}
+
 static int check_patch_list(struct apply_state *state, struct patch *patch)
 {
+	struct string_list shared = STRING_LIST_INIT_NODUP;
+	struct patch *speculated_to = NULL;
 	int err = 0;
 
 	prepare_symlink_changes(state, patch);
 	prepare_fn_table(state, patch);
+	if (state->threads > 1 &&
+	    state->apply_verbosity <= verbosity_normal &&
+	    state->ws_error_action != correct_ws_error) {
+		find_shared_paths(patch, &shared);
+		speculated_to = patch;
+	}
 	while (patch) {
 		int res;
+		if (speculated_to && patch == speculated_to)
+			speculated_to = speculate_patches(state, patch, &shared);
 		if (state->apply_verbosity > verbosity_normal)
 			say_patch_name(stderr,
 				       _("Checking patch %s..."), patch);
 		res = check_patch(state, patch);
-		if (res == -128)
-			return -128;
+		free_speculation(patch);
+		if (res == -128) {
+			err = -128;
+			break;
+		}
 		err |= res;
 		patch = patch->next;
 	}
+	string_list_clear(&shared, 0);
 	return err;
 }
 
@@ -4690,7 +4924,8 @@ static int apply_patch(struct apply_state *state,
 		state->apply = 0;
 
 	state->update_index = (state->check_index || state->ita_only) && state->apply;
-	if (state->update_index && !is_lock_file_locked(&state->lock_file)) {
+	if (state->update_index && !state->index_in_core &&
+	    !is_lock_file_locked(&state->lock_file)) {
 		if (state->index_file)
 			hold_lock_file_for_update(&state->lock_file,
 						  state->index_file,
@@ -4910,7 +5145,7 @@ int apply_all_patches(struct apply_state *state,
 				state->whitespace_error);
 	}
 
-	if (state->update_index) {
+	if (state->update_index && !state->index_in_core) {
 		res = write_locked_index(state->repo->index, &state->lock_file, COMMIT_LOCK);
 		if (res) {
 			error(_("Unable to write new index file"));
@@ -4,6 +4,7 @@
 #include "lockfile.h"
 #include "string-list.h"
 
+struct apply_speculation;
 struct repository;
 
 enum apply_ws_error_action {
@@ -51,6 +52,7 @@ struct apply_state {
 	int check_index; /* preimage must match the indexed version */
 	int update_index; /* check_index && apply */
 	int ita_only;	  /* add intent-to-add entries to the index */
+	int index_in_core; /* leave writing the updated index to the caller */
 
 	/* These control cosmetic aspect of the output */
 	int diffstat; /* just show a diffstat, and don't actually apply */
@@ -77,6 +79,7 @@ struct apply_state {
 	int p_value;
 	int p_value_known;
 	unsigned int p_context;
+	int threads; /* apply fragments ahead of time on this many threads */
 
 	/* Exclude and include path parameters */
 	struct string_list limit_by_name;
@@ -115,6 +118,15 @@ struct apply_state {
 	int whitespace_error;
 	int squelch_whitespace_errors;
 	int applied_after_fixing_ws;
+
+	/*
+	 * Set on the private copy of the state that worker threads
+	 * apply fragments with ahead of time. Whatever would have to be
+	 * reported or recorded makes the fragment fail there instead,
+	 * so that the patch is applied again, in order, with the real
+	 * state.
+	 */
+	int speculative;
 };
 
 /*
@@ -149,6 +161,9 @@ struct patch {
 
 	/* three-way fallback result */
 	struct object_id threeway_stage[3];
+
+	/* fragments applied ahead of time, see "apply.threads" */
+	struct apply_speculation *speculation;
 };
 
 int apply_parse_options(int argc, const char **argv,
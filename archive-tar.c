@@ -20,6 +20,12 @@ static int tar_umask = 002;
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args);
 
+static void tar_write_block(const void *buf);
+static void (*write_block)(const void *) = tar_write_block;
+
+/* The filter command that selects our own, multi-threaded, gzip. */
+static const char internal_gzip_command[] = "git archive gzip";
+
 /*
  * This is the max value that a ustar size header can specify, as it is fixed
  * at 11 octal digits. POSIX specifies that we switch to extended headers at
@@ -38,11 +44,16 @@ static int write_tar_filter_archive(const struct archiver *ar,
 #define USTAR_MAX_MTIME 077777777777ULL
 #endif
 
+static void tar_write_block(const void *buf)
+{
+	write_or_die(1, buf, BLOCKSIZE);
+}
+
 /* writes out the whole block, but only if it is full */
 static void write_if_needed(void)
 {
 	if (offset == BLOCKSIZE) {
-		write_or_die(1, block, BLOCKSIZE);
+		write_block(block);
 		offset = 0;
 	}
 }
@@ -66,7 +77,7 @@ static void do_write_blocked(const void *data, unsigned long size)
 		write_if_needed();
 	}
 	while (size >= BLOCKSIZE) {
-		write_or_die(1, buf, BLOCKSIZE);
+		write_block(buf);
 		size -= BLOCKSIZE;
 		buf += BLOCKSIZE;
 	}
@@ -101,10 +112,10 @@ static void write_trailer(void)
 {
 	int tail = BLOCKSIZE - offset;
 	memset(block + offset, 0, tail);
-	write_or_die(1, block, BLOCKSIZE);
+	write_block(block);
 	if (tail < 2 * RECORDSIZE) {
 		memset(block, 0, offset);
-		write_or_die(1, block, BLOCKSIZE);
+		write_block(block);
 	}
 }
 
@@ -434,6 +445,113 @@ static int write_tar_archive(const struct archiver *ar,
 	return err;
 }
 
+/*
+ * Our own gzip cuts the tar stream into blocks and, like pigz,
+ * compresses them in parallel, each primed with the 32kB that precede
+ * it.  The result is a single gzip member, and does not depend on the
+ * number of threads.
+ */
+#define GZIP_BLOCK_SIZE (128 * 1024)
+#define GZIP_DICT_SIZE (32 * 1024)
+
+static struct archive_deflate_queue *gzip_queue;
+static unsigned char *gzip_buf;
+static unsigned long gzip_len, gzip_dict_len;
+static uint32_t gzip_crc, gzip_size;
+
+static void gzip_emit(struct archive_deflate_job *job, void *data)
+{
+	unsigned long size = job->len - job->dict_len;
+
+	if (job->failed)
+		die(_("unable to compress the archive"));
+	write_or_die(1, job->out, job->out_len);
+	gzip_crc = crc32_combine(gzip_crc, job->crc, size);
+	gzip_size += size;
+}
+
+static void gzip_queue_block(int flush)
+{
+	struct archive_deflate_job *job = xcalloc(1, sizeof(*job));
+	unsigned long dict_len = gzip_len;
+
+	if (dict_len > GZIP_DICT_SIZE)
+		dict_len = GZIP_DICT_SIZE;
+
+	job->in = gzip_buf;
+	job->len = gzip_len;
+	job->dict_len = gzip_dict_len;
+	job->flush = flush;
+
+	gzip_buf = xmalloc(GZIP_DICT_SIZE + GZIP_BLOCK_SIZE);
+	memcpy(gzip_buf, job->in + job->len - dict_len, dict_len);
+	gzip_len = gzip_dict_len = dict_len;
+
+	archive_deflate_add(gzip_queue, job);
+}
+
+static void tgz_write_block(const void *data)
+{
+	const unsigned char *buf = data;
+	unsigned long size = BLOCKSIZE;
+
+	while (size) {
+		unsigned long chunk = gzip_dict_len + GZIP_BLOCK_SIZE - gzip_len;
+
+		if (chunk > size)
+			chunk = size;
+		memcpy(gzip_buf + gzip_len, buf, chunk);
+		gzip_len += chunk;
+		buf += chunk;
+		size -= chunk;
+		if (gzip_len == gzip_dict_len + GZIP_BLOCK_SIZE)
+			gzip_queue_block(Z_SYNC_FLUSH);
+	}
+}
+
+static void put_le32(unsigned char *p, uint32_t n)
+{
+	p[0] = 0xff & n;
+	p[1] = 0xff & (n >> 8);
+	p[2] = 0xff & (n >> 16);
+	p[3] = 0xff & (n >> 24);
+}
+
+static int write_tar_gzip_archive(const struct archiver *ar,
+				  struct archiver_args *args)
+{
+	/* no file name and no time stamp, like "gzip -n"; made on Unix */
+	unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+	unsigned char trailer[8];
+	int r;
+
+	if (args->compression_level == 9)
+		header[8] = 2;
+	else if (args->compression_level == 1)
+		header[8] = 4;
+	write_or_die(1, header, sizeof(header));
+
+	gzip_queue = archive_deflate_start(args->compression_level,
+					   args->threads, gzip_emit, NULL);
+	gzip_buf = xmalloc(GZIP_DICT_SIZE + GZIP_BLOCK_SIZE);
+	gzip_len = gzip_dict_len = 0;
+	gzip_crc = crc32(0, NULL, 0);
+	gzip_size = 0;
+
+	write_block = tgz_write_block;
+	r = write_tar_archive(ar, args);
+	write_block = tar_write_block;
+
+	gzip_queue_block(Z_FINISH);
+	archive_deflate_finish(gzip_queue);
+	FREE_AND_NULL(gzip_buf);
+
+	put_le32(trailer, gzip_crc);
+	put_le32(trailer + 4, gzip_size);
+	write_or_die(1, trailer, sizeof(trailer));
+	return r;
+}
+
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args)
 {
@@ -445,6 +563,9 @@ static int write_tar_filter_archive(const struct archiver *ar,
 	if (!ar->data)
 		BUG("tar-filter archiver called with no filter defined");
 
+	if (!strcmp(ar->data, internal_gzip_command))
+		return write_tar_gzip_archive(ar, args);
+
 	strbuf_addstr(&cmd, ar->data);
 	if (args->compression_level >= 0)
 		strbuf_addf(&cmd, " -%d", args->compression_level);
@@ -483,9 +604,9 @@ void init_tar_archiver(void)
 	int i;
 	register_archiver(&tar_archiver);
 
-	tar_filter_config("tar.tgz.command", "gzip -cn", NULL);
+	tar_filter_config("tar.tgz.command", internal_gzip_command, NULL);
 	tar_filter_config("tar.tgz.remote", "true", NULL);
-	tar_filter_config("tar.tar.gz.command", "gzip -cn", NULL);
+	tar_filter_config("tar.tar.gz.command", internal_gzip_command, NULL);
 	tar_filter_config("tar.tar.gz.remote", "true", NULL);
 	git_config(git_tar_config, NULL);
 	for (i = 0; i < nr_tar_filters; i++) {
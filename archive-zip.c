@@ -21,6 +21,8 @@ static uint64_t zip_dir_entries;
 
 static unsigned int max_creator_version;
 
+static struct archive_deflate_queue *zip_queue;
+
 #define ZIP_STREAM	(1 <<  3)
 #define ZIP_UTF8	(1 << 11)
 
@@ -187,39 +189,6 @@ static uint32_t clamp32(uintmax_t n)
 	return (n < max) ? n : max;
 }
 
-static void *zlib_deflate_raw(void *data, unsigned long size,
-			      int compression_level,
-			      unsigned long *compressed_size)
-{
-	git_zstream stream;
-	unsigned long maxsize;
-	void *buffer;
-	int result;
-
-	git_deflate_init_raw(&stream, compression_level);
-	maxsize = git_deflate_bound(&stream, size);
-	buffer = xmalloc(maxsize);
-
-	stream.next_in = data;
-	stream.avail_in = size;
-	stream.next_out = buffer;
-	stream.avail_out = maxsize;
-
-	do {
-		result = git_deflate(&stream, Z_FINISH);
-	} while (result == Z_OK);
-
-	if (result != Z_STREAM_END) {
-		free(buffer);
-		return NULL;
-	}
-
-	git_deflate_end(&stream);
-	*compressed_size = stream.total_out;
-
-	return buffer;
-}
-
 static void write_zip_data_desc(unsigned long size,
 				unsigned long compressed_size,
 				unsigned long crc)
@@ -277,175 +246,180 @@ static int entry_is_binary(struct index_state *istate, const char *path,
 
 #define STREAM_BUFFER_SIZE (1024 * 16)
 
-static int write_zip_entry(struct archiver_args *args,
-			   const struct object_id *oid,
-			   const char *path, size_t pathlen,
-			   unsigned int mode)
-{
-	struct zip_local_header header;
-	uintmax_t offset = zip_offset;
-	struct zip_extra_mtime extra;
-	struct zip64_extra extra64;
-	size_t header_extra_size = ZIP_EXTRA_MTIME_SIZE;
-	int need_zip64_extra = 0;
+static struct zip_extra_mtime zip_extra_mtime;
+
+struct zip_entry {
+	unsigned long flags;
 	unsigned long attr2;
+	unsigned long size;
 	unsigned long compressed_size;
 	unsigned long crc;
 	int method;
-	unsigned char *out;
-	void *deflated = NULL;
-	void *buffer;
-	struct git_istream *stream = NULL;
-	unsigned long flags = 0;
-	unsigned long size;
-	int is_binary = -1;
-	const char *path_without_prefix = path + args->baselen;
-	unsigned int creator_version = 0;
-	unsigned int version_needed = 10;
-	size_t zip_dir_extra_size = ZIP_EXTRA_MTIME_SIZE;
-	size_t zip64_dir_extra_payload_size = 0;
-
-	crc = crc32(0, NULL, 0);
-
-	if (!has_only_ascii(path)) {
-		if (is_utf8(path))
-			flags |= ZIP_UTF8;
-		else
-			warning(_("path is not valid UTF-8: %s"), path);
-	}
-
-	if (pathlen > 0xffff) {
-		return error(_("path too long (%d chars, SHA1: %s): %s"),
-				(int)pathlen, oid_to_hex(oid), path);
-	}
-
-	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
-		method = 0;
-		attr2 = 16;
-		out = NULL;
-		size = 0;
-		compressed_size = 0;
-		buffer = NULL;
-	} else if (S_ISREG(mode) || S_ISLNK(mode)) {
-		enum object_type type = oid_object_info(args->repo, oid,
-							&size);
-
-		method = 0;
-		attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
-			(mode & 0111) ? ((mode) << 16) : 0;
-		if (S_ISLNK(mode) || (mode & 0111))
-			creator_version = 0x0317;
-		if (S_ISREG(mode) && args->compression_level != 0 && size > 0)
-			method = 8;
-
-		if (S_ISREG(mode) && type == OBJ_BLOB && !args->convert &&
-		    size > big_file_threshold) {
-			stream = open_istream(oid, &type, &size, NULL);
-			if (!stream)
-				return error(_("cannot stream blob %s"),
-					     oid_to_hex(oid));
-			flags |= ZIP_STREAM;
-			out = buffer = NULL;
-		} else {
-			buffer = object_file_to_archive(args, path, oid, mode,
-							&type, &size);
-			if (!buffer)
-				return error(_("cannot read %s"),
-					     oid_to_hex(oid));
-			crc = crc32(crc, buffer, size);
-			is_binary = entry_is_binary(args->repo->index,
-						    path_without_prefix,
-						    buffer, size);
-			out = buffer;
-		}
-		compressed_size = (method == 0) ? size : 0;
-	} else {
-		return error(_("unsupported file mode: 0%o (SHA1: %s)"), mode,
-				oid_to_hex(oid));
-	}
-
-	if (creator_version > max_creator_version)
-		max_creator_version = creator_version;
-
-	if (buffer && method == 8) {
-		out = deflated = zlib_deflate_raw(buffer, size,
-						  args->compression_level,
-						  &compressed_size);
-		if (!out || compressed_size >= size) {
-			out = buffer;
-			method = 0;
-			compressed_size = size;
-		}
-	}
+	int is_binary;
+	int need_zip64_extra;
+	unsigned int creator_version;
+	unsigned int version_needed;
+	size_t pathlen;
+	char path[FLEX_ARRAY];
+};
 
-	copy_le16(extra.magic, 0x5455);
-	copy_le16(extra.extra_size, ZIP_EXTRA_MTIME_PAYLOAD_SIZE);
-	extra.flags[0] = 1;	/* just mtime */
-	copy_le32(extra.mtime, args->time);
+static void write_zip_header(struct zip_entry *e, int streamed)
+{
+	struct zip_local_header header;
+	struct zip64_extra extra64;
+	size_t header_extra_size = ZIP_EXTRA_MTIME_SIZE;
 
-	if (size > 0xffffffff || compressed_size > 0xffffffff)
-		need_zip64_extra = 1;
-	if (stream && size > 0x7fffffff)
-		need_zip64_extra = 1;
+	if (e->size > 0xffffffff || e->compressed_size > 0xffffffff)
+		e->need_zip64_extra = 1;
+	if (streamed && e->size > 0x7fffffff)
+		e->need_zip64_extra = 1;
 
-	if (need_zip64_extra)
-		version_needed = 45;
+	if (e->need_zip64_extra)
+		e->version_needed = 45;
 
 	copy_le32(header.magic, 0x04034b50);
-	copy_le16(header.version, version_needed);
-	copy_le16(header.flags, flags);
-	copy_le16(header.compression_method, method);
+	copy_le16(header.version, e->version_needed);
+	copy_le16(header.flags, e->flags);
+	copy_le16(header.compression_method, e->method);
 	copy_le16(header.mtime, zip_time);
 	copy_le16(header.mdate, zip_date);
-	if (need_zip64_extra) {
-		set_zip_header_data_desc(&header, 0xffffffff, 0xffffffff, crc);
+	if (e->need_zip64_extra) {
+		set_zip_header_data_desc(&header, 0xffffffff, 0xffffffff,
+					 e->crc);
 		header_extra_size += ZIP64_EXTRA_SIZE;
 	} else {
-		set_zip_header_data_desc(&header, size, compressed_size, crc);
+		set_zip_header_data_desc(&header, e->size, e->compressed_size,
+					 e->crc);
 	}
-	copy_le16(header.filename_length, pathlen);
+	copy_le16(header.filename_length, e->pathlen);
 	copy_le16(header.extra_length, header_extra_size);
 	write_or_die(1, &header, ZIP_LOCAL_HEADER_SIZE);
 	zip_offset += ZIP_LOCAL_HEADER_SIZE;
-	write_or_die(1, path, pathlen);
-	zip_offset += pathlen;
-	write_or_die(1, &extra, ZIP_EXTRA_MTIME_SIZE);
+	write_or_die(1, e->path, e->pathlen);
+	zip_offset += e->pathlen;
+	write_or_die(1, &zip_extra_mtime, ZIP_EXTRA_MTIME_SIZE);
 	zip_offset += ZIP_EXTRA_MTIME_SIZE;
-	if (need_zip64_extra) {
+	if (e->need_zip64_extra) {
 		copy_le16(extra64.magic, 0x0001);
 		copy_le16(extra64.extra_size, ZIP64_EXTRA_PAYLOAD_SIZE);
-		copy_le64(extra64.size, size);
-		copy_le64(extra64.compressed_size, compressed_size);
+		copy_le64(extra64.size, e->size);
+		copy_le64(extra64.compressed_size, e->compressed_size);
 		write_or_die(1, &extra64, ZIP64_EXTRA_SIZE);
 		zip_offset += ZIP64_EXTRA_SIZE;
 	}
+}
+
+static void add_zip_dir_entry(const struct zip_entry *e, uintmax_t offset)
+{
+	size_t zip_dir_extra_size = ZIP_EXTRA_MTIME_SIZE;
+	size_t zip64_dir_extra_payload_size = 0;
+
+	if (e->compressed_size > 0xffffffff || e->size > 0xffffffff ||
+	    offset > 0xffffffff) {
+		if (e->compressed_size >= 0xffffffff)
+			zip64_dir_extra_payload_size += 8;
+		if (e->size >= 0xffffffff)
+			zip64_dir_extra_payload_size += 8;
+		if (offset >= 0xffffffff)
+			zip64_dir_extra_payload_size += 8;
+		zip_dir_extra_size += 2 + 2 + zip64_dir_extra_payload_size;
+	}
+
+	strbuf_add_le(&zip_dir, 4, 0x02014b50);	/* magic */
+	strbuf_add_le(&zip_dir, 2, e->creator_version);
+	strbuf_add_le(&zip_dir, 2, e->version_needed);
+	strbuf_add_le(&zip_dir, 2, e->flags);
+	strbuf_add_le(&zip_dir, 2, e->method);
+	strbuf_add_le(&zip_dir, 2, zip_time);
+	strbuf_add_le(&zip_dir, 2, zip_date);
+	strbuf_add_le(&zip_dir, 4, e->crc);
+	strbuf_add_le(&zip_dir, 4, clamp32(e->compressed_size));
+	strbuf_add_le(&zip_dir, 4, clamp32(e->size));
+	strbuf_add_le(&zip_dir, 2, e->pathlen);
+	strbuf_add_le(&zip_dir, 2, zip_dir_extra_size);
+	strbuf_add_le(&zip_dir, 2, 0);		/* comment length */
+	strbuf_add_le(&zip_dir, 2, 0);		/* disk */
+	strbuf_add_le(&zip_dir, 2, !e->is_binary);
+	strbuf_add_le(&zip_dir, 4, e->attr2);
+	strbuf_add_le(&zip_dir, 4, clamp32(offset));
+	strbuf_add(&zip_dir, e->path, e->pathlen);
+	strbuf_add(&zip_dir, &zip_extra_mtime, ZIP_EXTRA_MTIME_SIZE);
+	if (zip64_dir_extra_payload_size) {
+		strbuf_add_le(&zip_dir, 2, 0x0001);	/* magic */
+		strbuf_add_le(&zip_dir, 2, zip64_dir_extra_payload_size);
+		if (e->size >= 0xffffffff)
+			strbuf_add_le(&zip_dir, 8, e->size);
+		if (e->compressed_size >= 0xffffffff)
+			strbuf_add_le(&zip_dir, 8, e->compressed_size);
+		if (offset >= 0xffffffff)
+			strbuf_add_le(&zip_dir, 8, offset);
+	}
+	zip_dir_entries++;
+}
 
-	if (stream && method == 0) {
-		unsigned char buf[STREAM_BUFFER_SIZE];
-		ssize_t readlen;
+/*
+ * Called, in order, for the entries that were read into memory, once
+ * the deflate queue has compressed them.
+ */
+static void write_zip_entry_data(struct archive_deflate_job *job, void *data)
+{
+	struct zip_entry *e = job->data;
+	const unsigned char *out = job->in;
+	uintmax_t offset = zip_offset;
 
+	e->crc = job->crc;
+	e->compressed_size = e->size;
+	if (e->method == 8) {
+		if (!job->failed && job->out_len < e->size) {
+			out = job->out;
+			e->compressed_size = job->out_len;
+		} else {
+			e->method = 0;
+		}
+	}
+
+	write_zip_header(e, 0);
+	if (e->compressed_size > 0) {
+		write_or_die(1, out, e->compressed_size);
+		zip_offset += e->compressed_size;
+	}
+	add_zip_dir_entry(e, offset);
+	free(e);
+}
+
+static int write_zip_stream(struct archiver_args *args,
+			    struct zip_entry *e, struct git_istream *stream)
+{
+	const char *path_without_prefix = e->path + args->baselen;
+	uintmax_t offset = zip_offset;
+	unsigned char buf[STREAM_BUFFER_SIZE];
+	ssize_t readlen;
+
+	e->crc = crc32(0, NULL, 0);
+	e->compressed_size = (e->method == 0) ? e->size : 0;
+	write_zip_header(e, 1);
+
+	if (e->method == 0) {
 		for (;;) {
 			readlen = read_istream(stream, buf, sizeof(buf));
 			if (readlen <= 0)
 				break;
-			crc = crc32(crc, buf, readlen);
-			if (is_binary == -1)
-				is_binary = entry_is_binary(args->repo->index,
-							    path_without_prefix,
-							    buf, readlen);
+			e->crc = crc32(e->crc, buf, readlen);
+			if (e->is_binary == -1)
+				e->is_binary = entry_is_binary(args->repo->index,
+							       path_without_prefix,
+							       buf, readlen);
 			write_or_die(1, buf, readlen);
 		}
 		close_istream(stream);
 		if (readlen)
 			return readlen;
 
-		compressed_size = size;
-		zip_offset += compressed_size;
+		e->compressed_size = e->size;
+		zip_offset += e->compressed_size;
 
-		write_zip_data_desc(size, compressed_size, crc);
-	} else if (stream && method == 8) {
-		unsigned char buf[STREAM_BUFFER_SIZE];
-		ssize_t readlen;
+		write_zip_data_desc(e->size, e->compressed_size, e->crc);
+	} else {
 		git_zstream zstream;
 		int result;
 		size_t out_len;
@@ -453,7 +427,7 @@ static int write_zip_entry(struct archiver_args *args,
 
 		git_deflate_init_raw(&zstream, args->compression_level);
 
-		compressed_size = 0;
+		e->compressed_size = 0;
 		zstream.next_out = compressed;
 		zstream.avail_out = sizeof(compressed);
 
@@ -461,11 +435,11 @@ static int write_zip_entry(struct archiver_args *args,
 			readlen = read_istream(stream, buf, sizeof(buf));
 			if (readlen <= 0)
 				break;
-			crc = crc32(crc, buf, readlen);
-			if (is_binary == -1)
-				is_binary = entry_is_binary(args->repo->index,
-							    path_without_prefix,
-							    buf, readlen);
+			e->crc = crc32(e->crc, buf, readlen);
+			if (e->is_binary == -1)
+				e->is_binary = entry_is_binary(args->repo->index,
+							       path_without_prefix,
+							       buf, readlen);
 
 			zstream.next_in = buf;
 			zstream.avail_in = readlen;
@@ -476,7 +450,7 @@ static int write_zip_entry(struct archiver_args *args,
 
 			if (out_len > 0) {
 				write_or_die(1, compressed, out_len);
-				compressed_size += out_len;
+				e->compressed_size += out_len;
 				zstream.next_out = compressed;
 				zstream.avail_out = sizeof(compressed);
 			}
@@ -495,61 +469,114 @@ static int write_zip_entry(struct archiver_args *args,
 		git_deflate_end(&zstream);
 		out_len = zstream.next_out - compressed;
 		write_or_die(1, compressed, out_len);
-		compressed_size += out_len;
-		zip_offset += compressed_size;
+		e->compressed_size += out_len;
+		zip_offset += e->compressed_size;
 
-		write_zip_data_desc(size, compressed_size, crc);
-	} else if (compressed_size > 0) {
-		write_or_die(1, out, compressed_size);
-		zip_offset += compressed_size;
+		write_zip_data_desc(e->size, e->compressed_size, e->crc);
 	}
 
-	free(deflated);
-	free(buffer);
+	add_zip_dir_entry(e, offset);
+	return 0;
+}
 
-	if (compressed_size > 0xffffffff || size > 0xffffffff ||
-	    offset > 0xffffffff) {
-		if (compressed_size >= 0xffffffff)
-			zip64_dir_extra_payload_size += 8;
-		if (size >= 0xffffffff)
-			zip64_dir_extra_payload_size += 8;
-		if (offset >= 0xffffffff)
-			zip64_dir_extra_payload_size += 8;
-		zip_dir_extra_size += 2 + 2 + zip64_dir_extra_payload_size;
+static int write_zip_entry(struct archiver_args *args,
+			   const struct object_id *oid,
+			   const char *path, size_t pathlen,
+			   unsigned int mode)
+{
+	struct zip_entry *e;
+	struct archive_deflate_job *job;
+	unsigned long attr2;
+	int method;
+	void *buffer;
+	struct git_istream *stream = NULL;
+	unsigned long flags = 0;
+	unsigned long size;
+	int is_binary = -1;
+	const char *path_without_prefix = path + args->baselen;
+	unsigned int creator_version = 0;
+	int err;
+
+	if (!has_only_ascii(path)) {
+		if (is_utf8(path))
+			flags |= ZIP_UTF8;
+		else
+			warning(_("path is not valid UTF-8: %s"), path);
 	}
 
-	strbuf_add_le(&zip_dir, 4, 0x02014b50);	/* magic */
-	strbuf_add_le(&zip_dir, 2, creator_version);
-	strbuf_add_le(&zip_dir, 2, version_needed);
-	strbuf_add_le(&zip_dir, 2, flags);
-	strbuf_add_le(&zip_dir, 2, method);
-	strbuf_add_le(&zip_dir, 2, zip_time);
-	strbuf_add_le(&zip_dir, 2, zip_date);
-	strbuf_add_le(&zip_dir, 4, crc);
-	strbuf_add_le(&zip_dir, 4, clamp32(compressed_size));
-	strbuf_add_le(&zip_dir, 4, clamp32(size));
-	strbuf_add_le(&zip_dir, 2, pathlen);
-	strbuf_add_le(&zip_dir, 2, zip_dir_extra_size);
-	strbuf_add_le(&zip_dir, 2, 0);		/* comment length */
-	strbuf_add_le(&zip_dir, 2, 0);		/* disk */
-	strbuf_add_le(&zip_dir, 2, !is_binary);
-	strbuf_add_le(&zip_dir, 4, attr2);
-	strbuf_add_le(&zip_dir, 4, clamp32(offset));
-	strbuf_add(&zip_dir, path, pathlen);
-	strbuf_add(&zip_dir, &extra, ZIP_EXTRA_MTIME_SIZE);
-	if (zip64_dir_extra_payload_size) {
-		strbuf_add_le(&zip_dir, 2, 0x0001);	/* magic */
-		strbuf_add_le(&zip_dir, 2, zip64_dir_extra_payload_size);
-		if (size >= 0xffffffff)
-			strbuf_add_le(&zip_dir, 8, size);
-		if (compressed_size >= 0xffffffff)
-			strbuf_add_le(&zip_dir, 8, compressed_size);
-		if (offset >= 0xffffffff)
-			strbuf_add_le(&zip_dir, 8, offset);
+	if (pathlen > 0xffff) {
+		return error(_("path too long (%d chars, SHA1: %s): %s"),
+				(int)pathlen, oid_to_hex(oid), path);
 	}
-	zip_dir_entries++;
 
-	return 0;
+	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
+		method = 0;
+		attr2 = 16;
+		size = 0;
+		buffer = NULL;
+	} else if (S_ISREG(mode) || S_ISLNK(mode)) {
+		enum object_type type = oid_object_info(args->repo, oid,
+							&size);
+
+		method = 0;
+		attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
+			(mode & 0111) ? ((mode) << 16) : 0;
+		if (S_ISLNK(mode) || (mode & 0111))
+			creator_version = 0x0317;
+		if (S_ISREG(mode) && args->compression_level != 0 && size > 0)
+			method = 8;
+
+		if (S_ISREG(mode) && type == OBJ_BLOB && !args->convert &&
+		    size > big_file_threshold) {
+			stream = open_istream(oid, &type, &size, NULL);
+			if (!stream)
+				return error(_("cannot stream blob %s"),
+					     oid_to_hex(oid));
+			flags |= ZIP_STREAM;
+			buffer = NULL;
+		} else {
+			buffer = object_file_to_archive(args, path, oid, mode,
+							&type, &size);
+			if (!buffer)
+				return error(_("cannot read %s"),
+					     oid_to_hex(oid));
+			is_binary = entry_is_binary(args->repo->index,
+						    path_without_prefix,
+						    buffer, size);
+		}
+	} else {
+		return error(_("unsupported file mode: 0%o (SHA1: %s)"), mode,
+				oid_to_hex(oid));
+	}
+
+	if (creator_version > max_creator_version)
+		max_creator_version = creator_version;
+
+	FLEX_ALLOC_MEM(e, path, path, pathlen);
+	e->pathlen = pathlen;
+	e->flags = flags;
+	e->attr2 = attr2;
+	e->method = method;
+	e->size = size;
+	e->is_binary = is_binary;
+	e->creator_version = creator_version;
+	e->version_needed = 10;
+
+	if (!stream) {
+		job = xcalloc(1, sizeof(*job));
+		job->in = buffer;
+		job->len = size;
+		job->flush = (method == 8) ? Z_FINISH : 0;
+		job->data = e;
+		archive_deflate_add(zip_queue, job);
+		return 0;
+	}
+
+	/* the entries still being compressed come first */
+	archive_deflate_flush(zip_queue);
+	err = write_zip_stream(args, e, stream);
+	free(e);
+	return err;
 }
 
 static void write_zip64_trailer(void)
@@ -631,9 +658,18 @@ static int write_zip_archive(const struct archiver *ar,
 
 	dos_time(&args->time, &zip_date, &zip_time);
 
+	copy_le16(zip_extra_mtime.magic, 0x5455);
+	copy_le16(zip_extra_mtime.extra_size, ZIP_EXTRA_MTIME_PAYLOAD_SIZE);
+	zip_extra_mtime.flags[0] = 1;	/* just mtime */
+	copy_le32(zip_extra_mtime.mtime, args->time);
+
 	strbuf_init(&zip_dir, 0);
 
+	zip_queue = archive_deflate_start(args->compression_level,
+					  args->threads,
+					  write_zip_entry_data, NULL);
 	err = write_archive_entries(args, write_zip_entry);
+	archive_deflate_finish(zip_queue);
 	if (!err)
 		write_zip_trailer(args->commit_oid);
 
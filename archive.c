@@ -9,6 +9,7 @@
 #include "parse-options.h"
 #include "unpack-trees.h"
 #include "dir.h"
+#include "thread-utils.h"
 
 static char const * const archive_usage[] = {
 	N_("git archive [<options>] <tree-ish> [<path>...]"),
@@ -22,6 +23,7 @@ static const struct archiver **archivers;
 static int nr_archivers;
 static int alloc_archivers;
 static int remote_allow_unreachable;
+static int archive_threads;
 
 void register_archiver(struct archiver *ar)
 {
@@ -95,6 +97,224 @@ void *object_file_to_archive(const struct archiver_args *args,
 	return buffer;
 }
 
+/*
+ * Keep at most this many bytes of input in the deflate queue, on top of
+ * the one job every thread may be working on.
+ */
+#define ARCHIVE_DEFLATE_QUEUED_MAX (32 * 1024 * 1024)
+
+struct archive_deflate_queue {
+	int level;
+	archive_deflate_emit_fn emit;
+	void *emit_data;
+
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_work;	/* a job was added, or we are done */
+	pthread_cond_t cond_done;	/* a worker finished a job */
+
+	/*
+	 * A ring of jobs: those in [first, next) are taken by a worker or
+	 * done and wait to be emitted, those in [next, end) wait for a
+	 * worker.
+	 */
+	struct archive_deflate_job **jobs;
+	unsigned long nr_slots, first, next, end;
+	unsigned long queued;
+	int stopping;
+};
+
+static void deflate_job(struct archive_deflate_job *job, int level)
+{
+	unsigned char *data = job->in + job->dict_len;
+	unsigned long size = job->len - job->dict_len;
+	unsigned long maxsize;
+	git_zstream stream;
+	int result;
+
+	job->crc = crc32(crc32(0, NULL, 0), data, size);
+	if (!job->flush)
+		return;
+
+	git_deflate_init_raw(&stream, level);
+	if (job->dict_len &&
+	    deflateSetDictionary(&stream.z, job->in, job->dict_len) != Z_OK) {
+		job->failed = 1;
+		git_deflate_abort(&stream);
+		return;
+	}
+	/* a sync flush ends with an empty stored block */
+	maxsize = git_deflate_bound(&stream, size) + 8;
+	job->out = xmalloc(maxsize);
+
+	stream.next_in = data;
+	stream.avail_in = size;
+	stream.next_out = job->out;
+	stream.avail_out = maxsize;
+
+	for (;;) {
+		result = git_deflate(&stream, job->flush);
+		if (result == Z_STREAM_END ||
+		    (job->flush != Z_FINISH && result == Z_OK &&
+		     !stream.avail_in && stream.avail_out))
+			break;
+		if (result != Z_OK && result != Z_BUF_ERROR) {
+			job->failed = 1;
+			break;
+		}
+		maxsize = alloc_nr(maxsize);
+		job->out = xrealloc(job->out, maxsize);
+		stream.next_out = job->out + stream.total_out;
+		stream.avail_out = maxsize - stream.total_out;
+	}
+	job->out_len = stream.total_out;
+	/* deflateEnd() complains about a stream that was only flushed */
+	git_deflate_abort(&stream);
+}
+
+static void *deflate_worker(void *data)
+{
+	struct archive_deflate_queue *queue = data;
+
+	pthread_mutex_lock(&queue->mutex);
+	for (;;) {
+		struct archive_deflate_job *job;
+
+		while (!queue->stopping && queue->next == queue->end)
+			pthread_cond_wait(&queue->cond_work, &queue->mutex);
+		if (queue->next == queue->end)
+			break;
+		job = queue->jobs[queue->next++ % queue->nr_slots];
+
+		pthread_mutex_unlock(&queue->mutex);
+		deflate_job(job, queue->level);
+		pthread_mutex_lock(&queue->mutex);
+
+		job->done = 1;
+		pthread_cond_signal(&queue->cond_done);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	return NULL;
+}
+
+struct archive_deflate_queue *archive_deflate_start(int level, int nr_threads,
+						    archive_deflate_emit_fn emit,
+						    void *emit_data)
+{
+	struct archive_deflate_queue *queue = xcalloc(1, sizeof(*queue));
+	int i;
+
+	queue->level = level;
+	queue->emit = emit;
+	queue->emit_data = emit_data;
+	if (!HAVE_THREADS || nr_threads <= 1)
+		return queue;
+
+	queue->nr_slots = 2 * nr_threads;
+	ALLOC_ARRAY(queue->jobs, queue->nr_slots);
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond_work, NULL);
+	pthread_cond_init(&queue->cond_done, NULL);
+
+	ALLOC_ARRAY(queue->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&queue->threads[i], NULL,
+					 deflate_worker, queue);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+		queue->nr_threads++;
+	}
+	return queue;
+}
+
+static void emit_deflate_job(struct archive_deflate_queue *queue,
+			     struct archive_deflate_job *job)
+{
+	queue->emit(job, queue->emit_data);
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/*
+ * Emit the oldest job, waiting for it to be compressed. Called, and
+ * returns, with the mutex held.
+ */
+static void emit_first_job(struct archive_deflate_queue *queue)
+{
+	struct archive_deflate_job *job;
+
+	job = queue->jobs[queue->first % queue->nr_slots];
+	while (!job->done)
+		pthread_cond_wait(&queue->cond_done, &queue->mutex);
+	queue->first++;
+	queue->queued -= job->len;
+
+	pthread_mutex_unlock(&queue->mutex);
+	emit_deflate_job(queue, job);
+	pthread_mutex_lock(&queue->mutex);
+}
+
+void archive_deflate_add(struct archive_deflate_queue *queue,
+			 struct archive_deflate_job *job)
+{
+	if (!queue->nr_threads) {
+		deflate_job(job, queue->level);
+		emit_deflate_job(queue, job);
+		return;
+	}
+
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->end - queue->first == queue->nr_slots ||
+	       queue->queued > ARCHIVE_DEFLATE_QUEUED_MAX)
+		emit_first_job(queue);
+	queue->jobs[queue->end++ % queue->nr_slots] = job;
+	queue->queued += job->len;
+	pthread_cond_signal(&queue->cond_work);
+
+	/* keep the output flowing */
+	while (queue->first != queue->next &&
+	       queue->jobs[queue->first % queue->nr_slots]->done)
+		emit_first_job(queue);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void archive_deflate_flush(struct archive_deflate_queue *queue)
+{
+	if (!queue->nr_threads)
+		return;
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->first != queue->end)
+		emit_first_job(queue);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void archive_deflate_finish(struct archive_deflate_queue *queue)
+{
+	int i;
+
+	if (!queue->nr_threads) {
+		free(queue);
+		return;
+	}
+
+	archive_deflate_flush(queue);
+	pthread_mutex_lock(&queue->mutex);
+	queue->stopping = 1;
+	pthread_cond_broadcast(&queue->cond_work);
+	pthread_mutex_unlock(&queue->mutex);
+	for (i = 0; i < queue->nr_threads; i++)
+		pthread_join(queue->threads[i], NULL);
+
+	pthread_cond_destroy(&queue->cond_done);
+	pthread_cond_destroy(&queue->cond_work);
+	pthread_mutex_destroy(&queue->mutex);
+	free(queue->threads);
+	free(queue->jobs);
+	free(queue);
+}
+
 struct directory {
 	struct directory *up;
 	struct object_id oid;
@@ -539,10 +759,14 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	struct archiver_args args;
 
 	git_config_get_bool("uploadarchive.allowunreachable", &remote_allow_unreachable);
+	if (!git_config_get_int("archive.threads", &archive_threads) &&
+	    !HAVE_THREADS && archive_threads != 1)
+		warning(_("no threads support, ignoring %s"), "archive.threads");
 	git_config(git_default_config, NULL);
 
 	args.repo = repo;
 	argc = parse_archive_args(argc, argv, &ar, &args, name_hint, remote);
+	args.threads = archive_threads > 0 ? archive_threads : online_cpus();
 	if (!startup_info->have_repository) {
 		/*
 		 * We know this will die() with an error, so we could just
@@ -19,6 +19,7 @@ struct archiver_args {
 	unsigned int worktree_attributes : 1;
 	unsigned int convert : 1;
 	int compression_level;
+	int threads;
 };
 
 /* main api */
@@ -56,4 +57,46 @@ void *object_file_to_archive(const struct archiver_args *args,
 			     unsigned int mode, enum object_type *type,
 			     unsigned long *sizep);
 
+/*
+ * The deflate queue compresses its jobs as raw deflate streams on up to
+ * "threads" worker threads, and hands them, in the order they were
+ * added, to the emit callback, which runs in the thread that adds jobs.
+ */
+struct archive_deflate_job {
+	/* Set by the caller; "in" is freed once the job is emitted. */
+	unsigned char *in;
+	unsigned long len;
+	/* The first dict_len bytes of "in" only prime the compressor. */
+	unsigned long dict_len;
+	/*
+	 * Z_FINISH ends the stream, Z_SYNC_FLUSH leaves it open for the
+	 * next job; with 0 the job is not compressed at all but keeps
+	 * its place in the order.
+	 */
+	int flush;
+	void *data;
+
+	/* Set by the queue. */
+	unsigned char *out;
+	unsigned long out_len;
+	uint32_t crc;		/* of the part of "in" after the dictionary */
+	unsigned failed : 1;
+	unsigned done : 1;
+};
+
+struct archive_deflate_queue;
+typedef void (*archive_deflate_emit_fn)(struct archive_deflate_job *job,
+					void *data);
+
+struct archive_deflate_queue *archive_deflate_start(int level, int threads,
+						    archive_deflate_emit_fn emit,
+						    void *emit_data);
+/* Take ownership of the job, which must be allocated with xcalloc(). */
+void archive_deflate_add(struct archive_deflate_queue *queue,
+			 struct archive_deflate_job *job);
+/* Emit all jobs added so far. */
+void archive_deflate_flush(struct archive_deflate_queue *queue);
+/* Emit all jobs, and free the queue. */
+void archive_deflate_finish(struct archive_deflate_queue *queue);
+
 #endif	/* ARCHIVE_H */
@@ -887,13 +887,31 @@ static void bootstrap_attr_stack(const struct index_state *istate,
 	push_stack(stack, e, NULL, 0);
 }
 
-static void prepare_attr_stack(const struct index_state *istate,
-			       const char *path, int dirlen,
-			       struct attr_stack **stack)
+/*
+ * Make *stack the attribute stack for the directory of 'path', the
+ * first 'dirlen' bytes of it. Returns 1 if the stack had to be changed,
+ * and 0 if it already was the one of that directory.
+ */
+static int prepare_attr_stack(const struct index_state *istate,
+			      const char *path, int dirlen,
+			      struct attr_stack **stack)
 {
 	struct attr_stack *info;
 	struct strbuf pathbuf = STRBUF_INIT;
 
+	/*
+	 * Checking the paths of one directory after another is the
+	 * common case. Every directory has its frame, just below the
+	 * "info" one, even without a .gitattributes file.
+	 */
+	if (*stack && (*stack)->prev && (*stack)->prev->origin) {
+		const struct attr_stack *dir = (*stack)->prev;
+
+		if (dir->originlen == dirlen &&
+		    !strncmp(dir->origin, path, dirlen))
+			return 0;
+	}
+
 	/*
 	 * At the bottom of the attribute stack is the built-in
 	 * set of attribute definitions, followed by the contents
@@ -980,6 +998,7 @@ static void prepare_attr_stack(const struct index_state *istate,
 	push_stack(stack, info, NULL, 0);
 
 	strbuf_release(&pathbuf);
+	return 1;
 }
 
 static int path_matches(const char *pathname, int pathlen,
@@ -1082,6 +1101,16 @@ static void determine_macros(struct all_attrs_item *all_attrs,
 	}
 }
 
+static int check_has_new_attrs(const struct attr_check *check)
+{
+	int i;
+
+	for (i = 0; i < check->nr; i++)
+		if (check->items[i].attr->attr_nr >= check->all_attrs_nr)
+			return 1;
+	return 0;
+}
+
 /*
  * Collect attributes for path into the array pointed to by check->all_attrs.
  * If check->check_nr is non-zero, only attributes in check[] are collected.
@@ -1108,9 +1137,23 @@ static void collect_some_attrs(const struct index_state *istate,
 		dirlen = 0;
 	}
 
-	prepare_attr_stack(istate, path, dirlen, &check->stack);
-	all_attrs_init(&g_attr_hashmap, check);
-	determine_macros(check->all_attrs, check->stack);
+	/*
+	 * All the attributes the rules of the stack and the items of
+	 * the check refer to were interned before we last sized
+	 * check->all_attrs, unless either has changed since. Only then
+	 * do we need to look at the dictionary, under its lock, and to
+	 * find the macros of the stack again.
+	 */
+	if (prepare_attr_stack(istate, path, dirlen, &check->stack) ||
+	    check_has_new_attrs(check)) {
+		all_attrs_init(&g_attr_hashmap, check);
+		determine_macros(check->all_attrs, check->stack);
+	} else {
+		int i;
+
+		for (i = 0; i < check->all_attrs_nr; i++)
+			check->all_attrs[i].value = ATTR__UNKNOWN;
+	}
 
 	rem = check->all_attrs_nr;
 	fill(path, pathlen, basename_offset, check->stack, check->all_attrs, rem);
@@ -15,6 +15,8 @@
 #include "commit-slab.h"
 #include "commit-reach.h"
 #include "object-store.h"
+#include "commit-graph.h"
+#include "prio-queue.h"
 
 static struct oid_array good_revs;
 static struct oid_array skipped_revs;
@@ -29,6 +31,8 @@ static const char *term_good;
 
 /* Remember to update object flag allocation in object.h */
 #define COUNTED		(1u<<16)
+#define REACH_FIRST	(1u<<17)
+#define REACH_OTHER	(1u<<18)
 
 /*
  * This is a truly stupid algorithm, but it's only
@@ -76,6 +80,9 @@ static void clear_distance(struct commit_list *list)
 define_commit_slab(commit_weight, int *);
 static struct commit_weight commit_weight;
 
+define_commit_slab(bisect_generation, timestamp_t);
+static struct bisect_generation bisect_generation;
+
 #define DEBUG_BISECT 0
 
 static inline int weight(struct commit_list *elem)
@@ -101,6 +108,20 @@ static int count_interesting_parents(struct commit *commit)
 	return count;
 }
 
+static int first_interesting_parent(struct commit *commit,
+				    struct commit **first)
+{
+	struct commit_list *p;
+
+	for (p = commit->parents; p; p = p->next) {
+		if (p->item->object.flags & UNINTERESTING)
+			continue;
+		*first = p->item;
+		return 0;
+	}
+	return -1;
+}
+
 static inline int halfway(struct commit_list *p, int nr)
 {
 	/*
@@ -244,6 +265,193 @@ static struct commit_list *best_bisection_sorted(struct commit_list *list, int n
 	return list;
 }
 
+static timestamp_t generation(struct commit *commit)
+{
+	if (commit->generation != GENERATION_NUMBER_INFINITY)
+		return commit->generation;
+	return *bisect_generation_at(&bisect_generation, commit);
+}
+
+/*
+ * Give the commits that are not in the commit-graph, like the ones
+ * made since it was written, a generation one more than their
+ * parents'. Return -1 if some are left without one.
+ */
+static int fill_generations(struct commit_list *list)
+{
+	int left, done;
+
+	if (!generation_numbers_enabled(the_repository))
+		return -1;
+
+	do {
+		struct commit_list *p;
+
+		left = done = 0;
+		for (p = list; p; p = p->next) {
+			struct commit *commit = p->item;
+			struct commit_list *q;
+			timestamp_t max = 0;
+
+			if (generation(commit))
+				continue;
+			for (q = commit->parents; q; q = q->next) {
+				timestamp_t g;
+
+				if (q->item->object.flags & UNINTERESTING)
+					continue;
+				g = generation(q->item);
+				if (!g)
+					break;
+				if (max < g)
+					max = g;
+			}
+			if (q) {
+				left++;
+				continue;
+			}
+			*bisect_generation_at(&bisect_generation, commit) = max + 1;
+			done++;
+		}
+	} while (left && done);
+
+	return left ? -1 : 0;
+}
+
+static int compare_generation_desc(const void *a_, const void *b_,
+				   void *unused)
+{
+	struct commit *a = (struct commit *)a_, *b = (struct commit *)b_;
+	timestamp_t ga = generation(a), gb = generation(b);
+
+	if (ga != gb)
+		return ga < gb ? 1 : -1;
+	if (a->date != b->date)
+		return a->date < b->date ? 1 : -1;
+	return 0;
+}
+
+/*
+ * Count the tree-changing commits that the merge "commit" reaches
+ * through its other parents but not through "first". Commits come out
+ * of the queue in generation order, so no commit can still gain a flag
+ * once it is out, and the walk can stop as soon as every commit left
+ * in it is reachable from "first".
+ */
+static int count_distance_beyond(struct commit *commit, struct commit *first)
+{
+	struct prio_queue queue = { compare_generation_desc };
+	struct commit_list *p;
+	int nr = 0, others = 0;
+
+	first->object.flags |= REACH_FIRST;
+	prio_queue_put(&queue, first);
+	for (p = commit->parents; p; p = p->next) {
+		struct commit *parent = p->item;
+
+		if (parent->object.flags &
+		    (UNINTERESTING | REACH_FIRST | REACH_OTHER))
+			continue;
+		parent->object.flags |= REACH_OTHER;
+		prio_queue_put(&queue, parent);
+		others++;
+	}
+
+	while (others) {
+		struct commit *c = prio_queue_get(&queue);
+		unsigned flags = c->object.flags & (REACH_FIRST | REACH_OTHER);
+
+		if (flags == REACH_OTHER) {
+			others--;
+			if (!(c->object.flags & TREESAME))
+				nr++;
+		}
+		for (p = c->parents; p; p = p->next) {
+			struct commit *parent = p->item;
+			unsigned old = parent->object.flags &
+				       (REACH_FIRST | REACH_OTHER);
+
+			if (parent->object.flags & UNINTERESTING)
+				continue;
+			if ((old & flags) == flags)
+				continue;
+			parent->object.flags |= flags;
+			if (!old) {
+				prio_queue_put(&queue, parent);
+				if (flags == REACH_OTHER)
+					others++;
+			} else if (old == REACH_OTHER) {
+				/* queued as ours, but "first" reaches it, too */
+				others--;
+			}
+		}
+	}
+
+	clear_commit_marks(first, REACH_FIRST | REACH_OTHER);
+	for (p = commit->parents; p; p = p->next)
+		clear_commit_marks(p->item, REACH_FIRST | REACH_OTHER);
+	clear_prio_queue(&queue);
+	return nr;
+}
+
+static int compare_generation(const void *a_, const void *b_)
+{
+	struct commit *a = (*(struct commit_list **)a_)->item;
+	struct commit *b = (*(struct commit_list **)b_)->item;
+	timestamp_t ga = generation(a), gb = generation(b);
+
+	if (ga != gb)
+		return ga < gb ? -1 : 1;
+	return oidcmp(&a->object.oid, &b->object.oid);
+}
+
+/*
+ * With generation numbers, every parent comes before its children in
+ * generation order, so one pass in that order gives each commit its
+ * weight from its first parent's. A merge adds what only its other
+ * parents reach, which count_distance_beyond() finds without walking
+ * down to the bottom of the range.
+ */
+static struct commit_list *weigh_by_generation(struct commit_list *list,
+					       int on_list, int nr,
+					       int find_all)
+{
+	struct commit_list **sorted, *p, *found = NULL;
+	int i;
+
+	ALLOC_ARRAY(sorted, on_list);
+	for (i = 0, p = list; p; p = p->next)
+		sorted[i++] = p;
+	QSORT(sorted, on_list, compare_generation);
+
+	for (i = 0; i < on_list; i++) {
+		struct commit *first;
+		int w;
+
+		p = sorted[i];
+		if (weight(p) >= 0)
+			continue;
+		if (first_interesting_parent(p->item, &first))
+			BUG("commit %s has no interesting parent",
+			    oid_to_hex(&p->item->object.oid));
+		w = **commit_weight_at(&commit_weight, first);
+		if (weight(p) == -2)
+			w += count_distance_beyond(p->item, first);
+		if (!(p->item->object.flags & TREESAME))
+			w++;
+		weight_set(p, w);
+
+		/* Does it happen to be at exactly half-way? */
+		if (!find_all && halfway(p, nr)) {
+			found = p;
+			break;
+		}
+	}
+
+	free(sorted);
+	return found;
+}
+
 /*
  * zero or positive weight is the number of interesting commits it can
  * reach, including itself.  Especially, weight = 0 means it does not
@@ -295,6 +503,14 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 
 	show_list("bisection 2 initialize", counted, nr, list);
 
+	if (!fill_generations(list)) {
+		p = weigh_by_generation(list, n, nr, find_all);
+		if (p)
+			return p;
+		show_list("bisection 2 counted all", nr, nr, list);
+		goto done;
+	}
+
 	/*
 	 * If you have only one parent in the resulting set
 	 * then you can reach one commit more than that parent
@@ -363,6 +579,7 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 
 	show_list("bisection 2 counted all", counted, nr, list);
 
+done:
 	if (!find_all)
 		return best_bisection(list, nr);
 	else
@@ -378,6 +595,7 @@ void find_bisection(struct commit_list **commit_list, int *reaches,
 
 	show_list("bisection 2 entry", 0, 0, *commit_list);
 	init_commit_weight(&commit_weight);
+	init_bisect_generation(&bisect_generation);
 
 	/*
 	 * Count the number of total and tree-changing items on the
@@ -419,6 +637,7 @@ void find_bisection(struct commit_list **commit_list, int *reaches,
 	free(weights);
 	*commit_list = best;
 	clear_commit_weight(&commit_weight);
+	clear_bisect_generation(&bisect_generation);
 }
 
 static int register_ref(const char *refname, const struct object_id *oid,
@@ -7,8 +7,14 @@
 #include "diffcore.h"
 #include "tag.h"
 #include "blame.h"
+#include "lockfile.h"
 #include "alloc.h"
 #include "commit-slab.h"
+#include "thread-utils.h"
+#include "bloom.h"
+#include "fetch-object.h"
+#include "oidset.h"
+#include "sha1-array.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -299,13 +305,15 @@ static struct commit *fake_working_tree_commit(struct repository *r,
 
 
 static int diff_hunks(mmfile_t *file_a, mmfile_t *file_b,
-		      xdl_emit_hunk_consume_func_t hunk_func, void *cb_data, int xdl_opts)
+		      xdl_emit_hunk_consume_func_t hunk_func, void *cb_data, int xdl_opts,
+		      xdlcache_t *cache)
 {
 	xpparam_t xpp = {0};
 	xdemitconf_t xecfg = {0};
 	xdemitcb_t ecb = {NULL};
 
 	xpp.flags = xdl_opts;
+	xpp.cache = cache;
 	xecfg.hunk_func = hunk_func;
 	ecb.priv = cb_data;
 	return xdi_diff(file_a, file_b, &xpp, &xecfg, &ecb);
@@ -1137,11 +1145,11 @@ void blame_sort_final(struct blame_scoreboard *sb)
 				  compare_blame_final);
 }
 
-static int compare_commits_by_reverse_commit_date(const void *a,
-						  const void *b,
-						  void *c)
+void blame_queue_commit(struct blame_scoreboard *sb, struct commit *commit)
 {
-	return -compare_commits_by_commit_date(a, b, c);
+	timestamp_t key = sb->reverse ? TIME_MAX - commit->date : commit->date;
+
+	keyed_queue_put(&sb->commits, commit, key);
 }
 
 /*
@@ -1214,7 +1222,7 @@ static void queue_blames(struct blame_scoreboard *sb, struct blame_origin *porig
 			}
 		}
 		porigin->suspects = sorted;
-		prio_queue_put(&sb->commits, porigin->commit);
+		blame_queue_commit(sb, porigin->commit);
 	}
 }
 
@@ -1265,6 +1273,20 @@ static struct blame_origin *find_origin(struct repository *r,
 			return blame_origin_incref (porigin);
 		}
 
+	/*
+	 * The changed-path filter of the commit-graph may tell us that
+	 * it is the same as in the first parent without diffing.
+	 */
+	if (!is_null_oid(&origin->commit->object.oid) &&
+	    origin->commit->parents &&
+	    origin->commit->parents->item == parent &&
+	    !bloom_filter_maybe_changed(r, origin->commit, origin->path)) {
+		porigin = get_origin(parent, origin->path);
+		oidcpy(&porigin->blob_oid, &origin->blob_oid);
+		porigin->mode = origin->mode;
+		return porigin;
+	}
+
 	/* See if the origin->path is different between parent
 	 * and origin first.  Most of the time they are the
 	 * same and diff-tree is fairly efficient about this.
@@ -1853,14 +1875,131 @@ static int blame_chunk_cb(long start_a, long count_a,
 	return 0;
 }
 
+/*
+ * The diff between a parent and a target, as the hunks given to
+ * blame_chunk_cb(), so that it can be computed in a thread and
+ * replayed later.
+ */
+struct parent_diff {
+	mmfile_t file_p, file_o;
+	int xdl_opts;
+	int ret;
+	long (*hunk)[4];
+	size_t nr, alloc;
+};
+
+static int save_hunk(long start_a, long count_a,
+		     long start_b, long count_b, void *data)
+{
+	struct parent_diff *pd = data;
+
+	ALLOC_GROW(pd->hunk, pd->nr + 1, pd->alloc);
+	pd->hunk[pd->nr][0] = start_a;
+	pd->hunk[pd->nr][1] = count_a;
+	pd->hunk[pd->nr][2] = start_b;
+	pd->hunk[pd->nr][3] = count_b;
+	pd->nr++;
+	return 0;
+}
+
+struct parent_diff_thread {
+	pthread_t thread;
+	struct parent_diff *diffs;
+	int nr, start, step;
+	xdlcache_t *cache;
+};
+
+static void *run_parent_diffs(void *data)
+{
+	struct parent_diff_thread *t = data;
+	int i;
+
+	for (i = t->start; i < t->nr; i += t->step) {
+		struct parent_diff *pd = &t->diffs[i];
+
+		if (pd->file_p.ptr)
+			pd->ret = diff_hunks(&pd->file_p, &pd->file_o,
+					     save_hunk, pd, pd->xdl_opts,
+					     t->cache);
+	}
+	return NULL;
+}
+
+/*
+ * Diff "target" against each of the "nr" parent origins in "parent"
+ * (some of which may be NULL), using up to sb->num_threads threads.
+ * Only the diffs run in threads; the blobs are read beforehand, and
+ * the blame is passed afterwards, in order.
+ */
+static struct parent_diff *diff_parents(struct blame_scoreboard *sb,
+					struct blame_origin *target,
+					struct blame_origin **parent, int nr)
+{
+	struct parent_diff *diffs;
+	struct parent_diff_thread *threads;
+	int i, n = 0, nr_threads = sb->num_threads;
+
+	for (i = 0; i < nr; i++)
+		if (parent[i])
+			n++;
+	if (!HAVE_THREADS || nr_threads < 2 || n < 2)
+		return NULL;
+
+	diffs = xcalloc(nr, sizeof(*diffs));
+	for (i = 0; i < nr; i++) {
+		if (!parent[i])
+			continue;
+		fill_origin_blob(&sb->revs->diffopt, parent[i],
+				 &diffs[i].file_p, &sb->num_read_blob, 0);
+		fill_origin_blob(&sb->revs->diffopt, target,
+				 &diffs[i].file_o, &sb->num_read_blob, 0);
+		diffs[i].xdl_opts = sb->xdl_opts;
+	}
+
+	if (nr_threads > n)
+		nr_threads = n;
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].diffs = diffs;
+		threads[i].nr = nr;
+		threads[i].start = i;
+		threads[i].step = nr_threads;
+		if (i)
+			threads[i].cache = xdi_cache_new();
+		if (i && pthread_create(&threads[i].thread, NULL,
+					run_parent_diffs, &threads[i]))
+			die(_("unable to create threaded diff"));
+	}
+	run_parent_diffs(&threads[0]);
+	for (i = 1; i < nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		xdl_cache_free(threads[i].cache);
+	}
+	free(threads);
+	return diffs;
+}
+
+static void free_parent_diffs(struct parent_diff *diffs, int nr)
+{
+	int i;
+
+	if (!diffs)
+		return;
+	for (i = 0; i < nr; i++)
+		free(diffs[i].hunk);
+	free(diffs);
+}
+
 /*
  * We are looking at the origin 'target' and aiming to pass blame
  * for the lines it is suspected to its parent.  Run diff to find
- * which lines came from parent and pass blame for them.
+ * which lines came from parent and pass blame for them, or take them
+ * from "pd" if the diff was already run by diff_parents().
  */
 static void pass_blame_to_parent(struct blame_scoreboard *sb,
 				 struct blame_origin *target,
-				 struct blame_origin *parent, int ignore_diffs)
+				 struct blame_origin *parent, int ignore_diffs,
+				 struct parent_diff *pd)
 {
 	mmfile_t file_p, file_o;
 	struct blame_chunk_cb_data d;
@@ -1881,7 +2020,15 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 			 &sb->num_read_blob, ignore_diffs);
 	sb->num_get_patch++;
 
-	if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
+	if (pd) {
+		size_t i;
+
+		for (i = 0; !pd->ret && i < pd->nr; i++)
+			blame_chunk_cb(pd->hunk[i][0], pd->hunk[i][1],
+				       pd->hunk[i][2], pd->hunk[i][3], &d);
+	}
+	if (pd ? pd->ret :
+	    diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts, NULL))
 		die("unable to generate diff (%s -> %s)",
 		    oid_to_hex(&parent->commit->object.oid),
 		    oid_to_hex(&target->commit->object.oid));
@@ -2036,7 +2183,7 @@ static void find_copy_in_blob(struct blame_scoreboard *sb,
 	 * file_p partially may match that image.
 	 */
 	memset(split, 0, sizeof(struct blame_entry [3]));
-	if (diff_hunks(file_p, &file_o, handle_split_cb, &d, sb->xdl_opts))
+	if (diff_hunks(file_p, &file_o, handle_split_cb, &d, sb->xdl_opts, NULL))
 		die("unable to generate diff (%s)",
 		    oid_to_hex(&parent->commit->object.oid));
 	/* remainder, if any, all match the preimage */
@@ -2339,6 +2486,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	struct blame_origin *porigin, **sg_origin = sg_buf;
 	struct blame_entry *toosmall = NULL;
 	struct blame_entry *blames, **blametail = &blames;
+	struct parent_diff *diffs = NULL;
 
 	num_sg = num_scapegoats(revs, commit, sb->reverse);
 	if (!num_sg)
@@ -2388,6 +2536,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	}
 
 	sb->num_commits++;
+	diffs = diff_parents(sb, origin, sg_origin, num_sg);
 	for (i = 0, sg = first_scapegoat(revs, commit, sb->reverse);
 	     i < num_sg && sg;
 	     sg = sg->next, i++) {
@@ -2398,7 +2547,8 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 			blame_origin_incref(porigin);
 			origin->previous = porigin;
 		}
-		pass_blame_to_parent(sb, origin, porigin, 0);
+		pass_blame_to_parent(sb, origin, porigin, 0,
+				     diffs ? &diffs[i] : NULL);
 		if (!origin->suspects)
 			goto finish;
 	}
@@ -2414,7 +2564,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 
 			if (!porigin)
 				continue;
-			pass_blame_to_parent(sb, origin, porigin, 1);
+			pass_blame_to_parent(sb, origin, porigin, 1, NULL);
 			/*
 			 * Preemptively drop porigin so we can refresh the
 			 * fingerprints if we use the parent again, which can
@@ -2471,6 +2621,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	}
 
 finish:
+	free_parent_diffs(diffs, num_sg);
 	*blametail = NULL;
 	distribute_blame(sb, blames);
 	/*
@@ -2498,6 +2649,303 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * The blame cache keeps, for a blob at a path in a commit, which
+ * origin each of its lines comes from. The file is named after the
+ * hash of the commit, the path and the diff options, and holds
+ *
+ *	<blob> SP <number of lines> LF
+ *
+ * followed by one record per group of lines, in order:
+ *
+ *	<lno> SP <num_lines> SP <s_lno> SP <commit> SP <blob> SP <mode>
+ *	SP <previous commit or null> SP <path> NUL <previous path> NUL
+ */
+struct blame_cache_record {
+	int lno, num_lines, s_lno;
+	struct blame_origin *origin;
+};
+
+static char *blame_cache_path(struct blame_scoreboard *sb,
+			      const struct object_id *commit, const char *path)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct object_id oid;
+	char *ret;
+
+	strbuf_addf(&key, "%s %d", oid_to_hex(commit), sb->xdl_opts);
+	strbuf_add(&key, path, strlen(path) + 1);
+	hash_object_file(key.buf, key.len, "blob", &oid);
+	ret = repo_git_path(sb->repo, "blame-cache/%s", oid_to_hex(&oid));
+	strbuf_release(&key);
+	return ret;
+}
+
+static int parse_cache_int(const char **p, int *v, char end)
+{
+	char *ep;
+	long l = strtol(*p, &ep, 10);
+
+	if (ep == *p || *ep != end || l < 0 || l > INT_MAX)
+		return -1;
+	*v = l;
+	*p = ep + 1;
+	return 0;
+}
+
+static int parse_cache_oid(const char **p, struct object_id *oid)
+{
+	if (parse_oid_hex(*p, oid, p) || **p != ' ')
+		return -1;
+	(*p)++;
+	return 0;
+}
+
+static void release_cache_records(struct blame_cache_record *rec, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		blame_origin_decref(rec[i].origin);
+	free(rec);
+}
+
+/*
+ * Read the records cached for "suspect", creating the origins they
+ * point at. Return how many there are, or -1 if there is no usable
+ * cache for it.
+ */
+static int read_blame_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *suspect,
+			    struct blame_cache_record **out)
+{
+	char *path = blame_cache_path(sb, &suspect->commit->object.oid,
+				      suspect->path);
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_cache_record *rec = NULL;
+	int nr = 0, alloc = 0, num_lines, lno = 0;
+	struct object_id oid;
+	const char *p, *end;
+
+	if (strbuf_read_file(&buf, path, 0) < 0)
+		goto fail;
+	p = buf.buf;
+	end = buf.buf + buf.len;
+	if (parse_cache_oid(&p, &oid) || !oideq(&oid, &suspect->blob_oid) ||
+	    parse_cache_int(&p, &num_lines, '\n'))
+		goto fail;
+
+	while (p < end) {
+		struct blame_cache_record *r;
+		struct object_id blob, prev_oid;
+		struct commit *commit;
+		const char *name, *prev_name;
+		int mode;
+		char *ep;
+
+		ALLOC_GROW(rec, nr + 1, alloc);
+		r = &rec[nr];
+		if (parse_cache_int(&p, &r->lno, ' ') ||
+		    parse_cache_int(&p, &r->num_lines, ' ') ||
+		    parse_cache_int(&p, &r->s_lno, ' ') ||
+		    r->lno != lno || !r->num_lines ||
+		    parse_cache_oid(&p, &oid) || parse_cache_oid(&p, &blob))
+			goto fail;
+		mode = strtol(p, &ep, 8);
+		p = ep;
+		if (*p++ != ' ' || parse_cache_oid(&p, &prev_oid))
+			goto fail;
+		name = p;
+		p += strnlen(p, end - p) + 1;
+		prev_name = p;
+		p += strnlen(p, end - p) + 1;
+		if (p > end)
+			goto fail;
+
+		commit = lookup_commit(sb->repo, &oid);
+		if (!commit || parse_commit(commit))
+			goto fail;
+		r->origin = get_origin(commit, name);
+		if (is_null_oid(&r->origin->blob_oid)) {
+			oidcpy(&r->origin->blob_oid, &blob);
+			r->origin->mode = mode;
+		}
+		nr++;
+		lno += r->num_lines;
+
+		if (!r->origin->previous && !is_null_oid(&prev_oid)) {
+			commit = lookup_commit(sb->repo, &prev_oid);
+			if (!commit)
+				goto fail;
+			r->origin->previous = get_origin(commit, prev_name);
+		}
+		/* treat root commit as boundary, as assign_blame() would */
+		if (!r->origin->commit->parents && !sb->show_root)
+			r->origin->commit->object.flags |= UNINTERESTING;
+	}
+	if (lno != num_lines)
+		goto fail;
+
+	strbuf_release(&buf);
+	free(path);
+	*out = rec;
+	return nr;
+
+fail:
+	release_cache_records(rec, nr);
+	strbuf_release(&buf);
+	free(path);
+	return -1;
+}
+
+/*
+ * Move the suspects of "suspect" to the final blame list, splitting
+ * them across the origins its cached blame points at. Return 0 if
+ * there is no usable cache for it.
+ */
+static int blame_from_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *suspect)
+{
+	struct blame_cache_record *rec;
+	struct blame_entry *ent, *next;
+	int nr, num_lines;
+
+	nr = read_blame_cache(sb, suspect, &rec);
+	if (nr <= 0) {
+		release_cache_records(rec, 0);
+		return 0;
+	}
+
+	num_lines = rec[nr - 1].lno + rec[nr - 1].num_lines;
+	for (ent = suspect->suspects; ent; ent = ent->next) {
+		if (ent->s_lno + ent->num_lines > num_lines) {
+			release_cache_records(rec, nr);
+			return 0;
+		}
+	}
+
+	for (ent = suspect->suspects; ent; ent = next) {
+		int start = ent->s_lno, end = ent->s_lno + ent->num_lines;
+		int lo = 0, hi = nr, i;
+
+		next = ent->next;
+		/* find the record "start" is in */
+		while (hi - lo > 1) {
+			int mi = lo + (hi - lo) / 2;
+			if (rec[mi].lno <= start)
+				lo = mi;
+			else
+				hi = mi;
+		}
+		for (i = lo; start < end; i++) {
+			struct blame_cache_record *r = &rec[i];
+			int r_end = r->lno + r->num_lines;
+			struct blame_entry *e;
+
+			if (end < r_end)
+				r_end = end;
+
+			e = xcalloc(1, sizeof(*e));
+			e->lno = ent->lno + start - ent->s_lno;
+			e->num_lines = r_end - start;
+			e->s_lno = r->s_lno + start - r->lno;
+			e->suspect = blame_origin_incref(r->origin);
+			r->origin->guilty = 1;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(e, sb->found_guilty_entry_data);
+			e->next = sb->ent;
+			sb->ent = e;
+			start = r_end;
+		}
+		blame_origin_decref(ent->suspect);
+		free(ent);
+	}
+	suspect->suspects = NULL;
+	release_cache_records(rec, nr);
+	return 1;
+}
+
+static int compare_blame_final_lno(const void *a_, const void *b_)
+{
+	const struct blame_entry *a = *(const struct blame_entry **)a_;
+	const struct blame_entry *b = *(const struct blame_entry **)b_;
+
+	return a->lno < b->lno ? -1 : a->lno > b->lno;
+}
+
+void blame_cache_write(struct blame_scoreboard *sb)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct blame_entry *ent, **entries = NULL;
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id blob;
+	unsigned short mode;
+	char *path = NULL;
+	int i, nr = 0, alloc = 0, lno = 0;
+
+	if (!sb->final || is_null_oid(&sb->final->object.oid) ||
+	    get_tree_entry(sb->repo, &sb->final->object.oid, sb->path,
+			   &blob, &mode))
+		return;
+
+	for (ent = sb->ent; ent; ent = ent->next) {
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr++] = ent;
+	}
+	QSORT(entries, nr, compare_blame_final_lno);
+
+	strbuf_addf(&buf, "%s %d\n", oid_to_hex(&blob), sb->num_lines);
+	for (i = 0; i < nr; i++) {
+		struct blame_origin *o;
+		int j, num_lines;
+
+		ent = entries[i];
+		o = ent->suspect;
+		if (ent->lno != lno)
+			goto out; /* not all of the file was blamed */
+
+		/* coalesce the way blame_coalesce() does */
+		num_lines = ent->num_lines;
+		for (j = i + 1; j < nr; j++) {
+			if (entries[j]->suspect != o ||
+			    entries[j]->s_lno != ent->s_lno + num_lines)
+				break;
+			num_lines += entries[j]->num_lines;
+		}
+
+		strbuf_addf(&buf, "%d %d %d %s ", lno, num_lines, ent->s_lno,
+			    oid_to_hex(&o->commit->object.oid));
+		strbuf_addf(&buf, "%s %06o %s %s", oid_to_hex(&o->blob_oid),
+			    o->mode,
+			    oid_to_hex(o->previous ?
+				       &o->previous->commit->object.oid :
+				       &null_oid),
+			    o->path);
+		strbuf_add(&buf, "", 1);
+		if (o->previous)
+			strbuf_addstr(&buf, o->previous->path);
+		strbuf_add(&buf, "", 1);
+		lno += num_lines;
+		i = j - 1;
+	}
+	if (lno != sb->num_lines)
+		goto out;
+
+	path = blame_cache_path(sb, &sb->final->object.oid, sb->path);
+	if (safe_create_leading_directories(path) ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0)
+		rollback_lock_file(&lk);
+	else
+		commit_lock_file(&lk);
+
+out:
+	free(path);
+	free(entries);
+	strbuf_release(&buf);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2505,7 +2953,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
-	struct commit *commit = prio_queue_get(&sb->commits);
+	struct commit *commit = keyed_queue_get(&sb->commits);
 
 	while (commit) {
 		struct blame_entry *ent;
@@ -2516,7 +2964,7 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 			suspect = suspect->next;
 
 		if (!suspect) {
-			commit = prio_queue_get(&sb->commits);
+			commit = keyed_queue_get(&sb->commits);
 			continue;
 		}
 
@@ -2528,7 +2976,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		 */
 		blame_origin_incref(suspect);
 		parse_commit(commit);
-		if (sb->reverse ||
+		if (sb->use_cache && blame_from_cache(sb, suspect))
+			; /* all of its suspects are now on sb->ent */
+		else if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
 		     !(revs->max_age != -1 && commit->date < revs->max_age)))
 			pass_blame(sb, suspect, opt);
@@ -2682,6 +3132,54 @@ void init_scoreboard(struct blame_scoreboard *sb)
 	sb->copy_score = BLAME_DEFAULT_COPY_SCORE;
 }
 
+/*
+ * In a partial clone, the blobs of "path" are lazily fetched one at a
+ * time as the blame reaches the commits that have them. Walk the
+ * history blame may visit up front instead, and fetch the blobs it will
+ * need in a few batched requests. Renames are not followed; blobs of
+ * older paths are still fetched when they are reached.
+ */
+static void prefetch_path_history(struct blame_scoreboard *sb,
+				  const char *path)
+{
+	struct commit_list *queue = NULL;
+	struct oidset seen = OIDSET_INIT;
+	struct oid_array blobs = OID_ARRAY_INIT;
+
+	if (!repository_format_partial_clone || sb->repo != the_repository)
+		return;
+
+	commit_list_insert(sb->final, &queue);
+	while (queue) {
+		struct commit *commit = pop_commit(&queue);
+		struct commit_list *parent;
+		struct object_id blob_oid;
+		unsigned short mode;
+
+		if (oidset_insert(&seen, &commit->object.oid) ||
+		    (commit->object.flags & UNINTERESTING) ||
+		    repo_parse_commit(sb->repo, commit))
+			continue;
+		if (sb->revs->max_age != -1 && commit->date < sb->revs->max_age)
+			continue;
+		if (!is_null_oid(&commit->object.oid) &&
+		    !get_tree_entry(sb->repo, get_commit_tree_oid(commit),
+				    path, &blob_oid, &mode) &&
+		    S_ISREG(mode))
+			oid_array_append(&blobs, &blob_oid);
+
+		for (parent = commit->parents; parent; parent = parent->next) {
+			commit_list_insert(parent->item, &queue);
+			if (sb->revs->first_parent_only)
+				break;
+		}
+	}
+
+	prefetch_objects(&blobs);
+	oid_array_clear(&blobs);
+	oidset_clear(&seen);
+}
+
 void setup_scoreboard(struct blame_scoreboard *sb,
 		      const char *path,
 		      struct blame_origin **orig)
@@ -2701,10 +3199,8 @@ void setup_scoreboard(struct blame_scoreboard *sb,
 
 	if (!sb->reverse) {
 		sb->final = find_single_final(sb->revs, &final_commit_name);
-		sb->commits.compare = compare_commits_by_commit_date;
 	} else {
 		sb->final = find_single_initial(sb->revs, &final_commit_name);
-		sb->commits.compare = compare_commits_by_reverse_commit_date;
 	}
 
 	if (sb->final && sb->contents_from)
@@ -2759,6 +3255,9 @@ void setup_scoreboard(struct blame_scoreboard *sb,
 			die(_("--reverse --first-parent together require range along first-parent chain"));
 	}
 
+	if (!sb->reverse)
+		prefetch_path_history(sb, path);
+
 	if (is_null_oid(&sb->final->object.oid)) {
 		o = get_blame_suspects(sb->final);
 		sb->final_buf = xmemdupz(o->file.ptr, o->file.size);
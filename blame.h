@@ -104,8 +104,12 @@ struct blame_entry {
 struct blame_scoreboard {
 	/* the final commit (i.e. where we started digging from) */
 	struct commit *final;
-	/* Priority queue for commits with unassigned blame records */
-	struct prio_queue commits;
+	/*
+	 * Priority queue for commits with unassigned blame records,
+	 * newest first (oldest first with --reverse); see
+	 * blame_queue_commit().
+	 */
+	struct keyed_queue commits;
 	struct repository *repo;
 	struct rev_info *revs;
 	const char *path;
@@ -149,6 +153,16 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/* how many threads may diff a merge against its parents */
+	int num_threads;
+
+	/*
+	 * Take the blame of the suspects found in $GIT_DIR/blame-cache
+	 * from there. The caller makes sure that nothing but the
+	 * history of a suspect decides its blame.
+	 */
+	int use_cache;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
@@ -172,6 +186,15 @@ void blame_coalesce(struct blame_scoreboard *sb);
 void blame_sort_final(struct blame_scoreboard *sb);
 unsigned blame_entry_score(struct blame_scoreboard *sb, struct blame_entry *e);
 void assign_blame(struct blame_scoreboard *sb, int opt);
+
+/* Add a commit with unassigned blame records to sb->commits. */
+void blame_queue_commit(struct blame_scoreboard *sb, struct commit *commit);
+
+/*
+ * Store the blame of the whole final image, as found by assign_blame(),
+ * in $GIT_DIR/blame-cache for later runs to reuse.
+ */
+void blame_cache_write(struct blame_scoreboard *sb);
 const char *blame_nth_line(struct blame_scoreboard *sb, long lno);
 
 void init_scoreboard(struct blame_scoreboard *sb);
@@ -0,0 +1,106 @@
+#include "cache.h"
+#include "config.h"
+#include "blob-cache.h"
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+/*
+ * Smaller files take up a block of their own anyway, and cloning them
+ * costs more system calls than writing them does.
+ */
+#define BLOB_CACHE_MIN_SIZE 8192
+
+static const char *blob_cache_dir;
+
+/* set once a clone failed for a reason other than a missing copy */
+static int reflink_unsupported;
+
+int blob_cache_enabled(void)
+{
+	static int initialized;
+
+	if (!initialized) {
+		const char *dir;
+
+		if (!git_config_get_pathname("checkout.blobcache", &dir) &&
+		    *dir)
+			blob_cache_dir = dir;
+		initialized = 1;
+	}
+	return blob_cache_dir && !reflink_unsupported;
+}
+
+static int reflink(int dst, int src)
+{
+#ifdef FICLONE
+	return ioctl(dst, FICLONE, src);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+static void blob_cache_path(struct strbuf *sb, const struct object_id *oid)
+{
+	const char *hex = oid_to_hex(oid);
+
+	strbuf_addf(sb, "%s/%.2s/%s", blob_cache_dir, hex, hex + 2);
+}
+
+int blob_cache_clone(const struct object_id *oid, unsigned long size, int fd)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	int src, ret = -1;
+
+	if (!blob_cache_enabled() || size < BLOB_CACHE_MIN_SIZE)
+		return -1;
+
+	blob_cache_path(&path, oid);
+	src = open(path.buf, O_RDONLY);
+	strbuf_release(&path);
+	if (src < 0)
+		return -1;
+
+	/* do not trust a copy that was cut short */
+	if (!fstat(src, &st) && st.st_size == size) {
+		ret = reflink(fd, src);
+		if (ret && errno != EINTR)
+			reflink_unsupported = 1;
+	}
+	close(src);
+	return ret;
+}
+
+void blob_cache_add(const struct object_id *oid, unsigned long size, int fd)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf tmp = STRBUF_INIT;
+	int dst;
+
+	if (!blob_cache_enabled() || size < BLOB_CACHE_MIN_SIZE)
+		return;
+
+	blob_cache_path(&path, oid);
+	if (!access(path.buf, F_OK))
+		goto out;
+	if (safe_create_leading_directories_const(path.buf) != SCLD_OK)
+		goto out;
+
+	strbuf_addf(&tmp, "%s/tmp_blob_XXXXXX", blob_cache_dir);
+	dst = git_mkstemp_mode(tmp.buf, 0444);
+	if (dst < 0)
+		goto out;
+	if (reflink(dst, fd)) {
+		reflink_unsupported = 1;
+		close(dst);
+		unlink(tmp.buf);
+		goto out;
+	}
+	if (close(dst) || rename(tmp.buf, path.buf))
+		unlink(tmp.buf);
+out:
+	strbuf_release(&tmp);
+	strbuf_release(&path);
+}
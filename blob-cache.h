@@ -0,0 +1,37 @@
+#ifndef BLOB_CACHE_H
+#define BLOB_CACHE_H
+
+struct object_id;
+
+/*
+ * The blob cache "checkout.blobCache" is a directory of read-only files
+ * named after the blobs they hold, as "<dir>/xx/<rest of the hex>". On
+ * a filesystem that can share the data of two files ("reflinks", as on
+ * btrfs, XFS or APFS), checkout clones a blob from there instead of
+ * writing it, and adds the blobs it does write. Elsewhere the cache
+ * stays empty and checkout writes every file as usual.
+ *
+ * Only files whose contents are the blob as is can come from, or go to,
+ * the cache; the callers check that no conversion took place.
+ */
+
+/*
+ * Is the blob cache in use? This reads the configuration the first
+ * time; do that before starting threads that call the functions below.
+ */
+int blob_cache_enabled(void);
+
+/*
+ * Fill the file "fd" was just created for with the cached copy of the
+ * blob "oid" of "size" bytes. Return 0 on success, and -1 when there is
+ * no such copy or it cannot be cloned; the file is still empty then.
+ */
+int blob_cache_clone(const struct object_id *oid, unsigned long size, int fd);
+
+/*
+ * Add the file "fd", which holds the blob "oid" of "size" bytes, to the
+ * cache. This is only a cache; failures are silently ignored.
+ */
+void blob_cache_add(const struct object_id *oid, unsigned long size, int fd);
+
+#endif
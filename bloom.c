@@ -0,0 +1,310 @@
+#include "git-compat-util.h"
+#include "bloom.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "revision.h"
+#include "hashmap.h"
+#include "commit-graph.h"
+#include "commit.h"
+#include "commit-slab.h"
+
+define_commit_slab(bloom_filter_slab, struct bloom_filter);
+
+static struct bloom_filter_slab bloom_filters;
+
+struct pathmap_hash_entry {
+	struct hashmap_entry entry;
+	const char path[FLEX_ARRAY];
+};
+
+static int pathmap_cmp(const void *hashmap_cmp_fn_data,
+		       const void *entry, const void *entry_or_key,
+		       const void *keydata)
+{
+	const struct pathmap_hash_entry *e1 = entry;
+	const struct pathmap_hash_entry *e2 = entry_or_key;
+
+	return strcmp(e1->path, e2->path);
+}
+
+static uint32_t rotate_left(uint32_t value, int32_t count)
+{
+	uint32_t mask = 8 * sizeof(uint32_t) - 1;
+	count &= mask;
+	return ((value << count) | (value >> ((-count) & mask)));
+}
+
+static inline unsigned char get_bitmask(uint32_t pos)
+{
+	return ((unsigned char)1) << (pos & (BITS_PER_WORD - 1));
+}
+
+/*
+ * Calculate the murmur3 32-bit hash value for the given data
+ * using the given seed.
+ * Produces a uniformly distributed hash value.
+ * Not considered to be cryptographically secure.
+ * Implemented as described in https://en.wikipedia.org/wiki/MurmurHash#Algorithm
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	const unsigned char *udata = (const unsigned char *)data;
+	const unsigned char *tail;
+	size_t i, len4 = len / sizeof(uint32_t);
+	uint32_t k, k1 = 0;
+
+	for (i = 0; i < len4; i++) {
+		uint32_t byte1 = (uint32_t)udata[4*i];
+		uint32_t byte2 = ((uint32_t)udata[4*i + 1]) << 8;
+		uint32_t byte3 = ((uint32_t)udata[4*i + 2]) << 16;
+		uint32_t byte4 = ((uint32_t)udata[4*i + 3]) << 24;
+		k = byte1 | byte2 | byte3 | byte4;
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		seed ^= k;
+		seed = rotate_left(seed, r2) * m + n;
+	}
+
+	tail = udata + len4 * sizeof(uint32_t);
+
+	switch (len & (sizeof(uint32_t) - 1)) {
+	case 3:
+		k1 ^= ((uint32_t)tail[2]) << 16;
+		/*-fallthrough*/
+	case 2:
+		k1 ^= ((uint32_t)tail[1]) << 8;
+		/*-fallthrough*/
+	case 1:
+		k1 ^= ((uint32_t)tail[0]) << 0;
+		k1 *= c1;
+		k1 = rotate_left(k1, r1);
+		k1 *= c2;
+		seed ^= k1;
+		break;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= (seed >> 16);
+	seed *= 0x85ebca6b;
+	seed ^= (seed >> 13);
+	seed *= 0xc2b2ae35;
+	seed ^= (seed >> 16);
+
+	return seed;
+}
+
+void fill_bloom_key(const char *data,
+		    size_t len,
+		    struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	int i;
+	const uint32_t seed0 = 0x293ae76f;
+	const uint32_t seed1 = 0x7e646e2c;
+	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
+	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
+
+	key->hashes = (uint32_t *)xcalloc(settings->num_hashes, sizeof(uint32_t));
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	FREE_AND_NULL(key->hashes);
+}
+
+void add_key_to_filter(const struct bloom_key *key,
+		       struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		filter->data[block_pos] |= get_bitmask(hash_mod);
+	}
+}
+
+void init_bloom_filters(void)
+{
+	if (!bloom_filters.slab_size)
+		init_bloom_filter_slab(&bloom_filters);
+}
+
+void deinit_bloom_filters(void)
+{
+	clear_bloom_filter_slab(&bloom_filters);
+}
+
+static void add_path_and_leading_dirs(struct hashmap *paths, const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *last_slash;
+
+	strbuf_addstr(&buf, path);
+
+	/*
+	 * Insert the path itself and every leading directory, so that
+	 * a pathspec naming a directory can be answered by the same
+	 * filter as one naming a file.
+	 */
+	while (buf.len) {
+		struct pathmap_hash_entry *e;
+
+		FLEX_ALLOC_MEM(e, path, buf.buf, buf.len);
+		hashmap_entry_init(e, strhash(e->path));
+
+		if (hashmap_get(paths, e, NULL)) {
+			/* Its leading directories are already present, too. */
+			free(e);
+			break;
+		}
+		hashmap_add(paths, e);
+
+		last_slash = strrchr(buf.buf, '/');
+		strbuf_setlen(&buf, last_slash ? last_slash - buf.buf : 0);
+	}
+
+	strbuf_release(&buf);
+}
+
+struct bloom_filter *get_bloom_filter(struct repository *r,
+				      struct commit *c,
+				      int compute_if_not_present)
+{
+	struct bloom_filter *filter;
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	int i;
+	struct diff_options diffopt;
+
+	if (bloom_filters.slab_size == 0)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+
+	if (!filter->data && load_bloom_filter_from_graph(r, c, filter))
+		return filter;
+
+	if (filter->data || !compute_if_not_present)
+		return filter->data ? filter : NULL;
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diff_setup_done(&diffopt);
+
+	if (repo_parse_commit(r, c))
+		return NULL;
+
+	if (c->parents)
+		diff_tree_oid(get_commit_tree_oid(c->parents->item),
+			      get_commit_tree_oid(c), "", &diffopt);
+	else
+		diff_tree_oid(NULL, get_commit_tree_oid(c), "", &diffopt);
+
+	if (diff_queued_diff.nr <= BLOOM_FILTER_MAX_CHANGED_PATHS) {
+		struct hashmap pathmap;
+		struct pathmap_hash_entry *e;
+		struct hashmap_iter iter;
+
+		hashmap_init(&pathmap, pathmap_cmp, NULL, 0);
+
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			add_path_and_leading_dirs(&pathmap,
+						  diff_queued_diff.queue[i]->two->path);
+
+		filter->len = (hashmap_get_size(&pathmap) * settings.bits_per_entry +
+			       BITS_PER_WORD - 1) / BITS_PER_WORD;
+		if (!filter->len) {
+			/*
+			 * An empty diff still gets a one-word filter with
+			 * no bits set, so that we can tell "nothing changed"
+			 * apart from "not computed".
+			 */
+			filter->len = 1;
+		}
+		filter->data = xcalloc(filter->len, sizeof(unsigned char));
+
+		hashmap_iter_init(&pathmap, &iter);
+		while ((e = hashmap_iter_next(&iter))) {
+			struct bloom_key key;
+
+			fill_bloom_key(e->path, strlen(e->path), &key, &settings);
+			add_key_to_filter(&key, filter, &settings);
+			clear_bloom_key(&key);
+		}
+
+		hashmap_free(&pathmap, 1);
+	} else {
+		/*
+		 * Too many paths to be worth storing; a filter with every
+		 * bit set answers "maybe" for all queries.
+		 */
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xFF;
+	}
+
+	for (i = 0; i < diff_queued_diff.nr; i++)
+		diff_free_filepair(diff_queued_diff.queue[i]);
+	free(diff_queued_diff.queue);
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+
+	return filter;
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	if (!mod)
+		return -1;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		if (!(filter->data[block_pos] & get_bitmask(hash_mod)))
+			return 0;
+	}
+
+	return 1;
+}
+
+int bloom_filter_maybe_changed(struct repository *r, struct commit *c,
+			       const char *path)
+{
+	struct bloom_filter_settings *settings;
+	struct bloom_filter *filter;
+	struct bloom_key key;
+	int ret;
+
+	if (!*path || repo_parse_commit(r, c) ||
+	    c->generation == GENERATION_NUMBER_INFINITY)
+		return 1;
+	settings = get_bloom_filter_settings(r);
+	if (!settings)
+		return 1;
+	filter = get_bloom_filter(r, c, 0);
+	if (!filter)
+		return 1;
+
+	fill_bloom_key(path, strlen(path), &key, settings);
+	ret = bloom_filter_contains(filter, &key, settings);
+	clear_bloom_key(&key);
+	return ret != 0;
+}
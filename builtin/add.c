@@ -12,6 +12,7 @@
 #include "pathspec.h"
 #include "exec-cmd.h"
 #include "cache-tree.h"
+#include "sparse-index.h"
 #include "run-command.h"
 #include "parse-options.h"
 #include "diff.h"
@@ -20,6 +21,8 @@
 #include "bulk-checkin.h"
 #include "argv-array.h"
 #include "submodule.h"
+#include "convert.h"
+#include "thread-utils.h"
 
 static const char * const builtin_add_usage[] = {
 	N_("git add [<options>] [--] <pathspec>..."),
@@ -28,6 +31,14 @@ static const char * const builtin_add_usage[] = {
 static int patch_interactive, add_interactive, edit_interactive;
 static int take_worktree_changes;
 static int add_renormalize;
+static int add_threads;
+
+/*
+ * Below this many new files, each one is written as a loose object on
+ * the main thread; from there on, they are read, hashed and deflated on
+ * add.threads threads and go into a single pack.
+ */
+#define BULK_ADD_MIN (256)
 
 struct update_callback_data {
 	int flags;
@@ -38,6 +49,7 @@ static void chmod_pathspec(struct pathspec *pathspec, char flip)
 {
 	int i;
 
+	ensure_full_index(&the_index);
 	for (i = 0; i < active_nr; i++) {
 		struct cache_entry *ce = active_cache[i];
 
@@ -129,6 +141,7 @@ static int renormalize_tracked_files(const struct pathspec *pathspec, int flags)
 {
 	int i, retval = 0;
 
+	ensure_full_index(&the_index);
 	for (i = 0; i < active_nr; i++) {
 		struct cache_entry *ce = active_cache[i];
 
@@ -319,6 +332,17 @@ static int add_config(const char *var, const char *value, void *cb)
 		ignore_add_errors = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "add.threads")) {
+		int is_bool;
+
+		add_threads = git_config_bool_or_int(var, value, &is_bool);
+		if (is_bool)
+			add_threads = add_threads ? 0 : 1;
+		if (add_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    add_threads, var);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
 
@@ -364,6 +388,10 @@ static void check_embedded_repo(const char *path)
 static int add_files(struct dir_struct *dir, int flags)
 {
 	int i, exit_status = 0;
+	struct bulk_checkin_blob *blobs = NULL;
+	struct stat *st = NULL;
+	int *blob_of = NULL;
+	int nr_blobs = 0, threads;
 
 	if (dir->ignored_nr) {
 		fprintf(stderr, _(ignore_error));
@@ -373,15 +401,48 @@ static int add_files(struct dir_struct *dir, int flags)
 		exit_status = 1;
 	}
 
+	threads = add_threads ? add_threads : online_cpus();
+	if (HAVE_THREADS && threads > 1 && dir->nr >= BULK_ADD_MIN &&
+	    !(flags & (ADD_CACHE_PRETEND | ADD_CACHE_INTENT))) {
+		ALLOC_ARRAY(blob_of, dir->nr);
+		ALLOC_ARRAY(st, dir->nr);
+		CALLOC_ARRAY(blobs, dir->nr);
+		for (i = 0; i < dir->nr; i++) {
+			const char *path = dir->entries[i]->name;
+
+			blob_of[i] = -1;
+			if (lstat(path, &st[i]) || !S_ISREG(st[i].st_mode) ||
+			    st[i].st_size > big_file_threshold ||
+			    would_convert_to_git(&the_index, path))
+				continue;
+			blobs[nr_blobs].path = path;
+			blobs[nr_blobs].size = xsize_t(st[i].st_size);
+			blob_of[i] = nr_blobs++;
+		}
+		index_blobs_bulk_checkin(blobs, nr_blobs, threads);
+	}
+
 	for (i = 0; i < dir->nr; i++) {
-		if (add_file_to_index(&the_index, dir->entries[i]->name, flags)) {
+		const char *path = dir->entries[i]->name;
+		int ret;
+
+		if (blob_of && blob_of[i] >= 0 && !blobs[blob_of[i]].status)
+			ret = add_to_index_with_oid(&the_index, path, &st[i],
+						    &blobs[blob_of[i]].oid,
+						    flags);
+		else
+			ret = add_file_to_index(&the_index, path, flags);
+		if (ret) {
 			if (!ignore_add_errors)
 				die(_("adding files failed"));
 			exit_status = 1;
 		} else {
-			check_embedded_repo(dir->entries[i]->name);
+			check_embedded_repo(path);
 		}
 	}
+	free(blob_of);
+	free(st);
+	free(blobs);
 	return exit_status;
 }
 
@@ -434,6 +495,9 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 
 	hold_locked_index(&lock_file, LOCK_DIE_ON_ERROR);
 
+	/* Paths outside of the sparse directories are expanded on demand. */
+	command_requires_full_index = 0;
+
 	flags = ((verbose ? ADD_CACHE_VERBOSE : 0) |
 		 (show_only ? ADD_CACHE_PRETEND : 0) |
 		 (intent_to_add ? ADD_CACHE_INTENT : 0) |
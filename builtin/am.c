@@ -34,6 +34,7 @@
 #include "string-list.h"
 #include "packfile.h"
 #include "repository.h"
+#include "wt-status.h"
 
 /**
  * Returns the length of the first line of msg.
@@ -119,6 +120,11 @@ struct am_state {
 	int allow_rerere_autoupdate;
 	const char *sign_commit;
 	int rebasing;
+	int batch;
+
+	/* applying to the index in core only, see am_batch_begin() */
+	int batching;
+	struct object_id batch_base;
 };
 
 /**
@@ -360,6 +366,9 @@ static void am_load(struct am_state *state)
 	read_state_file(&sb, state, "quiet", 1);
 	state->quiet = !strcmp(sb.buf, "t");
 
+	read_state_file(&sb, state, "batch", 1);
+	state->batch = !strcmp(sb.buf, "t");
+
 	read_state_file(&sb, state, "sign", 1);
 	state->signoff = !strcmp(sb.buf, "t");
 
@@ -959,6 +968,7 @@ static void am_setup(struct am_state *state, enum patch_format patch_format,
 
 	write_state_bool(state, "threeway", state->threeway);
 	write_state_bool(state, "quiet", state->quiet);
+	write_state_bool(state, "batch", state->batch);
 	write_state_bool(state, "sign", state->signoff);
 	write_state_bool(state, "utf8", state->utf8);
 
@@ -1084,12 +1094,16 @@ static void refresh_and_write_cache(void)
 		die(_("unable to write index file"));
 }
 
+static void am_batch_end(struct am_state *state);
+
 /**
  * Dies with a user-friendly message on how to proceed after resolving the
  * problem. This message can be overridden with state->resolvemsg.
  */
-static void NORETURN die_user_resolve(const struct am_state *state)
+static void NORETURN die_user_resolve(struct am_state *state)
 {
+	am_batch_end(state);
+
 	if (state->resolvemsg) {
 		printf_ln("%s", state->resolvemsg);
 	} else {
@@ -1420,6 +1434,10 @@ static int run_apply(const struct am_state *state, const char *index_file)
 	if (index_file) {
 		apply_state.index_file = index_file;
 		apply_state.cached = 1;
+	} else if (state->batching) {
+		apply_state.cached = 1;
+		apply_state.check_index = 1;
+		apply_state.index_in_core = 1;
 	} else
 		apply_state.check_index = 1;
 
@@ -1569,7 +1587,14 @@ static void do_commit(const struct am_state *state)
 	if (run_hook_le(NULL, "pre-applypatch", NULL))
 		exit(1);
 
-	if (write_cache_as_tree(&tree, 0, NULL))
+	if (state->batching) {
+		/* only the trees that the patch touched are written again */
+		if (!the_index.cache_tree)
+			the_index.cache_tree = cache_tree();
+		if (cache_tree_update(&the_index, 0))
+			die(_("git write-tree failed to write a tree"));
+		oidcpy(&tree, &the_index.cache_tree->oid);
+	} else if (write_cache_as_tree(&tree, 0, NULL))
 		die(_("git write-tree failed to write a tree"));
 
 	if (!get_oid_commit("HEAD", &parent)) {
@@ -1689,6 +1714,61 @@ static int do_interactive(struct am_state *state)
 	}
 }
 
+static int fast_forward_to(struct tree *head, struct tree *remote, int reset);
+
+/**
+ * With --batch, apply the patches to the index in core and commit from
+ * there, without writing the index out or touching the working tree
+ * until am_batch_end(). Nothing that gets to look at the working tree
+ * on the way, like the pre-applypatch and post-applypatch hooks, can
+ * run then, and local changes in the working tree would get in the
+ * way at the end; in these cases, the patches are applied one at a
+ * time as usual.
+ */
+static void am_batch_begin(struct am_state *state)
+{
+	struct object_id head;
+
+	if (!state->batch)
+		return;
+	if (state->interactive ||
+	    find_hook("pre-applypatch") || find_hook("post-applypatch") ||
+	    has_unstaged_changes(the_repository, 1)) {
+		state->batch = 0; /* not in this run */
+		return;
+	}
+
+	if (get_oid_tree("HEAD", &head))
+		oidcpy(&head, the_hash_algo->empty_tree);
+	oidcpy(&state->batch_base, &head);
+	state->batching = 1;
+}
+
+/*
+ * Bring the index and the working tree from where the batch started
+ * up to HEAD.
+ */
+static void am_batch_end(struct am_state *state)
+{
+	struct object_id head;
+	struct tree *base_tree, *head_tree;
+
+	if (!state->batching)
+		return;
+	state->batching = 0;
+
+	discard_cache();
+	if (read_cache() < 0)
+		die(_("index file corrupt"));
+	if (get_oid_tree("HEAD", &head) || oideq(&head, &state->batch_base))
+		return;
+	base_tree = parse_tree_indirect(&state->batch_base);
+	head_tree = parse_tree_indirect(&head);
+	if (!base_tree || !head_tree || fast_forward_to(base_tree, head_tree, 0))
+		die(_("could not update the working tree to HEAD; "
+		      "run \"git reset --keep HEAD\" once it is out of the way"));
+}
+
 /**
  * Applies all queued mail.
  *
@@ -1698,7 +1778,6 @@ static int do_interactive(struct am_state *state)
  */
 static void am_run(struct am_state *state, int resume)
 {
-	const char *argv_gc_auto[] = {"gc", "--auto", NULL};
 	struct strbuf sb = STRBUF_INIT;
 
 	unlink(am_path(state, "dirtyindex"));
@@ -1712,6 +1791,8 @@ static void am_run(struct am_state *state, int resume)
 
 	strbuf_release(&sb);
 
+	am_batch_begin(state);
+
 	while (state->cur <= state->last) {
 		const char *mail = am_path(state, msgnum(state));
 		int apply_status;
@@ -1744,13 +1825,19 @@ static void am_run(struct am_state *state, int resume)
 		if (state->interactive && do_interactive(state))
 			goto next;
 
-		if (run_applypatch_msg_hook(state))
+		if (run_applypatch_msg_hook(state)) {
+			am_batch_end(state);
 			exit(1);
+		}
 
 		say(state, stdout, _("Applying: %.*s"), linelen(state->msg), state->msg);
 
 		apply_status = run_apply(state, NULL);
 
+		/* the index and the working tree must agree from here on */
+		if (apply_status)
+			am_batch_end(state);
+
 		if (apply_status && state->threeway) {
 			struct strbuf sb = STRBUF_INIT;
 
@@ -1781,6 +1868,10 @@ static void am_run(struct am_state *state, int resume)
 
 		do_commit(state);
 
+		/* pick the batch up again after falling back to a merge */
+		if (state->batch && !state->batching)
+			am_batch_begin(state);
+
 next:
 		am_next(state);
 
@@ -1789,6 +1880,8 @@ static void am_run(struct am_state *state, int resume)
 		resume = 0;
 	}
 
+	am_batch_end(state);
+
 	if (!is_empty_or_missing_file(am_path(state, "rewritten"))) {
 		assert(state->rebasing);
 		copy_notes_for_rebase(state);
@@ -1802,7 +1895,7 @@ static void am_run(struct am_state *state, int resume)
 	if (!state->rebasing) {
 		am_destroy(state);
 		close_object_store(the_repository->objects);
-		run_command_v_opt(argv_gc_auto, RUN_GIT_CMD);
+		run_auto_maintenance(state->quiet);
 	}
 }
 
@@ -2174,6 +2267,8 @@ int cmd_am(int argc, const char **argv, const char *prefix)
 		OPT_BOOL('3', "3way", &state.threeway,
 			N_("allow fall back on 3way merging if needed")),
 		OPT__QUIET(&state.quiet, N_("be quiet")),
+		OPT_BOOL(0, "batch", &state.batch,
+			N_("update the working tree only after the last patch")),
 		OPT_SET_INT('s', "signoff", &state.signoff,
 			N_("add a Signed-off-by line to the commit message"),
 			SIGNOFF_EXPLICIT),
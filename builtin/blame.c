@@ -51,6 +51,8 @@ static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
 static int show_progress;
+static int blame_cache;
+static int num_threads;
 static char repeated_meta_color[COLOR_MAXLEN];
 static int coloring_mode;
 static struct string_list ignore_revs_file_list = STRING_LIST_INIT_NODUP;
@@ -717,6 +719,17 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		string_list_insert(&ignore_revs_file_list, str);
 		return 0;
 	}
+	if (!strcmp(var, "blame.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+		return 0;
+	}
+	if (!strcmp(var, "blame.cache")) {
+		blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.markunblamablelines")) {
 		mark_unblamable_lines = git_config_bool(var, value);
 		return 0;
@@ -795,6 +808,28 @@ static int blame_move_callback(const struct option *option, const char *arg, int
 	return 0;
 }
 
+/*
+ * The cached blame of a blob only depends on the history behind it,
+ * which is not true anymore when blame may come from other files, when
+ * part of the history is ignored or rewritten, or when it is cut short.
+ */
+static int can_use_blame_cache(struct blame_scoreboard *sb, int opt,
+			       const char *revs_file)
+{
+	struct rev_info *revs = sb->revs;
+	int i;
+
+	if (sb->reverse || revs_file ||
+	    (opt & (PICKAXE_BLAME_MOVE | PICKAXE_BLAME_COPY)) ||
+	    kh_size(&sb->ignore_list.set) ||
+	    revs->max_age != -1 || revs->first_parent_only)
+		return 0;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 0;
+	return 1;
+}
+
 static int is_a_rev(const char *name)
 {
 	struct object_id oid;
@@ -1068,6 +1103,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	build_ignorelist(&sb, &ignore_revs_file_list, &ignore_rev_list);
 	string_list_clear(&ignore_revs_file_list, 0);
 	string_list_clear(&ignore_rev_list, 0);
+	sb.use_cache = blame_cache && can_use_blame_cache(&sb, opt, revs_file);
 	setup_scoreboard(&sb, path, &o);
 	lno = sb.num_lines;
 
@@ -1103,7 +1139,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	}
 
 	o->suspects = ent;
-	prio_queue_put(&sb.commits, o->commit);
+	blame_queue_commit(&sb, o->commit);
 
 	blame_origin_decref(o);
 
@@ -1124,6 +1160,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.num_threads = num_threads ? num_threads : online_cpus();
 
 	read_mailmap(&mailmap, NULL);
 
@@ -1136,6 +1173,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	stop_progress(&pi.progress);
 
+	if (sb.use_cache)
+		blame_cache_write(&sb);
+
 	if (!incremental)
 		setup_pager();
 	else
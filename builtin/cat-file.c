@@ -15,14 +15,19 @@
 #include "sha1-array.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "pack-revindex.h"
+#include "thread-utils.h"
 
 struct batch_options {
 	int enabled;
 	int follow_symlinks;
 	int print_contents;
+	int command; /* --batch-command; print_contents is per command */
 	int buffer_output;
 	int all_objects;
 	int unordered;
+	int zlib;
+	int threads;
 	int cmdmode; /* may be 'w' or 'c' for --filters or --textconv */
 	const char *format;
 };
@@ -235,10 +240,12 @@ static void expand_atom(struct strbuf *sb, const char *atom, int len,
 			void *vdata)
 {
 	struct expand_data *data = vdata;
+	char hex[GIT_MAX_HEXSZ + 1];
 
+	/* this may run in several threads; avoid oid_to_hex() */
 	if (is_atom("objectname", atom, len)) {
 		if (!data->mark_query)
-			strbuf_addstr(sb, oid_to_hex(&data->oid));
+			strbuf_addstr(sb, oid_to_hex_r(hex, &data->oid));
 	} else if (is_atom("objecttype", atom, len)) {
 		if (data->mark_query)
 			data->info.typep = &data->type;
@@ -263,8 +270,8 @@ static void expand_atom(struct strbuf *sb, const char *atom, int len,
 		if (data->mark_query)
 			data->info.delta_base_sha1 = data->delta_base_oid.hash;
 		else
-			strbuf_addstr(sb,
-				      oid_to_hex(&data->delta_base_oid));
+			strbuf_addstr(sb, oid_to_hex_r(hex,
+							&data->delta_base_oid));
 	} else
 		die("unknown format element: %.*s", len, atom);
 }
@@ -293,12 +300,105 @@ static void batch_write(struct batch_options *opt, const void *data, int len)
 		write_or_die(1, data, len);
 }
 
+static void *read_object_or_die(struct expand_data *data, unsigned long *size)
+{
+	enum object_type type;
+	void *contents;
+
+	contents = read_object_file(&data->oid, &type, size);
+	if (!contents)
+		die("object %s disappeared", oid_to_hex(&data->oid));
+	if (type != data->type)
+		die("object %s changed type!?", oid_to_hex(&data->oid));
+	if (data->info.sizep && *size != data->size)
+		die("object %s changed size!?", oid_to_hex(&data->oid));
+	return contents;
+}
+
+/*
+ * If the object of "data" is stored whole (i.e. not as a delta) in a
+ * pack, find where its zlib stream starts in the pack, and how long it
+ * is. Returns -1 if the object has to be inflated to be shown.
+ */
+static int find_packed_zlib(struct expand_data *data, off_t *offset,
+			    off_t *len)
+{
+	struct packed_git *p = data->info.u.packed.pack;
+	struct pack_window *w_curs = NULL;
+	unsigned long size;
+	uint32_t pos;
+	int ret = -1;
+
+	if (data->info.whence != OI_PACKED || data->info.u.packed.is_delta)
+		return -1;
+
+	obj_read_lock();
+	*offset = data->info.u.packed.offset;
+	if (!offset_to_pack_pos(p, *offset, &pos) &&
+	    unpack_object_header(p, &w_curs, offset, &size) > 0) {
+		*len = pack_pos_to_offset(p, pos + 1) - *offset;
+		ret = 0;
+	}
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return ret;
+}
+
+/* Write the zlib stream found by find_packed_zlib(), without a copy. */
+static void write_packed_zlib(struct batch_options *opt,
+			      struct expand_data *data, off_t offset, off_t len)
+{
+	struct packed_git *p = data->info.u.packed.pack;
+	struct pack_window *w_curs = NULL;
+	struct strbuf header = STRBUF_INIT;
+
+	strbuf_addf(&header, "zlib %"PRIuMAX"\n", (uintmax_t)len);
+	batch_write(opt, header.buf, header.len);
+	strbuf_release(&header);
+
+	obj_read_lock();
+	while (len) {
+		unsigned long avail;
+		unsigned char *in = use_pack(p, &w_curs, offset, &avail);
+
+		if (avail > len)
+			avail = (unsigned long)len;
+		if (avail > INT_MAX)
+			avail = INT_MAX;
+		batch_write(opt, in, avail);
+		offset += avail;
+		len -= avail;
+	}
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+}
+
+static void write_plain_header(struct batch_options *opt,
+			       struct expand_data *data)
+{
+	struct strbuf header = STRBUF_INIT;
+
+	strbuf_addf(&header, "plain %"PRIuMAX"\n", (uintmax_t)data->size);
+	batch_write(opt, header.buf, header.len);
+	strbuf_release(&header);
+}
+
 static void print_object_or_die(struct batch_options *opt, struct expand_data *data)
 {
 	const struct object_id *oid = &data->oid;
 
 	assert(data->info.typep);
 
+	if (opt->zlib) {
+		off_t offset, len;
+
+		if (!find_packed_zlib(data, &offset, &len)) {
+			write_packed_zlib(opt, data, offset, len);
+			return;
+		}
+		write_plain_header(opt, data);
+	}
+
 	if (data->type == OBJ_BLOB) {
 		if (opt->buffer_output)
 			fflush(stdout);
@@ -334,17 +434,8 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 		}
 	}
 	else {
-		enum object_type type;
 		unsigned long size;
-		void *contents;
-
-		contents = read_object_file(oid, &type, &size);
-		if (!contents)
-			die("object %s disappeared", oid_to_hex(oid));
-		if (type != data->type)
-			die("object %s changed type!?", oid_to_hex(oid));
-		if (data->info.sizep && size != data->size)
-			die("object %s changed size!?", oid_to_hex(oid));
+		void *contents = read_object_or_die(data, &size);
 
 		batch_write(opt, contents, size);
 		free(contents);
@@ -376,10 +467,14 @@ static void batch_object_write(const char *obj_name,
 	}
 }
 
-static void batch_one_object(const char *obj_name,
-			     struct strbuf *scratch,
-			     struct batch_options *opt,
-			     struct expand_data *data)
+/*
+ * Resolve "obj_name" into data->oid. If that does not give an object
+ * to show, put the answer for "obj_name" into "out" and return -1.
+ */
+static int resolve_one_object(const char *obj_name,
+			      struct strbuf *out,
+			      struct batch_options *opt,
+			      struct expand_data *data)
 {
 	struct object_context ctx;
 	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
@@ -390,36 +485,48 @@ static void batch_one_object(const char *obj_name,
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
-			printf("%s missing\n", obj_name);
+			strbuf_addf(out, "%s missing\n", obj_name);
 			break;
 		case SHORT_NAME_AMBIGUOUS:
-			printf("%s ambiguous\n", obj_name);
+			strbuf_addf(out, "%s ambiguous\n", obj_name);
 			break;
 		case DANGLING_SYMLINK:
-			printf("dangling %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(out, "dangling %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case SYMLINK_LOOP:
-			printf("loop %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(out, "loop %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case NOT_DIR:
-			printf("notdir %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(out, "notdir %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		default:
 			BUG("unknown get_sha1_with_context result %d\n",
 			       result);
 			break;
 		}
-		fflush(stdout);
-		return;
+		return -1;
 	}
 
 	if (ctx.mode == 0) {
-		printf("symlink %"PRIuMAX"\n%s\n",
-		       (uintmax_t)ctx.symlink_path.len,
-		       ctx.symlink_path.buf);
+		strbuf_addf(out, "symlink %"PRIuMAX"\n%s\n",
+			    (uintmax_t)ctx.symlink_path.len,
+			    ctx.symlink_path.buf);
+		return -1;
+	}
+	return 0;
+}
+
+static void batch_one_object(const char *obj_name,
+			     struct strbuf *scratch,
+			     struct batch_options *opt,
+			     struct expand_data *data)
+{
+	strbuf_reset(scratch);
+	if (resolve_one_object(obj_name, scratch, opt, data)) {
+		fwrite(scratch->buf, 1, scratch->len, stdout);
 		fflush(stdout);
 		return;
 	}
@@ -427,6 +534,260 @@ static void batch_one_object(const char *obj_name,
 	batch_object_write(obj_name, scratch, opt, data);
 }
 
+/*
+ * Split the input line at the first whitespace, tying off the name and
+ * saving the remainder (or NULL) in data->rest.
+ */
+static void split_batch_input(char *input, struct expand_data *data)
+{
+	char *p = strpbrk(input, " \t");
+
+	if (p) {
+		while (*p && strchr(" \t", *p))
+			*p++ = '\0';
+	}
+	data->rest = p;
+}
+
+/*
+ * With --threads, the main thread reads and resolves the names given
+ * on the standard input, worker threads look up and read the objects,
+ * and a writer thread prints the answers in input order as soon as
+ * they are ready, so that interactive callers still get each answer
+ * without sending more input. At most "nr" names are in flight; their
+ * answers are kept in a ring of slots, indexed by sequence number.
+ */
+struct batch_slot {
+	struct strbuf input;
+	struct strbuf out;
+	struct expand_data data;
+	void *contents;
+	unsigned long size;
+	off_t zlib_offset, zlib_len;
+	unsigned needs_work : 1,
+		 ready : 1,
+		 stream : 1,
+		 zlib : 1;
+};
+
+struct batch_queue {
+	struct batch_options *opt;
+	struct batch_slot *slots;
+	unsigned nr;
+	unsigned long nr_read, nr_taken, nr_written;
+	int eof;
+	pthread_mutex_t mutex; /* protects the fields above and "ready" */
+	pthread_cond_t cond;
+};
+
+/* Like "*dst = *src", but point dst->info at the fields of dst. */
+static void copy_expand_data(struct expand_data *dst,
+			     const struct expand_data *src)
+{
+	*dst = *src;
+	if (src->info.typep)
+		dst->info.typep = &dst->type;
+	if (src->info.sizep)
+		dst->info.sizep = &dst->size;
+	if (src->info.disk_sizep)
+		dst->info.disk_sizep = &dst->disk_size;
+	if (src->info.delta_base_sha1)
+		dst->info.delta_base_sha1 = dst->delta_base_oid.hash;
+}
+
+static void batch_queue_add(struct batch_queue *q, struct strbuf *input,
+			    const struct expand_data *template)
+{
+	struct batch_slot *slot;
+	int resolved;
+
+	pthread_mutex_lock(&q->mutex);
+	while (q->nr_read - q->nr_written >= q->nr)
+		pthread_cond_wait(&q->cond, &q->mutex);
+	pthread_mutex_unlock(&q->mutex);
+
+	/* nobody else looks at this slot until nr_read moves past it */
+	slot = &q->slots[q->nr_read % q->nr];
+	strbuf_swap(&slot->input, input);
+	strbuf_reset(&slot->out);
+	copy_expand_data(&slot->data, template);
+	if (slot->data.split_on_whitespace)
+		split_batch_input(slot->input.buf, &slot->data);
+
+	obj_read_lock();
+	resolved = !resolve_one_object(slot->input.buf, &slot->out,
+				       q->opt, &slot->data);
+	obj_read_unlock();
+
+	pthread_mutex_lock(&q->mutex);
+	slot->needs_work = resolved;
+	slot->ready = !resolved;
+	q->nr_read++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static void batch_prepare_answer(struct batch_options *opt,
+				 struct batch_slot *slot)
+{
+	struct expand_data *data = &slot->data;
+
+	if (!data->skip_object_info &&
+	    oid_object_info_extended(the_repository, &data->oid, &data->info,
+				     OBJECT_INFO_LOOKUP_REPLACE) < 0) {
+		strbuf_addf(&slot->out, "%s missing\n", slot->input.buf);
+		return;
+	}
+
+	strbuf_expand(&slot->out, opt->format, expand_format, data);
+	strbuf_addch(&slot->out, '\n');
+
+	if (!opt->print_contents)
+		return;
+	if (opt->zlib &&
+	    !find_packed_zlib(data, &slot->zlib_offset, &slot->zlib_len))
+		slot->zlib = 1;
+	/* large blobs are streamed out by the writer */
+	else if (data->type == OBJ_BLOB && data->size > big_file_threshold)
+		slot->stream = 1;
+	else
+		slot->contents = read_object_or_die(data, &slot->size);
+}
+
+static void *batch_worker(void *vq)
+{
+	struct batch_queue *q = vq;
+
+	for (;;) {
+		struct batch_slot *slot;
+
+		pthread_mutex_lock(&q->mutex);
+		while (q->nr_taken == q->nr_read && !q->eof)
+			pthread_cond_wait(&q->cond, &q->mutex);
+		if (q->nr_taken == q->nr_read) {
+			pthread_mutex_unlock(&q->mutex);
+			return NULL;
+		}
+		slot = &q->slots[q->nr_taken++ % q->nr];
+		pthread_mutex_unlock(&q->mutex);
+
+		if (!slot->needs_work)
+			continue;
+		batch_prepare_answer(q->opt, slot);
+
+		pthread_mutex_lock(&q->mutex);
+		slot->ready = 1;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
+
+static void batch_write_answer(struct batch_options *opt,
+			       struct batch_slot *slot)
+{
+	batch_write(opt, slot->out.buf, slot->out.len);
+	if (opt->zlib && (slot->stream || slot->contents))
+		write_plain_header(opt, &slot->data);
+	if (slot->zlib) {
+		write_packed_zlib(opt, &slot->data,
+				  slot->zlib_offset, slot->zlib_len);
+	} else if (slot->stream) {
+		if (opt->buffer_output)
+			fflush(stdout);
+		obj_read_lock();
+		stream_blob(&slot->data.oid);
+		obj_read_unlock();
+	} else if (slot->contents) {
+		batch_write(opt, slot->contents, slot->size);
+		FREE_AND_NULL(slot->contents);
+	} else
+		return;
+	batch_write(opt, "\n", 1);
+	slot->stream = 0;
+	slot->zlib = 0;
+}
+
+static void *batch_writer(void *vq)
+{
+	struct batch_queue *q = vq;
+
+	for (;;) {
+		struct batch_slot *slot;
+
+		pthread_mutex_lock(&q->mutex);
+		for (;;) {
+			slot = &q->slots[q->nr_written % q->nr];
+			if (q->nr_written < q->nr_read ? slot->ready : q->eof)
+				break;
+			pthread_cond_wait(&q->cond, &q->mutex);
+		}
+		if (q->nr_written == q->nr_read) {
+			pthread_mutex_unlock(&q->mutex);
+			return NULL;
+		}
+		pthread_mutex_unlock(&q->mutex);
+
+		batch_write_answer(q->opt, slot);
+
+		pthread_mutex_lock(&q->mutex);
+		slot->ready = 0;
+		q->nr_written++;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
+
+static void batch_objects_threaded(struct batch_options *opt,
+				   struct expand_data *template)
+{
+	struct batch_queue q;
+	struct strbuf input = STRBUF_INIT;
+	pthread_t writer, *workers;
+	int i;
+
+	memset(&q, 0, sizeof(q));
+	q.opt = opt;
+	q.nr = opt->threads * 16;
+	CALLOC_ARRAY(q.slots, q.nr);
+	for (i = 0; i < q.nr; i++) {
+		strbuf_init(&q.slots[i].input, 0);
+		strbuf_init(&q.slots[i].out, 0);
+	}
+	pthread_mutex_init(&q.mutex, NULL);
+	pthread_cond_init(&q.cond, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(workers, opt->threads);
+	for (i = 0; i < opt->threads; i++)
+		if (pthread_create(&workers[i], NULL, batch_worker, &q))
+			die(_("unable to create thread"));
+	if (pthread_create(&writer, NULL, batch_writer, &q))
+		die(_("unable to create thread"));
+
+	while (strbuf_getline(&input, stdin) != EOF)
+		batch_queue_add(&q, &input, template);
+
+	pthread_mutex_lock(&q.mutex);
+	q.eof = 1;
+	pthread_cond_broadcast(&q.cond);
+	pthread_mutex_unlock(&q.mutex);
+
+	for (i = 0; i < opt->threads; i++)
+		pthread_join(workers[i], NULL);
+	pthread_join(writer, NULL);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&q.cond);
+	pthread_mutex_destroy(&q.mutex);
+	for (i = 0; i < q.nr; i++) {
+		strbuf_release(&q.slots[i].input);
+		strbuf_release(&q.slots[i].out);
+	}
+	free(q.slots);
+	free(workers);
+	strbuf_release(&input);
+}
+
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
@@ -484,6 +845,48 @@ static int batch_unordered_packed(const struct object_id *oid,
 	return batch_unordered_object(oid, data);
 }
 
+/*
+ * Read "info <object>", "contents <object>" and "flush" commands from
+ * the standard input. With --buffer, the answers are only flushed out
+ * by "flush" (or when the stdio buffer is full), so that callers can
+ * send a whole batch of commands before waiting for the answers.
+ */
+static void batch_objects_command(struct batch_options *opt,
+				  struct strbuf *output,
+				  struct expand_data *data)
+{
+	struct strbuf input = STRBUF_INIT;
+
+	while (strbuf_getline(&input, stdin) != EOF) {
+		const char *args;
+
+		if (!input.len)
+			die(_("empty command in input"));
+		if (isspace(*input.buf))
+			die(_("whitespace before command: '%s'"), input.buf);
+
+		if (!strcmp(input.buf, "flush")) {
+			if (!opt->buffer_output)
+				die(_("flush is only for --buffer mode"));
+			fflush(stdout);
+			continue;
+		}
+		if (skip_prefix(input.buf, "contents ", &args))
+			opt->print_contents = 1;
+		else if (skip_prefix(input.buf, "info ", &args))
+			opt->print_contents = 0;
+		else
+			die(_("unknown command: '%s'"), input.buf);
+
+		/* args points into our own buffer, so we may split it */
+		if (data->split_on_whitespace)
+			split_batch_input(input.buf + (args - input.buf), data);
+		batch_one_object(args, output, opt, data);
+	}
+
+	strbuf_release(&input);
+}
+
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf input = STRBUF_INIT;
@@ -518,7 +921,7 @@ static int batch_objects(struct batch_options *opt)
 	 * If we are printing out the object, then always fill in the type,
 	 * since we will want to decide whether or not to stream.
 	 */
-	if (opt->print_contents)
+	if (opt->print_contents || opt->command)
 		data.info.typep = &data.type;
 
 	if (opt->all_objects) {
@@ -566,22 +969,27 @@ static int batch_objects(struct batch_options *opt)
 	save_warning = warn_on_object_refname_ambiguity;
 	warn_on_object_refname_ambiguity = 0;
 
-	while (strbuf_getline(&input, stdin) != EOF) {
-		if (data.split_on_whitespace) {
-			/*
-			 * Split at first whitespace, tying off the beginning
-			 * of the string and saving the remainder (or NULL) in
-			 * data.rest.
-			 */
-			char *p = strpbrk(input.buf, " \t");
-			if (p) {
-				while (*p && strchr(" \t", *p))
-					*p++ = '\0';
-			}
-			data.rest = p;
-		}
+	/*
+	 * The size is needed for the "plain" header of --zlib, and by the
+	 * threaded writer to decide whether to stream.
+	 */
+	if (opt->zlib || (opt->threads > 1 && opt->print_contents))
+		data.info.sizep = &data.size;
 
-		batch_one_object(input.buf, &output, opt, &data);
+	/*
+	 * --textconv and --filters run external commands and read the
+	 * attributes, which is not safe to do from several threads.
+	 */
+	if (opt->command) {
+		batch_objects_command(opt, &output, &data);
+	} else if (HAVE_THREADS && opt->threads > 1 && !opt->cmdmode) {
+		batch_objects_threaded(opt, &data);
+	} else {
+		while (strbuf_getline(&input, stdin) != EOF) {
+			if (data.split_on_whitespace)
+				split_batch_input(input.buf, &data);
+			batch_one_object(input.buf, &output, opt, &data);
+		}
 	}
 
 	strbuf_release(&input);
@@ -592,7 +1000,7 @@ static int batch_objects(struct batch_options *opt)
 
 static const char * const cat_file_usage[] = {
 	N_("git cat-file (-t [--allow-unknown-type] | -s [--allow-unknown-type] | -e | -p | <type> | --textconv | --filters) [--path=<path>] <object>"),
-	N_("git cat-file (--batch | --batch-check) [--follow-symlinks] [--textconv | --filters]"),
+	N_("git cat-file (--batch | --batch-check | --batch-command) [--follow-symlinks] [--textconv | --filters]"),
 	NULL
 };
 
@@ -618,6 +1026,7 @@ static int batch_option_callback(const struct option *opt,
 
 	bo->enabled = 1;
 	bo->print_contents = !strcmp(opt->long_name, "batch");
+	bo->command = !strcmp(opt->long_name, "batch-command");
 	bo->format = arg;
 
 	return 0;
@@ -654,18 +1063,27 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			N_("show info about objects fed from the standard input"),
 			PARSE_OPT_OPTARG | PARSE_OPT_NONEG,
 			batch_option_callback },
+		{ OPTION_CALLBACK, 0, "batch-command", &batch, "format",
+			N_("read commands from stdin"),
+			PARSE_OPT_OPTARG | PARSE_OPT_NONEG,
+			batch_option_callback },
 		OPT_BOOL(0, "follow-symlinks", &batch.follow_symlinks,
 			 N_("follow in-tree symlinks (used with --batch or --batch-check)")),
 		OPT_BOOL(0, "batch-all-objects", &batch.all_objects,
 			 N_("show all objects with --batch or --batch-check")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order --batch-all-objects output")),
+		OPT_BOOL(0, "zlib", &batch.zlib,
+			 N_("show contents stored whole in a pack as zlib streams")),
+		OPT_INTEGER(0, "threads", &batch.threads,
+			    N_("use <n> threads to read the objects named on stdin")),
 		OPT_END()
 	};
 
 	git_config(git_cat_file_config, NULL);
 
 	batch.buffer_output = -1;
+	batch.threads = 1;
 	argc = parse_options(argc, argv, prefix, options, cat_file_usage, 0);
 
 	if (opt) {
@@ -689,9 +1107,17 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		if (batch.cmdmode && batch.all_objects)
 			die("--batch-all-objects cannot be combined with "
 			    "--textconv nor with --filters");
+		if (batch.cmdmode && batch.zlib)
+			die(_("--zlib cannot be combined with "
+			      "--textconv nor with --filters"));
+		if (batch.command && batch.all_objects)
+			die(_("--batch-all-objects cannot be combined with "
+			      "--batch-command"));
 	}
 
-	if ((batch.follow_symlinks || batch.all_objects) && !batch.enabled) {
+	if ((batch.follow_symlinks || batch.all_objects || batch.zlib ||
+	     batch.threads != 1) &&
+	    !batch.enabled) {
 		usage_with_options(cat_file_usage, options);
 	}
 
@@ -705,6 +1131,9 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		usage_with_options(cat_file_usage, options);
 	}
 
+	if (batch.threads <= 0)
+		batch.threads = online_cpus();
+
 	if (batch.buffer_output < 0)
 		batch.buffer_output = batch.all_objects;
 
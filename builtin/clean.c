@@ -18,14 +18,16 @@
 #include "color.h"
 #include "pathspec.h"
 #include "help.h"
+#include "thread-utils.h"
 
 static int force = -1; /* unset */
 static int interactive;
+static int clean_threads;
 static struct string_list del_list = STRING_LIST_INIT_DUP;
 static unsigned int colopts;
 
 static const char *const builtin_clean_usage[] = {
-	N_("git clean [-d] [-f] [-i] [-n] [-q] [-e <pattern>] [-x | -X] [--] <paths>..."),
+	N_("git clean [-d] [-f] [-i] [-n] [-q] [-e <pattern>] [-x | -X] [--threads=<n>] [--] <paths>..."),
 	NULL
 };
 
@@ -147,8 +149,106 @@ static int exclude_cb(const struct option *opt, const char *arg, int unset)
 	return 0;
 }
 
+/*
+ * Where the messages of remove_dirs() go. Without one, they are printed
+ * right away; a thread removing one subtree of a larger directory keeps
+ * them instead, for the main thread to print in the order the serial
+ * removal would have.
+ */
+struct clean_log {
+	struct strbuf out;
+	struct string_list warnings;
+	pthread_mutex_t *mutex; /* serializes is_nonbare_repository_dir() */
+};
+
+__attribute__((format (printf, 2, 3)))
+static void log_printf(struct clean_log *log, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (log)
+		strbuf_vaddf(&log->out, fmt, ap);
+	else
+		vprintf(fmt, ap);
+	va_end(ap);
+}
+
+static void log_warning_errno(struct clean_log *log, const char *fmt,
+			      const char *name)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!log) {
+		warning_errno(fmt, name);
+		return;
+	}
+	/* the same text as warning_errno() */
+	strbuf_addf(&sb, fmt, name);
+	strbuf_addf(&sb, ": %s", strerror(errno));
+	string_list_append_nodup(&log->warnings, strbuf_detach(&sb, NULL));
+}
+
+static void flush_clean_log(struct clean_log *log)
+{
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, &log->warnings)
+		warning("%s", item->string);
+	fputs(log->out.buf, stdout);
+	strbuf_release(&log->out);
+	string_list_clear(&log->warnings, 0);
+}
+
+static int is_nested_repository(struct strbuf *path, struct clean_log *log)
+{
+	int ret;
+
+	if (log)
+		pthread_mutex_lock(log->mutex);
+	ret = is_nonbare_repository_dir(path);
+	if (log)
+		pthread_mutex_unlock(log->mutex);
+	return ret;
+}
+
+/*
+ * Remove the directory "path" once all of its entries are gone, and
+ * list the entries in "dels" that were removed from a directory that
+ * has to stay.
+ */
+static int finish_remove_dir(struct strbuf *path, const char *prefix,
+			     int dry_run, int quiet, int *dir_gone,
+			     struct string_list *dels, struct clean_log *log)
+{
+	struct strbuf quoted = STRBUF_INIT;
+	int res, ret = 0;
+
+	if (*dir_gone) {
+		res = dry_run ? 0 : rmdir(path->buf);
+		if (!res)
+			*dir_gone = 1;
+		else {
+			int saved_errno = errno;
+			quote_path_relative(path->buf, prefix, &quoted);
+			errno = saved_errno;
+			log_warning_errno(log, _(msg_warn_remove_failed), quoted.buf);
+			*dir_gone = 0;
+			ret = 1;
+		}
+	}
+
+	if (!*dir_gone && !quiet) {
+		int i;
+		for (i = 0; i < dels->nr; i++)
+			log_printf(log, dry_run ?  _(msg_would_remove) : _(msg_remove), dels->items[i].string);
+	}
+	strbuf_release(&quoted);
+	return ret;
+}
+
 static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
-		int dry_run, int quiet, int *dir_gone)
+		int dry_run, int quiet, int *dir_gone, struct clean_log *log)
 {
 	DIR *dir;
 	struct strbuf quoted = STRBUF_INIT;
@@ -158,10 +258,10 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 
 	*dir_gone = 1;
 
-	if ((force_flag & REMOVE_DIR_KEEP_NESTED_GIT) && is_nonbare_repository_dir(path)) {
+	if ((force_flag & REMOVE_DIR_KEEP_NESTED_GIT) && is_nested_repository(path, log)) {
 		if (!quiet) {
 			quote_path_relative(path->buf, prefix, &quoted);
-			printf(dry_run ?  _(msg_would_skip_git_dir) : _(msg_skip_git_dir),
+			log_printf(log, dry_run ?  _(msg_would_skip_git_dir) : _(msg_skip_git_dir),
 					quoted.buf);
 		}
 
@@ -177,7 +277,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 			int saved_errno = errno;
 			quote_path_relative(path->buf, prefix, &quoted);
 			errno = saved_errno;
-			warning_errno(_(msg_warn_remove_failed), quoted.buf);
+			log_warning_errno(log, _(msg_warn_remove_failed), quoted.buf);
 			*dir_gone = 0;
 		}
 		ret = res;
@@ -195,9 +295,9 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 		strbuf_setlen(path, len);
 		strbuf_addstr(path, e->d_name);
 		if (lstat(path->buf, &st))
-			warning_errno(_(msg_warn_lstat_failed), path->buf);
+			log_warning_errno(log, _(msg_warn_lstat_failed), path->buf);
 		else if (S_ISDIR(st.st_mode)) {
-			if (remove_dirs(path, prefix, force_flag, dry_run, quiet, &gone))
+			if (remove_dirs(path, prefix, force_flag, dry_run, quiet, &gone, log))
 				ret = 1;
 			if (gone) {
 				quote_path_relative(path->buf, prefix, &quoted);
@@ -214,7 +314,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 				int saved_errno = errno;
 				quote_path_relative(path->buf, prefix, &quoted);
 				errno = saved_errno;
-				warning_errno(_(msg_warn_remove_failed), quoted.buf);
+				log_warning_errno(log, _(msg_warn_remove_failed), quoted.buf);
 				*dir_gone = 0;
 				ret = 1;
 			}
@@ -230,27 +330,200 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 
 	strbuf_setlen(path, original_len);
 
-	if (*dir_gone) {
-		res = dry_run ? 0 : rmdir(path->buf);
-		if (!res)
-			*dir_gone = 1;
-		else {
+	if (finish_remove_dir(path, prefix, dry_run, quiet, dir_gone, &dels, log))
+		ret = 1;
+out:
+	strbuf_release(&quoted);
+	string_list_clear(&dels, 0);
+	return ret;
+}
+
+/*
+ * The subdirectories of one directory are independent of each other,
+ * so remove_dirs_threaded() hands them out to several threads. Each of
+ * them removes its subtree the serial way, and keeps its messages in
+ * its own clean_log.
+ */
+struct clean_subdir {
+	const char *name;
+	int is_dir;
+	int gone;
+	int ret;
+	struct clean_log log;
+};
+
+struct subdir_removal {
+	char *dir; /* with a trailing slash */
+	const char *prefix;
+	int force_flag, dry_run, quiet;
+	struct clean_subdir *entries;
+	int nr;
+	int next; /* protected by "mutex" */
+	pthread_mutex_t mutex;
+	pthread_mutex_t nested_git_mutex;
+};
+
+static void *remove_subdirs_thread(void *data)
+{
+	struct subdir_removal *ct = data;
+	struct strbuf path = STRBUF_INIT;
+
+	for (;;) {
+		struct clean_subdir *entry;
+		int i;
+
+		pthread_mutex_lock(&ct->mutex);
+		while (ct->next < ct->nr && !ct->entries[ct->next].is_dir)
+			ct->next++;
+		i = ct->next++;
+		pthread_mutex_unlock(&ct->mutex);
+		if (i >= ct->nr)
+			break;
+
+		entry = &ct->entries[i];
+		strbuf_reset(&path);
+		strbuf_addstr(&path, ct->dir);
+		strbuf_addstr(&path, entry->name);
+		entry->ret = remove_dirs(&path, ct->prefix, ct->force_flag,
+					 ct->dry_run, ct->quiet, &entry->gone,
+					 &entry->log);
+	}
+	strbuf_release(&path);
+	return NULL;
+}
+
+/*
+ * Same as remove_dirs(), but remove the subdirectories of "path" in
+ * "nr_threads" threads. Return -1 before touching anything when there
+ * are not enough subdirectories to share out.
+ */
+static int remove_dirs_threaded(struct strbuf *path, const char *prefix,
+				int force_flag, int dry_run, int quiet,
+				int *dir_gone, int nr_threads)
+{
+	struct subdir_removal ct;
+	struct strbuf quoted = STRBUF_INIT;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list dels = STRING_LIST_INIT_DUP;
+	pthread_t *threads;
+	struct dirent *e;
+	DIR *dir;
+	int i, nr_dirs = 0, lstat_failed = 0, ret = 0;
+	size_t original_len = path->len, len;
+
+	if (!HAVE_THREADS || nr_threads < 2 ||
+	    ((force_flag & REMOVE_DIR_KEEP_NESTED_GIT) && is_nonbare_repository_dir(path)))
+		return -1;
+	dir = opendir(path->buf);
+	if (!dir)
+		return -1;
+	while ((e = readdir(dir)) != NULL)
+		if (!is_dot_or_dotdot(e->d_name))
+			string_list_append(&names, e->d_name);
+	closedir(dir);
+
+	memset(&ct, 0, sizeof(ct));
+	CALLOC_ARRAY(ct.entries, names.nr);
+	strbuf_complete(path, '/');
+	len = path->len;
+	for (i = 0; i < names.nr; i++) {
+		struct clean_subdir *entry = &ct.entries[ct.nr];
+		struct stat st;
+
+		strbuf_setlen(path, len);
+		strbuf_addstr(path, names.items[i].string);
+		entry->name = names.items[i].string;
+		strbuf_init(&entry->log.out, 0);
+		string_list_init(&entry->log.warnings, 1);
+		entry->log.mutex = &ct.nested_git_mutex;
+		ct.nr++;
+		if (lstat(path->buf, &st)) {
+			log_warning_errno(&entry->log, _(msg_warn_lstat_failed), path->buf);
+			lstat_failed = 1;
+			break;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			entry->is_dir = 1;
+			nr_dirs++;
+		}
+	}
+
+	if (nr_dirs < 2) {
+		for (i = 0; i < ct.nr; i++) {
+			strbuf_release(&ct.entries[i].log.out);
+			string_list_clear(&ct.entries[i].log.warnings, 0);
+		}
+		free(ct.entries);
+		string_list_clear(&names, 0);
+		strbuf_setlen(path, original_len);
+		return -1;
+	}
+
+	ct.dir = xmemdupz(path->buf, len);
+	ct.prefix = prefix;
+	ct.force_flag = force_flag;
+	ct.dry_run = dry_run;
+	ct.quiet = quiet;
+	pthread_mutex_init(&ct.mutex, NULL);
+	pthread_mutex_init(&ct.nested_git_mutex, NULL);
+	if (nr_threads > nr_dirs)
+		nr_threads = nr_dirs;
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, remove_subdirs_thread, &ct))
+			die(_("unable to create thread"));
+
+	/* the files are ours, while the threads take care of the rest */
+	for (i = 0; i < ct.nr; i++) {
+		struct clean_subdir *entry = &ct.entries[i];
+
+		if (entry->is_dir || (lstat_failed && i == ct.nr - 1))
+			continue;
+		strbuf_setlen(path, len);
+		strbuf_addstr(path, entry->name);
+		if (dry_run || !unlink(path->buf)) {
+			entry->gone = 1;
+		} else {
 			int saved_errno = errno;
 			quote_path_relative(path->buf, prefix, &quoted);
 			errno = saved_errno;
-			warning_errno(_(msg_warn_remove_failed), quoted.buf);
-			*dir_gone = 0;
-			ret = 1;
+			log_warning_errno(&entry->log, _(msg_warn_remove_failed), quoted.buf);
+			entry->ret = 1;
 		}
 	}
 
-	if (!*dir_gone && !quiet) {
-		int i;
-		for (i = 0; i < dels.nr; i++)
-			printf(dry_run ?  _(msg_would_remove) : _(msg_remove), dels.items[i].string);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&ct.mutex);
+	pthread_mutex_destroy(&ct.nested_git_mutex);
+
+	*dir_gone = !lstat_failed;
+	ret = lstat_failed;
+	for (i = 0; i < ct.nr; i++) {
+		struct clean_subdir *entry = &ct.entries[i];
+
+		flush_clean_log(&entry->log);
+		if (entry->ret)
+			ret = 1;
+		if (entry->gone) {
+			strbuf_setlen(path, len);
+			strbuf_addstr(path, entry->name);
+			quote_path_relative(path->buf, prefix, &quoted);
+			string_list_append(&dels, quoted.buf);
+		} else {
+			*dir_gone = 0;
+		}
 	}
-out:
+	strbuf_setlen(path, original_len);
+
+	if (finish_remove_dir(path, prefix, dry_run, quiet, dir_gone, &dels, NULL))
+		ret = 1;
+
+	free(ct.dir);
+	free(ct.entries);
 	strbuf_release(&quoted);
+	string_list_clear(&names, 0);
 	string_list_clear(&dels, 0);
 	return ret;
 }
@@ -914,6 +1187,8 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 		{ OPTION_CALLBACK, 'e', "exclude", &exclude_list, N_("pattern"),
 		  N_("add <pattern> to ignore rules"), PARSE_OPT_NONEG, exclude_cb },
 		OPT_BOOL('x', NULL, &ignored, N_("remove ignored files, too")),
+		OPT_INTEGER(0, "threads", &clean_threads,
+			    N_("remove directories with <n> threads")),
 		OPT_BOOL('X', NULL, &ignored_only,
 				N_("remove only ignored files")),
 		OPT_END()
@@ -935,6 +1210,11 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 	if (ignored && ignored_only)
 		die(_("-x and -X cannot be used together"));
 
+	if (clean_threads <= 0)
+		clean_threads = online_cpus();
+	if (!HAVE_THREADS)
+		clean_threads = 1;
+
 	if (!interactive && !dry_run && !force) {
 		if (config_set)
 			die(_("clean.requireForce set to true and neither -i, -n, nor -f given; "
@@ -1021,7 +1301,12 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 			continue;
 
 		if (S_ISDIR(st.st_mode)) {
-			if (remove_dirs(&abs_path, prefix, rm_flags, dry_run, quiet, &gone))
+			res = remove_dirs_threaded(&abs_path, prefix, rm_flags,
+						   dry_run, quiet, &gone, clean_threads);
+			if (res < 0)
+				res = remove_dirs(&abs_path, prefix, rm_flags,
+						  dry_run, quiet, &gone, NULL);
+			if (res)
 				errors++;
 			if (gone && !quiet) {
 				qname = quote_path_relative(item->string, NULL, &buf);
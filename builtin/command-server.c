@@ -0,0 +1,589 @@
+#include "builtin.h"
+#include "config.h"
+#include "dir.h"
+#include "command-server.h"
+#include "commit-graph.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "parse-options.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+
+static const char * const command_server_usage[] = {
+	"git command-server start",
+	"git command-server run",
+	"git command-server stop",
+	"git command-server status",
+	NULL
+};
+
+#ifdef NO_UNIX_SOCKETS
+int cmd_command_server(int argc, const char **argv, const char *prefix)
+{
+	die(_("command-server is not supported on this platform"));
+}
+#else
+
+static struct tempfile *socket_file;
+
+/*
+ * A file or directory the loaded state was read from. "racy" is set
+ * when it was modified in the second we looked at it, as it could then
+ * be modified again without its stat data telling.
+ */
+struct watched_path {
+	char *path;
+	int exists;
+	int racy;
+	struct stat_data sd;
+};
+
+static void watch_update(struct watched_path *w)
+{
+	struct stat st;
+
+	w->exists = !stat(w->path, &st);
+	w->racy = 0;
+	if (w->exists) {
+		fill_stat_data(&w->sd, &st);
+		w->racy = w->sd.sd_mtime.sec >= time(NULL);
+	}
+}
+
+static int watch_changed(struct watched_path *w)
+{
+	struct stat st;
+
+	if (stat(w->path, &st))
+		return w->exists;
+	return !w->exists || w->racy || match_stat_data(&w->sd, &st);
+}
+
+static void watch_init(struct watched_path *w, char *path)
+{
+	w->path = path;
+	watch_update(w);
+}
+
+/*
+ * The state shared with the commands: the index, the packs with their
+ * .idx files, and the commit-graph of the main object directory. The
+ * commit-graph is not attached to the repository; whether it may be
+ * used depends on the refs, which every command has to look at anew.
+ */
+static struct watched_path config_paths[2], alternates_path;
+static struct watched_path index_file_path, pack_dir, graph_paths[2];
+static struct commit_graph *warm_graph;
+static char *server_gitdir;
+
+static void load_index(struct repository *r)
+{
+	discard_index(r->index);
+	watch_update(&index_file_path);
+	repo_read_index(r);
+}
+
+static void load_packs(struct repository *r)
+{
+	struct packed_git *p;
+
+	watch_update(&pack_dir);
+	reprepare_packed_git(r);
+	for (p = get_all_packs(r); p; p = p->next)
+		open_pack_index(p);
+}
+
+static void load_commit_graph(struct repository *r)
+{
+	static char *obj_dir;
+	struct commit_graph *g;
+
+	while (warm_graph) {
+		g = warm_graph->base_graph;
+		free_commit_graph(warm_graph);
+		warm_graph = g;
+	}
+	watch_update(&graph_paths[0]);
+	watch_update(&graph_paths[1]);
+
+	/*
+	 * The graph remembers its object directory by pointer, and the
+	 * commands set up the repository again, freeing the one we have.
+	 */
+	if (!obj_dir)
+		obj_dir = xstrdup(r->objects->odb->path);
+	warm_graph = read_commit_graph_one(r, obj_dir);
+	for (g = warm_graph; g; g = g->base_graph)
+		g->obj_dir = obj_dir;
+}
+
+/*
+ * A change to these makes the server exit, so wait for them to be
+ * no longer racy rather than exit on the first request.
+ */
+static void watch_init_settled(struct watched_path *w, char *path)
+{
+	watch_init(w, path);
+	while (w->racy) {
+		sleep_millisec(100);
+		watch_update(w);
+	}
+}
+
+static void init_state(struct repository *r)
+{
+	watch_init_settled(&config_paths[0], git_pathdup("config"));
+	watch_init_settled(&config_paths[1], git_pathdup("config.worktree"));
+	watch_init_settled(&alternates_path,
+			   xstrfmt("%s/info/alternates",
+				   r->objects->odb->path));
+	watch_init(&index_file_path, xstrdup(r->index_file));
+	watch_init(&pack_dir, xstrfmt("%s/pack", r->objects->odb->path));
+	watch_init(&graph_paths[0],
+		   get_commit_graph_filename(r->objects->odb->path));
+	watch_init(&graph_paths[1],
+		   xstrfmt("%s/info/commit-graphs/commit-graph-chain",
+			   r->objects->odb->path));
+
+	load_index(r);
+	load_packs(r);
+	load_commit_graph(r);
+}
+
+/*
+ * Bring the state up to date before starting a command. Return -1
+ * when the repository changed in a way that needs a new server.
+ */
+static int refresh_state(struct repository *r)
+{
+	if (watch_changed(&config_paths[0]) ||
+	    watch_changed(&config_paths[1]) ||
+	    watch_changed(&alternates_path))
+		return -1;
+	if (watch_changed(&index_file_path))
+		load_index(r);
+	if (watch_changed(&pack_dir))
+		load_packs(r);
+	if (watch_changed(&graph_paths[0]) || watch_changed(&graph_paths[1]))
+		load_commit_graph(r);
+	return 0;
+}
+
+struct running_command {
+	pid_t pid;
+	int fd;
+};
+
+static struct running_command *running;
+static int running_nr, running_alloc;
+static int listen_fd = -1;
+static int child_pipe[2] = { -1, -1 };
+
+static void child_exited(int signo)
+{
+	int saved_errno = errno;
+
+	if (write(child_pipe[1], "", 1) < 0)
+		; /* the pipe is full, we will wake up anyway */
+	errno = saved_errno;
+}
+
+/* Tell the clients of the commands that are done how they ended. */
+static void reap_commands(void)
+{
+	pid_t pid;
+	int status, i;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < running_nr; i++)
+			if (running[i].pid == pid)
+				break;
+		if (i == running_nr)
+			continue;
+		if (WIFSIGNALED(status))
+			packet_write_fmt_gently(running[i].fd, "signal %d\n",
+						WTERMSIG(status));
+		else
+			packet_write_fmt_gently(running[i].fd, "exit %d\n",
+						WEXITSTATUS(status));
+		close(running[i].fd);
+		running[i] = running[--running_nr];
+	}
+}
+
+static void refuse(int fd, const char *reason)
+{
+	packet_write_fmt_gently(fd, "refused %s\n", reason);
+	exit(0);
+}
+
+static void replace_environment(struct string_list *env)
+{
+	extern char **environ;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	char **e;
+
+	for (e = environ; e && *e; e++) {
+		const char *eq = strchr(*e, '=');
+
+		if (eq)
+			string_list_append_nodup(&names,
+						 xmemdupz(*e, eq - *e));
+	}
+	for_each_string_list_item(item, &names)
+		unsetenv(item->string);
+	string_list_clear(&names, 0);
+
+	for_each_string_list_item(item, env) {
+		char *eq = strchr(item->string, '=');
+
+		if (!eq)
+			continue;
+		*eq = '\0';
+		setenv(item->string, eq + 1, 1);
+		*eq = '=';
+	}
+}
+
+static int serving_repository(void)
+{
+	struct strbuf commondir = STRBUF_INIT, gitdir = STRBUF_INIT;
+	struct strbuf real = STRBUF_INIT;
+	int ret = 0;
+
+	if (!discover_git_directory(&commondir, &gitdir) &&
+	    strbuf_realpath(&real, gitdir.buf, 0))
+		ret = !fspathcmp(real.buf, server_gitdir);
+	strbuf_release(&commondir);
+	strbuf_release(&gitdir);
+	strbuf_release(&real);
+	return ret;
+}
+
+static void use_client_fds(int *client_fds, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (client_fds[i] == i)
+			continue;
+		if (dup2(client_fds[i], i) < 0)
+			die_errno("dup2");
+		close(client_fds[i]);
+	}
+}
+
+static void answer_control_request(int fd, int argc, const char **argv)
+{
+	pid_t server = getppid();
+	int i;
+
+	packet_write_fmt_gently(fd, "started\n");
+	if (argc == 2 && !strcmp(argv[1], "status")) {
+		printf(_("command server is serving '%s'\n"), server_gitdir);
+		exit(0);
+	}
+	if (argc != 2 || strcmp(argv[1], "stop"))
+		exit(129);
+
+	/*
+	 * The server removes its socket when it is killed; let the
+	 * client know only once that is done, so that it can start
+	 * another one right away.
+	 */
+	kill(server, SIGTERM);
+	for (i = 0; i < 5000 && getppid() == server; i++)
+		sleep_millisec(1);
+	packet_write_fmt_gently(fd, "exit 0\n");
+	exit(0);
+}
+
+/* Run in a process forked for one client; never returns. */
+static void run_command_for(struct repository *r, int fd)
+{
+	struct string_list env = STRING_LIST_INIT_DUP;
+	struct argv_array args = ARGV_ARRAY_INIT;
+	char *cwd = NULL;
+	const char *arg;
+	char *line;
+	int client_fds[3];
+	uid_t peer;
+	int i;
+
+	close(listen_fd);
+	close(child_pipe[0]);
+	close(child_pipe[1]);
+	for (i = 0; i < running_nr; i++)
+		close(running[i].fd);
+	sigchain_pop(SIGCHLD);
+	sigchain_pop(SIGPIPE);
+
+	/*
+	 * The command runs as us, with the environment (and so the
+	 * configuration) the client gives; only serve ourselves.
+	 */
+	if (unix_stream_peer_uid(fd, &peer) < 0 || peer != geteuid())
+		refuse(fd, "not the user running the server");
+
+	if (unix_stream_recv_fds(fd, client_fds, ARRAY_SIZE(client_fds)) < 0)
+		exit(128);
+	while ((line = packet_read_line(fd, NULL))) {
+		if (skip_prefix(line, "cwd ", &arg))
+			cwd = xstrdup(arg);
+		else if (skip_prefix(line, "env ", &arg))
+			string_list_append(&env, arg);
+		else if (skip_prefix(line, "arg ", &arg))
+			argv_array_push(&args, arg);
+	}
+	if (!cwd || !args.argc)
+		refuse(fd, "incomplete request");
+
+	if (!strcmp(args.argv[0], "command-server")) {
+		use_client_fds(client_fds, ARRAY_SIZE(client_fds));
+		answer_control_request(fd, args.argc, args.argv);
+	}
+	/* the tests still need to be able to stop us */
+	if (git_env_bool("GIT_TEST_COMMAND_SERVER_ASSUME_OTHER_PEER", 0))
+		refuse(fd, "not the user running the server");
+	if (!is_served_builtin(args.argv[0]))
+		refuse(fd, "not a command we serve");
+
+	replace_environment(&env);
+	/* the client may read other config files, e.g. with another $HOME */
+	git_config_clear();
+	if (chdir(cwd))
+		refuse(fd, "cannot change to the working directory");
+	if (!serving_repository())
+		refuse(fd, "not our repository");
+
+	r->index->fsmonitor_has_run_once = 0;
+	r->objects->commit_graph = warm_graph;
+
+	if (packet_write_fmt_gently(fd, "started\n"))
+		exit(128);
+	use_client_fds(client_fds, ARRAY_SIZE(client_fds));
+	close(fd);
+
+	exit(run_served_builtin(args.argc, args.argv));
+}
+
+static int serve(struct repository *r)
+{
+	for (;;) {
+		struct pollfd pfd[2];
+		pid_t pid;
+		int client;
+
+		pfd[0].fd = listen_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = child_pipe[0];
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return error_errno("poll failed");
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			char buf[64];
+
+			while (read(child_pipe[0], buf, sizeof(buf)) > 0)
+				; /* drain */
+			reap_commands();
+		}
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+		client = accept(listen_fd, NULL, NULL);
+		if (client < 0) {
+			warning_errno("accept failed");
+			continue;
+		}
+		if (refresh_state(r) < 0) {
+			/* the client sees EOF and runs the command itself */
+			close(client);
+			return 0;
+		}
+
+		fflush(NULL);
+		pid = fork();
+		if (pid < 0) {
+			warning_errno("fork failed");
+			close(client);
+			continue;
+		}
+		if (!pid)
+			run_command_for(r, client);
+		ALLOC_GROW(running, running_nr + 1, running_alloc);
+		running[running_nr].pid = pid;
+		running[running_nr].fd = client;
+		running_nr++;
+	}
+}
+
+static int is_running(const char *socket_path)
+{
+	const char *argv[] = { "command-server", "status" };
+	int fd = open("/dev/null", O_WRONLY);
+	int saved_stdout = dup(1);
+	int status = -1, ret;
+
+	/* the answer would go to our stdout */
+	dup2(fd, 1);
+	close(fd);
+	ret = !command_server_send(socket_path, 2, argv, &status) && !status;
+	dup2(saved_stdout, 1);
+	close(saved_stdout);
+	return ret;
+}
+
+static int run_server(struct repository *r, const char *socket_path,
+		      int detach)
+{
+	struct strbuf gitdir = STRBUF_INIT;
+	mode_t old_umask;
+	int ret;
+
+	if (is_running(socket_path))
+		die(_("command server is already running for '%s'"),
+		    get_git_dir());
+
+	/*
+	 * The paths of the packs are made from that of the repository;
+	 * they have to stay valid from whatever directory a command
+	 * runs in.
+	 */
+	strbuf_realpath(&gitdir, get_git_dir(), 1);
+	server_gitdir = strbuf_detach(&gitdir, NULL);
+	set_git_dir(server_gitdir);
+	init_state(r);
+
+	if (pipe(child_pipe) < 0)
+		die_errno(_("unable to create pipe"));
+	if (fcntl(child_pipe[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(child_pipe[1], F_SETFL, O_NONBLOCK) < 0)
+		die_errno(_("unable to set up pipe"));
+
+	/* in a shared repository, others may not even connect */
+	old_umask = umask(077);
+	listen_fd = unix_stream_listen(socket_path);
+	umask(old_umask);
+	if (listen_fd < 0)
+		die_errno(_("unable to bind to '%s'"), socket_path);
+	socket_file = register_tempfile(socket_path);
+
+	/*
+	 * After registering the socket, which installs handlers that
+	 * remove it: a client that goes away must not take it along.
+	 */
+	sigchain_push(SIGCHLD, child_exited);
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	if (detach) {
+		int null_fd = open("/dev/null", O_RDWR);
+
+		printf("ok\n");
+		fflush(stdout);
+		/* the commands find the client's fds in their place */
+		if (null_fd < 0)
+			die_errno("unable to open /dev/null");
+		dup2(null_fd, 0);
+		dup2(null_fd, 1);
+		dup2(null_fd, 2);
+		close(null_fd);
+	}
+
+	ret = serve(r);
+
+	delete_tempfile(&socket_file);
+	close(listen_fd);
+	return ret;
+}
+
+static int start_server(const char *socket_path)
+{
+	struct child_process server = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r;
+
+	if (is_running(socket_path))
+		die(_("command server is already running for '%s'"),
+		    get_git_dir());
+
+	argv_array_pushl(&server.args, "git", "command-server", "run",
+			 "--detach", NULL);
+	server.no_stdin = 1;
+	server.out = -1;
+
+	if (start_command(&server))
+		die_errno(_("unable to start command server"));
+	r = read_in_full(server.out, buf, sizeof(buf));
+	if (r < 0)
+		die_errno(_("unable to read result code from command server"));
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		die(_("command server did not start: %.*s"), r, buf);
+	close(server.out);
+	return 0;
+}
+
+static int stop_server(const char *socket_path)
+{
+	const char *argv[] = { "command-server", "stop" };
+	int status;
+
+	if (command_server_send(socket_path, 2, argv, &status) < 0)
+		return error(_("command server is not running"));
+	return status;
+}
+
+static int server_status(const char *socket_path)
+{
+	const char *argv[] = { "command-server", "status" };
+	int status;
+
+	if (command_server_send(socket_path, 2, argv, &status) < 0) {
+		printf(_("command server is not running for '%s'\n"),
+		       get_git_dir());
+		return 1;
+	}
+	return status;
+}
+
+int cmd_command_server(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	char *socket_path;
+	int detach = 0, ret;
+	struct option options[] = {
+		OPT_HIDDEN_BOOL(0, "detach", &detach,
+				N_("report readiness on stdout and close it")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     command_server_usage, 0);
+	if (argc != 1)
+		usage_with_options(command_server_usage, options);
+	subcmd = argv[0];
+
+	socket_path = command_server_socket_path();
+
+	if (!strcmp(subcmd, "start"))
+		ret = start_server(socket_path);
+	else if (!strcmp(subcmd, "run"))
+		ret = run_server(the_repository, socket_path, detach);
+	else if (!strcmp(subcmd, "stop"))
+		ret = stop_server(socket_path);
+	else if (!strcmp(subcmd, "status"))
+		ret = server_status(socket_path);
+	else
+		usage_with_options(command_server_usage, options);
+
+	free(socket_path);
+	return !!ret;
+}
+#endif
@@ -3,6 +3,7 @@
 #include "config.h"
 #include "lockfile.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "tag.h"
 #include "blob.h"
 #include "refs.h"
@@ -332,8 +333,11 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 		init_commit_names(&commit_names);
 		n = hashmap_iter_first(&names, &iter);
 		for (; n; n = hashmap_iter_next(&iter)) {
-			c = lookup_commit_reference_gently(the_repository,
-							   &n->peeled, 1);
+			/* most tags are of commits in the commit-graph */
+			c = lookup_commit_in_graph(the_repository, &n->peeled);
+			if (!c)
+				c = lookup_commit_reference_gently(the_repository,
+								   &n->peeled, 1);
 			if (c)
 				*commit_names_at(&commit_names, c) = n;
 		}
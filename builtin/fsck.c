@@ -21,6 +21,9 @@
 #include "object-store.h"
 #include "run-command.h"
 #include "worktree.h"
+#include "thread-utils.h"
+#include "commit-graph.h"
+#include "pack-bitmap.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -44,6 +47,11 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int fsck_threads;
+static int trust_indexes;
+/* with --trust-indexes, the objects known to be reachable from a bitmap */
+static struct bitmap_index *bitmap_git;
+static struct bitmap *bitmap_reached;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -192,6 +200,11 @@ static int mark_object(struct object *obj, int type, void *data, struct fsck_opt
 		return 1;
 	}
 
+	if (bitmap_reached &&
+	    (bitmap_reaches_oid(bitmap_git, bitmap_reached, &obj->oid) ||
+	     !bitmap_add_stored(bitmap_git, bitmap_reached, &obj->oid)))
+		return 0; /* see mark_bitmap_reachable() */
+
 	add_object_array(obj, NULL, &pending);
 	return 0;
 }
@@ -201,6 +214,54 @@ static void mark_object_reachable(struct object *obj)
 	mark_object(obj, OBJ_ANY, NULL, NULL);
 }
 
+static void mark_one_bitmap_reachable(const struct object_id *oid, void *data)
+{
+	struct object *obj = lookup_object(the_repository, oid);
+
+	if (obj)
+		obj->flags |= REACHABLE;
+}
+
+/*
+ * With --trust-indexes, the traversal does not descend into the
+ * commits that have a bitmap, nor into the objects they reach: those
+ * are all in the bitmapped pack, so they are neither missing nor have
+ * missing links. Mark them as reachable once the traversal is over.
+ */
+static void mark_bitmap_reachable(void)
+{
+	if (!bitmap_reached)
+		return;
+	bitmap_for_each_object(bitmap_git, bitmap_reached,
+			       mark_one_bitmap_reachable, NULL);
+	bitmap_free(bitmap_reached);
+	bitmap_reached = NULL;
+	free_bitmap_index(bitmap_git);
+	bitmap_git = NULL;
+}
+
+/*
+ * Check the checksums of the commit-graph and of the reachability
+ * bitmap once, so that the connectivity check can rely on them rather
+ * than parse every commit and tree; see --trust-indexes.
+ */
+static void prepare_trusted_indexes(void)
+{
+	if (verify_commit_graph_checksums(the_repository) < 0)
+		errors_found |= ERROR_COMMIT_GRAPH;
+
+	bitmap_git = prepare_bitmap_git(the_repository);
+	if (!bitmap_git)
+		return;
+	if (bitmap_verify_checksum(bitmap_git)) {
+		errors_found |= ERROR_PACK;
+		free_bitmap_index(bitmap_git);
+		bitmap_git = NULL;
+		return;
+	}
+	bitmap_reached = bitmap_new();
+}
+
 static int traverse_one_object(struct object *obj)
 {
 	int result = fsck_walk(obj, obj, &fsck_walk_options);
@@ -388,6 +449,7 @@ static void check_connectivity(void)
 
 	/* Traverse the pending reachable objects */
 	traverse_reachable();
+	mark_bitmap_reachable();
 
 	/*
 	 * With --connectivity-only, we won't have actually opened and marked
@@ -621,21 +683,13 @@ static void get_default_heads(void)
 	}
 }
 
-static int fsck_loose(const struct object_id *oid, const char *path, void *data)
+static void fsck_loose_contents(const struct object_id *oid, const char *path,
+				enum object_type type, unsigned long size,
+				void *contents)
 {
 	struct object *obj;
-	enum object_type type;
-	unsigned long size;
-	void *contents;
 	int eaten;
 
-	if (read_loose_object(path, oid, &type, &size, &contents) < 0) {
-		errors_found |= ERROR_OBJECT;
-		error(_("%s: object corrupt or missing: %s"),
-		      oid_to_hex(oid), path);
-		return 0; /* keep checking other objects */
-	}
-
 	if (!contents && type != OBJ_BLOB)
 		BUG("read_loose_object streamed a non-blob");
 
@@ -648,7 +702,7 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 		      oid_to_hex(oid), path);
 		if (!eaten)
 			free(contents);
-		return 0; /* keep checking other objects */
+		return; /* keep checking other objects */
 	}
 
 	obj->flags &= ~(REACHABLE | SEEN);
@@ -658,7 +712,108 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 
 	if (!eaten)
 		free(contents);
-	return 0; /* keep checking other objects, even if we saw an error */
+}
+
+/*
+ * The loose objects of each fan-out directory are collected, then read
+ * and hashed by several threads; parsing and checking the objects is
+ * done under a mutex, as fsck_obj() is not thread-safe.
+ */
+struct loose_entry {
+	struct object_id oid;
+	char *path;
+};
+
+struct loose_batch {
+	struct loose_entry *entries;
+	int nr, alloc;
+	struct progress *progress;
+
+	pthread_mutex_t mutex; /* protects the fields below */
+	int next;
+};
+
+static void fsck_loose_entry(struct loose_batch *batch, struct loose_entry *e,
+			     int threaded)
+{
+	enum object_type type;
+	unsigned long size;
+	void *contents;
+	int ret;
+
+	ret = read_loose_object(e->path, &e->oid, &type, &size, &contents);
+
+	if (threaded)
+		pthread_mutex_lock(&batch->mutex);
+	if (ret < 0) {
+		errors_found |= ERROR_OBJECT;
+		error(_("%s: object corrupt or missing: %s"),
+		      oid_to_hex(&e->oid), e->path);
+	} else {
+		fsck_loose_contents(&e->oid, e->path, type, size, contents);
+	}
+	if (threaded)
+		pthread_mutex_unlock(&batch->mutex);
+}
+
+static void *fsck_loose_thread(void *data)
+{
+	struct loose_batch *batch = data;
+
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&batch->mutex);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->mutex);
+		if (i >= batch->nr)
+			break;
+		fsck_loose_entry(batch, &batch->entries[i], 1);
+	}
+	return NULL;
+}
+
+static void fsck_loose_batch(struct loose_batch *batch)
+{
+	int i, nr_threads = fsck_threads;
+
+	if (!HAVE_THREADS || batch->nr < 2 * nr_threads)
+		nr_threads = 1;
+
+	if (nr_threads == 1) {
+		for (i = 0; i < batch->nr; i++)
+			fsck_loose_entry(batch, &batch->entries[i], 0);
+	} else {
+		pthread_t *threads;
+
+		ALLOC_ARRAY(threads, nr_threads);
+		pthread_mutex_init(&batch->mutex, NULL);
+		batch->next = 0;
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL,
+					   fsck_loose_thread, batch))
+				die(_("unable to create thread"));
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&batch->mutex);
+		free(threads);
+	}
+
+	for (i = 0; i < batch->nr; i++)
+		free(batch->entries[i].path);
+	batch->nr = 0;
+}
+
+static int fsck_loose(const struct object_id *oid, const char *path, void *data)
+{
+	struct loose_batch *batch = data;
+	struct loose_entry *e;
+
+	ALLOC_GROW(batch->entries, batch->nr + 1, batch->alloc);
+	e = &batch->entries[batch->nr++];
+	oidcpy(&e->oid, oid);
+	e->path = xstrdup(path);
+	return 0;
 }
 
 static int fsck_cruft(const char *basename, const char *path, void *data)
@@ -668,26 +823,31 @@ static int fsck_cruft(const char *basename, const char *path, void *data)
 	return 0;
 }
 
-static int fsck_subdir(unsigned int nr, const char *path, void *progress)
+static int fsck_subdir(unsigned int nr, const char *path, void *data)
 {
-	display_progress(progress, nr + 1);
+	struct loose_batch *batch = data;
+
+	fsck_loose_batch(batch);
+	display_progress(batch->progress, nr + 1);
 	return 0;
 }
 
 static void fsck_object_dir(const char *path)
 {
-	struct progress *progress = NULL;
+	struct loose_batch batch;
 
 	if (verbose)
 		fprintf_ln(stderr, _("Checking object directory"));
 
+	memset(&batch, 0, sizeof(batch));
 	if (show_progress)
-		progress = start_progress(_("Checking object directories"), 256);
+		batch.progress = start_progress(_("Checking object directories"), 256);
 
 	for_each_loose_file_in_objdir(path, fsck_loose, fsck_cruft, fsck_subdir,
-				      progress);
-	display_progress(progress, 256);
-	stop_progress(&progress);
+				      &batch);
+	display_progress(batch.progress, 256);
+	stop_progress(&batch.progress);
+	free(batch.entries);
 }
 
 static int fsck_head_link(const char *head_ref_name,
@@ -797,6 +957,9 @@ static struct option fsck_opts[] = {
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
+	OPT_INTEGER(0, "threads", &fsck_threads, N_("use <n> threads to check objects")),
+	OPT_BOOL(0, "trust-indexes", &trust_indexes,
+		 N_("check connectivity with the commit-graph and bitmaps after checking their checksums")),
 	OPT_END(),
 };
 
@@ -824,6 +987,12 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	if (verbose)
 		show_progress = 0;
 
+	if (fsck_threads <= 0)
+		fsck_threads = online_cpus();
+	/* keep the output of --verbose in order */
+	if (verbose)
+		fsck_threads = 1;
+
 	if (write_lost_and_found) {
 		check_full = 1;
 		include_reflogs = 0;
@@ -835,6 +1004,9 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	git_config(fsck_config, NULL);
 
+	if (trust_indexes)
+		prepare_trusted_indexes();
+
 	if (connectivity_only) {
 		for_each_loose_object(mark_loose_for_connectivity, NULL, 0);
 		for_each_packed_object(mark_packed_for_connectivity, NULL, 0);
@@ -863,7 +1035,8 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count,
+						fsck_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -940,9 +1113,11 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	check_connectivity();
 
-	if (!git_config_get_bool("core.commitgraph", &i) && i) {
+	if (!trust_indexes &&
+	    !git_config_get_bool("core.commitgraph", &i) && i) {
 		struct child_process commit_graph_verify = CHILD_PROCESS_INIT;
-		const char *verify_argv[] = { "commit-graph", "verify", NULL, NULL, NULL };
+		const char *verify_argv[] = { "commit-graph", "verify", NULL, NULL, NULL, NULL };
+		char *threads_arg = xstrfmt("--threads=%d", fsck_threads);
 
 		prepare_alt_odb(the_repository);
 		for (odb = the_repository->objects->odb; odb; odb = odb->next) {
@@ -951,14 +1126,17 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 			commit_graph_verify.git_cmd = 1;
 			verify_argv[2] = "--object-dir";
 			verify_argv[3] = odb->path;
+			verify_argv[4] = threads_arg;
 			if (run_command(&commit_graph_verify))
 				errors_found |= ERROR_COMMIT_GRAPH;
 		}
+		free(threads_arg);
 	}
 
 	if (!git_config_get_bool("core.multipackindex", &i) && i) {
 		struct child_process midx_verify = CHILD_PROCESS_INIT;
-		const char *midx_argv[] = { "multi-pack-index", "verify", NULL, NULL, NULL };
+		const char *midx_argv[] = { "multi-pack-index", "verify", NULL, NULL, NULL, NULL };
+		char *threads_arg = xstrfmt("--threads=%d", fsck_threads);
 
 		prepare_alt_odb(the_repository);
 		for (odb = the_repository->objects->odb; odb; odb = odb->next) {
@@ -967,9 +1145,11 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 			midx_verify.git_cmd = 1;
 			midx_argv[2] = "--object-dir";
 			midx_argv[3] = odb->path;
+			midx_argv[4] = threads_arg;
 			if (run_command(&midx_verify))
 				errors_found |= ERROR_COMMIT_GRAPH;
 		}
+		free(threads_arg);
 	}
 
 	return errors_found;
@@ -21,12 +21,17 @@
 #include "argv-array.h"
 #include "commit.h"
 #include "commit-graph.h"
+#include "notes-index.h"
 #include "packfile.h"
 #include "object-store.h"
 #include "pack.h"
 #include "pack-objects.h"
 #include "blob.h"
 #include "tree.h"
+#include "prefetch-blobs.h"
+#include "exec-cmd.h"
+#include "refs.h"
+#include "remote.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -43,6 +48,8 @@ static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
 static int gc_write_commit_graph;
 static int detach_auto = 1;
+static int gc_prefetch_blobs;
+static int gc_cruft_packs;
 static timestamp_t gc_log_expire_time;
 static const char *gc_log_expire = "1.day.ago";
 static const char *prune_expire = "2.weeks.ago";
@@ -150,6 +157,8 @@ static void gc_config(void)
 	git_config_get_int("gc.autopacklimit", &gc_auto_pack_limit);
 	git_config_get_bool("gc.writecommitgraph", &gc_write_commit_graph);
 	git_config_get_bool("gc.autodetach", &detach_auto);
+	git_config_get_bool("gc.prefetchblobs", &gc_prefetch_blobs);
+	git_config_get_bool("gc.cruftpacks", &gc_cruft_packs);
 	git_config_get_expiry("gc.pruneexpire", &prune_expire);
 	git_config_get_expiry("gc.worktreepruneexpire", &prune_worktrees_expire);
 	git_config_get_expiry("gc.logexpiry", &gc_log_expire);
@@ -320,7 +329,11 @@ static void add_repack_all_option(struct string_list *keep_pack)
 {
 	if (prune_expire && !strcmp(prune_expire, "now"))
 		argv_array_push(&repack, "-a");
-	else {
+	else if (gc_cruft_packs) {
+		argv_array_push(&repack, "--cruft");
+		if (prune_expire)
+			argv_array_pushf(&repack, "--cruft-expiration=%s", prune_expire);
+	} else {
 		argv_array_push(&repack, "-A");
 		if (prune_expire)
 			argv_array_pushf(&repack, "--unpack-unreachable=%s", prune_expire);
@@ -522,6 +535,21 @@ static void gc_before_repack(void)
 		die(FAILED_RUN, reflog.argv[0]);
 }
 
+/* How many recently checked out branches prefetch_blobs() looks at */
+#define PREFETCH_RECENT_BRANCHES 5
+
+static int want_prefetch_blobs(void)
+{
+	return gc_prefetch_blobs && repository_format_partial_clone;
+}
+
+static void prefetch_blobs(void)
+{
+	trace2_region_enter("gc", "prefetch-blobs", the_repository);
+	prefetch_predicted_blobs(the_repository, PREFETCH_RECENT_BRANCHES);
+	trace2_region_leave("gc", "prefetch-blobs", the_repository);
+}
+
 int cmd_gc(int argc, const char **argv, const char *prefix)
 {
 	int aggressive = 0;
@@ -531,6 +559,7 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	const char *name;
 	pid_t pid;
 	int daemonized = 0;
+	int prefetch_only = 0;
 	int keep_base_pack = -1;
 	timestamp_t dummy;
 
@@ -547,6 +576,8 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 			   PARSE_OPT_NOCOMPLETE),
 		OPT_BOOL(0, "keep-largest-pack", &keep_base_pack,
 			 N_("repack all other packs except the largest pack")),
+		OPT_BOOL(0, "cruft", &gc_cruft_packs,
+			 N_("pack unreachable objects into a cruft pack")),
 		OPT_END()
 	};
 
@@ -590,9 +621,13 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 		/*
 		 * Auto-gc should be least intrusive as possible.
 		 */
-		if (!need_to_gc())
-			return 0;
-		if (!quiet) {
+		if (!need_to_gc()) {
+			/* There may still be blobs to prefetch while idle. */
+			if (!want_prefetch_blobs())
+				return 0;
+			prefetch_only = 1;
+		}
+		if (!quiet && !prefetch_only) {
 			if (detach_auto)
 				fprintf(stderr, _("Auto packing the repository in background for optimum performance.\n"));
 			else
@@ -610,7 +645,8 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 
 			if (lock_repo_for_gc(force, &pid))
 				return 0;
-			gc_before_repack(); /* dies on failure */
+			if (!prefetch_only)
+				gc_before_repack(); /* dies on failure */
 			delete_tempfile(&pidfile);
 
 			/*
@@ -650,6 +686,11 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 		atexit(process_log_file_at_exit);
 	}
 
+	if (prefetch_only) {
+		prefetch_blobs();
+		return 0;
+	}
+
 	gc_before_repack();
 
 	if (!repository_format_precious_objects) {
@@ -678,6 +719,9 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	if (run_command_v_opt(rerere.argv, RUN_GIT_CMD))
 		die(FAILED_RUN, rerere.argv[0]);
 
+	if (want_prefetch_blobs())
+		prefetch_blobs();
+
 	report_garbage = report_pack_garbage;
 	reprepare_packed_git(the_repository);
 	if (pack_garbage.nr > 0) {
@@ -691,6 +735,9 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 					 NULL))
 		return 1;
 
+	if (notes_index_enabled())
+		write_notes_indexes();
+
 	if (auto_gc && too_many_loose_objects())
 		warning(_("There are too many unreachable loose objects; "
 			"run 'git prune' to remove them."));
@@ -700,3 +747,905 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 
 	return 0;
 }
+
+static const char builtin_maintenance_usage[] = N_("git maintenance <subcommand> [<options>]");
+
+static const char * const builtin_maintenance_run_usage[] = {
+	N_("git maintenance run [--auto] [--[no-]quiet] [--task=<task>] [--schedule=<frequency>]"),
+	NULL
+};
+
+enum schedule_priority {
+	SCHEDULE_NONE = 0,
+	SCHEDULE_WEEKLY = 1,
+	SCHEDULE_DAILY = 2,
+	SCHEDULE_HOURLY = 3,
+};
+
+static enum schedule_priority parse_schedule(const char *value)
+{
+	if (!value)
+		return SCHEDULE_NONE;
+	if (!strcasecmp(value, "hourly"))
+		return SCHEDULE_HOURLY;
+	if (!strcasecmp(value, "daily"))
+		return SCHEDULE_DAILY;
+	if (!strcasecmp(value, "weekly"))
+		return SCHEDULE_WEEKLY;
+	return SCHEDULE_NONE;
+}
+
+static int maintenance_opt_schedule(const struct option *opt, const char *arg,
+				    int unset)
+{
+	enum schedule_priority *priority = opt->value;
+
+	if (unset)
+		die(_("--no-schedule is not allowed"));
+
+	*priority = parse_schedule(arg);
+
+	if (!*priority)
+		die(_("unrecognized --schedule argument '%s'"), arg);
+
+	return 0;
+}
+
+struct maintenance_task;
+
+enum maintenance_task_label {
+	TASK_PREFETCH,
+	TASK_LOOSE_OBJECTS,
+	TASK_INCREMENTAL_REPACK,
+	TASK_GC,
+	TASK_COMMIT_GRAPH,
+
+	/* Leave as final value */
+	TASK__COUNT
+};
+
+struct maintenance_run_opts {
+	int auto_flag;
+	int quiet;
+	enum schedule_priority schedule;
+	/* the tasks given with --task, in command-line order */
+	struct maintenance_task *selected[TASK__COUNT];
+	int selected_nr;
+};
+
+/* Remember to update object flag allocation in object.h */
+#define SEEN		(1u<<0)
+
+struct cg_auto_data {
+	int num_not_in_graph;
+	int limit;
+};
+
+static int dfs_on_ref(const char *refname,
+		      const struct object_id *oid, int flags,
+		      void *cb_data)
+{
+	struct cg_auto_data *data = (struct cg_auto_data *)cb_data;
+	int result = 0;
+	struct object_id peeled;
+	struct commit_list *stack = NULL;
+	struct commit *commit;
+
+	if (!peel_ref(refname, &peeled))
+		oid = &peeled;
+	if (oid_object_info(the_repository, oid, NULL) != OBJ_COMMIT)
+		return 0;
+
+	commit = lookup_commit(the_repository, oid);
+	if (!commit)
+		return 0;
+	if (parse_commit(commit) ||
+	    commit->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		return 0;
+
+	data->num_not_in_graph++;
+
+	if (data->num_not_in_graph >= data->limit)
+		return 1;
+
+	commit_list_append(commit, &stack);
+
+	while (!result && stack) {
+		struct commit_list *parent;
+
+		commit = pop_commit(&stack);
+
+		for (parent = commit->parents; parent; parent = parent->next) {
+			if (parse_commit(parent->item) ||
+			    parent->item->graph_pos != COMMIT_NOT_FROM_GRAPH ||
+			    parent->item->object.flags & SEEN)
+				continue;
+
+			parent->item->object.flags |= SEEN;
+			data->num_not_in_graph++;
+
+			if (data->num_not_in_graph >= data->limit) {
+				result = 1;
+				break;
+			}
+
+			commit_list_append(parent->item, &stack);
+		}
+	}
+
+	free_commit_list(stack);
+	return result;
+}
+
+static int should_write_commit_graph(void)
+{
+	int result;
+	struct cg_auto_data data;
+
+	data.num_not_in_graph = 0;
+	data.limit = 100;
+	git_config_get_int("maintenance.commit-graph.auto",
+			   &data.limit);
+
+	if (!data.limit)
+		return 0;
+	if (data.limit < 0)
+		return 1;
+
+	result = for_each_ref(dfs_on_ref, &data);
+
+	clear_commit_marks_all(SEEN);
+
+	return result;
+}
+
+static int maintenance_task_commit_graph(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	close_object_store(the_repository->objects);
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "commit-graph", "write",
+			 "--split", "--reachable", NULL);
+	if (opts->quiet)
+		argv_array_push(&child.args, "--no-progress");
+
+	if (run_command(&child))
+		return error(_("failed to write commit-graph"));
+	return 0;
+}
+
+static int fetch_remote(const char *remote, struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "fetch", remote, "--prune", "--no-tags",
+			 "--no-write-fetch-head", "--recurse-submodules=no",
+			 "--no-auto-gc", "--refmap=", NULL);
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+
+	argv_array_pushf(&child.args, "+refs/heads/*:refs/prefetch/%s/*",
+			 remote);
+
+	return !!run_command(&child);
+}
+
+static int append_remote(struct remote *remote, void *cbdata)
+{
+	struct string_list *remotes = (struct string_list *)cbdata;
+
+	string_list_append(remotes, remote->name);
+	return 0;
+}
+
+static int maintenance_task_prefetch(struct maintenance_run_opts *opts)
+{
+	int result = 0;
+	struct string_list_item *item;
+	struct string_list remotes = STRING_LIST_INIT_DUP;
+
+	if (for_each_remote(append_remote, &remotes)) {
+		error(_("failed to fill remotes"));
+		result = 1;
+		goto cleanup;
+	}
+
+	for_each_string_list_item(item, &remotes)
+		if (fetch_remote(item->string, opts))
+			result = error(_("failed to prefetch remote '%s'"),
+				       item->string);
+
+cleanup:
+	string_list_clear(&remotes, 0);
+	return result ? 1 : 0;
+}
+
+static int maintenance_task_gc(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_push(&child.args, "gc");
+
+	if (opts->auto_flag)
+		argv_array_push(&child.args, "--auto");
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+	else
+		argv_array_push(&child.args, "--no-quiet");
+
+	close_object_store(the_repository->objects);
+	return run_command(&child);
+}
+
+static int prune_packed(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_push(&child.args, "prune-packed");
+
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+
+	return !!run_command(&child);
+}
+
+struct write_loose_object_data {
+	FILE *in;
+	int count;
+	int batch_size;
+};
+
+static int loose_object_auto_limit = 100;
+
+static int loose_object_count(const struct object_id *oid,
+			      const char *path,
+			      void *data)
+{
+	int *count = (int*)data;
+	if (++*count >= loose_object_auto_limit)
+		return 1;
+	return 0;
+}
+
+static int loose_object_auto_condition(void)
+{
+	int count = 0;
+
+	git_config_get_int("maintenance.loose-objects.auto",
+			   &loose_object_auto_limit);
+
+	if (!loose_object_auto_limit)
+		return 0;
+	if (loose_object_auto_limit < 0)
+		return 1;
+
+	return for_each_loose_file_in_objdir(the_repository->objects->odb->path,
+					     loose_object_count,
+					     NULL, NULL, &count);
+}
+
+static int bail_on_loose(const struct object_id *oid,
+			 const char *path,
+			 void *data)
+{
+	return 1;
+}
+
+static int write_loose_object_to_stdin(const struct object_id *oid,
+				       const char *path,
+				       void *data)
+{
+	struct write_loose_object_data *d = (struct write_loose_object_data *)data;
+
+	fprintf(d->in, "%s\n", oid_to_hex(oid));
+
+	return ++(d->count) > d->batch_size;
+}
+
+static int pack_loose(struct maintenance_run_opts *opts)
+{
+	struct repository *r = the_repository;
+	int result = 0;
+	struct write_loose_object_data data;
+	struct child_process pack_proc = CHILD_PROCESS_INIT;
+
+	/*
+	 * Do not start pack-objects process
+	 * if there are no loose objects.
+	 */
+	if (!for_each_loose_file_in_objdir(r->objects->odb->path,
+					   bail_on_loose,
+					   NULL, NULL, NULL))
+		return 0;
+
+	pack_proc.git_cmd = 1;
+
+	argv_array_push(&pack_proc.args, "pack-objects");
+	if (opts->quiet)
+		argv_array_push(&pack_proc.args, "--quiet");
+	argv_array_pushf(&pack_proc.args, "%s/pack/loose", r->objects->odb->path);
+
+	pack_proc.in = -1;
+	pack_proc.no_stdout = 1;
+
+	if (start_command(&pack_proc)) {
+		error(_("failed to start 'git pack-objects' process"));
+		return 1;
+	}
+
+	data.in = xfdopen(pack_proc.in, "w");
+	data.count = 0;
+	data.batch_size = 50000;
+
+	for_each_loose_file_in_objdir(r->objects->odb->path,
+				      write_loose_object_to_stdin,
+				      NULL,
+				      NULL,
+				      &data);
+
+	fclose(data.in);
+
+	if (finish_command(&pack_proc)) {
+		error(_("failed to finish 'git pack-objects' process"));
+		result = 1;
+	}
+
+	return result;
+}
+
+static int maintenance_task_loose_objects(struct maintenance_run_opts *opts)
+{
+	return prune_packed(opts) || pack_loose(opts);
+}
+
+static int multi_pack_index_enabled(void)
+{
+	int enabled;
+
+	return !git_config_get_bool("core.multipackindex", &enabled) && enabled;
+}
+
+static int incremental_repack_auto_condition(void)
+{
+	struct packed_git *p;
+	int incremental_repack_auto_limit = 10;
+	int count = 0;
+
+	if (!multi_pack_index_enabled())
+		return 0;
+
+	git_config_get_int("maintenance.incremental-repack.auto",
+			   &incremental_repack_auto_limit);
+
+	if (!incremental_repack_auto_limit)
+		return 0;
+	if (incremental_repack_auto_limit < 0)
+		return 1;
+
+	for (p = get_all_packs(the_repository);
+	     count < incremental_repack_auto_limit && p;
+	     p = p->next) {
+		if (p->pack_local && !p->multi_pack_index)
+			count++;
+	}
+
+	return count >= incremental_repack_auto_limit;
+}
+
+static int multi_pack_index_command(const char *subcommand,
+				    const char *extra_arg)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "multi-pack-index", subcommand, NULL);
+	if (extra_arg)
+		argv_array_push(&child.args, extra_arg);
+
+	close_object_store(the_repository->objects);
+	if (run_command(&child))
+		return error(_("'git multi-pack-index %s' failed"), subcommand);
+	return 0;
+}
+
+/*
+ * Optimize for one large pack (i.e. from a clone) with the rest small
+ * enough to be repacked quickly: a batch one byte larger than the
+ * second-largest pack repacks at least two packs if there are three or
+ * more.
+ */
+static off_t get_auto_pack_size(void)
+{
+	off_t max_size = 0;
+	off_t second_largest_size = 0;
+	off_t result_size;
+	struct packed_git *p;
+	struct repository *r = the_repository;
+
+	reprepare_packed_git(r);
+	for (p = get_all_packs(r); p; p = p->next) {
+		if (p->pack_size > max_size) {
+			second_largest_size = max_size;
+			max_size = p->pack_size;
+		} else if (p->pack_size > second_largest_size)
+			second_largest_size = p->pack_size;
+	}
+
+	result_size = second_largest_size + 1;
+
+	/* But limit ourselves to a batch size of 2g */
+	if (result_size > UINT32_MAX)
+		result_size = UINT32_MAX;
+
+	return result_size;
+}
+
+static int maintenance_task_incremental_repack(struct maintenance_run_opts *opts)
+{
+	struct strbuf batch_size = STRBUF_INIT;
+	int result;
+
+	if (!multi_pack_index_enabled()) {
+		warning(_("skipping incremental-repack task because core.multiPackIndex is disabled"));
+		return 0;
+	}
+
+	strbuf_addf(&batch_size, "--batch-size=%"PRIuMAX,
+		    (uintmax_t)get_auto_pack_size());
+	result = multi_pack_index_command("write", NULL) ||
+		 multi_pack_index_command("expire", NULL) ||
+		 multi_pack_index_command("repack", batch_size.buf);
+	strbuf_release(&batch_size);
+	return result;
+}
+
+typedef int maintenance_task_fn(struct maintenance_run_opts *opts);
+
+/*
+ * An auto condition function returns 1 if the task should run
+ * and 0 if the task should NOT run. A task without one always
+ * runs, and is expected to make that decision itself (like
+ * 'git gc --auto' does).
+ */
+typedef int maintenance_auto_fn(void);
+
+struct maintenance_task {
+	const char *name;
+	maintenance_task_fn *fn;
+	maintenance_auto_fn *auto_condition;
+	unsigned enabled:1,
+		 selected:1;
+	enum schedule_priority schedule;
+};
+
+static struct maintenance_task tasks[] = {
+	[TASK_PREFETCH] = {
+		"prefetch",
+		maintenance_task_prefetch,
+	},
+	[TASK_LOOSE_OBJECTS] = {
+		"loose-objects",
+		maintenance_task_loose_objects,
+		loose_object_auto_condition,
+	},
+	[TASK_INCREMENTAL_REPACK] = {
+		"incremental-repack",
+		maintenance_task_incremental_repack,
+		incremental_repack_auto_condition,
+	},
+	[TASK_GC] = {
+		"gc",
+		maintenance_task_gc,
+		NULL,
+		1,
+	},
+	[TASK_COMMIT_GRAPH] = {
+		"commit-graph",
+		maintenance_task_commit_graph,
+		should_write_commit_graph,
+	},
+};
+
+/*
+ * Run one task under its own lock, so that tasks on different schedules
+ * can overlap, but no task runs twice at the same time.
+ */
+static int maintenance_run_task(struct maintenance_task *task,
+				struct maintenance_run_opts *opts)
+{
+	struct repository *r = the_repository;
+	struct lock_file lk = LOCK_INIT;
+	char *lock_path;
+	int result = 0;
+
+	if (opts->auto_flag && task->auto_condition &&
+	    !task->auto_condition())
+		return 0;
+
+	lock_path = xstrfmt("%s/maintenance-%s", r->objects->odb->path,
+			    task->name);
+	if (hold_lock_file_for_update(&lk, lock_path, LOCK_NO_DEREF) < 0) {
+		/*
+		 * Another maintenance command is running this task.
+		 * Be quiet about it when running in the background.
+		 */
+		if (!opts->auto_flag && !opts->quiet)
+			warning(_("lock file '%s.lock' exists, skipping %s maintenance"),
+				lock_path, task->name);
+		free(lock_path);
+		return 0;
+	}
+
+	trace2_region_enter("maintenance", task->name, r);
+	if (task->fn(opts)) {
+		error(_("task '%s' failed"), task->name);
+		result = 1;
+	}
+	trace2_region_leave("maintenance", task->name, r);
+
+	rollback_lock_file(&lk);
+	free(lock_path);
+	return result;
+}
+
+static int maintenance_run_tasks(struct maintenance_run_opts *opts)
+{
+	int i;
+	int result = 0;
+
+	if (opts->selected_nr) {
+		for (i = 0; i < opts->selected_nr; i++)
+			result |= maintenance_run_task(opts->selected[i], opts);
+		return result;
+	}
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		if (!tasks[i].enabled)
+			continue;
+		if (opts->schedule && tasks[i].schedule < opts->schedule)
+			continue;
+		result |= maintenance_run_task(&tasks[i], opts);
+	}
+
+	return result;
+}
+
+static void initialize_maintenance_strategy(void)
+{
+	char *config_str;
+
+	if (git_config_get_string("maintenance.strategy", &config_str))
+		return;
+
+	if (!strcasecmp(config_str, "incremental")) {
+		tasks[TASK_GC].schedule = SCHEDULE_NONE;
+		tasks[TASK_COMMIT_GRAPH].enabled = 1;
+		tasks[TASK_COMMIT_GRAPH].schedule = SCHEDULE_HOURLY;
+		tasks[TASK_PREFETCH].enabled = 1;
+		tasks[TASK_PREFETCH].schedule = SCHEDULE_HOURLY;
+		tasks[TASK_INCREMENTAL_REPACK].enabled = 1;
+		tasks[TASK_INCREMENTAL_REPACK].schedule = SCHEDULE_DAILY;
+		tasks[TASK_LOOSE_OBJECTS].enabled = 1;
+		tasks[TASK_LOOSE_OBJECTS].schedule = SCHEDULE_DAILY;
+	} else if (strcasecmp(config_str, "none")) {
+		warning(_("unrecognized maintenance.strategy '%s'"), config_str);
+	}
+
+	free(config_str);
+}
+
+static void initialize_task_config(void)
+{
+	int i;
+	struct strbuf config_name = STRBUF_INIT;
+
+	initialize_maintenance_strategy();
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		int config_value;
+		char *config_str;
+
+		strbuf_reset(&config_name);
+		strbuf_addf(&config_name, "maintenance.%s.enabled",
+			    tasks[i].name);
+
+		if (!git_config_get_bool(config_name.buf, &config_value))
+			tasks[i].enabled = config_value;
+
+		strbuf_reset(&config_name);
+		strbuf_addf(&config_name, "maintenance.%s.schedule",
+			    tasks[i].name);
+
+		if (!git_config_get_string(config_name.buf, &config_str)) {
+			tasks[i].schedule = parse_schedule(config_str);
+			free(config_str);
+		}
+	}
+
+	strbuf_release(&config_name);
+}
+
+static int task_option_parse(const struct option *opt,
+			     const char *arg, int unset)
+{
+	struct maintenance_run_opts *opts = opt->value;
+	struct maintenance_task *task = NULL;
+	int i;
+
+	BUG_ON_OPT_NEG(unset);
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		if (!strcasecmp(tasks[i].name, arg)) {
+			task = &tasks[i];
+			break;
+		}
+	}
+
+	if (!task) {
+		error(_("'%s' is not a valid task"), arg);
+		return 1;
+	}
+
+	if (task->selected) {
+		error(_("task '%s' cannot be selected multiple times"), arg);
+		return 1;
+	}
+
+	task->selected = 1;
+	opts->selected[opts->selected_nr++] = task;
+	return 0;
+}
+
+static int maintenance_run(int argc, const char **argv, const char *prefix)
+{
+	struct maintenance_run_opts opts;
+	struct option builtin_maintenance_run_options[] = {
+		OPT_BOOL(0, "auto", &opts.auto_flag,
+			 N_("run tasks based on the state of the repository")),
+		OPT_CALLBACK(0, "schedule", &opts.schedule, N_("frequency"),
+			     N_("run tasks based on frequency"),
+			     maintenance_opt_schedule),
+		OPT_BOOL(0, "quiet", &opts.quiet,
+			 N_("do not report progress or other information over stderr")),
+		OPT_CALLBACK_F(0, "task", &opts, N_("task"),
+			N_("run a specific task"),
+			PARSE_OPT_NONEG, task_option_parse),
+		OPT_END()
+	};
+
+	memset(&opts, 0, sizeof(opts));
+	opts.quiet = !isatty(2);
+	initialize_task_config();
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_maintenance_run_options,
+			     builtin_maintenance_run_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (opts.auto_flag && opts.schedule)
+		die(_("use at most one of --auto and --schedule=<frequency>"));
+	if (opts.selected_nr && opts.schedule)
+		die(_("use at most one of --task and --schedule=<frequency>"));
+	if (argc != 0)
+		usage_with_options(builtin_maintenance_run_usage,
+				   builtin_maintenance_run_options);
+	return maintenance_run_tasks(&opts);
+}
+
+static char *get_maintpath(void)
+{
+	const char *path = the_repository->worktree ?
+		the_repository->worktree : the_repository->gitdir;
+
+	return absolute_pathdup(path);
+}
+
+static int maintenance_register(void)
+{
+	char *config_value;
+	char *maintpath = get_maintpath();
+	struct child_process config_get = CHILD_PROCESS_INIT;
+	struct strbuf registered = STRBUF_INIT;
+	struct string_list repos = STRING_LIST_INIT_DUP;
+	int found = 0, result = 0;
+
+	/* Disable foreground maintenance */
+	git_config_set("maintenance.auto", "false");
+
+	/* Set maintenance strategy, if unset */
+	if (git_config_get_string("maintenance.strategy", &config_value))
+		git_config_set("maintenance.strategy", "incremental");
+	else
+		free(config_value);
+
+	config_get.git_cmd = 1;
+	argv_array_pushl(&config_get.args, "config", "--global", "--get-all",
+			 "maintenance.repo", NULL);
+	/* exits with 1 when there is no such value yet */
+	capture_command(&config_get, &registered, 0);
+	string_list_split(&repos, registered.buf, '\n', -1);
+	found = unsorted_string_list_has_string(&repos, maintpath);
+
+	if (!found) {
+		struct child_process config_set = CHILD_PROCESS_INIT;
+
+		config_set.git_cmd = 1;
+		argv_array_pushl(&config_set.args, "config", "--add", "--global",
+				 "maintenance.repo", maintpath, NULL);
+		if (run_command(&config_set))
+			result = error(_("failed to register '%s'"), maintpath);
+	}
+
+	string_list_clear(&repos, 0);
+	strbuf_release(&registered);
+	free(maintpath);
+	return result;
+}
+
+static int maintenance_unregister(void)
+{
+	char *maintpath = get_maintpath();
+	struct child_process config_unset = CHILD_PROCESS_INIT;
+	struct strbuf value_regex = STRBUF_INIT;
+	const char *p;
+	int rc;
+
+	/* match the path literally */
+	strbuf_addch(&value_regex, '^');
+	for (p = maintpath; *p; p++) {
+		if (strchr("\\^$.|?*+()[]{}", *p))
+			strbuf_addch(&value_regex, '\\');
+		strbuf_addch(&value_regex, *p);
+	}
+	strbuf_addch(&value_regex, '$');
+
+	config_unset.git_cmd = 1;
+	argv_array_pushl(&config_unset.args, "config", "--global", "--unset-all",
+			 "maintenance.repo", value_regex.buf, NULL);
+	rc = run_command(&config_unset);
+
+	strbuf_release(&value_regex);
+	free(maintpath);
+
+	/* 5 means that the repository was not registered */
+	if (rc && rc != 5)
+		return error(_("failed to unregister repository"));
+	return 0;
+}
+
+#define BEGIN_LINE "# BEGIN GIT MAINTENANCE SCHEDULE"
+#define END_LINE "# END GIT MAINTENANCE SCHEDULE"
+
+static int update_background_schedule(int run_maintenance)
+{
+	int result = 0;
+	int in_old_region = 0;
+	struct child_process crontab_list = CHILD_PROCESS_INIT;
+	struct child_process crontab_edit = CHILD_PROCESS_INIT;
+	FILE *cron_list, *cron_in;
+	const char *crontab_name;
+	struct strbuf line = STRBUF_INIT;
+	struct lock_file lk = LOCK_INIT;
+	char *lock_path = xstrfmt("%s/schedule", the_repository->objects->odb->path);
+
+	if (hold_lock_file_for_update(&lk, lock_path, LOCK_NO_DEREF) < 0) {
+		free(lock_path);
+		return error(_("another process is scheduling background maintenance"));
+	}
+	free(lock_path);
+
+	crontab_name = getenv("GIT_TEST_CRONTAB");
+	if (!crontab_name)
+		crontab_name = "crontab";
+
+	argv_array_split(&crontab_list.args, crontab_name);
+	argv_array_push(&crontab_list.args, "-l");
+	crontab_list.in = -1;
+	crontab_list.out = dup(get_lock_file_fd(&lk));
+	crontab_list.git_cmd = 0;
+
+	if (start_command(&crontab_list)) {
+		result = error(_("failed to run 'crontab -l'; your system might not support 'cron'"));
+		goto cleanup;
+	}
+
+	/* Ignore exit code, as an empty crontab will return error. */
+	finish_command(&crontab_list);
+
+	/*
+	 * Read from the .lock file, filtering out the old
+	 * schedule while appending the new schedule.
+	 */
+	cron_list = fdopen_lock_file(&lk, "r");
+	rewind(cron_list);
+
+	argv_array_split(&crontab_edit.args, crontab_name);
+	crontab_edit.in = -1;
+	crontab_edit.git_cmd = 0;
+
+	if (start_command(&crontab_edit)) {
+		result = error(_("failed to run 'crontab'; your system might not support 'cron'"));
+		goto cleanup;
+	}
+
+	cron_in = xfdopen(crontab_edit.in, "w");
+
+	while (!strbuf_getline_lf(&line, cron_list)) {
+		if (!in_old_region && !strcmp(line.buf, BEGIN_LINE))
+			in_old_region = 1;
+		else if (in_old_region && !strcmp(line.buf, END_LINE))
+			in_old_region = 0;
+		else if (!in_old_region)
+			fprintf(cron_in, "%s\n", line.buf);
+	}
+
+	if (run_maintenance) {
+		struct strbuf line_format = STRBUF_INIT;
+		const char *exec_path = git_exec_path();
+
+		fprintf(cron_in, "%s\n", BEGIN_LINE);
+		fprintf(cron_in,
+			"# The following schedule was created by Git\n");
+		fprintf(cron_in, "# Any edits made in this region might be\n");
+		fprintf(cron_in,
+			"# replaced in the future by a Git command.\n\n");
+
+		strbuf_addf(&line_format,
+			    "%%s %%s * * %%s \"%s/git\" --exec-path=\"%s\" for-each-repo --config=maintenance.repo maintenance run --schedule=%%s\n",
+			    exec_path, exec_path);
+		fprintf(cron_in, line_format.buf, "0", "1-23", "*", "hourly");
+		fprintf(cron_in, line_format.buf, "0", "0", "1-6", "daily");
+		fprintf(cron_in, line_format.buf, "0", "0", "0", "weekly");
+		strbuf_release(&line_format);
+
+		fprintf(cron_in, "\n%s\n", END_LINE);
+	}
+
+	fclose(cron_in);
+
+	if (finish_command(&crontab_edit))
+		result = error(_("'crontab' died"));
+
+cleanup:
+	strbuf_release(&line);
+	rollback_lock_file(&lk);
+	return result;
+}
+
+static int maintenance_start(void)
+{
+	if (maintenance_register())
+		warning(_("failed to add repo to global config"));
+
+	return update_background_schedule(1);
+}
+
+static int maintenance_stop(void)
+{
+	return update_background_schedule(0);
+}
+
+int cmd_maintenance(int argc, const char **argv, const char *prefix)
+{
+	if (argc < 2 ||
+	    (argc == 2 && !strcmp(argv[1], "-h")))
+		usage(builtin_maintenance_usage);
+
+	if (!strcmp(argv[1], "run"))
+		return maintenance_run(argc - 1, argv + 1, prefix);
+	if (!strcmp(argv[1], "start"))
+		return maintenance_start();
+	if (!strcmp(argv[1], "stop"))
+		return maintenance_stop();
+	if (!strcmp(argv[1], "register"))
+		return maintenance_register();
+	if (!strcmp(argv[1], "unregister"))
+		return maintenance_unregister();
+
+	die(_("invalid subcommand: %s"), argv[1]);
+}
@@ -18,12 +18,14 @@
 #include "run-command.h"
 #include "userdiff.h"
 #include "grep.h"
+#include "grep-trigram.h"
 #include "quote.h"
 #include "dir.h"
 #include "pathspec.h"
 #include "submodule.h"
 #include "submodule-config.h"
 #include "object-store.h"
+#include "oidset.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -31,6 +33,14 @@ static char const * const grep_usage[] = {
 };
 
 static int recurse_submodules;
+static int use_trigram_index;
+static int dedup_blobs;
+
+/*
+ * With --dedup-blobs, the blobs that are known not to match; the
+ * other names of such a blob need not be searched again.
+ */
+static struct oidset unmatched_blobs = OIDSET_INIT;
 
 #define GREP_NUM_THREADS_DEFAULT 8
 static int num_threads;
@@ -91,6 +101,29 @@ static pthread_cond_t cond_result;
 
 static int skip_first_line;
 
+static int blob_known_unmatched(const struct object_id *oid)
+{
+	int ret;
+
+	if (num_threads > 1)
+		grep_lock();
+	ret = oidset_contains(&unmatched_blobs, oid);
+	if (num_threads > 1)
+		grep_unlock();
+	return ret;
+}
+
+static void remember_grep_result(struct grep_source *gs, int hit)
+{
+	if (!dedup_blobs || hit || gs->type != GREP_SOURCE_OID)
+		return;
+	if (num_threads > 1)
+		grep_lock();
+	oidset_insert(&unmatched_blobs, gs->identifier);
+	if (num_threads > 1)
+		grep_unlock();
+}
+
 static void add_work(struct grep_opt *opt, const struct grep_source *gs)
 {
 	grep_lock();
@@ -175,11 +208,15 @@ static void *run(void *arg)
 
 	while (1) {
 		struct work_item *w = get_work();
+		int this_hit;
+
 		if (!w)
 			break;
 
 		opt->output_priv = w;
-		hit |= grep_source(opt, &w->source);
+		this_hit = grep_source(opt, &w->source);
+		remember_grep_result(&w->source, this_hit);
+		hit |= this_hit;
 		grep_source_clear_data(&w->source);
 		work_done(w);
 	}
@@ -206,6 +243,7 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
 	grep_use_locks = 1;
+	enable_obj_read_lock();
 
 	for (i = 0; i < ARRAY_SIZE(todo); i++) {
 		strbuf_init(&todo[i].out, 0);
@@ -263,6 +301,7 @@ static int wait_all(void)
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
 	grep_use_locks = 0;
+	disable_obj_read_lock();
 
 	return hit;
 }
@@ -292,17 +331,10 @@ static int grep_cmd_config(const char *var, const char *value, void *cb)
 	if (!strcmp(var, "submodule.recurse"))
 		recurse_submodules = git_config_bool(var, value);
 
-	return st;
-}
-
-static void *lock_and_read_oid_file(const struct object_id *oid, enum object_type *type, unsigned long *size)
-{
-	void *data;
+	if (!strcmp(var, "grep.trigramindex"))
+		use_trigram_index = git_config_bool(var, value);
 
-	grep_read_lock();
-	data = read_object_file(oid, type, size);
-	grep_read_unlock();
-	return data;
+	return st;
 }
 
 static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
@@ -312,6 +344,9 @@ static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 	struct strbuf pathbuf = STRBUF_INIT;
 	struct grep_source gs;
 
+	if (dedup_blobs && blob_known_unmatched(oid))
+		return 0;
+
 	if (opt->relative && opt->prefix_length) {
 		quote_path_relative(filename + tree_name_len, opt->prefix, &pathbuf);
 		strbuf_insert(&pathbuf, 0, filename, tree_name_len);
@@ -333,13 +368,15 @@ static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 		int hit;
 
 		hit = grep_source(opt, &gs);
+		remember_grep_result(&gs, hit);
 
 		grep_source_clear(&gs);
 		return hit;
 	}
 }
 
-static int grep_file(struct grep_opt *opt, const char *filename)
+static int grep_file(struct grep_opt *opt, const char *filename,
+		     const struct object_id *oid)
 {
 	struct strbuf buf = STRBUF_INIT;
 	struct grep_source gs;
@@ -350,6 +387,8 @@ static int grep_file(struct grep_opt *opt, const char *filename)
 		strbuf_addstr(&buf, filename);
 
 	grep_source_init(&gs, GREP_SOURCE_FILE, buf.buf, filename, filename);
+	if (oid)
+		gs.blob_oid = oiddup(oid);
 	strbuf_release(&buf);
 
 	if (num_threads > 1) {
@@ -442,7 +481,9 @@ static int grep_submodule(struct grep_opt *opt,
 	 * store is no longer global and instead is a member of the repository
 	 * object.
 	 */
+	obj_read_lock();
 	add_to_alternates_memory(subrepo.objects->odb->path);
+	obj_read_unlock();
 	grep_read_unlock();
 
 	memcpy(&subopt, opt, sizeof(subopt));
@@ -457,11 +498,9 @@ static int grep_submodule(struct grep_opt *opt,
 
 		object = parse_object_or_die(oid, oid_to_hex(oid));
 
-		grep_read_lock();
 		data = read_object_with_reference(&subrepo,
 						  &object->oid, tree_type,
 						  &size, NULL);
-		grep_read_unlock();
 
 		if (!data)
 			die(_("unable to read tree (%s)"), oid_to_hex(&object->oid));
@@ -519,7 +558,15 @@ static int grep_cache(struct grep_opt *opt,
 				hit |= grep_oid(opt, &ce->oid, name.buf,
 						 0, name.buf);
 			} else {
-				hit |= grep_file(opt, name.buf);
+				const struct object_id *oid = NULL;
+				struct stat st;
+
+				/* a clean file can use the index of its blob */
+				if (opt->trigram_index && !repo->submodule_prefix &&
+				    !lstat(name.buf, &st) &&
+				    !ie_match_stat(repo->index, ce, &st, 0))
+					oid = &ce->oid;
+				hit |= grep_file(opt, name.buf, oid);
 			}
 		} else if (recurse_submodules && S_ISGITLINK(ce->ce_mode) &&
 			   submodule_path_match(repo->index, pathspec, name.buf, NULL)) {
@@ -587,7 +634,7 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			void *data;
 			unsigned long size;
 
-			data = lock_and_read_oid_file(&entry.oid, &type, &size);
+			data = read_object_file(&entry.oid, &type, &size);
 			if (!data)
 				die(_("unable to read tree (%s)"),
 				    oid_to_hex(&entry.oid));
@@ -625,11 +672,9 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 		struct strbuf base;
 		int hit, len;
 
-		grep_read_lock();
 		data = read_object_with_reference(opt->repo,
 						  &obj->oid, tree_type,
 						  &size, NULL);
-		grep_read_unlock();
 
 		if (!data)
 			die(_("unable to read tree (%s)"), oid_to_hex(&obj->oid));
@@ -693,7 +738,7 @@ static int grep_directory(struct grep_opt *opt, const struct pathspec *pathspec,
 	for (i = 0; i < dir.nr; i++) {
 		if (!dir_path_match(opt->repo->index, dir.entries[i], pathspec, 0, NULL))
 			continue;
-		hit |= grep_file(opt, dir.entries[i]->name);
+		hit |= grep_file(opt, dir.entries[i]->name, NULL);
 		if (hit && opt->status_only)
 			break;
 	}
@@ -889,6 +934,10 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 			N_("show <n> context lines after matches")),
 		OPT_INTEGER(0, "threads", &num_threads,
 			N_("use <n> worker threads")),
+		OPT_BOOL(0, "trigram-index", &use_trigram_index,
+			N_("skip blobs the trigram index rules out, and extend it")),
+		OPT_BOOL(0, "dedup-blobs", &dedup_blobs,
+			N_("search each blob only once across trees")),
 		OPT_NUMBER_CALLBACK(&opt, N_("shortcut for -C NUM"),
 			context_callback),
 		OPT_BOOL('p', "show-function", &opt.funcname,
@@ -1062,7 +1111,7 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	pathspec.recursive = 1;
 	pathspec.recurse_submodules = !!recurse_submodules;
 
-	if (list.nr || cached || show_in_pager) {
+	if (show_in_pager) {
 		if (num_threads > 1)
 			warning(_("invalid option combination, ignoring --threads"));
 		num_threads = 1;
@@ -1074,6 +1123,18 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	else if (num_threads == 0)
 		num_threads = HAVE_THREADS ? GREP_NUM_THREADS_DEFAULT : 1;
 
+	/*
+	 * Whether a blob matches must depend on its contents alone, and
+	 * not on the path it is found at.
+	 */
+	if (opt.allow_textconv || opt.binary == GREP_BINARY_NOMATCH ||
+	    opt.unmatch_name_only)
+		dedup_blobs = 0;
+
+	/* the patterns are planned for the index as they are compiled */
+	if (use_trigram_index && use_index && !untracked)
+		opt.trigram_index = grep_trigram_index_open(the_repository);
+
 	if (num_threads > 1) {
 		if (!HAVE_THREADS)
 			BUG("Somebody got num_threads calculation wrong!");
@@ -1143,6 +1204,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 
 	if (num_threads > 1)
 		hit |= wait_all();
+	grep_trigram_index_close(opt.trigram_index);
+	oidset_clear(&unmatched_blobs);
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
 	clear_pathspec(&pathspec);
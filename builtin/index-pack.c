@@ -15,9 +15,11 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "fetch-object.h"
+#include "list.h"
+#include "sha1-array.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--[no-]rev-index] [--foreign-objects=<file>] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -33,19 +35,30 @@ struct object_stat {
 };
 
 struct base_data {
+	/* Initialized by make_base(). */
 	struct base_data *base;
-	struct base_data *child;
 	struct object_entry *obj;
-	void *data;
-	unsigned long size;
 	int ref_first, ref_last;
 	int ofs_first, ofs_last;
+	/*
+	 * A thread about to apply a delta against this base holds it in
+	 * retain_data, so that its data is not pruned from under it.
+	 */
+	int retain_data;
+	/*
+	 * The number of direct children that are not fully resolved yet;
+	 * once it drops to zero, this struct can be freed.
+	 */
+	int children_remaining;
+
+	/* Not initialized by make_base(). */
+	struct list_head list;
+	void *data;
+	unsigned long size;
 };
 
 struct thread_local {
 	pthread_t thread;
-	struct base_data *base_cache;
-	size_t base_cache_used;
 	int pack_fd;
 };
 
@@ -83,6 +96,8 @@ static int verbose;
 static int show_resolving_progress;
 static int show_stat;
 static int check_self_contained_and_connected;
+static const char *foreign_objects_file;
+static struct oid_array foreign_objects = OID_ARRAY_INIT;
 
 static struct progress *progress;
 
@@ -101,6 +116,32 @@ static struct thread_local *thread_data;
 static int nr_dispatched;
 static int threads_active;
 
+/*
+ * Bases that still have children nobody has started resolving. Threads
+ * take their next delta from the top of this stack before they go back
+ * to the objects array for a new base, so that one base with a huge
+ * delta family is spread over all threads.
+ *
+ * Guarded by work_mutex.
+ */
+static LIST_HEAD(work_head);
+
+/*
+ * Bases whose children have all been handed out, but are kept around
+ * until the last of them is resolved.
+ *
+ * Guarded by work_mutex.
+ */
+static LIST_HEAD(done_head);
+
+/*
+ * The delta base cache is shared by all threads.
+ *
+ * base_cache_used is guarded by work_mutex.
+ */
+static size_t base_cache_used;
+static size_t base_cache_limit;
+
 static pthread_mutex_t read_mutex;
 #define read_lock()		lock_mutex(&read_mutex)
 #define read_unlock()		unlock_mutex(&read_mutex)
@@ -225,7 +266,12 @@ static unsigned check_objects(void)
 		progress = start_delayed_progress(_("Checking objects"), max);
 
 	for (i = 0; i < max; i++) {
-		foreign_nr += check_object(get_indexed_object(i));
+		struct object *obj = get_indexed_object(i);
+		if (check_object(obj)) {
+			foreign_nr++;
+			if (foreign_objects_file)
+				oid_array_append(&foreign_objects, &obj->oid);
+		}
 		display_progress(progress, i + 1);
 	}
 
@@ -234,6 +280,32 @@ static unsigned check_objects(void)
 }
 
 
+static int print_foreign_object(const struct object_id *oid, void *data)
+{
+	fprintf(data, "%s\n", oid_to_hex(oid));
+	return 0;
+}
+
+/*
+ * Write out the objects that the pack refers to without containing them,
+ * and the local objects that --fix-thin appended to it. Their links were
+ * not checked, so the caller has to check connectivity from them.
+ */
+static void write_foreign_objects(int nr_received)
+{
+	FILE *fp;
+	int i;
+
+	for (i = nr_received; i < nr_objects; i++)
+		oid_array_append(&foreign_objects, &objects[i].idx.oid);
+
+	fp = xfopen(foreign_objects_file, "w");
+	oid_array_for_each_unique(&foreign_objects, print_foreign_object, fp);
+	if (fclose(fp))
+		die_errno(_("unable to write '%s'"), foreign_objects_file);
+	oid_array_clear(&foreign_objects);
+}
+
 /* Discard current buffer used content. */
 static void flush(void)
 {
@@ -364,56 +436,36 @@ static void set_thread_data(struct thread_local *data)
 		pthread_setspecific(key, data);
 }
 
-static struct base_data *alloc_base_data(void)
-{
-	struct base_data *base = xcalloc(1, sizeof(struct base_data));
-	base->ref_last = -1;
-	base->ofs_last = -1;
-	return base;
-}
-
 static void free_base_data(struct base_data *c)
 {
 	if (c->data) {
 		FREE_AND_NULL(c->data);
-		get_thread_data()->base_cache_used -= c->size;
+		base_cache_used -= c->size;
 	}
 }
 
-static void prune_base_data(struct base_data *retain)
+static int prune_base_list(struct list_head *head, struct base_data *retain)
 {
-	struct base_data *b;
-	struct thread_local *data = get_thread_data();
-	for (b = data->base_cache;
-	     data->base_cache_used > delta_base_cache_limit && b;
-	     b = b->child) {
-		if (b->data && b != retain)
-			free_base_data(b);
-	}
-}
+	struct list_head *pos;
 
-static void link_base_data(struct base_data *base, struct base_data *c)
-{
-	if (base)
-		base->child = c;
-	else
-		get_thread_data()->base_cache = c;
-
-	c->base = base;
-	c->child = NULL;
-	if (c->data)
-		get_thread_data()->base_cache_used += c->size;
-	prune_base_data(c);
+	list_for_each_prev(pos, head) {
+		struct base_data *b = list_entry(pos, struct base_data, list);
+		if (b->retain_data || b == retain || !b->data)
+			continue;
+		free_base_data(b);
+		if (base_cache_used <= base_cache_limit)
+			return 1;
+	}
+	return 0;
 }
 
-static void unlink_base_data(struct base_data *c)
+static void prune_base_data(struct base_data *retain)
 {
-	struct base_data *base = c->base;
-	if (base)
-		base->child = NULL;
-	else
-		get_thread_data()->base_cache = NULL;
-	free_base_data(c);
+	if (base_cache_used <= base_cache_limit)
+		return;
+	if (prune_base_list(&done_head, retain))
+		return;
+	prune_base_list(&work_head, retain);
 }
 
 static int is_delta_type(enum object_type type)
@@ -432,17 +484,20 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
+	/*
+	 * Only large blobs, whose contents are not kept, are hashed
+	 * here; the caller hashes the data returned for other objects.
+	 */
+	if (type == OBJ_BLOB && size > big_file_threshold) {
+		buf = fixed_buf;
 		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
 				   type_name(type),(uintmax_t)size) + 1;
 		the_hash_algo->init_fn(&c);
 		the_hash_algo->update_fn(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
-	if (type == OBJ_BLOB && size > big_file_threshold)
-		buf = fixed_buf;
-	else
+	} else {
 		buf = xmallocz(size);
+		oid = NULL;
+	}
 
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
@@ -548,6 +603,27 @@ static void *unpack_data(struct object_entry *obj,
 	int status;
 
 	data = xmallocz(consume ? 64*1024 : obj->size);
+
+	/* read small objects whole and inflate them in one go */
+	if (!consume && obj->size < big_file_threshold) {
+		ssize_t n;
+
+		inbuf = xmalloc(len);
+		n = pread_in_full(get_thread_data()->pack_fd, inbuf, len, from);
+		if (n < 0)
+			die_errno(_("cannot pread pack file"));
+		if (n != len)
+			die(Q_("premature end of pack file, %"PRIuMAX" byte missing",
+			       "premature end of pack file, %"PRIuMAX" bytes missing",
+			       (unsigned int)(len - n)),
+			    (uintmax_t)(len - n));
+		if (git_inflate_buffer(data, obj->size, inbuf, len, NULL))
+			die(_("serious inflate inconsistency"));
+		data[obj->size] = '\0';
+		free(inbuf);
+		return data;
+	}
+
 	inbuf = xmalloc((len < 64*1024) ? (int)len : 64*1024);
 
 	memset(&stream, 0, sizeof(stream));
@@ -865,26 +941,15 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 }
 
 /*
- * This function is part of find_unresolved_deltas(). There are two
- * walkers going in the opposite ways.
- *
- * The first one in find_unresolved_deltas() traverses down from
- * parent node to children, deflating nodes along the way. However,
- * memory for deflated nodes is limited by delta_base_cache_limit, so
- * at some point parent node's deflated content may be freed.
- *
- * The second walker is this function, which goes from current node up
- * to top parent if necessary to deflate the node. In normal
- * situation, its parent node would be already deflated, so it just
- * needs to apply delta.
- *
- * In the worst case scenario, parent node is no longer deflated because
- * we're running out of delta_base_cache_limit; we need to re-deflate
- * parents, possibly up to the top base.
+ * Ensure that the base "c" has its data, so that a delta can be applied
+ * against it. Normally it is still there, but the data of bases that
+ * still have children may be freed once the delta base cache limit is
+ * exceeded; in that case we need to re-deflate parents, possibly up to
+ * the top base.
  *
  * All deflated objects here are subject to be freed if we exceed
- * delta_base_cache_limit, just like in find_unresolved_deltas(), we
- * just need to make sure the last node is not freed.
+ * base_cache_limit; we just need to make sure the last node is not
+ * freed. The caller must hold work_mutex.
  */
 static void *get_base_data(struct base_data *c)
 {
@@ -901,7 +966,7 @@ static void *get_base_data(struct base_data *c)
 		if (!delta_nr) {
 			c->data = get_data_from_pack(obj);
 			c->size = obj->size;
-			get_thread_data()->base_cache_used += c->size;
+			base_cache_used += c->size;
 			prune_base_data(c);
 		}
 		for (; delta_nr > 0; delta_nr--) {
@@ -917,7 +982,7 @@ static void *get_base_data(struct base_data *c)
 			free(raw);
 			if (!c->data)
 				bad_object(obj->idx.offset, _("failed to apply delta"));
-			get_thread_data()->base_cache_used += c->size;
+			base_cache_used += c->size;
 			prune_base_data(c);
 		}
 		free(delta);
@@ -925,10 +990,29 @@ static void *get_base_data(struct base_data *c)
 	return c->data;
 }
 
-static void resolve_delta(struct object_entry *delta_obj,
-			  struct base_data *base, struct base_data *result)
+static struct base_data *make_base(struct object_entry *obj,
+				   struct base_data *parent)
+{
+	struct base_data *base = xcalloc(1, sizeof(struct base_data));
+	base->base = parent;
+	base->obj = obj;
+	find_ref_delta_children(&obj->idx.oid,
+				&base->ref_first, &base->ref_last,
+				OBJ_REF_DELTA);
+	find_ofs_delta_children(obj->idx.offset,
+				&base->ofs_first, &base->ofs_last,
+				OBJ_OFS_DELTA);
+	base->children_remaining = base->ref_last - base->ref_first +
+		base->ofs_last - base->ofs_first + 2;
+	return base;
+}
+
+static struct base_data *resolve_delta(struct object_entry *delta_obj,
+				       struct base_data *base)
 {
-	void *base_data, *delta_data;
+	void *delta_data, *result_data;
+	struct base_data *result;
+	unsigned long result_size;
 
 	if (show_stat) {
 		int i = delta_obj - objects;
@@ -941,20 +1025,26 @@ static void resolve_delta(struct object_entry *delta_obj,
 		obj_stat[i].base_object_no = j;
 	}
 	delta_data = get_data_from_pack(delta_obj);
-	base_data = get_base_data(base);
-	result->obj = delta_obj;
-	result->data = patch_delta(base_data, base->size,
-				   delta_data, delta_obj->size, &result->size);
+	assert(base->data);
+	result_data = patch_delta(base->data, base->size,
+				  delta_data, delta_obj->size, &result_size);
 	free(delta_data);
-	if (!result->data)
+	if (!result_data)
 		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
-	hash_object_file(result->data, result->size,
+	hash_object_file(result_data, result_size,
 			 type_name(delta_obj->real_type), &delta_obj->idx.oid);
-	sha1_object(result->data, NULL, result->size, delta_obj->real_type,
+	sha1_object(result_data, NULL, result_size, delta_obj->real_type,
 		    &delta_obj->idx.oid);
+
+	result = make_base(delta_obj, base);
+	result->data = result_data;
+	result->size = result_size;
+
 	counter_lock();
 	nr_resolved_deltas++;
 	counter_unlock();
+
+	return result;
 }
 
 /*
@@ -977,79 +1067,6 @@ static int compare_and_swap_type(signed char *type,
 	return old == want;
 }
 
-static struct base_data *find_unresolved_deltas_1(struct base_data *base,
-						  struct base_data *prev_base)
-{
-	if (base->ref_last == -1 && base->ofs_last == -1) {
-		find_ref_delta_children(&base->obj->idx.oid,
-					&base->ref_first, &base->ref_last,
-					OBJ_REF_DELTA);
-
-		find_ofs_delta_children(base->obj->idx.offset,
-					&base->ofs_first, &base->ofs_last,
-					OBJ_OFS_DELTA);
-
-		if (base->ref_last == -1 && base->ofs_last == -1) {
-			free(base->data);
-			return NULL;
-		}
-
-		link_base_data(prev_base, base);
-	}
-
-	if (base->ref_first <= base->ref_last) {
-		struct object_entry *child = objects + ref_deltas[base->ref_first].obj_no;
-		struct base_data *result = alloc_base_data();
-
-		if (!compare_and_swap_type(&child->real_type, OBJ_REF_DELTA,
-					   base->obj->real_type))
-			BUG("child->real_type != OBJ_REF_DELTA");
-
-		resolve_delta(child, base, result);
-		if (base->ref_first == base->ref_last && base->ofs_last == -1)
-			free_base_data(base);
-
-		base->ref_first++;
-		return result;
-	}
-
-	if (base->ofs_first <= base->ofs_last) {
-		struct object_entry *child = objects + ofs_deltas[base->ofs_first].obj_no;
-		struct base_data *result = alloc_base_data();
-
-		assert(child->real_type == OBJ_OFS_DELTA);
-		child->real_type = base->obj->real_type;
-		resolve_delta(child, base, result);
-		if (base->ofs_first == base->ofs_last)
-			free_base_data(base);
-
-		base->ofs_first++;
-		return result;
-	}
-
-	unlink_base_data(base);
-	return NULL;
-}
-
-static void find_unresolved_deltas(struct base_data *base)
-{
-	struct base_data *new_base, *prev_base = NULL;
-	for (;;) {
-		new_base = find_unresolved_deltas_1(base, prev_base);
-
-		if (new_base) {
-			prev_base = base;
-			base = new_base;
-		} else {
-			free(base);
-			base = prev_base;
-			if (!base)
-				return;
-			prev_base = base->base;
-		}
-	}
-}
-
 static int compare_ofs_delta_entry(const void *a, const void *b)
 {
 	const struct ofs_delta_entry *delta_a = a;
@@ -1068,38 +1085,189 @@ static int compare_ref_delta_entry(const void *a, const void *b)
 	return oidcmp(&delta_a->oid, &delta_b->oid);
 }
 
-static void resolve_base(struct object_entry *obj)
-{
-	struct base_data *base_obj = alloc_base_data();
-	base_obj->obj = obj;
-	base_obj->data = NULL;
-	find_unresolved_deltas(base_obj);
-}
-
 static void *threaded_second_pass(void *data)
 {
-	set_thread_data(data);
+	if (data)
+		set_thread_data(data);
 	for (;;) {
-		int i;
+		struct base_data *parent = NULL;
+		struct object_entry *child_obj;
+		struct base_data *child;
+
 		counter_lock();
 		display_progress(progress, nr_resolved_deltas);
 		counter_unlock();
+
 		work_lock();
-		while (nr_dispatched < nr_objects &&
-		       is_delta_type(objects[nr_dispatched].type))
-			nr_dispatched++;
-		if (nr_dispatched >= nr_objects) {
-			work_unlock();
-			break;
+		if (list_empty(&work_head)) {
+			/*
+			 * Take a new base from the objects array.
+			 */
+			while (nr_dispatched < nr_objects &&
+			       is_delta_type(objects[nr_dispatched].type))
+				nr_dispatched++;
+			if (nr_dispatched >= nr_objects) {
+				work_unlock();
+				break;
+			}
+			child_obj = &objects[nr_dispatched++];
+		} else {
+			/*
+			 * Take a child of the base at the top of the stack.
+			 */
+			parent = list_first_entry(&work_head, struct base_data,
+						  list);
+
+			if (parent->ref_first <= parent->ref_last) {
+				child_obj = objects +
+					ref_deltas[parent->ref_first++].obj_no;
+				if (!compare_and_swap_type(&child_obj->real_type,
+							   OBJ_REF_DELTA,
+							   parent->obj->real_type))
+					BUG("child->real_type != OBJ_REF_DELTA");
+			} else {
+				child_obj = objects +
+					ofs_deltas[parent->ofs_first++].obj_no;
+				assert(child_obj->real_type == OBJ_OFS_DELTA);
+				child_obj->real_type = parent->obj->real_type;
+			}
+
+			if (parent->ref_first > parent->ref_last &&
+			    parent->ofs_first > parent->ofs_last) {
+				/*
+				 * All children of this base are handed out;
+				 * keep it until they are resolved.
+				 */
+				list_del(&parent->list);
+				list_add(&parent->list, &done_head);
+			}
+
+			/*
+			 * The parent data may have been pruned; reload it
+			 * while we still hold the mutex, and keep it until
+			 * the delta is applied.
+			 */
+			get_base_data(parent);
+			parent->retain_data++;
 		}
-		i = nr_dispatched++;
 		work_unlock();
 
-		resolve_base(&objects[i]);
+		if (parent) {
+			child = resolve_delta(child_obj, parent);
+			if (!child->children_remaining)
+				FREE_AND_NULL(child->data);
+		} else {
+			child = make_base(child_obj, NULL);
+			if (child->children_remaining) {
+				/*
+				 * Inflate the base now, outside the mutex,
+				 * as its children are going to need it.
+				 */
+				child->data = get_data_from_pack(child_obj);
+				child->size = child_obj->size;
+			}
+		}
+
+		work_lock();
+		if (parent)
+			parent->retain_data--;
+		if (child->data) {
+			/*
+			 * This child has children of its own; let any
+			 * thread pick them up.
+			 */
+			list_add(&child->list, &work_head);
+			base_cache_used += child->size;
+			prune_base_data(NULL);
+		} else {
+			/*
+			 * This child has no children; it may be the last
+			 * descendant of its ancestors, so free those we can.
+			 */
+			struct base_data *p = parent;
+
+			while (p) {
+				struct base_data *next_p;
+
+				p->children_remaining--;
+				if (p->children_remaining)
+					break;
+
+				next_p = p->base;
+				free_base_data(p);
+				list_del(&p->list);
+				free(p);
+
+				p = next_p;
+			}
+			free(child);
+		}
+		work_unlock();
 	}
 	return NULL;
 }
 
+/*
+ * Non-delta objects read by the first pass, to be hashed together by
+ * flush_hash_batch() once there are enough of them.
+ */
+#define HASH_BATCH_OBJECTS 1024
+#define HASH_BATCH_BYTES (8 * 1024 * 1024)
+
+static struct hash_batch_object {
+	struct object_entry *obj;
+	void *data;
+	char hdr[32];
+} *hash_batch;
+static struct git_hash_batch_item *hash_batch_items;
+static int hash_batch_nr, hash_batch_alloc, hash_batch_items_alloc;
+static size_t hash_batch_bytes;
+
+static void flush_hash_batch(void)
+{
+	int i;
+
+	ALLOC_GROW(hash_batch_items, hash_batch_nr, hash_batch_items_alloc);
+	for (i = 0; i < hash_batch_nr; i++) {
+		struct hash_batch_object *b = &hash_batch[i];
+		struct git_hash_batch_item *item = &hash_batch_items[i];
+
+		item->hdr = b->hdr;
+		item->hdrlen = xsnprintf(b->hdr, sizeof(b->hdr),
+					 "%s %"PRIuMAX, type_name(b->obj->type),
+					 (uintmax_t)b->obj->size) + 1;
+		item->buf = b->data;
+		item->len = b->obj->size;
+		item->hash = b->obj->idx.oid.hash;
+	}
+	git_hash_batch(the_hash_algo, hash_batch_items, hash_batch_nr,
+		       nr_threads);
+
+	for (i = 0; i < hash_batch_nr; i++) {
+		struct object_entry *obj = hash_batch[i].obj;
+
+		sha1_object(hash_batch[i].data, NULL, obj->size, obj->type,
+			    &obj->idx.oid);
+		free(hash_batch[i].data);
+	}
+	hash_batch_nr = 0;
+	hash_batch_bytes = 0;
+}
+
+static void add_to_hash_batch(struct object_entry *obj, void *data)
+{
+	struct hash_batch_object *b;
+
+	ALLOC_GROW(hash_batch, hash_batch_nr + 1, hash_batch_alloc);
+	b = &hash_batch[hash_batch_nr++];
+	b->obj = obj;
+	b->data = data;
+	hash_batch_bytes += obj->size;
+	if (hash_batch_nr >= HASH_BATCH_OBJECTS ||
+	    hash_batch_bytes >= HASH_BATCH_BYTES)
+		flush_hash_batch();
+}
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -1136,12 +1304,17 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
-			sha1_object(data, NULL, obj->size, obj->type,
-				    &obj->idx.oid);
+		} else {
+			add_to_hash_batch(obj, data);
+			data = NULL;
+		}
 		free(data);
 		display_progress(progress, i+1);
 	}
+	flush_hash_batch();
+	FREE_AND_NULL(hash_batch);
+	FREE_AND_NULL(hash_batch_items);
+	hash_batch_alloc = hash_batch_items_alloc = 0;
 	objects[i].idx.offset = consumed_bytes;
 	stop_progress(&progress);
 
@@ -1196,6 +1369,7 @@ static void resolve_deltas(void)
 					  nr_ref_deltas + nr_ofs_deltas);
 
 	nr_dispatched = 0;
+	base_cache_limit = delta_base_cache_limit * nr_threads;
 	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
 		init_thread();
 		for (i = 0; i < nr_threads; i++) {
@@ -1210,15 +1384,7 @@ static void resolve_deltas(void)
 		cleanup_thread();
 		return;
 	}
-
-	for (i = 0; i < nr_objects; i++) {
-		struct object_entry *obj = &objects[i];
-
-		if (is_delta_type(obj->type))
-			continue;
-		resolve_base(obj);
-		display_progress(progress, nr_resolved_deltas);
-	}
+	threaded_second_pass(&nothread_data);
 }
 
 /*
@@ -1359,50 +1525,58 @@ static void fix_unresolved_deltas(struct hashfile *f)
 		struct oid_array to_fetch = OID_ARRAY_INIT;
 		for (i = 0; i < nr_ref_deltas; i++) {
 			struct ref_delta_entry *d = sorted_by_pos[i];
-			if (!oid_object_info_extended(the_repository, &d->oid,
-						      NULL,
-						      OBJECT_INFO_FOR_PREFETCH))
-				continue;
 			oid_array_append(&to_fetch, &d->oid);
 		}
-		if (to_fetch.nr)
-			fetch_objects(repository_format_partial_clone,
-				      to_fetch.oid, to_fetch.nr);
+		prefetch_objects(&to_fetch);
 		oid_array_clear(&to_fetch);
 	}
 
 	for (i = 0; i < nr_ref_deltas; i++) {
 		struct ref_delta_entry *d = sorted_by_pos[i];
 		enum object_type type;
-		struct base_data *base_obj = alloc_base_data();
+		struct object_entry *obj;
+		struct base_data *base;
+		unsigned long size;
+		void *data;
 
 		if (objects[d->obj_no].real_type != OBJ_REF_DELTA)
 			continue;
-		base_obj->data = read_object_file(&d->oid, &type,
-						  &base_obj->size);
-		if (!base_obj->data)
+		data = read_object_file(&d->oid, &type, &size);
+		if (!data)
 			continue;
 
-		if (check_object_signature(&d->oid, base_obj->data,
-				base_obj->size, type_name(type)))
+		if (check_object_signature(&d->oid, data, size,
+					   type_name(type)))
 			die(_("local object %s is corrupt"), oid_to_hex(&d->oid));
-		base_obj->obj = append_obj_to_pack(f, d->oid.hash,
-					base_obj->data, base_obj->size, type);
-		find_unresolved_deltas(base_obj);
+		obj = append_obj_to_pack(f, d->oid.hash, data, size, type);
+
+		/*
+		 * Hand the appended object to threaded_second_pass() as
+		 * the only base it has to resolve.
+		 */
+		nr_dispatched = nr_objects;
+		if (!list_empty(&work_head) || !list_empty(&done_head))
+			BUG("delta bases left over from the second pass");
+		base = make_base(obj, NULL);
+		base->data = data;
+		base->size = size;
+		base_cache_used += size;
+		list_add(&base->list, &work_head);
+		threaded_second_pass(NULL);
 		display_progress(progress, nr_resolved_deltas);
 	}
 	free(sorted_by_pos);
 }
 
-static const char *derive_filename(const char *pack_name, const char *suffix,
-				   struct strbuf *buf)
+static const char *derive_filename(const char *pack_name, const char *strip,
+				   const char *suffix, struct strbuf *buf)
 {
 	size_t len;
-	if (!strip_suffix(pack_name, ".pack", &len))
-		die(_("packfile name '%s' does not end with '.pack'"),
-		    pack_name);
+	if (!strip_suffix(pack_name, strip, &len) || !len ||
+	    pack_name[len - 1] != '.')
+		die(_("packfile name '%s' does not end with '.%s'"),
+		    pack_name, strip);
 	strbuf_add(buf, pack_name, len);
-	strbuf_addch(buf, '.');
 	strbuf_addstr(buf, suffix);
 	return buf->buf;
 }
@@ -1417,7 +1591,7 @@ static void write_special_file(const char *suffix, const char *msg,
 	int msg_len = strlen(msg);
 
 	if (pack_name)
-		filename = derive_filename(pack_name, suffix, &name_buf);
+		filename = derive_filename(pack_name, "pack", suffix, &name_buf);
 	else
 		filename = odb_pack_name(&name_buf, hash, suffix);
 
@@ -1442,12 +1616,14 @@ static void write_special_file(const char *suffix, const char *msg,
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_index_name, const char *curr_rev_index_name,
 		  const char *keep_msg, const char *promisor_msg,
 		  unsigned char *hash)
 {
 	const char *report = "pack";
 	struct strbuf pack_name = STRBUF_INIT;
 	struct strbuf index_name = STRBUF_INIT;
+	struct strbuf rev_index_name = STRBUF_INIT;
 	int err;
 
 	if (!from_stdin) {
@@ -1482,6 +1658,16 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else
 		chmod(final_index_name, 0444);
 
+	if (curr_rev_index_name) {
+		if (final_rev_index_name != curr_rev_index_name) {
+			if (!final_rev_index_name)
+				final_rev_index_name = odb_pack_name(&rev_index_name, hash, "rev");
+			if (finalize_object_file(curr_rev_index_name, final_rev_index_name))
+				die(_("cannot store reverse index file"));
+		} else
+			chmod(final_rev_index_name, 0444);
+	}
+
 	if (do_fsck_object) {
 		struct packed_git *p;
 		p = add_packed_git(final_index_name, strlen(final_index_name), 0);
@@ -1511,6 +1697,7 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 		}
 	}
 
+	strbuf_release(&rev_index_name);
 	strbuf_release(&index_name);
 	strbuf_release(&pack_name);
 }
@@ -1536,6 +1723,13 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 		}
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -1659,15 +1853,19 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
 	const char *curr_index;
+	const char *curr_rev_index = NULL;
+	const char *rev_index_name = NULL;
 	const char *index_name = NULL, *pack_name = NULL;
 	const char *keep_msg = NULL;
 	const char *promisor_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT;
+	struct strbuf rev_index_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
 	unsigned char pack_hash[GIT_MAX_RAWSZ];
 	unsigned foreign_nr = 1;	/* zero is a "good" value, assume bad */
 	int report_end_of_input = 0;
+	int nr_received;
 
 	/*
 	 * index-pack never needs to fetch missing objects except when
@@ -1684,6 +1882,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	fsck_options.walk = mark_link;
 
 	reset_pack_idx_option(&opts);
+	if (git_env_bool(GIT_TEST_WRITE_REV_INDEX, 0))
+		opts.flags |= WRITE_REV;
 	git_config(git_index_pack_config, &opts);
 	if (prefix && chdir(prefix))
 		die(_("Cannot come back to cwd"));
@@ -1703,6 +1903,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			} else if (!strcmp(arg, "--check-self-contained-and-connected")) {
 				strict = 1;
 				check_self_contained_and_connected = 1;
+			} else if (skip_prefix(arg, "--foreign-objects=", &foreign_objects_file)) {
+				strict = 1;
 			} else if (!strcmp(arg, "--fsck-objects")) {
 				do_fsck_object = 1;
 			} else if (!strcmp(arg, "--verify")) {
@@ -1759,6 +1961,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 					opts.off32_limit = strtoul(c+1, &c, 0);
 				if (*c || opts.off32_limit & 0x80000000)
 					die(_("bad %s"), arg);
+			} else if (!strcmp(arg, "--rev-index")) {
+				opts.flags |= WRITE_REV;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				opts.flags &= ~WRITE_REV;
 			} else if (skip_prefix(arg, "--max-input-size=", &arg)) {
 				max_input_size = strtoumax(arg, NULL, 10);
 			} else
@@ -1778,7 +1984,13 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	if (from_stdin && !startup_info->have_repository)
 		die(_("--stdin requires a git repository"));
 	if (!index_name && pack_name)
-		index_name = derive_filename(pack_name, "idx", &index_name_buf);
+		index_name = derive_filename(pack_name, "pack", "idx", &index_name_buf);
+
+	if (verify)
+		opts.flags &= ~WRITE_REV;
+	if ((opts.flags & WRITE_REV) && index_name)
+		rev_index_name = derive_filename(index_name, "idx", "rev",
+						 &rev_index_name_buf);
 
 	if (verify) {
 		if (!index_name)
@@ -1806,11 +2018,14 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	if (report_end_of_input)
 		write_in_full(2, "\0", 1);
 	resolve_deltas();
+	nr_received = nr_objects;
 	conclude_pack(fix_thin_pack, curr_pack, pack_hash);
 	free(ofs_deltas);
 	free(ref_deltas);
 	if (strict)
 		foreign_nr = check_objects();
+	if (foreign_objects_file)
+		write_foreign_objects(nr_received);
 
 	if (show_stat)
 		show_pack_info(stat_only);
@@ -1819,11 +2034,15 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_hash);
+	if (opts.flags & WRITE_REV)
+		curr_rev_index = write_rev_file(rev_index_name, idx_objects,
+						nr_objects, pack_hash);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_index_name, curr_rev_index,
 		      keep_msg, promisor_msg,
 		      pack_hash);
 	else
@@ -1834,10 +2053,13 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 
 	free(objects);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_index_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_index_name == NULL)
+		free((void *) curr_rev_index);
 
 	/*
 	 * Let the caller know this pack is not self contained
@@ -23,6 +23,7 @@
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
 static const char *init_db_template_dir;
+static const char *init_ref_format;
 
 static void copy_templates_1(struct strbuf *path, struct strbuf *template_path,
 			     DIR *dir)
@@ -229,6 +230,14 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	/*
+	 * Check for an existing HEAD before setting up the refs db,
+	 * some backends write a placeholder HEAD file.
+	 */
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -236,9 +245,6 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
@@ -246,8 +252,11 @@ static int create_default_files(const char *template_path,
 
 	/* This forces creation of new config file */
 	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
+		  "%d", repository_format_ref_storage ? 1 : GIT_REPO_VERSION);
 	git_config_set("core.repositoryformatversion", repo_version_string);
+	if (repository_format_ref_storage)
+		git_config_set("extensions.refstorage",
+			       repository_format_ref_storage);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -340,6 +349,42 @@ static void separate_git_dir(const char *git_dir, const char *git_link)
 	write_file(git_link, "gitdir: %s", git_dir);
 }
 
+/*
+ * Pick the ref storage format of a new repository: the one given with
+ * --ref-format, or $GIT_DEFAULT_REF_FORMAT. An existing repository
+ * keeps its format.
+ */
+static void set_ref_storage_format(const char *git_dir)
+{
+	const char *format = init_ref_format;
+	struct strbuf path = STRBUF_INIT;
+	int exists;
+
+	if (!format)
+		format = getenv(GIT_DEFAULT_REF_FORMAT_ENVIRONMENT);
+	if (!format)
+		return;
+	if (!ref_storage_backend_exists(format))
+		die(_("unknown ref storage format '%s'"), format);
+
+	strbuf_addf(&path, "%s/HEAD", git_dir);
+	exists = !access(path.buf, F_OK);
+	strbuf_release(&path);
+
+	if (exists) {
+		const char *current = repository_format_ref_storage ?
+			repository_format_ref_storage : "files";
+
+		if (init_ref_format && strcmp(format, current))
+			die(_("attempt to reinitialize repository with different ref storage format"));
+		return;
+	}
+
+	free(repository_format_ref_storage);
+	repository_format_ref_storage =
+		strcmp(format, "files") ? xstrdup(format) : NULL;
+}
+
 int init_db(const char *git_dir, const char *real_git_dir,
 	    const char *template_dir, unsigned int flags)
 {
@@ -380,6 +425,8 @@ int init_db(const char *git_dir, const char *real_git_dir,
 	 */
 	check_repository_format();
 
+	set_ref_storage_format(git_dir);
+
 	reinit = create_default_files(template_dir, original_git_dir);
 
 	create_object_directory();
@@ -465,7 +512,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-format=<format>] [<directory>]"),
 	NULL
 };
 
@@ -494,11 +541,16 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-format", &init_ref_format, N_("format"),
+			   N_("specify the ref storage format to use")),
 		OPT_END()
 	};
 
 	argc = parse_options(argc, argv, prefix, init_db_options, init_db_usage, 0);
 
+	if (init_ref_format && !ref_storage_backend_exists(init_ref_format))
+		die(_("unknown ref storage format '%s'"), init_ref_format);
+
 	if (real_git_dir && !is_absolute_path(real_git_dir))
 		real_git_dir = real_pathdup(real_git_dir, 1);
 
@@ -35,6 +35,7 @@
 #include "commit-reach.h"
 #include "interdiff.h"
 #include "range-diff.h"
+#include "thread-utils.h"
 
 #define MAIL_DEFAULT_WRAP 72
 
@@ -45,6 +46,7 @@ static int default_abbrev_commit;
 static int default_show_root = 1;
 static int default_follow;
 static int default_show_signature;
+static int log_threads = 1;
 static int decoration_style;
 static int decoration_given;
 static int use_mailmap_config = 1;
@@ -181,6 +183,8 @@ static void cmd_log_init_finish(int argc, const char **argv, const char *prefix,
 		OPT_CALLBACK('L', NULL, &line_cb, "n,m:file",
 			     N_("Process line range n,m in file, counting from 1"),
 			     log_line_range_callback),
+		OPT_INTEGER(0, "threads", &log_threads,
+			    N_("prepare patches on <n> threads")),
 		OPT_END()
 	};
 
@@ -195,6 +199,13 @@ static void cmd_log_init_finish(int argc, const char **argv, const char *prefix,
 
 	if (quiet)
 		rev->diffopt.output_format |= DIFF_FORMAT_NO_OUTPUT;
+	if (!HAVE_THREADS && log_threads > 1) {
+		warning(_("no threads support, ignoring --threads"));
+		log_threads = 1;
+	} else if (log_threads < 0)
+		die(_("invalid number of threads specified (%d)"), log_threads);
+	else if (log_threads == 0)
+		log_threads = online_cpus();
 	argc = setup_revisions(argc, argv, rev, opt);
 
 	/* Any arguments at this point are not recognized */
@@ -379,6 +390,7 @@ static int cmd_log_walk(struct rev_info *rev)
 	struct commit *commit;
 	int saved_nrl = 0;
 	int saved_dcctc = 0, close_file = rev->diffopt.close_file;
+	int threaded;
 
 	if (rev->early_output)
 		setup_early_output();
@@ -395,7 +407,9 @@ static int cmd_log_walk(struct rev_info *rev)
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
 	rev->diffopt.close_file = 0;
-	while ((commit = get_revision(rev)) != NULL) {
+	threaded = log_tree_start_threads(rev, log_threads);
+	while ((commit = threaded ? log_tree_next_commit(rev) :
+				    get_revision(rev)) != NULL) {
 		if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
 			/*
 			 * We decremented max_count in get_revision,
@@ -417,6 +431,8 @@ static int cmd_log_walk(struct rev_info *rev)
 		if (rev->diffopt.degraded_cc_to_c)
 			saved_dcctc = 1;
 	}
+	if (threaded)
+		log_tree_stop_threads(rev);
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
 	if (close_file)
@@ -467,6 +483,10 @@ static int git_log_config(const char *var, const char *value, void *cb)
 		default_show_signature = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "log.threads")) {
+		log_threads = git_config_int(var, value);
+		return 0;
+	}
 
 	if (grep_config(var, value, cb) < 0)
 		return -1;
@@ -7,8 +7,15 @@
 #include "blob.h"
 #include "exec-cmd.h"
 #include "merge-blobs.h"
-
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+#include "merge-recursive.h"
+#include "parse-options.h"
+#include "quote.h"
+
+static const char * const merge_tree_usage[] = {
+	N_("git merge-tree --write-tree [<options>] <branch1> <branch2>"),
+	N_("git merge-tree <base-tree> <branch1> <branch2>"),
+	NULL
+};
 
 struct merge_list {
 	struct merge_list *next;
@@ -28,7 +35,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -109,7 +116,7 @@ static void show_diff(struct merge_list *entry)
 	xdemitconf_t xecfg;
 	xdemitcb_t ecb;
 
-	xpp.flags = 0;
+	memset(&xpp, 0, sizeof(xpp));
 	memset(&xecfg, 0, sizeof(xecfg));
 	xecfg.ctxlen = 3;
 	ecb.out_hunk = NULL;
@@ -227,7 +234,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(r, t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -344,7 +351,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -368,19 +375,99 @@ static void *get_tree_descriptor(struct repository *r,
 	return buf;
 }
 
+static struct commit *get_commit(struct repository *r, const char *rev)
+{
+	struct object_id oid;
+	struct commit *commit;
+
+	if (repo_get_oid(r, rev, &oid))
+		die(_("unknown rev %s"), rev);
+	commit = lookup_commit_reference(r, &oid);
+	if (!commit)
+		die(_("%s is not a commit"), rev);
+	return commit;
+}
+
+/*
+ * Merge the commits "branch1" and "branch2" as merge-recursive would,
+ * without an index file or a working tree, and print the tree of the
+ * working tree the merge would have left behind, then the unmerged
+ * entries of the index, and the messages of the merge.
+ */
+static int write_tree(struct repository *r, const char *branch1,
+		      const char *branch2, int show_messages,
+		      int line_termination)
+{
+	struct merge_options opt;
+	struct commit *h1 = get_commit(r, branch1);
+	struct commit *h2 = get_commit(r, branch2);
+	struct commit *result;
+	int clean, i;
+
+	init_merge_options(&opt, r);
+	opt.branch1 = branch1;
+	opt.branch2 = branch2;
+	opt.in_memory = 1;
+	opt.no_worktree = 1;
+	opt.buffer_output = 2;
+
+	clean = merge_recursive(&opt, h1, h2, NULL, &result);
+	if (clean < 0) {
+		fputs(opt.obuf.buf, stderr);
+		die(_("merging %s and %s failed"), branch1, branch2);
+	}
+
+	printf("%s%c", oid_to_hex(get_commit_tree_oid(result)),
+	       line_termination);
+	for (i = 0; i < r->index->cache_nr; i++) {
+		const struct cache_entry *ce = r->index->cache[i];
+
+		if (!ce_stage(ce))
+			continue;
+		printf("%06o %s %d\t", ce->ce_mode, oid_to_hex(&ce->oid),
+		       ce_stage(ce));
+		write_name_quoted(ce->name, stdout, line_termination);
+	}
+	if (show_messages < 0)
+		show_messages = !clean;
+	if (show_messages) {
+		putchar(line_termination);
+		fputs(opt.obuf.buf, stdout);
+	}
+	strbuf_release(&opt.obuf);
+	return !clean;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct repository *r = the_repository;
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
+	int write_tree_mode = 0, show_messages = -1, line_termination = '\n';
+	struct option options[] = {
+		OPT_BOOL(0, "write-tree", &write_tree_mode,
+			 N_("merge the two commits and write the resulting tree")),
+		OPT_BOOL(0, "messages", &show_messages,
+			 N_("also show informational messages")),
+		OPT_SET_INT('z', NULL, &line_termination,
+			    N_("terminate entries with NUL"), '\0'),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options, merge_tree_usage, 0);
+	if (write_tree_mode) {
+		if (argc != 2)
+			usage_with_options(merge_tree_usage, options);
+		return write_tree(r, argv[0], argv[1], show_messages,
+				  line_termination);
+	}
+	if (argc != 3 || show_messages >= 0 || line_termination != '\n')
+		usage_with_options(merge_tree_usage, options);
 
-	if (argc != 4)
-		usage(merge_tree_usage);
-
-	buf1 = get_tree_descriptor(r, t+0, argv[1]);
-	buf2 = get_tree_descriptor(r, t+1, argv[2]);
-	buf3 = get_tree_descriptor(r, t+2, argv[3]);
-	merge_trees(t, "");
+	buf1 = get_tree_descriptor(r, t+0, argv[0]);
+	buf2 = get_tree_descriptor(r, t+1, argv[1]);
+	buf3 = get_tree_descriptor(r, t+2, argv[2]);
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -3,16 +3,20 @@
 #include "config.h"
 #include "parse-options.h"
 #include "midx.h"
+#include "thread-utils.h"
 #include "trace2.h"
 
 static char const * const builtin_multi_pack_index_usage[] = {
-	N_("git multi-pack-index [--object-dir=<dir>] (write|verify|expire|repack --batch-size=<size>)"),
+	N_("git multi-pack-index [--object-dir=<dir>] (write [--bitmap | --incremental [--size-multiple=<n>] | --include-alternates]|verify [--threads=<n>]|expire|repack --batch-size=<size>)"),
 	NULL
 };
 
 static struct opts_multi_pack_index {
 	const char *object_dir;
 	unsigned long batch_size;
+	unsigned flags;
+	int size_multiple;
+	int threads;
 } opts;
 
 int cmd_multi_pack_index(int argc, const char **argv,
@@ -23,6 +27,19 @@ int cmd_multi_pack_index(int argc, const char **argv,
 		  N_("object directory containing set of packfile and pack-index pairs")),
 		OPT_MAGNITUDE(0, "batch-size", &opts.batch_size,
 		  N_("during repack, collect pack-files of smaller size into a batch that is larger than this size")),
+		OPT_BIT(0, "bitmap", &opts.flags,
+		  N_("write a reachability bitmap for the multi-pack-index"),
+		  MIDX_WRITE_BITMAP),
+		OPT_BIT(0, "incremental", &opts.flags,
+		  N_("add a layer for new packs to an incremental multi-pack-index chain"),
+		  MIDX_WRITE_INCREMENTAL),
+		OPT_BIT(0, "include-alternates", &opts.flags,
+		  N_("cover the packs of the alternate object directories, too"),
+		  MIDX_WRITE_ALTERNATES),
+		OPT_INTEGER(0, "size-multiple", &opts.size_multiple,
+		  N_("maximal size ratio between two layers of an incremental chain")),
+		OPT_INTEGER(0, "threads", &opts.threads,
+		  N_("during verify, use <n> threads to check the object offsets")),
 		OPT_END(),
 	};
 
@@ -46,15 +63,43 @@ int cmd_multi_pack_index(int argc, const char **argv,
 
 	trace2_cmd_mode(argv[0]);
 
+	if (opts.threads && strcmp(argv[0], "verify"))
+		die(_("--threads option is only for 'verify' subcommand"));
+	if (opts.threads <= 0)
+		opts.threads = online_cpus();
+
 	if (!strcmp(argv[0], "repack"))
 		return midx_repack(the_repository, opts.object_dir, (size_t)opts.batch_size);
 	if (opts.batch_size)
 		die(_("--batch-size option is only for 'repack' subcommand"));
 
-	if (!strcmp(argv[0], "write"))
-		return write_midx_file(opts.object_dir);
+	if (opts.size_multiple && !(opts.flags & MIDX_WRITE_INCREMENTAL))
+		die(_("--size-multiple requires --incremental"));
+	if (opts.size_multiple < 0)
+		die(_("--size-multiple must be positive"));
+
+	if (!strcmp(argv[0], "write")) {
+		struct split_midx_opts split_opts;
+
+		if ((opts.flags & MIDX_WRITE_BITMAP) &&
+		    (opts.flags & MIDX_WRITE_INCREMENTAL))
+			die(_("--bitmap and --incremental are incompatible"));
+		if ((opts.flags & MIDX_WRITE_ALTERNATES) &&
+		    (opts.flags & (MIDX_WRITE_BITMAP | MIDX_WRITE_INCREMENTAL)))
+			die(_("--include-alternates cannot be used with --bitmap or --incremental"));
+
+		split_opts.size_multiple = opts.size_multiple;
+		return write_midx_file(opts.object_dir, opts.flags, &split_opts);
+	}
+	if (opts.flags & MIDX_WRITE_BITMAP)
+		die(_("--bitmap option is only for 'write' subcommand"));
+	if (opts.flags & MIDX_WRITE_INCREMENTAL)
+		die(_("--incremental option is only for 'write' subcommand"));
+	if (opts.flags & MIDX_WRITE_ALTERNATES)
+		die(_("--include-alternates option is only for 'write' subcommand"));
 	if (!strcmp(argv[0], "verify"))
-		return verify_midx_file(the_repository, opts.object_dir);
+		return verify_midx_file(the_repository, opts.object_dir,
+					opts.threads);
 	if (!strcmp(argv[0], "expire"))
 		return expire_midx_packs(the_repository, opts.object_dir);
 
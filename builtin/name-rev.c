@@ -3,11 +3,13 @@
 #include "repository.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "tag.h"
 #include "refs.h"
 #include "parse-options.h"
 #include "sha1-lookup.h"
 #include "commit-slab.h"
+#include "prio-queue.h"
 
 #define CUTOFF_DATE_SLOP 86400 /* one day */
 
@@ -19,24 +21,32 @@ typedef struct rev_name {
 	int from_tag;
 } rev_name;
 
-define_commit_slab(commit_rev_name, struct rev_name *);
+define_commit_slab(commit_rev_name, struct rev_name);
 
 static timestamp_t cutoff = TIME_MAX;
+static timestamp_t generation_cutoff = GENERATION_NUMBER_INFINITY;
 static struct commit_rev_name rev_names;
 
 /* How many generations are maximally preferred over _one_ merge traversal? */
 #define MERGE_TRAVERSAL_WEIGHT 65535
 
-static struct rev_name *get_commit_rev_name(struct commit *commit)
+/*
+ * Nothing older than the commits to name can lead to them. Generation
+ * numbers say so exactly, when all of them are in the commit-graph;
+ * the commit date, with some slop for clock skew, otherwise.
+ */
+static int commit_is_before_cutoff(struct commit *commit)
 {
-	struct rev_name **slot = commit_rev_name_peek(&rev_names, commit);
-
-	return slot ? *slot : NULL;
+	if (generation_cutoff < GENERATION_NUMBER_INFINITY)
+		return commit->generation < generation_cutoff;
+	return commit->date < cutoff;
 }
 
-static void set_commit_rev_name(struct commit *commit, struct rev_name *name)
+static struct rev_name *get_commit_rev_name(struct commit *commit)
 {
-	*commit_rev_name_at(&rev_names, commit) = name;
+	struct rev_name *name = commit_rev_name_peek(&rev_names, commit);
+
+	return name && name->tip_name ? name : NULL;
 }
 
 static int is_better_name(struct rev_name *name,
@@ -75,68 +85,115 @@ static int is_better_name(struct rev_name *name,
 	return 0;
 }
 
-static void name_rev(struct commit *commit,
-		const char *tip_name, timestamp_t taggerdate,
-		int generation, int distance, int from_tag,
-		int deref)
+static struct rev_name *create_or_update_name(struct commit *commit,
+					      timestamp_t taggerdate,
+					      int generation, int distance,
+					      int from_tag)
 {
 	struct rev_name *name = get_commit_rev_name(commit);
-	struct commit_list *parents;
-	int parent_number = 1;
-	char *to_free = NULL;
 
-	parse_commit(commit);
+	if (name && !is_better_name(name, taggerdate, distance, from_tag))
+		return NULL;
 
-	if (commit->date < cutoff)
-		return;
+	name = commit_rev_name_at(&rev_names, commit);
+	name->taggerdate = taggerdate;
+	name->generation = generation;
+	name->distance = distance;
+	name->from_tag = from_tag;
+	return name;
+}
 
-	if (deref) {
-		tip_name = to_free = xstrfmt("%s^0", tip_name);
+static char *get_parent_name(const struct rev_name *name, int parent_number)
+{
+	size_t len;
 
-		if (generation)
-			die("generation: %d, but deref?", generation);
-	}
+	strip_suffix(name->tip_name, "^0", &len);
+	if (name->generation > 0)
+		return xstrfmt("%.*s~%d^%d", (int)len, name->tip_name,
+			       name->generation, parent_number);
+	return xstrfmt("%.*s^%d", (int)len, name->tip_name, parent_number);
+}
 
-	if (name == NULL) {
-		name = xmalloc(sizeof(rev_name));
-		set_commit_rev_name(commit, name);
-		goto copy_data;
-	} else if (is_better_name(name, taggerdate, distance, from_tag)) {
-copy_data:
-		name->tip_name = tip_name;
-		name->taggerdate = taggerdate;
-		name->generation = generation;
-		name->distance = distance;
-		name->from_tag = from_tag;
-	} else {
-		free(to_free);
+/*
+ * Name the commits reachable from "start_commit" after it, depth-first
+ * and first parents first, with an explicit stack rather than by
+ * recursion, which overflows on long histories.
+ */
+static void name_rev(struct commit *start_commit,
+		const char *tip_name, timestamp_t taggerdate,
+		int from_tag, int deref)
+{
+	struct prio_queue stack = { NULL };
+	struct commit *commit;
+	struct commit **parents_to_push = NULL;
+	size_t parents_to_push_nr, parents_to_push_alloc = 0;
+	struct rev_name *start_name;
+
+	parse_commit(start_commit);
+	if (commit_is_before_cutoff(start_commit))
 		return;
-	}
 
-	for (parents = commit->parents;
-			parents;
-			parents = parents->next, parent_number++) {
-		if (parent_number > 1) {
-			size_t len;
-			char *new_name;
-
-			strip_suffix(tip_name, "^0", &len);
-			if (generation > 0)
-				new_name = xstrfmt("%.*s~%d^%d", (int)len, tip_name,
-						   generation, parent_number);
+	start_name = create_or_update_name(start_commit, taggerdate, 0, 0,
+					   from_tag);
+	if (!start_name)
+		return;
+	if (deref)
+		start_name->tip_name = xstrfmt("%s^0", tip_name);
+	else
+		start_name->tip_name = xstrdup(tip_name);
+
+	/* without a compare function, the prio_queue is a stack */
+	prio_queue_put(&stack, start_commit);
+
+	while ((commit = prio_queue_get(&stack))) {
+		struct rev_name *name = get_commit_rev_name(commit);
+		struct commit_list *parents;
+		int parent_number = 1;
+
+		parents_to_push_nr = 0;
+
+		for (parents = commit->parents;
+				parents;
+				parents = parents->next, parent_number++) {
+			struct commit *parent = parents->item;
+			struct rev_name *parent_name;
+			int generation, distance;
+
+			parse_commit(parent);
+			if (commit_is_before_cutoff(parent))
+				continue;
+
+			if (parent_number > 1) {
+				generation = 0;
+				distance = name->distance + MERGE_TRAVERSAL_WEIGHT;
+			} else {
+				generation = name->generation + 1;
+				distance = name->distance + 1;
+			}
+
+			parent_name = create_or_update_name(parent, taggerdate,
+							    generation,
+							    distance, from_tag);
+			if (!parent_name)
+				continue;
+			if (parent_number > 1)
+				parent_name->tip_name =
+					get_parent_name(name, parent_number);
 			else
-				new_name = xstrfmt("%.*s^%d", (int)len, tip_name,
-						   parent_number);
-
-			name_rev(parents->item, new_name, taggerdate, 0,
-				 distance + MERGE_TRAVERSAL_WEIGHT,
-				 from_tag, 0);
-		} else {
-			name_rev(parents->item, tip_name, taggerdate,
-				 generation + 1, distance + 1,
-				 from_tag, 0);
+				parent_name->tip_name = name->tip_name;
+			ALLOC_GROW(parents_to_push, parents_to_push_nr + 1,
+				   parents_to_push_alloc);
+			parents_to_push[parents_to_push_nr++] = parent;
 		}
+
+		/* the first parent must come out of the stack first */
+		while (parents_to_push_nr)
+			prio_queue_put(&stack,
+				       parents_to_push[--parents_to_push_nr]);
 	}
+
+	clear_prio_queue(&stack);
+	free(parents_to_push);
 }
 
 static int subpath_matches(const char *path, const char *filter)
@@ -270,8 +327,7 @@ static int name_ref(const char *path, const struct object_id *oid, int flags, vo
 		if (taggerdate == TIME_MAX)
 			taggerdate = ((struct commit *)o)->date;
 		path = name_ref_abbrev(path, can_abbreviate_output);
-		name_rev(commit, xstrdup(path), taggerdate, 0, 0,
-			 from_tag, deref);
+		name_rev(commit, path, taggerdate, from_tag, deref);
 	}
 	return 0;
 }
@@ -437,7 +493,7 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		usage_with_options(name_rev_usage, opts);
 	}
 	if (all || transform_stdin)
-		cutoff = 0;
+		cutoff = generation_cutoff = 0;
 
 	for (; argc; argc--, argv++) {
 		struct object_id oid;
@@ -468,6 +524,8 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		if (commit) {
 			if (cutoff > commit->date)
 				cutoff = commit->date;
+			if (generation_cutoff > commit->generation)
+				generation_cutoff = commit->generation;
 		}
 
 		if (peel_tag) {
@@ -483,6 +541,8 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 
 	if (cutoff)
 		cutoff = cutoff - CUTOFF_DATE_SLOP;
+	if (!generation_numbers_enabled(the_repository))
+		generation_cutoff = GENERATION_NUMBER_INFINITY;
 	for_each_ref(name_ref, &data);
 
 	if (transform_stdin) {
@@ -33,6 +33,8 @@
 #include "object-store.h"
 #include "dir.h"
 #include "midx.h"
+#include "oidmap.h"
+#include "pack-mtimes.h"
 #include "trace2.h"
 
 #define IN_PACK(obj) oe_in_pack(&to_pack, obj)
@@ -70,6 +72,8 @@ static int non_empty;
 static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static timestamp_t unpack_unreachable_expiration;
+static int cruft;
+static timestamp_t cruft_expiration;
 static int pack_loose_unreachable;
 static int local;
 static int have_non_local_packs;
@@ -90,9 +94,10 @@ static int thin;
 static int num_preferred_base;
 static struct progress *progress_state;
 
-static struct packed_git *reuse_packfile;
+static struct bitmapped_pack *reuse_packs;
+static size_t reuse_packs_nr;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
@@ -106,6 +111,7 @@ static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
 static int exclude_promisor_objects;
 
 static int use_delta_islands;
+static int name_hash_version = 1;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
@@ -404,7 +410,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 {
 	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = oe_type(entry);
 	off_t datalen;
@@ -421,10 +427,15 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 					      type, entry_size);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("write_reuse_object: could not locate %s, expected at "
+		      "offset %"PRIuMAX" in pack %s"),
+		    oid_to_hex(&entry->idx.oid), (uintmax_t)offset,
+		    p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -784,63 +795,231 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct hashfile *f)
+/*
+ * The offsets that the objects of the pack being reused move by in our
+ * output, because of the objects we left out before them: from offset
+ * "original" on, up to the next chunk, an object ends up "difference"
+ * bytes earlier.
+ */
+static struct reused_chunk {
+	off_t original;
+	off_t difference;
+} *reused_chunks;
+static int reused_chunks_nr;
+static int reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t offset)
 {
-	unsigned char buffer[8192];
-	off_t to_write, total;
-	int fd;
+	if (reused_chunks_nr &&
+	    reused_chunks[reused_chunks_nr - 1].difference == offset)
+		return;
 
-	if (!is_pack_valid(reuse_packfile))
-		die(_("packfile is invalid: %s"), reuse_packfile->pack_name);
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1,
+		   reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = offset;
+	reused_chunks_nr++;
+}
 
-	fd = git_open(reuse_packfile->pack_name);
-	if (fd < 0)
-		die_errno(_("unable to open packfile for reuse: %s"),
-			  reuse_packfile->pack_name);
+/*
+ * Binary search to find the chunk that "where" is in. Note
+ * that we're not looking for an exact match, just the first
+ * chunk that contains it (which implicitly ends at the start
+ * of the next chunk).
+ */
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
+	while (lo < hi) {
+		int mi = lo + ((hi - lo) / 2);
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
 
-	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
-		die_errno(_("unable to seek in reused packfile"));
+	/*
+	 * The first chunk starts with the first object we reuse, and
+	 * deltas only refer to objects before them.
+	 */
+	assert(lo);
+	return reused_chunks[lo - 1].difference;
+}
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - the_hash_algo->rawsz;
+/*
+ * Bytes of the reused pack that go out as they are, once we reach
+ * something that does not directly follow them.
+ */
+struct reused_run {
+	off_t start, end;
+};
+
+static void flush_reused_run(struct hashfile *out, struct packed_git *p,
+			     struct pack_window **w_curs,
+			     struct reused_run *run)
+{
+	if (run->end > run->start)
+		copy_pack_data(out, p, w_curs, run->start,
+			       run->end - run->start);
+	run->start = run->end = 0;
+}
+
+static void write_reused_pack_one(struct hashfile *out,
+				  struct bitmapped_pack *pack, uint32_t pos,
+				  struct pack_window **w_curs,
+				  struct reused_run *run)
+{
+	struct packed_git *p = pack->p;
+	off_t offset, next, cur;
+	enum object_type type;
+	unsigned long size;
+
+	offset = bitmapped_pack_object(bitmap_git, pack, pos, &next);
+	record_reused_object(offset, offset - (hashfile_total(out) +
+					       run->end - run->start));
+
+	/* without a gap so far, no delta needs its offset rewritten */
+	if (reused_chunks_nr > 1) {
+		cur = offset;
+		type = unpack_object_header(p, w_curs, &cur, &size);
+		if (type == OBJ_OFS_DELTA) {
+			off_t base_offset, fixup;
+
+			base_offset = get_delta_base(p, w_curs, &cur, type,
+						     offset);
+			assert(base_offset);
+			fixup = find_reused_offset(offset) -
+				find_reused_offset(base_offset);
+			if (fixup) {
+				unsigned char header[MAX_PACK_OBJECT_HEADER];
+				unsigned char ofs_header[10];
+				unsigned i, len, ofs_len;
+				off_t ofs = offset - base_offset - fixup;
+
+				flush_reused_run(out, p, w_curs, run);
+
+				len = encode_in_pack_object_header(header,
+						sizeof(header),
+						OBJ_OFS_DELTA, size);
+
+				i = sizeof(ofs_header) - 1;
+				ofs_header[i] = ofs & 127;
+				while (ofs >>= 7)
+					ofs_header[--i] = 128 | (--ofs & 127);
+				ofs_len = sizeof(ofs_header) - i;
+
+				hashwrite(out, header, len);
+				hashwrite(out, ofs_header + i, ofs_len);
+				copy_pack_data(out, p, w_curs, cur, next - cur);
+				return;
+			}
+		}
+	}
 
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+	if (run->end != offset) {
+		flush_reused_run(out, p, w_curs, run);
+		run->start = offset;
+	}
+	run->end = next;
+}
 
-	while (to_write) {
-		int read_pack = xread(fd, buffer, sizeof(buffer));
+static void write_reused_pack_1(struct hashfile *out,
+				struct bitmapped_pack *pack)
+{
+	struct pack_window *w_curs = NULL;
+	struct reused_run run = { 0, 0 };
+	uint32_t pos = pack->bitmap_pos;
+	uint32_t end = pos + pack->bitmap_nr;
 
-		if (read_pack <= 0)
-			die_errno(_("unable to read from reused packfile"));
+	if (!is_pack_valid(pack->p))
+		die(_("packfile is invalid: %s"), pack->p->pack_name);
 
-		if (read_pack > to_write)
-			read_pack = to_write;
+	reused_chunks_nr = 0;
+	for (; pos < end; pos++) {
+		size_t word = pos / BITS_IN_EWORD;
 
-		hashwrite(f, buffer, read_pack);
-		to_write -= read_pack;
+		if (word >= reuse_packfile_bitmap->word_alloc)
+			break;
+		if (!reuse_packfile_bitmap->words[word]) {
+			pos |= BITS_IN_EWORD - 1;
+			continue;
+		}
+		if (!bitmap_get(reuse_packfile_bitmap, pos))
+			continue;
 
-		/*
-		 * We don't know the actual number of objects written,
-		 * only how many bytes written, how many bytes total, and
-		 * how many objects total. So we can fake it by pretending all
-		 * objects we are writing are the same size. This gives us a
-		 * smooth progress meter, and at the end it matches the true
-		 * answer.
-		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
-		display_progress(progress_state, written);
+		write_reused_pack_one(out, pack, pos, &w_curs, &run);
+		display_progress(progress_state, ++written);
 	}
+	flush_reused_run(out, pack->p, &w_curs, &run);
+	unuse_pack(&w_curs);
+}
 
-	close(fd);
-	written = reuse_packfile_objects;
-	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+/*
+ * Send the objects that reuse_partial_packfile_from_bitmap() picked,
+ * pack after pack, copying runs of them verbatim and rewriting only
+ * the OFS_DELTA offsets that span objects we left out.
+ */
+static void write_reused_pack(struct hashfile *f)
+{
+	size_t i;
+
+	for (i = 0; i < reuse_packs_nr; i++)
+		write_reused_pack_1(f, &reuse_packs[i]);
 }
 
 static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
 
+/*
+ * The candidates for a cruft pack, i.e. the objects of the packs that
+ * are going away and the loose objects, with the most recent mtime any
+ * of their copies has.
+ */
+struct cruft_object {
+	struct oidmap_entry entry;
+	timestamp_t mtime;
+};
+static struct oidmap cruft_objects = OIDMAP_INIT;
+
+static int idx_entry_oid_cmp(const void *va, const void *vb)
+{
+	const struct pack_idx_entry *a = *(const struct pack_idx_entry **)va;
+	const struct pack_idx_entry *b = *(const struct pack_idx_entry **)vb;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static void write_cruft_mtimes(const char *mtimes_name,
+			       struct pack_idx_entry **written_list,
+			       uint32_t nr_written, const unsigned char *hash)
+{
+	struct pack_idx_entry **sorted;
+	uint32_t *mtimes;
+	uint32_t i;
+
+	ALLOC_ARRAY(sorted, nr_written);
+	COPY_ARRAY(sorted, written_list, nr_written);
+	QSORT(sorted, nr_written, idx_entry_oid_cmp);
+
+	ALLOC_ARRAY(mtimes, nr_written);
+	for (i = 0; i < nr_written; i++) {
+		struct cruft_object *c = oidmap_get(&cruft_objects,
+						    &sorted[i]->oid);
+		if (!c)
+			BUG("object %s is not a cruft candidate",
+			    oid_to_hex(&sorted[i]->oid));
+		mtimes[i] = (uint32_t)c->mtime;
+	}
+
+	write_mtimes_file(mtimes_name, mtimes, nr_written, hash);
+
+	free(mtimes);
+	free(sorted);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -866,12 +1045,10 @@ static void write_pack_file(void)
 
 		offset = write_pack_header(f, nr_remaining);
 
-		if (reuse_packfile) {
-			off_t packfile_size;
+		if (reuse_packfile_bitmap) {
 			assert(pack_to_stdout);
-
-			packfile_size = write_reused_pack(f);
-			offset += packfile_size;
+			write_reused_pack(f);
+			offset = hashfile_total(f);
 		}
 
 		nr_written = 0;
@@ -927,6 +1104,15 @@ static void write_pack_file(void)
 
 			strbuf_addf(&tmpname, "%s-", base_name);
 
+			if (cruft) {
+				size_t len = tmpname.len;
+
+				strbuf_addf(&tmpname, "%s.mtimes", oid_to_hex(&oid));
+				write_cruft_mtimes(tmpname.buf, written_list,
+						   nr_written, oid.hash);
+				strbuf_setlen(&tmpname, len);
+			}
+
 			if (write_bitmap_index) {
 				bitmap_writer_set_checksum(oid.hash);
 				bitmap_writer_build_type_index(
@@ -943,9 +1129,18 @@ static void write_pack_file(void)
 				stop_progress(&progress_state);
 
 				bitmap_writer_show_progress(progress);
+				bitmap_writer_set_name_hash_version(name_hash_version);
 				bitmap_writer_reuse_bitmaps(&to_pack);
 				bitmap_writer_select_commits(indexed_commits, indexed_commits_nr, -1);
 				bitmap_writer_build(&to_pack);
+				if (use_delta_islands) {
+					struct strbuf islands = STRBUF_INIT;
+
+					write_island_marks(&to_pack, written_list,
+							   nr_written, &islands);
+					bitmap_writer_set_islands(&islands);
+					strbuf_release(&islands);
+				}
 				bitmap_writer_finish(written_list, nr_written,
 						     tmpname.buf, write_bitmap_options);
 				write_bitmap_index = 0;
@@ -971,6 +1166,10 @@ static void write_pack_file(void)
 		    written, nr_result);
 	trace2_data_intmax("pack-objects", the_repository,
 			   "write_pack_file/wrote", nr_result);
+	trace2_data_intmax("pack-objects", the_repository,
+			   "write_pack_file/reused", reuse_packfile_objects);
+	trace2_data_intmax("pack-objects", the_repository,
+			   "write_pack_file/reused-packs", reuse_packs_nr);
 }
 
 static int no_try_delta(const char *path)
@@ -1188,7 +1387,8 @@ static int add_object_entry(const struct object_id *oid, enum object_type type,
 		return 0;
 	}
 
-	create_object_entry(oid, type, pack_name_hash(name),
+	create_object_entry(oid, type,
+			    pack_name_hash_version(name_hash_version, name),
 			    exclude, name && no_try_delta(name),
 			    index_pos, found_pack, found_offset);
 	return 1;
@@ -1608,11 +1808,11 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+					pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
@@ -2227,6 +2427,20 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 		progress_unlock();
 
+		/*
+		 * The list is sorted by type, and objects of another type
+		 * are never tried as bases; do not let them hold on to
+		 * window memory.
+		 */
+		if (count) {
+			struct unpacked *prev = array + (idx + window - 1) % window;
+			if (prev->entry && oe_type(prev->entry) != oe_type(entry)) {
+				for (i = 0; i < window; i++)
+					mem_usage -= free_unpacked(array + i);
+				count = 0;
+			}
+		}
+
 		mem_usage -= free_unpacked(n);
 		n->entry = entry;
 
@@ -2439,6 +2653,52 @@ static void *threaded_find_deltas(void *arg)
 	return NULL;
 }
 
+/*
+ * The work is split between threads by estimated cost rather than by
+ * number of objects: searching a delta for an object costs roughly in
+ * proportion to its size, plus some fixed overhead.
+ */
+#define DELTA_SEARCH_OVERHEAD 1024
+
+/* delta_cost[i] is the cost of the first i objects of delta_cost_list. */
+static struct object_entry **delta_cost_list;
+static uint64_t *delta_cost;
+
+static void prepare_delta_cost(struct object_entry **list, unsigned list_size)
+{
+	unsigned i;
+
+	delta_cost_list = list;
+	ALLOC_ARRAY(delta_cost, st_add(list_size, 1));
+	delta_cost[0] = 0;
+	for (i = 0; i < list_size; i++)
+		delta_cost[i + 1] = delta_cost[i] + SIZE(list[i]) +
+				    DELTA_SEARCH_OVERHEAD;
+}
+
+static uint64_t list_cost(struct object_entry **list, unsigned nr)
+{
+	size_t pos = list - delta_cost_list;
+	return delta_cost[pos + nr] - delta_cost[pos];
+}
+
+/* How many of the "nr" objects at "list" it takes to cost "cost". */
+static unsigned split_by_cost(struct object_entry **list, unsigned nr,
+			      uint64_t cost)
+{
+	size_t pos = list - delta_cost_list;
+	unsigned lo = 0, hi = nr;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (delta_cost[pos + mid] - delta_cost[pos] < cost)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
@@ -2456,10 +2716,13 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		fprintf_ln(stderr, _("Delta compression using up to %d threads"),
 			   delta_search_threads);
 	p = xcalloc(delta_search_threads, sizeof(*p));
+	prepare_delta_cost(list, list_size);
 
 	/* Partition the work amongst work threads. */
 	for (i = 0; i < delta_search_threads; i++) {
-		unsigned sub_size = list_size / (delta_search_threads - i);
+		unsigned sub_size = split_by_cost(list, list_size,
+				list_cost(list, list_size) /
+				(delta_search_threads - i));
 
 		/* don't use too small segments or no deltas will be found */
 		if (sub_size < 2*window && i+1 < delta_search_threads)
@@ -2501,7 +2764,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	/*
 	 * Now let's wait for work completion.  Each time a thread is done
 	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
+	 * thread with the most costly unprocessed objects and give
 	 * it to that newly idle thread.  This ensure good load balancing
 	 * until the remaining object list segments are simply too short
 	 * to be worth splitting anymore.
@@ -2509,6 +2772,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	while (active_threads) {
 		struct thread_params *target = NULL;
 		struct thread_params *victim = NULL;
+		uint64_t victim_cost = 0;
 		unsigned sub_size = 0;
 
 		progress_lock();
@@ -2521,12 +2785,22 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			pthread_cond_wait(&progress_cond, &progress_mutex);
 		}
 
-		for (i = 0; i < delta_search_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
+		for (i = 0; i < delta_search_threads; i++) {
+			uint64_t cost;
+			if (p[i].remaining <= 2*window)
+				continue;
+			cost = list_cost(p[i].list + p[i].list_size -
+					 p[i].remaining, p[i].remaining);
+			if (!victim || victim_cost < cost) {
 				victim = &p[i];
+				victim_cost = cost;
+			}
+		}
 		if (victim) {
-			sub_size = victim->remaining / 2;
+			list = victim->list + victim->list_size - victim->remaining;
+			sub_size = victim->remaining -
+				split_by_cost(list, victim->remaining,
+					      victim_cost / 2);
 			list = victim->list + victim->list_size - sub_size;
 			while (sub_size && list[0]->hash &&
 			       list[0]->hash == list[-1]->hash) {
@@ -2565,6 +2839,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		}
 	}
 	cleanup_threaded_search();
+	FREE_AND_NULL(delta_cost);
 	free(p);
 }
 
@@ -2711,6 +2986,16 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	}
+	if (!strcmp(k, "pack.namehashversion")) {
+		name_hash_version = git_config_int(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -2737,6 +3022,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2947,6 +3239,87 @@ static void add_objects_in_unpacked_packs(void)
 	free(in_pack.array);
 }
 
+/*
+ * Read the names of packs from stdin, one per line. All the objects in
+ * those packs are packed, except the ones that are also in one of the
+ * packs listed with a leading '^'.
+ */
+static void read_packs_list_from_stdin(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list include_packs = STRING_LIST_INIT_DUP;
+	struct string_list exclude_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+	struct in_pack in_pack;
+	uint32_t i;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (*buf.buf == '^')
+			string_list_append(&exclude_packs, buf.buf + 1);
+		else
+			string_list_append(&include_packs, buf.buf);
+	}
+	string_list_sort(&include_packs);
+	string_list_sort(&exclude_packs);
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = pack_basename(p);
+
+		item = string_list_lookup(&include_packs, name);
+		if (item)
+			item->util = p;
+		item = string_list_lookup(&exclude_packs, name);
+		if (item)
+			item->util = p;
+	}
+
+	for_each_string_list_item(item, &exclude_packs) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		p->pack_keep_in_core = 1;
+		ignore_packed_keep_in_core = 1;
+	}
+
+	memset(&in_pack, 0, sizeof(in_pack));
+	for_each_string_list_item(item, &include_packs) {
+		struct object_id oid;
+		struct object *o;
+
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		if (open_pack_index(p))
+			die(_("cannot open pack index"));
+
+		ALLOC_GROW(in_pack.array,
+			   in_pack.nr + p->num_objects,
+			   in_pack.alloc);
+
+		for (i = 0; i < p->num_objects; i++) {
+			nth_packed_object_oid(&oid, p, i);
+			o = lookup_unknown_object(&oid);
+			if (!(o->flags & OBJECT_ADDED))
+				mark_in_pack_object(o, p, &in_pack);
+			o->flags |= OBJECT_ADDED;
+		}
+	}
+
+	QSORT(in_pack.array, in_pack.nr, ofscmp);
+	for (i = 0; i < in_pack.nr; i++) {
+		struct object *o = in_pack.array[i].object;
+		add_object_entry(&o->oid, o->type, "", 0);
+	}
+
+	free(in_pack.array);
+	string_list_clear(&include_packs, 0);
+	string_list_clear(&exclude_packs, 0);
+	strbuf_release(&buf);
+}
+
 static int add_loose_object(const struct object_id *oid, const char *path,
 			    void *data)
 {
@@ -2998,6 +3371,180 @@ static int has_sha1_pack_kept_or_nonlocal(const struct object_id *oid)
 	return 0;
 }
 
+static void add_cruft_candidate(const struct object_id *oid,
+				timestamp_t mtime)
+{
+	struct cruft_object *c;
+
+	if (has_sha1_pack_kept_or_nonlocal(oid))
+		return;
+
+	c = oidmap_get(&cruft_objects, oid);
+	if (!c) {
+		c = xcalloc(1, sizeof(*c));
+		oidcpy(&c->entry.oid, oid);
+		c->mtime = mtime;
+		oidmap_put(&cruft_objects, c);
+	} else if (c->mtime < mtime) {
+		c->mtime = mtime;
+	}
+}
+
+static int add_cruft_loose_object(const struct object_id *oid,
+				  const char *path, void *data)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		if (errno == ENOENT)
+			return 0; /* went away during a concurrent repack */
+		return error_errno(_("unable to stat %s"), oid_to_hex(oid));
+	}
+	add_cruft_candidate(oid, st.st_mtime);
+	return 0;
+}
+
+/*
+ * Read the names of packs from stdin, one per line, like --stdin-packs
+ * does: the objects of the packs listed without a '^' (the ones that
+ * are going away), and all the loose objects, are the candidates for
+ * the cruft pack, except those that are also in one of the packs
+ * listed with a '^' (the ones that stay), or in a kept pack. Unlisted
+ * packs are left alone, as if they were kept.
+ */
+static void read_cruft_packs_from_stdin(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list include_packs = STRING_LIST_INIT_DUP;
+	struct string_list exclude_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+	uint32_t i;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (*buf.buf == '^')
+			string_list_append(&exclude_packs, buf.buf + 1);
+		else
+			string_list_append(&include_packs, buf.buf);
+	}
+	string_list_sort(&include_packs);
+	string_list_sort(&exclude_packs);
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = pack_basename(p);
+
+		item = string_list_lookup(&include_packs, name);
+		if (item) {
+			item->util = p;
+			continue;
+		}
+		p->pack_keep_in_core = 1;
+		ignore_packed_keep_in_core = 1;
+		item = string_list_lookup(&exclude_packs, name);
+		if (item)
+			item->util = p;
+	}
+
+	for_each_string_list_item(item, &exclude_packs)
+		if (!item->util)
+			die(_("could not find pack '%s'"), item->string);
+
+	for_each_string_list_item(item, &include_packs) {
+		struct object_id oid;
+
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		if (open_pack_index(p))
+			die(_("cannot open pack index"));
+
+		for (i = 0; i < p->num_objects; i++) {
+			nth_packed_object_oid(&oid, p, i);
+			add_cruft_candidate(&oid, packed_object_mtime(p, i));
+		}
+	}
+
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      add_cruft_loose_object,
+				      NULL, NULL, NULL);
+
+	string_list_clear(&include_packs, 0);
+	string_list_clear(&exclude_packs, 0);
+	strbuf_release(&buf);
+}
+
+static void add_cruft_root(struct rev_info *revs, const struct object_id *oid)
+{
+	struct object *obj;
+
+	switch (oid_object_info(the_repository, oid, NULL)) {
+	case OBJ_TAG:
+	case OBJ_COMMIT:
+		obj = parse_object(the_repository, oid);
+		break;
+	case OBJ_TREE:
+		obj = (struct object *)lookup_tree(the_repository, oid);
+		break;
+	case OBJ_BLOB:
+		obj = (struct object *)lookup_blob(the_repository, oid);
+		break;
+	default:
+		obj = NULL;
+	}
+	if (!obj)
+		die(_("unable to get object info for %s"), oid_to_hex(oid));
+	add_pending_object(revs, obj, "");
+}
+
+static void show_cruft_object(struct object *obj, const char *name, void *data)
+{
+	if (oidmap_get(&cruft_objects, &obj->oid))
+		add_object_entry(&obj->oid, obj->type, name, 0);
+}
+
+static void show_cruft_commit(struct commit *commit, void *data)
+{
+	show_cruft_object(&commit->object, NULL, data);
+}
+
+/*
+ * Pack the candidates read by read_cruft_packs_from_stdin(). With an
+ * expiration date, only those modified since then are packed, as well
+ * as the older ones that are reachable from them.
+ */
+static void enumerate_cruft_objects(void)
+{
+	struct oidmap_iter iter;
+	struct cruft_object *c;
+	struct rev_info revs;
+
+	read_cruft_packs_from_stdin();
+
+	if (!cruft_expiration) {
+		oidmap_iter_init(&cruft_objects, &iter);
+		while ((c = oidmap_iter_next(&iter)))
+			add_object_entry(&c->entry.oid, OBJ_NONE, "", 0);
+		return;
+	}
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	revs.ignore_missing_links = 1;
+
+	oidmap_iter_init(&cruft_objects, &iter);
+	while ((c = oidmap_iter_next(&iter)))
+		if (c->mtime > cruft_expiration)
+			add_cruft_root(&revs, &c->entry.oid);
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, show_cruft_commit, show_cruft_object, NULL);
+}
+
 /*
  * Store a list of sha1s that are should not be discarded
  * because they are either written too recently, or are
@@ -3060,15 +3607,16 @@ static int pack_options_allow_reuse(void)
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
-	if (!(bitmap_git = prepare_bitmap_walk(revs)))
+	if (!(bitmap_git = prepare_bitmap_walk(revs, &filter_options)))
 		return -1;
 
 	if (pack_options_allow_reuse() &&
 	    !reuse_partial_packfile_from_bitmap(
 			bitmap_git,
-			&reuse_packfile,
+			&reuse_packs,
+			&reuse_packs_nr,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
@@ -3234,6 +3782,20 @@ static int option_parse_unpack_unreachable(const struct option *opt,
 	return 0;
 }
 
+static int option_parse_cruft_expiration(const struct option *opt,
+					 const char *arg, int unset)
+{
+	if (unset) {
+		cruft = 0;
+		cruft_expiration = 0;
+	} else {
+		cruft = 1;
+		if (arg)
+			cruft_expiration = approxidate(arg);
+	}
+	return 0;
+}
+
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
@@ -3242,6 +3804,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	struct argv_array rp = ARGV_ARRAY_INIT;
 	int rev_list_unpacked = 0, rev_list_all = 0, rev_list_reflog = 0;
 	int rev_list_index = 0;
+	int stdin_packs = 0;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	struct option pack_objects_options[] = {
 		OPT_SET_INT('q', "quiet", &progress,
@@ -3280,6 +3843,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from stdin")),
 		OPT_SET_INT_F(0, "unpacked", &rev_list_unpacked,
 			      N_("limit the objects to those that are not yet packed"),
 			      1, PARSE_OPT_NONEG),
@@ -3303,6 +3868,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		{ OPTION_CALLBACK, 0, "unpack-unreachable", NULL, N_("time"),
 		  N_("unpack unreachable objects newer than <time>"),
 		  PARSE_OPT_OPTARG, option_parse_unpack_unreachable },
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("pack the unreachable objects of the packs read from stdin, with their mtimes")),
+		{ OPTION_CALLBACK, 0, "cruft-expiration", NULL, N_("time"),
+		  N_("with --cruft, drop unreachable objects older than <time>"),
+		  PARSE_OPT_OPTARG, option_parse_cruft_expiration },
 		OPT_BOOL(0, "sparse", &sparse,
 			 N_("use the sparse reachability algorithm")),
 		OPT_BOOL(0, "thin", &thin,
@@ -3334,6 +3904,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not pack objects in promisor packfiles")),
 		OPT_BOOL(0, "delta-islands", &use_delta_islands,
 			 N_("respect islands during delta compression")),
+		OPT_INTEGER(0, "name-hash-version", &name_hash_version,
+			    N_("version of the name-hash used to group delta candidates")),
 		OPT_END(),
 	};
 
@@ -3344,6 +3916,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	sparse = git_env_bool("GIT_TEST_PACK_SPARSE", 0);
 	reset_pack_idx_option(&pack_idx_opts);
+	if (git_env_bool(GIT_TEST_WRITE_REV_INDEX, 0))
+		pack_idx_opts.flags |= WRITE_REV;
 	git_config(git_pack_config, NULL);
 
 	progress = isatty(2);
@@ -3389,7 +3963,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--indexed-objects");
 	}
-	if (rev_list_unpacked) {
+	if (rev_list_unpacked && !stdin_packs) {
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--unpacked");
 	}
@@ -3402,12 +3976,25 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (unpack_unreachable || keep_unreachable || pack_loose_unreachable)
 		use_internal_rev_list = 1;
 
+	if (stdin_packs && use_internal_rev_list)
+		die(_("cannot use internal rev list with --stdin-packs"));
+	if (cruft) {
+		if (use_internal_rev_list)
+			die(_("cannot use internal rev list with --cruft"));
+		if (stdin_packs)
+			die(_("cannot use --stdin-packs with --cruft"));
+		if (pack_to_stdout)
+			die(_("cannot use --stdout with --cruft"));
+	}
+
 	if (!reuse_object)
 		reuse_delta = 0;
 	if (pack_compression_level == -1)
 		pack_compression_level = Z_DEFAULT_COMPRESSION;
 	else if (pack_compression_level < 0 || pack_compression_level > Z_BEST_COMPRESSION)
 		die(_("bad pack compression level %d"), pack_compression_level);
+	if (name_hash_version != 1 && name_hash_version != 2)
+		die(_("unsupported name-hash version %d"), name_hash_version);
 
 	if (!delta_search_threads)	/* --threads=0 means autodetect */
 		delta_search_threads = online_cpus();
@@ -3434,7 +4021,6 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (filter_options.choice) {
 		if (!pack_to_stdout)
 			die(_("cannot use --filter without --stdout"));
-		use_bitmap_index = 0;
 	}
 
 	/*
@@ -3456,7 +4042,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!use_internal_rev_list || (!pack_to_stdout && write_bitmap_index) || is_repository_shallow(the_repository))
 		use_bitmap_index = 0;
 
-	if (pack_to_stdout || !rev_list_all)
+	if (pack_to_stdout || !rev_list_all || cruft)
 		write_bitmap_index = 0;
 
 	if (use_delta_islands)
@@ -3495,7 +4081,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Enumerating objects"), 0);
-	if (!use_internal_rev_list)
+	if (cruft) {
+		enumerate_cruft_objects();
+	} else if (stdin_packs) {
+		read_packs_list_from_stdin();
+		if (rev_list_unpacked)
+			add_unreachable_loose_objects();
+	} else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.argc, rp.argv);
@@ -87,6 +87,7 @@ struct rebase_options {
 	char *strategy, *strategy_opts;
 	struct strbuf git_format_patch_opt;
 	int reschedule_failed_exec;
+	int in_memory;
 	int use_legacy_rebase;
 };
 
@@ -112,6 +113,7 @@ static struct replay_opts get_replay_opts(const struct rebase_options *opts)
 	replay.allow_empty_message = opts->allow_empty_message;
 	replay.verbose = opts->flags & REBASE_VERBOSE;
 	replay.reschedule_failed_exec = opts->reschedule_failed_exec;
+	replay.in_memory = opts->in_memory;
 	replay.gpg_sign = xstrdup_or_null(opts->gpg_sign_opt);
 	replay.strategy = opts->strategy;
 	if (opts->strategy_opts)
@@ -737,17 +739,16 @@ static int apply_autostash(struct rebase_options *opts)
 static int finish_rebase(struct rebase_options *opts)
 {
 	struct strbuf dir = STRBUF_INIT;
-	const char *argv_gc_auto[] = { "gc", "--auto", NULL };
 	int ret = 0;
 
 	delete_ref(NULL, "REBASE_HEAD", NULL, REF_NO_DEREF);
 	apply_autostash(opts);
 	close_object_store(the_repository->objects);
 	/*
-	 * We ignore errors in 'gc --auto', since the
+	 * We ignore errors in 'maintenance run --auto', since the
 	 * user should see them.
 	 */
-	run_command_v_opt(argv_gc_auto, RUN_GIT_CMD);
+	run_auto_maintenance(!(opts->flags & (REBASE_NO_QUIET|REBASE_VERBOSE)));
 	if (opts->type == REBASE_INTERACTIVE) {
 		struct replay_opts replay = REPLAY_OPTS_INIT;
 
@@ -1234,6 +1235,11 @@ static int rebase_config(const char *var, const char *value, void *data)
 		return 0;
 	}
 
+	if (!strcmp(var, "rebase.inmemory")) {
+		opts->in_memory = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "rebase.usebuiltin")) {
 		opts->use_legacy_rebase = !git_config_bool(var, value);
 		return 0;
@@ -1390,6 +1396,7 @@ int cmd_rebase(int argc, const char **argv, const char *prefix)
 	struct object_id squash_onto;
 	char *squash_onto_name = NULL;
 	int reschedule_failed_exec = -1;
+	int in_memory = -1;
 	struct option builtin_rebase_options[] = {
 		OPT_STRING(0, "onto", &options.onto_name,
 			   N_("revision"),
@@ -1484,6 +1491,9 @@ int cmd_rebase(int argc, const char **argv, const char *prefix)
 		OPT_BOOL(0, "reschedule-failed-exec",
 			 &reschedule_failed_exec,
 			 N_("automatically re-schedule any `exec` that fails")),
+		OPT_BOOL(0, "in-memory", &in_memory,
+			 N_("pick commits without updating the working tree "
+			    "until it is needed")),
 		OPT_END(),
 	};
 	int i;
@@ -1768,6 +1778,27 @@ int cmd_rebase(int argc, const char **argv, const char *prefix)
 		}
 	}
 
+	if (in_memory >= 0)
+		options.in_memory = in_memory;
+	if (in_memory > 0) {
+		switch (options.type) {
+		case REBASE_AM:
+			die(_("--in-memory requires --merge or --interactive"));
+		case REBASE_PRESERVE_MERGES:
+			die(_("cannot combine '--preserve-merges' with "
+			      "'--in-memory'"));
+		case REBASE_UNSPECIFIED:
+			options.type = REBASE_MERGE;
+			break;
+		default:
+			/* compatible */
+			break;
+		}
+	} else if (options.in_memory && options.type == REBASE_UNSPECIFIED) {
+		/* rebase.inMemory picks the merge backend by default */
+		options.type = REBASE_MERGE;
+	}
+
 	if (options.type == REBASE_MERGE)
 		imply_interactive(&options, "--merge");
 
@@ -27,6 +27,9 @@
 #include "object-store.h"
 #include "protocol.h"
 #include "commit-reach.h"
+#include "tempfile.h"
+#include "sub-process.h"
+#include "quote.h"
 
 static const char * const receive_pack_usage[] = {
 	N_("git receive-pack <git-dir>"),
@@ -63,6 +66,8 @@ static int prefer_ofs_delta = 1;
 static int auto_update_server_info;
 static int auto_gc = 1;
 static int reject_thin;
+static int index_pack_connectivity;
+static int update_hook_process;
 static int stateless_rpc;
 static const char *service_dir;
 static const char *head_name;
@@ -227,6 +232,16 @@ static int receive_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (strcmp(var, "receive.indexpackconnectivity") == 0) {
+		index_pack_connectivity = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (strcmp(var, "receive.updatehookprocess") == 0) {
+		update_hook_process = git_config_bool(var, value);
+		return 0;
+	}
+
 	return git_default_config(var, value, cb);
 }
 
@@ -354,6 +369,14 @@ static void rp_error(const char *err, ...)
 	va_end(params);
 }
 
+static void rp_message(const char *msg, ...)
+{
+	va_list params;
+	va_start(params, msg);
+	report_message("", msg, params);
+	va_end(params);
+}
+
 static int copy_to_sideband(int in, int out, void *arg)
 {
 	char data[128];
@@ -789,6 +812,119 @@ static int run_receive_hook(struct command *commands,
 	return status;
 }
 
+/*
+ * With receive.updateHookProcess, the update hook is started once and
+ * is asked about each ref over the long-running process protocol; see
+ * "update" in githooks(5).
+ */
+#define CAP_UPDATE (1u<<0)
+
+static struct hashmap update_hook_map;
+static struct subprocess_entry *update_hook_entry;
+static char *update_hook_cmd;
+static int update_hook_failed;
+
+static int start_update_hook_process(struct subprocess_entry *subprocess)
+{
+	static int versions[] = {1, 0};
+	static struct subprocess_capability capabilities[] = {
+		{ "update", CAP_UPDATE },
+		{ NULL, 0 }
+	};
+	unsigned int supported = 0;
+
+	if (subprocess_handshake(subprocess, "git-update-hook", versions,
+				 NULL, capabilities, &supported))
+		return -1;
+	if (!(supported & CAP_UPDATE))
+		return error(_("update hook process does not support 'update'"));
+	return 0;
+}
+
+static int ask_update_hook_process(const char *hook, struct command *cmd)
+{
+	struct child_process *process;
+	struct strbuf status = STRBUF_INIT;
+	char *line;
+	int err;
+
+	if (update_hook_failed)
+		return -1;
+	if (!update_hook_entry) {
+		struct strbuf cmdline = STRBUF_INIT;
+
+		/* it is run by the shell, and is kept as the entry's key */
+		sq_quote_buf(&cmdline, hook);
+		update_hook_cmd = strbuf_detach(&cmdline, NULL);
+		hashmap_init(&update_hook_map, cmd2process_cmp, NULL, 0);
+		update_hook_entry = xcalloc(1, sizeof(*update_hook_entry));
+		if (subprocess_start(&update_hook_map, update_hook_entry,
+				     update_hook_cmd, start_update_hook_process)) {
+			FREE_AND_NULL(update_hook_entry);
+			FREE_AND_NULL(update_hook_cmd);
+			update_hook_failed = 1;
+			return -1;
+		}
+	}
+	process = subprocess_get_child_process(update_hook_entry);
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	err = packet_write_fmt_gently(process->in, "command=update\n") ||
+	      packet_write_fmt_gently(process->in, "ref=%s\n", cmd->ref_name) ||
+	      packet_write_fmt_gently(process->in, "old=%s\n",
+				      oid_to_hex(&cmd->old_oid)) ||
+	      packet_write_fmt_gently(process->in, "new=%s\n",
+				      oid_to_hex(&cmd->new_oid)) ||
+	      packet_flush_gently(process->in);
+	while (!err) {
+		const char *value;
+
+		if (packet_read_line_gently(process->out, NULL, &line) < 0) {
+			err = -1;
+			break;
+		}
+		if (!line)
+			break;
+
+		if (skip_prefix(line, "message=", &value))
+			rp_message("%s", value);
+		else if (skip_prefix(line, "status=", &value)) {
+			strbuf_reset(&status);
+			strbuf_addstr(&status, value);
+		}
+	}
+	sigchain_pop(SIGPIPE);
+
+	if (err || !status.len) {
+		/* it went away; decline this ref and all that follow */
+		rp_error("update hook process '%s' failed", hook);
+		subprocess_stop(&update_hook_map, update_hook_entry);
+		FREE_AND_NULL(update_hook_entry);
+		FREE_AND_NULL(update_hook_cmd);
+		update_hook_failed = 1;
+		err = -1;
+	} else if (strcmp(status.buf, "success")) {
+		err = -1;
+	}
+	strbuf_release(&status);
+	return err;
+}
+
+static void finish_update_hook_process(void)
+{
+	struct child_process *process;
+
+	if (!update_hook_entry)
+		return;
+	process = subprocess_get_child_process(update_hook_entry);
+	hashmap_remove(&update_hook_map, &update_hook_entry->ent, NULL);
+	close(process->in);
+	close(process->out);
+	finish_command(process);
+	FREE_AND_NULL(update_hook_entry);
+	FREE_AND_NULL(update_hook_cmd);
+}
+
 static int run_update_hook(struct command *cmd)
 {
 	const char *argv[5];
@@ -799,6 +935,9 @@ static int run_update_hook(struct command *cmd)
 	if (!argv[0])
 		return 0;
 
+	if (update_hook_process)
+		return ask_update_hook_process(argv[0], cmd);
+
 	argv[1] = cmd->ref_name;
 	argv[2] = oid_to_hex(&cmd->old_oid);
 	argv[3] = oid_to_hex(&cmd->new_oid);
@@ -1458,6 +1597,57 @@ static void execute_commands_atomic(struct command *commands,
 	strbuf_release(&err);
 }
 
+static const char *pack_lockfile;
+
+/*
+ * With receive.indexPackConnectivity, the objects the received pack refers
+ * to without containing them, as reported by index-pack.
+ */
+static struct oid_array foreign_objects = OID_ARRAY_INIT;
+static int have_foreign_objects;
+
+static void read_foreign_objects(const char *path)
+{
+	struct strbuf line = STRBUF_INIT;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp)
+		return;
+	while (strbuf_getline(&line, fp) != EOF) {
+		struct object_id oid;
+		if (get_oid_hex(line.buf, &oid) || line.buf[the_hash_algo->hexsz]) {
+			oid_array_clear(&foreign_objects);
+			goto out;
+		}
+		oid_array_append(&foreign_objects, &oid);
+	}
+	have_foreign_objects = 1;
+out:
+	strbuf_release(&line);
+	fclose(fp);
+}
+
+/* Find the pack index-pack wrote, from the name of its .keep file. */
+static struct packed_git *find_received_pack(void)
+{
+	struct strbuf name = STRBUF_INIT;
+	struct packed_git *p = NULL;
+	const char *base;
+	size_t len;
+
+	if (!pack_lockfile ||
+	    !(base = strrchr(pack_lockfile, '/')) ||
+	    !strip_suffix(base, ".keep", &len))
+		return NULL;
+	strbuf_add(&name, base, len);
+	strbuf_addstr(&name, ".pack");
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		if (ends_with(p->pack_name, name.buf))
+			break;
+	strbuf_release(&name);
+	return p;
+}
+
 static void execute_commands(struct command *commands,
 			     const char *unpacker_error,
 			     struct shallow_info *si,
@@ -1489,6 +1679,15 @@ static void execute_commands(struct command *commands,
 	opt.err_fd = err_fd;
 	opt.progress = err_fd && !quiet;
 	opt.env = tmp_objdir_env(tmp_objdir);
+	if (have_foreign_objects) {
+		opt.pack = find_received_pack();
+		if (opt.pack) {
+			opt.foreign = &foreign_objects;
+			trace2_data_intmax("receive-pack", the_repository,
+					   "foreign-objects",
+					   foreign_objects.nr);
+		}
+	}
 	if (check_connected(iterate_receive_command_list, &data, &opt))
 		set_connectivity_errors(commands, si);
 
@@ -1527,6 +1726,7 @@ static void execute_commands(struct command *commands,
 		execute_commands_atomic(commands, si);
 	else
 		execute_commands_non_atomic(commands, si);
+	finish_update_hook_process();
 
 	if (shallow_update)
 		warn_if_skipped_connectivity_check(commands, si);
@@ -1681,8 +1881,6 @@ static const char *parse_pack_header(struct pack_header *hdr)
 	}
 }
 
-static const char *pack_lockfile;
-
 static void push_header_arg(struct argv_array *args, struct pack_header *hdr)
 {
 	argv_array_pushf(args, "--pack_header=%"PRIu32",%"PRIu32,
@@ -1748,6 +1946,7 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 			return "unpack-objects abnormal exit";
 	} else {
 		char hostname[HOST_NAME_MAX + 1];
+		struct tempfile *foreign_file = NULL;
 
 		argv_array_pushl(&child.args, "index-pack", "--stdin", NULL);
 		push_header_arg(&child.args, &hdr);
@@ -1771,17 +1970,34 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		if (max_input_size)
 			argv_array_pushf(&child.args, "--max-input-size=%"PRIuMAX,
 				(uintmax_t)max_input_size);
+		/*
+		 * Shallow pushes check the connectivity of each ref
+		 * separately; leave them alone.
+		 */
+		if (index_pack_connectivity && !si->nr_ours && !si->nr_theirs)
+			foreign_file = mks_tempfile_t("receive-foreign-XXXXXX");
+		if (foreign_file)
+			argv_array_pushf(&child.args, "--foreign-objects=%s",
+					 get_tempfile_path(foreign_file));
 		child.out = -1;
 		child.err = err_fd;
 		child.git_cmd = 1;
 		status = start_command(&child);
-		if (status)
+		if (status) {
+			delete_tempfile(&foreign_file);
 			return "index-pack fork failed";
+		}
 		pack_lockfile = index_pack_lockfile(child.out);
 		close(child.out);
 		status = finish_command(&child);
-		if (status)
+		if (status) {
+			delete_tempfile(&foreign_file);
 			return "index-pack abnormal exit";
+		}
+		if (foreign_file) {
+			read_foreign_objects(get_tempfile_path(foreign_file));
+			delete_tempfile(&foreign_file);
+		}
 		reprepare_packed_git(the_repository);
 	}
 	return NULL;
@@ -246,6 +246,160 @@ static void repack_promisor_objects(const struct pack_objects_args *args,
 		die(_("could not finish pack-objects to repack promisor objects"));
 }
 
+/*
+ * Pack the unreachable objects of the packs about to be deleted, and
+ * the loose ones, into a cruft pack; see "--cruft" in pack-objects.
+ * 'names' holds the packs just written, to which the new cruft pack is
+ * added.
+ */
+static int write_cruft_pack(const struct pack_objects_args *args,
+			    const char *cruft_expiration,
+			    struct string_list *names,
+			    struct string_list *existing_packs)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct string_list_item *item;
+	struct strbuf line = STRBUF_INIT;
+	const char *tmpbase = strrchr(packtmp, '/') + 1;
+	FILE *in, *out;
+	int ret;
+
+	prepare_pack_objects(&cmd, args);
+	argv_array_push(&cmd.args, "--cruft");
+	if (cruft_expiration)
+		argv_array_pushf(&cmd.args, "--cruft-expiration=%s",
+				 cruft_expiration);
+	argv_array_push(&cmd.args, "--non-empty");
+	cmd.in = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "^%s-%s.pack\n", tmpbase, item->string);
+	for_each_string_list_item(item, existing_packs)
+		fprintf(in, "%s.pack\n", item->string);
+	fclose(in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != the_hash_algo->hexsz)
+			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	return finish_command(&cmd);
+}
+
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	/* the packs before this position are rolled up into a new one */
+	uint32_t split;
+};
+
+static uint32_t geometry_pack_weight(struct packed_git *p)
+{
+	if (open_pack_index(p))
+		die(_("cannot open index for %s"), p->pack_name);
+	return p->num_objects;
+}
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	uint32_t aw = geometry_pack_weight(*(struct packed_git **)va),
+		 bw = geometry_pack_weight(*(struct packed_git **)vb);
+
+	if (aw < bw)
+		return -1;
+	if (aw > bw)
+		return 1;
+	return 0;
+}
+
+/*
+ * Collect the packs that may be rolled up, from the smallest to the
+ * largest. Kept packs are left alone, and so are promisor packs, which
+ * would lose their .promisor file.
+ */
+static void init_pack_geometry(struct pack_geometry *geometry,
+			       const struct string_list *keep_pack_list)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		int i;
+
+		if (!p->pack_local || p->pack_keep || p->pack_promisor)
+			continue;
+		for (i = 0; i < keep_pack_list->nr; i++)
+			if (!fspathcmp(pack_basename(p),
+				       keep_pack_list->items[i].string))
+				break;
+		if (i < keep_pack_list->nr)
+			continue;
+
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+/*
+ * Find the smallest packs to roll up so that, afterwards, each pack has
+ * at least "factor" times as many objects as the next smaller one.
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i, split;
+	uint64_t total_size = 0;
+
+	if (!geometry->pack_nr) {
+		geometry->split = 0;
+		return;
+	}
+
+	/*
+	 * Starting from the largest pack, find the first pair of
+	 * neighbours that does not follow the progression: that pack
+	 * and all the smaller ones are rolled up.
+	 */
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		uint64_t ours = geometry_pack_weight(geometry->pack[i]);
+		uint64_t prev = geometry_pack_weight(geometry->pack[i - 1]);
+
+		if (ours < factor * prev)
+			break;
+	}
+	split = i ? i + 1 : 0;
+
+	/*
+	 * The new pack may be big enough to break the progression with
+	 * the larger packs in its turn; roll those up as well.
+	 */
+	for (i = 0; i < split; i++)
+		total_size += geometry_pack_weight(geometry->pack[i]);
+	for (i = split; i < geometry->pack_nr; i++) {
+		uint64_t ours = geometry_pack_weight(geometry->pack[i]);
+
+		if (ours >= factor * total_size)
+			break;
+		split++;
+		total_size += ours;
+	}
+
+	/* Rolling up a single pack would only rewrite it. */
+	if (split == 1)
+		split = 0;
+	geometry->split = split;
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
 
@@ -257,6 +411,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	} exts[] = {
 		{".pack"},
 		{".idx"},
+		{".rev", 1},
+		{".mtimes", 1},
 		{".bitmap", 1},
 		{".promisor", 1},
 	};
@@ -274,9 +430,14 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int delete_redundant = 0;
 	const char *unpack_unreachable = NULL;
 	int keep_unreachable = 0;
+	int cruft = 0;
+	const char *cruft_expiration = NULL;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	int no_update_server_info = 0;
 	int midx_cleared = 0;
+	int geometric_factor = 0;
+	int write_midx = 0;
+	struct pack_geometry geometry = { NULL };
 	struct pack_objects_args po_args = {NULL};
 
 	struct option builtin_repack_options[] = {
@@ -304,6 +465,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
 				N_("with -a, repack unreachable objects")),
+		OPT_BOOL(0, "cruft", &cruft,
+				N_("same as -a, and pack unreachable objects into a cruft pack")),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, drop unreachable objects older than this")),
 		OPT_STRING(0, "window", &po_args.window, N_("n"),
 				N_("size of the window used for delta compression")),
 		OPT_STRING(0, "window-memory", &po_args.window_memory, N_("bytes"),
@@ -318,6 +483,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("repack objects in packs marked with .keep")),
 		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
 				N_("do not repack this pack")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("find a geometric progression with factor <n>")),
+		OPT_BOOL('m', "write-midx", &write_midx,
+				N_("write a multi-pack index of the resulting packs")),
 		OPT_END()
 	};
 
@@ -333,6 +502,15 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (cruft_expiration && !cruft)
+		die(_("--cruft-expiration requires --cruft"));
+	if (cruft) {
+		if (keep_unreachable || unpack_unreachable ||
+		    (pack_everything & LOOSEN_UNREACHABLE))
+			die(_("--cruft is incompatible with -A and -k"));
+		pack_everything |= ALL_INTO_ONE;
+	}
+
 	if (write_bitmaps < 0) {
 		if (!(pack_everything & ALL_INTO_ONE) ||
 		    !is_bare_repository())
@@ -341,9 +519,18 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps > 0;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
+	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE) && !write_midx)
 		die(_(incremental_bitmap_conflict_error));
 
+	if (geometric_factor) {
+		if (pack_everything)
+			die(_("--geometric is incompatible with -A, -a"));
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+		init_pack_geometry(&geometry, &keep_pack_list);
+		split_pack_geometry(&geometry, geometric_factor);
+	}
+
 	packdir = mkpathdup("%s/pack", get_object_directory());
 	packtmp = mkpathdup("%s/.tmp-%d-pack", packdir, (int)getpid());
 
@@ -358,14 +545,20 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--keep-pack=%s",
 				 keep_pack_list.items[i].string);
 	argv_array_push(&cmd.args, "--non-empty");
-	argv_array_push(&cmd.args, "--all");
-	argv_array_push(&cmd.args, "--reflog");
-	argv_array_push(&cmd.args, "--indexed-objects");
-	if (repository_format_partial_clone)
-		argv_array_push(&cmd.args, "--exclude-promisor-objects");
-	if (write_bitmaps > 0)
+	if (geometric_factor) {
+		argv_array_push(&cmd.args, "--stdin-packs");
+		argv_array_push(&cmd.args, "--unpacked");
+	} else {
+		argv_array_push(&cmd.args, "--all");
+		argv_array_push(&cmd.args, "--reflog");
+		argv_array_push(&cmd.args, "--indexed-objects");
+		if (repository_format_partial_clone)
+			argv_array_push(&cmd.args, "--exclude-promisor-objects");
+	}
+	/* With --write-midx, the bitmap is written for the MIDX instead. */
+	if (write_bitmaps > 0 && !write_midx)
 		argv_array_push(&cmd.args, "--write-bitmap-index");
-	else if (write_bitmaps < 0)
+	else if (write_bitmaps < 0 && !write_midx)
 		argv_array_push(&cmd.args, "--write-bitmap-index-quiet");
 	if (use_delta_islands)
 		argv_array_push(&cmd.args, "--delta-islands");
@@ -391,17 +584,30 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				argv_array_push(&cmd.env_array, "GIT_REF_PARANOIA=1");
 			}
 		}
-	} else {
+	} else if (!geometric_factor) {
 		argv_array_push(&cmd.args, "--unpacked");
 		argv_array_push(&cmd.args, "--incremental");
 	}
 
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
 
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+
+		for (i = 0; i < geometry.split; i++)
+			fprintf(in, "%s\n", pack_basename(geometry.pack[i]));
+		for (i = geometry.split; i < geometry.pack_nr; i++)
+			fprintf(in, "^%s\n", pack_basename(geometry.pack[i]));
+		fclose(in);
+	}
+
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline_lf(&line, out) != EOF) {
 		if (line.len != the_hash_algo->hexsz)
@@ -413,6 +619,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (ret)
 		return ret;
 
+	if (cruft && delete_redundant) {
+		ret = write_cruft_pack(&po_args, cruft_expiration,
+				       &names, &existing_packs);
+		if (ret)
+			return ret;
+	}
+
 	if (!names.nr && !po_args.quiet)
 		printf_ln(_("Nothing new to pack."));
 
@@ -545,6 +758,17 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 			if (!string_list_has_string(&names, sha1))
 				remove_redundant_pack(packdir, item->string);
 		}
+		for (i = 0; i < geometry.split; i++) {
+			struct packed_git *p = geometry.pack[i];
+			char *base = xstrdup(pack_basename(p));
+			size_t len;
+
+			strip_suffix(base, ".pack", &len);
+			base[len] = '\0';
+			if (!string_list_has_string(&names, base + len - hexsz))
+				remove_redundant_pack(packdir, base);
+			free(base);
+		}
 		if (!po_args.quiet && isatty(2))
 			opts |= PRUNE_PACKED_VERBOSE;
 		prune_packed_objects(opts);
@@ -560,12 +784,18 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		update_server_info(0);
 	remove_temporary_files();
 
-	if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
-		write_midx_file(get_object_directory());
+	if (write_midx) {
+		if (write_midx_file(get_object_directory(),
+				    write_bitmaps > 0 ? MIDX_WRITE_BITMAP : 0,
+				    NULL))
+			return error(_("could not write multi-pack-index"));
+	} else if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
+		write_midx_file(get_object_directory(), 0, NULL);
 
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
+	free(geometry.pack);
 	strbuf_release(&line);
 
 	return 0;
@@ -526,9 +526,6 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (revs.show_notes)
 		die(_("rev-list does not support display of notes"));
 
-	if (filter_options.choice && use_bitmap_index)
-		die(_("cannot combine --use-bitmap-index with object filtering"));
-
 	save_commit_buffer = (revs.verbose_header ||
 			      revs.grep_filter.pattern_list ||
 			      revs.grep_filter.header_list);
@@ -538,12 +535,13 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (show_progress)
 		progress = start_delayed_progress(show_progress, 0);
 
-	if (use_bitmap_index && !revs.prune) {
+	/* A bitmap walk cannot tell which objects the filter omitted. */
+	if (use_bitmap_index && !revs.prune && !arg_print_omitted) {
 		if (revs.count && !revs.left_right && !revs.cherry_mark) {
 			uint32_t commit_count;
 			int max_count = revs.max_count;
 			struct bitmap_index *bitmap_git;
-			if ((bitmap_git = prepare_bitmap_walk(&revs))) {
+			if ((bitmap_git = prepare_bitmap_walk(&revs, &filter_options))) {
 				count_bitmap_commit_list(bitmap_git, &commit_count, NULL, NULL, NULL);
 				if (max_count >= 0 && max_count < commit_count)
 					commit_count = max_count;
@@ -554,7 +552,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 		} else if (revs.max_count < 0 &&
 			   revs.tag_objects && revs.tree_objects && revs.blob_objects) {
 			struct bitmap_index *bitmap_git;
-			if ((bitmap_git = prepare_bitmap_walk(&revs))) {
+			if ((bitmap_git = prepare_bitmap_walk(&revs, &filter_options))) {
 				traverse_bitmap_commit_list(bitmap_git, &show_object_fast);
 				free_bitmap_index(bitmap_git);
 				return 0;
@@ -324,33 +324,60 @@ static void add_diff_to_buf(struct diff_queue_struct *q,
 	}
 }
 
-static int get_newly_staged(struct strbuf *out, struct object_id *c_tree)
+/*
+ * Put the entries of "c_tree" back for the paths the merge changed in
+ * the index, but keep the paths it newly added, so that they are not
+ * forgotten about.
+ */
+static void unstage_merged_paths(struct diff_queue_struct *q,
+				 struct diff_options *opt, void *data)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
-	const char *c_tree_hex = oid_to_hex(c_tree);
+	int i;
 
-	/*
-	 * diff-index is very similar to diff-tree above, and should be
-	 * converted together with update_index.
-	 */
-	cp.git_cmd = 1;
-	argv_array_pushl(&cp.args, "diff-index", "--cached", "--name-only",
-			 "--diff-filter=A", NULL);
-	argv_array_push(&cp.args, c_tree_hex);
-	return pipe_command(&cp, NULL, 0, out, 0, NULL, 0);
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filespec *one = q->queue[i]->one;
+		struct cache_entry *ce;
+
+		if (!DIFF_FILE_VALID(one))
+			continue;
+
+		ce = make_cache_entry(&the_index, one->mode, &one->oid,
+				      one->path, 0, 0);
+		if (!ce)
+			die(_("make_cache_entry failed for path '%s'"),
+			    one->path);
+		add_cache_entry(ce, ADD_CACHE_OK_TO_ADD | ADD_CACHE_OK_TO_REPLACE);
+	}
 }
 
-static int update_index(struct strbuf *out)
+/*
+ * Same as resetting the index to "c_tree" and adding back the files
+ * the merge added, but only the changed paths are looked at; the
+ * cache-tree lets the diff skip the directories nobody touched.
+ */
+static int unstage_merge_result(struct object_id *c_tree)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
+	struct lock_file lock_file = LOCK_INIT;
+	struct diff_options opt;
 
-	/*
-	 * Update-index is very complicated and may need to have a public
-	 * function exposed in order to remove this forking.
-	 */
-	cp.git_cmd = 1;
-	argv_array_pushl(&cp.args, "update-index", "--add", "--stdin", NULL);
-	return pipe_command(&cp, out->buf, out->len, NULL, 0, NULL, 0);
+	if (read_cache() < 0)
+		return error(_("could not read the index"));
+	hold_locked_index(&lock_file, LOCK_DIE_ON_ERROR);
+
+	repo_diff_setup(the_repository, &opt);
+	opt.output_format = DIFF_FORMAT_CALLBACK;
+	opt.format_callback = unstage_merged_paths;
+	opt.flags.override_submodule_config = 1;
+	diff_setup_done(&opt);
+	if (do_diff_cache(c_tree, &opt)) {
+		rollback_lock_file(&lock_file);
+		return -1;
+	}
+	diff_flush(&opt);
+
+	if (write_locked_index(&the_index, &lock_file, COMMIT_LOCK))
+		return error(_("unable to write new index file"));
+	return 0;
 }
 
 static int restore_untracked(struct object_id *u_tree)
@@ -464,21 +491,7 @@ static int do_apply_stash(const char *prefix, struct stash_info *info,
 		if (reset_tree(&index_tree, 0, 0))
 			return -1;
 	} else {
-		struct strbuf out = STRBUF_INIT;
-
-		if (get_newly_staged(&out, &c_tree)) {
-			strbuf_release(&out);
-			return -1;
-		}
-
-		if (reset_tree(&c_tree, 0, 1)) {
-			strbuf_release(&out);
-			return -1;
-		}
-
-		ret = update_index(&out);
-		strbuf_release(&out);
-		if (ret)
+		if (unstage_merge_result(&c_tree))
 			return -1;
 
 		discard_cache();
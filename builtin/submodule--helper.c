@@ -1552,11 +1552,85 @@ struct submodule_update_clone {
 	int failed_clones_nr, failed_clones_alloc;
 
 	int max_jobs;
+
+	/*
+	 * With submodule.reuseClones, the clones of each URL, with a
+	 * "struct url_clone" as util, and the indices into 'list' of
+	 * the submodules that wait for another clone of their URL.
+	 */
+	int reuse_clones;
+	struct string_list url_clones;
+	int *waiting;
+	int waiting_nr, waiting_alloc;
 };
 #define SUBMODULE_UPDATE_CLONE_INIT {0, MODULE_LIST_INIT, 0, \
 	SUBMODULE_UPDATE_STRATEGY_INIT, 0, 0, -1, STRING_LIST_INIT_DUP, 0, \
 	NULL, NULL, NULL, \
-	NULL, 0, 0, 0, NULL, 0, 0, 1}
+	NULL, 0, 0, 0, NULL, 0, 0, 1, \
+	0, STRING_LIST_INIT_DUP, NULL, 0, 0}
+
+enum url_clone_state {
+	URL_CLONE_RUNNING,
+	URL_CLONE_DONE,
+	URL_CLONE_FAILED
+};
+
+struct url_clone {
+	enum url_clone_state state;
+	int idx; /* into 'list', of the submodule that clones it */
+	char *gitdir;
+};
+
+/*
+ * Decide how to clone "url" for the submodule "sub" at index "idx".
+ * Return 1 when the clone has to wait for the one of another submodule
+ * of the same URL, and 0 otherwise, with "*reference" set when the
+ * clone can borrow objects from that one.
+ */
+static int reuse_url_clone(struct submodule_update_clone *suc, int idx,
+			   const struct submodule *sub, const char *url,
+			   const char **reference)
+{
+	struct string_list_item *item;
+	struct url_clone *uc;
+
+	*reference = NULL;
+	if (!suc->reuse_clones)
+		return 0;
+
+	item = string_list_lookup(&suc->url_clones, url);
+	if (!item) {
+		uc = xcalloc(1, sizeof(*uc));
+		uc->state = URL_CLONE_RUNNING;
+		uc->idx = idx;
+		/* where "submodule--helper clone" puts it */
+		uc->gitdir = xstrfmt("%s/modules/%s",
+				     absolute_path(get_git_dir()), sub->name);
+		string_list_insert(&suc->url_clones, url)->util = uc;
+		return 0;
+	}
+
+	uc = item->util;
+	if (uc->state == URL_CLONE_RUNNING)
+		return 1;
+	if (uc->state == URL_CLONE_DONE)
+		*reference = uc->gitdir;
+	return 0;
+}
+
+static void finish_url_clone(struct submodule_update_clone *suc, int idx,
+			     int result)
+{
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, &suc->url_clones) {
+		struct url_clone *uc = item->util;
+
+		if (uc->idx == idx && uc->state == URL_CLONE_RUNNING)
+			uc->state = result ? URL_CLONE_FAILED : URL_CLONE_DONE;
+	}
+}
+
 
 
 static void next_submodule_warn_missing(struct submodule_update_clone *suc,
@@ -1582,12 +1656,14 @@ static void next_submodule_warn_missing(struct submodule_update_clone *suc,
  * run the clone. Returns 1 if 'ce' needs to be cloned, 0 otherwise.
  */
 static int prepare_to_clone_next_submodule(const struct cache_entry *ce,
+					   int idx,
 					   struct child_process *child,
 					   struct submodule_update_clone *suc,
 					   struct strbuf *out)
 {
 	const struct submodule *sub = NULL;
 	const char *url = NULL;
+	const char *reference = NULL;
 	const char *update_string;
 	enum submodule_update_type update_type;
 	char *key;
@@ -1657,6 +1733,15 @@ static int prepare_to_clone_next_submodule(const struct cache_entry *ce,
 	strbuf_addf(&sb, "%s/.git", ce->name);
 	needs_cloning = !file_exists(sb.buf);
 
+	if (needs_cloning &&
+	    reuse_url_clone(suc, idx, sub, url, &reference)) {
+		ALLOC_GROW(suc->waiting, suc->waiting_nr + 1,
+			   suc->waiting_alloc);
+		suc->waiting[suc->waiting_nr++] = idx;
+		needs_cloning = 0;
+		goto cleanup;
+	}
+
 	ALLOC_GROW(suc->update_clone, suc->update_clone_nr + 1,
 		   suc->update_clone_alloc);
 	oidcpy(&suc->update_clone[suc->update_clone_nr].oid, &ce->oid);
@@ -1689,6 +1774,8 @@ static int prepare_to_clone_next_submodule(const struct cache_entry *ce,
 		for_each_string_list_item(item, &suc->references)
 			argv_array_pushl(&child->args, "--reference", item->string, NULL);
 	}
+	if (reference)
+		argv_array_pushl(&child->args, "--reference", reference, NULL);
 	if (suc->dissociate)
 		argv_array_push(&child->args, "--dissociate");
 	if (suc->depth)
@@ -1710,11 +1797,29 @@ static int update_clone_get_next_task(struct child_process *child,
 {
 	struct submodule_update_clone *suc = suc_cb;
 	const struct cache_entry *ce;
-	int index;
+	int i, index;
+
+	/*
+	 * First the submodules that waited for a clone of their URL.
+	 * Those still waiting are put back at the end of the list.
+	 */
+	for (i = suc->waiting_nr; i > 0; i--) {
+		int idx = suc->waiting[0];
+
+		MOVE_ARRAY(suc->waiting, suc->waiting + 1, --suc->waiting_nr);
+		ce = suc->list.entries[idx];
+		if (prepare_to_clone_next_submodule(ce, idx, child, suc, err)) {
+			int *p = xmalloc(sizeof(*p));
+			*p = idx;
+			*idx_task_cb = p;
+			return 1;
+		}
+	}
 
 	for (; suc->current < suc->list.nr; suc->current++) {
 		ce = suc->list.entries[suc->current];
-		if (prepare_to_clone_next_submodule(ce, child, suc, err)) {
+		if (prepare_to_clone_next_submodule(ce, suc->current, child,
+						    suc, err)) {
 			int *p = xmalloc(sizeof(*p));
 			*p = suc->current;
 			*idx_task_cb = p;
@@ -1723,6 +1828,10 @@ static int update_clone_get_next_task(struct child_process *child,
 		}
 	}
 
+	/* the rest has to wait for clones that are still running */
+	if (suc->waiting_nr)
+		return 0;
+
 	/*
 	 * The loop above tried cloning each submodule once, now try the
 	 * stragglers again, which we can imagine as an extension of the
@@ -1732,7 +1841,8 @@ static int update_clone_get_next_task(struct child_process *child,
 	if (index < suc->failed_clones_nr) {
 		int *p;
 		ce = suc->failed_clones[index];
-		if (!prepare_to_clone_next_submodule(ce, child, suc, err)) {
+		if (!prepare_to_clone_next_submodule(ce, suc->current, child,
+						     suc, err)) {
 			suc->current ++;
 			strbuf_addstr(err, "BUG: submodule considered for "
 					   "cloning, doesn't need cloning "
@@ -1770,6 +1880,7 @@ static int update_clone_task_finished(int result,
 	int idx = *idxP;
 	free(idxP);
 
+	finish_url_clone(suc, idx, result);
 	if (!result)
 		return 0;
 
@@ -1799,9 +1910,11 @@ static int update_clone_task_finished(int result,
 static int git_update_clone_config(const char *var, const char *value,
 				   void *cb)
 {
-	int *max_jobs = cb;
+	struct submodule_update_clone *suc = cb;
 	if (!strcmp(var, "submodule.fetchjobs"))
-		*max_jobs = parse_submodule_fetchjobs(var, value);
+		suc->max_jobs = parse_submodule_fetchjobs(var, value);
+	else if (!strcmp(var, "submodule.reuseclones"))
+		suc->reuse_clones = git_config_bool(var, value);
 	return 0;
 }
 
@@ -1880,7 +1993,7 @@ static int update_clone(int argc, const char **argv, const char *prefix)
 	suc.prefix = prefix;
 
 	update_clone_config_from_gitmodules(&suc.max_jobs);
-	git_config(git_update_clone_config, &suc.max_jobs);
+	git_config(git_update_clone_config, &suc);
 
 	argc = parse_options(argc, argv, prefix, module_update_clone_options,
 			     git_submodule_helper_usage, 0);
@@ -13,6 +13,7 @@
 #include "progress.h"
 #include "decorate.h"
 #include "fsck.h"
+#include "bulk-checkin.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
 static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict]";
@@ -316,11 +317,89 @@ static void added_object(unsigned nr, enum object_type type,
 	}
 }
 
+struct input_zstream_data {
+	git_zstream *zstream;
+	unsigned char buf[8192];
+	int status;
+};
+
+static const void *feed_input_zstream(struct input_stream *in_stream,
+				      unsigned long *readlen)
+{
+	struct input_zstream_data *data = in_stream->data;
+	git_zstream *zstream = data->zstream;
+	void *in = fill(1);
+
+	zstream->next_out = data->buf;
+	zstream->avail_out = sizeof(data->buf);
+	zstream->next_in = in;
+	zstream->avail_in = len;
+
+	data->status = git_inflate(zstream, 0);
+	in_stream->is_finished = data->status != Z_OK;
+	use(len - zstream->avail_in);
+	*readlen = sizeof(data->buf) - zstream->avail_out;
+	return data->buf;
+}
+
+/*
+ * Inflate a large blob straight into a loose object, instead of into
+ * a buffer as big as the blob itself.
+ */
+static void stream_blob(unsigned long size, unsigned nr)
+{
+	git_zstream zstream;
+	struct input_zstream_data data;
+	struct input_stream in_stream = {
+		.read = feed_input_zstream,
+		.data = &data,
+	};
+	struct obj_info *info = &obj_list[nr];
+
+	memset(&zstream, 0, sizeof(zstream));
+	memset(&data, 0, sizeof(data));
+	data.zstream = &zstream;
+	git_inflate_init(&zstream);
+
+	if (stream_loose_object(&in_stream, size, &info->oid))
+		die(_("failed to write object in stream"));
+	if (data.status != Z_STREAM_END)
+		die(_("inflate returned (%d)"), data.status);
+	git_inflate_end(&zstream);
+
+	if (strict) {
+		struct blob *blob = lookup_blob(the_repository, &info->oid);
+
+		if (!blob)
+			die(_("invalid blob object from stream"));
+		blob->object.flags |= FLAG_WRITTEN;
+	}
+	info->obj = NULL;
+
+	/* deltas already waiting for this blob need its contents after all */
+	if (delta_list) {
+		enum object_type type;
+		unsigned long base_size;
+		void *base = read_object_file(&info->oid, &type, &base_size);
+
+		if (!base)
+			die(_("unable to read back %s"), oid_to_hex(&info->oid));
+		added_object(nr, type, base, base_size);
+		free(base);
+	}
+}
+
 static void unpack_non_delta_entry(enum object_type type, unsigned long size,
 				   unsigned nr)
 {
-	void *buf = get_data(size);
+	void *buf;
+
+	if (!dry_run && type == OBJ_BLOB && size > big_file_threshold) {
+		stream_blob(size, nr);
+		return;
+	}
 
+	buf = get_data(size);
 	if (!dry_run && buf)
 		write_object(nr, type, buf, size);
 	else
@@ -571,6 +650,8 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 		usage(unpack_usage);
 	}
 	the_hash_algo->init_fn(&ctx);
+	/* with core.fsyncObjectFiles=batch, flush the new objects only once */
+	plug_bulk_checkin();
 	unpack_all();
 	the_hash_algo->update_fn(&ctx, buffer, offset);
 	the_hash_algo->final_fn(oid.hash, &ctx);
@@ -582,6 +663,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 	if (!hasheq(fill(the_hash_algo->rawsz), oid.hash))
 		die("final sha1 did not match");
 	use(the_hash_algo->rawsz);
+	unplug_bulk_checkin();
 
 	/* Write the last part of the buffer to stdout */
 	while (len) {
@@ -18,6 +18,7 @@
 #include "dir.h"
 #include "split-index.h"
 #include "fsmonitor.h"
+#include "bulk-checkin.h"
 
 /*
  * Default to not allowing changes to the list of files. The
@@ -1089,6 +1090,9 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	 */
 	parse_options_start(&ctx, argc, argv, prefix,
 			    options, PARSE_OPT_STOP_AT_NON_OPTION);
+
+	/* with core.fsyncObjectFiles=batch, flush the new objects only once */
+	plug_bulk_checkin();
 	while (ctx.argc) {
 		if (parseopt_state != PARSE_OPT_DONE)
 			parseopt_state = parse_options_step(&ctx, options,
@@ -1162,6 +1166,7 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 		strbuf_release(&unquoted);
 		strbuf_release(&buf);
 	}
+	unplug_bulk_checkin();
 
 	if (split_index > 0) {
 		if (git_config_get_split_index() == 0)
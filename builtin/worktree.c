@@ -262,6 +262,29 @@ static void validate_worktree_add(const char *path, const struct add_opts *opts)
 	free_worktrees(worktrees);
 }
 
+/*
+ * The untracked cache and the fsmonitor data of the new worktree start
+ * out empty, so the first "git status" there has to look at every file
+ * and directory. Do that right after the checkout instead, while what
+ * was just written is still in the filesystem cache. It is only a
+ * cache, so do not complain if it fails.
+ */
+static void warm_worktree_caches(struct argv_array *child_env)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+
+	if (git_config_get_untracked_cache() != 1 && !git_config_get_fsmonitor())
+		return;
+
+	cp.git_cmd = 1;
+	cp.no_stdin = 1;
+	cp.no_stdout = 1;
+	cp.no_stderr = 1;
+	cp.env = child_env->argv;
+	argv_array_pushl(&cp.args, "status", "--porcelain", NULL);
+	run_command(&cp);
+}
+
 static int add_worktree(const char *path, const char *refname,
 			const struct add_opts *opts)
 {
@@ -384,6 +407,7 @@ static int add_worktree(const char *path, const char *refname,
 		ret = run_command(&cp);
 		if (ret)
 			goto done;
+		warm_worktree_caches(&child_env);
 	}
 
 	is_junk = 0;
@@ -9,6 +9,9 @@
 #include "strbuf.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "tempfile.h"
+#include "tmp-objdir.h"
+#include "thread-utils.h"
 
 static struct bulk_checkin_state {
 	unsigned plugged:1;
@@ -23,6 +26,13 @@ static struct bulk_checkin_state {
 	uint32_t nr_written;
 } state;
 
+/*
+ * With core.fsyncObjectFiles=batch, the loose objects written while we are
+ * plugged go here, and only become visible in the repository once they
+ * have all been made durable.
+ */
+static struct tmp_objdir *bulk_fsync_objdir;
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	struct object_id oid;
@@ -62,7 +72,8 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 	reprepare_packed_git(the_repository);
 }
 
-static int already_written(struct bulk_checkin_state *state, struct object_id *oid)
+static int already_written(struct bulk_checkin_state *state,
+			   const struct object_id *oid)
 {
 	int i;
 
@@ -268,6 +279,230 @@ int index_bulk_checkin(struct object_id *oid,
 	return status;
 }
 
+/*
+ * Keep about this much file data in memory between the threads that
+ * read and compress a batch of blobs and the pack they go into.
+ */
+#define BLOB_BATCH_BYTES (64 * 1024 * 1024)
+#define BLOB_BATCH_MAX (4096)
+#define MAX_BLOB_THREADS (20)
+
+struct blob_thread_data {
+	pthread_t pthread;
+	struct bulk_checkin_blob *blobs;
+	int nr, step;
+};
+
+/*
+ * Read, hash and deflate one blob; only what is safe to do on any
+ * thread, so errors are left in "status" instead of dying.
+ */
+static void prepare_blob(struct bulk_checkin_blob *blob)
+{
+	char hdr[64];
+	int hdrlen, fd;
+	git_hash_ctx ctx;
+	git_zstream s;
+	void *buf;
+	ssize_t got;
+
+	blob->status = -1;
+	fd = open(blob->path, O_RDONLY);
+	if (fd < 0)
+		return;
+	buf = xmallocz(blob->size);
+	got = read_in_full(fd, buf, blob->size);
+	/* anything past the size we were told about means it changed */
+	if (got == (ssize_t)blob->size && !xread(fd, hdr, 1)) {
+		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
+				   type_name(OBJ_BLOB),
+				   (uintmax_t)blob->size) + 1;
+		the_hash_algo->init_fn(&ctx);
+		the_hash_algo->update_fn(&ctx, hdr, hdrlen);
+		the_hash_algo->update_fn(&ctx, buf, blob->size);
+		the_hash_algo->final_fn(blob->oid.hash, &ctx);
+
+		git_deflate_init(&s, pack_compression_level);
+		blob->deflated = xmalloc(git_deflate_bound(&s, blob->size));
+		s.next_in = buf;
+		s.avail_in = blob->size;
+		s.next_out = blob->deflated;
+		s.avail_out = git_deflate_bound(&s, blob->size);
+		while (git_deflate(&s, Z_FINISH) == Z_OK)
+			; /* nothing */
+		blob->deflated_len = s.total_out;
+		if (git_deflate_end_gently(&s) == Z_OK)
+			blob->status = 0;
+		else
+			FREE_AND_NULL(blob->deflated);
+	}
+	free(buf);
+	close(fd);
+}
+
+static void *prepare_blobs_thread(void *data)
+{
+	struct blob_thread_data *p = data;
+	int i;
+
+	for (i = 0; i < p->nr; i += p->step)
+		prepare_blob(&p->blobs[i]);
+	return NULL;
+}
+
+static void write_prepared_blob(struct bulk_checkin_state *state,
+				struct bulk_checkin_blob *blob)
+{
+	unsigned char hdr[MAX_PACK_OBJECT_HEADER];
+	unsigned hdrlen;
+	struct pack_idx_entry *idx;
+
+	if (already_written(state, &blob->oid))
+		return;
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), OBJ_BLOB,
+					      blob->size);
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + hdrlen + blob->deflated_len) {
+		finish_bulk_checkin(state);
+		prepare_to_stream(state, HASH_WRITE_OBJECT);
+	}
+
+	idx = xcalloc(1, sizeof(*idx));
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+	hashwrite(state->f, hdr, hdrlen);
+	hashwrite(state->f, blob->deflated, blob->deflated_len);
+	state->offset += hdrlen + blob->deflated_len;
+	idx->crc32 = crc32_end(state->f);
+	oidcpy(&idx->oid, &blob->oid);
+	ALLOC_GROW(state->written, state->nr_written + 1, state->alloc_written);
+	state->written[state->nr_written++] = idx;
+}
+
+static void prepare_blob_batch(struct bulk_checkin_blob *blobs, int nr,
+			       int nr_threads)
+{
+	struct blob_thread_data *data;
+	int i;
+
+	if (nr_threads > nr)
+		nr_threads = nr;
+	if (nr_threads <= 1) {
+		for (i = 0; i < nr; i++)
+			prepare_blob(&blobs[i]);
+		return;
+	}
+
+	/* interleave, so that a few big files do not all go to one thread */
+	CALLOC_ARRAY(data, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		struct blob_thread_data *p = &data[i];
+		int err;
+
+		p->blobs = blobs + i;
+		p->nr = nr - i;
+		p->step = nr_threads;
+		err = pthread_create(&p->pthread, NULL, prepare_blobs_thread, p);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die(_("unable to join thread"));
+	free(data);
+}
+
+void index_blobs_bulk_checkin(struct bulk_checkin_blob *blobs, int nr,
+			      int nr_threads)
+{
+	int start = 0;
+
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	else if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > MAX_BLOB_THREADS)
+		nr_threads = MAX_BLOB_THREADS;
+
+	while (start < nr) {
+		size_t bytes = 0;
+		int end, i;
+
+		for (end = start; end < nr && end - start < BLOB_BATCH_MAX; end++) {
+			if (end > start && bytes + blobs[end].size > BLOB_BATCH_BYTES)
+				break;
+			bytes += blobs[end].size;
+		}
+
+		prepare_blob_batch(blobs + start, end - start, nr_threads);
+		for (i = start; i < end; i++) {
+			if (blobs[i].status)
+				continue;
+			write_prepared_blob(&state, &blobs[i]);
+			FREE_AND_NULL(blobs[i].deflated);
+		}
+		start = end;
+	}
+
+	if (!state.plugged)
+		finish_bulk_checkin(&state);
+}
+
+static void finish_bulk_fsync(void)
+{
+	struct strbuf temp_path = STRBUF_INIT;
+	struct tempfile *temp;
+
+	if (!bulk_fsync_objdir)
+		return;
+
+	/*
+	 * fsync_loose_object_bulk_checkin() had the data of each object
+	 * written out, but the storage may still hold it in a volatile
+	 * cache. A single fsync() of a new file flushes it, together with
+	 * the metadata, before the objects get their final names.
+	 */
+	strbuf_addf(&temp_path, "%s/bulk_fsync_XXXXXX", get_object_directory());
+	temp = xmks_tempfile(temp_path.buf);
+	fsync_or_die(get_tempfile_fd(temp), get_tempfile_path(temp));
+	delete_tempfile(&temp);
+	strbuf_release(&temp_path);
+
+	if (tmp_objdir_migrate(bulk_fsync_objdir))
+		die(_("unable to move new objects into the object database"));
+	bulk_fsync_objdir = NULL;
+	/* a pack we may have written there has moved, too */
+	reprepare_packed_git(the_repository);
+}
+
+void prepare_loose_object_bulk_checkin(void)
+{
+	/*
+	 * Callers do not know whether they will write loose objects when
+	 * they plug, so the temporary object directory is created with
+	 * the first one.
+	 */
+	if (!state.plugged || bulk_fsync_objdir ||
+	    fsync_object_files != FSYNC_OBJECT_FILES_BATCH)
+		return;
+
+	bulk_fsync_objdir = tmp_objdir_create();
+	if (bulk_fsync_objdir)
+		tmp_objdir_replace_primary_odb(bulk_fsync_objdir);
+}
+
+void fsync_loose_object_bulk_checkin(int fd)
+{
+	/*
+	 * Outside of a plugged bulk checkin, or if we cannot only write
+	 * out the data, the object must be durable right away.
+	 */
+	if (!bulk_fsync_objdir || fsync_writeout_only(fd) < 0)
+		fsync_or_die(fd, "loose object file");
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
@@ -278,4 +513,5 @@ void unplug_bulk_checkin(void)
 	state.plugged = 0;
 	if (state.f)
 		finish_bulk_checkin(&state);
+	finish_bulk_fsync();
 }
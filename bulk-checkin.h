@@ -10,6 +10,43 @@ int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags);
 
+struct bulk_checkin_blob {
+	const char *path;
+	size_t size;
+
+	/* filled in by index_blobs_bulk_checkin() */
+	struct object_id oid;
+	int status;
+
+	/* private */
+	void *deflated;
+	size_t deflated_len;
+};
+
+/*
+ * Add the files at "blobs[i].path", of "blobs[i].size" bytes each, as
+ * blobs to the bulk-checkin pack. They are read, hashed and deflated
+ * on up to "nr_threads" threads (0 meaning one per CPU), and then
+ * appended to the pack in order, so the caller must have checked that
+ * their contents need no conversion. A blob whose "status" is 0
+ * afterwards has its name in "oid"; any other file could not be read
+ * as expected, and is left for the caller to add the usual way.
+ */
+void index_blobs_bulk_checkin(struct bulk_checkin_blob *blobs, int nr,
+			      int nr_threads);
+
+/*
+ * Called by write_loose_object() before it decides where to write the
+ * object, and instead of fsync() with core.fsyncObjectFiles=batch.
+ */
+void prepare_loose_object_bulk_checkin(void);
+void fsync_loose_object_bulk_checkin(int fd);
+
+/*
+ * Between these, objects are added to a single pack (and with
+ * core.fsyncObjectFiles=batch, loose objects are made durable with a
+ * single flush when unplugging).
+ */
 void plug_bulk_checkin(void);
 void unplug_bulk_checkin(void);
 
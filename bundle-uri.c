@@ -0,0 +1,276 @@
+#include "cache.h"
+#include "bundle-uri.h"
+#include "bundle.h"
+#include "config.h"
+#include "object-store.h"
+#include "refs.h"
+#include "repository.h"
+#include "run-command.h"
+#include "string-list.h"
+#include "strbuf.h"
+
+struct remote_bundle {
+	char *uri;
+	char *file;
+	struct child_process *download;
+	unsigned temporary : 1,
+		 failed : 1,
+		 applied : 1;
+};
+
+struct bundle_list {
+	struct remote_bundle *bundles;
+	int nr, alloc;
+	struct strbuf dir;
+	/* "bundle.<id>.uri" entries, in the order they are first seen */
+	struct string_list ids;
+};
+
+static int is_remote_uri(const char *uri)
+{
+	return starts_with(uri, "http://") || starts_with(uri, "https://");
+}
+
+/*
+ * Start downloading "uri" into a temporary file, or, for a local bundle,
+ * just remember its path.
+ */
+static void add_bundle(struct bundle_list *list, const char *uri)
+{
+	struct remote_bundle *b;
+	const char *path;
+
+	ALLOC_GROW(list->bundles, list->nr + 1, list->alloc);
+	b = &list->bundles[list->nr++];
+	memset(b, 0, sizeof(*b));
+	b->uri = xstrdup(uri);
+
+	if (skip_prefix(uri, "file://", &path)) {
+		b->file = xstrdup(path);
+		return;
+	}
+	if (!is_remote_uri(uri)) {
+		b->file = xstrdup(uri);
+		return;
+	}
+
+	b->file = xstrfmt("%s/bundle-%d-%"PRIuMAX, get_object_directory(),
+			  list->nr, (uintmax_t)getpid());
+	b->temporary = 1;
+	b->download = xmalloc(sizeof(*b->download));
+	child_process_init(b->download);
+	b->download->git_cmd = 1;
+	argv_array_pushl(&b->download->args, "http-fetch",
+			 "--output", b->file, uri, NULL);
+	if (start_command(b->download)) {
+		error(_("unable to download bundle %s"), uri);
+		FREE_AND_NULL(b->download);
+		b->failed = 1;
+	}
+}
+
+static int finish_download(struct remote_bundle *b)
+{
+	if (!b->download)
+		return b->failed ? -1 : 0;
+	if (finish_command(b->download))
+		b->failed = 1;
+	FREE_AND_NULL(b->download);
+	if (b->failed)
+		return error(_("unable to download bundle %s"), b->uri);
+	return 0;
+}
+
+static void clear_bundle_list(struct bundle_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++) {
+		struct remote_bundle *b = &list->bundles[i];
+
+		if (b->temporary)
+			unlink_or_warn(b->file);
+		free(b->uri);
+		free(b->file);
+	}
+	FREE_AND_NULL(list->bundles);
+	list->nr = list->alloc = 0;
+	strbuf_release(&list->dir);
+	string_list_clear(&list->ids, 1);
+}
+
+static int read_bundle_list_entry(const char *key, const char *value, void *data)
+{
+	struct bundle_list *list = data;
+	const char *id, *subkey;
+	int id_len;
+	struct string_list_item *item;
+
+	if (parse_config_key(key, "bundle", &id, &id_len, &subkey) ||
+	    !id || strcmp(subkey, "uri"))
+		return 0;
+	if (!value)
+		return config_error_nonbool(key);
+
+	item = string_list_append_nodup(&list->ids, xmemdupz(id, id_len));
+	if (is_remote_uri(value) || starts_with(value, "file://") ||
+	    is_absolute_path(value) || !list->dir.len)
+		item->util = xstrdup(value);
+	else
+		item->util = xstrfmt("%s%s", list->dir.buf, value);
+	return 0;
+}
+
+/*
+ * "file" (downloaded from "uri") is either a bundle or a list of them.
+ * Start downloading all the bundles on the list, which each can be
+ * a full bundle or an incremental one: the order they are unbundled
+ * in is decided by their prerequisites.
+ */
+static int expand_bundle_list(struct bundle_list *list,
+			      const char *uri, const char *file)
+{
+	const char *slash;
+	int i;
+
+	if (is_bundle(file, 1))
+		return 0;
+
+	slash = strrchr(uri, '/');
+	if (slash)
+		strbuf_add(&list->dir, uri, slash - uri + 1);
+	if (git_config_from_file(read_bundle_list_entry, file, list) < 0)
+		return -1;
+	if (!list->ids.nr)
+		return error(_("%s is neither a bundle nor a bundle list"), uri);
+
+	/* The list itself is not unbundled. */
+	if (list->bundles[0].temporary)
+		unlink(list->bundles[0].file);
+	free(list->bundles[0].uri);
+	free(list->bundles[0].file);
+	list->nr = 0;
+
+	for (i = 0; i < list->ids.nr; i++) {
+		int j;
+
+		/* A later entry for the same id overrides an earlier one. */
+		for (j = i + 1; j < list->ids.nr; j++)
+			if (!strcmp(list->ids.items[i].string,
+				    list->ids.items[j].string))
+				break;
+		if (j == list->ids.nr)
+			add_bundle(list, list->ids.items[i].util);
+	}
+	return 0;
+}
+
+static int prerequisites_present(struct bundle_header *header)
+{
+	int i;
+
+	for (i = 0; i < header->prerequisites.nr; i++)
+		if (!has_object_file(&header->prerequisites.list[i].oid))
+			return 0;
+	return 1;
+}
+
+/*
+ * Write the branches of a bundle under refs/bundles/, so that fetch
+ * negotiation tells the server we have them.
+ */
+static int write_bundle_refs(struct bundle_header *header, const char *uri)
+{
+	struct strbuf ref = STRBUF_INIT;
+	struct strbuf msg = STRBUF_INIT;
+	int i, ret = 0;
+
+	strbuf_addf(&msg, "bundle: %s", uri);
+	for (i = 0; i < header->references.nr; i++) {
+		struct ref_list_entry *e = &header->references.list[i];
+		const char *branch;
+
+		if (!skip_prefix(e->name, "refs/heads/", &branch))
+			continue;
+		strbuf_reset(&ref);
+		strbuf_addf(&ref, "refs/bundles/%s", branch);
+		if (update_ref(msg.buf, ref.buf, &e->oid, NULL,
+			       0, UPDATE_REFS_MSG_ON_ERR))
+			ret = -1;
+	}
+	strbuf_release(&ref);
+	strbuf_release(&msg);
+	return ret;
+}
+
+static int apply_bundle(struct repository *r, struct remote_bundle *b,
+			int *progress)
+{
+	struct bundle_header header;
+	int fd, ret = 0;
+
+	memset(&header, 0, sizeof(header));
+	fd = read_bundle_header(b->file, &header);
+	if (fd < 0) {
+		b->applied = 1;
+		return -1;
+	}
+	if (!prerequisites_present(&header)) {
+		close(fd);
+		return 0;
+	}
+	/* unbundle() closes fd */
+	if (unbundle(r, &header, fd, 0) ||
+	    write_bundle_refs(&header, b->uri))
+		ret = error(_("unable to unbundle %s"), b->uri);
+	b->applied = 1;
+	*progress = 1;
+	return ret;
+}
+
+int fetch_bundle_uri(struct repository *r, const char *uri)
+{
+	struct bundle_list list = { NULL, 0, 0, STRBUF_INIT, STRING_LIST_INIT_DUP };
+	int i, progress, ret = 0;
+
+	add_bundle(&list, uri);
+	if (finish_download(&list.bundles[0]) ||
+	    expand_bundle_list(&list, uri, list.bundles[0].file) < 0) {
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* All downloads run in parallel; wait for them in turn. */
+	for (i = 0; i < list.nr; i++) {
+		if (finish_download(&list.bundles[i])) {
+			list.bundles[i].applied = 1; /* nothing to apply */
+			ret = -1;
+		}
+	}
+
+	/*
+	 * Unbundle whichever bundles have all their prerequisites,
+	 * until no more can be: an incremental bundle may need the
+	 * objects of one listed after it.
+	 */
+	do {
+		progress = 0;
+		for (i = 0; i < list.nr; i++) {
+			if (list.bundles[i].applied)
+				continue;
+			if (apply_bundle(r, &list.bundles[i], &progress) < 0)
+				ret = -1;
+		}
+	} while (progress);
+
+	for (i = 0; i < list.nr; i++) {
+		if (list.bundles[i].applied)
+			continue;
+		ret = error(_("prerequisites of bundle %s are missing"),
+			    list.bundles[i].uri);
+	}
+
+cleanup:
+	clear_bundle_list(&list);
+	return ret;
+}
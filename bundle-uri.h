@@ -0,0 +1,26 @@
+#ifndef BUNDLE_URI_H
+#define BUNDLE_URI_H
+
+struct repository;
+
+/*
+ * Download the bundles at 'uri' and unbundle them into the repository
+ * 'r', so that a fetch that follows only needs what they lack.
+ *
+ * 'uri' names either a bundle, or a bundle list: a file in the git
+ * config format whose "bundle.<id>.uri" entries name the bundles, e.g.
+ * a full bundle and incremental ones on top of it. Relative entries
+ * are relative to the list. Each bundle can be a local path, a file://
+ * URI or an http(s):// URL; the latter are downloaded in parallel.
+ *
+ * Bundles are unbundled as their prerequisites become available, and
+ * the branches they contain are written under refs/bundles/, from
+ * where fetch negotiation offers them to the server as "have"s.
+ *
+ * Returns 0 if every bundle could be applied, and a negative value
+ * (after reporting the problem) otherwise. The bundles applied before
+ * a failure are kept.
+ */
+int fetch_bundle_uri(struct repository *r, const char *uri);
+
+#endif
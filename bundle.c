@@ -182,13 +182,13 @@ int verify_bundle(struct repository *r,
 		error("%s %s", oid_to_hex(&e->oid), e->name);
 	}
 
-	/* Clean up objects used, as they will be reused. */
-	for (i = 0; i < p->nr; i++) {
-		struct ref_list_entry *e = p->list + i;
-		commit = lookup_commit_reference_gently(r, &e->oid, 1);
-		if (commit)
-			clear_commit_marks(commit, ALL_REV_FLAGS);
-	}
+	/*
+	 * Clean up objects used, as they will be reused. The walk from
+	 * "--all" marked more than the prerequisites, and stale marks
+	 * would confuse the verification of the next bundle we are
+	 * asked about.
+	 */
+	clear_object_flags(ALL_REV_FLAGS | PREREQ_MARK);
 
 	if (verbose) {
 		struct ref_list *r;
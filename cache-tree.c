@@ -98,6 +98,12 @@ struct cache_tree_sub *cache_tree_sub(struct cache_tree *it, const char *path)
 	return find_subtree(it, path, pathlen, 1);
 }
 
+struct cache_tree_sub *cache_tree_find_subtree(struct cache_tree *it,
+					       const char *path, int pathlen)
+{
+	return find_subtree(it, path, pathlen, 0);
+}
+
 static int do_invalidate_path(struct cache_tree *it, const char *path)
 {
 	/* a/b/c
@@ -220,20 +226,25 @@ static void discard_unused_subtrees(struct cache_tree *it)
 	}
 }
 
+/*
+ * Invalidating a path invalidates every level above it, so a valid
+ * node only ever has valid subtrees, and the trees they name were
+ * written (or read) before the tree of the node itself.  Checking the
+ * top level is therefore enough; update_one() trusts the same.
+ */
 int cache_tree_fully_valid(struct cache_tree *it)
 {
-	int i;
 	if (!it)
 		return 0;
-	if (it->entry_count < 0 || !has_object_file(&it->oid))
-		return 0;
-	for (i = 0; i < it->subtree_nr; i++) {
-		if (!cache_tree_fully_valid(it->down[i]->cache_tree))
-			return 0;
-	}
-	return 1;
+	return it->entry_count >= 0 &&
+		has_object_file_with_flags(&it->oid, OBJECT_INFO_SKIP_FETCH_OBJECT);
 }
 
+/* number of tree objects hashed by the current cache_tree_update() */
+static int trees_hashed;
+/* number of nodes a WRITE_TREE_REPAIR update found valid again */
+static int trees_repaired;
+
 static int update_one(struct cache_tree *it,
 		      struct cache_entry **cache,
 		      int entries,
@@ -253,9 +264,19 @@ static int update_one(struct cache_tree *it,
 
 	*skip_count = 0;
 
-	if (0 <= it->entry_count && has_object_file(&it->oid))
+	if (0 <= it->entry_count &&
+	    has_object_file_with_flags(&it->oid, OBJECT_INFO_SKIP_FETCH_OBJECT))
 		return it->entry_count;
 
+	/* A sparse directory entry is its own tree. */
+	if (entries && S_ISSPARSEDIR(cache[0]->ce_mode) &&
+	    ce_namelen(cache[0]) == baselen &&
+	    !memcmp(cache[0]->name, base, baselen)) {
+		oidcpy(&it->oid, &cache[0]->oid);
+		it->entry_count = 1;
+		return 1;
+	}
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -361,6 +382,15 @@ static int update_one(struct cache_tree *it,
 			 ce_skip_worktree(ce));
 		if (is_null_oid(oid) ||
 		    (!ce_missing_ok && !has_object_file(oid))) {
+			/*
+			 * A subtree that could not be repaired leaves this
+			 * level invalid, but must not stop its siblings
+			 * from being repaired.
+			 */
+			if (expected_missing && repair) {
+				to_invalidate = 1;
+				continue;
+			}
 			strbuf_release(&buffer);
 			if (expected_missing)
 				return -1;
@@ -404,12 +434,15 @@ static int update_one(struct cache_tree *it,
 #endif
 	}
 
+	trees_hashed++;
 	if (repair) {
 		struct object_id oid;
 		hash_object_file(buffer.buf, buffer.len, tree_type, &oid);
-		if (has_object_file(&oid))
+		if (has_object_file(&oid)) {
 			oidcpy(&it->oid, &oid);
-		else
+			if (!to_invalidate)
+				trees_repaired++;
+		} else
 			to_invalidate = 1;
 	} else if (dryrun) {
 		hash_object_file(buffer.buf, buffer.len, tree_type, &it->oid);
@@ -434,16 +467,27 @@ int cache_tree_update(struct index_state *istate, int flags)
 	struct cache_tree *it = istate->cache_tree;
 	struct cache_entry **cache = istate->cache;
 	int entries = istate->cache_nr;
-	int skip, i = verify_cache(cache, entries, flags);
+	int skip, i;
 
+	/* nothing was invalidated since the last update */
+	if (cache_tree_fully_valid(it))
+		return 0;
+
+	i = verify_cache(cache, entries, flags);
 	if (i)
 		return i;
 	trace_performance_enter();
+	trees_hashed = 0;
+	trees_repaired = 0;
 	i = update_one(it, cache, entries, "", 0, &skip, flags);
+	trace2_data_intmax("cache_tree", the_repository, "update/hashed",
+			   trees_hashed);
 	trace_performance_leave("cache_tree_update");
 	if (i < 0)
 		return i;
-	istate->cache_changed |= CACHE_TREE_CHANGED;
+	/* a repair that found nothing to repair has nothing to write */
+	if (!(flags & WRITE_TREE_REPAIR) || trees_repaired)
+		istate->cache_changed |= CACHE_TREE_CHANGED;
 	return 0;
 }
 
@@ -659,13 +703,27 @@ int write_index_as_tree(struct object_id *oid, struct index_state *index_state,
 	return ret;
 }
 
+/*
+ * Make "it" describe "tree".  The number of entries below a tree
+ * depends only on the tree, so a valid node that already names it
+ * (e.g. one unpack_trees() kept or repaired) is left alone, and its
+ * tree is not even read.
+ */
 static void prime_cache_tree_rec(struct repository *r,
 				 struct cache_tree *it,
 				 struct tree *tree)
 {
 	struct tree_desc desc;
 	struct name_entry entry;
-	int cnt;
+	int i, cnt;
+
+	if (it->entry_count >= 0 && oideq(&it->oid, &tree->object.oid))
+		return;
+	if (!tree->object.parsed)
+		parse_tree(tree);
+
+	for (i = 0; i < it->subtree_nr; i++)
+		it->down[i]->used = 0;
 
 	oidcpy(&it->oid, &tree->object.oid);
 	init_tree_desc(&desc, tree->buffer, tree->size);
@@ -676,14 +734,15 @@ static void prime_cache_tree_rec(struct repository *r,
 		else {
 			struct cache_tree_sub *sub;
 			struct tree *subtree = lookup_tree(r, &entry.oid);
-			if (!subtree->object.parsed)
-				parse_tree(subtree);
 			sub = cache_tree_sub(it, entry.path);
-			sub->cache_tree = cache_tree();
+			if (!sub->cache_tree)
+				sub->cache_tree = cache_tree();
+			sub->used = 1;
 			prime_cache_tree_rec(r, sub->cache_tree, subtree);
 			cnt += sub->cache_tree->entry_count;
 		}
 	}
+	discard_unused_subtrees(it);
 	it->entry_count = cnt;
 }
 
@@ -691,12 +750,53 @@ void prime_cache_tree(struct repository *r,
 		      struct index_state *istate,
 		      struct tree *tree)
 {
-	cache_tree_free(&istate->cache_tree);
-	istate->cache_tree = cache_tree();
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
 	prime_cache_tree_rec(r, istate->cache_tree, tree);
 	istate->cache_changed |= CACHE_TREE_CHANGED;
 }
 
+/*
+ * The sparse directory "path" (e.g. "a/b/") below "it" was expanded
+ * into the entries of "tree": give its node the subtrees of "tree",
+ * and return how many entries were added to the index.
+ */
+static int expand_sparse_dir_rec(struct repository *r,
+				 struct cache_tree *it,
+				 const char *path,
+				 struct tree *tree)
+{
+	const char *slash = strchrnul(path, '/');
+	struct cache_tree_sub *sub;
+	int delta;
+
+	sub = find_subtree(it, path, slash - path, 0);
+	if (!sub || !sub->cache_tree)
+		return 0; /* then "it" is invalid already */
+	if (*slash && slash[1]) {
+		delta = expand_sparse_dir_rec(r, sub->cache_tree, slash + 1,
+					      tree);
+	} else {
+		int old = sub->cache_tree->entry_count;
+
+		cache_tree_free(&sub->cache_tree);
+		sub->cache_tree = cache_tree();
+		prime_cache_tree_rec(r, sub->cache_tree, tree);
+		delta = sub->cache_tree->entry_count - old;
+	}
+	if (it->entry_count >= 0)
+		it->entry_count += delta;
+	return delta;
+}
+
+void cache_tree_expand_sparse_dir(struct repository *r,
+				  struct cache_tree *root,
+				  const char *path,
+				  struct tree *tree)
+{
+	expand_sparse_dir_rec(r, root, path, tree);
+}
+
 /*
  * find the cache_tree that corresponds to the current level without
  * exploding the full path into textual form.  The root of the
@@ -751,6 +851,15 @@ static void verify_one(struct repository *r,
 
 	if (path->len) {
 		pos = index_name_pos(istate, path->buf, path->len);
+		if (pos >= 0) {
+			const struct cache_entry *ce = istate->cache[pos];
+
+			if (!S_ISSPARSEDIR(ce->ce_mode) ||
+			    it->entry_count != 1 || !oideq(&ce->oid, &it->oid))
+				BUG("cache-tree for sparse directory %s does not match",
+				    ce->name);
+			return;
+		}
 		pos = -pos - 1;
 	} else {
 		pos = 0;
@@ -34,6 +34,22 @@ void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
 int git_inflate(git_zstream *, int flush);
 
+/*
+ * Inflate the zlib stream at the start of "in", of which "inlen" bytes
+ * are available, into "out" in one go.  The stream must inflate to
+ * exactly "outlen" bytes; "out" needs room for one more byte, which may
+ * be clobbered.  Returns 0 and stores the number of input bytes used in
+ * "consumed" (when not NULL) on success, and -1 when the stream is
+ * corrupt, is truncated or does not have the expected size, in which
+ * case the caller can fall back to git_inflate() to find out more.
+ *
+ * This skips the setup of a git_zstream, and uses libdeflate when Git
+ * is built with USE_LIBDEFLATE.
+ */
+int git_inflate_buffer(void *out, unsigned long outlen,
+		       const void *in, unsigned long inlen,
+		       unsigned long *consumed);
+
 void git_deflate_init(git_zstream *, int level);
 void git_deflate_init_gzip(git_zstream *, int level);
 void git_deflate_init_raw(git_zstream *, int level);
@@ -69,6 +85,13 @@ unsigned long git_deflate_bound(git_zstream *, unsigned long);
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * In a sparse index, a directory outside of the sparse-checkout cone
+ * is stored as a single entry named "dir/" whose mode is S_IFDIR
+ * and whose object name is that of its tree (see sparse-index.h).
+ */
+#define S_ISSPARSEDIR(m)	((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -318,7 +341,8 @@ struct index_state {
 		 drop_cache_tree : 1,
 		 updated_workdir : 1,
 		 updated_skipworktree : 1,
-		 fsmonitor_has_run_once : 1;
+		 fsmonitor_has_run_once : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	struct object_id oid;
@@ -329,6 +353,7 @@ struct index_state {
 };
 
 /* Name hashing */
+void lazy_init_name_hash(struct index_state *istate);
 int test_lazy_init_name_hash(struct index_state *istate, int try_threaded);
 void add_name_hash(struct index_state *istate, struct cache_entry *ce);
 void remove_name_hash(struct index_state *istate, struct cache_entry *ce);
@@ -467,6 +492,7 @@ static inline enum object_type object_type(unsigned int mode)
 #define GRAFT_ENVIRONMENT "GIT_GRAFT_FILE"
 #define GIT_SHALLOW_FILE_ENVIRONMENT "GIT_SHALLOW_FILE"
 #define TEMPLATE_DIR_ENVIRONMENT "GIT_TEMPLATE_DIR"
+#define GIT_DEFAULT_REF_FORMAT_ENVIRONMENT "GIT_DEFAULT_REF_FORMAT"
 #define CONFIG_ENVIRONMENT "GIT_CONFIG"
 #define CONFIG_DATA_ENVIRONMENT "GIT_CONFIG_PARAMETERS"
 #define EXEC_PATH_ENVIRONMENT "GIT_EXEC_PATH"
@@ -757,6 +783,14 @@ int remove_file_from_index(struct index_state *, const char *path);
 int add_to_index(struct index_state *, const char *path, struct stat *, int flags);
 int add_file_to_index(struct index_state *, const char *path, int flags);
 
+/*
+ * Like add_to_index(), for a file whose contents the caller has
+ * already written out as the blob "oid".
+ */
+int add_to_index_with_oid(struct index_state *, const char *path,
+			  struct stat *, const struct object_id *oid,
+			  int flags);
+
 int chmod_index_entry(struct index_state *, struct cache_entry *ce, char flip);
 int ce_same_name(const struct cache_entry *a, const struct cache_entry *b);
 void set_object_name_for_intent_to_add_entry(struct cache_entry *ce);
@@ -841,7 +875,16 @@ extern int pack_compression_level;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+
+enum delta_base_cache_policy {
+	DELTA_BASE_CACHE_LRU = 0,
+	DELTA_BASE_CACHE_2Q
+};
+
+extern enum delta_base_cache_policy delta_base_cache_policy;
 extern unsigned long big_file_threshold;
+extern unsigned long diff_cache_limit;
+extern unsigned long tree_cache_limit;
 extern unsigned long pack_size_limit_cfg;
 
 /*
@@ -863,9 +906,22 @@ void reset_shared_repository(void);
 extern int read_replace_refs;
 extern char *git_replace_ref_base;
 
-extern int fsync_object_files;
+enum fsync_object_files {
+	FSYNC_OBJECT_FILES_OFF = 0,
+	FSYNC_OBJECT_FILES_ON,
+	FSYNC_OBJECT_FILES_BATCH
+};
+extern enum fsync_object_files fsync_object_files;
 extern int core_preload_index;
 extern int core_apply_sparse_checkout;
+extern int core_sparse_checkout_cone;
+
+/*
+ * Commands that can work on a sparse index set this to 0 before they
+ * read the index; the index is expanded when it is read otherwise.
+ */
+extern int command_requires_full_index;
+extern int core_loose_object_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -940,6 +996,7 @@ extern int repository_format_precious_objects;
 extern char *repository_format_partial_clone;
 extern const char *core_partial_clone_filter_default;
 extern int repository_format_worktree_config;
+extern char *repository_format_ref_storage;
 
 /*
  * You _have_ to initialize a `struct repository_format` using
@@ -950,6 +1007,7 @@ struct repository_format {
 	int precious_objects;
 	char *partial_clone; /* value of extensions.partialclone */
 	int worktree_config;
+	char *ref_storage; /* value of extensions.refstorage */
 	int is_bare;
 	int hash_algo;
 	char *work_tree;
@@ -1607,6 +1665,12 @@ struct checkout {
 
 #define TEMPORARY_FILENAME_LENGTH 25
 int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath, int *nr_checkouts);
+/*
+ * Refresh the index entry of 'ce' from the stat data 'st' of the file
+ * just written for it, if 'state' asks for the index to be refreshed.
+ */
+void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+			   struct stat *st);
 void enable_delayed_checkout(struct checkout *state);
 int finish_delayed_checkout(struct checkout *state, int *nr_checkouts);
 /*
@@ -1629,6 +1693,7 @@ static inline void cache_def_clear(struct cache_def *cache)
 
 int has_symlink_leading_path(const char *name, int len);
 int threaded_has_symlink_leading_path(struct cache_def *, const char *, int);
+int threaded_check_leading_path(struct cache_def *, const char *, int);
 int check_leading_path(const char *name, int len);
 int has_dirs_only_path(const char *name, int len, int prefix_len);
 void schedule_dir_for_removal(const char *name, int len);
@@ -1704,10 +1769,22 @@ int copy_file(const char *dst, const char *src, int mode);
 int copy_file_with_time(const char *dst, const char *src, int mode);
 
 void write_or_die(int fd, const void *buf, size_t count);
+void writev_or_die(int fd, struct iovec *iov, int iovcnt);
 void fsync_or_die(int fd, const char *);
 
+/*
+ * Start writing out the data of "fd" and wait for it, without asking
+ * the storage to flush its caches, or return -1 if we cannot.
+ */
+int fsync_writeout_only(int fd);
+
 ssize_t read_in_full(int fd, void *buf, size_t count);
 ssize_t write_in_full(int fd, const void *buf, size_t count);
+/*
+ * Write all the buffers in one go where possible. The array is modified
+ * to keep track of partial writes.
+ */
+ssize_t writev_in_full(int fd, struct iovec *iov, int iovcnt);
 ssize_t pread_in_full(int fd, void *buf, size_t count, off_t offset);
 
 static inline ssize_t write_str_in_full(int fd, const char *str)
@@ -12,6 +12,8 @@
 #include "userdiff.h"
 #include "sha1-array.h"
 #include "revision.h"
+#include "config.h"
+#include "thread-utils.h"
 
 static int compare_paths(const struct combine_diff_path *one,
 			  const struct diff_filespec *two)
@@ -419,13 +421,184 @@ static void consume_line(void *state_, char *line, unsigned long len)
 	}
 }
 
+/*
+ * The diff between a parent and the result, as what xdiff gives to
+ * consume_hunk() and consume_line(), so that it can be made in a
+ * thread and replayed later.
+ */
+struct parent_diff {
+	mmfile_t parent_file, *result_file;
+	long flags;
+	int ret;
+	struct parent_diff_event {
+		long ob, on, nb, nn;	/* a hunk, if "len" is 0 */
+		size_t line, len;	/* a line of "lines" */
+	} *ev;
+	size_t nr, alloc;
+	struct strbuf lines;
+};
+
+static void save_hunk(void *data, long ob, long on, long nb, long nn,
+		      const char *funcline, long funclen)
+{
+	struct parent_diff *pd = data;
+	struct parent_diff_event *ev;
+
+	ALLOC_GROW(pd->ev, pd->nr + 1, pd->alloc);
+	ev = &pd->ev[pd->nr++];
+	memset(ev, 0, sizeof(*ev));
+	ev->ob = ob;
+	ev->on = on;
+	ev->nb = nb;
+	ev->nn = nn;
+}
+
+static void save_line(void *data, char *line, unsigned long len)
+{
+	struct parent_diff *pd = data;
+	struct parent_diff_event *ev;
+
+	/* consume_line() only looks at these */
+	if (!len || (line[0] != '-' && line[0] != '+'))
+		return;
+	ALLOC_GROW(pd->ev, pd->nr + 1, pd->alloc);
+	ev = &pd->ev[pd->nr++];
+	ev->line = pd->lines.len;
+	ev->len = len;
+	strbuf_add(&pd->lines, line, len);
+}
+
+struct parent_diff_thread {
+	pthread_t thread;
+	struct parent_diff *diffs;
+	int nr, start, step;
+};
+
+static void *run_parent_diffs(void *data)
+{
+	struct parent_diff_thread *t = data;
+	xdlcache_t *cache = xdi_cache_new();
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	int i;
+
+	for (i = t->start; i < t->nr; i += t->step) {
+		struct parent_diff *pd = &t->diffs[i];
+
+		if (!pd->parent_file.ptr)
+			continue;
+		memset(&xpp, 0, sizeof(xpp));
+		xpp.flags = pd->flags;
+		xpp.cache = cache;
+		memset(&xecfg, 0, sizeof(xecfg));
+		pd->ret = xdi_diff_outf(&pd->parent_file, pd->result_file,
+					save_hunk, save_line, pd, &xpp, &xecfg);
+	}
+	xdl_cache_free(cache);
+	return NULL;
+}
+
+static int combined_threads(struct repository *r)
+{
+	static int threads = -1;
+
+	if (threads < 0) {
+		if (repo_config_get_int(r, "diff.combinedthreads", &threads) ||
+		    threads < 0)
+			threads = 0;
+		if (!threads)
+			threads = online_cpus();
+	}
+	return HAVE_THREADS ? threads : 1;
+}
+
+/*
+ * Diff the result against each parent that show_patch_diff() would
+ * hand to combine_diff() ("todo"), using as many threads as
+ * diff.combinedThreads allows. The blobs are read beforehand, and the
+ * diffs are replayed by combine_diff() in order.
+ */
+static struct parent_diff *diff_parents(struct repository *r,
+					struct combine_diff_path *elem,
+					int num_parent, const int *todo,
+					mmfile_t *result_file,
+					struct userdiff_driver *textconv,
+					long flags)
+{
+	struct parent_diff *diffs;
+	struct parent_diff_thread *threads;
+	int i, n = 0, nr_threads = combined_threads(r);
+
+	for (i = 0; i < num_parent; i++)
+		if (todo[i])
+			n++;
+	if (nr_threads < 2 || n < 2)
+		return NULL;
+
+	diffs = xcalloc(num_parent, sizeof(*diffs));
+	for (i = 0; i < num_parent; i++) {
+		unsigned long sz;
+
+		strbuf_init(&diffs[i].lines, 0);
+		if (!todo[i])
+			continue;
+		diffs[i].parent_file.ptr = grab_blob(r, &elem->parent[i].oid,
+						     elem->parent[i].mode,
+						     &sz, textconv, elem->path);
+		diffs[i].parent_file.size = sz;
+		diffs[i].result_file = result_file;
+		diffs[i].flags = flags;
+	}
+
+	if (nr_threads > n)
+		nr_threads = n;
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].diffs = diffs;
+		threads[i].nr = num_parent;
+		threads[i].start = i;
+		threads[i].step = nr_threads;
+		if (i && pthread_create(&threads[i].thread, NULL,
+					run_parent_diffs, &threads[i]))
+			die(_("unable to create threaded diff"));
+	}
+	run_parent_diffs(&threads[0]);
+	for (i = 1; i < nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	free(threads);
+
+	for (i = 0; i < num_parent; i++)
+		FREE_AND_NULL(diffs[i].parent_file.ptr);
+	return diffs;
+}
+
+static void free_parent_diffs(struct parent_diff *diffs, int num_parent)
+{
+	int i;
+
+	if (!diffs)
+		return;
+	for (i = 0; i < num_parent; i++) {
+		free(diffs[i].ev);
+		strbuf_release(&diffs[i].lines);
+	}
+	free(diffs);
+}
+
+/*
+ * Diff the result against parent "n", or take the diff from "pd" if
+ * diff_parents() already made it. A parent that has the result's
+ * blob ("result_oid", if known) needs no diff at all.
+ */
 static void combine_diff(struct repository *r,
 			 const struct object_id *parent, unsigned int mode,
+			 const struct object_id *result_oid,
 			 mmfile_t *result_file,
 			 struct sline *sline, unsigned int cnt, int n,
 			 int num_parent, int result_deleted,
 			 struct userdiff_driver *textconv,
-			 const char *path, long flags)
+			 const char *path, long flags,
+			 struct parent_diff *pd)
 {
 	unsigned int p_lno, lno;
 	unsigned long nmask = (1UL << n);
@@ -438,11 +611,6 @@ static void combine_diff(struct repository *r,
 	if (result_deleted)
 		return; /* result deleted */
 
-	parent_file.ptr = grab_blob(r, parent, mode, &sz, textconv, path);
-	parent_file.size = sz;
-	memset(&xpp, 0, sizeof(xpp));
-	xpp.flags = flags;
-	memset(&xecfg, 0, sizeof(xecfg));
 	memset(&state, 0, sizeof(state));
 	state.nmask = nmask;
 	state.sline = sline;
@@ -450,11 +618,35 @@ static void combine_diff(struct repository *r,
 	state.num_parent = num_parent;
 	state.n = n;
 
-	if (xdi_diff_outf(&parent_file, result_file, consume_hunk,
-			  consume_line, &state, &xpp, &xecfg))
-		die("unable to generate combined diff for %s",
-		    oid_to_hex(parent));
-	free(parent_file.ptr);
+	if (pd) {
+		size_t i;
+
+		if (pd->ret)
+			die("unable to generate combined diff for %s",
+			    oid_to_hex(parent));
+		for (i = 0; i < pd->nr; i++) {
+			struct parent_diff_event *ev = &pd->ev[i];
+
+			if (ev->len)
+				consume_line(&state, pd->lines.buf + ev->line,
+					     ev->len);
+			else
+				consume_hunk(&state, ev->ob, ev->on,
+					     ev->nb, ev->nn, NULL, 0);
+		}
+	} else if (!result_oid || !oideq(parent, result_oid)) {
+		parent_file.ptr = grab_blob(r, parent, mode, &sz, textconv, path);
+		parent_file.size = sz;
+		memset(&xpp, 0, sizeof(xpp));
+		xpp.flags = flags;
+		memset(&xecfg, 0, sizeof(xecfg));
+
+		if (xdi_diff_outf(&parent_file, result_file, consume_hunk,
+				  consume_line, &state, &xpp, &xecfg))
+			die("unable to generate combined diff for %s",
+			    oid_to_hex(parent));
+		free(parent_file.ptr);
+	}
 
 	/* Assign line numbers for this parent.
 	 *
@@ -1027,6 +1219,8 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	struct userdiff_driver *textconv = NULL;
 	int is_binary;
 	const char *line_prefix = diff_line_prefix(opt);
+	struct parent_diff *diffs;
+	int *todo;
 
 	context = opt->context;
 	userdiff = userdiff_find_by_path(opt->repo->index, elem->path);
@@ -1182,6 +1376,20 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	for (lno = 0; lno <= cnt; lno++)
 		sline[lno+1].p_lno = sline[lno].p_lno + num_parent;
 
+	/* the parents that are not the same as an earlier one */
+	ALLOC_ARRAY(todo, num_parent);
+	for (i = 0; i < num_parent; i++) {
+		int j;
+		for (j = 0; j < i; j++)
+			if (oideq(&elem->parent[i].oid, &elem->parent[j].oid))
+				break;
+		todo[i] = i <= j && !result_deleted &&
+			  (working_tree_file ||
+			   !oideq(&elem->parent[i].oid, &elem->oid));
+	}
+	diffs = diff_parents(opt->repo, elem, num_parent, todo,
+			     &result_file, textconv, opt->xdl_opts);
+
 	for (i = 0; i < num_parent; i++) {
 		int j;
 		for (j = 0; j < i; j++) {
@@ -1195,10 +1403,14 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 			combine_diff(opt->repo,
 				     &elem->parent[i].oid,
 				     elem->parent[i].mode,
+				     working_tree_file ? NULL : &elem->oid,
 				     &result_file, sline,
 				     cnt, i, num_parent, result_deleted,
-				     textconv, elem->path, opt->xdl_opts);
+				     textconv, elem->path, opt->xdl_opts,
+				     diffs && todo[i] ? &diffs[i] : NULL);
 	}
+	free_parent_diffs(diffs, num_parent);
+	free(todo);
 
 	show_hunks = make_hunks(sline, cnt, num_parent, dense);
 
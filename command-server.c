@@ -0,0 +1,157 @@
+#include "cache.h"
+#include "command-server.h"
+#include "pkt-line.h"
+#include "sigchain.h"
+#include "unix-socket.h"
+
+char *command_server_socket_path(void)
+{
+	return absolute_pathdup(git_path("command-server.ipc"));
+}
+
+#ifdef NO_UNIX_SOCKETS
+int command_server_send(const char *socket_path,
+			int argc, const char **argv, int *status)
+{
+	return -1;
+}
+
+int command_server_run(int argc, const char **argv, int *status)
+{
+	return -1;
+}
+#else
+/*
+ * Add one pkt-line to the request. The environment may hold secrets,
+ * so unlike packet_buf_write() this does not show up in packet traces.
+ */
+static int add_request_line(struct strbuf *req, const char *prefix,
+			    const char *value)
+{
+	size_t len = 4 + strlen(prefix) + strlen(value);
+
+	if (len > LARGE_PACKET_MAX)
+		return -1;
+	strbuf_grow(req, len);
+	set_packet_header(req->buf + req->len, len);
+	strbuf_setlen(req, req->len + 4);
+	strbuf_addstr(req, prefix);
+	strbuf_addstr(req, value);
+	return 0;
+}
+
+static int build_request(struct strbuf *req, int argc, const char **argv)
+{
+	extern char **environ;
+	struct strbuf cwd = STRBUF_INIT;
+	char **e;
+	int i, ret = 0;
+
+	if (strbuf_getcwd(&cwd) || add_request_line(req, "cwd ", cwd.buf))
+		ret = -1;
+	for (e = environ; !ret && e && *e; e++)
+		ret = add_request_line(req, "env ", *e);
+	for (i = 0; !ret && i < argc; i++)
+		ret = add_request_line(req, "arg ", argv[i]);
+	strbuf_addstr(req, "0000");
+	strbuf_release(&cwd);
+	return ret;
+}
+
+/*
+ * Read one line of the answer. Unlike packet_read(), which dies, take
+ * a server that went away, even in the middle of the request, quietly.
+ */
+static const char *read_answer(int fd)
+{
+	static char buf[LARGE_PACKET_MAX];
+	int len, hi, lo;
+
+	if (read_in_full(fd, buf, 4) != 4)
+		return NULL;
+	hi = hex2chr(buf);
+	lo = hex2chr(buf + 2);
+	if (hi < 0 || lo < 0)
+		return NULL;
+	len = ((hi << 8) | lo) - 4;
+	if (len <= 0 || len >= sizeof(buf) ||
+	    read_in_full(fd, buf, len) != len)
+		return NULL;
+	if (buf[len - 1] == '\n')
+		len--;
+	buf[len] = '\0';
+	return buf;
+}
+
+int command_server_send(const char *socket_path,
+			int argc, const char **argv, int *status)
+{
+	static const int fds[] = { 0, 1, 2 };
+	struct strbuf req = STRBUF_INIT;
+	const char *answer, *arg;
+	int fd, ret = -1;
+
+	if (build_request(&req, argc, argv) < 0) {
+		strbuf_release(&req);
+		return -1;
+	}
+
+	fd = unix_stream_connect(socket_path);
+	if (fd < 0) {
+		strbuf_release(&req);
+		return -1;
+	}
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	if (unix_stream_send_fds(fd, fds, ARRAY_SIZE(fds)) < 0 ||
+	    write_in_full(fd, req.buf, req.len) < 0)
+		goto out;
+	answer = read_answer(fd);
+	if (!answer || strcmp(answer, "started"))
+		goto out;
+
+	/* from here on, the command has run and we cannot run it again */
+	ret = 0;
+	answer = read_answer(fd);
+	if (answer && skip_prefix(answer, "exit ", &arg)) {
+		*status = atoi(arg);
+	} else if (answer && skip_prefix(answer, "signal ", &arg)) {
+		int sig = atoi(arg);
+
+		/* die the way the command did, if we can */
+		close(fd);
+		sigchain_pop(SIGPIPE);
+		strbuf_release(&req);
+		signal(sig, SIG_DFL);
+		raise(sig);
+		*status = 128 + sig;
+		return 0;
+	} else {
+		*status = 128;
+		error(_("the command server went away"));
+	}
+
+out:
+	close(fd);
+	sigchain_pop(SIGPIPE);
+	strbuf_release(&req);
+	return ret;
+}
+
+int command_server_run(int argc, const char **argv, int *status)
+{
+	const char *socket_path = getenv("GIT_COMMAND_SERVER");
+	int i;
+
+	if (!socket_path || !*socket_path)
+		return -1;
+	/* these would select another repository, or change how it is read */
+	for (i = 0; local_repo_env[i]; i++)
+		if (getenv(local_repo_env[i]))
+			return -1;
+	if (command_server_send(socket_path, argc, argv, status) < 0)
+		return -1;
+	trace2_data_string("command-server", the_repository, "served", argv[0]);
+	return 0;
+}
+#endif
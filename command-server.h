@@ -0,0 +1,42 @@
+#ifndef COMMAND_SERVER_H
+#define COMMAND_SERVER_H
+
+/*
+ * "git command-server" keeps the index, the packs and the commit-graph
+ * of one repository loaded, and runs some read-only commands on behalf
+ * of clients in a process forked from it, sparing them most of the
+ * start-up cost.
+ *
+ * The client sends its standard input, output and error over the
+ * socket, then a request made of pkt-lines:
+ *
+ *	cwd <directory>
+ *	env <name>=<value>	(for each environment variable)
+ *	arg <argument>		(for each argument, the command first)
+ *	flush
+ *
+ * The server answers "started", or "refused <reason>" if the client
+ * should run the command itself, e.g. because it is in another
+ * repository. Once the command is done, the server sends "exit <code>",
+ * or "signal <number>" if the command was killed.
+ */
+
+/* The socket the command server of the current repository listens on. */
+char *command_server_socket_path(void);
+
+/*
+ * Send the command in argv to the command server listening on
+ * "socket_path". Return 0 and set "status" to the exit code when it
+ * ran the command, and -1 when it did not.
+ */
+int command_server_send(const char *socket_path,
+			int argc, const char **argv, int *status);
+
+/*
+ * Have the command server named by $GIT_COMMAND_SERVER run the builtin
+ * command in argv. Return 0 and set "status" to the exit code when it
+ * did, and -1 when the caller has to run the command itself.
+ */
+int command_server_run(int argc, const char **argv, int *status);
+
+#endif /* COMMAND_SERVER_H */
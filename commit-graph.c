@@ -16,12 +16,19 @@
 #include "hashmap.h"
 #include "replace-object.h"
 #include "progress.h"
+#include "bloom.h"
+#include "thread-utils.h"
+#include "radix-sort.h"
 
 #define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA 0x47444154 /* "GDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f56 /* "GDOV" */
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
@@ -35,6 +42,10 @@
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW (1ULL << 31)
+
+#define MAX_NUM_CHUNKS 9
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_CHUNKLOOKUP_WIDTH 12
@@ -72,6 +83,15 @@ static uint8_t oid_version(void)
 	return 1;
 }
 
+define_commit_slab(topo_level_slab, uint32_t);
+
+static int get_configured_generation_version(struct repository *r)
+{
+	int version = 1;
+	repo_config_get_int(r, "commitgraph.generationversion", &version);
+	return version;
+}
+
 static struct commit_graph *alloc_commit_graph(void)
 {
 	struct commit_graph *g = xcalloc(1, sizeof(*g));
@@ -227,6 +247,7 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
 		if (data + graph_size - chunk_lookup <
 		    GRAPH_CHUNKLOOKUP_WIDTH) {
 			error(_("commit-graph chunk lookup table entry missing; file may be incomplete"));
+			free(graph->bloom_filter_settings);
 			free(graph);
 			return NULL;
 		}
@@ -239,6 +260,7 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
 		if (chunk_offset > graph_size - the_hash_algo->rawsz) {
 			error(_("commit-graph improper chunk offset %08x%08x"), (uint32_t)(chunk_offset >> 32),
 			      (uint32_t)chunk_offset);
+			free(graph->bloom_filter_settings);
 			free(graph);
 			return NULL;
 		}
@@ -272,15 +294,56 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
 				graph->chunk_extra_edges = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_GENERATION_DATA:
+			if (graph->chunk_generation_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW:
+			if (graph->chunk_generation_data_overflow)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data_overflow = data + chunk_offset;
+			break;
+
 		case GRAPH_CHUNKID_BASE:
 			if (graph->chunk_base_graphs)
 				chunk_repeated = 1;
 			else
 				graph->chunk_base_graphs = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			if (graph->chunk_bloom_indexes)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_indexes = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMDATA:
+			if (graph->chunk_bloom_data)
+				chunk_repeated = 1;
+			else {
+				uint32_t hash_version;
+				graph->chunk_bloom_data = data + chunk_offset;
+				hash_version = get_be32(data + chunk_offset);
+
+				if (hash_version != 1)
+					break;
+
+				graph->bloom_filter_settings = xmalloc(sizeof(struct bloom_filter_settings));
+				graph->bloom_filter_settings->hash_version = hash_version;
+				graph->bloom_filter_settings->num_hashes = get_be32(data + chunk_offset + 4);
+				graph->bloom_filter_settings->bits_per_entry = get_be32(data + chunk_offset + 8);
+			}
+			break;
 		}
 
 		if (chunk_repeated) {
 			error(_("commit-graph chunk id %08x appears multiple times"), chunk_id);
+			free(graph->bloom_filter_settings);
 			free(graph);
 			return NULL;
 		}
@@ -291,13 +354,40 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
 					     / graph->hash_len;
 		}
 
+		if (last_chunk_id == GRAPH_CHUNKID_BLOOMDATA)
+			graph->bloom_data_len = chunk_offset - last_chunk_offset;
+
+		if (last_chunk_id == GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW)
+			graph->generation_data_overflow_len = chunk_offset - last_chunk_offset;
+
 		last_chunk_id = chunk_id;
 		last_chunk_offset = chunk_offset;
 	}
 
+	if (last_chunk_id == GRAPH_CHUNKID_BLOOMDATA)
+		graph->bloom_data_len = graph_size - graph->hash_len - last_chunk_offset;
+	if (last_chunk_id == GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW)
+		graph->generation_data_overflow_len = graph_size - graph->hash_len - last_chunk_offset;
+
 	hashcpy(graph->oid.hash, graph->data + graph->data_len - graph->hash_len);
 
+	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data &&
+	    graph->bloom_filter_settings &&
+	    graph->bloom_data_len >= BLOOMDATA_CHUNK_HEADER_SIZE)
+		init_bloom_filters();
+	else {
+		/* We need both the index and data chunks to use the filters. */
+		graph->chunk_bloom_indexes = NULL;
+		graph->chunk_bloom_data = NULL;
+		FREE_AND_NULL(graph->bloom_filter_settings);
+	}
+
+	if (graph->chunk_generation_data &&
+	    get_configured_generation_version(the_repository) >= 2)
+		graph->read_generation_data = 1;
+
 	if (verify_commit_graph_lite(graph)) {
+		free(graph->bloom_filter_settings);
 		free(graph);
 		return NULL;
 	}
@@ -369,6 +459,25 @@ static int add_graph_to_chain(struct commit_graph *g,
 	return 1;
 }
 
+/*
+ * Corrected commit dates are only comparable with each other, so they
+ * can only be used if every layer of the chain provides them.
+ */
+static void validate_mixed_generation_chain(struct commit_graph *g)
+{
+	int read_generation_data = 1;
+	struct commit_graph *p;
+
+	for (p = g; read_generation_data && p; p = p->base_graph)
+		read_generation_data = p->read_generation_data;
+
+	if (read_generation_data)
+		return;
+
+	for (p = g; p; p = p->base_graph)
+		p->read_generation_data = 0;
+}
+
 static struct commit_graph *load_commit_graph_chain(struct repository *r, const char *obj_dir)
 {
 	struct commit_graph *graph_chain = NULL;
@@ -432,6 +541,8 @@ static struct commit_graph *load_commit_graph_chain(struct repository *r, const
 		}
 	}
 
+	validate_mixed_generation_chain(graph_chain);
+
 	free(oids);
 	fclose(fp);
 	strbuf_release(&line);
@@ -486,10 +597,10 @@ static int prepare_commit_graph(struct repository *r)
 		 * so that commit graph loading is not attempted again for this
 		 * repository.)
 		 */
-		return 0;
+		goto not_used;
 
 	if (!commit_graph_compatible(r))
-		return 0;
+		goto not_used;
 
 	prepare_alt_odb(r);
 	for (odb = r->objects->odb;
@@ -497,6 +608,11 @@ static int prepare_commit_graph(struct repository *r)
 	     odb = odb->next)
 		prepare_commit_graph_one(r, odb->path);
 	return !!r->objects->commit_graph;
+
+not_used:
+	/* "git command-server" hands its children a graph loaded in advance */
+	close_commit_graph(r->objects);
+	return 0;
 }
 
 int generation_numbers_enabled(struct repository *r)
@@ -528,6 +644,9 @@ static void close_commit_graph_one(struct commit_graph *g)
 
 void close_commit_graph(struct raw_object_store *o)
 {
+	/* Filters loaded from the graph point into its mapping. */
+	if (o->commit_graph)
+		deinit_bloom_filters();
 	close_commit_graph_one(o->commit_graph);
 	o->commit_graph = NULL;
 }
@@ -577,6 +696,62 @@ static struct commit_list **insert_parent_or_die(struct repository *r,
 	return &commit_list_insert(c, pptr)->next;
 }
 
+static timestamp_t read_commit_date(struct commit_graph *g,
+				    const unsigned char *commit_data)
+{
+	uint64_t date_high, date_low;
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	return (timestamp_t)((date_high << 32) | date_low);
+}
+
+/*
+ * Read the generation of the commit at local position 'lex_index' of
+ * layer 'g': the corrected commit date if the layer stores generation
+ * data and we are allowed to read it, the topological level otherwise.
+ */
+static timestamp_t read_generation(struct commit_graph *g, uint32_t lex_index,
+				   const unsigned char *commit_data)
+{
+	timestamp_t offset;
+	uint32_t pos;
+
+	if (!g->read_generation_data)
+		return get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	offset = get_be32(g->chunk_generation_data +
+			  sizeof(uint32_t) * lex_index);
+	if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+		if (!g->chunk_generation_data_overflow)
+			die(_("commit-graph requires overflow generation data but has none"));
+
+		pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+		if (pos >= g->generation_data_overflow_len / 8)
+			die(_("commit-graph overflow generation data is too small"));
+
+		offset = get_be64(g->chunk_generation_data_overflow + 8 * pos);
+	}
+	return read_commit_date(g, commit_data) + offset;
+}
+
+/*
+ * Fill the generation of a commit at local position 'lex_index' of
+ * layer 'g'. The topological level is also recorded in
+ * 'g->topo_levels', if the caller asked for it.
+ */
+static void fill_commit_generation(struct commit *item, struct commit_graph *g,
+				   uint32_t lex_index,
+				   const unsigned char *commit_data)
+{
+	uint32_t topo_level = get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	item->generation = read_generation(g, lex_index, commit_data);
+
+	if (g->topo_levels)
+		*topo_level_slab_at(g->topo_levels, item) = topo_level;
+}
+
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
 	const unsigned char *commit_data;
@@ -588,7 +763,7 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 	lex_index = pos - g->num_commits_in_base;
 	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 	item->graph_pos = pos;
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	fill_commit_generation(item, g, lex_index, commit_data);
 }
 
 static inline void set_commit_tree(struct commit *c, struct tree *t)
@@ -602,7 +777,6 @@ static int fill_commit_in_graph(struct repository *r,
 {
 	uint32_t edge_value;
 	uint32_t *parent_data_ptr;
-	uint64_t date_low, date_high;
 	struct commit_list **pptr;
 	const unsigned char *commit_data;
 	uint32_t lex_index;
@@ -626,11 +800,8 @@ static int fill_commit_in_graph(struct repository *r,
 
 	set_commit_tree(item, NULL);
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->date = read_commit_date(g, commit_data);
+	fill_commit_generation(item, g, lex_index, commit_data);
 
 	pptr = &item->parents;
 
@@ -660,6 +831,100 @@ static int fill_commit_in_graph(struct repository *r,
 	return 1;
 }
 
+/*
+ * Find the layer of the chain 'g' that holds the commit at (global)
+ * position 'pos', and return its commit data in that layer.
+ */
+static const unsigned char *graph_commit_data(struct commit_graph **g,
+					      uint32_t pos,
+					      uint32_t *lex_index)
+{
+	while (*g && pos < (*g)->num_commits_in_base)
+		*g = (*g)->base_graph;
+
+	if (!*g || pos >= (*g)->num_commits + (*g)->num_commits_in_base)
+		die(_("invalid commit position. commit-graph is likely corrupt"));
+
+	*lex_index = pos - (*g)->num_commits_in_base;
+	return (*g)->chunk_commit_data + GRAPH_DATA_WIDTH * *lex_index;
+}
+
+timestamp_t commit_graph_generation_at(struct commit_graph *g, uint32_t pos)
+{
+	uint32_t lex_index;
+	const unsigned char *commit_data = graph_commit_data(&g, pos, &lex_index);
+
+	return read_generation(g, lex_index, commit_data);
+}
+
+int commit_graph_commit_date(struct repository *r,
+			     const struct object_id *oid,
+			     timestamp_t *date)
+{
+	struct commit_graph *g;
+	uint32_t lex_index;
+
+	if (!prepare_commit_graph(r))
+		return 0;
+
+	for (g = r->objects->commit_graph; g; g = g->base_graph) {
+		if (bsearch_graph(g, (struct object_id *)oid, &lex_index)) {
+			*date = read_commit_date(g, g->chunk_commit_data +
+						 GRAPH_DATA_WIDTH * lex_index);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int commit_graph_parents_at(struct commit_graph *g, uint32_t pos,
+			    uint32_t **parents, size_t *alloc)
+{
+	uint32_t lex_index, edge_value;
+	const unsigned char *commit_data = graph_commit_data(&g, pos, &lex_index);
+	const unsigned char *extra;
+	int nr = 0;
+
+	ALLOC_GROW(*parents, 2, *alloc);
+
+	edge_value = get_be32(commit_data + g->hash_len);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 0;
+	(*parents)[nr++] = edge_value;
+
+	edge_value = get_be32(commit_data + g->hash_len + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return nr;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		(*parents)[nr++] = edge_value;
+		return nr;
+	}
+
+	extra = g->chunk_extra_edges +
+		4 * (uint64_t)(edge_value & GRAPH_EDGE_LAST_MASK);
+	do {
+		edge_value = get_be32(extra);
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = edge_value & GRAPH_EDGE_LAST_MASK;
+		extra += 4;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return nr;
+}
+
+void commit_graph_oid_at(struct commit_graph *g, uint32_t pos,
+			 struct object_id *oid)
+{
+	load_oid_from_graph(g, pos, oid);
+}
+
+timestamp_t commit_graph_date_at(struct commit_graph *g, uint32_t pos)
+{
+	uint32_t lex_index;
+
+	return read_commit_date(g, graph_commit_data(&g, pos, &lex_index));
+}
+
 static int find_commit_in_graph(struct commit *item, struct commit_graph *g, uint32_t *pos)
 {
 	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH) {
@@ -703,6 +968,32 @@ int parse_commit_in_graph(struct repository *r, struct commit *item)
 	return parse_commit_in_graph_one(r, r->objects->commit_graph, item);
 }
 
+struct commit *lookup_commit_in_graph(struct repository *r,
+				      const struct object_id *oid)
+{
+	struct commit_graph *g;
+	struct commit *commit;
+	uint32_t lex_index;
+
+	if (!prepare_commit_graph(r))
+		return NULL;
+
+	for (g = r->objects->commit_graph; g; g = g->base_graph)
+		if (bsearch_graph(g, (struct object_id *)oid, &lex_index))
+			break;
+	if (!g)
+		return NULL;
+
+	commit = lookup_commit(r, oid);
+	if (!commit)
+		return NULL;
+	if (!commit->object.parsed &&
+	    !fill_commit_in_graph(r, commit, r->objects->commit_graph,
+				  lex_index + g->num_commits_in_base))
+		return NULL;
+	return commit;
+}
+
 void load_commit_graph_info(struct repository *r, struct commit *item)
 {
 	uint32_t pos;
@@ -712,6 +1003,61 @@ void load_commit_graph_info(struct repository *r, struct commit *item)
 		fill_commit_graph_info(item, r->objects->commit_graph, pos);
 }
 
+int load_bloom_filter_from_graph(struct repository *r,
+				 struct commit *c,
+				 struct bloom_filter *filter)
+{
+	struct commit_graph *g;
+	uint32_t pos, lex_pos, start_index, end_index;
+
+	if (!prepare_commit_graph(r))
+		return 0;
+
+	g = r->objects->commit_graph;
+	if (!find_commit_in_graph(c, g, &pos))
+		return 0;
+
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	/* The graph layer that commit 'c' lives in carries no filters. */
+	if (!g->chunk_bloom_indexes)
+		return 0;
+
+	lex_pos = pos - g->num_commits_in_base;
+	end_index = get_be32(g->chunk_bloom_indexes + 4 * lex_pos);
+	if (lex_pos > 0)
+		start_index = get_be32(g->chunk_bloom_indexes + 4 * (lex_pos - 1));
+	else
+		start_index = 0;
+
+	if (end_index < start_index ||
+	    BLOOMDATA_CHUNK_HEADER_SIZE + end_index > g->bloom_data_len) {
+		warning(_("commit-graph has invalid Bloom filter offsets for commit %s"),
+			oid_to_hex(&c->object.oid));
+		return 0;
+	}
+
+	filter->len = end_index - start_index;
+	filter->data = (unsigned char *)(g->chunk_bloom_data +
+					 BLOOMDATA_CHUNK_HEADER_SIZE +
+					 start_index);
+	return 1;
+}
+
+struct bloom_filter_settings *get_bloom_filter_settings(struct repository *r)
+{
+	struct commit_graph *g;
+
+	if (!prepare_commit_graph(r))
+		return NULL;
+
+	for (g = r->objects->commit_graph; g; g = g->base_graph)
+		if (g->bloom_filter_settings)
+			return g->bloom_filter_settings;
+	return NULL;
+}
+
 static struct tree *load_tree_for_commit(struct repository *r,
 					 struct commit_graph *g,
 					 struct commit *c)
@@ -781,12 +1127,20 @@ struct write_commit_graph_context {
 	uint32_t new_num_commits_in_base;
 	struct commit_graph *new_base_graph;
 
+	int nr_threads;
+
 	unsigned append:1,
 		 report_progress:1,
 		 split:1,
-		 check_oids:1;
+		 check_oids:1,
+		 changed_paths:1,
+		 write_generation_data:1;
+
+	struct topo_level_slab *topo_levels;
+	int num_generation_data_overflows;
 
 	const struct split_commit_graph_opts *split_opts;
+	size_t total_bloom_filter_data_size;
 };
 
 static void write_graph_chunk_fanout(struct hashfile *f,
@@ -917,7 +1271,7 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		else
 			packedDate[0] = 0;
 
-		packedDate[0] |= htonl((*list)->generation << 2);
+		packedDate[0] |= htonl(*topo_level_slab_at(ctx->topo_levels, *list) << 2);
 
 		packedDate[1] = htonl((*list)->date);
 		hashwrite(f, packedDate, 8);
@@ -926,6 +1280,44 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 	}
 }
 
+static void write_graph_chunk_generation_data(struct hashfile *f,
+					      struct write_commit_graph_context *ctx)
+{
+	int i, num_generation_data_overflows = 0;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset = c->generation - c->date;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			offset = CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW | num_generation_data_overflows;
+			num_generation_data_overflows++;
+		}
+
+		hashwrite_be32(f, offset);
+	}
+}
+
+static void write_graph_chunk_generation_data_overflow(struct hashfile *f,
+						       struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset = c->generation - c->date;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			hashwrite_be32(f, offset >> 32);
+			hashwrite_be32(f, (uint32_t)offset);
+		}
+	}
+}
+
 static void write_graph_chunk_extra_edges(struct hashfile *f,
 					  struct write_commit_graph_context *ctx)
 {
@@ -978,6 +1370,46 @@ static void write_graph_chunk_extra_edges(struct hashfile *f,
 	}
 }
 
+static void write_graph_chunk_bloom_indexes(struct hashfile *f,
+					    struct write_commit_graph_context *ctx)
+{
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+	uint32_t cur_pos = 0;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list, 0);
+
+		if (!filter)
+			BUG("missing Bloom filter for commit %s",
+			    oid_to_hex(&(*list)->object.oid));
+		cur_pos += filter->len;
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct hashfile *f,
+					 struct write_commit_graph_context *ctx,
+					 const struct bloom_filter_settings *settings)
+{
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+
+	hashwrite_be32(f, settings->hash_version);
+	hashwrite_be32(f, settings->num_hashes);
+	hashwrite_be32(f, settings->bits_per_entry);
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list, 0);
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite(f, filter->data, filter->len * sizeof(unsigned char));
+		list++;
+	}
+}
+
 static int oid_compare(const void *_a, const void *_b)
 {
 	const struct object_id *a = (const struct object_id *)_a;
@@ -985,6 +1417,11 @@ static int oid_compare(const void *_a, const void *_b)
 	return oidcmp(a, b);
 }
 
+static const unsigned char *oid_hash(const void *oid)
+{
+	return ((const struct object_id *)oid)->hash;
+}
+
 static int add_packed_commits(const struct object_id *oid,
 			      struct packed_git *pack,
 			      uint32_t pos,
@@ -1012,6 +1449,231 @@ static int add_packed_commits(const struct object_id *oid,
 	return 0;
 }
 
+/*
+ * Sort the object names in several threads: each sorts a slice, and
+ * the slices are then merged pairwise.
+ */
+struct sort_oids_thread {
+	pthread_t thread;
+	struct object_id *list;
+	size_t nr;
+};
+
+static void *sort_oids_slice(void *data)
+{
+	struct sort_oids_thread *t = data;
+
+	RADIX_SORT_BY_HASH(t->list, t->nr, oid_hash, oid_compare);
+	return NULL;
+}
+
+static void merge_oids(struct object_id *dst,
+		       const struct object_id *a, size_t a_nr,
+		       const struct object_id *b, size_t b_nr)
+{
+	while (a_nr && b_nr) {
+		if (oidcmp(b, a) < 0) {
+			oidcpy(dst++, b++);
+			b_nr--;
+		} else {
+			oidcpy(dst++, a++);
+			a_nr--;
+		}
+	}
+	COPY_ARRAY(dst, a, a_nr);
+	COPY_ARRAY(dst + a_nr, b, b_nr);
+}
+
+static void sort_oids(struct write_commit_graph_context *ctx)
+{
+	struct object_id *list = ctx->oids.list, *tmp;
+	size_t nr = ctx->oids.nr, slice;
+	struct sort_oids_thread *threads;
+	int nr_threads = ctx->nr_threads, i, width;
+
+	if (!HAVE_THREADS || nr_threads < 2 || nr < 1024 * nr_threads) {
+		RADIX_SORT_BY_HASH(list, nr, oid_hash, oid_compare);
+		return;
+	}
+
+	slice = DIV_ROUND_UP(nr, nr_threads);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		size_t start = st_mult(slice, i);
+
+		threads[i].list = list + start;
+		threads[i].nr = nr - start < slice ? nr - start : slice;
+		if (i && pthread_create(&threads[i].thread, NULL,
+					sort_oids_slice, &threads[i]))
+			die(_("unable to create thread"));
+	}
+	sort_oids_slice(&threads[0]);
+	for (i = 1; i < nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	ALLOC_ARRAY(tmp, nr);
+	for (width = 1; width < nr_threads; width *= 2) {
+		for (i = 0; i < nr_threads; i += 2 * width) {
+			struct sort_oids_thread *a = &threads[i];
+			struct sort_oids_thread *b;
+			struct object_id *dst = tmp + (a->list - list);
+
+			if (i + width >= nr_threads) {
+				COPY_ARRAY(dst, a->list, a->nr);
+				a->list = dst;
+				continue;
+			}
+			b = &threads[i + width];
+			merge_oids(dst, a->list, a->nr, b->list, b->nr);
+			a->list = dst;
+			a->nr += b->nr;
+		}
+		SWAP(list, tmp);
+	}
+	if (list != ctx->oids.list) {
+		COPY_ARRAY(ctx->oids.list, list, nr);
+		tmp = list;
+	}
+	free(tmp);
+	free(threads);
+}
+
+/*
+ * Reading and inflating the commits is most of the work of writing a
+ * graph from scratch. So, when there are enough of them, the commits
+ * about to be parsed are read ahead by several threads, in batches of
+ * this many, and parsed from what they read.
+ */
+#define READ_COMMITS_BATCH 4096
+#define READ_COMMITS_MIN 64
+
+struct read_commit {
+	struct commit *commit;
+	void *buffer;
+	unsigned long size;
+	enum object_type type;
+};
+
+struct read_commits_thread {
+	pthread_t thread;
+	struct repository *r;
+	struct read_commit *todo;
+	int nr, start, step;
+};
+
+static void *read_commits(void *data)
+{
+	struct read_commits_thread *t = data;
+	int i;
+
+	for (i = t->start; i < t->nr; i += t->step) {
+		struct read_commit *rc = &t->todo[i];
+
+		rc->buffer = repo_read_object_file(t->r, &rc->commit->object.oid,
+						   &rc->type, &rc->size);
+	}
+	return NULL;
+}
+
+/*
+ * Read the commits of "todo" with up to "nr_threads" threads. When
+ * there are too few of them for that to be worth it, nothing is read
+ * and the buffers are left NULL.
+ */
+static void read_commit_buffers(struct repository *r, struct read_commit *todo,
+				int nr, int nr_threads)
+{
+	struct read_commits_thread *threads;
+	int own_lock = 0, i;
+
+	if (!HAVE_THREADS || nr_threads < 2 || nr < READ_COMMITS_MIN)
+		return;
+
+	if (!obj_read_use_lock) {
+		enable_obj_read_lock();
+		own_lock = 1;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].r = r;
+		threads[i].todo = todo;
+		threads[i].nr = nr;
+		threads[i].start = i;
+		threads[i].step = nr_threads;
+		if (i && pthread_create(&threads[i].thread, NULL,
+					read_commits, &threads[i]))
+			die(_("unable to create thread"));
+	}
+	read_commits(&threads[0]);
+	for (i = 1; i < nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	free(threads);
+	if (own_lock)
+		disable_obj_read_lock();
+}
+
+/*
+ * Parse "rc->commit" from what read_commit_buffers() read, the same way
+ * parse_commit_no_graph() does after reading it. Return 1 if nothing
+ * usable was read, so that the caller can read it again and complain
+ * the usual way, and the result of parse_commit_buffer() otherwise.
+ */
+static int parse_read_commit(struct repository *r, struct read_commit *rc)
+{
+	int ret = 1;
+
+	if (rc->buffer && rc->type == OBJ_COMMIT) {
+		ret = parse_commit_buffer(r, rc->commit, rc->buffer,
+					  rc->size, 0);
+		if (!ret && save_commit_buffer) {
+			set_commit_buffer(r, rc->commit, rc->buffer, rc->size);
+			rc->buffer = NULL;
+		}
+	}
+	FREE_AND_NULL(rc->buffer);
+	return ret;
+}
+
+/*
+ * Parse the commits of ctx->oids from "start" on, up to a batch, that
+ * close_reachable() would read, and return where the batch ends. The
+ * commits that cannot be read are left for it to complain about.
+ */
+static int read_commits_ahead(struct write_commit_graph_context *ctx,
+			      int start)
+{
+	struct read_commit *todo;
+	int end = start + READ_COMMITS_BATCH;
+	int nr = 0, i;
+
+	if (end > ctx->oids.nr)
+		end = ctx->oids.nr;
+	if (!HAVE_THREADS || ctx->nr_threads < 2 ||
+	    end - start < READ_COMMITS_MIN)
+		return end;
+
+	ALLOC_ARRAY(todo, end - start);
+	for (i = start; i < end; i++) {
+		struct commit *c = lookup_commit(ctx->r, &ctx->oids.list[i]);
+		uint32_t pos;
+
+		if (!c || c->object.parsed ||
+		    (ctx->split &&
+		     find_commit_in_graph(c, ctx->r->objects->commit_graph, &pos)))
+			continue;
+		memset(&todo[nr], 0, sizeof(*todo));
+		todo[nr++].commit = c;
+	}
+
+	read_commit_buffers(ctx->r, todo, nr, ctx->nr_threads);
+	for (i = 0; i < nr; i++)
+		parse_read_commit(ctx->r, &todo[i]);
+	free(todo);
+	return end;
+}
+
 static void add_missing_parents(struct write_commit_graph_context *ctx, struct commit *commit)
 {
 	struct commit_list *parent;
@@ -1027,7 +1689,7 @@ static void add_missing_parents(struct write_commit_graph_context *ctx, struct c
 
 static void close_reachable(struct write_commit_graph_context *ctx)
 {
-	int i;
+	int i, read_end = 0;
 	struct commit *commit;
 
 	if (ctx->report_progress)
@@ -1053,6 +1715,8 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 					ctx->oids.nr);
 	for (i = 0; i < ctx->oids.nr; i++) {
 		display_progress(ctx->progress, i + 1);
+		if (i == read_end)
+			read_end = read_commits_ahead(ctx, i);
 		commit = lookup_commit(ctx->r, &ctx->oids.list[i]);
 
 		if (!commit)
@@ -1080,6 +1744,82 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 	stop_progress(&ctx->progress);
 }
 
+static uint32_t get_topo_level(struct write_commit_graph_context *ctx,
+			       struct commit *c)
+{
+	uint32_t *level = topo_level_slab_at(ctx->topo_levels, c);
+
+	/*
+	 * A commit that was parsed from the commit-graph before we
+	 * started recording topological levels is re-read here, which
+	 * fills in its level as a side effect.
+	 */
+	if (*level == GENERATION_NUMBER_ZERO &&
+	    c->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		load_commit_graph_info(ctx->r, c);
+
+	return *level;
+}
+
+static void compute_topological_levels(struct write_commit_graph_context *ctx)
+{
+	int i;
+	struct commit_list *list = NULL;
+
+	/*
+	 * Without corrected commit dates, the topological levels are the
+	 * generation numbers that get written.
+	 */
+	if (ctx->report_progress)
+		ctx->progress = start_progress(
+					ctx->write_generation_data ?
+					_("Computing commit graph topological levels") :
+					_("Computing commit graph generation numbers"),
+					ctx->commits.nr);
+	for (i = 0; i < ctx->commits.nr; i++) {
+		display_progress(ctx->progress, i + 1);
+		if (get_topo_level(ctx, ctx->commits.list[i]) != GENERATION_NUMBER_ZERO)
+			continue;
+
+		commit_list_insert(ctx->commits.list[i], &list);
+		while (list) {
+			struct commit *current = list->item;
+			struct commit_list *parent;
+			int all_parents_computed = 1;
+			uint32_t max_level = 0;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				uint32_t level = get_topo_level(ctx, parent->item);
+
+				if (level == GENERATION_NUMBER_ZERO) {
+					all_parents_computed = 0;
+					commit_list_insert(parent->item, &list);
+					break;
+				} else if (level > max_level) {
+					max_level = level;
+				}
+			}
+
+			if (all_parents_computed) {
+				pop_commit(&list);
+
+				if (max_level > GENERATION_NUMBER_V1_MAX - 1)
+					max_level = GENERATION_NUMBER_V1_MAX - 1;
+				*topo_level_slab_at(ctx->topo_levels, current) = max_level + 1;
+			}
+		}
+	}
+	stop_progress(&ctx->progress);
+
+	if (ctx->write_generation_data)
+		return;
+
+	/* Without generation data, the topological level is the generation. */
+	for (i = 0; i < ctx->commits.nr; i++)
+		ctx->commits.list[i]->generation =
+			*topo_level_slab_at(ctx->topo_levels, ctx->commits.list[i]);
+}
+
 static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
@@ -1089,10 +1829,14 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 		ctx->progress = start_progress(
 					_("Computing commit graph generation numbers"),
 					ctx->commits.nr);
+
+	/* Recompute the corrected commit date of every commit we write. */
+	for (i = 0; i < ctx->commits.nr; i++)
+		ctx->commits.list[i]->generation = GENERATION_NUMBER_ZERO;
+
 	for (i = 0; i < ctx->commits.nr; i++) {
 		display_progress(ctx->progress, i + 1);
-		if (ctx->commits.list[i]->generation != GENERATION_NUMBER_INFINITY &&
-		    ctx->commits.list[i]->generation != GENERATION_NUMBER_ZERO)
+		if (ctx->commits.list[i]->generation != GENERATION_NUMBER_ZERO)
 			continue;
 
 		commit_list_insert(ctx->commits.list[i], &list);
@@ -1100,7 +1844,7 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 			struct commit *current = list->item;
 			struct commit_list *parent;
 			int all_parents_computed = 1;
-			uint32_t max_generation = 0;
+			timestamp_t max_corrected_commit_date = 0;
 
 			for (parent = current->parents; parent; parent = parent->next) {
 				if (parent->item->generation == GENERATION_NUMBER_INFINITY ||
@@ -1108,23 +1852,48 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 					all_parents_computed = 0;
 					commit_list_insert(parent->item, &list);
 					break;
-				} else if (parent->item->generation > max_generation) {
-					max_generation = parent->item->generation;
+				} else if (parent->item->generation > max_corrected_commit_date) {
+					max_corrected_commit_date = parent->item->generation;
 				}
 			}
 
 			if (all_parents_computed) {
-				current->generation = max_generation + 1;
 				pop_commit(&list);
 
-				if (current->generation > GENERATION_NUMBER_MAX)
-					current->generation = GENERATION_NUMBER_MAX;
+				if (current->date && current->date > max_corrected_commit_date)
+					max_corrected_commit_date = current->date - 1;
+				current->generation = max_corrected_commit_date + 1;
+
+				if (current->generation - current->date > GENERATION_NUMBER_V2_OFFSET_MAX)
+					ctx->num_generation_data_overflows++;
 			}
 		}
 	}
 	stop_progress(&ctx->progress);
 }
 
+static void compute_bloom_filters(struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	init_bloom_filters();
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+			_("Computing commit changed paths Bloom filters"),
+			ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, c, 1);
+
+		ctx->total_bloom_filter_data_size += filter->len * sizeof(unsigned char);
+		display_progress(ctx->progress, i + 1);
+	}
+
+	stop_progress(&ctx->progress);
+}
+
 static int add_ref_to_list(const char *refname,
 			   const struct object_id *oid,
 			   int flags, void *cb_data)
@@ -1195,6 +1964,22 @@ static int fill_oids_from_packs(struct write_commit_graph_context *ctx,
 	return 0;
 }
 
+/*
+ * Like lookup_commit_reference_gently(), but when writing a split graph,
+ * take the commits the layers already there have from them instead of
+ * reading and parsing them again; they only need to still exist.
+ * Other writes do not trust the graph they may be replacing.
+ */
+static struct commit *lookup_commit_to_write(struct write_commit_graph_context *ctx,
+					     const struct object_id *oid)
+{
+	struct commit *c = NULL;
+
+	if (ctx->split && repo_has_object_file(ctx->r, oid))
+		c = lookup_commit_in_graph(ctx->r, oid);
+	return c ? c : lookup_commit_reference_gently(ctx->r, oid, 1);
+}
+
 static int fill_oids_from_commit_hex(struct write_commit_graph_context *ctx,
 				     struct string_list *commit_hex)
 {
@@ -1218,7 +2003,7 @@ static int fill_oids_from_commit_hex(struct write_commit_graph_context *ctx,
 
 		display_progress(ctx->progress, i + 1);
 		if (!parse_oid_hex(commit_hex->items[i].string, &oid, &end) &&
-		    (result = lookup_commit_reference_gently(ctx->r, &oid, 1))) {
+		    (result = lookup_commit_to_write(ctx, &oid))) {
 			ALLOC_GROW(ctx->oids.list, ctx->oids.nr + 1, ctx->oids.alloc);
 			oidcpy(&ctx->oids.list[ctx->oids.nr], &(result->object.oid));
 			ctx->oids.nr++;
@@ -1256,7 +2041,7 @@ static uint32_t count_distinct_commits(struct write_commit_graph_context *ctx)
 			_("Counting distinct commits in commit graph"),
 			ctx->oids.nr);
 	display_progress(ctx->progress, 0); /* TODO: Measure QSORT() progress */
-	QSORT(ctx->oids.list, ctx->oids.nr, oid_compare);
+	sort_oids(ctx);
 
 	for (i = 1; i < ctx->oids.nr; i++) {
 		display_progress(ctx->progress, i + 1);
@@ -1345,12 +2130,13 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	int fd;
 	struct hashfile *f;
 	struct lock_file lk = LOCK_INIT;
-	uint32_t chunk_ids[6];
-	uint64_t chunk_offsets[6];
+	uint32_t chunk_ids[MAX_NUM_CHUNKS + 1];
+	uint64_t chunk_offsets[MAX_NUM_CHUNKS + 1];
 	const unsigned hashsz = the_hash_algo->rawsz;
 	struct strbuf progress_title = STRBUF_INIT;
 	int num_chunks = 3;
 	struct object_id file_hash;
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
 
 	if (ctx->split) {
 		struct strbuf tmp_file = STRBUF_INIT;
@@ -1395,6 +2181,20 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 		chunk_ids[num_chunks] = GRAPH_CHUNKID_EXTRAEDGES;
 		num_chunks++;
 	}
+	if (ctx->write_generation_data) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA;
+		num_chunks++;
+	}
+	if (ctx->num_generation_data_overflows) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW;
+		num_chunks++;
+	}
+	if (ctx->changed_paths) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMINDEXES;
+		num_chunks++;
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMDATA;
+		num_chunks++;
+	}
 	if (ctx->num_commit_graphs_after > 1) {
 		chunk_ids[num_chunks] = GRAPH_CHUNKID_BASE;
 		num_chunks++;
@@ -1413,6 +2213,26 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 						4 * ctx->num_extra_edges;
 		num_chunks++;
 	}
+	if (ctx->write_generation_data) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint32_t) * ctx->commits.nr;
+		num_chunks++;
+	}
+	if (ctx->num_generation_data_overflows) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(timestamp_t) * ctx->num_generation_data_overflows;
+		num_chunks++;
+	}
+	if (ctx->changed_paths) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint32_t) * ctx->commits.nr;
+		num_chunks++;
+
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						BLOOMDATA_CHUNK_HEADER_SIZE +
+						ctx->total_bloom_filter_data_size;
+		num_chunks++;
+	}
 	if (ctx->num_commit_graphs_after > 1) {
 		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
 						hashsz * (ctx->num_commit_graphs_after - 1);
@@ -1450,6 +2270,14 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	write_graph_chunk_data(f, hashsz, ctx);
 	if (ctx->num_extra_edges)
 		write_graph_chunk_extra_edges(f, ctx);
+	if (ctx->write_generation_data)
+		write_graph_chunk_generation_data(f, ctx);
+	if (ctx->num_generation_data_overflows)
+		write_graph_chunk_generation_data_overflow(f, ctx);
+	if (ctx->changed_paths) {
+		write_graph_chunk_bloom_indexes(f, ctx);
+		write_graph_chunk_bloom_data(f, ctx, &bloom_settings);
+	}
 	if (ctx->num_commit_graphs_after > 1 &&
 	    write_graph_chunk_base(f, ctx)) {
 		return -1;
@@ -1598,7 +2426,7 @@ static void merge_commit_graph(struct write_commit_graph_context *ctx,
 		load_oid_from_graph(g, i + offset, &oid);
 
 		/* only add commits if they still exist in the repo */
-		result = lookup_commit_reference_gently(ctx->r, &oid, 1);
+		result = lookup_commit_to_write(ctx, &oid);
 
 		if (result) {
 			ctx->commits.list[ctx->commits.nr] = result;
@@ -1762,6 +2590,8 @@ int write_commit_graph(const char *obj_dir,
 	uint32_t i, count_distinct = 0;
 	size_t len;
 	int res = 0;
+	struct commit_graph *g;
+	struct topo_level_slab topo_levels;
 
 	if (!commit_graph_compatible(the_repository))
 		return 0;
@@ -1780,10 +2610,19 @@ int write_commit_graph(const char *obj_dir,
 	ctx->report_progress = flags & COMMIT_GRAPH_WRITE_PROGRESS ? 1 : 0;
 	ctx->split = flags & COMMIT_GRAPH_WRITE_SPLIT ? 1 : 0;
 	ctx->check_oids = flags & COMMIT_GRAPH_WRITE_CHECK_OIDS ? 1 : 0;
+	ctx->changed_paths = flags & COMMIT_GRAPH_WRITE_BLOOM_FILTERS ? 1 : 0;
+	ctx->write_generation_data = (get_configured_generation_version(ctx->r) >= 2);
+	ctx->num_generation_data_overflows = 0;
+	if (repo_config_get_int(ctx->r, "commitgraph.writethreads",
+				&ctx->nr_threads) ||
+	    ctx->nr_threads < 1)
+		ctx->nr_threads = online_cpus();
+
+	init_topo_level_slab(&topo_levels);
+	ctx->topo_levels = &topo_levels;
 	ctx->split_opts = split_opts;
 
 	if (ctx->split) {
-		struct commit_graph *g;
 		prepare_commit_graph(ctx->r);
 
 		g = ctx->r->objects->commit_graph;
@@ -1870,10 +2709,31 @@ int write_commit_graph(const char *obj_dir,
 		split_graph_merge_strategy(ctx);
 
 		merge_commit_graphs(ctx);
+
+		/*
+		 * Generation data is only usable when every layer of the
+		 * chain has it, so do not start writing it on top of
+		 * layers that we are keeping and that lack it.
+		 */
+		for (g = ctx->new_base_graph; g; g = g->base_graph)
+			if (!g->chunk_generation_data)
+				ctx->write_generation_data = 0;
 	} else
 		ctx->num_commit_graphs_after = 1;
 
-	compute_generation_numbers(ctx);
+	/*
+	 * Any commit-graph loaded by now records the topological levels
+	 * of the commits it parses, so that they need not be recomputed.
+	 */
+	for (g = ctx->r->objects->commit_graph; g; g = g->base_graph)
+		g->topo_levels = &topo_levels;
+
+	compute_topological_levels(ctx);
+	if (ctx->write_generation_data)
+		compute_generation_numbers(ctx);
+
+	if (ctx->changed_paths)
+		compute_bloom_filters(ctx);
 
 	res = write_commit_graph_file(ctx);
 
@@ -1883,6 +2743,10 @@ int write_commit_graph(const char *obj_dir,
 	expire_commit_graphs(ctx);
 
 cleanup:
+	for (g = ctx->r->objects->commit_graph; g; g = g->base_graph)
+		g->topo_levels = NULL;
+	clear_topo_level_slab(&topo_levels);
+
 	free(ctx->graph_name);
 	free(ctx->commits.list);
 	free(ctx->oids.list);
@@ -1921,18 +2785,50 @@ static void graph_report(const char *fmt, ...)
 	va_end(ap);
 }
 
+static int commit_graph_checksum_matches(struct commit_graph *g)
+{
+	struct object_id checksum;
+	struct hashfile *f;
+	int devnull;
+
+	devnull = open("/dev/null", O_WRONLY);
+	f = hashfd(devnull, NULL);
+	hashwrite(f, g->data, g->data_len - g->hash_len);
+	finalize_hashfile(f, checksum.hash, CSUM_CLOSE);
+	return hasheq(checksum.hash, g->data + g->data_len - g->hash_len);
+}
+
+int verify_commit_graph_checksums(struct repository *r)
+{
+	struct commit_graph *g;
+
+	if (!prepare_commit_graph(r))
+		return 0;
+
+	for (g = r->objects->commit_graph; g; g = g->base_graph) {
+		if (!commit_graph_checksum_matches(g)) {
+			error(_("commit-graph file %s has incorrect checksum"),
+			      g->filename);
+			close_commit_graph(r->objects);
+			return -1;
+		}
+	}
+	return 1;
+}
+
 #define GENERATION_ZERO_EXISTS 1
 #define GENERATION_NUMBER_EXISTS 2
 
-int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
+int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags,
+			int nr_threads)
 {
 	uint32_t i, cur_fanout_pos = 0;
-	struct object_id prev_oid, cur_oid, checksum;
+	struct object_id prev_oid, cur_oid;
 	int generation_zero = 0;
-	struct hashfile *f;
-	int devnull;
 	struct progress *progress = NULL;
 	int local_error = 0;
+	struct read_commit *todo;
+	struct commit **graph_commits;
 
 	if (!g) {
 		graph_report("no commit-graph file loaded");
@@ -1943,11 +2839,7 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	if (verify_commit_graph_error)
 		return verify_commit_graph_error;
 
-	devnull = open("/dev/null", O_WRONLY);
-	f = hashfd(devnull, NULL);
-	hashwrite(f, g->data, g->data_len - g->hash_len);
-	finalize_hashfile(f, checksum.hash, CSUM_CLOSE);
-	if (!hasheq(checksum.hash, g->data + g->data_len - g->hash_len)) {
+	if (!commit_graph_checksum_matches(g)) {
 		graph_report(_("the commit-graph file has incorrect checksum and is likely corrupt"));
 		verify_commit_graph_error = VERIFY_COMMIT_GRAPH_ERROR_HASH;
 	}
@@ -1992,19 +2884,47 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	if (verify_commit_graph_error & ~VERIFY_COMMIT_GRAPH_ERROR_HASH)
 		return verify_commit_graph_error;
 
+	/*
+	 * The commits are read from the object database by several
+	 * threads, a batch at a time, and compared in order.
+	 */
+	ALLOC_ARRAY(todo, READ_COMMITS_BATCH);
+	ALLOC_ARRAY(graph_commits, READ_COMMITS_BATCH);
 	progress = start_progress(_("Verifying commits in commit graph"),
 				  g->num_commits);
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
-		uint32_t max_generation = 0;
+		timestamp_t max_generation = 0;
+		struct read_commit *rc = &todo[i % READ_COMMITS_BATCH];
+		int ret;
 
 		display_progress(progress, i + 1);
 		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
 
-		graph_commit = lookup_commit(r, &cur_oid);
-		odb_commit = (struct commit *)create_object(r, &cur_oid, alloc_commit_node(r));
-		if (parse_commit_internal(odb_commit, 0, 0)) {
+		if (!(i % READ_COMMITS_BATCH)) {
+			uint32_t j, nr = g->num_commits - i;
+			struct object_id oid;
+
+			if (nr > READ_COMMITS_BATCH)
+				nr = READ_COMMITS_BATCH;
+			for (j = 0; j < nr; j++) {
+				hashcpy(oid.hash, g->chunk_oid_lookup +
+						  g->hash_len * (i + j));
+				graph_commits[j] = lookup_commit(r, &oid);
+				memset(&todo[j], 0, sizeof(*todo));
+				todo[j].commit = (struct commit *)
+					create_object(r, &oid, alloc_commit_node(r));
+			}
+			read_commit_buffers(r, todo, nr, nr_threads);
+		}
+
+		graph_commit = graph_commits[i % READ_COMMITS_BATCH];
+		odb_commit = rc->commit;
+		ret = parse_read_commit(r, rc);
+		if (ret > 0)
+			ret = parse_commit_internal(odb_commit, 0, 0);
+		if (ret) {
 			graph_report(_("failed to parse commit %s from object database for commit-graph"),
 				     oid_to_hex(&cur_oid));
 			continue;
@@ -2059,16 +2979,26 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 		if (generation_zero == GENERATION_ZERO_EXISTS)
 			continue;
 
-		/*
-		 * If one of our parents has generation GENERATION_NUMBER_MAX, then
-		 * our generation is also GENERATION_NUMBER_MAX. Decrement to avoid
-		 * extra logic in the following condition.
-		 */
-		if (max_generation == GENERATION_NUMBER_MAX)
+		if (g->read_generation_data) {
+			/*
+			 * A corrected commit date is the larger of the
+			 * commit date and one more than the largest
+			 * corrected commit date of its parents.
+			 */
+			if (odb_commit->date > max_generation)
+				max_generation = odb_commit->date - 1;
+		} else if (max_generation == GENERATION_NUMBER_V1_MAX) {
+			/*
+			 * If one of our parents has generation
+			 * GENERATION_NUMBER_V1_MAX, then our generation is
+			 * also GENERATION_NUMBER_V1_MAX. Decrement to avoid
+			 * extra logic in the following condition.
+			 */
 			max_generation--;
+		}
 
 		if (graph_commit->generation != max_generation + 1)
-			graph_report(_("commit-graph generation for commit %s is %u != %u"),
+			graph_report(_("commit-graph generation for commit %s is %"PRItime" != %"PRItime),
 				     oid_to_hex(&cur_oid),
 				     graph_commit->generation,
 				     max_generation + 1);
@@ -2080,11 +3010,14 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 				     odb_commit->date);
 	}
 	stop_progress(&progress);
+	free(todo);
+	free(graph_commits);
 
 	local_error = verify_commit_graph_error;
 
 	if (!(flags & COMMIT_GRAPH_VERIFY_SHALLOW) && g->base_graph)
-		local_error |= verify_commit_graph(r, g->base_graph, flags);
+		local_error |= verify_commit_graph(r, g->base_graph, flags,
+						   nr_threads);
 
 	return local_error;
 }
@@ -2099,5 +3032,6 @@ void free_commit_graph(struct commit_graph *g)
 		close(g->graph_fd);
 	}
 	free(g->filename);
+	free(g->bloom_filter_settings);
 	free(g);
 }
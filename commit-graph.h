@@ -8,8 +8,11 @@
 
 #define GIT_TEST_COMMIT_GRAPH "GIT_TEST_COMMIT_GRAPH"
 #define GIT_TEST_COMMIT_GRAPH_DIE_ON_LOAD "GIT_TEST_COMMIT_GRAPH_DIE_ON_LOAD"
+#define GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS "GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS"
 
 struct commit;
+struct bloom_filter;
+struct bloom_filter_settings;
 
 char *get_commit_graph_filename(const char *obj_dir);
 int open_commit_graph(const char *graph_file, int *fd, struct stat *st);
@@ -26,6 +29,16 @@ int open_commit_graph(const char *graph_file, int *fd, struct stat *st);
  */
 int parse_commit_in_graph(struct repository *r, struct commit *item);
 
+/*
+ * If "oid" is a commit in the commit-graph of "r", return it, parsed
+ * from the graph. Unlike lookup_commit() followed by parse_commit(),
+ * this does not need to find out the type of "oid" from the object
+ * store first, and reads nothing from it; whether the object is
+ * still there is up to the caller. Return NULL otherwise.
+ */
+struct commit *lookup_commit_in_graph(struct repository *r,
+				      const struct object_id *oid);
+
 /*
  * It is possible that we loaded commit contents from the commit buffer,
  * but we also want to ensure the commit-graph content is correctly
@@ -37,6 +50,23 @@ void load_commit_graph_info(struct repository *r, struct commit *item);
 struct tree *get_commit_tree_in_graph(struct repository *r,
 				      const struct commit *c);
 
+/*
+ * Point 'filter' at the changed-path Bloom filter of commit 'c' as
+ * stored in the commit-graph. Returns 1 if and only if the graph layer
+ * containing 'c' carries Bloom filters.
+ */
+int load_bloom_filter_from_graph(struct repository *r,
+				 struct commit *c,
+				 struct bloom_filter *filter);
+
+/*
+ * Return the Bloom filter settings of the commit-graph, or NULL if no
+ * layer of it has changed-path Bloom filters.
+ */
+struct bloom_filter_settings *get_bloom_filter_settings(struct repository *r);
+
+struct topo_level_slab;
+
 struct commit_graph {
 	int graph_fd;
 
@@ -56,8 +86,28 @@ struct commit_graph {
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_generation_data;
+	const unsigned char *chunk_generation_data_overflow;
+	size_t generation_data_overflow_len;
 	const unsigned char *chunk_extra_edges;
 	const unsigned char *chunk_base_graphs;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t bloom_data_len;
+
+	struct bloom_filter_settings *bloom_filter_settings;
+
+	/*
+	 * Set when this layer (and every layer below it) stores corrected
+	 * commit dates and the repository is configured to use them.
+	 */
+	int read_generation_data;
+
+	/*
+	 * When non-NULL, topological levels read from this layer are
+	 * recorded here; used while writing a new layer on top of it.
+	 */
+	struct topo_level_slab *topo_levels;
 };
 
 struct commit_graph *load_commit_graph_one_fd_st(int fd, struct stat *st);
@@ -71,12 +121,42 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
  */
 int generation_numbers_enabled(struct repository *r);
 
+/*
+ * Topology-only access to the commit-graph chain 'g', by the positions
+ * found in "commit->graph_pos". These let a walk that only cares about
+ * the shape of the history go from a commit to its parents without a
+ * "struct commit" or "commit_list" nodes for what it visits.
+ *
+ * commit_graph_parents_at() stores the positions of the parents of the
+ * commit at 'pos' in '*parents' (grown with ALLOC_GROW as needed) and
+ * returns how many there are.
+ */
+timestamp_t commit_graph_generation_at(struct commit_graph *g, uint32_t pos);
+
+/*
+ * If "oid" is a commit in the commit-graph of "r", store its commit
+ * date in "date" and return 1. Return 0 otherwise. No object is looked
+ * up or parsed.
+ */
+int commit_graph_commit_date(struct repository *r,
+			     const struct object_id *oid,
+			     timestamp_t *date);
+int commit_graph_parents_at(struct commit_graph *g, uint32_t pos,
+			    uint32_t **parents, size_t *alloc);
+
+/* The object name and the commit date of the commit at 'pos'. */
+void commit_graph_oid_at(struct commit_graph *g, uint32_t pos,
+			 struct object_id *oid);
+timestamp_t commit_graph_date_at(struct commit_graph *g, uint32_t pos);
+
 enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_APPEND     = (1 << 0),
 	COMMIT_GRAPH_WRITE_PROGRESS   = (1 << 1),
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	/* Make sure that each OID in the input is a valid commit OID. */
-	COMMIT_GRAPH_WRITE_CHECK_OIDS = (1 << 3)
+	COMMIT_GRAPH_WRITE_CHECK_OIDS = (1 << 3),
+	/* Compute and store a changed-path Bloom filter for each commit. */
+	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 4)
 };
 
 struct split_commit_graph_opts {
@@ -102,7 +182,22 @@ int write_commit_graph(const char *obj_dir,
 
 #define COMMIT_GRAPH_VERIFY_SHALLOW	(1 << 0)
 
-int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags);
+/*
+ * Check the commit-graph "g" against the object database, reading the
+ * commits with the help of up to "nr_threads" threads.
+ */
+int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags,
+			int nr_threads);
+
+/*
+ * Check the trailing checksum of each layer of the commit-graph that
+ * "r" uses, if it uses one, without the rest of the checks of
+ * verify_commit_graph(). Return 1 if they all match and 0 if there is
+ * no commit-graph. Otherwise, report an error, stop using the
+ * commit-graph and return -1; this must happen before any commit has
+ * been parsed from it.
+ */
+int verify_commit_graph_checksums(struct repository *r);
 
 void close_commit_graph(struct raw_object_store *);
 void free_commit_graph(struct commit_graph *);
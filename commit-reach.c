@@ -8,6 +8,11 @@
 #include "revision.h"
 #include "tag.h"
 #include "commit-reach.h"
+#include "ewah/ewok.h"
+#include "object-store.h"
+#include "pack-bitmap.h"
+#include "replace-object.h"
+#include "commit-slab.h"
 
 /* Remember to update object flag allocation in object.h */
 #define REACHABLE       (1u<<15)
@@ -33,12 +38,12 @@ static int queue_has_nonstale(struct prio_queue *queue)
 static struct commit_list *paint_down_to_common(struct repository *r,
 						struct commit *one, int n,
 						struct commit **twos,
-						int min_generation)
+						timestamp_t min_generation)
 {
 	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
 	struct commit_list *result = NULL;
 	int i;
-	uint32_t last_gen = GENERATION_NUMBER_INFINITY;
+	timestamp_t last_gen = GENERATION_NUMBER_INFINITY;
 
 	if (!min_generation)
 		queue.compare = compare_commits_by_commit_date;
@@ -61,7 +66,7 @@ static struct commit_list *paint_down_to_common(struct repository *r,
 		int flags;
 
 		if (min_generation && commit->generation > last_gen)
-			BUG("bad generation skip %8x > %8x at %s",
+			BUG("bad generation skip %"PRItime" > %"PRItime" at %s",
 			    commit->generation, last_gen,
 			    oid_to_hex(&commit->object.oid));
 		last_gen = commit->generation;
@@ -177,7 +182,7 @@ static int remove_redundant(struct repository *r, struct commit **array, int cnt
 		repo_parse_commit(r, array[i]);
 	for (i = 0; i < cnt; i++) {
 		struct commit_list *common;
-		uint32_t min_generation = array[i]->generation;
+		timestamp_t min_generation = array[i]->generation;
 
 		if (redundant[i])
 			continue;
@@ -309,6 +314,67 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 	}
 }
 
+/*
+ * Answer repo_in_merge_bases_many() from the commit-graph alone, when
+ * all the commits involved are in it: walk down from the references by
+ * graph position, with the commits seen so far in a bitmap, and stop
+ * below the generation of "commit". No commit is looked up or parsed,
+ * and no flag set, on the way.
+ *
+ * Returns -1 if the commit-graph cannot answer.
+ */
+static int in_merge_bases_from_graph(struct repository *r,
+				     struct commit *commit,
+				     int nr_reference,
+				     struct commit **reference)
+{
+	struct commit_graph *g = r->objects->commit_graph;
+	uint32_t *stack, *parents = NULL;
+	size_t nr = 0, alloc, parents_alloc = 0;
+	struct bitmap *seen;
+	int i, ret = 0;
+
+	if (!g || commit->graph_pos == COMMIT_NOT_FROM_GRAPH)
+		return -1;
+	for (i = 0; i < nr_reference; i++)
+		if (reference[i]->graph_pos == COMMIT_NOT_FROM_GRAPH)
+			return -1;
+
+	alloc = nr_reference;
+	ALLOC_ARRAY(stack, alloc);
+	for (i = 0; i < nr_reference; i++)
+		stack[nr++] = reference[i]->graph_pos;
+	seen = bitmap_new();
+
+	while (nr) {
+		uint32_t pos = stack[--nr];
+		int nr_parents;
+
+		if (pos == commit->graph_pos) {
+			ret = 1;
+			break;
+		}
+		if (bitmap_get(seen, pos))
+			continue;
+		bitmap_set(seen, pos);
+
+		if (commit_graph_generation_at(g, pos) < commit->generation)
+			continue;
+
+		nr_parents = commit_graph_parents_at(g, pos, &parents,
+						     &parents_alloc);
+		ALLOC_GROW(stack, nr + nr_parents, alloc);
+		for (i = 0; i < nr_parents; i++)
+			if (!bitmap_get(seen, parents[i]))
+				stack[nr++] = parents[i];
+	}
+
+	bitmap_free(seen);
+	free(parents);
+	free(stack);
+	return ret;
+}
+
 /*
  * Is "commit" an ancestor of one of the "references"?
  */
@@ -317,7 +383,7 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 {
 	struct commit_list *bases;
 	int ret = 0, i;
-	uint32_t min_generation = GENERATION_NUMBER_INFINITY;
+	timestamp_t min_generation = GENERATION_NUMBER_INFINITY;
 
 	if (repo_parse_commit(r, commit))
 		return ret;
@@ -331,6 +397,11 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 	if (commit->generation > min_generation)
 		return ret;
 
+	ret = in_merge_bases_from_graph(r, commit, nr_reference, reference);
+	if (ret >= 0)
+		return ret;
+	ret = 0;
+
 	bases = paint_down_to_common(r, commit,
 				     nr_reference, reference,
 				     commit->generation);
@@ -451,7 +522,8 @@ static int in_commit_list(const struct commit_list *want, struct commit *c)
 static enum contains_result contains_test(struct commit *candidate,
 					  const struct commit_list *want,
 					  struct contains_cache *cache,
-					  uint32_t cutoff)
+					  struct bitmap_index *bitmap_git,
+					  timestamp_t cutoff)
 {
 	enum contains_result *cached = contains_cache_at(cache, candidate);
 
@@ -465,6 +537,21 @@ static enum contains_result contains_test(struct commit *candidate,
 		return CONTAINS_YES;
 	}
 
+	/* or does our bitmap, if we have one, know? */
+	if (bitmap_git) {
+		const struct commit_list *p;
+		int reaches = 0;
+
+		for (p = want; p && !reaches; p = p->next)
+			reaches = bitmap_commit_reaches_oid(bitmap_git,
+							    &candidate->object.oid,
+							    &p->item->object.oid);
+		if (reaches >= 0) {
+			*cached = reaches ? CONTAINS_YES : CONTAINS_NO;
+			return *cached;
+		}
+	}
+
 	/* Otherwise, we don't know; prepare to recurse */
 	parse_commit_or_die(candidate);
 
@@ -483,11 +570,12 @@ static void push_to_contains_stack(struct commit *candidate, struct contains_sta
 
 static enum contains_result contains_tag_algo(struct commit *candidate,
 					      const struct commit_list *want,
-					      struct contains_cache *cache)
+					      struct contains_cache *cache,
+					      struct bitmap_index *bitmap_git)
 {
 	struct contains_stack contains_stack = { 0, 0, NULL };
 	enum contains_result result;
-	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+	timestamp_t cutoff = GENERATION_NUMBER_INFINITY;
 	const struct commit_list *p;
 
 	for (p = want; p; p = p->next) {
@@ -497,7 +585,7 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 			cutoff = c->generation;
 	}
 
-	result = contains_test(candidate, want, cache, cutoff);
+	result = contains_test(candidate, want, cache, bitmap_git, cutoff);
 	if (result != CONTAINS_UNKNOWN)
 		return result;
 
@@ -515,7 +603,8 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		 * If we just popped the stack, parents->item has been marked,
 		 * therefore contains_test will return a meaningful yes/no.
 		 */
-		else switch (contains_test(parents->item, want, cache, cutoff)) {
+		else switch (contains_test(parents->item, want, cache, bitmap_git,
+				       cutoff)) {
 		case CONTAINS_YES:
 			*contains_cache_at(cache, commit) = CONTAINS_YES;
 			contains_stack.nr--;
@@ -529,14 +618,56 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		}
 	}
 	free(contains_stack.contains_stack);
-	return contains_test(candidate, want, cache, cutoff);
+	return contains_test(candidate, want, cache, bitmap_git, cutoff);
+}
+
+extern int read_replace_refs;
+
+/*
+ * The bitmap index that commit_contains() answers from, loaded once
+ * for all the refs that a process filters. Replace refs, grafts and
+ * shallow boundaries change the history that bitmaps were computed
+ * on, so we do not use them when the repository has any of those.
+ */
+static struct bitmap_index *contains_bitmap(struct repository *r)
+{
+	static struct bitmap_index *bitmap_git;
+	static int tried;
+
+	if (tried)
+		return bitmap_git;
+	tried = 1;
+
+	if (read_replace_refs) {
+		prepare_replace_object(r);
+		if (hashmap_get_size(&r->objects->replace_map->map))
+			return NULL;
+	}
+	prepare_commit_graft(r);
+	if ((r->parsed_objects && r->parsed_objects->grafts_nr) ||
+	    is_repository_shallow(r))
+		return NULL;
+
+	bitmap_git = prepare_bitmap_git(r);
+	return bitmap_git;
 }
 
 int commit_contains(struct ref_filter *filter, struct commit *commit,
 		    struct commit_list *list, struct contains_cache *cache)
 {
-	if (filter->with_commit_tag_algo)
-		return contains_tag_algo(commit, list, cache) == CONTAINS_YES;
+	struct bitmap_index *bitmap_git = contains_bitmap(the_repository);
+
+	/*
+	 * The tag algorithm memoizes what it learns about each commit in
+	 * "cache" across all the refs we are asked about, so that the
+	 * history they share is walked only once. Without generation
+	 * numbers or bitmaps, though, it walks down to the root commits,
+	 * where is_descendant_of() can stop earlier.
+	 */
+	if (filter->with_commit_tag_algo || bitmap_git ||
+	    generation_numbers_enabled(the_repository))
+		return contains_tag_algo(commit, list, cache,
+					 bitmap_git) == CONTAINS_YES;
 	return is_descendant_of(commit, list);
 }
 
@@ -556,7 +687,7 @@ int can_all_from_reach_with_flag(struct object_array *from,
 				 unsigned int with_flag,
 				 unsigned int assign_flag,
 				 time_t min_commit_date,
-				 uint32_t min_generation)
+				 timestamp_t min_generation)
 {
 	struct commit **list = NULL;
 	int i;
@@ -657,7 +788,7 @@ int can_all_from_reach(struct commit_list *from, struct commit_list *to,
 	time_t min_commit_date = cutoff_by_min_date ? from->item->date : 0;
 	struct commit_list *from_iter = from, *to_iter = to;
 	int result;
-	uint32_t min_generation = GENERATION_NUMBER_INFINITY;
+	timestamp_t min_generation = GENERATION_NUMBER_INFINITY;
 
 	while (from_iter) {
 		add_object_array(&from_iter->item->object, NULL, &from_objs);
@@ -713,7 +844,7 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 	struct commit_list *found_commits = NULL;
 	struct commit **to_last = to + nr_to;
 	struct commit **from_last = from + nr_from;
-	uint32_t min_generation = GENERATION_NUMBER_INFINITY;
+	timestamp_t min_generation = GENERATION_NUMBER_INFINITY;
 	int num_to_find = 0;
 
 	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
@@ -772,3 +903,116 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 
 	return found_commits;
 }
+
+define_commit_slab(reaching_tips, struct bitmap *);
+
+static struct bitmap *get_reaching_tips(struct reaching_tips *slab,
+					struct commit *c)
+{
+	struct bitmap **bitmap = reaching_tips_at(slab, c);
+
+	if (!*bitmap)
+		*bitmap = bitmap_new();
+	return *bitmap;
+}
+
+static void free_reaching_tips(struct reaching_tips *slab, struct commit *c)
+{
+	struct bitmap **bitmap = reaching_tips_peek(slab, c);
+
+	if (bitmap && *bitmap) {
+		bitmap_free(*bitmap);
+		*bitmap = NULL;
+	}
+}
+
+int ahead_behind(struct repository *r,
+		 struct commit **commits, size_t commits_nr,
+		 struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct reaching_tips tips;
+	size_t i, nonstale = 0;
+
+	if (!commits_nr || !counts_nr)
+		return 0;
+	if (!generation_numbers_enabled(r))
+		return -1;
+	for (i = 0; i < commits_nr; i++) {
+		if (repo_parse_commit(r, commits[i]))
+			return -1;
+		/* the walk needs all ancestors to be in the commit-graph */
+		if (commits[i]->generation == GENERATION_NUMBER_INFINITY)
+			return -1;
+	}
+
+	for (i = 0; i < counts_nr; i++)
+		counts[i].ahead = counts[i].behind = 0;
+
+	init_reaching_tips(&tips);
+	for (i = 0; i < commits_nr; i++) {
+		struct commit *c = commits[i];
+
+		bitmap_set(get_reaching_tips(&tips, c), i);
+		if (c->object.flags & PARENT2)
+			continue;
+		c->object.flags |= PARENT2;
+		prio_queue_put(&queue, c);
+		nonstale++;
+	}
+
+	/*
+	 * Commits come out of the queue after all their descendants that
+	 * are part of the walk, so the tips reaching a commit are known
+	 * by then.  A commit reached by all tips counts for nobody, and
+	 * neither do its ancestors: it is marked STALE, and the walk ends
+	 * when only STALE commits are left.
+	 */
+	while (nonstale) {
+		struct commit *c = prio_queue_get(&queue);
+		struct bitmap *reached = get_reaching_tips(&tips, c);
+		struct commit_list *p;
+
+		if (!(c->object.flags & STALE))
+			nonstale--;
+
+		for (i = 0; i < counts_nr; i++) {
+			int from_tip = bitmap_get(reached, counts[i].tip_index);
+			int from_base = bitmap_get(reached, counts[i].base_index);
+
+			if (from_tip && !from_base)
+				counts[i].ahead++;
+			else if (from_base && !from_tip)
+				counts[i].behind++;
+		}
+
+		for (p = c->parents; p; p = p->next) {
+			struct commit *parent = p->item;
+			struct bitmap *parent_reached;
+
+			if (repo_parse_commit(r, parent))
+				continue;
+			parent_reached = get_reaching_tips(&tips, parent);
+			bitmap_or(parent_reached, reached);
+
+			if (!(parent->object.flags & PARENT2)) {
+				parent->object.flags |= PARENT2;
+				prio_queue_put(&queue, parent);
+				nonstale++;
+			}
+			if (!(parent->object.flags & STALE) &&
+			    bitmap_popcount(parent_reached) == commits_nr) {
+				parent->object.flags |= STALE;
+				nonstale--;
+			}
+		}
+		free_reaching_tips(&tips, c);
+	}
+
+	while (queue.nr)
+		free_reaching_tips(&tips, prio_queue_get(&queue));
+	clear_prio_queue(&queue);
+	clear_reaching_tips(&tips);
+	clear_commit_marks_many(commits_nr, commits, PARENT2 | STALE);
+	return 0;
+}
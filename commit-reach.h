@@ -85,7 +85,7 @@ int can_all_from_reach_with_flag(struct object_array *from,
 				 unsigned int with_flag,
 				 unsigned int assign_flag,
 				 time_t min_commit_date,
-				 uint32_t min_generation);
+				 timestamp_t min_generation);
 int can_all_from_reach(struct commit_list *from, struct commit_list *to,
 		       int commit_date_cutoff);
 
@@ -102,4 +102,30 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 					 struct commit **to, int nr_to,
 					 unsigned int reachable_flag);
 
+struct ahead_behind_count {
+	/* indices into the "commits" array given to ahead_behind() */
+	size_t tip_index;
+	size_t base_index;
+
+	/* commits reachable from the tip but not the base, and vice versa */
+	unsigned int ahead;
+	unsigned int behind;
+};
+
+/*
+ * Fill in "ahead" and "behind" of all "counts" with a single walk from
+ * all the "commits", which stops as soon as the commits left cannot
+ * count for any of the pairs.
+ *
+ * The walk relies on generation numbers: -1 is returned without
+ * counting anything when the commit-graph does not provide them for
+ * all "commits".
+ *
+ * This method uses the PARENT2 and STALE flags during its operation,
+ * so be sure these flags are not set before calling the method.
+ */
+int ahead_behind(struct repository *r,
+		 struct commit **commits, size_t commits_nr,
+		 struct ahead_behind_count *counts, size_t counts_nr);
+
 #endif
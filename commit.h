@@ -11,9 +11,10 @@
 #include "commit-slab.h"
 
 #define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
-#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
-#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_INFINITY ((1ULL << 63) - 1)
+#define GENERATION_NUMBER_V1_MAX 0x3FFFFFFF
 #define GENERATION_NUMBER_ZERO 0
+#define GENERATION_NUMBER_V2_OFFSET_MAX ((1ULL << 31) - 1)
 
 struct commit_list {
 	struct commit *item;
@@ -37,8 +38,13 @@ struct commit {
 	 */
 	struct tree *maybe_tree;
 	uint32_t graph_pos;
-	uint32_t generation;
 	unsigned int index;
+
+	/*
+	 * The topological level of the commit, or its corrected commit
+	 * date when the commit-graph stores generation data.
+	 */
+	timestamp_t generation;
 };
 
 extern int save_commit_buffer;
@@ -255,6 +261,14 @@ struct commit_list *get_shallow_commits(struct object_array *heads,
 					int depth, int shallow_flag, int not_shallow_flag);
 struct commit_list *get_shallow_commits_by_rev_list(
 		int ac, const char **av, int shallow_flag, int not_shallow_flag);
+/*
+ * Same as get_shallow_commits_by_rev_list() for "rev-list
+ * --max-age=<since> <heads>", answered from the commit-graph without
+ * parsing the commits. Return -1 when the commit-graph cannot be used.
+ */
+int get_shallow_commits_since(struct object_array *heads, timestamp_t since,
+			      int shallow_flag, int not_shallow_flag,
+			      struct commit_list **result);
 void set_alternate_shallow_file(struct repository *r, const char *path, int override);
 int write_shallow_commits(struct strbuf *out, int use_pack_protocol,
 			  const struct oid_array *extra);
@@ -0,0 +1,279 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsm-listen.h"
+#include <sys/inotify.h>
+
+/*
+ * inotify watches single directories, so we add a watch for every
+ * directory of the working tree, and map watch descriptors back to
+ * the directory they watch.
+ */
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+		    IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DELETE_SELF | IN_MOVE_SELF | \
+		    IN_ONLYDIR | IN_DONT_FOLLOW)
+
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	/* relative to the root of the working tree, "" for the root */
+	char *path;
+};
+
+struct fsm_listen_data {
+	int fd;
+	int root_wd;
+	struct hashmap watches;
+};
+
+static int watch_entry_cmp(const void *unused_cmp_data,
+			   const void *entry, const void *entry_or_key,
+			   const void *unused_keydata)
+{
+	const struct watch_entry *a = entry;
+	const struct watch_entry *b = entry_or_key;
+
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	return hashmap_get(&data->watches, &key, NULL);
+}
+
+static void forget_watch(struct fsm_listen_data *data, struct watch_entry *w)
+{
+	hashmap_remove(&data->watches, w, NULL);
+	free(w->path);
+	free(w);
+}
+
+static int is_dotgit(const char *name)
+{
+	return !strcmp(name, ".git");
+}
+
+/*
+ * Watch the directory `path` and, recursively, all directories below
+ * it. With `report`, each of them is reported as changed once it is
+ * watched, so that nothing that happens in between is lost.
+ */
+static int add_watches(struct fsmonitor_daemon_state *state,
+		       const char *path, int report)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf full = STRBUF_INIT;
+	struct watch_entry *w;
+	struct dirent *de;
+	DIR *dir;
+	size_t baselen;
+	int wd, ret = 0;
+
+	strbuf_addbuf(&full, &state->worktree);
+	if (*path)
+		strbuf_addf(&full, "/%s", path);
+
+	wd = inotify_add_watch(data->fd, full.buf, WATCH_MASK);
+	if (wd < 0) {
+		if (errno == ENOSPC)
+			ret = error(_("inotify watch limit reached; consider "
+				      "raising fs.inotify.max_user_watches"));
+		else if (errno != ENOENT && errno != ENOTDIR)
+			ret = error_errno(_("unable to watch '%s'"), full.buf);
+		strbuf_release(&full);
+		return ret;
+	}
+
+	/* the same directory may be watched already, e.g. after a rename */
+	w = find_watch(data, wd);
+	if (w) {
+		free(w->path);
+	} else {
+		w = xcalloc(1, sizeof(*w));
+		hashmap_entry_init(w, memhash(&wd, sizeof(wd)));
+		w->wd = wd;
+		hashmap_add(&data->watches, w);
+	}
+	w->path = xstrdup(path);
+
+	if (report && *path)
+		fsmonitor_daemon_path_changed(state, path, 1);
+
+	dir = opendir(full.buf);
+	if (!dir) {
+		strbuf_release(&full);
+		return 0;
+	}
+	strbuf_addch(&full, '/');
+	baselen = full.len;
+	while (!ret && (de = readdir(dir))) {
+		struct stat st;
+		char *sub;
+
+		if (is_dot_or_dotdot(de->d_name) || is_dotgit(de->d_name))
+			continue;
+		if (de->d_type != DT_DIR) {
+			if (de->d_type != DT_UNKNOWN)
+				continue;
+			strbuf_setlen(&full, baselen);
+			strbuf_addstr(&full, de->d_name);
+			if (lstat(full.buf, &st) || !S_ISDIR(st.st_mode))
+				continue;
+		}
+
+		sub = *path ? xstrfmt("%s/%s", path, de->d_name) :
+			      xstrdup(de->d_name);
+		ret = add_watches(state, sub, report);
+		free(sub);
+	}
+	closedir(dir);
+	strbuf_release(&full);
+	return ret;
+}
+
+/* Stop watching `path` and everything below it. */
+static void remove_watches(struct fsm_listen_data *data, const char *path)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *w, **to_remove = NULL;
+	size_t nr = 0, alloc = 0, i;
+	const char *rest;
+
+	hashmap_iter_init(&data->watches, &iter);
+	while ((w = hashmap_iter_next(&iter))) {
+		if (skip_prefix(w->path, path, &rest) &&
+		    (!*rest || *rest == '/')) {
+			ALLOC_GROW(to_remove, nr + 1, alloc);
+			to_remove[nr++] = w;
+		}
+	}
+	for (i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd, to_remove[i]->wd);
+		forget_watch(data, to_remove[i]);
+	}
+	free(to_remove);
+}
+
+static int handle_event(struct fsmonitor_daemon_state *state,
+			const struct inotify_event *ev)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct watch_entry *w;
+	char *path;
+	int ret = 0;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		fsmonitor_daemon_invalidate_all(state);
+		return 0;
+	}
+
+	w = find_watch(data, ev->wd);
+	if (!w)
+		return 0;
+
+	if (ev->mask & IN_IGNORED) {
+		forget_watch(data, w);
+		return ev->wd == data->root_wd ? -1 : 0;
+	}
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+		return ev->wd == data->root_wd ? -1 : 0;
+	if (!ev->len)
+		return 0;
+	if (is_dotgit(ev->name))
+		return 0;
+
+	path = *w->path ? xstrfmt("%s/%s", w->path, ev->name) :
+			  xstrdup(ev->name);
+	if (ev->mask & IN_ISDIR) {
+		if (ev->mask & IN_MOVED_FROM)
+			remove_watches(data, path);
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			ret = add_watches(state, path, 1);
+		fsmonitor_daemon_path_changed(state, path, 1);
+	} else {
+		fsmonitor_daemon_path_changed(state, path, 0);
+	}
+	free(path);
+	return ret;
+}
+
+int fsm_listen_init(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = xcalloc(1, sizeof(*data));
+
+	data->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd < 0) {
+		free(data);
+		return error_errno(_("unable to initialize inotify"));
+	}
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+	state->listen_data = data;
+
+	if (add_watches(state, "", 0) < 0) {
+		fsm_listen_release(state);
+		return -1;
+	}
+
+	/* watching the same directory again returns its descriptor */
+	data->root_wd = inotify_add_watch(data->fd, state->worktree.buf,
+					  WATCH_MASK);
+	if (data->root_wd < 0 || !find_watch(data, data->root_wd)) {
+		fsm_listen_release(state);
+		return error(_("unable to watch '%s'"), state->worktree.buf);
+	}
+	return data->fd;
+}
+
+int fsm_listen_read(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	union {
+		struct inotify_event ev; /* for alignment */
+		char buf[4096];
+	} u;
+	char *buf = u.buf;
+
+	for (;;) {
+		ssize_t len = read(data->fd, buf, sizeof(u.buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return error_errno(_("unable to read inotify events"));
+		}
+		if (!len)
+			return 0;
+
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (void *)p;
+
+			if (handle_event(state, ev) < 0)
+				return -1;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+void fsm_listen_release(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!data)
+		return;
+	hashmap_iter_init(&data->watches, &iter);
+	while ((w = hashmap_iter_next(&iter)))
+		free(w->path);
+	hashmap_free(&data->watches, 1);
+	close(data->fd);
+	FREE_AND_NULL(state->listen_data);
+}
@@ -0,0 +1,64 @@
+#ifndef FSM_LISTEN_H
+#define FSM_LISTEN_H
+
+#include "hashmap.h"
+#include "strbuf.h"
+
+/*
+ * Interface between git-fsmonitor--daemon and the platform-specific
+ * code that watches the working tree for changes. The backend is
+ * selected with FSMONITOR_DAEMON_BACKEND in the Makefile, and lives in
+ * compat/fsmonitor/fsm-listen-$(FSMONITOR_DAEMON_BACKEND).c.
+ */
+
+struct fsm_listen_data;
+
+struct fsmonitor_daemon_state {
+	/* absolute path of the working tree, without a trailing slash */
+	struct strbuf worktree;
+
+	/*
+	 * Changes before this time (as returned by getnanotime()) are
+	 * not known; queries for them are answered with "everything may
+	 * have changed".
+	 */
+	uint64_t epoch;
+
+	/* paths changed since the epoch, see fsmonitor--daemon.c */
+	struct hashmap changed;
+
+	struct fsm_listen_data *listen_data;
+};
+
+/*
+ * Record that the path (relative to the root of the working tree) has
+ * changed. A directory that was created, removed or renamed is
+ * reported with `is_dir` set; everything below it is then considered
+ * to be changed, too.
+ */
+void fsmonitor_daemon_path_changed(struct fsmonitor_daemon_state *state,
+				   const char *path, int is_dir);
+
+/*
+ * Forget all changes and move the epoch to the present, e.g. because
+ * the backend lost events.
+ */
+void fsmonitor_daemon_invalidate_all(struct fsmonitor_daemon_state *state);
+
+/*
+ * Start watching state->worktree. Return a file descriptor that
+ * becomes readable whenever fsm_listen_read() has events to process,
+ * or -1 after printing an error.
+ */
+int fsm_listen_init(struct fsmonitor_daemon_state *state);
+
+/*
+ * Process all pending events without blocking. Return -1 if the
+ * working tree cannot be watched anymore (e.g. because it was
+ * removed), 0 otherwise.
+ */
+int fsm_listen_read(struct fsmonitor_daemon_state *state);
+
+void fsm_listen_release(struct fsmonitor_daemon_state *state);
+
+#endif /* FSM_LISTEN_H */
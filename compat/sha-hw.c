@@ -0,0 +1,261 @@
+#include "../git-compat-util.h"
+#include "../config.h"
+#include "sha-hw.h"
+
+#if defined(HAVE_HW_SHA1) || defined(HAVE_HW_SHA256)
+
+#ifdef HAVE_HW_SHA256
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+#endif
+
+static int hw_sha_allowed(void)
+{
+	return git_env_bool("GIT_TEST_HW_SHA", 1);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_NI __attribute__((target("sha,sse4.1")))
+
+/* SSSE3 and SSE4.1 are needed to shuffle the words around */
+static int cpu_has_sha_ni(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & (1 << 9)) || !(ecx & (1 << 19)))
+		return 0;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return !!(ebx & (1 << 29));
+}
+
+static int sha_ni_available(void)
+{
+	static int available = -1;
+
+	if (available < 0)
+		available = cpu_has_sha_ni() && hw_sha_allowed();
+	return available;
+}
+
+int hw_sha1_available(void)
+{
+	return sha_ni_available();
+}
+
+int hw_sha256_available(void)
+{
+	return sha_ni_available();
+}
+
+/*
+ * Four rounds of SHA-1 starting at round 4 * i, with the round
+ * function "f".  msg[i % 4] holds their message words (the first one
+ * in the top lane), and meanwhile the words of the rounds 16 to 28
+ * ahead are prepared in the other three.
+ */
+#define SHA1_ROUNDS(i, f) do { \
+	__m128i w = msg[(i) % 4]; \
+	_mm_storeu_si128((__m128i *)(W + 4 * (i)), \
+			 _mm_shuffle_epi32(w, 0x1b)); \
+	if (i) \
+		e = _mm_sha1nexte_epu32(abcd_prev, w); \
+	else \
+		e = _mm_add_epi32(e, w); \
+	abcd_prev = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, (f)); \
+	if ((i) >= 3 && (i) <= 18) \
+		msg[((i) + 1) % 4] = \
+			_mm_sha1msg2_epu32(msg[((i) + 1) % 4], w); \
+	if ((i) >= 2 && (i) <= 17) \
+		msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4], w); \
+	if ((i) >= 1 && (i) <= 16) \
+		msg[((i) + 3) % 4] = \
+			_mm_sha1msg1_epu32(msg[((i) + 3) % 4], w); \
+} while (0)
+
+SHA_NI
+void hw_sha1_block(uint32_t state[5], const unsigned char *block,
+		   uint32_t W[80])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, abcd_prev, e, e_save, msg[4];
+	int i;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state),
+				 0x1b);
+	e = _mm_set_epi32(state[4], 0, 0, 0);
+	abcd_save = abcd;
+	e_save = e;
+	abcd_prev = abcd;
+
+	for (i = 0; i < 4; i++)
+		msg[i] = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(block + 16 * i)),
+			bswap);
+
+	SHA1_ROUNDS(0, 0);
+	SHA1_ROUNDS(1, 0);
+	SHA1_ROUNDS(2, 0);
+	SHA1_ROUNDS(3, 0);
+	SHA1_ROUNDS(4, 0);
+	SHA1_ROUNDS(5, 1);
+	SHA1_ROUNDS(6, 1);
+	SHA1_ROUNDS(7, 1);
+	SHA1_ROUNDS(8, 1);
+	SHA1_ROUNDS(9, 1);
+	SHA1_ROUNDS(10, 2);
+	SHA1_ROUNDS(11, 2);
+	SHA1_ROUNDS(12, 2);
+	SHA1_ROUNDS(13, 2);
+	SHA1_ROUNDS(14, 2);
+	SHA1_ROUNDS(15, 3);
+	SHA1_ROUNDS(16, 3);
+	SHA1_ROUNDS(17, 3);
+	SHA1_ROUNDS(18, 3);
+	SHA1_ROUNDS(19, 3);
+
+	e = _mm_sha1nexte_epu32(abcd_prev, e_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = _mm_extract_epi32(e, 3);
+}
+
+/*
+ * Four rounds of SHA-256 starting at round 4 * i; msg[i % 4] holds
+ * their message words, and the words of the rounds 4 to 12 ahead are
+ * prepared in the others.
+ */
+#define SHA256_ROUNDS(i) do { \
+	__m128i w = msg[(i) % 4]; \
+	__m128i wk = _mm_add_epi32(w, \
+		_mm_loadu_si128((const __m128i *)(sha256_k + 4 * (i)))); \
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk); \
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, \
+				     _mm_shuffle_epi32(wk, 0x0e)); \
+	if ((i) >= 3 && (i) <= 14) { \
+		__m128i t = _mm_alignr_epi8(w, msg[((i) + 3) % 4], 4); \
+		t = _mm_add_epi32(msg[((i) + 1) % 4], t); \
+		msg[((i) + 1) % 4] = _mm_sha256msg2_epu32(t, w); \
+	} \
+	if ((i) >= 1 && (i) <= 12) \
+		msg[((i) + 3) % 4] = \
+			_mm_sha256msg1_epu32(msg[((i) + 3) % 4], w); \
+} while (0)
+
+SHA_NI
+void hw_sha256_block(uint32_t state[8], const unsigned char *block)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, t, msg[4];
+	int i;
+
+	/* the instructions want the state as ABEF and CDGH */
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xb1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)),
+				 0x1b);
+	abef = _mm_alignr_epi8(t, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, t, 0xf0);
+	abef_save = abef;
+	cdgh_save = cdgh;
+
+	for (i = 0; i < 4; i++)
+		msg[i] = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(block + 16 * i)),
+			bswap);
+
+	SHA256_ROUNDS(0);
+	SHA256_ROUNDS(1);
+	SHA256_ROUNDS(2);
+	SHA256_ROUNDS(3);
+	SHA256_ROUNDS(4);
+	SHA256_ROUNDS(5);
+	SHA256_ROUNDS(6);
+	SHA256_ROUNDS(7);
+	SHA256_ROUNDS(8);
+	SHA256_ROUNDS(9);
+	SHA256_ROUNDS(10);
+	SHA256_ROUNDS(11);
+	SHA256_ROUNDS(12);
+	SHA256_ROUNDS(13);
+	SHA256_ROUNDS(14);
+	SHA256_ROUNDS(15);
+
+	abef = _mm_add_epi32(abef, abef_save);
+	cdgh = _mm_add_epi32(cdgh, cdgh_save);
+
+	t = _mm_shuffle_epi32(abef, 0x1b);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+	_mm_storeu_si128((__m128i *)state, _mm_blend_epi16(t, cdgh, 0xf0));
+	_mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(cdgh, t, 8));
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+int hw_sha256_available(void)
+{
+	static int available = -1;
+
+	if (available < 0)
+		available = hw_sha_allowed();
+	return available;
+}
+
+void hw_sha256_block(uint32_t state[8], const unsigned char *block)
+{
+	uint32x4_t abcd, efgh, abcd_save, efgh_save, msg[4];
+	int i;
+
+	abcd = abcd_save = vld1q_u32(state);
+	efgh = efgh_save = vld1q_u32(state + 4);
+
+	for (i = 0; i < 4; i++)
+		msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(block + 16 * i)));
+
+	for (i = 0; i < 16; i++) {
+		uint32x4_t w = msg[i % 4];
+		uint32x4_t wk = vaddq_u32(w, vld1q_u32(sha256_k + 4 * i));
+		uint32x4_t prev = abcd;
+
+		if (i < 12)
+			msg[i % 4] = vsha256su1q_u32(
+				vsha256su0q_u32(w, msg[(i + 1) % 4]),
+				msg[(i + 2) % 4], msg[(i + 3) % 4]);
+		abcd = vsha256hq_u32(abcd, efgh, wk);
+		efgh = vsha256h2q_u32(efgh, prev, wk);
+	}
+
+	vst1q_u32(state, vaddq_u32(abcd, abcd_save));
+	vst1q_u32(state + 4, vaddq_u32(efgh, efgh_save));
+}
+
+#endif
+
+#endif /* HAVE_HW_SHA1 || HAVE_HW_SHA256 */
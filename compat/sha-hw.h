@@ -0,0 +1,45 @@
+#ifndef COMPAT_SHA_HW_H
+#define COMPAT_SHA_HW_H
+
+/*
+ * Block functions using the SHA instructions of the CPU, for use by
+ * the portable SHA-256 code and the collision-detecting SHA-1 code.
+ *
+ * The x86 SHA extensions are detected at runtime.  The ARMv8 crypto
+ * extensions are used only when the compiler was told they are there
+ * (e.g. -march=armv8-a+crypto, or on Apple silicon).
+ *
+ * Define NO_HW_SHA to build without them; setting GIT_TEST_HW_SHA=false
+ * in the environment disables them at runtime.
+ */
+
+#ifndef NO_HW_SHA
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_HW_SHA1
+#define HAVE_HW_SHA256
+#elif defined(__aarch64__) && \
+	(defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#define HAVE_HW_SHA256
+#endif
+#endif
+
+#ifdef HAVE_HW_SHA1
+int hw_sha1_available(void);
+
+/*
+ * Compress one 64-byte block into "state" (the five SHA-1 chaining
+ * words) and store the 80 words of the expanded message in "W", as
+ * the collision detection needs them.
+ */
+void hw_sha1_block(uint32_t state[5], const unsigned char *block,
+		   uint32_t W[80]);
+#endif
+
+#ifdef HAVE_HW_SHA256
+int hw_sha256_available(void);
+
+/* Compress one 64-byte block into "state", the eight SHA-256 words. */
+void hw_sha256_block(uint32_t state[8], const unsigned char *block);
+#endif
+
+#endif /* COMPAT_SHA_HW_H */
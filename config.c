@@ -21,6 +21,25 @@
 #include "color.h"
 #include "refs.h"
 
+/*
+ * The values parsed from a config file, kept so that reading the same
+ * unchanged file again in this process can replay them instead of
+ * parsing it again; see git_config_from_file_with_options().
+ */
+struct parsed_config_value {
+	size_t key, value; /* offsets into "strings" */
+	unsigned has_value : 1;
+	int linenr;
+};
+
+struct parsed_config_file {
+	struct stat_validity validity;
+	struct strbuf strings;
+	struct parsed_config_value *values;
+	size_t nr, alloc;
+	unsigned replaying : 1; /* an include may read the file again */
+};
+
 struct config_source {
 	struct config_source *prev;
 	union {
@@ -41,6 +60,9 @@ struct config_source {
 	struct strbuf var;
 	unsigned subsection_case_sensitive : 1;
 
+	/* when non-NULL, the values parsed are recorded here for reuse */
+	struct parsed_config_file *record;
+
 	int (*do_fgetc)(struct config_source *c);
 	int (*do_ungetc)(int c, struct config_source *conf);
 	long (*do_ftell)(struct config_source *c);
@@ -78,6 +100,72 @@ static int core_compression_seen;
 static int pack_compression_seen;
 static int zlib_compression_seen;
 
+/*
+ * While the config of a repository is read into its configset, this
+ * records what a config snapshot needs to know; see repo_read_config().
+ */
+struct config_snapshot_file {
+	char *path;
+	int exists;
+	struct stat_data sd;
+};
+
+struct config_snapshot_recorder {
+	struct config_set *cs;
+	time_t start;
+	struct config_snapshot_file *files;
+	size_t nr, alloc;
+	/* set once the config files are read and the command line is next */
+	int files_done;
+	/* the number of values read from the files, and core.configSnapshot */
+	int nr_values;
+	int enabled;
+	int uncacheable;
+};
+
+static struct config_snapshot_recorder *snapshot_recorder;
+
+/*
+ * Note a config file we are about to look at, even if it does not exist;
+ * its stat data has to be taken before it is read.
+ */
+static void note_config_file(const char *path)
+{
+	struct config_snapshot_recorder *rec = snapshot_recorder;
+	struct config_snapshot_file *file;
+	struct stat st;
+
+	if (!rec || rec->files_done)
+		return;
+	ALLOC_GROW(rec->files, rec->nr + 1, rec->alloc);
+	file = &rec->files[rec->nr++];
+	file->path = xstrdup(path);
+	file->exists = !stat(path, &st);
+	if (file->exists)
+		fill_stat_data(&file->sd, &st);
+	else
+		memset(&file->sd, 0, sizeof(file->sd));
+}
+
+static void note_config_uncacheable(void)
+{
+	if (snapshot_recorder && !snapshot_recorder->files_done)
+		snapshot_recorder->uncacheable = 1;
+}
+
+static void note_config_files_done(void)
+{
+	struct config_snapshot_recorder *rec = snapshot_recorder;
+	int enabled;
+
+	if (!rec || rec->files_done)
+		return;
+	rec->files_done = 1;
+	rec->nr_values = rec->cs->list.nr;
+	if (!git_configset_get_bool(rec->cs, "core.configsnapshot", &enabled))
+		rec->enabled = enabled;
+}
+
 static int config_file_fgetc(struct config_source *conf)
 {
 	return getc_unlocked(conf->u.file);
@@ -157,6 +245,7 @@ static int handle_path_include(const char *path, struct config_include_data *inc
 		path = buf.buf;
 	}
 
+	note_config_file(path);
 	if (!access_or_die(path, R_OK, 0)) {
 		if (++inc->depth > MAX_INCLUDE_DEPTH)
 			die(_(include_depth_advice), MAX_INCLUDE_DEPTH, path,
@@ -279,6 +368,9 @@ static int include_by_branch(const char *cond, size_t cond_len)
 		NULL : resolve_ref_unsafe("HEAD", 0, NULL, &flags);
 	const char *shortname;
 
+	/* the snapshot cannot tell when HEAD moves */
+	note_config_uncacheable();
+
 	if (!refname || !(flags & REF_ISSYMREF)	||
 			!skip_prefix(refname, "refs/heads/", &shortname))
 		return 0;
@@ -594,6 +686,22 @@ static char *parse_value(void)
 	}
 }
 
+static void record_parsed_value(struct parsed_config_file *file,
+				const char *key, const char *value, int linenr)
+{
+	struct parsed_config_value *v;
+
+	ALLOC_GROW(file->values, file->nr + 1, file->alloc);
+	v = &file->values[file->nr++];
+	v->key = file->strings.len;
+	strbuf_add(&file->strings, key, strlen(key) + 1);
+	v->value = file->strings.len;
+	v->has_value = !!value;
+	if (value)
+		strbuf_add(&file->strings, value, strlen(value) + 1);
+	v->linenr = linenr;
+}
+
 static int get_value(config_fn_t fn, void *data, struct strbuf *name)
 {
 	int c;
@@ -628,8 +736,12 @@ static int get_value(config_fn_t fn, void *data, struct strbuf *name)
 	 */
 	cf->linenr--;
 	ret = fn(name->buf, value, data);
-	if (ret >= 0)
+	if (ret >= 0) {
+		if (cf->record)
+			record_parsed_value(cf->record, name->buf, value,
+					    cf->linenr);
 		cf->linenr++;
+	}
 	return ret;
 }
 
@@ -724,14 +836,67 @@ static int do_event(enum config_event_t type, struct parse_event_data *data)
 	return 0;
 }
 
+/*
+ * Report a bad line in the current config source, at cf->linenr, as
+ * the options ask for.
+ */
+static int config_parse_error(const struct config_options *opts)
+{
+	int error_return = 0;
+	char *error_msg = NULL;
+
+	switch (cf->origin_type) {
+	case CONFIG_ORIGIN_BLOB:
+		error_msg = xstrfmt(_("bad config line %d in blob %s"),
+				      cf->linenr, cf->name);
+		break;
+	case CONFIG_ORIGIN_FILE:
+		error_msg = xstrfmt(_("bad config line %d in file %s"),
+				      cf->linenr, cf->name);
+		break;
+	case CONFIG_ORIGIN_STDIN:
+		error_msg = xstrfmt(_("bad config line %d in standard input"),
+				      cf->linenr);
+		break;
+	case CONFIG_ORIGIN_SUBMODULE_BLOB:
+		error_msg = xstrfmt(_("bad config line %d in submodule-blob %s"),
+				       cf->linenr, cf->name);
+		break;
+	case CONFIG_ORIGIN_CMDLINE:
+		error_msg = xstrfmt(_("bad config line %d in command line %s"),
+				       cf->linenr, cf->name);
+		break;
+	default:
+		error_msg = xstrfmt(_("bad config line %d in %s"),
+				      cf->linenr, cf->name);
+	}
+
+	switch (opts && opts->error_action ?
+		opts->error_action :
+		cf->default_error_action) {
+	case CONFIG_ERROR_DIE:
+		die("%s", error_msg);
+		break;
+	case CONFIG_ERROR_ERROR:
+		error_return = error("%s", error_msg);
+		break;
+	case CONFIG_ERROR_SILENT:
+		error_return = -1;
+		break;
+	case CONFIG_ERROR_UNSET:
+		BUG("config error action unset");
+	}
+
+	free(error_msg);
+	return error_return;
+}
+
 static int git_parse_source(config_fn_t fn, void *data,
 			    const struct config_options *opts)
 {
 	int comment = 0;
 	int baselen = 0;
 	struct strbuf *var = &cf->var;
-	int error_return = 0;
-	char *error_msg = NULL;
 
 	/* U+FEFF Byte Order Mark in UTF8 */
 	const char *bomptr = utf8_bom;
@@ -816,50 +981,7 @@ static int git_parse_source(config_fn_t fn, void *data,
 	if (do_event(CONFIG_EVENT_ERROR, &event_data) < 0)
 		return -1;
 
-	switch (cf->origin_type) {
-	case CONFIG_ORIGIN_BLOB:
-		error_msg = xstrfmt(_("bad config line %d in blob %s"),
-				      cf->linenr, cf->name);
-		break;
-	case CONFIG_ORIGIN_FILE:
-		error_msg = xstrfmt(_("bad config line %d in file %s"),
-				      cf->linenr, cf->name);
-		break;
-	case CONFIG_ORIGIN_STDIN:
-		error_msg = xstrfmt(_("bad config line %d in standard input"),
-				      cf->linenr);
-		break;
-	case CONFIG_ORIGIN_SUBMODULE_BLOB:
-		error_msg = xstrfmt(_("bad config line %d in submodule-blob %s"),
-				       cf->linenr, cf->name);
-		break;
-	case CONFIG_ORIGIN_CMDLINE:
-		error_msg = xstrfmt(_("bad config line %d in command line %s"),
-				       cf->linenr, cf->name);
-		break;
-	default:
-		error_msg = xstrfmt(_("bad config line %d in %s"),
-				      cf->linenr, cf->name);
-	}
-
-	switch (opts && opts->error_action ?
-		opts->error_action :
-		cf->default_error_action) {
-	case CONFIG_ERROR_DIE:
-		die("%s", error_msg);
-		break;
-	case CONFIG_ERROR_ERROR:
-		error_return = error("%s", error_msg);
-		break;
-	case CONFIG_ERROR_SILENT:
-		error_return = -1;
-		break;
-	case CONFIG_ERROR_UNSET:
-		BUG("config error action unset");
-	}
-
-	free(error_msg);
-	return error_return;
+	return config_parse_error(opts);
 }
 
 static uintmax_t get_unit_factor(const char *end)
@@ -1257,6 +1379,16 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.diffcachelimit")) {
+		diff_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.treecachelimit")) {
+		tree_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.packedgitlimit")) {
 		packed_git_limit = git_config_ulong(var, value);
 		return 0;
@@ -1267,6 +1399,18 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.deltabasecachepolicy")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "lru"))
+			delta_base_cache_policy = DELTA_BASE_CACHE_LRU;
+		else if (!strcmp(value, "2q"))
+			delta_base_cache_policy = DELTA_BASE_CACHE_2Q;
+		else
+			die(_("invalid delta base cache policy: %s"), value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.autocrlf")) {
 		if (value && !strcasecmp(value, "input")) {
 			auto_crlf = AUTO_CRLF_INPUT;
@@ -1340,7 +1484,12 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 	}
 
 	if (!strcmp(var, "core.fsyncobjectfiles")) {
-		fsync_object_files = git_config_bool(var, value);
+		if (value && !strcasecmp(value, "batch"))
+			fsync_object_files = FSYNC_OBJECT_FILES_BATCH;
+		else if (git_config_bool(var, value))
+			fsync_object_files = FSYNC_OBJECT_FILES_ON;
+		else
+			fsync_object_files = FSYNC_OBJECT_FILES_OFF;
 		return 0;
 	}
 
@@ -1364,6 +1513,16 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.sparsecheckoutcone")) {
+		core_sparse_checkout_cone = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectindex")) {
+		core_loose_object_index = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.precomposeunicode")) {
 		precomposed_unicode = git_config_bool(var, value);
 		return 0;
@@ -1556,7 +1715,8 @@ static int do_config_from(struct config_source *top, config_fn_t fn, void *data,
 static int do_config_from_file(config_fn_t fn,
 		const enum config_origin_type origin_type,
 		const char *name, const char *path, FILE *f,
-		void *data, const struct config_options *opts)
+		void *data, const struct config_options *opts,
+		struct parsed_config_file *record)
 {
 	struct config_source top;
 	int ret;
@@ -1569,6 +1729,7 @@ static int do_config_from_file(config_fn_t fn,
 	top.do_fgetc = config_file_fgetc;
 	top.do_ungetc = config_file_ungetc;
 	top.do_ftell = config_file_ftell;
+	top.record = record;
 
 	flockfile(f);
 	ret = do_config_from(&top, fn, data, opts);
@@ -1579,22 +1740,118 @@ static int do_config_from_file(config_fn_t fn,
 static int git_config_from_stdin(config_fn_t fn, void *data)
 {
 	return do_config_from_file(fn, CONFIG_ORIGIN_STDIN, "", NULL, stdin,
-				   data, NULL);
+				   data, NULL, NULL);
+}
+
+/*
+ * The same config files are read several times by most commands: for
+ * the trace2 settings, for the pager and aliases, and then for the
+ * repository's configset.  Keep the values parsed from each file, and
+ * replay them to the callback as long as the file does not change.
+ */
+static struct string_list parsed_config_files = STRING_LIST_INIT_DUP;
+
+static void free_parsed_config_file(struct parsed_config_file *file)
+{
+	if (!file)
+		return;
+	strbuf_release(&file->strings);
+	free(file->values);
+	stat_validity_clear(&file->validity);
+	free(file);
+}
+
+static int replay_parsed_config_file(struct parsed_config_file *file,
+				     config_fn_t fn, const char *filename,
+				     void *data,
+				     const struct config_options *opts)
+{
+	struct config_source top = { NULL };
+	size_t i;
+	int ret = 0;
+
+	top.prev = cf;
+	top.origin_type = CONFIG_ORIGIN_FILE;
+	top.name = filename;
+	top.path = filename;
+	top.default_error_action = CONFIG_ERROR_DIE;
+	strbuf_init(&top.value, 0);
+	strbuf_init(&top.var, 0);
+	cf = &top;
+	file->replaying = 1;
+
+	for (i = 0; i < file->nr; i++) {
+		struct parsed_config_value *v = &file->values[i];
+		const char *value = v->has_value ?
+			file->strings.buf + v->value : NULL;
+
+		top.linenr = v->linenr;
+		if (fn(file->strings.buf + v->key, value, data) < 0) {
+			ret = config_parse_error(opts);
+			break;
+		}
+	}
+
+	file->replaying = 0;
+	cf = top.prev;
+	return ret;
 }
 
 int git_config_from_file_with_options(config_fn_t fn, const char *filename,
 				      void *data,
 				      const struct config_options *opts)
 {
+	struct parsed_config_file *record = NULL;
+	int keep = 0;
 	int ret = -1;
 	FILE *f;
 
+	/* the parser events need the actual file */
+	if (!opts || !opts->event_fn) {
+		struct string_list_item *item;
+		struct parsed_config_file *parsed;
+
+		item = string_list_insert(&parsed_config_files, filename);
+		parsed = item->util;
+		if (parsed && stat_validity_check(&parsed->validity, filename))
+			return replay_parsed_config_file(parsed, fn, filename,
+							 data, opts);
+		if (!parsed || !parsed->replaying) {
+			free_parsed_config_file(parsed);
+			item->util = NULL;
+			keep = 1;
+		}
+	}
+
 	f = fopen_or_warn(filename, "r");
 	if (f) {
+		if (keep) {
+			record = xcalloc(1, sizeof(*record));
+			stat_validity_update(&record->validity, fileno(f));
+			/* the names and values take about as much as the file */
+			strbuf_init(&record->strings, record->validity.sd ?
+				    record->validity.sd->sd_size : 0);
+		}
 		ret = do_config_from_file(fn, CONFIG_ORIGIN_FILE, filename,
-					  filename, f, data, opts);
+					  filename, f, data, opts, record);
 		fclose(f);
 	}
+
+	/*
+	 * A file modified in the second it was read could be modified
+	 * again without its stat data telling; do not keep it then.
+	 */
+	if (record && !ret && record->validity.sd &&
+	    record->validity.sd->sd_mtime.sec < time(NULL)) {
+		/* includes may have added to the list while parsing */
+		struct string_list_item *item =
+			string_list_insert(&parsed_config_files, filename);
+
+		free_parsed_config_file(item->util);
+		item->util = record;
+	} else {
+		free_parsed_config_file(record);
+	}
 	return ret;
 }
 
@@ -1620,6 +1877,7 @@ int git_config_from_mem(config_fn_t fn,
 	top.do_fgetc = config_buf_fgetc;
 	top.do_ungetc = config_buf_ungetc;
 	top.do_ftell = config_buf_ftell;
+	top.record = NULL;
 
 	return do_config_from(&top, fn, data, opts);
 }
@@ -1711,6 +1969,8 @@ static int do_git_config_sequence(const struct config_options *opts,
 		repo_config = NULL;
 
 	current_parsing_scope = CONFIG_SCOPE_SYSTEM;
+	if (git_config_system())
+		note_config_file(git_etc_gitconfig());
 	if (git_config_system() && !access_or_die(git_etc_gitconfig(), R_OK,
 						  opts->system_gently ?
 						  ACCESS_EACCES_OK : 0))
@@ -1718,13 +1978,19 @@ static int do_git_config_sequence(const struct config_options *opts,
 					    data);
 
 	current_parsing_scope = CONFIG_SCOPE_GLOBAL;
+	if (xdg_config)
+		note_config_file(xdg_config);
 	if (xdg_config && !access_or_die(xdg_config, R_OK, ACCESS_EACCES_OK))
 		ret += git_config_from_file(fn, xdg_config, data);
 
+	if (user_config)
+		note_config_file(user_config);
 	if (user_config && !access_or_die(user_config, R_OK, ACCESS_EACCES_OK))
 		ret += git_config_from_file(fn, user_config, data);
 
 	current_parsing_scope = CONFIG_SCOPE_REPO;
+	if (!opts->ignore_repo && repo_config)
+		note_config_file(repo_config);
 	if (!opts->ignore_repo && repo_config &&
 	    !access_or_die(repo_config, R_OK, 0))
 		ret += git_config_from_file(fn, repo_config, data);
@@ -1735,11 +2001,13 @@ static int do_git_config_sequence(const struct config_options *opts,
 	 */
 	if (!opts->ignore_worktree && repository_format_worktree_config) {
 		char *path = git_pathdup("config.worktree");
+		note_config_file(path);
 		if (!access_or_die(path, R_OK, 0))
 			ret += git_config_from_file(fn, path, data);
 		free(path);
 	}
 
+	note_config_files_done();
 	current_parsing_scope = CONFIG_SCOPE_CMDLINE;
 	if (!opts->ignore_cmdline && git_config_from_parameters(fn, data) < 0)
 		die(_("unable to parse command-line config"));
@@ -1802,6 +2070,51 @@ static void configset_iter(struct config_set *cs, config_fn_t fn, void *data)
 	}
 }
 
+typedef void (*snapshot_value_fn)(const char *key, const char *value,
+				  struct key_value_info *kvi, void *data);
+static int read_config_snapshot(const char *path,
+				const struct config_options *opts,
+				snapshot_value_fn fn, void *cb_data);
+static void read_cmdline_config(config_fn_t fn, void *data,
+				const struct config_options *opts);
+
+struct early_config_data {
+	config_fn_t fn;
+	void *data;
+};
+
+static void snapshot_value_to_callback(const char *key, const char *value,
+				       struct key_value_info *kvi, void *data)
+{
+	struct early_config_data *early = data;
+
+	current_config_kvi = kvi;
+	if (early->fn(key, value, early->data) < 0)
+		git_die_config_linenr(key, kvi->filename, kvi->linenr);
+	current_config_kvi = NULL;
+}
+
+/*
+ * Feed the values of the config snapshot of the repository, if it is
+ * usable, and the command line config to "cb".  Returns -1 if there is
+ * no usable snapshot, and leaves the rest to the caller.
+ */
+static int read_early_config_snapshot(config_fn_t cb, void *data,
+				      const struct config_options *opts)
+{
+	struct early_config_data early = { cb, data };
+	char *path = xstrfmt("%s/config-snapshot", opts->git_dir);
+	int ret;
+
+	ret = read_config_snapshot(path, opts, snapshot_value_to_callback,
+				   &early);
+	free(path);
+	if (ret)
+		return -1;
+	read_cmdline_config(cb, data, opts);
+	return 0;
+}
+
 void read_early_config(config_fn_t cb, void *data)
 {
 	struct config_options opts = {0};
@@ -1826,7 +2139,8 @@ void read_early_config(config_fn_t cb, void *data)
 		opts.git_dir = gitdir.buf;
 	}
 
-	config_with_options(cb, data, NULL, &opts);
+	if (!opts.git_dir || read_early_config_snapshot(cb, data, &opts))
+		config_with_options(cb, data, NULL, &opts);
 
 	strbuf_release(&commondir);
 	strbuf_release(&gitdir);
@@ -1868,18 +2182,21 @@ static struct config_set_element *configset_find_element(struct config_set *cs,
 	return found_entry;
 }
 
-static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+static void configset_add_value_1(struct config_set *cs, const char *key,
+				  const char *value,
+				  struct key_value_info *kv_info)
 {
-	struct config_set_element *e;
+	struct config_set_element k, *e;
 	struct string_list_item *si;
 	struct configset_list_item *l_item;
-	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
-	e = configset_find_element(cs, key);
 	/*
 	 * Since the keys are being fed by git_config*() callback mechanism, they
 	 * are already normalized. So simply add them without any further munging.
 	 */
+	hashmap_entry_init(&k, strhash(key));
+	k.key = (char *)key;
+	e = hashmap_get(&cs->config_hash, &k, NULL);
 	if (!e) {
 		e = xmalloc(sizeof(*e));
 		hashmap_entry_init(e, strhash(key));
@@ -1893,6 +2210,12 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 	l_item = &cs->list.items[cs->list.nr++];
 	l_item->e = e;
 	l_item->value_index = e->value_list.nr - 1;
+	si->util = kv_info;
+}
+
+static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+{
+	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
 	if (!cf)
 		BUG("configset_add_value has no source");
@@ -1907,7 +2230,7 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 		kv_info->origin_type = CONFIG_ORIGIN_CMDLINE;
 	}
 	kv_info->scope = current_parsing_scope;
-	si->util = kv_info;
+	configset_add_value_1(cs, key, value, kv_info);
 
 	return 0;
 }
@@ -2063,10 +2386,323 @@ int git_configset_get_pathname(struct config_set *cs, const char *key, const cha
 		return 1;
 }
 
+/*
+ * The config snapshot of a repository, "$GIT_DIR/config-snapshot", holds
+ * the values read from its config files, with the stat data of every file
+ * that was looked at (including those that did not exist), so that later
+ * processes can load them as long as none of these files changed.  All
+ * numbers are 32-bit in network byte order, and the strings are prefixed
+ * with their length and NUL-terminated:
+ *
+ *   signature "CFGS", version
+ *   the inputs that decide which files are read, as a string
+ *   number of files, and for each: path, whether it exists, stat data
+ *   number of values, and for each: key, whether there is a value, the
+ *     value, file name, line number, origin type, scope
+ *
+ * It is replaced atomically and only read with bounds checks, so it does
+ * not bother with a checksum.
+ */
+#define CONFIG_SNAPSHOT_SIGNATURE 0x43464753 /* "CFGS" */
+#define CONFIG_SNAPSHOT_VERSION 1
+
+/*
+ * What else decides which config files get read and what they say: the
+ * paths of the top-level files and the location of the repository, which
+ * "includeIf.gitdir" looks at.
+ */
+static void config_snapshot_inputs(struct strbuf *sb,
+				   const struct config_options *opts)
+{
+	char *xdg_config = xdg_config_home("config");
+	char *user_config = expand_user_path("~/.gitconfig", 0);
+
+	strbuf_addf(sb, "system=%s\n",
+		    git_config_system() ? git_etc_gitconfig() : "");
+	strbuf_addf(sb, "xdg=%s\n", xdg_config ? xdg_config : "");
+	strbuf_addf(sb, "user=%s\n", user_config ? user_config : "");
+	strbuf_addstr(sb, "commondir=");
+	strbuf_add_real_path(sb, opts->commondir);
+	strbuf_addf(sb, "\nworktree=%d\n", repository_format_worktree_config);
+	strbuf_addstr(sb, "gitdir=");
+	strbuf_add_real_path(sb, opts->git_dir);
+	strbuf_addch(sb, '\n');
+
+	free(xdg_config);
+	free(user_config);
+}
+
+static void snapshot_add_be32(struct strbuf *sb, uint32_t v)
+{
+	v = htonl(v);
+	strbuf_add(sb, &v, sizeof(v));
+}
+
+static void snapshot_add_string(struct strbuf *sb, const char *str)
+{
+	size_t len = strlen(str);
+
+	snapshot_add_be32(sb, len);
+	strbuf_add(sb, str, len + 1);
+}
+
+static void snapshot_add_stat_data(struct strbuf *sb, const struct stat_data *sd)
+{
+	snapshot_add_be32(sb, sd->sd_ctime.sec);
+	snapshot_add_be32(sb, sd->sd_ctime.nsec);
+	snapshot_add_be32(sb, sd->sd_mtime.sec);
+	snapshot_add_be32(sb, sd->sd_mtime.nsec);
+	snapshot_add_be32(sb, sd->sd_dev);
+	snapshot_add_be32(sb, sd->sd_ino);
+	snapshot_add_be32(sb, sd->sd_uid);
+	snapshot_add_be32(sb, sd->sd_gid);
+	snapshot_add_be32(sb, sd->sd_size);
+}
+
+static void write_config_snapshot(const char *path, const char *inputs,
+				  struct config_snapshot_recorder *rec)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	int i;
+
+	/*
+	 * A file changed in the second we started reading could change
+	 * again without its stat data telling; try again another time.
+	 */
+	for (i = 0; i < rec->nr; i++)
+		if (rec->files[i].exists &&
+		    rec->files[i].sd.sd_mtime.sec >= rec->start)
+			return;
+
+	snapshot_add_be32(&sb, CONFIG_SNAPSHOT_SIGNATURE);
+	snapshot_add_be32(&sb, CONFIG_SNAPSHOT_VERSION);
+	snapshot_add_string(&sb, inputs);
+
+	snapshot_add_be32(&sb, rec->nr);
+	for (i = 0; i < rec->nr; i++) {
+		snapshot_add_string(&sb, rec->files[i].path);
+		snapshot_add_be32(&sb, rec->files[i].exists);
+		snapshot_add_stat_data(&sb, &rec->files[i].sd);
+	}
+
+	snapshot_add_be32(&sb, rec->nr_values);
+	for (i = 0; i < rec->nr_values; i++) {
+		struct configset_list_item *item = &rec->cs->list.items[i];
+		struct string_list_item *v =
+			&item->e->value_list.items[item->value_index];
+		struct key_value_info *kvi = v->util;
+
+		snapshot_add_string(&sb, item->e->key);
+		snapshot_add_be32(&sb, !!v->string);
+		snapshot_add_string(&sb, v->string ? v->string : "");
+		snapshot_add_string(&sb, kvi->filename ? kvi->filename : "");
+		snapshot_add_be32(&sb, kvi->linenr);
+		snapshot_add_be32(&sb, kvi->origin_type);
+		snapshot_add_be32(&sb, kvi->scope);
+	}
+
+	/* the snapshot is only an optimization; never complain */
+	if (hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), sb.buf, sb.len) < 0 ||
+	    commit_lock_file(&lk)) {
+		rollback_lock_file(&lk);
+		goto out;
+	}
+	trace2_data_string("config", the_repository, "snapshot", "written");
+out:
+	strbuf_release(&sb);
+}
+
+struct config_snapshot_reader {
+	const unsigned char *p, *end;
+	int bad;
+};
+
+static uint32_t snapshot_get_be32(struct config_snapshot_reader *r)
+{
+	uint32_t v;
+
+	if (r->bad || r->end - r->p < 4) {
+		r->bad = 1;
+		return 0;
+	}
+	v = get_be32(r->p);
+	r->p += 4;
+	return v;
+}
+
+static const char *snapshot_get_string(struct config_snapshot_reader *r)
+{
+	uint32_t len = snapshot_get_be32(r);
+	const char *str = (const char *)r->p;
+
+	if (r->bad || r->end - r->p <= len || str[len]) {
+		r->bad = 1;
+		return "";
+	}
+	r->p += len + 1;
+	return str;
+}
+
+static void snapshot_get_stat_data(struct config_snapshot_reader *r,
+				   struct stat_data *sd)
+{
+	sd->sd_ctime.sec = snapshot_get_be32(r);
+	sd->sd_ctime.nsec = snapshot_get_be32(r);
+	sd->sd_mtime.sec = snapshot_get_be32(r);
+	sd->sd_mtime.nsec = snapshot_get_be32(r);
+	sd->sd_dev = snapshot_get_be32(r);
+	sd->sd_ino = snapshot_get_be32(r);
+	sd->sd_uid = snapshot_get_be32(r);
+	sd->sd_gid = snapshot_get_be32(r);
+	sd->sd_size = snapshot_get_be32(r);
+}
+
+/*
+ * Feed the values of a snapshot to "fn" if it is still valid.  Returns -1
+ * without calling "fn" when it is not.
+ */
+static int load_config_snapshot(const unsigned char *data, size_t len,
+				const char *inputs, snapshot_value_fn fn,
+				void *cb_data)
+{
+	struct config_snapshot_reader r;
+	const unsigned char *values;
+	const char *last_filename = NULL;
+	struct key_value_info kvi = { NULL };
+	uint32_t nr, i;
+
+	r.p = data;
+	r.end = data + len;
+	r.bad = 0;
+	if (snapshot_get_be32(&r) != CONFIG_SNAPSHOT_SIGNATURE ||
+	    snapshot_get_be32(&r) != CONFIG_SNAPSHOT_VERSION ||
+	    strcmp(snapshot_get_string(&r), inputs))
+		return -1;
+
+	nr = snapshot_get_be32(&r);
+	for (i = 0; i < nr && !r.bad; i++) {
+		const char *path = snapshot_get_string(&r);
+		int exists = snapshot_get_be32(&r);
+		struct stat_data sd;
+		struct stat st;
+
+		snapshot_get_stat_data(&r, &sd);
+		if (r.bad)
+			break;
+		if (stat(path, &st))
+			st.st_mode = 0;
+		if (!exists != !st.st_mode ||
+		    (exists && match_stat_data(&sd, &st)))
+			return -1;
+	}
+
+	/* check that all of it is there before feeding any of it */
+	nr = snapshot_get_be32(&r);
+	values = r.p;
+	for (i = 0; i < nr && !r.bad; i++) {
+		snapshot_get_string(&r);
+		snapshot_get_be32(&r);
+		snapshot_get_string(&r);
+		snapshot_get_string(&r);
+		snapshot_get_be32(&r);
+		snapshot_get_be32(&r);
+		snapshot_get_be32(&r);
+	}
+	if (r.bad || r.p != r.end)
+		return -1;
+
+	r.p = values;
+	for (i = 0; i < nr; i++) {
+		const char *key = snapshot_get_string(&r);
+		int has_value = snapshot_get_be32(&r);
+		const char *value = snapshot_get_string(&r);
+		const char *filename = snapshot_get_string(&r);
+
+		/* values of the same file come in a row */
+		if (!last_filename || strcmp(filename, last_filename)) {
+			last_filename = filename;
+			kvi.filename = *filename ? strintern(filename) : NULL;
+		}
+		kvi.linenr = snapshot_get_be32(&r);
+		kvi.origin_type = snapshot_get_be32(&r);
+		kvi.scope = snapshot_get_be32(&r);
+		fn(key, has_value ? value : NULL, &kvi, cb_data);
+	}
+	return 0;
+}
+
+/*
+ * Returns 0 when the values of the snapshot at "path" were fed to "fn",
+ * 1 when it was unusable, and -1 when there is none.
+ */
+static int read_config_snapshot(const char *path,
+				const struct config_options *opts,
+				snapshot_value_fn fn, void *cb_data)
+{
+	struct strbuf inputs = STRBUF_INIT;
+	struct stat st;
+	void *map;
+	int fd, ret;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return 1;
+	}
+	map = xmmap(NULL, xsize_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	config_snapshot_inputs(&inputs, opts);
+	ret = load_config_snapshot(map, xsize_t(st.st_size), inputs.buf,
+				   fn, cb_data) ? 1 : 0;
+	munmap(map, xsize_t(st.st_size));
+	strbuf_release(&inputs);
+
+	trace2_data_string("config", the_repository, "snapshot",
+			   ret ? "stale" : "used");
+	return ret;
+}
+
+static void snapshot_value_to_configset(const char *key, const char *value,
+					struct key_value_info *kvi, void *data)
+{
+	struct key_value_info *copy = xmalloc(sizeof(*copy));
+
+	*copy = *kvi;
+	configset_add_value_1(data, key, value, copy);
+}
+
+/*
+ * The command line config that is applied on top of a snapshot, just like
+ * do_git_config_sequence() would after reading the files.
+ */
+static void read_cmdline_config(config_fn_t fn, void *data,
+				const struct config_options *opts)
+{
+	struct config_include_data inc = CONFIG_INCLUDE_INIT;
+
+	inc.fn = fn;
+	inc.data = data;
+	inc.opts = opts;
+
+	current_parsing_scope = CONFIG_SCOPE_CMDLINE;
+	if (git_config_from_parameters(git_config_include, &inc) < 0)
+		die(_("unable to parse command-line config"));
+	current_parsing_scope = CONFIG_SCOPE_UNKNOWN;
+}
+
 /* Functions use to read configuration from a repository */
 static void repo_read_config(struct repository *repo)
 {
 	struct config_options opts = { 0 };
+	struct config_snapshot_recorder rec = { NULL };
+	char *snapshot = NULL;
+	int ret = -1, i;
 
 	opts.respect_includes = 1;
 	opts.commondir = repo->commondir;
@@ -2079,6 +2715,23 @@ static void repo_read_config(struct repository *repo)
 
 	git_configset_init(repo->config);
 
+	if (repo->gitdir && !snapshot_recorder) {
+		snapshot = repo_git_path(repo, "config-snapshot");
+		ret = read_config_snapshot(snapshot, &opts,
+					   snapshot_value_to_configset,
+					   repo->config);
+		if (!ret) {
+			read_cmdline_config(config_set_callback, repo->config,
+					    &opts);
+			free(snapshot);
+			return;
+		}
+
+		rec.cs = repo->config;
+		rec.start = time(NULL);
+		snapshot_recorder = &rec;
+	}
+
 	if (config_with_options(config_set_callback, repo->config, NULL, &opts) < 0)
 		/*
 		 * config_with_options() normally returns only
@@ -2092,6 +2745,24 @@ static void repo_read_config(struct repository *repo)
 		 * immediately.
 		 */
 		die(_("unknown error occurred while reading the configuration files"));
+
+	if (!snapshot)
+		return;
+	snapshot_recorder = NULL;
+	if (rec.files_done && rec.enabled && !rec.uncacheable) {
+		struct strbuf inputs = STRBUF_INIT;
+
+		config_snapshot_inputs(&inputs, &opts);
+		write_config_snapshot(snapshot, inputs.buf, &rec);
+		strbuf_release(&inputs);
+	} else if (ret > 0) {
+		unlink_or_warn(snapshot);
+	}
+
+	for (i = 0; i < rec.nr; i++)
+		free(rec.files[i].path);
+	free(rec.files);
+	free(snapshot);
 }
 
 static void git_config_check_init(struct repository *repo)
@@ -2342,7 +3013,8 @@ int git_config_get_fsmonitor(void)
 	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
 		core_fsmonitor = getenv("GIT_TEST_FSMONITOR");
 
-	if (core_fsmonitor && !*core_fsmonitor)
+	if (core_fsmonitor &&
+	    (!*core_fsmonitor || !git_parse_maybe_bool(core_fsmonitor)))
 		core_fsmonitor = NULL;
 
 	if (core_fsmonitor)
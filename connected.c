@@ -5,6 +5,218 @@
 #include "connected.h"
 #include "transport.h"
 #include "packfile.h"
+#include "sha1-array.h"
+#include "config.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree-walk.h"
+#include "oidset.h"
+#include "pack-bitmap.h"
+#include "progress.h"
+
+static int write_oid(struct child_process *rev_list, const struct object_id *oid)
+{
+	char commit[GIT_MAX_HEXSZ + 1];
+
+	memcpy(commit, oid_to_hex(oid), GIT_SHA1_HEXSZ);
+	commit[GIT_SHA1_HEXSZ] = '\n';
+	if (write_in_full(rev_list->in, commit, GIT_SHA1_HEXSZ + 1) < 0) {
+		if (errno != EPIPE && errno != EINVAL)
+			error_errno(_("failed write to rev-list"));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * With a reachability bitmap, the connectivity check does not need to
+ * exclude everything reachable from our refs: everything reachable from
+ * the bitmapped commits is known to be present. Walk from the given
+ * objects until we reach that set instead, without looking at any ref.
+ *
+ * When the bitmaps are old, that can mean walking everything received
+ * since the last repack; give up after this many objects and let
+ * rev-list do the check.
+ */
+#define BITMAP_WALK_LIMIT 100000
+
+struct bitmap_walk {
+	struct check_connected_options *opt;
+	struct bitmap_index *bitmap_git;
+	struct bitmap *reachable;
+	struct oidset seen;
+	struct object_id *stack;
+	size_t nr, alloc;
+	struct progress *progress;
+	uint64_t walked;
+};
+
+__attribute__((format (printf, 2, 3)))
+static int walk_error(struct bitmap_walk *w, const char *fmt, ...)
+{
+	struct strbuf sb = STRBUF_INIT;
+	va_list ap;
+
+	if (w->opt->quiet)
+		return -1;
+	strbuf_addstr(&sb, _("error: "));
+	va_start(ap, fmt);
+	strbuf_vaddf(&sb, fmt, ap);
+	va_end(ap);
+	strbuf_addch(&sb, '\n');
+	write_in_full(w->opt->err_fd ? w->opt->err_fd : 2, sb.buf, sb.len);
+	strbuf_release(&sb);
+	return -1;
+}
+
+static void walk_push(struct bitmap_walk *w, const struct object_id *oid)
+{
+	if (bitmap_reaches_oid(w->bitmap_git, w->reachable, oid))
+		return;
+	if (oidset_insert(&w->seen, oid))
+		return;
+	ALLOC_GROW(w->stack, w->nr + 1, w->alloc);
+	oidcpy(&w->stack[w->nr++], oid);
+}
+
+static int walk_one(struct bitmap_walk *w, const struct object_id *oid)
+{
+	enum object_type type = oid_object_info(the_repository, oid, NULL);
+
+	switch (type) {
+	case OBJ_COMMIT: {
+		struct commit *commit = lookup_commit(the_repository, oid);
+		struct commit_list *p;
+
+		if (!commit || repo_parse_commit(the_repository, commit))
+			return walk_error(w, _("bad commit object %s"),
+					  oid_to_hex(oid));
+		walk_push(w, get_commit_tree_oid(commit));
+		for (p = commit->parents; p; p = p->next)
+			walk_push(w, &p->item->object.oid);
+		break;
+	}
+	case OBJ_TREE: {
+		struct tree_desc desc;
+		struct name_entry entry;
+		void *buf;
+
+		/*
+		 * Read the tree afresh: a tree parsed earlier in this
+		 * process may have had its buffer freed.
+		 */
+		buf = fill_tree_descriptor(the_repository, &desc, oid);
+		if (!buf)
+			return walk_error(w, _("bad tree object %s"),
+					  oid_to_hex(oid));
+		while (tree_entry(&desc, &entry))
+			if (!S_ISGITLINK(entry.mode))
+				walk_push(w, &entry.oid);
+		free(buf);
+		break;
+	}
+	case OBJ_TAG: {
+		struct tag *tag = lookup_tag(the_repository, oid);
+
+		if (!tag || parse_tag(tag) || !tag->tagged)
+			return walk_error(w, _("bad tag object %s"),
+					  oid_to_hex(oid));
+		walk_push(w, &tag->tagged->oid);
+		break;
+	}
+	case OBJ_BLOB:
+		break;
+	default:
+		return walk_error(w, _("missing object %s"), oid_to_hex(oid));
+	}
+	display_progress(w->progress, ++w->walked);
+	return 0;
+}
+
+static int use_bitmap_walk(struct check_connected_options *opt)
+{
+	int use_bitmaps = 1;
+
+	/*
+	 * These need rev-list: shallow and deepening fetches look at
+	 * the whole history, and partial clones exclude promisor objects.
+	 */
+	if (opt->shallow_file || opt->is_deepening_fetch ||
+	    repository_format_partial_clone)
+		return 0;
+	git_config_get_bool("pack.usebitmaps", &use_bitmaps);
+	return use_bitmaps;
+}
+
+/*
+ * Returns 0 if everything is connected, 1 if not, and -1 if the walk was
+ * given up; the objects to check, including the foreign ones, are then
+ * left in "tips".
+ */
+static int check_connected_bitmap(struct bitmap_index *bitmap_git,
+				  oid_iterate_fn fn, void *cb_data,
+				  struct object_id *oid,
+				  struct packed_git *new_pack,
+				  struct check_connected_options *opt,
+				  struct oid_array *tips)
+{
+	struct bitmap_walk w = { opt, bitmap_git };
+	int err = 0;
+
+	w.reachable = bitmap_reachable_from_stored(bitmap_git);
+	oidset_init(&w.seen, 0);
+	if (opt->progress && !opt->err_fd)
+		w.progress = start_delayed_progress(_("Checking connectivity"), 0);
+
+	do {
+		if (new_pack && find_pack_entry_one(oid->hash, new_pack))
+			continue;
+		oid_array_append(tips, oid);
+		walk_push(&w, oid);
+	} while (!fn(cb_data, oid));
+	if (opt->foreign) {
+		size_t i;
+		for (i = 0; i < opt->foreign->nr; i++) {
+			oid_array_append(tips, &opt->foreign->oid[i]);
+			walk_push(&w, &opt->foreign->oid[i]);
+		}
+	}
+
+	while (w.nr && !err) {
+		struct object_id next;
+
+		if (w.walked >= BITMAP_WALK_LIMIT) {
+			err = -1;
+			break;
+		}
+		oidcpy(&next, &w.stack[--w.nr]);
+		if (walk_one(&w, &next))
+			err = 1;
+	}
+
+	trace2_data_intmax("check-connected", the_repository,
+			   "bitmap-walked", w.walked);
+	stop_progress(&w.progress);
+	free(w.stack);
+	oidset_clear(&w.seen);
+	bitmap_free(w.reachable);
+	return err;
+}
+
+struct tips_iter {
+	struct oid_array *tips;
+	size_t nr;
+};
+
+static int iterate_tips(void *cb_data, struct object_id *oid)
+{
+	struct tips_iter *iter = cb_data;
+
+	if (iter->nr >= iter->tips->nr)
+		return -1;
+	oidcpy(oid, &iter->tips->oid[iter->nr++]);
+	return 0;
+}
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -22,10 +234,13 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 {
 	struct child_process rev_list = CHILD_PROCESS_INIT;
 	struct check_connected_options defaults = CHECK_CONNECTED_INIT;
-	char commit[GIT_MAX_HEXSZ + 1];
 	struct object_id oid;
 	int err = 0;
 	struct packed_git *new_pack = NULL;
+	struct bitmap_index *bitmap_git;
+	struct oid_array tips = OID_ARRAY_INIT;
+	struct tips_iter iter = { &tips };
+	const struct oid_array *foreign = opt ? opt->foreign : NULL;
 	struct transport *transport;
 	size_t base_len;
 
@@ -39,12 +254,16 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		return err;
 	}
 
-	if (transport && transport->smart_options &&
+	if (opt->pack)
+		new_pack = opt->pack;
+	else if (transport && transport->smart_options &&
 	    transport->smart_options->self_contained_and_connected &&
-	    transport->pack_lockfile &&
-	    strip_suffix(transport->pack_lockfile, ".keep", &base_len)) {
+	    transport->pack_lockfiles.nr == 1 &&
+	    strip_suffix(transport->pack_lockfiles.items[0].string,
+			 ".keep", &base_len)) {
 		struct strbuf idx_file = STRBUF_INIT;
-		strbuf_add(&idx_file, transport->pack_lockfile, base_len);
+		strbuf_add(&idx_file, transport->pack_lockfiles.items[0].string,
+			   base_len);
 		strbuf_addstr(&idx_file, ".idx");
 		new_pack = add_packed_git(idx_file.buf, idx_file.len, 1);
 		strbuf_release(&idx_file);
@@ -66,6 +285,26 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		return 0;
 	}
 
+	if (use_bitmap_walk(opt) &&
+	    (bitmap_git = prepare_bitmap_git(the_repository))) {
+		err = check_connected_bitmap(bitmap_git, fn, cb_data, &oid,
+					     new_pack, opt, &tips);
+		free_bitmap_index(bitmap_git);
+		if (err >= 0) {
+			oid_array_clear(&tips);
+			if (opt->err_fd)
+				close(opt->err_fd);
+			return err;
+		}
+
+		/* The walk was given up; let rev-list check the same tips. */
+		err = 0;
+		fn = iterate_tips;
+		cb_data = &iter;
+		fn(cb_data, &oid);
+		foreign = NULL;
+	}
+
 	if (opt->shallow_file) {
 		argv_array_push(&rev_list.args, "--shallow-file");
 		argv_array_push(&rev_list.args, opt->shallow_file);
@@ -94,12 +333,13 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	else
 		rev_list.no_stderr = opt->quiet;
 
-	if (start_command(&rev_list))
+	if (start_command(&rev_list)) {
+		oid_array_clear(&tips);
 		return error(_("Could not run 'git rev-list'"));
+	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
 
-	commit[GIT_SHA1_HEXSZ] = '\n';
 	do {
 		/*
 		 * If index-pack already checked that:
@@ -112,18 +352,26 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		if (new_pack && find_pack_entry_one(oid.hash, new_pack))
 			continue;
 
-		memcpy(commit, oid_to_hex(&oid), GIT_SHA1_HEXSZ);
-		if (write_in_full(rev_list.in, commit, GIT_SHA1_HEXSZ + 1) < 0) {
-			if (errno != EPIPE && errno != EINVAL)
-				error_errno(_("failed write to rev-list"));
+		if (write_oid(&rev_list, &oid)) {
 			err = -1;
 			break;
 		}
 	} while (!fn(cb_data, &oid));
 
+	if (!err && foreign) {
+		size_t i;
+		for (i = 0; i < foreign->nr; i++) {
+			if (write_oid(&rev_list, &foreign->oid[i])) {
+				err = -1;
+				break;
+			}
+		}
+	}
+
 	if (close(rev_list.in))
 		err = error_errno(_("failed to close rev-list's stdin"));
 
 	sigchain_pop(SIGPIPE);
+	oid_array_clear(&tips);
 	return finish_command(&rev_list) || err;
 }
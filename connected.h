@@ -2,6 +2,8 @@
 #define CONNECTED_H
 
 struct object_id;
+struct oid_array;
+struct packed_git;
 struct transport;
 
 /*
@@ -54,6 +56,16 @@ struct check_connected_options {
 	 * slow and the commit-walk itself becomes a no-op.
 	 */
 	unsigned check_refs_only : 1;
+
+	/*
+	 * The pack the objects were received in, if index-pack already
+	 * checked that everything it refers to is either in it or listed
+	 * in "foreign" (see --foreign-objects in git-index-pack(1)). The
+	 * given objects found in the pack are then not walked again; the
+	 * foreign objects are walked in their place.
+	 */
+	struct packed_git *pack;
+	const struct oid_array *foreign;
 };
 
 #define CHECK_CONNECTED_INIT { 0 }
@@ -23,17 +23,6 @@
 #define CONVERT_STAT_BITS_TXT_CRLF  0x2
 #define CONVERT_STAT_BITS_BIN       0x4
 
-enum crlf_action {
-	CRLF_UNDEFINED,
-	CRLF_BINARY,
-	CRLF_TEXT,
-	CRLF_TEXT_INPUT,
-	CRLF_TEXT_CRLF,
-	CRLF_AUTO,
-	CRLF_AUTO_INPUT,
-	CRLF_AUTO_CRLF
-};
-
 struct text_stat {
 	/* NUL, CR, LF and CRLF counts */
 	unsigned nul, lonecr, lonelf, crlf;
@@ -42,6 +31,23 @@ struct text_stat {
 	unsigned printable, nonprintable;
 };
 
+/*
+ * Does the 8-byte word at 'p' consist only of bytes that gather_stats()
+ * counts as printable without looking at them any further, i.e. no
+ * control character and no DEL? This lets the common case skip a word
+ * at a time.
+ */
+static inline int is_plain_word(const char *p)
+{
+	uint64_t w, low, del;
+
+	memcpy(&w, p, sizeof(w));
+	low = (w - 0x2020202020202020ULL) & ~w & 0x8080808080808080ULL;
+	w ^= 0x7f7f7f7f7f7f7f7fULL;
+	del = (w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL;
+	return !(low | del);
+}
+
 static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
 {
 	unsigned long i;
@@ -49,7 +55,15 @@ static void gather_stats(const char *buf, unsigned long size, struct text_stat *
 	memset(stats, 0, sizeof(*stats));
 
 	for (i = 0; i < size; i++) {
-		unsigned char c = buf[i];
+		unsigned char c;
+
+		if (size - i >= sizeof(uint64_t) && is_plain_word(buf + i)) {
+			stats->printable += sizeof(uint64_t);
+			i += sizeof(uint64_t) - 1;
+			continue;
+		}
+
+		c = buf[i];
 		if (c == '\r') {
 			if (i+1 < size && buf[i+1] == '\n') {
 				stats->crlf++;
@@ -508,7 +522,7 @@ static int crlf_to_git(const struct index_state *istate,
 {
 	struct text_stat stats;
 	char *dst;
-	int convert_crlf_into_lf;
+	int convert_crlf_into_lf, guessed;
 
 	if (crlf_action == CRLF_BINARY ||
 	    (src && !len))
@@ -568,23 +582,25 @@ static int crlf_to_git(const struct index_state *istate,
 	if (strbuf_avail(buf) + buf->len < len)
 		strbuf_grow(buf, len - buf->len);
 	dst = buf->buf;
-	if (crlf_action == CRLF_AUTO || crlf_action == CRLF_AUTO_INPUT || crlf_action == CRLF_AUTO_CRLF) {
-		/*
-		 * If we guessed, we already know we rejected a file with
-		 * lone CR, and we can strip a CR without looking at what
-		 * follow it.
-		 */
-		do {
-			unsigned char c = *src++;
-			if (c != '\r')
-				*dst++ = c;
-		} while (--len);
-	} else {
-		do {
-			unsigned char c = *src++;
-			if (! (c == '\r' && (1 < len && *src == '\n')))
-				*dst++ = c;
-		} while (--len);
+	/*
+	 * If we guessed, we already know we rejected a file with lone
+	 * CR, and we can strip a CR without looking at what follows it.
+	 */
+	guessed = crlf_action == CRLF_AUTO || crlf_action == CRLF_AUTO_INPUT ||
+		  crlf_action == CRLF_AUTO_CRLF;
+	for (;;) {
+		const char *cr = memchr(src, '\r', len);
+		size_t run = cr ? cr - src : len;
+
+		/* "dst" trails "src" when we convert in place */
+		memmove(dst, src, run);
+		dst += run;
+		if (!cr)
+			break;
+		len -= run + 1;
+		src = cr + 1;
+		if (!guessed && !(len && *src == '\n'))
+			*dst++ = '\r';
 	}
 	strbuf_setlen(buf, dst - buf->buf);
 	return 1;
@@ -751,6 +767,7 @@ static int apply_single_file_filter(const char *path, const char *src, size_t le
 #define CAP_CLEAN    (1u<<0)
 #define CAP_SMUDGE   (1u<<1)
 #define CAP_DELAY    (1u<<2)
+#define CAP_BATCH    (1u<<3)
 
 struct cmd2process {
 	struct subprocess_entry subprocess; /* must be the first member! */
@@ -767,12 +784,18 @@ static int start_multi_file_filter_fn(struct subprocess_entry *subprocess)
 		{ "clean",  CAP_CLEAN  },
 		{ "smudge", CAP_SMUDGE },
 		{ "delay",  CAP_DELAY  },
+		{ "batch",  CAP_BATCH  },
 		{ NULL, 0 }
 	};
 	struct cmd2process *entry = (struct cmd2process *)subprocess;
-	return subprocess_handshake(subprocess, "git-filter", versions, NULL,
-				    capabilities,
-				    &entry->supported_capabilities);
+	int err = subprocess_handshake(subprocess, "git-filter", versions, NULL,
+				       capabilities,
+				       &entry->supported_capabilities);
+
+	/* Batched blobs are handed back like delayed ones. */
+	if (!(entry->supported_capabilities & CAP_DELAY))
+		entry->supported_capabilities &= ~CAP_BATCH;
+	return err;
 }
 
 static void handle_filter_error(const struct strbuf *filter_status,
@@ -805,7 +828,7 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 				   struct delayed_checkout *dco)
 {
 	int err;
-	int can_delay = 0;
+	int can_delay = 0, batch = 0;
 	struct cmd2process *entry;
 	struct child_process *process;
 	struct strbuf nbuf = STRBUF_INIT;
@@ -818,6 +841,11 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 		entry = NULL;
 	} else {
 		entry = (struct cmd2process *)subprocess_find_entry(&subprocess_map, cmd);
+		if (entry &&
+		    subprocess_finish_start(&subprocess_map, &entry->subprocess)) {
+			free(entry);
+			return 0;
+		}
 	}
 
 	fflush(NULL);
@@ -866,6 +894,13 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 		err = packet_write_fmt_gently(process->in, "can-delay=1\n");
 		if (err)
 			goto done;
+
+		if (entry->supported_capabilities & CAP_BATCH) {
+			batch = 1;
+			err = packet_write_fmt_gently(process->in, "batch=1\n");
+			if (err)
+				goto done;
+		}
 	}
 
 	err = packet_flush_gently(process->in);
@@ -879,6 +914,18 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 	if (err)
 		goto done;
 
+	/*
+	 * The filter does not answer a batched request; it lists the
+	 * path in "list_available_blobs" when it is done with it. This
+	 * lets us send the next blob without waiting for a round trip,
+	 * while the filter works on the blobs in any order.
+	 */
+	if (batch) {
+		string_list_insert(&dco->filters, cmd);
+		string_list_insert(&dco->paths, path);
+		goto done;
+	}
+
 	err = subprocess_read_status(process->out, &filter_status);
 	if (err)
 		goto done;
@@ -915,6 +962,25 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 }
 
 
+static void prestart_multi_file_filter(const char *cmd)
+{
+	struct cmd2process *entry;
+
+	if (!subprocess_map_initialized) {
+		subprocess_map_initialized = 1;
+		hashmap_init(&subprocess_map, cmd2process_cmp, NULL, 0);
+	} else if (subprocess_find_entry(&subprocess_map, cmd)) {
+		return;
+	}
+
+	fflush(NULL);
+	entry = xmalloc(sizeof(*entry));
+	entry->supported_capabilities = 0;
+	if (subprocess_prestart(&subprocess_map, &entry->subprocess, cmd,
+				start_multi_file_filter_fn))
+		free(entry);
+}
+
 int async_query_available_blobs(const char *cmd, struct string_list *available_paths)
 {
 	int err;
@@ -971,6 +1037,7 @@ static struct convert_driver {
 	const char *clean;
 	const char *process;
 	int required;
+	int prestart;
 } *user_convert, **user_convert_tail;
 
 static int apply_filter(const char *path, const char *src, size_t len,
@@ -1045,6 +1112,11 @@ static int read_convert_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp("prestart", key)) {
+		drv->prestart = git_config_bool(var, value);
+		return 0;
+	}
+
 	return 0;
 }
 
@@ -1285,16 +1357,26 @@ static int git_path_check_ident(struct attr_check_item *check)
 	return !!ATTR_TRUE(value);
 }
 
-struct conv_attrs {
+static void init_convert_config(void)
+{
+	if (user_convert_tail)
+		return;
+	user_convert_tail = &user_convert;
+	git_config(read_convert_config, NULL);
+}
+
+void prestart_filter_processes(void)
+{
 	struct convert_driver *drv;
-	enum crlf_action attr_action; /* What attr says */
-	enum crlf_action crlf_action; /* When no attr is set, use core.autocrlf */
-	int ident;
-	const char *working_tree_encoding; /* Supported encoding or default encoding if NULL */
-};
 
-static void convert_attrs(const struct index_state *istate,
-			  struct conv_attrs *ca, const char *path)
+	init_convert_config();
+	for (drv = user_convert; drv; drv = drv->next)
+		if (drv->process && drv->prestart)
+			prestart_multi_file_filter(drv->process);
+}
+
+void convert_attrs(const struct index_state *istate,
+		   struct conv_attrs *ca, const char *path)
 {
 	static struct attr_check *check;
 	struct attr_check_item *ccheck = NULL;
@@ -1303,8 +1385,7 @@ static void convert_attrs(const struct index_state *istate,
 		check = attr_check_initl("crlf", "ident", "filter",
 					 "eol", "text", "working-tree-encoding",
 					 NULL);
-		user_convert_tail = &user_convert;
-		git_config(read_convert_config, NULL);
+		init_convert_config();
 	}
 
 	git_check_attr(istate, path, check);
@@ -1436,17 +1517,14 @@ void convert_to_git_filter_fd(const struct index_state *istate,
 	ident_to_git(dst->buf, dst->len, dst, ca.ident);
 }
 
-static int convert_to_working_tree_internal(const struct index_state *istate,
+static int convert_to_working_tree_internal(const struct conv_attrs *ca,
 					    const char *path, const char *src,
 					    size_t len, struct strbuf *dst,
 					    int normalizing, struct delayed_checkout *dco)
 {
 	int ret = 0, ret_filter = 0;
-	struct conv_attrs ca;
-
-	convert_attrs(istate, &ca, path);
 
-	ret |= ident_to_worktree(src, len, dst, ca.ident);
+	ret |= ident_to_worktree(src, len, dst, ca->ident);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -1456,24 +1534,24 @@ static int convert_to_working_tree_internal(const struct index_state *istate,
 	 * is a smudge or process filter (even if the process filter doesn't
 	 * support smudge).  The filters might expect CRLFs.
 	 */
-	if ((ca.drv && (ca.drv->smudge || ca.drv->process)) || !normalizing) {
-		ret |= crlf_to_worktree(src, len, dst, ca.crlf_action);
+	if ((ca->drv && (ca->drv->smudge || ca->drv->process)) || !normalizing) {
+		ret |= crlf_to_worktree(src, len, dst, ca->crlf_action);
 		if (ret) {
 			src = dst->buf;
 			len = dst->len;
 		}
 	}
 
-	ret |= encode_to_worktree(path, src, len, dst, ca.working_tree_encoding);
+	ret |= encode_to_worktree(path, src, len, dst, ca->working_tree_encoding);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
 	}
 
 	ret_filter = apply_filter(
-		path, src, len, -1, dst, ca.drv, CAP_SMUDGE, dco);
-	if (!ret_filter && ca.drv && ca.drv->required)
-		die(_("%s: smudge filter %s failed"), path, ca.drv->name);
+		path, src, len, -1, dst, ca->drv, CAP_SMUDGE, dco);
+	if (!ret_filter && ca->drv && ca->drv->required)
+		die(_("%s: smudge filter %s failed"), path, ca->drv->name);
 
 	return ret | ret_filter;
 }
@@ -1483,20 +1561,42 @@ int async_convert_to_working_tree(const struct index_state *istate,
 				  size_t len, struct strbuf *dst,
 				  void *dco)
 {
-	return convert_to_working_tree_internal(istate, path, src, len, dst, 0, dco);
+	struct conv_attrs ca;
+
+	convert_attrs(istate, &ca, path);
+	return convert_to_working_tree_internal(&ca, path, src, len, dst, 0, dco);
 }
 
 int convert_to_working_tree(const struct index_state *istate,
 			    const char *path, const char *src,
 			    size_t len, struct strbuf *dst)
 {
-	return convert_to_working_tree_internal(istate, path, src, len, dst, 0, NULL);
+	struct conv_attrs ca;
+
+	convert_attrs(istate, &ca, path);
+	return convert_to_working_tree_internal(&ca, path, src, len, dst, 0, NULL);
+}
+
+int convert_to_working_tree_ca(const struct conv_attrs *ca,
+			       const char *path, const char *src,
+			       size_t len, struct strbuf *dst)
+{
+	return convert_to_working_tree_internal(ca, path, src, len, dst, 0, NULL);
+}
+
+int conv_attrs_need_filter(const struct conv_attrs *ca)
+{
+	return ca->drv && (ca->drv->smudge || ca->drv->process);
 }
 
 int renormalize_buffer(const struct index_state *istate, const char *path,
 		       const char *src, size_t len, struct strbuf *dst)
 {
-	int ret = convert_to_working_tree_internal(istate, path, src, len, dst, 1, NULL);
+	struct conv_attrs ca;
+	int ret;
+
+	convert_attrs(istate, &ca, path);
+	ret = convert_to_working_tree_internal(&ca, path, src, len, dst, 1, NULL);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -1573,6 +1673,21 @@ struct lf_to_crlf_filter {
 	char held;
 };
 
+/*
+ * Returns the length of the run of bytes at 'p', at most 'len' long,
+ * that has neither a CR nor a LF.
+ */
+static size_t plain_run(const char *p, size_t len)
+{
+	const char *lf = memchr(p, '\n', len);
+	const char *cr;
+
+	if (lf)
+		len = lf - p;
+	cr = memchr(p, '\r', len);
+	return cr ? cr - p : len;
+}
+
 static int lf_to_crlf_filter_fn(struct stream_filter *filter,
 				const char *input, size_t *isize_p,
 				char *output, size_t *osize_p)
@@ -1609,6 +1724,19 @@ static int lf_to_crlf_filter_fn(struct stream_filter *filter,
 		for (i = 0; o < *osize_p && i < count; i++) {
 			char ch = input[i];
 
+			/* copy a line without CR or LF in one go */
+			if (!was_cr && ch != '\n' && ch != '\r') {
+				size_t n = count - i;
+
+				if (n > *osize_p - o)
+					n = *osize_p - o;
+				n = plain_run(input + i, n);
+				memcpy(output + o, input + i, n);
+				o += n;
+				i += n - 1;
+				continue;
+			}
+
 			if (ch == '\n') {
 				output[o++] = '\r';
 			} else if (was_cr) {
@@ -57,6 +57,27 @@ struct delayed_checkout {
 	struct string_list paths;
 };
 
+struct convert_driver;
+
+enum crlf_action {
+	CRLF_UNDEFINED,
+	CRLF_BINARY,
+	CRLF_TEXT,
+	CRLF_TEXT_INPUT,
+	CRLF_TEXT_CRLF,
+	CRLF_AUTO,
+	CRLF_AUTO_INPUT,
+	CRLF_AUTO_CRLF
+};
+
+struct conv_attrs {
+	struct convert_driver *drv;
+	enum crlf_action attr_action; /* What attr says */
+	enum crlf_action crlf_action; /* When no attr is set, use core.autocrlf */
+	int ident;
+	const char *working_tree_encoding; /* Supported encoding or default encoding if NULL */
+};
+
 extern enum eol core_eol;
 extern char *check_roundtrip_encoding;
 const char *get_cached_convert_stats_ascii(const struct index_state *istate,
@@ -76,6 +97,27 @@ int async_convert_to_working_tree(const struct index_state *istate,
 				  const char *path, const char *src,
 				  size_t len, struct strbuf *dst,
 				  void *dco);
+
+/*
+ * Look up the conversion attributes of 'path', so that they can be
+ * used by convert_to_working_tree_ca() later (possibly from another
+ * thread, as long as no external filter is involved).
+ */
+void convert_attrs(const struct index_state *istate,
+		   struct conv_attrs *ca, const char *path);
+int convert_to_working_tree_ca(const struct conv_attrs *ca,
+			       const char *path, const char *src,
+			       size_t len, struct strbuf *dst);
+
+/*
+ * Start the "filter.<driver>.process" commands of the drivers that have
+ * "filter.<driver>.prestart" set, so that they start up while the
+ * caller gets ready to check out files.
+ */
+void prestart_filter_processes(void);
+
+/* Returns 1 if 'ca' asks for a smudge or process filter to be run. */
+int conv_attrs_need_filter(const struct conv_attrs *ca);
 int async_query_available_blobs(const char *cmd,
 				struct string_list *available_paths);
 int renormalize_buffer(const struct index_state *istate,
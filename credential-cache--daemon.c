@@ -9,16 +9,70 @@ struct credential_cache_entry {
 	struct credential item;
 	timestamp_t expiration;
 };
-static struct credential_cache_entry *entries;
+
+/*
+ * Cached credentials are grouped by protocol and host, which requests
+ * practically always give; other requests look at every group.
+ */
+struct credential_cache_group {
+	struct hashmap_entry ent;
+	char *protocol;
+	char *host;
+	struct credential_cache_entry *entries;
+	int entries_nr;
+	int entries_alloc;
+};
+static struct hashmap groups;
 static int entries_nr;
-static int entries_alloc;
+
+static const char *key_or_empty(const char *s)
+{
+	return s ? s : "";
+}
+
+static unsigned int group_hash(const struct credential *c)
+{
+	return strhash(key_or_empty(c->protocol)) +
+	       31 * strhash(key_or_empty(c->host));
+}
+
+static int group_cmp(const void *unused_cmp_data,
+		     const void *entry, const void *entry_or_key,
+		     const void *keydata)
+{
+	const struct credential_cache_group *a = entry, *b = entry_or_key;
+	const char *protocol = b->protocol, *host = b->host;
+
+	if (keydata) {
+		const struct credential *c = keydata;
+
+		protocol = key_or_empty(c->protocol);
+		host = key_or_empty(c->host);
+	}
+	return strcmp(a->protocol, protocol) || strcmp(a->host, host);
+}
+
+static struct credential_cache_group *find_group(const struct credential *c)
+{
+	return hashmap_get_from_hash(&groups, group_hash(c), c);
+}
 
 static void cache_credential(struct credential *c, int timeout)
 {
+	struct credential_cache_group *g = find_group(c);
 	struct credential_cache_entry *e;
 
-	ALLOC_GROW(entries, entries_nr + 1, entries_alloc);
-	e = &entries[entries_nr++];
+	if (!g) {
+		g = xcalloc(1, sizeof(*g));
+		g->protocol = xstrdup(key_or_empty(c->protocol));
+		g->host = xstrdup(key_or_empty(c->host));
+		hashmap_entry_init(g, group_hash(c));
+		hashmap_add(&groups, g);
+	}
+
+	ALLOC_GROW(g->entries, g->entries_nr + 1, g->entries_alloc);
+	e = &g->entries[g->entries_nr++];
+	entries_nr++;
 
 	/* take ownership of pointers */
 	memcpy(&e->item, c, sizeof(*c));
@@ -26,17 +80,39 @@ static void cache_credential(struct credential *c, int timeout)
 	e->expiration = time(NULL) + timeout;
 }
 
-static struct credential_cache_entry *lookup_credential(const struct credential *c)
+static struct credential_cache_entry *lookup_in_group(struct credential_cache_group *g,
+						      const struct credential *c)
 {
 	int i;
-	for (i = 0; i < entries_nr; i++) {
-		struct credential *e = &entries[i].item;
+	for (i = 0; i < g->entries_nr; i++) {
+		struct credential *e = &g->entries[i].item;
+
+		/* removed, but check_expirations() has not run yet */
+		if (!g->entries[i].expiration)
+			continue;
 		if (credential_match(c, e))
-			return &entries[i];
+			return &g->entries[i];
 	}
 	return NULL;
 }
 
+static struct credential_cache_entry *lookup_credential(const struct credential *c)
+{
+	struct credential_cache_group *g;
+	struct credential_cache_entry *e;
+	struct hashmap_iter iter;
+
+	if (c->protocol && c->host) {
+		g = find_group(c);
+		return g ? lookup_in_group(g, c) : NULL;
+	}
+	for (g = hashmap_iter_first(&groups, &iter); g;
+	     g = hashmap_iter_next(&iter))
+		if ((e = lookup_in_group(g, c)))
+			return e;
+	return NULL;
+}
+
 static void remove_credential(const struct credential *c)
 {
 	struct credential_cache_entry *e;
@@ -49,7 +125,9 @@ static void remove_credential(const struct credential *c)
 static timestamp_t check_expirations(void)
 {
 	static timestamp_t wait_for_entry_until;
-	int i = 0;
+	struct credential_cache_group *g, **empty = NULL;
+	int empty_nr = 0, empty_alloc = 0;
+	struct hashmap_iter iter;
 	timestamp_t now = time(NULL);
 	timestamp_t next = TIME_MAX;
 
@@ -61,25 +139,46 @@ static timestamp_t check_expirations(void)
 	if (!wait_for_entry_until)
 		wait_for_entry_until = now + 30;
 
-	while (i < entries_nr) {
-		if (entries[i].expiration <= now) {
-			entries_nr--;
-			credential_clear(&entries[i].item);
-			if (i != entries_nr)
-				memcpy(&entries[i], &entries[entries_nr], sizeof(*entries));
-			/*
-			 * Stick around 30 seconds in case a new credential
-			 * shows up (e.g., because we just removed a failed
-			 * one, and we will soon get the correct one).
-			 */
-			wait_for_entry_until = now + 30;
+	for (g = hashmap_iter_first(&groups, &iter); g;
+	     g = hashmap_iter_next(&iter)) {
+		struct credential_cache_entry *entries = g->entries;
+		int i = 0;
+
+		while (i < g->entries_nr) {
+			if (entries[i].expiration <= now) {
+				g->entries_nr--;
+				entries_nr--;
+				credential_clear(&entries[i].item);
+				if (i != g->entries_nr)
+					memcpy(&entries[i], &entries[g->entries_nr],
+					       sizeof(*entries));
+				/*
+				 * Stick around 30 seconds in case a new credential
+				 * shows up (e.g., because we just removed a failed
+				 * one, and we will soon get the correct one).
+				 */
+				wait_for_entry_until = now + 30;
+			}
+			else {
+				if (entries[i].expiration < next)
+					next = entries[i].expiration;
+				i++;
+			}
 		}
-		else {
-			if (entries[i].expiration < next)
-				next = entries[i].expiration;
-			i++;
+		if (!g->entries_nr) {
+			ALLOC_GROW(empty, empty_nr + 1, empty_alloc);
+			empty[empty_nr++] = g;
 		}
 	}
+	while (empty_nr--) {
+		g = empty[empty_nr];
+		hashmap_remove(&groups, g, NULL);
+		free(g->protocol);
+		free(g->host);
+		free(g->entries);
+		free(g);
+	}
+	free(empty);
 
 	if (!entries_nr) {
 		if (wait_for_entry_until <= now)
@@ -90,34 +189,51 @@ static timestamp_t check_expirations(void)
 	return next - now;
 }
 
-static int read_request(FILE *fh, struct credential *c,
+static char *next_line(char **p)
+{
+	char *line = *p, *eol;
+
+	if (!*line)
+		return NULL;
+	eol = strchrnul(line, '\n');
+	if (*eol)
+		*eol++ = '\0';
+	*p = eol;
+	return line;
+}
+
+/* The client sends the whole request and then shuts down its end. */
+static int read_request(char *request, struct credential *c,
 			struct strbuf *action, int *timeout)
 {
-	static struct strbuf item = STRBUF_INIT;
+	char *line;
 	const char *p;
 
-	strbuf_getline_lf(&item, fh);
-	if (!skip_prefix(item.buf, "action=", &p))
-		return error("client sent bogus action line: %s", item.buf);
+	line = next_line(&request);
+	if (!line || !skip_prefix(line, "action=", &p))
+		return error("client sent bogus action line: %s",
+			     line ? line : "");
 	strbuf_addstr(action, p);
 
-	strbuf_getline_lf(&item, fh);
-	if (!skip_prefix(item.buf, "timeout=", &p))
-		return error("client sent bogus timeout line: %s", item.buf);
+	line = next_line(&request);
+	if (!line || !skip_prefix(line, "timeout=", &p))
+		return error("client sent bogus timeout line: %s",
+			     line ? line : "");
 	*timeout = atoi(p);
 
-	if (credential_read(c, fh) < 0)
-		return -1;
+	while ((line = next_line(&request)) && *line)
+		if (credential_read_item(c, line) < 0)
+			return -1;
 	return 0;
 }
 
-static void serve_one_client(FILE *in, FILE *out)
+static void serve_one_client(char *request, FILE *out)
 {
 	struct credential c = CREDENTIAL_INIT;
 	struct strbuf action = STRBUF_INIT;
 	int timeout = -1;
 
-	if (read_request(in, &c, &action, &timeout) < 0)
+	if (read_request(request, &c, &action, &timeout) < 0)
 		/* ignore error */ ;
 	else if (!strcmp(action.buf, "get")) {
 		struct credential_cache_entry *e = lookup_credential(&c);
@@ -156,45 +272,87 @@ static void serve_one_client(FILE *in, FILE *out)
 	strbuf_release(&action);
 }
 
+/*
+ * Clients whose request is still coming in. They are served as soon as
+ * their request is complete, so that a slow client does not hold up
+ * the others.
+ */
+struct cache_client {
+	int fd;
+	struct strbuf request;
+};
+static struct cache_client *clients;
+static int clients_nr, clients_alloc;
+
+static void accept_client(int fd)
+{
+	int client = accept(fd, NULL, NULL);
+
+	if (client < 0) {
+		warning_errno("accept failed");
+		return;
+	}
+	ALLOC_GROW(clients, clients_nr + 1, clients_alloc);
+	clients[clients_nr].fd = client;
+	strbuf_init(&clients[clients_nr].request, 0);
+	clients_nr++;
+}
+
+/* Read what client "i" sent; serve and drop it once it is done. */
+static void read_client(int i)
+{
+	struct cache_client *cl = &clients[i];
+	ssize_t n = strbuf_read_once(&cl->request, cl->fd, 0);
+
+	if (n > 0)
+		return;
+	if (!n) {
+		FILE *out = xfdopen(cl->fd, "w");
+
+		serve_one_client(cl->request.buf, out);
+		fclose(out);
+	} else {
+		warning_errno("read from cache client failed");
+		close(cl->fd);
+	}
+	strbuf_release(&cl->request);
+	clients[i] = clients[--clients_nr];
+}
+
 static int serve_cache_loop(int fd)
 {
-	struct pollfd pfd;
+	static struct pollfd *pfd;
+	static int pfd_alloc;
 	timestamp_t wakeup;
+	int i, nr;
 
 	wakeup = check_expirations();
-	if (!wakeup)
-		return 0;
+	if (!wakeup) {
+		if (!clients_nr)
+			return 0;
+		wakeup = 1;
+	}
 
-	pfd.fd = fd;
-	pfd.events = POLLIN;
-	if (poll(&pfd, 1, 1000 * wakeup) < 0) {
+	nr = clients_nr;
+	ALLOC_GROW(pfd, nr + 1, pfd_alloc);
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	for (i = 0; i < nr; i++) {
+		pfd[i + 1].fd = clients[i].fd;
+		pfd[i + 1].events = POLLIN;
+	}
+	if (poll(pfd, nr + 1, 1000 * wakeup) < 0) {
 		if (errno != EINTR)
 			die_errno("poll failed");
 		return 1;
 	}
 
-	if (pfd.revents & POLLIN) {
-		int client, client2;
-		FILE *in, *out;
-
-		client = accept(fd, NULL, NULL);
-		if (client < 0) {
-			warning_errno("accept failed");
-			return 1;
-		}
-		client2 = dup(client);
-		if (client2 < 0) {
-			warning_errno("dup failed");
-			close(client);
-			return 1;
-		}
-
-		in = xfdopen(client, "r");
-		out = xfdopen(client2, "w");
-		serve_one_client(in, out);
-		fclose(in);
-		fclose(out);
-	}
+	/* backwards, as a served client is replaced by the last one */
+	for (i = nr - 1; i >= 0; i--)
+		if (pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+			read_client(i);
+	if (pfd[0].revents & POLLIN)
+		accept_client(fd);
 	return 1;
 }
 
@@ -285,6 +443,7 @@ int cmd_main(int argc, const char **argv)
 		die("socket directory must be an absolute path");
 
 	init_socket_directory(socket_path);
+	hashmap_init(&groups, group_cmp, NULL, 0);
 	socket_file = register_tempfile(socket_path);
 
 	if (ignore_sighup)
@@ -142,49 +142,57 @@ static void credential_getpass(struct credential *c)
 						 PROMPT_ASKPASS);
 }
 
+int credential_read_item(struct credential *c, char *line)
+{
+	char *key = line;
+	char *value = strchr(key, '=');
+
+	if (!value) {
+		warning("invalid credential line: %s", key);
+		return -1;
+	}
+	*value++ = '\0';
+
+	if (!strcmp(key, "username")) {
+		free(c->username);
+		c->username = xstrdup(value);
+	} else if (!strcmp(key, "password")) {
+		free(c->password);
+		c->password = xstrdup(value);
+	} else if (!strcmp(key, "protocol")) {
+		free(c->protocol);
+		c->protocol = xstrdup(value);
+	} else if (!strcmp(key, "host")) {
+		free(c->host);
+		c->host = xstrdup(value);
+	} else if (!strcmp(key, "path")) {
+		free(c->path);
+		c->path = xstrdup(value);
+	} else if (!strcmp(key, "url")) {
+		credential_from_url(c, value);
+	} else if (!strcmp(key, "quit")) {
+		c->quit = !!git_config_bool("quit", value);
+	}
+	/*
+	 * Ignore other lines; we don't know what they mean, but
+	 * this future-proofs us when later versions of git do
+	 * learn new lines, and the helpers are updated to match.
+	 */
+	return 0;
+}
+
 int credential_read(struct credential *c, FILE *fp)
 {
 	struct strbuf line = STRBUF_INIT;
 
 	while (strbuf_getline_lf(&line, fp) != EOF) {
-		char *key = line.buf;
-		char *value = strchr(key, '=');
-
 		if (!line.len)
 			break;
 
-		if (!value) {
-			warning("invalid credential line: %s", key);
+		if (credential_read_item(c, line.buf) < 0) {
 			strbuf_release(&line);
 			return -1;
 		}
-		*value++ = '\0';
-
-		if (!strcmp(key, "username")) {
-			free(c->username);
-			c->username = xstrdup(value);
-		} else if (!strcmp(key, "password")) {
-			free(c->password);
-			c->password = xstrdup(value);
-		} else if (!strcmp(key, "protocol")) {
-			free(c->protocol);
-			c->protocol = xstrdup(value);
-		} else if (!strcmp(key, "host")) {
-			free(c->host);
-			c->host = xstrdup(value);
-		} else if (!strcmp(key, "path")) {
-			free(c->path);
-			c->path = xstrdup(value);
-		} else if (!strcmp(key, "url")) {
-			credential_from_url(c, value);
-		} else if (!strcmp(key, "quit")) {
-			c->quit = !!git_config_bool("quit", value);
-		}
-		/*
-		 * Ignore other lines; we don't know what they mean, but
-		 * this future-proofs us when later versions of git do
-		 * learn new lines, and the helpers are updated to match.
-		 */
 	}
 
 	strbuf_release(&line);
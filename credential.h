@@ -27,6 +27,12 @@ void credential_approve(struct credential *);
 void credential_reject(struct credential *);
 
 int credential_read(struct credential *, FILE *);
+/*
+ * Parse one "key=value" line of the helper protocol into the credential;
+ * the line is modified. Returns -1 (after a warning) if it is not such a
+ * line.
+ */
+int credential_read_item(struct credential *, char *line);
 void credential_write(const struct credential *, FILE *);
 void credential_from_url(struct credential *, const char *url);
 int credential_match(const struct credential *have,
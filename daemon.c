@@ -25,7 +25,7 @@ static const char daemon_usage[] =
 "           [--strict-paths] [--base-path=<path>] [--base-path-relaxed]\n"
 "           [--user-path | --user-path=<path>]\n"
 "           [--interpolated-path=<path>]\n"
-"           [--reuseaddr] [--pid-file=<file>]\n"
+"           [--reuseaddr] [--pid-file=<file>] [--no-reexec]\n"
 "           [--(enable|disable|allow-override|forbid-override)=<service>]\n"
 "           [--access-hook=<path>]\n"
 "           [--inetd | [--listen=<host_or_ipaddr>] [--port=<n>]\n"
@@ -893,6 +893,42 @@ static void check_dead_children(void)
 			cradle = &blanket->next;
 }
 
+struct socketlist {
+	int *list;
+	size_t nr;
+	size_t alloc;
+};
+
+static struct socketlist listen_sockets;
+static int no_reexec;
+
+/*
+ * With --no-reexec, serve the connection in a forked copy of the
+ * daemon, instead of starting a new "git daemon --serve" process for
+ * it; the daemon has already parsed the same options.
+ */
+static void NORETURN serve_forked(int incoming, const struct argv_array *env)
+{
+	int i;
+
+	for (i = 0; i < listen_sockets.nr; i++)
+		close(listen_sockets.list[i]);
+	signal(SIGCHLD, SIG_DFL);
+
+	if (dup2(incoming, 0) < 0 || dup2(incoming, 1) < 0)
+		die_errno("unable to dup connection");
+	if (incoming > 1)
+		close(incoming);
+	for (i = 0; i < env->argc; i++) {
+		const char *eq = strchr(env->argv[i], '=');
+		char *name = xmemdupz(env->argv[i], eq - env->argv[i]);
+
+		setenv(name, eq + 1, 1);
+		free(name);
+	}
+	exit(execute());
+}
+
 static struct argv_array cld_argv = ARGV_ARRAY_INIT;
 static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 {
@@ -927,6 +963,24 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 #endif
 	}
 
+	if (no_reexec) {
+		pid_t pid;
+
+		fflush(NULL);
+		pid = fork();
+		if (!pid)
+			serve_forked(incoming, &cld.env_array);
+		close(incoming);
+		if (pid < 0) {
+			logerror("unable to fork");
+			child_process_clear(&cld);
+			return;
+		}
+		cld.pid = pid;
+		add_child(&cld, addr, addrlen);
+		return;
+	}
+
 	cld.argv = cld_argv.argv;
 	cld.in = incoming;
 	cld.out = dup(incoming);
@@ -957,12 +1011,6 @@ static int set_reuse_addr(int sockfd)
 			  &on, sizeof(on));
 }
 
-struct socketlist {
-	int *list;
-	size_t nr;
-	size_t alloc;
-};
-
 static const char *ip2str(int family, struct sockaddr *sin, socklen_t len)
 {
 #ifdef NO_IPV6
@@ -1253,10 +1301,8 @@ static struct credentials *prepare_credentials(const char *user_name,
 static int serve(struct string_list *listen_addr, int listen_port,
     struct credentials *cred)
 {
-	struct socketlist socklist = { NULL, 0, 0 };
-
-	socksetup(listen_addr, listen_port, &socklist);
-	if (socklist.nr == 0)
+	socksetup(listen_addr, listen_port, &listen_sockets);
+	if (listen_sockets.nr == 0)
 		die("unable to allocate any listen sockets on port %u",
 		    listen_port);
 
@@ -1264,7 +1310,7 @@ static int serve(struct string_list *listen_addr, int listen_port,
 
 	loginfo("Ready to rumble");
 
-	return service_loop(&socklist);
+	return service_loop(&listen_sockets);
 }
 
 int cmd_main(int argc, const char **argv)
@@ -1381,6 +1427,10 @@ int cmd_main(int argc, const char **argv)
 			detach = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--no-reexec")) {
+			no_reexec = 1;
+			continue;
+		}
 		if (skip_prefix(arg, "--user=", &v)) {
 			user_name = v;
 			continue;
@@ -1441,6 +1491,11 @@ int cmd_main(int argc, const char **argv)
 	if (inetd_mode && (detach || group_name || user_name))
 		die("--detach, --user and --group are incompatible with --inetd");
 
+#ifdef NO_POSIX_GOODIES
+	if (no_reexec)
+		die("--no-reexec not supported on this platform");
+#endif
+
 	if (inetd_mode && (listen_port || (listen_addr.nr > 0)))
 		die("--listen= and --port= are incompatible with --inetd");
 	else if (listen_port == 0)
@@ -26,6 +26,12 @@ static kh_oid_map_t *island_marks;
 static unsigned island_counter;
 static unsigned island_counter_core;
 
+/*
+ * Set when the marks were taken from the bitmap index: they are then
+ * complete, and need not be propagated along the traversal.
+ */
+static int island_marks_complete;
+
 static kh_str_t *remote_islands;
 
 struct remote_island {
@@ -33,11 +39,22 @@ struct remote_island {
 	struct oid_array oids;
 };
 
+/* The islands left by deduplicate_islands(), by island number */
+static struct remote_island **island_list;
+static unsigned int island_list_nr;
+
 struct island_bitmap {
 	uint32_t refcount;
+	/* the number of its set of islands, while writing the bitmap */
+	uint32_t write_id;
 	uint32_t bits[FLEX_ARRAY];
 };
 
+#define island_ptr_hash(p) ((khint_t)((uintptr_t)(p) >> 4))
+#define island_ptr_equal(a, b) ((a) == (b))
+KHASH_INIT(island_copies, struct island_bitmap *, struct island_bitmap *, 1,
+	   island_ptr_hash, island_ptr_equal)
+
 static uint32_t island_bitmap_size;
 
 /*
@@ -53,6 +70,7 @@ static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
 		memcpy(b, old, size);
 
 	b->refcount = 1;
+	b->write_id = 0;
 	return b;
 }
 
@@ -248,7 +266,7 @@ void resolve_tree_islands(struct repository *r,
 	int nr = 0;
 	int i;
 
-	if (!island_marks)
+	if (!island_marks || island_marks_complete)
 		return;
 
 	/*
@@ -419,9 +437,9 @@ static struct remote_island *get_core_island(void)
 	return NULL;
 }
 
-static void deduplicate_islands(struct repository *r)
+static void deduplicate_islands(void)
 {
-	struct remote_island *island, *core = NULL, **list;
+	struct remote_island *island, **list;
 	unsigned int island_count, dst, src, ref, i = 0;
 
 	island_count = kh_size(remote_islands);
@@ -445,13 +463,266 @@ static void deduplicate_islands(struct repository *r)
 	}
 
 	island_bitmap_size = (island_count / 32) + 1;
-	core = get_core_island();
+	island_list = list;
+	island_list_nr = island_count;
+}
+
+static void mark_remote_islands(struct repository *r)
+{
+	struct remote_island *core = get_core_island();
+	unsigned int i;
+
+	for (i = 0; i < island_list_nr; ++i) {
+		mark_remote_island_1(r, island_list[i],
+				     core && island_list[i]->hash == core->hash);
+	}
+}
+
+struct stored_island {
+	uint64_t hash;
+	uint32_t nr;
+};
+
+static int stored_island_cmp(const void *va, const void *vb)
+{
+	const struct stored_island *a = va, *b = vb;
+
+	if (a->hash < b->hash)
+		return -1;
+	return a->hash > b->hash;
+}
+
+/*
+ * Whether the tips of "rl" all peel to commits that the traversal of
+ * pack-objects has not been told to leave out, so that what they reach
+ * can be found with the bitmaps without disturbing it.
+ */
+static int island_tips_are_commits(struct repository *r,
+				   struct remote_island *rl)
+{
+	uint32_t i;
+
+	for (i = 0; i < rl->oids.nr; i++) {
+		struct object *obj = parse_object(r, &rl->oids.oid[i]);
+
+		if (!obj)
+			continue;
+		obj = deref_tag(r, obj, NULL, 0);
+		if (!obj || obj->type != OBJ_COMMIT ||
+		    (obj->flags & UNINTERESTING))
+			return 0;
+	}
+	return 1;
+}
+
+struct add_island_data {
+	uint32_t island;
+	/* the marks of the objects in this island only */
+	struct island_bitmap *alone;
+	/* the copy of each shared set of marks, with this island added */
+	kh_island_copies_t *copies;
+};
+
+static void add_island_mark(const struct object_id *oid, void *data)
+{
+	struct add_island_data *d = data;
+	struct island_bitmap *old, *b;
+	khiter_t pos, copy_pos;
+	int hash_ret;
+
+	pos = kh_put_oid_map(island_marks, *oid, &hash_ret);
+	if (hash_ret) {
+		if (d->alone) {
+			d->alone->refcount++;
+		} else {
+			d->alone = island_bitmap_new(NULL);
+			island_bitmap_set(d->alone, d->island);
+		}
+		kh_value(island_marks, pos) = d->alone;
+		return;
+	}
+
+	old = kh_value(island_marks, pos);
+	if (island_bitmap_get(old, d->island))
+		return;
+	if (old->refcount == 1) {
+		island_bitmap_set(old, d->island);
+		return;
+	}
+
+	copy_pos = kh_put_island_copies(d->copies, old, &hash_ret);
+	if (hash_ret) {
+		b = island_bitmap_new(old);
+		island_bitmap_set(b, d->island);
+		kh_value(d->copies, copy_pos) = b;
+	} else {
+		b = kh_value(d->copies, copy_pos);
+		b->refcount++;
+	}
+	old->refcount--;
+	kh_value(island_marks, pos) = b;
+}
 
-	for (i = 0; i < island_count; ++i) {
-		mark_remote_island_1(r, list[i], core && list[i]->hash == core->hash);
+static void mark_island_from_bitmap(struct repository *r,
+				    struct bitmap_index *bitmap_git,
+				    struct remote_island *rl,
+				    struct add_island_data *data)
+{
+	struct bitmap *reachable = bitmap_new();
+	uint32_t i;
+
+	for (i = 0; i < rl->oids.nr; i++) {
+		struct object *obj = parse_object(r, &rl->oids.oid[i]);
+		struct bitmap *tip;
+
+		if (!obj)
+			continue;
+		/* the tags themselves are not in what the commit reaches */
+		while (obj && obj->type == OBJ_TAG) {
+			add_island_mark(&obj->oid, data);
+			obj = ((struct tag *)obj)->tagged;
+			if (obj)
+				obj = parse_object(r, &obj->oid);
+		}
+		if (!obj || obj->type != OBJ_COMMIT)
+			continue;
+		tip = bitmap_objects_reachable_from(r, bitmap_git,
+						    (struct commit *)obj);
+		bitmap_or(reachable, tip);
+		bitmap_free(tip);
 	}
 
-	free(list);
+	bitmap_for_each_object(bitmap_git, reachable, add_island_mark, data);
+	bitmap_free(reachable);
+}
+
+/*
+ * Take the marks of the islands whose refs did not change since the
+ * bitmaps were written from the bitmap index, and find what the other
+ * islands reach with the bitmaps. Either way, there is then no need to
+ * propagate the marks over every commit and tree of the traversal.
+ * Return 0, having marked nothing, if the bitmap index cannot help.
+ */
+static int load_island_marks_from_bitmap(struct repository *r)
+{
+	struct bitmap_index *bitmap_git = prepare_bitmap_git(r);
+	const struct bitmap_islands *stored;
+	struct stored_island *by_hash;
+	struct island_bitmap **sets;
+	struct remote_island *core = get_core_island();
+	uint32_t *current, i, j, reused = 0;
+	int ret = 0;
+
+	if (!bitmap_git)
+		return 0;
+	stored = bitmap_get_islands(bitmap_git);
+	if (!stored) {
+		free_bitmap_index(bitmap_git);
+		return 0;
+	}
+
+	ALLOC_ARRAY(by_hash, stored->islands_nr);
+	for (j = 0; j < stored->islands_nr; j++) {
+		by_hash[j].hash = get_be64(stored->hashes + j * sizeof(uint64_t));
+		by_hash[j].nr = j;
+	}
+	QSORT(by_hash, stored->islands_nr, stored_island_cmp);
+
+	/* the island number, now, of each stored island that is still here */
+	ALLOC_ARRAY(current, stored->islands_nr);
+	for (j = 0; j < stored->islands_nr; j++)
+		current[j] = island_list_nr;
+	for (i = 0; i < island_list_nr; i++) {
+		struct stored_island key, *found;
+
+		key.hash = island_list[i]->hash;
+		found = bsearch(&key, by_hash, stored->islands_nr,
+				sizeof(*by_hash), stored_island_cmp);
+		if (found) {
+			current[found->nr] = i;
+			reused++;
+		} else if (!island_tips_are_commits(r, island_list[i])) {
+			goto out;
+		}
+	}
+
+	CALLOC_ARRAY(sets, stored->sets_nr);
+	for (i = 0; i < stored->sets_nr; i++) {
+		const unsigned char *words = stored->sets +
+			st_mult(st_mult(i, stored->words), sizeof(uint32_t));
+
+		for (j = 0; j < stored->islands_nr; j++) {
+			uint32_t word = get_be32(words + (j / 32) * sizeof(uint32_t));
+
+			if (!(word & (1u << (j % 32))) ||
+			    current[j] == island_list_nr)
+				continue;
+			if (!sets[i])
+				sets[i] = island_bitmap_new(NULL);
+			island_bitmap_set(sets[i], current[j]);
+		}
+	}
+
+	for (i = 0; i < stored->objects_nr; i++) {
+		uint32_t set = get_be32(stored->object_sets + i * sizeof(uint32_t));
+		struct object_id oid;
+		khiter_t pos;
+		int hash_ret;
+
+		if (set == BITMAP_NO_ISLANDS || !sets[set])
+			continue;
+		bitmap_object_oid(bitmap_git, i, &oid);
+		pos = kh_put_oid_map(island_marks, oid, &hash_ret);
+		sets[set]->refcount++;
+		kh_value(island_marks, pos) = sets[set];
+	}
+
+	/* drop our own reference, freeing the sets no object is in */
+	for (i = 0; i < stored->sets_nr; i++) {
+		if (sets[i] && !--sets[i]->refcount)
+			free(sets[i]);
+	}
+	free(sets);
+
+	for (i = 0; i < island_list_nr; i++) {
+		struct remote_island *rl = island_list[i];
+
+		if (core && rl->hash == core->hash) {
+			for (j = 0; j < rl->oids.nr; j++) {
+				struct object *obj = parse_object(r, &rl->oids.oid[j]);
+
+				if (obj && obj->type == OBJ_COMMIT)
+					obj->flags |= NEEDS_BITMAP;
+			}
+			island_counter_core = i;
+		}
+	}
+
+	for (i = 0; i < island_list_nr; i++) {
+		struct add_island_data data = { 0 };
+		struct stored_island key;
+
+		key.hash = island_list[i]->hash;
+		if (bsearch(&key, by_hash, stored->islands_nr,
+			    sizeof(*by_hash), stored_island_cmp))
+			continue;
+
+		data.island = i;
+		data.copies = kh_init_island_copies();
+		mark_island_from_bitmap(r, bitmap_git, island_list[i], &data);
+		kh_destroy_island_copies(data.copies);
+	}
+
+	island_counter = island_list_nr;
+	island_marks_complete = 1;
+	trace2_data_intmax("delta-islands", r, "reused", reused);
+	ret = 1;
+
+out:
+	free(current);
+	free(by_hash);
+	free_bitmap_index(bitmap_git);
+	return ret;
 }
 
 void load_delta_islands(struct repository *r, int progress)
@@ -461,7 +732,9 @@ void load_delta_islands(struct repository *r, int progress)
 
 	git_config(island_config_callback, NULL);
 	for_each_ref(find_island_for_ref, NULL);
-	deduplicate_islands(r);
+	deduplicate_islands();
+	if (!island_list_nr || !load_island_marks_from_bitmap(r))
+		mark_remote_islands(r);
 
 	if (progress)
 		fprintf(stderr, _("Marked %d islands, done.\n"), island_counter);
@@ -469,8 +742,12 @@ void load_delta_islands(struct repository *r, int progress)
 
 void propagate_island_marks(struct commit *commit)
 {
-	khiter_t pos = kh_get_oid_map(island_marks, commit->object.oid);
+	khiter_t pos;
 
+	if (island_marks_complete)
+		return;
+
+	pos = kh_get_oid_map(island_marks, commit->object.oid);
 	if (pos < kh_end(island_marks)) {
 		struct commit_list *p;
 		struct island_bitmap *root_marks = kh_value(island_marks, pos);
@@ -505,3 +782,92 @@ int compute_pack_layers(struct packing_data *to_pack)
 
 	return 2;
 }
+
+static int island_bitmap_cmp(const void *va, const void *vb)
+{
+	struct island_bitmap *a = *(struct island_bitmap **)va;
+	struct island_bitmap *b = *(struct island_bitmap **)vb;
+
+	return memcmp(a->bits, b->bits, island_bitmap_size * sizeof(uint32_t));
+}
+
+void write_island_marks(struct packing_data *to_pack,
+			struct pack_idx_entry **index, uint32_t index_nr,
+			struct strbuf *out)
+{
+	struct island_bitmap **sets = NULL;
+	uint32_t *object_sets;
+	uint32_t sets_nr = 0, sets_alloc = 0, i, j, id;
+	unsigned char buf[8];
+
+	if (!island_marks || !island_list_nr)
+		return;
+
+	/* number each distinct set of marks, as sets_nr + 1 for a start */
+	for (i = 0; i < index_nr; i++) {
+		struct object_entry *entry = (struct object_entry *)index[i];
+		khiter_t pos = kh_get_oid_map(island_marks, entry->idx.oid);
+		struct island_bitmap *b;
+
+		if (pos >= kh_end(island_marks))
+			continue;
+		b = kh_value(island_marks, pos);
+		if (b->write_id)
+			continue;
+		ALLOC_GROW(sets, sets_nr + 1, sets_alloc);
+		sets[sets_nr++] = b;
+		b->write_id = sets_nr;
+	}
+
+	/* copies of the same marks get the same number */
+	QSORT(sets, sets_nr, island_bitmap_cmp);
+	for (i = 0, id = 0; i < sets_nr; i++) {
+		if (i && island_bitmap_cmp(&sets[i - 1], &sets[i]))
+			id++;
+		sets[i]->write_id = id + 1;
+	}
+
+	put_be32(buf, island_list_nr);
+	strbuf_add(out, buf, 4);
+	for (i = 0; i < island_list_nr; i++) {
+		put_be64(buf, island_list[i]->hash);
+		strbuf_add(out, buf, 8);
+	}
+
+	put_be32(buf, sets_nr ? id + 1 : 0);
+	strbuf_add(out, buf, 4);
+	put_be32(buf, island_bitmap_size);
+	strbuf_add(out, buf, 4);
+	for (i = 0; i < sets_nr; i++) {
+		if (i && sets[i]->write_id == sets[i - 1]->write_id)
+			continue;
+		for (j = 0; j < island_bitmap_size; j++) {
+			put_be32(buf, sets[i]->bits[j]);
+			strbuf_add(out, buf, 4);
+		}
+	}
+
+	/* "index" is in name order by now; the bitmaps go by pack order */
+	ALLOC_ARRAY(object_sets, index_nr);
+	for (i = 0; i < index_nr; i++) {
+		struct object_entry *entry = (struct object_entry *)index[i];
+		khiter_t pos = kh_get_oid_map(island_marks, entry->idx.oid);
+		struct island_bitmap *b;
+		uint32_t set = BITMAP_NO_ISLANDS;
+
+		if (pos < kh_end(island_marks)) {
+			b = kh_value(island_marks, pos);
+			set = b->write_id - 1;
+		}
+		object_sets[oe_in_pack_pos(to_pack, entry)] = set;
+	}
+	for (i = 0; i < index_nr; i++) {
+		put_be32(buf, object_sets[i]);
+		strbuf_add(out, buf, 4);
+	}
+
+	for (i = 0; i < sets_nr; i++)
+		sets[i]->write_id = 0;
+	free(object_sets);
+	free(sets);
+}
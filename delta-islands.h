@@ -3,8 +3,10 @@
 
 struct commit;
 struct object_id;
+struct pack_idx_entry;
 struct packing_data;
 struct repository;
+struct strbuf;
 
 int island_delta_cmp(const struct object_id *a, const struct object_id *b);
 int in_same_island(const struct object_id *, const struct object_id *);
@@ -15,4 +17,13 @@ void load_delta_islands(struct repository *r, int progress);
 void propagate_island_marks(struct commit *commit);
 int compute_pack_layers(struct packing_data *to_pack);
 
+/*
+ * Append the island marks of the objects of "index", for the bitmap of
+ * the pack they are written to (see BITMAP_OPT_ISLANDS). Nothing is
+ * appended if there are no islands.
+ */
+void write_island_marks(struct packing_data *to_pack,
+			struct pack_idx_entry **index, uint32_t index_nr,
+			struct strbuf *out);
+
 #endif /* DELTA_ISLANDS_H */
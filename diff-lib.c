@@ -13,6 +13,8 @@
 #include "submodule.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "config.h"
+#include "string-list.h"
 
 /*
  * diff-files
@@ -57,6 +59,30 @@ static int check_removed(const struct cache_entry *ce, struct stat *st)
 	return 0;
 }
 
+/*
+ * Returns -1 when the submodule "ce" is to be ignored altogether, 1 when
+ * the caller needs to know whether its work tree is dirty, given whether
+ * its commit "changed", and 0 otherwise.
+ */
+static int want_dirty_submodule(struct diff_options *diffopt,
+				const struct cache_entry *ce, int changed,
+				int *ignore_untracked)
+{
+	struct diff_flags orig_flags = diffopt->flags;
+	int ret = 0;
+
+	if (!diffopt->flags.override_submodule_config)
+		set_diffopt_flags_from_submodule_config(diffopt, ce->name);
+	if (diffopt->flags.ignore_submodules)
+		ret = -1;
+	else if (!diffopt->flags.ignore_dirty_submodules &&
+		 (!changed || diffopt->flags.dirty_submodules))
+		ret = 1;
+	*ignore_untracked = diffopt->flags.ignore_untracked_in_submodules;
+	diffopt->flags = orig_flags;
+	return ret;
+}
+
 /*
  * Has a file changed or has a submodule new commits or a dirty work tree?
  *
@@ -64,28 +90,113 @@ static int check_removed(const struct cache_entry *ce, struct stat *st)
  * option is set, the caller does not only want to know if a submodule is
  * modified at all but wants to know all the conditions that are met (new
  * commits, untracked content and/or modified content).
+ *
+ * The work trees of the submodules in "submodule_status", if any, have
+ * already been looked at by get_submodules_status().
  */
 static int match_stat_with_submodule(struct diff_options *diffopt,
 				     const struct cache_entry *ce,
 				     struct stat *st, unsigned ce_option,
-				     unsigned *dirty_submodule)
+				     unsigned *dirty_submodule,
+				     struct string_list *submodule_status)
 {
 	int changed = ie_match_stat(diffopt->repo->index, ce, st, ce_option);
 	if (S_ISGITLINK(ce->ce_mode)) {
-		struct diff_flags orig_flags = diffopt->flags;
-		if (!diffopt->flags.override_submodule_config)
-			set_diffopt_flags_from_submodule_config(diffopt, ce->name);
-		if (diffopt->flags.ignore_submodules)
+		struct string_list_item *item = NULL;
+		int ignore_untracked;
+
+		switch (want_dirty_submodule(diffopt, ce, changed,
+					     &ignore_untracked)) {
+		case -1:
 			changed = 0;
-		else if (!diffopt->flags.ignore_dirty_submodules &&
-			 (!changed || diffopt->flags.dirty_submodules))
-			*dirty_submodule = is_submodule_modified(ce->name,
-								 diffopt->flags.ignore_untracked_in_submodules);
-		diffopt->flags = orig_flags;
+			break;
+		case 1:
+			if (submodule_status)
+				item = string_list_lookup(submodule_status,
+							  ce->name);
+			if (item)
+				*dirty_submodule =
+					((struct submodule_status *)item->util)->dirty;
+			else
+				*dirty_submodule =
+					is_submodule_modified(ce->name,
+							      ignore_untracked);
+			break;
+		}
 	}
 	return changed;
 }
 
+static int submodule_diff_jobs(struct repository *r)
+{
+	int jobs = 0;
+
+	repo_config_get_int(r, "submodule.diffjobs", &jobs);
+	if (jobs < 0)
+		die(_("negative values not allowed for submodule.diffJobs"));
+	return jobs;
+}
+
+/*
+ * Ask all the submodules run_diff_files() is going to look at whether
+ * their work tree is dirty up front, so that several of them can run
+ * "git status" at the same time.
+ */
+static void get_submodule_status_in_parallel(struct rev_info *revs,
+					     unsigned ce_option,
+					     struct string_list *status)
+{
+	struct index_state *istate = revs->diffopt.repo->index;
+	int jobs, i;
+
+	/* not worth it when the first change ends the diff */
+	if (revs->diffopt.flags.quick)
+		return;
+	jobs = submodule_diff_jobs(revs->diffopt.repo);
+	if (jobs == 1)
+		return;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		struct submodule_status *ss;
+		struct stat st;
+		int changed, ignore_untracked;
+
+		if (!S_ISGITLINK(ce->ce_mode) || ce_stage(ce) ||
+		    ce_uptodate(ce) || ce_skip_worktree(ce) ||
+		    (ce->ce_flags & CE_VALID) ||
+		    !ce_path_match(istate, ce, &revs->prune_data, NULL) ||
+		    check_removed(ce, &st))
+			continue;
+		changed = ie_match_stat(istate, ce, &st, ce_option);
+		if (want_dirty_submodule(&revs->diffopt, ce, changed,
+					 &ignore_untracked) <= 0)
+			continue;
+
+		ss = xcalloc(1, sizeof(*ss));
+		ss->ignore_untracked = ignore_untracked;
+		string_list_append(status, ce->name)->util = ss;
+	}
+
+	if (status->nr > 1)
+		get_submodules_status(status, jobs);
+	else
+		string_list_clear(status, 1);
+}
+
+/*
+ * The fsmonitor hook reported no change to this path since the index
+ * was last written, so there is no need to lstat() it again. Submodules
+ * are still asked whether their work tree is dirty.
+ */
+static int fsmonitor_valid(struct index_state *istate,
+			   const struct cache_entry *ce)
+{
+	refresh_fsmonitor(istate);
+	return (ce->ce_flags & CE_FSMONITOR_VALID) &&
+	       !S_ISGITLINK(ce->ce_mode) && !ce_intent_to_add(ce);
+}
+
 int run_diff_files(struct rev_info *revs, unsigned int option)
 {
 	int entries, i;
@@ -94,11 +205,13 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 			      ? CE_MATCH_RACY_IS_DIRTY : 0);
 	uint64_t start = getnanotime();
 	struct index_state *istate = revs->diffopt.repo->index;
+	struct string_list submodule_status = STRING_LIST_INIT_DUP;
 
 	diff_set_mnemonic_prefix(&revs->diffopt, "i/", "w/");
 
 	if (diff_unmerged_stage < 0)
 		diff_unmerged_stage = 2;
+	get_submodule_status_in_parallel(revs, ce_option, &submodule_status);
 	entries = istate->cache_nr;
 	for (i = 0; i < entries; i++) {
 		unsigned int oldmode, newmode;
@@ -199,8 +312,11 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 		if (ce_uptodate(ce) || ce_skip_worktree(ce))
 			continue;
 
-		/* If CE_VALID is set, don't look at workdir for file removal */
-		if (ce->ce_flags & CE_VALID) {
+		/*
+		 * If CE_VALID is set, or fsmonitor vouches for the entry,
+		 * don't look at workdir for file removal
+		 */
+		if ((ce->ce_flags & CE_VALID) || fsmonitor_valid(istate, ce)) {
 			changed = 0;
 			newmode = ce->ce_mode;
 		} else {
@@ -226,7 +342,8 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 			}
 
 			changed = match_stat_with_submodule(&revs->diffopt, ce, &st,
-							    ce_option, &dirty_submodule);
+							    ce_option, &dirty_submodule,
+							    &submodule_status);
 			newmode = ce_mode_from_stat(ce, st.st_mode);
 		}
 
@@ -246,6 +363,7 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 			    ce->name, 0, dirty_submodule);
 
 	}
+	string_list_clear(&submodule_status, 1);
 	diffcore_std(&revs->diffopt);
 	diff_flush(&revs->diffopt);
 	trace_performance_since(start, "diff-files");
@@ -277,7 +395,8 @@ static int get_stat_data(const struct cache_entry *ce,
 	const struct object_id *oid = &ce->oid;
 	unsigned int mode = ce->ce_mode;
 
-	if (!cached && !ce_uptodate(ce)) {
+	if (!cached && !ce_uptodate(ce) &&
+	    !fsmonitor_valid(diffopt->repo->index, ce)) {
 		int changed;
 		struct stat st;
 		changed = check_removed(ce, &st);
@@ -292,7 +411,7 @@ static int get_stat_data(const struct cache_entry *ce,
 			return -1;
 		}
 		changed = match_stat_with_submodule(diffopt, ce, &st,
-						    0, dirty_submodule);
+						    0, dirty_submodule, NULL);
 		if (changed) {
 			mode = ce_mode_from_stat(ce, st.st_mode);
 			oid = &null_oid;
@@ -444,6 +563,28 @@ static void do_oneway_diff(struct unpack_trees_options *o,
 	show_modified(revs, tree, idx, 1, cached, match_missing);
 }
 
+/*
+ * The index has a sparse directory entry where the tree has "tree"
+ * (or nothing): diff the two trees, paths inside them are what the
+ * pathspec is matched against.
+ */
+static void show_sparse_directory(struct rev_info *revs,
+				  const struct cache_entry *tree,
+				  const struct cache_entry *idx)
+{
+	struct pathspec pathspec = revs->diffopt.pathspec;
+	int recursive = revs->diffopt.flags.recursive;
+
+	if (tree && oideq(&tree->oid, &idx->oid))
+		return;
+	revs->diffopt.pathspec = revs->prune_data;
+	revs->diffopt.flags.recursive = 1;
+	diff_tree_oid(tree ? &tree->oid : NULL, &idx->oid, idx->name,
+		      &revs->diffopt);
+	revs->diffopt.flags.recursive = recursive;
+	revs->diffopt.pathspec = pathspec;
+}
+
 /*
  * The unpack_trees() interface is designed for merging, so
  * the different source entries are designed primarily for
@@ -475,16 +616,19 @@ static int oneway_diff(const struct cache_entry * const *src,
 	if (tree == o->df_conflict_entry)
 		tree = NULL;
 
-	if (ce_path_match(revs->diffopt.repo->index,
-			  idx ? idx : tree,
-			  &revs->prune_data, NULL)) {
+	if (idx && S_ISSPARSEDIR(idx->ce_mode))
+		show_sparse_directory(revs, tree, idx);
+	else if (ce_path_match(revs->diffopt.repo->index,
+			       idx ? idx : tree,
+			       &revs->prune_data, NULL))
 		do_oneway_diff(o, idx, tree);
-		if (diff_can_quit_early(&revs->diffopt)) {
-			o->exiting_early = 1;
-			return -1;
-		}
-	}
+	else
+		return 0;
 
+	if (diff_can_quit_early(&revs->diffopt)) {
+		o->exiting_early = 1;
+		return -1;
+	}
 	return 0;
 }
 
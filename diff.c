@@ -26,6 +26,7 @@
 #include "parse-options.h"
 #include "help.h"
 #include "fetch-object.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -2142,6 +2143,7 @@ static void diff_words_show(struct diff_words_data *diff_words)
 	diff_words_fill(&diff_words->minus, &minus, diff_words->word_regex);
 	diff_words_fill(&diff_words->plus, &plus, diff_words->word_regex);
 	xpp.flags = 0;
+	xpp.cache = opt->xdl_cache;
 	/* as only the hunk header will be parsed, we need a 0-context */
 	xecfg.ctxlen = 0;
 	if (xdi_diff_outf(&minus, &plus, fn_out_diff_words_aux, NULL,
@@ -2528,15 +2530,79 @@ static struct diffstat_file *diffstat_add(struct diffstat_t *diffstat,
 	return x;
 }
 
-static void diffstat_consume(void *priv, char *line, unsigned long len)
+/*
+ * The line counts of the diffs made for --stat and the like, by pair of
+ * blobs, as the same pair comes up again: the same change picked onto
+ * several branches, a merge shown against its parents, --follow and -M
+ * looking at a pair before it is shown. They are only good for the
+ * diff options they were made with, so start over when those change.
+ */
+struct diffstat_count {
+	struct hashmap_entry ent;
+	struct object_id one, two;
+	long added, deleted;
+};
+
+/* Start over beyond that many pairs. */
+#define DIFFSTAT_COUNTS_MAX (1 << 16)
+
+static struct hashmap diffstat_counts;
+static unsigned long diffstat_counts_flags;
+static long diffstat_counts_ctxlen, diffstat_counts_interhunk;
+
+static int diffstat_count_cmp(const void *unused_cmp_data,
+			      const void *entry,
+			      const void *entry_or_key,
+			      const void *unused_keydata)
 {
-	struct diffstat_t *diffstat = priv;
-	struct diffstat_file *x = diffstat->files[diffstat->nr - 1];
+	const struct diffstat_count *e1 = entry;
+	const struct diffstat_count *e2 = entry_or_key;
 
-	if (line[0] == '+')
-		x->added++;
-	else if (line[0] == '-')
-		x->deleted++;
+	return !oideq(&e1->one, &e2->one) || !oideq(&e1->two, &e2->two);
+}
+
+static struct diffstat_count *find_diffstat_count(struct diff_filespec *one,
+						  struct diff_filespec *two,
+						  xpparam_t *xpp,
+						  xdemitconf_t *xecfg)
+{
+	struct diffstat_count key;
+
+	if (!one->oid_valid || !two->oid_valid || xpp->anchors_nr)
+		return NULL;
+	if (!diffstat_counts.tablesize ||
+	    hashmap_get_size(&diffstat_counts) >= DIFFSTAT_COUNTS_MAX ||
+	    diffstat_counts_flags != xpp->flags ||
+	    diffstat_counts_ctxlen != xecfg->ctxlen ||
+	    diffstat_counts_interhunk != xecfg->interhunkctxlen) {
+		hashmap_free(&diffstat_counts, 1);
+		hashmap_init(&diffstat_counts, diffstat_count_cmp, NULL, 0);
+		diffstat_counts_flags = xpp->flags;
+		diffstat_counts_ctxlen = xecfg->ctxlen;
+		diffstat_counts_interhunk = xecfg->interhunkctxlen;
+		return NULL;
+	}
+	hashmap_entry_init(&key, oidhash(&one->oid) + 31 * oidhash(&two->oid));
+	oidcpy(&key.one, &one->oid);
+	oidcpy(&key.two, &two->oid);
+	return hashmap_get(&diffstat_counts, &key, NULL);
+}
+
+static void add_diffstat_count(struct diff_filespec *one,
+			       struct diff_filespec *two,
+			       xpparam_t *xpp, long added, long deleted)
+{
+	struct diffstat_count *c;
+
+	if (!one->oid_valid || !two->oid_valid || xpp->anchors_nr)
+		return;
+	c = xmalloc(sizeof(*c));
+	hashmap_entry_init(c, oidhash(&one->oid) + 31 * oidhash(&two->oid));
+	oidcpy(&c->one, &one->oid);
+	oidcpy(&c->two, &two->oid);
+	c->added = added;
+	c->deleted = deleted;
+	hashmap_add(&diffstat_counts, c);
 }
 
 const char mime_boundary_leader[] = "------------";
@@ -3583,6 +3649,7 @@ static void builtin_diff(const char *name_a,
 		xpp.flags = o->xdl_opts;
 		xpp.anchors = o->anchors;
 		xpp.anchors_nr = o->anchors_nr;
+		xpp.cache = o->xdl_cache;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
 		xecfg.flags = XDL_EMIT_FUNCNAMES;
@@ -3700,10 +3767,8 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		/* Crazy xdl interfaces.. */
 		xpparam_t xpp;
 		xdemitconf_t xecfg;
-
-		if (fill_mmfile(o->repo, &mf1, one) < 0 ||
-		    fill_mmfile(o->repo, &mf2, two) < 0)
-			die("unable to read files to diff");
+		struct diffstat_count *count;
+		long added, deleted;
 
 		memset(&xpp, 0, sizeof(xpp));
 		memset(&xecfg, 0, sizeof(xecfg));
@@ -3712,9 +3777,22 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		xpp.anchors_nr = o->anchors_nr;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
-		if (xdi_diff_outf(&mf1, &mf2, discard_hunk_line,
-				  diffstat_consume, diffstat, &xpp, &xecfg))
-			die("unable to generate diffstat for %s", one->path);
+
+		count = find_diffstat_count(one, two, &xpp, &xecfg);
+		if (count) {
+			added = count->added;
+			deleted = count->deleted;
+		} else {
+			if (fill_mmfile(o->repo, &mf1, one) < 0 ||
+			    fill_mmfile(o->repo, &mf2, two) < 0)
+				die("unable to read files to diff");
+			if (xdi_diff_count(&mf1, &mf2, &xpp, &xecfg,
+					   &deleted, &added))
+				die("unable to generate diffstat for %s", one->path);
+			add_diffstat_count(one, two, &xpp, added, deleted);
+		}
+		data->added = added;
+		data->deleted = deleted;
 	}
 
 	diff_free_filespec_data(one);
@@ -3791,11 +3869,66 @@ static void builtin_checkdiff(const char *name_a, const char *name_b,
 		o->flags.check_failed = 1;
 }
 
+/*
+ * Something that is never freed keeps the pool from being rewound;
+ * past this size, fall back to malloc() rather than keep growing it.
+ */
+#define DIFF_POOL_MAX (16 * 1024 * 1024)
+
+static struct mem_pool *diff_pool;
+static int diff_pool_depth;
+static unsigned long diff_pool_live;
+#ifndef NO_PTHREADS
+static pthread_t diff_pool_owner;
+#endif
+
+void diff_pool_begin(void)
+{
+	if (diff_pool_depth++)
+		return;
+	mem_pool_init(&diff_pool, 0);
+#ifndef NO_PTHREADS
+	diff_pool_owner = pthread_self();
+#endif
+}
+
+void diff_pool_end(void)
+{
+	diff_pool_depth--;
+}
+
+static void *diff_pool_calloc(size_t size)
+{
+	if (!diff_pool_depth || diff_pool->pool_alloc > DIFF_POOL_MAX)
+		return NULL;
+#ifndef NO_PTHREADS
+	/* the threads that prepare patches queue their own pairs */
+	if (!pthread_equal(diff_pool_owner, pthread_self()))
+		return NULL;
+#endif
+	diff_pool_live++;
+	return mem_pool_calloc(diff_pool, 1, size);
+}
+
+static void diff_pool_release(void)
+{
+	if (!--diff_pool_live)
+		mem_pool_reset(diff_pool);
+}
+
 struct diff_filespec *alloc_filespec(const char *path)
 {
 	struct diff_filespec *spec;
+	size_t len = strlen(path);
 
-	FLEXPTR_ALLOC_STR(spec, path, path);
+	spec = diff_pool_calloc(st_add3(sizeof(*spec), len, 1));
+	if (spec) {
+		spec->path = (char *)(spec + 1);
+		memcpy(spec->path, path, len);
+		spec->pooled = 1;
+	} else {
+		FLEXPTR_ALLOC_MEM(spec, path, path, len);
+	}
 	spec->count = 1;
 	spec->is_binary = -1;
 	return spec;
@@ -3805,7 +3938,10 @@ void free_filespec(struct diff_filespec *spec)
 {
 	if (!--spec->count) {
 		diff_free_filespec_data(spec);
-		free(spec);
+		if (spec->pooled)
+			diff_pool_release();
+		else
+			free(spec);
 	}
 }
 
@@ -4061,7 +4197,8 @@ void diff_free_filespec_blob(struct diff_filespec *s)
 void diff_free_filespec_data(struct diff_filespec *s)
 {
 	diff_free_filespec_blob(s);
-	FREE_AND_NULL(s->cnt_data);
+	diffcore_free_count(s->cnt_data);
+	s->cnt_data = NULL;
 }
 
 static void prep_temp_blob(struct index_state *istate,
@@ -4224,12 +4361,14 @@ static int similarity_index(struct diff_filepair *p)
 	return p->score * 100 / MAX_SCORE;
 }
 
-static const char *diff_abbrev_oid(const struct object_id *oid, int abbrev)
+static const char *diff_abbrev_oid(char *hex, const struct object_id *oid,
+				   int abbrev)
 {
-	if (startup_info->have_repository)
-		return find_unique_abbrev(oid, abbrev);
-	else {
-		char *hex = oid_to_hex(oid);
+	if (startup_info->have_repository) {
+		find_unique_abbrev_r(hex, oid, abbrev);
+		return hex;
+	} else {
+		oid_to_hex_r(hex, oid);
 		if (abbrev < 0)
 			abbrev = FALLBACK_DEFAULT_ABBREV;
 		if (abbrev > the_hash_algo->hexsz)
@@ -4292,6 +4431,7 @@ static void fill_metainfo(struct strbuf *msg,
 	if (one && two && !oideq(&one->oid, &two->oid)) {
 		const unsigned hexsz = the_hash_algo->hexsz;
 		int abbrev = o->flags.full_index ? hexsz : DEFAULT_ABBREV;
+		char one_hex[GIT_MAX_HEXSZ + 1], two_hex[GIT_MAX_HEXSZ + 1];
 
 		if (o->flags.binary) {
 			mmfile_t mf;
@@ -4302,8 +4442,8 @@ static void fill_metainfo(struct strbuf *msg,
 				abbrev = hexsz;
 		}
 		strbuf_addf(msg, "%s%sindex %s..%s", line_prefix, set,
-			    diff_abbrev_oid(&one->oid, abbrev),
-			    diff_abbrev_oid(&two->oid, abbrev));
+			    diff_abbrev_oid(one_hex, &one->oid, abbrev),
+			    diff_abbrev_oid(two_hex, &two->oid, abbrev));
 		if (one->mode == two->mode)
 			strbuf_addf(msg, " %06o", one->mode);
 		strbuf_addf(msg, "%s\n", reset);
@@ -4429,13 +4569,13 @@ static void run_diff(struct diff_filepair *p, struct diff_options *o)
 		run_diff_cmd(NULL, name, other, attr_path,
 			     one, null, &msg,
 			     o, p);
-		free(null);
+		free_filespec(null);
 		strbuf_release(&msg);
 
 		null = alloc_filespec(one->path);
 		run_diff_cmd(NULL, name, other, attr_path,
 			     null, two, &msg, o, p);
-		free(null);
+		free_filespec(null);
 	}
 	else
 		run_diff_cmd(pgm, name, other, attr_path,
@@ -5593,7 +5733,12 @@ struct diff_filepair *diff_queue(struct diff_queue_struct *queue,
 				 struct diff_filespec *one,
 				 struct diff_filespec *two)
 {
-	struct diff_filepair *dp = xcalloc(1, sizeof(*dp));
+	struct diff_filepair *dp = diff_pool_calloc(sizeof(*dp));
+
+	if (dp)
+		dp->pooled = 1;
+	else
+		dp = xcalloc(1, sizeof(*dp));
 	dp->one = one;
 	dp->two = two;
 	if (queue)
@@ -5605,11 +5750,20 @@ void diff_free_filepair(struct diff_filepair *p)
 {
 	free_filespec(p->one);
 	free_filespec(p->two);
-	free(p);
+	diff_free_filepair_only(p);
+}
+
+void diff_free_filepair_only(struct diff_filepair *p)
+{
+	if (p->pooled)
+		diff_pool_release();
+	else
+		free(p);
 }
 
 const char *diff_aligned_abbrev(const struct object_id *oid, int len)
 {
+	static char abbrev_hex[GIT_MAX_HEXSZ + 1];
 	int abblen;
 	const char *abbrev;
 
@@ -5618,7 +5772,7 @@ const char *diff_aligned_abbrev(const struct object_id *oid, int len)
 		return oid_to_hex(oid);
 
 	/* An abbreviated value is fine, possibly followed by an ellipsis. */
-	abbrev = diff_abbrev_oid(oid, len);
+	abbrev = diff_abbrev_oid(abbrev_hex, oid, len);
 
 	if (!print_sha1_ellipsis())
 		return abbrev;
@@ -5724,6 +5878,72 @@ int diff_unmodified_pair(struct diff_filepair *p)
 	return 0;
 }
 
+struct prepared_patch {
+	struct hashmap_entry ent;
+	struct object_id old_oid, new_oid;
+	unsigned old_mode, new_mode;
+	unsigned found_changes:1;
+	struct emitted_diff_symbols symbols;
+	char path[FLEX_ARRAY];
+};
+
+struct diff_prepared_patches {
+	struct hashmap map;
+};
+
+static int prepared_patch_cmp(const void *unused_cmp_data,
+			      const void *entry,
+			      const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct prepared_patch *a = entry;
+	const struct prepared_patch *b = entry_or_key;
+
+	return a->old_mode != b->old_mode || a->new_mode != b->new_mode ||
+	       !oideq(&a->old_oid, &b->old_oid) ||
+	       !oideq(&a->new_oid, &b->new_oid) ||
+	       strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static unsigned int prepared_patch_hash(const struct diff_filepair *p)
+{
+	return strhash(p->one->path) ^ oidhash(&p->one->oid) ^
+		oidhash(&p->two->oid);
+}
+
+/*
+ * Emit the patch prepared for "p" by diff_prepare_patches(), if
+ * there is one. Renames, copies and broken pairs are never prepared.
+ */
+static int emit_prepared_patch(struct diff_filepair *p, struct diff_options *o)
+{
+	struct prepared_patch key, *patch;
+	int i;
+
+	if (!o->prepared_patches || p->score ||
+	    p->status == DIFF_STATUS_RENAMED ||
+	    p->status == DIFF_STATUS_COPIED ||
+	    strcmp(p->one->path, p->two->path))
+		return 0;
+
+	oidcpy(&key.old_oid, &p->one->oid);
+	oidcpy(&key.new_oid, &p->two->oid);
+	key.old_mode = p->one->mode;
+	key.new_mode = p->two->mode;
+	hashmap_entry_init(&key, prepared_patch_hash(p));
+	patch = hashmap_get(&o->prepared_patches->map, &key, p->one->path);
+	if (!patch)
+		return 0;
+
+	for (i = 0; i < patch->symbols.nr; i++) {
+		struct emitted_diff_symbol *e = &patch->symbols.buf[i];
+		emit_diff_symbol(o, e->s, e->line, e->len, e->flags);
+	}
+	if (patch->found_changes)
+		o->found_changes = 1;
+	return 1;
+}
+
 static void diff_flush_patch(struct diff_filepair *p, struct diff_options *o)
 {
 	if (diff_unmodified_pair(p))
@@ -5733,6 +5953,9 @@ static void diff_flush_patch(struct diff_filepair *p, struct diff_options *o)
 	    (DIFF_FILE_VALID(p->two) && S_ISDIR(p->two->mode)))
 		return; /* no tree diffs in patch format */
 
+	if (emit_prepared_patch(p, o))
+		return;
+
 	run_diff(p, o);
 }
 
@@ -6245,6 +6468,168 @@ static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 	}
 }
 
+int diff_can_prepare_patches(struct diff_options *options)
+{
+	if (!(options->output_format & DIFF_FORMAT_PATCH) ||
+	    options->output_prefix || options->flags.follow_renames ||
+	    options->repo->index->cache)
+		return 0;
+	if (options->flags.allow_external && external_diff())
+		return 0;
+
+	/* this caches what it finds for the threads to read */
+	want_color(options->use_color);
+	return 1;
+}
+
+static void prepare_patch_change(struct diff_options *options,
+				 unsigned old_mode, unsigned new_mode,
+				 const struct object_id *old_oid,
+				 const struct object_id *new_oid,
+				 int old_oid_valid, int new_oid_valid,
+				 const char *concatpath,
+				 unsigned old_dirty_submodule,
+				 unsigned new_dirty_submodule)
+{
+	struct diff_filespec *one, *two;
+
+	if (options->flags.reverse_diff) {
+		SWAP(old_mode, new_mode);
+		SWAP(old_oid, new_oid);
+		SWAP(old_oid_valid, new_oid_valid);
+	}
+
+	one = alloc_filespec(concatpath);
+	two = alloc_filespec(concatpath);
+	fill_filespec(one, old_oid, old_oid_valid, old_mode);
+	fill_filespec(two, new_oid, new_oid_valid, new_mode);
+	diff_queue(options->change_fn_data, one, two);
+}
+
+static void prepare_patch_addremove(struct diff_options *options,
+				    int addremove, unsigned mode,
+				    const struct object_id *oid,
+				    int oid_valid,
+				    const char *concatpath,
+				    unsigned dirty_submodule)
+{
+	struct diff_filespec *one, *two;
+
+	if (options->flags.reverse_diff)
+		addremove = (addremove == '+' ? '-' :
+			     addremove == '-' ? '+' : addremove);
+
+	one = alloc_filespec(concatpath);
+	two = alloc_filespec(concatpath);
+	if (addremove != '+')
+		fill_filespec(one, oid, oid_valid, mode);
+	if (addremove != '-')
+		fill_filespec(two, oid, oid_valid, mode);
+	diff_queue(options->change_fn_data, one, two);
+}
+
+/*
+ * Whether run_diff() would show this side of "p" without a textconv
+ * filter, as only those can be diffed away from the main thread.
+ */
+static int can_prepare_filespec(struct diff_options *o,
+				struct diff_filespec *one)
+{
+	if (!DIFF_FILE_VALID(one))
+		return 1;
+	if (S_ISGITLINK(one->mode))
+		return 0;
+	if (!o->flags.allow_textconv)
+		return 1;
+	diff_filespec_load_driver(one, o->repo->index);
+	return !one->driver->textconv;
+}
+
+static int can_prepare_patch(struct diff_options *o, struct diff_filepair *p)
+{
+	if (o->flags.allow_external) {
+		struct userdiff_driver *drv;
+
+		drv = userdiff_find_by_path(o->repo->index, p->one->path);
+		if (drv && drv->external)
+			return 0;
+	}
+	return can_prepare_filespec(o, p->one) &&
+	       can_prepare_filespec(o, p->two);
+}
+
+struct diff_prepared_patches *diff_prepare_patches(struct diff_options *options,
+						   const struct object_id *old_tree,
+						   const struct object_id *new_tree,
+						   struct s_xdlcache *cache)
+{
+	struct diff_prepared_patches *patches = xmalloc(sizeof(*patches));
+	struct diff_queue_struct q;
+	struct diff_options o;
+	int i;
+
+	memcpy(&o, options, sizeof(o));
+	o.change = prepare_patch_change;
+	o.add_remove = prepare_patch_addremove;
+	o.change_fn_data = &q;
+	o.prepared_patches = NULL;
+	o.xdl_cache = cache;
+
+	DIFF_QUEUE_CLEAR(&q);
+	diff_tree_oid(old_tree, new_tree, "", &o);
+
+	hashmap_init(&patches->map, prepared_patch_cmp, NULL, q.nr);
+	for (i = 0; i < q.nr; i++) {
+		struct diff_filepair *p = q.queue[i];
+		struct prepared_patch *patch;
+
+		if (!DIFF_FILE_VALID(p->one))
+			p->status = DIFF_STATUS_ADDED;
+		else if (!DIFF_FILE_VALID(p->two))
+			p->status = DIFF_STATUS_DELETED;
+		else if (DIFF_PAIR_TYPE_CHANGED(p))
+			p->status = DIFF_STATUS_TYPE_CHANGED;
+		else
+			p->status = DIFF_STATUS_MODIFIED;
+
+		if (can_prepare_patch(&o, p)) {
+			FLEX_ALLOC_STR(patch, path, p->one->path);
+			oidcpy(&patch->old_oid, &p->one->oid);
+			oidcpy(&patch->new_oid, &p->two->oid);
+			patch->old_mode = p->one->mode;
+			patch->new_mode = p->two->mode;
+			hashmap_entry_init(patch, prepared_patch_hash(p));
+
+			o.emitted_symbols = &patch->symbols;
+			o.found_changes = 0;
+			diff_flush_patch(p, &o);
+			patch->found_changes = o.found_changes;
+			hashmap_add(&patches->map, patch);
+		}
+		diff_free_filepair(p);
+	}
+	free(q.queue);
+	return patches;
+}
+
+void diff_free_prepared_patches(struct diff_prepared_patches *patches)
+{
+	struct hashmap_iter iter;
+	struct prepared_patch *patch;
+	int i;
+
+	if (!patches)
+		return;
+	hashmap_iter_init(&patches->map, &iter);
+	while ((patch = hashmap_iter_next(&iter))) {
+		for (i = 0; i < patch->symbols.nr; i++)
+			free((void *)patch->symbols.buf[i].line);
+		free(patch->symbols.buf);
+	}
+	hashmap_free(&patches->map, 1);
+	free(patches);
+}
+
 void diff_flush(struct diff_options *options)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
@@ -6507,46 +6892,68 @@ void diffcore_fix_diff_index(void)
 	QSORT(q->queue, q->nr, diffnamecmp);
 }
 
-static void add_if_missing(struct repository *r,
-			   struct oid_array *to_fetch,
-			   const struct diff_filespec *filespec)
+static void add_to_prefetch(struct oid_array *to_fetch,
+			    const struct diff_filespec *filespec)
 {
 	if (filespec && filespec->oid_valid &&
-	    oid_object_info_extended(r, &filespec->oid, NULL,
-				     OBJECT_INFO_FOR_PREFETCH))
+	    !S_ISGITLINK(filespec->mode))
 		oid_array_append(to_fetch, &filespec->oid);
 }
 
-void diffcore_std(struct diff_options *options)
+/* Does the diff need the contents of the blobs of every filepair? */
+static int diff_needs_contents(struct diff_options *options)
 {
-	if (options->repo == the_repository &&
-	    repository_format_partial_clone) {
-		/*
-		 * Prefetch the diff pairs that are about to be flushed.
-		 */
-		int i;
-		struct diff_queue_struct *q = &diff_queued_diff;
-		struct oid_array to_fetch = OID_ARRAY_INIT;
+	const unsigned content_formats = DIFF_FORMAT_DIFFSTAT |
+		DIFF_FORMAT_NUMSTAT | DIFF_FORMAT_SHORTSTAT |
+		DIFF_FORMAT_DIRSTAT | DIFF_FORMAT_PATCH |
+		DIFF_FORMAT_CHECKDIFF | DIFF_FORMAT_CALLBACK;
 
-		for (i = 0; i < q->nr; i++) {
-			struct diff_filepair *p = q->queue[i];
-			add_if_missing(options->repo, &to_fetch, p->one);
-			add_if_missing(options->repo, &to_fetch, p->two);
-		}
-		if (to_fetch.nr)
-			/*
-			 * NEEDSWORK: Consider deduplicating the OIDs sent.
-			 */
-			fetch_objects(repository_format_partial_clone,
-				      to_fetch.oid, to_fetch.nr);
-		oid_array_clear(&to_fetch);
+	return (options->output_format & content_formats) ||
+		(options->pickaxe_opts & DIFF_PICKAXE_KINDS_MASK) ||
+		options->break_opt != -1 ||
+		(options->xdl_opts & XDF_WHITESPACE_FLAGS);
+}
+
+/*
+ * Prefetch the blobs of the diff pairs that are about to be flushed, if
+ * their contents are going to be needed. Rename detection prefetches
+ * the ones it needs itself.
+ */
+static void diff_queued_diff_prefetch(struct diff_options *options)
+{
+	int i, all;
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+
+	if (options->repo != the_repository || !repository_format_partial_clone)
+		return;
+
+	all = diff_needs_contents(options);
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		/* a stat-dirty entry is compared to the file by contents */
+		if (!all &&
+		    !(options->skip_stat_unmatch &&
+		      (!p->one->oid_valid || !p->two->oid_valid)))
+			continue;
+		add_to_prefetch(&to_fetch, p->one);
+		add_to_prefetch(&to_fetch, p->two);
 	}
+	prefetch_objects(&to_fetch);
+	oid_array_clear(&to_fetch);
+}
+
+void diffcore_std(struct diff_options *options)
+{
+	diff_queued_diff_prefetch(options);
 
 	/* NOTE please keep the following in sync with diff_tree_combined() */
 	if (options->skip_stat_unmatch)
 		diffcore_skip_stat_unmatch(options);
 	if (!options->found_follow) {
 		/* See try_to_follow_renames() in tree-diff.c */
+		diffcore_count_cache_begin();
 		if (options->break_opt != -1)
 			diffcore_break(options->repo,
 				       options->break_opt);
@@ -6554,6 +6961,7 @@ void diffcore_std(struct diff_options *options)
 			diffcore_rename(options);
 		if (options->break_opt != -1)
 			diffcore_merge_broken();
+		diffcore_count_cache_end();
 	}
 	if (options->pickaxe_opts & DIFF_PICKAXE_KINDS_MASK)
 		diffcore_pickaxe(options);
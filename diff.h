@@ -13,11 +13,13 @@ struct combine_diff_path;
 struct commit;
 struct diff_filespec;
 struct diff_options;
+struct diff_prepared_patches;
 struct diff_queue_struct;
 struct oid_array;
 struct option;
 struct repository;
 struct rev_info;
+struct s_xdlcache;
 struct strbuf;
 struct userdiff_driver;
 
@@ -158,6 +160,7 @@ struct diff_options {
 	int needed_rename_limit;
 	int degraded_cc_to_c;
 	int show_rename_progress;
+	int rename_cache;
 	int dirstat_permille;
 	int setup;
 	int abbrev;
@@ -215,6 +218,16 @@ struct diff_options {
 	int diff_path_counter;
 
 	struct emitted_diff_symbols *emitted_symbols;
+
+	/*
+	 * Patches that diff_flush() shows instead of diffing the same
+	 * file pairs again; see diff_prepare_patches().
+	 */
+	struct diff_prepared_patches *prepared_patches;
+
+	/* Buffers for xdiff; NULL for the shared one of xdi_diff(). */
+	struct s_xdlcache *xdl_cache;
+
 	enum {
 		COLOR_MOVED_NO = 0,
 		COLOR_MOVED_PLAIN = 1,
@@ -359,6 +372,9 @@ int git_config_rename(const char *var, const char *value);
 #define DIFF_DETECT_RENAME	1
 #define DIFF_DETECT_COPY	2
 
+#define DIFF_RENAME_CACHE_MEMORY	1
+#define DIFF_RENAME_CACHE_PERSIST	2
+
 #define DIFF_PICKAXE_ALL	1
 #define DIFF_PICKAXE_REGEX	2
 
@@ -405,8 +421,55 @@ void diffcore_fix_diff_index(void);
 
 int diff_queue_is_empty(void);
 void diff_flush(struct diff_options*);
+
+/*
+ * Between these, the filepairs and filespecs the calling thread queues
+ * come from a memory pool instead of one malloc() each. The pool is
+ * rewound whenever none of them is in use any more, which for a caller
+ * that shows one diff after another (e.g. "log -p") is at the end of
+ * every diff_flush(). They nest.
+ */
+void diff_pool_begin(void);
+void diff_pool_end(void);
 void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc);
 
+/*
+ * Whether the patches that diff_flush() shows with these options can
+ * be prepared on other threads by diff_prepare_patches(). Ask from the
+ * main thread before starting them, as it sets up state they read.
+ */
+int diff_can_prepare_patches(struct diff_options *);
+
+/*
+ * Compare two trees (old_tree may be NULL for the empty tree) and
+ * prepare the patches diff_flush() would show with the options for
+ * the file pairs found, to be used by setting opt->prepared_patches
+ * before the flush. Pairs that a rename, copy or break turns into
+ * something else, and those shown through textconv or an external
+ * diff, are diffed again by diff_flush() as usual.
+ *
+ * This only reads the options and the objects, so several threads can
+ * use it after enable_obj_read_lock(), each with its own xdiff cache
+ * from xdi_cache_new().
+ */
+struct diff_prepared_patches *diff_prepare_patches(struct diff_options *opt,
+						   const struct object_id *old_tree,
+						   const struct object_id *new_tree,
+						   struct s_xdlcache *cache);
+void diff_free_prepared_patches(struct diff_prepared_patches *);
+
+/*
+ * Likewise for -S and -G: whether the blobs diffcore_pickaxe() will
+ * search can be searched ahead of time on other threads, and do so for
+ * the file pairs between two trees (old_tree may be NULL for the empty
+ * tree). What is found is remembered by blob for diffcore_pickaxe() to
+ * use; the same rules apply as for diff_prepare_patches().
+ */
+int diff_can_prepare_pickaxe(struct diff_options *);
+void diff_prepare_pickaxe(struct diff_options *opt,
+			  const struct object_id *old_tree,
+			  const struct object_id *new_tree);
+
 /* diff-raw status letters */
 #define DIFF_STATUS_ADDED		'A'
 #define DIFF_STATUS_COPIED		'C'
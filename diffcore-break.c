@@ -209,7 +209,7 @@ void diffcore_break(struct repository *r, int break_score)
 
 				diff_free_filespec_blob(p->one);
 				diff_free_filespec_blob(p->two);
-				free(p); /* not diff_free_filepair(), we are
+				diff_free_filepair_only(p); /* we are
 					  * reusing one and two here.
 					  */
 				continue;
@@ -254,10 +254,10 @@ static void merge_broken(struct diff_filepair *p,
 	 * in the resulting tree.
 	 */
 	d->one->rename_used++;
-	diff_free_filespec_data(d->two);
-	diff_free_filespec_data(c->one);
-	free(d);
-	free(c);
+	free_filespec(d->two);
+	free_filespec(c->one);
+	diff_free_filepair_only(d);
+	diff_free_filepair_only(c);
 }
 
 void diffcore_merge_broken(void)
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "hashmap.h"
 
 /*
  * Idea here is very simple.
@@ -43,9 +44,39 @@ struct spanhash {
 struct spanhash_top {
 	int alloc_log2;
 	int free;
+	unsigned int refs;
 	struct spanhash data[FLEX_ARRAY];
 };
 
+/*
+ * While diffcore_count_cache_begin() is in effect, the hashed blobs,
+ * so that break, rename and copy detection and every filespec of the
+ * same blob share one table (the copy sources of -C are often the same
+ * blobs as the preimages -B looked at, and break frees what it does
+ * not break). Text and binary data are hashed differently, and whether
+ * a blob is binary depends on its path, so that is part of the key.
+ */
+struct count_cache_entry {
+	struct hashmap_entry ent;
+	struct object_id oid;
+	int is_text;
+	struct spanhash_top *count;
+};
+
+static struct hashmap count_cache;
+static int count_cache_depth;
+
+static int count_cache_cmp(const void *unused_cmp_data,
+			   const void *entry,
+			   const void *entry_or_key,
+			   const void *unused_keydata)
+{
+	const struct count_cache_entry *e1 = entry;
+	const struct count_cache_entry *e2 = entry_or_key;
+
+	return e1->is_text != e2->is_text || !oideq(&e1->oid, &e2->oid);
+}
+
 static struct spanhash_top *spanhash_rehash(struct spanhash_top *orig)
 {
 	struct spanhash_top *new_spanhash;
@@ -121,15 +152,13 @@ static int spanhash_cmp(const void *a_, const void *b_)
 		a->hashval > b->hashval ? 1 : 0;
 }
 
-static struct spanhash_top *hash_chars(struct repository *r,
-				       struct diff_filespec *one)
+static struct spanhash_top *hash_chars(struct diff_filespec *one, int is_text)
 {
 	int i, n;
 	unsigned int accum1, accum2, hashval;
 	struct spanhash_top *hash;
 	unsigned char *buf = one->data;
 	unsigned int sz = one->size;
-	int is_text = !diff_filespec_is_binary(r, one);
 
 	i = INITIAL_HASH_SIZE;
 	hash = xmalloc(st_add(sizeof(*hash),
@@ -160,9 +189,68 @@ static struct spanhash_top *hash_chars(struct repository *r,
 		accum1 = accum2 = 0;
 	}
 	QSORT(hash->data, 1ul << hash->alloc_log2, spanhash_cmp);
+	hash->refs = 1;
 	return hash;
 }
 
+static struct spanhash_top *get_count(struct repository *r,
+				      struct diff_filespec *one)
+{
+	int is_text = !diff_filespec_is_binary(r, one);
+	struct count_cache_entry key, *e;
+
+	if (!count_cache_depth || !one->oid_valid)
+		return hash_chars(one, is_text);
+
+	hashmap_entry_init(&key, oidhash(&one->oid) ^ is_text);
+	oidcpy(&key.oid, &one->oid);
+	key.is_text = is_text;
+	e = hashmap_get(&count_cache, &key, NULL);
+	if (!e) {
+		e = xmalloc(sizeof(*e));
+		memcpy(e, &key, sizeof(*e));
+		e->count = hash_chars(one, is_text);
+		hashmap_add(&count_cache, e);
+	}
+	e->count->refs++;
+	return e->count;
+}
+
+void diffcore_free_count(void *count_)
+{
+	struct spanhash_top *count = count_;
+
+	if (count && !--count->refs)
+		free(count);
+}
+
+void diffcore_count_cache_begin(void)
+{
+	if (!count_cache_depth++)
+		hashmap_init(&count_cache, count_cache_cmp, NULL, 0);
+}
+
+void diffcore_count_cache_end(void)
+{
+	struct hashmap_iter iter;
+	struct count_cache_entry *e;
+
+	if (--count_cache_depth)
+		return;
+	hashmap_iter_init(&count_cache, &iter);
+	while ((e = hashmap_iter_next(&iter)))
+		diffcore_free_count(e->count);
+	hashmap_free(&count_cache, 1);
+}
+
+void diffcore_prepare_count(struct repository *r,
+			    struct diff_filespec *one,
+			    void **count_p)
+{
+	if (!*count_p)
+		*count_p = get_count(r, one);
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
@@ -179,14 +267,14 @@ int diffcore_count_changes(struct repository *r,
 	if (src_count_p)
 		src_count = *src_count_p;
 	if (!src_count) {
-		src_count = hash_chars(r, src);
+		src_count = get_count(r, src);
 		if (src_count_p)
 			*src_count_p = src_count;
 	}
 	if (dst_count_p)
 		dst_count = *dst_count_p;
 	if (!dst_count) {
-		dst_count = hash_chars(r, dst);
+		dst_count = get_count(r, dst);
 		if (dst_count_p)
 			*dst_count_p = dst_count;
 	}
@@ -224,9 +312,9 @@ int diffcore_count_changes(struct repository *r,
 	}
 
 	if (!src_count_p)
-		free(src_count);
+		diffcore_free_count(src_count);
 	if (!dst_count_p)
-		free(dst_count);
+		diffcore_free_count(dst_count);
 	*src_copied = sc;
 	*literal_added = la;
 	return 0;
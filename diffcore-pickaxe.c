@@ -9,6 +9,9 @@
 #include "kwset.h"
 #include "commit.h"
 #include "quote.h"
+#include "object-store.h"
+#include "thread-utils.h"
+#include "userdiff.h"
 
 typedef int (*pickaxe_fn)(mmfile_t *one, mmfile_t *two,
 			  struct diff_options *o,
@@ -117,6 +120,134 @@ static int has_changes(mmfile_t *one, mmfile_t *two,
 	return one_contains != two_contains;
 }
 
+/*
+ * The compiled needle, kept for as long as it is the same one, along
+ * with what it finds in each blob: for -S the number of matches, for
+ * -G whether there is any. A blob usually shows up on both sides of
+ * two changes, as the postimage of one commit and the preimage of the
+ * next, so this reads and searches it once instead of twice.
+ */
+struct pickaxe_blob {
+	struct hashmap_entry ent;
+	struct object_id oid;
+	unsigned int count;
+};
+
+/* Start over beyond that many blobs. */
+#define PICKAXE_BLOBS_MAX (1 << 16)
+
+static struct pickaxe_needle {
+	char *needle;
+	unsigned int opts;
+	regex_t regex, *regexp;
+	kwset_t kws;
+	struct hashmap blobs;
+} needle;
+static pthread_mutex_t pickaxe_blobs_mutex;
+
+static int pickaxe_blob_cmp(const void *unused_cmp_data,
+			    const void *entry,
+			    const void *entry_or_key,
+			    const void *unused_keydata)
+{
+	const struct pickaxe_blob *e1 = entry;
+	const struct pickaxe_blob *e2 = entry_or_key;
+
+	return !oideq(&e1->oid, &e2->oid);
+}
+
+static int blob_count(struct repository *r, const struct object_id *oid,
+		      unsigned int *count)
+{
+	struct pickaxe_blob key, *blob;
+	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	mmfile_t mf;
+
+	hashmap_entry_init(&key, oidhash(oid));
+	oidcpy(&key.oid, oid);
+	pthread_mutex_lock(&pickaxe_blobs_mutex);
+	blob = hashmap_get(&needle.blobs, &key, NULL);
+	if (blob)
+		*count = blob->count;
+	pthread_mutex_unlock(&pickaxe_blobs_mutex);
+	if (blob)
+		return 0;
+
+	/* leave anything out of the ordinary to the usual code path */
+	oi.typep = &type;
+	oi.sizep = &size;
+	oi.contentp = &buf;
+	if (oid_object_info_extended(r, oid, &oi,
+				     OBJECT_INFO_LOOKUP_REPLACE |
+				     OBJECT_INFO_SKIP_FETCH_OBJECT) < 0)
+		return -1;
+	if (type != OBJ_BLOB) {
+		free(buf);
+		return -1;
+	}
+
+	mf.ptr = buf;
+	mf.size = size;
+	if (needle.opts & DIFF_PICKAXE_KIND_G) {
+		regmatch_t regmatch;
+
+		*count = !regexec_buf(needle.regexp, mf.ptr, mf.size,
+				      1, &regmatch, 0);
+	} else {
+		*count = contains(&mf, needle.regexp, needle.kws);
+	}
+	free(buf);
+
+	blob = xmalloc(sizeof(*blob));
+	hashmap_entry_init(blob, key.ent.hash);
+	oidcpy(&blob->oid, oid);
+	blob->count = *count;
+	pthread_mutex_lock(&pickaxe_blobs_mutex);
+	if (hashmap_get_size(&needle.blobs) >= PICKAXE_BLOBS_MAX) {
+		hashmap_free(&needle.blobs, 1);
+		hashmap_init(&needle.blobs, pickaxe_blob_cmp, NULL, 0);
+	}
+	if (hashmap_get(&needle.blobs, blob, NULL))
+		free(blob);
+	else
+		hashmap_add(&needle.blobs, blob);
+	pthread_mutex_unlock(&pickaxe_blobs_mutex);
+	return 0;
+}
+
+static int filespec_count(struct diff_options *o, struct diff_filespec *one,
+			  unsigned int *count)
+{
+	if (!DIFF_FILE_VALID(one)) {
+		*count = 0;
+		return 0;
+	}
+	if (!one->oid_valid || S_ISGITLINK(one->mode))
+		return -1;
+	return blob_count(o->repo, &one->oid, count);
+}
+
+/*
+ * Answer for a pair shown without textconv from what its blobs contain,
+ * if that is enough: for -S the counts are all there is to it, and for
+ * -G no line of the diff can match if neither side does. Return -1 to
+ * look at the contents.
+ */
+static int pickaxe_match_blobs(struct diff_filepair *p, struct diff_options *o)
+{
+	unsigned int one, two;
+
+	if (filespec_count(o, p->one, &one) ||
+	    filespec_count(o, p->two, &two))
+		return -1;
+	if (o->pickaxe_opts & DIFF_PICKAXE_KIND_G)
+		return one || two ? -1 : 0;
+	return one != two;
+}
+
 static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 			 regex_t *regexp, kwset_t kws, pickaxe_fn fn)
 {
@@ -154,6 +285,12 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 	if (textconv_one == textconv_two && diff_unmodified_pair(p))
 		return 0;
 
+	if (!textconv_one && !textconv_two) {
+		ret = pickaxe_match_blobs(p, o);
+		if (ret >= 0)
+			return ret;
+	}
+
 	if ((o->pickaxe_opts & DIFF_PICKAXE_KIND_G) &&
 	    !o->flags.text &&
 	    ((!textconv_one && diff_filespec_is_binary(o->repo, p->one)) ||
@@ -226,43 +363,124 @@ static void regcomp_or_die(regex_t *regex, const char *needle, int cflags)
 	}
 }
 
-void diffcore_pickaxe(struct diff_options *o)
+static void prepare_needle(struct diff_options *o)
 {
-	const char *needle = o->pickaxe;
-	int opts = o->pickaxe_opts;
-	regex_t regex, *regexp = NULL;
-	kwset_t kws = NULL;
+	const char *str = o->pickaxe;
+	unsigned int opts = o->pickaxe_opts;
+
+	if (needle.needle && !strcmp(needle.needle, str) && needle.opts == opts)
+		return;
+	if (!needle.needle) {
+		pthread_mutex_init(&pickaxe_blobs_mutex, NULL);
+	} else {
+		free(needle.needle);
+		if (needle.regexp)
+			regfree(needle.regexp);
+		if (needle.kws)
+			kwsfree(needle.kws);
+		hashmap_free(&needle.blobs, 1);
+	}
+	needle.needle = xstrdup(str);
+	needle.opts = opts;
+	needle.regexp = NULL;
+	needle.kws = NULL;
+	hashmap_init(&needle.blobs, pickaxe_blob_cmp, NULL, 0);
 
 	if (opts & (DIFF_PICKAXE_REGEX | DIFF_PICKAXE_KIND_G)) {
 		int cflags = REG_EXTENDED | REG_NEWLINE;
-		if (o->pickaxe_opts & DIFF_PICKAXE_IGNORE_CASE)
+		if (opts & DIFF_PICKAXE_IGNORE_CASE)
 			cflags |= REG_ICASE;
-		regcomp_or_die(&regex, needle, cflags);
-		regexp = &regex;
+		regcomp_or_die(&needle.regex, str, cflags);
+		needle.regexp = &needle.regex;
 	} else if (opts & DIFF_PICKAXE_KIND_S) {
-		if (o->pickaxe_opts & DIFF_PICKAXE_IGNORE_CASE &&
-		    has_non_ascii(needle)) {
+		if (opts & DIFF_PICKAXE_IGNORE_CASE &&
+		    has_non_ascii(str)) {
 			struct strbuf sb = STRBUF_INIT;
 			int cflags = REG_NEWLINE | REG_ICASE;
 
-			basic_regex_quote_buf(&sb, needle);
-			regcomp_or_die(&regex, sb.buf, cflags);
+			basic_regex_quote_buf(&sb, str);
+			regcomp_or_die(&needle.regex, sb.buf, cflags);
 			strbuf_release(&sb);
-			regexp = &regex;
+			needle.regexp = &needle.regex;
 		} else {
-			kws = kwsalloc(o->pickaxe_opts & DIFF_PICKAXE_IGNORE_CASE
-				       ? tolower_trans_tbl : NULL);
-			kwsincr(kws, needle, strlen(needle));
-			kwsprep(kws);
+			needle.kws = kwsalloc(opts & DIFF_PICKAXE_IGNORE_CASE
+					      ? tolower_trans_tbl : NULL);
+			kwsincr(needle.kws, str, strlen(str));
+			kwsprep(needle.kws);
 		}
 	}
+}
+
+void diffcore_pickaxe(struct diff_options *o)
+{
+	int opts = o->pickaxe_opts;
 
-	pickaxe(&diff_queued_diff, o, regexp, kws,
+	if (opts & (DIFF_PICKAXE_KIND_S | DIFF_PICKAXE_KIND_G))
+		prepare_needle(o);
+
+	pickaxe(&diff_queued_diff, o, needle.regexp, needle.kws,
 		(opts & DIFF_PICKAXE_KIND_G) ? diff_grep : has_changes);
+}
+
+int diff_can_prepare_pickaxe(struct diff_options *o)
+{
+	if (!(o->pickaxe_opts & (DIFF_PICKAXE_KIND_S | DIFF_PICKAXE_KIND_G)) ||
+	    o->flags.follow_renames || o->repo->index->cache)
+		return 0;
+	prepare_needle(o);
+	return 1;
+}
+
+static void prepare_pickaxe_blob(struct diff_options *o,
+				 const struct object_id *oid, int oid_valid,
+				 unsigned mode, const char *path)
+{
+	unsigned int count;
+
+	if (!oid_valid || S_ISGITLINK(mode))
+		return;
+	if (o->flags.allow_textconv) {
+		struct userdiff_driver *drv;
+
+		drv = userdiff_find_by_path(o->repo->index, path);
+		if (drv && drv->textconv)
+			return;
+	}
+	blob_count(o->repo, oid, &count);
+}
+
+static void prepare_pickaxe_change(struct diff_options *o,
+				   unsigned old_mode, unsigned new_mode,
+				   const struct object_id *old_oid,
+				   const struct object_id *new_oid,
+				   int old_oid_valid, int new_oid_valid,
+				   const char *concatpath,
+				   unsigned old_dirty_submodule,
+				   unsigned new_dirty_submodule)
+{
+	prepare_pickaxe_blob(o, old_oid, old_oid_valid, old_mode, concatpath);
+	prepare_pickaxe_blob(o, new_oid, new_oid_valid, new_mode, concatpath);
+}
+
+static void prepare_pickaxe_addremove(struct diff_options *o,
+				      int addremove, unsigned mode,
+				      const struct object_id *oid,
+				      int oid_valid,
+				      const char *concatpath,
+				      unsigned dirty_submodule)
+{
+	prepare_pickaxe_blob(o, oid, oid_valid, mode, concatpath);
+}
+
+void diff_prepare_pickaxe(struct diff_options *options,
+			  const struct object_id *old_tree,
+			  const struct object_id *new_tree)
+{
+	struct diff_options o;
 
-	if (regexp)
-		regfree(regexp);
-	if (kws)
-		kwsfree(kws);
-	return;
+	memcpy(&o, options, sizeof(o));
+	o.change = prepare_pickaxe_change;
+	o.add_remove = prepare_pickaxe_addremove;
+	o.prepared_patches = NULL;
+	diff_tree_oid(old_tree, new_tree, "", &o);
 }
@@ -7,6 +7,13 @@
 #include "object-store.h"
 #include "hashmap.h"
 #include "progress.h"
+#include "config.h"
+#include "thread-utils.h"
+#include "string-list.h"
+#include "oidmap.h"
+#include "notes-cache.h"
+#include "fetch-object.h"
+#include "sha1-array.h"
 
 /* Table of rename/copy destinations */
 
@@ -16,7 +23,7 @@ static struct diff_rename_dst {
 } *rename_dst;
 static int rename_dst_nr, rename_dst_alloc;
 
-static int find_rename_dst(struct diff_filespec *two)
+static int find_rename_dst(const char *path)
 {
 	int first, last;
 
@@ -25,7 +32,7 @@ static int find_rename_dst(struct diff_filespec *two)
 	while (last > first) {
 		int next = first + ((last - first) >> 1);
 		struct diff_rename_dst *dst = &(rename_dst[next]);
-		int cmp = strcmp(two->path, dst->two->path);
+		int cmp = strcmp(path, dst->two->path);
 		if (!cmp)
 			return next;
 		if (cmp < 0) {
@@ -39,7 +46,7 @@ static int find_rename_dst(struct diff_filespec *two)
 
 static struct diff_rename_dst *locate_rename_dst(struct diff_filespec *two)
 {
-	int ofs = find_rename_dst(two);
+	int ofs = find_rename_dst(two->path);
 	return ofs < 0 ? NULL : &rename_dst[ofs];
 }
 
@@ -48,7 +55,7 @@ static struct diff_rename_dst *locate_rename_dst(struct diff_filespec *two)
  */
 static int add_rename_dst(struct diff_filespec *two)
 {
-	int first = find_rename_dst(two);
+	int first = find_rename_dst(two->path);
 
 	if (first >= 0)
 		return -1;
@@ -128,10 +135,128 @@ struct diff_score {
 	short name_score;
 };
 
+/*
+ * With options->rename_cache, the similarity scores computed by
+ * estimate_similarity() are remembered for the rest of the process, so
+ * that a command detecting renames between mostly the same blobs over
+ * and over again, like the merges of a rebase through a mass rename,
+ * does not compare them again. A score only depends on the contents of
+ * the two blobs, not on their paths or on the minimum score.
+ *
+ * With DIFF_RENAME_CACHE_PERSIST, the inexact renames that were found
+ * are also stored in "refs/notes/rename-cache", keyed by the destination
+ * blob, and a later command pairs the same two blobs up again before
+ * building the similarity matrix.
+ */
+struct rename_score {
+	struct hashmap_entry ent;
+	struct object_id src, dst;
+	int score;
+};
+
+/* Stop remembering scores beyond that many. */
+#define RENAME_SCORES_MAX (1 << 20)
+
+static int rename_cache;
+static struct hashmap rename_scores;
+static int rename_scores_hits;
+static int rename_scores_threaded;
+static pthread_mutex_t rename_scores_mutex;
+static struct notes_cache *rename_notes;
+
+static int rename_score_cmp(const void *unused_cmp_data,
+			    const void *entry,
+			    const void *entry_or_key,
+			    const void *unused_keydata)
+{
+	const struct rename_score *e1 = entry;
+	const struct rename_score *e2 = entry_or_key;
+
+	return !oideq(&e1->src, &e2->src) || !oideq(&e1->dst, &e2->dst);
+}
+
+static void init_rename_cache(struct diff_options *options)
+{
+	rename_cache = options->rename_cache;
+	rename_scores_hits = 0;
+	if (!rename_cache)
+		return;
+	if (!rename_scores.tablesize) {
+		hashmap_init(&rename_scores, rename_score_cmp, NULL, 0);
+		pthread_mutex_init(&rename_scores_mutex, NULL);
+	}
+	if (rename_cache == DIFF_RENAME_CACHE_PERSIST && !rename_notes) {
+		rename_notes = xmalloc(sizeof(*rename_notes));
+		notes_cache_init(options->repo, rename_notes, "rename-cache",
+				 "rename scores");
+	}
+}
+
+static void lock_rename_scores(void)
+{
+	if (rename_scores_threaded)
+		pthread_mutex_lock(&rename_scores_mutex);
+}
+
+static void unlock_rename_scores(void)
+{
+	if (rename_scores_threaded)
+		pthread_mutex_unlock(&rename_scores_mutex);
+}
+
+static struct rename_score *find_rename_score(const struct object_id *src,
+					      const struct object_id *dst)
+{
+	struct rename_score key;
+
+	hashmap_entry_init(&key, oidhash(src) + 31 * oidhash(dst));
+	oidcpy(&key.src, src);
+	oidcpy(&key.dst, dst);
+	return hashmap_get(&rename_scores, &key, NULL);
+}
+
+/* Returns -1 if the score of the two is not known. */
+static int get_rename_score(struct diff_filespec *src,
+			    struct diff_filespec *dst)
+{
+	struct rename_score *e;
+	int score = -1;
+
+	if (!rename_cache || !src->oid_valid || !dst->oid_valid)
+		return -1;
+	lock_rename_scores();
+	e = find_rename_score(&src->oid, &dst->oid);
+	if (e) {
+		score = e->score;
+		rename_scores_hits++;
+	}
+	unlock_rename_scores();
+	return score;
+}
+
+static void put_rename_score(const struct object_id *src,
+			     const struct object_id *dst, int score)
+{
+	struct rename_score *e;
+
+	lock_rename_scores();
+	if (!find_rename_score(src, dst) &&
+	    hashmap_get_size(&rename_scores) < RENAME_SCORES_MAX) {
+		e = xmalloc(sizeof(*e));
+		hashmap_entry_init(e, oidhash(src) + 31 * oidhash(dst));
+		oidcpy(&e->src, src);
+		oidcpy(&e->dst, dst);
+		e->score = score;
+		hashmap_add(&rename_scores, e);
+	}
+	unlock_rename_scores();
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
-			       int minimum_score)
+			       int minimum_score,
+			       int prepared)
 {
 	/* src points at a file that existed in the original tree (or
 	 * optionally a file in the destination tree) and dst points
@@ -164,12 +289,15 @@ static int estimate_similarity(struct repository *r,
 	 * all good (avoid checking the size for zero, as that
 	 * is a possible size - we really should have a flag to
 	 * say whether the size is valid or not!)
+	 *
+	 * If the filespecs were prepared by prepare_similarity(),
+	 * the sizes are filled in, and we must not touch them.
 	 */
 	if (!src->cnt_data &&
-	    diff_populate_filespec(r, src, CHECK_SIZE_ONLY))
+	    !prepared && diff_populate_filespec(r, src, CHECK_SIZE_ONLY))
 		return 0;
 	if (!dst->cnt_data &&
-	    diff_populate_filespec(r, dst, CHECK_SIZE_ONLY))
+	    !prepared && diff_populate_filespec(r, dst, CHECK_SIZE_ONLY))
 		return 0;
 
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
@@ -187,6 +315,13 @@ static int estimate_similarity(struct repository *r,
 	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
 		return 0;
 
+	score = get_rename_score(src, dst);
+	if (score >= 0)
+		return score;
+
+	/* the ones worth reading were read by prepare_similarity() */
+	if (prepared && (!src->cnt_data || !dst->cnt_data))
+		return 0;
 	if (!src->cnt_data && diff_populate_filespec(r, src, 0))
 		return 0;
 	if (!dst->cnt_data && diff_populate_filespec(r, dst, 0))
@@ -204,6 +339,8 @@ static int estimate_similarity(struct repository *r,
 		score = 0; /* should not happen */
 	else
 		score = (int)(src_copied * MAX_SCORE / max_size);
+	if (rename_cache && src->oid_valid && dst->oid_valid)
+		put_rename_score(&src->oid, &dst->oid, score);
 	return score;
 }
 
@@ -428,6 +565,50 @@ static int too_many_rename_candidates(int num_create,
 	return 1;
 }
 
+/*
+ * In a partial clone, fetch the blobs that inexact rename detection is
+ * going to compare in one go, rather than one at a time as they are
+ * read.
+ */
+static void prefetch_rename_candidates(struct diff_options *options,
+				       int num_create)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	int i, skip_unmodified;
+
+	if (options->repo != the_repository || !repository_format_partial_clone)
+		return;
+
+	switch (too_many_rename_candidates(num_create, options)) {
+	case 1:
+		return; /* inexact detection will not happen */
+	case 2:
+		skip_unmodified = 1;
+		break;
+	default:
+		skip_unmodified = 0;
+		break;
+	}
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+
+		if (rename_dst[i].pair || !two->oid_valid)
+			continue; /* dealt with exact match already. */
+		oid_array_append(&to_fetch, &two->oid);
+	}
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if ((skip_unmodified && diff_unmodified_pair(rename_src[i].p)) ||
+		    !one->oid_valid)
+			continue;
+		oid_array_append(&to_fetch, &one->oid);
+	}
+	prefetch_objects(&to_fetch);
+	oid_array_clear(&to_fetch);
+}
+
 static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, int copies)
 {
 	int count = 0, i;
@@ -449,19 +630,593 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+/*
+ * Most renamed files keep their basename, and most of those that do not
+ * are moved along with the rest of their directory. Before comparing all
+ * the sources with all the destinations, pair up a deleted and a created
+ * path that have a basename no other deleted or created path has, or
+ * whose directories were renamed into each other by the renames found so
+ * far, when their contents are similar enough.
+ *
+ * A guess from the name may miss a more similar source of another name,
+ * so this is only done when detecting renames (not copies) without
+ * break detection, and only for a score halfway between the minimum and
+ * an exact rename.
+ */
+struct basename_entry {
+	struct hashmap_entry ent;
+	const char *name;
+	int index; /* -1 if the basename is not unique */
+};
+
+static int basename_entry_cmp(const void *unused_cmp_data,
+			      const void *entry,
+			      const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct basename_entry *e1 = entry;
+	const struct basename_entry *e2 = entry_or_key;
+
+	return strcmp(e1->name, keydata ? keydata : e2->name);
+}
+
+static const char *path_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static struct basename_entry *get_basename_entry(struct hashmap *map,
+						 const char *name)
+{
+	struct basename_entry key;
+
+	hashmap_entry_init(&key, strhash(name));
+	return hashmap_get(map, &key, name);
+}
+
+static void add_basename(struct hashmap *map, const char *path, int index)
+{
+	const char *name = path_basename(path);
+	struct basename_entry *e = get_basename_entry(map, name);
+
+	if (e) {
+		e->index = -1;
+		return;
+	}
+	e = xmalloc(sizeof(*e));
+	hashmap_entry_init(e, strhash(name));
+	e->name = name;
+	e->index = index;
+	hashmap_add(map, e);
+}
+
+static int lookup_basename(struct hashmap *map, const char *name)
+{
+	struct basename_entry *e = get_basename_entry(map, name);
+	return e ? e->index : -1;
+}
+
+static int try_guessed_rename(struct diff_options *options,
+			      int dst_index, int src_index, int min_score)
+{
+	struct diff_filespec *one = rename_src[src_index].p->one;
+	struct diff_filespec *two = rename_dst[dst_index].two;
+	int score;
+
+	score = estimate_similarity(options->repo, one, two, min_score, 0);
+	diff_free_filespec_blob(one);
+	diff_free_filespec_blob(two);
+	if (score < min_score)
+		return 0;
+	record_rename_pair(dst_index, src_index, score);
+	return 1;
+}
+
+static int find_basename_renames(struct diff_options *options, int min_score)
+{
+	struct hashmap srcs, dsts;
+	int i, renames = 0;
+
+	hashmap_init(&srcs, basename_entry_cmp, NULL, rename_src_nr);
+	hashmap_init(&dsts, basename_entry_cmp, NULL, rename_dst_nr);
+	for (i = 0; i < rename_src_nr; i++)
+		if (!rename_src[i].p->one->rename_used)
+			add_basename(&srcs, rename_src[i].p->one->path, i);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair)
+			add_basename(&dsts, rename_dst[i].two->path, i);
+
+	for (i = 0; i < rename_src_nr; i++) {
+		const char *name = path_basename(rename_src[i].p->one->path);
+		int dst_index;
+
+		if (rename_src[i].p->one->rename_used ||
+		    lookup_basename(&srcs, name) != i)
+			continue;
+		dst_index = lookup_basename(&dsts, name);
+		if (dst_index >= 0)
+			renames += try_guessed_rename(options, dst_index, i,
+						      min_score);
+	}
+
+	hashmap_free(&srcs, 1);
+	hashmap_free(&dsts, 1);
+	return renames;
+}
+
+struct dir_rename {
+	char *from, *to; /* with their trailing slash, if any */
+};
+
+static int dir_rename_cmp(const void *a_, const void *b_)
+{
+	const struct dir_rename *a = a_, *b = b_;
+	int cmp = strcmp(a->from, b->from);
+
+	return cmp ? cmp : strcmp(a->to, b->to);
+}
+
+/*
+ * Map each directory that lost files to the renames found so far to the
+ * directory most of them went to, if there is one.
+ */
+static void guess_dir_renames(struct string_list *dirs)
+{
+	struct dir_rename *renames;
+	int nr = 0, i;
+
+	ALLOC_ARRAY(renames, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *p = rename_dst[i].pair;
+		const char *from, *to;
+		size_t from_len, to_len;
+
+		if (!p)
+			continue;
+		from = p->one->path;
+		to = p->two->path;
+		from_len = path_basename(from) - from;
+		to_len = path_basename(to) - to;
+		if (from_len == to_len && !strncmp(from, to, from_len))
+			continue;
+		renames[nr].from = xstrndup(from, from_len);
+		renames[nr].to = xstrndup(to, to_len);
+		nr++;
+	}
+	QSORT(renames, nr, dir_rename_cmp);
+
+	for (i = 0; i < nr; ) {
+		const char *from = renames[i].from, *best = NULL;
+		int best_count = 0, tied = 0;
+
+		while (i < nr && !strcmp(renames[i].from, from)) {
+			const char *to = renames[i].to;
+			int count = 0;
+
+			for (; i < nr && !strcmp(renames[i].from, from) &&
+			       !strcmp(renames[i].to, to); i++)
+				count++;
+			if (count > best_count) {
+				best = to;
+				best_count = count;
+				tied = 0;
+			} else if (count == best_count) {
+				tied = 1;
+			}
+		}
+		if (!tied)
+			string_list_append(dirs, from)->util = xstrdup(best);
+	}
+
+	for (i = 0; i < nr; i++) {
+		free(renames[i].from);
+		free(renames[i].to);
+	}
+	free(renames);
+}
+
+static int find_dir_renames(struct diff_options *options, int min_score)
+{
+	struct string_list dirs = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	int i, renames = 0;
+
+	guess_dir_renames(&dirs);
+	for (i = 0; dirs.nr && i < rename_src_nr; i++) {
+		const char *from = rename_src[i].p->one->path;
+		const char *name = path_basename(from);
+		struct string_list_item *dir;
+		int dst_index;
+
+		if (rename_src[i].p->one->rename_used)
+			continue;
+		strbuf_reset(&path);
+		strbuf_add(&path, from, name - from);
+		dir = string_list_lookup(&dirs, path.buf);
+		if (!dir)
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s%s", (const char *)dir->util, name);
+		dst_index = find_rename_dst(path.buf);
+		if (dst_index >= 0 && !rename_dst[dst_index].pair)
+			renames += try_guessed_rename(options, dst_index, i,
+						      min_score);
+	}
+
+	strbuf_release(&path);
+	string_list_clear(&dirs, 1);
+	return renames;
+}
+
+struct rename_src_entry {
+	struct oidmap_entry entry;
+	int index;
+};
+
+/* Pair up again the blobs that make a rename in rename_notes. */
+static int find_remembered_renames(struct diff_options *options,
+				   int min_score)
+{
+	struct oidmap srcs;
+	int i, renames = 0;
+
+	oidmap_init(&srcs, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+		struct rename_src_entry *e;
+
+		if (one->rename_used || !one->oid_valid ||
+		    oidmap_get(&srcs, &one->oid))
+			continue;
+		e = xmalloc(sizeof(*e));
+		oidcpy(&e->entry.oid, &one->oid);
+		e->index = i;
+		oidmap_put(&srcs, e);
+	}
+
+	for (i = 0; srcs.map.tablesize && i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+		struct rename_src_entry *e;
+		struct object_id src_oid;
+		const char *p;
+		char *note;
+		size_t size;
+		int score;
+
+		if (rename_dst[i].pair || !two->oid_valid)
+			continue;
+		note = notes_cache_get(rename_notes, &two->oid, &size);
+		if (!note)
+			continue;
+		if (!parse_oid_hex(note, &src_oid, &p) && *p == ' ' &&
+		    (score = atoi(p + 1)) >= min_score && score <= MAX_SCORE &&
+		    (e = oidmap_get(&srcs, &src_oid)) &&
+		    !rename_src[e->index].p->one->rename_used) {
+			put_rename_score(&src_oid, &two->oid, score);
+			record_rename_pair(i, e->index, score);
+			renames++;
+		}
+		free(note);
+	}
+
+	oidmap_free(&srcs, 1);
+	return renames;
+}
+
+/* Store the inexact renames that were found in rename_notes. */
+static void remember_renames(void)
+{
+	struct strbuf note = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *p = rename_dst[i].pair;
+		const struct object_id *old;
+		struct object_id oid;
+
+		if (!p || p->score >= MAX_SCORE ||
+		    !p->one->oid_valid || !p->two->oid_valid ||
+		    !strcmp(p->one->path, p->two->path))
+			continue;
+		strbuf_reset(&note);
+		strbuf_addf(&note, "%s %d\n", oid_to_hex(&p->one->oid),
+			    p->score);
+		old = get_note(&rename_notes->tree, &p->two->oid);
+		if (old) {
+			hash_object_file(note.buf, note.len, "blob", &oid);
+			if (oideq(old, &oid))
+				continue;
+		}
+		notes_cache_put(rename_notes, &p->two->oid, note.buf, note.len);
+	}
+	strbuf_release(&note);
+	notes_cache_write(rename_notes);
+}
+
+/*
+ * When detecting renames only, a source can be used once, and the ones
+ * already used would only take up room in the similarity matrix.
+ */
+static void remove_used_rename_src(void)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < rename_src_nr; i++)
+		if (!rename_src[i].p->one->rename_used)
+			rename_src[nr++] = rename_src[i];
+	rename_src_nr = nr;
+}
+
+/*
+ * The similarity matrix has a row of NUM_CANDIDATE_PER_DST best scores for
+ * each destination that is not an exact rename. Rows can be filled by
+ * several threads, as long as the filespecs involved were read and hashed
+ * up front by prepare_similarity().
+ */
+struct rename_matrix {
+	struct diff_options *options;
+	struct diff_score *mx;
+	int *dst_index; /* in rename_dst, for each row */
+	int nr;
+	int minimum_score;
+	int skip_unmodified;
+	int prepared;
+
+	struct progress *progress;
+	uint64_t progress_done;
+
+	pthread_mutex_t mutex;
+	int next;
+};
+
+/* Fewer source/destination pairs than this per thread are not worth it. */
+#define RENAME_THREAD_COST 10000
+
+static void fill_rename_row(struct rename_matrix *rm, int row)
+{
+	int i = rm->dst_index[row], j;
+	struct diff_filespec *two = rename_dst[i].two;
+	struct diff_score *m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[j].p))
+			continue;
+
+		this_src.score = estimate_similarity(rm->options->repo,
+						     one, two,
+						     rm->minimum_score,
+						     rm->prepared);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+		/*
+		 * Once we run estimate_similarity,
+		 * We do not need the text anymore.
+		 */
+		if (!rm->prepared) {
+			diff_free_filespec_blob(one);
+			diff_free_filespec_blob(two);
+		}
+	}
+}
+
+static int compare_sizes(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Is there a size in "sizes" (sorted) that estimate_similarity() might not
+ * reject next to "size"? The smaller of the two must be at least
+ * minimum_score/MAX_SCORE of the larger.
+ */
+static int has_similar_size(const unsigned long *sizes, int nr,
+			    unsigned long size, int minimum_score)
+{
+	uint64_t lo = (uint64_t)size * minimum_score / MAX_SCORE;
+	uint64_t hi = minimum_score ?
+		(uint64_t)size * MAX_SCORE / minimum_score : UINT64_MAX;
+	int first = 0, last = nr;
+
+	while (first < last) {
+		int next = first + (last - first) / 2;
+		if (sizes[next] < lo)
+			first = next + 1;
+		else
+			last = next;
+	}
+	return first < nr && sizes[first] <= hi;
+}
+
+static int populate_size(struct repository *r, struct diff_filespec *s,
+			 unsigned long *size)
+{
+	if (!S_ISREG(s->mode) ||
+	    (!s->cnt_data && diff_populate_filespec(r, s, CHECK_SIZE_ONLY)))
+		return -1;
+	*size = s->size;
+	return 0;
+}
+
+static void prepare_similarity(struct repository *r, struct diff_filespec *s,
+			       const unsigned long *sizes, int nr,
+			       int minimum_score)
+{
+	if (!S_ISREG(s->mode) || s->cnt_data ||
+	    !has_similar_size(sizes, nr, s->size, minimum_score) ||
+	    diff_populate_filespec(r, s, 0))
+		return;
+	diffcore_prepare_count(r, s, &s->cnt_data);
+	diff_free_filespec_blob(s);
+}
+
+/*
+ * Read and hash all the filespecs estimate_similarity() would read and
+ * hash, i.e. those of a regular file with a size that is similar enough to
+ * one on the other side, so that the rows can be filled in any order.
+ */
+static void prepare_rename_matrix(struct rename_matrix *rm)
+{
+	struct repository *r = rm->options->repo;
+	unsigned long *src_sizes, *dst_sizes;
+	int src_nr = 0, dst_nr = 0, i;
+
+	ALLOC_ARRAY(src_sizes, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rm->skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (!populate_size(r, rename_src[i].p->one, &src_sizes[src_nr]))
+			src_nr++;
+	}
+	ALLOC_ARRAY(dst_sizes, rm->nr);
+	for (i = 0; i < rm->nr; i++)
+		if (!populate_size(r, rename_dst[rm->dst_index[i]].two,
+				   &dst_sizes[dst_nr]))
+			dst_nr++;
+	QSORT(src_sizes, src_nr, compare_sizes);
+	QSORT(dst_sizes, dst_nr, compare_sizes);
+
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rm->skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		prepare_similarity(r, rename_src[i].p->one, dst_sizes, dst_nr,
+				   rm->minimum_score);
+	}
+	for (i = 0; i < rm->nr; i++)
+		prepare_similarity(r, rename_dst[rm->dst_index[i]].two,
+				   src_sizes, src_nr, rm->minimum_score);
+
+	free(src_sizes);
+	free(dst_sizes);
+	rm->prepared = 1;
+}
+
+static void *rename_worker(void *data)
+{
+	struct rename_matrix *rm = data;
+
+	for (;;) {
+		int row;
+
+		pthread_mutex_lock(&rm->mutex);
+		row = rm->next < rm->nr ? rm->next++ : -1;
+		pthread_mutex_unlock(&rm->mutex);
+		if (row < 0)
+			break;
+
+		fill_rename_row(rm, row);
+
+		pthread_mutex_lock(&rm->mutex);
+		rm->progress_done += rename_src_nr;
+		display_progress(rm->progress, rm->progress_done);
+		pthread_mutex_unlock(&rm->mutex);
+	}
+	return NULL;
+}
+
+static int rename_threads(struct rename_matrix *rm, int *forced)
+{
+	const char *env = getenv("GIT_TEST_RENAME_THREADS");
+	uint64_t pairs = (uint64_t)rm->nr * rename_src_nr;
+	int threads, is_bool;
+
+	*forced = 0;
+	if (!HAVE_THREADS)
+		return 1;
+
+	if (env && *env) {
+		*forced = 1;
+		if (strtol_i(env, 10, &threads))
+			die(_("invalid value for GIT_TEST_RENAME_THREADS: '%s'"),
+			    env);
+		if (threads < 1)
+			threads = online_cpus();
+		return threads;
+	}
+
+	if (repo_config_get_bool_or_int(rm->options->repo,
+					"diff.renamethreads",
+					&is_bool, &threads))
+		threads = 0;
+	else if (is_bool)
+		threads = threads ? 0 : 1;
+	if (threads < 1)
+		threads = online_cpus();
+	if (threads > pairs / RENAME_THREAD_COST)
+		threads = pairs / RENAME_THREAD_COST;
+	return threads < 1 ? 1 : threads;
+}
+
+static void fill_rename_matrix(struct rename_matrix *rm)
+{
+	int forced, threads = rename_threads(rm, &forced), i, err;
+	pthread_t *workers;
+
+	if (threads > rm->nr)
+		threads = rm->nr;
+	if (threads < 2 && !forced) {
+		for (i = 0; i < rm->nr; i++) {
+			fill_rename_row(rm, i);
+			display_progress(rm->progress,
+					 (uint64_t)(rm->dst_index[i] + 1) *
+					 (uint64_t)rename_src_nr);
+		}
+		return;
+	}
+
+	trace2_region_enter("diff", "rename/threads", rm->options->repo);
+	trace2_data_intmax("diff", rm->options->repo, "rename/threads",
+			   threads);
+	prepare_rename_matrix(rm);
+	pthread_mutex_init(&rm->mutex, NULL);
+
+	/* this thread is one of the workers */
+	if (threads < 1)
+		threads = 1;
+	rename_scores_threaded = 1;
+	ALLOC_ARRAY(workers, threads - 1);
+	for (i = 0; i < threads - 1; i++) {
+		err = pthread_create(&workers[i], NULL, rename_worker, rm);
+		if (err)
+			die(_("unable to create threaded rename detection: %s"),
+			    strerror(err));
+	}
+	rename_worker(rm);
+	for (i = 0; i < threads - 1; i++)
+		pthread_join(workers[i], NULL);
+	rename_scores_threaded = 0;
+
+	free(workers);
+	pthread_mutex_destroy(&rm->mutex);
+	trace2_region_leave("diff", "rename/threads", rm->options->repo);
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
 	int minimum_score = options->rename_score;
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
-	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_create, dst_cnt;
+	struct rename_matrix rm;
+	int i, rename_count, skip_unmodified = 0;
+	int num_create;
 	struct progress *progress = NULL;
 
 	if (!minimum_score)
 		minimum_score = DEFAULT_RENAME_SCORE;
+	init_rename_cache(options);
 
 	for (i = 0; i < q->nr; i++) {
 		struct diff_filepair *p = q->queue[i];
@@ -518,6 +1273,35 @@ void diffcore_rename(struct diff_options *options)
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	if (rename_count < rename_dst_nr)
+		prefetch_rename_candidates(options,
+					   rename_dst_nr - rename_count);
+
+	if (detect_rename == DIFF_DETECT_RENAME && options->break_opt < 0 &&
+	    rename_count < rename_dst_nr) {
+		int guess_score = minimum_score + (MAX_SCORE - minimum_score) / 2;
+		int guessed;
+
+		if (rename_cache == DIFF_RENAME_CACHE_PERSIST) {
+			guessed = find_remembered_renames(options, guess_score);
+			trace2_data_intmax("diff", options->repo,
+					   "rename/remembered", guessed);
+			rename_count += guessed;
+		}
+
+		guessed = find_basename_renames(options, guess_score);
+		trace2_data_intmax("diff", options->repo,
+				   "rename/basename", guessed);
+		rename_count += guessed;
+
+		guessed = find_dir_renames(options, guess_score);
+		trace2_data_intmax("diff", options->repo,
+				   "rename/directory", guessed);
+		rename_count += guessed;
+	}
+	if (detect_rename != DIFF_DETECT_COPY)
+		remove_used_rename_src();
+
 	/*
 	 * Calculate how many renames are left (but all the source
 	 * files still remain as options for rename/copies!)
@@ -545,54 +1329,37 @@ void diffcore_rename(struct diff_options *options)
 				(uint64_t)rename_dst_nr * (uint64_t)rename_src_nr);
 	}
 
-	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
+	memset(&rm, 0, sizeof(rm));
+	rm.options = options;
+	rm.minimum_score = minimum_score;
+	rm.skip_unmodified = skip_unmodified;
+	rm.progress = progress;
+	rm.mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create),
+			sizeof(*rm.mx));
+	ALLOC_ARRAY(rm.dst_index, num_create);
+	for (i = 0; i < rename_dst_nr; i++) {
 		if (rename_dst[i].pair)
 			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
+		rm.dst_index[rm.nr++] = i;
 	}
+	fill_rename_matrix(&rm);
 	stop_progress(&progress);
+	free(rm.dst_index);
 
 	/* cost matrix sorted by most to least similar pair */
-	QSORT(mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
+	QSORT(rm.mx, rm.nr * NUM_CANDIDATE_PER_DST, score_compare);
 
-	rename_count += find_renames(mx, dst_cnt, minimum_score, 0);
+	rename_count += find_renames(rm.mx, rm.nr, minimum_score, 0);
 	if (detect_rename == DIFF_DETECT_COPY)
-		rename_count += find_renames(mx, dst_cnt, minimum_score, 1);
-	free(mx);
+		rename_count += find_renames(rm.mx, rm.nr, minimum_score, 1);
+	free(rm.mx);
 
  cleanup:
+	if (rename_cache)
+		trace2_data_intmax("diff", options->repo, "rename/cached",
+				   rename_scores_hits);
+	if (rename_cache == DIFF_RENAME_CACHE_PERSIST)
+		remember_renames();
 	/* At this point, we have found some renames and copies and they
 	 * are recorded in rename_dst.  The original list is still in *q.
 	 */
@@ -49,6 +49,7 @@ struct diff_filespec {
 #define DIRTY_SUBMODULE_MODIFIED  2
 	unsigned is_stdin : 1;
 	unsigned has_more_entries : 1; /* only appear in combined diff */
+	unsigned pooled : 1;	 /* allocated from the diff_pool_begin() pool */
 	/* data should be considered "binary"; -1 means "don't know yet" */
 	signed int is_binary : 2;
 	struct userdiff_driver *driver;
@@ -76,6 +77,7 @@ struct diff_filepair {
 	unsigned is_unmerged : 1;
 	unsigned done_skip_stat_unmatch : 1;
 	unsigned skip_stat_unmatch_result : 1;
+	unsigned pooled : 1;
 };
 #define DIFF_PAIR_UNMERGED(p) ((p)->is_unmerged)
 
@@ -92,6 +94,9 @@ struct diff_filepair {
 
 void diff_free_filepair(struct diff_filepair *);
 
+/* Free the pair itself, but not its filespecs, which the caller took over. */
+void diff_free_filepair_only(struct diff_filepair *);
+
 int diff_unmodified_pair(struct diff_filepair *);
 
 struct diff_queue_struct {
@@ -150,4 +155,24 @@ int diffcore_count_changes(struct repository *r,
 			   unsigned long *src_copied,
 			   unsigned long *literal_added);
 
+/*
+ * Fill "*count_p" of the populated "one" the way diffcore_count_changes()
+ * would, so that later calls with both counts filled do not need to look
+ * at the filespecs, and can be made by several threads at once.
+ */
+void diffcore_prepare_count(struct repository *r,
+			    struct diff_filespec *one,
+			    void **count_p);
+
+/* Free the "cnt_data" of a filespec. */
+void diffcore_free_count(void *count);
+
+/*
+ * Between these, the counts of the filespecs with a known object name
+ * are made once per blob and shared. diffcore_std() uses them around
+ * break, rename and copy detection. They nest.
+ */
+void diffcore_count_cache_begin(void);
+void diffcore_count_cache_end(void);
+
 #endif
@@ -20,6 +20,7 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "thread-utils.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -599,6 +600,341 @@ void parse_exclude_pattern(const char **pattern,
 	*patternlen = len;
 }
 
+/*
+ * A directory in one of the cone mode sets, without the leading and
+ * trailing slash.
+ */
+struct cone_dir {
+	struct hashmap_entry ent;
+	size_t len;
+	char path[FLEX_ARRAY];
+};
+
+static int cone_dir_cmp(const void *unused_cmp_data,
+			const void *entry, const void *entry_or_key,
+			const void *keydata)
+{
+	const struct cone_dir *a = entry;
+	const struct cone_dir *b = entry_or_key;
+	const char *path = keydata ? keydata : b->path;
+
+	if (a->len != b->len)
+		return 1;
+	return ignore_case ? strncasecmp(a->path, path, a->len) :
+			     memcmp(a->path, path, a->len);
+}
+
+static void cone_dir_key(struct cone_dir *key, const char *path, size_t len)
+{
+	hashmap_entry_init(key, ignore_case ? memihash(path, len) :
+					      memhash(path, len));
+	key->len = len;
+}
+
+static int cone_contains(struct hashmap *map, const char *path, size_t len)
+{
+	struct cone_dir key;
+
+	cone_dir_key(&key, path, len);
+	return !!hashmap_get(map, &key, path);
+}
+
+static void cone_add(struct hashmap *map, const char *path, size_t len)
+{
+	struct cone_dir *d;
+
+	if (cone_contains(map, path, len))
+		return;
+	FLEX_ALLOC_MEM(d, path, path, len);
+	cone_dir_key(d, path, len);
+	hashmap_add(map, d);
+}
+
+static void cone_remove(struct hashmap *map, const char *path, size_t len)
+{
+	struct cone_dir key;
+
+	cone_dir_key(&key, path, len);
+	free(hashmap_remove(map, &key, path));
+}
+
+/*
+ * Add the leading directories of path to the parent set, so that the
+ * files directly inside them are matched, and so that only paths
+ * inside a matched directory need to be looked at.
+ */
+static void cone_add_parents(struct exclude_list *el,
+			     const char *path, size_t len)
+{
+	while (len) {
+		while (len && path[len - 1] != '/')
+			len--;
+		if (!len)
+			break;
+		cone_add(&el->parent_hashmap, path, --len);
+	}
+}
+
+/*
+ * Copy the directory named by a cone mode pattern without the leading
+ * slash into dir, unquoting it. Return -1 if it contains wildcards.
+ */
+static int cone_pattern_dir(const char *pattern, int len, struct strbuf *dir)
+{
+	int i;
+
+	strbuf_reset(dir);
+	for (i = 1; i < len; i++) {
+		if (pattern[i] == '\\' && i + 1 < len)
+			i++;
+		else if (is_glob_special(pattern[i]))
+			return -1;
+		strbuf_addch(dir, pattern[i]);
+	}
+	return 0;
+}
+
+/*
+ * Cone mode only allows the patterns described in the "Sparse checkout"
+ * section of git-read-tree(1): one including everything and one
+ * excluding all top-level directories and, per directory, one
+ * including everything inside it, possibly followed by one excluding
+ * all directories inside it again. Record such a pattern in the
+ * hashsets, or turn cone mode off.
+ */
+static void add_exclude_to_hashsets(struct exclude_list *el,
+				    struct exclude *x)
+{
+	struct strbuf dir = STRBUF_INIT;
+	unsigned flags = x->flags & ~EXC_FLAG_NODIR;
+
+	if (!el->recursive_hashmap.tablesize) {
+		hashmap_init(&el->recursive_hashmap, cone_dir_cmp, NULL, 0);
+		hashmap_init(&el->parent_hashmap, cone_dir_cmp, NULL, 0);
+	}
+
+	if (x->patternlen == 2 && !strncmp(x->pattern, "/*", 2)) {
+		if (!flags) {
+			el->full_cone = 1;
+			return;
+		}
+		if (flags == (EXC_FLAG_NEGATIVE | EXC_FLAG_MUSTBEDIR)) {
+			el->full_cone = 0;
+			return;
+		}
+	} else if (x->patternlen > 3 && *x->pattern == '/' &&
+		   !strncmp(x->pattern + x->patternlen - 2, "/*", 2) &&
+		   flags == (EXC_FLAG_NEGATIVE | EXC_FLAG_MUSTBEDIR) &&
+		   !cone_pattern_dir(x->pattern, x->patternlen - 2, &dir)) {
+		if (!cone_contains(&el->recursive_hashmap, dir.buf, dir.len)) {
+			if (!el->quiet_cone_fallback)
+				warning(_("unrecognized negative pattern: '%s'"),
+					x->pattern);
+			goto disable;
+		}
+		cone_remove(&el->recursive_hashmap, dir.buf, dir.len);
+		cone_add(&el->parent_hashmap, dir.buf, dir.len);
+		strbuf_release(&dir);
+		return;
+	} else if (x->patternlen > 1 && *x->pattern == '/' &&
+		   flags == EXC_FLAG_MUSTBEDIR &&
+		   !cone_pattern_dir(x->pattern, x->patternlen, &dir)) {
+		cone_add(&el->recursive_hashmap, dir.buf, dir.len);
+		cone_add_parents(el, dir.buf, dir.len);
+		strbuf_release(&dir);
+		return;
+	}
+	if (!el->quiet_cone_fallback)
+		warning(_("unrecognized pattern: '%s'"), x->pattern);
+
+disable:
+	if (!el->quiet_cone_fallback)
+		warning(_("disabling cone pattern matching"));
+	strbuf_release(&dir);
+	hashmap_free(&el->recursive_hashmap, 1);
+	hashmap_free(&el->parent_hashmap, 1);
+	el->use_cone_patterns = 0;
+}
+
+/*
+ * Return EXC_MATCHED_RECURSIVE if the path is inside a recursively
+ * matched directory (or is one), 1 if it is directly inside the root
+ * or a parent directory, and 0 otherwise.
+ */
+static int cone_patterns_match(const char *pathname, int pathlen,
+			       struct exclude_list *el)
+{
+	int i, last_slash = -1;
+
+	if (el->full_cone)
+		return EXC_MATCHED_RECURSIVE;
+
+	for (i = 0; i <= pathlen; i++) {
+		if (i < pathlen && pathname[i] != '/')
+			continue;
+		if (cone_contains(&el->recursive_hashmap, pathname, i))
+			return EXC_MATCHED_RECURSIVE;
+		if (i < pathlen)
+			last_slash = i;
+	}
+	if (last_slash < 0)
+		return 1;
+	return cone_contains(&el->parent_hashmap, pathname, last_slash);
+}
+
+/*
+ * Lists shorter than this are cheap enough to walk as they are.
+ */
+#define EXCLUDE_INDEX_MIN 16
+
+/*
+ * The patterns of a list that can only match a path with a given
+ * basename, extension, or leading directory, as positions in
+ * el->excludes[] in increasing order.
+ */
+struct exclude_bucket {
+	struct hashmap_entry ent;
+	int *pos;
+	int nr, alloc;
+	size_t len;
+	char key[FLEX_ARRAY];
+};
+
+struct exclude_index {
+	/* NODIR patterns without wildcards, by the basename they match */
+	struct hashmap basenames;
+	/* "*.ext" NODIR patterns, by the extension (".ext") */
+	struct hashmap extensions;
+	/*
+	 * The other patterns that match full paths, by the directory
+	 * their base and the literal part of the pattern lead to.
+	 */
+	struct hashmap dirs;
+	/* whatever is left, walked like the list itself */
+	int *residual;
+	int residual_nr, residual_alloc;
+};
+
+static int exclude_bucket_cmp(const void *unused_cmp_data,
+			      const void *entry, const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct exclude_bucket *a = entry;
+	const struct exclude_bucket *b = entry_or_key;
+	const char *key = keydata ? keydata : b->key;
+
+	if (a->len != b->len)
+		return 1;
+	return fspathncmp(a->key, key, a->len);
+}
+
+static struct exclude_bucket *exclude_bucket_get(struct hashmap *map,
+						 const char *key, size_t len)
+{
+	struct exclude_bucket k;
+
+	hashmap_entry_init(&k, ignore_case ? memihash(key, len) :
+					     memhash(key, len));
+	k.len = len;
+	return hashmap_get(map, &k, key);
+}
+
+static void exclude_bucket_add(struct hashmap *map, const char *key,
+			       size_t len, int pos)
+{
+	struct exclude_bucket *b = exclude_bucket_get(map, key, len);
+
+	if (!b) {
+		FLEX_ALLOC_MEM(b, key, key, len);
+		hashmap_entry_init(b, ignore_case ? memihash(key, len) :
+						    memhash(key, len));
+		b->len = len;
+		hashmap_add(map, b);
+	}
+	ALLOC_GROW(b->pos, b->nr + 1, b->alloc);
+	b->pos[b->nr++] = pos;
+}
+
+static void index_one_exclude(struct exclude_index *idx, struct exclude *x,
+			      int pos, struct strbuf *buf)
+{
+	const char *pattern = x->pattern;
+	int prefix = x->nowildcardlen;
+	const char *slash;
+
+	if (x->flags & EXC_FLAG_NODIR) {
+		if (prefix == x->patternlen) {
+			exclude_bucket_add(&idx->basenames, pattern,
+					   x->patternlen, pos);
+			return;
+		}
+		if ((x->flags & EXC_FLAG_ENDSWITH) && pattern[1] == '.') {
+			exclude_bucket_add(&idx->extensions, pattern + 1,
+					   x->patternlen - 1, pos);
+			return;
+		}
+		ALLOC_GROW(idx->residual, idx->residual_nr + 1,
+			   idx->residual_alloc);
+		idx->residual[idx->residual_nr++] = pos;
+		return;
+	}
+
+	/*
+	 * match_pathname() wants the path to start with the base and
+	 * the literal part of the pattern; everything up to the last
+	 * slash in there is a leading directory of the path.
+	 */
+	if (*pattern == '/') {
+		pattern++;
+		prefix--;
+	}
+	strbuf_reset(buf);
+	strbuf_add(buf, x->base, x->baselen);
+	strbuf_add(buf, pattern, prefix);
+	slash = strrchr(buf->buf, '/');
+	exclude_bucket_add(&idx->dirs, buf->buf,
+			   slash ? slash - buf->buf : 0, pos);
+}
+
+static void build_exclude_index(struct exclude_list *el)
+{
+	struct exclude_index *idx = xcalloc(1, sizeof(*idx));
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	hashmap_init(&idx->basenames, exclude_bucket_cmp, NULL, 0);
+	hashmap_init(&idx->extensions, exclude_bucket_cmp, NULL, 0);
+	hashmap_init(&idx->dirs, exclude_bucket_cmp, NULL, 0);
+	for (i = 0; i < el->nr; i++)
+		index_one_exclude(idx, el->excludes[i], i, &buf);
+	strbuf_release(&buf);
+	el->index = idx;
+}
+
+static void free_exclude_buckets(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct exclude_bucket *b;
+
+	hashmap_iter_init(map, &iter);
+	while ((b = hashmap_iter_next(&iter)))
+		free(b->pos);
+	hashmap_free(map, 1);
+}
+
+static void free_exclude_index(struct exclude_list *el)
+{
+	struct exclude_index *idx = el->index;
+
+	if (!idx)
+		return;
+	free_exclude_buckets(&idx->basenames);
+	free_exclude_buckets(&idx->extensions);
+	free_exclude_buckets(&idx->dirs);
+	free(idx->residual);
+	FREE_AND_NULL(el->index);
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *el, int srcpos)
 {
@@ -623,6 +959,10 @@ void add_exclude(const char *string, const char *base,
 	ALLOC_GROW(el->excludes, el->nr + 1, el->alloc);
 	el->excludes[el->nr++] = x;
 	x->el = el;
+	free_exclude_index(el);
+
+	if (el->use_cone_patterns)
+		add_exclude_to_hashsets(el, x);
 }
 
 static int read_skip_worktree_file_from_index(const struct index_state *istate,
@@ -654,6 +994,9 @@ void clear_exclude_list(struct exclude_list *el)
 		free(el->excludes[i]);
 	free(el->excludes);
 	free(el->filebuf);
+	hashmap_free(&el->recursive_hashmap, 1);
+	hashmap_free(&el->parent_hashmap, 1);
+	free_exclude_index(el);
 
 	memset(el, 0, sizeof(*el));
 }
@@ -1021,6 +1364,52 @@ int match_pathname(const char *pathname, int pathlen,
  * any, determines the fate.  Returns the exclude_list element which
  * matched, or NULL for undecided.
  */
+static int exclude_matches(struct exclude *x,
+			   const char *pathname, int pathlen,
+			   const char *basename, int *dtype,
+			   struct index_state *istate)
+{
+	if (x->flags & EXC_FLAG_MUSTBEDIR) {
+		if (*dtype == DT_UNKNOWN)
+			*dtype = get_dtype(NULL, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (x->flags & EXC_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      x->pattern, x->nowildcardlen,
+				      x->patternlen, x->flags);
+
+	assert(x->baselen == 0 || x->base[x->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      x->base, x->baselen ? x->baselen - 1 : 0,
+			      x->pattern, x->nowildcardlen, x->patternlen,
+			      x->flags);
+}
+
+/*
+ * Returns the position of the last pattern of the bucket that matches
+ * the path, if it comes after "best", or "best" otherwise.
+ */
+static int last_match_in_bucket(struct exclude_list *el,
+				struct exclude_bucket *b, int best,
+				const char *pathname, int pathlen,
+				const char *basename, int *dtype,
+				struct index_state *istate)
+{
+	int i;
+
+	if (!b)
+		return best;
+	for (i = b->nr - 1; 0 <= i && best < b->pos[i]; i--)
+		if (exclude_matches(el->excludes[b->pos[i]], pathname,
+				    pathlen, basename, dtype, istate))
+			return b->pos[i];
+	return best;
+}
+
 static struct exclude *last_exclude_matching_from_list(const char *pathname,
 						       int pathlen,
 						       const char *basename,
@@ -1028,55 +1417,67 @@ static struct exclude *last_exclude_matching_from_list(const char *pathname,
 						       struct exclude_list *el,
 						       struct index_state *istate)
 {
-	struct exclude *exc = NULL; /* undecided */
-	int i;
+	int i, best = -1;
+	struct exclude_index *idx;
+	const char *p;
 
 	if (!el->nr)
 		return NULL;	/* undefined */
 
-	for (i = el->nr - 1; 0 <= i; i--) {
-		struct exclude *x = el->excludes[i];
-		const char *exclude = x->pattern;
-		int prefix = x->nowildcardlen;
-
-		if (x->flags & EXC_FLAG_MUSTBEDIR) {
-			if (*dtype == DT_UNKNOWN)
-				*dtype = get_dtype(NULL, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
+	if (el->nr < EXCLUDE_INDEX_MIN) {
+		for (i = el->nr - 1; 0 <= i; i--)
+			if (exclude_matches(el->excludes[i], pathname, pathlen,
+					    basename, dtype, istate))
+				return el->excludes[i];
+		return NULL;
+	}
 
-		if (x->flags & EXC_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, x->patternlen,
-					   x->flags)) {
-				exc = x;
-				break;
-			}
+	/*
+	 * The last pattern that matches wins: look for it in each set
+	 * of patterns that can match this path, and keep the latest.
+	 */
+	if (!el->index)
+		build_exclude_index(el);
+	idx = el->index;
+
+	best = last_match_in_bucket(el, exclude_bucket_get(&idx->basenames,
+			basename, pathlen - (basename - pathname)),
+			best, pathname, pathlen, basename, dtype, istate);
+	for (p = basename; (p = strchr(p, '.')); p++)
+		best = last_match_in_bucket(el,
+				exclude_bucket_get(&idx->extensions, p,
+						   pathlen - (p - pathname)),
+				best, pathname, pathlen, basename, dtype, istate);
+	for (i = 0; i < pathlen; i++) {
+		if (i && pathname[i] != '/')
 			continue;
-		}
-
-		assert(x->baselen == 0 || x->base[x->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   x->base, x->baselen ? x->baselen - 1 : 0,
-				   exclude, prefix, x->patternlen, x->flags)) {
-			exc = x;
+		best = last_match_in_bucket(el,
+				exclude_bucket_get(&idx->dirs, pathname, i),
+				best, pathname, pathlen, basename, dtype, istate);
+	}
+	for (i = idx->residual_nr - 1; 0 <= i && best < idx->residual[i]; i--)
+		if (exclude_matches(el->excludes[idx->residual[i]], pathname,
+				    pathlen, basename, dtype, istate)) {
+			best = idx->residual[i];
 			break;
 		}
-	}
-	return exc;
+	return best < 0 ? NULL : el->excludes[best];
 }
 
 /*
  * Scan the list and let the last match determine the fate.
  * Return 1 for exclude, 0 for include and -1 for undecided.
+ * In cone mode, the result is never undecided, and paths inside
+ * a recursively matched directory give EXC_MATCHED_RECURSIVE.
  */
 int is_excluded_from_list(const char *pathname,
 			  int pathlen, const char *basename, int *dtype,
 			  struct exclude_list *el, struct index_state *istate)
 {
 	struct exclude *exclude;
+
+	if (el->use_cone_patterns && el->nr)
+		return cone_patterns_match(pathname, pathlen, el);
 	exclude = last_exclude_matching_from_list(pathname, pathlen, basename,
 						  dtype, el, istate);
 	if (exclude)
@@ -1776,6 +2177,13 @@ static void add_untracked(struct untracked_cache_dir *dir, const char *name)
 	dir->untracked[dir->untracked_nr++] = xstrdup(name);
 }
 
+struct untracked_prefetch {
+	struct untracked_cache_dir *ucd;
+	char *path;
+	unsigned int failed : 1;
+	struct stat st;
+};
+
 static int valid_cached_dir(struct dir_struct *dir,
 			    struct untracked_cache_dir *untracked,
 			    struct index_state *istate,
@@ -1792,7 +2200,15 @@ static int valid_cached_dir(struct dir_struct *dir,
 	 */
 	refresh_fsmonitor(istate);
 	if (!(dir->untracked->use_fsmonitor && untracked->valid)) {
-		if (lstat(path->len ? path->buf : ".", &st)) {
+		int failed;
+
+		if (untracked->prefetch) {
+			failed = untracked->prefetch->failed;
+			st = untracked->prefetch->st;
+			untracked->prefetch = NULL;
+		} else
+			failed = lstat(path->len ? path->buf : ".", &st);
+		if (failed) {
 			memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
 			return 0;
 		}
@@ -2210,11 +2626,8 @@ static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *d
 		return NULL;
 	}
 
-	if (!dir->untracked->root) {
-		const int len = sizeof(*dir->untracked->root);
-		dir->untracked->root = xmalloc(len);
-		memset(dir->untracked->root, 0, len);
-	}
+	if (!dir->untracked->root)
+		FLEX_ALLOC_STR(dir->untracked->root, name, "");
 
 	/* Validate $GIT_DIR/info/exclude and core.excludesfile */
 	root = dir->untracked->root;
@@ -2234,10 +2647,157 @@ static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *d
 	return root;
 }
 
+/*
+ * Same limits as preload-index.c: at most 20 threads, and at least
+ * 500 directories per thread for starting one to be worth it.
+ */
+#define PREFETCH_MAX_PARALLEL (20)
+#define PREFETCH_THREAD_COST (500)
+
+struct prefetch_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct untracked_prefetch *items;
+	int nr;
+};
+
+static void *prefetch_thread(void *_data)
+{
+	struct prefetch_thread_data *p = _data;
+	int i;
+
+	for (i = 0; i < p->nr; i++) {
+		struct untracked_prefetch *item = p->items + i;
+		const char *c_path = *item->path ? item->path : ".";
+		DIR *fdir;
+
+		if (lstat(c_path, &item->st)) {
+			item->failed = 1;
+			continue;
+		}
+		if (item->ucd->valid &&
+		    !match_stat_data_racy(p->istate, &item->ucd->stat_data,
+					  &item->st))
+			continue;
+
+		/*
+		 * The directory changed and read_directory_recursive()
+		 * is going to read it again. Do it once here, so that
+		 * the serial scan finds it in the kernel's caches
+		 * rather than waiting on the filesystem.
+		 */
+		fdir = opendir(c_path);
+		if (!fdir)
+			continue;
+		while (readdir(fdir))
+			; /* nothing */
+		closedir(fdir);
+	}
+	return NULL;
+}
+
+static void collect_untracked_dirs(struct untracked_cache_dir *ucd,
+				   struct strbuf *path, int use_fsmonitor,
+				   struct untracked_prefetch **items,
+				   int *nr, int *alloc)
+{
+	size_t len = path->len;
+	int i;
+
+	if (!(use_fsmonitor && ucd->valid)) {
+		ALLOC_GROW(*items, *nr + 1, *alloc);
+		(*items)[*nr].ucd = ucd;
+		(*items)[*nr].path = xstrdup(path->buf);
+		(*items)[*nr].failed = 0;
+		(*nr)++;
+	}
+	for (i = 0; i < ucd->dirs_nr; i++) {
+		strbuf_addf(path, "%s/", ucd->dirs[i]->name);
+		collect_untracked_dirs(ucd->dirs[i], path, use_fsmonitor,
+				       items, nr, alloc);
+		strbuf_setlen(path, len);
+	}
+}
+
+/*
+ * The untracked cache remembers every directory the last scan went
+ * through, so the lstat() calls that revalidate them, and the
+ * directory reads for those that changed, can be issued in parallel
+ * up front. read_directory_recursive() then consumes these results,
+ * so the list it builds is the same as without threads.
+ */
+static struct untracked_prefetch *prefetch_untracked_dirs(struct dir_struct *dir,
+							  struct index_state *istate,
+							  struct untracked_cache_dir *root,
+							  int *nr_p)
+{
+	struct prefetch_thread_data data[PREFETCH_MAX_PARALLEL];
+	struct untracked_prefetch *items = NULL;
+	struct strbuf path = STRBUF_INIT;
+	int i, nr = 0, alloc = 0, threads, work, offset;
+
+	*nr_p = 0;
+	if (!HAVE_THREADS || !core_preload_index)
+		return NULL;
+
+	refresh_fsmonitor(istate);
+	collect_untracked_dirs(root, &path, dir->untracked->use_fsmonitor,
+			       &items, &nr, &alloc);
+	strbuf_release(&path);
+
+	threads = nr / PREFETCH_THREAD_COST;
+	if (nr > 1 && threads < 2 && git_env_bool("GIT_TEST_PRELOAD_INDEX", 0))
+		threads = 2;
+	if (threads < 2) {
+		for (i = 0; i < nr; i++)
+			free(items[i].path);
+		free(items);
+		return NULL;
+	}
+	if (threads > PREFETCH_MAX_PARALLEL)
+		threads = PREFETCH_MAX_PARALLEL;
+
+	trace_performance_enter();
+	work = DIV_ROUND_UP(nr, threads);
+	for (i = offset = 0; i < threads; i++, offset += work) {
+		struct prefetch_thread_data *p = data + i;
+		int err;
+
+		p->istate = istate;
+		p->items = items + offset;
+		p->nr = offset + work > nr ? nr - offset : work;
+		err = pthread_create(&p->pthread, NULL, prefetch_thread, p);
+		if (err)
+			die(_("unable to create threaded lstat: %s"), strerror(err));
+	}
+	for (i = 0; i < threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join threaded lstat");
+	for (i = 0; i < nr; i++)
+		items[i].ucd->prefetch = &items[i];
+	trace_performance_leave("prefetch untracked cache");
+
+	*nr_p = nr;
+	return items;
+}
+
+static void clear_untracked_prefetch(struct untracked_prefetch *items, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		items[i].ucd->prefetch = NULL;
+		free(items[i].path);
+	}
+	free(items);
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
 	struct untracked_cache_dir *untracked;
+	struct untracked_prefetch *prefetch = NULL;
+	int prefetch_nr = 0;
 
 	trace_performance_enter();
 
@@ -2253,8 +2813,12 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
+	else
+		prefetch = prefetch_untracked_dirs(dir, istate, untracked,
+						   &prefetch_nr);
 	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+	clear_untracked_prefetch(prefetch, prefetch_nr);
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
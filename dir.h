@@ -55,8 +55,35 @@ struct exclude_list {
 	const char *src;
 
 	struct exclude **excludes;
+
+	/*
+	 * In "cone mode" (see core.sparseCheckoutCone), the patterns
+	 * are also stored as sets of directories: everything below a
+	 * directory in recursive_hashmap is matched, and so are the
+	 * files directly inside a directory in parent_hashmap. This
+	 * is turned off again when a pattern does not fit, with a
+	 * warning unless quiet_cone_fallback is set.
+	 */
+	unsigned use_cone_patterns;
+	unsigned full_cone;
+	unsigned quiet_cone_fallback;
+	struct hashmap recursive_hashmap;
+	struct hashmap parent_hashmap;
+
+	/*
+	 * Long lists are sorted into hash tables the first time they
+	 * are matched against, so that only the patterns that might
+	 * match a path are tried. See last_exclude_matching_from_list().
+	 */
+	struct exclude_index *index;
 };
 
+/*
+ * is_excluded_from_list() returns this in cone mode for a path at or
+ * below a recursively matched directory.
+ */
+#define EXC_MATCHED_RECURSIVE 2
+
 /*
  * The contents of the per-directory exclude files are lazily read on
  * demand and then cached in memory, one per exclude_stack struct, in
@@ -121,6 +148,8 @@ struct untracked_cache_dir {
 	unsigned int recurse : 1;
 	/* null object ID means this directory does not have .gitignore */
 	struct object_id exclude_oid;
+	/* lstat() result gathered ahead of time by read_directory() */
+	struct untracked_prefetch *prefetch;
 	char name[FLEX_ARRAY];
 };
 
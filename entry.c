@@ -1,11 +1,13 @@
 #include "cache.h"
 #include "blob.h"
+#include "blob-cache.h"
 #include "object-store.h"
 #include "dir.h"
 #include "streaming.h"
 #include "submodule.h"
 #include "progress.h"
 #include "fsmonitor.h"
+#include "parallel-checkout.h"
 
 static void create_directories(const char *path, int path_len,
 			       const struct checkout *state)
@@ -126,12 +128,19 @@ static int streaming_write_entry(const struct cache_entry *ce, char *path,
 {
 	int result = 0;
 	int fd;
+	unsigned long size = 0;
+	int as_is = is_null_stream_filter(filter) && blob_cache_enabled() &&
+		    oid_object_info(the_repository, &ce->oid, &size) == OBJ_BLOB;
 
 	fd = open_output_fd(path, ce, to_tempfile);
 	if (fd < 0)
 		return -1;
 
-	result |= stream_blob_to_fd(fd, &ce->oid, filter, 1);
+	if (!as_is || blob_cache_clone(&ce->oid, size, fd)) {
+		result |= stream_blob_to_fd(fd, &ce->oid, filter, 1);
+		if (as_is && !result)
+			blob_cache_add(&ce->oid, size, fd);
+	}
 	*fstat_done = fstat_output(fd, state, statbuf);
 	result |= close(fd);
 
@@ -256,7 +265,7 @@ static int write_entry(struct cache_entry *ce,
 {
 	unsigned int ce_mode_s_ifmt = ce->ce_mode & S_IFMT;
 	struct delayed_checkout *dco = state->delayed_checkout;
-	int fd, ret, fstat_done = 0;
+	int fd, ret, fstat_done = 0, as_is = 0;
 	char *new_blob;
 	struct strbuf buf = STRBUF_INIT;
 	unsigned long size;
@@ -327,6 +336,8 @@ static int write_entry(struct cache_entry *ce,
 			free(new_blob);
 			new_blob = strbuf_detach(&buf, &newsize);
 			size = newsize;
+		} else {
+			as_is = 1;
 		}
 		/*
 		 * No "else" here as errors from convert are OK at this
@@ -341,7 +352,13 @@ static int write_entry(struct cache_entry *ce,
 			return error_errno("unable to create file %s", path);
 		}
 
-		wrote = write_in_full(fd, new_blob, size);
+		if (as_is && !blob_cache_clone(&ce->oid, size, fd)) {
+			wrote = size;
+		} else {
+			wrote = write_in_full(fd, new_blob, size);
+			if (as_is && wrote >= 0)
+				blob_cache_add(&ce->oid, size, fd);
+		}
 		if (!to_tempfile)
 			fstat_done = fstat_output(fd, state, &st);
 		close(fd);
@@ -367,19 +384,26 @@ static int write_entry(struct cache_entry *ce,
 	}
 
 finish:
+	if (state->refresh_cache) {
+		if (!fstat_done && lstat(ce->name, &st) < 0)
+			return error_errno("unable to stat just-written file %s",
+					   ce->name);
+		update_ce_after_write(state, ce, &st);
+	}
+delayed:
+	return 0;
+}
+
+void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+			   struct stat *st)
+{
 	if (state->refresh_cache) {
 		assert(state->istate);
-		if (!fstat_done)
-			if (lstat(ce->name, &st) < 0)
-				return error_errno("unable to stat just-written file %s",
-						   ce->name);
-		fill_stat_cache_info(state->istate, ce, &st);
+		fill_stat_cache_info(state->istate, ce, st);
 		ce->ce_flags |= CE_UPDATE_IN_BASE;
 		mark_fsmonitor_invalid(state->istate, ce);
 		state->istate->cache_changed |= CE_ENTRY_CHANGED;
 	}
-delayed:
-	return 0;
 }
 
 /*
@@ -519,6 +543,8 @@ int checkout_entry(struct cache_entry *ce, const struct checkout *state,
 	create_directories(path.buf, path.len, state);
 	if (nr_checkouts)
 		(*nr_checkouts)++;
+	if (!enqueue_checkout(ce, state))
+		return 0;
 	return write_entry(ce, path.buf, state, 0);
 }
 
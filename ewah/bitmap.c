@@ -18,6 +18,7 @@
  */
 #include "cache.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
@@ -45,6 +46,14 @@ void bitmap_set(struct bitmap *self, size_t pos)
 	self->words[block] |= EWAH_MASK(pos);
 }
 
+void bitmap_unset(struct bitmap *self, size_t pos)
+{
+	size_t block = EWAH_BLOCK(pos);
+
+	if (block < self->word_alloc)
+		self->words[block] &= ~EWAH_MASK(pos);
+}
+
 int bitmap_get(struct bitmap *self, size_t pos)
 {
 	size_t block = EWAH_BLOCK(pos);
@@ -79,54 +88,112 @@ struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
 	return ewah;
 }
 
-struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+static void bitmap_grow(struct bitmap *self, size_t word_alloc)
 {
-	struct bitmap *bitmap = bitmap_new();
-	struct ewah_iterator it;
-	eword_t blowup;
-	size_t i = 0;
+	size_t original_size = self->word_alloc;
 
-	ewah_iterator_init(&it, ewah);
+	if (word_alloc <= original_size)
+		return;
+	self->word_alloc = word_alloc;
+	REALLOC_ARRAY(self->words, self->word_alloc);
+	memset(self->words + original_size, 0x0,
+		(self->word_alloc - original_size) * sizeof(eword_t));
+}
 
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
-	}
+/*
+ * The dense loops below go through plain pointers, so that the
+ * compiler can tell the words do not move under it and vectorize them.
+ */
+static void words_or(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
 
-	bitmap->word_alloc = i;
-	return bitmap;
+	for (i = 0; i < nr; i++)
+		dst[i] |= src[i];
 }
 
-void bitmap_and_not(struct bitmap *self, struct bitmap *other)
+static void words_and_not(eword_t *dst, const eword_t *src, size_t nr)
 {
-	const size_t count = (self->word_alloc < other->word_alloc) ?
-		self->word_alloc : other->word_alloc;
-
 	size_t i;
 
-	for (i = 0; i < count; ++i)
-		self->words[i] &= ~other->words[i];
+	for (i = 0; i < nr; i++)
+		dst[i] &= ~src[i];
 }
 
+/*
+ * Work on the compressed form a run-length word at a time: runs of
+ * zeroes are skipped, runs of ones filled in, and only the literal
+ * words are looked at one by one.
+ */
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
-	size_t original_size = self->word_alloc;
-	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	size_t i = 0, pointer = 0;
 
-	if (self->word_alloc < other_final) {
-		self->word_alloc = other_final;
-		REALLOC_ARRAY(self->words, self->word_alloc);
-		memset(self->words + original_size, 0x0,
-			(self->word_alloc - original_size) * sizeof(eword_t));
+	bitmap_grow(self, (other->bit_size / BITS_IN_EWORD) + 1);
+
+	while (pointer < other->buffer_size) {
+		const eword_t *rlw = other->buffer + pointer;
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+
+		if (pointer + 1 + literals > other->buffer_size)
+			literals = other->buffer_size - pointer - 1;
+		bitmap_grow(self, i + run + literals);
+
+		if (rlw_get_run_bit(rlw))
+			memset(self->words + i, 0xff, run * sizeof(eword_t));
+		i += run;
+
+		words_or(self->words + i, rlw + 1, literals);
+		i += literals;
+		pointer += 1 + literals;
 	}
+}
+
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other)
+{
+	size_t i, j;
+
+	for (i = 0; i < other->containers_nr; i++) {
+		const struct roaring_container *c = &other->containers[i];
+		size_t base = (size_t)c->key * ROARING_CHUNK_BITS;
+
+		if (c->cardinality > ROARING_ARRAY_MAX) {
+			eword_t *words;
+
+			bitmap_grow(self, (base + ROARING_CHUNK_BITS) / BITS_IN_EWORD);
+			words = self->words + base / BITS_IN_EWORD;
+			for (j = 0; j < ROARING_CHUNK_WORDS; j++)
+				words[j] |= get_be64(c->data + j * sizeof(eword_t));
+		} else {
+			for (j = 0; j < c->cardinality; j++)
+				bitmap_set(self, base + get_be16(c->data + j * 2));
+		}
+	}
+}
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+{
+	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
 
-	ewah_iterator_init(&it, other);
+	bitmap->words = NULL;
+	bitmap->word_alloc = 0;
+	bitmap_or_ewah(bitmap, ewah);
+	return bitmap;
+}
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+void bitmap_and_not(struct bitmap *self, struct bitmap *other)
+{
+	const size_t count = (self->word_alloc < other->word_alloc) ?
+		self->word_alloc : other->word_alloc;
+
+	words_and_not(self->words, other->words, count);
+}
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	bitmap_grow(self, other->word_alloc);
+	words_or(self->words, other->words, other->word_alloc);
 }
 
 size_t bitmap_popcount(struct bitmap *self)
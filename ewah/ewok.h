@@ -173,6 +173,7 @@ struct bitmap {
 
 struct bitmap *bitmap_new(void);
 void bitmap_set(struct bitmap *self, size_t pos);
+void bitmap_unset(struct bitmap *self, size_t pos);
 int bitmap_get(struct bitmap *self, size_t pos);
 void bitmap_reset(struct bitmap *self);
 void bitmap_free(struct bitmap *self);
@@ -182,8 +183,39 @@ int bitmap_is_subset(struct bitmap *self, struct bitmap *super);
 struct ewah_bitmap * bitmap_to_ewah(struct bitmap *bitmap);
 struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah);
 
+/*
+ * A bitmap in the container-based ("roaring") encoding, as read from a
+ * file: the bits are cut into chunks of 2^16, and each chunk with any
+ * bit set is kept either as the sorted list of those bits or as a plain
+ * bitmap. Unlike with EWAH, testing one bit does not need a scan.
+ * "containers" points into the buffer the bitmap was read from.
+ */
+#define ROARING_CHUNK_BITS 65536
+#define ROARING_CHUNK_WORDS (ROARING_CHUNK_BITS / BITS_IN_EWORD)
+
+/*
+ * A chunk with at most this many bits set is kept as a list of 16-bit
+ * positions, which is then no bigger than the plain bitmap.
+ */
+#define ROARING_ARRAY_MAX 4096
+
+struct roaring_bitmap {
+	size_t containers_nr;
+	struct roaring_container {
+		uint32_t key;
+		uint32_t cardinality;
+		const unsigned char *data;
+	} *containers;
+};
+
+void roaring_serialize_strbuf(struct ewah_bitmap *ewah, struct strbuf *sb);
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map, size_t len);
+void roaring_release(struct roaring_bitmap *self);
+int roaring_get(const struct roaring_bitmap *self, size_t pos);
+
 void bitmap_and_not(struct bitmap *self, struct bitmap *other);
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other);
 void bitmap_or(struct bitmap *self, const struct bitmap *other);
 
 size_t bitmap_popcount(struct bitmap *self);
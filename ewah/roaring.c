@@ -0,0 +1,197 @@
+/*
+ * A read-only, container-based ("roaring") encoding of bitmaps, as an
+ * alternative to EWAH where random access matters.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "git-compat-util.h"
+#include "ewok.h"
+#include "strbuf.h"
+
+/* key, reserved and cardinality of each container */
+#define ROARING_DIR_ENTRY 8
+
+static void add_be16(struct strbuf *sb, uint16_t value)
+{
+	unsigned char buf[2];
+
+	buf[0] = value >> 8;
+	buf[1] = value & 0xff;
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_be32(struct strbuf *sb, uint32_t value)
+{
+	unsigned char buf[4];
+
+	put_be32(buf, value);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_be64(struct strbuf *sb, uint64_t value)
+{
+	unsigned char buf[8];
+
+	put_be64(buf, value);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static size_t container_size(uint32_t cardinality)
+{
+	if (cardinality <= ROARING_ARRAY_MAX)
+		return cardinality * sizeof(uint16_t);
+	return ROARING_CHUNK_WORDS * sizeof(eword_t);
+}
+
+static void add_chunk(struct strbuf *dir, struct strbuf *data,
+		      uint32_t key, const eword_t *words)
+{
+	uint32_t cardinality = 0;
+	size_t i;
+
+	for (i = 0; i < ROARING_CHUNK_WORDS; i++)
+		cardinality += ewah_bit_popcount64(words[i]);
+	if (!cardinality)
+		return;
+
+	add_be16(dir, key);
+	add_be16(dir, 0);
+	add_be32(dir, cardinality);
+
+	if (cardinality <= ROARING_ARRAY_MAX) {
+		for (i = 0; i < ROARING_CHUNK_WORDS; i++) {
+			eword_t word = words[i];
+
+			while (word) {
+				int bit = ewah_bit_ctz64(word);
+
+				add_be16(data, i * BITS_IN_EWORD + bit);
+				word &= word - 1;
+			}
+		}
+	} else {
+		for (i = 0; i < ROARING_CHUNK_WORDS; i++)
+			add_be64(data, words[i]);
+	}
+}
+
+void roaring_serialize_strbuf(struct ewah_bitmap *ewah, struct strbuf *sb)
+{
+	struct strbuf dir = STRBUF_INIT, data = STRBUF_INIT;
+	eword_t words[ROARING_CHUNK_WORDS];
+	struct ewah_iterator it;
+	uint32_t key = 0, nr = 0;
+	size_t i = 0;
+
+	ewah_iterator_init(&it, ewah);
+	memset(words, 0, sizeof(words));
+	while (ewah_iterator_next(&words[i], &it)) {
+		if (++i < ROARING_CHUNK_WORDS)
+			continue;
+		add_chunk(&dir, &data, key++, words);
+		memset(words, 0, sizeof(words));
+		i = 0;
+	}
+	if (i)
+		add_chunk(&dir, &data, key, words);
+
+	nr = dir.len / ROARING_DIR_ENTRY;
+	add_be32(sb, nr);
+	strbuf_addbuf(sb, &dir);
+	strbuf_addbuf(sb, &data);
+	strbuf_release(&dir);
+	strbuf_release(&data);
+}
+
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map,
+			  size_t len)
+{
+	const unsigned char *ptr = map, *data;
+	size_t nr, i, left;
+
+	if (len < sizeof(uint32_t))
+		return error("corrupt roaring bitmap: eof before container count");
+	nr = get_be32(ptr);
+	left = len - sizeof(uint32_t);
+	if (left / ROARING_DIR_ENTRY < nr)
+		return error("corrupt roaring bitmap: eof in container directory");
+	data = ptr + sizeof(uint32_t) + nr * ROARING_DIR_ENTRY;
+	left -= nr * ROARING_DIR_ENTRY;
+
+	ALLOC_ARRAY(self->containers, nr);
+	self->containers_nr = nr;
+	for (i = 0; i < nr; i++) {
+		const unsigned char *entry = ptr + sizeof(uint32_t) +
+					     i * ROARING_DIR_ENTRY;
+		struct roaring_container *c = &self->containers[i];
+		size_t size;
+
+		c->key = get_be16(entry);
+		c->cardinality = get_be32(entry + 4);
+		if ((i && c->key <= self->containers[i - 1].key) ||
+		    !c->cardinality || c->cardinality > ROARING_CHUNK_BITS) {
+			FREE_AND_NULL(self->containers);
+			return error("corrupt roaring bitmap: bad container %"PRIuMAX,
+				     (uintmax_t)i);
+		}
+		size = container_size(c->cardinality);
+		if (left < size) {
+			FREE_AND_NULL(self->containers);
+			return error("corrupt roaring bitmap: eof in container %"PRIuMAX,
+				     (uintmax_t)i);
+		}
+		c->data = data;
+		data += size;
+		left -= size;
+	}
+
+	return data - ptr;
+}
+
+void roaring_release(struct roaring_bitmap *self)
+{
+	FREE_AND_NULL(self->containers);
+	self->containers_nr = 0;
+}
+
+int roaring_get(const struct roaring_bitmap *self, size_t pos)
+{
+	uint32_t key = pos / ROARING_CHUNK_BITS;
+	uint16_t low = pos % ROARING_CHUNK_BITS;
+	size_t lo = 0, hi = self->containers_nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		const struct roaring_container *c = &self->containers[mi];
+
+		if (c->key < key) {
+			lo = mi + 1;
+		} else if (c->key > key) {
+			hi = mi;
+		} else if (c->cardinality > ROARING_ARRAY_MAX) {
+			eword_t word = get_be64(c->data + (low / BITS_IN_EWORD) *
+						sizeof(eword_t));
+
+			return !!(word & ((eword_t)1 << (low % BITS_IN_EWORD)));
+		} else {
+			size_t alo = 0, ahi = c->cardinality;
+
+			while (alo < ahi) {
+				size_t ami = alo + (ahi - alo) / 2;
+				uint16_t v = get_be16(c->data + ami * 2);
+
+				if (v == low)
+					return 1;
+				if (v < low)
+					alo = ami + 1;
+				else
+					ahi = ami;
+			}
+			return 0;
+		}
+	}
+	return 0;
+}
@@ -18,6 +18,7 @@
 #include "object-store.h"
 #include "mem-pool.h"
 #include "commit-reach.h"
+#include "thread-utils.h"
 
 #define PACK_ID_BITS 16
 #define MAX_PACK_ID ((1<<PACK_ID_BITS)-1)
@@ -347,6 +348,7 @@ static void write_crash_report(const char *err)
 }
 
 static void end_packfile(void);
+static void write_queued_blobs(void);
 static void unkeep_all_packs(void);
 static void dump_marks(void);
 
@@ -731,9 +733,8 @@ static void start_packfile(void)
 	all_packs[pack_id] = p;
 }
 
-static const char *create_index(void)
+static struct pack_idx_entry **pack_index_entries(void)
 {
-	const char *tmpfile;
 	struct pack_idx_entry **idx, **c, **last;
 	struct object_entry *e;
 	struct object_entry_pool *o;
@@ -748,20 +749,16 @@ static const char *create_index(void)
 	last = idx + object_count;
 	if (c != last)
 		die("internal consistency error creating the index");
-
-	tmpfile = write_idx_file(NULL, idx, object_count, &pack_idx_opts,
-				 pack_data->hash);
-	free(idx);
-	return tmpfile;
+	return idx;
 }
 
-static char *keep_pack(const char *curr_index_name)
+static char *keep_pack(struct packed_git *p, const char *curr_index_name)
 {
 	static const char *keep_msg = "fast-import";
 	struct strbuf name = STRBUF_INIT;
 	int keep_fd;
 
-	odb_pack_name(&name, pack_data->hash, "keep");
+	odb_pack_name(&name, p->hash, "keep");
 	keep_fd = odb_pack_keep(name.buf);
 	if (keep_fd < 0)
 		die_errno("cannot create keep file");
@@ -769,11 +766,11 @@ static char *keep_pack(const char *curr_index_name)
 	if (close(keep_fd))
 		die_errno("failed to write keep file");
 
-	odb_pack_name(&name, pack_data->hash, "pack");
-	if (finalize_object_file(pack_data->pack_name, name.buf))
+	odb_pack_name(&name, p->hash, "pack");
+	if (finalize_object_file(p->pack_name, name.buf))
 		die("cannot store pack file");
 
-	odb_pack_name(&name, pack_data->hash, "idx");
+	odb_pack_name(&name, p->hash, "idx");
 	if (finalize_object_file(curr_index_name, name.buf))
 		die("cannot store index file");
 	free((void *)curr_index_name);
@@ -810,74 +807,186 @@ static int loosen_small_pack(const struct packed_git *p)
 	return run_command(&unpack);
 }
 
-static void end_packfile(void)
+/*
+ * A full pack whose header, index and .keep file are written, and
+ * which is moved into place, while the import goes on into the next
+ * pack. Only the main thread installs it; until then, the objects in
+ * it must not be read.
+ */
+struct finished_pack {
+	struct packed_git *p, *new_p;
+	unsigned int id;
+	struct pack_idx_entry **idx;
+	unsigned long nr;
+	struct object_id oid;
+	off_t size;
+	struct strbuf edges;
+	pthread_t thread;
+	int running;
+	int header_done;
+};
+static struct finished_pack finished_pack = { .edges = STRBUF_INIT };
+
+/* Commit-graph layers are written in the background, one at a time. */
+static int write_commit_graph;
+static struct child_process commit_graph_cmd = CHILD_PROCESS_INIT;
+static int commit_graph_running;
+
+static void finish_commit_graph(void)
+{
+	if (!commit_graph_running)
+		return;
+	if (finish_command(&commit_graph_cmd))
+		warning("failed to write a commit-graph for the imported packs");
+	commit_graph_running = 0;
+}
+
+static void start_commit_graph(struct packed_git *p)
+{
+	FILE *in;
+
+	finish_commit_graph();
+	child_process_init(&commit_graph_cmd);
+	commit_graph_cmd.git_cmd = 1;
+	commit_graph_cmd.in = -1;
+	commit_graph_cmd.no_stdout = 1;
+	argv_array_pushl(&commit_graph_cmd.args, "commit-graph", "write",
+			 "--split", "--stdin-packs", "--no-progress", NULL);
+	if (start_command(&commit_graph_cmd)) {
+		warning("failed to start writing a commit-graph");
+		return;
+	}
+	commit_graph_running = 1;
+	in = xfdopen(commit_graph_cmd.in, "w");
+	fprintf(in, "pack-%s.idx\n", hash_to_hex(p->hash));
+	fclose(in);
+}
+
+static void *finish_pack(void *data)
+{
+	struct finished_pack *fp = data;
+	struct packed_git *p = fp->p;
+	const char *tmpfile;
+	char *idx_name;
+
+	if (!fp->header_done)
+		fixup_pack_header_footer(p->pack_fd, p->hash, p->pack_name,
+					 fp->nr, fp->oid.hash, fp->size);
+	close(p->pack_fd);
+
+	tmpfile = write_idx_file(NULL, fp->idx, fp->nr, &pack_idx_opts,
+				 p->hash);
+	FREE_AND_NULL(fp->idx);
+	idx_name = keep_pack(p, tmpfile);
+
+	/* Register the packfile with core git's machinery. */
+	fp->new_p = add_packed_git(idx_name, strlen(idx_name), 1);
+	if (!fp->new_p)
+		die("core git rejected index %s", idx_name);
+	free(idx_name);
+	return NULL;
+}
+
+static void install_finished_pack(struct finished_pack *fp)
+{
+	all_packs[fp->id] = fp->new_p;
+	install_packed_git(the_repository, fp->new_p);
+	free(fp->p);
+
+	/* Print the boundary */
+	if (pack_edges) {
+		fprintf(pack_edges, "%s:%s\n", fp->new_p->pack_name,
+			fp->edges.buf);
+		fflush(pack_edges);
+	}
+	strbuf_reset(&fp->edges);
+
+	if (write_commit_graph)
+		start_commit_graph(fp->new_p);
+}
+
+/* Wait for the pack being finished in the background, if any. */
+static void wait_finished_pack(void)
+{
+	if (!finished_pack.running)
+		return;
+	pthread_join(finished_pack.thread, NULL);
+	finished_pack.running = 0;
+	install_finished_pack(&finished_pack);
+}
+
+static void close_packfile(int background)
 {
 	static int running;
 
 	if (running || !pack_data)
 		return;
 
+	write_queued_blobs();
+	wait_finished_pack();
 	running = 1;
 	clear_delta_base_cache();
 	if (object_count) {
-		struct packed_git *new_p;
-		struct object_id cur_pack_oid;
-		char *idx_name;
+		struct finished_pack *fp = &finished_pack;
 		int i;
 		struct branch *b;
 		struct tag *t;
 
 		close_pack_windows(pack_data);
-		finalize_hashfile(pack_file, cur_pack_oid.hash, 0);
-		fixup_pack_header_footer(pack_data->pack_fd, pack_data->hash,
-					 pack_data->pack_name, object_count,
-					 cur_pack_oid.hash, pack_size);
-
-		if (object_count <= unpack_limit) {
+		finalize_hashfile(pack_file, fp->oid.hash, 0);
+
+		/* a small pack is unpacked right away, if we can */
+		fp->header_done = object_count <= unpack_limit;
+		if (fp->header_done) {
+			fixup_pack_header_footer(pack_data->pack_fd,
+						 pack_data->hash,
+						 pack_data->pack_name,
+						 object_count, fp->oid.hash,
+						 pack_size);
 			if (!loosen_small_pack(pack_data)) {
 				invalidate_pack_id(pack_id);
 				goto discard_pack;
 			}
 		}
 
-		close(pack_data->pack_fd);
-		idx_name = keep_pack(create_index());
-
-		/* Register the packfile with core git's machinery. */
-		new_p = add_packed_git(idx_name, strlen(idx_name), 1);
-		if (!new_p)
-			die("core git rejected index %s", idx_name);
-		all_packs[pack_id] = new_p;
-		install_packed_git(the_repository, new_p);
-		free(idx_name);
+		fp->p = pack_data;
+		fp->id = pack_id;
+		fp->idx = pack_index_entries();
+		fp->nr = object_count;
+		fp->size = pack_size;
 
-		/* Print the boundary */
+		/* Remember the boundary, the branches move on */
 		if (pack_edges) {
-			fprintf(pack_edges, "%s:", new_p->pack_name);
 			for (i = 0; i < branch_table_sz; i++) {
 				for (b = branch_table[i]; b; b = b->table_next_branch) {
 					if (b->pack_id == pack_id)
-						fprintf(pack_edges, " %s",
-							oid_to_hex(&b->oid));
+						strbuf_addf(&fp->edges, " %s",
+							    oid_to_hex(&b->oid));
 				}
 			}
 			for (t = first_tag; t; t = t->next_tag) {
 				if (t->pack_id == pack_id)
-					fprintf(pack_edges, " %s",
-						oid_to_hex(&t->oid));
+					strbuf_addf(&fp->edges, " %s",
+						    oid_to_hex(&t->oid));
 			}
-			fputc('\n', pack_edges);
-			fflush(pack_edges);
 		}
 
+		if (HAVE_THREADS && background &&
+		    !pthread_create(&fp->thread, NULL, finish_pack, fp)) {
+			fp->running = 1;
+		} else {
+			finish_pack(fp);
+			install_finished_pack(fp);
+		}
 		pack_id++;
+		pack_data = NULL;
 	}
 	else {
 discard_pack:
 		close(pack_data->pack_fd);
 		unlink_or_warn(pack_data->pack_name);
+		FREE_AND_NULL(pack_data);
 	}
-	FREE_AND_NULL(pack_data);
 	running = 0;
 
 	/* We can't carry a delta across packfiles. */
@@ -886,26 +995,36 @@ static void end_packfile(void)
 	last_blob.depth = 0;
 }
 
+static void end_packfile(void)
+{
+	close_packfile(0);
+	finish_commit_graph();
+}
+
+/*
+ * Start a new pack; the index of the full one is written in the
+ * background.
+ */
 static void cycle_packfile(void)
 {
-	end_packfile();
+	close_packfile(1);
 	start_packfile();
 }
 
-static int store_object(
-	enum object_type type,
-	struct strbuf *dat,
-	struct last_object *last,
-	struct object_id *oidout,
-	uintmax_t mark)
+/*
+ * Hash "dat" as an object of "type", and look it up. Returns the entry
+ * to fill in if the object is new, or NULL if we already have it.
+ */
+static struct object_entry *new_object_entry(enum object_type type,
+					     struct strbuf *dat,
+					     struct object_id *oidout,
+					     uintmax_t mark)
 {
-	void *out, *delta;
 	struct object_entry *e;
 	unsigned char hdr[96];
 	struct object_id oid;
-	unsigned long hdrlen, deltalen;
+	unsigned long hdrlen;
 	git_hash_ctx c;
-	git_zstream s;
 
 	hdrlen = xsnprintf((char *)hdr, sizeof(hdr), "%s %lu",
 			   type_name(type), (unsigned long)dat->len) + 1;
@@ -921,44 +1040,53 @@ static int store_object(
 		insert_mark(mark, e);
 	if (e->idx.offset) {
 		duplicate_count_by_type[type]++;
-		return 1;
+		return NULL;
 	} else if (find_sha1_pack(oid.hash,
 				  get_all_packs(the_repository))) {
 		e->type = type;
 		e->pack_id = MAX_PACK_ID;
 		e->idx.offset = 1; /* just not zero! */
 		duplicate_count_by_type[type]++;
-		return 1;
+		return NULL;
 	}
+	return e;
+}
 
-	if (last && last->data.len && last->data.buf && last->depth < max_depth
-		&& dat->len > the_hash_algo->rawsz) {
-
-		delta_count_attempts_by_type[type]++;
-		delta = diff_delta(last->data.buf, last->data.len,
-			dat->buf, dat->len,
-			&deltalen, dat->len - the_hash_algo->rawsz);
-	} else
-		delta = NULL;
+static unsigned long deflate_object(const void *in, unsigned long len,
+				    void **out)
+{
+	git_zstream s;
 
 	git_deflate_init(&s, pack_compression_level);
-	if (delta) {
-		s.next_in = delta;
-		s.avail_in = deltalen;
-	} else {
-		s.next_in = (void *)dat->buf;
-		s.avail_in = dat->len;
-	}
+	s.next_in = (void *)in;
+	s.avail_in = len;
 	s.avail_out = git_deflate_bound(&s, s.avail_in);
-	s.next_out = out = xmalloc(s.avail_out);
+	s.next_out = *out = xrealloc(*out, s.avail_out);
 	while (git_deflate(&s, Z_FINISH) == Z_OK)
 		; /* nothing */
 	git_deflate_end(&s);
+	return s.total_out;
+}
+
+/*
+ * Write "dat" to the pack as entry "e", given its deflated form "out"
+ * (of "dat" itself, or of "delta" against "last" if there is one).
+ * Takes ownership of "out" and "delta".
+ */
+static void write_object(enum object_type type,
+			 struct object_entry *e,
+			 struct strbuf *dat,
+			 struct last_object *last,
+			 void *delta, unsigned long deltalen,
+			 void *out, unsigned long outlen)
+{
+	unsigned char hdr[96];
+	unsigned long hdrlen;
 
 	/* Determine if we should auto-checkpoint. */
 	if ((max_packsize
-		&& (pack_size + PACK_SIZE_THRESHOLD + s.total_out) > max_packsize)
-		|| (pack_size + PACK_SIZE_THRESHOLD + s.total_out) < pack_size) {
+		&& (pack_size + PACK_SIZE_THRESHOLD + outlen) > max_packsize)
+		|| (pack_size + PACK_SIZE_THRESHOLD + outlen) < pack_size) {
 
 		/* This new object needs to *not* have the current pack_id. */
 		e->pack_id = pack_id + 1;
@@ -967,15 +1095,7 @@ static int store_object(
 		/* We cannot carry a delta into the new pack. */
 		if (delta) {
 			FREE_AND_NULL(delta);
-
-			git_deflate_init(&s, pack_compression_level);
-			s.next_in = (void *)dat->buf;
-			s.avail_in = dat->len;
-			s.avail_out = git_deflate_bound(&s, s.avail_in);
-			s.next_out = out = xrealloc(out, s.avail_out);
-			while (git_deflate(&s, Z_FINISH) == Z_OK)
-				; /* nothing */
-			git_deflate_end(&s);
+			outlen = deflate_object(dat->buf, dat->len, &out);
 		}
 	}
 
@@ -1012,8 +1132,8 @@ static int store_object(
 		pack_size += hdrlen;
 	}
 
-	hashwrite(pack_file, out, s.total_out);
-	pack_size += s.total_out;
+	hashwrite(pack_file, out, outlen);
+	pack_size += outlen;
 
 	e->idx.crc32 = crc32_end(pack_file);
 
@@ -1028,9 +1148,277 @@ static int store_object(
 		last->offset = e->idx.offset;
 		last->depth = e->depth;
 	}
+}
+
+static int store_object(
+	enum object_type type,
+	struct strbuf *dat,
+	struct last_object *last,
+	struct object_id *oidout,
+	uintmax_t mark)
+{
+	void *out = NULL, *delta;
+	struct object_entry *e;
+	unsigned long deltalen, outlen;
+
+	/* keep the pack in stream order */
+	write_queued_blobs();
+
+	e = new_object_entry(type, dat, oidout, mark);
+	if (!e)
+		return 1;
+
+	if (last && last->data.len && last->data.buf && last->depth < max_depth
+		&& dat->len > the_hash_algo->rawsz) {
+
+		delta_count_attempts_by_type[type]++;
+		delta = diff_delta(last->data.buf, last->data.len,
+			dat->buf, dat->len,
+			&deltalen, dat->len - the_hash_algo->rawsz);
+	} else
+		delta = NULL;
+
+	if (delta)
+		outlen = deflate_object(delta, deltalen, &out);
+	else
+		outlen = deflate_object(dat->buf, dat->len, &out);
+
+	write_object(type, e, dat, last, delta, deltalen, out, outlen);
 	return 0;
 }
 
+/*
+ * With --threads, the blobs read from the stream are hashed (so that
+ * marks and duplicates are resolved right away), and then deltified
+ * against the previous blob and deflated by worker threads. The main
+ * thread writes them to the pack in stream order, as they are done,
+ * and before anything else is written to or read from the pack.
+ *
+ * The delta decisions are the same as store_object() would make: a
+ * worker computes the delta against the previous blob speculatively,
+ * and then waits for the previous blob to decide its own delta depth
+ * before deciding whether to use it.
+ */
+struct blob_job {
+	struct strbuf data;
+	struct object_entry *e;
+	const char *base; /* the previous blob */
+	size_t base_len;
+	void *delta, *out;
+	unsigned long deltalen, outlen;
+	unsigned attempted : 1,
+		 done : 1;
+};
+
+static struct blob_queue {
+	struct blob_job *jobs;
+	unsigned nr;
+	unsigned long nr_queued, nr_taken, nr_decided, nr_written;
+	unsigned int decided_depth; /* of the last decided blob */
+	int exit;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} blob_queue;
+static int blob_threads = 1;
+
+static void *blob_worker(void *data)
+{
+	struct blob_queue *q = data;
+
+	for (;;) {
+		struct blob_job *job;
+		unsigned long seq;
+		unsigned long len;
+
+		pthread_mutex_lock(&q->mutex);
+		while (q->nr_taken == q->nr_queued && !q->exit)
+			pthread_cond_wait(&q->cond, &q->mutex);
+		if (q->nr_taken == q->nr_queued) {
+			pthread_mutex_unlock(&q->mutex);
+			return NULL;
+		}
+		seq = q->nr_taken++;
+		job = &q->jobs[seq % q->nr];
+		pthread_mutex_unlock(&q->mutex);
+
+		len = job->data.len;
+		if (job->base_len && len > the_hash_algo->rawsz)
+			job->delta = diff_delta(job->base, job->base_len,
+						job->data.buf, len,
+						&job->deltalen,
+						len - the_hash_algo->rawsz);
+
+		pthread_mutex_lock(&q->mutex);
+		while (q->nr_decided != seq)
+			pthread_cond_wait(&q->cond, &q->mutex);
+		job->attempted = job->base_len &&
+				 len > the_hash_algo->rawsz &&
+				 q->decided_depth < max_depth;
+		if (!job->attempted)
+			FREE_AND_NULL(job->delta);
+		q->decided_depth = job->delta ? q->decided_depth + 1 : 0;
+		q->nr_decided++;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->mutex);
+
+		if (job->delta)
+			job->outlen = deflate_object(job->delta, job->deltalen,
+						     &job->out);
+		else
+			job->outlen = deflate_object(job->data.buf, len,
+						     &job->out);
+
+		pthread_mutex_lock(&q->mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
+
+/*
+ * Write the oldest queued blob to the pack, waiting for it if "wait"
+ * is set. Returns 0 if there was nothing (ready) to write.
+ */
+static int write_one_queued_blob(int wait)
+{
+	struct blob_queue *q = &blob_queue;
+	struct blob_job *job;
+	static int running;
+
+	/* write_object() may cycle the pack, which comes back here */
+	if (running)
+		return 0;
+
+	pthread_mutex_lock(&q->mutex);
+	job = &q->jobs[q->nr_written % q->nr];
+	while (q->nr_written < q->nr_queued && !job->done && wait)
+		pthread_cond_wait(&q->cond, &q->mutex);
+	if (q->nr_written == q->nr_queued || !job->done) {
+		pthread_mutex_unlock(&q->mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&q->mutex);
+
+	if (job->attempted)
+		delta_count_attempts_by_type[OBJ_BLOB]++;
+	running = 1;
+	write_object(OBJ_BLOB, job->e, &job->data, &last_blob,
+		     job->delta, job->deltalen, job->out, job->outlen);
+	running = 0;
+	job->delta = job->out = NULL;
+
+	pthread_mutex_lock(&q->mutex);
+	job->done = 0;
+	q->nr_written++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+	return 1;
+}
+
+static void write_queued_blobs(void)
+{
+	if (!blob_queue.nr)
+		return;
+	while (write_one_queued_blob(1))
+		; /* nothing */
+}
+
+static void start_blob_threads(void);
+
+static void queue_blob(struct strbuf *dat, struct object_id *oidout,
+		       uintmax_t mark)
+{
+	struct blob_queue *q = &blob_queue;
+	struct object_entry *e;
+	struct blob_job *job;
+
+	e = new_object_entry(OBJ_BLOB, dat, oidout, mark);
+	if (!e)
+		return;
+	/*
+	 * Not in a pack yet; write_object() fills in the rest. Until then
+	 * the entry looks like that of an object we did not write, which
+	 * is what it is to pack_index_entries().
+	 */
+	e->type = OBJ_BLOB;
+	e->pack_id = MAX_PACK_ID;
+	e->idx.offset = 1;
+
+	if (!q->nr)
+		start_blob_threads();
+
+	while (q->nr_queued - q->nr_written == q->nr)
+		write_one_queued_blob(1);
+
+	/* nobody else looks at this job until nr_queued moves past it */
+	job = &q->jobs[q->nr_queued % q->nr];
+	strbuf_swap(&job->data, dat);
+	job->e = e;
+	if (q->nr_queued == q->nr_written) {
+		job->base = last_blob.data.buf;
+		job->base_len = last_blob.data.len;
+	} else {
+		struct blob_job *prev = &q->jobs[(q->nr_queued - 1) % q->nr];
+		job->base = prev->data.buf;
+		job->base_len = prev->data.len;
+	}
+
+	pthread_mutex_lock(&q->mutex);
+	if (q->nr_written == q->nr_queued)
+		q->decided_depth = last_blob.depth;
+	q->nr_queued++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+
+	while (write_one_queued_blob(0))
+		; /* nothing */
+}
+
+static void start_blob_threads(void)
+{
+	struct blob_queue *q = &blob_queue;
+	int i;
+
+	if (!HAVE_THREADS || blob_threads <= 1)
+		return;
+	q->nr = 2 * blob_threads;
+	CALLOC_ARRAY(q->jobs, q->nr);
+	for (i = 0; i < q->nr; i++)
+		strbuf_init(&q->jobs[i].data, 0);
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	ALLOC_ARRAY(q->threads, blob_threads);
+	for (i = 0; i < blob_threads; i++)
+		if (pthread_create(&q->threads[i], NULL, blob_worker, q))
+			die("unable to create thread");
+}
+
+static void stop_blob_threads(void)
+{
+	struct blob_queue *q = &blob_queue;
+	int i;
+
+	if (!q->nr)
+		return;
+	write_queued_blobs();
+
+	pthread_mutex_lock(&q->mutex);
+	q->exit = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+	for (i = 0; i < blob_threads; i++)
+		pthread_join(q->threads[i], NULL);
+
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->mutex);
+	for (i = 0; i < q->nr; i++)
+		strbuf_release(&q->jobs[i].data);
+	FREE_AND_NULL(q->jobs);
+	FREE_AND_NULL(q->threads);
+	q->nr = 0;
+}
+
 static void truncate_pack(struct hashfile_checkpoint *checkpoint)
 {
 	if (hashfile_truncate(pack_file, checkpoint))
@@ -1052,6 +1440,8 @@ static void stream_blob(uintmax_t len, struct object_id *oidout, uintmax_t mark)
 	struct hashfile_checkpoint checkpoint;
 	int status = Z_OK;
 
+	write_queued_blobs();
+
 	/* Determine if we should auto-checkpoint. */
 	if ((max_packsize
 		&& (pack_size + PACK_SIZE_THRESHOLD + len) > max_packsize)
@@ -1167,7 +1557,12 @@ static void *gfi_unpack_entry(
 	unsigned long *sizep)
 {
 	enum object_type type;
-	struct packed_git *p = all_packs[oe->pack_id];
+	struct packed_git *p;
+
+	write_queued_blobs();
+	if (finished_pack.running && oe->pack_id == finished_pack.id)
+		wait_finished_pack();
+	p = all_packs[oe->pack_id];
 	if (p == pack_data && p->pack_size < (pack_size + the_hash_algo->rawsz)) {
 		/* The object is stored in the packfile we are writing to
 		 * and we have modified it since the last time we scanned
@@ -1946,9 +2341,14 @@ static void parse_and_store_blob(
 	static struct strbuf buf = STRBUF_INIT;
 	uintmax_t len;
 
-	if (parse_data(&buf, big_file_threshold, &len))
-		store_object(OBJ_BLOB, &buf, last, oidout, mark);
-	else {
+	if (parse_data(&buf, big_file_threshold, &len)) {
+		if (HAVE_THREADS && blob_threads > 1 && last == &last_blob)
+			queue_blob(&buf, oidout, mark);
+		else
+			store_object(OBJ_BLOB, &buf, last, oidout, mark);
+	} else {
+		/* the queued blobs may still need last_blob */
+		write_queued_blobs();
 		if (last) {
 			strbuf_release(&last->data);
 			last->offset = 0;
@@ -2810,6 +3210,7 @@ static void cat_blob(struct object_entry *oe, struct object_id *oid)
 	enum object_type type = 0;
 	char *buf;
 
+	write_queued_blobs();
 	if (!oe || oe->pack_id == MAX_PACK_ID) {
 		buf = read_object_file(oid, &type, &size);
 	} else {
@@ -3037,9 +3438,12 @@ static void parse_ls(const char *p, struct branch *b)
 static void checkpoint(void)
 {
 	checkpoint_requested = 0;
+	write_queued_blobs();
 	if (object_count) {
 		cycle_packfile();
 	}
+	/* the refs must not point into a pack that is not there yet */
+	wait_finished_pack();
 	dump_branches();
 	dump_tags();
 	dump_marks();
@@ -3159,6 +3563,12 @@ static int parse_one_option(const char *option)
 		big_file_threshold = v;
 	} else if (skip_prefix(option, "depth=", &option)) {
 		option_depth(option);
+	} else if (!strcmp(option, "write-commit-graph")) {
+		write_commit_graph = 1;
+	} else if (skip_prefix(option, "threads=", &option)) {
+		blob_threads = ulong_arg("--threads", option);
+		if (!blob_threads)
+			blob_threads = online_cpus();
 	} else if (skip_prefix(option, "active-branches=", &option)) {
 		option_active_branches(option);
 	} else if (skip_prefix(option, "export-pack-edges=", &option)) {
@@ -3364,6 +3774,7 @@ int cmd_main(int argc, const char **argv)
 	if (require_explicit_termination && feof(stdin))
 		die("stream ends early");
 
+	stop_blob_threads();
 	end_packfile();
 
 	dump_branches();
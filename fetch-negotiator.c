@@ -1,6 +1,7 @@
 #include "git-compat-util.h"
 #include "fetch-negotiator.h"
 #include "negotiator/default.h"
+#include "negotiator/generation.h"
 #include "negotiator/skipping.h"
 
 void fetch_negotiator_init(struct fetch_negotiator *negotiator,
@@ -10,6 +11,9 @@ void fetch_negotiator_init(struct fetch_negotiator *negotiator,
 		if (!strcmp(algorithm, "skipping")) {
 			skipping_negotiator_init(negotiator);
 			return;
+		} else if (!strcmp(algorithm, "generation")) {
+			generation_negotiator_init(negotiator);
+			return;
 		} else if (!strcmp(algorithm, "default")) {
 			/* Fall through to default initialization */
 		} else {
@@ -1,4 +1,7 @@
 #include "cache.h"
+#include "config.h"
+#include "object-store.h"
+#include "sha1-array.h"
 #include "packfile.h"
 #include "pkt-line.h"
 #include "strbuf.h"
@@ -38,3 +41,35 @@ void fetch_objects(const char *remote_name, const struct object_id *oids,
 	}
 	fetch_refs(remote_name, ref);
 }
+
+static int append_if_missing(const struct object_id *oid, void *data)
+{
+	struct oid_array *missing = data;
+
+	if (oid_object_info_extended(the_repository, oid, NULL,
+				     OBJECT_INFO_FOR_PREFETCH))
+		oid_array_append(missing, oid);
+	return 0;
+}
+
+void prefetch_objects(struct oid_array *oids)
+{
+	struct oid_array missing = OID_ARRAY_INIT;
+	int batch_size = 50000;
+	int i;
+
+	if (!repository_format_partial_clone || !oids->nr)
+		return;
+
+	oid_array_for_each_unique(oids, append_if_missing, &missing);
+
+	git_config_get_int("fetch.lazybatchsize", &batch_size);
+	if (batch_size <= 0)
+		batch_size = missing.nr;
+	for (i = 0; i < missing.nr; i += batch_size)
+		fetch_objects(repository_format_partial_clone,
+			      missing.oid + i,
+			      missing.nr - i < batch_size ?
+			      missing.nr - i : batch_size);
+	oid_array_clear(&missing);
+}
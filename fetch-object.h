@@ -2,8 +2,18 @@
 #define FETCH_OBJECT_H
 
 struct object_id;
+struct oid_array;
 
 void fetch_objects(const char *remote_name, const struct object_id *oids,
 		   int oid_nr);
 
+/*
+ * In a partial clone, fetch those of "oids" that are missing from the
+ * repository, instead of letting each of them be fetched on its own when
+ * it is first read. Duplicates are requested once, and the objects are
+ * requested in batches of at most fetch.lazyBatchSize. "oids" is sorted
+ * as a side effect. Does nothing outside of partial clones.
+ */
+void prefetch_objects(struct oid_array *oids);
+
 #endif
@@ -37,6 +37,7 @@ static int server_supports_filtering;
 static struct lock_file shallow_lock;
 static const char *alternate_shallow_file;
 static char *negotiation_algorithm;
+static char *uri_protocols;
 static struct strbuf fsck_msg_types = STRBUF_INIT;
 
 /* Remember to update object flag allocation in object.h */
@@ -758,8 +759,30 @@ static int sideband_demux(int in, int out, void *data)
 	return ret;
 }
 
+static void add_index_pack_keep_option(struct argv_array *args,
+				       const char *prefix)
+{
+	char hostname[HOST_NAME_MAX + 1];
+
+	if (xgethostname(hostname, sizeof(hostname)))
+		xsnprintf(hostname, sizeof(hostname), "localhost");
+	argv_array_pushf(args, "%s--keep=fetch-pack %"PRIuMAX " on %s",
+			 prefix, (uintmax_t)getpid(), hostname);
+}
+
+static int fsck_objects(void)
+{
+	return fetch_fsck_objects >= 0 ? fetch_fsck_objects :
+	       transfer_fsck_objects >= 0 ? transfer_fsck_objects : 0;
+}
+
+/*
+ * With "packfile_uris" not empty, the pack we receive is not whole
+ * without the packs at those URIs.
+ */
 static int get_pack(struct fetch_pack_args *args,
-		    int xd[2], char **pack_lockfile)
+		    int xd[2], struct string_list *pack_lockfiles,
+		    const struct string_list *packfile_uris)
 {
 	struct async demux;
 	int do_keep = args->keep_pack;
@@ -785,6 +808,9 @@ static int get_pack(struct fetch_pack_args *args,
 	else
 		demux.out = xd[0];
 
+	if (packfile_uris && packfile_uris->nr)
+		args->check_self_contained_and_connected = 0;
+
 	if (!args->keep_pack && unpack_limit) {
 
 		if (read_pack_header(demux.out, &header))
@@ -802,7 +828,7 @@ static int get_pack(struct fetch_pack_args *args,
 	}
 
 	if (do_keep || args->from_promisor) {
-		if (pack_lockfile)
+		if (pack_lockfiles)
 			cmd.out = -1;
 		cmd_name = "index-pack";
 		argv_array_push(&cmd.args, cmd_name);
@@ -811,14 +837,8 @@ static int get_pack(struct fetch_pack_args *args,
 			argv_array_push(&cmd.args, "-v");
 		if (args->use_thin_pack)
 			argv_array_push(&cmd.args, "--fix-thin");
-		if (do_keep && (args->lock_pack || unpack_limit)) {
-			char hostname[HOST_NAME_MAX + 1];
-			if (xgethostname(hostname, sizeof(hostname)))
-				xsnprintf(hostname, sizeof(hostname), "localhost");
-			argv_array_pushf(&cmd.args,
-					"--keep=fetch-pack %"PRIuMAX " on %s",
-					(uintmax_t)getpid(), hostname);
-		}
+		if (do_keep && (args->lock_pack || unpack_limit))
+			add_index_pack_keep_option(&cmd.args, "");
 		if (args->check_self_contained_and_connected)
 			argv_array_push(&cmd.args, "--check-self-contained-and-connected");
 		if (args->from_promisor)
@@ -836,16 +856,14 @@ static int get_pack(struct fetch_pack_args *args,
 		argv_array_pushf(&cmd.args, "--pack_header=%"PRIu32",%"PRIu32,
 				 ntohl(header.hdr_version),
 				 ntohl(header.hdr_entries));
-	if (fetch_fsck_objects >= 0
-	    ? fetch_fsck_objects
-	    : transfer_fsck_objects >= 0
-	    ? transfer_fsck_objects
-	    : 0) {
-		if (args->from_promisor)
+	if (fsck_objects()) {
+		if (args->from_promisor ||
+		    (packfile_uris && packfile_uris->nr))
 			/*
 			 * We cannot use --strict in index-pack because it
 			 * checks both broken objects and links, but we only
-			 * want to check for broken objects.
+			 * want to check for broken objects (the links may
+			 * point to objects we do not have yet).
 			 */
 			argv_array_push(&cmd.args, "--fsck-objects");
 		else
@@ -857,8 +875,11 @@ static int get_pack(struct fetch_pack_args *args,
 	cmd.git_cmd = 1;
 	if (start_command(&cmd))
 		die(_("fetch-pack: unable to fork off %s"), cmd_name);
-	if (do_keep && pack_lockfile) {
-		*pack_lockfile = index_pack_lockfile(cmd.out);
+	if (do_keep && pack_lockfiles) {
+		char *lockfile = index_pack_lockfile(cmd.out);
+
+		if (lockfile)
+			string_list_append_nodup(pack_lockfiles, lockfile);
 		close(cmd.out);
 	}
 
@@ -890,7 +911,7 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 				 const struct ref *orig_ref,
 				 struct ref **sought, int nr_sought,
 				 struct shallow_info *si,
-				 char **pack_lockfile)
+				 struct string_list *pack_lockfiles)
 {
 	struct ref *ref = copy_ref_list(orig_ref);
 	struct object_id oid;
@@ -1009,7 +1030,7 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 		alternate_shallow_file = setup_temporary_shallow(si->shallow);
 	else
 		alternate_shallow_file = NULL;
-	if (get_pack(args, fd, pack_lockfile))
+	if (get_pack(args, fd, pack_lockfiles, NULL))
 		die(_("git fetch-pack: fetch failed."));
 
  all_done:
@@ -1143,6 +1164,9 @@ static int send_fetch_request(struct fetch_negotiator *negotiator, int fd_out,
 		packet_buf_write(&req_buf, "ofs-delta");
 	if (sideband_all)
 		packet_buf_write(&req_buf, "sideband-all");
+	if (uri_protocols &&
+	    server_supports_feature("fetch", "packfile-uris", 0))
+		packet_buf_write(&req_buf, "packfile-uris %s", uri_protocols);
 
 	/* Add shallow-info and deepen request */
 	if (server_supports_feature("fetch", "shallow", 0))
@@ -1363,6 +1387,85 @@ static void receive_wanted_refs(struct packet_reader *reader,
 		die(_("error processing wanted refs: %d"), reader->status);
 }
 
+static void receive_packfile_uris(struct packet_reader *reader,
+				  struct string_list *uris)
+{
+	process_section_header(reader, "packfile-uris", 0);
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		struct object_id oid;
+		const char *end;
+
+		if (parse_oid_hex(reader->line, &oid, &end) || *end++ != ' ' ||
+		    !*end)
+			die(_("expected '<hash> <uri>', received '%s'"),
+			    reader->line);
+		string_list_append(uris, reader->line);
+	}
+
+	if (reader->status != PACKET_READ_DELIM)
+		die(_("expected DELIM"));
+}
+
+/*
+ * Start downloading the packs at "uris" with http-fetch, all at once,
+ * to overlap with each other and with the pack coming over the wire.
+ */
+static struct child_process *start_packfile_uris(struct fetch_pack_args *args,
+						 const struct string_list *uris,
+						 int lock)
+{
+	struct child_process *cmds;
+	int i;
+
+	if (!uris->nr)
+		return NULL;
+	ALLOC_ARRAY(cmds, uris->nr);
+	for (i = 0; i < uris->nr; i++) {
+		struct child_process *cmd = &cmds[i];
+		const char *uri = uris->items[i].string;
+
+		child_process_init(cmd);
+		cmd->git_cmd = 1;
+		cmd->out = -1;
+		argv_array_push(&cmd->args, "http-fetch");
+		argv_array_pushf(&cmd->args, "--packfile=%.*s",
+				 (int)the_hash_algo->hexsz, uri);
+		if (lock)
+			add_index_pack_keep_option(&cmd->args,
+						   "--index-pack-arg=");
+		if (fsck_objects())
+			argv_array_push(&cmd->args,
+					"--index-pack-arg=--fsck-objects");
+		argv_array_push(&cmd->args, uri + the_hash_algo->hexsz + 1);
+		print_verbose(args, _("Downloading %s"),
+			      uri + the_hash_algo->hexsz + 1);
+		if (start_command(cmd))
+			die(_("fetch-pack: unable to fork off %s"), "http-fetch");
+	}
+	return cmds;
+}
+
+static void finish_packfile_uris(struct child_process *cmds,
+				 const struct string_list *uris,
+				 struct string_list *pack_lockfiles)
+{
+	int i;
+
+	for (i = 0; i < uris->nr; i++) {
+		char *lockfile = index_pack_lockfile(cmds[i].out);
+
+		close(cmds[i].out);
+		if (finish_command(&cmds[i]))
+			die(_("unable to fetch the pack at %s"),
+			    uris->items[i].string + the_hash_algo->hexsz + 1);
+		if (lockfile && pack_lockfiles)
+			string_list_append_nodup(pack_lockfiles, lockfile);
+		else
+			free(lockfile);
+	}
+	free(cmds);
+}
+
 enum fetch_state {
 	FETCH_CHECK_LOCAL = 0,
 	FETCH_SEND_REQUEST,
@@ -1377,7 +1480,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 				    struct ref **sought, int nr_sought,
 				    struct oid_array *shallows,
 				    struct shallow_info *si,
-				    char **pack_lockfile)
+				    struct string_list *pack_lockfiles)
 {
 	struct ref *ref = copy_ref_list(orig_ref);
 	enum fetch_state state = FETCH_CHECK_LOCAL;
@@ -1386,6 +1489,8 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	int in_vain = 0;
 	int haves_to_send = INITIAL_FLUSH;
 	struct fetch_negotiator negotiator;
+	struct string_list packfile_uris = STRING_LIST_INIT_DUP;
+	struct child_process *uri_cmds;
 	fetch_negotiator_init(&negotiator, negotiation_algorithm);
 	packet_reader_init(&reader, fd[0], NULL, 0,
 			   PACKET_READ_CHOMP_NEWLINE |
@@ -1456,10 +1561,18 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			if (process_section_header(&reader, "wanted-refs", 1))
 				receive_wanted_refs(&reader, sought, nr_sought);
 
+			if (process_section_header(&reader, "packfile-uris", 1))
+				receive_packfile_uris(&reader, &packfile_uris);
+			uri_cmds = start_packfile_uris(args, &packfile_uris,
+						       !!pack_lockfiles);
+
 			/* get the pack */
 			process_section_header(&reader, "packfile", 0);
-			if (get_pack(args, fd, pack_lockfile))
+			if (get_pack(args, fd, pack_lockfiles, &packfile_uris))
 				die(_("git fetch-pack: fetch failed."));
+			if (uri_cmds)
+				finish_packfile_uris(uri_cmds, &packfile_uris,
+						     pack_lockfiles);
 
 			state = FETCH_DONE;
 			break;
@@ -1470,6 +1583,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 
 	negotiator.release(&negotiator);
 	oidset_clear(&common);
+	string_list_clear(&packfile_uris, 0);
 	return ref;
 }
 
@@ -1507,6 +1621,7 @@ static void fetch_pack_config(void)
 	git_config_get_bool("transfer.fsckobjects", &transfer_fsck_objects);
 	git_config_get_string("fetch.negotiationalgorithm",
 			      &negotiation_algorithm);
+	git_config_get_string("fetch.uriprotocols", &uri_protocols);
 
 	git_config(fetch_pack_config_cb, NULL);
 }
@@ -1659,7 +1774,7 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		       const struct ref *ref,
 		       struct ref **sought, int nr_sought,
 		       struct oid_array *shallow,
-		       char **pack_lockfile,
+		       struct string_list *pack_lockfiles,
 		       enum protocol_version version)
 {
 	struct ref *ref_cpy;
@@ -1694,11 +1809,11 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		memset(&si, 0, sizeof(si));
 		ref_cpy = do_fetch_pack_v2(args, fd, ref, sought, nr_sought,
 					   &shallows_scratch, &si,
-					   pack_lockfile);
+					   pack_lockfiles);
 	} else {
 		prepare_shallow_info(&si, shallow);
 		ref_cpy = do_fetch_pack(args, fd, ref, sought, nr_sought,
-					&si, pack_lockfile);
+					&si, pack_lockfiles);
 	}
 	reprepare_packed_git(the_repository);
 
@@ -0,0 +1,123 @@
+#include "cache.h"
+#include "config.h"
+#include "connect.h"
+#include "fetch-scheduler.h"
+#include "repository.h"
+#include "trace2.h"
+
+struct fetch_job {
+	char *label;
+	/* host counted in the scheduler, NULL if not limited */
+	char *host;
+	uint64_t start_ns;
+};
+
+void fetch_scheduler_init(struct fetch_scheduler *s, struct repository *r)
+{
+	int value;
+
+	s->max_per_host = 0;
+	string_list_init(&s->hosts, 1);
+	if (!repo_config_get_int(r, "fetch.hostjobs", &value)) {
+		if (value < 0)
+			die(_("fetch.hostJobs cannot be negative"));
+		s->max_per_host = value;
+	}
+}
+
+void fetch_scheduler_clear(struct fetch_scheduler *s)
+{
+	string_list_clear(&s->hosts, 0);
+}
+
+/*
+ * Find the host part of a URL, of either the "scheme://[user@]host[:port]/"
+ * or the scp-like "[user@]host:path" form. Leaves 'host' empty for local
+ * repositories.
+ */
+static void url_host(const char *url, struct strbuf *host)
+{
+	const char *p = strstr(url, "://");
+	const char *end, *at;
+
+	if (p) {
+		if (starts_with(url, "file://"))
+			return;
+		p += 3;
+	} else if (url_is_local_not_ssh(url)) {
+		return;
+	} else {
+		p = url;
+	}
+
+	end = p + strcspn(p, "/");
+	at = memchr(p, '@', end - p);
+	if (at)
+		p = at + 1;
+	if (*p == '[') {
+		const char *bracket = memchr(p, ']', end - p);
+		if (bracket)
+			end = bracket + 1;
+	} else {
+		end = p + strcspn(p, "/:");
+	}
+	strbuf_add(host, p, end - p);
+	strbuf_tolower(host);
+}
+
+struct fetch_job *fetch_job_start(struct fetch_scheduler *s,
+				  const char *label, const char *url)
+{
+	struct strbuf host = STRBUF_INIT;
+	struct fetch_job *job;
+
+	if (url)
+		url_host(url, &host);
+	job = xcalloc(1, sizeof(*job));
+	if (s->max_per_host && host.len) {
+		struct string_list_item *item;
+
+		item = string_list_insert(&s->hosts, host.buf);
+		if ((intptr_t)item->util >= s->max_per_host) {
+			strbuf_release(&host);
+			free(job);
+			return NULL;
+		}
+		item->util = (void *)((intptr_t)item->util + 1);
+		job->host = xstrdup(host.buf);
+	}
+	job->label = xstrdup(label);
+	job->start_ns = getnanotime();
+
+	if (host.len)
+		strbuf_insertf(&host, 0, "%s ", label);
+	else
+		strbuf_addstr(&host, label);
+	trace2_data_string("fetch", the_repository, "job/start", host.buf);
+	strbuf_release(&host);
+	return job;
+}
+
+void fetch_job_finish(struct fetch_scheduler *s, struct fetch_job *job,
+		      int result)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (job->host) {
+		struct string_list_item *item;
+
+		item = string_list_lookup(&s->hosts, job->host);
+		if (!item)
+			BUG("fetch job for unknown host '%s'", job->host);
+		item->util = (void *)((intptr_t)item->util - 1);
+		free(job->host);
+	}
+
+	strbuf_addf(&msg, "%s result:%d ms:%"PRIuMAX, job->label, result,
+		    (uintmax_t)((getnanotime() - job->start_ns) / 1000000));
+	trace2_data_string("fetch", the_repository, "job/finish", msg.buf);
+	strbuf_release(&msg);
+
+	free(job->label);
+	free(job);
+}
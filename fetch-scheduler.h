@@ -0,0 +1,46 @@
+#ifndef FETCH_SCHEDULER_H
+#define FETCH_SCHEDULER_H
+
+#include "string-list.h"
+
+struct repository;
+
+/*
+ * Bookkeeping shared by the fetches that "git fetch" runs in parallel,
+ * i.e. those of several remotes (--multiple, --all, remote groups) and
+ * those of submodules. The number of jobs run at once is the limit given
+ * to run_processes_parallel(); the scheduler additionally caps how many
+ * of them talk to the same host (fetch.hostJobs), so that a recursive
+ * fetch spreads its jobs over the hosts involved.
+ *
+ * The fetches of the superproject always run before those of its
+ * submodules, which depend on what the former brought in.
+ */
+struct fetch_scheduler {
+	/* maximum number of jobs per host; 0 means no limit */
+	int max_per_host;
+	/* hosts with running jobs; util holds the number of jobs */
+	struct string_list hosts;
+};
+#define FETCH_SCHEDULER_INIT { 0, STRING_LIST_INIT_DUP }
+
+struct fetch_job;
+
+/* Read fetch.hostJobs from the configuration of 'r'. */
+void fetch_scheduler_init(struct fetch_scheduler *s, struct repository *r);
+void fetch_scheduler_clear(struct fetch_scheduler *s);
+
+/*
+ * Account for a job called 'label' (a remote or submodule name) about to
+ * fetch from 'url'. Returns NULL if the host of 'url' already has as many
+ * jobs as allowed; the caller should try another job, or retry when one
+ * finishes. Local URLs are never limited.
+ */
+struct fetch_job *fetch_job_start(struct fetch_scheduler *s,
+				  const char *label, const char *url);
+
+/* Release the slot of a job, which exited with 'result', and free it. */
+void fetch_job_finish(struct fetch_scheduler *s, struct fetch_job *job,
+		      int result);
+
+#endif /* FETCH_SCHEDULER_H */
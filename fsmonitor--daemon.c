@@ -0,0 +1,349 @@
+#include "cache.h"
+#include "config.h"
+#include "tempfile.h"
+#include "fsmonitor.h"
+#include "unix-socket.h"
+#include "parse-options.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "compat/fsmonitor/fsm-listen.h"
+
+static const char * const fsmonitor_daemon_usage[] = {
+	"git fsmonitor--daemon start",
+	"git fsmonitor--daemon run",
+	"git fsmonitor--daemon stop",
+	"git fsmonitor--daemon status",
+	NULL
+};
+
+/*
+ * Beyond this many changed paths, we forget them all and answer
+ * queries from before that point with "everything may have changed".
+ */
+#define MAX_CHANGED_PATHS (1 << 20)
+
+static struct tempfile *socket_file;
+
+/*
+ * The daemon remembers, for every path that changed since it started,
+ * when it last saw it change. A query "query <time>" is answered with
+ * the NUL-terminated paths that changed at or after <time>, or with
+ * "/" if the daemon cannot know, as in the fsmonitor hook protocol.
+ * Directories end in a slash.
+ */
+struct changed_path {
+	struct hashmap_entry ent;
+	uint64_t time;
+	char path[FLEX_ARRAY];
+};
+
+static int changed_path_cmp(const void *unused_cmp_data,
+			    const void *entry, const void *entry_or_key,
+			    const void *keydata)
+{
+	const struct changed_path *a = entry;
+	const struct changed_path *b = entry_or_key;
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+void fsmonitor_daemon_path_changed(struct fsmonitor_daemon_state *state,
+				   const char *path, int is_dir)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct changed_path *c;
+
+	strbuf_addstr(&key, path);
+	if (is_dir)
+		strbuf_addch(&key, '/');
+
+	c = hashmap_get_from_hash(&state->changed, strhash(key.buf), key.buf);
+	if (!c) {
+		if (hashmap_get_size(&state->changed) >= MAX_CHANGED_PATHS) {
+			fsmonitor_daemon_invalidate_all(state);
+			strbuf_release(&key);
+			return;
+		}
+		FLEX_ALLOC_MEM(c, path, key.buf, key.len);
+		hashmap_entry_init(c, strhash(c->path));
+		hashmap_add(&state->changed, c);
+	}
+	c->time = getnanotime();
+	strbuf_release(&key);
+}
+
+void fsmonitor_daemon_invalidate_all(struct fsmonitor_daemon_state *state)
+{
+	hashmap_free(&state->changed, 1);
+	hashmap_init(&state->changed, changed_path_cmp, NULL, 0);
+	state->epoch = getnanotime();
+}
+
+static void answer_query(struct fsmonitor_daemon_state *state,
+			 uint64_t since, int out)
+{
+	struct strbuf answer = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct changed_path *c;
+
+	if (since < state->epoch) {
+		strbuf_addch(&answer, '/');
+	} else {
+		hashmap_iter_init(&state->changed, &iter);
+		while ((c = hashmap_iter_next(&iter))) {
+			if (c->time < since)
+				continue;
+			strbuf_addstr(&answer, c->path);
+			strbuf_addch(&answer, '\0');
+		}
+	}
+	write_in_full(out, answer.buf, answer.len);
+	strbuf_release(&answer);
+}
+
+/* Return 0 to stop serving. */
+static int serve_one_client(struct fsmonitor_daemon_state *state, int fd)
+{
+	FILE *in = xfdopen(xdup(fd), "r");
+	struct strbuf line = STRBUF_INIT;
+	const char *arg;
+	int ret = 1;
+
+	if (strbuf_getline_lf(&line, in) == EOF)
+		; /* client went away */
+	else if (skip_prefix(line.buf, "query ", &arg)) {
+		/* make sure that we know about everything up to now */
+		if (fsm_listen_read(state) < 0) {
+			write_in_full(fd, "/", 1);
+			ret = 0;
+		} else {
+			answer_query(state, strtoumax(arg, NULL, 10), fd);
+		}
+	} else if (!strcmp(line.buf, "ping")) {
+		struct strbuf answer = STRBUF_INIT;
+
+		strbuf_addf(&answer, "ok %s\n", state->worktree.buf);
+		write_in_full(fd, answer.buf, answer.len);
+		strbuf_release(&answer);
+	} else if (!strcmp(line.buf, "stop")) {
+		ret = 0;
+	} else {
+		warning("fsmonitor client sent unknown request: %s", line.buf);
+	}
+
+	fclose(in);
+	strbuf_release(&line);
+	return ret;
+}
+
+static int serve(struct fsmonitor_daemon_state *state, int listen_fd,
+		 int events_fd)
+{
+	for (;;) {
+		struct pollfd pfd[2];
+
+		pfd[0].fd = listen_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = events_fd;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return error_errno("poll failed");
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			if (fsm_listen_read(state) < 0)
+				return 0;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			int client = accept(listen_fd, NULL, NULL);
+			int keep_going;
+
+			if (client < 0) {
+				warning_errno("accept failed");
+				continue;
+			}
+			keep_going = serve_one_client(state, client);
+			/*
+			 * Remove the socket before the client sees EOF, so
+			 * that "stop" followed by "start" cannot race with
+			 * our cleanup.
+			 */
+			if (!keep_going)
+				delete_tempfile(&socket_file);
+			close(client);
+			if (!keep_going)
+				return 0;
+		}
+	}
+}
+
+/*
+ * Send a request to the daemon watching our working tree and put
+ * its answer into `answer`. Return -1 if there is no such daemon.
+ */
+static int send_request(const char *socket_path, const char *request,
+			struct strbuf *answer)
+{
+	int fd = unix_stream_connect(socket_path);
+	int ret = 0;
+
+	if (fd < 0)
+		return -1;
+	if (write_in_full(fd, request, strlen(request)) < 0 ||
+	    shutdown(fd, SHUT_WR) < 0 ||
+	    strbuf_read(answer, fd, 0) < 0)
+		ret = -1;
+	close(fd);
+	return ret;
+}
+
+static int is_running(const char *socket_path)
+{
+	struct strbuf answer = STRBUF_INIT;
+	int ret = !send_request(socket_path, "ping\n", &answer) &&
+		  starts_with(answer.buf, "ok ");
+
+	strbuf_release(&answer);
+	return ret;
+}
+
+static int run_daemon(const char *socket_path, int detach)
+{
+	struct fsmonitor_daemon_state state;
+	int events_fd, listen_fd, ret;
+
+	if (is_running(socket_path))
+		die(_("fsmonitor daemon is already running for '%s'"),
+		    get_git_work_tree());
+
+	memset(&state, 0, sizeof(state));
+	strbuf_init(&state.worktree, 0);
+	strbuf_addstr(&state.worktree, get_git_work_tree());
+	strbuf_strip_suffix(&state.worktree, "/");
+	hashmap_init(&state.changed, changed_path_cmp, NULL, 0);
+
+	events_fd = fsm_listen_init(&state);
+	if (events_fd < 0)
+		return error(_("unable to watch '%s'"), state.worktree.buf);
+	/* whatever happened before we watched everything is unknown */
+	state.epoch = getnanotime();
+
+	listen_fd = unix_stream_listen(socket_path);
+	if (listen_fd < 0)
+		die_errno(_("unable to bind to '%s'"), socket_path);
+	socket_file = register_tempfile(socket_path);
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	/*
+	 * We only use absolute paths. Do not keep the working tree busy,
+	 * or we would not notice when it is removed.
+	 */
+	if (chdir("/"))
+		; /* not important */
+
+	if (detach) {
+		printf("ok\n");
+		fclose(stdout);
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno("unable to point stderr to /dev/null");
+	}
+
+	ret = serve(&state, listen_fd, events_fd);
+
+	delete_tempfile(&socket_file);
+	close(listen_fd);
+	fsm_listen_release(&state);
+	hashmap_free(&state.changed, 1);
+	strbuf_release(&state.worktree);
+	return ret;
+}
+
+static int start_daemon(const char *socket_path)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r;
+
+	if (is_running(socket_path))
+		die(_("fsmonitor daemon is already running for '%s'"),
+		    get_git_work_tree());
+
+	argv_array_pushl(&daemon.args, "git-fsmonitor--daemon", "run",
+			 "--detach", NULL);
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		die_errno(_("unable to start fsmonitor daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	if (r < 0)
+		die_errno(_("unable to read result code from fsmonitor daemon"));
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		die(_("fsmonitor daemon did not start: %.*s"), r, buf);
+	close(daemon.out);
+	return 0;
+}
+
+static int stop_daemon(const char *socket_path)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	/* the daemon closes the connection once it has cleaned up */
+	if (send_request(socket_path, "stop\n", &answer) < 0)
+		return error(_("fsmonitor daemon is not running"));
+	strbuf_release(&answer);
+	return 0;
+}
+
+static int daemon_status(const char *socket_path)
+{
+	if (!is_running(socket_path)) {
+		printf(_("fsmonitor daemon is not watching '%s'\n"),
+		       get_git_work_tree());
+		return 1;
+	}
+	printf(_("fsmonitor daemon is watching '%s'\n"), get_git_work_tree());
+	return 0;
+}
+
+int cmd_main(int argc, const char **argv)
+{
+	const char *subcmd;
+	char *socket_path;
+	int detach = 0, ret;
+	struct option options[] = {
+		OPT_HIDDEN_BOOL(0, "detach", &detach,
+				N_("report readiness on stdout and close it")),
+		OPT_END()
+	};
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, NULL, options,
+			     fsmonitor_daemon_usage, 0);
+	if (argc != 1)
+		usage_with_options(fsmonitor_daemon_usage, options);
+	subcmd = argv[0];
+
+	if (is_bare_repository() || !get_git_work_tree())
+		die(_("fsmonitor daemon needs a working tree"));
+	socket_path = fsmonitor_daemon_socket_path();
+
+	if (!strcmp(subcmd, "start"))
+		ret = start_daemon(socket_path);
+	else if (!strcmp(subcmd, "run"))
+		ret = run_daemon(socket_path, detach);
+	else if (!strcmp(subcmd, "stop"))
+		ret = stop_daemon(socket_path);
+	else if (!strcmp(subcmd, "status"))
+		ret = daemon_status(socket_path);
+	else
+		usage_with_options(fsmonitor_daemon_usage, options);
+
+	free(socket_path);
+	return !!ret;
+}
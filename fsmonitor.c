@@ -5,6 +5,7 @@
 #include "fsmonitor.h"
 #include "run-command.h"
 #include "strbuf.h"
+#include "unix-socket.h"
 
 #define INDEX_EXTENSION_VERSION	(1)
 #define HOOK_INTERFACE_VERSION	(1)
@@ -91,6 +92,50 @@ void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
 	trace_printf_key(&trace_fsmonitor, "write fsmonitor extension successful");
 }
 
+int fsmonitor_use_daemon(void)
+{
+	return core_fsmonitor && git_parse_maybe_bool(core_fsmonitor) == 1;
+}
+
+char *fsmonitor_daemon_socket_path(void)
+{
+	return absolute_pathdup(git_path("fsmonitor--daemon.ipc"));
+}
+
+/*
+ * Ask git-fsmonitor--daemon for the paths changed since last_update. The
+ * answer has the same format as the output of a hook.
+ */
+static int query_fsmonitor_daemon(uint64_t last_update, struct strbuf *query_result)
+{
+#ifdef NO_UNIX_SOCKETS
+	return -1;
+#else
+	char *socket_path = fsmonitor_daemon_socket_path();
+	struct strbuf request = STRBUF_INIT;
+	int fd, ret = 0;
+
+	fd = unix_stream_connect(socket_path);
+	if (fd < 0) {
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor daemon not listening on '%s'",
+				 socket_path);
+		free(socket_path);
+		return -1;
+	}
+	free(socket_path);
+
+	strbuf_addf(&request, "query %"PRIuMAX"\n", (uintmax_t)last_update);
+	if (write_in_full(fd, request.buf, request.len) < 0 ||
+	    shutdown(fd, SHUT_WR) < 0 ||
+	    strbuf_read(query_result, fd, 1024) < 0)
+		ret = -1;
+	close(fd);
+	strbuf_release(&request);
+	return ret;
+#endif
+}
+
 /*
  * Call the query-fsmonitor hook passing the time of the last saved results.
  */
@@ -101,6 +146,9 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	if (!core_fsmonitor)
 		return -1;
 
+	if (fsmonitor_use_daemon())
+		return query_fsmonitor_daemon(last_update, query_result);
+
 	argv_array_push(&cp.args, core_fsmonitor);
 	argv_array_pushf(&cp.args, "%d", version);
 	argv_array_pushf(&cp.args, "%" PRIuMAX, (uintmax_t)last_update);
@@ -110,10 +158,50 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	return capture_command(&cp, query_result, 1024);
 }
 
+/*
+ * A name ending in a slash stands for a directory that was created,
+ * removed or renamed as a whole; everything below it may have changed.
+ */
+static void fsmonitor_refresh_callback_dir(struct index_state *istate,
+					   const char *name, size_t len)
+{
+	char *dir = xmemdupz(name, len - 1);
+	int pos = index_name_pos(istate, dir, len - 1);
+
+	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback dir '%s'", name);
+	if (pos >= 0)
+		istate->cache[pos++]->ce_flags &= ~CE_FSMONITOR_VALID;
+	else
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+		int cmp = strncmp(ce->name, name, len);
+
+		/* "dir-a" sorts before "dir/", "dir0" after it */
+		if (cmp > 0)
+			break;
+		if (!cmp)
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+
+	if (verify_path(dir, 0)) {
+		untracked_cache_invalidate_path(istate, dir, 1);
+		untracked_cache_invalidate_path(istate, name, 1);
+	}
+	free(dir);
+}
+
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	size_t len = strlen(name);
+	int pos;
+
+	if (len > 1 && name[len - 1] == '/') {
+		fsmonitor_refresh_callback_dir(istate, name, len);
+		return;
+	}
 
+	pos = index_name_pos(istate, name, len);
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
 		ce->ce_flags &= ~CE_FSMONITOR_VALID;
@@ -37,13 +37,25 @@ void remove_fsmonitor(struct index_state *istate);
 void tweak_fsmonitor(struct index_state *istate);
 
 /*
- * Run the configured fsmonitor integration script and clear the
+ * Run the configured fsmonitor integration script (or ask the built-in
+ * git-fsmonitor--daemon, if core.fsmonitor is "true") and clear the
  * CE_FSMONITOR_VALID bit for any files returned as dirty.  Also invalidate
  * any corresponding untracked cache directory structures. Optimized to only
  * run the first time it is called.
  */
 void refresh_fsmonitor(struct index_state *istate);
 
+/*
+ * Does core.fsmonitor select the built-in daemon rather than a hook?
+ */
+int fsmonitor_use_daemon(void);
+
+/*
+ * Return the path of the socket on which git-fsmonitor--daemon serves
+ * the working tree of the current repository. The caller must free it.
+ */
+char *fsmonitor_daemon_socket_path(void);
+
 /*
  * Set the given cache entries CE_FSMONITOR_VALID bit. This should be
  * called any time the cache entry has been updated to reflect the
@@ -4,6 +4,7 @@
 #include "help.h"
 #include "run-command.h"
 #include "alias.h"
+#include "command-server.h"
 
 #define RUN_SETUP		(1<<0)
 #define RUN_SETUP_GENTLY	(1<<1)
@@ -16,6 +17,7 @@
 #define SUPPORT_SUPER_PREFIX	(1<<4)
 #define DELAY_PAGER_CONFIG	(1<<5)
 #define NO_PARSEOPT		(1<<6) /* parse-options is not used */
+#define USE_COMMAND_SERVER	(1<<7) /* may run in "git command-server" */
 
 struct cmd_struct {
 	const char *cmd;
@@ -417,8 +419,12 @@ static int run_builtin(struct cmd_struct *p, int argc, const char **argv)
 			prefix = setup_git_directory_gently(&nongit_ok);
 		}
 
+		/*
+		 * Without a terminal no pager is started, whatever
+		 * pager.<cmd> says; do not read the config for it.
+		 */
 		if (use_pager == -1 && p->option & (RUN_SETUP | RUN_SETUP_GENTLY) &&
-		    !(p->option & DELAY_PAGER_CONFIG))
+		    !(p->option & DELAY_PAGER_CONFIG) && isatty(1))
 			use_pager = check_pager_config(p->cmd);
 		if (use_pager == -1 && p->option & USE_PAGER)
 			use_pager = 1;
@@ -475,7 +481,7 @@ static struct cmd_struct commands[] = {
 	{ "blame", cmd_blame, RUN_SETUP },
 	{ "branch", cmd_branch, RUN_SETUP | DELAY_PAGER_CONFIG },
 	{ "bundle", cmd_bundle, RUN_SETUP_GENTLY | NO_PARSEOPT },
-	{ "cat-file", cmd_cat_file, RUN_SETUP },
+	{ "cat-file", cmd_cat_file, RUN_SETUP | USE_COMMAND_SERVER },
 	{ "check-attr", cmd_check_attr, RUN_SETUP },
 	{ "check-ignore", cmd_check_ignore, RUN_SETUP | NEED_WORK_TREE },
 	{ "check-mailmap", cmd_check_mailmap, RUN_SETUP },
@@ -488,6 +494,7 @@ static struct cmd_struct commands[] = {
 	{ "clean", cmd_clean, RUN_SETUP | NEED_WORK_TREE },
 	{ "clone", cmd_clone },
 	{ "column", cmd_column, RUN_SETUP_GENTLY },
+	{ "command-server", cmd_command_server, RUN_SETUP },
 	{ "commit", cmd_commit, RUN_SETUP | NEED_WORK_TREE },
 	{ "commit-graph", cmd_commit_graph, RUN_SETUP },
 	{ "commit-tree", cmd_commit_tree, RUN_SETUP | NO_PARSEOPT },
@@ -505,7 +512,8 @@ static struct cmd_struct commands[] = {
 	{ "fetch", cmd_fetch, RUN_SETUP },
 	{ "fetch-pack", cmd_fetch_pack, RUN_SETUP | NO_PARSEOPT },
 	{ "fmt-merge-msg", cmd_fmt_merge_msg, RUN_SETUP },
-	{ "for-each-ref", cmd_for_each_ref, RUN_SETUP },
+	{ "for-each-ref", cmd_for_each_ref, RUN_SETUP | USE_COMMAND_SERVER },
+	{ "for-each-repo", cmd_for_each_repo, RUN_SETUP_GENTLY },
 	{ "format-patch", cmd_format_patch, RUN_SETUP },
 	{ "fsck", cmd_fsck, RUN_SETUP },
 	{ "fsck-objects", cmd_fsck, RUN_SETUP },
@@ -519,13 +527,14 @@ static struct cmd_struct commands[] = {
 	{ "init-db", cmd_init_db },
 	{ "interpret-trailers", cmd_interpret_trailers, RUN_SETUP_GENTLY },
 	{ "log", cmd_log, RUN_SETUP },
-	{ "ls-files", cmd_ls_files, RUN_SETUP },
+	{ "ls-files", cmd_ls_files, RUN_SETUP | USE_COMMAND_SERVER },
 	{ "ls-remote", cmd_ls_remote, RUN_SETUP_GENTLY },
-	{ "ls-tree", cmd_ls_tree, RUN_SETUP },
+	{ "ls-tree", cmd_ls_tree, RUN_SETUP | USE_COMMAND_SERVER },
 	{ "mailinfo", cmd_mailinfo, RUN_SETUP_GENTLY | NO_PARSEOPT },
 	{ "mailsplit", cmd_mailsplit, NO_PARSEOPT },
+	{ "maintenance", cmd_maintenance, RUN_SETUP | NO_PARSEOPT },
 	{ "merge", cmd_merge, RUN_SETUP | NEED_WORK_TREE },
-	{ "merge-base", cmd_merge_base, RUN_SETUP },
+	{ "merge-base", cmd_merge_base, RUN_SETUP | USE_COMMAND_SERVER },
 	{ "merge-file", cmd_merge_file, RUN_SETUP_GENTLY },
 	{ "merge-index", cmd_merge_index, RUN_SETUP | NO_PARSEOPT },
 	{ "merge-ours", cmd_merge_ours, RUN_SETUP | NO_PARSEOPT },
@@ -533,7 +542,7 @@ static struct cmd_struct commands[] = {
 	{ "merge-recursive-ours", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
 	{ "merge-recursive-theirs", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
 	{ "merge-subtree", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
-	{ "merge-tree", cmd_merge_tree, RUN_SETUP | NO_PARSEOPT },
+	{ "merge-tree", cmd_merge_tree, RUN_SETUP },
 	{ "mktag", cmd_mktag, RUN_SETUP | NO_PARSEOPT },
 	{ "mktree", cmd_mktree, RUN_SETUP },
 	{ "multi-pack-index", cmd_multi_pack_index, RUN_SETUP_GENTLY },
@@ -563,8 +572,8 @@ static struct cmd_struct commands[] = {
 	{ "rerere", cmd_rerere, RUN_SETUP },
 	{ "reset", cmd_reset, RUN_SETUP },
 	{ "restore", cmd_restore, RUN_SETUP | NEED_WORK_TREE },
-	{ "rev-list", cmd_rev_list, RUN_SETUP | NO_PARSEOPT },
-	{ "rev-parse", cmd_rev_parse, NO_PARSEOPT },
+	{ "rev-list", cmd_rev_list, RUN_SETUP | NO_PARSEOPT | USE_COMMAND_SERVER },
+	{ "rev-parse", cmd_rev_parse, NO_PARSEOPT | USE_COMMAND_SERVER },
 	{ "revert", cmd_revert, RUN_SETUP | NEED_WORK_TREE },
 	{ "rm", cmd_rm, RUN_SETUP },
 	{ "send-pack", cmd_send_pack, RUN_SETUP },
@@ -572,7 +581,7 @@ static struct cmd_struct commands[] = {
 	{ "show", cmd_show, RUN_SETUP },
 	{ "show-branch", cmd_show_branch, RUN_SETUP },
 	{ "show-index", cmd_show_index },
-	{ "show-ref", cmd_show_ref, RUN_SETUP },
+	{ "show-ref", cmd_show_ref, RUN_SETUP | USE_COMMAND_SERVER },
 	{ "stage", cmd_add, RUN_SETUP | NEED_WORK_TREE },
 	/*
 	 * NEEDSWORK: Until the builtin stash is thoroughly robust and no
@@ -670,11 +679,35 @@ static void handle_builtin(int argc, const char **argv)
 	}
 
 	builtin = get_builtin(cmd);
-	if (builtin)
+	if (builtin) {
+		int status;
+
+		/* --[no-]pager and --super-prefix are not passed on */
+		if (builtin->option & USE_COMMAND_SERVER &&
+		    use_pager == -1 && !get_super_prefix() &&
+		    !command_server_run(argc, argv, &status))
+			exit(status);
 		exit(run_builtin(builtin, argc, argv));
+	}
 	argv_array_clear(&args);
 }
 
+int is_served_builtin(const char *cmd)
+{
+	struct cmd_struct *builtin = get_builtin(cmd);
+
+	return builtin && builtin->option & USE_COMMAND_SERVER;
+}
+
+int run_served_builtin(int argc, const char **argv)
+{
+	struct cmd_struct *builtin = get_builtin(argv[0]);
+
+	if (!builtin || !(builtin->option & USE_COMMAND_SERVER))
+		return -1;
+	return run_builtin(builtin, argc, argv);
+}
+
 static void execv_dashed_external(const char **argv)
 {
 	struct child_process cmd = CHILD_PROCESS_INIT;
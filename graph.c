@@ -5,6 +5,7 @@
 #include "graph.h"
 #include "revision.h"
 #include "argv-array.h"
+#include "commit-slab.h"
 
 /* Internal API */
 
@@ -122,6 +123,19 @@ static void strbuf_write_column(struct strbuf *sb, const struct column *c,
 		strbuf_addstr(sb, column_get_color_code(column_colors_max));
 }
 
+/*
+ * Where a commit is in graph->new_columns, so that it can be found
+ * without scanning all the columns: there are hundreds of them in
+ * histories with many concurrent branches. The entry is only valid if
+ * "round" is the current graph->round; if it is the previous round,
+ * "index" is where the commit is in graph->columns instead.
+ */
+struct column_pos {
+	unsigned int round;
+	int index;
+};
+define_commit_slab(column_pos_slab, struct column_pos);
+
 struct git_graph {
 	/*
 	 * The commit currently being processed
@@ -226,6 +240,12 @@ struct git_graph {
 	 * stored as an index into the array column_colors.
 	 */
 	unsigned short default_column_color;
+	/*
+	 * Incremented each time new_columns is computed anew, see
+	 * struct column_pos.
+	 */
+	unsigned int round;
+	struct column_pos_slab column_pos;
 };
 
 static struct strbuf *diff_output_prefix_callback(struct diff_options *opt, void *data)
@@ -295,6 +315,10 @@ struct git_graph *graph_init(struct rev_info *opt)
 	 */
 	graph->default_column_color = column_colors_max - 1;
 
+	/* no column_pos entry is valid, not even for the previous round */
+	graph->round = 1;
+	init_column_pos_slab(&graph->column_pos);
+
 	/*
 	 * Allocate a reasonably large default number of columns
 	 * We'll automatically grow columns later if we need more room.
@@ -421,14 +445,15 @@ static void graph_increment_column_color(struct git_graph *graph)
 		column_colors_max;
 }
 
-static unsigned short graph_find_commit_color(const struct git_graph *graph,
+static unsigned short graph_find_commit_color(struct git_graph *graph,
 					      const struct commit *commit)
 {
-	int i;
-	for (i = 0; i < graph->num_columns; i++) {
-		if (graph->columns[i].commit == commit)
-			return graph->columns[i].color;
-	}
+	struct column_pos *pos = column_pos_slab_peek(&graph->column_pos,
+						      commit);
+
+	if (pos && pos->round == graph->round - 1 &&
+	    pos->index < graph->num_columns)
+		return graph->columns[pos->index].color;
 	return graph_get_current_column_color(graph);
 }
 
@@ -436,18 +461,17 @@ static void graph_insert_into_new_columns(struct git_graph *graph,
 					  struct commit *commit,
 					  int *mapping_index)
 {
-	int i;
+	struct column_pos *pos;
 
 	/*
 	 * If the commit is already in the new_columns list, we don't need to
 	 * add it.  Just update the mapping correctly.
 	 */
-	for (i = 0; i < graph->num_new_columns; i++) {
-		if (graph->new_columns[i].commit == commit) {
-			graph->mapping[*mapping_index] = i;
-			*mapping_index += 2;
-			return;
-		}
+	pos = column_pos_slab_at(&graph->column_pos, commit);
+	if (pos->round == graph->round) {
+		graph->mapping[*mapping_index] = pos->index;
+		*mapping_index += 2;
+		return;
 	}
 
 	/*
@@ -455,6 +479,8 @@ static void graph_insert_into_new_columns(struct git_graph *graph,
 	 */
 	graph->new_columns[graph->num_new_columns].commit = commit;
 	graph->new_columns[graph->num_new_columns].color = graph_find_commit_color(graph, commit);
+	pos->round = graph->round;
+	pos->index = graph->num_new_columns;
 	graph->mapping[*mapping_index] = graph->num_new_columns;
 	*mapping_index += 2;
 	graph->num_new_columns++;
@@ -513,6 +539,7 @@ static void graph_update_columns(struct git_graph *graph)
 	SWAP(graph->columns, graph->new_columns);
 	graph->num_columns = graph->num_new_columns;
 	graph->num_new_columns = 0;
+	graph->round++;
 
 	/*
 	 * Now update new_columns and mapping with the information for the
@@ -973,12 +1000,12 @@ static void graph_output_commit_line(struct git_graph *graph, struct strbuf *sb)
 static struct column *find_new_column_by_commit(struct git_graph *graph,
 						struct commit *commit)
 {
-	int i;
-	for (i = 0; i < graph->num_new_columns; i++) {
-		if (graph->new_columns[i].commit == commit)
-			return &graph->new_columns[i];
-	}
-	return NULL;
+	struct column_pos *pos = column_pos_slab_peek(&graph->column_pos,
+						      commit);
+
+	if (!pos || pos->round != graph->round)
+		return NULL;
+	return &graph->new_columns[pos->index];
 }
 
 static void graph_output_post_merge_line(struct git_graph *graph, struct strbuf *sb)
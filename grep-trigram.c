@@ -0,0 +1,526 @@
+#include "cache.h"
+#include "grep-trigram.h"
+#include "object-store.h"
+#include "lockfile.h"
+#include "csum-file.h"
+#include "sha1-lookup.h"
+#include "thread-utils.h"
+
+#define GREP_TRIGRAM_SIGNATURE 0x47545249 /* "GTRI" */
+#define GREP_TRIGRAM_VERSION 1
+#define GREP_TRIGRAM_HASH_VERSION 1
+#define GREP_TRIGRAM_HEADER_SIZE 16
+#define GREP_TRIGRAM_FANOUT_SIZE (256 * 4)
+
+/*
+ * A trigram sets this many bits of a filter, which has this many bits
+ * for each distinct trigram of its blob.
+ */
+#define TRIGRAM_NUM_HASHES 7
+#define TRIGRAM_BITS_PER_ENTRY 10
+
+/*
+ * Blobs with more distinct trigrams than this (large or binary ones)
+ * get an empty filter, which rules nothing out.
+ */
+#define TRIGRAM_MAX_ENTRIES (1 << 14)
+
+/* Keeps the query of a long pattern cheap. */
+#define TRIGRAM_MAX_PLANNED 32
+
+#define TRIGRAM_NONE 0xffffffff
+
+struct added_filter {
+	struct object_id oid;
+	unsigned char *data;
+	size_t len;
+};
+
+struct grep_trigram_index {
+	char *filename;
+
+	const unsigned char *map;
+	size_t map_len;
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *oids;
+	const unsigned char *offsets;
+	const unsigned char *filters;
+	size_t filters_len;
+
+	/* protects the filters added by grep_trigram_index_add() */
+	pthread_mutex_t mutex;
+	struct added_filter *added;
+	size_t added_nr, added_alloc;
+};
+
+static inline uint32_t trigram_at(const unsigned char *p)
+{
+	return (tolower(p[0]) << 16) | (tolower(p[1]) << 8) | tolower(p[2]);
+}
+
+static inline uint32_t trigram_hash(uint32_t t, uint32_t seed)
+{
+	uint32_t h = t ^ seed;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static void add_trigram_to_filter(uint32_t t, unsigned char *data, size_t len)
+{
+	uint32_t h1 = trigram_hash(t, 0x293ae76f);
+	uint32_t h2 = trigram_hash(t, 0x7e646e2c);
+	size_t nbits = len * 8;
+	int i;
+
+	for (i = 0; i < TRIGRAM_NUM_HASHES; i++) {
+		size_t bit = (h1 + i * h2) % nbits;
+		data[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+int grep_trigram_filter_maybe(const struct grep_trigram_filter *filter,
+			      const uint32_t *trigrams, size_t nr)
+{
+	size_t nbits = filter->len * 8;
+	size_t i;
+
+	if (!filter->len)
+		return 1;
+
+	for (i = 0; i < nr; i++) {
+		uint32_t h1 = trigram_hash(trigrams[i], 0x293ae76f);
+		uint32_t h2 = trigram_hash(trigrams[i], 0x7e646e2c);
+		int j;
+
+		for (j = 0; j < TRIGRAM_NUM_HASHES; j++) {
+			size_t bit = (h1 + j * h2) % nbits;
+			if (!(filter->data[bit / 8] & (1 << (bit % 8))))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_grep_trigrams(struct grep_trigram_index *idx,
+			       const unsigned char *map, size_t len)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	size_t fixed_len;
+
+	if (len < GREP_TRIGRAM_HEADER_SIZE + GREP_TRIGRAM_FANOUT_SIZE + rawsz)
+		return error(_("grep trigram index is too small"));
+	if (get_be32(map) != GREP_TRIGRAM_SIGNATURE)
+		return error(_("grep trigram index signature %X does not match %X"),
+			     get_be32(map), GREP_TRIGRAM_SIGNATURE);
+	if (map[4] != GREP_TRIGRAM_VERSION || map[5] != GREP_TRIGRAM_HASH_VERSION ||
+	    map[6] != TRIGRAM_NUM_HASHES)
+		return error(_("grep trigram index version %d.%d.%d is not supported"),
+			     map[4], map[5], map[6]);
+	if (get_be32(map + 8) != the_hash_algo->format_id)
+		return error(_("grep trigram index uses another hash algorithm"));
+
+	idx->nr = get_be32(map + 12);
+	idx->fanout = map + GREP_TRIGRAM_HEADER_SIZE;
+	idx->oids = idx->fanout + GREP_TRIGRAM_FANOUT_SIZE;
+	idx->offsets = idx->oids + st_mult(idx->nr, rawsz);
+	idx->filters = idx->offsets + st_mult(idx->nr, 8);
+
+	fixed_len = st_add3(GREP_TRIGRAM_HEADER_SIZE + GREP_TRIGRAM_FANOUT_SIZE,
+			    st_mult(idx->nr, rawsz + 8), rawsz);
+	if (len < fixed_len ||
+	    get_be32(idx->fanout + 255 * 4) != idx->nr)
+		return error(_("grep trigram index is truncated"));
+	idx->filters_len = len - fixed_len;
+	if (idx->nr &&
+	    get_be64(idx->offsets + 8 * (idx->nr - 1)) != idx->filters_len)
+		return error(_("grep trigram index is truncated"));
+
+	idx->map = map;
+	idx->map_len = len;
+	return 0;
+}
+
+struct grep_trigram_index *grep_trigram_index_open(struct repository *r)
+{
+	struct grep_trigram_index *idx = xcalloc(1, sizeof(*idx));
+	struct stat st;
+	int fd;
+
+	idx->filename = xstrfmt("%s/info/grep-trigrams", r->objects->odb->path);
+	pthread_mutex_init(&idx->mutex, NULL);
+
+	fd = git_open(idx->filename);
+	if (fd < 0)
+		return idx;
+	if (!fstat(fd, &st) && st.st_size) {
+		size_t len = xsize_t(st.st_size);
+		void *map = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (parse_grep_trigrams(idx, map, len)) {
+			munmap(map, len);
+			idx->nr = 0;
+		}
+	}
+	close(fd);
+	return idx;
+}
+
+int grep_trigram_index_lookup(struct grep_trigram_index *idx,
+			      const struct object_id *oid,
+			      struct grep_trigram_filter *filter)
+{
+	uint32_t pos;
+	uint64_t start, end;
+
+	if (!idx->nr ||
+	    !bsearch_hash(oid->hash, (const uint32_t *)idx->fanout, idx->oids,
+			  the_hash_algo->rawsz, &pos))
+		return -1;
+
+	start = pos ? get_be64(idx->offsets + 8 * (pos - 1)) : 0;
+	end = get_be64(idx->offsets + 8 * pos);
+	if (start > end || end > idx->filters_len)
+		return -1;
+
+	filter->data = idx->filters + start;
+	filter->len = end - start;
+	return 0;
+}
+
+void grep_trigram_index_add(struct grep_trigram_index *idx,
+			    const struct object_id *oid,
+			    const char *buf, unsigned long size)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t want = size < TRIGRAM_MAX_ENTRIES ? size : TRIGRAM_MAX_ENTRIES + 1;
+	size_t set_size = 16, nr = 0, len = 0, i;
+	unsigned char *data = NULL;
+	uint32_t *set;
+
+	while (set_size < 2 * want)
+		set_size *= 2;
+	ALLOC_ARRAY(set, set_size);
+	memset(set, 0xff, st_mult(set_size, sizeof(*set)));
+
+	for (i = 0; i + 2 < size; i++) {
+		uint32_t t = trigram_at(p + i);
+		size_t slot = (t * 2654435761u) & (set_size - 1);
+
+		while (set[slot] != t && set[slot] != TRIGRAM_NONE)
+			slot = (slot + 1) & (set_size - 1);
+		if (set[slot] == t)
+			continue;
+		if (++nr > TRIGRAM_MAX_ENTRIES)
+			break;
+		set[slot] = t;
+	}
+
+	if (nr <= TRIGRAM_MAX_ENTRIES) {
+		/* a filter without any bit set rules out every trigram */
+		len = (nr * TRIGRAM_BITS_PER_ENTRY + 7) / 8;
+		if (!len)
+			len = 1;
+		data = xcalloc(len, 1);
+		for (i = 0; i < set_size; i++)
+			if (set[i] != TRIGRAM_NONE)
+				add_trigram_to_filter(set[i], data, len);
+	}
+	free(set);
+
+	pthread_mutex_lock(&idx->mutex);
+	ALLOC_GROW(idx->added, idx->added_nr + 1, idx->added_alloc);
+	oidcpy(&idx->added[idx->added_nr].oid, oid);
+	idx->added[idx->added_nr].data = data;
+	idx->added[idx->added_nr].len = len;
+	idx->added_nr++;
+	pthread_mutex_unlock(&idx->mutex);
+}
+
+static void plan_run(struct grep_pat *p, const char *run, size_t len,
+		     size_t *alloc)
+{
+	size_t i, j;
+
+	for (i = 0; i + 2 < len && p->trigrams_nr < TRIGRAM_MAX_PLANNED; i++) {
+		uint32_t t = trigram_at((const unsigned char *)run + i);
+
+		for (j = 0; j < p->trigrams_nr; j++)
+			if (p->trigrams[j] == t)
+				break;
+		if (j < p->trigrams_nr)
+			continue;
+		ALLOC_GROW(p->trigrams, p->trigrams_nr + 1, *alloc);
+		p->trigrams[p->trigrams_nr++] = t;
+	}
+}
+
+/*
+ * Returns the position of the ']' that closes the bracket expression
+ * starting at pat[i], or 0 if there is none.
+ */
+static size_t skip_bracket(const char *pat, size_t len, size_t i,
+			   enum grep_pattern_type type)
+{
+	i++;
+	if (i < len && pat[i] == '^')
+		i++;
+	if (i < len && pat[i] == ']')
+		i++;
+	for (; i < len; i++) {
+		if (pat[i] == ']')
+			return i;
+		if (type == GREP_PATTERN_TYPE_PCRE && pat[i] == '\\')
+			i++;
+		else if (pat[i] == '[' && i + 1 < len &&
+			 strchr(":.=", pat[i + 1])) {
+			char kind = pat[i + 1];
+			for (i += 2; i + 1 < len; i++)
+				if (pat[i] == kind && pat[i + 1] == ']')
+					break;
+			i++;
+		}
+	}
+	return 0;
+}
+
+void grep_trigram_plan(struct grep_pat *p, enum grep_pattern_type type)
+{
+	const char *pat = p->pattern;
+	size_t len = p->patternlen, alloc = 0, i;
+	struct strbuf run = STRBUF_INIT;
+	int depth = 0;
+
+	p->trigrams_nr = 0;
+	if (type == GREP_PATTERN_TYPE_FIXED) {
+		plan_run(p, pat, len, &alloc);
+		return;
+	}
+	/* the regex engines may fold more than ASCII */
+	if (p->ignore_case)
+		return;
+
+	/*
+	 * Collect the runs of literal characters outside of groups (which
+	 * may be optional), and give up on alternations outside of them.
+	 * An atom followed by a quantifier that allows zero repetitions is
+	 * not part of the run, and neither is anything else we do not
+	 * understand.
+	 */
+	for (i = 0; i < len; i++) {
+		char c = pat[i];
+		enum { LITERAL, BREAK, OPTIONAL, INTERVAL } what = LITERAL;
+
+		if (c == '\\') {
+			if (++i == len)
+				goto give_up;
+			c = pat[i];
+			if (type == GREP_PATTERN_TYPE_PCRE) {
+				if (isalnum(c) && !strchr("bBwWsSdDAzZGhHvVRNX", c))
+					goto give_up;
+				what = isalnum(c) ? BREAK : LITERAL;
+			} else if (strchr(".*[]^$\\/", c)) {
+				what = LITERAL;
+			} else if (type == GREP_PATTERN_TYPE_ERE &&
+				   strchr("+?{}()|", c)) {
+				what = LITERAL;
+			} else if (c == '|') {
+				if (!depth)
+					goto give_up;
+				what = BREAK;
+			} else if (c == '(') {
+				depth++;
+				what = BREAK;
+			} else if (c == ')') {
+				if (depth)
+					depth--;
+				what = BREAK;
+			} else if (c == '?') {
+				what = OPTIONAL;
+			} else if (c == '{') {
+				what = INTERVAL;
+			} else {
+				what = BREAK;
+			}
+		} else if (c == '[') {
+			i = skip_bracket(pat, len, i, type);
+			if (!i)
+				goto give_up;
+			what = BREAK;
+		} else if (c == '.' || c == '^' || c == '$') {
+			what = BREAK;
+		} else if (c == '*') {
+			what = OPTIONAL;
+		} else if (type != GREP_PATTERN_TYPE_BRE) {
+			if (c == '|') {
+				if (!depth)
+					goto give_up;
+				what = BREAK;
+			} else if (c == '(') {
+				if (type == GREP_PATTERN_TYPE_PCRE &&
+				    i + 1 < len && pat[i + 1] == '?' &&
+				    (i + 2 == len || pat[i + 2] != ':'))
+					goto give_up;
+				depth++;
+				what = BREAK;
+			} else if (c == ')') {
+				if (depth)
+					depth--;
+				what = BREAK;
+			} else if (c == '?') {
+				what = OPTIONAL;
+			} else if (c == '+') {
+				what = BREAK;
+			} else if (c == '{') {
+				what = INTERVAL;
+			}
+		}
+
+		if (what == LITERAL) {
+			if (!depth)
+				strbuf_addch(&run, c);
+			continue;
+		}
+		if (what != BREAK && run.len)
+			strbuf_setlen(&run, run.len - 1);
+		plan_run(p, run.buf, run.len, &alloc);
+		strbuf_reset(&run);
+		if (what == INTERVAL) {
+			const char *end = type == GREP_PATTERN_TYPE_BRE ? "\\}" : "}";
+			const char *close = strstr(pat + i, end);
+			if (!close || close >= pat + len)
+				goto give_up;
+			i = close - pat + strlen(end) - 1;
+		}
+	}
+	plan_run(p, run.buf, run.len, &alloc);
+	strbuf_release(&run);
+	return;
+
+give_up:
+	p->trigrams_nr = 0;
+	strbuf_release(&run);
+}
+
+static int added_filter_cmp(const void *va, const void *vb)
+{
+	const struct added_filter *a = va, *b = vb;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+struct merged_filter {
+	const unsigned char *hash;
+	const unsigned char *data;
+	size_t len;
+};
+
+static void write_grep_trigrams(struct grep_trigram_index *idx)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	struct lock_file lk = LOCK_INIT;
+	struct merged_filter *all;
+	struct hashfile *f;
+	size_t nr = 0, i = 0, j = 0, k;
+	uint32_t fanout[256] = { 0 };
+	unsigned char buf[GREP_TRIGRAM_HEADER_SIZE];
+	uint64_t offset = 0;
+
+	QSORT(idx->added, idx->added_nr, added_filter_cmp);
+
+	ALLOC_ARRAY(all, st_add(idx->nr, idx->added_nr));
+	while (i < idx->nr || j < idx->added_nr) {
+		const unsigned char *old = idx->oids + st_mult(i, rawsz);
+		int cmp;
+
+		if (i == idx->nr)
+			cmp = 1;
+		else if (j == idx->added_nr)
+			cmp = -1;
+		else
+			cmp = hashcmp(old, idx->added[j].oid.hash);
+
+		if (cmp <= 0) {
+			uint64_t start = i ? get_be64(idx->offsets + 8 * (i - 1)) : 0;
+
+			all[nr].hash = old;
+			all[nr].data = idx->filters + start;
+			all[nr].len = get_be64(idx->offsets + 8 * i) - start;
+			i++;
+		} else {
+			all[nr].hash = idx->added[j].oid.hash;
+			all[nr].data = idx->added[j].data;
+			all[nr].len = idx->added[j].len;
+		}
+		/* the same blob may have been added twice */
+		while (j < idx->added_nr &&
+		       hasheq(all[nr].hash, idx->added[j].oid.hash))
+			j++;
+		fanout[all[nr].hash[0]]++;
+		nr++;
+	}
+	if (nr > UINT32_MAX)
+		goto out;
+
+	if (safe_create_leading_directories(idx->filename) ||
+	    hold_lock_file_for_update(&lk, idx->filename, 0) < 0)
+		goto out;
+	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+
+	put_be32(buf, GREP_TRIGRAM_SIGNATURE);
+	buf[4] = GREP_TRIGRAM_VERSION;
+	buf[5] = GREP_TRIGRAM_HASH_VERSION;
+	buf[6] = TRIGRAM_NUM_HASHES;
+	buf[7] = 0;
+	put_be32(buf + 8, the_hash_algo->format_id);
+	put_be32(buf + 12, nr);
+	hashwrite(f, buf, sizeof(buf));
+
+	for (k = 0; k < 256; k++) {
+		if (k)
+			fanout[k] += fanout[k - 1];
+		put_be32(buf, fanout[k]);
+		hashwrite(f, buf, 4);
+	}
+	for (k = 0; k < nr; k++)
+		hashwrite(f, all[k].hash, rawsz);
+	for (k = 0; k < nr; k++) {
+		offset += all[k].len;
+		put_be64(buf, offset);
+		hashwrite(f, buf, 8);
+	}
+	for (k = 0; k < nr; k++)
+		hashwrite(f, all[k].data, all[k].len);
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+
+	/* the old file must not be mapped when it is replaced */
+	if (idx->map) {
+		munmap((void *)idx->map, idx->map_len);
+		idx->map = NULL;
+	}
+	commit_lock_file(&lk);
+out:
+	free(all);
+}
+
+void grep_trigram_index_close(struct grep_trigram_index *idx)
+{
+	size_t i;
+
+	if (!idx)
+		return;
+	if (idx->added_nr)
+		write_grep_trigrams(idx);
+	if (idx->map)
+		munmap((void *)idx->map, idx->map_len);
+	for (i = 0; i < idx->added_nr; i++)
+		free(idx->added[i].data);
+	free(idx->added);
+	pthread_mutex_destroy(&idx->mutex);
+	free(idx->filename);
+	free(idx);
+}
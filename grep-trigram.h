@@ -0,0 +1,70 @@
+#ifndef GREP_TRIGRAM_H
+#define GREP_TRIGRAM_H
+
+#include "grep.h"
+
+/*
+ * The trigram index of "git grep" remembers, for each blob it has
+ * searched, a Bloom filter of the (ASCII case-folded) three-byte
+ * sequences it contains. A pattern that needs a trigram the filter of a
+ * blob rules out cannot match anywhere in that blob, so the blob need
+ * not be read at all.
+ *
+ * The index lives in $GIT_OBJECT_DIRECTORY/info/grep-trigrams. It grows
+ * as "git grep" reads blobs that are not in it yet; see
+ * Documentation/technical/grep-trigram-format.txt for its layout.
+ */
+struct repository;
+struct grep_trigram_index;
+
+struct grep_trigram_filter {
+	const unsigned char *data;
+	size_t len;
+};
+
+/*
+ * Open the trigram index of the repository. An index that does not
+ * exist yet (or that cannot be used) is treated as empty.
+ */
+struct grep_trigram_index *grep_trigram_index_open(struct repository *r);
+
+/*
+ * Write the filters added since the index was opened, and free it.
+ * Failing to lock or write the file is not an error: the filters are
+ * only lost, and computed again next time.
+ */
+void grep_trigram_index_close(struct grep_trigram_index *idx);
+
+/*
+ * Look up the filter of the blob 'oid'. Returns 0 and fills 'filter'
+ * if the blob is in the index, and -1 if it is not.
+ */
+int grep_trigram_index_lookup(struct grep_trigram_index *idx,
+			      const struct object_id *oid,
+			      struct grep_trigram_filter *filter);
+
+/*
+ * Compute and remember the filter of the blob 'oid' whose contents are
+ * 'buf'. This can be called from several threads at once.
+ */
+void grep_trigram_index_add(struct grep_trigram_index *idx,
+			    const struct object_id *oid,
+			    const char *buf, unsigned long size);
+
+/*
+ * Returns 0 if a blob with the given filter is sure not to contain all
+ * of the 'nr' trigrams in 'trigrams', and 1 if it may.
+ */
+int grep_trigram_filter_maybe(const struct grep_trigram_filter *filter,
+			      const uint32_t *trigrams, size_t nr);
+
+/*
+ * Set p->trigrams to trigrams that every match of the pattern 'p'
+ * contains, as a 'type' pattern. The set is left empty when none can
+ * be found, e.g. because the pattern has no literal run of three
+ * characters, or uses constructs (alternation, case-insensitive regex
+ * matching, ...) we do not know how to plan for.
+ */
+void grep_trigram_plan(struct grep_pat *p, enum grep_pattern_type type);
+
+#endif
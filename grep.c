@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "grep.h"
+#include "grep-trigram.h"
 #include "object-store.h"
 #include "userdiff.h"
 #include "xdiff-interface.h"
@@ -669,6 +670,10 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 	 * case-folding search, we can internally turn it into a
 	 * simple string match using kws.  p->fixed tells us if we
 	 * want to use kws.
+	 *
+	 * A case-sensitive string match does not need kws, though:
+	 * the platform's memmem() is usually vectorized, and several
+	 * times faster than kws over a whole buffer.
 	 */
 	if (opt->fixed ||
 	    has_null(p->pattern, p->patternlen) ||
@@ -676,6 +681,10 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 		p->fixed = !p->ignore_case || ascii_only;
 
 	if (p->fixed) {
+#ifndef NO_MEMMEM
+		if (!p->ignore_case)
+			return;
+#endif
 		p->kws = kwsalloc(p->ignore_case ? tolower_trans_tbl : NULL);
 		kwsincr(p->kws, p->pattern, p->patternlen);
 		kwsprep(p->kws);
@@ -975,6 +984,23 @@ static struct grep_expr *grep_splice_or(struct grep_expr *x, struct grep_expr *y
 	return z;
 }
 
+static void compile_trigrams(struct grep_pat *p, struct grep_opt *opt)
+{
+	enum grep_pattern_type type;
+
+	if (p->fixed)
+		type = GREP_PATTERN_TYPE_FIXED;
+	else if (opt->fixed)
+		return; /* case-folded non-ASCII, see compile_fixed_regexp() */
+	else if (opt->pcre1 || opt->pcre2)
+		type = GREP_PATTERN_TYPE_PCRE;
+	else if (opt->extended_regexp_option)
+		type = GREP_PATTERN_TYPE_ERE;
+	else
+		type = GREP_PATTERN_TYPE_BRE;
+	grep_trigram_plan(p, type);
+}
+
 static void compile_grep_patterns_real(struct grep_opt *opt)
 {
 	struct grep_pat *p;
@@ -986,6 +1012,8 @@ static void compile_grep_patterns_real(struct grep_opt *opt)
 		case GREP_PATTERN_HEAD:
 		case GREP_PATTERN_BODY:
 			compile_regexp(p, opt);
+			if (opt->trigram_index)
+				compile_trigrams(p, opt);
 			break;
 		default:
 			opt->extended = 1;
@@ -1053,14 +1081,16 @@ void free_grep_patterns(struct grep_opt *opt)
 		case GREP_PATTERN: /* atom */
 		case GREP_PATTERN_HEAD:
 		case GREP_PATTERN_BODY:
-			if (p->kws)
-				kwsfree(p->kws);
-			else if (p->pcre1_regexp)
+			if (p->fixed) {
+				if (p->kws)
+					kwsfree(p->kws);
+			} else if (p->pcre1_regexp)
 				free_pcre1_regexp(p);
 			else if (p->pcre2_pattern)
 				free_pcre2_pattern(p);
 			else
 				regfree(&p->regexp);
+			free(p->trigrams);
 			free(p->pattern);
 			break;
 		default:
@@ -1119,7 +1149,21 @@ static int fixmatch(struct grep_pat *p, char *line, char *eol,
 		    regmatch_t *match)
 {
 	struct kwsmatch kwsm;
-	size_t offset = kwsexec(p->kws, line, eol - line, &kwsm);
+	size_t offset;
+
+	if (!p->kws) {
+		const char *hit = memmem(line, eol - line,
+					 p->pattern, p->patternlen);
+		if (!hit) {
+			match->rm_so = match->rm_eo = -1;
+			return REG_NOMATCH;
+		}
+		match->rm_so = hit - line;
+		match->rm_eo = match->rm_so + p->patternlen;
+		return 0;
+	}
+
+	offset = kwsexec(p->kws, line, eol - line, &kwsm);
 	if (offset == -1) {
 		match->rm_so = match->rm_eo = -1;
 		return REG_NOMATCH;
@@ -1534,7 +1578,9 @@ static inline void grep_attr_unlock(void)
 }
 
 /*
- * Same as git_attr_mutex, but protecting the thread-unsafe object db access.
+ * Same as git_attr_mutex, but protecting fill_textconv() and the submodule
+ * functions. Reading objects is protected by the object read lock instead,
+ * so that threads can inflate objects in parallel.
  */
 pthread_mutex_t grep_read_mutex;
 
@@ -2023,7 +2069,7 @@ static int chk_hit_marker(struct grep_expr *x)
 	}
 }
 
-int grep_source(struct grep_opt *opt, struct grep_source *gs)
+static int grep_source_real(struct grep_opt *opt, struct grep_source *gs)
 {
 	/*
 	 * we do not have to do the two-pass grep when we do not check
@@ -2044,6 +2090,67 @@ int grep_source(struct grep_opt *opt, struct grep_source *gs)
 	return grep_source_1(opt, gs, 0);
 }
 
+static const struct object_id *grep_source_blob_oid(struct grep_source *gs)
+{
+	switch (gs->type) {
+	case GREP_SOURCE_OID:
+		return gs->identifier;
+	case GREP_SOURCE_FILE:
+		return gs->blob_oid;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Can the trigram filter of a blob tell us that the patterns cannot
+ * match in it? Only when they are all alternatives, each of which
+ * needs some trigrams, and when not matching means not showing the
+ * blob at all.
+ */
+static int trigrams_rule_out(struct grep_opt *opt,
+			     const struct grep_trigram_filter *filter)
+{
+	struct grep_pat *p;
+
+	if (opt->invert || opt->unmatch_name_only || opt->extended ||
+	    opt->all_match || !opt->pattern_list)
+		return 0;
+	for (p = opt->pattern_list; p; p = p->next)
+		if (!p->trigrams_nr ||
+		    grep_trigram_filter_maybe(filter, p->trigrams,
+					      p->trigrams_nr))
+			return 0;
+	return 1;
+}
+
+int grep_source(struct grep_opt *opt, struct grep_source *gs)
+{
+	const struct object_id *oid = NULL;
+	int hit;
+
+	if (opt->trigram_index && !opt->allow_textconv)
+		oid = grep_source_blob_oid(gs);
+	if (oid) {
+		struct grep_trigram_filter filter;
+
+		if (!grep_trigram_index_lookup(opt->trigram_index, oid,
+					       &filter)) {
+			if (trigrams_rule_out(opt, &filter))
+				return 0;
+			oid = NULL;
+		}
+	}
+
+	hit = grep_source_real(opt, gs);
+
+	/* worktree files may have changed since we looked at them */
+	if (oid && gs->type == GREP_SOURCE_OID && gs->buf)
+		grep_trigram_index_add(opt->trigram_index, oid,
+				       gs->buf, gs->size);
+	return hit;
+}
+
 int grep_buffer(struct grep_opt *opt, char *buf, unsigned long size)
 {
 	struct grep_source gs;
@@ -2069,6 +2176,7 @@ void grep_source_init(struct grep_source *gs, enum grep_source_type type,
 	gs->buf = NULL;
 	gs->size = 0;
 	gs->driver = NULL;
+	gs->blob_oid = NULL;
 
 	switch (type) {
 	case GREP_SOURCE_FILE:
@@ -2088,6 +2196,7 @@ void grep_source_clear(struct grep_source *gs)
 	FREE_AND_NULL(gs->name);
 	FREE_AND_NULL(gs->path);
 	FREE_AND_NULL(gs->identifier);
+	FREE_AND_NULL(gs->blob_oid);
 	grep_source_clear_data(gs);
 }
 
@@ -2109,9 +2218,7 @@ static int grep_source_load_oid(struct grep_source *gs)
 {
 	enum object_type type;
 
-	grep_read_lock();
 	gs->buf = read_object_file(gs->identifier, &type, &gs->size);
-	grep_read_unlock();
 
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
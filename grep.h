@@ -98,6 +98,9 @@ struct grep_pat {
 	pcre2_jit_stack *pcre2_jit_stack;
 	uint32_t pcre2_jit_on;
 	kwset_t kws;
+	/* see grep_trigram_plan() */
+	uint32_t *trigrams;
+	size_t trigrams_nr;
 	unsigned fixed:1;
 	unsigned ignore_case:1;
 	unsigned word_regexp:1;
@@ -180,6 +183,7 @@ struct grep_opt {
 	int show_hunk_mark;
 	int file_break;
 	int heading;
+	struct grep_trigram_index *trigram_index;
 	void *priv;
 
 	void (*output)(struct grep_opt *opt, const void *data, size_t size);
@@ -213,6 +217,12 @@ struct grep_source {
 
 	char *path; /* for attribute lookups */
 	struct userdiff_driver *driver;
+
+	/*
+	 * The blob a GREP_SOURCE_FILE is known to have the contents of,
+	 * for the trigram index.
+	 */
+	struct object_id *blob_oid;
 };
 
 void grep_source_init(struct grep_source *gs, enum grep_source_type type,
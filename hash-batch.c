@@ -0,0 +1,87 @@
+#include "cache.h"
+#include "thread-utils.h"
+
+/* Below this many bytes in total, starting threads costs more than it saves. */
+#define HASH_BATCH_THREAD_BYTES (256 * 1024)
+
+struct hash_batch_range {
+	const struct git_hash_algo *algo;
+	struct git_hash_batch_item *items;
+	size_t nr;
+	pthread_t thread;
+};
+
+static void hash_range(struct hash_batch_range *range)
+{
+	const struct git_hash_algo *algo = range->algo;
+	git_hash_ctx ctx;
+	size_t i;
+
+	for (i = 0; i < range->nr; i++) {
+		struct git_hash_batch_item *item = &range->items[i];
+
+		algo->init_fn(&ctx);
+		if (item->hdrlen)
+			algo->update_fn(&ctx, item->hdr, item->hdrlen);
+		algo->update_fn(&ctx, item->buf, item->len);
+		algo->final_fn(item->hash, &ctx);
+	}
+}
+
+static void *hash_batch_thread(void *data)
+{
+	hash_range(data);
+	return NULL;
+}
+
+void git_hash_batch(const struct git_hash_algo *algo,
+		    struct git_hash_batch_item *items, size_t nr,
+		    int nr_threads)
+{
+	struct hash_batch_range *ranges;
+	size_t total = 0, share, start, i;
+	int t;
+
+	for (i = 0; i < nr; i++)
+		total += items[i].len;
+	if (!HAVE_THREADS || nr_threads <= 1 || nr < 2 ||
+	    total < HASH_BATCH_THREAD_BYTES) {
+		struct hash_batch_range range = { algo, items, nr };
+
+		hash_range(&range);
+		return;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+
+	/*
+	 * Give each thread a run of items with about the same number
+	 * of bytes; the calling thread takes the last one.
+	 */
+	CALLOC_ARRAY(ranges, nr_threads);
+	share = total / nr_threads;
+	for (start = 0, t = 0; t < nr_threads; t++) {
+		size_t end = start, bytes = 0;
+
+		if (t == nr_threads - 1)
+			end = nr;
+		else
+			while (end < nr && bytes < share)
+				bytes += items[end++].len;
+		ranges[t].algo = algo;
+		ranges[t].items = items + start;
+		ranges[t].nr = end - start;
+		start = end;
+	}
+
+	for (t = 0; t < nr_threads - 1; t++) {
+		int ret = pthread_create(&ranges[t].thread, NULL,
+					 hash_batch_thread, &ranges[t]);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	hash_range(&ranges[nr_threads - 1]);
+	for (t = 0; t < nr_threads - 1; t++)
+		pthread_join(ranges[t].thread, NULL);
+	free(ranges);
+}
@@ -124,6 +124,28 @@ struct git_hash_algo {
 };
 extern const struct git_hash_algo hash_algos[GIT_HASH_NALGOS];
 
+/*
+ * One buffer to hash with git_hash_batch(): the "len" bytes at "buf",
+ * preceded by the "hdrlen" bytes at "hdr" (e.g. the header of an
+ * object), with the result stored at "hash".
+ */
+struct git_hash_batch_item {
+	const void *hdr;
+	size_t hdrlen;
+	const void *buf;
+	size_t len;
+	unsigned char *hash;
+};
+
+/*
+ * Hash many independent buffers, splitting them between up to
+ * "nr_threads" threads when there are enough bytes to make it
+ * worthwhile.
+ */
+void git_hash_batch(const struct git_hash_algo *algo,
+		    struct git_hash_batch_item *items, size_t nr,
+		    int nr_threads);
+
 /*
  * Return a GIT_HASH_* constant based on the name.  Returns GIT_HASH_UNKNOWN if
  * the name doesn't match a known algorithm.
@@ -13,11 +13,13 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "protocol.h"
+#include "serve.h"
 
 static const char content_type[] = "Content-Type";
 static const char content_length[] = "Content-Length";
 static const char last_modified[] = "Last-Modified";
 static int getanyfile = 1;
+static int uploadpack_in_process;
 static unsigned long max_request_buffer = 10 * 1024 * 1024;
 
 static struct string_list *query_params;
@@ -237,6 +239,7 @@ static void http_config(void)
 	struct strbuf var = STRBUF_INIT;
 
 	git_config_get_bool("http.getanyfile", &getanyfile);
+	git_config_get_bool("http.uploadpackinprocess", &uploadpack_in_process);
 	git_config_get_ulong("http.maxrequestbuffer", &max_request_buffer);
 
 	for (i = 0; i < ARRAY_SIZE(rpc_service); i++) {
@@ -505,6 +508,51 @@ static void run_service(const char **argv, int buffer_input)
 		exit(1);
 }
 
+static NORETURN void die_in_process(const char *err, va_list params)
+{
+	/* the headers are out; fail the way "git upload-pack" would */
+	vreportf("fatal: ", err, params);
+	exit(128);
+}
+
+/*
+ * With http.uploadpackInProcess, answer protocol v2 upload-pack
+ * requests ourselves, as "git upload-pack --stateless-rpc" would,
+ * instead of starting it for each of the requests a fetch makes.
+ * Return -1 if the request has to go to a "git upload-pack" process.
+ */
+static int serve_upload_pack_v2(int advertise_refs)
+{
+	struct serve_options opts = SERVE_OPTIONS_INIT;
+	const char *encoding = getenv("HTTP_CONTENT_ENCODING");
+	unsigned char *request = NULL;
+	ssize_t len = 0;
+
+	if (!uploadpack_in_process ||
+	    determine_protocol_version_server() != protocol_v2)
+		return -1;
+	if (!advertise_refs) {
+		/* leave inflating compressed requests to run_service() */
+		if (encoding && *encoding)
+			return -1;
+		len = read_request(0, &request, get_content_length());
+		if (len < 0)
+			die_errno("error reading request body");
+	}
+
+	set_die_routine(die_in_process);
+	packet_trace_identity("upload-pack");
+	read_replace_refs = 0;
+
+	opts.advertise_capabilities = advertise_refs;
+	opts.stateless_rpc = 1;
+	opts.request = (char *)request;
+	opts.request_len = len;
+	serve(&opts);
+	free(request);
+	return 0;
+}
+
 static int show_text_ref(const char *name, const struct object_id *oid,
 			 int flag, void *cb_data)
 {
@@ -550,7 +598,8 @@ static void get_info_refs(struct strbuf *hdr, char *arg)
 		}
 
 		argv[0] = svc->name;
-		run_service(argv, 0);
+		if (strcmp(svc->name, "upload-pack") || serve_upload_pack_v2(1))
+			run_service(argv, 0);
 
 	} else {
 		select_getanyfile(hdr);
@@ -652,7 +701,8 @@ static void service_rpc(struct strbuf *hdr, char *service_name)
 	end_headers(hdr);
 
 	argv[0] = svc->name;
-	run_service(argv, svc->buffer_input);
+	if (strcmp(svc->name, "upload-pack") || serve_upload_pack_v2(0))
+		run_service(argv, svc->buffer_input);
 	strbuf_release(&buf);
 }
 
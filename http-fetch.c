@@ -3,9 +3,87 @@
 #include "exec-cmd.h"
 #include "http.h"
 #include "walker.h"
+#include "run-command.h"
+#include "argv-array.h"
 
 static const char http_fetch_usage[] = "git http-fetch "
-"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url";
+"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url\n"
+"   or: git http-fetch [--index-pack-arg=<arg>...] --packfile=<hash> url\n"
+"   or: git http-fetch --output <file> url";
+
+/*
+ * Download the pack named "hash" from "url", which is not relative to a
+ * repository, and index it with "index-pack --stdin <index_pack_args>".
+ * What index-pack prints, "pack\t<hash>" or "keep\t<hash>", goes to
+ * our standard output.
+ *
+ * An interrupted download is kept in "<tmpfile>.temp", and the next
+ * attempt resumes it with a range request. With fetch.resumeDir, that
+ * file lives outside of the repository, so that even a clone, which
+ * removes the repository it failed to make, can be resumed.
+ */
+static int fetch_single_packfile(const struct object_id *hash,
+				 const char *url,
+				 const struct argv_array *index_pack_args)
+{
+	struct strbuf tmpfile = STRBUF_INIT;
+	struct child_process ip = CHILD_PROCESS_INIT;
+	unsigned char trailer[GIT_MAX_RAWSZ];
+	const char *resume_dir;
+	int fd = -1, ret = -1;
+
+	if (!git_config_get_pathname("fetch.resumedir", &resume_dir)) {
+		strbuf_addf(&tmpfile, "%s/", resume_dir);
+		if (safe_create_leading_directories(tmpfile.buf)) {
+			error(_("unable to create directory %s"), resume_dir);
+			goto cleanup;
+		}
+		strbuf_addf(&tmpfile, "pack-%s.pack", oid_to_hex(hash));
+	} else {
+		strbuf_addf(&tmpfile, "%s/pack/tmp_uri_pack_%s",
+			    get_object_directory(), oid_to_hex(hash));
+	}
+	if (http_get_file(url, tmpfile.buf, NULL) != HTTP_OK) {
+		error(_("unable to download %s"), url);
+		goto cleanup;
+	}
+
+	/* The name of a pack is its trailing checksum. */
+	fd = open(tmpfile.buf, O_RDONLY);
+	if (fd < 0) {
+		error_errno(_("unable to open %s"), tmpfile.buf);
+		goto cleanup;
+	}
+	if (lseek(fd, -(off_t)the_hash_algo->rawsz, SEEK_END) < 0 ||
+	    read_in_full(fd, trailer, the_hash_algo->rawsz) !=
+	    the_hash_algo->rawsz ||
+	    !hasheq(trailer, hash->hash) ||
+	    lseek(fd, 0, SEEK_SET) < 0) {
+		error(_("%s is not the pack %s"), url, oid_to_hex(hash));
+		close(fd);
+		goto cleanup;
+	}
+
+	ip.git_cmd = 1;
+	ip.in = fd;
+	argv_array_push(&ip.args, "index-pack");
+	argv_array_push(&ip.args, "--stdin");
+	argv_array_pushv(&ip.args, index_pack_args->argv);
+	if (run_command(&ip))
+		error(_("index-pack failed on %s"), url);
+	else
+		ret = 0;
+
+cleanup:
+	/*
+	 * Only the ".temp" file of a download that did not complete is
+	 * kept; a complete one that turns out to be broken (e.g. as the
+	 * server ignored our range request) starts over next time.
+	 */
+	unlink(tmpfile.buf);
+	strbuf_release(&tmpfile);
+	return ret;
+}
 
 int cmd_main(int argc, const char **argv)
 {
@@ -19,9 +97,23 @@ int cmd_main(int argc, const char **argv)
 	int rc = 0;
 	int get_verbosely = 0;
 	int get_recover = 0;
+	int packfile = 0;
+	struct object_id packfile_hash;
+	struct argv_array index_pack_args = ARGV_ARRAY_INIT;
+	const char *output = NULL;
 
 	while (arg < argc && argv[arg][0] == '-') {
-		if (argv[arg][1] == 't') {
+		const char *p;
+
+		if (skip_prefix(argv[arg], "--packfile=", &p)) {
+			if (get_oid_hex(p, &packfile_hash))
+				die(_("argument to --packfile must be a valid hash (got '%s')"), p);
+			packfile = 1;
+		} else if (!strcmp(argv[arg], "--output") && arg + 1 < argc) {
+			output = argv[++arg];
+		} else if (skip_prefix(argv[arg], "--index-pack-arg=", &p)) {
+			argv_array_push(&index_pack_args, p);
+		} else if (argv[arg][1] == 't') {
 		} else if (argv[arg][1] == 'c') {
 		} else if (argv[arg][1] == 'a') {
 		} else if (argv[arg][1] == 'v') {
@@ -38,6 +130,30 @@ int cmd_main(int argc, const char **argv)
 		}
 		arg++;
 	}
+	if (output) {
+		/* Used for bundles, which may be fetched before a repository exists. */
+		if (argc != arg + 1 || packfile || commits_on_stdin)
+			usage(http_fetch_usage);
+		setup_git_directory_gently(NULL);
+		git_config(git_default_config, NULL);
+		http_init(NULL, argv[arg], 0);
+		if (http_get_file(argv[arg], output, NULL) != HTTP_OK)
+			rc = error(_("unable to download %s"), argv[arg]);
+		http_cleanup();
+		return rc ? 1 : 0;
+	}
+	if (packfile) {
+		if (argc != arg + 1 || commits_on_stdin)
+			usage(http_fetch_usage);
+		setup_git_directory();
+		git_config(git_default_config, NULL);
+		http_init(NULL, argv[arg], 0);
+		rc = fetch_single_packfile(&packfile_hash, argv[arg],
+					   &index_pack_args);
+		http_cleanup();
+		argv_array_clear(&index_pack_args);
+		return rc ? 1 : 0;
+	}
 	if (argc != arg + 2 - commits_on_stdin)
 		usage(http_fetch_usage);
 	if (commits_on_stdin) {
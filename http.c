@@ -845,6 +845,14 @@ static CURL *get_curl_handle(void)
     }
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/*
+	 * Wait for a connection that can be multiplexed rather than
+	 * opening another one, see CURLMOPT_PIPELINING in http_init().
+	 */
+	curl_easy_setopt(result, CURLOPT_PIPEWAIT, 1);
+#endif
+
 #if LIBCURL_VERSION_NUM >= 0x070907
 	curl_easy_setopt(result, CURLOPT_NETRC, CURL_NETRC_OPTIONAL);
 #endif
@@ -1127,6 +1135,13 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 	curlm = curl_multi_init();
 	if (!curlm)
 		die("curl_multi_init failed");
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/*
+	 * Let parallel requests to the same server share one HTTP/2
+	 * connection, instead of each paying for its own TLS handshake.
+	 */
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 #endif
 
 	if (getenv("GIT_SSL_NO_VERIFY"))
@@ -2028,13 +2043,7 @@ int http_get_strbuf(const char *url,
 	return http_request_reauth(url, result, HTTP_REQUEST_STRBUF, options);
 }
 
-/*
- * Downloads a URL and stores the result in the given file.
- *
- * If a previous interrupted download is detected (i.e. a previous temporary
- * file is still around) the download is resumed.
- */
-static int http_get_file(const char *url, const char *filename,
+int http_get_file(const char *url, const char *filename,
 			 struct http_get_options *options)
 {
 	int ret;
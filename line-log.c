@@ -15,6 +15,11 @@
 #include "userdiff.h"
 #include "line-log.h"
 #include "argv-array.h"
+#include "bloom.h"
+#include "config.h"
+
+/* log.fastLineRanges */
+static int fast_line_ranges;
 
 static void range_set_grow(struct range_set *rs, size_t extra)
 {
@@ -309,6 +314,7 @@ static void line_log_data_insert(struct line_log_data **list,
 
 struct collect_diff_cbdata {
 	struct diff_ranges *diff;
+	long offset;
 };
 
 static int collect_diff_cb(long start_a, long count_a,
@@ -317,6 +323,8 @@ static int collect_diff_cb(long start_a, long count_a,
 {
 	struct collect_diff_cbdata *d = data;
 
+	start_a += d->offset;
+	start_b += d->offset;
 	if (count_a >= 0)
 		range_set_append(&d->diff->parent, start_a, start_a + count_a);
 	if (count_b >= 0)
@@ -325,7 +333,12 @@ static int collect_diff_cb(long start_a, long count_a,
 	return 0;
 }
 
-static int collect_diff(mmfile_t *parent, mmfile_t *target, struct diff_ranges *out)
+/*
+ * Diff "parent" and "target", which are known to start with "offset"
+ * identical lines when the callers pass them without these.
+ */
+static int collect_diff(mmfile_t *parent, mmfile_t *target,
+			long offset, struct diff_ranges *out)
 {
 	struct collect_diff_cbdata cbdata = {NULL};
 	xpparam_t xpp;
@@ -337,6 +350,7 @@ static int collect_diff(mmfile_t *parent, mmfile_t *target, struct diff_ranges *
 	xecfg.ctxlen = xecfg.interhunkctxlen = 0;
 
 	cbdata.diff = out;
+	cbdata.offset = offset;
 	xecfg.hunk_func = collect_diff_cb;
 	memset(&ecb, 0, sizeof(ecb));
 	ecb.priv = &cbdata;
@@ -742,6 +756,10 @@ void line_log_init(struct rev_info *rev, const char *prefix, struct string_list
 	struct commit *commit = NULL;
 	struct line_log_data *range;
 
+	if (repo_config_get_bool(rev->repo, "log.fastlineranges",
+				 &fast_line_ranges))
+		fast_line_ranges = 0;
+
 	commit = check_single_commit(rev);
 	range = parse_lines(rev->diffopt.repo, commit, prefix, args);
 	add_line_range(rev, commit, range);
@@ -819,6 +837,19 @@ static void queue_diffs(struct line_log_data *range,
 {
 	assert(commit);
 
+	if (parent && commit->parents && commit->parents->item == parent) {
+		struct line_log_data *r;
+
+		for (r = range; r; r = r->next)
+			if (bloom_filter_maybe_changed(opt->repo, commit, r->path))
+				break;
+		if (!r) {
+			/* none of our paths can differ from the first parent */
+			DIFF_QUEUE_CLEAR(queue);
+			return;
+		}
+	}
+
 	DIFF_QUEUE_CLEAR(&diff_queued_diff);
 	diff_tree_oid(parent ? get_commit_tree_oid(parent) : NULL,
 		      get_commit_tree_oid(commit), "", opt);
@@ -984,6 +1015,87 @@ static void dump_diff_hacky(struct rev_info *rev, struct line_log_data *range)
 	}
 }
 
+static long count_lines(const char *buf, unsigned long size)
+{
+	long nr = 0;
+	const char *end = buf + size, *eol;
+
+	while (buf < end) {
+		nr++;
+		eol = memchr(buf, '\n', end - buf);
+		if (!eol)
+			break;
+		buf = eol + 1;
+	}
+	return nr;
+}
+
+/*
+ * Find the number of lines "parent" and "target" have in common at
+ * their start ("head", ending at byte "head_len") and, after that,
+ * at their end ("tail").
+ */
+static void common_lines(mmfile_t *parent, mmfile_t *target,
+			 long *head, unsigned long *head_len, long *tail)
+{
+	unsigned long smaller = parent->size < target->size ?
+				parent->size : target->size;
+	unsigned long i, n = 0;
+	const char *pe = parent->ptr + parent->size;
+	const char *te = target->ptr + target->size;
+
+	*head = 0;
+	*head_len = 0;
+	for (i = 0; i < smaller && parent->ptr[i] == target->ptr[i]; i++)
+		if (parent->ptr[i] == '\n') {
+			(*head)++;
+			*head_len = i + 1;
+		}
+
+	smaller -= *head_len;
+	while (n < smaller && pe[-n - 1] == te[-n - 1])
+		n++;
+	*tail = 0;
+	for (i = 1; i < n; i++)
+		if (pe[-i - 1] == '\n')
+			(*tail)++;
+	/* the first of these lines has to start a line on both sides */
+	if (n && (n == parent->size - *head_len || pe[-n - 1] == '\n') &&
+	    (n == target->size - *head_len || te[-n - 1] == '\n'))
+		(*tail)++;
+}
+
+/*
+ * With log.fastLineRanges, map the ranges across a diff that cannot
+ * touch them without making the diff: those within the lines both
+ * sides start with stay put, and those within the lines they end
+ * with move by the difference in length. Otherwise, return -1 and
+ * leave the common start out of the diff in "head" lines and bytes.
+ */
+static int map_ranges_outside_diff(struct range_set *out, struct range_set *rs,
+				   mmfile_t *parent, mmfile_t *target,
+				   long *head, unsigned long *head_len)
+{
+	long tail, parent_nr, target_nr;
+	unsigned int i;
+
+	common_lines(parent, target, head, head_len, &tail);
+	parent_nr = count_lines(parent->ptr, parent->size);
+	target_nr = count_lines(target->ptr, target->size);
+
+	for (i = 0; i < rs->nr; i++)
+		if (rs->ranges[i].end > *head &&
+		    rs->ranges[i].start < target_nr - tail)
+			return -1;
+	for (i = 0; i < rs->nr; i++) {
+		long shift = rs->ranges[i].end > *head ? parent_nr - target_nr : 0;
+
+		range_set_append(out, rs->ranges[i].start + shift,
+				 rs->ranges[i].end + shift);
+	}
+	return 0;
+}
+
 /*
  * Unlike most other functions, this destructively operates on
  * 'range'.
@@ -997,6 +1109,8 @@ static int process_diff_filepair(struct rev_info *rev,
 	struct range_set tmp;
 	struct diff_ranges diff;
 	mmfile_t file_parent, file_target;
+	long head = 0;
+	unsigned long head_len = 0;
 
 	assert(pair->two->path);
 	while (rg) {
@@ -1011,6 +1125,13 @@ static int process_diff_filepair(struct rev_info *rev,
 	if (rg->ranges.nr == 0)
 		return 0;
 
+	if (pair->one->oid_valid && oideq(&pair->one->oid, &pair->two->oid)) {
+		/* a pure rename or mode change moves no lines */
+		free(rg->path);
+		rg->path = xstrdup(pair->one->path);
+		return 0;
+	}
+
 	assert(pair->two->oid_valid);
 	diff_populate_filespec(rev->diffopt.repo, pair->two, 0);
 	file_target.ptr = pair->two->data;
@@ -1025,15 +1146,28 @@ static int process_diff_filepair(struct rev_info *rev,
 		file_parent.size = 0;
 	}
 
-	diff_ranges_init(&diff);
-	if (collect_diff(&file_parent, &file_target, &diff))
-		die("unable to generate diff for %s", pair->one->path);
-
 	/* NEEDSWORK should apply some heuristics to prevent mismatches */
 	free(rg->path);
 	rg->path = xstrdup(pair->one->path);
 
 	range_set_init(&tmp, 0);
+	if (fast_line_ranges) {
+		if (!map_ranges_outside_diff(&tmp, &rg->ranges, &file_parent,
+					     &file_target, &head, &head_len)) {
+			range_set_release(&rg->ranges);
+			range_set_move(&rg->ranges, &tmp);
+			return 0;
+		}
+		file_parent.ptr += head_len;
+		file_parent.size -= head_len;
+		file_target.ptr += head_len;
+		file_target.size -= head_len;
+	}
+
+	diff_ranges_init(&diff);
+	if (collect_diff(&file_parent, &file_target, head, &diff))
+		die("unable to generate diff for %s", pair->one->path);
+
 	range_set_map_across_diff(&tmp, &rg->ranges, &diff, diff_out);
 	range_set_release(&rg->ranges);
 	range_set_move(&rg->ranges, &tmp);
@@ -1045,9 +1179,7 @@ static int process_diff_filepair(struct rev_info *rev,
 
 static struct diff_filepair *diff_filepair_dup(struct diff_filepair *pair)
 {
-	struct diff_filepair *new_filepair = xmalloc(sizeof(struct diff_filepair));
-	new_filepair->one = pair->one;
-	new_filepair->two = pair->two;
+	struct diff_filepair *new_filepair = diff_queue(NULL, pair->one, pair->two);
 	new_filepair->one->count++;
 	new_filepair->two->count++;
 	return new_filepair;
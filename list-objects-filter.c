@@ -314,6 +314,14 @@ struct frame {
 	 */
 	int defval;
 
+	/*
+	 * 1 if defval holds for everything in this directory, with no
+	 * need to match the paths inside it. With cone mode patterns,
+	 * this is known for a directory that is recursively included
+	 * and for one that is out of the cone.
+	 */
+	unsigned decided : 1;
+
 	/*
 	 * 1 if the directory (recursively) contains any provisionally
 	 * omitted objects.
@@ -342,7 +350,7 @@ static enum list_objects_filter_result filter_sparse(
 	void *filter_data_)
 {
 	struct filter_sparse_data *filter_data = filter_data_;
-	int val, dtype;
+	int val, dtype, decided;
 	struct frame *frame;
 
 	switch (filter_situation) {
@@ -351,18 +359,32 @@ static enum list_objects_filter_result filter_sparse(
 
 	case LOFS_BEGIN_TREE:
 		assert(obj->type == OBJ_TREE);
-		dtype = DT_DIR;
-		val = is_excluded_from_list(pathname, strlen(pathname),
-					    filename, &dtype, &filter_data->el,
-					    r->index);
-		if (val < 0)
-			val = filter_data->array_frame[filter_data->nr - 1].defval;
+		frame = &filter_data->array_frame[filter_data->nr - 1];
+		if (frame->decided) {
+			val = frame->defval;
+			decided = 1;
+		} else {
+			dtype = DT_DIR;
+			val = is_excluded_from_list(pathname, strlen(pathname),
+						    filename, &dtype,
+						    &filter_data->el, r->index);
+			if (val < 0)
+				val = frame->defval;
+			/*
+			 * In cone mode, nothing inside a directory that does
+			 * not match can match, since all leading directories
+			 * of the cone do.
+			 */
+			decided = filter_data->el.use_cone_patterns &&
+				  (val == EXC_MATCHED_RECURSIVE || !val);
+		}
 
 		ALLOC_GROW(filter_data->array_frame, filter_data->nr + 1,
 			   filter_data->alloc);
-		filter_data->array_frame[filter_data->nr].defval = val;
-		filter_data->array_frame[filter_data->nr].child_prov_omit = 0;
-		filter_data->nr++;
+		frame = &filter_data->array_frame[filter_data->nr++];
+		frame->defval = val;
+		frame->decided = decided;
+		frame->child_prov_omit = 0;
 
 		/*
 		 * A directory with this tree OID may appear in multiple
@@ -413,12 +435,16 @@ static enum list_objects_filter_result filter_sparse(
 
 		frame = &filter_data->array_frame[filter_data->nr - 1];
 
-		dtype = DT_REG;
-		val = is_excluded_from_list(pathname, strlen(pathname),
-					    filename, &dtype, &filter_data->el,
-					    r->index);
-		if (val < 0)
+		if (frame->decided) {
 			val = frame->defval;
+		} else {
+			dtype = DT_REG;
+			val = is_excluded_from_list(pathname, strlen(pathname),
+						    filename, &dtype,
+						    &filter_data->el, r->index);
+			if (val < 0)
+				val = frame->defval;
+		}
 		if (val > 0) {
 			if (filter_data->omits)
 				oidset_remove(filter_data->omits, &obj->oid);
@@ -452,6 +478,7 @@ static enum list_objects_filter_result filter_sparse(
 static void filter_sparse_free(void *filter_data)
 {
 	struct filter_sparse_data *d = filter_data;
+	clear_exclude_list(&d->el);
 	free(d->array_frame);
 	free(d);
 }
@@ -464,12 +491,30 @@ static void *filter_sparse_oid__init(
 {
 	struct filter_sparse_data *d = xcalloc(1, sizeof(*d));
 	d->omits = omitted;
+
+	/*
+	 * Patterns written for cone mode are matched with hash lookups of
+	 * the leading directories of a path, rather than one by one. Any
+	 * other patterns quietly fall back to the full matching.
+	 */
+	d->el.use_cone_patterns = 1;
+	d->el.quiet_cone_fallback = 1;
 	if (add_excludes_from_blob_to_list(filter_options->sparse_oid_value,
 					   NULL, 0, &d->el) < 0)
 		die("could not load filter specification");
 
+	/*
+	 * Cone mode matches the root files by itself; that only agrees
+	 * with the patterns when they start by including them.
+	 */
+	if (d->el.use_cone_patterns &&
+	    (!d->el.nr || strcmp(d->el.excludes[0]->pattern, "/*") ||
+	     d->el.excludes[0]->flags & EXC_FLAG_NEGATIVE))
+		d->el.use_cone_patterns = 0;
+
 	ALLOC_GROW(d->array_frame, d->nr + 1, d->alloc);
 	d->array_frame[d->nr].defval = 0; /* default to include */
+	d->array_frame[d->nr].decided = 0;
 	d->array_frame[d->nr].child_prov_omit = 0;
 	d->nr++;
 
@@ -4,6 +4,7 @@
 #include "object-store.h"
 #include "repository.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "tag.h"
 #include "graph.h"
 #include "log-tree.h"
@@ -17,6 +18,8 @@
 #include "help.h"
 #include "interdiff.h"
 #include "range-diff.h"
+#include "thread-utils.h"
+#include "xdiff-interface.h"
 
 static struct decoration name_decoration = { "object names" };
 static int decoration_loaded;
@@ -84,6 +87,7 @@ static int add_ref_decoration(const char *refname, const struct object_id *oid,
 			      int flags, void *cb_data)
 {
 	struct object *obj;
+	struct commit *commit;
 	enum decoration_type type = DECORATION_NONE;
 	struct decoration_filter *filter = (struct decoration_filter *)cb_data;
 
@@ -107,7 +111,15 @@ static int add_ref_decoration(const char *refname, const struct object_id *oid,
 		return 0;
 	}
 
-	obj = parse_object(the_repository, oid);
+	/*
+	 * Most refs point at commits; when one is in the commit-graph,
+	 * there is no need to read it from the object store.
+	 */
+	if (repo_has_object_file(the_repository, oid) &&
+	    (commit = lookup_commit_in_graph(the_repository, oid)))
+		obj = &commit->object;
+	else
+		obj = parse_object(the_repository, oid);
 	if (!obj)
 		return 0;
 
@@ -923,7 +935,9 @@ int log_tree_commit(struct rev_info *opt, struct commit *commit)
 
 	if (opt->track_linear && !opt->linear && !opt->reverse_output_stage)
 		fprintf(opt->diffopt.file, "\n%s\n", opt->break_bar);
+	diff_pool_begin();
 	shown = log_tree_diff(opt, commit, &log);
+	diff_pool_end();
 	if (!shown && opt->loginfo && opt->always_show_header) {
 		log.parent = NULL;
 		show_log(opt);
@@ -937,3 +951,202 @@ int log_tree_commit(struct rev_info *opt, struct commit *commit)
 		fclose(opt->diffopt.file);
 	return shown;
 }
+
+/*
+ * The patches of the commits that get_revision() returns are prepared
+ * on other threads from a ring of jobs. The main thread adds jobs at
+ * prepare_end, the threads pick them up at prepare_todo, and the main
+ * thread shows the commit at prepare_first once its job is done.
+ */
+struct prepare_job {
+	struct commit *commit;
+	struct object_id old_tree, new_tree;
+	unsigned root:1, done:1;
+	struct diff_prepared_patches *patches;
+};
+
+#define PREPARE_AHEAD 64
+static struct prepare_job prepare_jobs[PREPARE_AHEAD];
+static unsigned int prepare_first, prepare_todo, prepare_end;
+static int prepare_walk_done, prepare_stop;
+
+/* A copy of the options, as the main thread changes its own as it goes. */
+static struct diff_options prepare_diffopt;
+
+static int prepare_patches, prepare_pickaxe;
+static int nr_prepare_threads;
+static pthread_t *prepare_threads;
+
+/* This lock protects prepare_todo, prepare_end, prepare_stop and "done". */
+static pthread_mutex_t prepare_mutex;
+static pthread_cond_t prepare_cond_todo;
+static pthread_cond_t prepare_cond_done;
+
+static void *prepare_patches_thread(void *unused)
+{
+	xdlcache_t *cache = xdi_cache_new();
+
+	pthread_mutex_lock(&prepare_mutex);
+	for (;;) {
+		struct prepare_job *job;
+
+		while (prepare_todo != prepare_end &&
+		       prepare_jobs[prepare_todo % PREPARE_AHEAD].done)
+			prepare_todo++;
+		if (prepare_todo == prepare_end) {
+			if (prepare_stop)
+				break;
+			pthread_cond_wait(&prepare_cond_todo, &prepare_mutex);
+			continue;
+		}
+		job = &prepare_jobs[prepare_todo++ % PREPARE_AHEAD];
+		pthread_mutex_unlock(&prepare_mutex);
+
+		if (prepare_pickaxe)
+			diff_prepare_pickaxe(&prepare_diffopt,
+					     job->root ? NULL : &job->old_tree,
+					     &job->new_tree);
+		if (prepare_patches)
+			job->patches = diff_prepare_patches(&prepare_diffopt,
+							    job->root ? NULL : &job->old_tree,
+							    &job->new_tree, cache);
+
+		pthread_mutex_lock(&prepare_mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&prepare_cond_done);
+	}
+	pthread_mutex_unlock(&prepare_mutex);
+	xdl_cache_free(cache);
+	return NULL;
+}
+
+/* Set up a job for the diff log_tree_diff() shows first for "commit". */
+static void init_prepare_job(struct rev_info *opt, struct prepare_job *job,
+			     struct commit *commit)
+{
+	struct commit_list *parents = get_saved_parents(opt, commit);
+
+	memset(job, 0, sizeof(*job));
+	job->commit = commit;
+	if ((!parents && !opt->show_root_diff) ||
+	    (parents && parents->next &&
+	     (opt->ignore_merges || opt->combine_merges))) {
+		job->done = 1;
+		return;
+	}
+
+	parse_commit_or_die(commit);
+	oidcpy(&job->new_tree, get_commit_tree_oid(commit));
+	if (parents) {
+		parse_commit_or_die(parents->item);
+		oidcpy(&job->old_tree, get_commit_tree_oid(parents->item));
+	} else
+		job->root = 1;
+}
+
+int log_tree_start_threads(struct rev_info *opt, int nr_threads)
+{
+	int i;
+
+	/*
+	 * The walk has to be run ahead of what is shown, so nothing that
+	 * get_revision() sets up for the commit it returns can be used
+	 * (e.g. the saved parents of --full-diff, which the end of the
+	 * walk frees, or what --show-linear-break looks at).
+	 */
+	if (!HAVE_THREADS || nr_threads < 2 || !opt->diff ||
+	    opt->reflog_info || opt->boundary || opt->early_output ||
+	    opt->line_level_traverse || opt->track_linear ||
+	    opt->rewrite_parents || opt->children.name)
+		return 0;
+	prepare_patches = diff_can_prepare_patches(&opt->diffopt);
+	prepare_pickaxe = diff_can_prepare_pickaxe(&opt->diffopt);
+	if (!prepare_patches && !prepare_pickaxe)
+		return 0;
+
+	memcpy(&prepare_diffopt, &opt->diffopt, sizeof(prepare_diffopt));
+	prepare_first = prepare_todo = prepare_end = 0;
+	prepare_walk_done = prepare_stop = 0;
+
+	pthread_mutex_init(&prepare_mutex, NULL);
+	pthread_cond_init(&prepare_cond_todo, NULL);
+	pthread_cond_init(&prepare_cond_done, NULL);
+	enable_obj_read_lock();
+
+	nr_prepare_threads = nr_threads;
+	prepare_threads = xcalloc(nr_threads, sizeof(*prepare_threads));
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&prepare_threads[i], NULL,
+					 prepare_patches_thread, NULL);
+		if (err)
+			die(_("log: failed to create thread: %s"),
+			    strerror(err));
+	}
+	return 1;
+}
+
+struct commit *log_tree_next_commit(struct rev_info *opt)
+{
+	struct prepare_job *job;
+
+	diff_free_prepared_patches(opt->diffopt.prepared_patches);
+	opt->diffopt.prepared_patches = NULL;
+
+	while (!prepare_walk_done &&
+	       prepare_end - prepare_first < PREPARE_AHEAD) {
+		/*
+		 * Once max_count runs out, a NULL is not the end yet, as
+		 * the caller gives back the commits it does not show.
+		 */
+		int stopped_by_count = !opt->max_count;
+		struct commit *commit = get_revision(opt);
+
+		if (!commit) {
+			prepare_walk_done = !stopped_by_count;
+			break;
+		}
+		init_prepare_job(opt, &prepare_jobs[prepare_end % PREPARE_AHEAD],
+				 commit);
+
+		pthread_mutex_lock(&prepare_mutex);
+		prepare_end++;
+		pthread_cond_signal(&prepare_cond_todo);
+		pthread_mutex_unlock(&prepare_mutex);
+	}
+
+	if (prepare_first == prepare_end)
+		return NULL;
+
+	job = &prepare_jobs[prepare_first++ % PREPARE_AHEAD];
+	pthread_mutex_lock(&prepare_mutex);
+	while (!job->done)
+		pthread_cond_wait(&prepare_cond_done, &prepare_mutex);
+	pthread_mutex_unlock(&prepare_mutex);
+
+	opt->diffopt.prepared_patches = job->patches;
+	return job->commit;
+}
+
+void log_tree_stop_threads(struct rev_info *opt)
+{
+	int i;
+
+	pthread_mutex_lock(&prepare_mutex);
+	prepare_stop = 1;
+	pthread_cond_broadcast(&prepare_cond_todo);
+	pthread_mutex_unlock(&prepare_mutex);
+
+	for (i = 0; i < nr_prepare_threads; i++)
+		pthread_join(prepare_threads[i], NULL);
+	FREE_AND_NULL(prepare_threads);
+
+	for (; prepare_first != prepare_end; prepare_first++)
+		diff_free_prepared_patches(prepare_jobs[prepare_first % PREPARE_AHEAD].patches);
+	diff_free_prepared_patches(opt->diffopt.prepared_patches);
+	opt->diffopt.prepared_patches = NULL;
+
+	pthread_mutex_destroy(&prepare_mutex);
+	pthread_cond_destroy(&prepare_cond_todo);
+	pthread_cond_destroy(&prepare_cond_done);
+	disable_obj_read_lock();
+}
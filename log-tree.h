@@ -15,6 +15,17 @@ int parse_decorate_color_config(const char *var, const char *slot_name, const ch
 void init_log_tree_opt(struct rev_info *);
 int log_tree_diff_flush(struct rev_info *);
 int log_tree_commit(struct rev_info *, struct commit *);
+
+/*
+ * Have "nr_threads" threads prepare the patches of the commits to come
+ * while the caller shows them with log_tree_commit(). Returns 0 if that
+ * cannot be done with these options. Otherwise the caller then takes
+ * the commits from log_tree_next_commit() instead of get_revision(),
+ * until it returns NULL, and calls log_tree_stop_threads().
+ */
+int log_tree_start_threads(struct rev_info *, int nr_threads);
+struct commit *log_tree_next_commit(struct rev_info *);
+void log_tree_stop_threads(struct rev_info *);
 int log_tree_opt_parse(struct rev_info *, const char **, int);
 void show_log(struct rev_info *opt);
 void format_decorations_extended(struct strbuf *sb, const struct commit *commit,
@@ -0,0 +1,476 @@
+#include "cache.h"
+#include "config.h"
+#include "csum-file.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "loose-index.h"
+#include "trace2.h"
+
+#define LOOSE_INDEX_SIGNATURE 0x4c4f4958 /* "LOIX" */
+#define LOOSE_INDEX_VERSION 1
+#define LOOSE_INDEX_HEADER_SIZE 12
+#define LOOSE_INDEX_RECORD_SIZE 44
+#define LOOSE_INDEX_TABLE_SIZE (LOOSE_INDEX_HEADER_SIZE + \
+				256 * LOOSE_INDEX_RECORD_SIZE)
+
+/* the directory was listed, and its stat data is valid */
+#define LOOSE_INDEX_LISTED (1u << 0)
+/* the directory did not exist */
+#define LOOSE_INDEX_MISSING (1u << 1)
+/*
+ * The listing was current before we wrote objects into the directory,
+ * and has them. Others may have written there at the same time, so it
+ * is listed again before it is written out.
+ */
+#define LOOSE_INDEX_WRITTEN (1u << 2)
+
+struct loose_index_record {
+	unsigned int flags;
+	struct stat_data sd;
+};
+
+struct loose_index {
+	pid_t owner;
+
+	/* the index file as we found it, if it was usable */
+	const unsigned char *data;
+	size_t data_len;
+	struct cache_time timestamp;
+
+	/*
+	 * For each odb->loose_objects_subdir_seen[], what the directory
+	 * looked like when the listing in odb->loose_objects_cache[]
+	 * was current.
+	 */
+	struct loose_index_record current[256];
+	unsigned dirty : 1;
+};
+
+static int atexit_registered;
+static intmax_t nr_read, nr_listed;
+
+int loose_index_enabled(void)
+{
+	return git_env_bool(GIT_TEST_LOOSE_OBJECT_INDEX,
+			    core_loose_object_index);
+}
+
+static char *loose_index_path(struct object_directory *odb)
+{
+	return xstrfmt("%s/info/loose-index", odb->path);
+}
+
+static const unsigned char *record_at(struct loose_index *li, int nr)
+{
+	return li->data + LOOSE_INDEX_HEADER_SIZE +
+		nr * LOOSE_INDEX_RECORD_SIZE;
+}
+
+static uint32_t record_end(struct loose_index *li, int nr)
+{
+	return get_be32(record_at(li, nr) + LOOSE_INDEX_RECORD_SIZE - 4);
+}
+
+static uint32_t record_begin(struct loose_index *li, int nr)
+{
+	return nr ? record_end(li, nr - 1) : 0;
+}
+
+static const unsigned char *oid_at(struct loose_index *li, uint32_t pos)
+{
+	return li->data + LOOSE_INDEX_TABLE_SIZE +
+		st_mult(pos, the_hash_algo->rawsz);
+}
+
+static void read_record(const unsigned char *p, struct loose_index_record *rec)
+{
+	rec->flags = get_be32(p);
+	rec->sd.sd_ctime.sec = get_be32(p + 4);
+	rec->sd.sd_ctime.nsec = get_be32(p + 8);
+	rec->sd.sd_mtime.sec = get_be32(p + 12);
+	rec->sd.sd_mtime.nsec = get_be32(p + 16);
+	rec->sd.sd_dev = get_be32(p + 20);
+	rec->sd.sd_ino = get_be32(p + 24);
+	rec->sd.sd_uid = get_be32(p + 28);
+	rec->sd.sd_gid = get_be32(p + 32);
+	rec->sd.sd_size = get_be32(p + 36);
+}
+
+static void write_record(struct hashfile *f,
+			 const struct loose_index_record *rec, uint32_t end)
+{
+	hashwrite_be32(f, rec->flags);
+	hashwrite_be32(f, rec->sd.sd_ctime.sec);
+	hashwrite_be32(f, rec->sd.sd_ctime.nsec);
+	hashwrite_be32(f, rec->sd.sd_mtime.sec);
+	hashwrite_be32(f, rec->sd.sd_mtime.nsec);
+	hashwrite_be32(f, rec->sd.sd_dev);
+	hashwrite_be32(f, rec->sd.sd_ino);
+	hashwrite_be32(f, rec->sd.sd_uid);
+	hashwrite_be32(f, rec->sd.sd_gid);
+	hashwrite_be32(f, rec->sd.sd_size);
+	hashwrite_be32(f, end);
+}
+
+/*
+ * A directory that was modified in the same timestamp tick in which
+ * the index file was written may have been modified again after it
+ * was listed, without its stat data changing; see is_racy_stat().
+ */
+static int is_racy(const struct cache_time *timestamp,
+		   const struct stat_data *sd)
+{
+#ifdef USE_NSEC
+	return timestamp->sec < sd->sd_mtime.sec ||
+	       (timestamp->sec == sd->sd_mtime.sec &&
+		timestamp->nsec <= sd->sd_mtime.nsec);
+#else
+	return timestamp->sec <= sd->sd_mtime.sec;
+#endif
+}
+
+static int verify_loose_index(struct loose_index *li)
+{
+	size_t max_end;
+	uint32_t end = 0;
+	int nr;
+
+	if (get_be32(li->data) != LOOSE_INDEX_SIGNATURE ||
+	    get_be32(li->data + 4) != LOOSE_INDEX_VERSION ||
+	    get_be32(li->data + 8) != the_hash_algo->format_id)
+		return 0;
+
+	max_end = (li->data_len - LOOSE_INDEX_TABLE_SIZE -
+		   the_hash_algo->rawsz) / the_hash_algo->rawsz;
+	for (nr = 0; nr < 256; nr++) {
+		uint32_t next = record_end(li, nr);
+
+		if (next < end || next > max_end)
+			return 0;
+		end = next;
+	}
+	return end == max_end &&
+		li->data_len == LOOSE_INDEX_TABLE_SIZE +
+				st_mult(end, the_hash_algo->rawsz) +
+				the_hash_algo->rawsz;
+}
+
+static void write_loose_indexes_atexit(void);
+
+static struct loose_index *prepare_loose_index(struct object_directory *odb)
+{
+	struct loose_index *li = odb->loose_index;
+	char *path;
+	struct stat st;
+	int fd;
+
+	if (li)
+		return li;
+	li = odb->loose_index = xcalloc(1, sizeof(*li));
+	li->owner = getpid();
+	if (!atexit_registered) {
+		atexit_registered = 1;
+		atexit(write_loose_indexes_atexit);
+	}
+
+	path = loose_index_path(odb);
+	fd = git_open(path);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), path);
+		close(fd);
+		goto out;
+	}
+	li->data_len = xsize_t(st.st_size);
+	if (li->data_len < LOOSE_INDEX_TABLE_SIZE + the_hash_algo->rawsz) {
+		error(_("loose object index file %s is too small"), path);
+		close(fd);
+		goto out;
+	}
+	li->data = xmmap(NULL, li->data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	li->timestamp.sec = (unsigned int)st.st_mtime;
+	li->timestamp.nsec = ST_MTIME_NSEC(st);
+
+	if (!verify_loose_index(li)) {
+		error(_("loose object index file %s is corrupt"), path);
+		munmap((void *)li->data, li->data_len);
+		li->data = NULL;
+	}
+out:
+	free(path);
+	return li;
+}
+
+/*
+ * Put the stat data of the directory for "subdir_nr" into "st" and
+ * return 0, or return 1 if it does not exist and -1 on other errors.
+ */
+static int stat_subdir(struct object_directory *odb, int subdir_nr,
+		       struct stat *st)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0;
+
+	strbuf_addf(&buf, "%s/%02x", odb->path, subdir_nr);
+	if (stat(buf.buf, st))
+		ret = errno == ENOENT ? 1 : -1;
+	strbuf_release(&buf);
+	return ret;
+}
+
+/*
+ * Fill the loose object cache for "subdir_nr" from the index file, if
+ * the directory still looks like it did when it was written there; a
+ * NULL "st" means that the directory does not exist.
+ */
+static int load_from_index(struct object_directory *odb, int subdir_nr,
+			   struct stat *st)
+{
+	struct loose_index *li = odb->loose_index;
+	struct oid_array *cache = &odb->loose_objects_cache[subdir_nr];
+	struct loose_index_record rec;
+	uint32_t i, end;
+
+	if (!li->data)
+		return -1;
+	read_record(record_at(li, subdir_nr), &rec);
+	if (!st) {
+		if (!(rec.flags & LOOSE_INDEX_MISSING))
+			return -1;
+	} else if (!(rec.flags & LOOSE_INDEX_LISTED) ||
+		   is_racy(&li->timestamp, &rec.sd) ||
+		   match_stat_data(&rec.sd, st)) {
+		return -1;
+	}
+
+	end = record_end(li, subdir_nr);
+	for (i = record_begin(li, subdir_nr); i < end; i++) {
+		struct object_id oid;
+
+		oidread(&oid, oid_at(li, i));
+		oid_array_append(cache, &oid);
+	}
+	/* the index file keeps them sorted */
+	cache->sorted = 1;
+
+	li->current[subdir_nr] = rec;
+	odb->loose_objects_subdir_seen[subdir_nr] = 1;
+	nr_read++;
+	return 0;
+}
+
+static int append_loose_object(const struct object_id *oid, const char *path,
+			       void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+static void list_subdir(struct object_directory *odb, int subdir_nr,
+			int missing, struct stat *st)
+{
+	struct loose_index_record *rec = &odb->loose_index->current[subdir_nr];
+	struct strbuf buf = STRBUF_INIT;
+
+	strbuf_addstr(&buf, odb->path);
+	for_each_file_in_obj_subdir(subdir_nr, &buf,
+				    append_loose_object,
+				    NULL, NULL,
+				    &odb->loose_objects_cache[subdir_nr]);
+	odb->loose_objects_subdir_seen[subdir_nr] = 1;
+	strbuf_release(&buf);
+	nr_listed++;
+
+	memset(rec, 0, sizeof(*rec));
+	if (missing > 0) {
+		rec->flags = LOOSE_INDEX_MISSING;
+	} else if (!missing) {
+		rec->flags = LOOSE_INDEX_LISTED;
+		fill_stat_data(&rec->sd, st);
+	}
+	odb->loose_index->dirty = 1;
+}
+
+void loose_index_load_subdir(struct object_directory *odb, int subdir_nr)
+{
+	struct stat st;
+	int missing;
+
+	prepare_loose_index(odb);
+
+	/* take the stat data before listing, so that we err on the safe side */
+	missing = stat_subdir(odb, subdir_nr, &st);
+	if (missing >= 0 &&
+	    !load_from_index(odb, subdir_nr, missing ? NULL : &st))
+		return;
+	list_subdir(odb, subdir_nr, missing, &st);
+}
+
+int loose_index_begin_write(struct object_directory *odb,
+			    const struct object_id *oid)
+{
+	int subdir_nr = oid->hash[0];
+	struct loose_index_record *rec;
+	struct stat st;
+	int missing;
+
+	if (!loose_index_enabled())
+		return 0;
+	prepare_loose_index(odb);
+
+	missing = stat_subdir(odb, subdir_nr, &st);
+	if (missing < 0)
+		return 0;
+	/* do not read the directory only to add a single object to it */
+	if (!odb->loose_objects_subdir_seen[subdir_nr])
+		return !load_from_index(odb, subdir_nr, missing ? NULL : &st);
+
+	rec = &odb->loose_index->current[subdir_nr];
+	if (rec->flags & LOOSE_INDEX_WRITTEN)
+		return 1;
+	if (missing)
+		return !!(rec->flags & LOOSE_INDEX_MISSING);
+	return (rec->flags & LOOSE_INDEX_LISTED) &&
+		!match_stat_data(&rec->sd, &st);
+}
+
+void loose_index_end_write(struct object_directory *odb,
+			   const struct object_id *oid)
+{
+	int subdir_nr = oid->hash[0];
+	struct loose_index *li = odb->loose_index;
+	struct loose_index_record *rec = &li->current[subdir_nr];
+
+	/*
+	 * The stat data of the directory now also covers whatever others
+	 * wrote into it since loose_index_begin_write(); do not take it
+	 * for that of our listing.
+	 */
+	oid_array_append(&odb->loose_objects_cache[subdir_nr], oid);
+	rec->flags = LOOSE_INDEX_WRITTEN;
+	li->dirty = 1;
+}
+
+/* List again the directories we wrote into, see LOOSE_INDEX_WRITTEN. */
+static void relist_written_subdirs(struct object_directory *odb)
+{
+	struct stat st;
+	int nr, missing;
+
+	for (nr = 0; nr < 256; nr++) {
+		if (!odb->loose_objects_subdir_seen[nr] ||
+		    !(odb->loose_index->current[nr].flags & LOOSE_INDEX_WRITTEN))
+			continue;
+		oid_array_clear(&odb->loose_objects_cache[nr]);
+		missing = stat_subdir(odb, nr, &st);
+		list_subdir(odb, nr, missing, &st);
+	}
+}
+
+static int count_oid(const struct object_id *oid, void *data)
+{
+	uint32_t *count = data;
+
+	(*count)++;
+	return 0;
+}
+
+static int write_oid(const struct object_id *oid, void *data)
+{
+	hashwrite(data, oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static void write_loose_index(struct object_directory *odb)
+{
+	struct loose_index *li = odb->loose_index;
+	struct lock_file lk = LOCK_INIT;
+	struct loose_index_record rec[256];
+	uint32_t count[256], end = 0;
+	struct hashfile *f;
+	char *path = loose_index_path(odb);
+	int nr;
+
+	/* somebody else is writing it, or we cannot; it is only a cache */
+	if (hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto out;
+
+	for (nr = 0; nr < 256; nr++) {
+		memset(&rec[nr], 0, sizeof(rec[nr]));
+		count[nr] = 0;
+
+		if (odb->loose_objects_subdir_seen[nr]) {
+			rec[nr] = li->current[nr];
+			oid_array_for_each_unique(&odb->loose_objects_cache[nr],
+						  count_oid, &count[nr]);
+		} else if (li->data) {
+			read_record(record_at(li, nr), &rec[nr]);
+			/*
+			 * A racy record would look trustworthy in a newer
+			 * file; drop it, like ce_smudge_racily_clean_entry().
+			 */
+			if ((rec[nr].flags & LOOSE_INDEX_LISTED) &&
+			    is_racy(&li->timestamp, &rec[nr].sd))
+				rec[nr].flags = 0;
+			count[nr] = record_end(li, nr) - record_begin(li, nr);
+		}
+		if (!(rec[nr].flags & LOOSE_INDEX_LISTED))
+			count[nr] = 0;
+	}
+
+	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	hashwrite_be32(f, LOOSE_INDEX_SIGNATURE);
+	hashwrite_be32(f, LOOSE_INDEX_VERSION);
+	hashwrite_be32(f, the_hash_algo->format_id);
+	for (nr = 0; nr < 256; nr++) {
+		end += count[nr];
+		write_record(f, &rec[nr], end);
+	}
+	for (nr = 0; nr < 256; nr++) {
+		if (!count[nr])
+			continue;
+		if (odb->loose_objects_subdir_seen[nr])
+			oid_array_for_each_unique(&odb->loose_objects_cache[nr],
+						  write_oid, f);
+		else
+			hashwrite(f, oid_at(li, record_begin(li, nr)),
+				  st_mult(count[nr], the_hash_algo->rawsz));
+	}
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM);
+	commit_lock_file(&lk);
+out:
+	free(path);
+}
+
+static void write_loose_indexes_atexit(void)
+{
+	struct object_directory *odb = the_repository->objects->odb;
+
+	if (!odb || !odb->loose_index || odb->loose_index->owner != getpid())
+		return;
+
+	trace2_data_intmax("loose-index", the_repository, "read", nr_read);
+	trace2_data_intmax("loose-index", the_repository, "listed", nr_listed);
+
+	/*
+	 * We only write the index of our own object directory; those of
+	 * alternates are used when they are up to date.
+	 */
+	if (odb->loose_index->dirty && use_optional_locks()) {
+		relist_written_subdirs(odb);
+		write_loose_index(odb);
+	}
+}
+
+void loose_index_release(struct object_directory *odb)
+{
+	struct loose_index *li = odb->loose_index;
+
+	if (!li)
+		return;
+	if (li->data)
+		munmap((void *)li->data, li->data_len);
+	FREE_AND_NULL(odb->loose_index);
+}
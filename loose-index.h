@@ -0,0 +1,41 @@
+#ifndef LOOSE_INDEX_H
+#define LOOSE_INDEX_H
+
+struct object_directory;
+struct object_id;
+
+#define GIT_TEST_LOOSE_OBJECT_INDEX "GIT_TEST_LOOSE_OBJECT_INDEX"
+
+/*
+ * The loose object index "$GIT_OBJECT_DIRECTORY/info/loose-index"
+ * remembers the listing of each loose object directory together with
+ * the stat data the directory had when it was listed, so that the
+ * loose object cache of the next command can be filled without
+ * reading the directory. See Documentation/technical/loose-index.txt.
+ */
+
+/* Is "core.looseObjectIndex" (or its GIT_TEST_ override) enabled? */
+int loose_index_enabled(void);
+
+/*
+ * Fill odb->loose_objects_cache[subdir_nr], from the loose object
+ * index if it is up to date for that directory, and by reading the
+ * directory otherwise.
+ */
+void loose_index_load_subdir(struct object_directory *odb, int subdir_nr);
+
+/*
+ * Bracket writing the loose object "oid" into "odb". If the listing
+ * of its directory in the loose object cache is current, begin
+ * returns 1, and end adds the new object to it after the object has
+ * been moved into place.
+ */
+int loose_index_begin_write(struct object_directory *odb,
+			    const struct object_id *oid);
+void loose_index_end_write(struct object_directory *odb,
+			   const struct object_id *oid);
+
+/* Forget everything, without writing it out. */
+void loose_index_release(struct object_directory *odb);
+
+#endif
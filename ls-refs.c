@@ -32,6 +32,7 @@ struct ls_refs_data {
 	unsigned peel;
 	unsigned symrefs;
 	struct argv_array prefixes;
+	struct packet_writer writer;
 };
 
 static int send_ref(const char *refname, const struct object_id *oid,
@@ -67,8 +68,7 @@ static int send_ref(const char *refname, const struct object_id *oid,
 			strbuf_addf(&refline, " peeled:%s", oid_to_hex(&peeled));
 	}
 
-	strbuf_addch(&refline, '\n');
-	packet_write(1, refline.buf, refline.len);
+	packet_writer_write(&data->writer, "%s\n", refline.buf);
 
 	strbuf_release(&refline);
 	return 0;
@@ -91,6 +91,9 @@ int ls_refs(struct repository *r, struct argv_array *keys,
 
 	memset(&data, 0, sizeof(data));
 
+	packet_writer_init(&data.writer, 1);
+	packet_writer_buffer(&data.writer);
+
 	git_config(ls_refs_config, NULL);
 
 	while (packet_reader_read(request) != PACKET_READ_FLUSH) {
@@ -106,8 +109,14 @@ int ls_refs(struct repository *r, struct argv_array *keys,
 	}
 
 	head_ref_namespaced(send_ref, &data);
-	for_each_namespaced_ref(send_ref, &data);
-	packet_flush(1);
+	if (data.prefixes.argc)
+		refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
+						  get_git_namespace(),
+						  data.prefixes.argv,
+						  send_ref, &data, 0);
+	else
+		for_each_namespaced_ref(send_ref, &data);
+	packet_writer_flush(&data.writer);
 	argv_array_clear(&data.prefixes);
 	return 0;
 }
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "hashmap.h"
 #include "string-list.h"
 #include "mailmap.h"
 #include "object-store.h"
@@ -237,10 +238,84 @@ static int read_mailmap_blob(struct string_list *map,
 	return 0;
 }
 
+/*
+ * A case-insensitive hash index on the emails of one map, so that
+ * map_user() does not need a binary search with strcasecmp() for each
+ * ident it is asked about. It is built on the first lookup, and
+ * dropped whenever the map changes.
+ */
+struct mailmap_email {
+	struct hashmap_entry ent;
+	size_t pos;
+};
+
+struct mailmap_key {
+	const char *email;
+	size_t len;
+};
+
+static const struct string_list *email_index_map;
+static struct hashmap email_index;
+
+static int mailmap_email_cmp(const void *map, const void *entry,
+			     const void *entry_or_key, const void *keydata)
+{
+	const struct mailmap_email *e = entry;
+	const struct string_list *m = map;
+	const char *string = m->items[e->pos].string;
+
+	if (keydata) {
+		const struct mailmap_key *k = keydata;
+		return strncasecmp(string, k->email, k->len) ||
+		       string[k->len];
+	}
+	return strcasecmp(string, m->items[((const struct mailmap_email *)
+					     entry_or_key)->pos].string);
+}
+
+static void drop_email_index(const struct string_list *map)
+{
+	if (email_index_map != map)
+		return;
+	hashmap_free(&email_index, 1);
+	email_index_map = NULL;
+}
+
+static void build_email_index(struct string_list *map)
+{
+	size_t i;
+
+	drop_email_index(email_index_map);
+	hashmap_init(&email_index, mailmap_email_cmp, map, map->nr);
+	for (i = 0; i < map->nr; i++) {
+		struct mailmap_email *e = xmalloc(sizeof(*e));
+
+		hashmap_entry_init(e, strihash(map->items[i].string));
+		e->pos = i;
+		hashmap_add(&email_index, e);
+	}
+	email_index_map = map;
+}
+
+static struct string_list_item *lookup_email(struct string_list *map,
+					     const char *email, size_t len)
+{
+	struct mailmap_key key;
+	struct mailmap_email *e;
+
+	if (email_index_map != map)
+		build_email_index(map);
+	key.email = email;
+	key.len = len;
+	e = hashmap_get_from_hash(&email_index, memihash(email, len), &key);
+	return e ? &map->items[e->pos] : NULL;
+}
+
 int read_mailmap(struct string_list *map, char **repo_abbrev)
 {
 	int err = 0;
 
+	drop_email_index(map);
 	map->strdup_strings = 1;
 	map->cmp = namemap_cmp;
 
@@ -257,6 +332,7 @@ int read_mailmap(struct string_list *map, char **repo_abbrev)
 void clear_mailmap(struct string_list *map)
 {
 	debug_mm("mailmap: clearing %d entries...\n", map->nr);
+	drop_email_index(map);
 	map->strdup_strings = 1;
 	string_list_clear_func(map, free_mailmap_entry);
 	debug_mm("mailmap: cleared\n");
@@ -324,7 +400,7 @@ int map_user(struct string_list *map,
 		 (int)*namelen, debug_str(*name),
 		 (int)*emaillen, debug_str(*email));
 
-	item = lookup_prefix(map, *email, *emaillen);
+	item = lookup_email(map, *email, *emaillen);
 	if (item != NULL) {
 		me = (struct mailmap_entry *)item->util;
 		if (me->namemap.nr) {
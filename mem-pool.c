@@ -69,6 +69,24 @@ void mem_pool_discard(struct mem_pool *mem_pool, int invalidate_memory)
 	free(mem_pool);
 }
 
+void mem_pool_reset(struct mem_pool *mem_pool)
+{
+	struct mp_block *keep = mem_pool->mp_block, *block, *block_to_free;
+
+	if (!keep)
+		return;
+	block = keep->next_block;
+	while (block) {
+		block_to_free = block;
+		block = block->next_block;
+		free(block_to_free);
+	}
+	keep->next_block = NULL;
+	keep->next_free = (char *)keep->space;
+	mem_pool->pool_alloc = sizeof(struct mp_block) +
+			       (keep->end - keep->next_free);
+}
+
 void *mem_pool_alloc(struct mem_pool *mem_pool, size_t len)
 {
 	struct mp_block *p = NULL;
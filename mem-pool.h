@@ -31,6 +31,13 @@ void mem_pool_init(struct mem_pool **mem_pool, size_t initial_size);
  */
 void mem_pool_discard(struct mem_pool *mem_pool, int invalidate_memory);
 
+/*
+ * Give back everything allocated from the pool at once, but keep its
+ * current block around for what is allocated next. Nothing allocated
+ * from the pool before may be used afterwards.
+ */
+void mem_pool_reset(struct mem_pool *mem_pool);
+
 /*
  * Alloc memory from the mem_pool.
  */
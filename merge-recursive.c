@@ -28,6 +28,7 @@
 #include "submodule.h"
 #include "revision.h"
 #include "commit-reach.h"
+#include "trace2.h"
 
 struct path_hashmap_entry {
 	struct hashmap_entry e;
@@ -374,9 +375,9 @@ static int unpack_trees_start(struct merge_options *opt,
 	struct index_state tmp_index = { NULL };
 
 	memset(&opt->unpack_opts, 0, sizeof(opt->unpack_opts));
-	if (opt->call_depth)
+	if (opt->call_depth || opt->no_worktree)
 		opt->unpack_opts.index_only = 1;
-	else
+	else if (!opt->in_memory)
 		opt->unpack_opts.update = 1;
 	opt->unpack_opts.merge = 1;
 	opt->unpack_opts.head_idx = 2;
@@ -443,30 +444,23 @@ struct tree *write_tree_from_memory(struct merge_options *opt)
 	return result;
 }
 
-static int save_files_dirs(const struct object_id *oid,
-			   struct strbuf *base, const char *path,
-			   unsigned int mode, int stage, void *context)
+/*
+ * Is there a file or directory at "path" in one of the trees being
+ * merged?  These are looked up one path at a time, as only conflicts
+ * need to know, instead of reading every path of both trees up front.
+ */
+static int path_in_merged_trees(struct merge_options *opt, const char *path)
 {
-	struct path_hashmap_entry *entry;
-	int baselen = base->len;
-	struct merge_options *opt = context;
-
-	strbuf_addstr(base, path);
-
-	FLEX_ALLOC_MEM(entry, path, base->buf, base->len);
-	hashmap_entry_init(entry, path_hash(entry->path));
-	hashmap_add(&opt->current_file_dir_set, entry);
-
-	strbuf_setlen(base, baselen);
-	return (S_ISDIR(mode) ? READ_TREE_RECURSIVE : 0);
-}
+	struct object_id oid;
+	unsigned short mode;
+	int i;
 
-static void get_files_dirs(struct merge_options *opt, struct tree *tree)
-{
-	struct pathspec match_all;
-	memset(&match_all, 0, sizeof(match_all));
-	read_tree_recursive(opt->repo, tree, "", 0, 0,
-			    &match_all, save_files_dirs, opt);
+	for (i = 0; i < ARRAY_SIZE(opt->merged_trees); i++)
+		if (!get_tree_entry(opt->repo,
+				    &opt->merged_trees[i]->object.oid,
+				    path, &oid, &mode))
+			return 1;
+	return 0;
 }
 
 static int get_tree_entry_if_blob(struct repository *r,
@@ -678,6 +672,37 @@ static void update_entry(struct stage_data *entry,
 	oidcpy(&entry->stages[3].oid, &b->oid);
 }
 
+/*
+ * With opt->in_memory, the merge only reads the working tree, and
+ * remembers what it would have written to it in opt->worktree_updates,
+ * until apply_in_memory_merge() checks it all out at once.
+ */
+struct worktree_update {
+	struct object_id oid;
+	unsigned int mode; /* 0 to remove the path */
+};
+
+static void record_worktree_update(struct merge_options *opt,
+				   const char *path,
+				   const struct object_id *oid,
+				   unsigned int mode)
+{
+	struct string_list_item *item;
+	struct worktree_update *update;
+
+	item = string_list_insert(&opt->worktree_updates, path);
+	if (!item->util)
+		item->util = xmalloc(sizeof(*update));
+	update = item->util;
+	if (oid)
+		oidcpy(&update->oid, oid);
+	else
+		oidclr(&update->oid);
+	update->mode = mode;
+}
+
+static int was_dirty(struct merge_options *opt, const char *path);
+
 static int remove_file(struct merge_options *opt, int clean,
 		       const char *path, int no_wd)
 {
@@ -688,6 +713,15 @@ static int remove_file(struct merge_options *opt, int clean,
 		if (remove_file_from_index(opt->repo->index, path))
 			return -1;
 	}
+	if (!opt->call_depth && no_wd && opt->in_memory &&
+	    was_dirty(opt, path)) {
+		/* Keep the dirty file, as if it had not been touched. */
+		const struct cache_entry *ce =
+			index_file_exists(&opt->orig_index, path, strlen(path),
+					  ignore_case);
+
+		record_worktree_update(opt, path, &ce->oid, ce->ce_mode);
+	}
 	if (update_working_directory) {
 		if (ignore_case) {
 			struct cache_entry *ce;
@@ -696,6 +730,10 @@ static int remove_file(struct merge_options *opt, int clean,
 			if (ce && ce_stage(ce) == 0 && strcmp(path, ce->name))
 				return 0;
 		}
+		if (opt->in_memory) {
+			record_worktree_update(opt, path, NULL, 0);
+			return 0;
+		}
 		if (remove_path(path))
 			return -1;
 	}
@@ -712,6 +750,79 @@ static void add_flattened_path(struct strbuf *out, const char *s)
 			out->buf[i] = '_';
 }
 
+/* Is there an index entry at "path", or under it if it ends with a slash? */
+static int index_has_path(struct index_state *istate, const char *path)
+{
+	size_t len = strlen(path);
+	int pos = index_name_pos(istate, path, len);
+
+	if (pos < 0)
+		pos = -1 - pos;
+	return pos < istate->cache_nr &&
+		(path[len - 1] == '/' ?
+		 !strncmp(path, istate->cache[pos]->name, len) :
+		 !strcmp(path, istate->cache[pos]->name));
+}
+
+/*
+ * With opt->in_memory, the working tree is the one the merge started
+ * with, but the checks below must see the one a merge that updated it as
+ * it went would have by now: the files unpack_trees() would have checked
+ * out or removed, and the updates merge-recursive made since.
+ */
+static int worktree_dir_exists(struct merge_options *opt, const char *path,
+			       int empty_ok)
+{
+	struct strbuf dirpath = STRBUF_INIT;
+	struct stat st;
+	int ret = -1, i;
+
+	if (opt->in_memory) {
+		strbuf_addf(&dirpath, "%s/", path);
+		i = string_list_find_insert_index(&opt->worktree_updates,
+						  dirpath.buf, 0);
+		if (i < 0)
+			i = -1 - i;
+		for (; ret < 0 && i < opt->worktree_updates.nr; i++) {
+			struct string_list_item *item =
+				&opt->worktree_updates.items[i];
+
+			if (!starts_with(item->string, dirpath.buf))
+				break;
+			if (((struct worktree_update *)item->util)->mode)
+				ret = 1;
+		}
+		/*
+		 * Assume that a directory with tracked files had only
+		 * those, and would be gone by now if they are.
+		 */
+		if (ret < 0 && index_has_path(&opt->orig_index, dirpath.buf))
+			ret = 0;
+		strbuf_release(&dirpath);
+		if (ret >= 0 || opt->no_worktree)
+			return ret > 0;
+	}
+	return !lstat(path, &st) && S_ISDIR(st.st_mode) &&
+		!(empty_ok && is_empty_dir(path));
+}
+
+static int worktree_file_exists(struct merge_options *opt, const char *path)
+{
+	struct string_list_item *item;
+	struct stat st;
+
+	if (!opt->in_memory)
+		return file_exists(path);
+	item = string_list_lookup(&opt->worktree_updates, path);
+	if (item)
+		return !!((struct worktree_update *)item->util)->mode;
+	if (index_has_path(&opt->orig_index, path))
+		return index_has_path(opt->repo->index, path);
+	if (opt->no_worktree || lstat(path, &st))
+		return 0;
+	return !S_ISDIR(st.st_mode) || worktree_dir_exists(opt, path, 0);
+}
+
 static char *unique_path(struct merge_options *opt, const char *path, const char *branch)
 {
 	struct path_hashmap_entry *entry;
@@ -725,7 +836,8 @@ static char *unique_path(struct merge_options *opt, const char *path, const char
 	base_len = newpath.len;
 	while (hashmap_get_from_hash(&opt->current_file_dir_set,
 				     path_hash(newpath.buf), newpath.buf) ||
-	       (!opt->call_depth && file_exists(newpath.buf))) {
+	       path_in_merged_trees(opt, newpath.buf) ||
+	       (!opt->call_depth && worktree_file_exists(opt, newpath.buf))) {
 		strbuf_setlen(&newpath, base_len);
 		strbuf_addf(&newpath, "_%d", suffix++);
 	}
@@ -742,12 +854,12 @@ static char *unique_path(struct merge_options *opt, const char *path, const char
  * check the working directory.  If empty_ok is non-zero, also return
  * 0 in the case where the working-tree dir exists but is empty.
  */
-static int dir_in_way(struct index_state *istate, const char *path,
+static int dir_in_way(struct merge_options *opt, const char *path,
 		      int check_working_copy, int empty_ok)
 {
+	struct index_state *istate = opt->repo->index;
 	int pos;
 	struct strbuf dirpath = STRBUF_INIT;
-	struct stat st;
 
 	strbuf_addstr(&dirpath, path);
 	strbuf_addch(&dirpath, '/');
@@ -763,8 +875,7 @@ static int dir_in_way(struct index_state *istate, const char *path,
 	}
 
 	strbuf_release(&dirpath);
-	return check_working_copy && !lstat(path, &st) && S_ISDIR(st.st_mode) &&
-		!(empty_ok && is_empty_dir(path));
+	return check_working_copy && worktree_dir_exists(opt, path, empty_ok);
 }
 
 /*
@@ -840,7 +951,7 @@ static int would_lose_untracked(struct merge_options *opt, const char *path)
 		}
 		pos++;
 	}
-	return file_exists(path);
+	return worktree_file_exists(opt, path);
 }
 
 static int was_dirty(struct merge_options *opt, const char *path)
@@ -933,6 +1044,19 @@ static int update_file_flags(struct merge_options *opt,
 			goto update_index;
 		}
 
+		if (opt->in_memory) {
+			/* refuse what make_room_for_path() would refuse */
+			if (would_lose_untracked(opt, path))
+				err(opt, _("refusing to lose untracked file at '%s'"),
+				    path);
+			else
+				record_worktree_update(opt, path,
+						       &contents->oid,
+						       contents->mode);
+			update_wd = 0;
+			goto update_index;
+		}
+
 		buf = read_object_file(&contents->oid, &type, &size);
 		if (!buf)
 			return err(opt, _("cannot read object %s '%s'"),
@@ -1424,7 +1548,7 @@ static int handle_change_delete(struct merge_options *opt,
 	const char *update_path = path;
 	int ret = 0;
 
-	if (dir_in_way(opt->repo->index, path, !opt->call_depth, 0) ||
+	if (dir_in_way(opt, path, !opt->call_depth, 0) ||
 	    (!opt->call_depth && would_lose_untracked(opt, path))) {
 		update_path = alt_path = unique_path(opt, path, change_branch);
 	}
@@ -1685,7 +1809,7 @@ static char *find_path_for_conflict(struct merge_options *opt,
 				    const char *branch2)
 {
 	char *new_path = NULL;
-	if (dir_in_way(opt->repo->index, path, !opt->call_depth, 0)) {
+	if (dir_in_way(opt, path, !opt->call_depth, 0)) {
 		new_path = unique_path(opt, path, branch1);
 		output(opt, 1, _("%s is a directory in %s adding "
 			       "as %s instead"),
@@ -1885,6 +2009,7 @@ static struct diff_queue_struct *get_diffpairs(struct merge_options *opt,
 			    1000;
 	opts.rename_score = opt->rename_score;
 	opts.show_rename_progress = opt->show_rename_progress;
+	opts.rename_cache = opt->rename_cache;
 	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
 	diff_setup_done(&opts);
 	diff_tree_oid(&o_tree->object.oid, &tree->object.oid, "", &opts);
@@ -3021,7 +3146,7 @@ static int handle_content_merge(struct merge_file_info *mfi,
 		reason = _("add/add");
 
 	assert(o->path && a->path && b->path);
-	if (ci && dir_in_way(opt->repo->index, path, !opt->call_depth,
+	if (ci && dir_in_way(opt, path, !opt->call_depth,
 			     S_ISGITLINK(ci->ren1->pair->two->mode)))
 		df_conflict_remains = 1;
 
@@ -3043,7 +3168,8 @@ static int handle_content_merge(struct merge_file_info *mfi,
 
 		output(opt, 3, _("Skipped %s (merged same as existing)"), path);
 		if (add_cacheinfo(opt, &mfi->blob, path,
-				  0, (!opt->call_depth && !is_dirty), 0))
+				  0, (!opt->call_depth && !opt->no_worktree &&
+				      !is_dirty), 0))
 			return -1;
 		/*
 		 * However, add_cacheinfo() will delete the old cache entry
@@ -3330,7 +3456,7 @@ static int process_entry(struct merge_options *opt,
 			contents = b;
 			conf = _("directory/file");
 		}
-		if (dir_in_way(opt->repo->index, path,
+		if (dir_in_way(opt, path,
 			       !opt->call_depth && !S_ISGITLINK(a->mode),
 			       0)) {
 			char *new_path = unique_path(opt, path, add_branch);
@@ -3380,6 +3506,158 @@ static int process_entry(struct merge_options *opt,
 	return clean_merge;
 }
 
+static void add_worktree_path(struct string_list *paths, const char *path,
+			      const struct object_id *oid, unsigned int mode)
+{
+	struct worktree_update *update = xmalloc(sizeof(*update));
+
+	oidcpy(&update->oid, oid);
+	update->mode = mode;
+	string_list_append(paths, path)->util = update;
+}
+
+/* Is paths->items[i] a leading directory of one of the other paths? */
+static int is_leading_dir(struct string_list *paths, int i)
+{
+	const char *path = paths->items[i].string;
+	size_t len = strlen(path);
+
+	for (i++; i < paths->nr; i++) {
+		const char *other = paths->items[i].string;
+
+		if (strncmp(path, other, len))
+			return 0;
+		if (other[len] == '/')
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Make a tree of the working tree an in-memory merge would have left
+ * behind: the resulting index, plus the working tree files not to be
+ * found in it (conflicts, and the paths they were moved to).
+ */
+static struct tree *write_in_memory_worktree(struct merge_options *opt)
+{
+	struct index_state *istate = opt->repo->index;
+	struct index_state worktree = { NULL };
+	struct string_list paths = STRING_LIST_INIT_NODUP;
+	struct tree *tree = NULL;
+	int i;
+
+	/*
+	 * The working tree has what merge-recursive wrote to it, or else
+	 * what unpack_trees() would have checked out: the merged entry, or
+	 * the file we had before for a conflict. In the few D/F conflicts
+	 * that would have kept merge-recursive from writing a file, the
+	 * directory wins.
+	 */
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		int pos;
+
+		if (string_list_has_string(&opt->worktree_updates, ce->name))
+			continue;
+		if (!ce_stage(ce)) {
+			add_worktree_path(&paths, ce->name, &ce->oid,
+					  ce->ce_mode);
+			continue;
+		}
+		if (i && !strcmp(istate->cache[i - 1]->name, ce->name))
+			continue;
+		pos = index_name_pos(&opt->orig_index, ce->name,
+				     ce_namelen(ce));
+		if (pos >= 0) {
+			ce = opt->orig_index.cache[pos];
+			add_worktree_path(&paths, ce->name, &ce->oid,
+					  ce->ce_mode);
+		}
+	}
+	for (i = 0; i < opt->worktree_updates.nr; i++) {
+		struct string_list_item *item = &opt->worktree_updates.items[i];
+		struct worktree_update *update = item->util;
+
+		if (update->mode)
+			add_worktree_path(&paths, item->string, &update->oid,
+					  update->mode);
+	}
+	string_list_sort(&paths);
+	for (i = 0; i < paths.nr; i++) {
+		struct worktree_update *update = paths.items[i].util;
+		struct cache_entry *ce;
+
+		if (is_leading_dir(&paths, i))
+			continue;
+		ce = make_cache_entry(&worktree, update->mode, &update->oid,
+				      paths.items[i].string, 0, 0);
+		if (ce)
+			add_index_entry(&worktree, ce,
+					ADD_CACHE_OK_TO_ADD |
+					ADD_CACHE_SKIP_DFCHECK);
+	}
+
+	worktree.cache_tree = cache_tree();
+	if (cache_tree_update(&worktree, 0) < 0)
+		err(opt, _("error building trees"));
+	else
+		tree = lookup_tree(opt->repo, &worktree.cache_tree->oid);
+
+	string_list_clear(&paths, 1);
+	discard_index(&worktree);
+	return tree;
+}
+
+/*
+ * Check out "tree", the working tree of an in-memory merge, on top of
+ * "head", which the index matched before the merge, and keep the stat
+ * information of the index entries that were checked out.
+ */
+static int apply_in_memory_merge(struct merge_options *opt, struct tree *head,
+				 struct tree *tree)
+{
+	struct index_state *istate = opt->repo->index;
+	struct index_state result = { NULL };
+	struct unpack_trees_options unpack_opts;
+	struct tree_desc t[2];
+	int i, ret = 0;
+
+	memset(&unpack_opts, 0, sizeof(unpack_opts));
+	unpack_opts.head_idx = 1;
+	unpack_opts.src_index = &opt->orig_index;
+	unpack_opts.dst_index = &result;
+	unpack_opts.update = 1;
+	unpack_opts.merge = 1;
+	unpack_opts.fn = twoway_merge;
+	setup_unpack_trees_porcelain(&unpack_opts, "merge");
+	init_tree_desc_from_tree(t+0, head);
+	init_tree_desc_from_tree(t+1, tree);
+	if (unpack_trees(2, t, &unpack_opts))
+		ret = -1;
+	clear_unpack_trees_porcelain(&unpack_opts);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		const struct cache_entry *checked_out;
+		int pos;
+
+		if (ce_stage(ce))
+			continue;
+		pos = index_name_pos(&result, ce->name, ce_namelen(ce));
+		if (pos < 0)
+			continue;
+		checked_out = result.cache[pos];
+		if (oideq(&checked_out->oid, &ce->oid) &&
+		    checked_out->ce_mode == ce->ce_mode)
+			ce->ce_stat_data = checked_out->ce_stat_data;
+	}
+
+	discard_index(&result);
+	return 0;
+}
+
 int merge_trees(struct merge_options *opt,
 		struct tree *head,
 		struct tree *merge,
@@ -3407,7 +3685,17 @@ int merge_trees(struct merge_options *opt,
 		return 1;
 	}
 
+	if (!opt->call_depth)
+		string_list_clear(&opt->worktree_updates, 1);
+	trace2_region_enter("merge", "unpack_trees", opt->repo);
 	code = unpack_trees_start(opt, common, head, merge);
+	trace2_region_leave("merge", "unpack_trees", opt->repo);
+	/*
+	 * The attributes must come from the merged index, as the working
+	 * tree is not updated yet.
+	 */
+	if (!opt->call_depth && opt->in_memory)
+		git_attr_set_direction(GIT_ATTR_INDEX);
 
 	if (code != 0) {
 		if (show(opt, 4) || opt->call_depth)
@@ -3430,15 +3718,18 @@ int merge_trees(struct merge_options *opt,
 		 * so that we don't have to pass it to around.
 		 */
 		hashmap_init(&opt->current_file_dir_set, path_hashmap_cmp, NULL, 512);
-		get_files_dirs(opt, head);
-		get_files_dirs(opt, merge);
+		opt->merged_trees[0] = head;
+		opt->merged_trees[1] = merge;
 
 		entries = get_unmerged(opt->repo->index);
+		trace2_region_enter("merge", "renames", opt->repo);
 		clean = detect_and_process_renames(opt, common, head, merge,
 						   entries, &re_info);
+		trace2_region_leave("merge", "renames", opt->repo);
 		record_df_conflict_files(opt, entries);
 		if (clean < 0)
 			goto cleanup;
+		trace2_region_enter("merge", "process_entries", opt->repo);
 		for (i = entries->nr-1; 0 <= i; i--) {
 			const char *path = entries->items[i].string;
 			struct stage_data *e = entries->items[i].util;
@@ -3448,10 +3739,13 @@ int merge_trees(struct merge_options *opt,
 					clean = 0;
 				else if (ret < 0) {
 					clean = ret;
-					goto cleanup;
+					break;
 				}
 			}
 		}
+		trace2_region_leave("merge", "process_entries", opt->repo);
+		if (clean < 0)
+			goto cleanup;
 		for (i = 0; i < entries->nr; i++) {
 			struct stage_data *e = entries->items[i].util;
 			if (!e->processed)
@@ -3475,7 +3769,22 @@ int merge_trees(struct merge_options *opt,
 	else
 		clean = 1;
 
+	if (!opt->call_depth && opt->in_memory) {
+		struct tree *worktree;
+
+		if (!opt->no_worktree)
+			git_attr_set_direction(GIT_ATTR_CHECKIN);
+		worktree = write_in_memory_worktree(opt);
+		if (!worktree)
+			clean = -1;
+		else if (opt->no_worktree)
+			*result = worktree;
+		else if (apply_in_memory_merge(opt, head, worktree) < 0)
+			clean = -1;
+	}
 	unpack_trees_finish(opt);
+	if (clean < 0)
+		return clean;
 
 	if (opt->call_depth && !(*result = write_tree_from_memory(opt)))
 		return -1;
@@ -3566,7 +3875,19 @@ int merge_recursive(struct merge_options *opt,
 	}
 
 	discard_index(opt->repo->index);
-	if (!opt->call_depth)
+	if (!opt->call_depth && opt->no_worktree) {
+		struct pathspec match_all;
+
+		memset(&match_all, 0, sizeof(match_all));
+		if (read_tree(opt->repo, get_commit_tree(h1), 0, &match_all,
+			      opt->repo->index) < 0)
+			return err(opt, _("could not read tree %s"),
+				   oid_to_hex(get_commit_tree_oid(h1)));
+		/* lets unpack_trees() skip the subtrees nobody changed */
+		prime_cache_tree(opt->repo, opt->repo->index,
+				 get_commit_tree(h1));
+		opt->repo->index->initialized = 1;
+	} else if (!opt->call_depth)
 		repo_read_index(opt->repo);
 
 	opt->ancestor = "merged common ancestors";
@@ -3578,7 +3899,7 @@ int merge_recursive(struct merge_options *opt,
 		return clean;
 	}
 
-	if (opt->call_depth) {
+	if (opt->call_depth || opt->no_worktree) {
 		*result = make_virtual_commit(opt->repo, mrtree, "merged tree");
 		commit_list_insert(h1, &(*result)->parents);
 		commit_list_insert(h2, &(*result)->parents->next);
@@ -3652,6 +3973,7 @@ int merge_recursive_generic(struct merge_options *opt,
 static void merge_recursive_config(struct merge_options *opt)
 {
 	char *value = NULL;
+	int in_memory = 0;
 	git_config_get_int("merge.verbosity", &opt->verbosity);
 	git_config_get_int("diff.renamelimit", &opt->diff_rename_limit);
 	git_config_get_int("merge.renamelimit", &opt->merge_rename_limit);
@@ -3672,6 +3994,16 @@ static void merge_recursive_config(struct merge_options *opt)
 		} /* avoid erroring on values from future versions of git */
 		free(value);
 	}
+	git_config_get_bool("merge.inmemory", &in_memory);
+	opt->in_memory = in_memory;
+	if (!git_config_get_string("merge.renamecache", &value)) {
+		int boolval = git_parse_maybe_bool(value);
+		if (0 <= boolval)
+			opt->rename_cache = boolval ? DIFF_RENAME_CACHE_MEMORY : 0;
+		else if (!strcasecmp(value, "persist"))
+			opt->rename_cache = DIFF_RENAME_CACHE_PERSIST;
+		free(value);
+	}
 	git_config(git_xmerge_config, NULL);
 }
 
@@ -3690,6 +4022,8 @@ void init_merge_options(struct merge_options *opt,
 	opt->merge_detect_rename = -1;
 	opt->detect_directory_renames = 1;
 	merge_recursive_config(opt);
+	opt->in_memory = git_env_bool("GIT_TEST_MERGE_IN_MEMORY",
+				      opt->in_memory);
 	merge_verbosity = getenv("GIT_MERGE_VERBOSITY");
 	if (merge_verbosity)
 		opt->verbosity = strtol(merge_verbosity, NULL, 10);
@@ -3697,6 +4031,7 @@ void init_merge_options(struct merge_options *opt,
 		opt->buffer_output = 0;
 	strbuf_init(&opt->obuf, 0);
 	string_list_init(&opt->df_conflict_file_set, 1);
+	string_list_init(&opt->worktree_updates, 1);
 }
 
 int parse_merge_opt(struct merge_options *opt, const char *s)
@@ -20,6 +20,8 @@ struct merge_options {
 	const char *subtree_shift;
 	unsigned buffer_output; /* 1: output at end, 2: keep buffered */
 	unsigned renormalize : 1;
+	unsigned in_memory : 1;
+	unsigned no_worktree : 1; /* with in_memory, no index file either */
 	long xdl_opts;
 	int verbosity;
 	int detect_directory_renames;
@@ -30,10 +32,13 @@ struct merge_options {
 	int rename_score;
 	int needed_rename_limit;
 	int show_rename_progress;
+	int rename_cache;
 	int call_depth;
 	struct strbuf obuf;
-	struct hashmap current_file_dir_set;
+	struct hashmap current_file_dir_set; /* paths made by unique_path() */
+	struct tree *merged_trees[2]; /* head and merge of merge_trees() */
 	struct string_list df_conflict_file_set;
+	struct string_list worktree_updates; /* with in_memory */
 	struct unpack_trees_options unpack_opts;
 	struct index_state orig_index;
 	struct repository *repo;
@@ -70,7 +75,13 @@ static inline int merge_detect_rename(struct merge_options *o)
 		o->diff_detect_rename >= 0 ? o->diff_detect_rename : 1;
 }
 
-/* merge_trees() but with recursive ancestor consolidation */
+/*
+ * merge_trees() but with recursive ancestor consolidation
+ *
+ * With o->no_worktree, the merge starts from the tree of h1 instead of
+ * the index, never looks at the working tree, and leaves the tree the
+ * working tree would have after it in "result", conflicts and all.
+ */
 int merge_recursive(struct merge_options *o,
 		    struct commit *h1,
 		    struct commit *h2,
@@ -10,20 +10,29 @@
 #include "progress.h"
 #include "trace2.h"
 #include "run-command.h"
+#include "refs.h"
+#include "revision.h"
+#include "tag.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
+#include "thread-utils.h"
+#include "radix-sort.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
 #define MIDX_BYTE_FILE_VERSION 4
 #define MIDX_BYTE_HASH_VERSION 5
 #define MIDX_BYTE_NUM_CHUNKS 6
+#define MIDX_BYTE_NUM_BASE_LAYERS 7
 #define MIDX_BYTE_NUM_PACKS 8
 #define MIDX_HASH_VERSION 1
 #define MIDX_HEADER_SIZE 12
 #define MIDX_HASH_LEN 20
 #define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_HASH_LEN)
 
-#define MIDX_MAX_CHUNKS 5
+#define MIDX_MAX_CHUNKS 6
 #define MIDX_CHUNK_ALIGNMENT 4
+#define MIDX_CHUNKID_BASELAYERS 0x42415345 /* "BASE" */
 #define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
 #define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
@@ -42,7 +51,38 @@ static char *get_midx_filename(const char *object_dir)
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
-struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+static char *get_midx_chain_dirname(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d", object_dir);
+}
+
+static char *get_midx_chain_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-chain",
+		       object_dir);
+}
+
+static char *get_split_midx_filename(const char *object_dir,
+				     const char *hash_hex)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-%s.midx",
+		       object_dir, hash_hex);
+}
+
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - m->hash_len;
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap",
+		       m->object_dir, hash_to_hex(get_midx_checksum(m)));
+}
+
+static struct multi_pack_index *load_multi_pack_index_one(const char *midx_name,
+							  const char *object_dir,
+							  int local)
 {
 	struct multi_pack_index *m = NULL;
 	int fd;
@@ -50,7 +90,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	size_t midx_size;
 	void *midx_map = NULL;
 	uint32_t hash_version;
-	char *midx_name = get_midx_filename(object_dir);
 	uint32_t i;
 	const char *cur_pack_name;
 
@@ -70,8 +109,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 		goto cleanup_fail;
 	}
 
-	FREE_AND_NULL(midx_name);
-
 	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
 	FLEX_ALLOC_STR(m, object_dir, object_dir);
@@ -96,6 +133,7 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	m->hash_len = MIDX_HASH_LEN;
 
 	m->num_chunks = m->data[MIDX_BYTE_NUM_CHUNKS];
+	m->num_base_layers = m->data[MIDX_BYTE_NUM_BASE_LAYERS];
 
 	m->num_packs = get_be32(m->data + MIDX_BYTE_NUM_PACKS);
 
@@ -129,6 +167,10 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 				m->chunk_large_offsets = m->data + chunk_offset;
 				break;
 
+			case MIDX_CHUNKID_BASELAYERS:
+				m->chunk_base_layers = m->data + chunk_offset;
+				break;
+
 			case 0:
 				die(_("terminating multi-pack-index chunk id appears earlier than expected"));
 				break;
@@ -175,7 +217,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 cleanup_fail:
 	free(m);
-	free(midx_name);
 	if (midx_map)
 		munmap(midx_map, midx_size);
 	if (0 <= fd)
@@ -183,14 +224,126 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	return NULL;
 }
 
+static int add_midx_to_chain(struct multi_pack_index *m,
+			     struct multi_pack_index *chain,
+			     struct object_id *oids,
+			     int n)
+{
+	struct multi_pack_index *cur_m = chain;
+
+	if (!hasheq(oids[n].hash, get_midx_checksum(m))) {
+		warning(_("multi-pack-index layer %s has a different checksum"),
+			oid_to_hex(&oids[n]));
+		return 0;
+	}
+
+	if (n && !m->chunk_base_layers) {
+		warning(_("multi-pack-index has no base layers chunk"));
+		return 0;
+	}
+
+	if (m->num_base_layers != n) {
+		warning(_("multi-pack-index chain does not match"));
+		return 0;
+	}
+
+	while (n) {
+		n--;
+
+		if (!cur_m ||
+		    !hasheq(oids[n].hash, get_midx_checksum(cur_m)) ||
+		    !hasheq(oids[n].hash, m->chunk_base_layers + m->hash_len * n)) {
+			warning(_("multi-pack-index chain does not match"));
+			return 0;
+		}
+
+		cur_m = cur_m->base_midx;
+	}
+
+	m->base_midx = chain;
+	return 1;
+}
+
+/*
+ * Load the layers listed in the chain file, oldest first, and return
+ * the newest one. If a layer is missing or does not fit onto the ones
+ * below it, stop there; the packs of the layers above it are then
+ * simply not covered by the MIDX.
+ */
+static struct multi_pack_index *load_midx_chain(const char *object_dir,
+						int local)
+{
+	struct multi_pack_index *chain = NULL;
+	struct strbuf line = STRBUF_INIT;
+	struct object_id *oids = NULL;
+	int nr = 0, alloc = 0;
+	char *chain_name = get_midx_chain_filename(object_dir);
+	FILE *fp;
+
+	fp = fopen(chain_name, "r");
+	free(chain_name);
+	if (!fp)
+		return NULL;
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct multi_pack_index *m;
+		char *midx_name;
+
+		ALLOC_GROW(oids, nr + 1, alloc);
+		if (get_oid_hex(line.buf, &oids[nr])) {
+			warning(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				line.buf);
+			break;
+		}
+
+		midx_name = get_split_midx_filename(object_dir, line.buf);
+		m = load_multi_pack_index_one(midx_name, object_dir, local);
+		free(midx_name);
+
+		if (!m) {
+			warning(_("unable to find all multi-pack-index files"));
+			break;
+		}
+		if (!add_midx_to_chain(m, chain, oids, nr)) {
+			close_midx(m);
+			free(m);
+			break;
+		}
+
+		chain = m;
+		nr++;
+	}
+
+	free(oids);
+	fclose(fp);
+	strbuf_release(&line);
+	return chain;
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	char *midx_name = get_midx_filename(object_dir);
+	struct multi_pack_index *m;
+
+	m = load_multi_pack_index_one(midx_name, object_dir, local);
+	free(midx_name);
+
+	if (!m)
+		m = load_midx_chain(object_dir, local);
+	return m;
+}
+
 void close_midx(struct multi_pack_index *m)
 {
 	uint32_t i;
 
-	if (!m)
+	if (!m || !m->data)
 		return;
 
+	close_midx(m->base_midx);
+
 	munmap((unsigned char *)m->data, m->data_len);
+	m->data = NULL;
 	close(m->fd);
 	m->fd = -1;
 
@@ -202,10 +355,31 @@ void close_midx(struct multi_pack_index *m)
 	FREE_AND_NULL(m->pack_names);
 }
 
+/*
+ * The packs of alternates that a multi-pack-index covers are listed by
+ * their absolute path, its own packs by their name in "pack/".
+ */
+static int is_alternate_pack_name(const char *pack_name)
+{
+	return is_absolute_path(pack_name);
+}
+
+static void midx_pack_path(struct strbuf *buf, struct multi_pack_index *m,
+			   uint32_t pack_int_id)
+{
+	const char *name = m->pack_names[pack_int_id];
+
+	if (is_alternate_pack_name(name))
+		strbuf_addstr(buf, name);
+	else
+		strbuf_addf(buf, "%s/pack/%s", m->object_dir, name);
+}
+
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id)
 {
 	struct strbuf pack_name = STRBUF_INIT;
 	struct packed_git *p;
+	int local;
 
 	if (pack_int_id >= m->num_packs)
 		die(_("bad pack-int-id: %u (%u total packs)"),
@@ -214,10 +388,10 @@ int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t
 	if (m->packs[pack_int_id])
 		return 0;
 
-	strbuf_addf(&pack_name, "%s/pack/%s", m->object_dir,
-		    m->pack_names[pack_int_id]);
+	midx_pack_path(&pack_name, m, pack_int_id);
+	local = m->local && !is_alternate_pack_name(m->pack_names[pack_int_id]);
 
-	p = add_packed_git(pack_name.buf, pack_name.len, m->local);
+	p = add_packed_git(pack_name.buf, pack_name.len, local);
 	strbuf_release(&pack_name);
 
 	if (!p)
@@ -248,7 +422,7 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 	return oid;
 }
 
-static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 {
 	const unsigned char *offset_data;
 	uint32_t offset32;
@@ -267,11 +441,82 @@ static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	return offset32;
 }
 
-static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
 	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
 
+struct midx_pack_order_data {
+	uint32_t nr;
+	uint32_t pack;
+	off_t offset;
+};
+
+static int midx_pack_order_cmp(const void *va, const void *vb)
+{
+	const struct midx_pack_order_data *a = va, *b = vb;
+
+	if (a->pack != b->pack)
+		return a->pack < b->pack ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+uint32_t *midx_pack_order(struct multi_pack_index *m)
+{
+	struct midx_pack_order_data *data;
+	uint32_t *order;
+	uint32_t i;
+
+	ALLOC_ARRAY(data, m->num_objects);
+	for (i = 0; i < m->num_objects; i++) {
+		data[i].nr = i;
+		data[i].pack = nth_midxed_pack_int_id(m, i);
+		data[i].offset = nth_midxed_offset(m, i);
+	}
+
+	QSORT(data, m->num_objects, midx_pack_order_cmp);
+
+	ALLOC_ARRAY(order, m->num_objects);
+	for (i = 0; i < m->num_objects; i++)
+		order[i] = data[i].nr;
+
+	free(data);
+	return order;
+}
+
+int midx_to_pack_pos(struct multi_pack_index *m, const uint32_t *order,
+		     uint32_t midx_pos, uint32_t *pos)
+{
+	uint32_t lo = 0, hi = m->num_objects;
+	struct midx_pack_order_data want;
+
+	want.pack = nth_midxed_pack_int_id(m, midx_pos);
+	want.offset = nth_midxed_offset(m, midx_pos);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		struct midx_pack_order_data cur;
+		int cmp;
+
+		cur.pack = nth_midxed_pack_int_id(m, order[mi]);
+		cur.offset = nth_midxed_offset(m, order[mi]);
+
+		cmp = midx_pack_order_cmp(&want, &cur);
+		if (!cmp) {
+			*pos = mi;
+			return 0;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	return -1;
+}
+
 static int nth_midxed_pack_entry(struct repository *r,
 				 struct multi_pack_index *m,
 				 struct pack_entry *e,
@@ -405,7 +650,14 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 	m = load_multi_pack_index(object_dir, local);
 
 	if (m) {
-		m->next = r->objects->multi_pack_index;
+		struct multi_pack_index *base = m;
+
+		/* the layers of a chain are looked at newest first */
+		while (base->base_midx) {
+			base->next = base->base_midx;
+			base = base->base_midx;
+		}
+		base->next = r->objects->multi_pack_index;
 		r->objects->multi_pack_index = m;
 		return 1;
 	}
@@ -415,6 +667,7 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 
 static size_t write_midx_header(struct hashfile *f,
 				unsigned char num_chunks,
+				unsigned char num_base_layers,
 				uint32_t num_packs)
 {
 	unsigned char byte_values[4];
@@ -423,7 +676,7 @@ static size_t write_midx_header(struct hashfile *f,
 	byte_values[0] = MIDX_VERSION;
 	byte_values[1] = MIDX_HASH_VERSION;
 	byte_values[2] = num_chunks;
-	byte_values[3] = 0; /* unused */
+	byte_values[3] = num_base_layers;
 	hashwrite(f, byte_values, sizeof(byte_values));
 	hashwrite_be32(f, num_packs);
 
@@ -449,8 +702,49 @@ struct pack_list {
 	uint32_t nr;
 	uint32_t alloc;
 	struct multi_pack_index *m;
+	/* packs covered by these layers are skipped as well */
+	struct multi_pack_index *layers;
 };
 
+static int midx_layers_contain_pack(struct multi_pack_index *m,
+				    const char *file_name)
+{
+	for (; m; m = m->base_midx)
+		if (midx_contains_pack(m, file_name))
+			return 1;
+	return 0;
+}
+
+static void add_pack_info(struct pack_list *packs,
+			  const char *full_path, size_t full_path_len,
+			  const char *pack_name)
+{
+	ALLOC_GROW(packs->info, packs->nr + 1, packs->alloc);
+
+	packs->info[packs->nr].p = add_packed_git(full_path,
+						  full_path_len,
+						  0);
+
+	if (!packs->info[packs->nr].p) {
+		warning(_("failed to add packfile '%s'"),
+			full_path);
+		return;
+	}
+
+	if (open_pack_index(packs->info[packs->nr].p)) {
+		warning(_("failed to open pack-index '%s'"),
+			full_path);
+		close_pack(packs->info[packs->nr].p);
+		FREE_AND_NULL(packs->info[packs->nr].p);
+		return;
+	}
+
+	packs->info[packs->nr].pack_name = xstrdup(pack_name);
+	packs->info[packs->nr].orig_pack_int_id = packs->nr;
+	packs->info[packs->nr].expired = 0;
+	packs->nr++;
+}
+
 static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 			     const char *file_name, void *data)
 {
@@ -459,32 +753,42 @@ static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 	if (ends_with(file_name, ".idx")) {
 		if (packs->m && midx_contains_pack(packs->m, file_name))
 			return;
+		if (midx_layers_contain_pack(packs->layers, file_name))
+			return;
 
-		ALLOC_GROW(packs->info, packs->nr + 1, packs->alloc);
-
-		packs->info[packs->nr].p = add_packed_git(full_path,
-							  full_path_len,
-							  0);
+		add_pack_info(packs, full_path, full_path_len, file_name);
+	}
+}
 
-		if (!packs->info[packs->nr].p) {
-			warning(_("failed to add packfile '%s'"),
-				full_path);
-			return;
-		}
+static void add_alternate_pack_to_midx(const char *full_path,
+				       size_t full_path_len,
+				       const char *file_name, void *data)
+{
+	if (ends_with(file_name, ".idx")) {
+		char *path = absolute_pathdup(full_path);
 
-		if (open_pack_index(packs->info[packs->nr].p)) {
-			warning(_("failed to open pack-index '%s'"),
-				full_path);
-			close_pack(packs->info[packs->nr].p);
-			FREE_AND_NULL(packs->info[packs->nr].p);
-			return;
-		}
+		add_pack_info(data, path, strlen(path), path);
+		free(path);
+	}
+}
 
-		packs->info[packs->nr].pack_name = xstrdup(file_name);
-		packs->info[packs->nr].orig_pack_int_id = packs->nr;
-		packs->info[packs->nr].expired = 0;
-		packs->nr++;
+/* Add the packs of the alternates of "object_dir". */
+static void add_alternate_packs(const char *object_dir, struct pack_list *packs)
+{
+	struct object_directory *odb;
+	char *self = real_pathdup(object_dir, 0);
+
+	prepare_alt_odb(the_repository);
+	for (odb = the_repository->objects->odb; odb; odb = odb->next) {
+		char *path = real_pathdup(odb->path, 0);
+
+		if (path && (!self || fspathcmp(path, self)))
+			for_each_file_in_pack_dir(odb->path,
+						  add_alternate_pack_to_midx,
+						  packs);
+		free(path);
 	}
+	free(self);
 }
 
 struct pack_midx_entry {
@@ -511,6 +815,11 @@ static int midx_oid_compare(const void *_a, const void *_b)
 	return a->pack_int_id - b->pack_int_id;
 }
 
+static const unsigned char *midx_entry_hash(const void *e)
+{
+	return ((const struct pack_midx_entry *)e)->oid.hash;
+}
+
 static int nth_midxed_pack_midx_entry(struct multi_pack_index *m,
 				      struct pack_midx_entry *e,
 				      uint32_t pos)
@@ -610,7 +919,8 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 			}
 		}
 
-		QSORT(entries_by_fanout, nr_fanout, midx_oid_compare);
+		RADIX_SORT_BY_HASH(entries_by_fanout, nr_fanout,
+				   midx_entry_hash, midx_oid_compare);
 
 		/*
 		 * The batch is now sorted by OID and then mtime (descending).
@@ -785,61 +1095,194 @@ static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_off
 	return written;
 }
 
-static int write_midx_internal(const char *object_dir, struct multi_pack_index *m,
-			       struct string_list *packs_to_drop)
+static int add_ref_to_pending(const char *refname,
+			      const struct object_id *oid,
+			      int flag, void *cb_data)
 {
-	unsigned char cur_chunk, num_chunks = 0;
-	char *midx_name;
-	uint32_t i;
-	struct hashfile *f = NULL;
-	struct lock_file lk;
-	struct pack_list packs;
-	uint32_t *pack_perm = NULL;
-	uint64_t written = 0;
-	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
-	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
-	uint32_t nr_entries, num_large_offsets = 0;
-	struct pack_midx_entry *entries = NULL;
-	int large_offsets_needed = 0;
-	int pack_name_concat_len = 0;
-	int dropped_packs = 0;
-	int result = 0;
+	struct rev_info *revs = cb_data;
+	struct object *object = parse_object(the_repository, oid);
 
-	midx_name = get_midx_filename(object_dir);
-	if (safe_create_leading_directories(midx_name)) {
-		UNLEAK(midx_name);
-		die_errno(_("unable to create leading directories of %s"),
-			  midx_name);
+	if (object)
+		object = deref_tag(the_repository, object, refname, 0);
+	if (object && object->type == OBJ_COMMIT)
+		add_pending_object(revs, object, "");
+	return 0;
+}
+
+/*
+ * Collect the commits reachable from any ref that are contained in
+ * 'pdata'; these are the candidates for receiving a bitmap.
+ */
+static struct commit **find_commits_for_midx_bitmap(struct packing_data *pdata,
+						    uint32_t *nr)
+{
+	struct rev_info revs;
+	struct commit *c;
+	struct commit **commits = NULL;
+	uint32_t alloc = 0;
+
+	*nr = 0;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	head_ref(add_ref_to_pending, &revs);
+	for_each_ref(add_ref_to_pending, &revs);
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+
+	while ((c = get_revision(&revs))) {
+		if (!packlist_find(pdata, &c->object.oid, NULL))
+			continue;
+		ALLOC_GROW(commits, *nr + 1, alloc);
+		commits[(*nr)++] = c;
 	}
 
-	if (m)
-		packs.m = m;
-	else
-		packs.m = load_multi_pack_index(object_dir, 1);
+	return commits;
+}
 
-	packs.nr = 0;
-	packs.alloc = packs.m ? packs.m->num_packs : 16;
-	packs.info = NULL;
-	ALLOC_ARRAY(packs.info, packs.alloc);
+static int write_midx_bitmap(struct multi_pack_index *m)
+{
+	struct packing_data pdata;
+	struct pack_idx_entry **index, **pseudo;
+	struct commit **commits;
+	unsigned char checksum[GIT_MAX_RAWSZ];
+	uint32_t *order;
+	uint32_t i, commits_nr;
+	char *bitmap_name;
+	uint16_t options = BITMAP_OPT_HASH_CACHE;
+	int lookup_table, name_hash_version;
+
+	if (!repo_config_get_bool(the_repository, "pack.writebitmaplookuptable",
+				  &lookup_table) && lookup_table)
+		options |= BITMAP_OPT_LOOKUP_TABLE;
+	if (repo_config_get_int(the_repository, "pack.namehashversion",
+				&name_hash_version))
+		name_hash_version = 1;
+	if (name_hash_version != 1 && name_hash_version != 2)
+		die(_("unsupported name-hash version %d"), name_hash_version);
+
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(the_repository, &pdata);
 
-	if (packs.m) {
-		for (i = 0; i < packs.m->num_packs; i++) {
-			ALLOC_GROW(packs.info, packs.nr + 1, packs.alloc);
+	for (i = 0; i < m->num_objects; i++) {
+		struct object_id oid;
+		uint32_t index_pos = 0;
 
-			packs.info[packs.nr].orig_pack_int_id = i;
-			packs.info[packs.nr].pack_name = xstrdup(packs.m->pack_names[i]);
-			packs.info[packs.nr].p = NULL;
-			packs.info[packs.nr].expired = 0;
-			packs.nr++;
-		}
+		nth_midxed_object_oid(&oid, m, i);
+		packlist_find(&pdata, &oid, &index_pos);
+		packlist_alloc(&pdata, oid.hash, index_pos);
 	}
 
-	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
+	/*
+	 * The entries were allocated in the MIDX's lexicographic order, so
+	 * 'index' is the order of the .idx-like part of the bitmap (commit
+	 * positions, name-hash cache), while the bits themselves follow the
+	 * pseudo-pack order.
+	 */
+	order = midx_pack_order(m);
+	ALLOC_ARRAY(index, m->num_objects);
+	ALLOC_ARRAY(pseudo, m->num_objects);
+	for (i = 0; i < m->num_objects; i++) {
+		index[i] = &pdata.objects[i].idx;
+		pseudo[i] = &pdata.objects[order[i]].idx;
+	}
 
-	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop)
-		goto cleanup;
+	commits = find_commits_for_midx_bitmap(&pdata, &commits_nr);
+
+	hashcpy(checksum, get_midx_checksum(m));
+	bitmap_name = get_midx_bitmap_filename(m);
+
+	bitmap_writer_show_progress(0);
+	bitmap_writer_set_name_hash_version(name_hash_version);
+	bitmap_writer_build_type_index(&pdata, pseudo, m->num_objects);
+	bitmap_writer_select_commits(commits, commits_nr, -1);
+	bitmap_writer_build(&pdata);
+	bitmap_writer_set_checksum(checksum);
+	bitmap_writer_finish(index, m->num_objects, bitmap_name, options);
+
+	free(bitmap_name);
+	free(commits);
+	free(pseudo);
+	free(index);
+	free(order);
+	free(pdata.in_pack_pos);
+	free(pdata.index);
+	free(pdata.objects);
+	return 0;
+}
 
-	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries);
+struct clear_midx_data {
+	char *keep;
+};
+
+static void clear_midx_bitmap(const char *full_path, size_t full_path_len,
+			      const char *file_name, void *_data)
+{
+	struct clear_midx_data *d = _data;
+
+	if (!starts_with(file_name, "multi-pack-index-") ||
+	    !ends_with(file_name, ".bitmap"))
+		return;
+	if (d->keep && !strcmp(d->keep, file_name))
+		return;
+
+	if (unlink(full_path))
+		die_errno(_("failed to remove %s"), full_path);
+}
+
+/*
+ * Remove all multi-pack-index bitmaps in 'object_dir', except for the one
+ * belonging to the multi-pack-index whose checksum is 'keep_hash', if any.
+ */
+static void clear_midx_bitmaps(const char *object_dir,
+			       const unsigned char *keep_hash)
+{
+	struct clear_midx_data data;
+
+	data.keep = keep_hash ?
+		xstrfmt("multi-pack-index-%s.bitmap", hash_to_hex(keep_hash)) :
+		NULL;
+
+	for_each_file_in_pack_dir(object_dir, clear_midx_bitmap, &data);
+
+	free(data.keep);
+}
+
+/* Write the checksums of 'm' and the layers below it, oldest first. */
+static size_t write_midx_base_layers(struct hashfile *f,
+				     struct multi_pack_index *m)
+{
+	size_t written;
+
+	if (!m)
+		return 0;
+
+	written = write_midx_base_layers(f, m->base_midx);
+	hashwrite(f, get_midx_checksum(m), MIDX_HASH_LEN);
+	return written + MIDX_HASH_LEN;
+}
+
+/*
+ * Write the header and all chunks of a MIDX covering the packs in
+ * 'info' that are not expired. If 'base' is given, the new MIDX is a
+ * layer on top of it in an incremental chain.
+ */
+static void write_midx_chunks(struct hashfile *f,
+			      struct pack_info *info, uint32_t nr_packs,
+			      uint32_t nr_written_packs,
+			      uint32_t *pack_perm,
+			      struct pack_midx_entry *entries,
+			      uint32_t nr_entries,
+			      struct multi_pack_index *base)
+{
+	unsigned char cur_chunk, num_chunks;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	uint32_t i, num_large_offsets = 0, num_base_layers = 0;
+	int large_offsets_needed = 0;
+	int pack_name_concat_len = 0;
+	struct multi_pack_index *m;
+	uint64_t written;
 
 	for (i = 0; i < nr_entries; i++) {
 		if (entries[i].offset > 0x7fffffff)
@@ -848,72 +1291,26 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 			large_offsets_needed = 1;
 	}
 
-	QSORT(packs.info, packs.nr, pack_info_compare);
+	for (i = 0; i < nr_packs; i++) {
+		if (!info[i].expired)
+			pack_name_concat_len += strlen(info[i].pack_name) + 1;
+	}
 
-	if (packs_to_drop && packs_to_drop->nr) {
-		int drop_index = 0;
-		int missing_drops = 0;
+	if (pack_name_concat_len % MIDX_CHUNK_ALIGNMENT)
+		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
+					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
-		for (i = 0; i < packs.nr && drop_index < packs_to_drop->nr; i++) {
-			int cmp = strcmp(packs.info[i].pack_name,
-					 packs_to_drop->items[drop_index].string);
-
-			if (!cmp) {
-				drop_index++;
-				packs.info[i].expired = 1;
-			} else if (cmp > 0) {
-				error(_("did not see pack-file %s to drop"),
-				      packs_to_drop->items[drop_index].string);
-				drop_index++;
-				missing_drops++;
-				i--;
-			} else {
-				packs.info[i].expired = 0;
-			}
-		}
-
-		if (missing_drops) {
-			result = 1;
-			goto cleanup;
-		}
-	}
-
-	/*
-	 * pack_perm stores a permutation between pack-int-ids from the
-	 * previous multi-pack-index to the new one we are writing:
-	 *
-	 * pack_perm[old_id] = new_id
-	 */
-	ALLOC_ARRAY(pack_perm, packs.nr);
-	for (i = 0; i < packs.nr; i++) {
-		if (packs.info[i].expired) {
-			dropped_packs++;
-			pack_perm[packs.info[i].orig_pack_int_id] = PACK_EXPIRED;
-		} else {
-			pack_perm[packs.info[i].orig_pack_int_id] = i - dropped_packs;
-		}
-	}
-
-	for (i = 0; i < packs.nr; i++) {
-		if (!packs.info[i].expired)
-			pack_name_concat_len += strlen(packs.info[i].pack_name) + 1;
-	}
-
-	if (pack_name_concat_len % MIDX_CHUNK_ALIGNMENT)
-		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
-					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
-
-	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
-	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
-	FREE_AND_NULL(midx_name);
-
-	if (packs.m)
-		close_midx(packs.m);
+	for (m = base; m; m = m->base_midx)
+		num_base_layers++;
+	if (num_base_layers > 255)
+		BUG("too many multi-pack-index base layers: %"PRIu32,
+		    num_base_layers);
 
 	cur_chunk = 0;
-	num_chunks = large_offsets_needed ? 5 : 4;
+	num_chunks = 4 + !!large_offsets_needed + !!num_base_layers;
 
-	written = write_midx_header(f, num_chunks, packs.nr - dropped_packs);
+	written = write_midx_header(f, num_chunks, num_base_layers,
+				    nr_written_packs);
 
 	chunk_ids[cur_chunk] = MIDX_CHUNKID_PACKNAMES;
 	chunk_offsets[cur_chunk] = written + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
@@ -939,6 +1336,13 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
 					   num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
 	}
+	if (num_base_layers) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_BASELAYERS;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   num_base_layers * MIDX_HASH_LEN;
+	}
 
 	chunk_ids[cur_chunk] = 0;
 
@@ -968,7 +1372,7 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 
 		switch (chunk_ids[i]) {
 			case MIDX_CHUNKID_PACKNAMES:
-				written += write_midx_pack_names(f, packs.info, packs.nr);
+				written += write_midx_pack_names(f, info, nr_packs);
 				break;
 
 			case MIDX_CHUNKID_OIDFANOUT:
@@ -987,6 +1391,10 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 				written += write_midx_large_offsets(f, num_large_offsets, entries, nr_entries);
 				break;
 
+			case MIDX_CHUNKID_BASELAYERS:
+				written += write_midx_base_layers(f, base);
+				break;
+
 			default:
 				BUG("trying to write unknown chunk id %"PRIx32,
 				    chunk_ids[i]);
@@ -997,10 +1405,405 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		BUG("incorrect final offset %"PRIu64" != %"PRIu64,
 		    written,
 		    chunk_offsets[num_chunks]);
+}
+
+/*
+ * Remove the layers of the incremental chain in 'object_dir' that are
+ * not listed in 'keep', or the whole chain if 'keep' is NULL.
+ */
+static void clear_midx_layers(const char *object_dir,
+			      const struct string_list *keep)
+{
+	char *dir_name = get_midx_chain_dirname(object_dir);
+	struct strbuf path = STRBUF_INIT;
+	DIR *dir;
+	struct dirent *de;
+	size_t dirnamelen;
+
+	dir = opendir(dir_name);
+	if (!dir) {
+		free(dir_name);
+		return;
+	}
+
+	strbuf_addf(&path, "%s/", dir_name);
+	dirnamelen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		if (!starts_with(de->d_name, "multi-pack-index-") ||
+		    !ends_with(de->d_name, ".midx"))
+			continue;
+		if (keep && string_list_has_string(keep, de->d_name))
+			continue;
+
+		strbuf_setlen(&path, dirnamelen);
+		strbuf_addstr(&path, de->d_name);
+		unlink_or_warn(path.buf);
+	}
+	closedir(dir);
 
-	finalize_hashfile(f, NULL, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	if (!keep) {
+		char *chain_name = get_midx_chain_filename(object_dir);
+
+		unlink(chain_name);
+		free(chain_name);
+		rmdir(dir_name);
+	}
+
+	strbuf_release(&path);
+	free(dir_name);
+}
+
+static void write_midx_chain_layers(FILE *fp, struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+
+	write_midx_chain_layers(fp, m->base_midx);
+	fprintf(fp, "%s\n", hash_to_hex(get_midx_checksum(m)));
+}
+
+static void add_midx_layer_packs(struct pack_list *packs,
+				 struct multi_pack_index *m)
+{
+	struct strbuf path = STRBUF_INIT;
+	uint32_t i;
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+
+		strbuf_reset(&path);
+		midx_pack_path(&path, m, i);
+
+		p = add_packed_git(path.buf, path.len, 0);
+		if (!p) {
+			warning(_("failed to add packfile '%s'"), path.buf);
+			continue;
+		}
+		if (open_pack_index(p)) {
+			warning(_("failed to open pack-index '%s'"), path.buf);
+			close_pack(p);
+			free(p);
+			continue;
+		}
+
+		ALLOC_GROW(packs->info, packs->nr + 1, packs->alloc);
+		packs->info[packs->nr].p = p;
+		packs->info[packs->nr].pack_name = xstrdup(m->pack_names[i]);
+		packs->info[packs->nr].orig_pack_int_id = packs->nr;
+		packs->info[packs->nr].expired = 0;
+		packs->nr++;
+	}
+
+	strbuf_release(&path);
+}
+
+/*
+ * Add a layer for the packs that are not covered by the existing MIDX
+ * or chain of MIDX layers yet. Like a split commit-graph, the new layer
+ * absorbs the layers below it as long as they are not more than
+ * 'size_multiple' times as large, so that the chain stays short while
+ * most writes only look at a few small packs.
+ */
+static int write_midx_incremental(const char *object_dir,
+				  const struct split_midx_opts *split_opts)
+{
+	struct lock_file midx_lk = LOCK_INIT, chain_lk = LOCK_INIT;
+	struct multi_pack_index *layers, *new_base, *m;
+	struct string_list keep = STRING_LIST_INIT_NODUP;
+	struct pack_list packs;
+	struct pack_midx_entry *entries = NULL;
+	uint32_t *pack_perm = NULL;
+	uint32_t i, nr_entries;
+	uint64_t nr_objects = 0;
+	int size_multiple = 2;
+	int from_single_file = 0;
+	int result = 0;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
+	char *midx_name = get_midx_filename(object_dir);
+	char *chain_name = get_midx_chain_filename(object_dir);
+	struct strbuf tmp_name = STRBUF_INIT;
+	struct hashfile *f;
+	FILE *chainf;
+	int fd;
+
+	if (split_opts && split_opts->size_multiple)
+		size_multiple = split_opts->size_multiple;
+
+	if (safe_create_leading_directories(chain_name))
+		die_errno(_("unable to create leading directories of %s"),
+			  chain_name);
+
+	/* keep out writers of both the single MIDX and the chain */
+	hold_lock_file_for_update(&midx_lk, midx_name, LOCK_DIE_ON_ERROR);
+	hold_lock_file_for_update(&chain_lk, chain_name, LOCK_DIE_ON_ERROR);
+
+	layers = load_multi_pack_index_one(midx_name, object_dir, 1);
+	if (layers)
+		from_single_file = 1;
+	else
+		layers = load_midx_chain(object_dir, 1);
+
+	memset(&packs, 0, sizeof(packs));
+	packs.layers = layers;
+	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
+
+	if (!packs.nr) {
+		rollback_lock_file(&chain_lk);
+		rollback_lock_file(&midx_lk);
+		goto cleanup;
+	}
+
+	for (i = 0; i < packs.nr; i++)
+		nr_objects += packs.info[i].p->num_objects;
+
+	for (new_base = layers;
+	     new_base && new_base->num_objects <= size_multiple * nr_objects;
+	     new_base = new_base->base_midx) {
+		nr_objects += new_base->num_objects;
+		add_midx_layer_packs(&packs, new_base);
+	}
+
+	entries = get_sorted_entries(NULL, packs.info, packs.nr, &nr_entries);
+
+	QSORT(packs.info, packs.nr, pack_info_compare);
+	ALLOC_ARRAY(pack_perm, packs.nr);
+	for (i = 0; i < packs.nr; i++)
+		pack_perm[packs.info[i].orig_pack_int_id] = i;
+
+	strbuf_addf(&tmp_name, "%s/pack/multi-pack-index.d/tmp_midx_XXXXXX",
+		    object_dir);
+	fd = git_mkstemp_mode(tmp_name.buf, 0444);
+	if (fd < 0) {
+		result = error_errno(_("unable to create '%s'"), tmp_name.buf);
+		rollback_lock_file(&chain_lk);
+		rollback_lock_file(&midx_lk);
+		goto cleanup;
+	}
+	f = hashfd(fd, tmp_name.buf);
+
+	write_midx_chunks(f, packs.info, packs.nr, packs.nr, pack_perm,
+			  entries, nr_entries, new_base);
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	close(fd);
+
+	for (m = new_base; m; m = m->base_midx)
+		string_list_insert(&keep, xstrfmt("multi-pack-index-%s.midx",
+					hash_to_hex(get_midx_checksum(m))));
+	if (from_single_file && new_base) {
+		/* the single MIDX becomes the bottom layer of the chain */
+		char *dest = get_split_midx_filename(object_dir,
+				hash_to_hex(get_midx_checksum(layers)));
+
+		if (rename(midx_name, dest))
+			result = error_errno(_("failed to rename %s"), midx_name);
+		free(dest);
+	}
+
+	if (!result) {
+		char *dest = get_split_midx_filename(object_dir,
+						     hash_to_hex(midx_hash));
+
+		if (rename(tmp_name.buf, dest))
+			result = error_errno(_("failed to rename temporary multi-pack-index file"));
+		free(dest);
+	}
+	if (result) {
+		unlink(tmp_name.buf);
+		rollback_lock_file(&chain_lk);
+		rollback_lock_file(&midx_lk);
+		goto cleanup;
+	}
+	string_list_insert(&keep, xstrfmt("multi-pack-index-%s.midx",
+					  hash_to_hex(midx_hash)));
+
+	chainf = fdopen_lock_file(&chain_lk, "w");
+	if (!chainf) {
+		result = error(_("unable to open multi-pack-index chain file"));
+		rollback_lock_file(&chain_lk);
+		rollback_lock_file(&midx_lk);
+		goto cleanup;
+	}
+	write_midx_chain_layers(chainf, new_base);
+	fprintf(chainf, "%s\n", hash_to_hex(midx_hash));
+
+	close_midx(layers);
+	layers = NULL;
+
+	if (commit_lock_file(&chain_lk) < 0) {
+		result = error_errno(_("unable to write multi-pack-index chain"));
+		rollback_lock_file(&midx_lk);
+		goto cleanup;
+	}
+
+	if (from_single_file && !new_base)
+		unlink_or_warn(midx_name);
+	rollback_lock_file(&midx_lk);
+
+	clear_midx_layers(object_dir, &keep);
+	clear_midx_bitmaps(object_dir, NULL);
+
+cleanup:
+	close_midx(layers);
+	for (i = 0; i < packs.nr; i++) {
+		if (packs.info[i].p) {
+			close_pack(packs.info[i].p);
+			free(packs.info[i].p);
+		}
+		free(packs.info[i].pack_name);
+	}
+	keep.strdup_strings = 1;
+	string_list_clear(&keep, 0);
+	strbuf_release(&tmp_name);
+	free(packs.info);
+	free(entries);
+	free(pack_perm);
+	free(midx_name);
+	free(chain_name);
+	return result;
+}
+
+static int write_midx_internal(const char *object_dir, struct multi_pack_index *m,
+			       struct string_list *packs_to_drop, unsigned flags)
+{
+	char *midx_name;
+	uint32_t i;
+	struct hashfile *f = NULL;
+	struct lock_file lk;
+	struct pack_list packs;
+	uint32_t *pack_perm = NULL;
+	uint32_t nr_entries;
+	struct pack_midx_entry *entries = NULL;
+	int dropped_packs = 0;
+	int result = 0;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
+
+	midx_name = get_midx_filename(object_dir);
+	if (safe_create_leading_directories(midx_name)) {
+		UNLEAK(midx_name);
+		die_errno(_("unable to create leading directories of %s"),
+			  midx_name);
+	}
+
+	memset(&packs, 0, sizeof(packs));
+	if (m)
+		packs.m = m;
+	else if (!(flags & MIDX_WRITE_ALTERNATES))
+		packs.m = load_multi_pack_index_one(midx_name, object_dir, 1);
+
+	packs.nr = 0;
+	packs.alloc = packs.m ? packs.m->num_packs : 16;
+	packs.info = NULL;
+	ALLOC_ARRAY(packs.info, packs.alloc);
+
+	if (packs.m) {
+		for (i = 0; i < packs.m->num_packs; i++) {
+			ALLOC_GROW(packs.info, packs.nr + 1, packs.alloc);
+
+			packs.info[packs.nr].orig_pack_int_id = i;
+			packs.info[packs.nr].pack_name = xstrdup(packs.m->pack_names[i]);
+			packs.info[packs.nr].p = NULL;
+			packs.info[packs.nr].expired = 0;
+			packs.nr++;
+		}
+	}
+
+	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
+	if (flags & MIDX_WRITE_ALTERNATES)
+		add_alternate_packs(object_dir, &packs);
+
+	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop) {
+		if (flags & MIDX_WRITE_BITMAP) {
+			char *bitmap_name = get_midx_bitmap_filename(packs.m);
+			if (!file_exists(bitmap_name))
+				result = write_midx_bitmap(packs.m);
+			free(bitmap_name);
+		}
+		goto cleanup;
+	}
+
+	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries);
+
+	QSORT(packs.info, packs.nr, pack_info_compare);
+
+	if (packs_to_drop && packs_to_drop->nr) {
+		int drop_index = 0;
+		int missing_drops = 0;
+
+		for (i = 0; i < packs.nr && drop_index < packs_to_drop->nr; i++) {
+			int cmp = strcmp(packs.info[i].pack_name,
+					 packs_to_drop->items[drop_index].string);
+
+			if (!cmp) {
+				drop_index++;
+				packs.info[i].expired = 1;
+			} else if (cmp > 0) {
+				error(_("did not see pack-file %s to drop"),
+				      packs_to_drop->items[drop_index].string);
+				drop_index++;
+				missing_drops++;
+				i--;
+			} else {
+				packs.info[i].expired = 0;
+			}
+		}
+
+		if (missing_drops) {
+			result = 1;
+			goto cleanup;
+		}
+	}
+
+	/*
+	 * pack_perm stores a permutation between pack-int-ids from the
+	 * previous multi-pack-index to the new one we are writing:
+	 *
+	 * pack_perm[old_id] = new_id
+	 */
+	ALLOC_ARRAY(pack_perm, packs.nr);
+	for (i = 0; i < packs.nr; i++) {
+		if (packs.info[i].expired) {
+			dropped_packs++;
+			pack_perm[packs.info[i].orig_pack_int_id] = PACK_EXPIRED;
+		} else {
+			pack_perm[packs.info[i].orig_pack_int_id] = i - dropped_packs;
+		}
+	}
+
+	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	FREE_AND_NULL(midx_name);
+
+	if (packs.m)
+		close_midx(packs.m);
+
+	write_midx_chunks(f, packs.info, packs.nr, packs.nr - dropped_packs,
+			  pack_perm, entries, nr_entries, NULL);
+
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
 	commit_lock_file(&lk);
 
+	/* the single MIDX covers all packs, and takes precedence anyway */
+	clear_midx_layers(object_dir, NULL);
+
+	if (flags & MIDX_WRITE_BITMAP) {
+		struct multi_pack_index *written;
+
+		written = load_multi_pack_index(object_dir, 1);
+		if (!written) {
+			result = error(_("could not load multi-pack-index to write bitmap"));
+		} else {
+			result = write_midx_bitmap(written);
+			close_midx(written);
+		}
+	}
+
+	/*
+	 * Bitmaps are tied to the multi-pack-index they were written for;
+	 * any other one is stale now.
+	 */
+	clear_midx_bitmaps(object_dir,
+			   (flags & MIDX_WRITE_BITMAP) && !result ? midx_hash : NULL);
+
 cleanup:
 	for (i = 0; i < packs.nr; i++) {
 		if (packs.info[i].p) {
@@ -1017,9 +1820,19 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	return result;
 }
 
-int write_midx_file(const char *object_dir)
+int write_midx_file(const char *object_dir, unsigned flags,
+		    const struct split_midx_opts *split_opts)
 {
-	return write_midx_internal(object_dir, NULL, NULL);
+	if ((flags & MIDX_WRITE_ALTERNATES) &&
+	    (flags & (MIDX_WRITE_BITMAP | MIDX_WRITE_INCREMENTAL)))
+		return error(_("a multi-pack-index covering alternates can "
+			       "be neither incremental nor have a bitmap"));
+	if (flags & MIDX_WRITE_INCREMENTAL) {
+		if (flags & MIDX_WRITE_BITMAP)
+			return error(_("cannot write a bitmap for an incremental multi-pack-index"));
+		return write_midx_incremental(object_dir, split_opts);
+	}
+	return write_midx_internal(object_dir, NULL, NULL, flags);
 }
 
 void clear_midx_file(struct repository *r)
@@ -1027,7 +1840,10 @@ void clear_midx_file(struct repository *r)
 	char *midx = get_midx_filename(r->objects->odb->path);
 
 	if (r->objects && r->objects->multi_pack_index) {
-		close_midx(r->objects->multi_pack_index);
+		struct multi_pack_index *m;
+
+		for (m = r->objects->multi_pack_index; m; m = m->next)
+			close_midx(m);
 		r->objects->multi_pack_index = NULL;
 	}
 
@@ -1036,6 +1852,9 @@ void clear_midx_file(struct repository *r)
 		die(_("failed to clear multi-pack-index at %s"), midx);
 	}
 
+	clear_midx_bitmaps(r->objects->odb->path, NULL);
+	clear_midx_layers(r->objects->odb->path, NULL);
+
 	free(midx);
 }
 
@@ -1077,16 +1896,178 @@ static int compare_pair_pos_vs_id(const void *_a, const void *_b)
 			display_progress(progress, _n); \
 	} while (0)
 
-int verify_midx_file(struct repository *r, const char *object_dir)
+/*
+ * Check that the multi-pack-index and the index of the pack agree on
+ * where the object at "pos" is. Return -1 if the pack index cannot be
+ * loaded, which ends the check.
+ */
+static int verify_midx_offset(struct repository *r,
+			      struct multi_pack_index *m, uint32_t pos)
 {
-	struct pair_pos_vs_id *pairs = NULL;
+	struct object_id oid;
+	struct pack_entry e;
+	off_t m_offset, p_offset;
+
+	nth_midxed_object_oid(&oid, m, pos);
+
+	if (!fill_midx_entry(r, &oid, &e, m)) {
+		midx_report(_("failed to load pack entry for oid[%d] = %s"),
+			    pos, oid_to_hex(&oid));
+		return 0;
+	}
+
+	if (open_pack_index(e.p)) {
+		midx_report(_("failed to load pack-index for packfile %s"),
+			    e.p->pack_name);
+		return -1;
+	}
+
+	m_offset = e.offset;
+	p_offset = find_pack_entry_one(oid.hash, e.p);
+
+	if (m_offset != p_offset)
+		midx_report(_("incorrect object offset for oid[%d] = %s: %"PRIx64" != %"PRIx64),
+			    pos, oid_to_hex(&oid), m_offset, p_offset);
+	return 0;
+}
+
+/*
+ * The objects of one pack are checked by several threads, in chunks of
+ * this many, once the pack and its index are known to be usable. The
+ * threads only look things up in what is already loaded; the results
+ * are reported in order by the main thread, the same way as
+ * verify_midx_offset() does.
+ */
+#define VERIFY_OFFSETS_CHUNK (1 << 14)
+#define VERIFY_OFFSETS_MIN 1024
+
+struct verify_offset {
+	off_t m_offset, p_offset;
+	unsigned found:1;
+};
+
+struct verify_offsets_thread {
+	pthread_t thread;
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	uint32_t pack_int_id;
+	const struct pair_pos_vs_id *pairs;
+	struct verify_offset *out;
+	uint32_t nr, start, step;
+};
+
+static void *verify_offsets(void *data)
+{
+	struct verify_offsets_thread *t = data;
 	uint32_t i;
-	struct progress *progress;
-	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
-	verify_midx_error = 0;
 
-	if (!m)
+	for (i = t->start; i < t->nr; i += t->step) {
+		struct verify_offset *v = &t->out[i];
+		struct object_id oid;
+		uint32_t pos;
+
+		nth_midxed_object_oid(&oid, t->m, t->pairs[i].pos);
+		/* anything else is left to verify_midx_offset() */
+		v->found = bsearch_midx(&oid, t->m, &pos) &&
+			   nth_midxed_pack_int_id(t->m, pos) == t->pack_int_id;
+		if (!v->found)
+			continue;
+		v->m_offset = nth_midxed_offset(t->m, pos);
+		v->p_offset = find_pack_entry_one(oid.hash, t->p);
+	}
+	return NULL;
+}
+
+/*
+ * Check the objects pairs[start..end), which are all in the same pack.
+ * Return -1 if that should end the check.
+ */
+static int verify_midx_offsets(struct repository *r,
+			       struct multi_pack_index *m,
+			       const struct pair_pos_vs_id *pairs,
+			       uint32_t start, uint32_t end,
+			       int nr_threads, struct progress *progress)
+{
+	uint32_t pack_int_id = pairs[start].pack_int_id;
+	struct verify_offsets_thread *threads;
+	struct verify_offset *out;
+	struct packed_git *p = NULL;
+	uint32_t i;
+	int t;
+
+	if (HAVE_THREADS && nr_threads > 1 &&
+	    end - start >= VERIFY_OFFSETS_MIN &&
+	    !prepare_midx_pack(r, m, pack_int_id)) {
+		p = m->packs[pack_int_id];
+		if (!is_pack_valid(p) || p->num_bad_objects ||
+		    open_pack_index(p))
+			p = NULL;
+	}
+	if (!p) {
+		for (i = start; i < end; i++) {
+			if (verify_midx_offset(r, m, pairs[i].pos))
+				return -1;
+			midx_display_sparse_progress(progress, i + 1);
+		}
 		return 0;
+	}
+
+	CALLOC_ARRAY(threads, nr_threads);
+	ALLOC_ARRAY(out, VERIFY_OFFSETS_CHUNK);
+	for (i = start; i < end; i += VERIFY_OFFSETS_CHUNK) {
+		uint32_t nr = end - i, j;
+
+		if (nr > VERIFY_OFFSETS_CHUNK)
+			nr = VERIFY_OFFSETS_CHUNK;
+		for (t = 0; t < nr_threads; t++) {
+			threads[t].m = m;
+			threads[t].p = p;
+			threads[t].pack_int_id = pack_int_id;
+			threads[t].pairs = pairs + i;
+			threads[t].out = out;
+			threads[t].nr = nr;
+			threads[t].start = t;
+			threads[t].step = nr_threads;
+			if (t && pthread_create(&threads[t].thread, NULL,
+						verify_offsets, &threads[t]))
+				die(_("unable to create thread"));
+		}
+		verify_offsets(&threads[0]);
+		for (t = 1; t < nr_threads; t++)
+			pthread_join(threads[t].thread, NULL);
+
+		for (j = 0; j < nr; j++) {
+			struct verify_offset *v = &out[j];
+			uint32_t pos = pairs[i + j].pos;
+
+			if (!v->found) {
+				if (verify_midx_offset(r, m, pos)) {
+					free(out);
+					free(threads);
+					return -1;
+				}
+			} else if (v->m_offset != v->p_offset) {
+				struct object_id oid;
+
+				nth_midxed_object_oid(&oid, m, pos);
+				midx_report(_("incorrect object offset for oid[%d] = %s: %"PRIx64" != %"PRIx64),
+					    pos, oid_to_hex(&oid),
+					    v->m_offset, v->p_offset);
+			}
+			midx_display_sparse_progress(progress, i + j + 1);
+		}
+	}
+	free(out);
+	free(threads);
+	return 0;
+}
+
+static void verify_midx_layer(struct repository *r, struct multi_pack_index *m,
+			      int nr_threads)
+{
+	struct pair_pos_vs_id *pairs = NULL;
+	uint32_t i;
+	struct progress *progress;
 
 	progress = start_progress(_("Looking for referenced packfiles"),
 				  m->num_packs);
@@ -1142,10 +2123,8 @@ int verify_midx_file(struct repository *r, const char *object_dir)
 	stop_progress(&progress);
 
 	progress = start_sparse_progress(_("Verifying object offsets"), m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
-		struct object_id oid;
-		struct pack_entry e;
-		off_t m_offset, p_offset;
+	for (i = 0; i < m->num_objects; ) {
+		uint32_t end = i + 1;
 
 		if (i > 0 && pairs[i-1].pack_int_id != pairs[i].pack_int_id &&
 		    m->packs[pairs[i-1].pack_int_id])
@@ -1154,32 +2133,27 @@ int verify_midx_file(struct repository *r, const char *object_dir)
 			close_pack_index(m->packs[pairs[i-1].pack_int_id]);
 		}
 
-		nth_midxed_object_oid(&oid, m, pairs[i].pos);
-
-		if (!fill_midx_entry(r, &oid, &e, m)) {
-			midx_report(_("failed to load pack entry for oid[%d] = %s"),
-				    pairs[i].pos, oid_to_hex(&oid));
-			continue;
-		}
-
-		if (open_pack_index(e.p)) {
-			midx_report(_("failed to load pack-index for packfile %s"),
-				    e.p->pack_name);
+		while (end < m->num_objects &&
+		       pairs[end].pack_int_id == pairs[i].pack_int_id)
+			end++;
+		if (verify_midx_offsets(r, m, pairs, i, end, nr_threads,
+					progress))
 			break;
-		}
-
-		m_offset = e.offset;
-		p_offset = find_pack_entry_one(oid.hash, e.p);
-
-		if (m_offset != p_offset)
-			midx_report(_("incorrect object offset for oid[%d] = %s: %"PRIx64" != %"PRIx64),
-				    pairs[i].pos, oid_to_hex(&oid), m_offset, p_offset);
-
-		midx_display_sparse_progress(progress, i + 1);
+		i = end;
 	}
 	stop_progress(&progress);
 
 	free(pairs);
+}
+
+int verify_midx_file(struct repository *r, const char *object_dir,
+		     int nr_threads)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	verify_midx_error = 0;
+
+	for (; m; m = m->base_midx)
+		verify_midx_layer(r, m, nr_threads);
 
 	return verify_midx_error;
 }
@@ -1202,7 +2176,7 @@ int expire_midx_packs(struct repository *r, const char *object_dir)
 	for (i = 0; i < m->num_packs; i++) {
 		char *pack_name;
 
-		if (count[i])
+		if (count[i] || is_alternate_pack_name(m->pack_names[i]))
 			continue;
 
 		if (prepare_midx_pack(r, m, i))
@@ -1222,7 +2196,7 @@ int expire_midx_packs(struct repository *r, const char *object_dir)
 	free(count);
 
 	if (packs_to_drop.nr)
-		result = write_midx_internal(object_dir, m, &packs_to_drop);
+		result = write_midx_internal(object_dir, m, &packs_to_drop, 0);
 
 	string_list_clear(&packs_to_drop, 0);
 	return result;
@@ -1251,12 +2225,16 @@ static int compare_by_mtime(const void *a_, const void *b_)
 static int fill_included_packs_all(struct multi_pack_index *m,
 				   unsigned char *include_pack)
 {
-	uint32_t i;
+	uint32_t i, nr = 0;
 
-	for (i = 0; i < m->num_packs; i++)
+	for (i = 0; i < m->num_packs; i++) {
+		if (is_alternate_pack_name(m->pack_names[i]))
+			continue;
 		include_pack[i] = 1;
+		nr++;
+	}
 
-	return m->num_packs < 2;
+	return nr < 2;
 }
 
 static int fill_included_packs_batch(struct repository *r,
@@ -1291,7 +2269,7 @@ static int fill_included_packs_batch(struct repository *r,
 		struct packed_git *p = m->packs[pack_int_id];
 		size_t expected_size;
 
-		if (!p)
+		if (!p || is_alternate_pack_name(m->pack_names[pack_int_id]))
 			continue;
 		if (open_pack_index(p) || !p->num_objects)
 			continue;
@@ -1371,7 +2349,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size)
 		goto cleanup;
 	}
 
-	result = write_midx_internal(object_dir, m, NULL);
+	result = write_midx_internal(object_dir, m, NULL, 0);
 	m = NULL;
 
 cleanup:
@@ -21,11 +21,19 @@ struct multi_pack_index {
 	unsigned char version;
 	unsigned char hash_len;
 	unsigned char num_chunks;
+	unsigned char num_base_layers;
 	uint32_t num_packs;
 	uint32_t num_objects;
 
 	int local;
 
+	/*
+	 * The next older layer if this MIDX is part of an incremental
+	 * chain. Every layer covers its own set of packs.
+	 */
+	struct multi_pack_index *base_midx;
+
+	const unsigned char *chunk_base_layers;
 	const unsigned char *chunk_pack_names;
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
@@ -37,19 +45,60 @@ struct multi_pack_index {
 	char object_dir[FLEX_ARRAY];
 };
 
+#define MIDX_WRITE_BITMAP (1 << 0)
+#define MIDX_WRITE_INCREMENTAL (1 << 1)
+/* cover the packs of the alternates, too */
+#define MIDX_WRITE_ALTERNATES (1 << 2)
+
+struct split_midx_opts {
+	/*
+	 * Merge the new layer with an existing one as long as the
+	 * latter has at most this many times as many objects.
+	 */
+	int size_multiple;
+};
+
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(struct multi_pack_index *m);
+/*
+ * Load the MIDX of 'object_dir', or the newest layer of its incremental
+ * chain if there is no single MIDX file.
+ */
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
+
+/*
+ * Return the objects of 'm' in "pseudo-pack" order: sorted by the
+ * pack-int-id of the pack each object is selected from, then by its
+ * offset in that pack. The caller must free the result.
+ */
+uint32_t *midx_pack_order(struct multi_pack_index *m);
+
+/*
+ * Find the position of the object with MIDX position 'midx_pos' in
+ * 'order' (as returned by midx_pack_order()). Returns 0 on success.
+ */
+int midx_to_pack_pos(struct multi_pack_index *m, const uint32_t *order,
+		     uint32_t midx_pos, uint32_t *pos);
 int fill_midx_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
-int write_midx_file(const char *object_dir);
+int write_midx_file(const char *object_dir, unsigned flags,
+		    const struct split_midx_opts *split_opts);
 void clear_midx_file(struct repository *r);
-int verify_midx_file(struct repository *r, const char *object_dir);
+/*
+ * Check the multi-pack-index of "object_dir" against the packs it lists,
+ * with the help of up to "nr_threads" threads.
+ */
+int verify_midx_file(struct repository *r, const char *object_dir,
+		     int nr_threads);
 int expire_midx_packs(struct repository *r, const char *object_dir);
 int midx_repack(struct repository *r, const char *object_dir, size_t batch_size);
 
@@ -29,19 +29,20 @@ static int dir_entry_cmp(const void *unused_cmp_data,
 			name ? name : e2->name, e1->namelen);
 }
 
-static struct dir_entry *find_dir_entry__hash(struct index_state *istate,
+static struct dir_entry *find_dir_entry__hash(struct hashmap *dir_hash,
 		const char *name, unsigned int namelen, unsigned int hash)
 {
 	struct dir_entry key;
 	hashmap_entry_init(&key, hash);
 	key.namelen = namelen;
-	return hashmap_get(&istate->dir_hash, &key, name);
+	return hashmap_get(dir_hash, &key, name);
 }
 
 static struct dir_entry *find_dir_entry(struct index_state *istate,
 		const char *name, unsigned int namelen)
 {
-	return find_dir_entry__hash(istate, name, namelen, memihash(name, namelen));
+	return find_dir_entry__hash(&istate->dir_hash, name, namelen,
+				    memihash(name, namelen));
 }
 
 static struct dir_entry *hash_dir_entry(struct index_state *istate,
@@ -141,21 +142,6 @@ static int lazy_nr_dir_threads;
  */
 #define LAZY_THREAD_COST (2000)
 
-/*
- * We use n mutexes to guard n partitions of the "istate->dir_hash"
- * hashtable.  Since "find" and "insert" operations will hash to a
- * particular bucket and modify/search a single chain, we can say
- * that "all chains mod n" are guarded by the same mutex -- rather
- * than having a single mutex to guard the entire table.  (This does
- * require that we disable "rehashing" on the hashtable.)
- *
- * So, a larger value here decreases the probability of a collision
- * and the time that each thread must wait for the mutex.
- */
-#define LAZY_MAX_MUTEX   (32)
-
-static pthread_mutex_t *lazy_dir_mutex_array;
-
 /*
  * An array of lazy_entry items is used by the n threads in
  * the directory parse (first) phase to (lock-free) store the
@@ -204,62 +190,44 @@ static int lookup_lazy_params(struct index_state *istate)
 }
 
 /*
- * Initialize n mutexes for use when searching and inserting
- * into "istate->dir_hash".  All "dir" threads are trying
- * to insert partial pathnames into the hash as they iterate
- * over their portions of the index, so lock contention is
- * high.
- *
- * However, the hashmap is going to put items into bucket
- * chains based on their hash values.  Use that to create n
- * mutexes and lock on mutex[bucket(hash) % n].  This will
- * decrease the collision rate by (hopefully) by a factor of n.
+ * Each "dir" thread builds the directories of its own range of the
+ * index in a private hashmap, without taking any lock. The index is
+ * sorted case-sensitively but directories are compared ignoring case,
+ * so "A/x" and "a/y" may land in different ranges yet name the same
+ * directory; the duplicates are recognized when the private maps are
+ * merged into "istate->dir_hash", after all the threads are done.
  */
-static void init_dir_mutex(void)
-{
-	int j;
-
-	lazy_dir_mutex_array = xcalloc(LAZY_MAX_MUTEX, sizeof(pthread_mutex_t));
-
-	for (j = 0; j < LAZY_MAX_MUTEX; j++)
-		init_recursive_mutex(&lazy_dir_mutex_array[j]);
-}
-
-static void cleanup_dir_mutex(void)
-{
-	int j;
-
-	for (j = 0; j < LAZY_MAX_MUTEX; j++)
-		pthread_mutex_destroy(&lazy_dir_mutex_array[j]);
-
-	free(lazy_dir_mutex_array);
-}
-
-static void lock_dir_mutex(int j)
-{
-	pthread_mutex_lock(&lazy_dir_mutex_array[j]);
-}
-
-static void unlock_dir_mutex(int j)
-{
-	pthread_mutex_unlock(&lazy_dir_mutex_array[j]);
-}
+struct lazy_dir_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct lazy_entry *lazy_entries;
+	int k_start;
+	int k_end;
+	struct hashmap dir_hash;
+	/* directories in the order they were created, parents first */
+	struct dir_entry **dirs;
+	int dirs_nr, dirs_alloc;
+};
 
-static inline int compute_dir_lock_nr(
-	const struct hashmap *map,
-	unsigned int hash)
+/*
+ * A directory that turned out to be a duplicate of one from an earlier
+ * range is marked with a negative "nr" and points to the one that was
+ * kept through its "parent" field.
+ */
+static inline struct dir_entry *lazy_resolve_dir(struct dir_entry *dir)
 {
-	return hashmap_bucket(map, hash) % LAZY_MAX_MUTEX;
+	if (dir && dir->nr < 0)
+		return dir->parent;
+	return dir;
 }
 
 static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	struct dir_entry *parent,
 	struct strbuf *prefix)
 {
 	struct dir_entry *dir;
 	unsigned int hash;
-	int lock_nr;
 
 	/*
 	 * Either we have a parent directory and path with slash(es)
@@ -274,29 +242,19 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
 	else
 		hash = memihash(prefix->buf, prefix->len);
 
-	lock_nr = compute_dir_lock_nr(&istate->dir_hash, hash);
-	lock_dir_mutex(lock_nr);
-
-	dir = find_dir_entry__hash(istate, prefix->buf, prefix->len, hash);
+	dir = find_dir_entry__hash(&d->dir_hash, prefix->buf, prefix->len, hash);
 	if (!dir) {
 		FLEX_ALLOC_MEM(dir, name, prefix->buf, prefix->len);
 		hashmap_entry_init(dir, hash);
 		dir->namelen = prefix->len;
 		dir->parent = parent;
-		hashmap_add(&istate->dir_hash, dir);
-
-		if (parent) {
-			unlock_dir_mutex(lock_nr);
+		hashmap_add(&d->dir_hash, dir);
 
-			/* All I really need here is an InterlockedIncrement(&(parent->nr)) */
-			lock_nr = compute_dir_lock_nr(&istate->dir_hash, parent->ent.hash);
-			lock_dir_mutex(lock_nr);
-			parent->nr++;
-		}
+		/* parent->nr is only counted when merging */
+		ALLOC_GROW(d->dirs, d->dirs_nr + 1, d->dirs_alloc);
+		d->dirs[d->dirs_nr++] = dir;
 	}
 
-	unlock_dir_mutex(lock_nr);
-
 	return dir;
 }
 
@@ -308,27 +266,26 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
  * directory.
  */
 static int handle_range_1(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
-	struct strbuf *prefix,
-	struct lazy_entry *lazy_entries);
+	struct strbuf *prefix);
 
 static int handle_range_dir(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
 	struct strbuf *prefix,
-	struct lazy_entry *lazy_entries,
 	struct dir_entry **dir_new_out)
 {
+	struct index_state *istate = d->istate;
 	int rc, k;
 	int input_prefix_len = prefix->len;
 	struct dir_entry *dir_new;
 
-	dir_new = hash_dir_entry_with_parent_and_prefix(istate, parent, prefix);
+	dir_new = hash_dir_entry_with_parent_and_prefix(d, parent, prefix);
 
 	strbuf_addch(prefix, '/');
 
@@ -362,7 +319,7 @@ static int handle_range_dir(
 	/*
 	 * Recurse and process what we can of this subset [k_start, k).
 	 */
-	rc = handle_range_1(istate, k_start, k, dir_new, prefix, lazy_entries);
+	rc = handle_range_1(d, k_start, k, dir_new, prefix);
 
 	strbuf_setlen(prefix, input_prefix_len);
 
@@ -371,13 +328,14 @@ static int handle_range_dir(
 }
 
 static int handle_range_1(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
-	struct strbuf *prefix,
-	struct lazy_entry *lazy_entries)
+	struct strbuf *prefix)
 {
+	struct index_state *istate = d->istate;
+	struct lazy_entry *lazy_entries = d->lazy_entries;
 	int input_prefix_len = prefix->len;
 	int k = k_start;
 
@@ -397,7 +355,7 @@ static int handle_range_1(
 			struct dir_entry *dir_new;
 
 			strbuf_add(prefix, name, len);
-			processed = handle_range_dir(istate, k, k_end, parent, prefix, lazy_entries, &dir_new);
+			processed = handle_range_dir(d, k, k_end, parent, prefix, &dir_new);
 			if (processed) {
 				k += processed;
 				strbuf_setlen(prefix, input_prefix_len);
@@ -405,18 +363,18 @@ static int handle_range_1(
 			}
 
 			strbuf_addch(prefix, '/');
-			processed = handle_range_1(istate, k, k_end, dir_new, prefix, lazy_entries);
+			processed = handle_range_1(d, k, k_end, dir_new, prefix);
 			k += processed;
 			strbuf_setlen(prefix, input_prefix_len);
 			continue;
 		}
 
 		/*
-		 * It is too expensive to take a lock to insert "ce_k"
-		 * into "istate->name_hash" and increment the ref-count
-		 * on the "parent" dir.  So we defer actually updating
-		 * permanent data structures until phase 2 (where we
-		 * can change the locking requirements) and simply
+		 * Inserting "ce_k" into "istate->name_hash" and
+		 * incrementing the ref-count on the "parent" dir would
+		 * need a lock.  So we defer actually updating
+		 * permanent data structures until phase 2 (where only
+		 * one thread touches each of them) and simply
 		 * accumulate our current results into the lazy_entries
 		 * data array).
 		 *
@@ -441,23 +399,60 @@ static int handle_range_1(
 	return k - k_start;
 }
 
-struct lazy_dir_thread_data {
-	pthread_t pthread;
-	struct index_state *istate;
-	struct lazy_entry *lazy_entries;
-	int k_start;
-	int k_end;
-};
-
 static void *lazy_dir_thread_proc(void *_data)
 {
 	struct lazy_dir_thread_data *d = _data;
 	struct strbuf prefix = STRBUF_INIT;
-	handle_range_1(d->istate, d->k_start, d->k_end, NULL, &prefix, d->lazy_entries);
+	hashmap_init(&d->dir_hash, dir_entry_cmp, NULL, 0);
+	handle_range_1(d, d->k_start, d->k_end, NULL, &prefix);
 	strbuf_release(&prefix);
 	return NULL;
 }
 
+/*
+ * Move the directories found by a "dir" thread into "istate->dir_hash",
+ * dropping those an earlier thread already put there, and count each
+ * new directory in its parent.
+ */
+static void lazy_merge_dir_hash(struct index_state *istate,
+				struct lazy_dir_thread_data *d)
+{
+	int i;
+
+	/* the entries move to the shared map; only drop the table */
+	hashmap_free(&d->dir_hash, 0);
+
+	for (i = 0; i < d->dirs_nr; i++) {
+		struct dir_entry *dir = d->dirs[i];
+		struct dir_entry *parent = lazy_resolve_dir(dir->parent);
+		struct dir_entry *found;
+
+		found = find_dir_entry__hash(&istate->dir_hash,
+					     dir->name, dir->namelen,
+					     dir->ent.hash);
+		if (found) {
+			dir->nr = -1;
+			dir->parent = found;
+			continue;
+		}
+
+		dir->parent = parent;
+		hashmap_add(&istate->dir_hash, dir);
+		if (parent)
+			parent->nr++;
+	}
+}
+
+static void lazy_free_duplicate_dirs(struct lazy_dir_thread_data *d)
+{
+	int i;
+
+	for (i = 0; i < d->dirs_nr; i++)
+		if (d->dirs[i]->nr < 0)
+			free(d->dirs[i]);
+	free(d->dirs);
+}
+
 struct lazy_name_thread_data {
 	pthread_t pthread;
 	struct index_state *istate;
@@ -486,8 +481,9 @@ static inline void lazy_update_dir_ref_counts(
 	int k;
 
 	for (k = 0; k < istate->cache_nr; k++) {
-		if (lazy_entries[k].dir)
-			lazy_entries[k].dir->nr++;
+		struct dir_entry *dir = lazy_resolve_dir(lazy_entries[k].dir);
+		if (dir)
+			dir->nr++;
 	}
 }
 
@@ -512,11 +508,11 @@ static void threaded_lazy_init_name_hash(
 	td_dir = xcalloc(lazy_nr_dir_threads, sizeof(struct lazy_dir_thread_data));
 	td_name = xcalloc(1, sizeof(struct lazy_name_thread_data));
 
-	init_dir_mutex();
-
 	/*
 	 * Phase 1:
-	 * Build "istate->dir_hash" using n "dir" threads (and a read-only index).
+	 * Build the directories of each range using n "dir" threads (and a
+	 * read-only index), then merge them into "istate->dir_hash" in
+	 * index order.
 	 */
 	for (t = 0; t < lazy_nr_dir_threads; t++) {
 		struct lazy_dir_thread_data *td_dir_t = td_dir + t;
@@ -536,6 +532,8 @@ static void threaded_lazy_init_name_hash(
 		if (pthread_join(td_dir_t->pthread, NULL))
 			die("unable to join lazy_dir_thread");
 	}
+	for (t = 0; t < lazy_nr_dir_threads; t++)
+		lazy_merge_dir_hash(istate, td_dir + t);
 
 	/*
 	 * Phase 2:
@@ -559,14 +557,15 @@ static void threaded_lazy_init_name_hash(
 	if (err)
 		die(_("unable to join lazy_name thread: %s"), strerror(err));
 
-	cleanup_dir_mutex();
+	for (t = 0; t < lazy_nr_dir_threads; t++)
+		lazy_free_duplicate_dirs(td_dir + t);
 
 	free(td_name);
 	free(td_dir);
 	free(lazy_entries);
 }
 
-static void lazy_init_name_hash(struct index_state *istate)
+void lazy_init_name_hash(struct index_state *istate)
 {
 
 	if (istate->name_hash_initialized)
@@ -576,15 +575,7 @@ static void lazy_init_name_hash(struct index_state *istate)
 	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
 
 	if (lookup_lazy_params(istate)) {
-		/*
-		 * Disable item counting and automatic rehashing because
-		 * we do per-chain (mod n) locking rather than whole hashmap
-		 * locking and we need to prevent the table-size from changing
-		 * and bucket items from being redistributed.
-		 */
-		hashmap_disable_item_counting(&istate->dir_hash);
 		threaded_lazy_init_name_hash(istate);
-		hashmap_enable_item_counting(&istate->dir_hash);
 	} else {
 		int nr;
 		for (nr = 0; nr < istate->cache_nr; nr++)
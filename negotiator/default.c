@@ -15,7 +15,7 @@
 static int marked;
 
 struct negotiation_state {
-	struct prio_queue rev_list;
+	struct keyed_queue rev_list;
 	int non_common_revs;
 };
 
@@ -28,7 +28,7 @@ static void rev_list_push(struct negotiation_state *ns,
 		if (parse_commit(commit))
 			return;
 
-		prio_queue_put(&ns->rev_list, commit);
+		keyed_queue_put(&ns->rev_list, commit, commit->date);
 
 		if (!(commit->object.flags & COMMON))
 			ns->non_common_revs++;
@@ -94,7 +94,7 @@ static const struct object_id *get_rev(struct negotiation_state *ns)
 		if (ns->rev_list.nr == 0 || ns->non_common_revs == 0)
 			return NULL;
 
-		commit = prio_queue_get(&ns->rev_list);
+		commit = keyed_queue_get(&ns->rev_list);
 		parse_commit(commit);
 		parents = commit->parents;
 
@@ -155,7 +155,7 @@ static int ack(struct fetch_negotiator *n, struct commit *c)
 
 static void release(struct fetch_negotiator *n)
 {
-	clear_prio_queue(&((struct negotiation_state *)n->data)->rev_list);
+	clear_keyed_queue(&((struct negotiation_state *)n->data)->rev_list);
 	FREE_AND_NULL(n->data);
 }
 
@@ -168,7 +168,6 @@ void default_negotiator_init(struct fetch_negotiator *negotiator)
 	negotiator->ack = ack;
 	negotiator->release = release;
 	negotiator->data = ns = xcalloc(1, sizeof(*ns));
-	ns->rev_list.compare = compare_commits_by_commit_date;
 
 	if (marked)
 		for_each_ref(clear_marks, NULL);
@@ -0,0 +1,316 @@
+#include "cache.h"
+#include "generation.h"
+#include "../commit.h"
+#include "../commit-graph.h"
+#include "../commit-reach.h"
+#include "../commit-slab.h"
+#include "../fetch-negotiator.h"
+#include "../prio-queue.h"
+#include "../refs.h"
+#include "../tag.h"
+
+/*
+ * Like the skipping negotiator, send exponentially fewer commits of each
+ * line of history, but walk in generation number order, so that the walk
+ * is topological when there is a commit-graph and every commit that can
+ * be skipped to is actually reached, no matter the clock skew. Once the
+ * server has acknowledged an ancestor of every tip, stop.
+ */
+
+/* Remember to update object flag allocation in object.h */
+/*
+ * Both us and the server know that both parties have this object.
+ */
+#define COMMON		(1U << 2)
+/*
+ * The server has told us that it has this object. We still need to tell the
+ * server that we have this object (or one of its descendants), but since we are
+ * going to do that, we do not need to tell the server about its ancestors.
+ */
+#define ADVERTISED	(1U << 3)
+/*
+ * This commit has entered the priority queue.
+ */
+#define SEEN		(1U << 4)
+/*
+ * This commit has left the priority queue.
+ */
+#define POPPED		(1U << 5)
+/*
+ * Temporarily set while checking whether all tips reach a COMMON commit.
+ */
+#define REACH_SEEN	(1U << 6)
+
+static int marked;
+
+/*
+ * An entry in the priority queue.
+ */
+struct entry {
+	struct commit *commit;
+
+	/*
+	 * Used only if commit is not COMMON.
+	 */
+	uint16_t original_ttl;
+	uint16_t ttl;
+};
+
+define_commit_slab(entry_slab, struct entry *);
+
+struct data {
+	struct prio_queue rev_list;
+
+	/*
+	 * The queue entry of each commit that is SEEN but not POPPED.
+	 */
+	struct entry_slab entries;
+
+	/*
+	 * The number of non-COMMON commits in rev_list.
+	 */
+	int non_common_revs;
+
+	/*
+	 * The tips, and whether an ancestor of each of them is known to
+	 * be COMMON, which is checked again after "ack" was called.
+	 */
+	struct object_array tips;
+	int tips_covered, acked;
+
+	/*
+	 * The lowest generation of any COMMON commit; the reachability
+	 * check need not look below it.
+	 */
+	timestamp_t min_common_generation;
+};
+
+static int compare(const void *a_, const void *b_, void *unused)
+{
+	const struct entry *a = a_;
+	const struct entry *b = b_;
+	return compare_commits_by_gen_then_commit_date(a->commit, b->commit, NULL);
+}
+
+static struct entry *rev_list_push(struct data *data, struct commit *commit, int mark)
+{
+	struct entry *entry;
+	commit->object.flags |= mark | SEEN;
+	/* the queue is ordered by generation, which needs a parsed commit */
+	parse_commit(commit);
+
+	entry = xcalloc(1, sizeof(*entry));
+	entry->commit = commit;
+	*entry_slab_at(&data->entries, commit) = entry;
+	prio_queue_put(&data->rev_list, entry);
+
+	if (!(mark & COMMON))
+		data->non_common_revs++;
+	return entry;
+}
+
+static int clear_marks(const char *refname, const struct object_id *oid,
+		       int flag, void *cb_data)
+{
+	struct object *o = deref_tag(the_repository, parse_object(the_repository, oid), refname, 0);
+
+	if (o && o->type == OBJ_COMMIT)
+		clear_commit_marks((struct commit *)o,
+				   COMMON | ADVERTISED | SEEN | POPPED);
+	return 0;
+}
+
+/*
+ * Mark this SEEN commit and all its SEEN ancestors as COMMON.
+ */
+static void mark_common(struct data *data, struct commit *c)
+{
+	struct commit_list *p;
+
+	if (c->object.flags & COMMON)
+		return;
+	c->object.flags |= COMMON;
+	if (!(c->object.flags & POPPED))
+		data->non_common_revs--;
+	if (c->generation < data->min_common_generation)
+		data->min_common_generation = c->generation;
+
+	if (!c->object.parsed)
+		return;
+	for (p = c->parents; p; p = p->next) {
+		if (p->item->object.flags & SEEN)
+			mark_common(data, p->item);
+	}
+}
+
+/*
+ * Ensure that the priority queue has an entry for to_push, and ensure that the
+ * entry has the correct flags and ttl.
+ *
+ * This function returns 1 if an entry was found or created, and 0 otherwise
+ * (because the entry for this commit had already been popped).
+ */
+static int push_parent(struct data *data, struct entry *entry,
+		       struct commit *to_push)
+{
+	struct entry *parent_entry;
+
+	if (to_push->object.flags & SEEN) {
+		if (to_push->object.flags & POPPED)
+			/*
+			 * The entry for this commit has already been popped,
+			 * which only happens for commits missing from the
+			 * commit-graph, due to clock skew. Pretend that this
+			 * parent does not exist.
+			 */
+			return 0;
+		parent_entry = *entry_slab_at(&data->entries, to_push);
+	} else {
+		parent_entry = rev_list_push(data, to_push, 0);
+	}
+
+	if (entry->commit->object.flags & (COMMON | ADVERTISED)) {
+		mark_common(data, to_push);
+	} else {
+		uint16_t new_original_ttl = entry->ttl
+			? entry->original_ttl : entry->original_ttl * 3 / 2 + 1;
+		uint16_t new_ttl = entry->ttl
+			? entry->ttl - 1 : new_original_ttl;
+		if (parent_entry->original_ttl < new_original_ttl) {
+			parent_entry->original_ttl = new_original_ttl;
+			parent_entry->ttl = new_ttl;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Does every tip reach a commit the server has acknowledged (or an
+ * ancestor of one)? The walk is cut off below the generation of the
+ * lowest such commit, so it stays within the part of the history that
+ * negotiation has already seen.
+ */
+static int all_tips_covered(struct data *data)
+{
+	if (!data->tips.nr || !generation_numbers_enabled(the_repository))
+		return 0;
+	return can_all_from_reach_with_flag(&data->tips, COMMON, REACH_SEEN, 0,
+					    data->min_common_generation);
+}
+
+static const struct object_id *get_rev(struct data *data)
+{
+	struct commit *to_send = NULL;
+
+	if (data->acked) {
+		data->acked = 0;
+		data->tips_covered = all_tips_covered(data);
+	}
+	if (data->tips_covered)
+		return NULL;
+
+	while (to_send == NULL) {
+		struct entry *entry;
+		struct commit *commit;
+		struct commit_list *p;
+		int parent_pushed = 0;
+
+		if (data->rev_list.nr == 0 || data->non_common_revs == 0)
+			return NULL;
+
+		entry = prio_queue_get(&data->rev_list);
+		commit = entry->commit;
+		commit->object.flags |= POPPED;
+		*entry_slab_at(&data->entries, commit) = NULL;
+		if (!(commit->object.flags & COMMON))
+			data->non_common_revs--;
+
+		if (!(commit->object.flags & COMMON) && !entry->ttl)
+			to_send = commit;
+
+		for (p = commit->parents; p; p = p->next)
+			parent_pushed |= push_parent(data, entry, p->item);
+
+		if (!(commit->object.flags & COMMON) && !parent_pushed)
+			/*
+			 * This commit has no parents, or all of its parents
+			 * have already been popped (due to clock skew), so send
+			 * it anyway.
+			 */
+			to_send = commit;
+
+		free(entry);
+	}
+
+	return &to_send->object.oid;
+}
+
+static void known_common(struct fetch_negotiator *n, struct commit *c)
+{
+	if (c->object.flags & SEEN)
+		return;
+	rev_list_push(n->data, c, ADVERTISED);
+}
+
+static void add_tip(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+
+	n->known_common = NULL;
+	add_object_array(&c->object, NULL, &data->tips);
+	if (c->object.flags & SEEN)
+		return;
+	rev_list_push(data, c, 0);
+}
+
+static const struct object_id *next(struct fetch_negotiator *n)
+{
+	n->known_common = NULL;
+	n->add_tip = NULL;
+	return get_rev(n->data);
+}
+
+static int ack(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+	int known_to_be_common = !!(c->object.flags & COMMON);
+	if (!(c->object.flags & SEEN))
+		die("received ack for commit %s not sent as 'have'\n",
+		    oid_to_hex(&c->object.oid));
+	mark_common(data, c);
+	if (!known_to_be_common)
+		data->acked = 1;
+	return known_to_be_common;
+}
+
+static void release(struct fetch_negotiator *n)
+{
+	struct data *data = n->data;
+	int i;
+
+	for (i = 0; i < data->rev_list.nr; i++)
+		free(data->rev_list.array[i].data);
+	clear_prio_queue(&data->rev_list);
+	clear_entry_slab(&data->entries);
+	object_array_clear(&data->tips);
+	FREE_AND_NULL(n->data);
+}
+
+void generation_negotiator_init(struct fetch_negotiator *negotiator)
+{
+	struct data *data;
+	negotiator->known_common = known_common;
+	negotiator->add_tip = add_tip;
+	negotiator->next = next;
+	negotiator->ack = ack;
+	negotiator->release = release;
+	negotiator->data = data = xcalloc(1, sizeof(*data));
+	data->rev_list.compare = compare;
+	init_entry_slab(&data->entries);
+	data->min_common_generation = GENERATION_NUMBER_INFINITY;
+
+	if (marked)
+		for_each_ref(clear_marks, NULL);
+	marked = 1;
+}
@@ -0,0 +1,382 @@
+#include "cache.h"
+#include "config.h"
+#include "csum-file.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "lockfile.h"
+#include "notes-index.h"
+#include "object-store.h"
+#include "refs.h"
+#include "tree.h"
+#include "trace2.h"
+
+#define NOTES_INDEX_SIGNATURE 0x4e544958 /* "NTIX" */
+#define NOTES_INDEX_VERSION 1
+#define NOTES_INDEX_HEADER_SIZE 16
+#define NOTES_INDEX_FANOUT_SIZE (256 * 4)
+
+struct notes_index {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *entries;
+	struct object_id tree;
+};
+
+struct notes_index_entry {
+	struct object_id object;
+	struct object_id note;
+};
+
+int notes_index_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled < 0 && git_config_get_bool("notes.index", &enabled))
+		enabled = 0;
+	return enabled;
+}
+
+static char *notes_index_path(const char *ref)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_git_common_path(&sb, the_repository, "notes-index/%s", ref);
+	return strbuf_detach(&sb, NULL);
+}
+
+static size_t entry_size(void)
+{
+	return 2 * the_hash_algo->rawsz;
+}
+
+static int verify_notes_index(struct notes_index *ni)
+{
+	const unsigned char *p = ni->data;
+	const size_t rawsz = the_hash_algo->rawsz;
+	uint32_t prev = 0;
+	int i;
+
+	if (ni->data_len < NOTES_INDEX_HEADER_SIZE + rawsz +
+			   NOTES_INDEX_FANOUT_SIZE + rawsz ||
+	    get_be32(p) != NOTES_INDEX_SIGNATURE ||
+	    get_be32(p + 4) != NOTES_INDEX_VERSION ||
+	    get_be32(p + 8) != the_hash_algo->format_id)
+		return 0;
+	ni->nr = get_be32(p + 12);
+	hashcpy(ni->tree.hash, p + NOTES_INDEX_HEADER_SIZE);
+	ni->fanout = p + NOTES_INDEX_HEADER_SIZE + rawsz;
+	ni->entries = ni->fanout + NOTES_INDEX_FANOUT_SIZE;
+
+	if ((ni->data_len - (ni->entries - p) - rawsz) / entry_size() != ni->nr ||
+	    (ni->data_len - (ni->entries - p) - rawsz) % entry_size())
+		return 0;
+	for (i = 0; i < 256; i++) {
+		uint32_t end = get_be32(ni->fanout + 4 * i);
+
+		if (end < prev)
+			return 0;
+		prev = end;
+	}
+	return prev == ni->nr;
+}
+
+struct notes_index *notes_index_open(const char *ref,
+				     const struct object_id *tree_oid)
+{
+	struct notes_index *ni = NULL;
+	struct stat st;
+	char *path;
+	int fd;
+
+	if (check_refname_format(ref, 0))
+		return NULL;
+	path = notes_index_path(ref);
+	fd = git_open(path);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	ni = xcalloc(1, sizeof(*ni));
+	ni->data_len = xsize_t(st.st_size);
+	ni->data = xmmap(NULL, ni->data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (!verify_notes_index(ni)) {
+		warning(_("notes index file %s is corrupt"), path);
+		notes_index_free(ni);
+		ni = NULL;
+	} else if (tree_oid && !oideq(&ni->tree, tree_oid)) {
+		/* the notes ref moved since; it is only a cache */
+		notes_index_free(ni);
+		ni = NULL;
+	}
+out:
+	free(path);
+	return ni;
+}
+
+const struct object_id *notes_index_tree(struct notes_index *ni)
+{
+	return &ni->tree;
+}
+
+int notes_index_lookup(struct notes_index *ni, const struct object_id *object,
+		       struct object_id *note)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	unsigned char first = object->hash[0];
+	uint32_t lo = first ? get_be32(ni->fanout + 4 * (first - 1)) : 0;
+	uint32_t hi = get_be32(ni->fanout + 4 * first);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *e = ni->entries + st_mult(mi, entry_size());
+		int cmp = hashcmp(e, object->hash);
+
+		if (!cmp) {
+			hashcpy(note->hash, e + rawsz);
+			return 0;
+		}
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+
+void notes_index_free(struct notes_index *ni)
+{
+	if (!ni)
+		return;
+	if (ni->data)
+		munmap((void *)ni->data, ni->data_len);
+	free(ni);
+}
+
+/* Same as in notes-merge.c: the annotated object of a note path. */
+static int path_to_oid(const char *path, struct object_id *oid)
+{
+	char hex_oid[GIT_MAX_HEXSZ];
+	int i = 0;
+
+	while (*path && i < the_hash_algo->hexsz) {
+		if (*path != '/')
+			hex_oid[i++] = *path;
+		path++;
+	}
+	if (*path || i != the_hash_algo->hexsz)
+		return -1;
+	return get_oid_hex(hex_oid, oid);
+}
+
+struct entry_list {
+	struct notes_index_entry *e;
+	size_t nr, alloc;
+};
+
+static void add_entry(struct entry_list *list, const struct object_id *object,
+		      const struct object_id *note)
+{
+	ALLOC_GROW(list->e, list->nr + 1, list->alloc);
+	oidcpy(&list->e[list->nr].object, object);
+	oidcpy(&list->e[list->nr].note, note);
+	list->nr++;
+}
+
+static int entry_cmp(const void *a_, const void *b_)
+{
+	const struct notes_index_entry *a = a_, *b = b_;
+
+	return oidcmp(&a->object, &b->object);
+}
+
+static int collect_note(const struct object_id *oid, struct strbuf *base,
+			const char *path, unsigned int mode, int stage,
+			void *data)
+{
+	struct object_id object;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	strbuf_addstr(base, path);
+	if (S_ISREG(mode) && !path_to_oid(base->buf, &object))
+		add_entry(data, &object, oid);
+	strbuf_setlen(base, base->len - strlen(path));
+	return 0;
+}
+
+static int read_all_notes(const struct object_id *tree_oid,
+			  struct entry_list *list)
+{
+	struct tree *tree = parse_tree_indirect(tree_oid);
+	struct pathspec pathspec;
+	int ret;
+
+	if (!tree)
+		return -1;
+	memset(&pathspec, 0, sizeof(pathspec));
+	ret = read_tree_recursive(the_repository, tree, "", 0, 0, &pathspec,
+				  collect_note, list);
+	trace2_data_intmax("notes-index", the_repository, "full",
+			   (intmax_t)list->nr);
+	return ret;
+}
+
+/*
+ * Take the entries of "old" with the changes between its tree and
+ * "tree_oid" applied. Paths that changed fanout show up as a deletion
+ * and an addition of the same note, so drop the deleted entries first.
+ */
+static int read_changed_notes(struct notes_index *old,
+			      const struct object_id *tree_oid,
+			      struct entry_list *list)
+{
+	struct diff_options opt;
+	struct entry_list added = { NULL };
+	struct oid_array deleted = OID_ARRAY_INIT;
+	uint32_t i;
+
+	repo_diff_setup(the_repository, &opt);
+	opt.flags.recursive = 1;
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+	diff_tree_oid(&old->tree, tree_oid, "", &opt);
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+		struct object_id object;
+
+		if (path_to_oid(p->one->path, &object))
+			continue;
+		if (DIFF_FILE_VALID(p->one) && S_ISREG(p->one->mode))
+			oid_array_append(&deleted, &object);
+		if (DIFF_FILE_VALID(p->two) && S_ISREG(p->two->mode))
+			add_entry(&added, &object, &p->two->oid);
+	}
+	trace2_data_intmax("notes-index", the_repository, "changed",
+			   (intmax_t)diff_queued_diff.nr);
+	diff_flush(&opt);
+	clear_pathspec(&opt.pathspec);
+
+	for (i = 0; i < old->nr; i++) {
+		const unsigned char *e = old->entries + st_mult(i, entry_size());
+		struct object_id object, note;
+
+		hashcpy(object.hash, e);
+		hashcpy(note.hash, e + the_hash_algo->rawsz);
+		if (oid_array_lookup(&deleted, &object) < 0)
+			add_entry(list, &object, &note);
+	}
+	for (i = 0; i < added.nr; i++)
+		add_entry(list, &added.e[i].object, &added.e[i].note);
+
+	free(added.e);
+	oid_array_clear(&deleted);
+	return 0;
+}
+
+static int write_entries(const char *ref, const struct object_id *tree_oid,
+			 struct entry_list *list)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	uint32_t fanout[256];
+	char *path = notes_index_path(ref);
+	size_t i;
+	int nr, ret = 0;
+
+	if (safe_create_leading_directories(path) ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0) {
+		/* somebody else is writing it, or we cannot; it is only a cache */
+		free(path);
+		return -1;
+	}
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < list->nr; i++)
+		fanout[list->e[i].object.hash[0]]++;
+	for (nr = 1; nr < 256; nr++)
+		fanout[nr] += fanout[nr - 1];
+
+	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	hashwrite_be32(f, NOTES_INDEX_SIGNATURE);
+	hashwrite_be32(f, NOTES_INDEX_VERSION);
+	hashwrite_be32(f, the_hash_algo->format_id);
+	hashwrite_be32(f, list->nr);
+	hashwrite(f, tree_oid->hash, the_hash_algo->rawsz);
+	for (nr = 0; nr < 256; nr++)
+		hashwrite_be32(f, fanout[nr]);
+	for (i = 0; i < list->nr; i++) {
+		hashwrite(f, list->e[i].object.hash, the_hash_algo->rawsz);
+		hashwrite(f, list->e[i].note.hash, the_hash_algo->rawsz);
+	}
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM);
+	if (commit_lock_file(&lk))
+		ret = error_errno(_("unable to write %s"), path);
+	free(path);
+	return ret;
+}
+
+int write_notes_index(const char *ref)
+{
+	struct object_id commit_oid, tree_oid;
+	struct entry_list list = { NULL };
+	struct notes_index *old;
+	unsigned short mode;
+	size_t i;
+	int ret;
+
+	if (check_refname_format(ref, 0) ||
+	    read_ref(ref, &commit_oid) ||
+	    get_tree_entry(the_repository, &commit_oid, "", &tree_oid, &mode))
+		return -1;
+
+	old = notes_index_open(ref, NULL);
+	if (old && oideq(&old->tree, &tree_oid)) {
+		notes_index_free(old);
+		return 0;
+	}
+	if (old)
+		ret = read_changed_notes(old, &tree_oid, &list);
+	else
+		ret = read_all_notes(&tree_oid, &list);
+	notes_index_free(old);
+	if (ret)
+		goto out;
+
+	QSORT(list.e, list.nr, entry_cmp);
+	for (i = 1; i < list.nr; i++) {
+		/*
+		 * Notes for one object at several fanouts are combined
+		 * by whoever loads the tree; leave that to them.
+		 */
+		if (oideq(&list.e[i - 1].object, &list.e[i].object)) {
+			ret = error(_("notes ref %s has several notes for %s; "
+				      "not indexing it"),
+				    ref, oid_to_hex(&list.e[i].object));
+			goto out;
+		}
+	}
+	ret = write_entries(ref, &tree_oid, &list);
+out:
+	free(list.e);
+	return ret;
+}
+
+static int write_one_notes_index(const char *refname,
+				 const struct object_id *oid,
+				 int flags, void *data)
+{
+	write_notes_index(refname);
+	return 0;
+}
+
+void write_notes_indexes(void)
+{
+	for_each_fullref_in("refs/notes/", write_one_notes_index, NULL, 0);
+}
@@ -0,0 +1,48 @@
+#ifndef NOTES_INDEX_H
+#define NOTES_INDEX_H
+
+struct object_id;
+struct notes_index;
+
+/*
+ * The notes index "$GIT_COMMON_DIR/notes-index/<ref>" maps each object
+ * annotated in the notes ref <ref> to its note, as a flat sorted table
+ * that get_note() can search without reading the notes trees. It is
+ * only used while it describes the tree the notes ref points at. See
+ * Documentation/technical/notes-index-format.txt.
+ */
+
+/* Is "notes.index" enabled? */
+int notes_index_enabled(void);
+
+/*
+ * Open the index of the notes ref "ref", if it is up to date with the
+ * notes tree "tree_oid"; return NULL otherwise.
+ */
+struct notes_index *notes_index_open(const char *ref,
+				     const struct object_id *tree_oid);
+
+/* The notes tree the index describes. */
+const struct object_id *notes_index_tree(struct notes_index *ni);
+
+/*
+ * Look up the note of "object" and store it in "note". Return 0 if
+ * there is one, and -1 otherwise.
+ */
+int notes_index_lookup(struct notes_index *ni, const struct object_id *object,
+		       struct object_id *note);
+
+void notes_index_free(struct notes_index *ni);
+
+/*
+ * Bring the index of the notes ref "ref" up to date with the tree it
+ * points at. When the old index is still around, only the notes trees
+ * that changed since are read. Return 0 on success, including when
+ * there is nothing to do.
+ */
+int write_notes_index(const char *ref);
+
+/* Same as above, for every ref under refs/notes/. */
+void write_notes_indexes(void);
+
+#endif
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "commit.h"
 #include "refs.h"
+#include "notes-index.h"
 #include "notes-utils.h"
 #include "repository.h"
 
@@ -55,6 +56,8 @@ void commit_notes(struct repository *r, struct notes_tree *t, const char *msg)
 	strbuf_insert(&buf, 0, "notes: ", 7); /* commit message starts at index 7 */
 	update_ref(buf.buf, t->update_ref, &commit_oid, NULL, 0,
 		   UPDATE_REFS_DIE_ON_ERR);
+	if (notes_index_enabled())
+		write_notes_index(t->update_ref);
 
 	strbuf_release(&buf);
 }
@@ -1,8 +1,11 @@
 #include "cache.h"
 #include "config.h"
 #include "notes.h"
+#include "notes-index.h"
+#include "oidmap.h"
 #include "object-store.h"
 #include "blob.h"
+#include "commit.h"
 #include "tree.h"
 #include "utf8.h"
 #include "strbuf.h"
@@ -990,6 +993,7 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	struct object_id oid, object_oid;
 	unsigned short mode;
 	struct leaf_node root_tree;
+	struct commit *commit;
 
 	if (!t)
 		t = &default_notes_tree;
@@ -1015,6 +1019,15 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 		return;
 	if (flags & NOTES_INIT_WRITABLE && read_ref(notes_ref, &object_oid))
 		die("Cannot use notes ref %s", notes_ref);
+
+	/* the index knows which tree it is for; do not read even that */
+	if (!(flags & NOTES_INIT_WRITABLE) && notes_index_enabled() &&
+	    (commit = lookup_commit_reference_gently(the_repository,
+						     &object_oid, 1)) &&
+	    (t->index = notes_index_open(notes_ref,
+					 get_commit_tree_oid(commit))))
+		return;
+
 	if (get_tree_entry(the_repository, &object_oid, "", &oid, &mode))
 		die("Failed to read notes tree referenced by %s (%s)",
 		    notes_ref, oid_to_hex(&object_oid));
@@ -1024,6 +1037,51 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	load_subtree(t, &root_tree, t->root, 0);
 }
 
+/*
+ * A note found in the notes index. It lives until the tree is freed,
+ * like the leaf nodes get_note() returns otherwise.
+ */
+struct note_index_hit {
+	struct oidmap_entry entry;
+	struct object_id note;
+};
+
+static const struct object_id *get_note_from_index(struct notes_tree *t,
+						   const struct object_id *oid)
+{
+	struct note_index_hit *hit;
+	struct object_id note;
+
+	if (!t->index_hits) {
+		t->index_hits = xmalloc(sizeof(*t->index_hits));
+		oidmap_init(t->index_hits, 0);
+	}
+	hit = oidmap_get(t->index_hits, oid);
+	if (hit)
+		return &hit->note;
+	if (notes_index_lookup(t->index, oid, &note))
+		return NULL;
+	hit = xmalloc(sizeof(*hit));
+	oidcpy(&hit->entry.oid, oid);
+	oidcpy(&hit->note, &note);
+	oidmap_put(t->index_hits, hit);
+	return &hit->note;
+}
+
+/* Load the notes tree for anything the notes index cannot answer. */
+static void load_indexed_notes(struct notes_tree *t)
+{
+	struct leaf_node root_tree;
+
+	if (!t->index)
+		return;
+	oidclr(&root_tree.key_oid);
+	oidcpy(&root_tree.val_oid, notes_index_tree(t->index));
+	notes_index_free(t->index);
+	t->index = NULL;
+	load_subtree(t, &root_tree, t->root, 0);
+}
+
 struct notes_tree **load_notes_trees(struct string_list *refs, int flags)
 {
 	struct string_list_item *item;
@@ -1080,6 +1138,7 @@ int add_note(struct notes_tree *t, const struct object_id *object_oid,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	load_indexed_notes(t);
 	t->dirty = 1;
 	if (!combine_notes)
 		combine_notes = t->combine_notes;
@@ -1096,6 +1155,7 @@ int remove_note(struct notes_tree *t, const unsigned char *object_sha1)
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	load_indexed_notes(t);
 	hashcpy(l.key_oid.hash, object_sha1);
 	oidclr(&l.val_oid);
 	note_tree_remove(t, t->root, 0, &l);
@@ -1113,6 +1173,8 @@ const struct object_id *get_note(struct notes_tree *t,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	if (t->index)
+		return get_note_from_index(t, oid);
 	found = note_tree_find(t, t->root, 0, oid->hash);
 	return found ? &found->val_oid : NULL;
 }
@@ -1123,6 +1185,7 @@ int for_each_note(struct notes_tree *t, int flags, each_note_fn fn,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	load_indexed_notes(t);
 	return for_each_note_helper(t, t->root, 0, 0, flags, fn, cb_data);
 }
 
@@ -1187,6 +1250,11 @@ void free_notes(struct notes_tree *t)
 		free(t->first_non_note);
 		t->first_non_note = t->prev_non_note;
 	}
+	notes_index_free(t->index);
+	if (t->index_hits) {
+		oidmap_free(t->index_hits, 1);
+		free(t->index_hits);
+	}
 	free(t->ref);
 	memset(t, 0, sizeof(struct notes_tree));
 }
@@ -5,6 +5,8 @@
 
 struct object_id;
 struct strbuf;
+struct notes_index;
+struct oidmap;
 
 /*
  * Function type for combining two notes annotating the same object.
@@ -56,6 +58,12 @@ extern struct notes_tree {
 	combine_notes_fn combine_notes;
 	int initialized;
 	int dirty;
+	/*
+	 * While "index" is set, the notes tree is not loaded, and
+	 * get_note() answers from the notes index instead.
+	 */
+	struct notes_index *index;
+	struct oidmap *index_hits;
 } default_notes_tree;
 
 /*
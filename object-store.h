@@ -6,6 +6,7 @@
 #include "list.h"
 #include "sha1-array.h"
 #include "strbuf.h"
+#include "thread-utils.h"
 
 struct object_directory {
 	struct object_directory *next;
@@ -22,6 +23,12 @@ struct object_directory {
 	char loose_objects_subdir_seen[256];
 	struct oid_array loose_objects_cache[256];
 
+	/*
+	 * The on-disk copy of the above, if "core.looseObjectIndex" is
+	 * enabled; see loose-index.h.
+	 */
+	struct loose_index *loose_index;
+
 	/*
 	 * Path to the alternative object store. If this is a relative path,
 	 * it is relative to the current working directory.
@@ -49,6 +56,22 @@ void add_to_alternates_file(const char *dir);
  */
 void add_to_alternates_memory(const char *dir);
 
+/*
+ * Replace the current writable object directory with the specified temporary
+ * object directory; returns the former primary object directory, which is
+ * kept as the first alternate.
+ */
+struct object_directory *set_temporary_primary_odb(const char *dir);
+
+/*
+ * Restore a previous object directory as the primary, and free the
+ * temporary one at "old_path".
+ */
+void restore_primary_odb(struct object_directory *restore_odb,
+			 const char *old_path);
+
+void free_object_directory(struct object_directory *odb);
+
 /*
  * Populate and return the loose object cache array corresponding to the
  * given object ID.
@@ -79,9 +102,16 @@ struct packed_git {
 		 freshened:1,
 		 do_not_close:1,
 		 pack_promisor:1,
-		 multi_pack_index:1;
+		 multi_pack_index:1,
+		 is_cruft:1;
 	unsigned char hash[GIT_MAX_RAWSZ];
 	struct revindex_entry *revindex;
+	const uint32_t *revindex_data;
+	const void *revindex_map;
+	size_t revindex_size;
+	/* the ".mtimes" file of a cruft pack, see pack-mtimes.h */
+	const void *mtimes_map;
+	size_t mtimes_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
@@ -183,6 +213,25 @@ int hash_object_file(const void *buf, unsigned long len,
 int write_object_file(const void *buf, unsigned long len,
 		      const char *type, struct object_id *oid);
 
+/*
+ * A source of object contents for stream_loose_object(). Each call to
+ * read() returns the next chunk and stores its length in "len"; it
+ * sets "is_finished" along with returning the last one.
+ */
+struct input_stream {
+	const void *(*read)(struct input_stream *, unsigned long *len);
+	void *data;
+	int is_finished;
+};
+
+/*
+ * Write a blob of "len" bytes read from "in_stream" as a loose object
+ * without holding it in memory, and store its name in "oid". Nothing
+ * is written if the object already exists.
+ */
+int stream_loose_object(struct input_stream *in_stream, size_t len,
+			struct object_id *oid);
+
 int hash_object_file_literally(const void *buf, unsigned long len,
 			       const char *type, struct object_id *oid,
 			       unsigned flags);
@@ -292,6 +341,36 @@ int oid_object_info_extended(struct repository *r,
 			     const struct object_id *,
 			     struct object_info *, unsigned flags);
 
+/*
+ * After enable_obj_read_lock(), several threads may read objects at
+ * the same time with oid_object_info_extended() and the functions
+ * built on it, like read_object_file(). They take the object read
+ * lock while looking at the object store and the packs, and drop it
+ * while inflating, which is where most of the time goes.
+ *
+ * obj_read_lock() can also protect other code that must not run
+ * concurrently with object reading, e.g. adding an alternate. The
+ * lock is recursive, so that code may read objects itself, but will
+ * then inflate them without letting the other threads in.
+ */
+void enable_obj_read_lock(void);
+void disable_obj_read_lock(void);
+
+extern int obj_read_use_lock;
+extern pthread_mutex_t obj_read_mutex;
+
+static inline void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+static inline void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
@@ -10,6 +10,7 @@
 #include "object-store.h"
 #include "packfile.h"
 #include "commit-graph.h"
+#include "loose-index.h"
 
 unsigned int get_max_object_index(void)
 {
@@ -54,24 +55,20 @@ int type_from_string_gently(const char *str, ssize_t len, int gentle)
 	die(_("invalid object type \"%s\""), str);
 }
 
-/*
- * Return a numerical hash value between 0 and n-1 for the object with
- * the specified sha1.  n must be a power of 2.  Please note that the
- * return value is *not* consistent across computer architectures.
- */
-static unsigned int hash_obj(const struct object_id *oid, unsigned int n)
-{
-	return oidhash(oid) & (n - 1);
-}
-
 /*
  * Insert obj into the hash table hash, which has length size (which
- * must be a power of 2).  On collisions, simply overflow to the next
- * empty bucket.
+ * must be a power of 2), and its tag into the same slot of tags.  On
+ * collisions, simply overflow to the next empty bucket.
+ *
+ * The tag is oidhash(), and its low bits give the first bucket to
+ * look at.  Please note that it is *not* consistent across computer
+ * architectures.
  */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static void insert_obj_hash(struct object *obj, struct object **hash,
+			    unsigned int *tags, unsigned int size)
 {
-	unsigned int j = hash_obj(&obj->oid, size);
+	unsigned int tag = oidhash(&obj->oid);
+	unsigned int j = tag & (size - 1);
 
 	while (hash[j]) {
 		j++;
@@ -79,6 +76,7 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
 			j = 0;
 	}
 	hash[j] = obj;
+	tags[j] = tag;
 }
 
 /*
@@ -87,15 +85,17 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid)
 {
-	unsigned int i, first;
+	unsigned int i, first, tag;
 	struct object *obj;
 
 	if (!r->parsed_objects->obj_hash)
 		return NULL;
 
-	first = i = hash_obj(oid, r->parsed_objects->obj_hash_size);
+	tag = oidhash(oid);
+	first = i = tag & (r->parsed_objects->obj_hash_size - 1);
 	while ((obj = r->parsed_objects->obj_hash[i]) != NULL) {
-		if (oideq(oid, &obj->oid))
+		if (r->parsed_objects->obj_hash_tag[i] == tag &&
+		    oideq(oid, &obj->oid))
 			break;
 		i++;
 		if (i == r->parsed_objects->obj_hash_size)
@@ -109,6 +109,8 @@ struct object *lookup_object(struct repository *r, const struct object_id *oid)
 		 */
 		SWAP(r->parsed_objects->obj_hash[i],
 		     r->parsed_objects->obj_hash[first]);
+		SWAP(r->parsed_objects->obj_hash_tag[i],
+		     r->parsed_objects->obj_hash_tag[first]);
 	}
 	return obj;
 }
@@ -122,22 +124,26 @@ static void grow_object_hash(struct repository *r)
 {
 	int i;
 	/*
-	 * Note that this size must always be power-of-2 to match hash_obj
-	 * above.
+	 * Note that this size must always be power-of-2 to match the
+	 * masking in insert_obj_hash() above.
 	 */
 	int new_hash_size = r->parsed_objects->obj_hash_size < 32 ? 32 : 2 * r->parsed_objects->obj_hash_size;
 	struct object **new_hash;
+	unsigned int *new_tags;
 
 	new_hash = xcalloc(new_hash_size, sizeof(struct object *));
+	ALLOC_ARRAY(new_tags, new_hash_size);
 	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
 		struct object *obj = r->parsed_objects->obj_hash[i];
 
 		if (!obj)
 			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
+		insert_obj_hash(obj, new_hash, new_tags, new_hash_size);
 	}
 	free(r->parsed_objects->obj_hash);
+	free(r->parsed_objects->obj_hash_tag);
 	r->parsed_objects->obj_hash = new_hash;
+	r->parsed_objects->obj_hash_tag = new_tags;
 	r->parsed_objects->obj_hash_size = new_hash_size;
 }
 
@@ -153,6 +159,7 @@ void *create_object(struct repository *r, const struct object_id *oid, void *o)
 		grow_object_hash(r);
 
 	insert_obj_hash(obj, r->parsed_objects->obj_hash,
+			r->parsed_objects->obj_hash_tag,
 			r->parsed_objects->obj_hash_size);
 	r->parsed_objects->nr_objs++;
 	return obj;
@@ -483,10 +490,11 @@ struct raw_object_store *raw_object_store_new(void)
 	return o;
 }
 
-static void free_object_directory(struct object_directory *odb)
+void free_object_directory(struct object_directory *odb)
 {
 	free(odb->path);
 	odb_clear_loose_cache(odb);
+	loose_index_release(odb);
 	free(odb);
 }
 
@@ -547,6 +555,7 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 	}
 
 	FREE_AND_NULL(o->obj_hash);
+	FREE_AND_NULL(o->obj_hash_tag);
 	o->obj_hash_size = 0;
 
 	free_commit_buffer_slab(o->buffer_slab);
@@ -7,6 +7,11 @@ struct buffer_slab;
 
 struct parsed_object_pool {
 	struct object **obj_hash;
+	/*
+	 * oidhash() of the object in the same slot of obj_hash, so that
+	 * probing past other objects does not need to dereference them.
+	 */
+	unsigned int *obj_hash_tag;
 	int nr_objs, obj_hash_size;
 
 	/* TODO: migrate alloc_states to mem-pool? */
@@ -62,16 +67,18 @@ struct object_array {
  * revision.h:               0---------10                              25----28
  * fetch-pack.c:             01
  * negotiator/default.c:       2--5
+ * negotiator/generation.c:    2---6
  * walker.c:                 0-2
  * upload-pack.c:                4       11-----14  16-----19
  * builtin/blame.c:                        12-13
- * bisect.c:                                        16
+ * bisect.c:                                        16-18
  * bundle.c:                                        16
  * http-push.c:                                     16-----19
  * commit-reach.c:                                15-------19
  * sha1-name.c:                                              20
  * list-objects-filter.c:                                      21
  * builtin/fsck.c:           0--3
+ * builtin/gc.c:             0
  * builtin/index-pack.c:                                     2021
  * builtin/pack-objects.c:                                   20
  * builtin/reflog.c:                   10--12
@@ -12,6 +12,9 @@
 #include "sha1-lookup.h"
 #include "pack-objects.h"
 #include "commit-reach.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "config.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -20,6 +23,14 @@ struct bitmapped_commit {
 	int flags;
 	int xor_offset;
 	uint32_t commit_pos;
+	off_t write_offset;
+};
+
+struct bitmapped_ref_group {
+	/* bit positions of the tips, sorted and unique */
+	uint32_t *tips;
+	uint32_t tips_nr;
+	struct ewah_bitmap *bitmap;
 };
 
 struct bitmap_writer {
@@ -35,8 +46,15 @@ struct bitmap_writer {
 	struct bitmapped_commit *selected;
 	unsigned int selected_nr, selected_alloc;
 
+	struct bitmapped_ref_group *ref_groups;
+	unsigned int ref_groups_nr, ref_groups_alloc;
+
+	struct strbuf islands;
+
 	struct progress *progress;
 	int show_progress;
+	int roaring;
+	int name_hash_version;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
 };
 
@@ -47,6 +65,11 @@ void bitmap_writer_show_progress(int show)
 	writer.show_progress = show;
 }
 
+void bitmap_writer_set_name_hash_version(int version)
+{
+	writer.name_hash_version = version;
+}
+
 /**
  * Build the initial type index for the packfile
  */
@@ -142,7 +165,7 @@ static inline void reset_all_seen(void)
 	seen_objects_nr = 0;
 }
 
-static uint32_t find_object_pos(const struct object_id *oid)
+static struct object_entry *find_object_entry(const struct object_id *oid)
 {
 	struct object_entry *entry = packlist_find(writer.to_pack, oid, NULL);
 
@@ -151,19 +174,87 @@ static uint32_t find_object_pos(const struct object_id *oid)
 			"(object %s is missing)", oid_to_hex(oid));
 	}
 
-	return oe_in_pack_pos(writer.to_pack, entry);
+	return entry;
 }
 
-static void show_object(struct object *object, const char *name, void *data)
+static uint32_t find_object_pos(const struct object_id *oid)
 {
-	struct bitmap *base = data;
-	bitmap_set(base, find_object_pos(&object->oid));
-	mark_as_seen(object);
+	return oe_in_pack_pos(writer.to_pack, find_object_entry(oid));
+}
+
+/*
+ * Sets the bit of the object in "base", returning 0 if it was already
+ * set.
+ */
+static int set_object_bit(struct bitmap *base, const struct object_id *oid,
+			  const char *name)
+{
+	struct object_entry *entry = find_object_entry(oid);
+	uint32_t pos = oe_in_pack_pos(writer.to_pack, entry);
+
+	if (bitmap_get(base, pos))
+		return 0;
+
+	/*
+	 * Entries that were not added by a named traversal (e.g. those
+	 * of a multi-pack-index) learn their name-hash here.
+	 */
+	if (!entry->hash)
+		entry->hash = pack_name_hash_version(writer.name_hash_version,
+						     name);
+
+	bitmap_set(base, pos);
+	return 1;
+}
+
+/*
+ * Adds "tree" and everything it reaches to "base". A tree whose bit is
+ * already set is reachable from a commit in "base" (possibly through
+ * a reused bitmap), so its entries are never opened again.
+ */
+static void fill_bitmap_tree(struct bitmap *base, struct tree *tree,
+			     struct strbuf *path)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	size_t baselen = path->len;
+
+	if (!set_object_bit(base, &tree->object.oid, path->buf))
+		return;
+
+	if (parse_tree(tree) < 0)
+		die("unable to load tree object %s",
+		    oid_to_hex(&tree->object.oid));
+	init_tree_desc(&desc, tree->buffer, tree->size);
+
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+
+		strbuf_setlen(path, baselen);
+		if (baselen)
+			strbuf_addch(path, '/');
+		strbuf_addstr(path, entry.path);
+
+		if (S_ISDIR(entry.mode))
+			fill_bitmap_tree(base, lookup_tree(the_repository,
+							   &entry.oid), path);
+		else
+			set_object_bit(base, &entry.oid, path->buf);
+	}
+	strbuf_setlen(path, baselen);
+
+	free_tree_buffer(tree);
 }
 
 static void show_commit(struct commit *commit, void *data)
 {
+	struct bitmap *base = data;
+	struct strbuf path = STRBUF_INIT;
+
 	mark_as_seen((struct object *)commit);
+	fill_bitmap_tree(base, get_commit_tree(commit), &path);
+	strbuf_release(&path);
 }
 
 static int
@@ -208,6 +299,88 @@ should_include(struct commit *commit, void *_data)
 	return 1;
 }
 
+static int add_ref_group_tip(const char *refname, const struct object_id *oid,
+			     int flags, void *data)
+{
+	struct rev_info *revs = data;
+	struct commit *commit;
+
+	commit = lookup_commit_reference_gently(revs->repo, oid, 1);
+	if (commit && packlist_find(writer.to_pack, &commit->object.oid, NULL))
+		add_pending_object(revs, &commit->object, refname);
+	return 0;
+}
+
+static int cmp_uint32(const void *a_, const void *b_)
+{
+	uint32_t a = *((uint32_t *)a_);
+	uint32_t b = *((uint32_t *)b_);
+
+	return (a < b) ? -1 : (a != b);
+}
+
+/*
+ * Computes one bitmap for everything reachable from the refs matching
+ * "pattern". Tips that are not in the pack are left out; the group
+ * then only stands for the tips it records.
+ */
+static void build_ref_group(const char *pattern)
+{
+	struct bitmapped_ref_group *group;
+	struct rev_info revs;
+	struct bitmap *base;
+	uint32_t i, nr = 0;
+
+	repo_init_revisions(writer.to_pack->repo, &revs, NULL);
+	for_each_glob_ref(add_ref_group_tip, pattern, &revs);
+	if (!revs.pending.nr)
+		return;
+
+	ALLOC_GROW(writer.ref_groups, writer.ref_groups_nr + 1,
+		   writer.ref_groups_alloc);
+	group = &writer.ref_groups[writer.ref_groups_nr++];
+
+	ALLOC_ARRAY(group->tips, revs.pending.nr);
+	for (i = 0; i < revs.pending.nr; i++)
+		group->tips[i] = find_object_pos(&revs.pending.objects[i].item->oid);
+	QSORT(group->tips, revs.pending.nr, cmp_uint32);
+	for (i = 0; i < revs.pending.nr; i++)
+		if (!nr || group->tips[nr - 1] != group->tips[i])
+			group->tips[nr++] = group->tips[i];
+	group->tips_nr = nr;
+
+	base = bitmap_new();
+	revs.include_check = should_include;
+	revs.include_check_data = base;
+
+	reset_all_seen();
+	if (prepare_revision_walk(&revs))
+		die("revision walk setup failed");
+	traverse_commit_list(&revs, show_commit, NULL, base);
+	object_array_clear(&revs.pending);
+
+	group->bitmap = bitmap_to_ewah(base);
+	bitmap_free(base);
+}
+
+static void build_ref_groups(void)
+{
+	const struct string_list *patterns;
+	const struct string_list_item *item;
+
+	patterns = repo_config_get_value_multi(writer.to_pack->repo,
+					       "pack.bitmaprefgroup");
+	if (!patterns)
+		return;
+
+	for_each_string_list_item(item, patterns) {
+		if (!item->string)
+			die("missing value for 'pack.bitmapRefGroup'");
+		build_ref_group(item->string);
+	}
+	reset_all_seen();
+}
+
 static void compute_xor_offsets(void)
 {
 	static const int MAX_XOR_OFFSET_SEARCH = 10;
@@ -252,7 +425,7 @@ void bitmap_writer_build(struct packing_data *to_pack)
 {
 	static const double REUSE_BITMAP_THRESHOLD = 0.2;
 
-	int i, reuse_after, need_reset;
+	int i, reuse_after, nr_reused = 0;
 	struct bitmap *base = bitmap_new();
 	struct rev_info revs;
 
@@ -263,16 +436,12 @@ void bitmap_writer_build(struct packing_data *to_pack)
 		writer.progress = start_progress("Building bitmaps", writer.selected_nr);
 
 	repo_init_revisions(to_pack->repo, &revs, NULL);
-	revs.tag_objects = 1;
-	revs.tree_objects = 1;
-	revs.blob_objects = 1;
 	revs.no_walk = 0;
 
 	revs.include_check = should_include;
 	reset_revision_walk();
 
 	reuse_after = writer.selected_nr * REUSE_BITMAP_THRESHOLD;
-	need_reset = 0;
 
 	for (i = writer.selected_nr - 1; i >= 0; --i) {
 		struct bitmapped_commit *stored;
@@ -286,9 +455,8 @@ void bitmap_writer_build(struct packing_data *to_pack)
 
 		if (stored->bitmap == NULL) {
 			if (i < writer.selected_nr - 1 &&
-			    (need_reset ||
-			     !in_merge_bases(writer.selected[i + 1].commit,
-					     stored->commit))) {
+			    !in_merge_bases(writer.selected[i + 1].commit,
+					    stored->commit)) {
 			    bitmap_reset(base);
 			    reset_all_seen();
 			}
@@ -299,14 +467,23 @@ void bitmap_writer_build(struct packing_data *to_pack)
 			if (prepare_revision_walk(&revs))
 				die("revision walk setup failed");
 
-			traverse_commit_list(&revs, show_commit, show_object, base);
+			traverse_commit_list(&revs, show_commit, NULL, base);
 
 			object_array_clear(&revs.pending);
 
 			stored->bitmap = bitmap_to_ewah(base);
-			need_reset = 0;
-		} else
-			need_reset = 1;
+		} else {
+			/*
+			 * A bitmap carried over from the previous pack is
+			 * complete on its own; start the next walk from it,
+			 * so that only the history it does not cover is
+			 * traversed.
+			 */
+			bitmap_reset(base);
+			reset_all_seen();
+			bitmap_or_ewah(base, stored->bitmap);
+			nr_reused++;
+		}
 
 		if (i >= reuse_after)
 			stored->flags |= BITMAP_FLAG_REUSE;
@@ -323,6 +500,13 @@ void bitmap_writer_build(struct packing_data *to_pack)
 	bitmap_free(base);
 	stop_progress(&writer.progress);
 
+	build_ref_groups();
+
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "building_bitmaps_total", writer.selected_nr);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "building_bitmaps_reused", nr_reused);
+
 	compute_xor_offsets();
 }
 
@@ -462,6 +646,14 @@ static int hashwrite_ewah_helper(void *f, const void *buf, size_t len)
  */
 static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap)
 {
+	if (writer.roaring) {
+		struct strbuf buf = STRBUF_INIT;
+
+		roaring_serialize_strbuf(bitmap, &buf);
+		hashwrite(f, buf.buf, buf.len);
+		strbuf_release(&buf);
+		return;
+	}
 	if (ewah_serialize_to(bitmap, hashwrite_ewah_helper, f) < 0)
 		die("Failed to write bitmap index");
 }
@@ -487,7 +679,17 @@ static void write_selected_commits_v1(struct hashfile *f,
 		if (commit_pos < 0)
 			BUG("trying to write commit not in index");
 
+		stored->commit_pos = commit_pos;
+		stored->write_offset = hashfile_total(f);
 		hashwrite_be32(f, commit_pos);
+		if (writer.roaring) {
+			/* the point is to read one bitmap without the others */
+			stored->xor_offset = 0;
+			hashwrite_u8(f, 0);
+			hashwrite_u8(f, stored->flags);
+			dump_bitmap(f, stored->bitmap);
+			continue;
+		}
 		hashwrite_u8(f, stored->xor_offset);
 		hashwrite_u8(f, stored->flags);
 
@@ -495,6 +697,65 @@ static void write_selected_commits_v1(struct hashfile *f,
 	}
 }
 
+static int lookup_table_cmp(const void *va, const void *vb)
+{
+	const struct bitmapped_commit *a = &writer.selected[*(const uint32_t *)va];
+	const struct bitmapped_commit *b = &writer.selected[*(const uint32_t *)vb];
+
+	if (a->commit_pos < b->commit_pos)
+		return -1;
+	return a->commit_pos > b->commit_pos;
+}
+
+/*
+ * One row per entry, sorted by commit position, so that a reader can
+ * find and load the bitmap of a commit without going through the
+ * others.
+ */
+static void write_lookup_table(struct hashfile *f, off_t entries_end)
+{
+	uint32_t *sorted, *row_of, i;
+
+	ALLOC_ARRAY(sorted, writer.selected_nr);
+	ALLOC_ARRAY(row_of, writer.selected_nr);
+	for (i = 0; i < writer.selected_nr; i++)
+		sorted[i] = i;
+	QSORT(sorted, writer.selected_nr, lookup_table_cmp);
+	for (i = 0; i < writer.selected_nr; i++)
+		row_of[sorted[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[sorted[i]];
+		uint32_t xor_row = 0xffffffff;
+
+		if (stored->xor_offset)
+			xor_row = row_of[sorted[i] - stored->xor_offset];
+		hashwrite_be32(f, stored->commit_pos);
+		hashwrite_be64(f, stored->write_offset);
+		hashwrite_be32(f, xor_row);
+	}
+	hashwrite_be64(f, entries_end);
+
+	free(sorted);
+	free(row_of);
+}
+
+static void write_ref_groups(struct hashfile *f)
+{
+	unsigned int i;
+	uint32_t j;
+
+	hashwrite_be32(f, writer.ref_groups_nr);
+	for (i = 0; i < writer.ref_groups_nr; i++) {
+		struct bitmapped_ref_group *group = &writer.ref_groups[i];
+
+		hashwrite_be32(f, group->tips_nr);
+		for (j = 0; j < group->tips_nr; j++)
+			hashwrite_be32(f, group->tips[j]);
+		dump_bitmap(f, group->bitmap);
+	}
+}
+
 static void write_hash_cache(struct hashfile *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -508,20 +769,42 @@ static void write_hash_cache(struct hashfile *f,
 	}
 }
 
+void bitmap_writer_set_islands(struct strbuf *islands)
+{
+	strbuf_swap(&writer.islands, islands);
+}
+
 void bitmap_writer_set_checksum(unsigned char *sha1)
 {
 	hashcpy(writer.pack_checksum, sha1);
 }
 
+static int use_roaring_encoding(void)
+{
+	const char *encoding;
+
+	if (repo_config_get_value(writer.to_pack->repo,
+				  "pack.bitmapencoding", &encoding))
+		return 0;
+	if (!encoding)
+		die("missing value for 'pack.bitmapEncoding'");
+	if (!strcmp(encoding, "roaring"))
+		return 1;
+	if (strcmp(encoding, "ewah"))
+		die("unknown value for 'pack.bitmapEncoding': %s", encoding);
+	return 0;
+}
+
 void bitmap_writer_finish(struct pack_idx_entry **index,
 			  uint32_t index_nr,
 			  const char *filename,
 			  uint16_t options)
 {
-	static uint16_t default_version = 1;
+	uint16_t version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct hashfile *f;
+	off_t entries_end;
 
 	struct bitmap_disk_header header;
 
@@ -529,8 +812,23 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 
 	f = hashfd(fd, tmp_file.buf);
 
+	if (writer.ref_groups_nr)
+		options |= BITMAP_OPT_REF_GROUPS;
+	if (writer.islands.len)
+		options |= BITMAP_OPT_ISLANDS;
+	/* older versions would take the hashes for version 1 ones */
+	if ((options & BITMAP_OPT_HASH_CACHE) && writer.name_hash_version == 2)
+		options ^= BITMAP_OPT_HASH_CACHE | BITMAP_OPT_HASH_CACHE_V2;
+
+	/* older versions would read roaring bitmaps as EWAH ones */
+	writer.roaring = use_roaring_encoding();
+	if (writer.roaring) {
+		options |= BITMAP_OPT_ROARING;
+		version = 2;
+	}
+
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(version);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(writer.selected_nr);
 	hashcpy(header.checksum, writer.pack_checksum);
@@ -541,8 +839,18 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.blobs);
 	dump_bitmap(f, writer.tags);
 	write_selected_commits_v1(f, index, index_nr);
+	entries_end = hashfile_total(f);
+
+	if (options & BITMAP_OPT_REF_GROUPS)
+		write_ref_groups(f);
+
+	if (options & BITMAP_OPT_ISLANDS)
+		hashwrite(f, writer.islands.buf, writer.islands.len);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, entries_end);
 
-	if (options & BITMAP_OPT_HASH_CACHE)
+	if (options & (BITMAP_OPT_HASH_CACHE | BITMAP_OPT_HASH_CACHE_V2))
 		write_hash_cache(f, index, index_nr);
 
 	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
@@ -553,5 +861,6 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	if (rename(tmp_file.buf, filename))
 		die_errno("unable to rename temporary bitmap file to '%s'", filename);
 
+	strbuf_release(&writer.islands);
 	strbuf_release(&tmp_file);
 }
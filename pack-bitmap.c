@@ -5,6 +5,7 @@
 #include "revision.h"
 #include "progress.h"
 #include "list-objects.h"
+#include "list-objects-filter-options.h"
 #include "pack.h"
 #include "pack-bitmap.h"
 #include "pack-revindex.h"
@@ -12,6 +13,7 @@
 #include "packfile.h"
 #include "repository.h"
 #include "object-store.h"
+#include "midx.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -22,26 +24,50 @@ struct stored_bitmap {
 	struct ewah_bitmap *root;
 	struct stored_bitmap *xor;
 	int flags;
+
+	/*
+	 * With BITMAP_OPT_ROARING, the bitmap as read from the index;
+	 * "root" is then only made from it on demand.
+	 */
+	struct roaring_bitmap *roaring;
+};
+
+/*
+ * A bitmap of everything reachable from a group of tips (e.g. all the
+ * refs under "refs/pull/"); "tips" points into the mmapped index, as a
+ * sorted list of network-order bit positions.
+ */
+struct ref_group_bitmap {
+	uint32_t tips_nr;
+	const unsigned char *tips;
+	struct ewah_bitmap *bitmap;
 };
 
 /*
  * The active bitmap index for a repository. By design, repositories only have
  * a single bitmap index available (the index for the biggest packfile in
- * the repository), since bitmap indexes need full closure.
+ * the repository, or the one for the multi-pack-index), since bitmap indexes
+ * need full closure.
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
+	/*
+	 * Packfile to which this bitmap index belongs to; NULL if the
+	 * bitmap belongs to a multi-pack-index instead.
+	 */
 	struct packed_git *pack;
 
 	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
+	 * Multi-pack-index to which this bitmap index belongs to. Its
+	 * bit positions refer to the "pseudo-pack" order of the MIDX:
+	 * objects sorted by the pack they were selected from, then by
+	 * their offset within that pack. 'midx_pack_order' maps those
+	 * positions to positions in the MIDX.
 	 */
-	uint32_t reuse_objects;
+	struct multi_pack_index *midx;
+	uint32_t *midx_pack_order;
 
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
@@ -66,9 +92,33 @@ struct bitmap_index {
 	/* Number of bitmapped commits */
 	uint32_t entry_count;
 
+	/*
+	 * If not NULL, the lookup table (BITMAP_OPT_LOOKUP_TABLE) in map:
+	 * the entries are then only loaded into "bitmaps" when asked for,
+	 * and "table_loaded" holds the ones that were, by table row.
+	 */
+	const unsigned char *table;
+	size_t entries_start, entries_end;
+	struct stored_bitmap **table_loaded;
+
 	/* If not NULL, this is a name-hash cache pointing into map. */
 	uint32_t *hashes;
 
+	/*
+	 * The pack_name_hash_version() of the cache; the objects of the
+	 * extended index are hashed the same way.
+	 */
+	int name_hash_version;
+
+	/* Ref group bitmaps, if BITMAP_OPT_REF_GROUPS is set */
+	int has_ref_groups;
+	struct ref_group_bitmap *ref_groups;
+	uint32_t ref_groups_nr;
+
+	/* Delta-island marks, if BITMAP_OPT_ISLANDS is set */
+	int has_islands;
+	struct bitmap_islands islands;
+
 	/*
 	 * Extended index.
 	 *
@@ -91,13 +141,48 @@ struct bitmap_index {
 
 	/* Version of the bitmap index */
 	unsigned int version;
+
+	/* Whether the bitmaps use the roaring encoding instead of EWAH */
+	int roaring;
 };
 
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
+/*
+ * Fill in 'oid' with the object at index position 'n' (i.e., in
+ * the lexicographic order of the .idx or of the MIDX).
+ */
+static int nth_bitmap_object_oid(struct bitmap_index *index,
+				 struct object_id *oid,
+				 uint32_t n)
+{
+	if (index->midx) {
+		if (n >= index->midx->num_objects)
+			return -1;
+		nth_midxed_object_oid(oid, index->midx, n);
+		return 0;
+	}
+	return nth_packed_object_oid(oid, index->pack, n) ? 0 : -1;
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
 	struct ewah_bitmap *composed;
 
+	if (!st->root) {
+		struct bitmap *b = bitmap_new();
+
+		bitmap_or_roaring(b, st->roaring);
+		st->root = bitmap_to_ewah(b);
+		bitmap_free(b);
+	}
+
 	if (st->xor == NULL)
 		return st->root;
 
@@ -112,15 +197,61 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 	return composed;
 }
 
+/*
+ * Add the objects of a stored bitmap to "dest", straight from the
+ * roaring encoding if it has one.
+ */
+static void bitmap_or_stored(struct bitmap *dest, struct stored_bitmap *st)
+{
+	if (st->roaring)
+		bitmap_or_roaring(dest, st->roaring);
+	else
+		bitmap_or_ewah(dest, lookup_stored_bitmap(st));
+}
+
+static struct roaring_bitmap *read_roaring_1(struct bitmap_index *index)
+{
+	struct roaring_bitmap *r = xcalloc(1, sizeof(*r));
+	ssize_t bitmap_size = roaring_read_mmap(r,
+		index->map + index->map_pos,
+		index->map_size - index->map_pos);
+
+	if (bitmap_size < 0) {
+		error("Failed to load bitmap index (corrupted?)");
+		free(r);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+	return r;
+}
+
 /*
  * Read a bitmap from the current read position on the mmaped
  * index, and increase the read position accordingly
  */
 static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 {
-	struct ewah_bitmap *b = ewah_pool_new();
+	struct ewah_bitmap *b;
+	ssize_t bitmap_size;
+
+	if (index->roaring) {
+		struct roaring_bitmap *r = read_roaring_1(index);
+		struct bitmap *inflated;
+
+		if (!r)
+			return NULL;
+		inflated = bitmap_new();
+		bitmap_or_roaring(inflated, r);
+		b = bitmap_to_ewah(inflated);
+		bitmap_free(inflated);
+		roaring_release(r);
+		free(r);
+		return b;
+	}
 
-	ssize_t bitmap_size = ewah_read_mmap(b,
+	b = ewah_pool_new();
+	bitmap_size = ewah_read_mmap(b,
 		index->map + index->map_pos,
 		index->map_size - index->map_pos);
 
@@ -134,6 +265,10 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 	return b;
 }
 
+/* commit position, offset and XOR base row of each lookup table row */
+#define BITMAP_LOOKUP_ROW 16
+#define BITMAP_LOOKUP_NO_XOR 0xffffffff
+
 static int load_bitmap_header(struct bitmap_index *index)
 {
 	struct bitmap_disk_header *header = (void *)index->map;
@@ -145,9 +280,13 @@ static int load_bitmap_header(struct bitmap_index *index)
 		return error("Corrupted bitmap index file (wrong header)");
 
 	index->version = ntohs(header->version);
-	if (index->version != 1)
+	if (index->version != 1 && index->version != 2)
 		return error("Unsupported version for bitmap index file (%d)", index->version);
 
+	if (index->midx &&
+	    !hasheq(header->checksum, get_midx_checksum(index->midx)))
+		return error("Checksum mismatch between multi-pack-index and bitmap");
+
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
@@ -156,19 +295,58 @@ static int load_bitmap_header(struct bitmap_index *index)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
-		if (flags & BITMAP_OPT_HASH_CACHE) {
+		if ((flags & BITMAP_OPT_HASH_CACHE) &&
+		    (flags & BITMAP_OPT_HASH_CACHE_V2))
+			return error("Bitmap index has two name-hash caches");
+		if (flags & (BITMAP_OPT_HASH_CACHE | BITMAP_OPT_HASH_CACHE_V2)) {
 			unsigned char *end = index->map + index->map_size - the_hash_algo->rawsz;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects(index);
 		}
+		index->name_hash_version =
+			flags & BITMAP_OPT_HASH_CACHE_V2 ? 2 : 1;
+
+		if (flags & BITMAP_OPT_REF_GROUPS)
+			index->has_ref_groups = 1;
+
+		if (flags & BITMAP_OPT_ISLANDS)
+			index->has_islands = 1;
+
+		/*
+		 * Version 2 only differs in the encoding of the bitmaps,
+		 * which version 1 readers would misread.
+		 */
+		index->roaring = !!(flags & BITMAP_OPT_ROARING);
+		if (index->roaring != (index->version == 2))
+			return error("Bitmap index version %d does not match "
+				     "its encoding", index->version);
 	}
 
 	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz;
+
+	if (ntohs(header->options) & BITMAP_OPT_LOOKUP_TABLE) {
+		size_t end = index->map_size - the_hash_algo->rawsz;
+		size_t table_size = st_add(st_mult(index->entry_count,
+						   BITMAP_LOOKUP_ROW),
+					   sizeof(uint64_t));
+
+		if (index->hashes)
+			end -= st_mult(bitmap_num_objects(index),
+				       sizeof(uint32_t));
+		if (end < index->map_pos || end - index->map_pos < table_size)
+			return error("Corrupted bitmap index (truncated lookup table)");
+		index->table = index->map + end - table_size;
+		index->entries_end = get_be64(index->table + table_size -
+					      sizeof(uint64_t));
+		if (index->entries_end > end - table_size)
+			return error("Corrupted bitmap index (bad lookup table)");
+	}
 	return 0;
 }
 
 static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 					  struct ewah_bitmap *root,
+					  struct roaring_bitmap *roaring,
 					  const unsigned char *hash,
 					  struct stored_bitmap *xor_with,
 					  int flags)
@@ -179,6 +357,7 @@ static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 
 	stored = xmalloc(sizeof(struct stored_bitmap));
 	stored->root = root;
+	stored->roaring = roaring;
 	stored->xor = xor_with;
 	stored->flags = flags;
 	oidread(&stored->oid, hash);
@@ -219,19 +398,30 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	for (i = 0; i < index->entry_count; ++i) {
 		int xor_offset, flags;
 		struct ewah_bitmap *bitmap = NULL;
+		struct roaring_bitmap *roaring = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
-		const unsigned char *sha1;
+		struct object_id oid;
 
 		commit_idx_pos = read_be32(index->map, &index->map_pos);
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (nth_bitmap_object_oid(index, &oid, commit_idx_pos) < 0)
+			return error("Corrupted bitmap pack index");
 
-		bitmap = read_bitmap_1(index);
-		if (!bitmap)
-			return -1;
+		if (index->roaring) {
+			/* roaring bitmaps are never XORed */
+			if (xor_offset)
+				return error("Corrupted bitmap pack index");
+			roaring = read_roaring_1(index);
+			if (!roaring)
+				return -1;
+		} else {
+			bitmap = read_bitmap_1(index);
+			if (!bitmap)
+				return -1;
+		}
 
 		if (xor_offset > MAX_XOR_OFFSET || xor_offset > i)
 			return error("Corrupted bitmap pack index");
@@ -244,8 +434,207 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		}
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
-			index, bitmap, sha1, xor_bitmap, flags);
+			index, bitmap, roaring, oid.hash, xor_bitmap, flags);
+	}
+
+	return 0;
+}
+
+/*
+ * Load the entry in row "row" of the lookup table, and the one it is
+ * XORed against, if they were not yet.
+ */
+static struct stored_bitmap *load_bitmap_row(struct bitmap_index *index,
+					     uint32_t row)
+{
+	const unsigned char *p = index->table + st_mult(row, BITMAP_LOOKUP_ROW);
+	uint32_t commit_idx_pos = get_be32(p);
+	uint64_t offset = get_be64(p + 4);
+	uint32_t xor_row = get_be32(p + 12);
+	struct stored_bitmap *xor_bitmap = NULL;
+	struct ewah_bitmap *bitmap = NULL;
+	struct roaring_bitmap *roaring = NULL;
+	struct object_id oid;
+	int xor_offset, flags;
+
+	if (index->table_loaded[row])
+		return index->table_loaded[row];
+
+	if (offset < index->entries_start ||
+	    offset + 6 > index->entries_end) {
+		error("Corrupted bitmap index (bad offset in lookup table)");
+		return NULL;
+	}
+	if (xor_row != BITMAP_LOOKUP_NO_XOR) {
+		/* a base is always written before, which rules out cycles */
+		if (xor_row >= index->entry_count ||
+		    get_be64(index->table +
+			     st_mult(xor_row, BITMAP_LOOKUP_ROW) + 4) >= offset) {
+			error("Corrupted bitmap index (bad XOR row in lookup table)");
+			return NULL;
+		}
+		xor_bitmap = load_bitmap_row(index, xor_row);
+		if (!xor_bitmap)
+			return NULL;
+	}
+
+	index->map_pos = offset;
+	if (read_be32(index->map, &index->map_pos) != commit_idx_pos ||
+	    nth_bitmap_object_oid(index, &oid, commit_idx_pos) < 0) {
+		error("Corrupted bitmap pack index");
+		return NULL;
+	}
+	xor_offset = read_u8(index->map, &index->map_pos);
+	flags = read_u8(index->map, &index->map_pos);
+	if (!xor_offset != !xor_bitmap) {
+		error("Corrupted bitmap pack index");
+		return NULL;
+	}
+
+	if (index->roaring)
+		roaring = read_roaring_1(index);
+	else
+		bitmap = read_bitmap_1(index);
+	if (!roaring && !bitmap)
+		return NULL;
+
+	index->table_loaded[row] = store_bitmap(index, bitmap, roaring,
+						oid.hash, xor_bitmap, flags);
+	return index->table_loaded[row];
+}
+
+/*
+ * Find the stored bitmap of the commit "oid", loading it from the
+ * lookup table if need be. Return NULL if the commit has none.
+ */
+static struct stored_bitmap *find_stored_bitmap(struct bitmap_index *index,
+						const struct object_id *oid)
+{
+	khiter_t hash_pos = kh_get_oid_map(index->bitmaps, *oid);
+	uint32_t idx_pos, lo = 0, hi = index->entry_count;
+
+	if (hash_pos < kh_end(index->bitmaps))
+		return kh_value(index->bitmaps, hash_pos);
+	if (!index->table)
+		return NULL;
+
+	if (index->midx ? !bsearch_midx(oid, index->midx, &idx_pos) :
+			  !bsearch_pack(oid, index->pack, &idx_pos))
+		return NULL;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t pos = get_be32(index->table +
+					st_mult(mi, BITMAP_LOOKUP_ROW));
+
+		if (pos == idx_pos)
+			return load_bitmap_row(index, mi);
+		if (pos < idx_pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+/* Load every entry, for the callers that go over all of them. */
+static void load_all_bitmap_rows(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	if (!index->table)
+		return;
+	for (i = 0; i < index->entry_count; i++)
+		load_bitmap_row(index, i);
+}
+
+/* Where the sections that follow the entries end. */
+static size_t sections_end(struct bitmap_index *index)
+{
+	size_t end = index->map_size - the_hash_algo->rawsz;
+
+	if (index->table)
+		return index->table - index->map;
+	if (index->hashes)
+		end -= st_mult(bitmap_num_objects(index), sizeof(uint32_t));
+	return end;
+}
+
+static int load_ref_groups(struct bitmap_index *index)
+{
+	size_t end = sections_end(index);
+	uint32_t i, j;
+
+	if (index->map_pos + sizeof(uint32_t) > end)
+		return error("Corrupted bitmap index (truncated ref groups)");
+	index->ref_groups_nr = read_be32(index->map, &index->map_pos);
+	if ((end - index->map_pos) / sizeof(uint32_t) < index->ref_groups_nr)
+		return error("Corrupted bitmap index (truncated ref groups)");
+	CALLOC_ARRAY(index->ref_groups, index->ref_groups_nr);
+
+	for (i = 0; i < index->ref_groups_nr; i++) {
+		struct ref_group_bitmap *group = &index->ref_groups[i];
+
+		if (index->map_pos + sizeof(uint32_t) > end)
+			return error("Corrupted bitmap index (truncated ref groups)");
+		group->tips_nr = read_be32(index->map, &index->map_pos);
+
+		if ((end - index->map_pos) / sizeof(uint32_t) < group->tips_nr)
+			return error("Corrupted bitmap index (truncated ref groups)");
+		group->tips = index->map + index->map_pos;
+		for (j = 0; j < group->tips_nr; j++)
+			if (get_be32(group->tips + j * sizeof(uint32_t)) >=
+			    bitmap_num_objects(index))
+				return error("Corrupted bitmap index (ref group tip out of range)");
+		index->map_pos += group->tips_nr * sizeof(uint32_t);
+
+		group->bitmap = read_bitmap_1(index);
+		if (!group->bitmap)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int load_islands(struct bitmap_index *index)
+{
+	struct bitmap_islands *islands = &index->islands;
+	size_t end = sections_end(index);
+	uint32_t i;
+
+	if (index->map_pos + sizeof(uint32_t) > end)
+		return error("Corrupted bitmap index (truncated islands)");
+	islands->islands_nr = read_be32(index->map, &index->map_pos);
+	if ((end - index->map_pos) / sizeof(uint64_t) < islands->islands_nr)
+		return error("Corrupted bitmap index (truncated islands)");
+	islands->hashes = index->map + index->map_pos;
+	index->map_pos += st_mult(islands->islands_nr, sizeof(uint64_t));
+
+	if (end - index->map_pos < 2 * sizeof(uint32_t))
+		return error("Corrupted bitmap index (truncated islands)");
+	islands->sets_nr = read_be32(index->map, &index->map_pos);
+	islands->words = read_be32(index->map, &index->map_pos);
+	if (islands->words != islands->islands_nr / 32 + 1)
+		return error("Corrupted bitmap index (bad island sets)");
+	if ((end - index->map_pos) / sizeof(uint32_t) / islands->words <
+	    islands->sets_nr)
+		return error("Corrupted bitmap index (truncated islands)");
+	islands->sets = index->map + index->map_pos;
+	index->map_pos += st_mult(st_mult(islands->sets_nr, islands->words),
+				  sizeof(uint32_t));
+
+	islands->objects_nr = bitmap_num_objects(index);
+	if ((end - index->map_pos) / sizeof(uint32_t) < islands->objects_nr)
+		return error("Corrupted bitmap index (truncated islands)");
+	islands->object_sets = index->map + index->map_pos;
+	for (i = 0; i < islands->objects_nr; i++) {
+		uint32_t set = get_be32(islands->object_sets +
+					i * sizeof(uint32_t));
+
+		if (set != BITMAP_NO_ISLANDS && set >= islands->sets_nr)
+			return error("Corrupted bitmap index (island set out of range)");
 	}
+	index->map_pos += st_mult(islands->objects_nr, sizeof(uint32_t));
 
 	return 0;
 }
@@ -259,6 +648,49 @@ static char *pack_bitmap_filename(struct packed_git *p)
 	return xstrfmt("%.*s.bitmap", (int)len, p->pack_name);
 }
 
+static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	int fd;
+	struct stat st;
+	char *idx_name;
+
+	idx_name = get_midx_bitmap_filename(midx);
+	fd = git_open(idx_name);
+	free(idx_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	if (bitmap_git->pack || bitmap_git->midx) {
+		warning("ignoring extra bitmap file for multi-pack-index in %s",
+			midx->object_dir);
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0) {
+		munmap(bitmap_git->map, bitmap_git->map_size);
+		bitmap_git->map = NULL;
+		bitmap_git->map_size = 0;
+		bitmap_git->midx = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
 static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git *packfile)
 {
 	int fd;
@@ -280,7 +712,7 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		return -1;
 	}
 
-	if (bitmap_git->pack) {
+	if (bitmap_git->pack || bitmap_git->midx) {
 		warning("ignoring extra bitmap file: %s", packfile->pack_name);
 		close(fd);
 		return -1;
@@ -296,19 +728,28 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		munmap(bitmap_git->map, bitmap_git->map_size);
 		bitmap_git->map = NULL;
 		bitmap_git->map_size = 0;
+		bitmap_git->pack = NULL;
 		return -1;
 	}
 
 	return 0;
 }
 
-static int load_pack_bitmap(struct bitmap_index *bitmap_git)
+static int load_bitmap(struct repository *r, struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
 
 	bitmap_git->bitmaps = kh_init_oid_map();
 	bitmap_git->ext_index.positions = kh_init_oid_pos();
-	if (load_pack_revindex(bitmap_git->pack))
+	if (bitmap_git->midx) {
+		struct multi_pack_index *m = bitmap_git->midx;
+		uint32_t i;
+
+		for (i = 0; i < m->num_packs; i++)
+			if (prepare_midx_pack(r, m, i))
+				goto failed;
+		bitmap_git->midx_pack_order = midx_pack_order(m);
+	} else if (load_pack_revindex(bitmap_git->pack))
 		goto failed;
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
@@ -317,7 +758,23 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(bitmap_git) < 0)
+	if (bitmap_git->table) {
+		/* the entries are loaded as they are looked up */
+		bitmap_git->entries_start = bitmap_git->map_pos;
+		if (bitmap_git->entries_end < bitmap_git->entries_start) {
+			error("Corrupted bitmap index (bad lookup table)");
+			goto failed;
+		}
+		CALLOC_ARRAY(bitmap_git->table_loaded,
+			     bitmap_git->entry_count);
+		bitmap_git->map_pos = bitmap_git->entries_end;
+	} else if (load_bitmap_entries_v1(bitmap_git) < 0)
+		goto failed;
+
+	if (bitmap_git->has_ref_groups && load_ref_groups(bitmap_git) < 0)
+		goto failed;
+
+	if (bitmap_git->has_islands && load_islands(bitmap_git) < 0)
 		goto failed;
 
 	return 0;
@@ -345,11 +802,30 @@ static int open_pack_bitmap(struct repository *r,
 	return ret;
 }
 
+static int open_bitmap(struct repository *r,
+		       struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *m;
+
+	assert(!bitmap_git->map);
+
+	/*
+	 * A bitmap for the multi-pack-index covers the objects of all
+	 * of its packs, so prefer it over any single-pack bitmap.
+	 */
+	for (m = get_multi_pack_index(r); m; m = m->next) {
+		if (m->local && !open_midx_bitmap_1(bitmap_git, m))
+			return 0;
+	}
+
+	return open_pack_bitmap(r, bitmap_git);
+}
+
 struct bitmap_index *prepare_bitmap_git(struct repository *r)
 {
 	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 
-	if (!open_pack_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
+	if (!open_bitmap(r, bitmap_git) && !load_bitmap(r, bitmap_git))
 		return bitmap_git;
 
 	free_bitmap_index(bitmap_git);
@@ -370,20 +846,41 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
 }
 
+static int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				const struct object_id *oid)
+{
+	uint32_t want, got;
+
+	if (!bsearch_midx(oid, bitmap_git->midx, &want))
+		return -1;
+	if (midx_to_pack_pos(bitmap_git->midx, bitmap_git->midx_pack_order,
+			     want, &got) < 0)
+		return -1;
+	return got;
+}
+
 static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 					   const struct object_id *oid)
 {
-	off_t offset = find_pack_entry_one(oid->hash, bitmap_git->pack);
+	uint32_t pos;
+	off_t offset;
+
+	if (bitmap_git->midx)
+		return bitmap_position_midx(bitmap_git, oid);
+
+	offset = find_pack_entry_one(oid->hash, bitmap_git->pack);
 	if (!offset)
 		return -1;
 
-	return find_revindex_position(bitmap_git->pack, offset);
+	if (offset_to_pack_pos(bitmap_git->pack, offset, &pos) < 0)
+		return -1;
+	return pos;
 }
 
 static int bitmap_position(struct bitmap_index *bitmap_git,
@@ -412,14 +909,16 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 
 		bitmap_pos = eindex->count;
 		eindex->objects[eindex->count] = object;
-		eindex->hashes[eindex->count] = pack_name_hash(name);
+		eindex->hashes[eindex->count] =
+			pack_name_hash_version(bitmap_git->name_hash_version,
+					       name);
 		kh_value(eindex->positions, hash_pos) = bitmap_pos;
 		eindex->count++;
 	} else {
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -450,7 +949,7 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      const struct object_id *oid,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct stored_bitmap *st;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -458,10 +957,9 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_oid_map(bitmap_git->bitmaps, *oid);
-	if (hash_pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, hash_pos);
-		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
+	st = find_stored_bitmap(bitmap_git, oid);
+	if (st) {
+		bitmap_or_stored(data->base, st);
 		return 0;
 	}
 
@@ -495,6 +993,49 @@ static int should_include(struct commit *commit, void *_data)
 	return 1;
 }
 
+/*
+ * Returns the union of the ref groups all of whose tips are among
+ * "roots", or NULL if there is no such group.
+ */
+static struct bitmap *find_ref_groups(struct bitmap_index *bitmap_git,
+				      struct object_list *roots)
+{
+	struct bitmap *tips = bitmap_new(), *base = NULL;
+	uint32_t i, j, used = 0;
+
+	for (; roots; roots = roots->next) {
+		int pos;
+
+		if (roots->item->type != OBJ_COMMIT)
+			continue;
+		pos = bitmap_position(bitmap_git, &roots->item->oid);
+		if (pos >= 0)
+			bitmap_set(tips, pos);
+	}
+
+	for (i = 0; i < bitmap_git->ref_groups_nr; i++) {
+		struct ref_group_bitmap *group = &bitmap_git->ref_groups[i];
+
+		for (j = 0; j < group->tips_nr; j++)
+			if (!bitmap_get(tips, get_be32(group->tips +
+						      j * sizeof(uint32_t))))
+				break;
+		if (j < group->tips_nr)
+			continue;
+
+		if (!base)
+			base = ewah_to_bitmap(group->bitmap);
+		else
+			bitmap_or_ewah(base, group->bitmap);
+		used++;
+	}
+
+	bitmap_free(tips);
+	trace2_data_intmax("pack-bitmap", the_repository,
+			   "ref-groups-used", used);
+	return base;
+}
+
 static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 				   struct rev_info *revs,
 				   struct object_list *roots,
@@ -505,6 +1046,14 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 
 	struct object_list *not_mapped = NULL;
 
+	/*
+	 * A ref group whose tips are all among the roots stands for all of
+	 * them at once; those tips are then found in "base" below, and are
+	 * not walked.
+	 */
+	if (bitmap_git->ref_groups_nr)
+		base = find_ref_groups(bitmap_git, roots);
+
 	/*
 	 * Go through all the roots for the walk. The ones that have bitmaps
 	 * on the bitmap index will be `or`ed together to form an initial
@@ -518,16 +1067,13 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_oid_map(bitmap_git->bitmaps, object->oid);
-
-			if (pos < kh_end(bitmap_git->bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
-				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
+			struct stored_bitmap *st =
+				find_stored_bitmap(bitmap_git, &object->oid);
 
+			if (st) {
 				if (base == NULL)
-					base = ewah_to_bitmap(or_with);
-				else
-					bitmap_or_ewah(base, or_with);
+					base = bitmap_new();
+				bitmap_or_stored(base, st);
 
 				object->flags |= SEEN;
 				continue;
@@ -608,7 +1154,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -630,9 +1176,6 @@ static void show_objects_for_type(
 
 	struct bitmap *objects = bitmap_git->result;
 
-	if (bitmap_git->reuse_objects == bitmap_git->pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
@@ -640,7 +1183,9 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
+			struct packed_git *pack;
+			uint32_t index_pos;
+			off_t ofs;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -648,16 +1193,24 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			if (pos + offset < bitmap_git->reuse_objects)
-				continue;
-
-			entry = &bitmap_git->pack->revindex[pos + offset];
-			nth_packed_object_oid(&oid, bitmap_git->pack, entry->nr);
+			if (bitmap_git->midx) {
+				struct multi_pack_index *m = bitmap_git->midx;
+
+				index_pos = bitmap_git->midx_pack_order[pos + offset];
+				nth_midxed_object_oid(&oid, m, index_pos);
+				pack = m->packs[nth_midxed_pack_int_id(m, index_pos)];
+				ofs = nth_midxed_offset(m, index_pos);
+			} else {
+				pack = bitmap_git->pack;
+				index_pos = pack_pos_to_index(pack, pos + offset);
+				nth_packed_object_oid(&oid, pack, index_pos);
+				ofs = pack_pos_to_offset(pack, pos + offset);
+			}
 
 			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + entry->nr);
+				hash = get_be32(bitmap_git->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, entry->offset);
+			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
 
 		pos += BITS_IN_EWORD;
@@ -672,14 +1225,230 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_git->midx) {
+			uint32_t pos;
+			if (bsearch_midx(&object->oid, bitmap_git->midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 			return 1;
 	}
 
 	return 0;
 }
 
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
+static struct ewah_bitmap *type_bitmap(struct bitmap_index *bitmap_git,
+				       enum object_type type)
+{
+	switch (type) {
+	case OBJ_COMMIT:
+		return bitmap_git->commits;
+	case OBJ_TREE:
+		return bitmap_git->trees;
+	case OBJ_BLOB:
+		return bitmap_git->blobs;
+	case OBJ_TAG:
+		return bitmap_git->tags;
+	default:
+		BUG("no type bitmap for %s", type_name(type));
+	}
+}
+
+/*
+ * The objects of "type" that were asked for by name: a filter never
+ * omits those.
+ */
+static struct bitmap *find_tip_objects(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       enum object_type type)
+{
+	struct bitmap *result = bitmap_new();
+
+	for (; tip_objects; tip_objects = tip_objects->next) {
+		struct object *object = tip_objects->item;
+		int pos;
+
+		if (object->type != type)
+			continue;
+		pos = bitmap_position(bitmap_git, &object->oid);
+		if (pos >= 0)
+			bitmap_set(result, pos);
+	}
+
+	return result;
+}
+
+static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       struct bitmap *to_filter,
+				       enum object_type type)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct bitmap *tips = find_tip_objects(bitmap_git, tip_objects, type);
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	/*
+	 * The type bitmap only covers the objects of the bitmapped pack;
+	 * those in the extended index are looked at one by one.
+	 */
+	ewah_iterator_init(&it, type_bitmap(bitmap_git, type));
+	for (i = 0; i < to_filter->word_alloc &&
+		    ewah_iterator_next(&mask, &it); i++) {
+		if (i < tips->word_alloc)
+			mask &= ~tips->words[i];
+		to_filter->words[i] &= ~mask;
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
+
+		if (eindex->objects[i]->type == type &&
+		    !bitmap_get(tips, pos))
+			bitmap_unset(to_filter, pos);
+	}
+
+	bitmap_free(tips);
+}
+
+static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
+				     uint32_t pos)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	struct packed_git *pack;
+	unsigned long size;
+	off_t ofs;
+
+	oi.sizep = &size;
+
+	if (pos >= bitmap_num_objects(bitmap_git)) {
+		struct eindex *eindex = &bitmap_git->ext_index;
+		struct object *obj;
+
+		obj = eindex->objects[pos - bitmap_num_objects(bitmap_git)];
+		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
+			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
+		return size;
+	}
+
+	if (bitmap_git->midx) {
+		struct multi_pack_index *m = bitmap_git->midx;
+		uint32_t index_pos = bitmap_git->midx_pack_order[pos];
+
+		pack = m->packs[nth_midxed_pack_int_id(m, index_pos)];
+		ofs = nth_midxed_offset(m, index_pos);
+	} else {
+		pack = bitmap_git->pack;
+		ofs = pack_pos_to_offset(pack, pos);
+	}
+
+	/* Only the object header (or delta header) is read. */
+	if (packed_object_info(the_repository, pack, ofs, &oi) < 0)
+		die(_("unable to get size of object at offset %"PRIuMAX" in %s"),
+		    (uintmax_t)ofs, pack->pack_name);
+	return size;
+}
+
+static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
+				     struct object_list *tip_objects,
+				     struct bitmap *to_filter,
+				     unsigned long limit)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct bitmap *tips = find_tip_objects(bitmap_git, tip_objects,
+					       OBJ_BLOB);
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	ewah_iterator_init(&it, bitmap_git->blobs);
+	for (i = 0; i < to_filter->word_alloc &&
+		    ewah_iterator_next(&mask, &it); i++) {
+		eword_t word = to_filter->words[i] & mask;
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			uint32_t pos;
+
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			pos = i * BITS_IN_EWORD + offset;
+
+			if (!bitmap_get(tips, pos) &&
+			    get_size_by_pos(bitmap_git, pos) >= limit)
+				bitmap_unset(to_filter, pos);
+		}
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
+
+		if (eindex->objects[i]->type == OBJ_BLOB &&
+		    bitmap_get(to_filter, pos) &&
+		    !bitmap_get(tips, pos) &&
+		    get_size_by_pos(bitmap_git, pos) >= limit)
+			bitmap_unset(to_filter, pos);
+	}
+
+	bitmap_free(tips);
+}
+
+/*
+ * Whether "filter" can be applied to the result of a bitmap walk, that
+ * is, from the type and size of each object alone. The other filters
+ * need to know the path at which an object is found, or its depth.
+ */
+static int can_filter_bitmap(struct list_objects_filter_options *filter)
+{
+	if (!filter)
+		return 1;
+
+	switch (filter->choice) {
+	case LOFC_DISABLED:
+	case LOFC_BLOB_NONE:
+	case LOFC_BLOB_LIMIT:
+		return 1;
+	case LOFC_TREE_DEPTH:
+		return !filter->tree_exclude_depth;
+	default:
+		return 0;
+	}
+}
+
+static void filter_bitmap(struct bitmap_index *bitmap_git,
+			  struct object_list *tip_objects,
+			  struct bitmap *to_filter,
+			  struct list_objects_filter_options *filter)
+{
+	if (!filter)
+		return;
+
+	switch (filter->choice) {
+	case LOFC_DISABLED:
+		break;
+	case LOFC_BLOB_NONE:
+		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_BLOB);
+		break;
+	case LOFC_BLOB_LIMIT:
+		filter_bitmap_blob_limit(bitmap_git, tip_objects, to_filter,
+					 filter->blob_limit_value);
+		break;
+	case LOFC_TREE_DEPTH:
+		/* tree:0, see can_filter_bitmap() */
+		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_TREE);
+		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_BLOB);
+		break;
+	default:
+		BUG("unsupported bitmap filter %d", filter->choice);
+	}
+}
+
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter)
 {
 	unsigned int i;
 
@@ -689,10 +1458,15 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	struct bitmap *wants_bitmap = NULL;
 	struct bitmap *haves_bitmap = NULL;
 
-	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
+	struct bitmap_index *bitmap_git;
+
+	if (!can_filter_bitmap(filter))
+		return NULL;
+
+	bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
-	if (open_pack_bitmap(revs->repo, bitmap_git) < 0)
+	if (open_bitmap(revs->repo, bitmap_git) < 0)
 		goto cleanup;
 
 	for (i = 0; i < revs->pending.nr; ++i) {
@@ -737,7 +1511,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	 * from disk. this is the point of no return; after this the rev_list
 	 * becomes invalidated and we must perform the revwalk through bitmaps
 	 */
-	if (load_pack_bitmap(bitmap_git) < 0)
+	if (load_bitmap(revs->repo, bitmap_git) < 0)
 		goto cleanup;
 
 	object_array_clear(&revs->pending);
@@ -760,6 +1534,8 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
+	filter_bitmap(bitmap_git, wants, wants_bitmap, filter);
+
 	bitmap_git->result = wants_bitmap;
 	bitmap_git->haves = haves_bitmap;
 
@@ -770,65 +1546,242 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	return NULL;
 }
 
-int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
-				       struct packed_git **packfile,
-				       uint32_t *entries,
-				       off_t *up_to)
+/*
+ * Return the offset of the object at bitmap position "pos", which comes
+ * from "pack", and store in "end" (if not NULL) where it ends.
+ */
+off_t bitmapped_pack_object(struct bitmap_index *bitmap_git,
+			    const struct bitmapped_pack *pack,
+			    uint32_t pos, off_t *end)
 {
-	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
-	 */
-	static const double REUSE_PERCENT = 0.9;
+	uint32_t pack_pos;
+	off_t offset;
 
-	struct bitmap *result = bitmap_git->result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	if (pack->bitmap_nr == pack->p->num_objects) {
+		/* all objects of the pack, in the order of the pack */
+		pack_pos = pos - pack->bitmap_pos;
+		offset = pack_pos_to_offset(pack->p, pack_pos);
+	} else {
+		offset = nth_midxed_offset(bitmap_git->midx,
+					   bitmap_git->midx_pack_order[pos]);
+		if (!end)
+			return offset;
+		if (offset_to_pack_pos(pack->p, offset, &pack_pos) < 0)
+			die(_("no object at offset %"PRIuMAX" in %s"),
+			    (uintmax_t)offset, pack->p->pack_name);
+	}
+	if (end)
+		*end = pack_pos_to_offset(pack->p, pack_pos + 1);
+	return offset;
+}
 
-	assert(result);
+/*
+ * Find the bitmap position of the object at "offset" in "pack", if it
+ * is the copy of the object that the bitmap refers to.
+ */
+static int bitmapped_pack_pos(struct bitmap_index *bitmap_git,
+			      const struct bitmapped_pack *pack,
+			      off_t offset, uint32_t *pos)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	struct object_id oid;
+	uint32_t pack_pos, midx_pos;
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
+	if (offset_to_pack_pos(pack->p, offset, &pack_pos) < 0)
+		return -1;
+	if (pack->bitmap_nr == pack->p->num_objects) {
+		*pos = pack->bitmap_pos + pack_pos;
+		return 0;
+	}
 
-		reuse_objects += BITS_IN_EWORD;
+	/* the multi-pack-index may have picked the copy in another pack */
+	nth_packed_object_oid(&oid, pack->p,
+			      pack_pos_to_index(pack->p, pack_pos));
+	if (!bsearch_midx(&oid, m, &midx_pos) ||
+	    nth_midxed_pack_int_id(m, midx_pos) != pack->pack_int_id ||
+	    nth_midxed_offset(m, midx_pos) != offset)
+		return -1;
+	return midx_to_pack_pos(m, bitmap_git->midx_pack_order,
+				midx_pos, pos);
+}
+
+static int try_partial_reuse(struct bitmap_index *bitmap_git,
+			     const struct bitmapped_pack *pack,
+			     uint32_t pos, struct bitmap *reuse,
+			     struct pack_window **w_curs)
+{
+	off_t offset, header;
+	enum object_type type;
+	unsigned long size;
+
+	offset = header = bitmapped_pack_object(bitmap_git, pack, pos, NULL);
+	type = unpack_object_header(pack->p, w_curs, &offset, &size);
+	if (type < 0)
+		return 0; /* broken packfile, punt */
+
+	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		uint32_t base_pos;
+
+		/*
+		 * If we cannot find the base, the pack is corrupt; let the
+		 * normal code path complain about it in more detail.
+		 */
+		base_offset = get_delta_base(pack->p, w_curs, &offset,
+					     type, header);
+		if (!base_offset ||
+		    bitmapped_pack_pos(bitmap_git, pack, base_offset,
+				       &base_pos) < 0)
+			return 0;
+
+		/*
+		 * Send the delta only if its base goes out before it, from
+		 * the same pack. OFS_DELTA bases always come first in the
+		 * pack, and REF_DELTAs are rare in the packs we bitmap.
+		 */
+		if (base_pos >= pos || !bitmap_get(reuse, base_pos))
+			return 0;
 	}
 
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	bitmap_set(reuse, pos);
+	return 1;
+}
+
+/*
+ * Count the objects from "pos" on that are all in "bitmap", stopping
+ * at "end".
+ */
+static uint32_t count_set_run(struct bitmap *bitmap, uint32_t pos,
+			      uint32_t end)
+{
+	uint32_t start = pos;
 
-		entry = &bitmap_git->reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
+	while (pos < end) {
+		size_t word = pos / BITS_IN_EWORD;
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", hash_to_hex(sha1));
+		if (!(pos % BITS_IN_EWORD) && pos + BITS_IN_EWORD <= end &&
+		    word < bitmap->word_alloc &&
+		    bitmap->words[word] == (eword_t)~0) {
+			pos += BITS_IN_EWORD;
+			continue;
+		}
+		if (!bitmap_get(bitmap, pos))
+			break;
+		pos++;
 	}
-#endif
+	return pos - start;
+}
 
-	if (!reuse_objects)
-		return -1;
+static void add_bitmapped_packs(struct bitmap_index *bitmap_git,
+				struct bitmapped_pack **packs,
+				size_t *packs_nr)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	size_t packs_alloc = 0;
+	uint32_t pos = 0;
 
-	if (reuse_objects >= bitmap_git->pack->num_objects) {
-		bitmap_git->reuse_objects = *entries = bitmap_git->pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git->pack;
-		return 0;
+	if (!m) {
+		ALLOC_GROW(*packs, *packs_nr + 1, packs_alloc);
+		(*packs)[*packs_nr].p = bitmap_git->pack;
+		(*packs)[*packs_nr].pack_int_id = 0;
+		(*packs)[*packs_nr].bitmap_pos = 0;
+		(*packs)[*packs_nr].bitmap_nr = bitmap_git->pack->num_objects;
+		(*packs_nr)++;
+		return;
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git->result) * REUSE_PERCENT;
+	/* the pseudo-pack holds the objects of each pack in turn */
+	while (pos < m->num_objects) {
+		uint32_t pack_int_id, end = pos + 1;
+
+		pack_int_id = nth_midxed_pack_int_id(m,
+					bitmap_git->midx_pack_order[pos]);
+		while (end < m->num_objects &&
+		       nth_midxed_pack_int_id(m,
+				bitmap_git->midx_pack_order[end]) == pack_int_id)
+			end++;
+
+		if (!load_pack_revindex(m->packs[pack_int_id])) {
+			ALLOC_GROW(*packs, *packs_nr + 1, packs_alloc);
+			(*packs)[*packs_nr].p = m->packs[pack_int_id];
+			(*packs)[*packs_nr].pack_int_id = pack_int_id;
+			(*packs)[*packs_nr].bitmap_pos = pos;
+			(*packs)[*packs_nr].bitmap_nr = end - pos;
+			(*packs_nr)++;
+		}
+		pos = end;
+	}
+}
 
-	if (reuse_objects < reuse_threshold)
-		return -1;
+int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out)
+{
+	struct bitmap *result = bitmap_git->result;
+	struct bitmapped_pack *packs = NULL;
+	size_t packs_nr = 0, i, kept = 0;
+	struct bitmap *reuse = bitmap_new();
+	struct pack_window *w_curs = NULL;
 
-	bitmap_git->reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git->pack->revindex[reuse_objects].offset;
-	*packfile = bitmap_git->pack;
+	assert(result);
 
+	add_bitmapped_packs(bitmap_git, &packs, &packs_nr);
+
+	for (i = 0; i < packs_nr; i++) {
+		struct bitmapped_pack *pack = &packs[i];
+		uint32_t pos = pack->bitmap_pos;
+		uint32_t end = pos + pack->bitmap_nr;
+		uint32_t reused = 0;
+
+		/*
+		 * A run of objects from the start of a pack, all of them
+		 * wanted, is sent as is: every delta base it needs is in
+		 * it.
+		 */
+		if (pack->bitmap_nr == pack->p->num_objects) {
+			uint32_t run = count_set_run(result, pos, end);
+	
+			for (; reused < run; reused++)
+				bitmap_set(reuse, pos++);
+		}
+
+		for (; pos < end; pos++) {
+			size_t word = pos / BITS_IN_EWORD;
+
+			if (word >= result->word_alloc)
+				break;
+			if (!result->words[word]) {
+				pos |= BITS_IN_EWORD - 1;
+				continue;
+			}
+			if (bitmap_get(result, pos))
+				reused += try_partial_reuse(bitmap_git, pack, pos,
+							    reuse, &w_curs);
+		}
+		/* a window belongs to one pack */
+		unuse_pack(&w_curs);
+
+		if (reused)
+			packs[kept++] = *pack;
+	}
+
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
+		free(packs);
+		return -1;
+	}
+
+	/*
+	 * Drop the reused objects from the result, since they will not
+	 * need to be handled separately.
+	 */
+	bitmap_and_not(result, reuse);
+	*packs_out = packs;
+	*packs_nr_out = kept;
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -887,7 +1840,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -952,7 +1905,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct stored_bitmap *st;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 	struct bitmap_index *bitmap_git;
@@ -967,10 +1920,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git->version, bitmap_git->entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_oid_map(bitmap_git->bitmaps, root->oid);
+	st = find_stored_bitmap(bitmap_git, &root->oid);
 
-	if (pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
+	if (st) {
 		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
 
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
@@ -1053,16 +2005,19 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	num_objects = bitmap_git->pack->num_objects;
+	num_objects = bitmap_num_objects(bitmap_git);
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		struct object_id oid;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git->pack->revindex[i];
-		nth_packed_object_oid(&oid, bitmap_git->pack, entry->nr);
+		if (bitmap_git->midx)
+			nth_midxed_object_oid(&oid, bitmap_git->midx,
+					      bitmap_git->midx_pack_order[i]);
+		else
+			nth_packed_object_oid(&oid, bitmap_git->pack,
+					      pack_pos_to_index(bitmap_git->pack, i));
 		oe = packlist_find(mapping, &oid, NULL);
 
 		if (oe)
@@ -1075,6 +2030,7 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	if (show_progress)
 		progress = start_progress("Reusing bitmaps", 0);
 
+	load_all_bitmap_rows(bitmap_git);
 	kh_foreach_value(bitmap_git->bitmaps, stored, {
 		if (stored->flags & BITMAP_FLAG_REUSE) {
 			if (!rebuild_bitmap(reposition,
@@ -1110,6 +2066,14 @@ void free_bitmap_index(struct bitmap_index *b)
 	ewah_pool_free(b->blobs);
 	ewah_pool_free(b->tags);
 	kh_destroy_oid_map(b->bitmaps);
+	if (b->ref_groups) {
+		uint32_t i;
+		for (i = 0; i < b->ref_groups_nr; i++)
+			ewah_pool_free(b->ref_groups[i].bitmap);
+		free(b->ref_groups);
+	}
+	free(b->midx_pack_order);
+	free(b->table_loaded);
 	free(b->ext_index.objects);
 	free(b->ext_index.hashes);
 	bitmap_free(b->result);
@@ -1117,6 +2081,159 @@ void free_bitmap_index(struct bitmap_index *b)
 	free(b);
 }
 
+static struct bitmap *reachable_from(struct repository *r,
+				     struct bitmap_index *bitmap_git,
+				     struct commit *commit,
+				     int all_objects)
+{
+	struct rev_info revs;
+	struct object_list *roots = NULL;
+	struct bitmap *reachable;
+
+	repo_init_revisions(r, &revs, NULL);
+	revs.tree_objects = revs.blob_objects = all_objects;
+	object_list_insert(&commit->object, &roots);
+	reachable = find_objects(bitmap_git, &revs, roots, NULL);
+	reset_revision_walk();
+	free(roots);
+	return reachable;
+}
+
+struct bitmap *bitmap_reachable_from(struct repository *r,
+				     struct bitmap_index *bitmap_git,
+				     struct commit *commit)
+{
+	return reachable_from(r, bitmap_git, commit, 0);
+}
+
+struct bitmap *bitmap_objects_reachable_from(struct repository *r,
+					     struct bitmap_index *bitmap_git,
+					     struct commit *commit)
+{
+	return reachable_from(r, bitmap_git, commit, 1);
+}
+
+int bitmap_reaches_oid(struct bitmap_index *bitmap_git,
+		       struct bitmap *reachable,
+		       const struct object_id *oid)
+{
+	/*
+	 * Everything reachable has a position by now; an object that is
+	 * neither in the pack nor in the extended index was not reached.
+	 */
+	int pos = bitmap_position(bitmap_git, oid);
+
+	return pos >= 0 && bitmap_get(reachable, pos);
+}
+
+struct bitmap *bitmap_reachable_from_stored(struct bitmap_index *bitmap_git)
+{
+	struct bitmap *reachable = bitmap_new();
+	struct stored_bitmap *st;
+
+	load_all_bitmap_rows(bitmap_git);
+	kh_foreach_value(bitmap_git->bitmaps, st, {
+		bitmap_or_stored(reachable, st);
+	});
+	return reachable;
+}
+
+int bitmap_commit_reaches_oid(struct bitmap_index *bitmap_git,
+			      const struct object_id *commit,
+			      const struct object_id *oid)
+{
+	struct stored_bitmap *st = find_stored_bitmap(bitmap_git, commit);
+	struct ewah_iterator it;
+	size_t word_nr;
+	eword_t word;
+	int pos;
+
+	if (!st)
+		return -1;
+
+	/*
+	 * What a bitmapped commit reaches is all in the pack; an object
+	 * that is not in it is not reached.
+	 */
+	pos = bitmap_position_packfile(bitmap_git, oid);
+	if (pos < 0)
+		return 0;
+
+	if (st->roaring)
+		return roaring_get(st->roaring, pos);
+
+	ewah_iterator_init(&it, lookup_stored_bitmap(st));
+	for (word_nr = 0; ewah_iterator_next(&word, &it); word_nr++)
+		if (word_nr == pos / BITS_IN_EWORD)
+			return !!(word & ((eword_t)1 << (pos % BITS_IN_EWORD)));
+	return 0;
+}
+
+int bitmap_add_stored(struct bitmap_index *bitmap_git,
+		      struct bitmap *reachable,
+		      const struct object_id *commit)
+{
+	struct stored_bitmap *st = find_stored_bitmap(bitmap_git, commit);
+
+	if (!st)
+		return -1;
+	bitmap_or_stored(reachable, st);
+	return 0;
+}
+
+void bitmap_for_each_object(struct bitmap_index *bitmap_git,
+			    struct bitmap *objects,
+			    void (*fn)(const struct object_id *, void *),
+			    void *data)
+{
+	uint32_t num_objects = bitmap_num_objects(bitmap_git);
+	uint32_t i;
+
+	for (i = 0; i < num_objects; i++) {
+		struct object_id oid;
+
+		if (!bitmap_get(objects, i))
+			continue;
+		bitmap_object_oid(bitmap_git, i, &oid);
+		fn(&oid, data);
+	}
+
+	for (i = 0; i < bitmap_git->ext_index.count; i++) {
+		if (bitmap_get(objects, num_objects + i))
+			fn(&bitmap_git->ext_index.objects[i]->oid, data);
+	}
+}
+
+void bitmap_object_oid(struct bitmap_index *bitmap_git, uint32_t pos,
+		       struct object_id *oid)
+{
+	if (bitmap_git->midx)
+		nth_midxed_object_oid(oid, bitmap_git->midx,
+				      bitmap_git->midx_pack_order[pos]);
+	else
+		nth_packed_object_oid(oid, bitmap_git->pack,
+				      pack_pos_to_index(bitmap_git->pack, pos));
+}
+
+const struct bitmap_islands *bitmap_get_islands(struct bitmap_index *bitmap_git)
+{
+	return bitmap_git->has_islands ? &bitmap_git->islands : NULL;
+}
+
+int bitmap_verify_checksum(struct bitmap_index *bitmap_git)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	size_t len = bitmap_git->map_size - the_hash_algo->rawsz;
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, bitmap_git->map, len);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (!hasheq(hash, bitmap_git->map + len))
+		return error(_("bitmap file checksum mismatch"));
+	return 0;
+}
+
 int bitmap_has_oid_in_uninteresting(struct bitmap_index *bitmap_git,
 				    const struct object_id *oid)
 {
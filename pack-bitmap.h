@@ -6,8 +6,10 @@
 #include "pack-objects.h"
 
 struct commit;
+struct list_objects_filter_options;
 struct repository;
 struct rev_info;
+struct strbuf;
 
 struct bitmap_disk_header {
 	char magic[4];
@@ -24,6 +26,11 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_REF_GROUPS = 0x10,
+	BITMAP_OPT_ROARING = 0x20,
+	BITMAP_OPT_LOOKUP_TABLE = 0x40,
+	BITMAP_OPT_ISLANDS = 0x80,
+	BITMAP_OPT_HASH_CACHE_V2 = 0x100,
 };
 
 enum pack_bitmap_flags {
@@ -46,10 +53,42 @@ void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
 void traverse_bitmap_commit_list(struct bitmap_index *,
 				 show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs);
+/*
+ * Find the objects reachable from the pending objects of "revs", as
+ * traverse_bitmap_commit_list() will show them, leaving out those that
+ * "filter" omits. Returns NULL if there is no usable bitmap, or if the
+ * filter cannot be applied without a tree walk (only "blob:none",
+ * "blob:limit=<n>" and "tree:0" can).
+ */
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter);
+/*
+ * A pack whose objects are at bitmap positions [bitmap_pos, bitmap_pos +
+ * bitmap_nr), in the order of the pack. The objects of the pack that the
+ * multi-pack-index takes from other packs are not among them.
+ */
+struct bitmapped_pack {
+	struct packed_git *p;
+	uint32_t pack_int_id;
+	uint32_t bitmap_pos;
+	uint32_t bitmap_nr;
+};
+
+/*
+ * After prepare_bitmap_walk(), find the objects of the result that can
+ * be copied verbatim from the packs they are in: each one's delta base,
+ * if any, is copied before it from the same pack. These are set in
+ * "reuse" and dropped from the result; "packs" lists the packs they
+ * come from, in bitmap order. Returns -1 if there are none.
+ */
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
-				       struct packed_git **packfile,
-				       uint32_t *entries, off_t *up_to);
+				       struct bitmapped_pack **packs,
+				       size_t *packs_nr,
+				       uint32_t *entries,
+				       struct bitmap **reuse);
+off_t bitmapped_pack_object(struct bitmap_index *,
+			    const struct bitmapped_pack *pack,
+			    uint32_t pos, off_t *end);
 int rebuild_existing_bitmaps(struct bitmap_index *, struct packing_data *mapping,
 			     kh_oid_map_t *reused_bitmaps, int show_progress);
 void free_bitmap_index(struct bitmap_index *);
@@ -61,7 +100,102 @@ void free_bitmap_index(struct bitmap_index *);
  */
 int bitmap_has_oid_in_uninteresting(struct bitmap_index *, const struct object_id *oid);
 
+/*
+ * Return the set of objects reachable from "commit", as a bitmap that
+ * is to be queried with bitmap_reaches_oid() and freed with
+ * bitmap_free(). Commits outside of the bitmapped pack are walked, and
+ * objects reachable from several of them are only walked once across
+ * calls with the same bitmap index.
+ */
+struct bitmap *bitmap_reachable_from(struct repository *r,
+				     struct bitmap_index *bitmap_git,
+				     struct commit *commit);
+/*
+ * Like bitmap_reachable_from(), but the trees and blobs of the commits
+ * outside of the bitmapped pack are walked too, so that the bitmap has
+ * every object "commit" reaches.
+ */
+struct bitmap *bitmap_objects_reachable_from(struct repository *r,
+					     struct bitmap_index *bitmap_git,
+					     struct commit *commit);
+int bitmap_reaches_oid(struct bitmap_index *bitmap_git,
+		       struct bitmap *reachable,
+		       const struct object_id *oid);
+
+/*
+ * Return the set of objects reachable from any of the commits that have
+ * a bitmap, as a bitmap to be used like the one from
+ * bitmap_reachable_from(). No walk is needed: all of these objects are
+ * known to be present.
+ */
+struct bitmap *bitmap_reachable_from_stored(struct bitmap_index *bitmap_git);
+
+/*
+ * Tell from the stored bitmap of "commit" whether it reaches "oid",
+ * without any walk. Return -1 if "commit" has no bitmap of its own.
+ */
+int bitmap_commit_reaches_oid(struct bitmap_index *bitmap_git,
+			      const struct object_id *commit,
+			      const struct object_id *oid);
+
+/*
+ * Add to "reachable" (a bitmap as from bitmap_reachable_from_stored())
+ * the objects that the stored bitmap of "commit" says it reaches.
+ * Return -1, leaving "reachable" alone, if "commit" has no bitmap of
+ * its own.
+ */
+int bitmap_add_stored(struct bitmap_index *bitmap_git,
+		      struct bitmap *reachable,
+		      const struct object_id *commit);
+
+/*
+ * Call "fn" with the name of each object of the bitmapped pack (or
+ * multi-pack-index) that is in "objects", then with each object that
+ * the walks had to add after them.
+ */
+void bitmap_for_each_object(struct bitmap_index *bitmap_git,
+			    struct bitmap *objects,
+			    void (*fn)(const struct object_id *, void *),
+			    void *data);
+
+/*
+ * Find the name of the object at position "pos" of the bitmapped pack
+ * (or multi-pack-index).
+ */
+void bitmap_object_oid(struct bitmap_index *bitmap_git, uint32_t pos,
+		       struct object_id *oid);
+
+/*
+ * The delta-island marks stored with the bitmaps (BITMAP_OPT_ISLANDS):
+ * the hash of each island, as delta-islands.c computes it from the tips
+ * of its refs, "sets_nr" distinct sets of islands of "words" 32-bit
+ * words each, and for each of the "objects_nr" objects of the
+ * bitmapped pack, the set it is in or BITMAP_NO_ISLANDS. All numbers
+ * are in network order.
+ */
+struct bitmap_islands {
+	uint32_t islands_nr;
+	const unsigned char *hashes;
+	uint32_t sets_nr, words;
+	const unsigned char *sets;
+	uint32_t objects_nr;
+	const unsigned char *object_sets;
+};
+
+#define BITMAP_NO_ISLANDS 0xffffffff
+
+/* Return the delta-island marks of the bitmap, or NULL if it has none. */
+const struct bitmap_islands *bitmap_get_islands(struct bitmap_index *bitmap_git);
+
+/*
+ * Check the trailing checksum of the bitmap file. Return 0 if it
+ * matches, and -1 (after reporting an error) otherwise.
+ */
+int bitmap_verify_checksum(struct bitmap_index *bitmap_git);
+
 void bitmap_writer_show_progress(int show);
+/* Hash the names of the objects with pack_name_hash_version(). */
+void bitmap_writer_set_name_hash_version(int version);
 void bitmap_writer_set_checksum(unsigned char *sha1);
 void bitmap_writer_build_type_index(struct packing_data *to_pack,
 				    struct pack_idx_entry **index,
@@ -70,6 +204,8 @@ void bitmap_writer_reuse_bitmaps(struct packing_data *to_pack);
 void bitmap_writer_select_commits(struct commit **indexed_commits,
 		unsigned int indexed_commits_nr, int max_bitmaps);
 void bitmap_writer_build(struct packing_data *to_pack);
+/* Store "islands", laid out as in bitmap-format.txt, with the bitmaps. */
+void bitmap_writer_set_islands(struct strbuf *islands);
 void bitmap_writer_finish(struct pack_idx_entry **index,
 			  uint32_t index_nr,
 			  const char *filename,
@@ -5,6 +5,7 @@
 #include "progress.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -48,11 +49,161 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * The objects of a pack are checked by several threads, each taking
+ * VERIFY_CHUNK of them at a time in pack order, so that the delta base
+ * cache still helps. Reading from the pack happens under the object
+ * read lock (see object-store.h), but inflating and hashing the objects
+ * does not. The callback is not expected to be thread-safe, and is
+ * called under its own mutex.
+ */
+#define VERIFY_CHUNK 64
+
+struct verify_state {
+	struct repository *r;
+	struct packed_git *p;
+	struct idx_entry *entries;
+	uint32_t nr_objects;
+	verify_fn fn;
+	struct progress *progress;
+	uint32_t base_count;
+
+	pthread_mutex_t mutex; /* protects the fields below */
+	uint32_t next;
+	uint32_t done;
+};
+
+struct verify_thread {
+	pthread_t thread;
+	struct verify_state *state;
+	int err;
+};
+
+static inline void verify_lock(struct verify_state *state)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&state->mutex);
+}
+
+static inline void verify_unlock(struct verify_state *state)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&state->mutex);
+}
+
+static int verify_entry(struct verify_state *state,
+			struct pack_window **w_curs, uint32_t i)
+{
+	struct packed_git *p = state->p;
+	struct idx_entry *entries = state->entries;
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	off_t curpos;
+	int data_valid;
+	int corrupt = 0, err = 0;
+
+	obj_read_lock();
+	if (p->index_version > 1) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			err = error("index CRC mismatch for object %s "
+				    "from %s at offset %"PRIuMAX"",
+				    oid_to_hex(entries[i].oid.oid),
+				    p->pack_name, (uintmax_t)offset);
+	}
+
+	curpos = entries[i].offset;
+	type = unpack_object_header(p, w_curs, &curpos, &size);
+	unuse_pack(w_curs);
+
+	if (type == OBJ_BLOB && big_file_threshold <= size) {
+		/*
+		 * Let check_object_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		data = NULL;
+		data_valid = 0;
+	} else {
+		data = unpack_entry(state->r, p, entries[i].offset, &type, &size);
+		data_valid = 1;
+	}
+
+	if (data_valid) {
+		obj_read_unlock();
+		if (!data)
+			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+				    oid_to_hex(entries[i].oid.oid), p->pack_name,
+				    (uintmax_t)entries[i].offset);
+		else
+			corrupt = check_object_signature(entries[i].oid.oid,
+							 data, size, type_name(type));
+	} else {
+		/* streaming reads from the pack, so keep the lock for it */
+		corrupt = check_object_signature(entries[i].oid.oid,
+						 data, size, type_name(type));
+		obj_read_unlock();
+	}
+
+	if (corrupt)
+		err = error("packed %s from %s is corrupt",
+			    oid_to_hex(entries[i].oid.oid), p->pack_name);
+	else if ((data || !data_valid) && state->fn) {
+		int eaten = 0;
+		verify_lock(state);
+		err |= state->fn(entries[i].oid.oid, type, size, data, &eaten);
+		verify_unlock(state);
+		if (eaten)
+			data = NULL;
+	}
+
+	verify_lock(state);
+	state->done++;
+	if (((state->base_count + state->done) & 1023) == 0)
+		display_progress(state->progress,
+				 state->base_count + state->done);
+	verify_unlock(state);
+
+	free(data);
+	return err;
+}
+
+static void *verify_entries(void *data)
+{
+	struct verify_thread *me = data;
+	struct verify_state *state = me->state;
+	struct pack_window *w_curs = NULL;
+
+	for (;;) {
+		uint32_t i, end;
+
+		verify_lock(state);
+		i = state->next;
+		end = state->next = i + VERIFY_CHUNK < state->nr_objects ?
+			i + VERIFY_CHUNK : state->nr_objects;
+		verify_unlock(state);
+		if (i >= end)
+			break;
+
+		for (; i < end; i++)
+			me->err |= verify_entry(state, &w_curs, i);
+	}
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
@@ -63,6 +214,9 @@ static int verify_packfile(struct repository *r,
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
+	struct verify_state state;
+	struct verify_thread *threads;
+	int own_lock = 0;
 
 	if (!is_pack_valid(p))
 		return error("packfile %s cannot be accessed", p->pack_name);
@@ -105,60 +259,49 @@ static int verify_packfile(struct repository *r,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(entries[i].oid.oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
-
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB && big_file_threshold <= size) {
-			/*
-			 * Let check_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
-			data_valid = 1;
-		}
+	memset(&state, 0, sizeof(state));
+	state.r = r;
+	state.p = p;
+	state.entries = entries;
+	state.nr_objects = nr_objects;
+	state.fn = fn;
+	state.progress = progress;
+	state.base_count = base_count;
 
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(entries[i].oid.oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (check_object_signature(entries[i].oid.oid, data, size, type_name(type)))
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(entries[i].oid.oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(entries[i].oid.oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	if (nr_threads > 1 && nr_objects / VERIFY_CHUNK < nr_threads)
+		nr_threads = nr_objects / VERIFY_CHUNK + 1;
+	if (nr_threads > 1 && !obj_read_use_lock) {
+		enable_obj_read_lock();
+		own_lock = 1;
+	}
+	if (obj_read_use_lock)
+		pthread_mutex_init(&state.mutex, NULL);
 
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].state = &state;
+		if (nr_threads > 1 &&
+		    pthread_create(&threads[i].thread, NULL,
+				   verify_entries, &threads[i]))
+			die(_("unable to create thread"));
 	}
-	display_progress(progress, base_count + i);
+	if (nr_threads <= 1)
+		verify_entries(&threads[0]);
+	for (i = 0; i < nr_threads; i++) {
+		if (nr_threads > 1)
+			pthread_join(threads[i].thread, NULL);
+		err |= threads[i].err;
+	}
+	free(threads);
+
+	if (obj_read_use_lock)
+		pthread_mutex_destroy(&state.mutex);
+	if (own_lock)
+		disable_obj_read_lock();
+
+	display_progress(progress, base_count + nr_objects);
 	free(entries);
 
 	return err;
@@ -188,7 +331,7 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count, int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -197,7 +340,8 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
@@ -0,0 +1,118 @@
+#include "cache.h"
+#include "object-store.h"
+#include "pack-mtimes.h"
+#include "packfile.h"
+
+static char *pack_mtimes_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.mtimes", (int)len, p->pack_name);
+}
+
+#define MTIMES_HEADER_SIZE (12)
+#define MTIMES_MIN_SIZE (MTIMES_HEADER_SIZE + (2 * the_hash_algo->rawsz))
+
+int load_pack_mtimes(struct packed_git *p)
+{
+	char *mtimes_name;
+	const unsigned char *data, *idx_checksum;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd, ret = -1;
+
+	if (p->mtimes_map)
+		return 0;
+	if (!p->is_cruft)
+		BUG("load_pack_mtimes() called on non-cruft pack %s",
+		    p->pack_name);
+	if (open_pack_index(p))
+		return -1;
+
+	mtimes_name = pack_mtimes_filename(p);
+	fd = git_open(mtimes_name);
+	if (fd < 0) {
+		error_errno(_("could not open %s"), mtimes_name);
+		goto cleanup;
+	}
+	if (fstat(fd, &st)) {
+		error_errno(_("could not stat %s"), mtimes_name);
+		close(fd);
+		goto cleanup;
+	}
+
+	size = xsize_t(st.st_size);
+	if (size != MTIMES_MIN_SIZE + st_mult(sizeof(uint32_t), p->num_objects)) {
+		error(_("mtimes file %s has unexpected size"), mtimes_name);
+		close(fd);
+		goto cleanup;
+	}
+
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != MTIMES_SIGNATURE) {
+		error(_("mtimes file %s has unknown signature"), mtimes_name);
+		goto unmap;
+	}
+	if (get_be32(data + 4) != MTIMES_VERSION) {
+		error(_("mtimes file %s has unsupported version %"PRIu32),
+		      mtimes_name, get_be32(data + 4));
+		goto unmap;
+	}
+	if (get_be32(data + 8) != hash_algo_by_ptr(the_hash_algo)) {
+		error(_("mtimes file %s has unsupported hash id %"PRIu32),
+		      mtimes_name, get_be32(data + 8));
+		goto unmap;
+	}
+
+	idx_checksum = (const unsigned char *)p->index_data +
+		p->index_size - 2 * the_hash_algo->rawsz;
+	if (!hasheq(data + size - 2 * the_hash_algo->rawsz, idx_checksum)) {
+		error(_("mtimes file %s does not match its pack"), mtimes_name);
+		goto unmap;
+	}
+
+	p->mtimes_map = map;
+	p->mtimes_size = size;
+	ret = 0;
+	goto cleanup;
+
+unmap:
+	munmap(map, size);
+cleanup:
+	free(mtimes_name);
+	return ret;
+}
+
+void close_pack_mtimes(struct packed_git *p)
+{
+	if (p->mtimes_map) {
+		munmap((void *)p->mtimes_map, p->mtimes_size);
+		p->mtimes_map = NULL;
+		p->mtimes_size = 0;
+	}
+}
+
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (!p->mtimes_map)
+		BUG("pack %s has no mtimes loaded", p->pack_name);
+	if (p->num_objects <= pos)
+		BUG("pack %s has no object at position %"PRIu32,
+		    p->pack_name, pos);
+	return get_be32((const unsigned char *)p->mtimes_map +
+			MTIMES_HEADER_SIZE + st_mult(sizeof(uint32_t), pos));
+}
+
+timestamp_t packed_object_mtime(struct packed_git *p, uint32_t pos)
+{
+	/* a cruft pack we cannot read is as old as the pack itself */
+	if (p->is_cruft && !load_pack_mtimes(p))
+		return nth_packed_mtime(p, pos);
+	return p->mtime;
+}
@@ -0,0 +1,46 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+/**
+ * A "cruft" pack holds unreachable objects. Since the mtime of the
+ * pack itself cannot tell how old each of them is, a ".mtimes" file
+ * next to the pack records one mtime per object, in the order of the
+ * ".idx" file (i.e., sorted by object name). Expiring old unreachable
+ * objects is then a rewrite of the cruft pack, rather than a walk over
+ * (and unlink of) as many loose objects.
+ *
+ * The file is made of a 12-byte header (signature, version and hash
+ * id), one 4-byte network-order timestamp per object, and a trailer
+ * with the checksum of the pack followed by the checksum of the file.
+ */
+
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+
+struct packed_git;
+
+/*
+ * Map the ".mtimes" file of the cruft pack 'p', if that has not been
+ * done yet. Returns 0 on success, and -1 (after reporting an error)
+ * if the file is missing or corrupt.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/*
+ * Release the ".mtimes" file of 'p', if it is mapped.
+ */
+void close_pack_mtimes(struct packed_git *p);
+
+/*
+ * Return the mtime of the object at index position 'pos' in the cruft
+ * pack 'p'. The ".mtimes" file of 'p' must have been loaded.
+ */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+/*
+ * Return the mtime to use for the object at index position 'pos' of
+ * 'p': its own mtime for a cruft pack, or that of the pack otherwise.
+ */
+timestamp_t packed_object_mtime(struct packed_git *p, uint32_t pos);
+
+#endif
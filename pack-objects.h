@@ -210,6 +210,44 @@ static inline uint32_t pack_name_hash(const char *name)
 	return hash;
 }
 
+/*
+ * Like pack_name_hash(), but the directories count too: the hash of the
+ * file name is mixed with that of its directories, so that the many
+ * files that share a name across a tree (index.js, Makefile) do not all
+ * sort together.
+ */
+static inline uint32_t pack_name_hash_v2(const char *name)
+{
+	uint32_t c, hash = 0, base = 0;
+
+	if (!name)
+		return 0;
+
+	while ((c = (unsigned char)*name++) != 0) {
+		if (isspace(c))
+			continue;
+		if (c == '/') {
+			base = (base >> 6) ^ hash;
+			hash = 0;
+			continue;
+		}
+		/*
+		 * Reverse the bits of the byte, so that its low bits,
+		 * which vary the most, end up at the top of the hash.
+		 */
+		c = (c & 0xF0) >> 4 | (c & 0x0F) << 4;
+		c = (c & 0xCC) >> 2 | (c & 0x33) << 2;
+		c = (c & 0xAA) >> 1 | (c & 0x55) << 1;
+		hash = (hash >> 2) + (c << 24);
+	}
+	return (base >> 6) ^ hash;
+}
+
+static inline uint32_t pack_name_hash_version(int version, const char *name)
+{
+	return version == 2 ? pack_name_hash_v2(name) : pack_name_hash(name);
+}
+
 static inline enum object_type oe_type(const struct object_entry *e)
 {
 	return e->type_valid ? e->type_ : OBJ_BAD;
@@ -159,47 +159,164 @@ static void create_pack_revindex(struct packed_git *p)
 	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
-int load_pack_revindex(struct packed_git *p)
+static char *pack_revindex_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
+}
+
+#define RIDX_HEADER_SIZE (12)
+#define RIDX_MIN_SIZE (RIDX_HEADER_SIZE + (2 * the_hash_algo->rawsz))
+
+/*
+ * Map the ".rev" file of 'p', if there is one. Returns 0 if it could be
+ * used, and -1 if the caller should compute the revindex in memory.
+ */
+static int load_revindex_from_disk(struct packed_git *p)
 {
-	if (!p->revindex) {
-		if (open_pack_index(p))
-			return -1;
-		create_pack_revindex(p);
+	char *revindex_name = pack_revindex_filename(p);
+	const unsigned char *data, *idx_checksum;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd, ret = -1;
+
+	fd = git_open(revindex_name);
+	if (fd < 0)
+		goto cleanup;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto cleanup;
+	}
+
+	size = xsize_t(st.st_size);
+	if (size != RIDX_MIN_SIZE + st_mult(sizeof(uint32_t), p->num_objects)) {
+		error(_("reverse-index file %s has unexpected size"),
+		      revindex_name);
+		close(fd);
+		goto cleanup;
+	}
+
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != RIDX_SIGNATURE) {
+		error(_("reverse-index file %s has unknown signature"),
+		      revindex_name);
+		goto unmap;
+	}
+	if (get_be32(data + 4) != RIDX_VERSION) {
+		error(_("reverse-index file %s has unsupported version %"PRIu32),
+		      revindex_name, get_be32(data + 4));
+		goto unmap;
+	}
+	if (get_be32(data + 8) != hash_algo_by_ptr(the_hash_algo)) {
+		error(_("reverse-index file %s has unsupported hash id %"PRIu32),
+		      revindex_name, get_be32(data + 8));
+		goto unmap;
+	}
+
+	/*
+	 * The .rev and the .idx both record the checksum of the pack they
+	 * were written for; make sure we are not looking at a leftover.
+	 */
+	idx_checksum = (const unsigned char *)p->index_data +
+		p->index_size - 2 * the_hash_algo->rawsz;
+	if (!hasheq(data + size - 2 * the_hash_algo->rawsz, idx_checksum)) {
+		error(_("reverse-index file %s does not match its pack"),
+		      revindex_name);
+		goto unmap;
 	}
+
+	p->revindex_map = map;
+	p->revindex_size = size;
+	p->revindex_data = (const uint32_t *)(data + RIDX_HEADER_SIZE);
+	ret = 0;
+	goto cleanup;
+
+unmap:
+	munmap(map, size);
+cleanup:
+	free(revindex_name);
+	return ret;
+}
+
+int load_pack_revindex(struct packed_git *p)
+{
+	if (p->revindex || p->revindex_data)
+		return 0;
+
+	if (open_pack_index(p))
+		return -1;
+	if (!load_revindex_from_disk(p))
+		return 0;
+
+	create_pack_revindex(p);
 	return 0;
 }
 
-int find_revindex_position(struct packed_git *p, off_t ofs)
+void close_pack_revindex(struct packed_git *p)
 {
-	int lo = 0;
-	int hi = p->num_objects + 1;
-	const struct revindex_entry *revindex = p->revindex;
+	FREE_AND_NULL(p->revindex);
+	if (p->revindex_map) {
+		munmap((void *)p->revindex_map, p->revindex_size);
+		p->revindex_map = NULL;
+		p->revindex_data = NULL;
+		p->revindex_size = 0;
+	}
+}
 
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
+{
+	uint32_t lo = 0;
+	uint32_t hi;
+
+	if (load_pack_revindex(p))
+		return -1;
+
+	hi = p->num_objects + 1;
 	do {
-		const unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
+		const uint32_t mi = lo + (hi - lo) / 2;
+		off_t got = pack_pos_to_offset(p, mi);
+
+		if (got == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < got)
 			hi = mi;
 		else
 			lo = mi + 1;
 	} while (lo < hi);
 
-	error("bad offset for revindex");
-	return -1;
+	return error("bad offset for revindex");
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
 {
-	int pos;
+	if (!p->revindex && !p->revindex_data)
+		BUG("pack_pos_to_index: reverse index not yet loaded");
+	if (p->num_objects <= pos)
+		BUG("pack_pos_to_index: out-of-bounds object at %"PRIu32, pos);
 
-	if (load_pack_revindex(p))
-		return NULL;
-
-	pos = find_revindex_position(p, ofs);
+	if (p->revindex_data)
+		return get_be32(p->revindex_data + pos);
+	return p->revindex[pos].nr;
+}
 
-	if (pos < 0)
-		return NULL;
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (!p->revindex && !p->revindex_data)
+		BUG("pack_pos_to_offset: reverse index not yet loaded");
+	if (p->num_objects < pos)
+		BUG("pack_pos_to_offset: out-of-bounds object at %"PRIu32, pos);
 
-	return p->revindex + pos;
+	if (p->revindex)
+		return p->revindex[pos].offset;
+	if (pos == p->num_objects)
+		return p->pack_size - the_hash_algo->rawsz;
+	return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
 }
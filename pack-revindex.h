@@ -1,6 +1,27 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
+/**
+ * A revindex allows converting between three orderings of the objects
+ * of a pack:
+ *
+ * - the "index position", which is the order of the .idx file (i.e.,
+ *   sorted by object name);
+ *
+ * - the "pack position", which is the order in which the objects appear
+ *   in the packfile;
+ *
+ * - the offset of the object in the packfile.
+ *
+ * If a ".rev" file exists next to the pack, it is mmapped and used as is;
+ * otherwise the mapping is computed in memory.
+ */
+
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+
+#define GIT_TEST_WRITE_REV_INDEX "GIT_TEST_WRITE_REV_INDEX"
+
 struct packed_git;
 
 struct revindex_entry {
@@ -8,9 +29,38 @@ struct revindex_entry {
 	unsigned int nr;
 };
 
+/*
+ * Load the revindex of 'p', either from its ".rev" file or by computing
+ * it, if that has not been done yet. Returns 0 on success.
+ */
 int load_pack_revindex(struct packed_git *p);
-int find_revindex_position(struct packed_git *p, off_t ofs);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Release the revindex of 'p', if any.
+ */
+void close_pack_revindex(struct packed_git *p);
+
+/*
+ * Find the pack position of the object at offset 'ofs' and store it in
+ * 'pos'. Returns 0 on success, and -1 (after reporting an error) if
+ * there is no object at that offset.
+ *
+ * This loads the revindex of 'p' if needed.
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
+
+/*
+ * Return the index position of the object at pack position 'pos'. The
+ * revindex of 'p' must have been loaded.
+ */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+
+/*
+ * Return the offset of the object at pack position 'pos'. A 'pos' equal
+ * to the number of objects in the pack gives the offset of the trailing
+ * checksum, i.e. where the last object ends. The revindex of 'p' must
+ * have been loaded.
+ */
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
 
 #endif
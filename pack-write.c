@@ -1,6 +1,9 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-revindex.h"
+#include "pack-mtimes.h"
+#include "radix-sort.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -16,6 +19,11 @@ static int sha1_compare(const void *_a, const void *_b)
 	return oidcmp(&a->oid, &b->oid);
 }
 
+static const unsigned char *idx_entry_hash(const void *e)
+{
+	return (*(struct pack_idx_entry **)e)->oid.hash;
+}
+
 static int cmp_uint32(const void *a_, const void *b_)
 {
 	uint32_t a = *((uint32_t *)a_);
@@ -61,7 +69,8 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 			if (objects[i]->offset > last_obj_offset)
 				last_obj_offset = objects[i]->offset;
 		}
-		QSORT(sorted_by_sha, nr_objects, sha1_compare);
+		RADIX_SORT_BY_HASH(sorted_by_sha, nr_objects, idx_entry_hash,
+				   sha1_compare);
 	}
 	else
 		sorted_by_sha = list = last = NULL;
@@ -176,6 +185,83 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+static int pack_order_cmp(const void *va, const void *vb, void *ctx)
+{
+	struct pack_idx_entry **objects = ctx;
+
+	off_t oa = objects[*(uint32_t *)va]->offset;
+	off_t ob = objects[*(uint32_t *)vb]->offset;
+
+	if (oa < ob)
+		return -1;
+	if (oa > ob)
+		return 1;
+	return 0;
+}
+
+static void write_rev_header(struct hashfile *f)
+{
+	hashwrite_be32(f, RIDX_SIGNATURE);
+	hashwrite_be32(f, RIDX_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(the_hash_algo));
+}
+
+static void write_rev_index_positions(struct hashfile *f,
+				      struct pack_idx_entry **objects,
+				      uint32_t nr_objects)
+{
+	uint32_t *pack_order;
+	uint32_t i;
+
+	ALLOC_ARRAY(pack_order, nr_objects);
+	for (i = 0; i < nr_objects; i++)
+		pack_order[i] = i;
+	QSORT_S(pack_order, nr_objects, pack_order_cmp, objects);
+
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+
+	free(pack_order);
+}
+
+/*
+ * Write the ".rev" file for a pack, i.e. the index positions of its
+ * objects in pack order, followed by the pack checksum 'hash'. The
+ * objects array must already be sorted by object name, as it is on
+ * return from write_idx_file().
+ *
+ * If 'rev_name' is NULL, a temporary file is created in the object
+ * directory; either way, the name of the written file is returned.
+ */
+const char *write_rev_file(const char *rev_name,
+			   struct pack_idx_entry **objects,
+			   uint32_t nr_objects,
+			   const unsigned char *hash)
+{
+	struct hashfile *f;
+	int fd;
+
+	if (!rev_name) {
+		struct strbuf tmp_file = STRBUF_INIT;
+		fd = odb_mkstemp(&tmp_file, "pack/tmp_rev_XXXXXX");
+		rev_name = strbuf_detach(&tmp_file, NULL);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+		if (fd < 0)
+			die_errno("unable to create '%s'", rev_name);
+	}
+	f = hashfd(fd, rev_name);
+
+	write_rev_header(f);
+	write_rev_index_positions(f, objects, nr_objects);
+	hashwrite(f, hash, the_hash_algo->rawsz);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	return rev_name;
+}
+
 off_t write_pack_header(struct hashfile *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -344,6 +430,38 @@ struct hashfile *create_tmp_packfile(char **pack_tmp_name)
 	return hashfd(fd, *pack_tmp_name);
 }
 
+/*
+ * Write the ".mtimes" file of a cruft pack to 'mtimes_name': the
+ * 'nr_objects' timestamps of 'mtimes', which must already be in index
+ * order (i.e., sorted by object name), followed by the pack checksum
+ * 'hash'. See pack-mtimes.h for the format.
+ */
+void write_mtimes_file(const char *mtimes_name, const uint32_t *mtimes,
+		       uint32_t nr_objects, const unsigned char *hash)
+{
+	struct hashfile *f;
+	uint32_t i;
+	int fd;
+
+	unlink(mtimes_name);
+	fd = open(mtimes_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	if (fd < 0)
+		die_errno("unable to create '%s'", mtimes_name);
+	f = hashfd(fd, mtimes_name);
+
+	hashwrite_be32(f, MTIMES_SIGNATURE);
+	hashwrite_be32(f, MTIMES_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(the_hash_algo));
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, mtimes[i]);
+	hashwrite(f, hash, the_hash_algo->rawsz);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	if (adjust_shared_perm(mtimes_name))
+		die_errno("unable to make mtimes file readable");
+}
+
 void finish_tmp_packfile(struct strbuf *name_buffer,
 			 const char *pack_tmp_name,
 			 struct pack_idx_entry **written_list,
@@ -351,7 +469,7 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name = NULL;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -362,6 +480,13 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	if (pack_idx_opts->flags & WRITE_REV) {
+		rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+					      sha1);
+		if (adjust_shared_perm(rev_tmp_name))
+			die_errno("unable to make temporary reverse-index file readable");
+	}
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 
 	if (rename(pack_tmp_name, name_buffer->buf))
@@ -375,5 +500,14 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse-index file");
+
+		strbuf_setlen(name_buffer, basename_len);
+	}
+
 	free((void *)idx_tmp_name);
+	free((void *)rev_tmp_name);
 }
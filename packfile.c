@@ -17,6 +17,8 @@
 #include "object-store.h"
 #include "midx.h"
 #include "commit-graph.h"
+#include "json-writer.h"
+#include "pack-mtimes.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *sha1,
@@ -335,6 +337,8 @@ void close_pack(struct packed_git *p)
 	close_pack_windows(p);
 	close_pack_fd(p);
 	close_pack_index(p);
+	close_pack_revindex(p);
+	close_pack_mtimes(p);
 }
 
 void close_object_store(struct raw_object_store *o)
@@ -348,7 +352,10 @@ void close_object_store(struct raw_object_store *o)
 			close_pack(p);
 
 	if (o->multi_pack_index) {
-		close_midx(o->multi_pack_index);
+		struct multi_pack_index *m;
+
+		for (m = o->multi_pack_index; m; m = m->next)
+			close_midx(m);
 		o->multi_pack_index = NULL;
 	}
 
@@ -357,7 +364,7 @@ void close_object_store(struct raw_object_store *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".promisor"};
+	static const char *exts[] = {".pack", ".idx", ".rev", ".mtimes", ".keep", ".bitmap", ".promisor"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -712,7 +719,9 @@ void unuse_pack(struct pack_window **w_cursor)
 
 static void try_to_free_pack_memory(size_t size)
 {
+	obj_read_lock();
 	release_pack_memory(size);
+	obj_read_unlock();
 }
 
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
@@ -750,6 +759,10 @@ struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_promisor = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -865,6 +878,33 @@ struct prepare_pack_data {
 	struct multi_pack_index *m;
 };
 
+/* Is the pack in 'm' or in any of the layers below it? */
+static int midx_layers_contain_pack(struct multi_pack_index *m,
+				    const char *file_name)
+{
+	for (; m; m = m->base_midx)
+		if (midx_contains_pack(m, file_name))
+			return 1;
+	return 0;
+}
+
+/*
+ * Is the pack of an alternate covered by a multi-pack-index that was
+ * written with "--include-alternates"? Those list it by its full path.
+ */
+static int midx_covers_alternate_pack(struct repository *r,
+				      const char *full_name)
+{
+	struct multi_pack_index *m;
+
+	if (!is_absolute_path(full_name))
+		return 0;
+	for (m = r->objects->multi_pack_index; m; m = m->next)
+		if (midx_contains_pack(m, full_name))
+			return 1;
+	return 0;
+}
+
 static void prepare_pack(const char *full_name, size_t full_name_len,
 			 const char *file_name, void *_data)
 {
@@ -873,7 +913,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	size_t base_len = full_name_len;
 
 	if (strip_suffix_mem(full_name, &base_len, ".idx") &&
-	    !(data->m && midx_contains_pack(data->m, file_name))) {
+	    !midx_layers_contain_pack(data->m, file_name) &&
+	    (data->local || !midx_covers_alternate_pack(data->r, full_name))) {
 		/* Don't reopen a pack we already have. */
 		for (p = data->r->objects->packed_git; p; p = p->next) {
 			size_t len;
@@ -893,11 +934,14 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!report_garbage)
 		return;
 
-	if (!strcmp(file_name, "multi-pack-index"))
+	if (!strcmp(file_name, "multi-pack-index") ||
+	    !strcmp(file_name, "multi-pack-index.d"))
 		return;
 	if (ends_with(file_name, ".idx") ||
 	    ends_with(file_name, ".pack") ||
 	    ends_with(file_name, ".bitmap") ||
+	    ends_with(file_name, ".rev") ||
+	    ends_with(file_name, ".mtimes") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor"))
 		string_list_append(data->garbage, full_name);
@@ -951,6 +995,7 @@ unsigned long repo_approximate_object_count(struct repository *r)
 			count += p->num_objects;
 		}
 		r->objects->approximate_object_count = count;
+		r->objects->approximate_object_count_valid = 1;
 	}
 	return r->objects->approximate_object_count;
 }
@@ -1115,7 +1160,14 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/*
+		 * The object read lock can be dropped while inflating:
+		 * our cursor keeps the window in use, so it cannot be
+		 * unmapped or moved by other readers.
+		 */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		curpos += stream.next_in - in;
 	} while ((st == Z_OK || st == Z_BUF_ERROR) &&
 		 stream.total_out < sizeof(delta_head));
@@ -1191,11 +1243,11 @@ const struct packed_git *has_packed_and_bad(struct repository *r,
 	return NULL;
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1246,18 +1298,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1267,12 +1318,11 @@ static int retry_bad_packed_offset(struct repository *r,
 				   off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	struct object_id oid;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	nth_packed_object_oid(&oid, p, revidx->nr);
+	nth_packed_object_oid(&oid, p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, oid.hash);
 	type = oid_object_info(r, &oid, NULL);
 	if (type <= OBJ_NONE)
@@ -1353,7 +1403,30 @@ static enum object_type packed_to_object_type(struct repository *r,
 static struct hashmap delta_base_cache;
 static size_t delta_base_cached;
 
+/*
+ * With the "lru" policy, all entries are in delta_base_cache_lru, least
+ * recently used first. With "2q", a new entry is put on probation
+ * first, and only moves to delta_base_cache_lru when it is used again,
+ * or when it comes back soon after it was evicted from probation; the
+ * keys of such entries are remembered in the "ghost" list. Entries on
+ * probation are evicted first as long as they take more than a quarter
+ * of the cache, so that walking many bases that are used only once
+ * does not push out the bases that are used over and over.
+ */
 static LIST_HEAD(delta_base_cache_lru);
+static LIST_HEAD(delta_base_cache_probation);
+static size_t delta_base_probation_cached;
+
+static struct hashmap delta_base_ghosts;
+static LIST_HEAD(delta_base_ghost_fifo);
+
+/* remember at least this many evicted keys */
+#define DELTA_BASE_GHOSTS_MIN 64
+
+static unsigned int delta_base_cache_hits;
+static unsigned int delta_base_cache_misses;
+static unsigned int delta_base_cache_evictions;
+static int delta_base_cache_atexit_registered;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1367,6 +1440,13 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+	unsigned probation : 1;
+};
+
+struct delta_base_ghost {
+	struct hashmap_entry ent;
+	struct delta_base_cache_key key;
+	struct list_head fifo;
 };
 
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
@@ -1416,6 +1496,108 @@ static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 	return !!get_delta_base_cache_entry(p, base_offset);
 }
 
+static void trace2_delta_base_cache_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_string(&jw, "policy",
+			 delta_base_cache_policy == DELTA_BASE_CACHE_2Q ?
+			 "2q" : "lru");
+	jw_object_intmax(&jw, "hits", delta_base_cache_hits);
+	jw_object_intmax(&jw, "misses", delta_base_cache_misses);
+	jw_object_intmax(&jw, "evictions", delta_base_cache_evictions);
+	jw_end(&jw);
+
+	trace2_data_json("delta_base_cache", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
+/*
+ * Like get_delta_base_cache_entry(), but for lookups that want the
+ * data, which we count, and which make an entry recently used.
+ */
+static struct delta_base_cache_entry *
+use_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+{
+	struct delta_base_cache_entry *ent;
+
+	if (trace2_is_enabled() && !delta_base_cache_atexit_registered) {
+		atexit(trace2_delta_base_cache_statistics_atexit);
+		delta_base_cache_atexit_registered = 1;
+	}
+
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (!ent) {
+		delta_base_cache_misses++;
+		return NULL;
+	}
+	delta_base_cache_hits++;
+
+	if (ent->probation) {
+		ent->probation = 0;
+		delta_base_probation_cached -= ent->size;
+	}
+	list_del(&ent->lru);
+	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	return ent;
+}
+
+static int delta_base_ghost_cmp(const void *unused_cmp_data,
+				const void *va, const void *vb,
+				const void *vkey)
+{
+	const struct delta_base_ghost *a = va, *b = vb;
+	const struct delta_base_cache_key *key = vkey;
+	return !delta_base_cache_key_eq(&a->key, key ? key : &b->key);
+}
+
+static void remember_delta_base_ghost(const struct delta_base_cache_key *key)
+{
+	struct delta_base_ghost *ghost = xmalloc(sizeof(*ghost));
+	unsigned int max = hashmap_get_size(&delta_base_cache);
+
+	if (max < DELTA_BASE_GHOSTS_MIN)
+		max = DELTA_BASE_GHOSTS_MIN;
+	if (!delta_base_ghosts.cmpfn)
+		hashmap_init(&delta_base_ghosts, delta_base_ghost_cmp, NULL, 0);
+	while (hashmap_get_size(&delta_base_ghosts) >= max) {
+		struct delta_base_ghost *old =
+			list_first_entry(&delta_base_ghost_fifo,
+					 struct delta_base_ghost, fifo);
+		hashmap_remove(&delta_base_ghosts, old, &old->key);
+		list_del(&old->fifo);
+		free(old);
+	}
+
+	hashmap_entry_init(ghost, pack_entry_hash(key->p, key->base_offset));
+	ghost->key = *key;
+	hashmap_add(&delta_base_ghosts, ghost);
+	list_add_tail(&ghost->fifo, &delta_base_ghost_fifo);
+}
+
+/* Return 1 if the key was a ghost, and forget about it. */
+static int forget_delta_base_ghost(struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry entry;
+	struct delta_base_cache_key key;
+	struct delta_base_ghost *ghost;
+
+	if (!delta_base_ghosts.cmpfn)
+		return 0;
+
+	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
+	key.p = p;
+	key.base_offset = base_offset;
+	ghost = hashmap_remove(&delta_base_ghosts, &entry, &key);
+	if (!ghost)
+		return 0;
+	list_del(&ghost->fifo);
+	free(ghost);
+	return 1;
+}
+
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
@@ -1426,6 +1608,8 @@ static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 	hashmap_remove(&delta_base_cache, ent, &ent->key);
 	list_del(&ent->lru);
 	delta_base_cached -= ent->size;
+	if (ent->probation)
+		delta_base_probation_cached -= ent->size;
 	free(ent);
 }
 
@@ -1435,7 +1619,7 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 {
 	struct delta_base_cache_entry *ent;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
+	ent = use_delta_base_cache_entry(p, base_offset);
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
 
@@ -1455,35 +1639,72 @@ static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
 void clear_delta_base_cache(void)
 {
 	struct list_head *lru, *tmp;
+	list_for_each_safe(lru, tmp, &delta_base_cache_probation) {
+		struct delta_base_cache_entry *entry =
+			list_entry(lru, struct delta_base_cache_entry, lru);
+		release_delta_base_cache(entry);
+	}
 	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
 		struct delta_base_cache_entry *entry =
 			list_entry(lru, struct delta_base_cache_entry, lru);
 		release_delta_base_cache(entry);
 	}
+	list_for_each_safe(lru, tmp, &delta_base_ghost_fifo) {
+		struct delta_base_ghost *ghost =
+			list_entry(lru, struct delta_base_ghost, fifo);
+		forget_delta_base_ghost(ghost->key.p, ghost->key.base_offset);
+	}
 }
 
-static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+static void prune_delta_base_cache(void)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
-	struct list_head *lru, *tmp;
-
-	delta_base_cached += base_size;
+	while (delta_base_cached > delta_base_cache_limit) {
+		struct delta_base_cache_entry *f;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
+		if (!list_empty(&delta_base_cache_probation) &&
+		    (delta_base_probation_cached > delta_base_cache_limit / 4 ||
+		     list_empty(&delta_base_cache_lru))) {
+			f = list_first_entry(&delta_base_cache_probation,
+					     struct delta_base_cache_entry, lru);
+			remember_delta_base_ghost(&f->key);
+		} else if (!list_empty(&delta_base_cache_lru)) {
+			f = list_first_entry(&delta_base_cache_lru,
+					     struct delta_base_cache_entry, lru);
+		} else {
 			break;
+		}
 		release_delta_base_cache(f);
+		delta_base_cache_evictions++;
 	}
+}
+
+/*
+ * "reused" says that the base came out of the cache, i.e. that it is
+ * not the first time that we need it.
+ */
+static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
+	void *base, unsigned long base_size, enum object_type type,
+	int reused)
+{
+	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
+
+	delta_base_cached += base_size;
+	prune_delta_base_cache();
 
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	if (delta_base_cache_policy == DELTA_BASE_CACHE_2Q && !reused &&
+	    !forget_delta_base_ghost(p, base_offset)) {
+		ent->probation = 1;
+		delta_base_probation_cached += base_size;
+		list_add_tail(&ent->lru, &delta_base_cache_probation);
+	} else {
+		ent->probation = 0;
+		list_add_tail(&ent->lru, &delta_base_cache_lru);
+	}
 
 	if (!delta_base_cache.cmpfn)
 		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
@@ -1532,8 +1753,15 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			error("could not find object at offset %"PRIuMAX" "
+			      "in pack %s", (uintmax_t)obj_offset, p->pack_name);
+			type = OBJ_BAD;
+			goto out;
+		}
+
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->type_name) {
@@ -1589,6 +1817,24 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	/*
+	 * Small objects usually sit in the window as a whole; inflate
+	 * them in one go and only stream the rest.
+	 */
+	if (size < big_file_threshold) {
+		unsigned long avail;
+
+		in = use_pack(p, w_curs, curpos, &avail);
+		obj_read_unlock();
+		st = git_inflate_buffer(buffer, size, in, avail, NULL);
+		obj_read_lock();
+		if (!st) {
+			buffer[size] = '\0';
+			return buffer;
+		}
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1597,7 +1843,10 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/* see get_size_from_delta() */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1667,7 +1916,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		int i;
 		struct delta_base_cache_entry *ent;
 
-		ent = get_delta_base_cache_entry(p, curpos);
+		ent = use_delta_base_cache_entry(p, curpos);
 		if (ent) {
 			type = ent->type;
 			data = ent->data;
@@ -1678,11 +1927,21 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pack_pos, index_pos;
+			off_t len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0) {
+				error("could not find object at offset %"PRIuMAX" in pack %s",
+				      (uintmax_t)obj_offset, p->pack_name);
+				data = NULL;
+				goto out;
+			}
+
+			len = pack_pos_to_offset(p, pack_pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pack_pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				struct object_id oid;
-				nth_packed_object_oid(&oid, p, revidx->nr);
+				nth_packed_object_oid(&oid, p, index_pos);
 				error("bad packed object CRC for %s",
 				      oid_to_hex(&oid));
 				mark_bad_packed_object(p, oid.hash);
@@ -1758,7 +2017,9 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		data = NULL;
 
 		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
+			add_delta_base_cache(p, obj_offset, base, base_size,
+					     type, base_from_cache);
+		base_from_cache = 0;
 
 		if (!base) {
 			/*
@@ -1767,11 +2028,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			struct object_id base_oid;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				nth_packed_object_oid(&base_oid, p, revidx->nr);
+			if (!(offset_to_pack_pos(p, obj_offset, &pos))) {
+				nth_packed_object_oid(&base_oid, p,
+						      pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      oid_to_hex(&base_oid), (uintmax_t)obj_offset,
@@ -2062,7 +2323,7 @@ int for_each_object_in_pack(struct packed_git *p,
 		struct object_id oid;
 
 		if (flags & FOR_EACH_OBJECT_PACK_ORDER)
-			pos = p->revindex[i].nr;
+			pos = pack_pos_to_index(p, i);
 		else
 			pos = i;
 
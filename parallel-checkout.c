@@ -0,0 +1,357 @@
+#include "cache.h"
+#include "blob-cache.h"
+#include "config.h"
+#include "convert.h"
+#include "object-store.h"
+#include "parallel-checkout.h"
+#include "thread-utils.h"
+#include "trace2.h"
+
+/*
+ * Mostly randomly chosen: do not bother starting threads for fewer
+ * entries than this, as the thread setup would cost more than the
+ * overlapped filesystem latency saves.
+ */
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The entry's path was taken by the time it was written (e.g. by
+	 * another entry on a case-insensitive filesystem) or its leading
+	 * directories are no longer real directories. It is retried with
+	 * checkout_entry(), which knows how to deal with that.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED,
+};
+
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	struct stat st;
+	enum pc_item_status status;
+};
+
+struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+
+	/*
+	 * Protects 'next_item' and the object store, which is not
+	 * thread-safe; everything else a worker does runs unlocked.
+	 */
+	pthread_mutex_t mutex;
+	size_t next_item;
+};
+
+static struct parallel_checkout parallel_checkout;
+
+struct pc_worker {
+	pthread_t pthread;
+	const struct checkout *state;
+};
+
+enum pc_status parallel_checkout_status(void)
+{
+	return parallel_checkout.status;
+}
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		if (strtol_i(env_workers, 10, num_workers))
+			die(_("invalid value for GIT_TEST_CHECKOUT_WORKERS: '%s'"),
+			    env_workers);
+		if (*num_workers < 1)
+			*num_workers = online_cpus();
+
+		*threshold = 0;
+	} else {
+		if (git_config_get_int("checkout.workers", num_workers))
+			*num_workers = 1;
+		else if (*num_workers < 1)
+			*num_workers = online_cpus();
+
+		if (git_config_get_int("checkout.thresholdForParallelism", threshold))
+			*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+	}
+
+	if (!HAVE_THREADS)
+		*num_workers = 1;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		BUG("parallel checkout already initialized");
+
+	/* read its configuration before the workers look at it */
+	blob_cache_enabled();
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		BUG("cannot finish parallel checkout: not initialized yet");
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	struct parallel_checkout_item *pc_item;
+	struct conv_attrs ca;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    !S_ISREG(ce->ce_mode))
+		return -1;
+
+	/*
+	 * External filters may be stateful (and long-running process
+	 * filters certainly are), so leave them to the sequential code.
+	 */
+	convert_attrs(state->istate, &ca, ce->name);
+	if (conv_attrs_need_filter(&ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr++];
+	pc_item->ce = ce;
+	memcpy(&pc_item->ca, &ca, sizeof(ca));
+	pc_item->status = PC_ITEM_PENDING;
+
+	return 0;
+}
+
+static void *read_blob_locked(const struct object_id *oid, unsigned long *size)
+{
+	enum object_type type;
+	void *blob_data;
+
+	pthread_mutex_lock(&parallel_checkout.mutex);
+	blob_data = read_object_file(oid, &type, size);
+	pthread_mutex_unlock(&parallel_checkout.mutex);
+
+	if (blob_data && type != OBJ_BLOB)
+		FREE_AND_NULL(blob_data);
+	return blob_data;
+}
+
+static void write_pc_item(struct parallel_checkout_item *pc_item,
+			  const struct checkout *state,
+			  struct cache_def *cache)
+{
+	struct cache_entry *ce = pc_item->ce;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	unsigned long size;
+	size_t newsize;
+	ssize_t wrote;
+	void *blob;
+	int fd, as_is = 0;
+
+	strbuf_add(&path, state->base_dir, state->base_dir_len);
+	strbuf_add(&path, ce->name, ce_namelen(ce));
+
+	/*
+	 * The leading directories were created before we were queued,
+	 * but make sure nothing replaced them with a symlink meanwhile.
+	 */
+	if (threaded_has_symlink_leading_path(cache, path.buf, path.len)) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		goto out;
+	}
+
+	blob = read_blob_locked(&ce->oid, &size);
+	if (!blob) {
+		error("unable to read sha1 file of %s (%s)",
+		      path.buf, oid_to_hex(&ce->oid));
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	if (convert_to_working_tree_ca(&pc_item->ca, ce->name, blob, size, &buf)) {
+		free(blob);
+		blob = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	} else {
+		as_is = 1;
+	}
+
+	fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL,
+		  (ce->ce_mode & 0100) ? 0777 : 0666);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == ENOENT || errno == ENOTDIR) {
+			pc_item->status = PC_ITEM_COLLIDED;
+		} else {
+			error_errno("unable to create file %s", path.buf);
+			pc_item->status = PC_ITEM_FAILED;
+		}
+		free(blob);
+		goto out;
+	}
+
+	if (as_is && !blob_cache_clone(&ce->oid, size, fd)) {
+		wrote = size;
+	} else {
+		wrote = write_in_full(fd, blob, size);
+		if (as_is && wrote >= 0)
+			blob_cache_add(&ce->oid, size, fd);
+	}
+	free(blob);
+	if (wrote < 0) {
+		close(fd);
+		error("unable to write file %s", path.buf);
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	if (state->refresh_cache) {
+		/* use fstat() only when path == ce->name */
+		int stat_err = (fstat_is_reliable() && !state->base_dir_len) ?
+			       fstat(fd, &pc_item->st) :
+			       lstat(path.buf, &pc_item->st);
+		if (stat_err) {
+			close(fd);
+			error_errno("unable to stat just-written file %s",
+				    path.buf);
+			pc_item->status = PC_ITEM_FAILED;
+			goto out;
+		}
+	}
+
+	if (close(fd)) {
+		error_errno("unable to write file %s", path.buf);
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+
+out:
+	strbuf_release(&buf);
+	strbuf_release(&path);
+}
+
+static void *pc_worker_thread(void *data)
+{
+	struct pc_worker *worker = data;
+	struct cache_def cache = CACHE_DEF_INIT;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&parallel_checkout.mutex);
+		i = parallel_checkout.next_item++;
+		pthread_mutex_unlock(&parallel_checkout.mutex);
+
+		if (i >= parallel_checkout.nr)
+			break;
+		write_pc_item(&parallel_checkout.items[i], worker->state, &cache);
+	}
+
+	cache_def_clear(&cache);
+	return NULL;
+}
+
+static void write_items_in_parallel(const struct checkout *state, int num_workers)
+{
+	struct pc_worker *workers;
+	int i;
+
+	workers = xcalloc(num_workers, sizeof(*workers));
+	for (i = 0; i < num_workers; i++) {
+		int err;
+
+		workers[i].state = state;
+		err = pthread_create(&workers[i].pthread, NULL,
+				     pc_worker_thread, &workers[i]);
+		if (err)
+			die(_("unable to create threaded checkout (%s)"),
+			    strerror(err));
+	}
+	for (i = 0; i < num_workers; i++)
+		if (pthread_join(workers[i].pthread, NULL))
+			die(_("unable to join threaded checkout"));
+
+	free(workers);
+}
+
+static void write_items_sequentially(const struct checkout *state)
+{
+	struct cache_def cache = CACHE_DEF_INIT;
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++)
+		write_pc_item(&parallel_checkout.items[i], state, &cache);
+
+	cache_def_clear(&cache);
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold)
+{
+	size_t i;
+	int errs = 0;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		BUG("cannot run parallel checkout: uninitialized or already running");
+
+	parallel_checkout.status = PC_RUNNING;
+
+	if (num_workers > parallel_checkout.nr)
+		num_workers = parallel_checkout.nr;
+
+	pthread_mutex_init(&parallel_checkout.mutex, NULL);
+	parallel_checkout.next_item = 0;
+
+	trace2_region_enter("checkout", "parallel-checkout", the_repository);
+	trace2_data_intmax("checkout", the_repository, "parallel-checkout/entries",
+			   parallel_checkout.nr);
+
+	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
+		write_items_sequentially(state);
+	} else {
+		trace2_data_intmax("checkout", the_repository,
+				   "parallel-checkout/workers", num_workers);
+		write_items_in_parallel(state, num_workers);
+	}
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			update_ce_after_write(state, pc_item->ce, &pc_item->st);
+			break;
+		case PC_ITEM_COLLIDED:
+			/*
+			 * Since parallel checkout is not accepting entries
+			 * any more, this writes the entry right away.
+			 */
+			errs |= checkout_entry(pc_item->ce, state, NULL, NULL);
+			break;
+		case PC_ITEM_FAILED:
+			errs = 1;
+			break;
+		case PC_ITEM_PENDING:
+			BUG("parallel checkout left '%s' unwritten",
+			    pc_item->ce->name);
+		}
+	}
+
+	trace2_region_leave("checkout", "parallel-checkout", the_repository);
+
+	pthread_mutex_destroy(&parallel_checkout.mutex);
+
+	finish_parallel_checkout();
+	return errs;
+}
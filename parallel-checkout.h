@@ -0,0 +1,47 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct cache_entry;
+struct checkout;
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING,
+};
+
+enum pc_status parallel_checkout_status(void);
+
+/*
+ * Read "checkout.workers" and "checkout.thresholdForParallelism".
+ * A 'num_workers' of 1 means that parallel checkout should not be used.
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Put parallel checkout into the PC_ACCEPTING_ENTRIES state, so that
+ * checkout_entry() queues eligible entries instead of writing them.
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Return -1 if parallel checkout is currently not accepting entries or
+ * if the entry is not eligible for parallel checkout (e.g. it is not a
+ * regular file, or it needs an external filter). Otherwise, enqueue the
+ * entry to be written by run_parallel_checkout() and return 0.
+ *
+ * The leading directories of the entry must already exist, and its path
+ * must be free for it in the working tree.
+ */
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state);
+
+/*
+ * Write all the queued entries using up to 'num_workers' threads, or
+ * sequentially if fewer than 'threshold' entries were queued. Entries
+ * that could not be written in parallel because their path collided
+ * with another entry are retried with checkout_entry(). Returns 0 on
+ * success and non-zero if any entry failed.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold);
+
+#endif /* PARALLEL_CHECKOUT_H */
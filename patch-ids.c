@@ -2,6 +2,8 @@
 #include "diff.h"
 #include "commit.h"
 #include "sha1-lookup.h"
+#include "notes-cache.h"
+#include "config.h"
 #include "patch-ids.h"
 
 static int patch_id_defined(struct commit *commit)
@@ -25,6 +27,76 @@ int commit_patch_id(struct commit *commit, struct diff_options *options,
 	return diff_flush_patch_id(options, oid, diff_header_only, stable);
 }
 
+/*
+ * The cache note of a commit holds its header-only patch-id on the
+ * first line and, once it has been needed, its full patch-id on the
+ * second one.  Patch-ids limited to a pathspec are never cached.
+ */
+static int use_patch_id_cache(struct patch_ids *ids)
+{
+	return ids->cache && !ids->diffopts.pathspec.nr;
+}
+
+static int read_cached_patch_ids(struct patch_ids *ids, struct commit *commit,
+				 struct object_id *header_only,
+				 struct object_id *full)
+{
+	char *note;
+	const char *p;
+	size_t size;
+	int ret = -1;
+
+	oidclr(header_only);
+	oidclr(full);
+	note = notes_cache_get(ids->cache, &commit->object.oid, &size);
+	if (!note)
+		return -1;
+	if (!parse_oid_hex(note, header_only, &p) && *p == '\n') {
+		ret = 0;
+		if (parse_oid_hex(p + 1, full, &p) || *p != '\n')
+			oidclr(full);
+	} else {
+		oidclr(header_only);
+	}
+	free(note);
+	return ret;
+}
+
+static int cached_commit_patch_id(struct commit *commit, struct patch_ids *ids,
+				  struct object_id *oid, int diff_header_only)
+{
+	struct object_id header_only, full;
+	struct strbuf note = STRBUF_INIT;
+	struct object_id *want;
+
+	if (!use_patch_id_cache(ids))
+		return commit_patch_id(commit, &ids->diffopts, oid,
+				       diff_header_only, 0);
+
+	read_cached_patch_ids(ids, commit, &header_only, &full);
+	want = diff_header_only ? &header_only : &full;
+	if (!is_null_oid(want)) {
+		ids->cache_hits++;
+		oidcpy(oid, want);
+		return 0;
+	}
+
+	ids->cache_misses++;
+	if (commit_patch_id(commit, &ids->diffopts, want, diff_header_only, 0))
+		return -1;
+	oidcpy(oid, want);
+
+	if (diff_header_only || !is_null_oid(&header_only)) {
+		strbuf_addf(&note, "%s\n", oid_to_hex(&header_only));
+		if (!is_null_oid(&full))
+			strbuf_addf(&note, "%s\n", oid_to_hex(&full));
+		notes_cache_put(ids->cache, &commit->object.oid,
+				note.buf, note.len);
+		strbuf_release(&note);
+	}
+	return 0;
+}
+
 /*
  * When we cannot load the full patch-id for both commits for whatever
  * reason, the function returns -1 (i.e. return error(...)). Despite
@@ -41,16 +113,16 @@ static int patch_id_neq(const void *cmpfn_data,
 			const void *unused_keydata)
 {
 	/* NEEDSWORK: const correctness? */
-	struct diff_options *opt = (void *)cmpfn_data;
+	struct patch_ids *ids = (void *)cmpfn_data;
 	struct patch_id *a = (void *)entry;
 	struct patch_id *b = (void *)entry_or_key;
 
 	if (is_null_oid(&a->patch_id) &&
-	    commit_patch_id(a->commit, opt, &a->patch_id, 0, 0))
+	    cached_commit_patch_id(a->commit, ids, &a->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&a->commit->object.oid));
 	if (is_null_oid(&b->patch_id) &&
-	    commit_patch_id(b->commit, opt, &b->patch_id, 0, 0))
+	    cached_commit_patch_id(b->commit, ids, &b->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&b->commit->object.oid));
 	return !oideq(&a->patch_id, &b->patch_id);
@@ -58,18 +130,41 @@ static int patch_id_neq(const void *cmpfn_data,
 
 int init_patch_ids(struct repository *r, struct patch_ids *ids)
 {
+	int use_cache = 0;
+
 	memset(ids, 0, sizeof(*ids));
 	repo_diff_setup(r, &ids->diffopts);
 	ids->diffopts.detect_rename = 0;
 	ids->diffopts.flags.recursive = 1;
 	diff_setup_done(&ids->diffopts);
-	hashmap_init(&ids->patches, patch_id_neq, &ids->diffopts, 256);
+	hashmap_init(&ids->patches, patch_id_neq, ids, 256);
+
+	repo_config_get_bool(r, "diff.patchidcache", &use_cache);
+	if (use_cache) {
+		/* patch-ids depend on how the diff is computed */
+		char *validity = xstrfmt("patch ids %x",
+					 (unsigned)ids->diffopts.xdl_opts);
+
+		ids->cache = xmalloc(sizeof(*ids->cache));
+		notes_cache_init(r, ids->cache, "patch-id-cache", validity);
+		free(validity);
+	}
 	return 0;
 }
 
 int free_patch_ids(struct patch_ids *ids)
 {
 	hashmap_free(&ids->patches, 1);
+	if (ids->cache) {
+		trace2_data_intmax("patch-ids", ids->diffopts.repo,
+				   "cache/hits", ids->cache_hits);
+		trace2_data_intmax("patch-ids", ids->diffopts.repo,
+				   "cache/misses", ids->cache_misses);
+		notes_cache_write(ids->cache);
+		free_notes(&ids->cache->tree);
+		free(ids->cache->validity);
+		FREE_AND_NULL(ids->cache);
+	}
 	return 0;
 }
 
@@ -80,7 +175,7 @@ static int init_patch_id_entry(struct patch_id *patch,
 	struct object_id header_only_patch_id;
 
 	patch->commit = commit;
-	if (commit_patch_id(commit, &ids->diffopts, &header_only_patch_id, 1, 0))
+	if (cached_commit_patch_id(commit, ids, &header_only_patch_id, 1))
 		return -1;
 
 	hashmap_entry_init(patch, oidhash(&header_only_patch_id));
@@ -5,6 +5,7 @@
 #include "hashmap.h"
 
 struct commit;
+struct notes_cache;
 struct object_id;
 struct repository;
 
@@ -17,6 +18,13 @@ struct patch_id {
 struct patch_ids {
 	struct hashmap patches;
 	struct diff_options diffopts;
+
+	/*
+	 * Patch-ids remembered across commands in
+	 * refs/notes/patch-id-cache (diff.patchIdCache), or NULL.
+	 */
+	struct notes_cache *cache;
+	int cache_hits, cache_misses;
 };
 
 int commit_patch_id(struct commit *commit, struct diff_options *options,
@@ -445,21 +445,30 @@ ssize_t read_packetized_to_strbuf(int fd_in, struct strbuf *sb_out)
 int recv_sideband(const char *me, int in_stream, int out)
 {
 	char buf[LARGE_PACKET_MAX + 1];
-	int len;
+	struct packet_reader reader;
 	struct strbuf scratch = STRBUF_INIT;
 	enum sideband_type sideband_type;
 
+	/*
+	 * The stream ends with the last packet; the other side says
+	 * nothing more before we do, so we can read ahead.
+	 */
+	packet_reader_init(&reader, in_stream, NULL, 0, 0);
+	reader.buffer = buf;
+	reader.buffer_size = LARGE_PACKET_MAX;
+	packet_reader_enable_read_ahead(&reader);
+
 	while (1) {
-		len = packet_read(in_stream, NULL, NULL, buf, LARGE_PACKET_MAX,
-				  0);
-		if (!demultiplex_sideband(me, buf, len, 0, &scratch,
+		packet_reader_read(&reader);
+		if (!demultiplex_sideband(me, buf, reader.pktlen, 0, &scratch,
 					  &sideband_type))
 			continue;
 		switch (sideband_type) {
 		case SIDEBAND_PRIMARY:
-			write_or_die(out, buf + 1, len - 1);
+			write_or_die(out, buf + 1, reader.pktlen - 1);
 			break;
 		default: /* errors: message already written */
+			packet_reader_release(&reader);
 			return sideband_type;
 		}
 	}
@@ -481,6 +490,65 @@ void packet_reader_init(struct packet_reader *reader, int fd,
 	reader->me = "git";
 }
 
+/* room for the largest packet the length header can announce, and more */
+#define PACKET_READ_AHEAD_SIZE (2 * LARGE_PACKET_MAX)
+
+void packet_reader_enable_read_ahead(struct packet_reader *reader)
+{
+	if (reader->fd < 0 || reader->src_buffer)
+		BUG("read-ahead needs a reader of a descriptor");
+	reader->read_ahead_alloc = PACKET_READ_AHEAD_SIZE;
+	reader->read_ahead = xmalloc(reader->read_ahead_alloc);
+	reader->src_buffer = reader->read_ahead;
+	reader->src_len = 0;
+}
+
+void packet_reader_release(struct packet_reader *reader)
+{
+	FREE_AND_NULL(reader->read_ahead);
+	reader->read_ahead_alloc = 0;
+	reader->src_buffer = NULL;
+	reader->src_len = 0;
+}
+
+/*
+ * Make sure that at least "want" bytes are buffered, reading no more
+ * than what is already there for the taking.  Returns -1 on EOF.
+ */
+static int read_ahead_fill(struct packet_reader *reader, size_t want)
+{
+	if (reader->src_len >= want)
+		return 0;
+
+	memmove(reader->read_ahead, reader->src_buffer, reader->src_len);
+	reader->src_buffer = reader->read_ahead;
+	while (reader->src_len < want) {
+		ssize_t n = xread(reader->fd, reader->read_ahead + reader->src_len,
+				  reader->read_ahead_alloc - reader->src_len);
+		if (n < 0)
+			die_errno(_("read error"));
+		if (!n)
+			return -1;
+		reader->src_len += n;
+	}
+	return 0;
+}
+
+/*
+ * Buffer the next packet as a whole; on EOF or bogus lengths we stop
+ * and let packet_read_with_status() complain about what is there.
+ */
+static void read_ahead_packet(struct packet_reader *reader)
+{
+	int len;
+
+	if (read_ahead_fill(reader, 4))
+		return;
+	len = packet_length(reader->src_buffer);
+	if (len > 4)
+		read_ahead_fill(reader, len);
+}
+
 enum packet_read_status packet_reader_read(struct packet_reader *reader)
 {
 	struct strbuf scratch = STRBUF_INIT;
@@ -496,7 +564,11 @@ enum packet_read_status packet_reader_read(struct packet_reader *reader)
 	 */
 	while (1) {
 		enum sideband_type sideband_type;
-		reader->status = packet_read_with_status(reader->fd,
+
+		if (reader->read_ahead)
+			read_ahead_packet(reader);
+		reader->status = packet_read_with_status(reader->read_ahead ?
+							 -1 : reader->fd,
 							 &reader->src_buffer,
 							 &reader->src_len,
 							 reader->buffer,
@@ -537,6 +609,46 @@ void packet_writer_init(struct packet_writer *writer, int dest_fd)
 {
 	writer->dest_fd = dest_fd;
 	writer->use_sideband = 0;
+	writer->buffered = 0;
+	strbuf_init(&writer->buf, 0);
+}
+
+/* how much a buffered writer collects before writing it out */
+#define PACKET_WRITE_BUFFER_SIZE (8 * LARGE_PACKET_MAX)
+
+void packet_writer_buffer(struct packet_writer *writer)
+{
+	writer->buffered = 1;
+}
+
+static void packet_writer_write_out(struct packet_writer *writer)
+{
+	if (!writer->buf.len)
+		return;
+	if (write_in_full(writer->dest_fd, writer->buf.buf,
+			  writer->buf.len) < 0) {
+		check_pipe(errno);
+		die_errno(_("packet write failed"));
+	}
+	strbuf_reset(&writer->buf);
+}
+
+void packet_writer_send(struct packet_writer *writer)
+{
+	packet_writer_write_out(writer);
+	strbuf_release(&writer->buf);
+}
+
+static void packet_writer_fmt(struct packet_writer *writer, const char *prefix,
+			      const char *fmt, va_list args)
+{
+	if (!writer->buffered) {
+		packet_write_fmt_1(writer->dest_fd, 0, prefix, fmt, args);
+		return;
+	}
+	format_packet(&writer->buf, prefix, fmt, args);
+	if (writer->buf.len >= PACKET_WRITE_BUFFER_SIZE)
+		packet_writer_write_out(writer);
 }
 
 void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
@@ -544,8 +656,8 @@ void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\001" : "", fmt, args);
+	packet_writer_fmt(writer, writer->use_sideband ? "\001" : "",
+			  fmt, args);
 	va_end(args);
 }
 
@@ -554,17 +666,27 @@ void packet_writer_error(struct packet_writer *writer, const char *fmt, ...)
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\003" : "ERR ", fmt, args);
+	packet_writer_fmt(writer, writer->use_sideband ? "\003" : "ERR ",
+			  fmt, args);
 	va_end(args);
+	packet_writer_send(writer);
 }
 
 void packet_writer_delim(struct packet_writer *writer)
 {
-	packet_delim(writer->dest_fd);
+	if (!writer->buffered) {
+		packet_delim(writer->dest_fd);
+		return;
+	}
+	packet_buf_delim(&writer->buf);
 }
 
 void packet_writer_flush(struct packet_writer *writer)
 {
-	packet_flush(writer->dest_fd);
+	if (!writer->buffered) {
+		packet_flush(writer->dest_fd);
+		return;
+	}
+	packet_buf_flush(&writer->buf);
+	packet_writer_send(writer);
 }
@@ -166,6 +166,10 @@ struct packet_reader {
 
 	unsigned use_sideband : 1;
 	const char *me;
+
+	/* see packet_reader_enable_read_ahead() */
+	char *read_ahead;
+	size_t read_ahead_alloc;
 };
 
 /*
@@ -198,6 +202,19 @@ enum packet_read_status packet_reader_read(struct packet_reader *reader);
  */
 enum packet_read_status packet_reader_peek(struct packet_reader *reader);
 
+/*
+ * Let a reader of a descriptor read ahead in large chunks and parse the
+ * packets from memory, instead of doing two read()s for every packet.
+ * The reader never waits for more than the packet it is asked for, but
+ * what it read ahead is lost once the reader is gone, so only use this
+ * when nothing else reads from the descriptor afterwards (e.g. no pack
+ * data follows that is handed to another process).
+ *
+ * Call packet_reader_release() when done with such a reader.
+ */
+void packet_reader_enable_read_ahead(struct packet_reader *reader);
+void packet_reader_release(struct packet_reader *reader);
+
 #define DEFAULT_PACKET_MAX 1000
 #define LARGE_PACKET_MAX 65520
 #define LARGE_PACKET_DATA_MAX (LARGE_PACKET_MAX - 4)
@@ -206,10 +223,22 @@ extern char packet_buffer[LARGE_PACKET_MAX];
 struct packet_writer {
 	int dest_fd;
 	unsigned use_sideband : 1;
+	unsigned buffered : 1;
+	struct strbuf buf;
 };
 
 void packet_writer_init(struct packet_writer *writer, int dest_fd);
 
+/*
+ * Collect the packets of a writer and write them out in large chunks,
+ * instead of doing one write() for every packet.  Whatever is pending is
+ * written out by packet_writer_flush(), packet_writer_error() and
+ * packet_writer_send(); the latter must be called before anything else
+ * writes to the descriptor.
+ */
+void packet_writer_buffer(struct packet_writer *writer);
+void packet_writer_send(struct packet_writer *writer);
+
 /* These functions die upon failure. */
 __attribute__((format (printf, 2, 3)))
 void packet_writer_write(struct packet_writer *writer, const char *fmt, ...);
@@ -0,0 +1,190 @@
+#include "cache.h"
+#include "commit.h"
+#include "dir.h"
+#include "fetch-object.h"
+#include "oidset.h"
+#include "pathspec.h"
+#include "prefetch-blobs.h"
+#include "refs.h"
+#include "remote.h"
+#include "repository.h"
+#include "sha1-array.h"
+#include "string-list.h"
+#include "tree.h"
+
+struct recent_branches {
+	struct string_list names;
+	int max;
+};
+
+static int collect_checkout_target(struct object_id *ooid,
+				   struct object_id *noid,
+				   const char *email, timestamp_t timestamp,
+				   int tz, const char *message, void *cb_data)
+{
+	struct recent_branches *recent = cb_data;
+	const char *target;
+	size_t len;
+
+	if (!skip_prefix(message, "checkout: moving from ", &message))
+		return 0;
+	target = strstr(message, " to ");
+	if (!target)
+		return 0;
+	target += 4;
+	len = strchrnul(target, '\n') - target;
+	if (len) {
+		char *name = xmemdupz(target, len);
+		if (!unsorted_string_list_has_string(&recent->names, name))
+			string_list_append_nodup(&recent->names, name);
+		else
+			free(name);
+	}
+	return recent->names.nr >= recent->max;
+}
+
+static void add_branch_tips(const char *name, struct oidset *commits)
+{
+	struct branch *branch;
+	const char *upstream;
+	struct object_id oid;
+	struct strbuf ref = STRBUF_INIT;
+
+	strbuf_addf(&ref, "refs/heads/%s", name);
+	if (read_ref(ref.buf, &oid)) {
+		strbuf_release(&ref);
+		return; /* a detached HEAD, or a deleted branch */
+	}
+	oidset_insert(commits, &oid);
+	strbuf_release(&ref);
+
+	branch = branch_get(name);
+	upstream = branch ? branch_get_upstream(branch, NULL) : NULL;
+	if (upstream && !read_ref(upstream, &oid))
+		oidset_insert(commits, &oid);
+}
+
+struct blob_collector {
+	struct oid_array *blobs;
+	struct exclude_list *sparse;
+	struct index_state *istate;
+};
+
+/*
+ * Is "path" to be checked out according to the sparse-checkout patterns?
+ * Like unpack-trees, let the nearest directory with a verdict decide.
+ */
+static int in_sparse_checkout(struct blob_collector *c, const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int dtype = DT_REG, ret;
+
+	strbuf_addstr(&buf, path);
+	for (;;) {
+		const char *slash = strrchr(buf.buf, '/');
+		const char *basename = slash ? slash + 1 : buf.buf;
+
+		ret = is_excluded_from_list(buf.buf, buf.len, basename, &dtype,
+					    c->sparse, c->istate);
+		if (ret >= 0 || !slash)
+			break;
+		strbuf_setlen(&buf, slash - buf.buf);
+		dtype = DT_DIR;
+	}
+	strbuf_release(&buf);
+	return ret > 0;
+}
+
+static int collect_blob(const struct object_id *oid, struct strbuf *base,
+			const char *pathname, unsigned mode, int stage,
+			void *context)
+{
+	struct blob_collector *c = context;
+	size_t baselen = base->len;
+	int wanted;
+
+	if (S_ISDIR(mode)) {
+		int dtype = DT_DIR;
+
+		/* In cone mode, skip the directories out of the cone. */
+		if (!c->sparse || !c->sparse->use_cone_patterns)
+			return READ_TREE_RECURSIVE;
+		strbuf_addstr(base, pathname);
+		wanted = is_excluded_from_list(base->buf, base->len, pathname,
+					       &dtype, c->sparse, c->istate);
+		strbuf_setlen(base, baselen);
+		return wanted ? READ_TREE_RECURSIVE : 0;
+	}
+	if (!S_ISREG(mode) && !S_ISLNK(mode))
+		return 0;
+	if (!c->sparse) {
+		oid_array_append(c->blobs, oid);
+		return 0;
+	}
+
+	strbuf_addstr(base, pathname);
+	wanted = in_sparse_checkout(c, base->buf);
+	strbuf_setlen(base, baselen);
+	if (wanted)
+		oid_array_append(c->blobs, oid);
+	return 0;
+}
+
+int prefetch_predicted_blobs(struct repository *r, int max_branches)
+{
+	struct recent_branches recent = { STRING_LIST_INIT_DUP, max_branches };
+	struct oidset commits = OIDSET_INIT;
+	struct oidset_iter iter;
+	const struct object_id *oid;
+	struct oid_array blobs = OID_ARRAY_INIT;
+	struct exclude_list sparse;
+	struct blob_collector collector = { &blobs, NULL, r->index };
+	struct pathspec everything;
+	const char *head;
+	int i, nr;
+
+	if (!repository_format_partial_clone || r != the_repository)
+		return 0;
+
+	if (max_branches > 0)
+		for_each_reflog_ent_reverse("HEAD", collect_checkout_target,
+					    &recent);
+	head = resolve_ref_unsafe("HEAD", 0, NULL, NULL);
+	if (head && skip_prefix(head, "refs/heads/", &head))
+		string_list_append(&recent.names, head);
+	for (i = 0; i < recent.names.nr; i++)
+		add_branch_tips(recent.names.items[i].string, &commits);
+
+	memset(&sparse, 0, sizeof(sparse));
+	if (core_apply_sparse_checkout) {
+		char *path = git_pathdup("info/sparse-checkout");
+
+		sparse.use_cone_patterns = core_sparse_checkout_cone;
+		if (add_excludes_from_file_to_list(path, "", 0, &sparse,
+						   NULL) >= 0)
+			collector.sparse = &sparse;
+		free(path);
+	}
+
+	memset(&everything, 0, sizeof(everything));
+	oidset_iter_init(&commits, &iter);
+	while ((oid = oidset_iter_next(&iter))) {
+		struct commit *commit = lookup_commit_reference_gently(r, oid, 1);
+		struct tree *tree;
+
+		if (!commit || repo_parse_commit(r, commit))
+			continue;
+		tree = repo_get_commit_tree(r, commit);
+		read_tree_recursive(r, tree, "", 0, 0, &everything,
+				    collect_blob, &collector);
+	}
+
+	nr = blobs.nr;
+	prefetch_objects(&blobs);
+
+	oid_array_clear(&blobs);
+	clear_exclude_list(&sparse);
+	oidset_clear(&commits);
+	string_list_clear(&recent.names, 0);
+	return nr;
+}
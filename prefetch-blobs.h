@@ -0,0 +1,21 @@
+#ifndef PREFETCH_BLOBS_H
+#define PREFETCH_BLOBS_H
+
+struct repository;
+
+/*
+ * In a partial clone, guess which commits are likely to be checked out
+ * next, and fetch the blobs of their trees that are missing, so that the
+ * checkout finds them locally.
+ *
+ * The guess is made of the branches named by the last 'max_branches'
+ * checkouts in the reflog of HEAD, and the current branch: their tips
+ * and those of their upstream branches, which "git fetch" has just
+ * updated. With core.sparseCheckout, only the blobs within the
+ * sparse-checkout patterns are fetched.
+ *
+ * Returns the number of blobs that were requested.
+ */
+int prefetch_predicted_blobs(struct repository *r, int max_branches);
+
+#endif
@@ -1428,8 +1428,11 @@ static size_t format_and_pad_commit(struct strbuf *sb, /* in UTF-8 */
 				    const char *placeholder,
 				    struct format_commit_context *c)
 {
-	struct strbuf local_sb = STRBUF_INIT;
+	char local_buf[256];
+	struct strbuf local_sb;
 	int total_consumed = 0, len, padding = c->padding;
+
+	strbuf_init_stack(&local_sb, local_buf, sizeof(local_buf));
 	if (padding < 0) {
 		const char *start = strrchr(sb->buf, '\n');
 		int occupied;
@@ -1607,11 +1610,96 @@ void userformat_find_requirements(const char *fmt, struct userformat_want *w)
 	strbuf_release(&dummy);
 }
 
+/*
+ * A user format, compiled once: where its placeholders start, and
+ * whether any of them looks at the commit message. Formats made only
+ * of hashes, refs and the like can then be expanded without reading
+ * the commit object at all, e.g. when it was parsed from the
+ * commit-graph.
+ */
+struct format_program {
+	char *format;
+	size_t *percent;
+	size_t percent_nr, percent_alloc;
+	unsigned need_message:1;
+};
+
+static int placeholder_needs_message(const char *placeholder)
+{
+	if (*placeholder == '+' || *placeholder == '-' || *placeholder == ' ')
+		placeholder++;
+	/*
+	 * These are all handled by format_commit_one() before it parses
+	 * the commit header; anything else (including unknown
+	 * placeholders) may need the message.
+	 */
+	return !*placeholder || !strchr("nx%CwHhTtPpmdDSgNG<>", *placeholder);
+}
+
+static const struct format_program *compile_format(const char *format)
+{
+	static struct format_program prog;
+	const char *p;
+
+	if (prog.format && !strcmp(prog.format, format))
+		return &prog;
+
+	free(prog.format);
+	prog.format = xstrdup(format);
+	prog.percent_nr = 0;
+	prog.need_message = 0;
+	for (p = strchr(prog.format, '%'); p; p = strchr(p + 1, '%')) {
+		ALLOC_GROW(prog.percent, prog.percent_nr + 1, prog.percent_alloc);
+		prog.percent[prog.percent_nr++] = p - prog.format;
+		if (placeholder_needs_message(p + 1))
+			prog.need_message = 1;
+	}
+	return &prog;
+}
+
+/*
+ * Same as strbuf_expand(), but jump from one placeholder to the next
+ * without scanning the literal text in between again.
+ */
+static void expand_format_program(struct strbuf *sb,
+				  const struct format_program *prog,
+				  struct format_commit_context *context)
+{
+	const char *format = prog->format;
+	const char *cur = format;
+	size_t i;
+
+	for (i = 0; i < prog->percent_nr; i++) {
+		const char *percent = format + prog->percent[i];
+		size_t consumed;
+
+		/* consumed as part of the previous placeholder */
+		if (percent < cur)
+			continue;
+		strbuf_add(sb, cur, percent - cur);
+		cur = percent + 1;
+
+		if (*cur == '%') {
+			strbuf_addch(sb, '%');
+			cur++;
+			continue;
+		}
+
+		consumed = format_commit_item(sb, cur, context);
+		if (consumed)
+			cur += consumed;
+		else
+			strbuf_addch(sb, '%');
+	}
+	strbuf_addstr(sb, cur);
+}
+
 void repo_format_commit_message(struct repository *r,
 				const struct commit *commit,
 				const char *format, struct strbuf *sb,
 				const struct pretty_print_context *pretty_ctx)
 {
+	const struct format_program *prog = compile_format(format);
 	struct format_commit_context context;
 	const char *output_enc = pretty_ctx->output_encoding;
 	const char *utf8 = "UTF-8";
@@ -1622,13 +1710,16 @@ void repo_format_commit_message(struct repository *r,
 	context.wrap_start = sb->len;
 	/*
 	 * convert a commit message to UTF-8 first
-	 * as far as 'format_commit_item' assumes it in UTF-8
+	 * as far as 'format_commit_item' assumes it in UTF-8;
+	 * without an output encoding we need the commit's
+	 * encoding even if no placeholder needs the message
 	 */
-	context.message = repo_logmsg_reencode(r, commit,
-					       &context.commit_encoding,
-					       utf8);
+	if (prog->need_message || !output_enc)
+		context.message = repo_logmsg_reencode(r, commit,
+						       &context.commit_encoding,
+						       utf8);
 
-	strbuf_expand(sb, format, format_commit_item, &context);
+	expand_format_program(sb, prog, &context);
 	rewrap_message_tail(sb, &context, 0, 0, 0);
 
 	/* then convert a commit message to an actual output encoding */
@@ -94,3 +94,71 @@ void *prio_queue_peek(struct prio_queue *queue)
 		return queue->array[queue->nr - 1].data;
 	return queue->array[0].data;
 }
+
+/* Does "a" come out of the queue before "b"? */
+static inline int keyed_before(const struct keyed_queue_entry *a,
+			       const struct keyed_queue_entry *b)
+{
+	if (a->key != b->key)
+		return a->key > b->key;
+	return (int)(a->ctr - b->ctr) < 0;
+}
+
+void keyed_queue_put(struct keyed_queue *queue, void *thing, timestamp_t key)
+{
+	struct keyed_queue_entry e;
+	int ix, parent;
+
+	e.key = key;
+	e.ctr = queue->insertion_ctr++;
+	e.data = thing;
+
+	/* Move the parents down until the new one fits in the hole */
+	ALLOC_GROW(queue->array, queue->nr + 1, queue->alloc);
+	for (ix = queue->nr++; ix; ix = parent) {
+		parent = (ix - 1) / 2;
+		if (!keyed_before(&e, &queue->array[parent]))
+			break;
+		queue->array[ix] = queue->array[parent];
+	}
+	queue->array[ix] = e;
+}
+
+void *keyed_queue_get(struct keyed_queue *queue)
+{
+	struct keyed_queue_entry *array = queue->array, last;
+	void *result;
+	int ix, child, nr;
+
+	if (!queue->nr)
+		return NULL;
+	result = array[0].data;
+	nr = --queue->nr;
+	if (!nr)
+		return result;
+
+	/* Move the children up until the last one fits in the hole */
+	last = array[nr];
+	for (ix = 0; (child = ix * 2 + 1) < nr; ix = child) {
+		if (child + 1 < nr && keyed_before(&array[child + 1], &array[child]))
+			child++;
+		if (!keyed_before(&array[child], &last))
+			break;
+		array[ix] = array[child];
+	}
+	array[ix] = last;
+	return result;
+}
+
+void *keyed_queue_peek(struct keyed_queue *queue)
+{
+	return queue->nr ? queue->array[0].data : NULL;
+}
+
+void clear_keyed_queue(struct keyed_queue *queue)
+{
+	FREE_AND_NULL(queue->array);
+	queue->nr = 0;
+	queue->alloc = 0;
+	queue->insertion_ctr = 0;
+}
@@ -57,4 +57,40 @@ void clear_prio_queue(struct prio_queue *);
 /* Reverse the LIFO elements */
 void prio_queue_reverse(struct prio_queue *);
 
+/*
+ * A priority queue for "things" ordered by an integer key, e.g. the
+ * date of a commit, that the caller hands in with each of them. The
+ * key is kept next to the "thing", so that ordering the heap neither
+ * calls a compare function nor looks at the "thing". The "thing" with
+ * the largest key comes out first (i.e. the newest commit, like
+ * compare_commits_by_commit_date() in a prio_queue), and those with
+ * the same key come out in the order they were added.
+ *
+ * The keys of a date walk do not only go down (clock skew), so this
+ * is a plain binary heap, not a radix heap or buckets that would need
+ * them to.
+ */
+struct keyed_queue_entry {
+	timestamp_t key;
+	unsigned ctr;
+	void *data;
+};
+
+struct keyed_queue {
+	unsigned insertion_ctr;
+	int alloc, nr;
+	struct keyed_queue_entry *array;
+};
+
+#define KEYED_QUEUE_INIT { 0 }
+
+void keyed_queue_put(struct keyed_queue *, void *thing, timestamp_t key);
+
+/* Extract the "thing" with the largest key, or NULL. */
+void *keyed_queue_get(struct keyed_queue *);
+
+void *keyed_queue_peek(struct keyed_queue *);
+
+void clear_keyed_queue(struct keyed_queue *);
+
 #endif /* PRIO_QUEUE_H */
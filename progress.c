@@ -10,6 +10,7 @@
 
 #include "cache.h"
 #include "gettext.h"
+#include "json-writer.h"
 #include "progress.h"
 #include "strbuf.h"
 #include "trace.h"
@@ -32,6 +33,7 @@ struct throughput {
 struct progress {
 	const char *title;
 	uint64_t last_value;
+	uint64_t next_value;
 	uint64_t total;
 	unsigned last_percent;
 	unsigned delay;
@@ -98,6 +100,9 @@ static void display(struct progress *progress, uint64_t n, const char *done)
 		unsigned percent = n * 100 / progress->total;
 		if (percent != progress->last_percent || progress_update) {
 			progress->last_percent = percent;
+			/* the first value that shows another percentage */
+			progress->next_value = ((percent + 1) * progress->total
+						+ 99) / 100;
 
 			strbuf_reset(counters_sb);
 			strbuf_addf(counters_sb,
@@ -207,10 +212,20 @@ void display_throughput(struct progress *progress, uint64_t total)
 		display(progress, progress->last_value, NULL);
 }
 
+/*
+ * This is called for every item of loops over millions of objects; it
+ * must not cost more than a comparison when there is nothing to show.
+ */
 void display_progress(struct progress *progress, uint64_t n)
 {
-	if (progress)
-		display(progress, n, NULL);
+	if (!progress)
+		return;
+	if (!progress_update && n < progress->next_value) {
+		if (!progress->delay)
+			progress->last_value = n;
+		return;
+	}
+	display(progress, n, NULL);
 }
 
 static struct progress *start_progress_delay(const char *title, uint64_t total,
@@ -220,6 +235,8 @@ static struct progress *start_progress_delay(const char *title, uint64_t total,
 	progress->title = title;
 	progress->total = total;
 	progress->last_value = -1;
+	/* without a total, there is only something to show every second */
+	progress->next_value = total ? 0 : UINT64_MAX;
 	progress->last_percent = -1;
 	progress->delay = delay;
 	progress->sparse = sparse;
@@ -270,6 +287,36 @@ static void finish_if_sparse(struct progress *progress)
 		display_progress(progress, progress->total);
 }
 
+/*
+ * What the progress meter would show as throughput, whether it was
+ * shown or not.
+ */
+static void trace2_progress_statistics(struct progress *progress)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+	uint64_t elapsed_ns;
+
+	if (!trace2_is_enabled())
+		return;
+	elapsed_ns = getnanotime() - progress->start_ns;
+
+	jw_object_begin(&jw, 0);
+	jw_object_string(&jw, "title", progress->title);
+	jw_object_intmax(&jw, "total", progress->total);
+	jw_object_intmax(&jw, "elapsed_ms", elapsed_ns / 1000000);
+	if (progress->total && elapsed_ns)
+		jw_object_intmax(&jw, "per_second",
+				 progress->total * 1000000000 / elapsed_ns);
+	if (progress->throughput)
+		jw_object_intmax(&jw, "bytes",
+				 progress->throughput->curr_total);
+	jw_end(&jw);
+
+	trace2_data_json("progress", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
 void stop_progress(struct progress **p_progress)
 {
 	finish_if_sparse(*p_progress);
@@ -301,6 +348,7 @@ void stop_progress_msg(struct progress **p_progress, const char *msg)
 		free(buf);
 	}
 	clear_progress_signal();
+	trace2_progress_statistics(progress);
 	strbuf_release(&progress->counters_sb);
 	if (progress->throughput)
 		strbuf_release(&progress->throughput->display);
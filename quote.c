@@ -321,8 +321,10 @@ void write_name_quoted(const char *name, FILE *fp, int terminator)
 void write_name_quoted_relative(const char *name, const char *prefix,
 				FILE *fp, int terminator)
 {
-	struct strbuf sb = STRBUF_INIT;
+	char buf[256];
+	struct strbuf sb;
 
+	strbuf_init_stack(&sb, buf, sizeof(buf));
 	name = relative_path(name, prefix, &sb);
 	write_name_quoted(name, fp, terminator);
 
@@ -333,8 +335,12 @@ void write_name_quoted_relative(const char *name, const char *prefix,
 char *quote_path_relative(const char *in, const char *prefix,
 			  struct strbuf *out)
 {
-	struct strbuf sb = STRBUF_INIT;
-	const char *rel = relative_path(in, prefix, &sb);
+	char buf[256];
+	struct strbuf sb;
+	const char *rel;
+
+	strbuf_init_stack(&sb, buf, sizeof(buf));
+	rel = relative_path(in, prefix, &sb);
 	strbuf_reset(out);
 	quote_c_style_counted(rel, strlen(rel), out, NULL, 0);
 	strbuf_release(&sb);
@@ -0,0 +1,74 @@
+#include "cache.h"
+#include "radix-sort.h"
+
+/* below this, bucketing costs more than it saves */
+#define RADIX_SORT_MIN 4096
+
+/*
+ * How many leading bytes all names share, up to a couple (e.g. the
+ * caller already grouped them by their first byte). The buckets are
+ * taken from the bytes after those.
+ */
+static size_t shared_bytes(const char *src, size_t nr, size_t size,
+			   const unsigned char *(*hash_fn)(const void *))
+{
+	const unsigned char *first = hash_fn(src);
+	size_t skip, i;
+
+	for (skip = 0; skip < 2; skip++)
+		for (i = 1; i < nr; i++)
+			if (hash_fn(src + i * size)[skip] != first[skip])
+				return skip;
+	return skip;
+}
+
+#define BUCKET(hash) (((hash)[skip] << 8 | (hash)[skip + 1]) >> shift)
+
+void radix_sort_by_hash(void *base, size_t nr, size_t size,
+			const unsigned char *(*hash_fn)(const void *),
+			int (*compare_fn)(const void *, const void *))
+{
+	char *src = base, *tmp;
+	size_t *pos, i, start, skip;
+	unsigned bits, nr_buckets, shift, key;
+
+	if (nr < RADIX_SORT_MIN) {
+		sane_qsort(base, nr, size, compare_fn);
+		return;
+	}
+
+	/* aim for buckets of a few dozen elements */
+	bits = nr >= (1 << 20) ? 16 : 12;
+	nr_buckets = 1 << bits;
+	shift = 16 - bits;
+	skip = shared_bytes(src, nr, size, hash_fn);
+
+	CALLOC_ARRAY(pos, nr_buckets + 1);
+	for (i = 0; i < nr; i++) {
+		const unsigned char *hash = hash_fn(src + i * size);
+
+		pos[BUCKET(hash) + 1]++;
+	}
+	for (key = 1; key <= nr_buckets; key++)
+		pos[key] += pos[key - 1];
+
+	tmp = xmalloc(st_mult(nr, size));
+	for (i = 0; i < nr; i++) {
+		const unsigned char *hash = hash_fn(src + i * size);
+
+		key = BUCKET(hash);
+		memcpy(tmp + pos[key]++ * size, src + i * size, size);
+	}
+
+	/* pos[key] is now where bucket "key + 1" starts */
+	for (key = 0, start = 0; key < nr_buckets; key++) {
+		if (pos[key] - start > 1)
+			sane_qsort(tmp + start * size, pos[key] - start, size,
+				   compare_fn);
+		start = pos[key];
+	}
+
+	memcpy(base, tmp, st_mult(nr, size));
+	free(tmp);
+	free(pos);
+}
@@ -0,0 +1,22 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+/*
+ * Sort an array whose order starts with an object name, as QSORT()
+ * would with "compare_fn", but first distribute the elements into
+ * buckets by the leading bits of the name that "hash_fn" returns for
+ * an element. Object names are uniformly distributed, so the buckets
+ * are small and cheap to sort, which beats comparing among all "nr"
+ * elements once the array is large. "compare_fn" still decides the
+ * order within a bucket, e.g. among elements with the same name.
+ *
+ * This needs room for a copy of the array while it works.
+ */
+void radix_sort_by_hash(void *base, size_t nr, size_t size,
+			const unsigned char *(*hash_fn)(const void *),
+			int (*compare_fn)(const void *, const void *));
+
+#define RADIX_SORT_BY_HASH(base, n, hash_fn, compare_fn) \
+	radix_sort_by_hash((base), (n), sizeof(*(base)), (hash_fn), (compare_fn))
+
+#endif
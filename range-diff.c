@@ -11,6 +11,7 @@
 #include "pretty.h"
 #include "userdiff.h"
 #include "apply.h"
+#include "thread-utils.h"
 
 struct patch_util {
 	/* For the search for an exact match */
@@ -275,60 +276,190 @@ static int diffsize(const char *a, const char *b)
 	return COST_MAX;
 }
 
-static void get_correspondences(struct string_list *a, struct string_list *b,
-				int creation_factor)
+/*
+ * The patches without an exact match are paired up by a linear assignment
+ * whose cost for a pair is the size of their diff-of-diffs, and for a
+ * patch left alone its size scaled by the creation factor.
+ *
+ * A diff between two patches has at least as many lines as their line
+ * counts differ, so pairs for which that alone is more than leaving both
+ * patches alone can never be part of an optimal assignment.  They are
+ * neither diffed nor considered, which splits the candidates into small
+ * groups that are assigned independently.
+ */
+struct range_diff_candidates {
+	struct string_list *a, *b;
+	int *a_index, *b_index; /* in a and b, of the unmatched patches */
+	int a_nr, b_nr;
+	int *a_lines, *b_lines, *a_creation, *b_creation;
+	int *cost; /* a_nr * b_nr pair costs, COST_MAX when pruned */
+
+	pthread_mutex_t mutex;
+	int next;
+};
+
+/* Fewer candidate pairs than this per thread are not worth it. */
+#define RANGE_DIFF_THREAD_COST 64
+
+static int count_lines(const char *p)
 {
-	int n = a->nr + b->nr;
-	int *cost, c, *a2b, *b2a;
-	int i, j;
+	int lines = 0;
 
-	ALLOC_ARRAY(cost, st_mult(n, n));
-	ALLOC_ARRAY(a2b, n);
-	ALLOC_ARRAY(b2a, n);
+	while ((p = strchr(p, '\n'))) {
+		lines++;
+		p++;
+	}
+	return lines;
+}
 
-	for (i = 0; i < a->nr; i++) {
-		struct patch_util *a_util = a->items[i].util;
+static int pair_is_candidate(struct range_diff_candidates *c, int i, int j)
+{
+	int delta = c->a_lines[i] - c->b_lines[j];
 
-		for (j = 0; j < b->nr; j++) {
-			struct patch_util *b_util = b->items[j].util;
+	return abs(delta) <= c->a_creation[i] + c->b_creation[j];
+}
 
-			if (a_util->matching == j)
-				c = 0;
-			else if (a_util->matching < 0 && b_util->matching < 0)
-				c = diffsize(a_util->diff, b_util->diff);
-			else
-				c = COST_MAX;
-			cost[i + n * j] = c;
-		}
+static void fill_candidate_row(struct range_diff_candidates *c, int i)
+{
+	struct patch_util *a_util = c->a->items[c->a_index[i]].util;
+	int j;
+
+	for (j = 0; j < c->b_nr; j++) {
+		struct patch_util *b_util = c->b->items[c->b_index[j]].util;
 
-		c = a_util->matching < 0 ?
-			a_util->diffsize * creation_factor / 100 : COST_MAX;
-		for (j = b->nr; j < n; j++)
-			cost[i + n * j] = c;
+		c->cost[i * c->b_nr + j] = pair_is_candidate(c, i, j) ?
+			diffsize(a_util->diff, b_util->diff) : COST_MAX;
 	}
+}
+
+static void *candidate_worker(void *data)
+{
+	struct range_diff_candidates *c = data;
 
-	for (j = 0; j < b->nr; j++) {
-		struct patch_util *util = b->items[j].util;
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&c->mutex);
+		i = c->next < c->a_nr ? c->next++ : -1;
+		pthread_mutex_unlock(&c->mutex);
+		if (i < 0)
+			break;
+
+		fill_candidate_row(c, i);
+	}
+	return NULL;
+}
 
-		c = util->matching < 0 ?
-			util->diffsize * creation_factor / 100 : COST_MAX;
-		for (i = a->nr; i < n; i++)
-			cost[i + n * j] = c;
+static int candidate_threads(uint64_t pairs)
+{
+	const char *env = getenv("GIT_TEST_RANGE_DIFF_THREADS");
+	int threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	if (env && *env) {
+		if (strtol_i(env, 10, &threads))
+			die(_("invalid value for GIT_TEST_RANGE_DIFF_THREADS: '%s'"),
+			    env);
+		return threads < 1 ? online_cpus() : threads;
+	}
+
+	threads = online_cpus();
+	if (threads > pairs / RANGE_DIFF_THREAD_COST)
+		threads = pairs / RANGE_DIFF_THREAD_COST;
+	return threads < 1 ? 1 : threads;
+}
+
+static void fill_candidate_costs(struct range_diff_candidates *c)
+{
+	uint64_t pairs = 0;
+	int threads, i, j, err;
+	pthread_t *workers;
+
+	for (i = 0; i < c->a_nr; i++)
+		for (j = 0; j < c->b_nr; j++)
+			pairs += pair_is_candidate(c, i, j);
+	trace2_data_intmax("range-diff", the_repository, "candidate-pairs",
+			   pairs);
+
+	threads = candidate_threads(pairs);
+	if (threads > c->a_nr)
+		threads = c->a_nr;
+	if (threads < 2) {
+		for (i = 0; i < c->a_nr; i++)
+			fill_candidate_row(c, i);
+		return;
 	}
 
-	for (i = a->nr; i < n; i++)
-		for (j = b->nr; j < n; j++)
+	trace2_data_intmax("range-diff", the_repository, "threads", threads);
+	pthread_mutex_init(&c->mutex, NULL);
+	c->next = 0;
+
+	/* this thread is one of the workers */
+	ALLOC_ARRAY(workers, threads - 1);
+	for (i = 0; i < threads - 1; i++) {
+		err = pthread_create(&workers[i], NULL, candidate_worker, c);
+		if (err)
+			die(_("unable to create threaded range-diff: %s"),
+			    strerror(err));
+	}
+	candidate_worker(c);
+	for (i = 0; i < threads - 1; i++)
+		pthread_join(workers[i], NULL);
+
+	free(workers);
+	pthread_mutex_destroy(&c->mutex);
+}
+
+static int find_group(int *group, int i)
+{
+	while (group[i] != i)
+		i = group[i] = group[group[i]];
+	return i;
+}
+
+/*
+ * Assign the patches of one group, a_members in a and b_members in b
+ * (indices into the candidates), laid out like compute_assignment()
+ * expects: a patch of a left alone is matched with one of the extra
+ * rows, a patch of b left alone with one of the extra columns.
+ */
+static void assign_group(struct range_diff_candidates *c,
+			 int *a_members, int a_nr, int *b_members, int b_nr)
+{
+	int n = a_nr + b_nr;
+	int *cost, *a2b, *b2a, i, j;
+
+	ALLOC_ARRAY(cost, st_mult(n, n));
+	ALLOC_ARRAY(a2b, n);
+	ALLOC_ARRAY(b2a, n);
+
+	for (i = 0; i < a_nr; i++) {
+		for (j = 0; j < b_nr; j++)
+			cost[i + n * j] =
+				c->cost[a_members[i] * c->b_nr + b_members[j]];
+		for (j = b_nr; j < n; j++)
+			cost[i + n * j] = c->a_creation[a_members[i]];
+	}
+	for (j = 0; j < b_nr; j++)
+		for (i = a_nr; i < n; i++)
+			cost[i + n * j] = c->b_creation[b_members[j]];
+	for (i = a_nr; i < n; i++)
+		for (j = b_nr; j < n; j++)
 			cost[i + n * j] = 0;
 
 	compute_assignment(n, n, cost, a2b, b2a);
 
-	for (i = 0; i < a->nr; i++)
-		if (a2b[i] >= 0 && a2b[i] < b->nr) {
-			struct patch_util *a_util = a->items[i].util;
-			struct patch_util *b_util = b->items[a2b[i]].util;
+	for (i = 0; i < a_nr; i++)
+		if (a2b[i] >= 0 && a2b[i] < b_nr) {
+			int a_i = c->a_index[a_members[i]];
+			int b_j = c->b_index[b_members[a2b[i]]];
+			struct patch_util *a_util = c->a->items[a_i].util;
+			struct patch_util *b_util = c->b->items[b_j].util;
 
-			a_util->matching = a2b[i];
-			b_util->matching = i;
+			a_util->matching = b_j;
+			b_util->matching = a_i;
 		}
 
 	free(cost);
@@ -336,6 +467,91 @@ static void get_correspondences(struct string_list *a, struct string_list *b,
 	free(b2a);
 }
 
+static void get_correspondences(struct string_list *a, struct string_list *b,
+				int creation_factor)
+{
+	struct range_diff_candidates c = { a, b };
+	int *group, *order, *members, i, j, k, n;
+
+	ALLOC_ARRAY(c.a_index, a->nr);
+	ALLOC_ARRAY(c.b_index, b->nr);
+	for (i = 0; i < a->nr; i++)
+		if (((struct patch_util *)a->items[i].util)->matching < 0)
+			c.a_index[c.a_nr++] = i;
+	for (j = 0; j < b->nr; j++)
+		if (((struct patch_util *)b->items[j].util)->matching < 0)
+			c.b_index[c.b_nr++] = j;
+	if (!c.a_nr || !c.b_nr)
+		goto out;
+
+	ALLOC_ARRAY(c.a_lines, c.a_nr);
+	ALLOC_ARRAY(c.a_creation, c.a_nr);
+	for (i = 0; i < c.a_nr; i++) {
+		struct patch_util *util = a->items[c.a_index[i]].util;
+
+		c.a_lines[i] = count_lines(util->diff);
+		c.a_creation[i] = util->diffsize * creation_factor / 100;
+	}
+	ALLOC_ARRAY(c.b_lines, c.b_nr);
+	ALLOC_ARRAY(c.b_creation, c.b_nr);
+	for (j = 0; j < c.b_nr; j++) {
+		struct patch_util *util = b->items[c.b_index[j]].util;
+
+		c.b_lines[j] = count_lines(util->diff);
+		c.b_creation[j] = util->diffsize * creation_factor / 100;
+	}
+
+	ALLOC_ARRAY(c.cost, st_mult(c.a_nr, c.b_nr));
+	fill_candidate_costs(&c);
+
+	/* group the patches a and b that are connected by candidate pairs */
+	n = c.a_nr + c.b_nr;
+	ALLOC_ARRAY(group, n);
+	for (k = 0; k < n; k++)
+		group[k] = k;
+	for (i = 0; i < c.a_nr; i++)
+		for (j = 0; j < c.b_nr; j++)
+			if (c.cost[i * c.b_nr + j] < COST_MAX)
+				group[find_group(group, i)] =
+					find_group(group, c.a_nr + j);
+
+	/* list the members of each group, a's before b's, one at a time */
+	ALLOC_ARRAY(order, n);
+	ALLOC_ARRAY(members, n);
+	for (k = 0; k < n; k++)
+		order[k] = find_group(group, k);
+	for (k = 0; k < n; k++) {
+		int root = order[k], a_nr = 0, b_nr = 0, l;
+
+		if (root < 0)
+			continue;
+		for (l = k; l < c.a_nr; l++)
+			if (order[l] == root) {
+				members[a_nr++] = l;
+				order[l] = -1;
+			}
+		for (l = k > c.a_nr ? k : c.a_nr; l < n; l++)
+			if (order[l] == root) {
+				members[a_nr + b_nr++] = l - c.a_nr;
+				order[l] = -1;
+			}
+		if (a_nr && b_nr)
+			assign_group(&c, members, a_nr, members + a_nr, b_nr);
+	}
+
+	free(group);
+	free(order);
+	free(members);
+	free(c.cost);
+	free(c.a_lines);
+	free(c.a_creation);
+	free(c.b_lines);
+	free(c.b_creation);
+out:
+	free(c.a_index);
+	free(c.b_index);
+}
+
 static void output_pair_header(struct diff_options *diffopt,
 			       int patch_no_width,
 			       struct strbuf *buf,
@@ -13,6 +13,7 @@
 #include "worktree.h"
 #include "object-store.h"
 #include "pack-bitmap.h"
+#include "pack-mtimes.h"
 
 struct connectivity_progress {
 	struct progress *progress;
@@ -138,7 +139,7 @@ static int add_recent_packed(const struct object_id *oid,
 
 	if (obj && obj->flags & SEEN)
 		return 0;
-	add_recent_object(oid, p->mtime, data);
+	add_recent_object(oid, packed_object_mtime(p, pos), data);
 	return 0;
 }
 
@@ -223,21 +224,32 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 	cp.progress = progress;
 	cp.count = 0;
 
-	bitmap_git = prepare_bitmap_walk(revs);
+	/*
+	 * The bitmaps cover what the bitmapped pack reaches; only the
+	 * tips outside of it are walked. Either way, everything reachable
+	 * ends up marked SEEN, which is where the walk from the recent
+	 * objects below stops.
+	 */
+	bitmap_git = prepare_bitmap_walk(revs, NULL);
 	if (bitmap_git) {
+		uint32_t commits, trees, blobs, tags;
+
 		traverse_bitmap_commit_list(bitmap_git, mark_object_seen);
+		count_bitmap_commit_list(bitmap_git, &commits, &trees,
+					 &blobs, &tags);
+		cp.count += commits + trees + blobs + tags;
+		display_progress(cp.progress, cp.count);
 		free_bitmap_index(bitmap_git);
-		return;
+	} else {
+		/*
+		 * Set up the revision walk - this will move all commits
+		 * from the pending list to the commit walking list.
+		 */
+		if (prepare_revision_walk(revs))
+			die("revision walk setup failed");
+		traverse_commit_list(revs, mark_commit, mark_object, &cp);
 	}
 
-	/*
-	 * Set up the revision walk - this will move all commits
-	 * from the pending list to the commit walking list.
-	 */
-	if (prepare_revision_walk(revs))
-		die("revision walk setup failed");
-	traverse_commit_list(revs, mark_commit, mark_object, &cp);
-
 	if (mark_recent) {
 		revs->ignore_missing_links = 1;
 		if (add_unseen_recent_objects_to_traversal(revs, mark_recent))
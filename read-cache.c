@@ -21,6 +21,7 @@
 #include "strbuf.h"
 #include "varint.h"
 #include "split-index.h"
+#include "sparse-index.h"
 #include "utf8.h"
 #include "fsmonitor.h"
 #include "thread-utils.h"
@@ -47,6 +48,7 @@
 #define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -560,6 +562,21 @@ static int index_name_stage_pos(const struct index_state *istate, const char *na
 		}
 		first = next+1;
 	}
+
+	/*
+	 * A path inside a sparse directory entry is only found once
+	 * that entry has been expanded.
+	 */
+	if (istate->sparse_index && first > 0) {
+		const struct cache_entry *ce = istate->cache[first - 1];
+		int len = ce_namelen(ce);
+
+		if (S_ISSPARSEDIR(ce->ce_mode) && len < namelen &&
+		    !memcmp(ce->name, name, len)) {
+			ensure_full_index((struct index_state *)istate);
+			return index_name_stage_pos(istate, name, namelen, stage);
+		}
+	}
 	return -first-1;
 }
 
@@ -697,7 +714,9 @@ void set_object_name_for_intent_to_add_entry(struct cache_entry *ce)
 	oidcpy(&ce->oid, &oid);
 }
 
-int add_to_index(struct index_state *istate, const char *path, struct stat *st, int flags)
+static int add_to_index_1(struct index_state *istate, const char *path,
+			  struct stat *st, const struct object_id *known_oid,
+			  int flags)
 {
 	int namelen, was_same;
 	mode_t st_mode = st->st_mode;
@@ -769,7 +788,9 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 			return 0;
 		}
 	}
-	if (!intent_only) {
+	if (!intent_only && known_oid) {
+		oidcpy(&ce->oid, known_oid);
+	} else if (!intent_only) {
 		if (index_path(istate, &ce->oid, path, st, hash_flags)) {
 			discard_cache_entry(ce);
 			return error(_("unable to index file '%s'"), path);
@@ -798,6 +819,18 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 	return 0;
 }
 
+int add_to_index(struct index_state *istate, const char *path, struct stat *st, int flags)
+{
+	return add_to_index_1(istate, path, st, NULL, flags);
+}
+
+int add_to_index_with_oid(struct index_state *istate, const char *path,
+			  struct stat *st, const struct object_id *oid,
+			  int flags)
+{
+	return add_to_index_1(istate, path, st, oid, flags);
+}
+
 int add_file_to_index(struct index_state *istate, const char *path, int flags)
 {
 	struct stat st;
@@ -1259,6 +1292,22 @@ static int check_file_directory_conflict(struct index_state *istate,
 	return retval + has_dir_name(istate, ce, pos, ok_to_replace);
 }
 
+/*
+ * Would replacing "old" by "ce" leave the trees written from the index
+ * unchanged?  Then the cache-tree need not be invalidated, e.g. when
+ * "git add" re-adds a file that was only touched.
+ */
+static int same_tree_entry(const struct cache_entry *old,
+			   const struct cache_entry *ce)
+{
+	unsigned int flags = CE_REMOVE | CE_INTENT_TO_ADD;
+
+	return !ce_stage(ce) && !ce_stage(old) &&
+		old->ce_mode == ce->ce_mode &&
+		oideq(&old->oid, &ce->oid) &&
+		!((old->ce_flags | ce->ce_flags) & flags);
+}
+
 static int add_index_entry_with_check(struct index_state *istate, struct cache_entry *ce, int option)
 {
 	int pos;
@@ -1267,9 +1316,6 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 	int skip_df_check = option & ADD_CACHE_SKIP_DFCHECK;
 	int new_only = option & ADD_CACHE_NEW_ONLY;
 
-	if (!(option & ADD_CACHE_KEEP_CACHE_TREE))
-		cache_tree_invalidate_path(istate, ce->name);
-
 	/*
 	 * If this entry's path sorts after the last entry in the index,
 	 * we can avoid searching for it.
@@ -1280,6 +1326,10 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 	else
 		pos = index_name_stage_pos(istate, ce->name, ce_namelen(ce), ce_stage(ce));
 
+	if (!(option & ADD_CACHE_KEEP_CACHE_TREE) &&
+	    !(pos >= 0 && same_tree_entry(istate->cache[pos], ce)))
+		cache_tree_invalidate_path(istate, ce->name);
+
 	/* existing match? Just replace it. */
 	if (pos >= 0) {
 		if (!new_only)
@@ -1402,6 +1452,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		return NULL;
 	}
 
+	trace2_counter_add(TRACE2_COUNTER_ID_REFRESH_LSTAT, 1);
 	if (lstat(ce->name, &st) < 0) {
 		if (ignore_missing && errno == ENOENT)
 			return ce;
@@ -1684,6 +1735,10 @@ static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 	if (!verify_index_checksum)
 		return 0;
 
+	/* written with index.skipHash; there is nothing to verify */
+	if (is_null_sha1((unsigned char *)hdr + size - the_hash_algo->rawsz))
+		return 0;
+
 	the_hash_algo->init_fn(&c);
 	the_hash_algo->update_fn(&c, hdr, size - the_hash_algo->rawsz);
 	the_hash_algo->final_fn(hash, &c);
@@ -1716,6 +1771,10 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
 		/* already handled in do_read_index() */
 		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indicator */
+		istate->sparse_index = 1;
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error(_("index uses %.4s extension, which we do not understand"),
@@ -1877,6 +1936,8 @@ static void tweak_split_index(struct index_state *istate)
 static void post_read_index_from(struct index_state *istate)
 {
 	check_ce_order(istate);
+	if (istate->sparse_index && command_requires_full_index)
+		ensure_full_index(istate);
 	tweak_untracked_cache(istate);
 	tweak_split_index(istate);
 	tweak_fsmonitor(istate);
@@ -2327,6 +2388,7 @@ int discard_index(struct index_state *istate)
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
 	istate->fsmonitor_has_run_once = 0;
+	istate->sparse_index = 0;
 	FREE_AND_NULL(istate->cache);
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
@@ -2423,11 +2485,16 @@ int repo_index_has_changes(struct repository *repo,
 static unsigned char write_buffer[WRITE_BUFFER_SIZE];
 static unsigned long write_buffer_len;
 
+/*
+ * A NULL "context" means that the index is written without a trailing
+ * hash, see index.skipHash.
+ */
 static int ce_write_flush(git_hash_ctx *context, int fd)
 {
 	unsigned int buffered = write_buffer_len;
 	if (buffered) {
-		the_hash_algo->update_fn(context, write_buffer, buffered);
+		if (context)
+			the_hash_algo->update_fn(context, write_buffer, buffered);
 		if (write_in_full(fd, write_buffer, buffered) < 0)
 			return -1;
 		write_buffer_len = 0;
@@ -2476,7 +2543,8 @@ static int ce_flush(git_hash_ctx *context, int fd, unsigned char *hash)
 
 	if (left) {
 		write_buffer_len = 0;
-		the_hash_algo->update_fn(context, write_buffer, left);
+		if (context)
+			the_hash_algo->update_fn(context, write_buffer, left);
 	}
 
 	/* Flush first if not enough space for hash signature */
@@ -2486,8 +2554,11 @@ static int ce_flush(git_hash_ctx *context, int fd, unsigned char *hash)
 		left = 0;
 	}
 
-	/* Append the hash signature at the end */
-	the_hash_algo->final_fn(write_buffer + left, context);
+	/* Append the hash signature (or a null one) at the end */
+	if (context)
+		the_hash_algo->final_fn(write_buffer + left, context);
+	else
+		hashclr(write_buffer + left);
 	hashcpy(hash, write_buffer + left);
 	left += the_hash_algo->rawsz;
 	return (write_in_full(fd, write_buffer, left) < 0) ? -1 : 0;
@@ -2571,14 +2642,18 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
-			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+/*
+ * Append the on-disk form of "ce" to "sb". With a version 4 index,
+ * "previous_name" is the name of the entry written before it.
+ */
+static void ce_encode_entry(struct strbuf *sb, struct cache_entry *ce,
+			    struct strbuf *previous_name,
+			    struct ondisk_cache_entry *ondisk)
 {
 	int size;
-	int result;
 	unsigned int saved_namelen;
 	int stripped_name = 0;
-	static unsigned char padding[8] = { 0x00 };
+	static const unsigned char padding[8] = { 0x00 };
 
 	if (ce->ce_flags & CE_STRIP_NAME) {
 		saved_namelen = ce_namelen(ce);
@@ -2591,11 +2666,9 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
-		if (!result)
-			result = ce_write(c, fd, ce->name, len);
-		if (!result)
-			result = ce_write(c, fd, padding, align_padding_size(size, len));
+		strbuf_add(sb, ondisk, size);
+		strbuf_add(sb, ce->name, len);
+		strbuf_add(sb, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2609,13 +2682,10 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
-		if (!result)
-			result = ce_write(c, fd, to_remove_vi, prefix_size);
-		if (!result)
-			result = ce_write(c, fd, ce->name + common, ce_namelen(ce) - common);
-		if (!result)
-			result = ce_write(c, fd, padding, 1);
+		strbuf_add(sb, ondisk, size);
+		strbuf_add(sb, to_remove_vi, prefix_size);
+		strbuf_add(sb, ce->name + common, ce_namelen(ce) - common);
+		strbuf_add(sb, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2624,8 +2694,133 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 		ce->ce_namelen = saved_namelen;
 		ce->ce_flags &= ~CE_STRIP_NAME;
 	}
+}
+
+static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
+			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk,
+			  struct strbuf *sb)
+{
+	strbuf_reset(sb);
+	ce_encode_entry(sb, ce, previous_name, ondisk);
+	return ce_write(c, fd, sb->buf, sb->len);
+}
+
+struct write_cache_entries_thread_data
+{
+	pthread_t pthread;
+	struct index_state *istate;
+	int start, end;		/* range of istate->cache[] in this block */
+	int nr;			/* count of entries written from it */
+	int use_previous_name;	/* version 4 */
+	struct strbuf previous_name;
+	struct strbuf out;	/* on-disk form of the block */
+};
+
+/*
+ * A thread proc to encode one ieot block of entries while the main
+ * thread hashes and writes out the blocks before it.
+ */
+static void *write_cache_entries_thread(void *_data)
+{
+	struct write_cache_entries_thread_data *p = _data;
+	struct ondisk_cache_entry ondisk;
+	int i;
+
+	for (i = p->start; i < p->end; i++) {
+		struct cache_entry *ce = p->istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		ce_encode_entry(&p->out, ce,
+				p->use_previous_name ? &p->previous_name : NULL,
+				&ondisk);
+	}
+	return NULL;
+}
+
+/*
+ * Write the cache entries as ieot blocks of about "ieot_entries"
+ * entries each, cut where the single-threaded writer would cut them.
+ * Every block is encoded by its own thread; the blocks are hashed and
+ * written in order as soon as they are ready.
+ */
+static int write_cache_entries_threaded(struct index_state *istate,
+					git_hash_ctx *c, int fd,
+					struct index_entry_offset_table *ieot,
+					int ieot_entries, int use_previous_name)
+{
+	struct write_cache_entries_thread_data *data;
+	int i, nr_blocks = 0, last = -1, err = 0;
+
+	data = xcalloc(DIV_ROUND_UP(istate->cache_nr, ieot_entries),
+		       sizeof(*data));
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct write_cache_entries_thread_data *p;
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!nr_blocks || !(i % ieot_entries)) {
+			p = &data[nr_blocks++];
+			p->istate = istate;
+			p->start = i;
+			p->use_previous_name = use_previous_name;
+			strbuf_init(&p->previous_name, 0);
+			strbuf_init(&p->out, 0);
+			if (p > data)
+				p[-1].end = i;
+
+			/*
+			 * As with a single thread, the first entry of a
+			 * block has nothing in common with the previous
+			 * one, but still strips all of its name.
+			 */
+			if (use_previous_name && last >= 0 &&
+			    !(istate->cache[last]->ce_flags & CE_STRIP_NAME)) {
+				strbuf_add(&p->previous_name,
+					   istate->cache[last]->name,
+					   ce_namelen(istate->cache[last]));
+				p->previous_name.buf[0] = 0;
+			}
+		}
+		data[nr_blocks - 1].nr++;
+		last = i;
+	}
+	if (nr_blocks)
+		data[nr_blocks - 1].end = istate->cache_nr;
+
+	for (i = 0; i < nr_blocks; i++) {
+		int ret = pthread_create(&data[i].pthread, NULL,
+					 write_cache_entries_thread, &data[i]);
+		if (ret)
+			die(_("unable to create write_cache_entries thread: %s"),
+			    strerror(ret));
+	}
+
+	for (i = 0; i < nr_blocks; i++) {
+		struct write_cache_entries_thread_data *p = &data[i];
+		off_t offset;
+		int ret = pthread_join(p->pthread, NULL);
 
-	return result;
+		if (ret)
+			die(_("unable to join write_cache_entries thread: %s"),
+			    strerror(ret));
+		if (!err) {
+			offset = lseek(fd, 0, SEEK_CUR);
+			if (offset < 0)
+				err = -1;
+			offset += write_buffer_len;
+			ieot->entries[ieot->nr].nr = p->nr;
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->nr++;
+			if (!err && ce_write(c, fd, p->out.buf, p->out.len) < 0)
+				err = -1;
+		}
+		strbuf_release(&p->previous_name);
+		strbuf_release(&p->out);
+	}
+	free(data);
+	return err;
 }
 
 /*
@@ -2696,6 +2891,13 @@ void repo_update_index_if_able(struct repository *repo,
 		rollback_lock_file(lockfile);
 }
 
+static int skip_index_hash(void)
+{
+	int val;
+
+	return !git_config_get_bool("index.skiphash", &val) && val;
+}
+
 static int record_eoie(void)
 {
 	int val;
@@ -2738,7 +2940,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 {
 	uint64_t start = getnanotime();
 	int newfd = tempfile->fd;
-	git_hash_ctx c, eoie_c;
+	git_hash_ctx c, eoie_c, *ctx = &c;
 	struct cache_header hdr;
 	int i, err = 0, removed, extended, hdr_version;
 	struct cache_entry **cache = istate->cache;
@@ -2746,11 +2948,12 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct stat st;
 	struct ondisk_cache_entry ondisk;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	struct strbuf entry_buf = STRBUF_INIT;
 	int drop_cache_tree = istate->drop_cache_tree;
 	off_t offset;
 	int ieot_entries = 1;
 	struct index_entry_offset_table *ieot = NULL;
-	int nr, nr_threads;
+	int nr_threads;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -2780,8 +2983,12 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	hdr.hdr_version = htonl(hdr_version);
 	hdr.hdr_entries = htonl(entries - removed);
 
-	the_hash_algo->init_fn(&c);
-	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
+	/* The shared index is named after its hash, so it needs one. */
+	if (!strip_extensions && skip_index_hash())
+		ctx = NULL;
+	else
+		the_hash_algo->init_fn(&c);
+	if (ce_write(ctx, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
 	if (!HAVE_THREADS || git_config_get_index_threads(&nr_threads))
@@ -2817,16 +3024,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		}
 	}
 
-	offset = lseek(newfd, 0, SEEK_CUR);
-	if (offset < 0) {
-		free(ieot);
-		return -1;
-	}
-	offset += write_buffer_len;
-	nr = 0;
-	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
-
-	for (i = 0; i < entries; i++) {
+	for (i = 0; i < entries && !err; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
@@ -2845,38 +3043,32 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 
 			drop_cache_tree = 1;
 		}
-		if (ieot && i && (i % ieot_entries == 0)) {
-			ieot->entries[ieot->nr].nr = nr;
-			ieot->entries[ieot->nr].offset = offset;
-			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
-			nr = 0;
-			offset = lseek(newfd, 0, SEEK_CUR);
-			if (offset < 0) {
-				free(ieot);
-				return -1;
-			}
-			offset += write_buffer_len;
-		}
-		if (ce_write_entry(&c, newfd, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
+	}
 
-		if (err)
-			break;
-		nr++;
+	if (err) {
+		free(ieot);
+		return err;
 	}
-	if (ieot && nr) {
-		ieot->entries[ieot->nr].nr = nr;
-		ieot->entries[ieot->nr].offset = offset;
-		ieot->nr++;
+
+	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+	if (ieot)
+		err = write_cache_entries_threaded(istate, ctx, newfd, ieot,
+						   ieot_entries, !!previous_name);
+	else {
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			if (ce_write_entry(ctx, newfd, ce, previous_name,
+					   (struct ondisk_cache_entry *)&ondisk,
+					   &entry_buf) < 0) {
+				err = -1;
+				break;
+			}
+		}
 	}
 	strbuf_release(&previous_name_buf);
+	strbuf_release(&entry_buf);
 
 	if (err) {
 		free(ieot);
@@ -2903,8 +3095,8 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_ieot_extension(&sb, ieot);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_INDEXENTRYOFFSETTABLE, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(ctx, &eoie_c, newfd, CACHE_EXT_INDEXENTRYOFFSETTABLE, sb.len) < 0
+			|| ce_write(ctx, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		free(ieot);
 		if (err)
@@ -2916,9 +3108,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(ctx, &eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
-			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			ce_write(ctx, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -2927,8 +3119,8 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(ctx, &eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
+			|| ce_write(ctx, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -2937,9 +3129,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(ctx, &eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			|| ce_write(ctx, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -2948,9 +3140,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_UNTRACKED,
+		err = write_index_ext_header(ctx, &eoie_c, newfd, CACHE_EXT_UNTRACKED,
 					     sb.len) < 0 ||
-			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			ce_write(ctx, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -2959,12 +3151,17 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_fsmonitor_extension(&sb, istate);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_FSMONITOR, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(ctx, &eoie_c, newfd, CACHE_EXT_FSMONITOR, sb.len) < 0
+			|| ce_write(ctx, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
 	}
+	if (istate->sparse_index) {
+		if (write_index_ext_header(ctx, &eoie_c, newfd,
+					   CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+			return -1;
+	}
 
 	/*
 	 * CACHE_EXT_ENDOFINDEXENTRIES must be written as the last entry before the SHA1
@@ -2976,14 +3173,14 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_eoie_extension(&sb, &eoie_c, offset);
-		err = write_index_ext_header(&c, NULL, newfd, CACHE_EXT_ENDOFINDEXENTRIES, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(ctx, NULL, newfd, CACHE_EXT_ENDOFINDEXENTRIES, sb.len) < 0
+			|| ce_write(ctx, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
 	}
 
-	if (ce_flush(&c, newfd, istate->oid.hash))
+	if (ce_flush(ctx, newfd, istate->oid.hash))
 		return -1;
 	if (close_tempfile_gently(tempfile)) {
 		error(_("could not close '%s'"), tempfile->filename.buf);
@@ -3024,6 +3221,11 @@ static int do_write_locked_index(struct index_state *istate, struct lock_file *l
 				 unsigned flags)
 {
 	int ret;
+	int was_full = !istate->sparse_index;
+
+	ret = convert_to_sparse(istate);
+	if (ret)
+		return ret;
 
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
@@ -3035,6 +3237,9 @@ static int do_write_locked_index(struct index_state *istate, struct lock_file *l
 	trace2_region_leave_printf("index", "do_write_index", the_repository,
 				   "%s", lock->tempfile->filename.buf);
 
+	if (was_full)
+		ensure_full_index(istate);
+
 	if (ret)
 		return ret;
 	if (flags & COMMIT_LOCK)
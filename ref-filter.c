@@ -113,6 +113,8 @@ static struct used_atom {
 	const char *name;
 	cmp_type type;
 	info_source source;
+	/* Is it shown, as opposed to only sorted on? */
+	unsigned in_format : 1;
 	union {
 		char color[COLOR_MAXLEN];
 		struct align align;
@@ -884,6 +886,7 @@ int verify_ref_format(struct ref_format *format)
 		at = parse_ref_filter_atom(format, sp + 2, ep, &err);
 		if (at < 0)
 			die("%s", err.buf);
+		used_atom[at].in_format = 1;
 		cp = ep + 1;
 
 		if (skip_prefix(used_atom[at].name, "color:", &color))
@@ -1409,16 +1412,29 @@ static const char *show_ref(struct refname_atom *atom, const char *refname)
 		return xstrdup(refname);
 }
 
+static int get_tracking_stat(struct ref_array_item *ref, struct branch *branch,
+			     int push, int *num_ours, int *num_theirs)
+{
+	struct tracking_stat *stat = ref->tracking[push];
+
+	if (!stat)
+		return stat_tracking_info(branch, num_ours, num_theirs,
+					  NULL, push, AHEAD_BEHIND_FULL);
+	*num_ours = stat->ours;
+	*num_theirs = stat->theirs;
+	return stat->result;
+}
+
 static void fill_remote_ref_details(struct used_atom *atom, const char *refname,
+				    struct ref_array_item *ref,
 				    struct branch *branch, const char **s)
 {
 	int num_ours, num_theirs;
 	if (atom->u.remote_ref.option == RR_REF)
 		*s = show_ref(&atom->u.remote_ref.refname, refname);
 	else if (atom->u.remote_ref.option == RR_TRACK) {
-		if (stat_tracking_info(branch, &num_ours, &num_theirs,
-				       NULL, atom->u.remote_ref.push,
-				       AHEAD_BEHIND_FULL) < 0) {
+		if (get_tracking_stat(ref, branch, atom->u.remote_ref.push,
+				      &num_ours, &num_theirs) < 0) {
 			*s = xstrdup(msgs.gone);
 		} else if (!num_ours && !num_theirs)
 			*s = xstrdup("");
@@ -1435,9 +1451,8 @@ static void fill_remote_ref_details(struct used_atom *atom, const char *refname,
 			free((void *)to_free);
 		}
 	} else if (atom->u.remote_ref.option == RR_TRACKSHORT) {
-		if (stat_tracking_info(branch, &num_ours, &num_theirs,
-				       NULL, atom->u.remote_ref.push,
-				       AHEAD_BEHIND_FULL) < 0) {
+		if (get_tracking_stat(ref, branch, atom->u.remote_ref.push,
+				      &num_ours, &num_theirs) < 0) {
 			*s = xstrdup("");
 			return;
 		}
@@ -1598,13 +1613,48 @@ static char *get_worktree_path(const struct used_atom *atom, const struct ref_ar
 		return xstrdup("");
 }
 
+/*
+ * Return the index of the atom whose value can be taken from the
+ * commit-graph without reading the object, or -1 if there is none.
+ *
+ * That is the case of %(committerdate) when it is only sorted on
+ * (the commit-graph lacks the timezone to show it), and when no other
+ * atom needs the contents of the object.
+ */
+static int commit_graph_date_atom(void)
+{
+	static int graph_atom = -2;
+	const char *arg;
+	int i;
+
+	if (graph_atom != -2)
+		return graph_atom;
+
+	graph_atom = -1;
+	if (need_tagged)
+		return graph_atom;
+	for (i = 0; i < used_atom_cnt; i++) {
+		if (used_atom[i].source != SOURCE_OBJ)
+			continue;
+		if (graph_atom >= 0 || used_atom[i].in_format ||
+		    !skip_prefix(used_atom[i].name, "committerdate", &arg) ||
+		    (*arg && *arg != ':')) {
+			graph_atom = -1;
+			break;
+		}
+		graph_atom = i;
+	}
+	return graph_atom;
+}
+
 /*
  * Parse the object referred by ref, and grab needed value.
  */
 static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 {
 	struct object *obj;
-	int i;
+	int i, graph_atom;
+	timestamp_t date;
 	struct object_info empty = OBJECT_INFO_INIT;
 
 	ref->value = xcalloc(used_atom_cnt, sizeof(struct atom_value));
@@ -1656,7 +1706,8 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 
 			refname = branch_get_upstream(branch, NULL);
 			if (refname)
-				fill_remote_ref_details(atom, refname, branch, &v->s);
+				fill_remote_ref_details(atom, refname, ref,
+							branch, &v->s);
 			else
 				v->s = xstrdup("");
 			continue;
@@ -1677,7 +1728,8 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 			}
 			/* We will definitely re-init v->s on the next line. */
 			free((char *)v->s);
-			fill_remote_ref_details(atom, refname, branch, &v->s);
+			fill_remote_ref_details(atom, refname, ref, branch,
+						&v->s);
 			continue;
 		} else if (starts_with(name, "color:")) {
 			v->s = xstrdup(atom->u.color);
@@ -1746,6 +1798,28 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 
 	if (need_tagged)
 		oi.info.contentp = &oi.content;
+
+	graph_atom = commit_graph_date_atom();
+	if (graph_atom >= 0 &&
+	    commit_graph_commit_date(the_repository, &ref->objectname, &date)) {
+		struct object_info info = oi.info;
+		int ret;
+
+		ref->value[graph_atom].value = date;
+		ref->value[graph_atom].s = xstrdup("");
+
+		/* Still get what the other atoms want, but not the contents. */
+		oi.info.contentp = NULL;
+		if (!memcmp(&oi.info, &empty, sizeof(empty)))
+			ret = 0;
+		else {
+			oi.oid = ref->objectname;
+			ret = get_object(ref, 0, &obj, &oi, err);
+		}
+		oi.info = info;
+		return ret;
+	}
+
 	if (!memcmp(&oi.info, &empty, sizeof(empty)) &&
 	    !memcmp(&oi_deref.info, &empty, sizeof(empty)))
 		return 0;
@@ -1864,64 +1938,6 @@ static int filter_pattern_match(struct ref_filter *filter, const char *refname)
 	return match_pattern(filter, refname);
 }
 
-static int qsort_strcmp(const void *va, const void *vb)
-{
-	const char *a = *(const char **)va;
-	const char *b = *(const char **)vb;
-
-	return strcmp(a, b);
-}
-
-static void find_longest_prefixes_1(struct string_list *out,
-				  struct strbuf *prefix,
-				  const char **patterns, size_t nr)
-{
-	size_t i;
-
-	for (i = 0; i < nr; i++) {
-		char c = patterns[i][prefix->len];
-		if (!c || is_glob_special(c)) {
-			string_list_append(out, prefix->buf);
-			return;
-		}
-	}
-
-	i = 0;
-	while (i < nr) {
-		size_t end;
-
-		/*
-		* Set "end" to the index of the element _after_ the last one
-		* in our group.
-		*/
-		for (end = i + 1; end < nr; end++) {
-			if (patterns[i][prefix->len] != patterns[end][prefix->len])
-				break;
-		}
-
-		strbuf_addch(prefix, patterns[i][prefix->len]);
-		find_longest_prefixes_1(out, prefix, patterns + i, end - i);
-		strbuf_setlen(prefix, prefix->len - 1);
-
-		i = end;
-	}
-}
-
-static void find_longest_prefixes(struct string_list *out,
-				  const char **patterns)
-{
-	struct argv_array sorted = ARGV_ARRAY_INIT;
-	struct strbuf prefix = STRBUF_INIT;
-
-	argv_array_pushv(&sorted, patterns);
-	QSORT(sorted.argv, sorted.argc, qsort_strcmp);
-
-	find_longest_prefixes_1(out, &prefix, sorted.argv, sorted.argc);
-
-	argv_array_clear(&sorted);
-	strbuf_release(&prefix);
-}
-
 /*
  * This is the same as for_each_fullref_in(), but it tries to iterate
  * only over the patterns we'll care about. Note that it _doesn't_ do a full
@@ -1932,10 +1948,6 @@ static int for_each_fullref_in_pattern(struct ref_filter *filter,
 				       void *cb_data,
 				       int broken)
 {
-	struct string_list prefixes = STRING_LIST_INIT_DUP;
-	struct string_list_item *prefix;
-	int ret;
-
 	if (!filter->match_as_path) {
 		/*
 		 * in this case, the patterns are applied after
@@ -1959,16 +1971,9 @@ static int for_each_fullref_in_pattern(struct ref_filter *filter,
 		return for_each_fullref_in("", cb, cb_data, broken);
 	}
 
-	find_longest_prefixes(&prefixes, filter->name_patterns);
-
-	for_each_string_list_item(prefix, &prefixes) {
-		ret = for_each_fullref_in(prefix->string, cb, cb_data, broken);
-		if (ret)
-			break;
-	}
-
-	string_list_clear(&prefixes, 0);
-	return ret;
+	return refs_for_each_fullref_in_prefixes(get_main_ref_store(the_repository),
+						 "", filter->name_patterns,
+						 cb, cb_data, broken);
 }
 
 /*
@@ -2141,6 +2146,8 @@ static int ref_filter_handler(const char *refname, const struct object_id *oid,
 static void free_array_item(struct ref_array_item *item)
 {
 	free((char *)item->symref);
+	free(item->tracking[0]);
+	free(item->tracking[1]);
 	if (item->value) {
 		int i;
 		for (i = 0; i < used_atom_cnt; i++)
@@ -2221,6 +2228,61 @@ static void do_merge_filter(struct ref_filter_cbdata *ref_cbdata)
  * as per the given ref_filter structure and finally store the
  * filtered refs in the ref_array structure.
  */
+/*
+ * Count the commits ahead of and behind their upstream (or push) branch
+ * of all the branches in "array" at once, when %(upstream:track) or the
+ * like will need them.
+ */
+static void fill_tracking_stats(struct ref_array *array)
+{
+	int want[2] = { 0, 0 }, push, i;
+
+	for (i = 0; i < used_atom_cnt; i++) {
+		struct used_atom *atom = &used_atom[i];
+
+		if ((starts_with(atom->name, "upstream") ||
+		     starts_with(atom->name, "push")) &&
+		    (atom->u.remote_ref.option == RR_TRACK ||
+		     atom->u.remote_ref.option == RR_TRACKSHORT))
+			want[atom->u.remote_ref.push] = 1;
+	}
+
+	for (push = 0; push < 2; push++) {
+		struct ref_array_item **items;
+		struct branch **branches;
+		struct tracking_stat *stats;
+		int nr = 0;
+
+		if (!want[push])
+			continue;
+
+		ALLOC_ARRAY(items, array->nr);
+		ALLOC_ARRAY(branches, array->nr);
+		for (i = 0; i < array->nr; i++) {
+			const char *name;
+
+			if (!skip_prefix(array->items[i]->refname,
+					 "refs/heads/", &name))
+				continue;
+			items[nr] = array->items[i];
+			branches[nr++] = branch_get(name);
+		}
+
+		ALLOC_ARRAY(stats, nr);
+		stat_tracking_info_many(branches, nr, push, stats);
+		for (i = 0; i < nr; i++) {
+			if (!items[i]->tracking[push])
+				items[i]->tracking[push] =
+					xmalloc(sizeof(stats[i]));
+			*items[i]->tracking[push] = stats[i];
+		}
+
+		free(stats);
+		free(branches);
+		free(items);
+	}
+}
+
 int filter_refs(struct ref_array *array, struct ref_filter *filter, unsigned int type)
 {
 	struct ref_filter_cbdata ref_cbdata;
@@ -2266,6 +2328,7 @@ int filter_refs(struct ref_array *array, struct ref_filter *filter, unsigned int
 	if (filter->merge_commit)
 		do_merge_filter(&ref_cbdata);
 
+	fill_tracking_stats(array);
 	return ret;
 }
 
@@ -2359,6 +2422,9 @@ int format_ref_array_item(struct ref_array_item *info,
 		if (cp < sp)
 			append_literal(cp, sp, &state);
 		pos = parse_ref_filter_atom(format, sp + 2, ep, error_buf);
+		if (pos >= 0 && !used_atom[pos].in_format)
+			BUG("format atom %s not seen by verify_ref_format()",
+			    used_atom[pos].name);
 		if (pos < 0 || get_ref_atom_value(info, pos, &atomv, error_buf) ||
 		    atomv->handler(atomv, &state, error_buf)) {
 			pop_stack_element(&state.stack);
@@ -2389,9 +2455,11 @@ int format_ref_array_item(struct ref_array_item *info,
 void show_ref_array_item(struct ref_array_item *info,
 			 const struct ref_format *format)
 {
-	struct strbuf final_buf = STRBUF_INIT;
+	char final[1024];
+	struct strbuf final_buf;
 	struct strbuf error_buf = STRBUF_INIT;
 
+	strbuf_init_stack(&final_buf, final, sizeof(final));
 	if (format_ref_array_item(info, format, &final_buf, &error_buf))
 		die("%s", error_buf.buf);
 	fwrite(final_buf.buf, 1, final_buf.len, stdout);
@@ -24,6 +24,7 @@
 #define FILTER_REFS_KIND_MASK      (FILTER_REFS_ALL | FILTER_REFS_DETACHED_HEAD)
 
 struct atom_value;
+struct tracking_stat;
 
 struct ref_sorting {
 	struct ref_sorting *next;
@@ -40,6 +41,8 @@ struct ref_array_item {
 	const char *symref;
 	struct commit *commit;
 	struct atom_value *value;
+	/* ahead/behind counts against the upstream and the push branch */
+	struct tracking_stat *tracking[2];
 	char refname[FLEX_ARRAY];
 };
 
@@ -15,6 +15,7 @@
 #include "submodule.h"
 #include "worktree.h"
 #include "argv-array.h"
+#include "string-list.h"
 #include "repository.h"
 
 /*
@@ -967,6 +968,9 @@ struct read_ref_at_cb {
 	timestamp_t *cutoff_time;
 	int *cutoff_tz;
 	int *cutoff_cnt;
+
+	/* newest entries the backend did not show us */
+	int skipped;
 };
 
 static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
@@ -975,6 +979,12 @@ static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
 {
 	struct read_ref_at_cb *cb = cb_data;
 
+	if (cb->skipped) {
+		cb->reccnt += cb->skipped;
+		if (cb->cnt > 0)
+			cb->cnt -= cb->skipped;
+		cb->skipped = 0;
+	}
 	cb->reccnt++;
 	cb->tz = tz;
 	cb->date = timestamp;
@@ -1054,7 +1064,10 @@ int read_ref_at(struct ref_store *refs, const char *refname,
 	cb.cutoff_cnt = cutoff_cnt;
 	cb.oid = oid;
 
-	refs_for_each_reflog_ent_reverse(refs, refname, read_ref_at_ent, &cb);
+	refs->be->for_each_reflog_ent_reverse_at(refs, refname, at_time, cnt,
+						 &cb.skipped, read_ref_at_ent,
+						 &cb);
+	cb.reccnt += cb.skipped;
 
 	if (!cb.reccnt) {
 		if (flags & GET_OID_QUIETLY)
@@ -1609,6 +1622,95 @@ int refs_for_each_fullref_in(struct ref_store *refs, const char *prefix,
 	return do_for_each_ref(refs, prefix, fn, 0, flag, cb_data);
 }
 
+static int qsort_strcmp(const void *va, const void *vb)
+{
+	const char *a = *(const char **)va;
+	const char *b = *(const char **)vb;
+
+	return strcmp(a, b);
+}
+
+static void find_longest_prefixes_1(struct string_list *out,
+				  struct strbuf *prefix,
+				  const char **patterns, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		char c = patterns[i][prefix->len];
+		if (!c || is_glob_special(c)) {
+			string_list_append(out, prefix->buf);
+			return;
+		}
+	}
+
+	i = 0;
+	while (i < nr) {
+		size_t end;
+
+		/*
+		* Set "end" to the index of the element _after_ the last one
+		* in our group.
+		*/
+		for (end = i + 1; end < nr; end++) {
+			if (patterns[i][prefix->len] != patterns[end][prefix->len])
+				break;
+		}
+
+		strbuf_addch(prefix, patterns[i][prefix->len]);
+		find_longest_prefixes_1(out, prefix, patterns + i, end - i);
+		strbuf_setlen(prefix, prefix->len - 1);
+
+		i = end;
+	}
+}
+
+static void find_longest_prefixes(struct string_list *out,
+				  const char **patterns)
+{
+	struct argv_array sorted = ARGV_ARRAY_INIT;
+	struct strbuf prefix = STRBUF_INIT;
+
+	argv_array_pushv(&sorted, patterns);
+	QSORT(sorted.argv, sorted.argc, qsort_strcmp);
+
+	find_longest_prefixes_1(out, &prefix, sorted.argv, sorted.argc);
+
+	argv_array_clear(&sorted);
+	strbuf_release(&prefix);
+}
+
+int refs_for_each_fullref_in_prefixes(struct ref_store *ref_store,
+				      const char *namespace,
+				      const char **patterns,
+				      each_ref_fn fn, void *cb_data,
+				      unsigned int broken)
+{
+	struct string_list prefixes = STRING_LIST_INIT_DUP;
+	struct string_list_item *prefix;
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0, namespace_len;
+
+	find_longest_prefixes(&prefixes, patterns);
+
+	if (namespace)
+		strbuf_addstr(&buf, namespace);
+	namespace_len = buf.len;
+
+	for_each_string_list_item(prefix, &prefixes) {
+		strbuf_addstr(&buf, prefix->string);
+		ret = refs_for_each_fullref_in(ref_store, buf.buf, fn,
+					       cb_data, broken);
+		if (ret)
+			break;
+		strbuf_setlen(&buf, namespace_len);
+	}
+
+	string_list_clear(&prefixes, 0);
+	strbuf_release(&buf);
+	return ret;
+}
+
 int for_each_replace_ref(struct repository *r, each_repo_ref_fn fn, void *cb_data)
 {
 	return do_for_each_repo_ref(r, git_replace_ref_base, fn,
@@ -1824,17 +1926,40 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
 	return entry ? entry->refs : NULL;
 }
 
+/*
+ * Return the name of the ref storage backend recorded in the
+ * repository format of the repository at `gitdir`, or NULL if it uses
+ * the default one.
+ */
+static char *read_ref_storage_format(const char *gitdir)
+{
+	struct repository_format format = REPOSITORY_FORMAT_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	char *ret = NULL;
+
+	get_common_dir_noenv(&sb, gitdir);
+	strbuf_addstr(&sb, "/config");
+	if (read_repository_format(&format, sb.buf) >= 1)
+		ret = xstrdup_or_null(format.ref_storage);
+	clear_repository_format(&format);
+	strbuf_release(&sb);
+	return ret;
+}
+
 /*
  * Create, record, and return a ref_store instance for the specified
- * gitdir.
+ * gitdir, using the backend `be_name` (or the default one if NULL).
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					const char *be_name,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	if (!be_name)
+		be_name = "files";
+	be = find_ref_storage_backend(be_name);
 	if (!be)
 		BUG("reference backend %s is unknown", be_name);
 
@@ -1850,7 +1975,16 @@ struct ref_store *get_main_ref_store(struct repository *r)
 	if (!r->gitdir)
 		BUG("attempting to get main_ref_store outside of repository");
 
-	r->refs = ref_store_init(r->gitdir, REF_STORE_ALL_CAPS);
+	if (r == the_repository) {
+		r->refs = ref_store_init(r->gitdir,
+					 repository_format_ref_storage,
+					 REF_STORE_ALL_CAPS);
+	} else {
+		char *be_name = read_ref_storage_format(r->gitdir);
+		r->refs = ref_store_init(r->gitdir, be_name,
+					 REF_STORE_ALL_CAPS);
+		free(be_name);
+	}
 	return r->refs;
 }
 
@@ -1874,7 +2008,7 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 {
 	struct strbuf submodule_sb = STRBUF_INIT;
 	struct ref_store *refs;
-	char *to_free = NULL;
+	char *to_free = NULL, *be_name;
 	size_t len;
 
 	if (!submodule)
@@ -1902,8 +2036,10 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 		goto done;
 
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
+	be_name = read_ref_storage_format(submodule_sb.buf);
+	refs = ref_store_init(submodule_sb.buf, be_name,
 			      REF_STORE_READ | REF_STORE_ODB);
+	free(be_name);
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
@@ -1929,9 +2065,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      repository_format_ref_storage,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      repository_format_ref_storage,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
@@ -318,6 +318,21 @@ int refs_for_each_fullref_in(struct ref_store *refs, const char *prefix,
 			     unsigned int broken);
 int for_each_fullref_in(const char *prefix, each_ref_fn fn, void *cb_data,
 			unsigned int broken);
+
+/**
+ * iterate all refs in "patterns" by partitioning patterns into disjoint sets
+ * and iterating the longest-common prefix of each set, with one seek per
+ * set instead of a scan of everything.
+ *
+ * Each pattern is taken up to its first glob character, if any, and is
+ * looked up under "namespace" (which may be NULL). The callback still
+ * sees refs that only share that prefix, and has to match them itself.
+ */
+int refs_for_each_fullref_in_prefixes(struct ref_store *refs,
+				      const char *namespace,
+				      const char **patterns,
+				      each_ref_fn fn, void *cb_data,
+				      unsigned int broken);
 int for_each_tag_ref(each_ref_fn fn, void *cb_data);
 int for_each_branch_ref(each_ref_fn fn, void *cb_data);
 int for_each_remote_ref(each_ref_fn fn, void *cb_data);
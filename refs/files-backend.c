@@ -1933,30 +1933,16 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
-					     const char *refname,
-					     each_reflog_ent_fn fn,
-					     void *cb_data)
+/*
+ * Feed the entries of "logfp" that end before "pos", which is either
+ * its end or the beginning of a line, to "fn" from the newest one.
+ */
+static int reflog_ent_reverse_from(FILE *logfp, long pos, const char *refname,
+				   each_reflog_ent_fn fn, void *cb_data)
 {
-	struct files_ref_store *refs =
-		files_downcast(ref_store, REF_STORE_READ,
-			       "for_each_reflog_ent_reverse");
 	struct strbuf sb = STRBUF_INIT;
-	FILE *logfp;
-	long pos;
 	int ret = 0, at_tail = 1;
 
-	files_reflog_path(refs, &sb, refname);
-	logfp = fopen(sb.buf, "r");
-	strbuf_release(&sb);
-	if (!logfp)
-		return -1;
-
-	/* Jump to the end */
-	if (fseek(logfp, 0, SEEK_END) < 0)
-		ret = error("cannot seek back reflog for %s: %s",
-			    refname, strerror(errno));
-	pos = ftell(logfp);
 	while (!ret && 0 < pos) {
 		int cnt;
 		size_t nread;
@@ -2042,8 +2028,162 @@ static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	if (!ret && sb.len)
 		BUG("reverse reflog parser had leftover data");
 
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+					     const char *refname,
+					     each_reflog_ent_fn fn,
+					     void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse");
+	struct strbuf sb = STRBUF_INIT;
+	FILE *logfp;
+	long pos;
+	int ret = 0;
+
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
+	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+
+	/* Jump to the end */
+	if (fseek(logfp, 0, SEEK_END) < 0)
+		ret = error("cannot seek back reflog for %s: %s",
+			    refname, strerror(errno));
+	pos = ftell(logfp);
+	if (!ret)
+		ret = reflog_ent_reverse_from(logfp, pos, refname, fn, cb_data);
+
 	fclose(logfp);
+	return ret;
+}
+
+/* The beginning of the line of "buf" that "p" is in. */
+static size_t reflog_line_start(const char *buf, size_t p)
+{
+	while (p && buf[p - 1] != '\n')
+		p--;
+	return p;
+}
+
+/* The end of the line of "buf" that starts at "p", past its LF. */
+static size_t reflog_line_end(const char *buf, size_t size, size_t p)
+{
+	const char *eol = memchr(buf + p, '\n', size - p);
+
+	return eol ? eol - buf + 1 : size;
+}
+
+/* The timestamp of the entry at "p", or 0 if it cannot be parsed. */
+static timestamp_t reflog_line_time(const char *buf, size_t size, size_t p)
+{
+	size_t end = reflog_line_end(buf, size, p);
+	const char *email_end = memchr(buf + p, '>', end - p);
+
+	if (!email_end || end - (email_end - buf) < 3 || email_end[1] != ' ' ||
+	    !isdigit(email_end[2]))
+		return 0;
+	return parse_timestamp(email_end + 2, NULL, 10);
+}
+
+/*
+ * Find where the reverse walk of read_ref_at() can start in the reflog
+ * "buf", so that the first entry it is given is the one just newer
+ * than the one it stops at. Store in "skipped" how many entries come
+ * after it. When walking by date, entries are expected in the order
+ * they are appended, which is also the order of their timestamps;
+ * that lets us bisect the log instead of parsing it all.
+ */
+static size_t reflog_seek(const char *buf, size_t size,
+			  timestamp_t at_time, int cnt, int *skipped)
+{
+	size_t lo = 0, hi = size, pos;
+
+	*skipped = 0;
+	if (!size || buf[size - 1] != '\n')
+		return size;
+
+	if (cnt >= 0) {
+		/* Skip the newest "cnt - 1" entries newer than "at_time". */
+		pos = size;
+		lo = reflog_line_start(buf, pos - 1);
+		while (lo && *skipped + 1 < cnt) {
+			size_t older = reflog_line_start(buf, lo - 1);
+			timestamp_t timestamp = reflog_line_time(buf, size, older);
+
+			if (!timestamp || timestamp <= at_time)
+				break;
+			pos = lo;
+			lo = older;
+			(*skipped)++;
+		}
+		return pos;
+	}
+
+	/* Find the oldest entry that is newer than "at_time". */
+	while (lo < hi) {
+		size_t start = reflog_line_start(buf, lo + (hi - lo) / 2);
+		timestamp_t timestamp = reflog_line_time(buf, size, start);
+
+		if (!timestamp)
+			return size;
+		if (timestamp > at_time)
+			hi = start;
+		else
+			lo = reflog_line_end(buf, size, start);
+	}
+	if (lo == size)
+		return size;
+
+	pos = reflog_line_end(buf, size, lo);
+	for (lo = pos; lo < size; lo = reflog_line_end(buf, size, lo))
+		(*skipped)++;
+	return pos;
+}
+
+static int files_for_each_reflog_ent_reverse_at(struct ref_store *ref_store,
+						const char *refname,
+						timestamp_t at_time, int cnt,
+						int *skipped,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse_at");
+	struct strbuf sb = STRBUF_INIT;
+	struct stat st;
+	FILE *logfp;
+	size_t pos;
+	int ret;
+
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
 	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+
+	if (fstat(fileno(logfp), &st) < 0) {
+		ret = error_errno("cannot stat reflog for %s", refname);
+		goto out;
+	}
+	pos = xsize_t(st.st_size);
+	*skipped = 0;
+	if (pos) {
+		char *buf = xmmap(NULL, pos, PROT_READ, MAP_PRIVATE,
+				  fileno(logfp), 0);
+		pos = reflog_seek(buf, pos, at_time, cnt, skipped);
+		munmap(buf, xsize_t(st.st_size));
+	}
+	ret = reflog_ent_reverse_from(logfp, pos, refname, fn, cb_data);
+
+out:
+	fclose(logfp);
 	return ret;
 }
 
@@ -3173,7 +3313,7 @@ static int files_init_db(struct ref_store *ref_store, struct strbuf *err)
 }
 
 struct ref_storage_be refs_be_files = {
-	NULL,
+	&refs_be_reftable,
 	"files",
 	files_ref_store_create,
 	files_init_db,
@@ -3194,6 +3334,7 @@ struct ref_storage_be refs_be_files = {
 	files_reflog_iterator_begin,
 	files_for_each_reflog_ent,
 	files_for_each_reflog_ent_reverse,
+	files_for_each_reflog_ent_reverse_at,
 	files_reflog_exists,
 	files_create_reflog,
 	files_delete_reflog,
@@ -1077,6 +1077,114 @@ static int packed_init_db(struct ref_store *ref_store, struct strbuf *err)
 	return 0;
 }
 
+/*
+ * Check that `update` agrees with the value `old_oid` that the
+ * reference currently has in the packed-refs file, or with the
+ * reference being missing from it if `old_oid` is NULL. On mismatch,
+ * write an error message to `err` and return -1.
+ */
+static int check_old_value(struct ref_update *update,
+			   const struct object_id *old_oid,
+			   struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD))
+		return 0;
+
+	if (!old_oid) {
+		if (is_null_oid(&update->old_oid))
+			return 0;
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "reference is missing but expected %s",
+			    update->refname,
+			    oid_to_hex(&update->old_oid));
+		return -1;
+	}
+
+	if (is_null_oid(&update->old_oid)) {
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "reference already exists",
+			    update->refname);
+		return -1;
+	} else if (!oideq(&update->old_oid, old_oid)) {
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "is at %s but expected %s",
+			    update->refname,
+			    oid_to_hex(old_oid),
+			    oid_to_hex(&update->old_oid));
+		return -1;
+	}
+	return 0;
+}
+
+static int write_snapshot_range(FILE *out, const char *start, const char *end)
+{
+	if (start == end)
+		return 0;
+	return fwrite(start, end - start, 1, out) == 1 ? 0 : -1;
+}
+
+/*
+ * Write the references of `snapshot`, with `updates` applied, to
+ * `out`. This gives the same result as the merge loop of
+ * write_with_updates(), but each update only costs a binary search
+ * in the snapshot: the records between two updates are copied as
+ * they are, instead of being parsed and written out one by one. That
+ * is only right if those records are what we would write for them,
+ * i.e. if the snapshot (which is always sorted) is fully peeled.
+ *
+ * Return 0 on success, -1 with a message in `err` if an update does
+ * not match the old value of its reference, and -2 on write error
+ * (with errno set).
+ */
+static int write_with_updates_by_copying(struct snapshot *snapshot,
+					 struct string_list *updates,
+					 FILE *out, struct strbuf *err)
+{
+	const char *pos = snapshot->start;
+	size_t i;
+
+	for (i = 0; i < updates->nr; i++) {
+		struct ref_update *update = updates->items[i].util;
+		const char *rec = find_reference_location(snapshot,
+							  update->refname, 0);
+		const char *next = rec;
+		struct object_id old_oid, peeled;
+
+		if (rec != snapshot->eof &&
+		    !cmp_record_to_refname(rec, update->refname)) {
+			const char *p;
+
+			if (parse_oid_hex(rec, &old_oid, &p))
+				die_invalid_line(snapshot->refs->path, rec,
+						 snapshot->eof - rec);
+			if (check_old_value(update, &old_oid, err))
+				return -1;
+			if (!(update->flags & REF_HAVE_NEW))
+				continue;
+			next = find_end_of_record(rec, snapshot->eof);
+		} else if (check_old_value(update, NULL, err)) {
+			return -1;
+		} else if (!(update->flags & REF_HAVE_NEW)) {
+			continue;
+		}
+
+		if (write_snapshot_range(out, pos, rec))
+			return -2;
+		pos = next;
+
+		if (is_null_oid(&update->new_oid))
+			continue;
+		if (write_packed_entry(out, update->refname, &update->new_oid,
+				       peel_object(&update->new_oid, &peeled) ?
+				       NULL : &peeled))
+			return -2;
+	}
+
+	if (write_snapshot_range(out, pos, snapshot->eof))
+		return -2;
+	return 0;
+}
+
 /*
  * Write the packed refs from the current snapshot to the packed-refs
  * tempfile, incorporating any changes from `updates`. `updates` must
@@ -1092,6 +1200,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 			      struct strbuf *err)
 {
 	struct ref_iterator *iter = NULL;
+	struct snapshot *snapshot;
 	size_t i;
 	int ok;
 	FILE *out;
@@ -1128,6 +1237,20 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
 		goto write_error;
 
+	snapshot = get_snapshot(refs);
+	if (snapshot->peeled == PEELED_FULLY) {
+		int ret;
+
+		acquire_snapshot(snapshot);
+		ret = write_with_updates_by_copying(snapshot, updates, out, err);
+		release_snapshot(snapshot);
+		if (ret == -1)
+			goto error;
+		if (ret)
+			goto write_error;
+		goto done;
+	}
+
 	/*
 	 * We iterate in parallel through the current list of refs and
 	 * the list of updates, processing an entry from at least one
@@ -1163,21 +1286,8 @@ static int write_with_updates(struct packed_ref_store *refs,
 			 * for this reference. Check the old value if
 			 * necessary:
 			 */
-			if ((update->flags & REF_HAVE_OLD)) {
-				if (is_null_oid(&update->old_oid)) {
-					strbuf_addf(err, "cannot update ref '%s': "
-						    "reference already exists",
-						    update->refname);
-					goto error;
-				} else if (!oideq(&update->old_oid, iter->oid)) {
-					strbuf_addf(err, "cannot update ref '%s': "
-						    "is at %s but expected %s",
-						    update->refname,
-						    oid_to_hex(iter->oid),
-						    oid_to_hex(&update->old_oid));
-					goto error;
-				}
-			}
+			if (check_old_value(update, iter->oid, err))
+				goto error;
 
 			/* Now figure out what to use for the new value: */
 			if ((update->flags & REF_HAVE_NEW)) {
@@ -1203,14 +1313,8 @@ static int write_with_updates(struct packed_ref_store *refs,
 			 * update for this reference. Make sure that
 			 * the update didn't expect an existing value:
 			 */
-			if ((update->flags & REF_HAVE_OLD) &&
-			    !is_null_oid(&update->old_oid)) {
-				strbuf_addf(err, "cannot update ref '%s': "
-					    "reference is missing but expected %s",
-					    update->refname,
-					    oid_to_hex(&update->old_oid));
+			if (check_old_value(update, NULL, err))
 				goto error;
-			}
 		}
 
 		if (cmp < 0) {
@@ -1255,6 +1359,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 		goto error;
 	}
 
+done:
 	if (close_tempfile_gently(refs->tempfile)) {
 		strbuf_addf(err, "error closing file %s: %s",
 			    get_tempfile_path(refs->tempfile),
@@ -1610,6 +1715,17 @@ static int packed_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	return 0;
 }
 
+static int packed_for_each_reflog_ent_reverse_at(struct ref_store *ref_store,
+						 const char *refname,
+						 timestamp_t at_time, int cnt,
+						 int *skipped,
+						 each_reflog_ent_fn fn,
+						 void *cb_data)
+{
+	*skipped = 0;
+	return 0;
+}
+
 static int packed_reflog_exists(struct ref_store *ref_store,
 			       const char *refname)
 {
@@ -1662,6 +1778,7 @@ struct ref_storage_be refs_be_packed = {
 	packed_reflog_iterator_begin,
 	packed_for_each_reflog_ent,
 	packed_for_each_reflog_ent_reverse,
+	packed_for_each_reflog_ent_reverse_at,
 	packed_reflog_exists,
 	packed_create_reflog,
 	packed_delete_reflog,
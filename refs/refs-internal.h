@@ -572,6 +572,21 @@ typedef int for_each_reflog_ent_reverse_fn(struct ref_store *ref_store,
 					   const char *refname,
 					   each_reflog_ent_fn fn,
 					   void *cb_data);
+
+/*
+ * Like for_each_reflog_ent_reverse_fn, but skip the newest entries
+ * that read_ref_at() would go past before reaching the one it is
+ * looking for, i.e. the first entry at or before "at_time", or the
+ * "cnt"-th one when "cnt" is not negative. The entry just newer than
+ * that one is still given to "fn". Store how many entries were
+ * skipped in "skipped" before calling "fn".
+ */
+typedef int for_each_reflog_ent_reverse_at_fn(struct ref_store *ref_store,
+					      const char *refname,
+					      timestamp_t at_time, int cnt,
+					      int *skipped,
+					      each_reflog_ent_fn fn,
+					      void *cb_data);
 typedef int reflog_exists_fn(struct ref_store *ref_store, const char *refname);
 typedef int create_reflog_fn(struct ref_store *ref_store, const char *refname,
 			     int force_create, struct strbuf *err);
@@ -649,6 +664,7 @@ struct ref_storage_be {
 	reflog_iterator_begin_fn *reflog_iterator_begin;
 	for_each_reflog_ent_fn *for_each_reflog_ent;
 	for_each_reflog_ent_reverse_fn *for_each_reflog_ent_reverse;
+	for_each_reflog_ent_reverse_at_fn *for_each_reflog_ent_reverse_at;
 	reflog_exists_fn *reflog_exists;
 	create_reflog_fn *create_reflog;
 	delete_reflog_fn *delete_reflog;
@@ -657,6 +673,7 @@ struct ref_storage_be {
 
 extern struct ref_storage_be refs_be_files;
 extern struct ref_storage_be refs_be_packed;
+extern struct ref_storage_be refs_be_reftable;
 
 /*
  * A representation of the reference store for the main repository or
@@ -0,0 +1,2058 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../lockfile.h"
+#include "../object.h"
+#include "../dir.h"
+#include "../chdir-notify.h"
+
+/*
+ * A reference store that keeps references and their reflogs in a
+ * stack of reftables (see Documentation/technical/reftable.txt).
+ *
+ * The refs of a repository live in $GIT_COMMON_DIR/reftable. Linked
+ * worktrees store their per-worktree refs (HEAD, refs/bisect/, ...) in
+ * a separate stack in $GIT_DIR/reftable. Pseudorefs like ORIG_HEAD or
+ * FETCH_HEAD are still stored as plain files in $GIT_DIR, as many
+ * parts of git read them directly.
+ */
+
+/*
+ * Flags that can be set in ref_update::flags, private to this
+ * backend. They are chosen not to clash with the public flags and
+ * match the ones used by the files backend.
+ */
+
+/* The reference is being deleted. */
+#define REF_DELETING (1 << 5)
+
+/* The reference has a new value that has to be written. */
+#define REF_NEEDS_COMMIT (1 << 6)
+
+/*
+ * Only the reflog of the reference is to be updated; the reference
+ * itself is changed by another update of the same transaction.
+ */
+#define REF_LOG_ONLY (1 << 7)
+
+/* The update was split off from an update of HEAD. */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+
+	struct reftable_stack *main_stack;
+	/* the per-worktree refs of a linked worktree, or NULL */
+	struct reftable_stack *worktree_stack;
+};
+
+static void reparent_stack(struct reftable_stack *st)
+{
+	chdir_notify_reparent("reftable-backend stack", &st->dir);
+	chdir_notify_reparent("reftable-backend stack list", &st->list_file);
+}
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	refs->gitdir = xstrdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	refs->main_stack = reftable_stack_new(sb.buf);
+	reparent_stack(refs->main_stack);
+	if (strcmp(refs->gitdir, refs->gitcommondir)) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", refs->gitdir);
+		refs->worktree_stack = reftable_stack_new(sb.buf);
+		reparent_stack(refs->worktree_stack);
+	}
+	strbuf_release(&sb);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's
+ * store_flags to ensure the ref_store has all required capabilities.
+ * "caller" is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+/* Return the stack that holds `refname`. */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname)
+{
+	if (refs->worktree_stack &&
+	    ref_type(refname) == REF_TYPE_PER_WORKTREE)
+		return refs->worktree_stack;
+	return refs->main_stack;
+}
+
+/*
+ * Return the stack that holds the HEAD referred to by a
+ * "main-worktree/HEAD" or "worktrees/<id>/HEAD" refname, and point
+ * `name` at "HEAD". The stack of another worktree is opened afresh and
+ * also stored in `other`, for the caller to free. For all other
+ * refnames, behave like stack_for().
+ */
+static struct reftable_stack *stack_for_head(struct reftable_ref_store *refs,
+					     const char *refname,
+					     const char **name,
+					     struct reftable_stack **other)
+{
+	struct strbuf sb = STRBUF_INIT;
+	const char *p, *slash;
+
+	*other = NULL;
+	*name = refname;
+	if (!strcmp(refname, "main-worktree/HEAD")) {
+		*name = "HEAD";
+		return refs->main_stack;
+	}
+	if (!skip_prefix(refname, "worktrees/", &p) ||
+	    !(slash = strchr(p, '/')) || strcmp(slash + 1, "HEAD"))
+		return stack_for(refs, refname);
+
+	strbuf_addf(&sb, "%s/worktrees/%.*s/reftable",
+		    refs->gitcommondir, (int)(slash - p), p);
+	*other = reftable_stack_new(sb.buf);
+	strbuf_release(&sb);
+	*name = "HEAD";
+	return *other;
+}
+
+/*
+ * Look up `refname` in `st`. Return 0 and fill in `ref` if it exists,
+ * 1 if it does not, or -1 on errors. The target of a symref is stored
+ * in `buf`; `ref->refname` is not set.
+ */
+static int stack_read_ref(struct reftable_stack *st, const char *refname,
+			  struct reftable_ref_record *ref, struct strbuf *buf)
+{
+	struct reftable_iter it;
+	int ret;
+
+	if (reftable_stack_reload(st))
+		return -1;
+
+	reftable_iter_seek(&it, st->tables, st->nr, REFTABLE_SECTION_REFS,
+			   refname, strlen(refname), 0);
+	ret = reftable_iter_next(&it);
+	if (!ret) {
+		if (strcmp(it.key.buf, refname))
+			ret = 1;
+		else if (reftable_iter_ref(&it, ref, buf))
+			ret = -1;
+		ref->refname = NULL;
+	}
+	reftable_iter_release(&it);
+	return ret;
+}
+
+/*
+ * Read a reference stored as a file, the way the files backend would.
+ */
+static int read_ref_file(const char *path, struct object_id *oid,
+			 struct strbuf *referent, unsigned int *type)
+{
+	struct strbuf sb = STRBUF_INIT;
+	const char *p;
+	int ret = 0;
+
+	if (strbuf_read_file(&sb, path, 0) < 0) {
+		int save_errno = errno;
+
+		strbuf_release(&sb);
+		errno = save_errno == EISDIR ? ENOENT : save_errno;
+		return -1;
+	}
+	strbuf_rtrim(&sb);
+
+	if (skip_prefix(sb.buf, "ref:", &p)) {
+		while (isspace(*p))
+			p++;
+		strbuf_reset(referent);
+		strbuf_addstr(referent, p);
+		*type |= REF_ISSYMREF;
+	} else if (parse_oid_hex(sb.buf, oid, &p) || (*p && !isspace(*p))) {
+		*type |= REF_ISBROKEN;
+		errno = EINVAL;
+		ret = -1;
+	}
+
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_stack *st, *other_stack = NULL;
+	struct reftable_ref_record ref;
+	struct strbuf sb = STRBUF_INIT;
+	const char *name, *slash;
+	int ret;
+
+	*type = 0;
+
+	switch (ref_type(refname)) {
+	case REF_TYPE_PSEUDOREF:
+		strbuf_addf(&sb, "%s/%s", refs->gitdir, refname);
+		ret = read_ref_file(sb.buf, oid, referent, type);
+		goto out;
+	case REF_TYPE_MAIN_PSEUDOREF:
+		if (!skip_prefix(refname, "main-worktree/", &name))
+			BUG("ref %s is not a main pseudoref", refname);
+		if (strcmp(name, "HEAD")) {
+			strbuf_addf(&sb, "%s/%s", refs->gitcommondir, name);
+			ret = read_ref_file(sb.buf, oid, referent, type);
+			goto out;
+		}
+		break;
+	case REF_TYPE_OTHER_PSEUDOREF:
+		if (!skip_prefix(refname, "worktrees/", &name) ||
+		    !(slash = strchr(name, '/')))
+			BUG("ref %s is not an other-worktree ref", refname);
+		if (strcmp(slash + 1, "HEAD")) {
+			strbuf_addf(&sb, "%s/worktrees/%s", refs->gitcommondir,
+				    name);
+			ret = read_ref_file(sb.buf, oid, referent, type);
+			goto out;
+		}
+		break;
+	default:
+		break;
+	}
+	st = stack_for_head(refs, refname, &name, &other_stack);
+
+	ret = stack_read_ref(st, name, &ref, &sb);
+	if (ret < 0) {
+		errno = EIO;
+	} else if (ret > 0) {
+		errno = ENOENT;
+		ret = -1;
+	} else if (ref.value_type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addstr(referent, ref.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &ref.value);
+	}
+
+out:
+	reftable_stack_free(other_stack);
+	strbuf_release(&sb);
+	return ret;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iter it;
+	char *prefix;
+	unsigned int flags;
+	/* 1: only per-worktree refs, -1: no per-worktree refs, 0: all */
+	int worktree_filter;
+
+	struct strbuf refname;
+	struct strbuf buf;
+	struct object_id oid;
+	unsigned int value_type;
+	struct object_id peeled;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ok;
+
+	while (!(ok = reftable_iter_next(&iter->it))) {
+		const char *refname = iter->it.key.buf;
+		struct reftable_ref_record ref;
+		int per_worktree, flags = 0;
+
+		if (!starts_with(refname, iter->prefix)) {
+			ok = 1;
+			break;
+		}
+		if (!starts_with(refname, "refs/"))
+			continue;
+
+		per_worktree = ref_type(refname) == REF_TYPE_PER_WORKTREE;
+		if ((iter->worktree_filter > 0 && !per_worktree) ||
+		    (iter->worktree_filter < 0 && per_worktree) ||
+		    (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		     !per_worktree))
+			continue;
+
+		if (reftable_iter_ref(&iter->it, &ref, &iter->buf)) {
+			ok = -1;
+			break;
+		}
+
+		strbuf_reset(&iter->refname);
+		strbuf_addstr(&iter->refname, refname);
+		iter->value_type = ref.value_type;
+		oidcpy(&iter->peeled, &ref.peeled);
+
+		if (ref.value_type == REFTABLE_REF_SYMREF) {
+			if (!refs_resolve_ref_unsafe(&iter->refs->base,
+						     iter->refname.buf,
+						     RESOLVE_REF_READING,
+						     &iter->oid, &flags)) {
+				oidclr(&iter->oid);
+				flags |= REF_ISBROKEN;
+			} else if (is_null_oid(&iter->oid)) {
+				flags |= REF_ISBROKEN;
+			}
+			flags |= REF_ISSYMREF;
+		} else {
+			oidcpy(&iter->oid, &ref.value);
+		}
+
+		if (check_refname_format(iter->refname.buf,
+					 REFNAME_ALLOW_ONELEVEL)) {
+			oidclr(&iter->oid);
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(iter->refname.buf, &iter->oid,
+					    flags))
+			continue;
+
+		iter->base.refname = iter->refname.buf;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ok < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	/*
+	 * Annotated tags are always written with their peeled value, so
+	 * anything else cannot be peeled.
+	 */
+	if (iter->value_type != REFTABLE_REF_VAL2)
+		return -1;
+	oidcpy(peeled, &iter->peeled);
+	return 0;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iter_release(&iter->it);
+	strbuf_release(&iter->refname);
+	strbuf_release(&iter->buf);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(
+		struct reftable_ref_store *refs, struct reftable_stack *st,
+		const char *prefix, unsigned int flags, int worktree_filter)
+{
+	struct reftable_ref_iterator *iter;
+	struct ref_iterator *ref_iterator;
+
+	if (reftable_stack_reload(st))
+		return empty_ref_iterator_begin();
+
+	iter = xcalloc(1, sizeof(*iter));
+	ref_iterator = &iter->base;
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->prefix = xstrdup(prefix);
+	iter->flags = flags;
+	iter->worktree_filter = worktree_filter;
+	strbuf_init(&iter->refname, 0);
+	strbuf_init(&iter->buf, 0);
+	reftable_iter_seek(&iter->it, st->tables, st->nr, REFTABLE_SECTION_REFS,
+			   prefix, strlen(prefix), 0);
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct ref_iterator *main_iter, *worktree_iter;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+
+	refs = reftable_downcast(ref_store, required_flags,
+				 "ref_iterator_begin");
+	if (!prefix)
+		prefix = "";
+
+	if (!refs->worktree_stack)
+		return stack_ref_iterator_begin(refs, refs->main_stack,
+						prefix, flags, 0);
+
+	/*
+	 * The main stack also holds the per-worktree refs of the main
+	 * worktree, which must not show up in a linked worktree.
+	 */
+	main_iter = stack_ref_iterator_begin(refs, refs->main_stack,
+					     prefix, flags, -1);
+	worktree_iter = stack_ref_iterator_begin(refs, refs->worktree_stack,
+						 prefix, flags, 1);
+	return overlay_ref_iterator_begin(worktree_iter, main_iter);
+}
+
+/*
+ * The live log records of one reference, newest first. Their strings
+ * are owned by the array.
+ */
+struct log_records {
+	struct reftable_log_record *log;
+	size_t nr, alloc;
+};
+
+static void copy_log_record(struct reftable_log_record *dst,
+			    const struct reftable_log_record *src)
+{
+	*dst = *src;
+	dst->refname = xstrdup(src->refname);
+	dst->ident = xstrdup_or_null(src->ident);
+	dst->message = xstrdup_or_null(src->message);
+}
+
+static void free_log_record(struct reftable_log_record *log)
+{
+	free((char *)log->refname);
+	free((char *)log->ident);
+	free((char *)log->message);
+}
+
+static void log_records_release(struct log_records *logs)
+{
+	size_t i;
+
+	for (i = 0; i < logs->nr; i++)
+		free_log_record(&logs->log[i]);
+	FREE_AND_NULL(logs->log);
+	logs->nr = logs->alloc = 0;
+}
+
+static int read_logs(struct reftable_stack *st, const char *refname,
+		     struct log_records *logs)
+{
+	struct reftable_iter it;
+	struct strbuf key = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	if (reftable_stack_reload(st))
+		return -1;
+
+	reftable_log_key(&key, refname, UINT64_MAX);
+	reftable_iter_seek(&it, st->tables, st->nr, REFTABLE_SECTION_LOGS,
+			   key.buf, key.len, 0);
+	while (!(ret = reftable_iter_next(&it))) {
+		struct reftable_log_record log;
+
+		if (strcmp(it.key.buf, refname))
+			break;
+		if (reftable_iter_log(&it, &log, &buf)) {
+			ret = -1;
+			break;
+		}
+		ALLOC_GROW(logs->log, logs->nr + 1, logs->alloc);
+		copy_log_record(&logs->log[logs->nr++], &log);
+	}
+
+	reftable_iter_release(&it);
+	strbuf_release(&key);
+	strbuf_release(&buf);
+	return ret < 0 ? -1 : 0;
+}
+
+static int log_exists(struct reftable_stack *st, const char *refname)
+{
+	struct reftable_iter it;
+	struct strbuf key = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_reload(st))
+		return 0;
+
+	reftable_log_key(&key, refname, UINT64_MAX);
+	reftable_iter_seek(&it, st->tables, st->nr, REFTABLE_SECTION_LOGS,
+			   key.buf, key.len, 0);
+	if (!reftable_iter_next(&it) && !strcmp(it.key.buf, refname))
+		ret = 1;
+	reftable_iter_release(&it);
+	strbuf_release(&key);
+	return ret;
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iter it;
+	struct strbuf refname;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	int ok;
+
+	while (!(ok = reftable_iter_next(&iter->it))) {
+		const char *refname = iter->it.key.buf;
+		int flags;
+
+		/* we only want each reference once */
+		if (!strcmp(refname, iter->refname.buf))
+			continue;
+		strbuf_reset(&iter->refname);
+		strbuf_addstr(&iter->refname, refname);
+
+		if (refs_read_ref_full(&iter->refs->base, iter->refname.buf,
+				       0, &iter->oid, &flags)) {
+			error("bad ref for %s", iter->refname.buf);
+			continue;
+		}
+
+		iter->base.refname = iter->refname.buf;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ok < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	reftable_iter_release(&iter->it);
+	strbuf_release(&iter->refname);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static struct ref_iterator *stack_reflog_iterator_begin(
+		struct reftable_ref_store *refs, struct reftable_stack *st)
+{
+	struct reftable_reflog_iterator *iter;
+	struct ref_iterator *ref_iterator;
+
+	if (reftable_stack_reload(st))
+		return empty_ref_iterator_begin();
+
+	iter = xcalloc(1, sizeof(*iter));
+	ref_iterator = &iter->base;
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable, 1);
+	iter->refs = refs;
+	strbuf_init(&iter->refname, 0);
+	reftable_iter_seek(&iter->it, st->tables, st->nr, REFTABLE_SECTION_LOGS,
+			   "", 0, 0);
+	return ref_iterator;
+}
+
+static enum iterator_selection reflog_iterator_select(
+	struct ref_iterator *iter_worktree,
+	struct ref_iterator *iter_common,
+	void *cb_data)
+{
+	if (iter_worktree) {
+		return ITER_SELECT_0;
+	} else if (iter_common) {
+		if (ref_type(iter_common->refname) == REF_TYPE_NORMAL)
+			return ITER_SELECT_1;
+
+		/*
+		 * The main stack may contain the main worktree's
+		 * per-worktree refs, which should be ignored.
+		 */
+		return ITER_SKIP_1;
+	} else
+		return ITER_DONE;
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+
+	if (!refs->worktree_stack)
+		return stack_reflog_iterator_begin(refs, refs->main_stack);
+
+	return merge_ref_iterator_begin(
+			0,
+			stack_reflog_iterator_begin(refs, refs->worktree_stack),
+			stack_reflog_iterator_begin(refs, refs->main_stack),
+			reflog_iterator_select, refs);
+}
+
+static int show_log_record(const struct reftable_log_record *log,
+			   each_reflog_ent_fn fn, void *cb_data,
+			   struct strbuf *msg)
+{
+	strbuf_reset(msg);
+	strbuf_addstr(msg, log->message);
+	strbuf_addch(msg, '\n');
+	return fn((struct object_id *)&log->old_oid,
+		  (struct object_id *)&log->new_oid,
+		  log->ident, log->time, log->tz, msg->buf, cb_data);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+	struct reftable_stack *st, *other_stack;
+	struct log_records logs = { NULL };
+	struct strbuf msg = STRBUF_INIT;
+	const char *name;
+	size_t i;
+	int ret = 0;
+
+	st = stack_for_head(refs, refname, &name, &other_stack);
+	if (read_logs(st, name, &logs))
+		ret = -1;
+	for (i = 0; !ret && i < logs.nr; i++)
+		if (logs.log[i].value_type == REFTABLE_LOG_UPDATE)
+			ret = show_log_record(&logs.log[i], fn, cb_data, &msg);
+
+	log_records_release(&logs);
+	strbuf_release(&msg);
+	reftable_stack_free(other_stack);
+	return ret;
+}
+
+/*
+ * The log records of a ref are all read in memory anyway, so there is
+ * nothing to gain from seeking among them.
+ */
+static int reftable_for_each_reflog_ent_reverse_at(struct ref_store *ref_store,
+						   const char *refname,
+						   timestamp_t at_time, int cnt,
+						   int *skipped,
+						   each_reflog_ent_fn fn,
+						   void *cb_data)
+{
+	*skipped = 0;
+	return reftable_for_each_reflog_ent_reverse(ref_store, refname,
+						    fn, cb_data);
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct reftable_stack *st, *other_stack;
+	struct log_records logs = { NULL };
+	struct strbuf msg = STRBUF_INIT;
+	const char *name;
+	size_t i;
+	int ret = 0;
+
+	st = stack_for_head(refs, refname, &name, &other_stack);
+	if (read_logs(st, name, &logs))
+		ret = -1;
+	for (i = logs.nr; !ret && i-- > 0; )
+		if (logs.log[i].value_type == REFTABLE_LOG_UPDATE)
+			ret = show_log_record(&logs.log[i], fn, cb_data, &msg);
+
+	log_records_release(&logs);
+	strbuf_release(&msg);
+	reftable_stack_free(other_stack);
+	return ret;
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *st, *other_stack;
+	const char *name;
+	int ret;
+
+	st = stack_for_head(refs, refname, &name, &other_stack);
+	ret = log_exists(st, name);
+	reftable_stack_free(other_stack);
+	return ret;
+}
+
+/*
+ * The records to be written to one stack as a single new table, and
+ * the lock on the stack that is held in the meantime.
+ */
+struct stack_write {
+	struct reftable_stack *stack;
+	struct lock_file lock;
+	uint64_t update_index;
+
+	struct reftable_ref_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record *logs;
+	size_t logs_nr, logs_alloc;
+};
+
+static int stack_write_lock(struct stack_write *w, struct reftable_stack *st,
+			    struct strbuf *err)
+{
+	memset(w, 0, sizeof(*w));
+	if (reftable_stack_lock(st, &w->lock, err))
+		return -1;
+	w->stack = st;
+	w->update_index = reftable_stack_next_update_index(st);
+	return 0;
+}
+
+static struct reftable_ref_record *stack_write_add_ref(struct stack_write *w,
+							const char *refname,
+							unsigned int value_type)
+{
+	struct reftable_ref_record *ref;
+
+	ALLOC_GROW(w->refs, w->refs_nr + 1, w->refs_alloc);
+	ref = &w->refs[w->refs_nr++];
+	memset(ref, 0, sizeof(*ref));
+	ref->refname = xstrdup(refname);
+	ref->update_index = w->update_index;
+	ref->value_type = value_type;
+	return ref;
+}
+
+/* Record `oid` as the value of `ref`, along with its peeled value. */
+static void set_ref_value(struct reftable_ref_record *ref,
+			  const struct object_id *oid)
+{
+	oidcpy(&ref->value, oid);
+	if (peel_object(oid, &ref->peeled) == PEEL_PEELED)
+		ref->value_type = REFTABLE_REF_VAL2;
+	else
+		ref->value_type = REFTABLE_REF_VAL1;
+}
+
+static struct reftable_log_record *stack_write_add_log(struct stack_write *w,
+							const char *refname,
+							uint64_t update_index,
+							unsigned int value_type)
+{
+	struct reftable_log_record *log;
+
+	ALLOC_GROW(w->logs, w->logs_nr + 1, w->logs_alloc);
+	log = &w->logs[w->logs_nr++];
+	memset(log, 0, sizeof(*log));
+	log->refname = xstrdup(refname);
+	log->update_index = update_index;
+	log->value_type = value_type;
+	return log;
+}
+
+/* Add a log entry for an update of `refname` by the current user. */
+static void stack_write_add_log_entry(struct stack_write *w,
+				      const char *refname,
+				      const struct object_id *old_oid,
+				      const struct object_id *new_oid,
+				      const char *msg)
+{
+	struct reftable_log_record *log =
+		stack_write_add_log(w, refname, w->update_index,
+				    REFTABLE_LOG_UPDATE);
+	const char *info = git_committer_info(0);
+	const char *email_end = strrchr(info, '>');
+	struct strbuf sb = STRBUF_INIT;
+	char *p;
+
+	if (!email_end)
+		BUG("committer ident '%s' has no email", info);
+
+	oidcpy(&log->old_oid, old_oid ? old_oid : &null_oid);
+	oidcpy(&log->new_oid, new_oid ? new_oid : &null_oid);
+	log->ident = xmemdupz(info, email_end + 1 - info);
+	log->time = parse_timestamp(email_end + 2, &p, 10);
+	log->tz = strtol(p, NULL, 10);
+
+	if (msg && *msg)
+		copy_reflog_msg(&sb, msg);
+	log->message = xstrdup(sb.len ? sb.buf + 1 : "");
+	strbuf_release(&sb);
+}
+
+/* Add deletion records for all live log records of a reference. */
+static int stack_write_delete_logs(struct stack_write *w, const char *refname)
+{
+	struct log_records logs = { NULL };
+	size_t i;
+
+	if (read_logs(w->stack, refname, &logs))
+		return -1;
+	for (i = 0; i < logs.nr; i++)
+		stack_write_add_log(w, refname, logs.log[i].update_index,
+				    REFTABLE_LOG_DELETION);
+	log_records_release(&logs);
+	return 0;
+}
+
+static int ref_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_ref_record *a = va, *b = vb;
+
+	return strcmp(a->refname, b->refname);
+}
+
+/*
+ * Order log records the way they are stored. If a record replaces a
+ * deletion record of the same entry (for example when renaming a ref
+ * over a deleted one), the replacement sorts first.
+ */
+static int log_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a = va, *b = vb;
+	int cmp = strcmp(a->refname, b->refname);
+
+	if (cmp)
+		return cmp;
+	if (a->update_index != b->update_index)
+		return a->update_index > b->update_index ? -1 : 1;
+	return (a->value_type == REFTABLE_LOG_DELETION) -
+	       (b->value_type == REFTABLE_LOG_DELETION);
+}
+
+static void stack_write_release(struct stack_write *w)
+{
+	size_t i;
+
+	if (w->stack)
+		rollback_lock_file(&w->lock);
+	w->stack = NULL;
+
+	for (i = 0; i < w->refs_nr; i++) {
+		free((char *)w->refs[i].refname);
+		free((char *)w->refs[i].target);
+	}
+	FREE_AND_NULL(w->refs);
+	w->refs_nr = w->refs_alloc = 0;
+
+	for (i = 0; i < w->logs_nr; i++)
+		free_log_record(&w->logs[i]);
+	FREE_AND_NULL(w->logs);
+	w->logs_nr = w->logs_alloc = 0;
+}
+
+/*
+ * Write the collected records as a new table on top of the stack and
+ * release the lock. If there is nothing to write, just release the
+ * lock.
+ */
+static int stack_write_commit(struct stack_write *w, struct strbuf *err)
+{
+	struct reftable_writer writer;
+	struct strbuf table = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	if (!w->stack)
+		return 0;
+
+	QSORT(w->refs, w->refs_nr, ref_record_cmp);
+	QSORT(w->logs, w->logs_nr, log_record_cmp);
+
+	reftable_writer_init(&writer, &w->stack->opts,
+			     w->update_index, w->update_index);
+	for (i = 0; i < w->refs_nr; i++)
+		reftable_writer_add_ref(&writer, &w->refs[i]);
+	for (i = 0; i < w->logs_nr; i++) {
+		if (i && !strcmp(w->logs[i].refname, w->logs[i - 1].refname) &&
+		    w->logs[i].update_index == w->logs[i - 1].update_index)
+			continue;
+		reftable_writer_add_log(&writer, &w->logs[i]);
+	}
+
+	if (reftable_writer_finish(&writer, &table))
+		rollback_lock_file(&w->lock);
+	else
+		ret = reftable_stack_add(w->stack, &w->lock, &table, err);
+	w->stack = NULL;
+
+	reftable_writer_release(&writer);
+	strbuf_release(&table);
+	return ret;
+}
+
+/*
+ * Return true if an update of `refname` should be logged, following
+ * the same rules as the files backend.
+ */
+static int should_write_log(struct reftable_stack *st, const char *refname,
+			    unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return (flags & REF_FORCE_CREATE_REFLOG) ||
+		should_autocreate_reflog(refname) ||
+		log_exists(st, refname);
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct stack_write w;
+
+	if (!force_create && !should_autocreate_reflog(refname))
+		return 0;
+
+	if (stack_write_lock(&w, stack_for(refs, refname), err))
+		return -1;
+	if (!log_exists(w.stack, refname))
+		/* an empty reflog is marked by an entry that is never shown */
+		stack_write_add_log(&w, refname, 0, REFTABLE_LOG_EXISTS);
+	if (stack_write_commit(&w, err)) {
+		stack_write_release(&w);
+		return -1;
+	}
+	stack_write_release(&w);
+	return 0;
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct strbuf err = STRBUF_INIT;
+	struct stack_write w;
+	int ret = 0;
+
+	if (stack_write_lock(&w, stack_for(refs, refname), &err))
+		ret = error("%s", err.buf);
+	else if (stack_write_delete_logs(&w, refname))
+		ret = -1;
+	else if (stack_write_commit(&w, &err))
+		ret = error(_("unable to delete reflog '%s': %s"),
+			    refname, err.buf);
+
+	stack_write_release(&w);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct strbuf err = STRBUF_INIT;
+	struct strbuf msg = STRBUF_INIT;
+	struct log_records logs = { NULL };
+	struct object_id last_kept_oid;
+	struct reftable_ref_record ref;
+	struct stack_write w;
+	size_t i;
+	int kept = 0, ret = 0;
+
+	/*
+	 * Hold the lock on the stack throughout, so that nobody can
+	 * update the reflog (or the reference) in the meantime.
+	 */
+	if (stack_write_lock(&w, stack_for(refs, refname), &err)) {
+		ret = error("cannot lock ref '%s': %s", refname, err.buf);
+		goto out;
+	}
+	if (read_logs(w.stack, refname, &logs)) {
+		ret = -1;
+		goto out;
+	}
+	if (!logs.nr)
+		goto out;
+
+	oidclr(&last_kept_oid);
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	for (i = logs.nr; i-- > 0; ) {
+		struct reftable_log_record *log = &logs.log[i];
+		struct object_id *ooid = &log->old_oid;
+
+		if (log->value_type != REFTABLE_LOG_UPDATE) {
+			kept = 1;
+			continue;
+		}
+
+		strbuf_reset(&msg);
+		strbuf_addf(&msg, "%s\n", log->message);
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			ooid = &last_kept_oid;
+
+		if ((*should_prune_fn)(ooid, &log->new_oid, log->ident,
+				       log->time, log->tz, msg.buf,
+				       policy_cb_data)) {
+			if (flags & EXPIRE_REFLOGS_DRY_RUN)
+				printf("would prune %s", msg.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", msg.buf);
+			stack_write_add_log(&w, refname, log->update_index,
+					    REFTABLE_LOG_DELETION);
+		} else {
+			if (!oideq(ooid, &log->old_oid)) {
+				struct reftable_log_record *rewritten =
+					stack_write_add_log(&w, refname,
+							    log->update_index,
+							    REFTABLE_LOG_UPDATE);
+
+				free((char *)rewritten->refname);
+				copy_log_record(rewritten, log);
+				oidcpy(&rewritten->old_oid, ooid);
+			}
+			oidcpy(&last_kept_oid, &log->new_oid);
+			kept = 1;
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", msg.buf);
+		}
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (flags & EXPIRE_REFLOGS_DRY_RUN)
+		goto out;
+
+	/* like an emptied reflog file, the reflog keeps existing */
+	if (!kept)
+		stack_write_add_log(&w, refname, 0, REFTABLE_LOG_EXISTS);
+
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic
+	 * reference's reflog. Nor can we update a reference if there
+	 * are no remaining reflog entries.
+	 */
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !is_null_oid(&last_kept_oid) &&
+	    !stack_read_ref(w.stack, refname, &ref, &msg) &&
+	    ref.value_type != REFTABLE_REF_SYMREF &&
+	    !oideq(&ref.value, &last_kept_oid))
+		set_ref_value(stack_write_add_ref(&w, refname,
+						  REFTABLE_REF_VAL1),
+			      &last_kept_oid);
+
+	if (stack_write_commit(&w, &err))
+		ret = error(_("unable to write reflog '%s': %s"),
+			    refname, err.buf);
+
+out:
+	stack_write_release(&w);
+	log_records_release(&logs);
+	strbuf_release(&err);
+	strbuf_release(&msg);
+	return ret;
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	safe_create_dir(refs->main_stack->dir, 1);
+	if (!file_exists(refs->main_stack->list_file)) {
+		write_file_buf(refs->main_stack->list_file, "", 0);
+		adjust_shared_perm(refs->main_stack->list_file);
+	}
+
+	/*
+	 * Git versions that do not know about reftables only recognize
+	 * a repository if it has a valid HEAD file and a "refs/"
+	 * directory. Provide both, but make "refs/heads" a file so
+	 * that they cannot write loose refs behind our back.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->gitdir);
+	if (!file_exists(sb.buf))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/refs/heads", refs->gitdir);
+	if (!file_exists(sb.buf))
+		write_file(sb.buf, "this repository uses the reftable format");
+
+	strbuf_release(&sb);
+	return 0;
+}
+
+/* Per-update data of a reftable transaction. */
+struct reftable_update_data {
+	/* the value of the reference before the transaction */
+	struct object_id old_oid;
+	/* the lock on a pseudoref, which is stored as a file */
+	struct lock_file lock;
+};
+
+struct reftable_transaction_data {
+	/* the main stack and the worktree stack */
+	struct stack_write stacks[2];
+};
+
+static struct stack_write *transaction_stack(struct reftable_ref_store *refs,
+					     struct reftable_transaction_data *data,
+					     struct reftable_stack *st,
+					     struct strbuf *err)
+{
+	struct stack_write *w = &data->stacks[st == refs->main_stack ? 0 : 1];
+
+	if (!w->stack && stack_write_lock(w, st, err))
+		return NULL;
+	return w;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * If update is for the reference HEAD points to, add a REF_LOG_ONLY
+ * update of HEAD to the transaction, so that its reflog records the
+ * change, too.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Turn it into a REF_LOG_ONLY update and add a
+ * separate update for the referent, which will itself be subject to
+ * splitting when we get to it.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+static int prepare_pseudoref_update(struct reftable_ref_store *refs,
+				    struct ref_update *update,
+				    struct strbuf *err)
+{
+	struct reftable_update_data *data = xcalloc(1, sizeof(*data));
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf referent = STRBUF_INIT;
+	unsigned int type = 0;
+	int fd, ret = 0;
+
+	update->backend_data = data;
+	strbuf_addf(&path, "%s/%s", refs->gitdir, update->refname);
+
+	fd = hold_lock_file_for_update_timeout(&data->lock, path.buf, 0,
+					       get_files_ref_lock_timeout_ms());
+	if (fd < 0) {
+		unable_to_lock_message(path.buf, errno, err);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+
+	if (read_ref_file(path.buf, &data->old_oid, &referent, &type) ||
+	    (type & REF_ISSYMREF))
+		oidclr(&data->old_oid);
+	if (check_old_oid(update, &data->old_oid, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+
+	if ((update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & REF_DELETING) &&
+	    (write_in_full(fd, oid_to_hex(&update->new_oid),
+			   the_hash_algo->hexsz) < 0 ||
+	     write_str_in_full(fd, "\n") < 0 ||
+	     close_lock_file_gently(&data->lock) < 0)) {
+		strbuf_addf(err, "couldn't write '%s'",
+			    get_lock_file_path(&data->lock));
+		ret = TRANSACTION_GENERIC_ERROR;
+	}
+
+out:
+	strbuf_release(&path);
+	strbuf_release(&referent);
+	return ret;
+}
+
+/*
+ * Prepare for carrying out update: read the reference's current value
+ * under the lock of its stack, check its old value, and add the
+ * records that implement the update to the table that will be written
+ * to the stack. The update may be split up, like in the files backend.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct reftable_transaction_data *tr_data,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  int initial, struct strbuf *err)
+{
+	struct reftable_update_data *data;
+	struct reftable_ref_record ref;
+	struct stack_write *w;
+	struct strbuf referent = STRBUF_INIT;
+	int exists, ret = 0;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			goto out;
+	}
+
+	switch (ref_type(update->refname)) {
+	case REF_TYPE_PSEUDOREF:
+		ret = prepare_pseudoref_update(refs, update, err);
+		goto out;
+	case REF_TYPE_MAIN_PSEUDOREF:
+	case REF_TYPE_OTHER_PSEUDOREF:
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "refs of other worktrees cannot be updated",
+			    update->refname);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	default:
+		break;
+	}
+
+	w = transaction_stack(refs, tr_data,
+			      stack_for(refs, update->refname), err);
+	if (!w) {
+		char *reason = strbuf_detach(err, NULL);
+
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update), reason);
+		free(reason);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+
+	data = xcalloc(1, sizeof(*data));
+	update->backend_data = data;
+
+	exists = stack_read_ref(w->stack, update->refname, &ref, &referent);
+	if (exists < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': unable to read reftables",
+			    original_update_refname(update));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	exists = !exists;
+
+	if (exists && ref.value_type == REFTABLE_REF_SYMREF) {
+		update->type |= REF_ISSYMREF;
+		if (update->flags & REF_NO_DEREF) {
+			/*
+			 * We won't be reading the referent as part of
+			 * the transaction, so we have to read it here
+			 * to record and possibly check old_oid:
+			 */
+			if (refs_read_ref_full(&refs->base, referent.buf, 0,
+					       &data->old_oid, NULL)) {
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			} else if (check_old_oid(update, &data->old_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else {
+			ret = split_symref_update(update, referent.buf,
+						  transaction,
+						  affected_refnames, err);
+			if (ret)
+				goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (exists)
+			oidcpy(&data->old_oid, &ref.value);
+		if (check_old_oid(update, &data->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_update_data *parent_data =
+				parent_update->backend_data;
+			oidcpy(&parent_data->old_oid, &data->old_oid);
+		}
+	}
+
+	if ((update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & REF_LOG_ONLY)) {
+		if (update->flags & REF_DELETING) {
+			if (exists)
+				stack_write_add_ref(w, update->refname,
+						    REFTABLE_REF_DELETION);
+			if (stack_write_delete_logs(w, update->refname)) {
+				strbuf_addf(err, "cannot delete the reflog of '%s'",
+					    update->refname);
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else if (!(update->type & REF_ISSYMREF) &&
+			   oideq(&data->old_oid, &update->new_oid)) {
+			/*
+			 * The reference already has the desired
+			 * value, so we don't need to write it.
+			 */
+		} else {
+			struct object *o = NULL;
+
+			if (!initial) {
+				o = parse_object(the_repository,
+						 &update->new_oid);
+				if (!o) {
+					strbuf_addf(err,
+						    "cannot update ref '%s': "
+						    "trying to write ref '%s' with nonexistent object %s",
+						    update->refname, update->refname,
+						    oid_to_hex(&update->new_oid));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+				if (o->type != OBJ_COMMIT &&
+				    is_branch(update->refname)) {
+					strbuf_addf(err,
+						    "cannot update ref '%s': "
+						    "trying to write non-commit object %s to branch '%s'",
+						    update->refname,
+						    oid_to_hex(&update->new_oid),
+						    update->refname);
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			}
+			if (!exists &&
+			    refs_verify_refname_available(&refs->base,
+							  update->refname,
+							  affected_refnames,
+							  NULL, err)) {
+				char *reason = strbuf_detach(err, NULL);
+
+				strbuf_addf(err, "cannot lock ref '%s': %s",
+					    original_update_refname(update),
+					    reason);
+				free(reason);
+				ret = TRANSACTION_NAME_CONFLICT;
+				goto out;
+			}
+			set_ref_value(stack_write_add_ref(w, update->refname,
+							  REFTABLE_REF_VAL1),
+				      &update->new_oid);
+			update->flags |= REF_NEEDS_COMMIT;
+		}
+	}
+
+out:
+	strbuf_release(&referent);
+	return ret;
+}
+
+/*
+ * Release the locks held by `transaction`, and mark it closed.
+ */
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *update_data = update->backend_data;
+
+		if (update_data) {
+			rollback_lock_file(&update_data->lock);
+			FREE_AND_NULL(update->backend_data);
+		}
+	}
+
+	if (data) {
+		for (i = 0; i < ARRAY_SIZE(data->stacks); i++)
+			stack_write_release(&data->stacks[i]);
+		FREE_AND_NULL(transaction->backend_data);
+	}
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+static int transaction_prepare(struct reftable_ref_store *refs,
+			       struct ref_transaction *transaction,
+			       int initial, struct strbuf *err)
+{
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	transaction->backend_data = xcalloc(1, sizeof(struct reftable_transaction_data));
+	if (!transaction->nr)
+		goto cleanup;
+
+	/*
+	 * Fail if a refname appears more than once in the
+	 * transaction. (If we end up splitting up any updates using
+	 * split_symref_update() or split_head_update(), those
+	 * functions will check that the new updates don't have the
+	 * same refname as any existing ones.)
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * As in the files backend, record the referent of HEAD, so
+	 * that updating it directly updates the reflog of HEAD, too.
+	 */
+	if (!initial) {
+		head_ref = refs_resolve_refdup(&refs->base, "HEAD",
+					       RESOLVE_REF_NO_RECURSE,
+					       NULL, &head_type);
+		if (head_ref && !(head_type & REF_ISSYMREF))
+			FREE_AND_NULL(head_ref);
+	}
+
+	/* Note that prepare_update() might append more updates. */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, transaction->backend_data,
+				     transaction->updates[i], transaction,
+				     head_ref, &affected_refnames, initial,
+				     err);
+		if (ret)
+			goto cleanup;
+	}
+
+	/*
+	 * Only now that split-off updates have recorded the old values
+	 * of their parents do we know what to write to the reflogs.
+	 */
+	for (i = 0; !initial && i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *data = update->backend_data;
+		struct stack_write *w;
+
+		if (!(update->flags & REF_HAVE_NEW) ||
+		    !(update->flags & (REF_NEEDS_COMMIT | REF_LOG_ONLY)) ||
+		    ref_type(update->refname) == REF_TYPE_PSEUDOREF)
+			continue;
+
+		w = transaction_stack(refs, transaction->backend_data,
+				      stack_for(refs, update->refname), err);
+		if (should_write_log(w->stack, update->refname, update->flags))
+			stack_write_add_log_entry(w, update->refname,
+						  &data->old_oid,
+						  &update->new_oid,
+						  update->msg);
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+
+	return transaction_prepare(refs, transaction, 0, err);
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	reftable_downcast(ref_store, 0, "ref_transaction_finish");
+	assert(err);
+
+	/* Each stack gets a single new table, written atomically. */
+	for (i = 0; i < ARRAY_SIZE(data->stacks); i++) {
+		if (stack_write_commit(&data->stacks[i], err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *update_data = update->backend_data;
+
+		if (!update_data || !is_lock_file_locked(&update_data->lock))
+			continue;
+
+		if (update->flags & REF_DELETING) {
+			struct strbuf path = STRBUF_INIT;
+
+			strbuf_addstr(&path, get_lock_file_path(&update_data->lock));
+			strbuf_strip_suffix(&path, LOCK_SUFFIX);
+			unlink_or_warn(path.buf);
+			rollback_lock_file(&update_data->lock);
+			strbuf_release(&path);
+		} else if ((update->flags & REF_HAVE_NEW) &&
+			   commit_lock_file(&update_data->lock)) {
+			strbuf_addf(err, "couldn't set '%s'", update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "initial_ref_transaction_commit");
+
+	if (transaction->state != REF_TRANSACTION_OPEN)
+		BUG("commit called for transaction that is not open");
+
+	if (transaction_prepare(refs, transaction, 1, err))
+		return TRANSACTION_GENERIC_ERROR;
+	return reftable_transaction_finish(ref_store, transaction, err);
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_compact_all(refs->main_stack, &err) ||
+	    (refs->worktree_stack &&
+	     reftable_stack_compact_all(refs->worktree_stack, &err)))
+		ret = error("%s", err.buf);
+
+	strbuf_release(&err);
+	return ret;
+}
+
+/* Pseudorefs are files, so symbolic pseudorefs are, too. */
+static int create_pseudoref_symref(struct reftable_ref_store *refs,
+				   const char *refname, const char *target)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf err = STRBUF_INIT;
+	int fd, ret = 0;
+
+	strbuf_addf(&path, "%s/%s", refs->gitdir, refname);
+	fd = hold_lock_file_for_update_timeout(&lock, path.buf, 0,
+					       get_files_ref_lock_timeout_ms());
+	if (fd < 0) {
+		unable_to_lock_message(path.buf, errno, &err);
+		ret = error("%s", err.buf);
+	} else if (write_str_in_full(fd, "ref: ") < 0 ||
+		   write_str_in_full(fd, target) < 0 ||
+		   write_str_in_full(fd, "\n") < 0 ||
+		   commit_lock_file(&lock) < 0) {
+		ret = error("unable to write symref for %s: %s", refname,
+			    strerror(errno));
+		rollback_lock_file(&lock);
+	}
+
+	strbuf_release(&path);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct strbuf err = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id old_oid, new_oid;
+	struct reftable_ref_record *ref;
+	struct stack_write w;
+	unsigned int type;
+	int ret = 0;
+
+	if (ref_type(refname) == REF_TYPE_PSEUDOREF)
+		return create_pseudoref_symref(refs, refname, target);
+
+	if (stack_write_lock(&w, st, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (refs_read_raw_ref(&refs->base, refname, &old_oid, &buf, &type) &&
+	    refs_verify_refname_available(&refs->base, refname, NULL, NULL,
+					  &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	ref = stack_write_add_ref(&w, refname, REFTABLE_REF_SYMREF);
+	ref->target = xstrdup(target);
+
+	if (logmsg &&
+	    !refs_read_ref_full(&refs->base, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_write_log(st, refname, 0)) {
+		if (refs_read_ref_full(&refs->base, refname, 0, &old_oid, NULL))
+			oidclr(&old_oid);
+		stack_write_add_log_entry(&w, refname, &old_oid, &new_oid,
+					  logmsg);
+	}
+
+	if (stack_write_commit(&w, &err))
+		ret = error("unable to write symref for %s: %s",
+			    refname, err.buf);
+
+out:
+	stack_write_release(&w);
+	strbuf_release(&err);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct strbuf err = STRBUF_INIT;
+	struct ref_transaction *transaction;
+	struct string_list_item *item;
+	int ret;
+
+	reftable_downcast(ref_store, REF_STORE_WRITE, "delete_refs");
+
+	if (!refnames->nr)
+		return 0;
+
+	/*
+	 * Since we don't check the references' old_oids, the
+	 * individual updates can't fail, so we can pack all of the
+	 * updates into a single transaction.
+	 */
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		return -1;
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err)) {
+			warning(_("could not delete reference %s: %s"),
+				item->string, err.buf);
+			strbuf_reset(&err);
+		}
+	}
+
+	ret = ref_transaction_commit(transaction, &err);
+
+	if (ret) {
+		if (refnames->nr == 1)
+			error(_("could not delete reference %s: %s"),
+			      refnames->items[0].string, err.buf);
+		else
+			error(_("could not delete references: %s"), err.buf);
+	}
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct reftable_stack *st = stack_for(refs, oldrefname);
+	struct strbuf err = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct log_records logs = { NULL };
+	struct reftable_ref_record ref, *new_ref;
+	struct stack_write w;
+	size_t i;
+	int ret = 0;
+
+	if (st != stack_for(refs, newrefname)) {
+		if (copy)
+			return error("cannot copy '%s' to '%s': "
+				     "they are stored in different worktrees",
+				     oldrefname, newrefname);
+		return error("cannot rename '%s' to '%s': "
+			     "they are stored in different worktrees",
+			     oldrefname, newrefname);
+	}
+
+	if (stack_write_lock(&w, st, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (stack_read_ref(st, oldrefname, &ref, &buf)) {
+		ret = error("refname %s not found", oldrefname);
+		goto out;
+	}
+	if (ref.value_type == REFTABLE_REF_SYMREF) {
+		if (copy)
+			ret = error("refname %s is a symbolic ref, copying it is not supported",
+				    oldrefname);
+		else
+			ret = error("refname %s is a symbolic ref, renaming it is not supported",
+				    oldrefname);
+		goto out;
+	}
+	if (!refs_rename_ref_available(&refs->base, oldrefname, newrefname)) {
+		ret = 1;
+		goto out;
+	}
+
+	/* the new reference takes over any existing one, and its reflog */
+	new_ref = stack_write_add_ref(&w, newrefname, ref.value_type);
+	oidcpy(&new_ref->value, &ref.value);
+	oidcpy(&new_ref->peeled, &ref.peeled);
+	if (stack_write_delete_logs(&w, newrefname) ||
+	    read_logs(st, oldrefname, &logs)) {
+		ret = error("unable to read the reflog of '%s'", oldrefname);
+		goto out;
+	}
+	for (i = 0; i < logs.nr; i++) {
+		struct reftable_log_record *log =
+			stack_write_add_log(&w, newrefname,
+					    logs.log[i].update_index,
+					    logs.log[i].value_type);
+		free((char *)log->refname);
+		copy_log_record(log, &logs.log[i]);
+		free((char *)log->refname);
+		log->refname = xstrdup(newrefname);
+	}
+
+	if (!copy) {
+		stack_write_add_ref(&w, oldrefname, REFTABLE_REF_DELETION);
+		for (i = 0; i < logs.nr; i++)
+			stack_write_add_log(&w, oldrefname,
+					    logs.log[i].update_index,
+					    REFTABLE_LOG_DELETION);
+	}
+
+	if (logs.nr || should_write_log(st, newrefname, 0))
+		stack_write_add_log_entry(&w, newrefname, &ref.value,
+					  &ref.value, logmsg);
+
+	if (stack_write_commit(&w, &err)) {
+		if (copy)
+			ret = error("unable to copy '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+		else
+			ret = error("unable to rename '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+	}
+
+out:
+	stack_write_release(&w);
+	log_records_release(&logs);
+	strbuf_release(&err);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 1);
+}
+
+struct ref_storage_be refs_be_reftable = {
+	NULL,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_for_each_reflog_ent_reverse_at,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
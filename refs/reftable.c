@@ -0,0 +1,1300 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../lockfile.h"
+#include "../trace2.h"
+#include "../varint.h"
+#include "refs-internal.h"
+#include "reftable.h"
+
+/*
+ * Table layout (all integers in network byte order):
+ *
+ *   header:  be32 signature, be32 version, be32 hash format id,
+ *            be32 block size, be64 min update index,
+ *            be64 max update index
+ *   ref blocks, [ref index block]
+ *   log blocks, [log index block]
+ *   footer:  copy of the header, be64 ref index offset,
+ *            be64 log offset, be64 log index offset,
+ *            be32 CRC-32 of the preceding footer bytes
+ *
+ * An offset of zero means that the corresponding part is absent.
+ */
+#define HEADER_SIZE 32
+#define FOOTER_SIZE (HEADER_SIZE + 3 * 8 + 4)
+
+/*
+ * Block layout:
+ *
+ *   u8 block type, be32 block length (including this header)
+ *   records
+ *   be32 restart offset (relative to the block start) * N
+ *   be32 N
+ *
+ * Record layout:
+ *
+ *   varint prefix length, varint (suffix length << 3 | value type),
+ *   key suffix, varint value length, value
+ */
+#define BLOCK_HEADER_SIZE 5
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+static int get_varint(const unsigned char **p, const unsigned char *end,
+		      uint64_t *out)
+{
+	const unsigned char *buf = *p;
+	unsigned char c;
+	uint64_t val;
+
+	/* the inverse of encode_varint(), with bounds checking */
+	if (buf >= end)
+		return -1;
+	c = *buf++;
+	val = c & 127;
+	while (c & 128) {
+		val += 1;
+		if (!val || (val >> 57) || buf >= end)
+			return -1;
+		c = *buf++;
+		val = (val << 7) + (c & 127);
+	}
+	*p = buf;
+	*out = val;
+	return 0;
+}
+
+static void put_varint(struct strbuf *sb, uint64_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(sb, buf, encode_varint(value, buf));
+}
+
+static int compare_keys(const char *a, size_t a_len,
+			const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+	if (cmp)
+		return cmp;
+	return a_len < b_len ? -1 : a_len > b_len;
+}
+
+void reftable_log_key(struct strbuf *key, const char *refname,
+		      uint64_t update_index)
+{
+	unsigned char be[8];
+
+	strbuf_reset(key);
+	strbuf_addstr(key, refname);
+	strbuf_addch(key, '\0');
+	put_be64(be, ~update_index);
+	strbuf_add(key, be, sizeof(be));
+}
+
+static void put_header(unsigned char *p, uint32_t block_size,
+		       uint64_t min_update_index, uint64_t max_update_index)
+{
+	put_be32(p, REFTABLE_SIGNATURE);
+	put_be32(p + 4, REFTABLE_VERSION);
+	put_be32(p + 8, the_hash_algo->format_id);
+	put_be32(p + 12, block_size);
+	put_be64(p + 16, min_update_index);
+	put_be64(p + 24, max_update_index);
+}
+
+void reftable_writer_init(struct reftable_writer *w,
+			  const struct reftable_write_options *opts,
+			  uint64_t min_update_index,
+			  uint64_t max_update_index)
+{
+	unsigned char header[HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	w->opts = *opts;
+	if (!w->opts.restart_interval)
+		w->opts.restart_interval = 1;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	strbuf_init(&w->buf, 0);
+	strbuf_init(&w->block.last_key, 0);
+
+	put_header(header, w->opts.block_size,
+		   min_update_index, max_update_index);
+	strbuf_add(&w->buf, header, sizeof(header));
+}
+
+static void encode_record(struct strbuf *out, const struct strbuf *last_key,
+			  int restart, const char *key, size_t key_len,
+			  unsigned int value_type,
+			  const unsigned char *value, size_t value_len)
+{
+	size_t prefix = 0;
+
+	if (!restart)
+		while (prefix < key_len && prefix < last_key->len &&
+		       key[prefix] == last_key->buf[prefix])
+			prefix++;
+
+	strbuf_reset(out);
+	put_varint(out, prefix);
+	put_varint(out, ((uint64_t)(key_len - prefix) << 3) | value_type);
+	strbuf_add(out, key + prefix, key_len - prefix);
+	put_varint(out, value_len);
+	strbuf_add(out, value, value_len);
+}
+
+static void block_begin(struct reftable_writer *w, int type)
+{
+	unsigned char header[BLOCK_HEADER_SIZE] = { type };
+
+	w->block.start = w->buf.len;
+	w->block.nr = 0;
+	w->block.restarts_nr = 0;
+	strbuf_reset(&w->block.last_key);
+	strbuf_add(&w->buf, header, sizeof(header));
+	w->in_block = 1;
+}
+
+static size_t block_end_size(const struct reftable_writer *w, size_t restarts)
+{
+	return w->buf.len - w->block.start + 4 * restarts + 4;
+}
+
+static void block_finish(struct reftable_writer *w)
+{
+	unsigned char be[4];
+	size_t i;
+
+	for (i = 0; i < w->block.restarts_nr; i++) {
+		put_be32(be, w->block.restarts[i]);
+		strbuf_add(&w->buf, be, sizeof(be));
+	}
+	put_be32(be, w->block.restarts_nr);
+	strbuf_add(&w->buf, be, sizeof(be));
+	put_be32(w->buf.buf + w->block.start + 1, w->buf.len - w->block.start);
+	w->in_block = 0;
+}
+
+/*
+ * Append a record to the current block. If `limit` is set, start a
+ * new block first if the record would not fit into the configured
+ * block size (blocks that hold a single large record may exceed it).
+ */
+static void block_add(struct reftable_writer *w, int type, int limit,
+		      const char *key, size_t key_len, unsigned int value_type,
+		      const unsigned char *value, size_t value_len)
+{
+	struct strbuf rec = STRBUF_INIT;
+	int restart;
+
+	if (!w->in_block)
+		block_begin(w, type);
+
+	restart = !(w->block.nr % w->opts.restart_interval);
+	encode_record(&rec, &w->block.last_key, restart, key, key_len,
+		      value_type, value, value_len);
+
+	if (limit && w->block.nr &&
+	    block_end_size(w, w->block.restarts_nr + restart) + rec.len >
+	    w->opts.block_size) {
+		struct reftable_index_entry *e;
+
+		ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+		e = &w->index[w->index_nr++];
+		e->last_key_len = w->block.last_key.len;
+		e->last_key = xmemdupz(w->block.last_key.buf, e->last_key_len);
+		e->offset = w->block.start;
+
+		block_finish(w);
+		block_begin(w, type);
+		restart = 1;
+		encode_record(&rec, &w->block.last_key, restart, key, key_len,
+			      value_type, value, value_len);
+	}
+
+	if (restart) {
+		ALLOC_GROW(w->block.restarts, w->block.restarts_nr + 1,
+			   w->block.restarts_alloc);
+		w->block.restarts[w->block.restarts_nr++] =
+			w->buf.len - w->block.start;
+	}
+	strbuf_addbuf(&w->buf, &rec);
+	strbuf_reset(&w->block.last_key);
+	strbuf_add(&w->block.last_key, key, key_len);
+	w->block.nr++;
+	strbuf_release(&rec);
+}
+
+/*
+ * Finish the blocks of the current section and, if there is more than
+ * one of them, write an index over them. Return the offset of that
+ * index, or 0 if none was written.
+ */
+static uint64_t section_finish(struct reftable_writer *w)
+{
+	uint64_t index_offset = 0;
+	size_t i;
+
+	if (!w->in_block)
+		return 0;
+
+	if (w->index_nr) {
+		struct reftable_index_entry *e;
+
+		ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+		e = &w->index[w->index_nr++];
+		e->last_key_len = w->block.last_key.len;
+		e->last_key = xmemdupz(w->block.last_key.buf, e->last_key_len);
+		e->offset = w->block.start;
+	}
+	block_finish(w);
+
+	if (w->index_nr) {
+		struct strbuf value = STRBUF_INIT;
+
+		index_offset = w->buf.len;
+		for (i = 0; i < w->index_nr; i++) {
+			strbuf_reset(&value);
+			put_varint(&value, w->index[i].offset);
+			block_add(w, BLOCK_TYPE_INDEX, 0,
+				  w->index[i].last_key, w->index[i].last_key_len,
+				  0, (unsigned char *)value.buf, value.len);
+			free(w->index[i].last_key);
+		}
+		block_finish(w);
+		strbuf_release(&value);
+	}
+	w->index_nr = 0;
+	return index_offset;
+}
+
+static void writer_add(struct reftable_writer *w, int section,
+		       const char *key, size_t key_len, unsigned int value_type,
+		       const unsigned char *value, size_t value_len)
+{
+	if (section < w->section)
+		BUG("reftable: ref records must be added before log records");
+	if (section > w->section) {
+		w->ref_index_offset = section_finish(w);
+		w->section = section;
+		if (section == 2)
+			w->log_offset = w->buf.len;
+	} else if (compare_keys(key, key_len, w->block.last_key.buf,
+				w->block.last_key.len) <= 0) {
+		BUG("reftable: records added out of order");
+	}
+
+	block_add(w, section == 1 ? BLOCK_TYPE_REF : BLOCK_TYPE_LOG, 1,
+		  key, key_len, value_type, value, value_len);
+}
+
+void reftable_writer_add_ref(struct reftable_writer *w,
+			     const struct reftable_ref_record *ref)
+{
+	struct strbuf value = STRBUF_INIT;
+
+	if (ref->update_index < w->min_update_index ||
+	    ref->update_index > w->max_update_index)
+		BUG("reftable: update index of '%s' out of range", ref->refname);
+
+	put_varint(&value, ref->update_index - w->min_update_index);
+	switch (ref->value_type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL2:
+		strbuf_add(&value, ref->value.hash, the_hash_algo->rawsz);
+		strbuf_add(&value, ref->peeled.hash, the_hash_algo->rawsz);
+		break;
+	case REFTABLE_REF_VAL1:
+		strbuf_add(&value, ref->value.hash, the_hash_algo->rawsz);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_addstr(&value, ref->target);
+		break;
+	default:
+		BUG("reftable: unknown ref value type %u", ref->value_type);
+	}
+
+	writer_add(w, 1, ref->refname, strlen(ref->refname), ref->value_type,
+		   (unsigned char *)value.buf, value.len);
+	w->nr_refs++;
+	strbuf_release(&value);
+}
+
+void reftable_writer_add_log(struct reftable_writer *w,
+			     const struct reftable_log_record *log)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct strbuf value = STRBUF_INIT;
+
+	reftable_log_key(&key, log->refname, log->update_index);
+	if (log->value_type == REFTABLE_LOG_UPDATE) {
+		uint64_t tz = log->tz < 0 ? ((uint64_t)-log->tz << 1) | 1 :
+					    (uint64_t)log->tz << 1;
+
+		strbuf_add(&value, log->old_oid.hash, the_hash_algo->rawsz);
+		strbuf_add(&value, log->new_oid.hash, the_hash_algo->rawsz);
+		put_varint(&value, log->time);
+		put_varint(&value, tz);
+		put_varint(&value, strlen(log->ident));
+		strbuf_addstr(&value, log->ident);
+		strbuf_addstr(&value, log->message);
+	} else if (log->value_type != REFTABLE_LOG_DELETION &&
+		   log->value_type != REFTABLE_LOG_EXISTS) {
+		BUG("reftable: unknown log value type %u", log->value_type);
+	}
+
+	writer_add(w, 2, key.buf, key.len, log->value_type,
+		   (unsigned char *)value.buf, value.len);
+	w->nr_logs++;
+	strbuf_release(&key);
+	strbuf_release(&value);
+}
+
+int reftable_writer_finish(struct reftable_writer *w, struct strbuf *out)
+{
+	unsigned char footer[FOOTER_SIZE];
+
+	if (w->section == 1)
+		w->ref_index_offset = section_finish(w);
+	else if (w->section == 2)
+		w->log_index_offset = section_finish(w);
+
+	put_header(footer, w->opts.block_size,
+		   w->min_update_index, w->max_update_index);
+	put_be64(footer + HEADER_SIZE, w->ref_index_offset);
+	put_be64(footer + HEADER_SIZE + 8, w->log_offset);
+	put_be64(footer + HEADER_SIZE + 16, w->log_index_offset);
+	put_be32(footer + FOOTER_SIZE - 4,
+		 crc32(0, footer, FOOTER_SIZE - 4));
+	strbuf_add(&w->buf, footer, sizeof(footer));
+
+	strbuf_swap(out, &w->buf);
+	return !w->nr_refs && !w->nr_logs;
+}
+
+void reftable_writer_release(struct reftable_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].last_key);
+	free(w->index);
+	free(w->block.restarts);
+	strbuf_release(&w->block.last_key);
+	strbuf_release(&w->buf);
+}
+
+struct reftable_table *reftable_table_open(const char *path, const char *name)
+{
+	struct reftable_table *t;
+	const unsigned char *footer;
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			error_errno(_("unable to open reftable '%s'"), path);
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		error_errno(_("unable to stat reftable '%s'"), path);
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < HEADER_SIZE + FOOTER_SIZE) {
+		error(_("reftable '%s' is too small"), path);
+		close(fd);
+		return NULL;
+	}
+	data = xmmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer = (const unsigned char *)data + st.st_size - FOOTER_SIZE;
+	if (get_be32(data) != REFTABLE_SIGNATURE ||
+	    get_be32((unsigned char *)data + 4) != REFTABLE_VERSION) {
+		error(_("reftable '%s' has an unknown signature or version"),
+		      path);
+		goto corrupt;
+	}
+	if (get_be32((unsigned char *)data + 8) != the_hash_algo->format_id) {
+		error(_("reftable '%s' uses a different hash algorithm"), path);
+		goto corrupt;
+	}
+	if (memcmp(data, footer, HEADER_SIZE) ||
+	    get_be32(footer + FOOTER_SIZE - 4) !=
+	    crc32(0, footer, FOOTER_SIZE - 4)) {
+		error(_("reftable '%s' has a corrupt footer"), path);
+		goto corrupt;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->refcount = 1;
+	t->name = xstrdup(name);
+	t->data = data;
+	t->size = st.st_size;
+	t->min_update_index = get_be64(footer + 16);
+	t->max_update_index = get_be64(footer + 24);
+	t->ref_index_offset = get_be64(footer + HEADER_SIZE);
+	t->log_offset = get_be64(footer + HEADER_SIZE + 8);
+	t->log_index_offset = get_be64(footer + HEADER_SIZE + 16);
+
+	t->log_end = t->log_index_offset ? t->log_index_offset :
+		     t->size - FOOTER_SIZE;
+	if (t->ref_index_offset)
+		t->ref_end = t->ref_index_offset;
+	else if (t->log_offset)
+		t->ref_end = t->log_offset;
+	else
+		t->ref_end = t->size - FOOTER_SIZE;
+
+	if (t->ref_end < HEADER_SIZE || t->ref_end > t->size - FOOTER_SIZE ||
+	    t->ref_index_offset > t->size - FOOTER_SIZE ||
+	    t->log_offset > t->size - FOOTER_SIZE ||
+	    t->log_index_offset > t->size - FOOTER_SIZE ||
+	    (t->log_offset && t->log_offset > t->log_end)) {
+		error(_("reftable '%s' has invalid section offsets"), path);
+		free(t->name);
+		free(t);
+		goto corrupt;
+	}
+	return t;
+
+corrupt:
+	munmap(data, st.st_size);
+	return NULL;
+}
+
+void reftable_table_close(struct reftable_table *t)
+{
+	if (!t || --t->refcount)
+		return;
+	munmap((void *)t->data, t->size);
+	free(t->name);
+	free(t);
+}
+
+/*
+ * Iteration over the records of one section of one table.
+ */
+struct reftable_table_iter {
+	struct reftable_table *table;
+	size_t section_end;
+	size_t block_end, records_end;
+	size_t restarts_off;
+	uint32_t restarts_nr;
+	size_t pos;
+	int type;
+	int done;
+
+	/* the current record */
+	struct strbuf key;
+	unsigned int value_type;
+	const unsigned char *value;
+	size_t value_len;
+};
+
+static int corrupt_table(struct reftable_table *t)
+{
+	return error(_("reftable '%s' is corrupt"), t->name);
+}
+
+static int block_open(struct reftable_table_iter *ti, size_t offset, int type)
+{
+	const unsigned char *data = ti->table->data;
+	uint32_t len;
+
+	if (offset + BLOCK_HEADER_SIZE + 4 > ti->table->size ||
+	    data[offset] != type)
+		return corrupt_table(ti->table);
+	len = get_be32(data + offset + 1);
+	if (len < BLOCK_HEADER_SIZE + 4 || offset + len > ti->table->size)
+		return corrupt_table(ti->table);
+
+	ti->block_end = offset + len;
+	ti->restarts_nr = get_be32(data + ti->block_end - 4);
+	if (ti->restarts_nr > (len - BLOCK_HEADER_SIZE - 4) / 4)
+		return corrupt_table(ti->table);
+	ti->restarts_off = ti->block_end - 4 - 4 * ti->restarts_nr;
+	ti->records_end = ti->restarts_off;
+	ti->pos = offset + BLOCK_HEADER_SIZE;
+	strbuf_reset(&ti->key);
+	return 0;
+}
+
+/* Decode the record at ti->pos into the current record. */
+static int decode_record(struct reftable_table_iter *ti)
+{
+	const unsigned char *p = ti->table->data + ti->pos;
+	const unsigned char *end = ti->table->data + ti->records_end;
+	uint64_t prefix, suffix_and_type, suffix, value_len;
+
+	if (get_varint(&p, end, &prefix) ||
+	    get_varint(&p, end, &suffix_and_type) ||
+	    prefix > ti->key.len)
+		return corrupt_table(ti->table);
+	suffix = suffix_and_type >> 3;
+	if (suffix > end - p)
+		return corrupt_table(ti->table);
+	strbuf_setlen(&ti->key, prefix);
+	strbuf_add(&ti->key, p, suffix);
+	p += suffix;
+	if (get_varint(&p, end, &value_len) || value_len > end - p)
+		return corrupt_table(ti->table);
+
+	ti->value_type = suffix_and_type & 7;
+	ti->value = p;
+	ti->value_len = value_len;
+	ti->pos = p + value_len - ti->table->data;
+	return 0;
+}
+
+/*
+ * Advance to the next record of the section, moving on to the next
+ * block if needed.
+ */
+static int table_iter_next(struct reftable_table_iter *ti)
+{
+	if (ti->done)
+		return 1;
+	if (ti->pos >= ti->records_end) {
+		if (ti->block_end >= ti->section_end) {
+			ti->done = 1;
+			return 1;
+		}
+		if (block_open(ti, ti->block_end, ti->type))
+			return -1;
+		if (ti->pos >= ti->records_end)
+			return corrupt_table(ti->table);
+	}
+	return decode_record(ti);
+}
+
+/*
+ * Within the current block, position `ti` on the first record whose
+ * key is at least `key`, and decode it. Return 1 if there is no such
+ * record in this block.
+ */
+static int block_seek(struct reftable_table_iter *ti,
+		      const char *key, size_t key_len)
+{
+	const unsigned char *data = ti->table->data;
+	size_t block_start = ti->pos - BLOCK_HEADER_SIZE;
+	uint32_t lo = 0, hi = ti->restarts_nr;
+
+	/* find the last restart point whose key is less than `key` */
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t off = get_be32(data + ti->restarts_off + 4 * mi);
+
+		if (off < BLOCK_HEADER_SIZE ||
+		    block_start + off >= ti->records_end)
+			return corrupt_table(ti->table);
+		strbuf_reset(&ti->key);
+		ti->pos = block_start + off;
+		if (decode_record(ti))
+			return -1;
+		if (compare_keys(ti->key.buf, ti->key.len, key, key_len) < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	strbuf_reset(&ti->key);
+	if (lo)
+		ti->pos = block_start +
+			get_be32(data + ti->restarts_off + 4 * (lo - 1));
+	else
+		ti->pos = block_start + BLOCK_HEADER_SIZE;
+
+	while (ti->pos < ti->records_end) {
+		if (decode_record(ti))
+			return -1;
+		if (compare_keys(ti->key.buf, ti->key.len, key, key_len) >= 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int table_iter_seek(struct reftable_table_iter *ti,
+			   struct reftable_table *t, int section,
+			   const char *key, size_t key_len)
+{
+	size_t start, index_offset;
+	int ret;
+
+	memset(ti, 0, sizeof(*ti));
+	strbuf_init(&ti->key, 0);
+	ti->table = t;
+	if (section == REFTABLE_SECTION_REFS) {
+		start = HEADER_SIZE;
+		ti->section_end = t->ref_end;
+		index_offset = t->ref_index_offset;
+		ti->type = BLOCK_TYPE_REF;
+	} else {
+		start = t->log_offset;
+		ti->section_end = start ? t->log_end : 0;
+		index_offset = t->log_index_offset;
+		ti->type = BLOCK_TYPE_LOG;
+	}
+	if (!start || start >= ti->section_end) {
+		ti->done = 1;
+		return 1;
+	}
+
+	if (index_offset) {
+		const unsigned char *p;
+		uint64_t offset;
+
+		if (block_open(ti, index_offset, BLOCK_TYPE_INDEX))
+			return -1;
+		ret = block_seek(ti, key, key_len);
+		if (ret) {
+			ti->done = 1;
+			return ret;
+		}
+		p = ti->value;
+		if (get_varint(&p, p + ti->value_len, &offset) ||
+		    offset < start || offset >= ti->section_end)
+			return corrupt_table(t);
+		start = offset;
+	}
+
+	if (block_open(ti, start, ti->type))
+		return -1;
+	ret = block_seek(ti, key, key_len);
+	if (ret > 0) {
+		/* the key sorts after this block; try the next one */
+		ti->pos = ti->records_end;
+		ret = table_iter_next(ti);
+	}
+	if (ret)
+		ti->done = 1;
+	return ret;
+}
+
+void reftable_iter_seek(struct reftable_iter *it,
+			struct reftable_table **tables, size_t nr,
+			int section, const char *key, size_t key_len,
+			int keep_deletions)
+{
+	size_t i;
+
+	memset(it, 0, sizeof(*it));
+	strbuf_init(&it->key, 0);
+	it->keep_deletions = keep_deletions;
+	it->sub_nr = nr;
+	it->sub = xcalloc(nr, sizeof(*it->sub));
+	for (i = 0; i < nr; i++) {
+		tables[i]->refcount++;
+		if (table_iter_seek(&it->sub[i], tables[i], section,
+				    key, key_len) < 0)
+			it->sub[i].done = -1;
+	}
+}
+
+int reftable_iter_next(struct reftable_iter *it)
+{
+	if (!it->sub)
+		return 1;
+
+	for (;;) {
+		struct reftable_table_iter *best = NULL;
+		size_t i;
+
+		for (i = 0; i < it->sub_nr; i++) {
+			struct reftable_table_iter *ti = &it->sub[i];
+
+			if (ti->done < 0)
+				return -1;
+			if (ti->done)
+				continue;
+			/* later tables win ties, hence "<=" */
+			if (!best ||
+			    compare_keys(ti->key.buf, ti->key.len,
+					 best->key.buf, best->key.len) <= 0)
+				best = ti;
+		}
+		if (!best)
+			return 1;
+
+		strbuf_reset(&it->key);
+		strbuf_addbuf(&it->key, &best->key);
+		it->value_type = best->value_type;
+		it->value = best->value;
+		it->value_len = best->value_len;
+		it->table = best->table;
+
+		/* skip the shadowed records with the same key */
+		for (i = 0; i < it->sub_nr; i++) {
+			struct reftable_table_iter *ti = &it->sub[i];
+
+			if (ti->done ||
+			    compare_keys(ti->key.buf, ti->key.len,
+					 it->key.buf, it->key.len))
+				continue;
+			if (table_iter_next(ti) < 0)
+				ti->done = -1;
+		}
+
+		/* both kinds of deletion records have value type 0 */
+		if (it->keep_deletions || it->value_type)
+			return 0;
+	}
+}
+
+void reftable_iter_release(struct reftable_iter *it)
+{
+	size_t i;
+
+	for (i = 0; i < it->sub_nr; i++) {
+		strbuf_release(&it->sub[i].key);
+		reftable_table_close(it->sub[i].table);
+	}
+	FREE_AND_NULL(it->sub);
+	it->sub_nr = 0;
+	strbuf_release(&it->key);
+}
+
+int reftable_iter_ref(struct reftable_iter *it,
+		      struct reftable_ref_record *ref, struct strbuf *buf)
+{
+	const unsigned char *p = it->value;
+	const unsigned char *end = it->value + it->value_len;
+	const size_t rawsz = the_hash_algo->rawsz;
+	uint64_t delta;
+
+	memset(ref, 0, sizeof(*ref));
+	ref->refname = it->key.buf;
+	ref->value_type = it->value_type;
+	if (get_varint(&p, end, &delta))
+		return corrupt_table(it->table);
+	ref->update_index = it->table->min_update_index + delta;
+
+	switch (it->value_type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL2:
+		if (end - p != 2 * rawsz)
+			return corrupt_table(it->table);
+		hashcpy(ref->value.hash, p);
+		hashcpy(ref->peeled.hash, p + rawsz);
+		break;
+	case REFTABLE_REF_VAL1:
+		if (end - p != rawsz)
+			return corrupt_table(it->table);
+		hashcpy(ref->value.hash, p);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_reset(buf);
+		strbuf_add(buf, p, end - p);
+		ref->target = buf->buf;
+		break;
+	default:
+		return corrupt_table(it->table);
+	}
+	return 0;
+}
+
+int reftable_iter_log(struct reftable_iter *it,
+		      struct reftable_log_record *log, struct strbuf *buf)
+{
+	const unsigned char *p = it->value;
+	const unsigned char *end = it->value + it->value_len;
+	const size_t rawsz = the_hash_algo->rawsz;
+	size_t name_len = strlen(it->key.buf);
+	uint64_t time, tz, ident_len;
+
+	memset(log, 0, sizeof(*log));
+	if (it->key.len != name_len + 9)
+		return corrupt_table(it->table);
+	log->refname = it->key.buf;
+	log->update_index = ~get_be64(it->key.buf + name_len + 1);
+	log->value_type = it->value_type;
+
+	switch (it->value_type) {
+	case REFTABLE_LOG_DELETION:
+	case REFTABLE_LOG_EXISTS:
+		return 0;
+	case REFTABLE_LOG_UPDATE:
+		break;
+	default:
+		return corrupt_table(it->table);
+	}
+
+	if (end - p < 2 * rawsz)
+		return corrupt_table(it->table);
+	hashcpy(log->old_oid.hash, p);
+	hashcpy(log->new_oid.hash, p + rawsz);
+	p += 2 * rawsz;
+	if (get_varint(&p, end, &time) || get_varint(&p, end, &tz) ||
+	    get_varint(&p, end, &ident_len) || ident_len > end - p)
+		return corrupt_table(it->table);
+	log->time = time;
+	log->tz = (tz & 1) ? -(int)(tz >> 1) : (int)(tz >> 1);
+
+	/* ident and message, each NUL-terminated */
+	strbuf_reset(buf);
+	strbuf_add(buf, p, ident_len);
+	strbuf_addch(buf, '\0');
+	strbuf_add(buf, p + ident_len, end - p - ident_len);
+	log->ident = buf->buf;
+	log->message = buf->buf + ident_len + 1;
+	return 0;
+}
+
+struct reftable_stack *reftable_stack_new(const char *dir)
+{
+	struct reftable_stack *st = xcalloc(1, sizeof(*st));
+	struct reftable_write_options opts = REFTABLE_WRITE_OPTIONS_INIT;
+	int value;
+
+	st->dir = xstrdup(dir);
+	st->list_file = xstrfmt("%s/tables.list", dir);
+
+	if (!git_config_get_int("reftable.blocksize", &value)) {
+		if (value < 256 || value > (1 << 24))
+			die(_("reftable.blockSize must be between 256 and 16777216"));
+		opts.block_size = value;
+	}
+	if (!git_config_get_int("reftable.restartinterval", &value)) {
+		if (value < 1)
+			die(_("reftable.restartInterval must be positive"));
+		opts.restart_interval = value;
+	}
+	if (!git_config_get_bool("reftable.autocompaction", &value))
+		st->disable_auto_compact = !value;
+	st->opts = opts;
+	return st;
+}
+
+static void stack_clear_tables(struct reftable_stack *st)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		reftable_table_close(st->tables[i]);
+	st->nr = 0;
+}
+
+void reftable_stack_free(struct reftable_stack *st)
+{
+	if (!st)
+		return;
+	stack_clear_tables(st);
+	free(st->tables);
+	free(st->list_file);
+	free(st->dir);
+	free(st);
+}
+
+/*
+ * Read "tables.list" and open the tables it names, reusing the ones
+ * that are already open. Return 1 if a table vanished in the meantime
+ * (because of a concurrent compaction), so that the caller can retry.
+ */
+static int stack_read_list(struct reftable_stack *st)
+{
+	struct strbuf list = STRBUF_INIT;
+	struct strbuf path = STRBUF_INIT;
+	struct reftable_table **tables = NULL;
+	size_t nr = 0, alloc = 0, i;
+	const char *p;
+	int fd, ret = 0;
+
+	fd = open(st->list_file, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return error_errno(_("unable to open '%s'"), st->list_file);
+		stack_clear_tables(st);
+		return 0;
+	}
+	if (strbuf_read(&list, fd, 0) < 0) {
+		ret = error_errno(_("unable to read '%s'"), st->list_file);
+		close(fd);
+		goto out;
+	}
+	close(fd);
+
+	for (p = list.buf; *p; ) {
+		const char *eol = strchrnul(p, '\n');
+		char *name = xmemdupz(p, eol - p);
+		struct reftable_table *t = NULL;
+
+		p = *eol ? eol + 1 : eol;
+		if (!*name) {
+			free(name);
+			continue;
+		}
+		for (i = 0; i < st->nr; i++)
+			if (st->tables[i] && !strcmp(st->tables[i]->name, name)) {
+				t = st->tables[i];
+				st->tables[i] = NULL;
+				break;
+			}
+		if (!t) {
+			strbuf_reset(&path);
+			strbuf_addf(&path, "%s/%s", st->dir, name);
+			t = reftable_table_open(path.buf, name);
+		}
+		if (!t) {
+			ret = errno == ENOENT ? 1 : -1;
+			free(name);
+			break;
+		}
+		free(name);
+		ALLOC_GROW(tables, nr + 1, alloc);
+		tables[nr++] = t;
+	}
+
+	if (ret) {
+		/* start from scratch on the next attempt */
+		for (i = 0; i < nr; i++)
+			reftable_table_close(tables[i]);
+		free(tables);
+		stack_clear_tables(st);
+		goto out;
+	}
+
+	stack_clear_tables(st);
+	free(st->tables);
+	st->tables = tables;
+	st->nr = nr;
+	st->alloc = alloc;
+
+out:
+	strbuf_release(&list);
+	strbuf_release(&path);
+	return ret;
+}
+
+int reftable_stack_reload(struct reftable_stack *st)
+{
+	int tries = 0;
+
+	/*
+	 * Do not trust stat data to tell whether "tables.list" changed:
+	 * a rewrite can easily end up with the same size, mtime and
+	 * (recycled) inode number. The file is small, and the tables it
+	 * names that are already open are reused.
+	 */
+	for (;;) {
+		int ret = stack_read_list(st);
+
+		if (ret <= 0)
+			return ret;
+		if (++tries >= 8)
+			return error(_("reftables listed in '%s' keep vanishing"),
+				     st->list_file);
+		sleep_millisec(tries);
+	}
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	return st->nr ? st->tables[st->nr - 1]->max_update_index + 1 : 1;
+}
+
+int reftable_stack_lock(struct reftable_stack *st, struct lock_file *lock,
+			struct strbuf *err)
+{
+	/* the stacks of linked worktrees are only created on demand */
+	safe_create_dir(st->dir, 1);
+	if (hold_lock_file_for_update_timeout(lock, st->list_file, 0,
+					      get_files_ref_lock_timeout_ms()) < 0) {
+		unable_to_lock_message(st->list_file, errno, err);
+		return -1;
+	}
+
+	/* we now own "tables.list"; make sure we have seen its latest version */
+	if (reftable_stack_reload(st)) {
+		strbuf_addf(err, _("unable to read '%s'"), st->list_file);
+		rollback_lock_file(lock);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write `table` to a new file in the stack directory and store its
+ * name in `name`.
+ */
+static int write_table_file(struct reftable_stack *st, struct strbuf *table,
+			    struct strbuf *name, struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	int fd;
+
+	strbuf_addf(&path, "%s/0x%012"PRIx64"-0x%012"PRIx64"-XXXXXX.ref",
+		    st->dir, get_be64(table->buf + 16), get_be64(table->buf + 24));
+	fd = git_mkstemps_mode(path.buf, 4, 0666);
+	if (fd < 0) {
+		strbuf_addf(err, _("unable to create '%s': %s"),
+			    path.buf, strerror(errno));
+		strbuf_release(&path);
+		return -1;
+	}
+	if (write_in_full(fd, table->buf, table->len) < 0 || close(fd)) {
+		strbuf_addf(err, _("unable to write '%s': %s"),
+			    path.buf, strerror(errno));
+		unlink(path.buf);
+		strbuf_release(&path);
+		return -1;
+	}
+	adjust_shared_perm(path.buf);
+
+	strbuf_reset(name);
+	strbuf_addstr(name, path.buf + strlen(st->dir) + 1);
+	strbuf_release(&path);
+	return 0;
+}
+
+/*
+ * Replace tables[start..end-1] in "tables.list" by `name` (if not
+ * NULL), and commit the lock.
+ */
+static int commit_table_list(struct reftable_stack *st, struct lock_file *lock,
+			     size_t start, size_t end, const char *name,
+			     struct strbuf *err)
+{
+	struct strbuf list = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < start; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (name)
+		strbuf_addf(&list, "%s\n", name);
+	for (i = end; i < st->nr; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+
+	if (write_in_full(get_lock_file_fd(lock), list.buf, list.len) < 0 ||
+	    commit_lock_file(lock)) {
+		strbuf_addf(err, _("unable to write '%s': %s"),
+			    st->list_file, strerror(errno));
+		rollback_lock_file(lock);
+		ret = -1;
+	} else {
+		adjust_shared_perm(st->list_file);
+	}
+	strbuf_release(&list);
+	return ret;
+}
+
+static void copy_section(struct reftable_writer *w, struct reftable_table **tables,
+			 size_t nr, int section, int keep_deletions, int *err)
+{
+	struct reftable_iter it;
+	struct strbuf value = STRBUF_INIT;
+	int ret;
+
+	reftable_iter_seek(&it, tables, nr, section, "", 0, keep_deletions);
+	while (!(ret = reftable_iter_next(&it))) {
+		const unsigned char *p = it.value;
+		const unsigned char *end = p + it.value_len;
+		int block_section = section == REFTABLE_SECTION_REFS ? 1 : 2;
+
+		strbuf_reset(&value);
+		if (section == REFTABLE_SECTION_REFS) {
+			uint64_t delta;
+
+			/* rebase the update index onto the new table */
+			if (get_varint(&p, end, &delta)) {
+				ret = corrupt_table(it.table);
+				break;
+			}
+			put_varint(&value, it.table->min_update_index + delta -
+					   w->min_update_index);
+			w->nr_refs++;
+		} else {
+			w->nr_logs++;
+		}
+		strbuf_add(&value, p, end - p);
+		writer_add(w, block_section, it.key.buf, it.key.len,
+			   it.value_type, (unsigned char *)value.buf, value.len);
+	}
+	if (ret < 0)
+		*err = -1;
+	reftable_iter_release(&it);
+	strbuf_release(&value);
+}
+
+/*
+ * Merge tables[start..end-1] into a single table. The stack must be
+ * locked with `lock`, which is released.
+ */
+static int stack_compact(struct reftable_stack *st, struct lock_file *lock,
+			 size_t start, size_t end, struct strbuf *err)
+{
+	struct reftable_writer w;
+	struct strbuf table = STRBUF_INIT;
+	struct strbuf name = STRBUF_INIT;
+	struct strbuf path = STRBUF_INIT;
+	/* deletions only matter if there are older tables left to shadow */
+	int keep_deletions = start > 0;
+	int corrupt = 0, empty, ret = 0;
+	char **obsolete;
+	size_t i;
+
+	trace2_region_enter("refs", "reftable/compact", the_repository);
+	reftable_writer_init(&w, &st->opts,
+			     st->tables[start]->min_update_index,
+			     st->tables[end - 1]->max_update_index);
+	copy_section(&w, st->tables + start, end - start,
+		     REFTABLE_SECTION_REFS, keep_deletions, &corrupt);
+	copy_section(&w, st->tables + start, end - start,
+		     REFTABLE_SECTION_LOGS, keep_deletions, &corrupt);
+	empty = reftable_writer_finish(&w, &table);
+	reftable_writer_release(&w);
+
+	if (corrupt) {
+		strbuf_addf(err, _("unable to compact corrupt reftables"));
+		rollback_lock_file(lock);
+		ret = -1;
+		goto out;
+	}
+	if (!empty && write_table_file(st, &table, &name, err)) {
+		rollback_lock_file(lock);
+		ret = -1;
+		goto out;
+	}
+
+	ALLOC_ARRAY(obsolete, end - start);
+	for (i = start; i < end; i++)
+		obsolete[i - start] = xstrdup(st->tables[i]->name);
+
+	if (commit_table_list(st, lock, start, end,
+			      empty ? NULL : name.buf, err)) {
+		if (!empty) {
+			strbuf_addf(&path, "%s/%s", st->dir, name.buf);
+			unlink(path.buf);
+		}
+		ret = -1;
+	} else {
+		/* readers that still have them mapped are not affected */
+		for (i = 0; i < end - start; i++) {
+			strbuf_reset(&path);
+			strbuf_addf(&path, "%s/%s", st->dir, obsolete[i]);
+			unlink_or_warn(path.buf);
+		}
+		trace2_data_intmax("refs", the_repository,
+				   "reftable/compacted-tables", end - start);
+	}
+	for (i = 0; i < end - start; i++)
+		free(obsolete[i]);
+	free(obsolete);
+
+	if (!ret && reftable_stack_reload(st)) {
+		strbuf_addf(err, _("unable to read '%s'"), st->list_file);
+		ret = -1;
+	}
+
+out:
+	trace2_region_leave("refs", "reftable/compact", the_repository);
+	strbuf_release(&table);
+	strbuf_release(&name);
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * Find the segment of newest tables to merge so that, walking from
+ * the top of the stack down, each table is more than twice as large as
+ * all the tables above it taken together. That keeps the number of
+ * tables logarithmic in the number of records, while each new table
+ * is usually merged only with a few small ones.
+ */
+static size_t suggest_compaction_start(struct reftable_stack *st)
+{
+	size_t start, total;
+
+	if (st->nr < 2)
+		return st->nr;
+
+	start = st->nr - 1;
+	total = st->tables[start]->size;
+	while (start > 0 && st->tables[start - 1]->size <= 2 * total) {
+		start--;
+		total += st->tables[start]->size;
+	}
+	return start;
+}
+
+static void stack_auto_compact(struct reftable_stack *st)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf err = STRBUF_INIT;
+	size_t start;
+
+	if (st->disable_auto_compact ||
+	    st->nr - suggest_compaction_start(st) < 2)
+		return;
+
+	/*
+	 * Compaction is an optimization: if somebody else is busy with
+	 * the stack, let them do it later.
+	 */
+	if (hold_lock_file_for_update(&lock, st->list_file, 0) < 0)
+		return;
+	if (reftable_stack_reload(st)) {
+		rollback_lock_file(&lock);
+		return;
+	}
+
+	start = suggest_compaction_start(st);
+	if (st->nr - start < 2)
+		rollback_lock_file(&lock);
+	else if (stack_compact(st, &lock, start, st->nr, &err))
+		warning(_("unable to compact reftables: %s"), err.buf);
+	strbuf_release(&err);
+}
+
+int reftable_stack_add(struct reftable_stack *st, struct lock_file *lock,
+		       struct strbuf *table, struct strbuf *err)
+{
+	struct strbuf name = STRBUF_INIT;
+	int ret = 0;
+
+	if (write_table_file(st, table, &name, err)) {
+		rollback_lock_file(lock);
+		ret = -1;
+		goto out;
+	}
+	if (commit_table_list(st, lock, st->nr, st->nr, name.buf, err)) {
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_addf(&path, "%s/%s", st->dir, name.buf);
+		unlink(path.buf);
+		strbuf_release(&path);
+		ret = -1;
+		goto out;
+	}
+
+	if (reftable_stack_reload(st)) {
+		strbuf_addf(err, _("unable to read '%s'"), st->list_file);
+		ret = -1;
+		goto out;
+	}
+	stack_auto_compact(st);
+
+out:
+	strbuf_release(&name);
+	return ret;
+}
+
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err)
+{
+	struct lock_file lock = LOCK_INIT;
+
+	if (reftable_stack_lock(st, &lock, err))
+		return -1;
+	if (st->nr < 2) {
+		rollback_lock_file(&lock);
+		return 0;
+	}
+	return stack_compact(st, &lock, 0, st->nr, err);
+}
@@ -0,0 +1,246 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+#include "cache.h"
+
+struct lock_file;
+
+/*
+ * Low-level support for reading and writing reftables, and for the
+ * stack of reftables that makes up a reftable reference store. See
+ * Documentation/technical/reftable.txt for the file format.
+ *
+ * A table holds a sorted section of ref records followed by a sorted
+ * section of log records. Records are grouped into blocks; within a
+ * block, keys are prefix-compressed against their predecessor, except
+ * at "restart points" whose offsets are stored at the end of the block
+ * so that the block can be binary searched. When a section has more
+ * than one block, an index block holding the last key of each block
+ * is written after it.
+ */
+
+#define REFTABLE_SIGNATURE 0x52454654 /* "REFT" */
+#define REFTABLE_VERSION 1
+
+/* Value types of ref records: */
+#define REFTABLE_REF_DELETION 0
+#define REFTABLE_REF_VAL1 1 /* object name */
+#define REFTABLE_REF_VAL2 2 /* object name and peeled object name */
+#define REFTABLE_REF_SYMREF 3 /* symbolic reference */
+
+/* Value types of log records: */
+#define REFTABLE_LOG_DELETION 0
+#define REFTABLE_LOG_UPDATE 1
+/* Marks an existing, but possibly empty, reflog. */
+#define REFTABLE_LOG_EXISTS 2
+
+struct reftable_ref_record {
+	const char *refname;
+	uint64_t update_index;
+	unsigned int value_type;
+	struct object_id value;
+	struct object_id peeled;
+	const char *target;
+};
+
+struct reftable_log_record {
+	const char *refname;
+	uint64_t update_index;
+	unsigned int value_type;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	/* "Name <email>", as passed to reflog callbacks */
+	const char *ident;
+	timestamp_t time;
+	int tz;
+	/* without a trailing newline */
+	const char *message;
+};
+
+/*
+ * Compute the key under which log for `refname` at `update_index` is
+ * stored. Log keys sort by refname, then newest first.
+ */
+void reftable_log_key(struct strbuf *key, const char *refname,
+		      uint64_t update_index);
+
+struct reftable_write_options {
+	unsigned int block_size;
+	unsigned int restart_interval;
+};
+
+#define REFTABLE_WRITE_OPTIONS_INIT { 4096, 16 }
+
+struct reftable_block_writer {
+	size_t start;
+	size_t nr;
+	uint32_t *restarts;
+	size_t restarts_nr, restarts_alloc;
+	struct strbuf last_key;
+};
+
+struct reftable_index_entry {
+	char *last_key;
+	size_t last_key_len;
+	uint64_t offset;
+};
+
+/*
+ * Accumulates a table in memory. Add all ref records in refname order,
+ * then all log records in key order, then call reftable_writer_finish().
+ */
+struct reftable_writer {
+	struct reftable_write_options opts;
+	uint64_t min_update_index, max_update_index;
+	struct strbuf buf;
+	int section; /* 0: none yet, 1: refs, 2: logs */
+	struct reftable_block_writer block;
+	int in_block;
+	struct reftable_index_entry *index;
+	size_t index_nr, index_alloc;
+	uint64_t ref_index_offset, log_offset, log_index_offset;
+	uint64_t nr_refs, nr_logs;
+};
+
+void reftable_writer_init(struct reftable_writer *w,
+			  const struct reftable_write_options *opts,
+			  uint64_t min_update_index,
+			  uint64_t max_update_index);
+void reftable_writer_add_ref(struct reftable_writer *w,
+			     const struct reftable_ref_record *ref);
+void reftable_writer_add_log(struct reftable_writer *w,
+			     const struct reftable_log_record *log);
+
+/*
+ * Finish the table and move its contents to `out`. Return 1 if no
+ * record was added, 0 otherwise.
+ */
+int reftable_writer_finish(struct reftable_writer *w, struct strbuf *out);
+void reftable_writer_release(struct reftable_writer *w);
+
+/*
+ * A single table, mmapped read-only. Iterators hold a reference to the
+ * tables they look at, so that reloading a stack can safely close them.
+ */
+struct reftable_table {
+	int refcount;
+	char *name;
+	const unsigned char *data;
+	size_t size;
+	uint64_t min_update_index, max_update_index;
+	size_t ref_end, ref_index_offset;
+	size_t log_offset, log_end, log_index_offset;
+};
+
+/*
+ * Open the table at `path`. On errors, print a message and return
+ * NULL.
+ */
+struct reftable_table *reftable_table_open(const char *path, const char *name);
+
+/* Drop a reference to the table, and close it if it was the last one. */
+void reftable_table_close(struct reftable_table *t);
+
+/*
+ * An iterator over the records of one section of one table, or of
+ * that section across a whole stack of tables. The current record's
+ * key, value type and undecoded value are available in the public
+ * members after reftable_iter_next() returned 0.
+ */
+#define REFTABLE_SECTION_REFS 0
+#define REFTABLE_SECTION_LOGS 1
+
+struct reftable_table_iter;
+
+struct reftable_iter {
+	struct strbuf key;
+	unsigned int value_type;
+	const unsigned char *value;
+	size_t value_len;
+	/* the table the current record comes from */
+	struct reftable_table *table;
+
+	/* private */
+	struct reftable_table_iter *sub;
+	size_t sub_nr;
+	int keep_deletions;
+};
+
+/*
+ * Position `it` on the first record of the given section whose key is
+ * at least `key` (which may be empty), looking at tables[0..nr-1].
+ * Later tables take precedence over earlier ones for equal keys. Unless
+ * `keep_deletions` is set, deletion records are skipped together with
+ * records they shadow.
+ */
+void reftable_iter_seek(struct reftable_iter *it,
+			struct reftable_table **tables, size_t nr,
+			int section, const char *key, size_t key_len,
+			int keep_deletions);
+
+/*
+ * Advance to the next record. Return 0 if there is one, 1 at the end
+ * of the section, or -1 on errors (after printing a message).
+ */
+int reftable_iter_next(struct reftable_iter *it);
+void reftable_iter_release(struct reftable_iter *it);
+
+/*
+ * Decode the current record of `it`. The strings pointed to by the
+ * result are valid until the iterator is advanced; `buf` is used to
+ * hold them. Return -1 if the record is corrupt.
+ */
+int reftable_iter_ref(struct reftable_iter *it,
+		      struct reftable_ref_record *ref, struct strbuf *buf);
+int reftable_iter_log(struct reftable_iter *it,
+		      struct reftable_log_record *log, struct strbuf *buf);
+
+/*
+ * A stack of tables in a directory, listed oldest first in
+ * "tables.list". Writers hold "tables.list.lock" while they add a new
+ * table or compact existing ones.
+ */
+struct reftable_stack {
+	char *dir;
+	char *list_file;
+	struct reftable_table **tables;
+	size_t nr, alloc;
+	struct reftable_write_options opts;
+	int disable_auto_compact;
+};
+
+struct reftable_stack *reftable_stack_new(const char *dir);
+void reftable_stack_free(struct reftable_stack *st);
+
+/*
+ * Make sure that the stack reflects "tables.list". Return 0 on
+ * success, or -1 (after printing a message) on errors.
+ */
+int reftable_stack_reload(struct reftable_stack *st);
+
+/* The update index the next table added to the stack should use. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/*
+ * Lock the stack for writing and bring it up to date. On errors,
+ * write a message to `err` and return -1.
+ */
+int reftable_stack_lock(struct reftable_stack *st, struct lock_file *lock,
+			struct strbuf *err);
+
+/*
+ * Write `table` (as produced by reftable_writer_finish()) as the new
+ * top of the stack, which must be locked with `lock`, and release the
+ * lock. Then compact the stack if it has grown lopsided. On errors,
+ * write a message to `err` and return -1; the lock is released in any
+ * case.
+ */
+int reftable_stack_add(struct reftable_stack *st, struct lock_file *lock,
+		       struct strbuf *table, struct strbuf *err);
+
+/*
+ * Merge all tables of the stack into one, dropping deletion records.
+ */
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err);
+
+#endif /* REFS_REFTABLE_H */
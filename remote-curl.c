@@ -908,6 +908,15 @@ static int post_rpc(struct rpc_state *rpc, int flush_received)
 	}
 
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, headers);
+#if LIBCURL_VERSION_NUM >= 0x073500
+	/*
+	 * The response may be a whole pack. Take it in the largest
+	 * pieces curl can give, so that it reaches the client with as
+	 * few callbacks and writes to its pipe as possible, instead of
+	 * 16kB at a time.
+	 */
+	curl_easy_setopt(slot->curl, CURLOPT_BUFFERSIZE, CURL_MAX_READ_SIZE);
+#endif
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, rpc_in);
 	rpc_in_data.rpc = rpc;
 	rpc_in_data.slot = slot;
@@ -1892,6 +1892,23 @@ int resolve_remote_symref(struct ref *ref, struct ref *list)
  * commits are different.
  */
 
+/*
+ * Count the commits on either side of ours...theirs with the help of
+ * the commit-graph.  Returns -1 when it cannot.
+ */
+static int count_ahead_behind(struct commit *ours, struct commit *theirs,
+			      int *num_ours, int *num_theirs)
+{
+	struct commit *commits[2] = { ours, theirs };
+	struct ahead_behind_count count = { 0, 1 };
+
+	if (ahead_behind(the_repository, commits, 2, &count, 1))
+		return -1;
+	*num_ours = count.ahead;
+	*num_theirs = count.behind;
+	return 0;
+}
+
 static int stat_branch_pair(const char *branch_name, const char *base,
 			     int *num_ours, int *num_theirs,
 			     enum ahead_behind_flags abf)
@@ -1924,6 +1941,9 @@ static int stat_branch_pair(const char *branch_name, const char *base,
 	if (abf != AHEAD_BEHIND_FULL)
 		BUG("stat_branch_pair: invalid abf '%d'", abf);
 
+	if (!count_ahead_behind(ours, theirs, num_ours, num_theirs))
+		return 1;
+
 	/* Run "rev-list --left-right ours...theirs" internally... */
 	argv_array_push(&argv, ""); /* ignored */
 	argv_array_push(&argv, "--left-right");
@@ -1992,6 +2012,71 @@ int stat_tracking_info(struct branch *branch, int *num_ours, int *num_theirs,
 	return stat_branch_pair(branch->refname, base, num_ours, num_theirs, abf);
 }
 
+static struct commit *tracking_commit(const char *refname)
+{
+	struct object_id oid;
+
+	if (read_ref(refname, &oid))
+		return NULL;
+	return lookup_commit_reference(the_repository, &oid);
+}
+
+void stat_tracking_info_many(struct branch **branches, int nr, int for_push,
+			     struct tracking_stat *stats)
+{
+	struct commit **commits;
+	struct ahead_behind_count *counts;
+	int *index, i, counts_nr = 0;
+
+	ALLOC_ARRAY(commits, st_mult(nr, 2));
+	ALLOC_ARRAY(counts, nr);
+	ALLOC_ARRAY(index, nr);
+	for (i = 0; i < nr; i++) {
+		struct tracking_stat *stat = &stats[i];
+		const char *base = for_push ? branch_get_push(branches[i], NULL) :
+			branch_get_upstream(branches[i], NULL);
+		struct commit *ours, *theirs;
+
+		stat->ours = stat->theirs = 0;
+		stat->result = -1;
+		if (!base ||
+		    !(theirs = tracking_commit(base)) ||
+		    !(ours = tracking_commit(branches[i]->refname)))
+			continue;
+		stat->result = ours != theirs;
+		if (!stat->result)
+			continue;
+
+		commits[2 * counts_nr] = ours;
+		commits[2 * counts_nr + 1] = theirs;
+		counts[counts_nr].tip_index = 2 * counts_nr;
+		counts[counts_nr].base_index = 2 * counts_nr + 1;
+		index[counts_nr++] = i;
+	}
+
+	if (!ahead_behind(the_repository, commits, 2 * counts_nr,
+			  counts, counts_nr)) {
+		for (i = 0; i < counts_nr; i++) {
+			stats[index[i]].ours = counts[i].ahead;
+			stats[index[i]].theirs = counts[i].behind;
+		}
+	} else {
+		for (i = 0; i < counts_nr; i++) {
+			struct tracking_stat *stat = &stats[index[i]];
+
+			stat->result = stat_tracking_info(branches[index[i]],
+							  &stat->ours,
+							  &stat->theirs, NULL,
+							  for_push,
+							  AHEAD_BEHIND_FULL);
+		}
+	}
+
+	free(commits);
+	free(counts);
+	free(index);
+}
+
 /*
  * Return true when there is anything to report, otherwise false.
  */
@@ -257,6 +257,20 @@ enum ahead_behind_flags {
 int stat_tracking_info(struct branch *branch, int *num_ours, int *num_theirs,
 		       const char **upstream_name, int for_push,
 		       enum ahead_behind_flags abf);
+
+struct tracking_stat {
+	int result; /* as returned by stat_tracking_info() */
+	int ours, theirs;
+};
+
+/*
+ * Like stat_tracking_info() with AHEAD_BEHIND_FULL for each of the "nr"
+ * branches, storing the results in "stats".  When the commit-graph has
+ * generation numbers, the commits of all the pairs are counted in a
+ * single walk.
+ */
+void stat_tracking_info_many(struct branch **branches, int nr, int for_push,
+			     struct tracking_stat *stats);
 int format_tracking_info(struct branch *branch, struct strbuf *sb,
 			 enum ahead_behind_flags abf);
 
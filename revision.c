@@ -28,6 +28,9 @@
 #include "commit-graph.h"
 #include "prio-queue.h"
 #include "hashmap.h"
+#include "bloom.h"
+#include "json-writer.h"
+#include "ewah/ewok.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -350,17 +353,45 @@ void add_head_to_pending(struct rev_info *revs)
 	add_pending_object(revs, obj, "HEAD");
 }
 
+/*
+ * Return the commit "oid" from the commit-graph, if it is there and the
+ * object itself is present: neither its type nor its contents are read
+ * from the object store.
+ */
+static struct commit *present_commit_in_graph(struct repository *r,
+					      const struct object_id *oid)
+{
+	if (!repo_has_object_file(r, oid))
+		return NULL;
+	return lookup_commit_in_graph(r, oid);
+}
+
+/* Like parse_object(), but commits come from the commit-graph if possible. */
+static struct object *parse_object_via_graph(struct repository *r,
+					     const struct object_id *oid)
+{
+	struct commit *commit = present_commit_in_graph(r, oid);
+
+	if (commit)
+		return &commit->object;
+	return parse_object(r, oid);
+}
+
 static struct object *get_reference(struct rev_info *revs, const char *name,
 				    const struct object_id *oid,
 				    unsigned int flags)
 {
 	struct object *object;
+	struct commit *commit;
 
 	/*
 	 * If the repository has commit graphs, repo_parse_commit() avoids
-	 * reading the object buffer, so use it whenever possible.
+	 * reading the object buffer, so use it whenever possible; for a
+	 * commit in the graph, even finding out its type is not needed.
 	 */
-	if (oid_object_info(revs->repo, oid, NULL) == OBJ_COMMIT) {
+	if ((commit = present_commit_in_graph(revs->repo, oid))) {
+		object = &commit->object;
+	} else if (oid_object_info(revs->repo, oid, NULL) == OBJ_COMMIT) {
 		struct commit *c = lookup_commit(revs->repo, oid);
 		if (!repo_parse_commit(revs->repo, c))
 			object = (struct object *) c;
@@ -406,7 +437,7 @@ static struct commit *handle_commit(struct rev_info *revs,
 			add_pending_object(revs, object, tag->tag);
 		if (!tag->tagged)
 			die("bad tag");
-		object = parse_object(revs->repo, &tag->tagged->oid);
+		object = parse_object_via_graph(revs->repo, &tag->tagged->oid);
 		if (!object) {
 			if (revs->ignore_missing_links || (flags & UNINTERESTING))
 				return NULL;
@@ -621,9 +652,118 @@ static void file_change(struct diff_options *options,
 	options->flags.has_changes = 1;
 }
 
+static int bloom_filter_atexit_registered;
+static unsigned int count_bloom_filter_maybe;
+static unsigned int count_bloom_filter_definitely_not;
+static unsigned int count_bloom_filter_false_positive;
+static unsigned int count_bloom_filter_not_present;
+
+static void trace2_bloom_filter_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "filter_not_present", count_bloom_filter_not_present);
+	jw_object_intmax(&jw, "maybe", count_bloom_filter_maybe);
+	jw_object_intmax(&jw, "definitely_not", count_bloom_filter_definitely_not);
+	jw_object_intmax(&jw, "false_positive", count_bloom_filter_false_positive);
+	jw_end(&jw);
+
+	trace2_data_json("bloom", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
+static int forbid_bloom_filters(struct rev_info *revs)
+{
+	struct pathspec *spec = &revs->prune_data;
+
+	if (spec->nr != 1 || spec->has_wildcard)
+		return 1;
+	if (spec->magic & ~PATHSPEC_LITERAL)
+		return 1;
+	if (spec->items[0].magic & ~PATHSPEC_LITERAL)
+		return 1;
+	if (revs->diffopt.flags.follow_renames || revs->line_level_traverse)
+		return 1;
+	if (revs->reflog_info)
+		return 1;
+
+	return 0;
+}
+
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	struct pathspec_item *pi;
+	const char *path;
+	size_t len;
+
+	if (!revs->commits)
+		return;
+
+	if (forbid_bloom_filters(revs))
+		return;
+
+	repo_parse_commit(revs->repo, revs->commits->item);
+
+	revs->bloom_filter_settings = get_bloom_filter_settings(revs->repo);
+	if (!revs->bloom_filter_settings)
+		return;
+
+	pi = &revs->pruning.pathspec.items[0];
+	path = pi->match;
+	len = pi->len;
+
+	/* remove single trailing slash from path, if needed */
+	if (len && path[len - 1] == '/')
+		len--;
+	if (!len) {
+		revs->bloom_filter_settings = NULL;
+		return;
+	}
+
+	revs->bloom_key = xmalloc(sizeof(struct bloom_key));
+	fill_bloom_key(path, len, revs->bloom_key, revs->bloom_filter_settings);
+
+	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
+		atexit(trace2_bloom_filter_statistics_atexit);
+		bloom_filter_atexit_registered = 1;
+	}
+}
+
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter *filter;
+	int result;
+
+	if (commit->generation == GENERATION_NUMBER_INFINITY)
+		return -1;
+
+	filter = get_bloom_filter(revs->repo, commit, 0);
+
+	if (!filter) {
+		count_bloom_filter_not_present++;
+		return -1;
+	}
+
+	result = bloom_filter_contains(filter, revs->bloom_key,
+				       revs->bloom_filter_settings);
+
+	if (result)
+		count_bloom_filter_maybe++;
+	else
+		count_bloom_filter_definitely_not++;
+
+	return result;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
+	int bloom_ret = 1;
+
 	struct tree *t1 = get_commit_tree(parent);
 	struct tree *t2 = get_commit_tree(commit);
 
@@ -650,11 +790,27 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	/*
+	 * The changed-path Bloom filter of a commit describes its diff
+	 * against the first parent only.
+	 */
+	if (revs->bloom_key && !nth_parent) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+
+		if (bloom_ret == 0)
+			return REV_TREE_SAME;
+	}
+
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
 	if (diff_tree_oid(&t1->object.oid, &t2->object.oid, "",
 			   &revs->pruning) < 0)
 		return REV_TREE_DIFFERENT;
+
+	if (revs->bloom_key && !nth_parent && bloom_ret == 1 &&
+	    tree_difference == REV_TREE_SAME)
+		count_bloom_filter_false_positive++;
+
 	return tree_difference;
 }
 
@@ -852,7 +1008,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    oid_to_hex(&commit->object.oid),
 			    oid_to_hex(&p->object.oid));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -1405,7 +1561,8 @@ static void handle_one_reflog_commit(struct object_id *oid, void *cb_data)
 {
 	struct all_refs_cb *cb = cb_data;
 	if (!is_null_oid(oid)) {
-		struct object *o = parse_object(cb->all_revs->repo, oid);
+		struct object *o = parse_object_via_graph(cb->all_revs->repo,
+							  oid);
 		if (o) {
 			o->flags |= cb->all_flags;
 			/* ??? CMDLINEFLAGS ??? */
@@ -3106,12 +3263,25 @@ define_commit_slab(indegree_slab, int);
 define_commit_slab(author_date_slab, timestamp_t);
 
 struct topo_walk_info {
-	uint32_t min_generation;
+	timestamp_t min_generation;
 	struct prio_queue explore_queue;
 	struct prio_queue indegree_queue;
 	struct prio_queue topo_queue;
 	struct indegree_slab indegree;
 	struct author_date_slab author_date;
+
+	/*
+	 * Once the indegree walk reaches the commit-graph, it goes on by
+	 * graph position: the queue holds positions (plus one, so that
+	 * none is NULL), and their indegrees are kept in an array
+	 * indexed by position instead of "indegree".
+	 */
+	struct commit_graph *graph;
+	struct prio_queue graph_indegree_queue;
+	struct bitmap *graph_indegree_queued;
+	int *graph_indegree;
+	uint32_t *graph_parents;
+	size_t graph_parents_alloc;
 };
 
 static inline void test_flag_and_insert(struct prio_queue *q, struct commit *c, int flag)
@@ -3123,6 +3293,49 @@ static inline void test_flag_and_insert(struct prio_queue *q, struct commit *c,
 	prio_queue_put(q, c);
 }
 
+static int *indegree_at(struct topo_walk_info *info, struct commit *c)
+{
+	if (info->graph && c->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		return &info->graph_indegree[c->graph_pos];
+	return indegree_slab_at(&info->indegree, c);
+}
+
+static inline uint32_t graph_queue_pos(void *entry)
+{
+	return (uint32_t)((uintptr_t)entry - 1);
+}
+
+static int compare_graph_pos_by_gen(const void *a_, const void *b_,
+				    void *cb_data)
+{
+	struct commit_graph *g = cb_data;
+	timestamp_t a = commit_graph_generation_at(g, graph_queue_pos((void *)a_));
+	timestamp_t b = commit_graph_generation_at(g, graph_queue_pos((void *)b_));
+
+	return a < b ? 1 : a > b ? -1 : 0;
+}
+
+static void graph_indegree_insert(struct topo_walk_info *info, uint32_t pos)
+{
+	if (bitmap_get(info->graph_indegree_queued, pos))
+		return;
+
+	bitmap_set(info->graph_indegree_queued, pos);
+	prio_queue_put(&info->graph_indegree_queue, (void *)((uintptr_t)pos + 1));
+}
+
+/*
+ * Queue "c" for the indegree walk, by graph position if it is in the
+ * commit-graph.
+ */
+static void indegree_insert(struct topo_walk_info *info, struct commit *c)
+{
+	if (info->graph && c->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		graph_indegree_insert(info, c->graph_pos);
+	else
+		test_flag_and_insert(&info->indegree_queue, c, TOPO_WALK_INDEGREE);
+}
+
 static void explore_walk_step(struct rev_info *revs)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
@@ -3152,7 +3365,7 @@ static void explore_walk_step(struct rev_info *revs)
 }
 
 static void explore_to_depth(struct rev_info *revs,
-			     uint32_t gen_cutoff)
+			     timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3177,28 +3390,67 @@ static void indegree_walk_step(struct rev_info *revs)
 
 	for (p = c->parents; p; p = p->next) {
 		struct commit *parent = p->item;
-		int *pi = indegree_slab_at(&info->indegree, parent);
+		int *pi;
+
+		if (info->graph && parse_commit_gently(parent, 1) < 0)
+			continue;
 
+		pi = indegree_at(info, parent);
 		if (*pi)
 			(*pi)++;
 		else
 			*pi = 2;
 
-		test_flag_and_insert(&info->indegree_queue, parent, TOPO_WALK_INDEGREE);
+		indegree_insert(info, parent);
 
 		if (revs->first_parent_only)
 			return;
 	}
 }
 
+static void graph_indegree_walk_step(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	uint32_t pos = graph_queue_pos(prio_queue_get(&info->graph_indegree_queue));
+	int i, nr;
+
+	explore_to_depth(revs, commit_graph_generation_at(info->graph, pos));
+
+	nr = commit_graph_parents_at(info->graph, pos, &info->graph_parents,
+				     &info->graph_parents_alloc);
+	if (nr && revs->first_parent_only)
+		nr = 1;
+	for (i = 0; i < nr; i++) {
+		uint32_t parent = info->graph_parents[i];
+		int *pi = &info->graph_indegree[parent];
+
+		if (*pi)
+			(*pi)++;
+		else
+			*pi = 2;
+
+		graph_indegree_insert(info, parent);
+	}
+}
+
 static void compute_indegrees_to_depth(struct rev_info *revs,
-				       uint32_t gen_cutoff)
+				       timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
+	void *entry;
+
+	/*
+	 * Commits outside of the commit-graph have an infinite
+	 * generation; they all come before those in it.
+	 */
 	while ((c = prio_queue_peek(&info->indegree_queue)) &&
 	       c->generation >= gen_cutoff)
 		indegree_walk_step(revs);
+
+	while ((entry = prio_queue_peek(&info->graph_indegree_queue)) &&
+	       commit_graph_generation_at(info->graph, graph_queue_pos(entry)) >= gen_cutoff)
+		graph_indegree_walk_step(revs);
 }
 
 static void init_topo_walk(struct rev_info *revs)
@@ -3231,6 +3483,23 @@ static void init_topo_walk(struct rev_info *revs)
 	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
 	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
 
+	/*
+	 * History simplification rewrites the parents of the commits it
+	 * explores, and the indegrees have to follow what it leaves; the
+	 * commit-graph only knows about the real parents.
+	 */
+	if (!revs->prune && generation_numbers_enabled(revs->repo)) {
+		struct commit_graph *g = revs->repo->objects->commit_graph;
+
+		info->graph = g;
+		info->graph_indegree_queue.compare = compare_graph_pos_by_gen;
+		info->graph_indegree_queue.cb_data = g;
+		info->graph_indegree_queued = bitmap_new();
+		info->graph_indegree = xcalloc(st_add(g->num_commits,
+						      g->num_commits_in_base),
+					       sizeof(int));
+	}
+
 	info->min_generation = GENERATION_NUMBER_INFINITY;
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
@@ -3239,12 +3508,12 @@ static void init_topo_walk(struct rev_info *revs)
 			continue;
 
 		test_flag_and_insert(&info->explore_queue, c, TOPO_WALK_EXPLORED);
-		test_flag_and_insert(&info->indegree_queue, c, TOPO_WALK_INDEGREE);
+		indegree_insert(info, c);
 
 		if (c->generation < info->min_generation)
 			info->min_generation = c->generation;
 
-		*(indegree_slab_at(&info->indegree, c)) = 1;
+		*(indegree_at(info, c)) = 1;
 
 		if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
 			record_author_date(&info->author_date, c);
@@ -3254,7 +3523,7 @@ static void init_topo_walk(struct rev_info *revs)
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
 
-		if (*(indegree_slab_at(&info->indegree, c)) == 1)
+		if (*(indegree_at(info, c)) == 1)
 			prio_queue_put(&info->topo_queue, c);
 	}
 
@@ -3275,7 +3544,7 @@ static struct commit *next_topo_commit(struct rev_info *revs)
 	c = prio_queue_get(&info->topo_queue);
 
 	if (c)
-		*(indegree_slab_at(&info->indegree, c)) = 0;
+		*(indegree_at(info, c)) = 0;
 
 	return c;
 }
@@ -3305,7 +3574,7 @@ static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
 			compute_indegrees_to_depth(revs, info->min_generation);
 		}
 
-		pi = indegree_slab_at(&info->indegree, parent);
+		pi = indegree_at(info, parent);
 
 		(*pi)--;
 		if (*pi == 1)
@@ -3352,6 +3621,8 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
+	if (revs->prune)
+		prepare_to_use_bloom_filter(revs);
 	if (revs->limited) {
 		if (limit_list(revs) < 0)
 			return -1;
@@ -7,6 +7,7 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "quote.h"
+#include "config.h"
 
 void child_process_init(struct child_process *child)
 {
@@ -1374,6 +1375,22 @@ int run_hook_le(const char *const *env, const char *name, ...)
 	return ret;
 }
 
+int run_auto_maintenance(int quiet)
+{
+	int enabled;
+	struct child_process maint = CHILD_PROCESS_INIT;
+
+	if (!git_config_get_bool("maintenance.auto", &enabled) &&
+	    !enabled)
+		return 0;
+
+	maint.git_cmd = 1;
+	argv_array_pushl(&maint.args, "maintenance", "run", "--auto", NULL);
+	argv_array_push(&maint.args, quiet ? "--quiet" : "--no-quiet");
+
+	return run_command(&maint);
+}
+
 struct io_pump {
 	/* initialized by caller */
 	int fd;
@@ -1561,6 +1578,8 @@ struct parallel_processes {
 	struct pollfd *pfd;
 
 	unsigned shutdown : 1;
+	/* hand the whole output of each child to task_finished */
+	unsigned buffer_output : 1;
 
 	int output_owner;
 	struct strbuf buffered_output; /* of finished children */
@@ -1741,7 +1760,8 @@ static void pp_buffer_stderr(struct parallel_processes *pp, int output_timeout)
 static void pp_output(struct parallel_processes *pp)
 {
 	int i = pp->output_owner;
-	if (pp->children[i].state == GIT_CP_WORKING &&
+	if (!pp->buffer_output &&
+	    pp->children[i].state == GIT_CP_WORKING &&
 	    pp->children[i].err.len) {
 		strbuf_write(&pp->children[i].err, stderr);
 		strbuf_reset(&pp->children[i].err);
@@ -1805,11 +1825,11 @@ static int pp_collect_finished(struct parallel_processes *pp)
 	return result;
 }
 
-int run_processes_parallel(int n,
-			   get_next_task_fn get_next_task,
-			   start_failure_fn start_failure,
-			   task_finished_fn task_finished,
-			   void *pp_cb)
+static int run_processes_parallel_1(int n,
+				    get_next_task_fn get_next_task,
+				    start_failure_fn start_failure,
+				    task_finished_fn task_finished,
+				    void *pp_cb, int buffer_output)
 {
 	int i, code;
 	int output_timeout = 100;
@@ -1817,6 +1837,7 @@ int run_processes_parallel(int n,
 	struct parallel_processes pp;
 
 	pp_init(&pp, n, get_next_task, start_failure, task_finished, pp_cb);
+	pp.buffer_output = buffer_output;
 	while (1) {
 		for (i = 0;
 		    i < spawn_cap && !pp.shutdown &&
@@ -1847,6 +1868,16 @@ int run_processes_parallel(int n,
 	return 0;
 }
 
+int run_processes_parallel(int n,
+			   get_next_task_fn get_next_task,
+			   start_failure_fn start_failure,
+			   task_finished_fn task_finished,
+			   void *pp_cb)
+{
+	return run_processes_parallel_1(n, get_next_task, start_failure,
+					task_finished, pp_cb, 0);
+}
+
 int run_processes_parallel_tr2(int n, get_next_task_fn get_next_task,
 			       start_failure_fn start_failure,
 			       task_finished_fn task_finished, void *pp_cb,
@@ -1864,3 +1895,22 @@ int run_processes_parallel_tr2(int n, get_next_task_fn get_next_task,
 
 	return result;
 }
+
+int run_processes_parallel_buffered_tr2(int n, get_next_task_fn get_next_task,
+					start_failure_fn start_failure,
+					task_finished_fn task_finished,
+					void *pp_cb, const char *tr2_category,
+					const char *tr2_label)
+{
+	int result;
+
+	trace2_region_enter_printf(tr2_category, tr2_label, NULL, "max:%d",
+				   ((n < 1) ? online_cpus() : n));
+
+	result = run_processes_parallel_1(n, get_next_task, start_failure,
+					  task_finished, pp_cb, 1);
+
+	trace2_region_leave(tr2_category, tr2_label, NULL);
+
+	return result;
+}
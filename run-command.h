@@ -72,6 +72,12 @@ LAST_ARG_MUST_BE_NULL
 int run_hook_le(const char *const *env, const char *name, ...);
 int run_hook_ve(const char *const *env, const char *name, va_list args);
 
+/*
+ * Trigger the background-friendly replacement of 'git gc --auto':
+ * run 'git maintenance run --auto', unless maintenance.auto is false.
+ */
+int run_auto_maintenance(int quiet);
+
 #define RUN_COMMAND_NO_STDIN 1
 #define RUN_GIT_CMD	     2	/*If this is to be git sub-command */
 #define RUN_COMMAND_STDOUT_TO_STDERR 4
@@ -232,4 +238,14 @@ int run_processes_parallel_tr2(int n, get_next_task_fn, start_failure_fn,
 			       task_finished_fn, void *pp_cb,
 			       const char *tr2_category, const char *tr2_label);
 
+/*
+ * Like run_processes_parallel_tr2(), but the output of a child is never
+ * shown while it runs: all of it is handed to task_finished_fn, which
+ * can parse it and leave in "out" what should still be printed.
+ */
+int run_processes_parallel_buffered_tr2(int n, get_next_task_fn,
+					start_failure_fn, task_finished_fn,
+					void *pp_cb, const char *tr2_category,
+					const char *tr2_label);
+
 #endif
@@ -32,6 +32,7 @@
 #include "alias.h"
 #include "commit-reach.h"
 #include "rebase-interactive.h"
+#include "tree-merge.h"
 
 #define GIT_REFLOG_ACTION "GIT_REFLOG_ACTION"
 
@@ -141,6 +142,12 @@ static GIT_PATH_FUNC(rebase_path_squash_onto, "rebase-merge/squash-onto")
  * finishes. This is used by the `label` command to record the need for cleanup.
  */
 static GIT_PATH_FUNC(rebase_path_refs_to_delete, "rebase-merge/refs-to-delete")
+/*
+ * When the index and the working tree could not be caught up with the
+ * picks made in memory, this file records the commit they are still at,
+ * so that `git rebase --continue` can try again.
+ */
+static GIT_PATH_FUNC(rebase_path_in_memory_base, "rebase-merge/in-memory-base")
 
 /*
  * The following files are written by git-rebase just after parsing the
@@ -158,6 +165,7 @@ static GIT_PATH_FUNC(rebase_path_strategy, "rebase-merge/strategy")
 static GIT_PATH_FUNC(rebase_path_strategy_opts, "rebase-merge/strategy_opts")
 static GIT_PATH_FUNC(rebase_path_allow_rerere_autoupdate, "rebase-merge/allow_rerere_autoupdate")
 static GIT_PATH_FUNC(rebase_path_reschedule_failed_exec, "rebase-merge/reschedule-failed-exec")
+static GIT_PATH_FUNC(rebase_path_in_memory, "rebase-merge/in-memory")
 
 static int git_sequencer_config(const char *k, const char *v, void *cb)
 {
@@ -481,20 +489,15 @@ static void update_abort_safety_file(void)
 		write_file(git_path_abort_safety_file(), "%s", "");
 }
 
-static int fast_forward_to(struct repository *r,
-			   const struct object_id *to,
-			   const struct object_id *from,
-			   int unborn,
-			   struct replay_opts *opts)
+static int fast_forward_head(const struct object_id *to,
+			     const struct object_id *from,
+			     int unborn,
+			     struct replay_opts *opts)
 {
 	struct ref_transaction *transaction;
 	struct strbuf sb = STRBUF_INIT;
 	struct strbuf err = STRBUF_INIT;
 
-	repo_read_index(r);
-	if (checkout_fast_forward(r, from, to, 1))
-		return -1; /* the callee should have complained already */
-
 	strbuf_addf(&sb, _("%s: fast-forward"), _(action_name(opts)));
 
 	transaction = ref_transaction_begin(&err);
@@ -518,6 +521,19 @@ static int fast_forward_to(struct repository *r,
 	return 0;
 }
 
+static int fast_forward_to(struct repository *r,
+			   const struct object_id *to,
+			   const struct object_id *from,
+			   int unborn,
+			   struct replay_opts *opts)
+{
+	repo_read_index(r);
+	if (checkout_fast_forward(r, from, to, 1))
+		return -1; /* the callee should have complained already */
+
+	return fast_forward_head(to, from, unborn, opts);
+}
+
 enum commit_msg_cleanup_mode get_cleanup_mode(const char *cleanup_arg,
 	int use_editor)
 {
@@ -946,6 +962,10 @@ static int run_command_silent_on_success(struct child_process *cmd)
  * An exception is when run_git_commit() is called during an
  * interactive rebase: in that case, we will want to retain the
  * author metadata.
+ *
+ * Commits are normally made in-process by try_to_commit(); this is
+ * only used to write a new root commit, and to let 'git commit'
+ * explain why there is nothing to commit.
  */
 static int run_git_commit(struct repository *r,
 			  const char *defmsg,
@@ -1193,8 +1213,8 @@ void commit_post_rewrite(struct repository *r,
 }
 
 static int run_prepare_commit_msg_hook(struct repository *r,
-				       struct strbuf *msg,
-				       const char *commit)
+				       struct strbuf *msg, int editor_is_used,
+				       const char *source, const char *commit)
 {
 	struct argv_array hook_env = ARGV_ARRAY_INIT;
 	int ret;
@@ -1205,13 +1225,10 @@ static int run_prepare_commit_msg_hook(struct repository *r,
 		return -1;
 
 	argv_array_pushf(&hook_env, "GIT_INDEX_FILE=%s", r->index_file);
-	argv_array_push(&hook_env, "GIT_EDITOR=:");
-	if (commit)
-		ret = run_hook_le(hook_env.argv, "prepare-commit-msg", name,
-				  "commit", commit, NULL);
-	else
-		ret = run_hook_le(hook_env.argv, "prepare-commit-msg", name,
-				  "message", NULL);
+	if (!editor_is_used)
+		argv_array_push(&hook_env, "GIT_EDITOR=:");
+	ret = run_hook_le(hook_env.argv, "prepare-commit-msg", name,
+			  source, commit, NULL);
 	if (ret)
 		ret = error(_("'prepare-commit-msg' hook failed"));
 	argv_array_clear(&hook_env);
@@ -1364,13 +1381,94 @@ static int parse_head(struct repository *r, struct commit **head)
 }
 
 /*
- * Try to commit without forking 'git commit'. In some cases we need
- * to run 'git commit' to display an error message
+ * Append the parents recorded in MERGE_HEAD, if any, to "tail".
+ * Returns the number of parents appended, or -1 on error.
+ */
+static int append_merge_heads(struct repository *r,
+			      struct commit_list **tail)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *p, *end;
+	int nr = 0;
+
+	if (strbuf_read_file(&buf, git_path_merge_head(r), 0) < 0) {
+		strbuf_release(&buf);
+		return errno == ENOENT ? 0 :
+			error_errno(_("could not read '%s'"),
+				    git_path_merge_head(r));
+	}
+
+	for (p = buf.buf; *p; p = end) {
+		struct object_id oid;
+		struct commit *parent;
+
+		end = strchrnul(p, '\n');
+		if (*end)
+			end++;
+		if (get_oid_hex(p, &oid) ||
+		    !(parent = lookup_commit_reference(r, &oid))) {
+			nr = error(_("corrupt MERGE_HEAD file (%s)"),
+				   git_path_merge_head(r));
+			break;
+		}
+		tail = commit_list_append(parent, tail);
+		nr++;
+	}
+	strbuf_release(&buf);
+	return nr;
+}
+
+/*
+ * Append the usual instructions for the editor to a commit message.
+ */
+static void append_edit_instructions(struct strbuf *msg,
+				     enum commit_msg_cleanup_mode cleanup)
+{
+	strbuf_complete_line(msg);
+	strbuf_addch(msg, '\n');
+	if (cleanup == COMMIT_MSG_CLEANUP_SCISSORS)
+		wt_status_append_cut_line(msg);
+	else if (cleanup == COMMIT_MSG_CLEANUP_ALL)
+		strbuf_commented_addf(msg,
+			_("Please enter the commit message for your changes."
+			  " Lines starting\nwith '%c' will be ignored, and an empty"
+			  " message aborts the commit.\n"), comment_line_char);
+	else
+		strbuf_commented_addf(msg,
+			_("Please enter the commit message for your changes."
+			  " Lines starting\n"
+			  "with '%c' will be kept; you may remove them"
+			  " yourself if you want to.\n"
+			  "An empty message aborts the commit.\n"),
+			comment_line_char);
+}
+
+static enum commit_msg_cleanup_mode commit_cleanup_mode(struct replay_opts *opts,
+							unsigned int flags)
+{
+	if (flags & CLEANUP_MSG)
+		return COMMIT_MSG_CLEANUP_ALL;
+	if (opts->explicit_cleanup)
+		return opts->default_msg_cleanup;
+	if (flags & EDIT_MSG)
+		return COMMIT_MSG_CLEANUP_ALL;
+	if (opts->signoff || opts->record_origin)
+		return COMMIT_MSG_CLEANUP_SPACE;
+	return opts->default_msg_cleanup;
+}
+
+/*
+ * Try to commit without forking 'git commit'. The hooks and the editor
+ * are run the way 'git commit' would run them, but only when they are
+ * wanted. In some cases we need to run 'git commit' to display an error
+ * message.
  *
  * Returns:
  *  -1 - error unable to commit
  *   0 - success
  *   1 - run 'git commit'
+ *   2 - the commit was aborted by a hook, the editor or an empty
+ *       message; the reason has already been reported
  */
 static int try_to_commit(struct repository *r,
 			 struct strbuf *msg, const char *author,
@@ -1378,13 +1476,18 @@ static int try_to_commit(struct repository *r,
 			 struct object_id *oid)
 {
 	struct object_id tree;
+	const struct object_id *parent_tree;
 	struct commit *current_head;
 	struct commit_list *parents = NULL;
 	struct commit_extra_header *extra = NULL;
 	struct strbuf err = STRBUF_INIT;
 	struct strbuf commit_msg = STRBUF_INIT;
 	char *amend_author = NULL;
+	const char *hook_source = "message";
 	const char *hook_commit = NULL;
+	int editor_is_used = !!(flags & EDIT_MSG);
+	int verify = !!(flags & VERIFY_MSG);
+	int msg_in_file = 0, is_merge = 0;
 	enum commit_msg_cleanup_mode cleanup;
 	int res = 0;
 
@@ -1403,6 +1506,7 @@ static int try_to_commit(struct repository *r,
 			find_commit_subject(message, &orig_message);
 			msg = &commit_msg;
 			strbuf_addstr(msg, orig_message);
+			hook_source = "commit";
 			hook_commit = "HEAD";
 		}
 		author = amend_author = get_author(message);
@@ -1413,8 +1517,36 @@ static int try_to_commit(struct repository *r,
 		}
 		parents = copy_commit_list(current_head->parents);
 		extra = read_commit_extra_headers(current_head, exclude_gpgsig);
-	} else if (current_head) {
-		commit_list_insert(current_head, &parents);
+		is_merge = parents && parents->next;
+		if (parents && parse_commit(parents->item)) {
+			res = error(_("could not parse parent commit %s"),
+				    oid_to_hex(&parents->item->object.oid));
+			goto out;
+		}
+		parent_tree = parents ? get_commit_tree_oid(parents->item) :
+			the_hash_algo->empty_tree;
+	} else {
+		if (current_head)
+			commit_list_insert(current_head, &parents);
+		is_merge = append_merge_heads(r, current_head ?
+					      &parents->next : &parents);
+		if (is_merge < 0) {
+			res = -1;
+			goto out;
+		}
+		parent_tree = current_head ? get_commit_tree_oid(current_head) :
+			the_hash_algo->empty_tree;
+		if (!msg) {
+			if (strbuf_read_file(&commit_msg, git_path_merge_msg(r),
+					     2048) < 0) {
+				res = error_errno(_("unable to read commit "
+						    "message from '%s'"),
+						  git_path_merge_msg(r));
+				goto out;
+			}
+			msg = &commit_msg;
+			hook_source = "merge";
+		}
 	}
 
 	if (write_index_as_tree(&tree, r->index, r->index_file, 0, NULL)) {
@@ -1422,17 +1554,71 @@ static int try_to_commit(struct repository *r,
 		goto out;
 	}
 
-	if (!(flags & ALLOW_EMPTY) && oideq(current_head ?
-					    get_commit_tree_oid(current_head) :
-					    the_hash_algo->empty_tree, &tree)) {
+	if (!(flags & ALLOW_EMPTY) && !is_merge && oideq(parent_tree, &tree)) {
 		res = 1; /* run 'git commit' to display error message */
 		goto out;
 	}
 
+	if (verify && find_hook("pre-commit")) {
+		if (run_commit_hook(editor_is_used, r->index_file,
+				    "pre-commit", NULL)) {
+			res = 2;
+			goto out;
+		}
+		/* the hook may have updated the index */
+		discard_index(r->index);
+		if (write_index_as_tree(&tree, r->index, r->index_file,
+					0, NULL)) {
+			res = error(_("git write-tree failed to write a tree"));
+			goto out;
+		}
+	}
+
+	cleanup = commit_cleanup_mode(opts, flags);
+	if (editor_is_used)
+		append_edit_instructions(msg, cleanup);
+
 	if (find_hook("prepare-commit-msg")) {
-		res = run_prepare_commit_msg_hook(r, msg, hook_commit);
+		res = run_prepare_commit_msg_hook(r, msg, editor_is_used,
+						  hook_source, hook_commit);
 		if (res)
 			goto out;
+		msg_in_file = 1;
+	}
+
+	if (editor_is_used || (verify && find_hook("commit-msg"))) {
+		if (!msg_in_file &&
+		    write_message(msg->buf, msg->len,
+				  git_path_commit_editmsg(), 0)) {
+			res = -1;
+			goto out;
+		}
+		msg_in_file = 1;
+	}
+
+	if (editor_is_used) {
+		struct argv_array env = ARGV_ARRAY_INIT;
+
+		argv_array_pushf(&env, "GIT_INDEX_FILE=%s", r->index_file);
+		res = launch_editor(git_path_commit_editmsg(), NULL, env.argv);
+		argv_array_clear(&env);
+		if (res) {
+			fprintf(stderr, _("Please supply the message using "
+					  "either -m or -F option.\n"));
+			res = 2;
+			goto out;
+		}
+	}
+
+	if (verify && run_commit_hook(editor_is_used, r->index_file,
+				      "commit-msg", git_path_commit_editmsg(),
+				      NULL)) {
+		res = 2;
+		goto out;
+	}
+
+	if (msg_in_file) {
+		strbuf_reset(&commit_msg);
 		if (strbuf_read_file(&commit_msg, git_path_commit_editmsg(),
 				     2048) < 0) {
 			res = error_errno(_("unable to read commit message "
@@ -1443,25 +1629,20 @@ static int try_to_commit(struct repository *r,
 		msg = &commit_msg;
 	}
 
-	if (flags & CLEANUP_MSG)
-		cleanup = COMMIT_MSG_CLEANUP_ALL;
-	else if ((opts->signoff || opts->record_origin) &&
-		 !opts->explicit_cleanup)
-		cleanup = COMMIT_MSG_CLEANUP_SPACE;
-	else
-		cleanup = opts->default_msg_cleanup;
-
-	if (cleanup != COMMIT_MSG_CLEANUP_NONE)
-		strbuf_stripspace(msg, cleanup == COMMIT_MSG_CLEANUP_ALL);
-	if ((flags & EDIT_MSG) && message_is_empty(msg, cleanup)) {
-		res = 1; /* run 'git commit' to display error message */
+	cleanup_message(msg, cleanup, 0);
+	if (editor_is_used && message_is_empty(msg, cleanup)) {
+		fprintf(stderr,
+			_("Aborting commit due to empty commit message.\n"));
+		res = 2;
 		goto out;
 	}
 
 	reset_ident_date();
 
-	if (commit_tree_extended(msg->buf, msg->len, &tree, parents,
-				 oid, author, opts->gpg_sign, extra)) {
+	res = commit_tree_extended(msg->buf, msg->len, &tree, parents,
+				   oid, author, opts->gpg_sign, extra);
+	parents = NULL; /* consumed by commit_tree_extended() */
+	if (res) {
 		res = error(_("failed to write commit object"));
 		goto out;
 	}
@@ -1472,10 +1653,12 @@ static int try_to_commit(struct repository *r,
 		goto out;
 	}
 
+	run_commit_hook(editor_is_used, r->index_file, "post-commit", NULL);
 	if (flags & AMEND_MSG)
 		commit_post_rewrite(r, current_head, oid);
 
 out:
+	free_commit_list(parents);
 	free_commit_extra_headers(extra);
 	strbuf_release(&err);
 	strbuf_release(&commit_msg);
@@ -1488,36 +1671,69 @@ static int do_commit(struct repository *r,
 		     const char *msg_file, const char *author,
 		     struct replay_opts *opts, unsigned int flags)
 {
-	int res = 1;
+	struct object_id oid;
+	struct strbuf sb = STRBUF_INIT;
+	int res;
 
-	if (!(flags & EDIT_MSG) && !(flags & VERIFY_MSG) &&
-	    !(flags & CREATE_ROOT_COMMIT)) {
-		struct object_id oid;
-		struct strbuf sb = STRBUF_INIT;
+	/*
+	 * A new root commit on top of "squash-onto" is written directly
+	 * by run_git_commit().
+	 */
+	if ((flags & CREATE_ROOT_COMMIT) && !(flags & AMEND_MSG))
+		return run_git_commit(r, msg_file, opts, flags);
 
-		if (msg_file && strbuf_read_file(&sb, msg_file, 2048) < 0)
-			return error_errno(_("unable to read commit message "
-					     "from '%s'"),
-					   msg_file);
+	if (msg_file && strbuf_read_file(&sb, msg_file, 2048) < 0)
+		return error_errno(_("unable to read commit message "
+				     "from '%s'"),
+				   msg_file);
 
-		res = try_to_commit(r, msg_file ? &sb : NULL,
-				    author, opts, flags, &oid);
-		strbuf_release(&sb);
-		if (!res) {
-			unlink(git_path_cherry_pick_head(r));
-			unlink(git_path_merge_msg(r));
-			if (!is_rebase_i(opts))
-				print_commit_summary(r, NULL, &oid,
-						SUMMARY_SHOW_AUTHOR_DATE);
-			return res;
-		}
+	res = try_to_commit(r, msg_file ? &sb : NULL,
+			    author, opts, flags, &oid);
+	strbuf_release(&sb);
+	if (!res) {
+		unlink(git_path_cherry_pick_head(r));
+		unlink(git_path_merge_head(r));
+		unlink(git_path_merge_msg(r));
+		unlink(git_path_merge_mode(r));
+		unlink(git_path_squash_msg(r));
+		if (!is_rebase_i(opts) || (flags & EDIT_MSG))
+			print_commit_summary(r, NULL, &oid,
+					SUMMARY_SHOW_AUTHOR_DATE);
+		return res;
 	}
 	if (res == 1)
 		return run_git_commit(r, msg_file, opts, flags);
+	if (res == 2)
+		return 1;
 
 	return res;
 }
 
+/*
+ * Commit what is staged during an interactive rebase, taking the author
+ * from the author-script unless we are amending.
+ */
+static int do_commit_with_author_script(struct repository *r,
+					const char *msg_file,
+					struct replay_opts *opts,
+					unsigned int flags)
+{
+	struct strbuf script = STRBUF_INIT;
+	const char *author = NULL;
+	int res;
+
+	if (!(flags & AMEND_MSG) && !(author = read_author_ident(&script))) {
+		const char *gpg_opt = gpg_sign_opt_quoted(opts);
+
+		strbuf_release(&script);
+		return error(_(staged_changes_advice), gpg_opt, gpg_opt);
+	}
+
+	res = do_commit(r, msg_file, author, opts, flags);
+	strbuf_release(&script);
+	return res;
+}
+
 static int is_original_commit_empty(struct commit *commit)
 {
 	const struct object_id *ptree_oid;
@@ -1771,6 +1987,146 @@ static void record_in_rewritten(struct object_id *oid,
 		flush_rewritten_pending();
 }
 
+/*
+ * Bring the index and the working tree up to date with the picks made
+ * by pick_in_memory().  If that fails, remember where they are so that
+ * `git rebase --continue` can try again.
+ */
+static int catch_up_in_memory_picks(struct repository *r,
+				    struct replay_opts *opts)
+{
+	struct object_id head;
+
+	if (!opts->in_memory_pending)
+		return 0;
+
+	if (get_oid("HEAD", &head))
+		return error(_("cannot read HEAD"));
+	trace2_region_enter("sequencer", "catch_up", r);
+	repo_read_index(r);
+	if (checkout_fast_forward(r, &opts->in_memory_base, &head, 1)) {
+		trace2_region_leave("sequencer", "catch_up", r);
+		write_file(rebase_path_in_memory_base(), "%s",
+			   oid_to_hex(&opts->in_memory_base));
+		return error(_("could not update the index and the working "
+			       "tree from %s to %s; fix the problem above and "
+			       "run 'git rebase --continue'"),
+			     oid_to_hex(&opts->in_memory_base),
+			     oid_to_hex(&head));
+	}
+	trace2_region_leave("sequencer", "catch_up", r);
+
+	opts->in_memory_pending = 0;
+	unlink(rebase_path_in_memory_base());
+	return 0;
+}
+
+/*
+ * Pick up where catch_up_in_memory_picks() failed in an earlier
+ * process, if it did.
+ */
+static int resume_in_memory_picks(struct repository *r,
+				  struct replay_opts *opts)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (!read_oneliner(&buf, rebase_path_in_memory_base(), 0))
+		return 0;
+	if (get_oid_hex(buf.buf, &opts->in_memory_base)) {
+		strbuf_release(&buf);
+		return error(_("invalid contents: '%s'"),
+			     rebase_path_in_memory_base());
+	}
+	strbuf_release(&buf);
+	opts->in_memory_pending = 1;
+	return catch_up_in_memory_picks(r, opts);
+}
+
+/*
+ * Pick "commit" on top of HEAD by merging the trees in the object store,
+ * without touching the index or the working tree; they are caught up by
+ * catch_up_in_memory_picks() before anything else needs them.
+ *
+ * Returns 0 when the commit was picked, 1 when it needs the regular code
+ * path (a real merge, an empty result, hooks...) and -1 on error.
+ */
+static int pick_in_memory(struct repository *r, struct commit *commit,
+			  struct replay_opts *opts)
+{
+	struct object_id head, tree, oid;
+	struct commit *head_commit, *parent;
+	struct commit_list *parents = NULL;
+	struct commit_message msg = { NULL, NULL, NULL, NULL };
+	struct strbuf msgbuf = STRBUF_INIT, err = STRBUF_INIT;
+	char *author = NULL;
+	const char *p;
+	int res;
+
+	if (!commit->parents || commit->parents->next ||
+	    (opts->strategy && strcmp(opts->strategy, "recursive")) ||
+	    opts->xopts_nr ||
+	    find_hook("prepare-commit-msg") || find_hook("post-commit") ||
+	    get_oid("HEAD", &head) ||
+	    (opts->have_squash_onto && oideq(&head, &opts->squash_onto)))
+		return 1;
+	if (!opts->in_memory_pending && index_differs_from(r, "HEAD", NULL, 0))
+		return 1;
+
+	parent = commit->parents->item;
+	head_commit = lookup_commit_reference(r, &head);
+	if (!head_commit || parse_commit(parent))
+		return 1;
+
+	if (opts->allow_ff && oideq(&parent->object.oid, &head)) {
+		res = fast_forward_head(&commit->object.oid, &head, 0, opts);
+		goto done;
+	}
+
+	res = merge_trees_in_object_store(r, get_commit_tree_oid(parent),
+					  get_commit_tree_oid(head_commit),
+					  get_commit_tree_oid(commit), &tree);
+	if (res)
+		return res;
+	/* let the regular code path decide what to do with empty picks */
+	if (oideq(&tree, get_commit_tree_oid(head_commit)))
+		return 1;
+
+	if (get_message(commit, &msg))
+		return 1;
+	author = get_author(msg.message);
+	if (!author) {
+		free_message(commit, &msg);
+		return 1;
+	}
+	find_commit_subject(msg.message, &p);
+	strbuf_addstr(&msgbuf, p);
+	if (opts->signoff)
+		append_signoff(&msgbuf, 0, 0);
+	cleanup_message(&msgbuf, commit_cleanup_mode(opts, 0), 0);
+
+	reset_ident_date();
+	commit_list_insert(head_commit, &parents);
+	if (commit_tree(msgbuf.buf, msgbuf.len, &tree, parents, &oid,
+			author, opts->gpg_sign))
+		res = error(_("failed to write commit object"));
+	else if (update_head_with_reflog(head_commit, &oid,
+					 getenv("GIT_REFLOG_ACTION"),
+					 &msgbuf, &err))
+		res = error("%s", err.buf);
+
+	free_message(commit, &msg);
+	free(author);
+	strbuf_release(&msgbuf);
+	strbuf_release(&err);
+
+done:
+	if (!res && !opts->in_memory_pending) {
+		oidcpy(&opts->in_memory_base, &head);
+		opts->in_memory_pending = 1;
+	}
+	return res;
+}
+
 static int do_pick_commit(struct repository *r,
 			  enum todo_command command,
 			  struct commit *commit,
@@ -1787,6 +2143,14 @@ static int do_pick_commit(struct repository *r,
 	struct strbuf msgbuf = STRBUF_INIT;
 	int res, unborn = 0, allow;
 
+	if (opts->in_memory && command == TODO_PICK && is_rebase_i(opts)) {
+		res = pick_in_memory(r, commit, opts);
+		if (!res)
+			return 0;
+		if (catch_up_in_memory_picks(r, opts) || res < 0)
+			return -1;
+	}
+
 	if (opts->no_commit) {
 		/*
 		 * We do not intend to commit immediately.  We just want to
@@ -2535,6 +2899,9 @@ static int read_populate_opts(struct replay_opts *opts)
 		if (file_exists(rebase_path_reschedule_failed_exec()))
 			opts->reschedule_failed_exec = 1;
 
+		if (file_exists(rebase_path_in_memory()))
+			opts->in_memory = 1;
+
 		read_strategy_opts(opts, &buf);
 		strbuf_release(&buf);
 
@@ -2616,6 +2983,8 @@ int write_basic_state(struct replay_opts *opts, const char *head_name,
 		write_file(rebase_path_signoff(), "--signoff\n");
 	if (opts->reschedule_failed_exec)
 		write_file(rebase_path_reschedule_failed_exec(), "%s", "");
+	if (opts->in_memory)
+		write_file(rebase_path_in_memory(), "%s", "");
 
 	return 0;
 }
@@ -3617,8 +3986,8 @@ static int do_merge(struct repository *r,
 		 * command needs to be rescheduled).
 		 */
 	fast_forward_edit:
-		ret = !!run_git_commit(r, git_path_merge_msg(r), opts,
-				       run_commit_flags);
+		ret = !!do_commit_with_author_script(r, git_path_merge_msg(r),
+						     opts, run_commit_flags);
 
 leave_merge:
 	strbuf_release(&ref_name);
@@ -3819,6 +4188,9 @@ static int pick_commits(struct repository *r,
 		struct todo_item *item = todo_list->items + todo_list->current;
 		const char *arg = todo_item_get_arg(todo_list, item);
 
+		if (item->command != TODO_PICK && !is_noop(item->command) &&
+		    catch_up_in_memory_picks(r, opts))
+			return -1;
 		if (save_todo(todo_list, opts))
 			return -1;
 		if (is_rebase_i(opts)) {
@@ -3977,6 +4349,9 @@ static int pick_commits(struct repository *r,
 			return res;
 	}
 
+	if (catch_up_in_memory_picks(r, opts))
+		return -1;
+
 	if (is_rebase_i(opts)) {
 		struct strbuf head_ref = STRBUF_INIT, buf = STRBUF_INIT;
 		struct stat st;
@@ -4222,9 +4597,11 @@ static int commit_staged_changes(struct repository *r,
 			return 0;
 	}
 
-	if (run_git_commit(r, final_fixup ? NULL : rebase_path_message(),
-			   opts, flags))
+	if (do_commit_with_author_script(r, final_fixup ?
+					 NULL : rebase_path_message(),
+					 opts, flags))
 		return error(_("could not commit staged changes."));
+	repo_rerere(r, 0);
 	unlink(rebase_path_amend());
 	unlink(git_path_merge_head(r));
 	if (final_fixup) {
@@ -4256,6 +4633,10 @@ int sequencer_continue(struct repository *r, struct replay_opts *opts)
 	if (is_rebase_i(opts)) {
 		if ((res = read_populate_todo(r, &todo_list, opts)))
 			goto release_todo_list;
+		if (resume_in_memory_picks(r, opts)) {
+			res = -1;
+			goto release_todo_list;
+		}
 		if (commit_staged_changes(r, opts, &todo_list))
 			return -1;
 	} else if (!file_exists(get_todo_path(opts)))
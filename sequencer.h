@@ -43,6 +43,7 @@ struct replay_opts {
 	int verbose;
 	int quiet;
 	int reschedule_failed_exec;
+	int in_memory;
 
 	int mainline;
 
@@ -63,6 +64,13 @@ struct replay_opts {
 	struct object_id squash_onto;
 	int have_squash_onto;
 
+	/*
+	 * With "in_memory", picks only move HEAD; the index and the
+	 * working tree stay at "in_memory_base" until they are needed.
+	 */
+	struct object_id in_memory_base;
+	int in_memory_pending;
+
 	/* Only used by REPLAY_NONE */
 	struct rev_info *revs;
 };
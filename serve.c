@@ -158,40 +158,38 @@ enum request_state {
 	PROCESS_REQUEST_DONE,
 };
 
-static int process_request(void)
+static int process_request(struct packet_reader *reader)
 {
 	enum request_state state = PROCESS_REQUEST_KEYS;
-	struct packet_reader reader;
 	struct argv_array keys = ARGV_ARRAY_INIT;
 	struct protocol_capability *command = NULL;
 
-	packet_reader_init(&reader, 0, NULL, 0,
-			   PACKET_READ_CHOMP_NEWLINE |
-			   PACKET_READ_GENTLE_ON_EOF |
-			   PACKET_READ_DIE_ON_ERR_PACKET);
+	reader->options = PACKET_READ_CHOMP_NEWLINE |
+			  PACKET_READ_GENTLE_ON_EOF |
+			  PACKET_READ_DIE_ON_ERR_PACKET;
 
 	/*
 	 * Check to see if the client closed their end before sending another
 	 * request.  If so we can terminate the connection.
 	 */
-	if (packet_reader_peek(&reader) == PACKET_READ_EOF)
+	if (packet_reader_peek(reader) == PACKET_READ_EOF)
 		return 1;
-	reader.options &= ~PACKET_READ_GENTLE_ON_EOF;
+	reader->options &= ~PACKET_READ_GENTLE_ON_EOF;
 
 	while (state != PROCESS_REQUEST_DONE) {
-		switch (packet_reader_peek(&reader)) {
+		switch (packet_reader_peek(reader)) {
 		case PACKET_READ_EOF:
 			BUG("Should have already died when seeing EOF");
 		case PACKET_READ_NORMAL:
 			/* collect request; a sequence of keys and values */
-			if (is_command(reader.line, &command) ||
-			    is_valid_capability(reader.line))
-				argv_array_push(&keys, reader.line);
+			if (is_command(reader->line, &command) ||
+			    is_valid_capability(reader->line))
+				argv_array_push(&keys, reader->line);
 			else
-				die("unknown capability '%s'", reader.line);
+				die("unknown capability '%s'", reader->line);
 
 			/* Consume the peeked line */
-			packet_reader_read(&reader);
+			packet_reader_read(reader);
 			break;
 		case PACKET_READ_FLUSH:
 			/*
@@ -213,7 +211,7 @@ static int process_request(void)
 			break;
 		case PACKET_READ_DELIM:
 			/* Consume the peeked line */
-			packet_reader_read(&reader);
+			packet_reader_read(reader);
 
 			state = PROCESS_REQUEST_DONE;
 			break;
@@ -223,7 +221,7 @@ static int process_request(void)
 	if (!command)
 		die("no command requested");
 
-	command->command(the_repository, &keys, &reader);
+	command->command(the_repository, &keys, reader);
 
 	argv_array_clear(&keys);
 	return 0;
@@ -232,6 +230,8 @@ static int process_request(void)
 /* Main serve loop for protocol version 2 */
 void serve(struct serve_options *options)
 {
+	struct packet_reader reader;
+
 	if (options->advertise_capabilities || !options->stateless_rpc) {
 		/* serve by default supports v2 */
 		packet_write_fmt(1, "version 2\n");
@@ -245,15 +245,29 @@ void serve(struct serve_options *options)
 			return;
 	}
 
+	/*
+	 * Unless the caller has the request at hand, all requests come
+	 * in on stdin and are read with this one reader, so it can read
+	 * ahead.
+	 */
+	if (options->request) {
+		packet_reader_init(&reader, -1, options->request,
+				   options->request_len, 0);
+	} else {
+		packet_reader_init(&reader, 0, NULL, 0, 0);
+		packet_reader_enable_read_ahead(&reader);
+	}
+
 	/*
 	 * If stateless-rpc was requested then exit after
 	 * a single request/response exchange
 	 */
 	if (options->stateless_rpc) {
-		process_request();
+		process_request(&reader);
 	} else {
 		for (;;)
-			if (process_request())
+			if (process_request(&reader))
 				break;
 	}
+	packet_reader_release(&reader);
 }
@@ -8,6 +8,10 @@ int has_capability(const struct argv_array *keys, const char *capability,
 struct serve_options {
 	unsigned advertise_capabilities;
 	unsigned stateless_rpc;
+
+	/* If set, the request is read from here instead of stdin. */
+	char *request;
+	size_t request_len;
 };
 #define SERVE_OPTIONS_INIT { 0 }
 void serve(struct serve_options *options);
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "sha1-array.h"
 #include "sha1-lookup.h"
+#include "radix-sort.h"
 
 void oid_array_append(struct oid_array *array, const struct object_id *oid)
 {
@@ -14,9 +15,14 @@ static int void_hashcmp(const void *a, const void *b)
 	return oidcmp(a, b);
 }
 
+static const unsigned char *oid_hash(const void *oid)
+{
+	return ((const struct object_id *)oid)->hash;
+}
+
 static void oid_array_sort(struct oid_array *array)
 {
-	QSORT(array->oid, array->nr, void_hashcmp);
+	RADIX_SORT_BY_HASH(array->oid, array->nr, oid_hash, void_hashcmp);
 	array->sorted = 1;
 }
 
@@ -15,6 +15,7 @@
 #include "submodule.h"
 #include "midx.h"
 #include "commit-reach.h"
+#include "commit-graph.h"
 
 static int get_oid_oneline(struct repository *r, const char *, struct object_id *, struct commit_list *);
 
@@ -227,11 +228,28 @@ static int finish_object_disambiguation(struct disambiguate_state *ds,
 	return 0;
 }
 
+/*
+ * The type of a candidate, without reading it when we can help it:
+ * objects we have already seen know their type, and the commit-graph
+ * knows its commits.
+ */
+static int candidate_type(struct repository *r, const struct object_id *oid)
+{
+	struct object *obj = lookup_object(r, oid);
+	timestamp_t date;
+
+	if (obj && obj->type != OBJ_NONE)
+		return obj->type;
+	if (commit_graph_commit_date(r, oid, &date))
+		return OBJ_COMMIT;
+	return oid_object_info(r, oid, NULL);
+}
+
 static int disambiguate_commit_only(struct repository *r,
 				    const struct object_id *oid,
 				    void *cb_data_unused)
 {
-	int kind = oid_object_info(r, oid, NULL);
+	int kind = candidate_type(r, oid);
 	return kind == OBJ_COMMIT;
 }
 
@@ -242,7 +260,7 @@ static int disambiguate_committish_only(struct repository *r,
 	struct object *obj;
 	int kind;
 
-	kind = oid_object_info(r, oid, NULL);
+	kind = candidate_type(r, oid);
 	if (kind == OBJ_COMMIT)
 		return 1;
 	if (kind != OBJ_TAG)
@@ -259,7 +277,7 @@ static int disambiguate_tree_only(struct repository *r,
 				  const struct object_id *oid,
 				  void *cb_data_unused)
 {
-	int kind = oid_object_info(r, oid, NULL);
+	int kind = candidate_type(r, oid);
 	return kind == OBJ_TREE;
 }
 
@@ -270,7 +288,7 @@ static int disambiguate_treeish_only(struct repository *r,
 	struct object *obj;
 	int kind;
 
-	kind = oid_object_info(r, oid, NULL);
+	kind = candidate_type(r, oid);
 	if (kind == OBJ_TREE || kind == OBJ_COMMIT)
 		return 1;
 	if (kind != OBJ_TAG)
@@ -287,7 +305,7 @@ static int disambiguate_blob_only(struct repository *r,
 				  const struct object_id *oid,
 				  void *cb_data_unused)
 {
-	int kind = oid_object_info(r, oid, NULL);
+	int kind = candidate_type(r, oid);
 	return kind == OBJ_BLOB;
 }
 
@@ -406,8 +424,8 @@ static int repo_collect_ambiguous(struct repository *r,
 static struct repository *sort_ambiguous_repo;
 static int sort_ambiguous(const void *a, const void *b)
 {
-	int a_type = oid_object_info(sort_ambiguous_repo, a, NULL);
-	int b_type = oid_object_info(sort_ambiguous_repo, b, NULL);
+	int a_type = candidate_type(sort_ambiguous_repo, a);
+	int b_type = candidate_type(sort_ambiguous_repo, b);
 	int a_type_sort;
 	int b_type_sort;
 
@@ -670,8 +688,8 @@ static void find_abbrev_len_packed(struct min_abbrev_data *mad)
 		find_abbrev_len_for_pack(p, mad);
 }
 
-int repo_find_unique_abbrev_r(struct repository *r, char *hex,
-			      const struct object_id *oid, int len)
+static int find_unique_abbrev_r_1(struct repository *r, char *hex,
+				  const struct object_id *oid, int len)
 {
 	struct disambiguate_state ds;
 	struct min_abbrev_data mad;
@@ -726,6 +744,18 @@ int repo_find_unique_abbrev_r(struct repository *r, char *hex,
 	return mad.cur_len;
 }
 
+int repo_find_unique_abbrev_r(struct repository *r, char *hex,
+			      const struct object_id *oid, int len)
+{
+	int ret;
+
+	/* the loose object cache is filled as we go */
+	obj_read_lock();
+	ret = find_unique_abbrev_r_1(r, hex, oid, len);
+	obj_read_unlock();
+	return ret;
+}
+
 const char *repo_find_unique_abbrev(struct repository *r,
 				    const struct object_id *oid,
 				    int len)
@@ -1,4 +1,14 @@
 #include "cache.h"
+#include "compat/sha-hw.h"
+
+#if defined(HAVE_HW_SHA1) && !defined(DC_SHA1_EXTERNAL)
+#define HW_SHA1DC
+#ifdef DC_SHA1_SUBMODULE
+#include "sha1collisiondetection/lib/ubc_check.h"
+#else
+#include "sha1dc/ubc_check.h"
+#endif
+#endif
 
 #ifdef DC_SHA1_EXTERNAL
 /*
@@ -22,12 +32,73 @@ void git_SHA1DCFinal(unsigned char hash[20], SHA1_CTX *ctx)
 	    sha1_to_hex(hash));
 }
 
+#ifdef HW_SHA1DC
+/*
+ * Process a 64-byte block like sha1dc would, but with the SHA
+ * instructions of the CPU.  The expanded message they leave behind is
+ * checked for the unavoidable bit conditions of the known disturbance
+ * vectors; only when one of them holds (which is rare for any input
+ * not crafted to collide) is the block given to sha1dc to look for a
+ * collision, which needs the intermediate states of the compression.
+ */
+static void hw_sha1dc_block(SHA1_CTX *ctx, const unsigned char *block)
+{
+	uint32_t ihv[5], W[80], dvmask[DVMASKSIZE];
+
+	memcpy(ihv, ctx->ihv, sizeof(ihv));
+	hw_sha1_block(ihv, block, W);
+	ubc_check(W, dvmask);
+	if (dvmask[0]) {
+		SHA1DCUpdate(ctx, (const char *)block, 64);
+		return;
+	}
+	memcpy(ctx->ihv, ihv, sizeof(ihv));
+	ctx->total += 64;
+}
+
+static void hw_sha1dc_update(SHA1_CTX *ctx, const char *data, size_t len)
+{
+	unsigned left = ctx->total & 63;
+
+	if (left) {
+		unsigned char block[64];
+		unsigned fill = 64 - left;
+
+		if (len < fill) {
+			SHA1DCUpdate(ctx, data, len);
+			return;
+		}
+		memcpy(block, ctx->buffer, left);
+		memcpy(block + left, data, fill);
+		ctx->total -= left;
+		hw_sha1dc_block(ctx, block);
+		data += fill;
+		len -= fill;
+	}
+	while (len >= 64) {
+		hw_sha1dc_block(ctx, (const unsigned char *)data);
+		data += 64;
+		len -= 64;
+	}
+	if (len)
+		SHA1DCUpdate(ctx, data, len);
+}
+#endif
+
 /*
  * Same as SHA1DCUpdate, but adjust types to match git's usual interface.
  */
 void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *vdata, unsigned long len)
 {
 	const char *data = vdata;
+
+#ifdef HW_SHA1DC
+	/* without the ubc check every block needs the slow path */
+	if (ctx->detect_coll && ctx->ubc_check && hw_sha1_available()) {
+		hw_sha1dc_update(ctx, data, len);
+		return;
+	}
+#endif
 	/* We expect an unsigned long, but sha1dc only takes an int */
 	while (len > INT_MAX) {
 		SHA1DCUpdate(ctx, data, INT_MAX);
@@ -1,4 +1,5 @@
 #include "git-compat-util.h"
+#include "compat/sha-hw.h"
 #include "./sha256.h"
 
 #undef RND
@@ -61,6 +62,13 @@ static void blk_SHA256_Transform(blk_SHA256_CTX *ctx, const unsigned char *buf)
 	uint32_t S[8], W[64], t0, t1;
 	int i;
 
+#ifdef HAVE_HW_SHA256
+	if (hw_sha256_available()) {
+		hw_sha256_block(ctx->state, buf);
+		return;
+	}
+#endif
+
 	/* copy state into S */
 	for (i = 0; i < 8; i++)
 		S[i] = ctx->state[i];
@@ -17,6 +17,8 @@
 #include "commit-slab.h"
 #include "repository.h"
 #include "commit-reach.h"
+#include "commit-graph.h"
+#include "ewah/ewok.h"
 
 void set_alternate_shallow_file(struct repository *r, const char *path, int override)
 {
@@ -82,6 +84,116 @@ int is_repository_shallow(struct repository *r)
 	return r->parsed_objects->is_shallow;
 }
 
+static void mark_from_graph(struct commit_graph *g, uint32_t pos, int boundary,
+			    int shallow_flag, int not_shallow_flag,
+			    struct commit_list **result)
+{
+	struct object_id oid;
+	struct object *o;
+
+	commit_graph_oid_at(g, pos, &oid);
+	if (boundary) {
+		struct commit *c = lookup_commit(the_repository, &oid);
+
+		if (!c)
+			die("unable to look up commit %s", oid_to_hex(&oid));
+		c->object.flags |= shallow_flag;
+		commit_list_insert(c, result);
+		return;
+	}
+	/* nobody looks at commits the caller has never heard of */
+	o = lookup_object(the_repository, &oid);
+	if (o)
+		o->flags |= not_shallow_flag;
+}
+
+/*
+ * Walk the commit-graph from "heads" by position, breadth first, and
+ * mark the commits the way get_shallow_commits() (when "depth" is
+ * given) or get_shallow_commits_by_rev_list() with "--max-age=<since>"
+ * (otherwise) would, without parsing any of them. Only the shallow
+ * boundary becomes a "struct commit". Return -1 when the commit-graph
+ * cannot be used for this, before anything is marked.
+ */
+static int shallow_commits_from_graph(struct object_array *heads,
+				      int depth, timestamp_t since,
+				      int shallow_flag, int not_shallow_flag,
+				      struct commit_list **result)
+{
+	struct repository *r = the_repository;
+	struct commit_graph *g;
+	struct bitmap *seen;
+	uint32_t *queue = NULL, *parents = NULL;
+	size_t nr = 0, alloc = 0, parents_alloc = 0, begin = 0;
+	int i, level;
+
+	if (is_repository_shallow(r))
+		return -1;
+
+	seen = bitmap_new();
+	for (i = 0; i < heads->nr; i++) {
+		struct commit *c = (struct commit *)
+			deref_tag(r, heads->objects[i].item, NULL, 0);
+
+		if (!c || c->object.type != OBJ_COMMIT)
+			continue;
+		if (parse_commit(c) || c->graph_pos == COMMIT_NOT_FROM_GRAPH) {
+			bitmap_free(seen);
+			free(queue);
+			return -1;
+		}
+		if (bitmap_get(seen, c->graph_pos))
+			continue;
+		bitmap_set(seen, c->graph_pos);
+		/* heads older than the cut-off are not even shown */
+		if (!depth && c->date < since)
+			continue;
+		ALLOC_GROW(queue, nr + 1, alloc);
+		queue[nr++] = c->graph_pos;
+	}
+	g = r->objects->commit_graph;
+
+	for (level = 0; begin < nr; level++) {
+		size_t end = nr;
+
+		for (; begin < end; begin++) {
+			uint32_t pos = queue[begin];
+			int boundary = 0, nr_parents, j;
+
+			if (depth && level + 1 >= depth) {
+				mark_from_graph(g, pos, 1, shallow_flag,
+						not_shallow_flag, result);
+				continue;
+			}
+
+			nr_parents = commit_graph_parents_at(g, pos, &parents,
+							     &parents_alloc);
+			for (j = 0; j < nr_parents; j++) {
+				if (!depth &&
+				    commit_graph_date_at(g, parents[j]) < since) {
+					boundary = 1;
+					continue;
+				}
+				if (bitmap_get(seen, parents[j]))
+					continue;
+				bitmap_set(seen, parents[j]);
+				ALLOC_GROW(queue, nr + 1, alloc);
+				queue[nr++] = parents[j];
+			}
+			mark_from_graph(g, pos, boundary, shallow_flag,
+					not_shallow_flag, result);
+		}
+	}
+	trace2_data_intmax("shallow", r, "graph-walk", (intmax_t)nr);
+
+	bitmap_free(seen);
+	free(parents);
+	free(queue);
+	if (!depth && !nr)
+		die("no commits selected for shallow requests");
+	return 0;
+}
+
 /*
  * TODO: use "int" elemtype instead of "int *" when/if commit-slab
  * supports a "valid" flag.
@@ -97,6 +209,11 @@ struct commit_list *get_shallow_commits(struct object_array *heads, int depth,
 	struct commit_graft *graft;
 	struct commit_depth depths;
 
+	if (depth != INFINITE_DEPTH &&
+	    !shallow_commits_from_graph(heads, depth, 0, shallow_flag,
+					not_shallow_flag, &result))
+		return result;
+
 	init_commit_depth(&depths);
 	while (commit || i < heads->nr || stack.nr) {
 		struct commit_list *p;
@@ -243,6 +360,15 @@ struct commit_list *get_shallow_commits_by_rev_list(int ac, const char **av,
 	return result;
 }
 
+int get_shallow_commits_since(struct object_array *heads, timestamp_t since,
+			      int shallow_flag, int not_shallow_flag,
+			      struct commit_list **result)
+{
+	clear_object_flags(shallow_flag | not_shallow_flag);
+	return shallow_commits_from_graph(heads, 0, since, shallow_flag,
+					  not_shallow_flag, result);
+}
+
 static void check_shallow_file_for_update(struct repository *r)
 {
 	if (r->parsed_objects->is_shallow == -1)
@@ -503,29 +629,66 @@ static uint32_t *paint_alloc(struct paint_info *info)
 }
 
 /*
- * Given a commit SHA-1, walk down to parents until either SEEN,
- * UNINTERESTING or BOTTOM is hit. Set the id-th bit in ref_bitmap for
- * all walked commits.
+ * Within one paint_down(), the commits that carried the same set of
+ * refs all end up with the same, larger set; share it instead of
+ * allocating it again for each of them.
  */
-static void paint_down(struct paint_info *info, const struct object_id *oid,
-		       unsigned int id)
+struct paint_union {
+	struct hashmap_entry ent;
+	const uint32_t *from;
+	uint32_t *to;
+};
+
+static int paint_union_cmp(const void *unused_cmp_data,
+			   const void *entry, const void *entry_or_key,
+			   const void *unused_keydata)
+{
+	const struct paint_union *a = entry, *b = entry_or_key;
+
+	return a->from != b->from;
+}
+
+static uint32_t *paint_union(struct paint_info *info, struct hashmap *unions,
+			     uint32_t *from, const uint32_t *bitmap)
 {
-	unsigned int i, nr;
-	struct commit_list *head = NULL;
 	int bitmap_nr = DIV_ROUND_UP(info->nr_bits, 32);
-	size_t bitmap_size = st_mult(sizeof(uint32_t), bitmap_nr);
-	struct commit *c = lookup_commit_reference_gently(the_repository, oid,
-							  1);
-	uint32_t *tmp; /* to be freed before return */
-	uint32_t *bitmap;
+	struct paint_union key, *u;
+	int i;
 
-	if (!c)
-		return;
+	for (i = 0; i < bitmap_nr; i++)
+		if ((from[i] & bitmap[i]) != bitmap[i])
+			break;
+	if (i == bitmap_nr)
+		return from; /* nothing new */
+
+	hashmap_entry_init(&key, memhash(&from, sizeof(from)));
+	key.from = from;
+	u = hashmap_get(unions, &key, NULL);
+	if (u)
+		return u->to;
+
+	u = xmalloc(sizeof(*u));
+	hashmap_entry_init(u, key.ent.hash);
+	u->from = from;
+	u->to = paint_alloc(info);
+	for (i = 0; i < bitmap_nr; i++)
+		u->to[i] = from[i] | bitmap[i];
+	hashmap_add(unions, u);
+	return u->to;
+}
 
-	tmp = xmalloc(bitmap_size);
-	bitmap = paint_alloc(info);
-	memset(bitmap, 0, bitmap_size);
-	bitmap[id / 32] |= (1U << (id % 32));
+/*
+ * Given a commit, walk down to parents until either SEEN,
+ * UNINTERESTING or BOTTOM is hit. Add the refs in "bitmap" to the
+ * ref_bitmap of all walked commits.
+ */
+static void paint_down(struct paint_info *info, struct commit *c,
+		       uint32_t *bitmap)
+{
+	struct commit_list *head = NULL, *painted = NULL;
+	struct hashmap unions;
+
+	hashmap_init(&unions, paint_union_cmp, NULL, 0);
 	commit_list_insert(c, &head);
 	while (head) {
 		struct commit_list *p;
@@ -537,18 +700,12 @@ static void paint_down(struct paint_info *info, const struct object_id *oid,
 			continue;
 		else
 			c->object.flags |= SEEN;
+		commit_list_insert(c, &painted);
 
 		if (*refs == NULL)
 			*refs = bitmap;
-		else {
-			memcpy(tmp, *refs, bitmap_size);
-			for (i = 0; i < bitmap_nr; i++)
-				tmp[i] |= bitmap[i];
-			if (memcmp(tmp, *refs, bitmap_size)) {
-				*refs = paint_alloc(info);
-				memcpy(*refs, tmp, bitmap_size);
-			}
-		}
+		else
+			*refs = paint_union(info, &unions, *refs, bitmap);
 
 		if (c->object.flags & BOTTOM)
 			continue;
@@ -564,14 +721,62 @@ static void paint_down(struct paint_info *info, const struct object_id *oid,
 		}
 	}
 
-	nr = get_max_object_index();
-	for (i = 0; i < nr; i++) {
-		struct object *o = get_indexed_object(i);
-		if (o && o->type == OBJ_COMMIT)
-			o->flags &= ~SEEN;
+	/* only what this walk has painted needs to be cleaned up */
+	while (painted)
+		pop_commit(&painted)->object.flags &= ~SEEN;
+	hashmap_free(&unions, 1);
+}
+
+struct paint_ref {
+	const struct object_id *oid;
+	unsigned int id;
+};
+
+static int paint_ref_cmp(const void *a_, const void *b_)
+{
+	const struct paint_ref *a = a_, *b = b_;
+
+	return oidcmp(a->oid, b->oid);
+}
+
+/*
+ * Paint down from each ref in "ref", once for all the refs that point
+ * at the same commit. Refs that an existing ref already reaches have
+ * nothing to paint.
+ */
+static void paint_refs(struct paint_info *info, struct oid_array *ref)
+{
+	int bitmap_nr = DIV_ROUND_UP(info->nr_bits, 32);
+	struct paint_ref *order;
+	size_t i, j;
+
+	ALLOC_ARRAY(order, ref->nr);
+	for (i = 0; i < ref->nr; i++) {
+		order[i].oid = ref->oid + i;
+		order[i].id = i;
 	}
+	QSORT(order, ref->nr, paint_ref_cmp);
 
-	free(tmp);
+	for (i = 0; i < ref->nr; i = j) {
+		struct commit *c;
+		uint32_t *bitmap;
+
+		for (j = i + 1; j < ref->nr; j++)
+			if (!oideq(order[i].oid, order[j].oid))
+				break;
+
+		c = lookup_commit_reference_gently(the_repository,
+						   order[i].oid, 1);
+		if (!c || (c->object.flags & UNINTERESTING))
+			continue;
+
+		bitmap = paint_alloc(info);
+		memset(bitmap, 0, st_mult(sizeof(uint32_t), bitmap_nr));
+		for (; i < j; i++)
+			bitmap[order[i].id / 32] |= (1U << (order[i].id % 32));
+		paint_down(info, c, bitmap);
+	}
+	free(order);
 }
 
 static int mark_uninteresting(const char *refname, const struct object_id *oid,
@@ -651,8 +856,7 @@ void assign_shallow_commits_to_refs(struct shallow_info *info,
 		c->object.flags |= BOTTOM;
 	}
 
-	for (i = 0; i < ref->nr; i++)
-		paint_down(&pi, ref->oid + i, i);
+	paint_refs(&pi, ref);
 
 	if (used) {
 		int bitmap_size = DIV_ROUND_UP(pi.nr_bits, 32) * sizeof(uint32_t);
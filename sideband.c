@@ -209,31 +209,45 @@ int demultiplex_sideband(const char *me, char *buf, int len,
 	return 1;
 }
 
+/* how many packets send_sideband() hands to the kernel at once */
+#define SIDEBAND_BATCH 16
+
 /*
  * fd is connected to the remote side; send the sideband data
  * over multiplexed packet stream.
+ *
+ * The headers and the payloads go out with one writev() per batch of
+ * packets, without copying the payloads.
  */
 void send_sideband(int fd, int band, const char *data, ssize_t sz, int packet_max)
 {
 	const char *p = data;
+	char hdr[SIDEBAND_BATCH][5];
+	struct iovec iov[2 * SIDEBAND_BATCH];
 
 	while (sz) {
-		unsigned n;
-		char hdr[5];
-
-		n = sz;
-		if (packet_max - 5 < n)
-			n = packet_max - 5;
-		if (0 <= band) {
-			xsnprintf(hdr, sizeof(hdr), "%04x", n + 5);
-			hdr[4] = band;
-			write_or_die(fd, hdr, 5);
-		} else {
-			xsnprintf(hdr, sizeof(hdr), "%04x", n + 4);
-			write_or_die(fd, hdr, 4);
+		int nr = 0;
+
+		for (; sz && nr < SIDEBAND_BATCH; nr++) {
+			unsigned n;
+
+			n = sz;
+			if (packet_max - 5 < n)
+				n = packet_max - 5;
+			if (0 <= band) {
+				xsnprintf(hdr[nr], sizeof(hdr[nr]), "%04x", n + 5);
+				hdr[nr][4] = band;
+				iov[2 * nr].iov_len = 5;
+			} else {
+				xsnprintf(hdr[nr], sizeof(hdr[nr]), "%04x", n + 4);
+				iov[2 * nr].iov_len = 4;
+			}
+			iov[2 * nr].iov_base = hdr[nr];
+			iov[2 * nr + 1].iov_base = (char *)p;
+			iov[2 * nr + 1].iov_len = n;
+			p += n;
+			sz -= n;
 		}
-		write_or_die(fd, p, n);
-		p += n;
-		sz -= n;
+		writev_or_die(fd, iov, 2 * nr);
 	}
 }
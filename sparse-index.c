@@ -0,0 +1,228 @@
+#include "cache.h"
+#include "config.h"
+#include "dir.h"
+#include "tree.h"
+#include "cache-tree.h"
+#include "pathspec.h"
+#include "sparse-index.h"
+
+/*
+ * A directory can be collapsed when cone mode says that neither it
+ * nor anything below it is in the sparse-checkout cone, i.e. when it
+ * is neither a recursive nor a parent directory of the cone.
+ */
+static int sparse_dir_outside_cone(struct index_state *istate,
+				   struct exclude_list *el,
+				   const char *path, int pathlen)
+{
+	int dtype = DT_DIR;
+
+	return !is_excluded_from_list(path, pathlen, NULL, &dtype, el, istate);
+}
+
+static struct cache_entry *make_sparse_dir_entry(struct index_state *istate,
+						 const char *path, int pathlen,
+						 const struct object_id *oid)
+{
+	struct cache_entry *ce = make_empty_cache_entry(istate, pathlen);
+
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = pathlen;
+	memcpy(ce->name, path, pathlen);
+	oidcpy(&ce->oid, oid);
+	return ce;
+}
+
+/*
+ * Collapse what can be collapsed of istate->cache[start..end), the
+ * entries of the cache-tree node "ct" for the directory "path" (with
+ * a trailing slash, or empty at the root). The result is written back
+ * in place starting at istate->cache[out]. Returns the number of
+ * entries written.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 struct exclude_list *el,
+				 int out, int start, int end,
+				 struct strbuf *path, struct cache_tree *ct)
+{
+	int i, out_start = out, can_collapse = path->len > 0;
+
+	for (i = start; can_collapse && i < end; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || !ce_skip_worktree(ce) ||
+		    (ce->ce_flags & (CE_INTENT_TO_ADD | CE_REMOVE)))
+			can_collapse = 0;
+	}
+	if (can_collapse &&
+	    sparse_dir_outside_cone(istate, el, path->buf, path->len)) {
+		for (i = start; i < end; i++)
+			discard_cache_entry(istate->cache[i]);
+		istate->cache[out] = make_sparse_dir_entry(istate, path->buf,
+							   path->len, &ct->oid);
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *name = ce->name + path->len;
+		const char *slash = strchr(name, '/');
+		struct cache_tree_sub *sub = NULL;
+		int span, len = path->len;
+
+		if (slash)
+			sub = cache_tree_find_subtree(ct, name, slash - name);
+		if (!sub) {
+			istate->cache[out++] = ce;
+			i++;
+			continue;
+		}
+
+		span = sub->cache_tree->entry_count;
+		strbuf_add(path, name, slash - name + 1);
+		out += convert_to_sparse_rec(istate, el, out, i, i + span,
+					     path, sub->cache_tree);
+		strbuf_setlen(path, len);
+		i += span;
+	}
+	return out - out_start;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	struct exclude_list el;
+	struct strbuf path = STRBUF_INIT;
+	char *sparse;
+	int nr, enabled = 0;
+
+	if (istate->sparse_index || !istate->cache_nr ||
+	    !core_apply_sparse_checkout || !core_sparse_checkout_cone ||
+	    git_config_get_bool("index.sparse", &enabled) || !enabled)
+		return 0;
+
+	/*
+	 * The split index and fsmonitor record positions in terms of
+	 * full index entries.
+	 */
+	if (istate->split_index || istate->fsmonitor_last_update ||
+	    core_fsmonitor)
+		return 0;
+
+	memset(&el, 0, sizeof(el));
+	el.use_cone_patterns = 1;
+	sparse = git_pathdup("info/sparse-checkout");
+	if (add_excludes_from_file_to_list(sparse, "", 0, &el, NULL) < 0 ||
+	    !el.use_cone_patterns)
+		goto out;
+
+	/*
+	 * The cache-tree tells us where each directory starts and ends,
+	 * and gives the tree we collapse it to; it has to be complete.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT))
+		goto out;
+
+	trace2_region_enter("index", "convert_to_sparse", the_repository);
+	free_name_hash(istate);
+	nr = convert_to_sparse_rec(istate, &el, 0, 0, istate->cache_nr,
+				   &path, istate->cache_tree);
+	if (nr != istate->cache_nr) {
+		istate->cache_nr = nr;
+		istate->sparse_index = 1;
+
+		/* Every collapsed directory is now one entry. */
+		cache_tree_free(&istate->cache_tree);
+		istate->cache_tree = cache_tree();
+		cache_tree_update(istate, WRITE_TREE_SILENT);
+	}
+	trace2_region_leave("index", "convert_to_sparse", the_repository);
+
+out:
+	clear_exclude_list(&el);
+	strbuf_release(&path);
+	free(sparse);
+	return 0;
+}
+
+struct expand_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+};
+
+static int add_expanded_entry(const struct object_id *oid, struct strbuf *base,
+			      const char *pathname, unsigned mode, int stage,
+			      void *context)
+{
+	struct expand_data *x = context;
+	struct cache_entry *ce;
+	size_t len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	len = base->len + strlen(pathname);
+	ce = make_empty_cache_entry(x->istate, len);
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, pathname, len - base->len + 1);
+	oidcpy(&ce->oid, oid);
+
+	ALLOC_GROW(x->cache, x->nr + 1, x->alloc);
+	x->cache[x->nr++] = ce;
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct expand_data x = { istate };
+	struct pathspec ps;
+	unsigned int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	trace2_region_enter("index", "ensure_full_index", the_repository);
+	memset(&ps, 0, sizeof(ps));
+	x.alloc = istate->cache_alloc;
+	ALLOC_ARRAY(x.cache, x.alloc);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(x.cache, x.nr + 1, x.alloc);
+			x.cache[x.nr++] = ce;
+			continue;
+		}
+
+		tree = parse_tree_indirect(&ce->oid);
+		if (!tree)
+			die(_("unable to read tree %s of sparse directory '%s'"),
+			    oid_to_hex(&ce->oid), ce->name);
+		if (read_tree_recursive(the_repository, tree, ce->name,
+					ce_namelen(ce), 0, &ps,
+					add_expanded_entry, &x))
+			die(_("unable to expand sparse directory '%s'"),
+			    ce->name);
+		if (istate->cache_tree)
+			cache_tree_expand_sparse_dir(the_repository,
+						     istate->cache_tree,
+						     ce->name, tree);
+		discard_cache_entry(ce);
+	}
+
+	free_name_hash(istate);
+	free(istate->cache);
+	istate->cache = x.cache;
+	istate->cache_nr = x.nr;
+	istate->cache_alloc = x.alloc;
+	istate->sparse_index = 0;
+	trace2_region_leave("index", "ensure_full_index", the_repository);
+}
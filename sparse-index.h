@@ -0,0 +1,20 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+
+/*
+ * Collapse every directory outside of the sparse-checkout cone whose
+ * entries are all merged and skip-worktree into a single sparse
+ * directory entry. Does nothing unless cone mode and "index.sparse"
+ * are enabled, or when the index uses a split index or fsmonitor.
+ */
+int convert_to_sparse(struct index_state *istate);
+
+/*
+ * Replace every sparse directory entry by the entries of its tree, so
+ * that code which expects one entry per path can work on the index.
+ */
+void ensure_full_index(struct index_state *istate);
+
+#endif
@@ -54,14 +54,27 @@ void strbuf_init(struct strbuf *sb, size_t hint)
 {
 	sb->alloc = sb->len = 0;
 	sb->buf = strbuf_slopbuf;
+	sb->on_stack = 0;
 	if (hint)
 		strbuf_grow(sb, hint);
 }
 
+void strbuf_init_stack(struct strbuf *sb, char *buf, size_t size)
+{
+	if (!size)
+		BUG("strbuf_init_stack() needs room for the NUL");
+	sb->alloc = size;
+	sb->len = 0;
+	sb->buf = buf;
+	sb->buf[0] = '\0';
+	sb->on_stack = 1;
+}
+
 void strbuf_release(struct strbuf *sb)
 {
 	if (sb->alloc) {
-		free(sb->buf);
+		if (!sb->on_stack)
+			free(sb->buf);
 		strbuf_init(sb, 0);
 	}
 }
@@ -70,7 +83,7 @@ char *strbuf_detach(struct strbuf *sb, size_t *sz)
 {
 	char *res;
 	strbuf_grow(sb, 0);
-	res = sb->buf;
+	res = sb->on_stack ? xmemdupz(sb->buf, sb->len) : sb->buf;
 	if (sz)
 		*sz = sb->len;
 	strbuf_init(sb, 0);
@@ -93,6 +106,19 @@ void strbuf_grow(struct strbuf *sb, size_t extra)
 	if (unsigned_add_overflows(extra, 1) ||
 	    unsigned_add_overflows(sb->len, extra + 1))
 		die("you want to use way too much memory");
+	if (sb->on_stack) {
+		char *stack_buf = sb->buf;
+
+		if (sb->len + extra + 1 <= sb->alloc)
+			return;
+		/* outgrown the caller's buffer; move to the heap */
+		sb->buf = NULL;
+		sb->alloc = 0;
+		sb->on_stack = 0;
+		ALLOC_GROW(sb->buf, sb->len + extra + 1, sb->alloc);
+		memcpy(sb->buf, stack_buf, sb->len + 1);
+		return;
+	}
 	if (new_buf)
 		sb->buf = NULL;
 	ALLOC_GROW(sb->buf, sb->len + extra + 1, sb->alloc);
@@ -612,6 +638,9 @@ int strbuf_getwholeline(struct strbuf *sb, FILE *fp, int term)
 
 	strbuf_reset(sb);
 
+	/* getdelim() cannot realloc the caller's buffer either */
+	if (sb->on_stack)
+		strbuf_init(sb, 0);
 	/* Translate slopbuf to NULL, as we cannot call realloc on it */
 	if (!sb->alloc)
 		sb->buf = NULL;
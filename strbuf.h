@@ -67,6 +67,7 @@ struct strbuf {
 	size_t alloc;
 	size_t len;
 	char *buf;
+	unsigned on_stack : 1; /* buf belongs to the caller; see strbuf_init_stack() */
 };
 
 extern char strbuf_slopbuf[];
@@ -89,6 +90,18 @@ struct object_id;
  */
 void strbuf_init(struct strbuf *sb, size_t alloc);
 
+/**
+ * Initialize the structure to use the caller's `buf` of `size` bytes,
+ * typically an array on the stack, for as long as the string fits, and
+ * only then move to memory of its own. This saves the malloc() and
+ * free() of a short-lived strbuf in a hot loop. `buf` must outlive the
+ * strbuf (and any strbuf it is swapped into), and the strbuf must not
+ * be handed to code that free()s its `buf` itself. strbuf_release()
+ * and strbuf_detach() work as usual; the latter hands out a copy while
+ * the string is still in `buf`.
+ */
+void strbuf_init_stack(struct strbuf *sb, char *buf, size_t size);
+
 /**
  * Release a string buffer and the memory it used. After this call, the
  * strbuf points to an empty string that does not need to be free()ed, as
@@ -4,6 +4,7 @@
 #include "sub-process.h"
 #include "sigchain.h"
 #include "pkt-line.h"
+#include "trace2.h"
 
 int cmd2process_cmp(const void *unused_cmp_data,
 		    const void *entry,
@@ -72,13 +73,12 @@ static void subprocess_exit_handler(struct child_process *process)
 	finish_command(process);
 }
 
-int subprocess_start(struct hashmap *hashmap, struct subprocess_entry *entry, const char *cmd,
-	subprocess_start_fn startfn)
+static int spawn_subprocess(struct subprocess_entry *entry, const char *cmd)
 {
-	int err;
 	struct child_process *process;
 
 	entry->cmd = cmd;
+	entry->pending_start = NULL;
 	process = &entry->process;
 
 	child_process_init(process);
@@ -90,17 +90,37 @@ int subprocess_start(struct hashmap *hashmap, struct subprocess_entry *entry, co
 	process->clean_on_exit_handler = subprocess_exit_handler;
 	process->trace2_child_class = "subprocess";
 
-	err = start_command(process);
-	if (err) {
-		error("cannot fork to run subprocess '%s'", cmd);
-		return err;
-	}
+	if (start_command(process))
+		return error("cannot fork to run subprocess '%s'", cmd);
 
 	hashmap_entry_init(entry, strhash(cmd));
+	return 0;
+}
+
+static int run_startfn(struct subprocess_entry *entry,
+		       subprocess_start_fn startfn)
+{
+	int err;
 
+	trace2_region_enter("subprocess", "start", NULL);
 	err = startfn(entry);
+	trace2_region_leave("subprocess", "start", NULL);
+	if (err)
+		error("initialization for subprocess '%s' failed", entry->cmd);
+	return err;
+}
+
+int subprocess_start(struct hashmap *hashmap, struct subprocess_entry *entry, const char *cmd,
+	subprocess_start_fn startfn)
+{
+	int err;
+
+	err = spawn_subprocess(entry, cmd);
+	if (err)
+		return err;
+
+	err = run_startfn(entry, startfn);
 	if (err) {
-		error("initialization for subprocess '%s' failed", cmd);
 		subprocess_stop(hashmap, entry);
 		return err;
 	}
@@ -109,6 +129,34 @@ int subprocess_start(struct hashmap *hashmap, struct subprocess_entry *entry, co
 	return 0;
 }
 
+int subprocess_prestart(struct hashmap *hashmap, struct subprocess_entry *entry,
+			const char *cmd, subprocess_start_fn startfn)
+{
+	int err;
+
+	err = spawn_subprocess(entry, cmd);
+	if (err)
+		return err;
+
+	entry->pending_start = startfn;
+	hashmap_add(hashmap, entry);
+	return 0;
+}
+
+int subprocess_finish_start(struct hashmap *hashmap, struct subprocess_entry *entry)
+{
+	subprocess_start_fn startfn = entry->pending_start;
+
+	if (!startfn)
+		return 0;
+	entry->pending_start = NULL;
+	if (run_startfn(entry, startfn)) {
+		subprocess_stop(hashmap, entry);
+		return -1;
+	}
+	return 0;
+}
+
 static int handshake_version(struct child_process *process,
 			     const char *welcome_prefix, int *versions,
 			     int *chosen_version)
@@ -27,6 +27,8 @@ struct subprocess_entry {
 	struct hashmap_entry ent; /* must be the first member! */
 	const char *cmd;
 	struct child_process process;
+	/* the startfn of a process started with subprocess_prestart() */
+	int (*pending_start)(struct subprocess_entry *entry);
 };
 
 struct subprocess_capability {
@@ -57,6 +59,22 @@ typedef int(*subprocess_start_fn)(struct subprocess_entry *entry);
 int subprocess_start(struct hashmap *hashmap, struct subprocess_entry *entry, const char *cmd,
 		subprocess_start_fn startfn);
 
+/*
+ * Start a subprocess and add it to the subprocess hashmap, but leave
+ * calling "startfn" to subprocess_finish_start(). Processes that are
+ * known to be needed soon can so start up in the background, all at
+ * the same time.
+ */
+int subprocess_prestart(struct hashmap *hashmap, struct subprocess_entry *entry,
+			const char *cmd, subprocess_start_fn startfn);
+
+/*
+ * Call the "startfn" of a subprocess started with subprocess_prestart(),
+ * if that has not been done yet. If it fails, the subprocess is stopped
+ * and -1 is returned; the caller owns "entry" and has to free it.
+ */
+int subprocess_finish_start(struct hashmap *hashmap, struct subprocess_entry *entry);
+
 /* Kill a subprocess and remove it from the subprocess hashmap. */
 void subprocess_stop(struct hashmap *hashmap, struct subprocess_entry *entry);
 
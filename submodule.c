@@ -22,6 +22,7 @@
 #include "parse-options.h"
 #include "object-store.h"
 #include "commit-reach.h"
+#include "fetch-scheduler.h"
 
 static int config_update_recurse_submodules = RECURSE_SUBMODULES_OFF;
 static int initialized_fetch_ref_tips;
@@ -1280,10 +1281,16 @@ struct submodule_parallel_fetch {
 	/* Pending fetches by OIDs */
 	struct fetch_task **oid_fetch_tasks;
 	int oid_fetch_tasks_nr, oid_fetch_tasks_alloc;
+
+	/* Fetches waiting for their host to have a free slot */
+	struct fetch_task **deferred_tasks;
+	int deferred_tasks_nr, deferred_tasks_alloc;
+
+	struct fetch_scheduler *scheduler;
 };
 #define SPF_INIT {0, ARGV_ARRAY_INIT, NULL, NULL, 0, 0, 0, 0, \
 		  STRING_LIST_INIT_DUP, \
-		  NULL, 0, 0}
+		  NULL, 0, 0, NULL, 0, 0, NULL}
 
 static int get_fetch_recurse_config(const struct submodule *submodule,
 				    struct submodule_parallel_fetch *spf)
@@ -1320,6 +1327,9 @@ struct fetch_task {
 	unsigned free_sub : 1; /* Do we need to free the submodule? */
 
 	struct oid_array *commits; /* Ensure these commits are fetched */
+
+	const char *default_argv; /* value of --recurse-submodules-default */
+	struct fetch_job *job; /* slot in the fetch scheduler, if running */
 };
 
 /**
@@ -1404,10 +1414,76 @@ static struct repository *get_submodule_repo_for(struct repository *r,
 	return ret;
 }
 
+/*
+ * Take a slot for the fetch of "task" in the scheduler; returns 0 if the
+ * host it fetches from is busy.
+ */
+static int fetch_task_start_job(struct submodule_parallel_fetch *spf,
+				struct fetch_task *task)
+{
+	const char *url = NULL;
+
+	if (!spf->scheduler)
+		return 1;
+	/* NEEDSWORK: have get_default_remote from submodule--helper */
+	repo_config_get_string_const(task->repo, "remote.origin.url", &url);
+	task->job = fetch_job_start(spf->scheduler, task->sub->path, url);
+	return !!task->job;
+}
+
+static void fetch_task_finish_job(struct submodule_parallel_fetch *spf,
+				  struct fetch_task *task, int result)
+{
+	if (task->job)
+		fetch_job_finish(spf->scheduler, task->job, result);
+	task->job = NULL;
+}
+
+static void prepare_submodule_fetch(struct submodule_parallel_fetch *spf,
+				    struct fetch_task *task,
+				    struct child_process *cp,
+				    struct strbuf *err)
+{
+	struct strbuf submodule_prefix = STRBUF_INIT;
+
+	child_process_init(cp);
+	cp->dir = task->repo->gitdir;
+	prepare_submodule_repo_env_in_gitdir(&cp->env_array);
+	cp->git_cmd = 1;
+	if (!spf->quiet)
+		strbuf_addf(err, "Fetching submodule %s%s\n",
+			    spf->prefix, task->sub->path);
+	argv_array_init(&cp->args);
+	argv_array_pushv(&cp->args, spf->args.argv);
+	argv_array_push(&cp->args, task->default_argv);
+	argv_array_push(&cp->args, "--submodule-prefix");
+
+	strbuf_addf(&submodule_prefix, "%s%s/",
+		    spf->prefix,
+		    task->sub->path);
+	argv_array_push(&cp->args, submodule_prefix.buf);
+
+	strbuf_release(&submodule_prefix);
+}
+
 static int get_next_submodule(struct child_process *cp,
 			      struct strbuf *err, void *data, void **task_cb)
 {
 	struct submodule_parallel_fetch *spf = data;
+	int i;
+
+	for (i = 0; i < spf->deferred_tasks_nr; i++) {
+		struct fetch_task *task = spf->deferred_tasks[i];
+
+		if (!fetch_task_start_job(spf, task))
+			continue;
+		spf->deferred_tasks_nr--;
+		MOVE_ARRAY(spf->deferred_tasks + i, spf->deferred_tasks + i + 1,
+			   spf->deferred_tasks_nr - i);
+		prepare_submodule_fetch(spf, task, cp, err);
+		*task_cb = task;
+		return 1;
+	}
 
 	for (; spf->count < spf->r->index->cache_nr; spf->count++) {
 		const struct cache_entry *ce = spf->r->index->cache[spf->count];
@@ -1442,28 +1518,19 @@ static int get_next_submodule(struct child_process *cp,
 
 		task->repo = get_submodule_repo_for(spf->r, task->sub);
 		if (task->repo) {
-			struct strbuf submodule_prefix = STRBUF_INIT;
-			child_process_init(cp);
-			cp->dir = task->repo->gitdir;
-			prepare_submodule_repo_env_in_gitdir(&cp->env_array);
-			cp->git_cmd = 1;
-			if (!spf->quiet)
-				strbuf_addf(err, "Fetching submodule %s%s\n",
-					    spf->prefix, ce->name);
-			argv_array_init(&cp->args);
-			argv_array_pushv(&cp->args, spf->args.argv);
-			argv_array_push(&cp->args, default_argv);
-			argv_array_push(&cp->args, "--submodule-prefix");
-
-			strbuf_addf(&submodule_prefix, "%s%s/",
-						       spf->prefix,
-						       task->sub->path);
-			argv_array_push(&cp->args, submodule_prefix.buf);
+			task->default_argv = default_argv;
+			if (!fetch_task_start_job(spf, task)) {
+				/* Come back to it when its host is less busy. */
+				ALLOC_GROW(spf->deferred_tasks,
+					   spf->deferred_tasks_nr + 1,
+					   spf->deferred_tasks_alloc);
+				spf->deferred_tasks[spf->deferred_tasks_nr++] = task;
+				continue;
+			}
+			prepare_submodule_fetch(spf, task, cp, err);
 
 			spf->count++;
 			*task_cb = task;
-
-			strbuf_release(&submodule_prefix);
 			return 1;
 		} else {
 
@@ -1484,11 +1551,15 @@ static int get_next_submodule(struct child_process *cp,
 		}
 	}
 
-	if (spf->oid_fetch_tasks_nr) {
-		struct fetch_task *task =
-			spf->oid_fetch_tasks[spf->oid_fetch_tasks_nr - 1];
+	for (i = spf->oid_fetch_tasks_nr - 1; i >= 0; i--) {
+		struct fetch_task *task = spf->oid_fetch_tasks[i];
 		struct strbuf submodule_prefix = STRBUF_INIT;
+
+		if (!fetch_task_start_job(spf, task))
+			continue;
 		spf->oid_fetch_tasks_nr--;
+		MOVE_ARRAY(spf->oid_fetch_tasks + i, spf->oid_fetch_tasks + i + 1,
+			   spf->oid_fetch_tasks_nr - i);
 
 		strbuf_addf(&submodule_prefix, "%s%s/",
 			    spf->prefix, task->sub->path);
@@ -1525,6 +1596,7 @@ static int fetch_start_failure(struct strbuf *err,
 
 	spf->result = 1;
 
+	fetch_task_finish_job(spf, task, -1);
 	fetch_task_release(task);
 	return 0;
 }
@@ -1560,6 +1632,8 @@ static int fetch_finish(int retvalue, struct strbuf *err,
 	if (!task || !task->sub)
 		BUG("callback cookie bogus");
 
+	fetch_task_finish_job(spf, task, retvalue);
+
 	/* Is this the second time we process this submodule? */
 	if (task->commits)
 		goto out;
@@ -1595,7 +1669,8 @@ int fetch_populated_submodules(struct repository *r,
 			       const struct argv_array *options,
 			       const char *prefix, int command_line_option,
 			       int default_option,
-			       int quiet, int max_parallel_jobs)
+			       int quiet, int max_parallel_jobs,
+			       struct fetch_scheduler *scheduler)
 {
 	int i;
 	struct submodule_parallel_fetch spf = SPF_INIT;
@@ -1605,6 +1680,7 @@ int fetch_populated_submodules(struct repository *r,
 	spf.default_option = default_option;
 	spf.quiet = quiet;
 	spf.prefix = prefix;
+	spf.scheduler = scheduler;
 
 	if (!r->worktree)
 		goto out;
@@ -1628,19 +1704,21 @@ int fetch_populated_submodules(struct repository *r,
 				   "submodule", "parallel/fetch");
 
 	argv_array_clear(&spf.args);
+	free(spf.deferred_tasks);
 out:
 	free_submodules_oids(&spf.changed_submodule_names);
 	return spf.result;
 }
 
-unsigned is_submodule_modified(const char *path, int ignore_untracked)
+/*
+ * Whether the submodule at "path" is checked out; dies when its
+ * directory looks like a repository but is not one.
+ */
+static int submodule_is_checked_out(const char *path)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
 	struct strbuf buf = STRBUF_INIT;
-	FILE *fp;
-	unsigned dirty_submodule = 0;
 	const char *git_dir;
-	int ignore_cp_exit_code = 0;
+	int ret = 1;
 
 	strbuf_addf(&buf, "%s/.git", path);
 	git_dir = read_gitfile(buf.buf);
@@ -1649,52 +1727,82 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 	if (!is_git_directory(git_dir)) {
 		if (is_directory(git_dir))
 			die(_("'%s' not recognized as a git repository"), git_dir);
-		strbuf_release(&buf);
-		/* The submodule is not checked out, so it is not modified */
-		return 0;
+		ret = 0;
 	}
-	strbuf_reset(&buf);
+	strbuf_release(&buf);
+	return ret;
+}
 
-	argv_array_pushl(&cp.args, "status", "--porcelain=2", NULL);
+static void prepare_status_porcelain(struct child_process *cp,
+				     const char *path, int ignore_untracked)
+{
+	argv_array_pushl(&cp->args, "status", "--porcelain=2", NULL);
 	if (ignore_untracked)
-		argv_array_push(&cp.args, "-uno");
+		argv_array_push(&cp->args, "-uno");
 
-	prepare_submodule_repo_env(&cp.env_array);
-	cp.git_cmd = 1;
-	cp.no_stdin = 1;
+	prepare_submodule_repo_env(&cp->env_array);
+	cp->git_cmd = 1;
+	cp->no_stdin = 1;
+	cp->dir = path;
+}
+
+/*
+ * Fold one line of "git status --porcelain=2" into "dirty_submodule".
+ * Returns 1 once the remaining lines cannot tell anything new.
+ */
+static int parse_status_porcelain(const char *line, size_t len,
+				  unsigned *dirty_submodule,
+				  int ignore_untracked)
+{
+	/* regular untracked files */
+	if (line[0] == '?')
+		*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+	if (line[0] == 'u' ||
+	    line[0] == '1' ||
+	    line[0] == '2') {
+		/* T = line type, XY = status, SSSS = submodule state */
+		if (len < strlen("T XY SSSS"))
+			BUG("invalid status --porcelain=2 line %s",
+			    line);
+
+		if (line[5] == 'S' && line[8] == 'U')
+			/* nested untracked file */
+			*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+		if (line[0] == 'u' ||
+		    line[0] == '2' ||
+		    memcmp(line + 5, "S..U", 4))
+			/* other change */
+			*dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
+	}
+
+	return (*dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
+	       ((*dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
+		ignore_untracked);
+}
+
+unsigned is_submodule_modified(const char *path, int ignore_untracked)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	FILE *fp;
+	unsigned dirty_submodule = 0;
+	int ignore_cp_exit_code = 0;
+
+	if (!submodule_is_checked_out(path))
+		/* The submodule is not checked out, so it is not modified */
+		return 0;
+
+	prepare_status_porcelain(&cp, path, ignore_untracked);
 	cp.out = -1;
-	cp.dir = path;
 	if (start_command(&cp))
 		die("Could not run 'git status --porcelain=2' in submodule %s", path);
 
 	fp = xfdopen(cp.out, "r");
 	while (strbuf_getwholeline(&buf, fp, '\n') != EOF) {
-		/* regular untracked files */
-		if (buf.buf[0] == '?')
-			dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-		if (buf.buf[0] == 'u' ||
-		    buf.buf[0] == '1' ||
-		    buf.buf[0] == '2') {
-			/* T = line type, XY = status, SSSS = submodule state */
-			if (buf.len < strlen("T XY SSSS"))
-				BUG("invalid status --porcelain=2 line %s",
-				    buf.buf);
-
-			if (buf.buf[5] == 'S' && buf.buf[8] == 'U')
-				/* nested untracked file */
-				dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-			if (buf.buf[0] == 'u' ||
-			    buf.buf[0] == '2' ||
-			    memcmp(buf.buf + 5, "S..U", 4))
-				/* other change */
-				dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
-		}
-
-		if ((dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
-		    ((dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
-		     ignore_untracked)) {
+		if (parse_status_porcelain(buf.buf, buf.len, &dirty_submodule,
+					   ignore_untracked)) {
 			/*
 			 * We're not interested in any further information from
 			 * the child any more, neither output nor its exit code.
@@ -1712,6 +1820,92 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 	return dirty_submodule;
 }
 
+struct submodule_status_cb {
+	struct string_list *submodules;
+	int next;
+	const char *failed;
+};
+
+static int get_next_status_task(struct child_process *cp, struct strbuf *out,
+				void *cb, void **task_cb)
+{
+	struct submodule_status_cb *sscb = cb;
+
+	while (sscb->next < sscb->submodules->nr) {
+		struct string_list_item *item =
+			&sscb->submodules->items[sscb->next++];
+		struct submodule_status *status = item->util;
+
+		if (!submodule_is_checked_out(item->string))
+			continue;
+		prepare_status_porcelain(cp, item->string,
+					 status->ignore_untracked);
+		*task_cb = item;
+		return 1;
+	}
+	return 0;
+}
+
+static int status_start_failure(struct strbuf *out, void *cb, void *task_cb)
+{
+	struct submodule_status_cb *sscb = cb;
+	struct string_list_item *item = task_cb;
+
+	sscb->failed = item->string;
+	return 1;
+}
+
+static int status_finish(int result, struct strbuf *out, void *cb,
+			 void *task_cb)
+{
+	struct submodule_status_cb *sscb = cb;
+	struct string_list_item *item = task_cb;
+	struct submodule_status *status = item->util;
+	struct strbuf messages = STRBUF_INIT;
+	const char *line = out->buf, *end = out->buf + out->len;
+
+	if (result) {
+		sscb->failed = item->string;
+		return 1;
+	}
+
+	/*
+	 * The output of the child is collected together with its stderr;
+	 * pass on the lines that are not part of the status.
+	 */
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		size_t len = eol ? eol - line : end - line;
+
+		if (len >= 2 && line[1] == ' ' && strchr("12u?!#", line[0]))
+			parse_status_porcelain(line, len, &status->dirty,
+					       status->ignore_untracked);
+		else
+			strbuf_add(&messages, line, eol ? len + 1 : len);
+		line += eol ? len + 1 : len;
+	}
+	strbuf_swap(out, &messages);
+	strbuf_release(&messages);
+	return 0;
+}
+
+void get_submodules_status(struct string_list *submodules,
+			   int max_parallel_jobs)
+{
+	struct submodule_status_cb sscb = { submodules };
+
+	if (max_parallel_jobs < 1)
+		max_parallel_jobs = online_cpus();
+	run_processes_parallel_buffered_tr2(max_parallel_jobs,
+					    get_next_status_task,
+					    status_start_failure,
+					    status_finish, &sscb,
+					    "submodule", "parallel/status");
+	if (sscb.failed)
+		die("'git status --porcelain=2' failed in submodule %s",
+		    sscb.failed);
+}
+
 int submodule_uses_gitfile(const char *path)
 {
 	struct child_process cp = CHILD_PROCESS_INIT;
@@ -4,6 +4,7 @@
 struct argv_array;
 struct cache_entry;
 struct diff_options;
+struct fetch_scheduler;
 struct index_state;
 struct object_id;
 struct oid_array;
@@ -88,8 +89,23 @@ int fetch_populated_submodules(struct repository *r,
 			       const char *prefix,
 			       int command_line_option,
 			       int default_option,
-			       int quiet, int max_parallel_jobs);
+			       int quiet, int max_parallel_jobs,
+			       struct fetch_scheduler *scheduler);
 unsigned is_submodule_modified(const char *path, int ignore_untracked);
+
+struct submodule_status {
+	unsigned ignore_untracked : 1;
+	unsigned dirty; /* DIRTY_SUBMODULE_* bits */
+};
+
+/*
+ * Like is_submodule_modified() for each item of "submodules", whose
+ * string is the path of the submodule and util a struct
+ * submodule_status, running up to "max_parallel_jobs" of the status
+ * checks at the same time (0 for some reasonable default).
+ */
+void get_submodules_status(struct string_list *submodules,
+			   int max_parallel_jobs);
 int submodule_uses_gitfile(const char *path);
 
 #define SUBMODULE_REMOVAL_DIE_ON_ERROR (1<<0)
@@ -1,6 +1,5 @@
 #include "cache.h"
 
-static int threaded_check_leading_path(struct cache_def *cache, const char *name, int len);
 static int threaded_has_dirs_only_path(struct cache_def *cache, const char *name, int len, int prefix_len);
 
 /*
@@ -233,7 +232,7 @@ int check_leading_path(const char *name, int len)
  * Return path length if leading path exists and is neither a
  * directory nor a symlink.
  */
-static int threaded_check_leading_path(struct cache_def *cache, const char *name, int len)
+int threaded_check_leading_path(struct cache_def *cache, const char *name, int len)
 {
 	int flags;
 	int match_len = lstat_cache_matchlen(cache, name, len, &flags,
@@ -0,0 +1,434 @@
+/*
+ * Microbenchmarks of core data structures and kernels.
+ *
+ * Usage: test-tool bench [--warmup=<n>] [--iterations=<n>] [--size=<n>]
+ *                        [<benchmark>...]
+ *
+ * Each benchmark sets up its input once, runs its kernel <n> times
+ * without timing it to warm up caches and the allocator, and then
+ * times <n> more runs. It prints one line per benchmark:
+ *
+ *   <benchmark> size=<n> iterations=<n> min_ns=<n> median_ns=<n> max_ns=<n>
+ *
+ * The timed runs also make up a trace2 region "bench/<benchmark>",
+ * which is what t/perf/p0010-microbench.sh measures.
+ *
+ * A kernel that does not get the result it expects dies, so that the
+ * benchmarks double as a check that the optimized code still works.
+ */
+#include "test-tool.h"
+#include "cache.h"
+#include "hashmap.h"
+#include "oidmap.h"
+#include "oidset.h"
+#include "prio-queue.h"
+#include "ewah/ewok.h"
+#include "xdiff-interface.h"
+#include "kwset.h"
+#include "parse-options.h"
+#include "trace2.h"
+
+struct bench {
+	const char *name;
+	size_t default_size;
+	void *(*setup)(size_t size);
+	void (*run)(void *data, size_t size);
+	void (*cleanup)(void *data, size_t size);
+};
+
+/* a deterministic sequence of object names */
+static void *setup_oids(size_t size)
+{
+	struct object_id *oids;
+	uint32_t x = 2463534242u;
+	size_t i, j;
+
+	ALLOC_ARRAY(oids, size);
+	for (i = 0; i < size; i++) {
+		for (j = 0; j < GIT_MAX_RAWSZ; j++) {
+			/* xorshift32 */
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			oids[i].hash[j] = x & 0xff;
+		}
+	}
+	return oids;
+}
+
+struct string_entry {
+	struct hashmap_entry ent;
+	char key[FLEX_ARRAY];
+};
+
+static int string_entry_cmp(const void *unused_cmp_data,
+			    const void *entry, const void *entry_or_key,
+			    const void *keydata)
+{
+	const struct string_entry *e1 = entry, *e2 = entry_or_key;
+
+	return strcmp(e1->key, keydata ? keydata : e2->key);
+}
+
+static void *setup_hashmap(size_t size)
+{
+	struct string_entry **entries;
+	size_t i;
+
+	ALLOC_ARRAY(entries, size);
+	for (i = 0; i < size; i++) {
+		char buf[32];
+
+		xsnprintf(buf, sizeof(buf), "key-%"PRIuMAX, (uintmax_t)i);
+		FLEX_ALLOC_STR(entries[i], key, buf);
+	}
+	return entries;
+}
+
+static void run_hashmap(void *data, size_t size)
+{
+	struct string_entry **entries = data;
+	struct hashmap map;
+	size_t i;
+
+	hashmap_init(&map, string_entry_cmp, NULL, 0);
+	for (i = 0; i < size; i++) {
+		hashmap_entry_init(entries[i], strhash(entries[i]->key));
+		hashmap_add(&map, entries[i]);
+	}
+	for (i = 0; i < size; i++)
+		if (hashmap_get_from_hash(&map, strhash(entries[i]->key),
+					  entries[i]->key) != entries[i])
+			die("hashmap: lost %s", entries[i]->key);
+	hashmap_free(&map, 0);
+}
+
+static void cleanup_hashmap(void *data, size_t size)
+{
+	struct string_entry **entries = data;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		free(entries[i]);
+	free(entries);
+}
+
+static void cleanup_array(void *data, size_t size)
+{
+	free(data);
+}
+
+static void run_oidmap(void *data, size_t size)
+{
+	struct object_id *oids = data;
+	struct oidmap map = OIDMAP_INIT;
+	struct oidmap_entry *entries;
+	size_t i;
+
+	ALLOC_ARRAY(entries, size);
+	for (i = 0; i < size; i++) {
+		oidcpy(&entries[i].oid, &oids[i]);
+		oidmap_put(&map, &entries[i]);
+	}
+	for (i = 0; i < size; i++)
+		if (oidmap_get(&map, &oids[i]) != &entries[i])
+			die("oidmap: lost %s", oid_to_hex(&oids[i]));
+	oidmap_free(&map, 0);
+	free(entries);
+}
+
+static void run_oidset(void *data, size_t size)
+{
+	struct object_id *oids = data;
+	struct oidset set = OIDSET_INIT;
+	size_t i;
+
+	for (i = 0; i < size; i += 2)
+		oidset_insert(&set, &oids[i]);
+	for (i = 0; i < size; i++)
+		if (oidset_contains(&set, &oids[i]) != !(i % 2))
+			die("oidset: wrong answer for %s", oid_to_hex(&oids[i]));
+	oidset_clear(&set);
+}
+
+static int compare_uint32(const void *va, const void *vb, void *unused)
+{
+	uint32_t a = *(const uint32_t *)va, b = *(const uint32_t *)vb;
+
+	return a < b ? -1 : a > b;
+}
+
+static void *setup_uint32(size_t size)
+{
+	struct object_id *oids = setup_oids(size);
+	uint32_t *values;
+	size_t i;
+
+	ALLOC_ARRAY(values, size);
+	for (i = 0; i < size; i++)
+		values[i] = get_be32(oids[i].hash);
+	free(oids);
+	return values;
+}
+
+static void run_prio_queue(void *data, size_t size)
+{
+	uint32_t *values = data, *v, prev = 0;
+	struct prio_queue queue = { compare_uint32 };
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		prio_queue_put(&queue, &values[i]);
+	for (i = 0; i < size; i++) {
+		v = prio_queue_get(&queue);
+		if (!v || *v < prev)
+			die("prio-queue: out of order");
+		prev = *v;
+	}
+	clear_prio_queue(&queue);
+}
+
+static void run_ewah(void *data, size_t size)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i, set = 0, bits = 0;
+
+	/* runs of set and clear bits, with some noise in between */
+	for (i = 0; i < size; i++) {
+		if ((i / 1000) % 2 || !(i % 7)) {
+			ewah_set(ewah, i);
+			set++;
+		}
+	}
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&word, &it))
+		bits += ewah_bit_popcount64(word);
+	if (bits != set)
+		die("ewah: %"PRIuMAX" bits set, but %"PRIuMAX" found",
+		    (uintmax_t)set, (uintmax_t)bits);
+	ewah_free(ewah);
+}
+
+static void *setup_lines(size_t size)
+{
+	struct strbuf *sb = xcalloc(2, sizeof(*sb));
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		strbuf_addf(&sb[0], "line %"PRIuMAX"\n", (uintmax_t)i);
+		if (i % 10)
+			strbuf_addf(&sb[1], "line %"PRIuMAX"\n", (uintmax_t)i);
+		else
+			strbuf_addf(&sb[1], "changed %"PRIuMAX"\n", (uintmax_t)i);
+	}
+	return sb;
+}
+
+static void cleanup_lines(void *data, size_t size)
+{
+	struct strbuf *sb = data;
+
+	strbuf_release(&sb[0]);
+	strbuf_release(&sb[1]);
+	free(sb);
+}
+
+static void run_xdiff(void *data, size_t size)
+{
+	struct strbuf *sb = data;
+	mmfile_t a, b;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	long removed, added;
+
+	a.ptr = sb[0].buf;
+	a.size = sb[0].len;
+	b.ptr = sb[1].buf;
+	b.size = sb[1].len;
+	memset(&xpp, 0, sizeof(xpp));
+	memset(&xecfg, 0, sizeof(xecfg));
+	if (xdi_diff_count(&a, &b, &xpp, &xecfg, &removed, &added) < 0 ||
+	    removed != (size + 9) / 10 || added != removed)
+		die("xdiff: wrong diff");
+}
+
+static void *setup_zlib(size_t size)
+{
+	struct strbuf *sb = setup_lines(size);
+	git_zstream stream;
+	unsigned long bound;
+
+	memset(&stream, 0, sizeof(stream));
+	git_deflate_init(&stream, Z_DEFAULT_COMPRESSION);
+	bound = git_deflate_bound(&stream, sb[0].len);
+	strbuf_reset(&sb[1]);
+	strbuf_grow(&sb[1], bound);
+	stream.next_in = (unsigned char *)sb[0].buf;
+	stream.avail_in = sb[0].len;
+	stream.next_out = (unsigned char *)sb[1].buf;
+	stream.avail_out = bound;
+	if (git_deflate(&stream, Z_FINISH) != Z_STREAM_END)
+		die("zlib: unable to deflate");
+	git_deflate_end(&stream);
+	strbuf_setlen(&sb[1], stream.total_out);
+	return sb;
+}
+
+static void run_zlib(void *data, size_t size)
+{
+	struct strbuf *sb = data;
+	char *out = xmalloc(sb[0].len);
+	git_zstream stream;
+
+	memset(&stream, 0, sizeof(stream));
+	git_inflate_init(&stream);
+	stream.next_in = (unsigned char *)sb[1].buf;
+	stream.avail_in = sb[1].len;
+	stream.next_out = (unsigned char *)out;
+	stream.avail_out = sb[0].len;
+	if (git_inflate(&stream, Z_FINISH) != Z_STREAM_END ||
+	    stream.total_out != sb[0].len ||
+	    memcmp(out, sb[0].buf, sb[0].len))
+		die("zlib: wrong inflated data");
+	git_inflate_end(&stream);
+	free(out);
+}
+
+static void run_kwset(void *data, size_t size)
+{
+	struct strbuf *sb = data;
+	static const char *words[] = { "changed 4", "line 99", "no such line" };
+	kwset_t kws = kwsalloc(NULL);
+	struct kwsmatch match;
+	const char *p = sb[1].buf, *end = sb[1].buf + sb[1].len;
+	size_t i, found = 0;
+
+	for (i = 0; i < ARRAY_SIZE(words); i++)
+		if (kwsincr(kws, words[i], strlen(words[i])))
+			die("kwset: unable to add '%s'", words[i]);
+	if (kwsprep(kws))
+		die("kwset: unable to prepare");
+	while (p < end) {
+		size_t offset = kwsexec(kws, p, end - p, &match);
+
+		if (offset == (size_t)-1)
+			break;
+		found++;
+		p += offset + match.size[0];
+	}
+	if (size >= 100 && !found)
+		die("kwset: nothing found");
+	kwsfree(kws);
+}
+
+static void run_strbuf(void *data, size_t size)
+{
+	struct strbuf sb = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		strbuf_addstr(&sb, "line ");
+		strbuf_addf(&sb, "%"PRIuMAX, (uintmax_t)i);
+		strbuf_addch(&sb, '\n');
+	}
+	if (sb.len < size * 7)
+		die("strbuf: too short");
+	strbuf_release(&sb);
+}
+
+static struct bench benches[] = {
+	{ "hashmap", 100000, setup_hashmap, run_hashmap, cleanup_hashmap },
+	{ "oidmap", 100000, setup_oids, run_oidmap, cleanup_array },
+	{ "oidset", 100000, setup_oids, run_oidset, cleanup_array },
+	{ "prio-queue", 100000, setup_uint32, run_prio_queue, cleanup_array },
+	{ "ewah", 10000000, NULL, run_ewah, NULL },
+	{ "xdiff", 100000, setup_lines, run_xdiff, cleanup_lines },
+	{ "zlib-inflate", 100000, setup_zlib, run_zlib, cleanup_lines },
+	{ "kwset", 100000, setup_lines, run_kwset, cleanup_lines },
+	{ "strbuf", 1000000, NULL, run_strbuf, NULL },
+};
+
+static int compare_u64(const void *va, const void *vb)
+{
+	uint64_t a = *(const uint64_t *)va, b = *(const uint64_t *)vb;
+
+	return a < b ? -1 : a > b;
+}
+
+static void run_bench(struct bench *b, size_t size, int warmup, int iterations)
+{
+	uint64_t *ns;
+	void *data = NULL;
+	int i;
+
+	if (!size)
+		size = b->default_size;
+	if (b->setup)
+		data = b->setup(size);
+
+	for (i = 0; i < warmup; i++)
+		b->run(data, size);
+
+	ALLOC_ARRAY(ns, iterations);
+	trace2_region_enter("bench", b->name, NULL);
+	for (i = 0; i < iterations; i++) {
+		uint64_t start = getnanotime();
+
+		b->run(data, size);
+		ns[i] = getnanotime() - start;
+	}
+	trace2_region_leave("bench", b->name, NULL);
+	QSORT(ns, iterations, compare_u64);
+
+	printf("%s size=%"PRIuMAX" iterations=%d min_ns=%"PRIuMAX
+	       " median_ns=%"PRIuMAX" max_ns=%"PRIuMAX"\n",
+	       b->name, (uintmax_t)size, iterations, (uintmax_t)ns[0],
+	       (uintmax_t)ns[iterations / 2], (uintmax_t)ns[iterations - 1]);
+
+	free(ns);
+	if (b->cleanup)
+		b->cleanup(data, size);
+}
+
+int cmd__bench(int argc, const char **argv)
+{
+	int warmup = 1, iterations = 10;
+	unsigned long size = 0;
+	const char * const usage[] = {
+		"test-tool bench [--warmup=<n>] [--iterations=<n>] [--size=<n>] [<benchmark>...]",
+		NULL
+	};
+	struct option options[] = {
+		OPT_INTEGER(0, "warmup", &warmup, "untimed runs of each benchmark"),
+		OPT_INTEGER(0, "iterations", &iterations, "timed runs of each benchmark"),
+		OPT_MAGNITUDE(0, "size", &size, "size of the input, instead of the default"),
+		OPT_END()
+	};
+	size_t i;
+	int j;
+
+	argc = parse_options(argc, argv, NULL, options, usage, 0);
+	if (warmup < 0 || iterations < 1)
+		usage_with_options(usage, options);
+
+	for (j = 0; j < argc; j++) {
+		for (i = 0; i < ARRAY_SIZE(benches); i++)
+			if (!strcmp(argv[j], benches[i].name))
+				break;
+		if (i == ARRAY_SIZE(benches))
+			die("unknown benchmark: %s", argv[j]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		int selected = !argc;
+
+		for (j = 0; j < argc; j++)
+			if (!strcmp(argv[j], benches[i].name))
+				selected = 1;
+		if (selected)
+			run_bench(&benches[i], size, warmup, iterations);
+	}
+	return 0;
+}
@@ -1,6 +1,7 @@
 #include "test-tool.h"
 #include "git-compat-util.h"
 #include "hashmap.h"
+#include "khash.h"
 #include "strbuf.h"
 
 struct test_entry
@@ -131,6 +132,83 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
 	}
 }
 
+/*
+ * The same workload with the open-addressing khash.h, which keeps the
+ * keys in the table itself, for comparison.
+ */
+struct perf_key {
+	unsigned int hash;
+	const char *key;
+};
+
+static inline unsigned int perf_key_hash(struct perf_key k)
+{
+	return k.hash;
+}
+
+static inline int perf_key_eq(struct perf_key a, struct perf_key b)
+{
+	return a.hash == b.hash && !strcmp(a.key, b.key);
+}
+
+KHASH_INIT(perf, struct perf_key, struct test_entry *, 1,
+	   perf_key_hash, perf_key_eq)
+
+/*
+ * Test performance of khash.h, for comparison with perfhashmap
+ * Usage: time echo "perfkhash method rounds" | test-tool hashmap
+ */
+static void perf_khash(unsigned int method, unsigned int rounds)
+{
+	kh_perf_t *map;
+	char buf[16];
+	struct test_entry **entries;
+	struct perf_key *keys;
+	unsigned int i, j;
+	int ret;
+
+	ALLOC_ARRAY(entries, TEST_SIZE);
+	ALLOC_ARRAY(keys, TEST_SIZE);
+	for (i = 0; i < TEST_SIZE; i++) {
+		xsnprintf(buf, sizeof(buf), "%i", i);
+		entries[i] = alloc_test_entry(0, buf, "");
+		keys[i].hash = hash(method, i, entries[i]->key);
+		keys[i].key = entries[i]->key;
+	}
+
+	if (method & TEST_ADD) {
+		/* test adding to the map */
+		for (j = 0; j < rounds; j++) {
+			map = kh_init_perf();
+
+			/* add entries */
+			for (i = 0; i < TEST_SIZE; i++) {
+				khiter_t pos = kh_put_perf(map, keys[i], &ret);
+				kh_value(map, pos) = entries[i];
+			}
+
+			kh_destroy_perf(map);
+		}
+	} else {
+		/* test map lookups */
+		map = kh_init_perf();
+
+		/* fill the map (sparsely if specified) */
+		j = (method & TEST_SPARSE) ? TEST_SIZE / 10 : TEST_SIZE;
+		for (i = 0; i < j; i++) {
+			khiter_t pos = kh_put_perf(map, keys[i], &ret);
+			kh_value(map, pos) = entries[i];
+		}
+
+		for (j = 0; j < rounds; j++) {
+			for (i = 0; i < TEST_SIZE; i++)
+				kh_get_perf(map, keys[i]);
+		}
+
+		kh_destroy_perf(map);
+	}
+}
+
 #define DELIM " \t\r\n"
 
 /*
@@ -144,6 +222,7 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
  * size -> tablesize numentries
  *
  * perfhashmap method rounds -> test hashmap.[ch] performance
+ * perfkhash method rounds -> the same with khash.h
  */
 int cmd__hashmap(int argc, const char **argv)
 {
@@ -250,6 +329,10 @@ int cmd__hashmap(int argc, const char **argv)
 
 			perf_hashmap(atoi(p1), atoi(p2));
 
+		} else if (!strcmp("perfkhash", cmd) && p1 && p2) {
+
+			perf_khash(atoi(p1), atoi(p2));
+
 		} else {
 
 			printf("Unknown command %s\n", cmd);
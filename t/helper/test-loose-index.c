@@ -0,0 +1,50 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "config.h"
+#include "object-store.h"
+#include "loose-index.h"
+#include "run-command.h"
+
+/*
+ * Write the loose object from <file> like write_loose_object() does,
+ * but let another process write <other-file> into the object directory
+ * while we are at it.
+ */
+static int interleave(const char *oid_hex, const char *file,
+		      const char *other_file)
+{
+	struct object_directory *odb;
+	struct object_id oid;
+	const char *argv[] = {
+		"-c", "core.looseObjectIndex=false",
+		"hash-object", "-w", NULL, NULL
+	};
+
+	if (get_oid_hex(oid_hex, &oid))
+		die("not an object name: %s", oid_hex);
+	odb = the_repository->objects->odb;
+	odb_loose_cache(odb, &oid);
+	if (!loose_index_begin_write(odb, &oid))
+		die("the listing of %s is not current", oid_hex);
+
+	argv[4] = other_file;
+	if (run_command_v_opt(argv, RUN_GIT_CMD))
+		die("cannot write %s", other_file);
+	argv[4] = file;
+	if (run_command_v_opt(argv, RUN_GIT_CMD))
+		die("cannot write %s", file);
+
+	loose_index_end_write(odb, &oid);
+	return 0;
+}
+
+int cmd__loose_index(int argc, const char **argv)
+{
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+
+	if (argc == 5 && !strcmp(argv[1], "interleave"))
+		return interleave(argv[2], argv[3], argv[4]);
+
+	die("usage: test-tool loose-index interleave <oid> <file> <other-file>");
+}
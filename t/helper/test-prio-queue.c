@@ -17,10 +17,46 @@ static void show(int *v)
 	free(v);
 }
 
+/*
+ * After "keyed", the arguments are "<key>[:<label>]" and go into a
+ * keyed_queue; what comes out is shown as it went in.
+ */
+static void keyed(const char **argv)
+{
+	struct keyed_queue kq = KEYED_QUEUE_INIT;
+	char *v;
+
+	while (*++argv) {
+		if (!strcmp(*argv, "get")) {
+			v = keyed_queue_peek(&kq);
+			if (v != keyed_queue_get(&kq))
+				BUG("peek and get results do not match");
+			printf("%s\n", v ? v : "NULL");
+			free(v);
+		} else if (!strcmp(*argv, "dump")) {
+			while ((v = keyed_queue_peek(&kq))) {
+				if (v != keyed_queue_get(&kq))
+					BUG("peek and get results do not match");
+				printf("%s\n", v);
+				free(v);
+			}
+		} else {
+			keyed_queue_put(&kq, xstrdup(*argv),
+					strtoumax(*argv, NULL, 10));
+		}
+	}
+	clear_keyed_queue(&kq);
+}
+
 int cmd__prio_queue(int argc, const char **argv)
 {
 	struct prio_queue pq = { intcmp };
 
+	if (argv[1] && !strcmp(argv[1], "keyed")) {
+		keyed(argv + 1);
+		return 0;
+	}
+
 	while (*++argv) {
 		if (!strcmp(*argv, "get")) {
 			void *peek = prio_queue_peek(&pq);
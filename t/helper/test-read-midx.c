@@ -30,9 +30,14 @@ static int read_midx_file(const char *object_dir)
 		printf(" object-offsets");
 	if (m->chunk_large_offsets)
 		printf(" large-offsets");
+	if (m->chunk_base_layers)
+		printf(" base-layers");
 
 	printf("\nnum_objects: %d\n", m->num_objects);
 
+	if (m->num_base_layers)
+		printf("num_base_layers: %d\n", m->num_base_layers);
+
 	printf("packs:\n");
 	for (i = 0; i < m->num_packs; i++)
 		printf("%s\n", m->pack_names[i]);
@@ -4,6 +4,7 @@
 #include "run-command.h"
 #include "exec-cmd.h"
 #include "config.h"
+#include "thread-utils.h"
 
 typedef int(fn_unit_test)(int argc, const char **argv);
 
@@ -198,6 +199,114 @@ static int ut_006data(int argc, const char **argv)
 	return 0;
 }
 
+/*
+ * Run the TEST1 timer <count> times, each interval lasting about
+ * <ms_delay> milliseconds.
+ */
+static int ut_007timer(int argc, const char **argv)
+{
+	const char *usage_error = "expect <count> <ms_delay>";
+	int count = 0;
+	int delay = 0;
+	int k;
+
+	if (argc != 2 || get_i(&count, argv[0]) || get_i(&delay, argv[1]))
+		die("%s", usage_error);
+
+	for (k = 0; k < count; k++) {
+		trace2_timer_start(TRACE2_TIMER_ID_TEST1);
+		/* a nested interval does not count on its own */
+		trace2_timer_start(TRACE2_TIMER_ID_TEST1);
+		sleep_millisec(delay);
+		trace2_timer_stop(TRACE2_TIMER_ID_TEST1);
+		trace2_timer_stop(TRACE2_TIMER_ID_TEST1);
+	}
+
+	return 0;
+}
+
+/*
+ * Add each <value> to the TEST1 counter.
+ */
+static int ut_008counter(int argc, const char **argv)
+{
+	const char *usage_error = "expect <value>+";
+	int value;
+
+	if (!argc)
+		die("%s", usage_error);
+
+	for (; argc; argc--, argv++) {
+		if (get_i(&value, argv[0]))
+			die("%s", usage_error);
+		trace2_counter_add(TRACE2_COUNTER_ID_TEST1, value);
+	}
+
+	return 0;
+}
+
+static int ut_009threads_count;
+
+static void *ut_009thread_proc(void *unused)
+{
+	int k;
+
+	trace2_thread_start("ut_009");
+	for (k = 0; k < ut_009threads_count; k++) {
+		trace2_timer_start(TRACE2_TIMER_ID_TEST2);
+		trace2_counter_add(TRACE2_COUNTER_ID_TEST2, 1);
+		trace2_timer_stop(TRACE2_TIMER_ID_TEST2);
+	}
+	trace2_thread_exit();
+
+	return NULL;
+}
+
+/*
+ * Start <threads> threads which each run the TEST2 timer and add
+ * one to the TEST2 counter <count> times.
+ */
+static int ut_009threads(int argc, const char **argv)
+{
+	const char *usage_error = "expect <threads> <count>";
+	pthread_t *pids;
+	int nr_threads = 0;
+	int k;
+
+	if (argc != 2 || get_i(&nr_threads, argv[0]) || nr_threads < 1 ||
+	    get_i(&ut_009threads_count, argv[1]))
+		die("%s", usage_error);
+
+	ALLOC_ARRAY(pids, nr_threads);
+	for (k = 0; k < nr_threads; k++)
+		if (pthread_create(&pids[k], NULL, ut_009thread_proc, NULL))
+			die("failed to create thread");
+	for (k = 0; k < nr_threads; k++)
+		pthread_join(pids[k], NULL);
+	free(pids);
+
+	return 0;
+}
+
+/*
+ * Sleep for <ms_delay> milliseconds inside a region, so that the
+ * sampling target has something to see.
+ */
+static int ut_010region(int argc, const char **argv)
+{
+	const char *usage_error = "expect <category> <label> <ms_delay>";
+	int delay = 0;
+
+	if (argc != 3 || !*argv[0] || !*argv[1] || get_i(&delay, argv[2]))
+		die("%s", usage_error);
+
+	trace2_region_enter(argv[0], argv[1], the_repository);
+	sleep_millisec(delay);
+	trace2_region_leave(argv[0], argv[1], the_repository);
+
+	return 0;
+}
+
 /*
  * Usage:
  *     test-tool trace2 <ut_name_1> <ut_usage_1>
@@ -214,6 +323,10 @@ static struct unit_test ut_table[] = {
 	{ ut_004child,    "004child",  "[<child_command_line>]" },
 	{ ut_005exec,     "005exec",   "<git_command_args>" },
 	{ ut_006data,     "006data",   "[<category> <key> <value>]+" },
+	{ ut_007timer,    "007timer",  "<count> <ms_delay>" },
+	{ ut_008counter,  "008counter", "<value>+" },
+	{ ut_009threads,  "009threads", "<threads> <count>" },
+	{ ut_010region,   "010region", "<category> <label> <ms_delay>" },
 };
 /* clang-format on */
 
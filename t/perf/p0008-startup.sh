@@ -0,0 +1,31 @@
+#!/bin/sh
+
+test_description='Start-up cost of small commands
+
+Shell prompts and editors run many commands that do very little; their
+time goes to starting up and reading the config.'
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	test_commit initial &&
+	for i in $(test_seq 500)
+	do
+		printf "[alias \"a%d\"]\n\tx = log -%d\n" $i $i || return 1
+	done >"$HOME/.gitconfig"
+'
+
+for cmd in "version" "rev-parse --show-toplevel" "symbolic-ref HEAD" \
+	"rev-parse --verify HEAD" "status --porcelain"
+do
+	test_perf "100 x git $cmd" "
+		for i in \$(test_seq 100)
+		do
+			git $cmd >/dev/null || return 1
+		done
+	"
+done
+
+test_done
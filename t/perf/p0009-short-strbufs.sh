@@ -0,0 +1,29 @@
+#!/bin/sh
+
+test_description='Tests the performance of callers formatting many short strings'
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# paths relative to a subdirectory are quoted through a strbuf each
+dir=$(git ls-files | sed -n "s|/[^/]*$||p" | head -n 1) &&
+mkdir -p "$dir"
+
+test_perf 'ls-files from a subdirectory' "
+	(cd '$dir' && git ls-files :/ >/dev/null)
+"
+
+test_perf 'for-each-ref' '
+	git for-each-ref --format="%(refname) %(objectname)" >/dev/null
+'
+
+test_perf 'log with padded placeholders' '
+	git log --format="%<(20,trunc)%an %>(12)%h %s" >/dev/null
+'
+
+test_perf 'read-tree -m of two trees' '
+	git read-tree -n -m HEAD~1 HEAD
+'
+
+test_done
@@ -0,0 +1,27 @@
+#!/bin/sh
+
+test_description='Microbenchmarks of core data structures and kernels
+
+Each test times the runs of one "test-tool bench" kernel, leaving out
+the setup of its input and its warmup runs. Set GIT_PERF_BENCH_SIZE to
+change the size of the inputs from their defaults.
+'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+bench_opts="--warmup=2 --iterations=10"
+test -z "$GIT_PERF_BENCH_SIZE" ||
+bench_opts="$bench_opts --size=$GIT_PERF_BENCH_SIZE"
+export bench_opts
+
+for kernel in hashmap oidmap oidset prio-queue ewah xdiff zlib-inflate kwset strbuf
+do
+	export kernel
+
+	test_perf_region bench/$kernel "$kernel" '
+		test-tool bench $bench_opts $kernel >out
+	'
+done
+
+test_done
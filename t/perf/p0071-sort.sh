@@ -23,4 +23,14 @@ test_expect_success 'string_list_sort() sorts like sort(1)' '
 	test_cmp_bin expect actual
 '
 
+test_expect_success 'setup object names' '
+	git cat-file --batch-all-objects --batch-check="append %(objectname)" \
+		--unordered >oids &&
+	echo for_each_unique >>oids
+'
+
+test_perf 'oid_array sort' '
+	test-tool sha1-array <oids >/dev/null
+'
+
 test_done
@@ -53,4 +53,18 @@ test_perf 'rebase a lot of unrelated changes with split-index' '
 	git rebase --onto base upstream2
 '
 
+test_expect_success 'setup rebasing many changes with the merge backend' '
+	git config core.splitIndex false
+'
+
+test_perf 'rebase --merge a lot of unrelated changes' '
+	git rebase --merge --onto upstream2 base &&
+	git rebase --merge --onto base upstream2
+'
+
+test_perf 'rebase --in-memory a lot of unrelated changes' '
+	git rebase --in-memory --onto upstream2 base &&
+	git rebase --in-memory --onto base upstream2
+'
+
 test_done
@@ -0,0 +1,62 @@
+#!/bin/sh
+
+test_description='Tests log --graph performance with many concurrent branches
+
+The history has a mainline of $GIT_PERF_GRAPH_BRANCHES commits, each
+of which starts a short branch that is merged back into the mainline
+later on, in the same order. All the branches are open at once in the
+middle of the graph.
+'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+GIT_PERF_GRAPH_BRANCHES=${GIT_PERF_GRAPH_BRANCHES:-1000}
+
+# usage: make-history.perl <n> | git fast-import
+write_script make-history.perl "$PERL_PATH" <<-\EOF
+my ($n) = @ARGV;
+my ($mark, $time) = (0, 1112911993);
+
+sub commit {
+	my ($ref, $msg, $from, @merge) = @_;
+	$mark++;
+	$time++;
+	print "commit $ref\nmark :$mark\n";
+	print "committer A U Thor <author\@example.com> $time -0700\n";
+	print "data ", length($msg), "\n$msg\n";
+	print "from :$from\n" if $from;
+	print "merge :$_\n" for @merge;
+	print "\n";
+	return $mark;
+}
+
+my (@main, @tips);
+my $prev;
+for my $i (0 .. $n - 1) {
+	$prev = commit("refs/heads/main", "main $i", $prev);
+	push @main, $prev;
+}
+for my $i (0 .. $n - 1) {
+	my $tip = $main[$i];
+	$tip = commit("refs/heads/branch$i", "branch $i.$_", $tip) for 1 .. 3;
+	push @tips, $tip;
+}
+for my $i (0 .. $n - 1) {
+	$prev = commit("refs/heads/main", "merge $i", $prev, $tips[$i]);
+}
+EOF
+
+test_expect_success "setup $GIT_PERF_GRAPH_BRANCHES branches" '
+	./make-history.perl $GIT_PERF_GRAPH_BRANCHES | git fast-import --quiet
+'
+
+test_perf 'git log --oneline (baseline)' '
+	git log --oneline --topo-order main >/dev/null
+'
+
+test_perf 'git log --graph --oneline' '
+	git log --graph --oneline main >/dev/null
+'
+
+test_done
@@ -32,4 +32,9 @@ test_perf 'prune with bitmaps' '
 	git prune
 '
 
+test_perf 'prune with bitmaps, keeping recent objects' '
+	echo "probably not present in repo" | git hash-object -w --stdin &&
+	git prune --expire=1.hour.ago
+'
+
 test_done
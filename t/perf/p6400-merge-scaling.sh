@@ -0,0 +1,149 @@
+#!/bin/sh
+
+test_description='Tests how merge, rebase and cherry-pick scale
+
+Each scenario has a base commit with $GIT_PERF_MERGE_UNCHANGED files
+that no side touches, plus <n> files for each <n> in
+$GIT_PERF_MERGE_SIZES. Branch A changes one line of each of the <n>
+files, and branch B another line of them. How B also moves them
+depends on the scenario:
+
+ none: B keeps all files where they are
+ some: B renames every tenth file
+ all:  B renames every file
+ dirs: B renames every directory, and A adds a file to each of them,
+       which directory rename detection has to move along
+'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+GIT_PERF_MERGE_SIZES=${GIT_PERF_MERGE_SIZES:-100 1000 10000}
+GIT_PERF_MERGE_UNCHANGED=${GIT_PERF_MERGE_UNCHANGED:-10000}
+
+# usage: make-history.perl <n> <unchanged> <scenario> | git fast-import
+write_script make-history.perl "$PERL_PATH" <<-\EOF
+my ($n, $unchanged, $scenario) = @ARGV;
+my $mark = 0;
+
+sub blob {
+	my ($content) = @_;
+	$mark++;
+	print "blob\nmark :$mark\ndata ", length($content), "\n$content\n";
+	return $mark;
+}
+
+sub commit {
+	my ($ref, $from, @changes) = @_;
+	my $ident = "A U Thor <author\@example.com> 1112911993 -0700";
+	$mark++;
+	print "commit $ref\nmark :$mark\n";
+	print "author $ident\ncommitter $ident\n";
+	my $msg = substr($ref, length("refs/heads/"));
+	print "data ", length($msg), "\n$msg\n";
+	print "from :$from\n" if $from;
+	print "$_\n" for @changes;
+	print "\n";
+	return $mark;
+}
+
+sub content {
+	my ($i, $middle, $final) = @_;
+	return "$i\n2\n3\n4\n$middle\n6\n7\n8\n9\n$final\n";
+}
+
+sub dir { return int($_[0] / 100); }
+sub path { return sprintf "dir%d/file%d", dir($_[0]), $_[0]; }
+
+sub moved {
+	my ($i) = @_;
+	return undef if $scenario eq "none";
+	return undef if $scenario eq "some" && $i % 10;
+	return sprintf "moved%d/file%d", dir($i), $i if $scenario eq "dirs";
+	return sprintf "dir%d/renamed%d", dir($i), $i;
+}
+
+my @changes;
+for my $i (0 .. $n - 1) {
+	push @changes, "M 100644 :" . blob(content($i, 5, 10)) . " " . path($i);
+}
+for my $i (0 .. $unchanged - 1) {
+	push @changes, "M 100644 :" . blob("$i\n") .
+		sprintf(" unchanged/%d/%d", int($i / 100), $i);
+}
+my $base = commit("refs/heads/base", undef, @changes);
+
+@changes = ();
+for my $i (0 .. $n - 1) {
+	push @changes, "M 100644 :" . blob(content($i, 5.5, 10)) . " " . path($i);
+}
+if ($scenario eq "dirs") {
+	for my $d (0 .. dir($n - 1)) {
+		push @changes, "M 100644 :" . blob("new $d\n") . " dir$d/new";
+	}
+}
+commit("refs/heads/A", $base, @changes);
+
+@changes = ();
+for my $i (0 .. $n - 1) {
+	my $to = moved($i);
+	my $blob = blob(content($i, 5, 10.5));
+
+	if ($to) {
+		push @changes, "D " . path($i), "M 100644 :$blob $to";
+	} else {
+		push @changes, "M 100644 :$blob " . path($i);
+	}
+}
+commit("refs/heads/B", $base, @changes);
+EOF
+
+for n in $GIT_PERF_MERGE_SIZES
+do
+	for scenario in none some all dirs
+	do
+		repo=scale-$scenario-$n
+		export repo
+
+		test_expect_success "setup $n files, renames: $scenario" '
+			git init -q $repo &&
+			./make-history.perl $n $GIT_PERF_MERGE_UNCHANGED $scenario |
+			git -C $repo fast-import --quiet &&
+			git -C $repo config merge.directoryRenames true &&
+			git -C $repo config merge.renameLimit 0 &&
+			git -C $repo checkout -q --detach A
+		'
+
+		test_perf "merge ($n, $scenario)" '
+			git -C $repo checkout -q -f --detach A &&
+			git -C $repo merge -q --no-edit B
+		'
+
+		test_perf_region merge/renames "merge: rename detection ($n, $scenario)" '
+			git -C $repo checkout -q -f --detach A &&
+			git -C $repo merge -q --no-edit B
+		'
+
+		test_perf_region merge/unpack_trees "merge: unpack_trees ($n, $scenario)" '
+			git -C $repo checkout -q -f --detach A &&
+			git -C $repo merge -q --no-edit B
+		'
+
+		test_perf_region merge/process_entries "merge: process entries ($n, $scenario)" '
+			git -C $repo checkout -q -f --detach A &&
+			git -C $repo merge -q --no-edit B
+		'
+
+		test_perf "rebase ($n, $scenario)" '
+			git -C $repo checkout -q -f --detach A &&
+			git -C $repo rebase -q B
+		'
+
+		test_perf "cherry-pick ($n, $scenario)" '
+			git -C $repo checkout -q -f --detach B &&
+			git -C $repo cherry-pick A >/dev/null
+		'
+	done
+done
+
+test_done
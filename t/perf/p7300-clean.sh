@@ -28,6 +28,14 @@ test_perf 'clean many untracked sub dirs, ignore nested git' '
 	git clean -n -q -f -f -d 100000_sub_dirs/
 '
 
+test_perf 'clean many untracked sub dirs, one thread' '
+	git clean -n -q -f -d --threads=1 100000_sub_dirs/
+'
+
+test_perf 'clean many untracked sub dirs, all threads' '
+	git clean -n -q -f -d --threads=0 100000_sub_dirs/
+'
+
 test_perf 'ls-files -o' '
 	git ls-files -o
 '
@@ -144,7 +144,12 @@ test_run_perf_ () {
 	test_cleanup=:
 	test_export_="test_cleanup"
 	export test_cleanup test_export_
-	"$GTIME" -f "%E %U %S" -o test_time.$i "$SHELL" -c '
+	test_perf_stat_=
+	if test -n "$GIT_PERF_STAT"
+	then
+		test_perf_stat_="perf stat -x, -e $GIT_PERF_STAT -o test_stat.$i --"
+	fi
+	"$GTIME" -f "%E %U %S %M" -o test_time.$i $test_perf_stat_ "$SHELL" -c '
 . '"$TEST_DIRECTORY"/test-lib-functions.sh'
 test_export () {
 	[ $# != 0 ] || return 0
@@ -196,7 +201,17 @@ test_perf_ () {
 	fi
 	for i in $(test_seq 1 $GIT_PERF_REPEAT_COUNT); do
 		say >&3 "running: $2"
-		if test_run_perf_ "$2"
+		if test -n "$test_perf_region_"
+		then
+			GIT_TRACE2_EVENT="$(pwd)/trace2.$i" &&
+			GIT_TRACE2_EVENT_NESTING=100 &&
+			export GIT_TRACE2_EVENT GIT_TRACE2_EVENT_NESTING &&
+			rm -f trace2.$i
+		fi
+		if test_run_perf_ "$2" &&
+		   { test -z "$test_perf_region_" ||
+		     "$TEST_DIRECTORY"/perf/region_time.perl \
+			"$test_perf_region_" trace2.$i >test_time.$i; }
 		then
 			if test -z "$verbose"; then
 				printf " %s" "$i"
@@ -215,12 +230,23 @@ test_perf_ () {
 		test_ok_ "$1"
 	fi
 	"$TEST_DIRECTORY"/perf/min_time.perl test_time.* >"$base".times
+	cat test_time.* >"$base".runs
+	test -z "$GIT_PERF_STAT" || cat test_stat.* >"$base".counters
+	test -z "$test_perf_region_" ||
+	sane_unset GIT_TRACE2_EVENT GIT_TRACE2_EVENT_NESTING
 }
 
 test_perf () {
 	test_wrapper_ test_perf_ "$@"
 }
 
+test_perf_region () {
+	test_perf_region_=$1
+	shift
+	test_wrapper_ test_perf_ "$@"
+	test_perf_region_=
+}
+
 test_size_ () {
 	say >&3 "running: $2"
 	if test_eval_ "$2" 3>"$base".size; then
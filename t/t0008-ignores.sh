@@ -858,4 +858,41 @@ test_expect_success 'info/exclude trumps core.excludesfile' '
 	test_cmp expect actual
 '
 
+test_expect_success 'last match wins in a long list of patterns' '
+	rm -rf many &&
+	mkdir -p many/sub/deep &&
+	for i in $(test_seq 40)
+	do
+		echo "filler$i" &&
+		echo "*.ext$i" &&
+		echo "/dir$i/*.c"
+	done >many/.gitignore &&
+	cat >>many/.gitignore <<-\EOF &&
+	*.o
+	!keep.o
+	sub/deep/
+	!sub/deep/
+	!*.txt
+	/sub/*.txt
+	!sub/b.txt
+	b*
+	EOF
+	cat >expect <<-\EOF &&
+	many/.gitignore:121:*.o	many/a.o
+	many/.gitignore:122:!keep.o	many/keep.o
+	many/.gitignore:124:!sub/deep/	many/sub/deep
+	many/.gitignore:126:/sub/*.txt	many/sub/a.txt
+	many/.gitignore:128:b*	many/sub/b.txt
+	many/.gitignore:128:b*	many/sub/b.o
+	many/.gitignore:1:filler1	many/filler1
+	many/.gitignore:119:*.ext40	many/x.ext40
+	many/.gitignore:120:/dir40/*.c	many/dir40/y.c
+	::	many/dir40/z/y.c
+	EOF
+	git check-ignore -v -n --no-index many/a.o many/keep.o many/sub/deep \
+		many/sub/a.txt many/sub/b.txt many/sub/b.o many/filler1 \
+		many/x.ext40 many/dir40/y.c many/dir40/z/y.c >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -61,4 +61,36 @@ test_expect_success 'stack order' '
 	test_cmp expect actual
 '
 
+cat >expect <<'EOF'
+10
+9
+8
+7
+6
+5:a
+5:b
+4
+3
+2
+1
+EOF
+test_expect_success 'keyed queue: largest key first, then in order added' '
+	test-tool prio-queue keyed 2 6 3 10 9 5:a 7 4 5:b 8 1 dump >actual &&
+	test_cmp expect actual
+'
+
+cat >expect <<'EOF'
+6
+5
+4:a
+4:b
+3
+2
+NULL
+EOF
+test_expect_success 'keyed queue: mixed put and get' '
+	test-tool prio-queue keyed 4:a 2 6 get 5 4:b 3 get dump get >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -16,4 +16,11 @@ test_expect_success 'test-sha1 detects shattered pdf' '
 	grep 38762cf7f55934b34d179ae6a4c80cadccbb7f0a err
 '
 
+test_expect_success 'detected without the SHA instructions of the CPU, too' '
+	test_must_fail env GIT_TEST_HW_SHA=false \
+		test-tool sha1 <"$TEST_DATA/shattered-1.pdf" 2>err &&
+	test_i18ngrep collision err &&
+	grep 38762cf7f55934b34d179ae6a4c80cadccbb7f0a err
+'
+
 test_done
@@ -52,4 +52,15 @@ test_expect_success 'test basic SHA-256 hash values' '
 	grep 6ef19b41225c5369f1c104d45d8d85efa9b057b53b14b4b9b939dd74decc5321 actual
 '
 
+test_expect_success 'SHA instructions of the CPU give the same hashes' '
+	for algo in sha1 sha256
+	do
+		perl -e "$| = 1; print q{abcdefghijklmnopqrstuvwxyz} for 1..100000;" |
+			GIT_TEST_HW_SHA=false test-tool $algo >expect &&
+		perl -e "$| = 1; print q{abcdefghijklmnopqrstuvwxyz} for 1..100000;" |
+			test-tool $algo >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
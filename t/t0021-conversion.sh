@@ -775,6 +775,50 @@ test_expect_success PERL 'delayed checkout in process filter' '
 	)
 '
 
+test_expect_success PERL 'batched checkout in process filter' '
+	test_config_global filter.a.process "rot13-filter.pl a.log clean smudge delay batch" &&
+	test_config_global filter.a.required true &&
+
+	rm -rf repo &&
+	mkdir repo &&
+	(
+		cd repo &&
+		git init &&
+		echo "*.a filter=a" >.gitattributes &&
+		cp "$TEST_ROOT/test.o" test1.a &&
+		cp "$TEST_ROOT/test.o" test2.a &&
+		cp "$TEST_ROOT/test.o" test3.a &&
+		git add . &&
+		git commit -m "test commit"
+	) &&
+
+	S=$(file_size "$TEST_ROOT/test.o") &&
+	cat >a.exp <<-EOF &&
+		START
+		init handshake complete
+		IN: smudge test1.a $S [OK] -- [BATCHED]
+		IN: smudge test2.a $S [OK] -- [BATCHED]
+		IN: smudge test3.a $S [OK] -- [BATCHED]
+		IN: list_available_blobs test1.a test2.a test3.a [OK]
+		IN: smudge test1.a 0 [OK] -- OUT: $S . [OK]
+		IN: smudge test2.a 0 [OK] -- OUT: $S . [OK]
+		IN: smudge test3.a 0 [OK] -- OUT: $S . [OK]
+		IN: list_available_blobs [OK]
+		STOP
+	EOF
+
+	rm -rf repo-cloned &&
+	filter_git clone repo repo-cloned &&
+	test_cmp_count a.exp repo-cloned/a.log &&
+
+	(
+		cd repo-cloned &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" test1.a &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" test2.a &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" test3.a
+	)
+'
+
 test_expect_success PERL 'missing file in delayed checkout' '
 	test_config_global filter.bug.process "rot13-filter.pl bug.log clean smudge delay" &&
 	test_config_global filter.bug.required true &&
@@ -817,4 +861,47 @@ test_expect_success PERL 'invalid file in delayed checkout' '
 	grep "error: external filter .* signaled that .unfiltered. is now available although it has not been delayed earlier" git-stderr.log
 '
 
+test_expect_success PERL 'process filter can be started ahead of a checkout' '
+	test_config_global filter.protocol.process "rot13-filter.pl debug.log clean smudge" &&
+	test_config_global filter.protocol.prestart true &&
+	rm -rf repo &&
+	mkdir repo &&
+	(
+		cd repo &&
+		git init &&
+
+		echo "*.r filter=protocol" >.gitattributes &&
+		cp "$TEST_ROOT/test.o" test.r &&
+		echo plain >plain.txt &&
+		git add . &&
+		git commit -m one &&
+		echo changed >plain.txt &&
+		git commit -a -m two &&
+
+		S=$(file_size test.r) &&
+		rm -f test.r debug.log &&
+		filter_git checkout --quiet --no-progress HEAD -- test.r &&
+		cat >expected.log <<-EOF &&
+			START
+			init handshake complete
+			IN: smudge test.r $S [OK] -- OUT: $S . [OK]
+			STOP
+		EOF
+		test_cmp_exclude_clean expected.log debug.log &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" test.r &&
+
+		# started before it is known whether any file needs it
+		rm -f debug.log &&
+		filter_git checkout --quiet HEAD^ &&
+		cat >expected.log <<-EOF &&
+			START
+			init handshake complete
+			STOP
+		EOF
+		test_cmp_exclude_clean expected.log debug.log &&
+		echo plain >expect &&
+		test_cmp expect plain.txt
+	)
+'
+
 test_done
@@ -28,6 +28,9 @@
 # (7) If data with the pathname "invalid-delay.a" is processed that the
 #     filter will add the path "unfiltered" which was not delayed before
 #     to the "list_available_blobs" response.
+# (8) If data is sent with the "batch" flag, then the filter does not
+#     respond and signals the availability of the object on the next
+#     "list_available_blobs" command.
 #
 
 use 5.008;
@@ -67,6 +70,8 @@ sub gitperllib {
 	'invalid-delay.a' => { "requested" => 0, "count" => 1 },
 );
 
+my %BATCH;
+
 sub rot13 {
 	my $str = shift;
 	$str =~ y/A-Za-z/N-ZA-Mn-za-m/;
@@ -114,6 +119,14 @@ sub rot13 {
 			}
 		}
 
+		foreach my $pathname ( sort keys %BATCH ) {
+			if ( !$BATCH{$pathname}{"listed"} ) {
+				$BATCH{$pathname}{"listed"} = 1;
+				print $debug " $pathname";
+				packet_txt_write("pathname=$pathname");
+			}
+		}
+
 		packet_flush();
 
 		print $debug " [OK]\n";
@@ -129,12 +142,15 @@ sub rot13 {
 		$debug->flush();
 
 		# Read until flush
+		my $batch = 0;
 		my ( $done, $buffer ) = packet_txt_read();
 		while ( $buffer ne '' ) {
 			if ( $buffer eq "can-delay=1" ) {
 				if ( exists $DELAY{$pathname} and $DELAY{$pathname}{"requested"} == 0 ) {
 					$DELAY{$pathname}{"requested"} = 1;
 				}
+			} elsif ( $buffer eq "batch=1" ) {
+				$batch = 1;
 			} else {
 				die "Unknown message '$buffer'";
 			}
@@ -164,6 +180,9 @@ sub rot13 {
 		my $output;
 		if ( exists $DELAY{$pathname} and exists $DELAY{$pathname}{"output"} ) {
 			$output = $DELAY{$pathname}{"output"}
+		} elsif ( exists $BATCH{$pathname} and $BATCH{$pathname}{"listed"} ) {
+			$output = $BATCH{$pathname}{"output"};
+			delete $BATCH{$pathname};
 		} elsif ( $pathname eq "error.r" or $pathname eq "abort.r" ) {
 			$output = "";
 		} elsif ( $command eq "clean" and grep( /^clean$/, @capabilities ) ) {
@@ -174,7 +193,11 @@ sub rot13 {
 			die "bad command '$command'";
 		}
 
-		if ( $pathname eq "error.r" ) {
+		if ( $batch ) {
+			print $debug "[BATCHED]\n";
+			$debug->flush();
+			$BATCH{$pathname} = { "output" => $output, "listed" => 0 };
+		} elsif ( $pathname eq "error.r" ) {
 			print $debug "[ERROR]\n";
 			$debug->flush();
 			packet_txt_write("status=error");
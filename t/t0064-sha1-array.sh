@@ -96,4 +96,24 @@ test_expect_success 'lookup with single duplicate value' '
 	test "$n" -le 1
 '
 
+test_expect_success 'ordered enumeration of many entries' '
+	awk -v len=${#ZERO_OID} "BEGIN {
+		srand(1);
+		for (i = 0; i < 6000; i++) {
+			s = \"\";
+			for (j = 0; j < len; j++)
+				s = s sprintf(\"%x\", int(rand() * 16));
+			print s;
+			if (i % 7 == 0)
+				print s;
+		}
+	}" >oids &&
+	sort -u oids >expect &&
+	{
+		sed "s/^/append /" oids &&
+		echo for_each_unique
+	} | test-tool sha1-array >actual &&
+	test_cmp expect actual
+'
+
 test_done
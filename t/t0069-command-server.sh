@@ -0,0 +1,158 @@
+#!/bin/sh
+
+test_description='git command-server'
+
+. ./test-lib.sh
+
+test -z "$NO_UNIX_SOCKETS" || {
+	skip_all='skipping command-server tests, unix sockets not available'
+	test_done
+}
+
+# don't leave a stale server running
+test_atexit 'git command-server stop 2>/dev/null'
+
+# run "git $@" with and without the server, and check that it was
+# served and gave the same results
+check_served () {
+	GIT_COMMAND_SERVER= git "$@" >expect 2>expect.err &&
+	echo $? >expect.code ||
+	echo $? >expect.code
+	GIT_TRACE2_EVENT="$(pwd)/trace" git "$@" >actual 2>actual.err &&
+	echo $? >actual.code ||
+	echo $? >actual.code
+	grep "\"key\":\"served\",\"value\":\"$1\"" trace &&
+	rm trace &&
+	test_cmp expect actual &&
+	test_cmp expect.err actual.err &&
+	test_cmp expect.code actual.code
+}
+
+test_expect_success 'setup' '
+	cat >.git/info/exclude <<-\EOF &&
+	expect*
+	actual*
+	trace
+	EOF
+	mkdir dir &&
+	echo 1 >file &&
+	echo 2 >dir/file &&
+	git add . &&
+	git commit -m initial &&
+	git commit-graph write --reachable &&
+	test_commit second
+'
+
+test_expect_success 'start the server' '
+	git command-server start &&
+	git command-server status >out &&
+	test_i18ngrep "serving" out &&
+	test_must_fail git command-server start
+'
+
+GIT_COMMAND_SERVER="$(pwd)/.git/command-server.ipc"
+export GIT_COMMAND_SERVER
+
+test_expect_success 'commands run in the server' '
+	check_served ls-files -s &&
+	check_served rev-parse --show-toplevel HEAD &&
+	check_served rev-list --count HEAD &&
+	check_served cat-file -p HEAD &&
+	check_served for-each-ref &&
+	check_served show-ref &&
+	check_served ls-tree -r HEAD &&
+	check_served merge-base HEAD HEAD^
+'
+
+test_expect_success 'standard input, errors and exit code are passed on' '
+	git rev-parse HEAD >expect &&
+	echo HEAD | git cat-file --batch-check >actual &&
+	grep "$(cat expect) commit" actual &&
+	check_served rev-parse --verify nothing-like-this
+'
+
+test_expect_success 'commands run in the working directory of the client' '
+	(
+		cd dir &&
+		check_served rev-parse --show-prefix &&
+		check_served ls-files
+	)
+'
+
+test_expect_success 'the server sees a new index' '
+	echo 3 >dir/new &&
+	git add dir/new &&
+	check_served ls-files -s &&
+	grep dir/new actual
+'
+
+test_expect_success 'the server sees new packs and commit-graph' '
+	test_commit third &&
+	git repack -a -d &&
+	git commit-graph write --reachable &&
+	check_served rev-list HEAD &&
+	check_served cat-file --batch-all-objects --batch-check
+'
+
+test_expect_success 'the server does not use the graph when grafts are set' '
+	git rev-parse HEAD >.git/info/grafts &&
+	test_when_finished "rm .git/info/grafts" &&
+	check_served rev-list --count HEAD &&
+	echo 1 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commands for other repositories are run locally' '
+	git init other &&
+	(
+		cd other &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git rev-parse --git-dir &&
+		! grep "\"key\":\"served\"" trace
+	) &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git --git-dir=other/.git rev-parse --git-dir &&
+	! grep "\"key\":\"served\"" trace
+'
+
+test_expect_success 'commands that write are run locally' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git update-index --refresh &&
+	! grep "\"key\":\"served\"" trace
+'
+
+test_expect_success 'the server exits when the config changes' '
+	test_config foo.bar baz &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git ls-files &&
+	! grep "\"key\":\"served\"" trace &&
+	test_expect_code 1 git command-server status
+'
+
+test_expect_success 'only the owner may connect to the socket' '
+	test_config core.sharedRepository group &&
+	git command-server start &&
+	test_when_finished "git command-server stop" &&
+	ls -l .git/command-server.ipc >mode &&
+	grep "^srwx------ " mode
+'
+
+test_expect_success 'commands from other users are run locally' '
+	GIT_TEST_COMMAND_SERVER_ASSUME_OTHER_PEER=1 git command-server start &&
+	test_when_finished "git command-server stop" &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git ls-files >actual &&
+	! grep "\"key\":\"served\"" trace &&
+	git ls-files >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'stop the server' '
+	git command-server start &&
+	git command-server stop &&
+	test_expect_code 1 git command-server status &&
+	test_path_is_missing .git/command-server.ipc &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git ls-files &&
+	! grep "\"key\":\"served\"" trace
+'
+
+test_done
@@ -107,6 +107,24 @@ test_expect_success 'git-add in subdir does not invalidate sibling cache-tree' '
 	cmp_cache_tree expect
 '
 
+test_expect_success 'git-add of unchanged content keeps cache-tree' '
+	test-tool chmtime +60 foo.t &&
+	git add foo.t &&
+	test_cache_tree
+'
+
+test_expect_success 'commit only hashes the changed trees' '
+	test_when_finished "git reset --hard no-children; git read-tree HEAD" &&
+	mkdir dir1 dir2 &&
+	test_commit dir1/c &&
+	test_commit dir2/d &&
+	echo "I changed this file" >dir1/c.t &&
+	git add dir1/c.t &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git commit -m changed &&
+	grep "\"key\":\"update/hashed\",\"value\":\"2\"" trace.event &&
+	test_cache_tree
+'
+
 test_expect_success 'update-index invalidates cache-tree' '
 	test_when_finished "git reset --hard; git read-tree HEAD" &&
 	echo "I changed this file" >foo &&
@@ -273,4 +291,22 @@ test_expect_success 'switching trees does not invalidate shared index' '
 	)
 '
 
+cat >expect <<\EOF
+invalid                                   (2 subtrees)
+invalid                                  dir1/ (0 subtrees)
+SHA dir2/ (1 entries, 0 subtrees)
+EOF
+
+test_expect_success 'status repairs the cache-tree of unchanged directories' '
+	git checkout -f -b status-repair no-children &&
+	mkdir dir1 dir2 &&
+	test_commit dir1/e &&
+	test_commit dir2/f &&
+	echo "I changed this file" >dir1/e.t &&
+	git add dir1/e.t &&
+	test-tool scrap-cache-tree &&
+	git status &&
+	cmp_cache_tree expect
+'
+
 test_done
@@ -150,6 +150,15 @@ test_expect_success 'perf stream, child processes' '
 	test_cmp expect actual
 '
 
+test_expect_success 'perf stream, timers and counters' '
+	test_when_finished "rm trace.perf actual" &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" test-tool trace2 007timer 3 1 &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" test-tool trace2 008counter 2 3 &&
+	perl "$TEST_DIRECTORY/t0211/scrub_perf.perl" <trace.perf >actual &&
+	grep "^d0|main|timer||||test|name:test1 intervals:3 total:" actual &&
+	grep "^d0|main|counter||||test|name:test1 value:5$" actual
+'
+
 sane_unset GIT_TRACE2_PERF_BRIEF
 
 # Now test without environment variables and get all Trace2 settings
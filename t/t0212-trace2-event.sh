@@ -265,4 +265,42 @@ test_expect_success JSON_PP 'using global config, event stream, error event' '
 	test_cmp expect actual
 '
 
+test_expect_success 'event stream, timer and counter summaries' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		test-tool trace2 007timer 3 1 &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		test-tool trace2 008counter 2 3 &&
+	grep "\"event\":\"timer\".*\"name\":\"test1\",\"intervals\":3," trace.event &&
+	grep "\"event\":\"counter\".*\"name\":\"test1\",\"count\":5}" trace.event &&
+	! grep "\"event\":\"th_" trace.event
+'
+
+test_expect_success PTHREADS 'event stream, per-thread timers and counters' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		test-tool trace2 009threads 3 10 &&
+	grep "\"event\":\"th_counter\".*\"name\":\"test2\",\"count\":10}" trace.event >per-thread &&
+	test_line_count = 3 per-thread &&
+	grep "\"event\":\"th_timer\".*\"name\":\"test2\",\"intervals\":10," trace.event >per-thread &&
+	test_line_count = 3 per-thread &&
+	grep "\"event\":\"timer\".*\"name\":\"test2\",\"intervals\":30," trace.event &&
+	grep "\"event\":\"counter\".*\"name\":\"test2\",\"count\":30}" trace.event
+'
+
+test_expect_success 'event stream, allocation accounting' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" GIT_TRACE2_MEMORY=1 \
+		test-tool trace2 010region test nap 1 &&
+	grep "\"event\":\"region_leave\".*\"label\":\"nap\",\"alloc_bytes\":[0-9]*,\"alloc_count\":[0-9]*,\"peak_rss_kb\":[0-9]*}" trace.event &&
+	grep "\"event\":\"exit\".*\"alloc_bytes\":[1-9][0-9]*,\"alloc_count\":[1-9][0-9]*," trace.event
+'
+
+test_expect_success 'event stream, no allocation accounting by default' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		test-tool trace2 010region test nap 1 &&
+	! grep alloc_bytes trace.event
+'
+
 test_done
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+test_description='test trace2 sampling target'
+. ./test-lib.sh
+
+# Turn off any inherited trace2 settings for this test.
+sane_unset GIT_TRACE2 GIT_TRACE2_PERF GIT_TRACE2_EVENT
+sane_unset GIT_TRACE2_SAMPLE GIT_TRACE2_SAMPLE_INTERVAL
+
+test_expect_success PTHREADS 'sample stream, time in a region' '
+	test_when_finished "rm trace.sample" &&
+	GIT_TRACE2_SAMPLE="$(pwd)/trace.sample" GIT_TRACE2_SAMPLE_INTERVAL=5 \
+		test-tool trace2 010region test nap 500 &&
+	grep "^trace2;main;test:nap [1-9][0-9]*$" trace.sample
+'
+
+test_expect_success PTHREADS 'using global config, sample stream' '
+	test_when_finished "rm trace.sample" &&
+	test_config_global trace2.sampleTarget "$(pwd)/trace.sample" &&
+	test_config_global trace2.sampleInterval 5 &&
+	test-tool trace2 010region test nap 500 &&
+	grep "^trace2;main;test:nap [1-9][0-9]*$" trace.sample
+'
+
+test_done
@@ -108,4 +108,46 @@ test_expect_success SYMLINKS 'use user socket if user directory is a symlink to
 
 helper_test_timeout cache --timeout=1
 
+test_expect_success PERL 'a slow client does not hold up the others' '
+	test_when_finished "git credential-cache exit" &&
+	check approve cache <<-\EOF &&
+	protocol=https
+	host=example.com
+	username=store-user
+	password=store-pass
+	EOF
+	write_script hold-connection "$PERL_PATH" <<-\EOF &&
+	use IO::Socket::UNIX;
+	my $s = IO::Socket::UNIX->new(Peer => shift) or die;
+	$s->autoflush(1);
+	print $s "action=get\n";
+	open my $fh, ">", "connected" or die;
+	close $fh;
+	for (1..60) {
+		exit 0 if -e "done";
+		sleep 1;
+	}
+	open $fh, ">", "timed-out" or die;
+	EOF
+	{ ./hold-connection "$HOME/.cache/git/credential/socket" & } &&
+	for i in $(test_seq 30)
+	do
+		test -f connected && break
+		sleep 1
+	done &&
+	test -f connected &&
+	check fill cache <<-\EOF &&
+	protocol=https
+	host=example.com
+	--
+	protocol=https
+	host=example.com
+	username=store-user
+	password=store-pass
+	EOF
+	>done &&
+	wait &&
+	test_path_is_missing timed-out
+'
+
 test_done
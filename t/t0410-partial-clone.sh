@@ -492,6 +492,44 @@ test_expect_success 'gc stops traversal when a missing but promised object is re
 	! grep "$TREE_HASH" out
 '
 
+test_expect_success 'gc --auto prefetches blobs of recent checkouts' '
+	rm -rf server client &&
+	test_create_repo server &&
+	mkdir server/a server/b &&
+	echo a >server/a/file &&
+	echo b >server/b/file &&
+	git -C server add a b &&
+	git -C server commit -m base &&
+	git -C server branch topic &&
+	git -C server config uploadpack.allowfilter 1 &&
+	git -C server config uploadpack.allowanysha1inwant 1 &&
+
+	git clone --filter=blob:none "file://$(pwd)/server" client &&
+	git -C client checkout topic &&
+	git -C client checkout master &&
+
+	echo a2 >server/a/file &&
+	echo b2 >server/b/file &&
+	git -C server commit -am "on topic" &&
+	git -C server branch -f topic &&
+	git -C client fetch origin &&
+	A2=$(git -C client rev-parse origin/topic:a/file) &&
+	B2=$(git -C client rev-parse origin/topic:b/file) &&
+
+	git -C client config core.sparseCheckout true &&
+	echo "/a/" >client/.git/info/sparse-checkout &&
+	git -C client config gc.autoDetach false &&
+	git -C client gc --auto &&
+	git -C client rev-list --objects --missing=print origin/topic >objects &&
+	grep "?$A2" objects &&
+
+	git -C client config gc.prefetchBlobs true &&
+	git -C client gc --auto &&
+	git -C client rev-list --objects --missing=print origin/topic >objects &&
+	! grep "?$A2" objects &&
+	grep "?$B2" objects
+'
+
 . "$TEST_DIRECTORY"/lib-httpd.sh
 start_httpd
 
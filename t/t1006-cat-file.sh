@@ -549,6 +549,127 @@ test_expect_success 'git cat-file --batch --follow-symlink returns correct sha a
 	test_cmp expect actual
 '
 
+test_expect_success 'cat-file --batch --threads matches single-threaded output' '
+	git rev-list --objects --all >objects &&
+	{
+		cut -d" " -f1 objects &&
+		echo deadbeef &&
+		echo HEAD:does-not-exist &&
+		echo HEAD:morx some rest &&
+		echo HEAD:broken
+	} >input &&
+	git cat-file --batch --follow-symlinks <input >expect &&
+	git cat-file --batch --follow-symlinks --threads=4 <input >actual &&
+	test_cmp expect actual &&
+	git -c core.bigFileThreshold=1 cat-file --batch --follow-symlinks \
+		--threads=3 --buffer <input >actual &&
+	test_cmp expect actual &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(rest)" \
+		<input >expect &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(rest)" \
+		--threads=2 <input >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file --threads requires a batch mode' '
+	test_must_fail git cat-file --threads=2 -t HEAD
+'
+
+test_expect_success '--batch-command mixes info and contents' '
+	git rev-parse HEAD HEAD^{tree} >names &&
+	git cat-file --batch <names >expect &&
+	echo deadbeef missing >>expect &&
+	git cat-file --batch-check <names >>expect &&
+	{
+		sed "s/^/contents /" names &&
+		echo "info deadbeef" &&
+		sed "s/^/info /" names
+	} >cmds &&
+	git cat-file --batch-command <cmds >actual &&
+	test_cmp expect actual &&
+	git cat-file --batch-command --buffer <cmds >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-command with %(rest) and flush' '
+	echo "$(git rev-parse HEAD) foo bar" >expect &&
+	cat >cmds <<-\EOF &&
+	info HEAD foo bar
+	flush
+	EOF
+	git cat-file --batch-command="%(objectname) %(rest)" --buffer \
+		<cmds >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-command rejects bad input' '
+	echo flush >cmds &&
+	test_must_fail git cat-file --batch-command <cmds 2>err &&
+	test_i18ngrep "only for --buffer" err &&
+	echo "frobnicate HEAD" >cmds &&
+	test_must_fail git cat-file --batch-command <cmds 2>err &&
+	test_i18ngrep "unknown command" err &&
+	echo " info HEAD" >cmds &&
+	test_must_fail git cat-file --batch-command <cmds 2>err &&
+	test_i18ngrep "whitespace before command" err &&
+	echo >cmds &&
+	test_must_fail git cat-file --batch-command <cmds 2>err &&
+	test_i18ngrep "empty command" err
+'
+
+test_lazy_prereq ZLIB_PERL 'perl -MCompress::Zlib -e 0'
+
+# Read the answer of "cat-file --batch --zlib" for a single object on
+# stdin, and print the framing line and the (inflated) contents.
+inflate_answer () {
+	perl -MCompress::Zlib -e '
+		binmode STDIN; binmode STDOUT;
+		<STDIN>;
+		my ($how, $len) = split " ", scalar <STDIN>;
+		read(STDIN, my $data, $len) == $len or die "short read";
+		$data = uncompress($data) if $how eq "zlib";
+		defined $data or die "bad zlib stream";
+		print "$how\n$data";
+	'
+}
+
+test_expect_success ZLIB_PERL '--zlib writes packed objects as zlib streams' '
+	git init zlib &&
+	test_commit -C zlib packed &&
+	git -C zlib repack -ad &&
+	echo loose >zlib/loose.t &&
+	git -C zlib add loose.t &&
+	git -C zlib commit -m loose &&
+	for obj in HEAD~1 HEAD:packed.t HEAD~1^{tree}
+	do
+		type=$(git -C zlib cat-file -t $obj) &&
+		echo zlib >expect &&
+		git -C zlib cat-file $type $obj >>expect &&
+		echo $obj | git -C zlib cat-file --batch --zlib >answer &&
+		inflate_answer <answer >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	echo plain >expect &&
+	echo loose >>expect &&
+	echo HEAD:loose.t | git -C zlib cat-file --batch --zlib >answer &&
+	inflate_answer <answer >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--zlib gives the same answers with --threads' '
+	git -C zlib rev-list --objects --all | cut -d" " -f1 >input &&
+	git -C zlib cat-file --batch --zlib <input >expect &&
+	git -C zlib cat-file --batch --zlib --threads=3 <input >actual &&
+	test_cmp expect actual &&
+	git -C zlib cat-file --batch-command --zlib <<-\EOF >actual &&
+	info HEAD
+	EOF
+	git -C zlib cat-file --batch-check <<-\EOF >expect &&
+	HEAD
+	EOF
+	test_cmp expect actual
+'
+
 test_expect_success 'cat-file --batch-all-objects shows all objects' '
 	# make new repos so we know the full set of objects; we will
 	# also make sure that there are some packed and some loose
@@ -0,0 +1,134 @@
+#!/bin/sh
+
+test_description='unpack_trees() with threads
+
+Ensure that unpacking the top-level directories of the trees in threads
+gives the same index, working tree and errors as doing it without threads.
+'
+
+. ./test-lib.sh
+
+# The tests below choose the number of threads themselves.
+sane_unset GIT_TEST_UNPACK_THREADS
+
+# Runs "git $@" in copies of the "repo" repository, without threads
+# in "seq" and with threads in "par", and compares the outcome.
+test_unpack_threads () {
+	rm -rf seq par trace &&
+	cp -R repo seq &&
+	cp -R repo par &&
+	test_might_fail git -C seq -c index.unpackThreads=1 "$@" \
+		>seq.out 2>&1 &&
+	echo $? >seq.rc &&
+	test_might_fail env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		GIT_TEST_UNPACK_THREADS=3 git -C par "$@" >par.out 2>&1 &&
+	echo $? >par.rc &&
+	grep "\"key\":\"parallel/jobs\",\"value\":\"[1-9]" trace &&
+	test_cmp seq.rc par.rc &&
+	test_cmp seq.out par.out &&
+	git -C seq ls-files -s >seq.index &&
+	git -C par ls-files -s >par.index &&
+	test_cmp seq.index par.index &&
+	test-tool -C seq dump-cache-tree >seq.cache-tree &&
+	test-tool -C par dump-cache-tree >par.cache-tree &&
+	test_cmp seq.cache-tree par.cache-tree &&
+	git -C seq status --porcelain --ignored >seq.status &&
+	git -C par status --porcelain --ignored >par.status &&
+	test_cmp seq.status par.status
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		for d in a b c d
+		do
+			mkdir -p $d/sub/deeper &&
+			echo $d >$d/file &&
+			echo $d >$d/sub/file &&
+			echo $d >$d/sub/deeper/file || return 1
+		done &&
+		echo top >top &&
+		echo df >b-df &&
+		mkdir c/df &&
+		echo c >c/df/file &&
+		echo ignored >.gitignore &&
+		git add . &&
+		git commit -m one &&
+		git tag one &&
+
+		echo changed >a/sub/file &&
+		git rm -q b/sub/deeper/file &&
+		rm -rf c/df &&
+		echo df >c/df &&
+		echo new >d/new &&
+		rm b-df &&
+		mkdir -p b-df e &&
+		echo df >b-df/file &&
+		echo e >e/file &&
+		git add -A &&
+		git commit -m two &&
+		git tag two &&
+		git reset -q --hard one
+	)
+'
+
+test_expect_success 'read-tree -m with one tree' '
+	test_unpack_threads read-tree -m two
+'
+
+test_expect_success 'read-tree -m with two trees' '
+	test_unpack_threads read-tree -m one two
+'
+
+test_expect_success 'read-tree -m -u with two trees' '
+	test_unpack_threads read-tree -m -u one two
+'
+
+test_expect_success 'read-tree --reset -u' '
+	git -C repo checkout -q two &&
+	test_when_finished "git -C repo checkout -q -f one" &&
+	echo modified >repo/a/file &&
+	test_unpack_threads read-tree --reset -u one
+'
+
+test_expect_success 'checkout switches branches' '
+	test_unpack_threads checkout -q two
+'
+
+test_expect_success 'reset --hard keeps unrelated index entries' '
+	echo added >repo/a/sub/added &&
+	git -C repo add a/sub/added &&
+	test_when_finished "git -C repo reset -q --hard && rm -f repo/a/sub/added" &&
+	test_unpack_threads reset --hard two
+'
+
+test_expect_success 'checkout keeps local changes' '
+	echo local >repo/d/file &&
+	echo local >repo/top &&
+	test_when_finished "git -C repo checkout -- d/file top" &&
+	test_unpack_threads checkout two
+'
+
+test_expect_success 'read-tree -m -u refuses to lose local changes' '
+	echo local >repo/a/sub/file &&
+	test_when_finished "git -C repo checkout -- a/sub/file" &&
+	test_unpack_threads read-tree -m -u one two &&
+	test_i18ngrep "not uptodate" par.out
+'
+
+test_expect_success 'checkout refuses to overwrite untracked files' '
+	echo untracked >repo/d/new &&
+	test_when_finished "rm repo/d/new" &&
+	test_unpack_threads checkout two &&
+	test_i18ngrep "would be overwritten" par.out
+'
+
+test_expect_success 'checkout overwrites ignored files' '
+	echo ignored >repo/d/new &&
+	echo d/new >repo/.git/info/exclude &&
+	test_when_finished "rm -f repo/d/new repo/.git/info/exclude" &&
+	test_unpack_threads checkout two
+'
+
+test_done
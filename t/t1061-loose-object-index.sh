@@ -0,0 +1,133 @@
+#!/bin/sh
+
+test_description='loose object index
+
+Ensure that the loose object cache is filled from .git/objects/info/loose-index
+only for object directories that did not change since it was written.
+'
+
+. ./test-lib.sh
+
+# The tests below enable the index themselves.
+sane_unset GIT_TEST_LOOSE_OBJECT_INDEX
+
+# Looks up the object "$1" by its abbreviation, and checks how many object
+# directories were read from the index ("$2") and by listing them ("$3").
+check_lookup () {
+	rm -f trace &&
+	prefix=$(echo "$1" | cut -c1-6) &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-parse --disambiguate=$prefix >actual 2>err &&
+	echo "$1" >expect &&
+	test_cmp expect actual &&
+	grep "\"key\":\"read\",\"value\":\"$2\"" trace &&
+	grep "\"key\":\"listed\",\"value\":\"$3\"" trace
+}
+
+# The index only trusts directories modified before it was written; let
+# it look like it was written later than it actually was.
+age_index () {
+	test-tool chmtime +10 .git/objects/info/loose-index
+}
+
+test_expect_success 'setup' '
+	cat >.git/info/exclude <<-\EOF &&
+	trace
+	expect
+	actual
+	err
+	blobs/
+	hashes
+	names
+	EOF
+	test_commit one &&
+	test_commit two &&
+	git config core.looseObjectIndex true
+'
+
+test_expect_success 'the index is written after listing a directory' '
+	test_path_is_missing .git/objects/info/loose-index &&
+	check_lookup $(git rev-parse HEAD) 0 1 &&
+	test_path_is_file .git/objects/info/loose-index
+'
+
+test_expect_success 'unchanged directories are read from the index' '
+	age_index &&
+	check_lookup $(git rev-parse HEAD) 1 0 &&
+	check_lookup $(git rev-parse HEAD^{tree}) 0 1 &&
+	age_index &&
+	check_lookup $(git rev-parse HEAD) 1 0 &&
+	check_lookup $(git rev-parse HEAD^{tree}) 1 0
+'
+
+test_expect_success 'racily clean directories are listed again' '
+	commit=$(git rev-parse HEAD) &&
+	dir=.git/objects/$(echo $commit | cut -c1-2) &&
+	test-tool chmtime =$(test-tool chmtime --get $dir) \
+		.git/objects/info/loose-index &&
+	check_lookup $commit 0 1
+'
+
+test_expect_success 'objects written without the index are found' '
+	age_index &&
+	blob=$(echo unindexed | git -c core.looseObjectIndex=false \
+		hash-object -w --stdin) &&
+	check_lookup $blob 0 1
+'
+
+test_expect_success 'objects written with the index are added to it' '
+	commit=$(git rev-parse HEAD) &&
+	fanout=$(echo $commit | cut -c1-2) &&
+	mkdir blobs &&
+	for i in $(test_seq 2000)
+	do
+		echo $i >blobs/$i || return 1
+	done &&
+	(cd blobs && git hash-object $(test_seq 2000)) >hashes &&
+	name=$(grep -n "^$fanout" hashes | head -n 1 | cut -d: -f1) &&
+	test -n "$name" &&
+	blob=$(sed -n "${name}p" hashes) &&
+	git rev-parse --disambiguate=$commit &&
+	age_index &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git hash-object -w blobs/$name &&
+	grep "\"key\":\"read\",\"value\":\"1\"" trace &&
+	age_index &&
+	check_lookup $blob 1 0 &&
+	check_lookup $commit 1 0
+'
+
+test_expect_success 'objects written by others while we write are kept' '
+	commit=$(git rev-parse HEAD) &&
+	fanout=$(cut -c1-2 hashes | grep -v "^$(echo $commit | cut -c1-2)" |
+		 sort | uniq -d | head -n 1) &&
+	test -n "$fanout" &&
+	grep -n "^$fanout" hashes | head -n 2 | cut -d: -f1 >names &&
+	ours=$(sed -n 1p names) &&
+	theirs=$(sed -n 2p names) &&
+	ours_blob=$(sed -n "${ours}p" hashes) &&
+	theirs_blob=$(sed -n "${theirs}p" hashes) &&
+	test-tool loose-index interleave $ours_blob \
+		blobs/$ours blobs/$theirs &&
+	age_index &&
+	check_lookup $theirs_blob 1 0 &&
+	check_lookup $ours_blob 1 0
+'
+
+test_expect_success 'the index is not written without optional locks' '
+	commit=$(git rev-parse HEAD) &&
+	rm .git/objects/info/loose-index &&
+	GIT_OPTIONAL_LOCKS=0 git rev-parse --disambiguate=$commit &&
+	test_path_is_missing .git/objects/info/loose-index
+'
+
+test_expect_success 'a corrupt index is ignored and replaced' '
+	echo garbage >.git/objects/info/loose-index &&
+	check_lookup $(git rev-parse HEAD) 0 1 &&
+	test_i18ngrep "loose object index file .* is too small" err &&
+	age_index &&
+	check_lookup $(git rev-parse HEAD) 1 0 &&
+	test_must_be_empty err
+'
+
+test_done
@@ -0,0 +1,177 @@
+#!/bin/sh
+
+test_description='sparse checkout with cone patterns
+
+Ensure that matching the sparse-checkout file in cone mode gives the same
+skip-worktree bits and working tree as matching the patterns one by one.
+'
+
+. ./test-lib.sh
+
+# Checks out HEAD in copies of the "repo" repository using the
+# sparse-checkout file "$1", without cone mode in "full" and with
+# cone mode in "cone", and compares the outcome.
+test_cone () {
+	rm -rf full cone &&
+	cp -R repo full &&
+	cp -R repo cone &&
+	git -C full update-index -q --refresh &&
+	git -C cone update-index -q --refresh &&
+	cp "$1" full/.git/info/sparse-checkout &&
+	cp "$1" cone/.git/info/sparse-checkout &&
+	git -C full -c core.sparseCheckout=true read-tree -m -u HEAD \
+		2>full.err &&
+	git -C cone -c core.sparseCheckout=true \
+		-c core.sparseCheckoutCone=true read-tree -m -u HEAD \
+		2>cone.err &&
+	git -C full ls-files -t >full.index &&
+	git -C cone ls-files -t >cone.index &&
+	test_cmp full.index cone.index &&
+	(cd full && find . -path ./.git -prune -o -type f -print | sort) \
+		>full.files &&
+	(cd cone && find . -path ./.git -prune -o -type f -print | sort) \
+		>cone.files &&
+	test_cmp full.files cone.files
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		for d in a a/b a/b/c a/d e e/f g
+		do
+			mkdir -p $d &&
+			echo $d >$d/file &&
+			echo $d >$d/other || return 1
+		done &&
+		echo top >top &&
+		git add . &&
+		git commit -m initial
+	)
+'
+
+test_expect_success 'everything' '
+	echo "/*" >patterns &&
+	test_cone patterns &&
+	test_must_be_empty cone.err &&
+	! grep "^S" cone.index
+'
+
+test_expect_success 'only the top-level directory' '
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	EOF
+	test_cone patterns &&
+	test_must_be_empty cone.err &&
+	grep "^H top" cone.index &&
+	grep "^S a/file" cone.index
+'
+
+test_expect_success 'recursive directories' '
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	/a/
+	!/a/*/
+	/a/b/
+	/e/
+	EOF
+	test_cone patterns &&
+	test_must_be_empty cone.err &&
+	grep "^H a/file" cone.index &&
+	grep "^H a/b/c/file" cone.index &&
+	grep "^S a/d/file" cone.index &&
+	grep "^H e/f/other" cone.index &&
+	grep "^S g/file" cone.index
+'
+
+test_expect_success 'parent directories' '
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	/a/
+	!/a/*/
+	/a/b/
+	!/a/b/*/
+	EOF
+	test_cone patterns &&
+	test_must_be_empty cone.err &&
+	grep "^H a/b/file" cone.index &&
+	grep "^S a/b/c/file" cone.index
+'
+
+test_expect_success 'leading directories are part of the cone' '
+	cat >patterns <<-\EOF &&
+	/a/b/c/
+	EOF
+	rm -rf cone &&
+	cp -R repo cone &&
+	git -C cone update-index -q --refresh &&
+	cp patterns cone/.git/info/sparse-checkout &&
+	git -C cone -c core.sparseCheckout=true \
+		-c core.sparseCheckoutCone=true read-tree -m -u HEAD &&
+	git -C cone ls-files -t >cone.index &&
+	cat >expect <<-\EOF &&
+	H a/b/c/file
+	H a/b/c/other
+	H a/b/file
+	H a/b/other
+	S a/d/file
+	S a/d/other
+	H a/file
+	H a/other
+	S e/f/file
+	S e/f/other
+	S e/file
+	S e/other
+	S g/file
+	S g/other
+	H top
+	EOF
+	test_cmp expect cone.index
+'
+
+test_expect_success 'other patterns disable cone mode' '
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	/a/
+	*.t
+	EOF
+	test_cone patterns &&
+	test_i18ngrep "unrecognized pattern: .\*\.t." cone.err &&
+	test_i18ngrep "disabling cone pattern matching" cone.err
+'
+
+test_expect_success 'negative patterns must follow their directory' '
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	!/a/*/
+	/a/b/
+	EOF
+	test_cone patterns &&
+	test_i18ngrep "unrecognized negative pattern: ./a/\*." cone.err &&
+	test_i18ngrep "disabling cone pattern matching" cone.err
+'
+
+test_expect_success FUNNYNAMES 'escaped characters' '
+	mkdir "repo/a/b*" &&
+	echo star >"repo/a/b*/file" &&
+	git -C repo add . &&
+	git -C repo commit -m star &&
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	/a/
+	!/a/*/
+	/a/b\*/
+	EOF
+	test_cone patterns &&
+	test_must_be_empty cone.err &&
+	grep "^H a/b\*/file" cone.index &&
+	grep "^S a/b/file" cone.index
+'
+
+test_done
@@ -0,0 +1,132 @@
+#!/bin/sh
+
+test_description='sparse index
+
+Ensure that with index.sparse, directories outside of the sparse-checkout
+cone are stored as single entries, and that commands give the same
+results as with a full index.
+'
+
+. ./test-lib.sh
+
+# The split index and fsmonitor keep the index full.
+sane_unset GIT_TEST_SPLIT_INDEX
+sane_unset GIT_TEST_FSMONITOR
+
+# Runs "$@" in both "full" and "sparse", and compares their output.
+test_all_match () {
+	(cd full && "$@") >full.out 2>full.err &&
+	(cd sparse && "$@") >sparse.out 2>sparse.err &&
+	test_cmp full.out sparse.out
+}
+
+# Checks that "$2" (read or write) saw "$3" entries in the trace in "$1".
+test_cache_nr () {
+	grep "\"key\":\"$2/cache_nr\",\"value\":\"$3\"" "$1"
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		for d in in in/deep out out/deep out/deeper/x other
+		do
+			mkdir -p $d &&
+			echo $d >$d/a &&
+			echo $d >$d/b || return 1
+		done &&
+		echo top >top &&
+		git add . &&
+		git commit -m initial &&
+		echo changed >in/a &&
+		echo changed >out/deep/a &&
+		git commit -am second
+	) &&
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	/in/
+	EOF
+	for r in full sparse
+	do
+		cp -R repo $r &&
+		git -C $r update-index -q --refresh &&
+		cp patterns $r/.git/info/sparse-checkout &&
+		git -C $r config core.sparseCheckout true &&
+		git -C $r config core.sparseCheckoutCone true || return 1
+	done &&
+	git -C sparse config index.sparse true &&
+	test_all_match git read-tree -m -u HEAD &&
+	test_path_is_missing sparse/out
+'
+
+test_expect_success 'out-of-cone directories are single entries' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C sparse status --porcelain &&
+	test_cache_nr trace read 7 &&
+	! grep ensure_full_index trace &&
+	git -C full ls-files -s -t >expect &&
+	git -C sparse ls-files -s -t >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status' '
+	test_all_match git status --porcelain=v2 &&
+	echo more >>full/in/deep/a &&
+	echo more >>sparse/in/deep/a &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'add and commit inside the cone' '
+	for r in full sparse
+	do
+		echo new >$r/in/new || return 1
+	done &&
+	rm -f trace &&
+	(
+		GIT_TRACE2_EVENT="$(pwd)/trace" &&
+		export GIT_TRACE2_EVENT &&
+		test_all_match git add in
+	) &&
+	test_cache_nr trace write 8 &&
+	! grep ensure_full_index trace &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git commit -q -m in &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'staged changes outside the cone' '
+	test_all_match git reset --soft HEAD~2 &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git status --porcelain=v2 -- out &&
+	test_all_match git status --porcelain=v2 -- in &&
+	test_all_match git diff --cached --name-status &&
+	test_all_match git reset -q --soft ORIG_HEAD
+'
+
+test_expect_success 'a path inside a sparse directory expands the index' '
+	for r in full sparse
+	do
+		mkdir -p $r/out &&
+		echo new >$r/out/new || return 1
+	done &&
+	test_all_match git add out/new &&
+	test_all_match git ls-files -s -t &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git commit -q -m out &&
+	test_all_match git rev-parse HEAD^{tree}
+'
+
+test_expect_success 'commands that need a full index expand it' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C sparse ls-files >actual &&
+	grep ensure_full_index trace &&
+	git -C full ls-files >expect &&
+	test_cmp expect actual &&
+	test_all_match git checkout -q HEAD~ &&
+	test_all_match git ls-files -s -t &&
+	test_all_match git status --porcelain=v2
+'
+
+test_done
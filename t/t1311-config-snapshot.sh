@@ -0,0 +1,136 @@
+#!/bin/sh
+
+test_description='config snapshot'
+
+. ./test-lib.sh
+
+# Run git with the remaining arguments and store in "snapshot" what it
+# did with the snapshot: "used", "stale" and/or "written".
+snapshot_git () {
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git "$@" &&
+	sed -n "s/.*\"key\":\"snapshot\",\"value\":\"\([a-z]*\)\".*/\1/p" \
+		trace.event >snapshot
+}
+
+# Pretend the config files were written a while ago, so that the
+# snapshot is not refused for being racy.
+age_config () {
+	for f in .git/config "$@"
+	do
+		test-tool chmtime =-10 "$f" || return 1
+	done
+}
+
+# Check what the first read of the config found ("used", "stale" or
+# "none"), and whether a new snapshot was written.
+expect_snapshot () {
+	echo "$1" >expect.first &&
+	{ cat snapshot && echo none; } |
+		sed -e "s/written/none/" -e q >actual.first &&
+	test_cmp expect.first actual.first &&
+	case "$2" in
+	written) grep written snapshot ;;
+	*) ! grep written snapshot ;;
+	esac
+}
+
+test_expect_success 'no snapshot unless asked for' '
+	git config foo.bar one &&
+	age_config &&
+	snapshot_git var -l &&
+	test_path_is_missing .git/config-snapshot &&
+	test_must_be_empty snapshot
+'
+
+test_expect_success 'snapshot is written and then used' '
+	git config core.configSnapshot true &&
+	age_config &&
+	snapshot_git var -l >expect &&
+	expect_snapshot none written &&
+	test_path_is_file .git/config-snapshot &&
+	snapshot_git var -l >actual &&
+	expect_snapshot used &&
+	test_cmp expect actual &&
+	grep "^foo.bar=one$" actual
+'
+
+test_expect_success 'values keep their origin and scope' '
+	test-tool config iterate >expect &&
+	snapshot_git config --list >/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" test-tool config iterate >actual &&
+	grep "\"value\":\"used\"" trace.event &&
+	test_cmp expect actual
+'
+
+test_expect_success 'command-line config applies on top of the snapshot' '
+	snapshot_git -c foo.bar=cmdline var -l >actual &&
+	expect_snapshot used &&
+	test_write_lines foo.bar=one foo.bar=cmdline >expect &&
+	grep "^foo.bar=" actual >actual.foo &&
+	test_cmp expect actual.foo
+'
+
+test_expect_success 'aliases are looked up in the snapshot' '
+	git config alias.foo-value "config foo.bar" &&
+	age_config &&
+	snapshot_git var -l &&
+	snapshot_git foo-value >actual &&
+	expect_snapshot used &&
+	echo one >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'changing the repository config invalidates the snapshot' '
+	git config foo.bar two &&
+	age_config &&
+	snapshot_git var -l >actual &&
+	expect_snapshot stale written &&
+	grep "^foo.bar=two$" actual
+'
+
+test_expect_success 'creating a global config invalidates the snapshot' '
+	test_when_finished "rm -f \"$HOME/.gitconfig\"" &&
+	snapshot_git var -l &&
+	expect_snapshot used &&
+	git config --global foo.global yes &&
+	age_config "$HOME/.gitconfig" &&
+	snapshot_git var -l >actual &&
+	expect_snapshot stale written &&
+	grep "^foo.global=yes$" actual
+'
+
+test_expect_success 'changing an included file invalidates the snapshot' '
+	echo "[foo] included = one" >included &&
+	git config include.path ../included &&
+	age_config included &&
+	snapshot_git var -l &&
+	expect_snapshot stale written &&
+	echo "[foo] included = two" >included &&
+	age_config included &&
+	test-tool chmtime =-5 included &&
+	snapshot_git var -l >actual &&
+	expect_snapshot stale written &&
+	grep "^foo.included=two$" actual
+'
+
+test_expect_success 'no snapshot with includeIf.onbranch' '
+	git config includeIf.onbranch:master.path ../included &&
+	age_config &&
+	snapshot_git var -l &&
+	expect_snapshot stale &&
+	test_path_is_missing .git/config-snapshot &&
+	git config --unset includeIf.onbranch:master.path
+'
+
+test_expect_success 'turning the snapshot off removes it' '
+	age_config &&
+	snapshot_git var -l &&
+	test_path_is_file .git/config-snapshot &&
+	git config core.configSnapshot false &&
+	snapshot_git var -l &&
+	expect_snapshot stale &&
+	test_path_is_missing .git/config-snapshot
+'
+
+test_done
@@ -0,0 +1,244 @@
+#!/bin/sh
+
+test_description='reftable ref storage'
+. ./test-lib.sh
+
+tables () {
+	grep -c . "$1/.git/reftable/tables.list"
+}
+
+test_expect_success 'init --ref-format=reftable' '
+	git init --ref-format=reftable repo &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	test_path_is_file repo/.git/refs/heads &&
+	echo reftable >expect &&
+	git -C repo config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryFormatVersion >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown ref format is rejected' '
+	test_must_fail git init --ref-format=bogus bogus 2>err &&
+	test_i18ngrep "unknown ref storage format" err &&
+	test_path_is_missing bogus
+'
+
+test_expect_success 'reinit with a different format dies' '
+	test_must_fail git init --ref-format=files repo 2>err &&
+	test_i18ngrep "different ref storage format" err &&
+	git init --ref-format=reftable repo &&
+	git init repo
+'
+
+test_expect_success 'GIT_DEFAULT_REF_FORMAT picks the format' '
+	GIT_DEFAULT_REF_FORMAT=reftable git init env &&
+	test_path_is_file env/.git/reftable/tables.list &&
+	GIT_DEFAULT_REF_FORMAT=files git init env-files &&
+	test_path_is_missing env-files/.git/reftable &&
+	test_must_fail git -C env-files config extensions.refStorage
+'
+
+test_expect_success 'commits and update-ref' '
+	(
+		cd repo &&
+		test_commit A &&
+		test_commit B &&
+		git rev-parse B >expect &&
+		git rev-parse refs/heads/master >actual &&
+		test_cmp expect actual &&
+		git update-ref refs/heads/other A &&
+		git rev-parse A >expect &&
+		git rev-parse other >actual &&
+		test_cmp expect actual &&
+		test_must_fail git update-ref refs/heads/other B B &&
+		git update-ref refs/heads/other B A &&
+		git update-ref -d refs/heads/other &&
+		test_must_fail git rev-parse --verify -q refs/heads/other
+	)
+'
+
+test_expect_success 'update-ref --stdin is atomic' '
+	(
+		cd repo &&
+		test_must_fail git update-ref --stdin <<-EOF &&
+		create refs/heads/one $(git rev-parse A)
+		update refs/heads/master $(git rev-parse A) $(git rev-parse A)
+		EOF
+		test_must_fail git rev-parse --verify -q refs/heads/one &&
+		git rev-parse B >expect &&
+		git rev-parse master >actual &&
+		test_cmp expect actual &&
+
+		git update-ref --stdin <<-EOF &&
+		create refs/heads/one $(git rev-parse A)
+		create refs/heads/two $(git rev-parse B)
+		EOF
+		git rev-parse A B >expect &&
+		git rev-parse one two >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'symbolic refs' '
+	(
+		cd repo &&
+		echo refs/heads/master >expect &&
+		git symbolic-ref HEAD >actual &&
+		test_cmp expect actual &&
+		git symbolic-ref refs/heads/sym refs/heads/one &&
+		git rev-parse A >expect &&
+		git rev-parse sym >actual &&
+		test_cmp expect actual &&
+		git symbolic-ref -d refs/heads/sym &&
+		test_must_fail git rev-parse --verify -q sym
+	)
+'
+
+test_expect_success 'for-each-ref and show-ref' '
+	(
+		cd repo &&
+		cat >expect <<-EOF &&
+		$(git rev-parse master) refs/heads/master
+		$(git rev-parse one) refs/heads/one
+		$(git rev-parse two) refs/heads/two
+		$(git rev-parse A) refs/tags/A
+		$(git rev-parse B) refs/tags/B
+		EOF
+		git for-each-ref --format="%(objectname) %(refname)" >actual &&
+		test_cmp expect actual &&
+		git show-ref >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'annotated tags are peeled' '
+	(
+		cd repo &&
+		git tag -a -m annotated annotated A &&
+		git pack-refs --all &&
+		git rev-parse A >expect &&
+		git show-ref -d annotated | sed -n "2s/ .*//p" >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'branch rename keeps the reflog' '
+	(
+		cd repo &&
+		git branch -m one renamed &&
+		test_must_fail git rev-parse --verify -q one &&
+		git rev-parse A >expect &&
+		git rev-parse renamed >actual &&
+		test_cmp expect actual &&
+		git reflog show renamed >log &&
+		test_line_count = 2 log &&
+		grep "Branch: renamed refs/heads/one to refs/heads/renamed" log
+	)
+'
+
+test_expect_success 'reflog show, expire and delete' '
+	(
+		cd repo &&
+		git reflog show master >log &&
+		test_line_count = 2 log &&
+		git reflog delete master@{0} &&
+		git reflog show master >log &&
+		test_line_count = 1 log &&
+		git reflog expire --expire=all master &&
+		git reflog show master >log &&
+		test_must_be_empty log &&
+		git reflog exists refs/heads/master &&
+		git branch -D renamed &&
+		test_must_fail git reflog exists refs/heads/renamed
+	)
+'
+
+test_expect_success 'd/f conflicts are detected' '
+	(
+		cd repo &&
+		test_must_fail git update-ref refs/heads/master/sub A 2>err &&
+		test_i18ngrep "refs/heads/master" err &&
+		test_must_fail git branch two/sub 2>err &&
+		test_must_fail git symbolic-ref refs/heads/master/sym refs/heads/two
+	)
+'
+
+test_expect_success 'pack-refs compacts the stack into a single table' '
+	(
+		cd repo &&
+		git config reftable.autoCompaction false &&
+		for i in 1 2 3 4 5
+		do
+			git update-ref refs/heads/branch-$i A || return 1
+		done &&
+		test $(tables .) -gt 5 &&
+		git pack-refs &&
+		test $(tables .) = 1 &&
+		git rev-parse A >expect &&
+		git rev-parse branch-3 >actual &&
+		test_cmp expect actual &&
+		git config --unset reftable.autoCompaction
+	)
+'
+
+test_expect_success 'automatic compaction keeps the stack small' '
+	(
+		cd repo &&
+		for i in $(test_seq 1 32)
+		do
+			git update-ref refs/heads/auto-$i B || return 1
+		done &&
+		test $(tables .) -le 6 &&
+		git for-each-ref refs/heads/auto-* >refs &&
+		test_line_count = 32 refs
+	)
+'
+
+test_expect_success 'linked worktrees have their own HEAD' '
+	(
+		cd repo &&
+		git worktree add ../wt -b wt A &&
+		test_path_is_file .git/worktrees/wt/reftable/tables.list &&
+		echo refs/heads/wt >expect &&
+		git -C ../wt symbolic-ref HEAD >actual &&
+		test_cmp expect actual &&
+		echo refs/heads/master >expect &&
+		git symbolic-ref HEAD >actual &&
+		test_cmp expect actual &&
+		git rev-parse A >expect &&
+		git rev-parse worktrees/wt/HEAD >actual &&
+		test_cmp expect actual &&
+		git -C ../wt commit --allow-empty -m wt-commit &&
+		git rev-parse wt >expect &&
+		git -C ../wt rev-parse HEAD >actual &&
+		test_cmp expect actual &&
+		git -C ../wt reflog show HEAD >log &&
+		test_line_count = 2 log
+	)
+'
+
+test_expect_success 'clone into a reftable repository' '
+	GIT_DEFAULT_REF_FORMAT=reftable git clone repo clone &&
+	test_path_is_file clone/.git/reftable/tables.list &&
+	git -C repo rev-parse master >expect &&
+	git -C clone rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	git -C clone rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsck and gc' '
+	(
+		cd repo &&
+		git fsck &&
+		git for-each-ref >expect &&
+		git gc &&
+		git for-each-ref >actual &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_done
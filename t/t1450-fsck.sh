@@ -831,4 +831,87 @@ test_expect_success 'detect corrupt index file in fsck' '
 	test_i18ngrep "bad index file" errors
 '
 
+test_expect_success 'fsck --threads checks packed and loose objects' '
+	git init threads &&
+	(
+		cd threads &&
+		test_commit_bulk 500 &&
+		git fsck --threads=1 >expect 2>&1 &&
+		git fsck --threads=4 >actual 2>&1 &&
+		test_cmp expect actual &&
+
+		pack=$(ls .git/objects/pack/pack-*.pack) &&
+		mv $pack packed.pack &&
+		rm -f .git/objects/pack/pack-* &&
+		git unpack-objects <packed.pack &&
+		git fsck --threads=4 >actual 2>&1 &&
+		test_cmp expect actual &&
+
+		blob=$(git rev-parse HEAD:500.t) &&
+		file=.git/objects/$(echo $blob | sed "s|^..|&/|") &&
+		chmod +w $file &&
+		echo garbage >$file &&
+		test_must_fail git fsck --threads=4 2>err &&
+		test_i18ngrep "$blob: object corrupt or missing" err
+	)
+'
+
+test_expect_success 'setup repository with bitmap and commit-graph' '
+	git init trusted &&
+	(
+		cd trusted &&
+		test_commit_bulk 20 &&
+		git repack -adb &&
+		git -c core.commitGraph=true commit-graph write --reachable &&
+		test_commit_bulk --start=21 5 &&
+		git checkout -b side HEAD~3 &&
+		test_commit_bulk --start=40 3 &&
+		git checkout - &&
+		git branch -D side &&
+		git reflog expire --expire=all --all &&
+		echo dangling | git hash-object -w --stdin >dangling
+	)
+'
+
+test_expect_success 'fsck --trust-indexes finds the same unreachable objects' '
+	(
+		cd trusted &&
+		git fsck --unreachable >expect &&
+		test_line_count = 10 expect &&
+		git -c core.commitGraph=true fsck --unreachable \
+			--trust-indexes >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=true fsck --unreachable \
+			--trust-indexes --connectivity-only >actual &&
+		test_cmp expect actual
+	)
+'
+
+# flip the bits of the last byte of a file, i.e. of its checksum
+corrupt_last_byte () {
+	size=$(wc -c <"$1") &&
+	chmod +w "$1" &&
+	printf "\377" |
+	dd of="$1" bs=1 seek=$(($size - 1)) conv=notrunc
+}
+
+test_expect_success 'fsck --trust-indexes checks the bitmap checksum' '
+	bitmap=$(ls trusted/.git/objects/pack/*.bitmap) &&
+	cp $bitmap bitmap.bak &&
+	test_when_finished "mv -f bitmap.bak $bitmap" &&
+	corrupt_last_byte $bitmap &&
+	test_must_fail git -C trusted fsck --trust-indexes 2>err &&
+	test_i18ngrep "bitmap file checksum mismatch" err
+'
+
+test_expect_success 'fsck --trust-indexes checks the commit-graph checksum' '
+	graph=trusted/.git/objects/info/commit-graph &&
+	cp $graph graph.bak &&
+	test_when_finished "mv -f graph.bak $graph" &&
+	corrupt_last_byte $graph &&
+	test_must_fail git -C trusted -c core.commitGraph=true \
+		fsck --trust-indexes 2>err &&
+	test_i18ngrep "commit-graph file .* has incorrect checksum" err
+'
+
 test_done
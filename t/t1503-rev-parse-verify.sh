@@ -139,6 +139,37 @@ test_expect_success 'master@{n} for various n' '
 	test_must_fail git rev-parse --verify master@{$Np1}
 '
 
+test_expect_success 'ref@{n} and ref@{date} in a longer reflog' '
+	tree=$(git rev-parse HEAD^{tree}) &&
+	for i in $(test_seq 30)
+	do
+		test_tick &&
+		commit=$(echo $i | git commit-tree $tree) &&
+		git update-ref -m "entry $i" refs/heads/long $commit &&
+		echo "$test_tick $commit" >>entries || return 1
+	done &&
+	n=30 &&
+	while read time commit
+	do
+		n=$(($n - 1)) &&
+		echo $commit >expect &&
+		git rev-parse --verify long@{$n} >actual &&
+		test_cmp expect actual &&
+		git rev-parse --verify long@{$time} >actual &&
+		test_cmp expect actual &&
+		git rev-parse --verify long@{$(($time + 30))} >actual &&
+		test_cmp expect actual || return 1
+	done <entries &&
+	head -n 1 entries >first &&
+	read time commit <first &&
+	echo $commit >expect &&
+	git rev-parse --verify long@{$(($time - 30))} >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "only goes back to" err &&
+	test_must_fail git rev-parse --verify long@{30} 2>err &&
+	test_i18ngrep "only has 30 entries" err
+'
+
 test_expect_success SYMLINKS 'ref resolution not confused by broken symlinks' '
 	ln -s does-not-exist .git/refs/heads/broken &&
 	test_must_fail git rev-parse --verify broken
@@ -110,6 +110,14 @@ test_expect_success 'disambiguate commit' '
 	test $(git rev-parse $commit^) = $(git rev-parse 0000000000e4f)
 '
 
+test_expect_success 'disambiguate commit with the commit-graph' '
+	git commit-graph write --reachable &&
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	git rev-parse --verify 000000000^{commit} &&
+	git -c core.disambiguate=commit rev-parse --verify 000000000 &&
+	test_must_fail git rev-parse --verify 000000000^{tag}
+'
+
 test_expect_success 'log name1..name2 takes only commit-ishes on both ends' '
 	# These are underspecified from the prefix-length point of view
 	# to disambiguate the commit with other objects, but there is only
@@ -72,4 +72,52 @@ test_expect_success 'GIT_INDEX_VERSION takes precedence over config' '
 	)
 '
 
+test_expect_success 'index written by threads reads back the same' '
+	test_create_repo threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 100)
+		do
+			mkdir -p d$(($i % 7)) &&
+			echo $i >d$(($i % 7))/f$i || return 1
+		done &&
+		git add . &&
+		git ls-files -s >expect &&
+		for v in 2 4
+		do
+			git -c index.threads=4 -c index.recordOffsetTable=true \
+				update-index --index-version $v &&
+			test-tool index-version <.git/index >version &&
+			echo $v >expect.version &&
+			test_cmp expect.version version &&
+			git -c index.threads=1 ls-files -s >actual.serial &&
+			git -c index.threads=4 ls-files -s >actual.threaded &&
+			test_cmp expect actual.serial &&
+			test_cmp expect actual.threaded || return 1
+		done
+	)
+'
+
+test_expect_success 'index.skipHash writes a null trailing hash' '
+	test_oid_init &&
+	test_create_repo skip-hash &&
+	(
+		cd skip-hash &&
+		echo content >file &&
+		git -c index.skipHash=true add file &&
+		tail -c $(test_oid rawsz) .git/index |
+		od -An -tx1 | tr -d " \n" >actual &&
+		printf "%s" $ZERO_OID >expect &&
+		test_cmp expect actual &&
+		git fsck &&
+		git ls-files -s >files &&
+		test_line_count = 1 files &&
+		git add file &&
+		tail -c $(test_oid rawsz) .git/index |
+		od -An -tx1 | tr -d " \n" >actual &&
+		! test_cmp expect actual &&
+		git fsck
+	)
+'
+
 test_done
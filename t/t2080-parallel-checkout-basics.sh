@@ -0,0 +1,224 @@
+#!/bin/sh
+
+test_description='parallel-checkout basics
+
+Ensure that parallel-checkout basically works on clone and checkout, spawning
+the required number of workers and correctly populating both the index and
+the working tree.
+'
+
+. ./test-lib.sh
+
+# The tests below choose the number of workers themselves.
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+# Runs "git $@" with the given number of workers and a threshold of 0,
+# and checks from the trace2 output how many workers were used.
+test_checkout_workers () {
+	workers=$1 &&
+	shift &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -c checkout.workers=$workers \
+		-c checkout.thresholdForParallelism=0 "$@" &&
+	if test $workers -gt 1
+	then
+		grep "\"key\":\"parallel-checkout/workers\",\"value\":\"$workers\"" trace
+	else
+		! grep "parallel-checkout/workers" trace
+	fi
+}
+
+# Checks that the working tree matches the index and that the index
+# has up-to-date stat information for every entry.
+verify_checkout () {
+	git -C "$1" diff-index --quiet HEAD -- &&
+	git -C "$1" diff-files --quiet &&
+	git -C "$1" status --porcelain >"$1".status &&
+	test_must_be_empty "$1".status
+}
+
+test_expect_success SYMLINKS 'setup repo for checkout with various types of changes' '
+	git init various &&
+	(
+		cd various &&
+		git checkout -b B1 &&
+		echo a >a &&
+		mkdir e &&
+		echo e/x >e/x &&
+		echo b >b &&
+		echo c >c &&
+		echo d >d &&
+		echo f >f &&
+		echo g >g &&
+		echo h >h &&
+		chmod +x f &&
+		ln -s e g2 &&
+		git add -A &&
+		git commit -m B1 &&
+
+		git checkout -b B2 &&
+		echo modified >a &&
+		rm -rf e &&
+		rm b &&
+		mkdir b &&
+		echo b/y >b/y &&
+		echo new >new &&
+		chmod -x f &&
+		chmod +x h &&
+		rm g2 &&
+		ln -s f g2 &&
+		git add -A &&
+		git commit -m B2 &&
+
+		git checkout --orphan B3 &&
+		git reset --hard &&
+		echo other >other &&
+		git add -A &&
+		git commit -m B3
+	)
+'
+
+test_expect_success SYMLINKS 'sequential checkout' '
+	cp -R various various_sequential &&
+	test_checkout_workers 1 -C various_sequential checkout B2 &&
+	verify_checkout various_sequential
+'
+
+test_expect_success SYMLINKS 'parallel checkout' '
+	cp -R various various_parallel &&
+	test_checkout_workers 2 -C various_parallel checkout B2 &&
+	verify_checkout various_parallel &&
+	test_cmp_bin various_sequential/a various_parallel/a &&
+	test_path_is_dir various_parallel/b &&
+	test_path_is_missing various_parallel/e &&
+	test_cmp_bin various_sequential/new various_parallel/new &&
+	test -h various_parallel/g2 &&
+	test "$(readlink various_parallel/g2)" = f
+'
+
+test_expect_success SYMLINKS,POSIXPERM 'parallel checkout keeps the executable bit' '
+	test -x various_parallel/h &&
+	! test -x various_parallel/f
+'
+
+test_expect_success SYMLINKS 'parallel checkout from an unrelated branch' '
+	cp -R various various_unrelated &&
+	git -C various_unrelated checkout B3 &&
+	test_checkout_workers 2 -C various_unrelated checkout B1 &&
+	verify_checkout various_unrelated &&
+	test_path_is_missing various_unrelated/other &&
+	echo e/x >expect &&
+	test_cmp expect various_unrelated/e/x
+'
+
+test_expect_success 'parallel checkout on clone' '
+	git init src &&
+	test_commit -C src one &&
+	test_commit -C src two &&
+	mkdir src/dir &&
+	test_commit -C src three dir/three &&
+	test_checkout_workers 2 clone src clone &&
+	verify_checkout clone &&
+	test_cmp src/dir/three clone/dir/three
+'
+
+test_expect_success 'threshold keeps small checkouts sequential' '
+	rm -rf clone_threshold trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -c checkout.workers=2 \
+		-c checkout.thresholdForParallelism=100 clone src clone_threshold &&
+	grep "parallel-checkout/entries" trace &&
+	! grep "parallel-checkout/workers" trace &&
+	verify_checkout clone_threshold
+'
+
+test_expect_success 'conversions are applied by the workers' '
+	git init conv &&
+	(
+		cd conv &&
+		echo "file.crlf text eol=crlf" >.gitattributes &&
+		echo "file.ident ident" >>.gitattributes &&
+		printf "line1\nline2\n" >file.crlf &&
+		printf "\$Id\$\n" >file.ident &&
+		git add -A &&
+		git commit -m conv
+	) &&
+	test_checkout_workers 2 clone conv conv_clone &&
+	printf "line1\r\nline2\r\n" >expect.crlf &&
+	test_cmp_bin expect.crlf conv_clone/file.crlf &&
+	grep "\$Id: [0-9a-f]* \\$" conv_clone/file.ident &&
+	verify_checkout conv_clone
+'
+
+test_expect_success 'entries with smudge filters are written sequentially' '
+	git init filtered &&
+	(
+		cd filtered &&
+		echo "*.upper filter=upper" >.gitattributes &&
+		echo "plain" >plain &&
+		echo "hello" >a.upper &&
+		git add -A &&
+		git commit -m filtered
+	) &&
+	git -c filter.upper.smudge="tr a-z A-Z" \
+		-c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+		clone filtered filtered_clone &&
+	echo HELLO >expect &&
+	test_cmp expect filtered_clone/a.upper &&
+	echo plain >expect &&
+	test_cmp expect filtered_clone/plain
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are reported on clone' '
+	git init colliding &&
+	(
+		cd colliding &&
+		echo lower >file &&
+		git add file &&
+		git commit -m lower &&
+		git rm --cached file &&
+		echo upper >FILE &&
+		git add FILE &&
+		git update-index --add --cacheinfo 100644,$(git hash-object -w file),file &&
+		git commit -m both
+	) &&
+	git -c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+		clone colliding colliding_clone 2>err &&
+	test_i18ngrep "the following paths have collided" err
+'
+
+test_expect_success 'checkout with a blob cache' '
+	git init blob_cache_src &&
+	(
+		cd blob_cache_src &&
+		test-tool genrandom big 20000 >big &&
+		test-tool genrandom huge 40000 >huge &&
+		echo small >small &&
+		test-tool genrandom crlf 20000 | tr -dc "a-z\n" >crlf &&
+		echo "crlf eol=crlf" >.gitattributes &&
+		git add . &&
+		git commit -m blobs
+	) &&
+	for workers in 1 2
+	do
+		rm -rf blob_cache_clone &&
+		test_checkout_workers $workers -c checkout.blobCache="$(pwd)/blobs" \
+			-c core.bigFileThreshold=30000 \
+			clone blob_cache_src blob_cache_clone &&
+		verify_checkout blob_cache_clone &&
+		test_cmp blob_cache_src/big blob_cache_clone/big &&
+		test_cmp blob_cache_src/huge blob_cache_clone/huge || return 1
+	done &&
+	# The cache only fills up where files can be reflinked, but what
+	# is there must be the blob it is named after, as is.
+	if test -d blobs
+	then
+		find blobs -type f >cached &&
+		while read f
+		do
+			oid=$(echo "$f" | sed -e "s|^blobs/||" -e "s|/||") &&
+			test "$(git hash-object "$f")" = "$oid" || return 1
+		done <cached
+	fi
+'
+
+test_done
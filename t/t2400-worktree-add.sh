@@ -587,4 +587,12 @@ test_expect_success '"add" should not fail because of another bad worktree' '
 	)
 '
 
+test_expect_success 'add fills the untracked cache of the new worktree' '
+	test_when_finished "git worktree remove -f warm-uc" &&
+	test_config core.untrackedCache true &&
+	git worktree add --detach warm-uc &&
+	test-tool -C warm-uc dump-untracked-cache >actual &&
+	grep "^/ .* valid" actual
+'
+
 test_done
@@ -24,4 +24,22 @@ test_expect_success 'no buffer overflow in lazy_init_name_hash' '
 	test-tool lazy-init-name-hash -m
 '
 
+test_expect_success 'directories differing only in case across thread ranges' '
+	git init case &&
+	(
+		cd case &&
+		(
+			test_seq $LAZY_THREAD_COST | sed "s/.*/D_&\/x/" &&
+			test_seq $LAZY_THREAD_COST | sed "s/.*/d_&\/y/"
+		) |
+		sed "s/^/100644 $EMPTY_BLOB	/" |
+		git update-index --index-info &&
+		test-tool lazy-init-name-hash -d -s >single &&
+		test-tool lazy-init-name-hash -d -m >multi &&
+		sort single >expect &&
+		sort multi >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -292,6 +292,17 @@ test_expect_success 'changed message' '
 	test_cmp expected actual
 '
 
+test_expect_success 'candidate pairs can be diffed in threads' '
+	for branch in added removed changed rebased renamed-file reordered
+	do
+		GIT_TEST_RANGE_DIFF_THREADS=1 \
+			git range-diff --no-color topic...$branch >expect &&
+		GIT_TEST_RANGE_DIFF_THREADS=3 \
+			git range-diff --no-color topic...$branch >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_expect_success 'dual-coloring' '
 	sed -e "s|^:||" >expect <<-\EOF &&
 	:<YELLOW>1:  a4b3333 = 1:  f686024 s/5/A/<RESET>
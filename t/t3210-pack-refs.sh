@@ -221,6 +221,43 @@ test_expect_success 'reject packed-refs with a short SHA-1' '
 	test_cmp expected_err err
 '
 
+test_expect_success 'deleting a packed ref leaves the other records alone' '
+	git tag -a -m "an annotated tag" copy-annotated &&
+	git branch copy-a &&
+	git branch copy-doomed &&
+	git branch copy-z &&
+	git pack-refs --all &&
+	grep "^^" .git/packed-refs &&
+	grep -v " refs/heads/copy-doomed\$" .git/packed-refs >expect &&
+	git branch -D copy-doomed &&
+	test_cmp expect .git/packed-refs
+'
+
+test_expect_success 'packing a new ref among packed ones' '
+	git update-ref refs/heads/copy-m HEAD &&
+	git for-each-ref --format="%(objectname) %(refname) %(*objectname)" >expect &&
+	git pack-refs --all &&
+	grep " refs/heads/copy-m\$" .git/packed-refs &&
+	git for-each-ref --format="%(objectname) %(refname) %(*objectname)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'deleting from a packed-refs that is not fully peeled' '
+	git branch copy-doomed &&
+	git pack-refs --all &&
+	{
+		echo "# pack-refs with: peeled " &&
+		grep -v "^#" .git/packed-refs
+	} >packed-refs.tmp &&
+	mv packed-refs.tmp .git/packed-refs &&
+	git branch -D copy-doomed &&
+	head -n 1 .git/packed-refs >actual &&
+	echo "# pack-refs with: peeled fully-peeled sorted " >expect &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q refs/heads/copy-doomed &&
+	git rev-parse --verify refs/heads/copy-z
+'
+
 test_expect_success 'timeout if packed-refs.lock exists' '
 	LOCK=.git/packed-refs.lock &&
 	>"$LOCK" &&
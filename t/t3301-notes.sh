@@ -1203,4 +1203,52 @@ test_expect_success 'empty notes are displayed by git log' '
 	test_cmp expect actual
 '
 
+test_expect_success 'notes.index writes an index when notes are committed' '
+	rm -rf notes-index &&
+	git init notes-index &&
+	(
+		cd notes-index &&
+		git config notes.index true &&
+		test_commit one &&
+		test_commit two &&
+		git notes add -m "note one" one &&
+		test_path_is_file .git/notes-index/refs/notes/commits &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git notes add -m "note two" &&
+		grep "\"key\":\"changed\"" trace &&
+		! grep "\"key\":\"full\"" trace &&
+		git log --format="%s %N" >actual &&
+		git -c notes.index=false log --format="%s %N" >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'notes index is used instead of the notes tree' '
+	(
+		cd notes-index &&
+		tree=$(git rev-parse refs/notes/commits^{tree}) &&
+		file=.git/objects/$(test_oid_to_path $tree) &&
+		mv $file tree.save &&
+		git log --format="%s %N" >actual &&
+		mv tree.save $file &&
+		test_cmp expect actual &&
+		mv $file tree.save &&
+		test_must_fail git -c notes.index=false log --format="%s %N" &&
+		mv tree.save $file
+	)
+'
+
+test_expect_success 'stale notes index is ignored, and gc updates it' '
+	(
+		cd notes-index &&
+		git update-ref refs/notes/commits refs/notes/commits^ &&
+		git -c notes.index=false log --format="%s %N" >expect &&
+		git log --format="%s %N" >actual &&
+		test_cmp expect actual &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.gc" git gc --quiet &&
+		grep "\"key\":\"changed\"" trace.gc &&
+		git log --format="%s %N" >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -1457,4 +1457,32 @@ test_expect_success 'valid author header when author contains single quote' '
 	test_cmp expected actual
 '
 
+test_expect_success 'reword and edit do not run "git commit"' '
+	rebase_setup_and_clean reword-in-process &&
+	test_hook_dir="$(git rev-parse --git-dir)/hooks" &&
+	mkdir -p "$test_hook_dir" &&
+	test_when_finished "rm -f \"$test_hook_dir/commit-msg\"" &&
+	write_script "$test_hook_dir/commit-msg" <<-\EOF &&
+	echo "Hooked: yes" >>"$1"
+	EOF
+	git log -1 --format=%s HEAD^ >expect.edit &&
+	set_fake_editor &&
+	(
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" &&
+		export GIT_TRACE2_EVENT &&
+		FAKE_LINES="1 reword 2 edit 3 4" FAKE_COMMIT_MESSAGE="reworded" \
+			git rebase -i HEAD~4 &&
+		echo amended >file-amended &&
+		git add file-amended &&
+		git rebase --continue
+	) &&
+	git cat-file commit HEAD~2 | sed "1,/^\$/d" >actual &&
+	test_write_lines "reworded" "Hooked: yes" >expect &&
+	test_cmp expect actual &&
+	git log -1 --format=%s HEAD^ >actual &&
+	test_cmp expect.edit actual &&
+	git show HEAD^ -- file-amended | grep "^+amended" &&
+	! grep "\"child_start\".*\"argv\":\[\"git\",\"commit\"" trace.event
+'
+
 test_done
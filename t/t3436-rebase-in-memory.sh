@@ -0,0 +1,130 @@
+#!/bin/sh
+
+test_description='git rebase --in-memory
+
+Picks are made in the object store and the index and the working tree
+are only updated when they are needed.'
+
+. ./test-lib.sh
+
+. "$TEST_DIRECTORY"/lib-rebase.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >shared &&
+	mkdir dir &&
+	echo base >dir/file &&
+	git add shared dir &&
+	test_commit base &&
+
+	git checkout -b topic &&
+	test_commit topic-1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >shared &&
+	git commit -a -m topic-2 &&
+	echo topic >dir/topic &&
+	git add dir/topic &&
+	git commit -m topic-3 &&
+	git rm -q topic-1.t &&
+	git commit -m topic-4 &&
+	test_commit conflict &&
+
+	git checkout -b upstream base &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >shared &&
+	echo upstream >dir/file &&
+	git commit -a -m upstream-1 &&
+	test_commit upstream-2 &&
+	test_commit upstream-conflict conflict.t
+'
+
+test_expect_success 'in-memory rebase gives the same result' '
+	git checkout -b regular topic~1 &&
+	git rebase upstream~1 &&
+	git checkout -b in-memory topic~1 &&
+	git rebase --in-memory upstream~1 &&
+	test_cmp_rev regular^{tree} in-memory^{tree} &&
+	git log --format="%an %ae %at %T%n%B" upstream~1..regular >expect &&
+	git log --format="%an %ae %at %T%n%B" upstream~1..in-memory >actual &&
+	test_cmp expect actual &&
+	git diff --quiet &&
+	git diff --cached --quiet
+'
+
+count_index_writes () {
+	grep "\"region_enter\".*\"label\":\"do_write_index\"" "$1" | wc -l
+}
+
+test_expect_success 'in-memory picks write the index once' '
+	git checkout -b merged topic~1 &&
+	GIT_TRACE2_EVENT="$(pwd)/merge.event" git rebase --merge upstream~1 &&
+	git checkout -b counted topic~1 &&
+	GIT_TRACE2_EVENT="$(pwd)/in-memory.event" \
+		git -c rebase.inMemory=true rebase upstream~1 &&
+	test_cmp_rev merged^{tree} counted^{tree} &&
+	grep "\"region_enter\".*\"label\":\"catch_up\"" in-memory.event >catch-up &&
+	test_line_count = 1 catch-up &&
+	test $(count_index_writes in-memory.event) -lt \
+		$(count_index_writes merge.event) &&
+	git diff --quiet &&
+	git diff --cached --quiet
+'
+
+test_expect_success 'conflicting pick stops with the earlier picks in place' '
+	git checkout -b conflicting topic &&
+	test_must_fail git rebase --in-memory upstream &&
+	git diff --name-only --diff-filter=U >actual &&
+	echo conflict.t >expect &&
+	test_cmp expect actual &&
+	git diff --quiet HEAD -- shared dir &&
+	test_write_lines one 2 3 4 5 6 7 8 nine >expect &&
+	test_cmp expect shared &&
+	echo resolved >conflict.t &&
+	git add conflict.t &&
+	git rebase --continue &&
+	test_path_is_missing .git/rebase-merge &&
+	echo resolved >expect &&
+	test_cmp expect conflict.t
+'
+
+test_expect_success 'edit catches up the working tree before stopping' '
+	git checkout -b edited topic~1 &&
+	set_fake_editor &&
+	FAKE_LINES="1 2 edit 3 4" git rebase -i --in-memory upstream~1 &&
+	git diff --quiet HEAD &&
+	test_path_is_file dir/topic &&
+	git rebase --continue &&
+	test_cmp_rev regular^{tree} edited^{tree}
+'
+
+test_expect_success 'exec sees the picked commits' '
+	git checkout -b exec topic~1 &&
+	git rebase --in-memory -x "git diff --quiet HEAD" upstream~1 &&
+	test_cmp_rev regular^{tree} exec^{tree}
+'
+
+test_expect_success 'untracked files stop the catch-up, --continue retries' '
+	git checkout -b untracked topic~1 &&
+	write_script drop-topic-4 <<-\EOF &&
+	echo untracked >topic-1.t &&
+	grep -v " topic-4$" "$1" >todo.tmp &&
+	mv todo.tmp "$1"
+	EOF
+	test_must_fail env GIT_SEQUENCE_EDITOR=./drop-topic-4 \
+		git rebase -i --in-memory upstream~1 2>err &&
+	test_i18ngrep "could not update the index and the working tree" err &&
+	test_path_is_file .git/rebase-merge/in-memory-base &&
+	rm topic-1.t &&
+	git rebase --continue &&
+	test_path_is_missing .git/rebase-merge &&
+	git log --format=%s -1 >actual &&
+	echo topic-3 >expect &&
+	test_cmp expect actual &&
+	test_path_is_file topic-1.t &&
+	git diff --quiet HEAD
+'
+
+test_expect_success '--in-memory cannot be used with the am backend' '
+	test_must_fail git rebase --in-memory --whitespace=fix upstream &&
+	test_path_is_missing .git/rebase-apply &&
+	test_path_is_missing .git/rebase-merge
+'
+
+test_done
@@ -414,6 +414,46 @@ test_expect_success 'all statuses changed in folder if . is given' '
 	test $(git ls-files --stage | grep ^100755 | wc -l) -eq 0
 '
 
+test_expect_success 'add with core.fsyncObjectFiles=batch' '
+	test_when_finished "git reset -q -- batch" &&
+	mkdir batch &&
+	for i in $(test_seq 10)
+	do
+		echo batch $i >batch/$i || return 1
+	done &&
+	git -c core.fsyncObjectFiles=batch add batch &&
+	git ls-files -s batch >index &&
+	test_line_count = 10 index &&
+	for i in $(test_seq 10)
+	do
+		echo batch $i | git hash-object --stdin >oid &&
+		test_path_is_file .git/objects/$(sed "s|^..|&/|" oid) || return 1
+	done &&
+	ls .git/objects >dirs &&
+	! grep -e incoming -e bulk_fsync dirs
+'
+
+test_expect_success 'add many new files on several threads' '
+	test_when_finished "git reset -q -- many; rm -rf many" &&
+	mkdir many &&
+	for i in $(test_seq 300)
+	do
+		echo many $i >many/$i || return 1
+	done &&
+	printf "a\r\nb\r\n" >many/crlf &&
+	echo "crlf text eol=lf" >many/.gitattributes &&
+	git -c add.threads=4 add many &&
+	git count-objects -v >count &&
+	grep "^packs: 1$" count &&
+	git ls-files -s many >actual &&
+	test_line_count = 302 actual &&
+	git diff --exit-code -- many &&
+	git rm -q -r --cached many &&
+	git -c add.threads=1 add many &&
+	git ls-files -s many >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success CASE_INSENSITIVE_FS 'path is case-insensitive' '
 	path="$(pwd)/BLUB" &&
 	touch "$path" &&
@@ -1241,4 +1241,25 @@ test_expect_success 'stash --keep-index with file deleted in index does not resu
 	test_path_is_missing to-remove
 '
 
+test_expect_success 'stash pop unstages changes but keeps added and deleted paths' '
+	git reset --hard &&
+	test_commit pop-base pop-modified.t &&
+	test_commit pop-deleted &&
+	echo changed >pop-modified.t &&
+	git add pop-modified.t &&
+	echo new >pop-added &&
+	git add pop-added &&
+	git rm -q pop-deleted.t &&
+	git stash &&
+	git stash pop &&
+	cat >expect <<-\EOF &&
+	A  pop-added
+	 D pop-deleted.t
+	 M pop-modified.t
+	EOF
+	git status --porcelain -uno >actual &&
+	test_cmp expect actual &&
+	git diff-index --cached --quiet HEAD -- pop-modified.t pop-deleted.t
+'
+
 test_done
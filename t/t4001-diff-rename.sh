@@ -262,4 +262,72 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'renames are guessed from basenames and directories' '
+	mkdir olddir other &&
+	test_seq 1 20 >olddir/main.c &&
+	test_seq 21 40 >olddir/Makefile &&
+	test_seq 41 60 >other/Makefile &&
+	git add olddir other &&
+	git commit -m "two makefiles" &&
+	git mv olddir newdir &&
+	echo changed >>newdir/main.c &&
+	echo changed >>newdir/Makefile &&
+	git rm -q other/Makefile &&
+	git add newdir &&
+	git commit -m "move with changes" &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git diff -M -l1 --name-status HEAD^ HEAD >actual &&
+	cat >expect <<-\EOF &&
+	R088	olddir/Makefile	newdir/Makefile
+	R086	olddir/main.c	newdir/main.c
+	D	other/Makefile
+	EOF
+	test_cmp expect actual &&
+	grep "\"key\":\"rename/basename\",\"value\":\"1\"" trace &&
+	grep "\"key\":\"rename/directory\",\"value\":\"1\"" trace
+'
+
+test_expect_success 'renames are not guessed when detecting copies' '
+	git diff -C -l1 --name-status HEAD^ HEAD >actual 2>err &&
+	grep "^D.*olddir/main.c" actual &&
+	test_i18ngrep "inexact rename detection was skipped" err
+'
+
+test_expect_success 'setup many similar renames' '
+	mkdir many &&
+	for i in $(test_seq 40)
+	do
+		test_seq $i $((i + 20)) >many/$i || return 1
+	done &&
+	test_write_lines binary Q 1 >many/binary.bin &&
+	printf "Q\000" >>many/binary.bin &&
+	git add many &&
+	git commit -m many &&
+	for i in $(test_seq 40)
+	do
+		echo changed >>many/$i &&
+		git mv many/$i many/new-$((41 - i)) || return 1
+	done &&
+	git mv many/binary.bin many/moved.bin &&
+	git add many &&
+	git commit -m "many renames"
+'
+
+test_expect_success 'threaded rename detection gives the same result' '
+	git -c diff.renameThreads=1 diff -M -C --find-copies-harder \
+		--summary HEAD^ HEAD >expect &&
+	grep "many/{22 => new-19}" expect &&
+	for n in 1 3
+	do
+		rm -f trace &&
+		GIT_TEST_RENAME_THREADS=$n GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git diff -M -C --find-copies-harder \
+			--summary HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"rename/threads\",\"value\":\"$n\"" trace ||
+		return 1
+	done
+'
+
 test_done
@@ -156,4 +156,30 @@ test_expect_success 'run diff with -B -C (#9)' '
 	compare_diff_raw expect current
 '
 
+test_expect_success 'a blob is hashed as text or binary depending on its path' '
+	git init crlf &&
+	(
+		cd crlf &&
+		echo "*.dat -diff" >.gitattributes &&
+		for i in $(test_seq 1 40)
+		do
+			printf "line %d\r\n" $i || return 1
+		done >text.txt &&
+		cp text.txt bin.dat &&
+		git add . &&
+		git commit -m old &&
+		sed -e "s/\r\$//" text.txt >text2.txt &&
+		cp text2.txt bin2.dat &&
+		git rm -q text.txt bin.dat &&
+		git add . &&
+		git diff --cached -M --name-status >actual &&
+		cat >expect <<-\EOF &&
+		D	bin.dat
+		R088	text.txt	bin2.dat
+		A	text2.txt
+		EOF
+		test_cmp expect actual
+	)
+'
+
 test_done
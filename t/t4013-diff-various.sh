@@ -408,4 +408,26 @@ test_expect_success 'diff-tree --stdin with log formatting' '
 	test_cmp expect actual
 '
 
+test_expect_success 'log -p does not depend on core.diffCacheLimit' '
+	for algo in myers patience histogram
+	do
+		git -c core.diffCacheLimit=0 log -p --all --diff-algorithm=$algo >expect &&
+		git -c core.diffCacheLimit=1k log -p --all --diff-algorithm=$algo >actual &&
+		test_cmp expect actual &&
+		git log -p --all --diff-algorithm=$algo >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'log --raw does not depend on core.treeCacheLimit' '
+	git -c core.treeCacheLimit=0 log --raw -r -m --all >expect &&
+	git -c core.treeCacheLimit=1k log --raw -r -m --all >actual &&
+	test_cmp expect actual &&
+	git log --raw -r -m --all >actual &&
+	test_cmp expect actual &&
+	git -c core.treeCacheLimit=0 log --raw -m --all -- dir >expect &&
+	git log --raw -m --all -- dir >actual &&
+	test_cmp expect actual
+'
+
 test_done
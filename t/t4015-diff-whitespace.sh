@@ -2030,4 +2030,22 @@ test_expect_success 'combine --ignore-blank-lines with --function-context' '
 	test_cmp expect actual
 '
 
+test_expect_success '--numstat counts what the patch shows' '
+	test_write_lines a "" b c "" d e >x &&
+	git add x &&
+	git commit -m "numstat base" x &&
+	test_write_lines a b "c " d "" "" e f >x &&
+	git commit -m "numstat change" x &&
+	for opt in "" -w --ignore-blank-lines -b
+	do
+		git show $opt --format= -- x >patch &&
+		sed -n "/^@@/,\$p" patch >hunks &&
+		added=$(grep "^+" hunks | wc -l) &&
+		deleted=$(grep "^-" hunks | wc -l) &&
+		echo $added $deleted x | tr " " "\t" >expect &&
+		git show $opt --format= --numstat -- x >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
@@ -523,4 +523,34 @@ test_expect_success FUNNYNAMES '--combined-all-paths and --cc and funny names' '
 	test_cmp expect actual
 '
 
+test_expect_success 'octopus diffed against its parents in threads' '
+	git checkout --orphan octopus &&
+	git rm -rf . &&
+	test_seq 100 >file &&
+	git add file &&
+	git commit -m base &&
+	for i in 1 2 3 4 5
+	do
+		git checkout -b octo$i octopus &&
+		sed -e "s/^${i}0$/changed by $i/" file >file.new &&
+		mv file.new file &&
+		git commit -a -m octo$i || return 1
+	done &&
+	git checkout octopus &&
+	git checkout -b octo6 octo5 &&
+	git commit --allow-empty -m octo6 &&
+	git checkout octopus &&
+	git merge --no-ff -m octopus octo1 octo2 octo3 octo4 octo5 octo6 &&
+	sed -e "s/^99$/evil/" file >file.new &&
+	mv file.new file &&
+	git commit --amend -a --no-edit &&
+	for opt in -c --cc
+	do
+		git -c diff.combinedThreads=1 show $opt HEAD >expect &&
+		git -c diff.combinedThreads=4 show $opt HEAD >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	grep "^++++++evil" actual
+'
+
 test_done
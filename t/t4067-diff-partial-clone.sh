@@ -100,4 +100,134 @@ test_expect_success 'diff with rename detection batches blobs' '
 	test_line_count = 1 done_lines
 '
 
+test_expect_success 'diff --raw does not fetch blobs' '
+	test_when_finished "rm -rf server client trace" &&
+
+	test_create_repo server &&
+	echo a >server/a &&
+	git -C server add a &&
+	git -C server commit -m x &&
+	echo another-a >server/a &&
+	git -C server commit -a -m x &&
+
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --bare --filter=blob:limit=0 "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client diff --raw HEAD^ HEAD &&
+	! grep "git> done" trace
+'
+
+test_expect_success 'rename detection with --name-status batches blobs' '
+	test_when_finished "rm -rf server client trace" &&
+
+	test_create_repo server &&
+	echo a >server/a &&
+	printf "b\nb\nb\nb\nb\n" >server/b &&
+	git -C server add a b &&
+	git -C server commit -m x &&
+	rm server/b &&
+	printf "b\nb\nb\nb\nbX\n" >server/c &&
+	git -C server add c &&
+	git -C server commit -a -m x &&
+
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --bare --filter=blob:limit=0 "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C client diff --name-status -M HEAD^ HEAD >out &&
+	grep "^R" out &&
+	grep "git> done" trace >done_lines &&
+	test_line_count = 1 done_lines
+'
+
+test_expect_success 'fetch.lazyBatchSize splits the requests' '
+	test_when_finished "rm -rf server client trace" &&
+
+	test_create_repo server &&
+	for i in 1 2 3 4 5
+	do
+		echo $i >server/$i || return 1
+	done &&
+	git -C server add . &&
+	git -C server commit -m x &&
+
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --bare --filter=blob:limit=0 "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C client -c fetch.lazyBatchSize=2 show HEAD &&
+	grep "git> done" trace >done_lines &&
+	test_line_count = 3 done_lines
+'
+
+test_expect_success 'blame batches the blobs of the history' '
+	test_when_finished "rm -rf server client trace" &&
+
+	test_create_repo server &&
+	for i in 1 2 3 4
+	do
+		echo $i >>server/file &&
+		git -C server add file &&
+		git -C server commit -m $i || return 1
+	done &&
+
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --bare --filter=blob:none "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client blame HEAD -- file &&
+	grep "git> done" trace >done_lines &&
+	test_line_count = 1 done_lines
+'
+
+# Make "client" a partial clone of "server" whose top-level directories
+# a, b and c have two versions each, with the trees of the directories
+# missing from it, and all blobs present.
+setup_missing_subtrees () {
+	test_create_repo server &&
+	for d in a b c
+	do
+		mkdir -p server/$d/sub &&
+		echo $d >server/$d/file &&
+		echo $d >server/$d/sub/file || return 1
+	done &&
+	git -C server add . &&
+	git -C server commit -m x &&
+	for d in a b c
+	do
+		echo more >>server/$d/file || return 1
+	done &&
+	git -C server commit -a -m x &&
+
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --bare --filter=blob:limit=1k "file://$(pwd)/server" client &&
+	ls client/objects/pack/pack-* >old_pack &&
+	git -C client rev-list --objects --missing=allow-any --all >objs &&
+	grep -v " [abc]\$" objs | cut -d" " -f1 |
+	git -C client pack-objects objects/pack/pack &&
+	rm $(cat old_pack)
+}
+
+test_expect_success 'diff batches the subtrees it descends into' '
+	test_when_finished "rm -rf server client trace" &&
+	setup_missing_subtrees &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client diff --raw HEAD^ HEAD &&
+	grep "git> done" trace >done_lines &&
+	test_line_count = 1 done_lines
+'
+
+test_expect_success 'read-tree batches the subtrees it descends into' '
+	test_when_finished "rm -rf server client trace" &&
+	setup_missing_subtrees &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client read-tree HEAD &&
+	grep "git> done" trace >done_lines &&
+	test_line_count = 1 done_lines
+'
+
 test_done
@@ -0,0 +1,41 @@
+#!/bin/sh
+
+test_description='diff of large files made of few distinct lines
+
+Diffing these exactly costs too much, and the diff gives up on parts
+of them; what it shows must still be a correct patch.'
+
+. ./test-lib.sh
+
+# Writes $2 lines picked from four, using $1 as the seed.
+repetitive_lines () {
+	awk -v seed="$1" -v n="$2" 'BEGIN {
+		split("{ } id: x:", line, " ");
+		for (i = 0; i < n; i++) {
+			seed = (seed * 1103515245 + 12345) % 2147483648;
+			print line[int(seed / 65536) % 4 + 1];
+		}
+	}'
+}
+
+test_expect_success EXPENSIVE setup '
+	repetitive_lines 1 400000 >one &&
+	repetitive_lines 2 400000 >two &&
+	cp one file &&
+	git add file &&
+	git commit -m one
+'
+
+for algo in myers patience histogram
+do
+	test_expect_success EXPENSIVE "$algo diff of repetitive files applies" '
+		cp two file &&
+		git diff --diff-algorithm=$algo >patch &&
+		git checkout file &&
+		git apply patch &&
+		test_cmp two file &&
+		git checkout file
+	'
+done
+
+test_done
@@ -0,0 +1,91 @@
+#!/bin/sh
+
+test_description='git apply with apply.threads'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	for i in $(test_seq 1 40)
+	do
+		test_seq 1 30 >file$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	for i in $(test_seq 1 40)
+	do
+		sed -e "s/^1[05]\$/&$i/" file$i >tmp &&
+		mv tmp file$i || return 1
+	done &&
+	git diff >clean.patch &&
+	git diff -U8 >wide.patch &&
+	git reset -q --hard &&
+	git tag base &&
+
+	# shift the context of some files, and break others
+	for i in 3 17 25
+	do
+		test_seq 1 5 >>file$i &&
+		test_seq 1 30 >>file$i || return 1
+	done &&
+	printf "x\n" | cat - file8 >tmp && mv tmp file8 &&
+	sed -e "s/^4\$/four/" file11 >tmp &&
+	mv tmp file11 &&
+	sed -e "s/^15\$/fifteen/" file30 >tmp &&
+	mv tmp file30 &&
+	git commit -q -a -m moved &&
+	git tag moved
+'
+
+# Apply "$2" at "$1" once without and once with threads, with the
+# remaining arguments, and make sure nothing tells the two apart.
+compare_apply () {
+	start=$1 patch=$2 &&
+	shift 2 &&
+	for threads in 1 4
+	do
+		git reset -q --hard $start &&
+		test_might_fail git -c apply.threads=$threads apply "$@" \
+			$patch >out.$threads 2>err.$threads &&
+		echo $? >status.$threads &&
+		git diff $start >worktree.$threads &&
+		git diff --cached $start >index.$threads || return 1
+	done &&
+	for f in out err status worktree index
+	do
+		test_cmp $f.1 $f.4 || return 1
+	done
+}
+
+test_expect_success 'clean patch' '
+	compare_apply base clean.patch &&
+	test_cmp clean.patch worktree.4 &&
+	git reset -q --hard base &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -c apply.threads=4 apply clean.patch &&
+	grep "\"speculated\",\"value\":\"40\"" trace
+'
+
+test_expect_success 'clean patch to the index' '
+	compare_apply base clean.patch --index &&
+	test_cmp clean.patch index.4 &&
+	compare_apply base clean.patch --cached &&
+	test_cmp clean.patch index.4
+'
+
+test_expect_success 'patch with offsets, reduced context and failures' '
+	compare_apply moved wide.patch -C2 &&
+	test_i18ngrep "Context reduced" err.4 &&
+	test_i18ngrep "patch does not apply" err.4 &&
+	compare_apply moved wide.patch -C2 --reject &&
+	test_i18ngrep "Rejected hunk" err.4 &&
+	compare_apply moved clean.patch --index --verbose
+'
+
+test_expect_success 'patches touching the same path' '
+	git reset -q --hard base &&
+	git diff HEAD moved >second.patch &&
+	cat clean.patch second.patch >both.patch &&
+	compare_apply base both.patch &&
+	test_i18ngrep "patch does not apply" err.4
+'
+
+test_done
@@ -1061,4 +1061,44 @@ test_expect_success 'am --quit keeps HEAD where it is' '
 	test_cmp expected actual
 '
 
+test_expect_success 'am --batch makes the same commits' '
+	rm -fr .git/rebase-apply &&
+	git reset --hard &&
+	git checkout -b batch-base first &&
+	echo one >batch-one &&
+	git add batch-one &&
+	test_tick &&
+	git commit -m "add one" &&
+	echo more >>file &&
+	git mv batch-one batch-two &&
+	test_tick &&
+	git commit -a -m "move one" &&
+	git rm batch-two &&
+	test_tick &&
+	git commit -m "remove two" &&
+	git format-patch --stdout first.. >series &&
+	git checkout -b batch-normal first &&
+	git am series &&
+	git checkout -b batch first &&
+	git am --batch series &&
+	test_cmp_rev batch-normal batch &&
+	git diff --exit-code &&
+	git diff --cached --exit-code HEAD
+'
+
+test_expect_success 'am --batch stops with the working tree at HEAD' '
+	git checkout -b batch-fail first &&
+	git format-patch --stdout first..batch-base~1 >series &&
+	git format-patch --stdout -1 batch-base | sed -e "s/^-one/-uno/" >>series &&
+	test_must_fail git am --batch series &&
+	test_cmp_rev batch-normal~1 HEAD &&
+	cat batch-two &&
+	git diff --exit-code &&
+	git diff --cached --exit-code HEAD &&
+	git am --skip &&
+	test_path_is_missing .git/rebase-apply &&
+	test_cmp_rev batch-normal~1 HEAD &&
+	git diff --exit-code
+'
+
 test_done
@@ -1707,4 +1707,21 @@ test_expect_success '--exclude-promisor-objects does not BUG-crash' '
 	test_must_fail git log --exclude-promisor-objects source-a
 '
 
+test_expect_success 'decorations of commits in the graph read no object' '
+	rm -rf graph-decorate &&
+	git init graph-decorate &&
+	test_commit -C graph-decorate one &&
+	test_commit -C graph-decorate two &&
+	git -C graph-decorate branch side one &&
+	git -C graph-decorate repack -adq &&
+	git -C graph-decorate config core.commitGraph true &&
+	git -C graph-decorate commit-graph write --reachable &&
+	git -C graph-decorate log --format="%h%d" one >expect &&
+	rm -f trace &&
+	GIT_TRACE_PACK_ACCESS="$(pwd)/trace" \
+		git -C graph-decorate log --format="%h%d" one >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing trace
+'
+
 test_done
@@ -788,4 +788,34 @@ test_expect_success '%S in git log --format works with other placeholders (part
 	test_cmp expect actual
 '
 
+test_expect_success 'log --format without message placeholders reads no commit' '
+	rm -rf graph-format &&
+	git init graph-format &&
+	test_commit -C graph-format one &&
+	test_commit -C graph-format two &&
+	git -C graph-format repack -adq &&
+	git -C graph-format config core.commitGraph true &&
+	git -C graph-format commit-graph write --reachable &&
+	git -C graph-format log --format="%H %% %P%n%h" >expect &&
+	rm -f trace &&
+	GIT_TRACE_PACK_ACCESS="$(pwd)/trace" \
+		git -C graph-format log --format="%H %% %P%n%h" >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing trace &&
+	GIT_TRACE_PACK_ACCESS="$(pwd)/trace" \
+		git -C graph-format log --format="%h %s" >actual &&
+	test_line_count = 2 trace
+'
+
+test_expect_success 'padding a placeholder longer than a short buffer' '
+	subject=$(printf "%0300d" 0 | tr 0 x) &&
+	git commit --allow-empty -m "$subject" &&
+	printf "%s|\n" "$subject" >expect &&
+	git log -1 --format="%<(10)%s|" >actual &&
+	test_cmp expect actual &&
+	printf "..%s|\n" "$(echo "$subject" | cut -c 293-)" >expect &&
+	git log -1 --format="%<(10,ltrunc)%s|" >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -141,4 +141,34 @@ test_expect_success 'log -S looks into binary files' '
 	test_cmp log full-log
 '
 
+test_expect_success 'log -[GS] with threads' '
+	git checkout --orphan GS-threads &&
+	git read-tree --empty &&
+	for i in 1 2 3 4 5 6
+	do
+		echo "line $i" >>a &&
+		echo "other $i" >b &&
+		git add a b &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git cat-file blob HEAD~3:a >b &&
+	git add b &&
+	git commit -q -m "copy a" &&
+	for opt in -Sline -Sother -G^line.4 -G[0-9] -Sline.3
+	do
+		git log --threads=1 --format=%s "$opt" >expect &&
+		git log --threads=4 --format=%s "$opt" >actual &&
+		test_cmp expect actual &&
+		git log --threads=4 --format=%s "$opt" -- b >actual &&
+		git log --threads=1 --format=%s "$opt" -- b >expect &&
+		test_cmp expect actual || return 1
+	done &&
+	git log --threads=4 --format=%s -Sline.3 --pickaxe-regex >actual &&
+	cat >expect <<-\EOF &&
+	copy a
+	commit 3
+	EOF
+	test_cmp expect actual
+'
+
 test_done
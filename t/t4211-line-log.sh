@@ -132,4 +132,27 @@ test_expect_success '--raw is forbidden' '
 	test_must_fail git log -L1,24:b.c --raw
 '
 
+test_expect_success 'log.fastLineRanges follows the same lines' '
+	git checkout --orphan fast-ranges &&
+	git rm -rf . &&
+	test_seq 100 >f &&
+	git add f &&
+	git commit -m "add f" &&
+	sed -e "s/^10$/ten/" f >f.new && mv f.new f &&
+	git commit -a -m "change head" &&
+	sed -e "s/^90$/ninety/" f >f.new && mv f.new f &&
+	git commit -a -m "change tail" &&
+	sed -e "s/^50$/a\\
+b/" f >f.new && mv f.new f &&
+	git commit -a -m "change middle" &&
+	git mv f g &&
+	git commit -m "rename" &&
+	for range in 1,5 8,12 30,40 45,55 88,92 96,101 /^ten/,+3
+	do
+		git log -M -L$range:g >expect &&
+		git -c log.fastLineRanges=true log -M -L$range:g >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
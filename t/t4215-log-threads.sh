@@ -0,0 +1,104 @@
+#!/bin/sh
+
+test_description='git log with patches prepared on threads'
+. ./test-lib.sh
+
+# Compares the output of "git log $*" with and without threads.
+check_log () {
+	git log --threads=1 "$@" >expect &&
+	git log --threads=4 "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >file &&
+	test_write_lines a b c >other &&
+	printf "\0binary\n" >binary &&
+	git add file other binary &&
+	test_tick &&
+	git commit -m root &&
+
+	test_write_lines 1 2 3 4 five 6 7 8 9 >file &&
+	printf "\0binary\nchanged\n" >binary &&
+	test_chmod +x other &&
+	test_tick &&
+	git commit -a -m "change, binary and mode" &&
+
+	git mv other renamed &&
+	test_write_lines 0 1 2 3 4 five 6 7 8 >file &&
+	echo new >new &&
+	git add new &&
+	test_tick &&
+	git commit -a -m "rename, add and change" &&
+
+	git checkout -b side HEAD^ &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+	git rm binary &&
+	test_tick &&
+	git commit -a -m "side, delete" &&
+	git checkout master &&
+	test_tick &&
+	git merge -s ours -m merge side &&
+
+	echo "renamed diff=upper" >.gitattributes &&
+	git config diff.upper.textconv "tr a-z A-Z <" &&
+	echo d >>renamed &&
+	echo "file whitespace=trailing-space" >>.gitattributes &&
+	echo "trailing " >>file &&
+	git add .gitattributes &&
+	test_tick &&
+	git commit -a -m "textconv and whitespace"
+'
+
+test_expect_success 'log -p is the same with threads' '
+	check_log -p &&
+	check_log -p --stat --summary &&
+	check_log -p -M -B &&
+	check_log -p --binary --full-index &&
+	check_log -p -R --relative=
+'
+
+test_expect_success 'diffs of merges are the same with threads' '
+	check_log -p -m &&
+	check_log -p --first-parent -m &&
+	check_log -p --cc
+'
+
+test_expect_success 'colored and word diffs are the same with threads' '
+	check_log -p --color=always &&
+	check_log -p --color=always --color-moved &&
+	check_log -p --word-diff=color &&
+	check_log -p --no-textconv
+'
+
+test_expect_success 'external diff drivers are the same with threads' '
+	test_config diff.upper.command "echo external; :" &&
+	check_log -p --ext-diff &&
+	test_config diff.external "echo everything; :" &&
+	check_log -p --ext-diff
+'
+
+test_expect_success 'limits and filters are the same with threads' '
+	check_log -p -2 &&
+	check_log -p --skip=1 -2 &&
+	check_log -p --reverse &&
+	check_log -p -S five &&
+	check_log -p -- file &&
+	check_log -p --full-diff --parents -- file &&
+	check_log -p --show-linear-break
+'
+
+test_expect_success 'log.threads is used and --threads overrides it' '
+	git -c log.threads=1 log -p >expect &&
+	git -c log.threads=0 log -p >actual &&
+	test_cmp expect actual &&
+	git -c log.threads=-1 log -p --threads=3 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a negative number of threads is rejected' '
+	test_must_fail git log -p --threads=-1 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_done
@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	echo hello >greeting &&
+	echo foo >whatever &&
+	git add numbers greeting whatever &&
+	test_tick &&
+	git commit -m initial &&
+
+	git branch side1 &&
+	git branch side2 &&
+
+	git checkout side1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 11 >numbers &&
+	echo hi >greeting &&
+	git mv whatever renamed &&
+	git commit -a -m modify-stuff &&
+
+	git checkout side2 &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	echo goodbye >greeting &&
+	echo bar >whatever &&
+	git commit -a -m other-modifications &&
+
+	git checkout -b clean side1^ &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 11 >numbers &&
+	git mv whatever renamed &&
+	git commit -a -m clean-side &&
+	git checkout side1 &&
+
+	git clone --bare . bare.git
+'
+
+test_expect_success 'clean merge' '
+	git -C bare.git merge-tree --write-tree clean side2 >actual &&
+	tree=$(cat actual) &&
+	git -C bare.git ls-tree $tree >tree &&
+	grep "	renamed$" tree &&
+	! grep "	whatever$" tree &&
+	git -C bare.git cat-file blob $tree:renamed >renamed &&
+	echo bar >expect &&
+	test_cmp expect renamed &&
+	git -C bare.git cat-file blob $tree:numbers >numbers.merged &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 10 11 >expect &&
+	test_cmp expect numbers.merged &&
+	test_path_is_missing bare.git/index
+'
+
+test_expect_success 'conflicted merge' '
+	test_expect_code 1 \
+		git -C bare.git merge-tree --write-tree side1 side2 >actual &&
+	tree=$(head -n 1 actual) &&
+	git -C bare.git rev-parse \
+		side1^:greeting side1:greeting side2:greeting >oids &&
+	cat >expect <<-EOF &&
+	100644 $(sed -n 1p oids) 1	greeting
+	100644 $(sed -n 2p oids) 2	greeting
+	100644 $(sed -n 3p oids) 3	greeting
+	EOF
+	sed -n "2,/^\$/p" actual | sed "\$d" >conflicts &&
+	test_cmp expect conflicts &&
+	grep "^CONFLICT (content): Merge conflict in greeting" actual &&
+	git -C bare.git cat-file blob $tree:greeting >greeting.merged &&
+	grep "^<<<<<<< side1$" greeting.merged &&
+	grep "^>>>>>>> side2$" greeting.merged &&
+	git -C bare.git cat-file blob $tree:renamed >renamed &&
+	echo bar >expect &&
+	test_cmp expect renamed &&
+	test_path_is_missing bare.git/index
+'
+
+test_expect_success '--no-messages and -z' '
+	test_expect_code 1 git -C bare.git merge-tree --write-tree \
+		--no-messages -z side1 side2 >actual &&
+	tr "\000" Q <actual >actual.q &&
+	! grep CONFLICT actual.q &&
+	grep "1	greetingQ" actual.q
+'
+
+test_expect_success 'the index and working tree are left alone' '
+	git reset --hard &&
+	cp .git/index index.before &&
+	test_expect_code 1 git merge-tree --write-tree side1 side2 &&
+	test_cmp_bin index.before .git/index &&
+	git status --porcelain --untracked-files=no >status &&
+	test_must_be_empty status
+'
+
+test_expect_success 'the trivial mode still takes three trees' '
+	test_must_fail git merge-tree side1 side2 &&
+	test_must_fail git merge-tree --messages side1^ side1 side2
+'
+
+test_done
@@ -333,6 +333,32 @@ test_expect_success GZIP 'remote tar.gz can be disabled' '
 		>remote.tar.gz
 '
 
+test_expect_success GZIP 'tgz with an external gzip' '
+	git -c tar.tgz.command="gzip -cn" archive --format=tgz HEAD >k.tgz &&
+	gzip -d -c <k.tgz >k.tar &&
+	test_cmp_bin b.tar k.tar
+'
+
+test_expect_success GZIP 'internal gzip does not depend on the number of threads' '
+	git init threads &&
+	(
+		cd threads &&
+		test-tool genrandom a 300000 >random &&
+		test_seq 100000 >numbers &&
+		git add random numbers &&
+		git commit -m big &&
+		git -c archive.threads=1 archive --format=tgz HEAD >../t1.tgz &&
+		git -c archive.threads=4 archive --format=tgz -9 HEAD >../t4-9.tgz &&
+		git -c archive.threads=4 archive --format=tgz HEAD >../t4.tgz &&
+		git archive --format=tar HEAD >../t.tar
+	) &&
+	test_cmp_bin t1.tgz t4.tgz &&
+	gzip -d -c <t4.tgz >t4.tar &&
+	test_cmp_bin t.tar t4.tar &&
+	gzip -d -c <t4-9.tgz >t4-9.tar &&
+	test_cmp_bin t.tar t4-9.tar
+'
+
 test_expect_success 'archive and :(glob)' '
 	git archive -v HEAD -- ":(glob)**/sh" >/dev/null 2>actual &&
 	cat >expect <<EOF &&
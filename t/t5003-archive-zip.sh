@@ -158,6 +158,13 @@ test_expect_success 'git archive --format=zip with --output' \
     'git archive --format=zip --output=d2.zip HEAD &&
     test_cmp_bin d.zip d2.zip'
 
+test_expect_success 'git archive --format=zip does not depend on the number of threads' '
+	git -c archive.threads=1 archive --format=zip HEAD >d-t1.zip &&
+	git -c archive.threads=3 archive --format=zip HEAD >d-t3.zip &&
+	test_cmp_bin d-t1.zip d-t3.zip &&
+	test_cmp_bin d.zip d-t3.zip
+'
+
 test_expect_success 'git archive with --output, inferring format (local)' '
 	git archive --output=d3.zip HEAD &&
 	test_cmp_bin d.zip d3.zip
@@ -135,6 +135,20 @@ test_expect_success 'compare delta flavors' '
 	'\'' test-2-$packname_2.pack test-3-$packname_3.pack
 '
 
+test_expect_success 'unpack with core.fsyncObjectFiles=batch' '
+	git init --bare batch.git &&
+	git -C batch.git -c core.fsyncObjectFiles=batch \
+		unpack-objects <test-1-${packname_1}.pack &&
+	(cd batch.git && find objects/?? -type f -print) >files &&
+	test_line_count = $(wc -l <obj-list) files &&
+	while read path
+	do
+		cmp batch.git/$path .git/$path || return 1
+	done <files &&
+	ls batch.git/objects >dirs &&
+	! grep -e incoming -e bulk_fsync dirs
+'
+
 rm -fr .git2
 mkdir .git2
 
@@ -496,4 +510,25 @@ test_expect_success 'make sure index-pack detects the SHA1 collision (large blob
 	)
 '
 
+test_expect_success 'progress shows every percent and traces its totals' '
+	git init progress &&
+	(
+		cd progress &&
+		for i in $(test_seq 100)
+		do
+			echo $i >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m files &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git pack-objects --all --progress pack </dev/null \
+			>/dev/null 2>err &&
+		tr "\015" "\012" <err >lines &&
+		test_i18ngrep "Writing objects:  49% (50/102)" lines &&
+		test_i18ngrep "Writing objects:  50% (51/102)" lines &&
+		test_i18ngrep "Writing objects: 100% (102/102), done" lines &&
+		grep "\"title\":\"Writing objects\",\"total\":102," trace
+	)
+'
+
 test_done
@@ -52,6 +52,14 @@ test_expect_success \
     'index v1 and index v2 should be different' \
     '! cmp "test-1-${pack1}.idx" "test-2-${pack2}.idx"'
 
+test_expect_success 'index-pack hashes non-delta objects in threads' '
+    pack3=$(git pack-objects --window=0 test-3 <obj-list) &&
+    git index-pack --threads=1 -o 3-single.idx "test-3-${pack3}.pack" &&
+    git index-pack --threads=4 -o 3-threads.idx "test-3-${pack3}.pack" &&
+    cmp "test-3-${pack3}.idx" 3-single.idx &&
+    cmp "test-3-${pack3}.idx" 3-threads.idx
+'
+
 test_expect_success \
     'index-pack with index version 1' \
     'git index-pack --index-version=1 -o 1.idx "test-1-${pack1}.pack"'
@@ -65,6 +73,16 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success 'threaded index-pack spreads delta families over threads' '
+	GIT_FORCE_THREADS=1 git index-pack --threads=4 --index-version=2 \
+		-o threaded.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" threaded.idx &&
+	GIT_FORCE_THREADS=1 git -c core.deltaBaseCacheLimit=1k \
+		index-pack --threads=4 --index-version=2 \
+		-o pruned.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" pruned.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
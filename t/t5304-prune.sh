@@ -349,4 +349,14 @@ test_expect_success 'trivial prune with bitmaps enabled' '
 	test_must_fail git cat-file -e $blob
 '
 
+test_expect_success 'prune with bitmaps keeps what recent objects reach' '
+	git repack -adb &&
+	blob=$(echo old-blob-in-recent-tree | git hash-object -w --stdin) &&
+	test-tool chmtime =-86400 .git/objects/$(test_oid_to_path $blob) &&
+	tree=$(printf "100644 blob %s\tfile\n" $blob | git mktree) &&
+	git prune --expire=1.hour.ago &&
+	git cat-file -e $tree &&
+	git cat-file -e $blob
+'
+
 test_done
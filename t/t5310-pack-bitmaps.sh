@@ -112,6 +112,87 @@ test_expect_success 'fetch (partial bitmap)' '
 	test_cmp expect actual
 '
 
+# The client has an old master that is not advertised, so the server
+# has to find out that master reaches it before sending "ready".
+setup_negotiate () {
+	rm -rf negotiate.git trace packets &&
+	git branch negotiate-base master~20 &&
+	git clone --no-local --bare --single-branch -b negotiate-base \
+		. negotiate.git &&
+	git branch -D negotiate-base
+}
+
+test_expect_success 'fetch negotiation looks up haves in the bitmaps' '
+	setup_negotiate &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE_PACKET="$(pwd)/packets" \
+		git --git-dir=negotiate.git fetch origin master:master &&
+	grep "\"key\":\"have-reachability\",\"value\":\"bitmap\"" trace &&
+	grep "fetch< ACK [0-9a-f]* ready" packets &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=negotiate.git rev-parse master >actual &&
+	test_cmp expect actual &&
+	git --git-dir=negotiate.git fsck
+'
+
+test_expect_success 'fetch negotiation without bitmaps' '
+	setup_negotiate &&
+	test_config pack.useBitmaps false &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE_PACKET="$(pwd)/packets" \
+		git --git-dir=negotiate.git fetch origin master:master &&
+	! grep "\"key\":\"have-reachability\"" trace &&
+	grep "fetch< ACK [0-9a-f]* ready" packets &&
+	git --git-dir=negotiate.git fsck
+'
+
+test_expect_success 'fetch checks connectivity up to the bitmaps' '
+	rm -rf connect.git trace &&
+	git clone --no-local --bare . connect.git &&
+	git --git-dir=connect.git repack -adb &&
+	new=$(git commit-tree -p master -m connect master^{tree}) &&
+	git update-ref refs/heads/connect $new &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git --git-dir=connect.git fetch origin connect:connect &&
+	grep "\"key\":\"bitmap-walked\",\"value\":\"1\"" trace &&
+	git --git-dir=connect.git fsck
+'
+
+test_expect_success 'connectivity check without bitmaps' '
+	rm -f trace &&
+	new=$(git commit-tree -p connect -m connect-2 master^{tree}) &&
+	git update-ref refs/heads/connect $new &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git --git-dir=connect.git \
+		-c pack.useBitmaps=false fetch origin connect:connect &&
+	! grep "\"key\":\"bitmap-walked\"" trace &&
+	git --git-dir=connect.git fsck
+'
+
+test_expect_success 'connectivity check with bitmaps finds missing objects' '
+	missing=$(echo missing | git hash-object --stdin) &&
+	cat >broken <<-EOF &&
+	tree $missing
+	author A U Thor <author@example.com> 1112912053 -0700
+	committer C O Mitter <committer@example.com> 1112912053 -0700
+
+	broken
+	EOF
+	broken=$(git hash-object -t commit -w --literally broken) &&
+	git --git-dir=connect.git hash-object -t commit -w --literally broken &&
+	commit=$(git commit-tree -p $broken -m child master^{tree}) &&
+	printf "%s\n^%s\n" $commit $broken |
+	git pack-objects --revs --stdout >child.pack &&
+	{
+		test-tool pkt-line pack \
+			"$ZERO_OID $commit refs/heads/child" 0000 &&
+		cat child.pack
+	} >input &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git --git-dir=connect.git receive-pack . <input >out 2>err &&
+	grep "\"key\":\"bitmap-walked\"" trace &&
+	test_i18ngrep "missing object $missing" err &&
+	test_must_fail git --git-dir=connect.git rev-parse --verify child
+'
+
 test_expect_success 'incremental repack fails when bitmaps are requested' '
 	test_commit more-1 &&
 	test_must_fail git repack -d 2>err &&
@@ -207,6 +288,15 @@ test_expect_success 'full repack, reusing previous bitmaps' '
 	test_line_count = 1 output
 '
 
+test_expect_success 'bitmaps built on top of reused bitmaps are correct' '
+	test_commit_bulk --id=reuse 10 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git repack -ad &&
+	grep "\"key\":\"building_bitmaps_reused\",\"value\":\"[1-9]" trace &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap HEAD~10
+'
+
 test_expect_success 'fetch (full bitmap)' '
 	git --git-dir=clone.git fetch origin master:master &&
 	git rev-parse HEAD >expect &&
@@ -426,4 +516,161 @@ test_expect_success 'fetch with bitmaps can reuse old base' '
 	)
 '
 
+test_expect_success 'setup ref group bitmaps' '
+	git init groups &&
+	(
+		cd groups &&
+		test_commit_bulk --id=file 120 &&
+		for i in 1 2 3 4 5 6
+		do
+			git checkout -q HEAD~$i &&
+			test_commit pull-$i &&
+			git update-ref refs/pull/$i/head HEAD &&
+			git checkout -q master || return 1
+		done &&
+		git config pack.bitmapRefGroup refs/pull &&
+		git repack -adb
+	)
+'
+
+test_expect_success 'ref groups answer --all without a walk' '
+	(
+		cd groups &&
+		git rev-list --objects --all >expect &&
+		rm -f trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git rev-list --use-bitmap-index --objects --all >actual &&
+		grep "\"key\":\"ref-groups-used\",\"value\":\"1\"" trace &&
+		cut -d" " -f1 expect | sort >expect.sorted &&
+		cut -d" " -f1 actual | sort >actual.sorted &&
+		test_cmp expect.sorted actual.sorted
+	)
+'
+
+test_expect_success 'ref groups answer excluded tips' '
+	(
+		cd groups &&
+		git rev-list --objects master --not --glob=refs/pull >expect &&
+		rm -f trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git rev-list --use-bitmap-index --objects \
+			master --not --glob=refs/pull >actual &&
+		grep "\"key\":\"ref-groups-used\",\"value\":\"1\"" trace &&
+		cut -d" " -f1 expect | sort >expect.sorted &&
+		cut -d" " -f1 actual | sort >actual.sorted &&
+		test_cmp expect.sorted actual.sorted
+	)
+'
+
+test_expect_success 'ref group is not used once one of its tips moved' '
+	(
+		cd groups &&
+		git update-ref refs/pull/1/head master~20 &&
+		git rev-list --objects master~10 --not --glob=refs/pull >expect &&
+		rm -f trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git rev-list --use-bitmap-index --objects \
+			master~10 --not --glob=refs/pull >actual &&
+		grep "\"key\":\"ref-groups-used\",\"value\":\"0\"" trace &&
+		cut -d" " -f1 expect | sort >expect.sorted &&
+		cut -d" " -f1 actual | sort >actual.sorted &&
+		test_cmp expect.sorted actual.sorted
+	)
+'
+
+test_expect_success 'roaring bitmaps are written as version 2' '
+	git -c pack.bitmapEncoding=roaring repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_copy_bytes 6 <$bitmap | tail -c 2 | od -An -tx1 >actual &&
+	echo " 00 02" >expect &&
+	test_cmp expect actual &&
+	git rev-list --test-bitmap HEAD &&
+	blob=$(git rev-parse tagged-blob)
+'
+
+rev_list_tests 'roaring bitmap'
+
+test_expect_success 'clone from roaring bitmaps' '
+	git clone --no-local --bare . roaring-clone.git &&
+	git -C roaring-clone.git fsck &&
+	git rev-parse --all >expect &&
+	git -C roaring-clone.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'roaring bitmaps with dense containers' '
+	git init dense &&
+	(
+		cd dense &&
+		test_commit_bulk 1500 &&
+		git -c pack.bitmapEncoding=roaring repack -adb &&
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --objects HEAD~10 ^HEAD~700 |
+			cut -d" " -f1 | sort >expect &&
+		git rev-list --use-bitmap-index --objects HEAD~10 ^HEAD~700 |
+			cut -d" " -f1 | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'bitmaps with a lookup table' '
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap HEAD~20
+'
+
+rev_list_tests 'lookup table'
+
+test_expect_success 'clone from bitmaps with a lookup table' '
+	git clone --no-local --bare . lookup-clone.git &&
+	git -C lookup-clone.git fsck &&
+	git rev-parse --all >expect &&
+	git -C lookup-clone.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'lookup table with roaring bitmaps and reuse' '
+	git -c pack.writeBitmapLookupTable=true \
+		-c pack.bitmapEncoding=roaring repack -adb &&
+	git rev-list --test-bitmap HEAD &&
+	test_commit lookup-reuse &&
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+	git rev-list --use-bitmap-index --objects --all |
+		cut -d" " -f1 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'name-hash version 2 is recorded in the hash cache' '
+	git -c pack.nameHashVersion=2 repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_copy_bytes 8 <$bitmap | tail -c 2 | od -An -tx1 >actual &&
+	echo " 01 01" >expect &&
+	test_cmp expect actual &&
+	git rev-list --test-bitmap HEAD &&
+	blob=$(git rev-parse tagged-blob)
+'
+
+rev_list_tests 'name-hash version 2'
+
+test_expect_success 'clone from bitmaps with name-hash version 2' '
+	git clone --no-local --bare . hash-v2-clone.git &&
+	git -C hash-v2-clone.git fsck &&
+	git rev-parse --all >expect &&
+	git -C hash-v2-clone.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown name-hash version is an error' '
+	test_must_fail git pack-objects --name-hash-version=3 \
+		--all --stdout </dev/null >/dev/null 2>err &&
+	test_i18ngrep "unsupported name-hash version 3" err
+'
+
+test_expect_success 'unknown bitmap encoding is an error' '
+	test_must_fail git -c pack.bitmapEncoding=bogus repack -adb 2>err &&
+	test_i18ngrep "unknown value for .pack.bitmapEncoding." err
+'
+
 test_done
@@ -75,7 +75,7 @@ graph_git_behavior 'no graph' full commits/3 commits/1
 graph_read_expect() {
 	OPTIONAL=""
 	NUM_CHUNKS=3
-	if test ! -z $2
+	if test ! -z "$2"
 	then
 		OPTIONAL=" $2"
 		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
@@ -232,6 +232,24 @@ test_expect_success 'build graph using --reachable' '
 graph_git_behavior 'append graph, commit 8 vs merge 1' full commits/8 merge/1
 graph_git_behavior 'append graph, commit 8 vs merge 2' full commits/8 merge/2
 
+test_expect_success 'rev-list reads no commit that is in the graph' '
+	rm -rf graph-reads &&
+	git init graph-reads &&
+	test_commit -C graph-reads one &&
+	test_commit -C graph-reads two &&
+	git -C graph-reads tag -a -m annotated annotated one &&
+	git -C graph-reads repack -adq &&
+	git -C graph-reads config core.commitGraph true &&
+	git -C graph-reads commit-graph write --reachable &&
+	git -C graph-reads rev-list --all >expect &&
+	rm -f trace &&
+	GIT_TRACE_PACK_ACCESS="$(pwd)/trace" \
+		git -C graph-reads rev-list --all >actual &&
+	test_cmp expect actual &&
+	# only the annotated tag itself is read
+	test_line_count = 1 trace
+'
+
 test_expect_success 'setup bare repo' '
 	cd "$TRASH_DIRECTORY" &&
 	git clone --bare --no-local full bare &&
@@ -585,4 +603,97 @@ test_expect_success 'get_commit_tree_in_graph works for non-the_repository' '
 	test_cmp expect actual
 '
 
+test_expect_success 'setup repo with skewed commit dates' '
+	git init gen-v2 &&
+	(
+		cd gen-v2 &&
+		git config core.commitGraph true &&
+		test_commit first &&
+		GIT_COMMITTER_DATE="@4000000000 +0000" git commit --allow-empty -m future &&
+		GIT_COMMITTER_DATE="@1000 +0000" git commit --allow-empty -m past &&
+		test_commit last
+	)
+'
+
+test_expect_success 'generationVersion=1 does not write generation data' '
+	(
+		cd gen-v2 &&
+		git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
+		graph_read_expect 4 &&
+		git commit-graph verify
+	)
+'
+
+test_expect_success 'generationVersion=2 writes corrected commit dates' '
+	(
+		cd gen-v2 &&
+		git config commitGraph.generationVersion 2 &&
+		git commit-graph write --reachable &&
+		graph_read_expect 4 "generation_data generation_data_overflow" &&
+		git commit-graph verify &&
+		git -c core.commitGraph=false log --topo-order --format=%s >expect &&
+		git log --topo-order --format=%s >actual &&
+		test_cmp expect actual &&
+		test_write_lines last past future first >expect &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=false merge-base --is-ancestor first last &&
+		git merge-base --is-ancestor first last
+	)
+'
+
+test_expect_success 'generation data is ignored when reading with generationVersion=1' '
+	(
+		cd gen-v2 &&
+		git -c commitGraph.generationVersion=1 commit-graph verify &&
+		git -c commitGraph.generationVersion=1 log --topo-order --format=%s >actual &&
+		test_write_lines last past future first >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'detect out-of-range overflow generation data' '
+	graph=gen-v2/.git/objects/info/commit-graph &&
+	cp $graph graph.bak &&
+	test_when_finished "mv -f graph.bak $graph" &&
+	(
+		cd gen-v2 &&
+		graph=.git/objects/info/commit-graph &&
+		gdat=$(perl -0777 -ne "/GDAT(.{8})/s and print unpack(\"N\", substr(\$1, 4))" $graph) &&
+		chmod u+w $graph &&
+		printf "\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377" |
+			dd of=$graph bs=1 seek=$gdat conv=notrunc &&
+		test_must_fail git log --format=%s 2>err &&
+		test_i18ngrep "overflow generation data is too small" err
+	)
+'
+
+test_expect_success 'commitGraph.writeThreads writes the same graph' '
+	git init threads &&
+	(
+		cd threads &&
+		test_commit_bulk --id=main 4200 &&
+		git checkout -b side HEAD~100 &&
+		test_commit_bulk --id=side 300 &&
+		git checkout - &&
+		git merge --no-ff -m merge side &&
+		git repack -d &&
+		git -c commitGraph.writeThreads=1 commit-graph write &&
+		mv .git/objects/info/commit-graph expect &&
+		git -c commitGraph.writeThreads=4 commit-graph write &&
+		test_cmp_bin expect .git/objects/info/commit-graph &&
+		rm .git/objects/info/commit-graph &&
+		git -c commitGraph.writeThreads=4 commit-graph write --reachable &&
+		test_cmp_bin expect .git/objects/info/commit-graph &&
+		git commit-graph verify
+	)
+'
+
+test_expect_success 'commit-graph verify --threads' '
+	(
+		cd threads &&
+		git commit-graph verify --threads=4 &&
+		git commit-graph verify --threads=1
+	)
+'
+
 test_done
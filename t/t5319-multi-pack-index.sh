@@ -520,7 +520,7 @@ test_expect_success 'expire respects .keep files' '
 		PACKA=$(ls .git/objects/pack/a-pack*\.pack | sed s/\.pack\$//) &&
 		touch $PACKA.keep &&
 		git multi-pack-index expire &&
-		ls -S .git/objects/pack/a-pack* | grep $PACKA >a-pack-files &&
+		ls -S .git/objects/pack/a-pack* | grep $PACKA | grep -v "\.rev$" >a-pack-files &&
 		test_line_count = 3 a-pack-files &&
 		test-tool read-midx .git/objects | grep idx >midx-list &&
 		test_line_count = 2 midx-list
@@ -547,4 +547,212 @@ test_expect_success 'repack --batch-size=0 repacks everything' '
 	)
 '
 
+
+chain=.git/objects/pack/multi-pack-index.d/multi-pack-index-chain
+
+incremental_pack () {
+	git rev-list --objects "$@" >revs &&
+	git pack-objects .git/objects/pack/pack <revs >/dev/null
+}
+
+test_expect_success 'write --incremental starts a chain' '
+	git init incremental &&
+	(
+		cd incremental &&
+		git config core.multiPackIndex true &&
+		for i in $(test_seq 1 10)
+		do
+			test_commit base-$i || return 1
+		done &&
+		incremental_pack HEAD &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing .git/objects/pack/multi-pack-index &&
+		test_line_count = 1 $chain &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'a small pack adds a layer' '
+	(
+		cd incremental &&
+		test_commit small-1 &&
+		incremental_pack HEAD^..HEAD &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $chain &&
+		test-tool read-midx .git/objects >out &&
+		grep "^chunks: .* base-layers" out &&
+		grep "^num_base_layers: 1" out &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'small layers are merged with the new one' '
+	(
+		cd incremental &&
+		head -n 1 $chain >expect &&
+		test_commit small-2 &&
+		incremental_pack HEAD^..HEAD &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $chain &&
+		head -n 1 $chain >actual &&
+		test_cmp expect actual &&
+		ls .git/objects/pack/multi-pack-index.d/*.midx >layers &&
+		test_line_count = 2 layers
+	)
+'
+
+test_expect_success 'a big pack merges the whole chain' '
+	(
+		cd incremental &&
+		for i in $(test_seq 1 20)
+		do
+			test_commit big-$i || return 1
+		done &&
+		incremental_pack HEAD~20..HEAD &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 1 $chain &&
+		ls .git/objects/pack/multi-pack-index.d/*.midx >layers &&
+		test_line_count = 1 layers &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--size-multiple controls merging' '
+	(
+		cd incremental &&
+		test_commit multiple &&
+		incremental_pack HEAD^..HEAD &&
+		git multi-pack-index write --incremental --size-multiple=1000 &&
+		test_line_count = 1 $chain
+	)
+'
+
+test_expect_success 'objects are found through the chain' '
+	(
+		cd incremental &&
+		test_commit loose &&
+		incremental_pack HEAD^..HEAD &&
+		git multi-pack-index write --incremental &&
+		test_line_count = 2 $chain &&
+		git prune-packed &&
+		git count-objects -v >count &&
+		grep "^count: 0" count &&
+		grep "^garbage: 0" count &&
+		git rev-list --objects --all >revs &&
+		cut -d" " -f1 revs >objects &&
+		git cat-file --batch-check <objects >out &&
+		! grep missing out &&
+		git fsck
+	)
+'
+
+test_expect_success 'write without --incremental flattens the chain' '
+	(
+		cd incremental &&
+		git multi-pack-index write &&
+		test_path_is_file .git/objects/pack/multi-pack-index &&
+		test_path_is_missing .git/objects/pack/multi-pack-index.d &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'write --incremental turns a single MIDX into a layer' '
+	(
+		cd incremental &&
+		test_commit after-flat &&
+		incremental_pack HEAD^..HEAD &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing .git/objects/pack/multi-pack-index &&
+		test_line_count = 2 $chain &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'incompatible options are rejected' '
+	(
+		cd incremental &&
+		test_must_fail git multi-pack-index write --bitmap --incremental &&
+		test_must_fail git multi-pack-index write --size-multiple=3 &&
+		test_must_fail git multi-pack-index verify --incremental
+	)
+'
+
+test_expect_success 'verify --threads' '
+	git init verify-threads &&
+	(
+		cd verify-threads &&
+		test_commit_bulk 400 &&
+		git repack -d &&
+		test_commit_bulk --start=401 400 &&
+		git repack -d &&
+		git multi-pack-index write &&
+		git multi-pack-index verify --threads=4 &&
+		git multi-pack-index verify --threads=1 &&
+		test_must_fail git multi-pack-index write --threads=4
+	)
+'
+
+test_expect_success 'write --include-alternates covers the packs of alternates' '
+	git init alt-base &&
+	(
+		cd alt-base &&
+		test_commit_bulk 10 &&
+		git repack -d &&
+		test_commit_bulk --start=11 10 &&
+		git repack -d
+	) &&
+	git clone --shared alt-base alt-fork &&
+	(
+		cd alt-fork &&
+		git config core.multiPackIndex true &&
+		test_commit fork-only &&
+		git repack -d &&
+		git multi-pack-index write --include-alternates &&
+		test-tool read-midx .git/objects >midx &&
+		grep "pack-.*\.idx$" midx >packs &&
+		test_line_count = 3 packs &&
+		grep "^$(cd ../alt-base && pwd)/.git/objects/pack/pack-.*\.idx$" midx &&
+		git multi-pack-index verify &&
+		git rev-list --objects --all >revs &&
+		cut -d" " -f1 revs >objects &&
+		git cat-file --batch-check <objects >out &&
+		! grep missing out &&
+		git fsck
+	)
+'
+
+test_expect_success 'expire and repack leave the packs of alternates alone' '
+	ls alt-base/.git/objects/pack/*.idx >alt-packs &&
+	(
+		cd alt-fork &&
+		git multi-pack-index repack --batch-size=0 &&
+		git multi-pack-index expire
+	) &&
+	ls alt-base/.git/objects/pack/*.idx >alt-packs-after &&
+	test_cmp alt-packs alt-packs-after
+'
+
+test_expect_success 'new packs of alternates are used outside the MIDX' '
+	(
+		cd alt-base &&
+		test_commit after-midx &&
+		git repack -d
+	) &&
+	(
+		cd alt-fork &&
+		git fetch origin &&
+		git cat-file -e origin/master &&
+		git log --oneline origin/master >/dev/null
+	)
+'
+
+test_expect_success '--include-alternates is only for a full MIDX' '
+	(
+		cd alt-fork &&
+		test_must_fail git multi-pack-index write --include-alternates --bitmap &&
+		test_must_fail git multi-pack-index write --include-alternates --incremental &&
+		test_must_fail git multi-pack-index verify --include-alternates
+	)
+'
+
 test_done
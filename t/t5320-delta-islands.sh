@@ -140,4 +140,32 @@ test_expect_success 'unmatched island core is not fatal' '
 	git -c "pack.islandcore=one" repack -adfi
 '
 
+test_expect_success 'island marks are stored with the bitmaps' '
+	git -c "pack.island=refs/heads/(.*)" repack -adfib &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c "pack.island=refs/heads/(.*)" repack -adfib &&
+	grep "\"key\":\"reused\",\"value\":\"3\"" trace &&
+	is_delta_base $one $root &&
+	is_delta_base $two $root
+'
+
+delta_bases () {
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(deltabase)"
+}
+
+test_expect_success 'islands that changed are found with the bitmaps' '
+	commit three shared 123 root &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c "pack.island=refs/heads/(.*)" -c pack.threads=1 \
+		repack -adfib &&
+	grep "\"key\":\"reused\",\"value\":\"3\"" trace &&
+	delta_bases >expect &&
+	rm -f .git/objects/pack/*.bitmap &&
+	git -c "pack.island=refs/heads/(.*)" -c pack.threads=1 repack -adfi &&
+	delta_bases >actual &&
+	test_cmp expect actual
+'
+
 test_done
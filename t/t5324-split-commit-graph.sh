@@ -342,4 +342,58 @@ test_expect_success 'split across alternate where alternate is not split' '
 	test_cmp commit-graph .git/objects/info/commit-graph
 '
 
+test_expect_success 'generation data is not added on top of layers without it' '
+	git init gen-split &&
+	(
+		cd gen-split &&
+		git config core.commitGraph true &&
+		test_commit base1 &&
+		test_commit base2 &&
+		test_commit base3 &&
+		git commit-graph write --reachable --split &&
+		test_commit tip &&
+		git -c commitGraph.generationVersion=2 commit-graph write \
+			--reachable --split &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		! grep -q GDAT $graphdir/graph-*.graph &&
+		git -c commitGraph.generationVersion=2 commit-graph verify
+	)
+'
+
+test_expect_success 'generation data is written when merging every layer' '
+	(
+		cd gen-split &&
+		test_commit tip2 &&
+		git -c commitGraph.generationVersion=2 commit-graph write \
+			--reachable --split --size-multiple=1000 &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		grep -q GDAT $graphdir/graph-*.graph &&
+		git -c commitGraph.generationVersion=2 commit-graph verify
+	)
+'
+
+test_expect_success 'merging layers takes the commits from them' '
+	git init merge-reads &&
+	(
+		cd merge-reads &&
+		git config core.commitGraph true &&
+		test_commit one &&
+		test_commit two &&
+		git commit-graph write --reachable --split &&
+		test_commit three &&
+		git commit-graph write --reachable --split &&
+		git repack -adq &&
+		test_commit four &&
+		>../trace &&
+		GIT_TRACE_PACK_ACCESS="$(pwd)/../trace" \
+			git commit-graph write --reachable --split --size-multiple=1000 &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		git commit-graph verify &&
+		git rev-list --all >commits &&
+		test_line_count = 4 commits &&
+		# "four" is loose, and the others are in the graph
+		test_must_be_empty ../trace
+	)
+'
+
 test_done
@@ -0,0 +1,153 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+# The below tests want control over the 'pack.writeReverseIndex' setting
+# themselves to assert various combinations of it with other options.
+sane_unset GIT_TEST_WRITE_REV_INDEX
+
+packdir=.git/objects/pack
+
+disk_sizes () {
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)"
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	for i in 1 2 3 4 5
+	do
+		echo $i >file.$i &&
+		test_write_lines a b c $i >>file &&
+		git add file.$i file &&
+		git commit -m "$i" || return 1
+	done &&
+
+	pack=$(git pack-objects --all $packdir/pack) &&
+	rev=$packdir/pack-$pack.rev &&
+	disk_sizes >expect.sizes &&
+
+	test_path_is_missing $rev
+'
+
+test_index_pack () {
+	rm -f $rev &&
+	conf=$1 &&
+	shift &&
+	# remove the index since Windows won't overwrite an existing file
+	rm $packdir/pack-$pack.idx &&
+	git -c pack.writeReverseIndex=$conf index-pack "$@" \
+		$packdir/pack-$pack.pack
+}
+
+test_expect_success 'index-pack with pack.writeReverseIndex' '
+	test_index_pack "" &&
+	test_path_is_missing $rev &&
+
+	test_index_pack false &&
+	test_path_is_missing $rev &&
+
+	test_index_pack true &&
+	test_path_is_file $rev
+'
+
+test_expect_success 'index-pack with --[no-]rev-index' '
+	for conf in "" true false
+	do
+		test_index_pack "$conf" --rev-index &&
+		test_path_is_file $rev &&
+
+		test_index_pack "$conf" --no-rev-index &&
+		test_path_is_missing $rev || return 1
+	done
+'
+
+test_expect_success 'index-pack can verify reverse indexes' '
+	test_when_finished "rm -f $rev" &&
+	test_index_pack true &&
+
+	test_path_is_file $rev &&
+	git index-pack --rev-index --verify $packdir/pack-$pack.pack &&
+	test_path_is_file $rev
+'
+
+test_expect_success 'object sizes match with and without a reverse index' '
+	test_index_pack true &&
+	test_path_is_file $rev &&
+	disk_sizes >actual &&
+	test_cmp expect.sizes actual &&
+
+	rm -f $rev &&
+	disk_sizes >actual &&
+	test_cmp expect.sizes actual
+'
+
+test_expect_success 'reverse index of another pack is ignored' '
+	test_when_finished "rm -f $rev" &&
+	test_index_pack true &&
+	other=$(git pack-objects --revs $packdir/other <<-EOF
+	HEAD
+	EOF
+	) &&
+	git index-pack --rev-index $packdir/other-$other.pack &&
+	rm -f $rev &&
+	mv $packdir/other-$other.rev $rev &&
+	rm -f $packdir/other-$other.* &&
+
+	disk_sizes >actual 2>err &&
+	test_cmp expect.sizes actual &&
+	test_i18ngrep "does not match its pack" err
+'
+
+test_expect_success 'truncated reverse index is ignored' '
+	test_when_finished "rm -f $rev" &&
+	test_index_pack true &&
+	test_copy_bytes 20 <$rev >$rev.tmp &&
+	mv -f $rev.tmp $rev &&
+
+	disk_sizes >actual 2>err &&
+	test_cmp expect.sizes actual &&
+	test_i18ngrep "unexpected size" err
+'
+
+test_expect_success 'pack-objects with pack.writeReverseIndex' '
+	test_when_finished "rm -f $packdir/rev-*" &&
+	p=$(git pack-objects --all $packdir/rev) &&
+	test_path_is_missing $packdir/rev-$p.rev &&
+
+	p=$(git -c pack.writeReverseIndex=true pack-objects --all $packdir/rev) &&
+	test_path_is_file $packdir/rev-$p.rev
+'
+
+test_expect_success 'GIT_TEST_WRITE_REV_INDEX writes a reverse index' '
+	test_when_finished "rm -f $packdir/rev-*" &&
+	p=$(GIT_TEST_WRITE_REV_INDEX=1 git pack-objects --all $packdir/rev) &&
+	test_path_is_file $packdir/rev-$p.rev
+'
+
+test_expect_success 'repack keeps and removes reverse indexes' '
+	git -c pack.writeReverseIndex=true repack -ad &&
+	ls $packdir/*.rev >revs &&
+	test_line_count = 1 revs &&
+
+	test_commit more &&
+	git repack -ad &&
+	ls $packdir/*.pack >packs &&
+	test_line_count = 1 packs &&
+	test_path_is_missing $(cat revs)
+'
+
+test_expect_success 'bitmaps can use a reverse index' '
+	git -c pack.writeReverseIndex=true repack -adb &&
+	ls $packdir/*.rev >revs &&
+	test_line_count = 1 revs &&
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "OK!" out &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+	git rev-list --use-bitmap-index --objects --all |
+		cut -d" " -f1 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
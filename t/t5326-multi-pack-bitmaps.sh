@@ -0,0 +1,177 @@
+#!/bin/sh
+
+test_description='exercise basic multi-pack bitmap functionality'
+. ./test-lib.sh
+
+objdir=.git/objects
+midx=$objdir/pack/multi-pack-index
+
+midx_bitmap () {
+	find $objdir/pack -name "multi-pack-index-*.bitmap"
+}
+
+test_expect_success 'setup multiple packs' '
+	git config core.multiPackIndex true &&
+	for i in 1 2 3 4 5
+	do
+		test_commit A$i &&
+		mkdir -p dir$i &&
+		echo $i >dir$i/file &&
+		git add dir$i &&
+		git commit -m "B$i" &&
+		git repack -d || return 1
+	done &&
+	git tag -a -m annotated annotated A3 &&
+	ls $objdir/pack/*.pack >packs &&
+	test_line_count = 5 packs
+'
+
+test_expect_success 'write midx with a bitmap' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_file $midx &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_expect_success 'bitmap name matches the midx checksum' '
+	checksum=$(tail -c 20 $midx | od -An -tx1 | tr -d " \n") &&
+	test_path_is_file $objdir/pack/multi-pack-index-$checksum.bitmap
+'
+
+test_expect_success 'rev-list --test-bitmap verifies' '
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "OK!" out
+'
+
+rev_list_tests () {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerating objects via bitmap ($state)" '
+		git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+		git rev-list --use-bitmap-index --objects --all |
+			cut -d" " -f1 | sort >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerating a range via bitmap ($state)" '
+		git rev-list --objects A2..HEAD | cut -d" " -f1 | sort >expect &&
+		git rev-list --use-bitmap-index --objects A2..HEAD |
+			cut -d" " -f1 | sort >actual &&
+		test_cmp expect actual
+	'
+}
+
+rev_list_tests 'midx bitmap'
+
+test_expect_success 'create objects outside of the midx' '
+	test_commit loose
+'
+
+rev_list_tests 'midx bitmap with loose objects'
+
+test_expect_success 'clone from a repository with a midx bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git -C clone.git fsck &&
+	git rev-parse --all >expect &&
+	git -C clone.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch from a repository with a midx bitmap' '
+	git clone --no-local --bare . fetch.git &&
+	test_commit more &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	git -C fetch.git fetch origin "+refs/*:refs/*" &&
+	git -C fetch.git fsck &&
+	git rev-parse --all >expect &&
+	git -C fetch.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rewriting the midx replaces the stale bitmap' '
+	midx_bitmap >before &&
+	test_commit another &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	midx_bitmap >after &&
+	test_line_count = 1 after &&
+	! test_cmp before after &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'rewriting the midx without --bitmap drops the bitmap' '
+	test_commit yet-another &&
+	git repack -d &&
+	git multi-pack-index write &&
+	midx_bitmap >bitmaps &&
+	test_must_be_empty bitmaps
+'
+
+test_expect_success '--bitmap writes a bitmap for an unchanged midx' '
+	git multi-pack-index write --bitmap &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_expect_success 'midx bitmap is ignored without core.multiPackIndex' '
+	test_must_fail git -c core.multiPackIndex=false \
+		rev-list --test-bitmap HEAD 2>err &&
+	test_i18ngrep "failed to load bitmap indexes" err
+'
+
+test_expect_success 'pack-objects reuses objects from several packs' '
+	git rev-parse --all >in &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git pack-objects --revs --stdout --delta-base-offset \
+		<in >all.pack &&
+	grep "\"key\":\"write_pack_file/reused-packs\",\"value\":\"[2-9]" trace &&
+	git index-pack --strict all.pack &&
+	git show-index <all.idx | cut -d" " -f2 | sort >actual &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects reuses objects around gaps' '
+	printf "%s\n" HEAD~1 ^A4 ^A2 >in &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git pack-objects --revs --stdout --delta-base-offset \
+		<in >range.pack &&
+	grep "\"key\":\"write_pack_file/reused\",\"value\":\"[1-9]" trace &&
+	git index-pack range.pack &&
+	git show-index <range.idx | cut -d" " -f2 | sort >actual &&
+	git rev-list --objects HEAD~1 ^A4 ^A2 | cut -d" " -f1 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'midx bitmap with a lookup table' '
+	rm -f $(midx_bitmap) &&
+	git -c pack.writeBitmapLookupTable=true multi-pack-index write --bitmap &&
+	test_copy_bytes 8 <$(midx_bitmap) | tail -c 1 | od -An -tx1 >flags &&
+	grep " 45" flags &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+	git rev-list --use-bitmap-index --objects --all |
+		cut -d" " -f1 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack -ad removes the midx bitmap' '
+	git repack -ad &&
+	test_path_is_missing $midx &&
+	midx_bitmap >bitmaps &&
+	test_must_be_empty bitmaps
+'
+
+test_expect_success '--bitmap is only for write' '
+	test_must_fail git multi-pack-index verify --bitmap 2>err &&
+	test_i18ngrep "only for .write." err
+'
+
+test_done
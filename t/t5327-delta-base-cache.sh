@@ -0,0 +1,51 @@
+#!/bin/sh
+
+test_description='delta base cache eviction policies'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_seq 2000 >file &&
+	git add file &&
+	git commit -m 0 &&
+	for i in $(test_seq 20)
+	do
+		sed "s/^$i\$/changed &/" file >file.new &&
+		mv file.new file &&
+		git commit -q -a -m $i || return 1
+	done &&
+	git repack -a -d -f --depth=50 &&
+	git cat-file --batch-all-objects --batch-check >objects &&
+	git cat-file --batch-all-objects --batch >expect
+'
+
+for policy in lru 2q
+do
+	test_expect_success "read objects with the $policy policy" "
+		git -c core.deltaBaseCachePolicy=$policy \
+			-c core.deltaBaseCacheLimit=16k \
+			cat-file --batch-all-objects --batch >actual &&
+		test_cmp expect actual &&
+		git -c core.deltaBaseCachePolicy=$policy \
+			-c core.deltaBaseCacheLimit=16k \
+			log -p >log.$policy
+	"
+done
+
+test_expect_success 'both policies give the same output' '
+	test_cmp log.lru log.2q
+'
+
+test_expect_success 'statistics are traced' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -c core.deltaBaseCachePolicy=lru \
+		-c core.deltaBaseCacheLimit=16k log -p >/dev/null &&
+	grep "\"key\":\"statistics\",\"value\":{\"policy\":\"lru\",\"hits\":[1-9][0-9]*,\"misses\":[1-9][0-9]*,\"evictions\":[1-9]" trace
+'
+
+test_expect_success 'invalid policy' '
+	test_must_fail git -c core.deltaBaseCachePolicy=fifo \
+		cat-file blob HEAD:file 2>err &&
+	test_i18ngrep "invalid delta base cache policy: fifo" err
+'
+
+test_done
@@ -0,0 +1,67 @@
+#!/bin/sh
+
+test_description='git unpack-objects streams large blobs'
+
+. ./test-lib.sh
+
+prepare_dest () {
+	test_when_finished "rm -rf dest.git" &&
+	git init --bare dest.git &&
+	git -C dest.git config core.bigFileThreshold "$1"
+}
+
+test_expect_success 'setup' '
+	test-tool genrandom foo 1500000 >big-blob &&
+	git add big-blob &&
+	test_tick &&
+	git commit -m foo &&
+	test-tool genrandom bar 1500000 >big-blob &&
+	git add big-blob &&
+	test_tick &&
+	git commit -m bar &&
+	PACK=$(echo HEAD | git pack-objects --revs pack) &&
+	git verify-pack -v pack-$PACK.pack >out &&
+	sed -n -e "s/^\([0-9a-f][0-9a-f]*\).*\(commit\|tree\|blob\).*/\1/p" \
+		<out >obj-list
+'
+
+test_expect_success 'unpack big objects in memory below the threshold' '
+	prepare_dest 20m &&
+	git -C dest.git unpack-objects <pack-$PACK.pack &&
+	git -C dest.git fsck &&
+	git -C dest.git cat-file --batch-check="%(objectname)" <obj-list >actual &&
+	test_cmp obj-list actual
+'
+
+test_expect_success 'unpack big blobs in a stream above the threshold' '
+	prepare_dest 1m &&
+	GIT_ALLOC_LIMIT=1m git -C dest.git unpack-objects <pack-$PACK.pack &&
+	git -C dest.git fsck &&
+	git -C dest.git cat-file --batch-check="%(objectname)" <obj-list >actual &&
+	test_cmp obj-list actual
+'
+
+test_expect_success 'unpack big blobs in a stream with --strict' '
+	prepare_dest 1m &&
+	GIT_ALLOC_LIMIT=1m git -C dest.git unpack-objects --strict <pack-$PACK.pack &&
+	git -C dest.git fsck &&
+	git -C dest.git cat-file --batch-check="%(objectname)" <obj-list >actual &&
+	test_cmp obj-list actual
+'
+
+test_expect_success 'do not write anything with --dry-run' '
+	prepare_dest 1m &&
+	git -C dest.git unpack-objects -n <pack-$PACK.pack &&
+	find dest.git/objects -type f -path "*/objects/??/*" >loose &&
+	test_must_be_empty loose
+'
+
+test_expect_success 'streaming an existing blob leaves no temporary file' '
+	prepare_dest 1m &&
+	git -C dest.git unpack-objects <pack-$PACK.pack &&
+	git -C dest.git unpack-objects <pack-$PACK.pack &&
+	find dest.git/objects -name "tmp_obj_*" >tmp &&
+	test_must_be_empty tmp
+'
+
+test_done
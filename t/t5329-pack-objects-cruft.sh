@@ -0,0 +1,112 @@
+#!/bin/sh
+
+test_description='cruft packs of unreachable objects'
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+loose_path () {
+	echo $objdir/$(echo "$1" | sed -e "s|^..|&/|")
+}
+
+# list the objects of the packs with a .mtimes file
+cruft_objects () {
+	for mtimes in $(find $packdir -name "*.mtimes")
+	do
+		git show-index <${mtimes%.mtimes}.idx || return 1
+	done | cut -d" " -f2 | sort
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git checkout -b unreachable &&
+	test_commit unreachable &&
+	git rev-list --objects base..unreachable >objs &&
+	cut -d" " -f1 <objs >unreachable.raw &&
+	git checkout - &&
+	git branch -D unreachable &&
+	git tag -d unreachable &&
+	git reflog expire --expire=all --all &&
+	git repack -ad &&
+	loose=$(echo loose | git hash-object -w --stdin) &&
+	{ cat unreachable.raw && echo $loose; } | sort >unreachable
+'
+
+test_expect_success 'repack --cruft packs unreachable objects with mtimes' '
+	git repack -d --cruft &&
+	ls $packdir/*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	cruft_objects >actual &&
+	test_cmp unreachable actual &&
+	test_path_is_missing "$(loose_path $loose)" &&
+	git cat-file -e $loose &&
+	git fsck
+'
+
+test_expect_success 'reachable objects are not in the cruft pack' '
+	git rev-list --objects --all | cut -d" " -f1 | sort >reachable &&
+	comm -12 reachable actual >both &&
+	test_must_be_empty both
+'
+
+test_expect_success 'cruft objects keep their own mtime' '
+	old=$(echo old | git hash-object -w --stdin) &&
+	test-tool chmtime =-86400 "$(loose_path $old)" &&
+	git repack -d --cruft &&
+	cruft_objects >actual &&
+	grep $old actual &&
+
+	# the cruft pack was just written, yet "old" is still old
+	git repack -d --cruft --cruft-expiration=1.hour.ago &&
+	cruft_objects >actual &&
+	! grep $old actual &&
+	test_cmp unreachable actual &&
+	test_must_fail git cat-file -e $old
+'
+
+test_expect_success 'expiration keeps old objects reachable from recent ones' '
+	blob=$(echo old-but-reachable | git hash-object -w --stdin) &&
+	test-tool chmtime =-86400 "$(loose_path $blob)" &&
+	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+	git repack -d --cruft --cruft-expiration=1.hour.ago &&
+	cruft_objects >actual &&
+	grep $blob actual &&
+	grep $tree actual
+'
+
+test_expect_success 'writing a cruft object freshens it as a loose object' '
+	echo loose | git hash-object -w --stdin &&
+	test_path_is_file "$(loose_path $loose)"
+'
+
+test_expect_success 'repack --cruft with nothing unreachable' '
+	git init empty &&
+	(
+		cd empty &&
+		test_commit one &&
+		git repack -d --cruft &&
+		test_path_is_missing $packdir/*.mtimes &&
+		git fsck
+	)
+'
+
+test_expect_success 'gc with gc.cruftPacks' '
+	git init gc &&
+	(
+		cd gc &&
+		test_commit one &&
+		garbage=$(echo garbage | git hash-object -w --stdin) &&
+		git -c gc.cruftPacks=true gc &&
+		git show-index <$(ls $packdir/*.mtimes | sed "s/mtimes$/idx/") >idx &&
+		grep $garbage idx &&
+		test_path_is_missing "$(loose_path $garbage)"
+	)
+'
+
+test_expect_success '--cruft is incompatible with -k' '
+	test_must_fail git repack -d --cruft -k 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_done
@@ -148,4 +148,53 @@ test_expect_success 'pre-receive hook that forgets to read its input' '
 	git push ./victim.git "+refs/heads/*:refs/heads/*"
 '
 
+test_expect_success PERL 'update hook process is asked about each ref' '
+	git init --bare process.git &&
+	write_script process.git/hooks/update "$PERL_PATH" <<-\EOF &&
+	use strict;
+	use warnings;
+	use lib (split(/:/, $ENV{GITPERLLIB}));
+	use Git::Packet;
+
+	open my $log, ">>", "update-process.log" or die;
+	print $log "start\n";
+	packet_initialize("git-update-hook", 1);
+	my %remote_caps = packet_read_and_check_capabilities("update");
+	packet_check_and_write_capabilities(\%remote_caps, "update");
+	while (1) {
+		my ($res, $command) = packet_key_val_read("command");
+		last if $res == -1;
+		my ($ref, $old, $new);
+		(undef, $ref) = packet_key_val_read("ref");
+		(undef, $old) = packet_key_val_read("old");
+		(undef, $new) = packet_key_val_read("new");
+		packet_bin_read();
+		print $log "$ref\n";
+		if ($ref =~ /reject/) {
+			packet_txt_write("message=rejecting $ref");
+			packet_txt_write("status=error");
+		} else {
+			packet_txt_write("status=success");
+		}
+		packet_flush();
+	}
+	EOF
+	git branch keep-1 master &&
+	git branch keep-2 master &&
+	git branch reject-1 master &&
+	git -C process.git config receive.updateHookProcess true &&
+	test_must_fail git push ./process.git keep-1 keep-2 reject-1 2>err &&
+	grep "rejecting refs/heads/reject-1" err &&
+	cat >expect <<-\EOF &&
+	start
+	refs/heads/keep-1
+	refs/heads/keep-2
+	refs/heads/reject-1
+	EOF
+	test_cmp expect process.git/update-process.log &&
+	git --git-dir=process.git rev-parse --verify keep-1 &&
+	git --git-dir=process.git rev-parse --verify keep-2 &&
+	test_must_fail git --git-dir=process.git rev-parse --verify reject-1
+'
+
 test_done
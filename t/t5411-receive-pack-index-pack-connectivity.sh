@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='receive-pack connectivity check from index-pack
+
+Ensure that with receive.indexPackConnectivity, a pushed pack is only
+walked from the objects it refers to without containing them.
+'
+
+. ./test-lib.sh
+
+# Pushes "$2" to refs/heads/"$3" of "$1", and checks how many foreign
+# objects index-pack reported ("$4").
+push_and_check_foreign () {
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git push "$1" "$2:refs/heads/$3" &&
+	grep "\"key\":\"foreign-objects\",\"value\":\"$4\"" trace &&
+	git -C "$1" fsck
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git init --bare server.git &&
+	git -C server.git config receive.unpackLimit 1 &&
+	git -C server.git config receive.indexPackConnectivity true
+'
+
+test_expect_success 'pushing new history refers to no foreign objects' '
+	push_and_check_foreign server.git master master 0 &&
+	git rev-parse master >expect &&
+	git -C server.git rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pushing on top of existing history' '
+	test_commit three &&
+	push_and_check_foreign server.git master master 3 &&
+	git rev-parse master >expect &&
+	git -C server.git rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index-pack lists the objects the pack refers to' '
+	git rev-parse two two:one.t two:two.t >expect.unsorted &&
+	sort expect.unsorted >expect &&
+	printf "%s\n^%s\n" $(git rev-parse three two) |
+	git pack-objects --revs --stdout >three.pack &&
+	git index-pack --stdin --foreign-objects=actual <three.pack &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a foreign object that is not connected is rejected' '
+	tree=$(git rev-parse HEAD^{tree}) &&
+	missing=$(echo missing | git hash-object --stdin) &&
+	cat >broken <<-EOF &&
+	tree $missing
+	author A U Thor <author@example.com> 1112912053 -0700
+	committer C O Mitter <committer@example.com> 1112912053 -0700
+
+	broken
+	EOF
+	broken=$(git hash-object -t commit -w --literally broken) &&
+	git -C server.git hash-object -t commit -w --literally \
+		"$(pwd)/broken" &&
+	commit=$(git commit-tree -p $broken -m child $tree) &&
+	printf "%s\n^%s\n" $commit $broken |
+	git pack-objects --revs --stdout >child.pack &&
+	{
+		test-tool pkt-line pack \
+			"$ZERO_OID $commit refs/heads/child" 0000 &&
+		cat child.pack
+	} >input &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C server.git receive-pack . <input >out 2>err &&
+	grep "\"key\":\"foreign-objects\",\"value\":\"1\"" trace &&
+	test_must_fail git -C server.git rev-parse --verify refs/heads/child
+'
+
+test_done
@@ -783,6 +783,40 @@ test_expect_success 'clone shallow since selects no commits' '
 	)
 '
 
+test_expect_success 'shallow boundaries from the commit-graph' '
+	test_create_repo shallow-graph &&
+	(
+	cd shallow-graph &&
+	for i in 1 2 3 4 5 6
+	do
+		GIT_COMMITTER_DATE="${i}00000000 +0000" &&
+		export GIT_COMMITTER_DATE &&
+		git commit --allow-empty -m main$i &&
+		git checkout -q -b side$i HEAD^0 &&
+		git commit --allow-empty -m side$i &&
+		git checkout -q master &&
+		git merge -q --no-ff -m merge$i side$i || return 1
+	done &&
+	git config core.commitGraph true &&
+	git commit-graph write --reachable
+	) &&
+	for opt in --depth=1 --depth=3 --depth=8 "--shallow-since=250000000 +0000"
+	do
+		rm -rf no-graph graph trace &&
+		git -c core.commitGraph=false clone -q --no-local "$opt" \
+			shallow-graph no-graph &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git clone -q --no-local "$opt" shallow-graph graph &&
+		grep "\"graph-walk\"" trace &&
+		sort no-graph/.git/shallow >expect &&
+		sort graph/.git/shallow >actual &&
+		test_cmp expect actual &&
+		git -C no-graph log --format=%s >expect &&
+		git -C graph log --format=%s >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_expect_success 'shallow clone exclude tag two' '
 	test_create_repo shallow-exclude &&
 	(
@@ -522,6 +522,47 @@ test_expect_success 'fetch --dry-run' '
 	! test -f .git/FETCH_HEAD
 '
 
+test_expect_success 'setup for fetch --atomic' '
+	git init atomic-upstream &&
+	test_commit -C atomic-upstream one &&
+	git -C atomic-upstream branch second &&
+	git -C atomic-upstream branch third
+'
+
+test_expect_success 'fetch --atomic updates all refs' '
+	test_when_finished "rm -rf atomic-clone" &&
+	git init atomic-clone &&
+	git -C atomic-clone fetch --atomic --no-tags ../atomic-upstream \
+		"refs/heads/*:refs/remotes/origin/*" &&
+	git -C atomic-upstream rev-parse master second third >expect &&
+	git -C atomic-clone rev-parse origin/master origin/second \
+		origin/third >actual &&
+	test_cmp expect actual &&
+	test_line_count = 3 atomic-clone/.git/FETCH_HEAD
+'
+
+test_expect_success 'fetch --atomic updates no ref if one is rejected' '
+	test_when_finished "rm -rf atomic-clone" &&
+	test_commit -C atomic-upstream two &&
+	git -C atomic-upstream branch -f third &&
+	git init atomic-clone &&
+	git -C atomic-clone fetch --no-tags ../atomic-upstream \
+		"refs/heads/*:refs/remotes/origin/*" &&
+	git -C atomic-clone rev-parse origin/master origin/second \
+		origin/third >expect &&
+	test_commit -C atomic-upstream three &&
+	git -C atomic-upstream branch -f second &&
+	git -C atomic-upstream branch -f third one &&
+	git -C atomic-upstream branch fourth &&
+	test_must_fail git -C atomic-clone fetch --atomic --no-tags \
+		../atomic-upstream "refs/heads/*:refs/remotes/origin/*" &&
+	git -C atomic-clone rev-parse origin/master origin/second \
+		origin/third >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C atomic-clone rev-parse --verify origin/fourth &&
+	test_must_be_empty atomic-clone/.git/FETCH_HEAD
+'
+
 test_expect_success "should be able to fetch with duplicate refspecs" '
 	mkdir dups &&
 	(
@@ -183,4 +183,46 @@ test_expect_success 'git fetch --all --tags' '
 	test_cmp expect test8/output
 '
 
+test_expect_success 'parallel' '
+	git remote add one ./bogus1 &&
+	git remote add two ./bogus2 &&
+
+	test_must_fail env GIT_TRACE="$PWD/trace" \
+		git fetch --jobs=2 --multiple one two 2>err &&
+	grep "preparing to run up to 2 tasks" trace &&
+	test_i18ngrep "could not fetch .one.*128" err &&
+	test_i18ngrep "could not fetch .two.*128" err
+'
+
+test_expect_success 'fetch.hostJobs limits parallel fetches per host' '
+	cp "$GIT_BUILD_DIR/t/helper/test-fake-ssh$X" "$TRASH_DIRECTORY/ssh$X" &&
+	git clone one test9 &&
+	(
+		cd test9 &&
+		git remote rm origin &&
+		git remote add one "myhost:$TRASH_DIRECTORY/one" &&
+		git remote add two "myhost:$TRASH_DIRECTORY/two" &&
+		git remote add three "otherhost:$TRASH_DIRECTORY/three" &&
+		git config fetch.hostJobs 1 &&
+		TRASH_DIRECTORY="$TRASH_DIRECTORY" \
+		GIT_SSH="$TRASH_DIRECTORY/ssh$X" \
+		GIT_TRACE2_EVENT="$(pwd)/events" \
+			git fetch -j3 --multiple one two three &&
+		grep "\"key\":\"job/start\",\"value\":\"one myhost\"" events &&
+		grep "\"key\":\"job/start\",\"value\":\"three otherhost\"" events &&
+		# the second job for myhost starts after the first is done
+		sed -n -e "s/.*\"key\":\"job\/\([a-z]*\)\",\"value\":\"\([a-z]*\) myhost.*/\1 \2/p" \
+			-e "s/.*\"key\":\"job\/finish\",\"value\":\"\(one\|two\) .*/finish \1/p" \
+			events >actual &&
+		cat >expect <<-\EOF &&
+		start one
+		finish one
+		start two
+		finish two
+		EOF
+		test_cmp expect actual &&
+		git rev-parse --verify two/another
+	)
+'
+
 test_done
@@ -141,6 +141,22 @@ EOF
 	)
 '
 
+test_expect_success 'refs sharing a tip are filtered together' '
+	test_when_finished "git -C shallow branch -D alias1 alias2" &&
+	git -C shallow branch alias1 master &&
+	git -C shallow branch alias2 master &&
+	git init notshallow-alias &&
+	(
+	cd notshallow-alias &&
+	git fetch ../shallow/.git refs/heads/*:refs/remotes/shallow/* &&
+	git for-each-ref --format="%(refname)" >actual.refs &&
+	cat <<EOF >expect.refs &&
+refs/remotes/shallow/no-shallow
+EOF
+	test_cmp expect.refs actual.refs
+	)
+'
+
 test_expect_success 'fetch --update-shallow' '
 	(
 	cd shallow &&
@@ -69,4 +69,22 @@ test_expect_success 'updating a ref from quarantine is forbidden' '
 	git -C update.git fsck
 '
 
+test_expect_success 'loose objects are migrated into a repacked repository' '
+	git init --bare repacked.git &&
+	git push repacked.git HEAD:refs/heads/base &&
+	git -C repacked.git repack -a -d &&
+	git -C repacked.git prune-packed &&
+	base=$(git rev-parse HEAD) &&
+	test_commit loose-one &&
+	test_commit loose-two &&
+	git push repacked.git HEAD:refs/heads/loose &&
+	git rev-list --objects $base..HEAD >objects &&
+	test_line_count -gt 0 objects &&
+	while read oid rest
+	do
+		test_path_is_file repacked.git/objects/$(test_oid_to_path $oid) || return 1
+	done <objects &&
+	git -C repacked.git fsck
+'
+
 test_done
@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='upload-pack response cache'
+. ./test-lib.sh
+
+# Runs "$@" and checks that upload-pack reported "$1" for the cache.
+check_cache () {
+	result=$1 &&
+	shift &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" "$@" &&
+	grep "\"key\":\"response-cache\",\"value\":\"$result\"" trace
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git config --global uploadpack.responseCache "$(pwd)/cache"
+'
+
+test_expect_success 'the first clone stores its response' '
+	check_cache stored git clone --no-local . first.git &&
+	ls cache/*.pack >entries &&
+	test_line_count = 1 entries &&
+	git -C first.git fsck
+'
+
+test_expect_success 'an identical request is answered from the cache' '
+	check_cache hit git clone --no-local . second.git &&
+	! grep "\"key\":\"response-cache\",\"value\":\"miss\"" trace &&
+	git -C second.git fsck &&
+	git -C first.git for-each-ref >expect &&
+	git -C second.git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'progress does not matter' '
+	check_cache hit git clone --progress --no-local . progress.git &&
+	git -C progress.git fsck
+'
+
+test_expect_success 'the cache is not used after a ref moved' '
+	test_commit three &&
+	check_cache miss git clone --no-local . third.git &&
+	ls cache/*.pack >entries &&
+	test_line_count = 2 entries &&
+	git -C third.git log --format=%s >actual &&
+	test_write_lines three two one >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the least recently used responses are pruned' '
+	old=$(ls -t cache/*.pack | tail -n 1) &&
+	new=$(ls -t cache/*.pack | head -n 1) &&
+	test-tool chmtime -200 $old &&
+	test-tool chmtime -100 $new &&
+	size=$(($(test-tool path-utils file-size $old) +
+		$(test-tool path-utils file-size $new) - 1)) &&
+	test_config_global uploadpack.responseCacheSize $size &&
+	check_cache stored git -C first.git fetch &&
+	test_path_is_missing $old &&
+	test_path_is_file $new &&
+	ls cache/*.pack >entries &&
+	test_line_count = 2 entries
+'
+
+test_expect_success 'responses larger than the cache are not stored' '
+	test_config_global uploadpack.responseCacheSize 1 &&
+	test_commit four &&
+	check_cache miss git clone --no-local . fourth.git &&
+	! grep "\"key\":\"response-cache\",\"value\":\"stored\"" trace &&
+	ls cache >entries &&
+	test_line_count = 2 entries
+'
+
+test_expect_success 'the cache is ignored in the repository config' '
+	test_unconfig --global uploadpack.responseCache &&
+	test_config uploadpack.responseCache "$(pwd)/repo-cache" &&
+	git clone --no-local . fifth.git &&
+	test_path_is_missing repo-cache
+'
+
+test_done
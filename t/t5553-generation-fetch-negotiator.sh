@@ -0,0 +1,152 @@
+#!/bin/sh
+
+test_description='test generation fetch negotiator'
+. ./test-lib.sh
+
+have_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -ne 0
+		then
+			echo "No have $(git -C client rev-parse $1) ($1)"
+			return 1
+		fi
+		shift
+	done
+}
+
+have_not_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -eq 0
+		then
+			return 1
+		fi
+		shift
+	done
+}
+
+# trace_fetch <client_dir> <server_dir> [args]
+#
+# Trace the packet output of fetch, but make sure we disable the variable
+# in the child upload-pack, so we don't combine the results in the same file.
+trace_fetch () {
+	client=$1; shift
+	server=$1; shift
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git -C "$client" fetch \
+	  --upload-pack 'unset GIT_TRACE_PACKET; git-upload-pack' \
+	  "$server" "$@"
+}
+
+test_expect_success 'commits are skipped at increasing distances' '
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	for i in $(test_seq 7)
+	do
+		test_commit -C client c$i
+	done &&
+	git -C client config core.commitGraph true &&
+	git -C client commit-graph write --reachable &&
+
+	# We send: "c7" (skip 1) "c5" (skip 2) "c2" (skip 4). After that, since
+	# "c1" has no parent, it is still sent as "have" even though it would
+	# normally be skipped.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent c7 c5 c2 c1 &&
+	have_not_sent c6 c4 c3
+'
+
+test_expect_success 'clock skew does not matter with a commit-graph' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+
+	# 2 regular commits
+	test_tick=2000000000 &&
+	test_commit -C client c1 &&
+	test_commit -C client c2 &&
+
+	# 4 old commits
+	test_tick=1000000000 &&
+	git -C client checkout c1 &&
+	test_commit -C client old1 &&
+	test_commit -C client old2 &&
+	test_commit -C client old3 &&
+	test_commit -C client old4 &&
+	git -C client config core.commitGraph true &&
+	git -C client commit-graph write --reachable &&
+
+	# Walking by generation, "old1" is popped before its parent "c1", so
+	# it is skipped like any other commit (unlike with the skipping
+	# negotiator), and "c1" is sent because it has no parent.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent old4 old2 c2 c1 &&
+	have_not_sent old3 old1
+'
+
+test_expect_success 'stop once all tips reach an acknowledged commit' '
+	rm -rf server client trace &&
+	git init client &&
+	test_commit -C client base &&
+	for i in $(test_seq 10)
+	do
+		git -C client checkout -q --detach base &&
+		test_commit -C client private$i || return 1
+	done &&
+	for i in $(test_seq 20)
+	do
+		git -C client checkout -q --detach base &&
+		test_commit -C client public$i || return 1
+	done &&
+	git -C client config core.commitGraph true &&
+	git -C client commit-graph write --reachable &&
+
+	# The server has all public tags, and an unrelated branch that
+	# it is never "ready" to send.
+	git clone --bare --no-local client server &&
+	git -C server for-each-ref --format="delete %(refname)" refs/tags/private* |
+		git -C server update-ref --stdin &&
+	git -C server gc --prune=now --quiet &&
+	git -C server branch -D master &&
+	git init unrelated &&
+	test_commit -C unrelated to_fetch &&
+	git -C server fetch --no-tags ../unrelated master:to_fetch &&
+
+	# The first request sends the 16 newest tips, all public. Once the
+	# server acknowledged them, "base" is known to be common, which all
+	# tips reach, so no more "have" lines are sent.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	(
+		GIT_TEST_PROTOCOL_VERSION=2 &&
+		export GIT_TEST_PROTOCOL_VERSION &&
+		trace_fetch client "$(pwd)/server" to_fetch
+	) &&
+	have_sent public20 public5 &&
+	have_not_sent public4 public1 private10 private1 base &&
+	git -C client fsck
+'
+
+test_expect_success 'without a commit-graph all haves are still sent' '
+	rm -f client/.git/objects/info/commit-graph trace &&
+	test_commit -C unrelated to_fetch2 &&
+	git -C server fetch --no-tags ../unrelated master:to_fetch2 &&
+	test_config -C client fetch.negotiationalgorithm generation &&
+	(
+		GIT_TEST_PROTOCOL_VERSION=2 &&
+		export GIT_TEST_PROTOCOL_VERSION &&
+		trace_fetch client "$(pwd)/server" to_fetch2
+	) &&
+	have_sent private10 private1 public1 &&
+	git -C client fsck
+'
+
+test_done
@@ -0,0 +1,90 @@
+#!/bin/sh
+
+test_description='clone and fetch bootstrapped from bundle URIs'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	git -C server bundle create ../full.bundle master &&
+	test_commit -C server two &&
+	git -C server bundle create ../incr1.bundle one..master &&
+	test_commit -C server three &&
+	git -C server bundle create ../incr2.bundle two..master &&
+	test_commit -C server four
+'
+
+test_expect_success 'clone --bundle-uri with a single bundle' '
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git clone --bundle-uri="$(pwd)/full.bundle" \
+		"file://$(pwd)/server" single &&
+	git -C single rev-parse --verify refs/bundles/master >actual &&
+	git -C server rev-parse one >expect &&
+	test_cmp expect actual &&
+	grep "> have $(cat expect)" trace &&
+	git -C single fsck &&
+	git -C server rev-parse master >expect &&
+	git -C single rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone --bundle-uri with a bundle list' '
+	mkdir list &&
+	cp full.bundle incr1.bundle incr2.bundle list/ &&
+	# incremental bundles may come in any order
+	cat >list/bundles <<-\EOF &&
+	[bundle "incr2"]
+		uri = incr2.bundle
+	[bundle "full"]
+		uri = full.bundle
+	[bundle "incr1"]
+		uri = incr1.bundle
+	EOF
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git clone --bundle-uri="file://$(pwd)/list/bundles" \
+		"file://$(pwd)/server" listed &&
+	git -C server rev-parse three >expect &&
+	git -C listed rev-parse --verify refs/bundles/master >actual &&
+	test_cmp expect actual &&
+	grep "> have $(cat expect)" trace &&
+	git -C listed fsck &&
+	git -C server rev-parse master >expect &&
+	git -C listed rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unusable bundles fall back to a full fetch' '
+	cat >list/broken <<-\EOF &&
+	[bundle "incr2"]
+		uri = incr2.bundle
+	[bundle "missing"]
+		uri = missing.bundle
+	EOF
+	git clone --bundle-uri="$(pwd)/list/broken" \
+		"file://$(pwd)/server" broken 2>err &&
+	test_i18ngrep "prerequisites of bundle .*incr2.bundle are missing" err &&
+	test_i18ngrep "failed to fetch objects from bundle URI" err &&
+	test_must_fail git -C broken rev-parse --verify refs/bundles/master &&
+	git -C broken fsck &&
+	git -C server rev-parse master >expect &&
+	git -C broken rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch --bundle-uri' '
+	git clone --bundle-uri="$(pwd)/full.bundle" \
+		"file://$(pwd)/server" fetcher &&
+	test_commit -C server five &&
+	git -C server bundle create ../incr3.bundle four..master &&
+	test_commit -C server six &&
+	git -C fetcher fetch --bundle-uri="$(pwd)/incr3.bundle" origin &&
+	git -C server rev-parse five >expect &&
+	git -C fetcher rev-parse refs/bundles/master >actual &&
+	test_cmp expect actual &&
+	git -C server rev-parse master >expect &&
+	git -C fetcher rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -71,4 +71,26 @@ test_expect_success 'http-backend blocks bad PATH_INFO' '
 	expect_aliased 1 //domain/data.txt
 '
 
+test_expect_success 'http-backend answers v2 upload-pack requests in process' '
+	test-tool pkt-line pack >request <<-\EOF &&
+	command=ls-refs
+	0001
+	0000
+	EOF
+	config http.uploadpack true &&
+	for in_process in false true
+	do
+		config http.uploadpackInProcess $in_process &&
+		REQUEST_METHOD=POST \
+		CONTENT_TYPE=application/x-git-upload-pack-request \
+		CONTENT_LENGTH=$(wc -c <request) \
+		QUERY_STRING= \
+		PATH_TRANSLATED="$HTTPD_DOCUMENT_ROOT_PATH/repo.git/git-upload-pack" \
+		GIT_PROTOCOL=version=2 \
+		git http-backend <request >out.$in_process || return 1
+	done &&
+	test_cmp out.false out.true &&
+	grep "refs/heads/master" out.true
+'
+
 test_done
@@ -199,4 +199,20 @@ test_expect_success FAKENC 'hostname interpolation works after LF-stripping' '
 	test_cmp expect actual
 '
 
+stop_git_daemon
+start_git_daemon --no-reexec --informative-errors
+
+test_expect_success 'clone from a daemon serving in forked copies' '
+	>"$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git/git-daemon-export-ok" &&
+	git clone "$GIT_DAEMON_URL/repo.git" clone-no-reexec &&
+	git --git-dir="$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git" \
+		rev-parse HEAD >expect &&
+	git -C clone-no-reexec rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'errors from a daemon serving in forked copies' "
+	test_remote_error 'no such repository' clone nowhere.git
+"
+
 test_done
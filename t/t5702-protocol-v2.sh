@@ -675,6 +675,94 @@ test_expect_success 'push with http:// and a config of v2 does not request v2' '
 	! grep "git< version 2" log
 '
 
+test_expect_success 'setup packfile URIs' '
+	rm -rf server &&
+	test_create_repo server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	git -C server repack -a -d &&
+	pack=$(ls server/.git/objects/pack/pack-*.pack) &&
+	hash=$(basename $pack .pack | sed "s/^pack-//") &&
+	cp $pack "$HTTPD_DOCUMENT_ROOT_PATH/$hash.pack" &&
+	test_commit -C server three &&
+	git -C server config uploadpack.packfileURI \
+		"$hash $HTTPD_URL/dumb/$hash.pack"
+'
+
+test_expect_success 'clone downloads the packs at packfile URIs' '
+	rm -rf client trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		-c fetch.uriProtocols=http \
+		clone "file://$(pwd)/server" client &&
+	grep "clone> packfile-uris http" trace &&
+	grep "clone< $hash $HTTPD_URL/dumb/" trace &&
+	test_path_is_file client/.git/objects/pack/pack-$hash.pack &&
+	test_path_is_missing client/.git/objects/pack/pack-$hash.keep &&
+	ls client/.git/objects/pack/*.pack >packs &&
+	test_line_count = 2 packs &&
+	git -C client fsck &&
+	git -C client log --pretty=tformat:%s >actual &&
+	test_write_lines three two one >expected &&
+	test_cmp expected actual
+'
+
+test_expect_success 'packfile URI downloads resume from fetch.resumeDir' '
+	rm -rf client resume &&
+	mkdir resume &&
+	pack="$HTTPD_DOCUMENT_ROOT_PATH/$hash.pack" &&
+	size=$(wc -c <"$pack") &&
+	test_copy_bytes $(($size / 2)) <"$pack" >resume/pack-$hash.pack.temp &&
+	git -c protocol.version=2 -c fetch.uriProtocols=http \
+		-c fetch.resumeDir="$(pwd)/resume" \
+		clone "file://$(pwd)/server" client &&
+	test_path_is_file client/.git/objects/pack/pack-$hash.pack &&
+	test_dir_is_empty resume &&
+	git -C client fsck
+'
+
+test_expect_success 'a broken resumed download starts over' '
+	rm -rf client resume &&
+	mkdir resume &&
+	echo garbage >resume/pack-$hash.pack.temp &&
+	test_must_fail git -c protocol.version=2 -c fetch.uriProtocols=http \
+		-c fetch.resumeDir="$(pwd)/resume" \
+		clone "file://$(pwd)/server" client &&
+	test_dir_is_empty resume &&
+	git -c protocol.version=2 -c fetch.uriProtocols=http \
+		-c fetch.resumeDir="$(pwd)/resume" \
+		clone "file://$(pwd)/server" client &&
+	git -C client fsck
+'
+
+test_expect_success 'packfile URIs are offered only to those asking' '
+	rm -rf client trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		clone "file://$(pwd)/server" client &&
+	grep "clone< version 2" trace &&
+	! grep "clone> packfile-uris" trace &&
+	test_path_is_missing client/.git/objects/pack/pack-$hash.pack &&
+
+	test_commit -C server four &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client -c protocol.version=2 \
+		-c fetch.uriProtocols=http fetch origin &&
+	grep "fetch> packfile-uris http" trace &&
+	! grep "fetch< $hash" trace &&
+	test_path_is_missing client/.git/objects/pack/pack-$hash.pack &&
+	git -C client fsck
+'
+
+test_expect_success 'clone fails if the pack at a packfile URI is not the one expected' '
+	rm -rf client &&
+	git -C server config uploadpack.packfileURI \
+		"$ZERO_OID $HTTPD_URL/dumb/$hash.pack" &&
+	zero=server/.git/objects/pack/pack-$ZERO_OID &&
+	cp server/.git/objects/pack/pack-$hash.pack $zero.pack &&
+	cp server/.git/objects/pack/pack-$hash.idx $zero.idx &&
+	test_must_fail git -c protocol.version=2 -c fetch.uriProtocols=http \
+		clone "file://$(pwd)/server" client 2>err &&
+	test_i18ngrep "is not the pack $ZERO_OID" err
+'
+
 test_expect_success 'when server sends "ready", expect DELIM' '
 	rm -rf "$HTTPD_DOCUMENT_ROOT_PATH/http_parent" http_child &&
 
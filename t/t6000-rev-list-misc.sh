@@ -140,4 +140,11 @@ test_expect_success '--header shows a NUL after each commit' '
 	test_cmp expect actual
 '
 
+test_expect_success 'object allocation statistics are traced' '
+	commits=$(git rev-list --count --all) &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git rev-list --objects --all >/dev/null &&
+	grep "\"category\":\"alloc\",\"key\":\"statistics\"" trace >stats &&
+	grep "\"commit\":{\"nodes\":$commits,\"slabs\":1," stats
+'
+
 test_done
@@ -263,4 +263,23 @@ test_expect_success 'rev-parse --bisect can default to good/bad refs' '
 	test_cmp expect.sorted actual.sorted
 '
 
+test_expect_success 'commit-graph does not change --bisect-all distances' '
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	git -c core.commitGraph=false rev-list --bisect-all l5 ^root >expect &&
+	git commit-graph write --reachable &&
+	git -c core.commitGraph=true rev-list --bisect-all l5 ^root >actual &&
+	test_cmp expect actual &&
+	git -c core.commitGraph=false rev-list --bisect-all a4 ^b1 ^c1 >expect &&
+	git -c core.commitGraph=true rev-list --bisect-all a4 ^b1 ^c1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commits outside the commit-graph get the same distances' '
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	git -c core.commitGraph=false rev-list --bisect-all l5 ^root >expect &&
+	git rev-parse b2 a2 | git commit-graph write --stdin-commits &&
+	git -c core.commitGraph=true rev-list --bisect-all l5 ^root >actual &&
+	test_cmp expect actual
+'
+
 test_done
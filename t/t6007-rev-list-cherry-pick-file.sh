@@ -245,6 +245,28 @@ test_expect_success '--count --left-right' '
 	test_cmp expect actual
 '
 
+test_expect_success 'diff.patchIdCache remembers patch-ids' '
+	git rev-list --left-right --cherry-pick B...C >expect &&
+	git -c diff.patchIdCache=true \
+		rev-list --left-right --cherry-pick B...C >actual &&
+	test_cmp expect actual &&
+	git notes --ref=patch-id-cache show C &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git -c diff.patchIdCache=true \
+		rev-list --left-right --cherry-pick B...C >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache/misses\",\"value\":\"0\"" trace.event &&
+	! grep "\"key\":\"cache/hits\",\"value\":\"0\"" trace.event
+'
+
+test_expect_success 'diff.patchIdCache is not used with a pathspec' '
+	git rev-list --left-right --cherry-pick B...C -- bar >expect &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git -c diff.patchIdCache=true \
+		rev-list --left-right --cherry-pick B...C -- bar >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache/hits\",\"value\":\"0\"" trace.event
+'
+
 # Corrupt the object store deliberately to make sure
 # the object is not even checked for its existence.
 remove_loose_object () {
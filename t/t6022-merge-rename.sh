@@ -896,4 +896,48 @@ test_expect_success 'do not follow renames for empty files' '
 	test_must_be_empty empty2
 '
 
+test_expect_success 'setup picks through a rename' '
+	git checkout -f --orphan cache-base &&
+	git rm -rf -q . &&
+	mkdir olddir &&
+	test_seq 1 20 >olddir/file &&
+	echo one >other &&
+	git add olddir other &&
+	git commit -m base &&
+	git checkout -b cache-topic &&
+	echo two >other &&
+	git commit -a -m two &&
+	echo three >other &&
+	git commit -a -m three &&
+	git checkout -b cache-renamed cache-base &&
+	git mv olddir newdir &&
+	echo changed >>newdir/file &&
+	git commit -a -m renamed
+'
+
+test_expect_success 'merge.renameCache remembers scores across picks' '
+	git checkout -f cache-renamed^0 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -c merge.renameCache=true \
+		cherry-pick cache-base..cache-topic &&
+	echo three >expect &&
+	test_cmp expect other &&
+	grep "\"key\":\"rename/cached\",\"value\":\"0\"" trace &&
+	grep "\"key\":\"rename/cached\",\"value\":\"1\"" trace &&
+	test_must_fail git rev-parse --verify -q refs/notes/rename-cache
+'
+
+test_expect_success 'merge.renameCache=persist remembers renames' '
+	git checkout -f cache-renamed^0 &&
+	git -c merge.renameCache=persist cherry-pick cache-topic^ &&
+	git notes --ref=rename-cache show \
+		$(git rev-parse cache-renamed:newdir/file) >actual &&
+	grep "^$(git rev-parse cache-base:olddir/file) [0-9]*$" actual &&
+	git checkout -f cache-renamed^0 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -c merge.renameCache=persist \
+		cherry-pick cache-topic^ &&
+	grep "\"key\":\"rename/remembered\",\"value\":\"1\"" trace
+'
+
 test_done
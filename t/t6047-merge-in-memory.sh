@@ -0,0 +1,122 @@
+#!/bin/sh
+
+test_description='merge-recursive with merge.inMemory
+
+Ensure that a merge that checks out its result at the end leaves the
+same index and working tree behind as one that updates the working tree
+as it goes.
+'
+
+. ./test-lib.sh
+
+# The tests below choose the mode themselves.
+sane_unset GIT_TEST_MERGE_IN_MEMORY
+
+# Merges "$2" into "$1" in copies of the "repo" repository, as it goes
+# in "normal" and at the end in "memory", and compares the outcome.
+test_merge () {
+	rm -rf normal memory &&
+	cp -R repo normal &&
+	cp -R repo memory &&
+	git -C normal checkout -q "$1" &&
+	git -C memory checkout -q "$1" &&
+	test_might_fail git -C normal -c merge.inMemory=false \
+		merge -q --no-edit "$2" >normal.out 2>&1 &&
+	test_might_fail git -C memory -c merge.inMemory=true \
+		merge -q --no-edit "$2" >memory.out 2>&1 &&
+	git -C normal ls-files -s >normal.index &&
+	git -C memory ls-files -s >memory.index &&
+	test_cmp normal.index memory.index &&
+	(cd normal && find . -path ./.git -prune -o -type f -print |
+		sort | xargs cat) >normal.files &&
+	(cd memory && find . -path ./.git -prune -o -type f -print |
+		sort | xargs cat) >memory.files &&
+	test_cmp normal.files memory.files &&
+	git -C memory diff-files --quiet -- $(git -C memory ls-files -s |
+		grep " 0	" | cut -f2)
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		mkdir dir &&
+		test_seq 1 10 >dir/file &&
+		test_seq 11 20 >other &&
+		echo base >conflict &&
+		git add . &&
+		git commit -m base &&
+
+		git checkout -b rename &&
+		git mv dir moved &&
+		test_seq 11 21 >other &&
+		echo rename >conflict &&
+		git commit -a -m rename &&
+
+		git checkout -b modify master &&
+		test_seq 0 10 >dir/file &&
+		echo new >dir/new &&
+		git add dir/new &&
+		echo modify >conflict &&
+		git commit -a -m modify &&
+
+		git checkout -b df master &&
+		git rm -q other &&
+		mkdir other &&
+		echo df >other/file &&
+		git add other &&
+		git commit -m df &&
+		git checkout -q master
+	)
+'
+
+test_expect_success 'clean merge with renames' '
+	git -C repo checkout -q -b clean rename &&
+	git -C repo rm -q conflict &&
+	git -C repo commit -q -m clean &&
+	git -C repo checkout -q master &&
+	git -C repo branch -f modify-clean modify &&
+	git -C repo checkout -q modify-clean &&
+	git -C repo rm -q conflict &&
+	git -C repo commit -q -m clean &&
+	git -C repo checkout -q master &&
+	test_merge clean modify-clean &&
+	test_path_is_file memory/moved/new &&
+	test_path_is_missing memory/dir
+'
+
+test_expect_success 'conflicted merge with renames' '
+	test_merge rename modify &&
+	git -C memory ls-files -u >unmerged &&
+	test_line_count = 4 unmerged
+'
+
+test_expect_success 'directory/file conflict' '
+	test_merge rename df &&
+	git -C memory ls-files -u >unmerged &&
+	test_line_count = 2 unmerged
+'
+
+test_expect_success 'untracked files are not overwritten' '
+	rm -rf memory &&
+	cp -R repo memory &&
+	git -C memory checkout -q modify &&
+	mkdir memory/moved &&
+	echo untracked >memory/moved/file &&
+	test_must_fail git -C memory -c merge.inMemory=true merge rename &&
+	echo untracked >expect &&
+	test_cmp expect memory/moved/file
+'
+
+test_expect_success 'local changes are not lost' '
+	rm -rf memory &&
+	cp -R repo memory &&
+	git -C memory checkout -q rename &&
+	echo dirty >>memory/conflict &&
+	test_must_fail git -C memory -c merge.inMemory=true merge modify &&
+	echo rename >expect &&
+	echo dirty >>expect &&
+	test_cmp expect memory/conflict
+'
+
+test_done
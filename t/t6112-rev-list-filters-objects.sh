@@ -231,6 +231,56 @@ test_expect_success 'verify sparse:oid=oid-ish omits top-level files' '
 	test_cmp expected observed
 '
 
+test_expect_success 'setup repo for cone mode sparse:oid' '
+	git init cone &&
+	for p in top a/top a/x/file a/b/file a/b/y/file c/file
+	do
+		mkdir -p cone/$(dirname $p) &&
+		echo "$p" >cone/$p || return 1
+	done &&
+	cat >cone/cone <<-\EOF &&
+	/*
+	!/*/
+	/a/
+	!/a/*/
+	/a/b/
+	EOF
+	echo "/a/b/" >cone/not-cone &&
+	git -C cone add . &&
+	git -C cone commit -m "cone"
+'
+
+test_expect_success 'verify sparse:oid=OID with cone mode patterns' '
+	git -C cone ls-files -s a/x/file c/file >ls_files_result &&
+	awk -f print_2.awk ls_files_result |
+	sort >expected &&
+
+	git -C cone rev-list --quiet --objects --filter-print-omitted \
+		--filter=sparse:oid=master:cone HEAD >revs 2>err &&
+	awk -f print_1.awk revs |
+	sed "s/~//" |
+	sort >observed &&
+
+	test_cmp expected observed &&
+	test_must_be_empty err
+'
+
+test_expect_success 'verify sparse:oid=OID with other patterns' '
+	git -C cone ls-files -s cone not-cone top a/top a/x/file c/file \
+		>ls_files_result &&
+	awk -f print_2.awk ls_files_result |
+	sort >expected &&
+
+	git -C cone rev-list --quiet --objects --filter-print-omitted \
+		--filter=sparse:oid=master:not-cone HEAD >revs 2>err &&
+	awk -f print_1.awk revs |
+	sed "s/~//" |
+	sort >observed &&
+
+	test_cmp expected observed &&
+	test_must_be_empty err
+'
+
 test_expect_success 'rev-list W/ --missing=print and --missing=allow-any for trees' '
 	TREE=$(git -C r3 rev-parse HEAD:dir1) &&
 
@@ -0,0 +1,67 @@
+#!/bin/sh
+
+test_description='rev-list and pack-objects combining bitmaps and filters'
+. ./test-lib.sh
+
+test_expect_success 'set up bitmapped repo' '
+	# one commit will have bitmaps, the other will not
+	test_commit one &&
+	test_commit much-larger-blob-one &&
+	git repack -adb &&
+	test_commit two &&
+	test_commit much-larger-blob-two &&
+	git tag tag-blob HEAD:two.t
+'
+
+for filter in blob:none blob:limit=10 tree:0 tree:1
+do
+	test_expect_success "$filter filter matches non-bitmap traversal" '
+		git rev-list --objects --filter=$filter HEAD >expect &&
+		git rev-list --use-bitmap-index \
+			--objects --filter=$filter HEAD >actual &&
+		# the bitmap output is not in the traversal order
+		sort <expect >expect.sorted &&
+		sort <actual >actual.sorted &&
+		cut -d" " -f1 <expect.sorted >expect &&
+		cut -d" " -f1 <actual.sorted >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'filters keep blobs asked for by name' '
+	git rev-list --objects --filter=blob:none tag-blob HEAD~2 >expect &&
+	git rev-list --use-bitmap-index \
+		--objects --filter=blob:none tag-blob HEAD~2 >actual &&
+	cut -d" " -f1 <expect | sort >expect.sorted &&
+	cut -d" " -f1 <actual | sort >actual.sorted &&
+	test_cmp expect.sorted actual.sorted &&
+	git rev-parse tag-blob >blob &&
+	grep -f blob actual
+'
+
+test_expect_success 'filters exclude objects reachable from haves' '
+	git rev-list --objects --filter=blob:limit=10 HEAD^..HEAD >expect &&
+	git rev-list --use-bitmap-index \
+		--objects --filter=blob:limit=10 HEAD^..HEAD >actual &&
+	cut -d" " -f1 <expect | sort >expect.sorted &&
+	cut -d" " -f1 <actual | sort >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+for bitmaps in true false
+do
+	test_expect_success "pack-objects filters with pack.useBitmaps=$bitmaps" '
+		git rev-list --objects --filter=blob:none HEAD >expect &&
+		cut -d" " -f1 <expect | sort >expect.sorted &&
+		echo HEAD |
+		git -c pack.useBitmaps=$bitmaps pack-objects --revs --stdout \
+			--filter=blob:none >filtered.pack &&
+		rm -f filtered.idx &&
+		git index-pack filtered.pack &&
+		git show-index <filtered.idx >idx &&
+		cut -d" " -f2 <idx | sort >actual.sorted &&
+		test_cmp expect.sorted actual.sorted
+	'
+done
+
+test_done
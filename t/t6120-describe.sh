@@ -382,7 +382,7 @@ test_expect_success 'describe tag object' '
 	test_i18ngrep "fatal: test-blob-1 is neither a commit nor blob" actual
 '
 
-test_expect_failure ULIMIT_STACK_SIZE 'name-rev works in a deep repo' '
+test_expect_success ULIMIT_STACK_SIZE 'name-rev works in a deep repo' '
 	i=1 &&
 	while test $i -lt 8000
 	do
@@ -424,4 +424,29 @@ test_expect_success 'describe complains about missing object' '
 	test_must_fail git describe $ZERO_OID
 '
 
+test_expect_success 'name-rev cuts off by generation with a commit-graph' '
+	rm -rf skew &&
+	git init skew &&
+	(
+		cd skew &&
+		test_commit base &&
+		test_commit target &&
+		# a commit dated long before its parent
+		(
+			GIT_COMMITTER_DATE="1000000000 +0000" &&
+			export GIT_COMMITTER_DATE &&
+			test_commit --notick skewed
+		) &&
+		test_commit tip &&
+		echo "undefined" >expect &&
+		git name-rev --name-only --refs=tip target^0 >actual &&
+		test_cmp expect actual &&
+		git config core.commitGraph true &&
+		git commit-graph write --reachable &&
+		echo "tip~2" >expect &&
+		git name-rev --name-only --refs=tip target^0 >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
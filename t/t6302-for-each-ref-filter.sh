@@ -454,4 +454,17 @@ test_expect_success 'validate worktree atom' '
 	test_cmp expect actual
 '
 
+test_expect_success 'sorting by committerdate from the commit-graph' '
+	git for-each-ref --sort=committerdate --format="%(refname) %(objecttype)" >expect &&
+	git for-each-ref --sort=-committerdate --format="%(refname)" >expect.reverse &&
+	git commit-graph write --reachable &&
+	git -c core.commitGraph=true for-each-ref --sort=committerdate \
+		--format="%(refname) %(objecttype)" >actual &&
+	git -c core.commitGraph=true for-each-ref --sort=-committerdate \
+		--format="%(refname)" >actual.reverse &&
+	rm -f .git/objects/info/commit-graph &&
+	test_cmp expect actual &&
+	test_cmp expect.reverse actual.reverse
+'
+
 test_done
@@ -269,6 +269,36 @@ test_expect_success 'commit_contains:miss' '
 	test_three_modes commit_contains --tag
 '
 
+test_expect_success 'for-each-ref %(upstream:track)' '
+	test_when_finished "git config --remove-section branch.commit-5-5 &&
+		git config --remove-section branch.commit-9-2 &&
+		git config --remove-section branch.commit-4-4 &&
+		git config --remove-section branch.commit-7-7 &&
+		git config --remove-section branch.commit-10-10" &&
+	git config branch.commit-5-5.remote . &&
+	git config branch.commit-5-5.merge refs/heads/commit-3-8 &&
+	git config branch.commit-9-2.remote . &&
+	git config branch.commit-9-2.merge refs/heads/commit-2-9 &&
+	git config branch.commit-4-4.remote . &&
+	git config branch.commit-4-4.merge refs/heads/commit-6-6 &&
+	git config branch.commit-7-7.remote . &&
+	git config branch.commit-7-7.merge refs/heads/commit-7-7 &&
+	git config branch.commit-10-10.remote . &&
+	git config branch.commit-10-10.merge refs/heads/commit-1-1 &&
+	cat >expect <<-\EOF &&
+	commit-10-10 [ahead 99] >
+	commit-4-4 [behind 20] <
+	commit-5-5 [ahead 10, behind 9] <>
+	commit-7-7  =
+	commit-9-2 [ahead 14, behind 14] <>
+	EOF
+	run_three_modes git for-each-ref \
+		--format="%(refname:short) %(upstream:track) %(upstream:trackshort)" \
+		refs/heads/commit-5-5 refs/heads/commit-9-2 \
+		refs/heads/commit-4-4 refs/heads/commit-7-7 \
+		refs/heads/commit-10-10
+'
+
 test_expect_success 'rev-list: basic topo-order' '
 	git rev-parse \
 		commit-6-6 commit-5-6 commit-4-6 commit-3-6 commit-2-6 commit-1-6 \
@@ -405,4 +435,28 @@ test_expect_success 'get_reachable_subset:none' '
 	test_three_modes get_reachable_subset
 '
 
+test_expect_success 'for-each-ref --contains with reachability bitmaps' '
+	for x in $(test_seq 5 10)
+	do
+		for y in $(test_seq 4 10)
+		do
+			echo refs/heads/commit-$x-$y || return 1
+		done
+	done | sort >expect &&
+	git for-each-ref --format="%(refname)" --contains=commit-5-4 \
+		"refs/heads/commit-*" >actual &&
+	test_cmp expect actual &&
+	test_when_finished "rm -f .git/objects/pack/*.bitmap" &&
+	git repack -adb &&
+	ls .git/objects/pack/*.bitmap &&
+	git for-each-ref --format="%(refname)" --contains=commit-5-4 \
+		"refs/heads/commit-*" >actual &&
+	test_cmp expect actual &&
+	run_three_modes git for-each-ref --format="%(refname)" \
+		--contains=commit-5-4 "refs/heads/commit-*" &&
+	sed -e "s,refs/heads/commit,refs/tags/tag," expect >expect.tags &&
+	git tag --contains=commit-5-4 --format="%(refname)" "tag-*" >actual &&
+	test_cmp expect.tags actual
+'
+
 test_done
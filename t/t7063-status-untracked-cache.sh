@@ -691,6 +691,21 @@ test_expect_success 'untracked cache survives a commit' '
 	test_cmp ../before ../after
 '
 
+test_expect_success 'threaded untracked cache prefetch gives the same status' '
+	git -c core.preloadIndex=false status --porcelain >expect &&
+	mkdir -p dtwo/newdir &&
+	: >dtwo/newdir/file &&
+	git -c core.preloadIndex=false status --porcelain >expect &&
+	: >dtwo/newdir/other &&
+	rm -f "$TRASH_DIRECTORY/perf" &&
+	GIT_TEST_PRELOAD_INDEX=1 GIT_TRACE_PERFORMANCE="$TRASH_DIRECTORY/perf" \
+		git status --porcelain >actual &&
+	grep "prefetch untracked cache" "$TRASH_DIRECTORY/perf" &&
+	git -c core.preloadIndex=false status --porcelain >expect &&
+	test_cmp expect actual &&
+	rm -rf dtwo/newdir
+'
+
 test_expect_success 'teardown worktree' '
 	cd ..
 '
@@ -681,4 +681,21 @@ test_expect_success MINGW 'handle clean & core.longpaths = false nicely' '
 	test_i18ngrep "too long" .git/err
 '
 
+test_expect_success 'clean --threads removes subtrees like the serial clean' '
+	test_when_finished "rm -rf threads expect expected actual" &&
+	mkdir -p threads/a/aa threads/b threads/c/cc/ccc threads/empty &&
+	touch threads/file threads/a/aa/1 threads/b/2 threads/c/cc/ccc/3 &&
+	git init threads/nested &&
+	git clean -n -d --threads=1 threads >expect &&
+	git clean -n -d --threads=4 threads >actual &&
+	test_cmp expect actual &&
+	git clean -f -d --threads=4 threads >actual &&
+	sed "s/^Would remove/Removing/;s/^Would skip/Skipping/" expect >expected &&
+	test_cmp expected actual &&
+	test_path_is_dir threads/nested/.git &&
+	test_path_is_missing threads/a &&
+	test_path_is_missing threads/c &&
+	test_path_is_missing threads/file
+'
+
 test_done
@@ -208,4 +208,25 @@ test_expect_success 'missing nested submodule alternate in --reference-if-able m
 	)
 '
 
+test_expect_success 'submodule.reuseClones borrows from a clone of the same URL' '
+	test_when_finished "rm -rf super-dup super-dup-clone" &&
+	test_create_repo super-dup &&
+	(
+		cd super-dup &&
+		git submodule add "file://$base_dir/A" one &&
+		git submodule add --name other "file://$base_dir/A" two &&
+		git commit -m "two submodules of one URL"
+	) &&
+	git clone super-dup super-dup-clone &&
+	(
+		cd super-dup-clone &&
+		git -c submodule.reuseClones=true submodule update --init -j 2 &&
+		test_path_is_missing .git/modules/one/objects/info/alternates &&
+		echo "$base_dir/super-dup-clone/.git/modules/one/objects" >expect &&
+		test_cmp expect .git/modules/other/objects/info/alternates &&
+		test_alternate_is_used .git/modules/other/objects/info/alternates two &&
+		git -C two rev-parse --verify HEAD
+	)
+'
+
 test_done
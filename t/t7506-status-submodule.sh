@@ -405,4 +405,16 @@ test_expect_success 'status with added file in nested submodule (short)' '
 	EOF
 '
 
+test_expect_success 'submodules are asked for their status in parallel' '
+	git -C super -c submodule.diffJobs=1 status --porcelain=2 >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C super -c submodule.diffJobs=3 status --porcelain=2 >actual &&
+	test_cmp expect actual &&
+	grep "\"region_enter\".*\"label\":\"parallel/status\"" trace.event &&
+	rm trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C super -c submodule.diffJobs=1 status --porcelain=2 &&
+	! grep "\"label\":\"parallel/status\"" trace.event
+'
+
 test_done
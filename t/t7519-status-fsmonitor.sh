@@ -294,6 +294,27 @@ do
 	done
 done
 
+test_expect_success 'diff does not lstat paths fsmonitor reports unchanged' '
+	write_script .git/hooks/fsmonitor-test<<-\EOF &&
+	EOF
+	git -c core.fsmonitor= reset --hard &&
+	git update-index --fsmonitor &&
+	git status &&
+	rm dir1/tracked &&
+	git diff --name-status >actual &&
+	test_must_be_empty actual &&
+	git diff --name-status HEAD >actual &&
+	test_must_be_empty actual &&
+	write_script .git/hooks/fsmonitor-test<<-\EOF &&
+	printf "dir1/tracked\0"
+	EOF
+	echo "D	dir1/tracked" >expect &&
+	git diff --name-status >actual &&
+	test_cmp expect actual &&
+	git diff --name-status HEAD >actual &&
+	test_cmp expect actual
+'
+
 # test that splitting the index dosn't interfere
 test_expect_success 'splitting the index results in the same state' '
 	write_integration_script &&
@@ -346,6 +367,40 @@ test_expect_success UNTRACKED_CACHE 'ignore .git changes when invalidating UNTR'
 	test_cmp before after
 '
 
+test_expect_success 'a trailing slash stands for a whole directory' '
+	test_create_repo dir-slash &&
+	(
+		cd dir-slash &&
+		mkdir dir1 dir2 &&
+		: >dir1/file &&
+		: >dir2/file &&
+		git add . &&
+		git commit -m initial &&
+		mkdir -p .git/hooks &&
+		write_script .git/hooks/fsmonitor-dir <<-\EOF &&
+		printf "dir1/\0"
+		EOF
+		git config core.fsmonitor .git/hooks/fsmonitor-dir &&
+		git update-index --fsmonitor &&
+		git update-index --fsmonitor-valid dir1/file dir2/file &&
+		echo changed >dir1/file &&
+		echo changed >dir2/file &&
+		git status --porcelain --untracked-files=no >../actual
+	) &&
+	echo " M dir1/file" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.fsmonitor=false removes the extension' '
+	(
+		cd dir-slash &&
+		git update-index --fsmonitor &&
+		git -c core.fsmonitor=false status &&
+		test-tool dump-fsmonitor >../actual
+	) &&
+	grep "^no fsmonitor" actual
+'
+
 test_expect_success 'discard_index() also discards fsmonitor info' '
 	test_config core.fsmonitor "$TEST_DIRECTORY/t7519/fsmonitor-all" &&
 	test_might_fail git update-index --refresh &&
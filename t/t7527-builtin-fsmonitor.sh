@@ -0,0 +1,145 @@
+#!/bin/sh
+
+test_description='git status with the built-in file system monitor'
+
+. ./test-lib.sh
+
+test -n "$FSMONITOR_DAEMON_BACKEND" || {
+	skip_all='skipping fsmonitor daemon tests, no backend on this platform'
+	test_done
+}
+
+# don't leave a stale daemon running
+test_atexit 'git fsmonitor--daemon stop 2>/dev/null'
+
+# compare "git status" with and without the daemon; the latter must not
+# write the index, which would drop the fsmonitor extension
+check_status () {
+	GIT_OPTIONAL_LOCKS=0 git -c core.fsmonitor=false \
+		status --porcelain --untracked-files=all >expect &&
+	git status --porcelain --untracked-files=all >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	cat >.git/info/exclude <<-\EOF &&
+	expect
+	actual
+	trace
+	out
+	err
+	EOF
+	mkdir -p dir1/sub dir2 &&
+	echo 1 >file &&
+	echo 2 >dir1/file &&
+	echo 3 >dir1/sub/file &&
+	echo 4 >dir2/file &&
+	git add . &&
+	git commit -m initial &&
+	git config core.fsmonitor true &&
+	git config core.untrackedCache true
+'
+
+test_expect_success 'status without a daemon' '
+	test_must_fail git fsmonitor--daemon status &&
+	echo changed >file &&
+	check_status &&
+	git checkout file
+'
+
+test_expect_success 'start the daemon' '
+	git fsmonitor--daemon start &&
+	git fsmonitor--daemon status >out &&
+	grep "is watching" out &&
+	test_must_fail git fsmonitor--daemon start 2>err &&
+	test_i18ngrep "already running" err
+'
+
+test_expect_success 'the first status after the start looks at everything' '
+	echo changed >dir1/file &&
+	(
+		GIT_TRACE_FSMONITOR="$(pwd)/trace" &&
+		export GIT_TRACE_FSMONITOR &&
+		check_status
+	) &&
+	grep "fsmonitor process .true. returned success" trace &&
+	check_status &&
+	git checkout dir1/file
+'
+
+test_expect_success 'modified files are reported' '
+	check_status &&
+	echo changed >dir1/sub/file &&
+	rm -f trace &&
+	(
+		GIT_TRACE_FSMONITOR="$(pwd)/trace" &&
+		export GIT_TRACE_FSMONITOR &&
+		check_status
+	) &&
+	grep "fsmonitor_refresh_callback .dir1/sub/file." trace &&
+	git checkout dir1/sub/file &&
+	check_status
+'
+
+test_expect_success 'new and removed files are reported' '
+	echo new >dir2/new &&
+	check_status &&
+	rm dir2/file &&
+	check_status &&
+	git checkout dir2/file &&
+	rm dir2/new &&
+	check_status
+'
+
+test_expect_success 'new directories are reported' '
+	mkdir -p new/deeper &&
+	echo new >new/deeper/file &&
+	check_status &&
+	echo newer >new/deeper/other &&
+	check_status &&
+	rm -rf new &&
+	check_status
+'
+
+test_expect_success 'renamed directories are reported' '
+	mv dir1 renamed &&
+	check_status &&
+	echo changed >renamed/sub/file &&
+	check_status &&
+	mv renamed dir1 &&
+	check_status &&
+	git checkout dir1 &&
+	check_status
+'
+
+test_expect_success 'mode changes are reported' '
+	test_chmod +x file &&
+	check_status &&
+	test_chmod -x file &&
+	check_status
+'
+
+test_expect_success 'stop the daemon' '
+	git fsmonitor--daemon stop &&
+	test_must_fail git fsmonitor--daemon status &&
+	test_path_is_missing .git/fsmonitor--daemon.ipc &&
+	echo changed >file &&
+	check_status &&
+	git checkout file
+'
+
+test_expect_success 'the daemon exits when the working tree is removed' '
+	git init --separate-git-dir=gone.git gone &&
+	git -C gone fsmonitor--daemon start &&
+	git -C gone fsmonitor--daemon status &&
+	test_path_exists gone.git/fsmonitor--daemon.ipc &&
+	rm -rf gone &&
+	for i in $(test_seq 30)
+	do
+		test -e gone.git/fsmonitor--daemon.ipc || break
+		sleep 1
+	done &&
+	test_path_is_missing gone.git/fsmonitor--daemon.ipc
+'
+
+test_done
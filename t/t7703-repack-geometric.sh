@@ -0,0 +1,173 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+
+objdir=.git/objects
+midx=$objdir/pack/multi-pack-index
+
+test_expect_success '--geometric with no packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		git repack --geometric 2 >out &&
+		test_i18ngrep "Nothing new to pack" out
+	)
+'
+
+test_expect_success '--geometric with an intact progression' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		# These packs already form a geometric progression.
+		test_commit_bulk --start=1 1 && # 3 objects
+		test_commit_bulk --start=2 2 && # 6 objects
+		test_commit_bulk --start=4 4 && # 12 objects
+
+		find $objdir/pack -name "*.pack" | sort >expect &&
+		git repack --geometric 2 -d &&
+		find $objdir/pack -name "*.pack" | sort >actual &&
+
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--geometric with small-pack rollup' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 1 && # 3 objects
+		test_commit_bulk --start=2 1 && # 3 objects
+		find $objdir/pack -name "*.pack" | sort >small &&
+		test_commit_bulk --start=3 4 && # 12 objects
+		test_commit_bulk --start=7 8 && # 24 objects
+		find $objdir/pack -name "*.pack" | sort >before &&
+
+		git repack --geometric 2 -d &&
+
+		# Three packs in total; two of the existing large ones,
+		# and one new one.
+		find $objdir/pack -name "*.pack" | sort >after &&
+		comm -12 before after >untouched &&
+		comm -13 before after >new &&
+		test_line_count = 2 untouched &&
+		test_line_count = 1 new &&
+		comm -12 small after >remaining &&
+		test_must_be_empty remaining &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric with small- and large-pack rollup' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		# size(small1) + size(small2) > size(medium) / 2
+		test_commit_bulk --start=1 1 && # 3 objects
+		test_commit_bulk --start=2 1 && # 3 objects
+		test_commit_bulk --start=2 3 && # 7 objects
+		test_commit_bulk --start=6 9 && # 27 objects &&
+
+		find $objdir/pack -name "*.pack" | sort >before &&
+
+		git repack --geometric 2 -d &&
+
+		find $objdir/pack -name "*.pack" | sort >after &&
+		comm -12 before after >untouched &&
+		comm -13 before after >new &&
+
+		test_line_count = 1 untouched &&
+		test_line_count = 1 new &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric packs loose objects' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 4 &&
+		test_commit loose &&
+		git rev-parse HEAD:loose.t >loose &&
+
+		git repack --geometric 2 -d &&
+
+		find $objdir -type f -path "*/??/*" >loose-files &&
+		test_must_be_empty loose-files &&
+		git cat-file -e $(cat loose)
+	)
+'
+
+test_expect_success '--geometric ignores kept packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit kept && # 3 objects
+		test_commit pack && # 3 objects
+
+		KEEP=$(git pack-objects --revs $objdir/pack/pack <<-EOF
+		refs/tags/kept
+		EOF
+		) &&
+		PACK=$(git pack-objects --revs $objdir/pack/pack <<-EOF
+		refs/tags/pack
+		^refs/tags/kept
+		EOF
+		) &&
+
+		# neither pack contains more than twice the number of
+		# objects in the other, so they would normally get merged
+		# into a new pack; but the kept pack must be left alone
+		touch $objdir/pack/pack-$KEEP.keep &&
+
+		git repack --geometric 2 -d &&
+
+		test_path_is_file $objdir/pack/pack-$KEEP.pack &&
+		test_path_is_file $objdir/pack/pack-$PACK.pack
+	)
+'
+
+test_expect_success '--geometric with --write-midx' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 1 &&
+		test_commit_bulk --start=2 1 &&
+		test_commit_bulk --start=3 4 &&
+
+		git repack --geometric 2 -d --write-midx -b &&
+
+		test_path_is_file $midx &&
+		ls $objdir/pack/multi-pack-index-*.bitmap &&
+		git multi-pack-index verify &&
+		git rev-list --objects --all >expect &&
+		git rev-list --use-bitmap-index --objects --all >actual &&
+		cut -d" " -f1 <expect | sort >expect.sorted &&
+		cut -d" " -f1 <actual | sort >actual.sorted &&
+		test_cmp expect.sorted actual.sorted
+	)
+'
+
+test_expect_success '--geometric is incompatible with -a' '
+	test_must_fail git repack --geometric 2 -a 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_done
@@ -931,6 +931,17 @@ do
 	"
 done
 
+test_expect_success PTHREADS 'grep --threads with --cached and revisions' '
+	git grep --threads=1 --cached -n -e a -e o >expect &&
+	git grep --threads=4 --cached -n -e a -e o >actual 2>err &&
+	test_must_be_empty err &&
+	test_cmp expect actual &&
+	git grep --threads=1 -C1 -e a -e o HEAD HEAD^ -- "[a-z]*" >expect &&
+	git grep --threads=4 -C1 -e a -e o HEAD HEAD^ -- "[a-z]*" >actual 2>err &&
+	test_must_be_empty err &&
+	test_cmp expect actual
+'
+
 test_expect_success !PTHREADS,C_LOCALE_OUTPUT 'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
 	grep ^warning: err >warnings &&
@@ -1701,4 +1712,39 @@ test_expect_success 'grep does not report i-t-a and assume unchanged with -L' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep --dedup-blobs across trees' '
+	git grep --no-dedup-blobs -e vvv -e "only one" HEAD HEAD~1 HEAD -- . >expected &&
+	git grep --dedup-blobs -e vvv -e "only one" HEAD HEAD~1 HEAD -- . >actual &&
+	test_cmp expected actual &&
+	git grep --dedup-blobs --threads=1 -c -e vvv HEAD HEAD~1 HEAD >actual &&
+	git grep --threads=1 -c -e vvv HEAD HEAD~1 HEAD >expected &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep --dedup-blobs finds blobs at several paths' '
+	git init dedup &&
+	(
+		cd dedup &&
+		echo "no match here" >a &&
+		cp a b &&
+		echo "a match here" >c &&
+		cp c d &&
+		git add . &&
+		git commit -m one &&
+		git tag one &&
+		echo "no match here either" >a &&
+		git commit -am two &&
+		cat >expected <<-\EOF &&
+		HEAD:c:a match here
+		HEAD:d:a match here
+		one:c:a match here
+		one:d:a match here
+		EOF
+		git grep --dedup-blobs --threads=1 "a match" HEAD one >actual &&
+		test_cmp expected actual &&
+		git grep --dedup-blobs --threads=4 "a match" HEAD one >actual &&
+		test_cmp expected actual
+	)
+'
+
 test_done
@@ -0,0 +1,121 @@
+#!/bin/sh
+
+test_description='git grep --trigram-index'
+
+. ./test-lib.sh
+
+index=.git/objects/info/grep-trigrams
+
+# Compares "git grep $*" with and without the trigram index.
+check_grep () {
+	test_might_fail git grep --no-trigram-index "$@" >expect &&
+	test_might_fail git grep --trigram-index "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success setup '
+	test_write_lines "hello world" "Color" >hello &&
+	test_write_lines "int main(void)" "return xxyz;" "a.b.c" >main.c &&
+	test_write_lines "aaab abbbc" "q.txt qqtxt" "colour" >misc &&
+	printf "binary\0data\n" >binary &&
+	echo ab >short &&
+	git add . &&
+	test_tick &&
+	git commit -m initial
+'
+
+test_expect_success 'searching the index builds the trigram index' '
+	test_path_is_missing $index &&
+	test_must_fail git grep --trigram-index --cached nothing-matches-this &&
+	test_path_is_file $index &&
+	git grep --trigram-index --cached main >actual &&
+	echo "main.c:int main(void)" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fixed strings give the same matches' '
+	for pattern in hello "lo wo" COLOR main binary nope ab
+	do
+		check_grep --cached -F "$pattern" &&
+		check_grep --cached -F -i "$pattern" &&
+		check_grep --cached -F -c "$pattern" &&
+		check_grep --cached -F -l "$pattern" &&
+		check_grep -F "$pattern" &&
+		check_grep -F "$pattern" HEAD || return 1
+	done
+'
+
+test_expect_success 'regular expressions give the same matches' '
+	for pattern in "col\(ou\)*r" "colou*r" "ab*c" "a\{3\}b" "[ab]bbc" \
+		"x*yz" "q\.txt" "qq.xt" "^return" "world$" "\(x\|y\)yz"
+	do
+		check_grep --cached -G "$pattern" &&
+		check_grep --cached -G -i "$pattern" || return 1
+	done &&
+	for pattern in "col(ou)?r" "colou?r" "colou+r" "ab{0,2}c" "a{3}b" \
+		"[^x]ain" "q\.txt" "(xx|qq)yz" "qq|xx" ma\\S
+	do
+		check_grep --cached -E "$pattern" &&
+		check_grep --cached -E -w "$pattern" || return 1
+	done
+'
+
+test_expect_success PCRE 'Perl regular expressions give the same matches' '
+	for pattern in "colou?r" "\bmain\b" "(?:xx)yz" "(?i)HELLO" "\x61ab" \
+		"q\.txt" "a{3}b" "[\]a]ab"
+	do
+		check_grep --cached -P "$pattern" || return 1
+	done
+'
+
+test_expect_success 'options that show non-matching blobs give the same output' '
+	check_grep --cached -v hello &&
+	check_grep --cached -L hello &&
+	check_grep --cached -e hello --and -e world &&
+	check_grep --cached --not -e hello &&
+	check_grep --cached --all-match -e hello -e main &&
+	check_grep --cached -e hello -e main
+'
+
+test_expect_success 'blobs ruled out are not read' '
+	blob=$(git rev-parse HEAD:hello) &&
+	file=.git/objects/$(test_oid_to_path $blob) &&
+	mv $file saved &&
+	test_when_finished "mv saved $file" &&
+	git grep --no-trigram-index --cached main 2>err &&
+	test_i18ngrep "unable to read" err &&
+	git grep --trigram-index --cached main >actual &&
+	echo "main.c:int main(void)" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'modified worktree files are searched' '
+	echo "hello there" >main.c &&
+	test_when_finished "git checkout main.c" &&
+	git grep --trigram-index there >actual &&
+	echo "main.c:hello there" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'grep.trigramIndex enables the index' '
+	echo "new content" >new &&
+	git add new &&
+	size=$(wc -c <$index) &&
+	git grep --cached content &&
+	test $(wc -c <$index) = $size &&
+	git -c grep.trigramIndex=true grep --cached content &&
+	test $(wc -c <$index) -gt $size
+'
+
+test_expect_success 'a corrupt trigram index is ignored and rewritten' '
+	echo garbage >$index &&
+	git grep --trigram-index --cached hello >actual 2>err &&
+	test_i18ngrep "trigram index" err &&
+	echo "hello:hello world" >expect &&
+	test_cmp expect actual &&
+	git grep --trigram-index --cached hello >actual 2>err &&
+	test_must_be_empty err &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,425 @@
+#!/bin/sh
+
+test_description='git maintenance builtin'
+
+. ./test-lib.sh
+
+GIT_TEST_COMMIT_GRAPH=0
+GIT_TEST_MULTI_PACK_INDEX=0
+
+test_expect_success 'help text' '
+	test_expect_code 129 git maintenance -h 2>err &&
+	test_i18ngrep "usage: git maintenance <subcommand>" err &&
+	test_expect_code 128 git maintenance barf 2>err &&
+	test_i18ngrep "invalid subcommand: barf" err &&
+	test_expect_code 129 git maintenance 2>err &&
+	test_i18ngrep "usage: git maintenance" err
+'
+
+test_expect_success 'run [--auto|--quiet]' '
+	GIT_TRACE2_EVENT="$(pwd)/run-no-auto.txt" \
+		git maintenance run 2>/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/run-auto.txt" \
+		git maintenance run --auto 2>/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/run-no-quiet.txt" \
+		git maintenance run --no-quiet 2>/dev/null &&
+	grep ",\"gc\",\"--quiet\"" run-no-auto.txt &&
+	grep ",\"gc\",\"--auto\",\"--quiet\"" run-auto.txt &&
+	grep ",\"gc\",\"--no-quiet\"" run-no-quiet.txt
+'
+
+test_expect_success 'each task runs in its own trace2 region' '
+	GIT_TRACE2_EVENT="$(pwd)/regions.txt" \
+		git maintenance run --task=gc --task=commit-graph 2>/dev/null &&
+	grep "\"region_enter\".*\"category\":\"maintenance\",\"label\":\"gc\"" regions.txt &&
+	grep "\"region_leave\".*\"category\":\"maintenance\",\"label\":\"commit-graph\"" regions.txt
+'
+
+test_expect_success 'maintenance.auto config option' '
+	GIT_TRACE2_EVENT="$(pwd)/default" git commit --quiet --allow-empty -m 1 &&
+	grep ",\"maintenance\",\"run\",\"--auto\",\"--quiet\"" default &&
+	GIT_TRACE2_EVENT="$(pwd)/true" \
+		git -c maintenance.auto=true \
+		commit --quiet --allow-empty -m 2 &&
+	grep ",\"maintenance\",\"run\",\"--auto\",\"--quiet\"" true &&
+	GIT_TRACE2_EVENT="$(pwd)/false" \
+		git -c maintenance.auto=false \
+		commit --quiet --allow-empty -m 3 &&
+	! grep ",\"maintenance\",\"run\",\"--auto\"" false
+'
+
+test_expect_success 'maintenance.<task>.enabled' '
+	git config maintenance.gc.enabled false &&
+	git config maintenance.commit-graph.enabled true &&
+	GIT_TRACE2_EVENT="$(pwd)/run-config.txt" git maintenance run 2>err &&
+	! grep ",\"gc\"" run-config.txt &&
+	grep ",\"commit-graph\",\"write\"" run-config.txt &&
+	git config --unset maintenance.gc.enabled &&
+	git config --unset maintenance.commit-graph.enabled
+'
+
+test_expect_success 'run --task=<task>' '
+	GIT_TRACE2_EVENT="$(pwd)/run-commit-graph.txt" \
+		git maintenance run --task=commit-graph 2>/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/run-gc.txt" \
+		git maintenance run --task=gc 2>/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/run-both.txt" \
+		git maintenance run --task=commit-graph --task=gc 2>/dev/null &&
+	! grep ",\"gc\"" run-commit-graph.txt &&
+	grep ",\"gc\"" run-gc.txt &&
+	grep ",\"gc\"" run-both.txt &&
+	grep ",\"commit-graph\",\"write\"" run-commit-graph.txt &&
+	! grep ",\"commit-graph\",\"write\"" run-gc.txt &&
+	grep ",\"commit-graph\",\"write\"" run-both.txt
+'
+
+test_expect_success 'run --task=bogus' '
+	test_must_fail git maintenance run --task=bogus 2>err &&
+	test_i18ngrep "is not a valid task" err
+'
+
+test_expect_success 'run --task duplicate' '
+	test_must_fail git maintenance run --task=gc --task=gc 2>err &&
+	test_i18ngrep "cannot be selected multiple times" err
+'
+
+test_expect_success 'a task whose lock is held is skipped' '
+	objdir=$(git rev-parse --git-path objects) &&
+	test_when_finished "rm -f \"$objdir/maintenance-gc.lock\"" &&
+	>"$objdir/maintenance-gc.lock" &&
+	GIT_TRACE2_EVENT="$(pwd)/locked.txt" \
+		git maintenance run --no-quiet --task=gc --task=commit-graph 2>err &&
+	test_i18ngrep "skipping gc maintenance" err &&
+	! grep ",\"gc\"" locked.txt &&
+	grep ",\"commit-graph\",\"write\"" locked.txt
+'
+
+test_expect_success 'commit-graph auto condition' '
+	# count commits against the commit-graph that is in use
+	git config core.commitGraph true &&
+	git commit-graph write --reachable --no-progress &&
+	COMMAND="maintenance run --task=commit-graph --auto --quiet" &&
+
+	GIT_TRACE2_EVENT="$(pwd)/cg-no.txt" \
+		git -c maintenance.commit-graph.auto=1 $COMMAND &&
+	GIT_TRACE2_EVENT="$(pwd)/cg-negative-means-yes.txt" \
+		git -c maintenance.commit-graph.auto="-1" $COMMAND &&
+
+	test_commit first &&
+
+	GIT_TRACE2_EVENT="$(pwd)/cg-zero-means-no.txt" \
+		git -c maintenance.commit-graph.auto=0 $COMMAND &&
+	GIT_TRACE2_EVENT="$(pwd)/cg-one-satisfied.txt" \
+		git -c maintenance.commit-graph.auto=1 $COMMAND &&
+
+	git commit --allow-empty -m "second" &&
+	git commit --allow-empty -m "third" &&
+
+	GIT_TRACE2_EVENT="$(pwd)/cg-two-satisfied.txt" \
+		git -c maintenance.commit-graph.auto=2 $COMMAND &&
+
+	COMMIT_GRAPH_WRITE=",\"commit-graph\",\"write\",\"--split\",\"--reachable\",\"--no-progress\"" &&
+	! grep "$COMMIT_GRAPH_WRITE" cg-no.txt &&
+	grep "$COMMIT_GRAPH_WRITE" cg-negative-means-yes.txt &&
+	! grep "$COMMIT_GRAPH_WRITE" cg-zero-means-no.txt &&
+	grep "$COMMIT_GRAPH_WRITE" cg-one-satisfied.txt &&
+	grep "$COMMIT_GRAPH_WRITE" cg-two-satisfied.txt
+'
+
+test_expect_success 'prefetch multiple remotes' '
+	git clone . clone1 &&
+	git clone . clone2 &&
+	git remote add remote1 "file://$(pwd)/clone1" &&
+	git remote add remote2 "file://$(pwd)/clone2" &&
+	git -C clone1 switch -c one &&
+	git -C clone2 switch -c two &&
+	test_commit -C clone1 one &&
+	test_commit -C clone2 two &&
+	GIT_TRACE2_EVENT="$(pwd)/run-prefetch.txt" git maintenance run --task=prefetch 2>/dev/null &&
+	fetchargs="--prune --no-tags --no-write-fetch-head --recurse-submodules=no --no-auto-gc --refmap= --quiet" &&
+	fetchargs=$(echo "$fetchargs" | sed "s/ /\",\"/g") &&
+	grep ",\"fetch\",\"remote1\",\"$fetchargs\"" run-prefetch.txt &&
+	grep ",\"fetch\",\"remote2\",\"$fetchargs\"" run-prefetch.txt &&
+	test_path_is_missing .git/refs/remotes &&
+	test_path_is_missing .git/FETCH_HEAD &&
+	git log prefetch/remote1/one &&
+	git log prefetch/remote2/two &&
+	git fetch --all &&
+	test_cmp_rev refs/remotes/remote1/one refs/prefetch/remote1/one &&
+	test_cmp_rev refs/remotes/remote2/two refs/prefetch/remote2/two
+'
+
+test_expect_success 'loose-objects task' '
+	# Repack everything so we know the state of the object dir
+	git repack -adk &&
+
+	# Hack to stop maintenance from running during "git commit"
+	echo in use >.git/objects/maintenance-loose-objects.lock &&
+
+	# Assuming that "git commit" creates at least one loose object
+	test_commit create-loose-object &&
+	rm .git/objects/maintenance-loose-objects.lock &&
+
+	ls .git/objects >obj-dir-before &&
+	test_file_not_empty obj-dir-before &&
+	ls .git/objects/pack/*.pack >packs-before &&
+	test_line_count = 1 packs-before &&
+
+	# The first run creates a pack-file
+	# but does not delete loose objects.
+	git maintenance run --task=loose-objects &&
+	ls .git/objects >obj-dir-between &&
+	test_cmp obj-dir-before obj-dir-between &&
+	ls .git/objects/pack/*.pack >packs-between &&
+	test_line_count = 2 packs-between &&
+	ls .git/objects/pack/loose-*.pack >loose-packs &&
+	test_line_count = 1 loose-packs &&
+
+	# The second run deletes loose objects
+	# but does not create a pack-file.
+	git maintenance run --task=loose-objects &&
+	ls .git/objects >obj-dir-after &&
+	cat >expect <<-\EOF &&
+	info
+	pack
+	EOF
+	test_cmp expect obj-dir-after &&
+	ls .git/objects/pack/*.pack >packs-after &&
+	test_cmp packs-between packs-after
+'
+
+test_expect_success 'maintenance.loose-objects.auto' '
+	git repack -adk &&
+	GIT_TRACE2_EVENT="$(pwd)/trace-lo1.txt" \
+		git -c maintenance.loose-objects.auto=1 maintenance \
+		run --auto --task=loose-objects 2>/dev/null &&
+	! grep ",\"prune-packed\"" trace-lo1.txt &&
+	for i in 1 2
+	do
+		printf data-A-$i | git hash-object -t blob --stdin -w &&
+		GIT_TRACE2_EVENT="$(pwd)/trace-loA-$i" \
+			git -c maintenance.loose-objects.auto=2 \
+			maintenance run --auto --task=loose-objects 2>/dev/null &&
+		! grep ",\"prune-packed\"" trace-loA-$i &&
+		printf data-B-$i | git hash-object -t blob --stdin -w &&
+		GIT_TRACE2_EVENT="$(pwd)/trace-loB-$i" \
+			git -c maintenance.loose-objects.auto=2 \
+			maintenance run --auto --task=loose-objects 2>/dev/null &&
+		grep ",\"prune-packed\"" trace-loB-$i &&
+		GIT_TRACE2_EVENT="$(pwd)/trace-loC-$i" \
+			git -c maintenance.loose-objects.auto=2 \
+			maintenance run --auto --task=loose-objects 2>/dev/null &&
+		grep ",\"prune-packed\"" trace-loC-$i || return 1
+	done
+'
+
+test_expect_success 'incremental-repack task' '
+	packDir=.git/objects/pack &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i || return 1
+	done &&
+
+	# Create three disjoint pack-files with size BIG, small, small.
+	echo HEAD~2 | git pack-objects --revs $packDir/test-1 &&
+	test_tick &&
+	git pack-objects --revs $packDir/test-2 <<-\EOF &&
+	HEAD~1
+	^HEAD~2
+	EOF
+	test_tick &&
+	git pack-objects --revs $packDir/test-3 <<-\EOF &&
+	HEAD
+	^HEAD~1
+	EOF
+	rm -f $packDir/pack-* &&
+	rm -f $packDir/loose-* &&
+	ls $packDir/*.pack >packs-before &&
+	test_line_count = 3 packs-before &&
+
+	# the task does nothing without core.multiPackIndex
+	git maintenance run --task=incremental-repack 2>err &&
+	test_i18ngrep "core.multiPackIndex is disabled" err &&
+	test_path_is_missing $packDir/multi-pack-index &&
+	git config core.multiPackIndex true &&
+
+	# the job repacks the two into a new pack, but does not
+	# delete the old ones.
+	git maintenance run --task=incremental-repack &&
+	ls $packDir/*.pack >packs-between &&
+	test_line_count = 4 packs-between &&
+
+	# the job deletes the two old packs, and does not write
+	# a new one because the batch size is not high enough to
+	# pack the largest pack-file.
+	git maintenance run --task=incremental-repack &&
+	ls .git/objects/pack/*.pack >packs-after &&
+	test_line_count = 2 packs-after &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'maintenance.incremental-repack.auto' '
+	git repack -adk &&
+	git config core.multiPackIndex true &&
+	git multi-pack-index write &&
+	GIT_TRACE2_EVENT="$(pwd)/midx-init.txt" git \
+		-c maintenance.incremental-repack.auto=1 \
+		maintenance run --auto --task=incremental-repack 2>/dev/null &&
+	! grep ",\"multi-pack-index\",\"write\"" midx-init.txt &&
+	test_commit new-commit-for-midx-1 &&
+	git pack-objects --revs .git/objects/pack/pack <<-\EOF &&
+	HEAD
+	^HEAD~1
+	EOF
+	GIT_TRACE2_EVENT=$(pwd)/trace-A git \
+		-c maintenance.incremental-repack.auto=2 \
+		maintenance run --auto --task=incremental-repack 2>/dev/null &&
+	! grep ",\"multi-pack-index\",\"write\"" trace-A &&
+	test_commit new-commit-for-midx-2 &&
+	git pack-objects --revs .git/objects/pack/pack <<-\EOF &&
+	HEAD
+	^HEAD~1
+	EOF
+	GIT_TRACE2_EVENT=$(pwd)/trace-B git \
+		-c maintenance.incremental-repack.auto=2 \
+		maintenance run --auto --task=incremental-repack 2>/dev/null &&
+	grep ",\"multi-pack-index\",\"write\"" trace-B &&
+	git config --unset core.multiPackIndex
+'
+
+test_expect_success '--auto and --schedule incompatible' '
+	test_must_fail git maintenance run --auto --schedule=daily 2>err &&
+	test_i18ngrep "at most one" err
+'
+
+test_expect_success 'invalid --schedule value' '
+	test_must_fail git maintenance run --schedule=annually 2>err &&
+	test_i18ngrep "unrecognized --schedule" err
+'
+
+test_expect_success '--schedule inheritance weekly -> daily -> hourly' '
+	git config maintenance.loose-objects.enabled true &&
+	git config maintenance.loose-objects.schedule hourly &&
+	git config maintenance.commit-graph.enabled true &&
+	git config maintenance.commit-graph.schedule daily &&
+	git config maintenance.incremental-repack.enabled true &&
+	git config maintenance.incremental-repack.schedule weekly &&
+
+	GIT_TRACE2_EVENT="$(pwd)/hourly.txt" \
+		git maintenance run --schedule=hourly 2>/dev/null &&
+	grep ",\"prune-packed\"" hourly.txt &&
+	! grep ",\"commit-graph\",\"write\"" hourly.txt &&
+	! grep ",\"multi-pack-index\",\"write\"" hourly.txt &&
+
+	GIT_TRACE2_EVENT="$(pwd)/daily.txt" \
+		git maintenance run --schedule=daily 2>/dev/null &&
+	grep ",\"prune-packed\"" daily.txt &&
+	grep ",\"commit-graph\",\"write\"" daily.txt &&
+	! grep ",\"multi-pack-index\",\"write\"" daily.txt &&
+
+	GIT_TRACE2_EVENT="$(pwd)/weekly.txt" \
+		git -c core.multiPackIndex=true \
+		maintenance run --schedule=weekly 2>/dev/null &&
+	grep ",\"prune-packed\"" weekly.txt &&
+	grep ",\"commit-graph\",\"write\"" weekly.txt &&
+	grep ",\"multi-pack-index\",\"write\"" weekly.txt
+'
+
+test_expect_success 'maintenance.strategy inheritance' '
+	for task in commit-graph loose-objects incremental-repack
+	do
+		git config --unset maintenance.$task.schedule || return 1
+	done &&
+
+	git config maintenance.strategy incremental &&
+
+	GIT_TRACE2_EVENT="$(pwd)/incremental-hourly.txt" \
+		git maintenance run --schedule=hourly --quiet &&
+	GIT_TRACE2_EVENT="$(pwd)/incremental-daily.txt" \
+		git maintenance run --schedule=daily --quiet &&
+
+	grep ",\"commit-graph\",\"write\"" incremental-hourly.txt &&
+	! grep ",\"prune-packed\"" incremental-hourly.txt &&
+	! grep ",\"gc\"" incremental-hourly.txt &&
+	grep ",\"commit-graph\",\"write\"" incremental-daily.txt &&
+	grep ",\"prune-packed\"" incremental-daily.txt &&
+	! grep ",\"gc\"" incremental-daily.txt &&
+
+	# Modify defaults
+	git config maintenance.commit-graph.schedule daily &&
+	git config maintenance.loose-objects.schedule hourly &&
+
+	GIT_TRACE2_EVENT="$(pwd)/modified-hourly.txt" \
+		git maintenance run --schedule=hourly --quiet &&
+	! grep ",\"commit-graph\",\"write\"" modified-hourly.txt &&
+	grep ",\"prune-packed\"" modified-hourly.txt &&
+	git config --unset maintenance.strategy
+'
+
+test_expect_success 'register and unregister' '
+	test_when_finished git config --global --unset-all maintenance.repo &&
+	git config --global --add maintenance.repo /existing1 &&
+	git config --global --add maintenance.repo /existing2 &&
+	git config --global --get-all maintenance.repo >before &&
+
+	git maintenance register &&
+	test_cmp_config false maintenance.auto &&
+	git config --global --get-all maintenance.repo >between &&
+	cp before expect &&
+	pwd >>expect &&
+	test_cmp expect between &&
+
+	# registering twice is a no-op
+	git maintenance register &&
+	git config --global --get-all maintenance.repo >actual &&
+	test_cmp expect actual &&
+
+	git maintenance unregister &&
+	git config --global --get-all maintenance.repo >actual &&
+	test_cmp before actual &&
+
+	# unregistering twice is a no-op
+	git maintenance unregister
+'
+
+test_expect_success 'start from empty cron table' '
+	write_script crontab <<-\EOF &&
+	if test "$1" = "-l"
+	then
+		cat "$HOME/cron.txt" || exit 1
+	else
+		cat >"$HOME/cron.txt"
+	fi
+	EOF
+	PATH="$(pwd):$PATH" GIT_TEST_CRONTAB=crontab git maintenance start &&
+
+	# start registers the repo
+	git config --get --global maintenance.repo "$(pwd)" &&
+
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=daily" cron.txt &&
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=hourly" cron.txt &&
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=weekly" cron.txt
+'
+
+test_expect_success 'stop from existing schedule' '
+	echo "# other job" >>cron.txt &&
+	PATH="$(pwd):$PATH" GIT_TEST_CRONTAB=crontab git maintenance stop &&
+	echo "# other job" >expect &&
+	test_cmp expect cron.txt &&
+
+	# Ensure we are not feeding our own output to the next run
+	PATH="$(pwd):$PATH" GIT_TEST_CRONTAB=crontab git maintenance stop &&
+	test_cmp expect cron.txt
+'
+
+test_expect_success 'start preserves existing schedule' '
+	PATH="$(pwd):$PATH" GIT_TEST_CRONTAB=crontab git maintenance start &&
+	grep "# other job" cron.txt &&
+	grep "maintenance run --schedule=hourly" cron.txt &&
+	PATH="$(pwd):$PATH" GIT_TEST_CRONTAB=crontab git maintenance start &&
+	grep -c "BEGIN GIT MAINTENANCE SCHEDULE" cron.txt >count &&
+	echo 1 >expect &&
+	test_cmp expect count
+'
+
+test_done
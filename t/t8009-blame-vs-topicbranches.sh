@@ -33,4 +33,30 @@ test_expect_success 'blame --reverse --first-parent finds A1' '
 	test_cmp expect actual
 	'
 
+test_expect_success 'blame with threads through a merge changing both sides' '
+	git checkout -b left A0 &&
+	test_write_lines 1 2 3 4 5 6 >both.t &&
+	git add both.t &&
+	test_tick &&
+	git commit -m base &&
+	git checkout -b right &&
+	test_write_lines 1 2 3 4 5 right >both.t &&
+	test_tick &&
+	git commit -a -m right &&
+	git checkout left &&
+	test_write_lines left 2 3 4 5 6 >both.t &&
+	test_tick &&
+	git commit -a -m left &&
+	git merge --no-commit right &&
+	test_write_lines left 2 merged 4 5 right >both.t &&
+	test_tick &&
+	git commit -a -m merge &&
+	git -c blame.threads=1 blame --porcelain both.t >expect &&
+	git -c blame.threads=4 blame --porcelain both.t >actual &&
+	test_cmp expect actual &&
+	grep "^$(git rev-parse HEAD^1) 1 1" actual &&
+	grep "^$(git rev-parse HEAD) 3 3" actual &&
+	grep "^$(git rev-parse HEAD^2) 6 6" actual
+	'
+
 test_done
@@ -0,0 +1,113 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+. ./test-lib.sh
+
+# Compares the output of "git blame $*" with and without the cache.
+check_blame () {
+	git -c blame.cache=false blame "$@" >expect &&
+	git -c blame.cache=true blame "$@" >actual &&
+	test_cmp expect actual
+}
+
+# Lists "<final line> <commit> <original line>" from --incremental output,
+# whose entries come in the order they are found.
+incremental_lines () {
+	awk "NF == 4 && length(\$1) >= 40 {
+		for (i = 0; i < \$4; i++)
+			print \$3 + i, \$1, \$2 + i
+	}" "$1" | sort -n
+}
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m root &&
+	for i in 2 4 6 8
+	do
+		sed -e "s/^$i\$/$i changed/" file >tmp &&
+		mv tmp file &&
+		test_tick &&
+		git commit -a -m "change $i" || return 1
+	done &&
+	git tag old &&
+	git checkout -b side old~2 &&
+	echo side >>file &&
+	test_tick &&
+	git commit -a -m side &&
+	git checkout master &&
+	test_tick &&
+	git merge -m merge side &&
+	git mv file renamed &&
+	sed -e "s/^3\$/3 changed/" renamed >tmp &&
+	mv tmp renamed &&
+	git add renamed &&
+	test_tick &&
+	git commit -m "rename and change 3"
+'
+
+test_expect_success 'blame writes a cache entry' '
+	check_blame old -- file &&
+	ls .git/blame-cache >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'blame of a cached commit walks no history' '
+	git -c blame.cache=true blame --show-stats old -- file >out &&
+	grep "^num commits: 0" out
+'
+
+test_expect_success 'blame builds on the cache of an ancestor' '
+	git -c blame.cache=false blame --show-stats renamed >out &&
+	grep "^num commits:" out >full &&
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame old -- file >/dev/null &&
+	check_blame renamed &&
+	check_blame --porcelain renamed &&
+	check_blame --line-porcelain -f renamed &&
+	git -c blame.cache=false blame --incremental renamed >out &&
+	incremental_lines out >expect &&
+	git -c blame.cache=true blame --incremental renamed >out &&
+	incremental_lines out >actual &&
+	test_cmp expect actual &&
+	rm .git/blame-cache/* &&
+	git -c blame.cache=true blame old -- file >/dev/null &&
+	git -c blame.cache=true blame --show-stats renamed >out &&
+	grep "^num commits:" out >cached &&
+	! test_cmp full cached
+'
+
+test_expect_success 'the root is still shown as a boundary' '
+	check_blame -b renamed &&
+	check_blame --root renamed
+'
+
+test_expect_success 'line ranges use the cache but do not fill it' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame -L 2,4 HEAD -- renamed >/dev/null &&
+	test_path_is_missing .git/blame-cache &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	check_blame -L 2,4 renamed &&
+	check_blame -L 2,4 HEAD^ -- file
+'
+
+test_expect_success 'options affecting blame do not use the cache' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame -M HEAD -- renamed >/dev/null &&
+	git -c blame.cache=true blame --ignore-rev HEAD^ HEAD -- renamed >/dev/null &&
+	git -c blame.cache=true blame old..HEAD -- renamed >/dev/null &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'a corrupt cache entry is ignored' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	for f in .git/blame-cache/*
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	check_blame HEAD -- renamed
+'
+
+test_done
@@ -3319,4 +3319,95 @@ test_expect_success 'X: handling encoding' '
 	git log -1 --format=%B encoding | grep $(printf "\317\200")
 '
 
+###
+### series Y (--threads)
+###
+
+test_expect_success 'Y: set up a stream with many blobs' '
+	for i in $(test_seq 1 30)
+	do
+		cat <<-EOF &&
+		blob
+		mark :$((i + 100))
+		data <<DATA
+		$(test_seq 1 $((i * 20)))
+		DATA
+
+		commit refs/heads/threads
+		mark :$i
+		committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $i +0000
+		data <<COMMIT
+		commit $i
+		COMMIT
+		M 644 :$((i + 100)) a
+		M 644 inline b
+		data <<DATA
+		$(test_seq $i 400)
+		DATA
+
+		EOF
+		if test $((i % 10)) = 0
+		then
+			echo "cat-blob :$((i + 100))" &&
+			echo
+		fi || return 1
+	done >threads.stream
+'
+
+test_expect_success 'Y: --threads writes the same pack and marks' '
+	for threads in 1 4
+	do
+		rm -fr threads-$threads &&
+		git init threads-$threads &&
+		git -C threads-$threads fast-import --depth=3 \
+			--threads=$threads --export-marks=../marks-$threads \
+			<threads.stream >cat-blob-$threads || return 1
+	done &&
+	test_cmp marks-1 marks-4 &&
+	test_cmp cat-blob-1 cat-blob-4 &&
+	ls threads-1/.git/objects/pack/*.pack >packs-1 &&
+	ls threads-4/.git/objects/pack/*.pack >packs-4 &&
+	test_line_count = 1 packs-1 &&
+	test_cmp_bin $(cat packs-1) $(cat packs-4) &&
+	git -C threads-4 fsck
+'
+
+test_expect_success 'Y: full packs are finished while the import goes on' '
+	for i in $(test_seq 1 6)
+	do
+		test-tool genrandom $i 400000 >random &&
+		echo blob &&
+		echo "mark :$i" &&
+		echo "data $(wc -c <random)" &&
+		cat random &&
+		cat <<-EOF &&
+
+		commit refs/heads/split
+		committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $i +0000
+		data <<COMMIT
+		commit $i
+		COMMIT
+		M 644 :$i random
+
+		EOF
+		# read back a blob that may be in a pack being finished
+		echo "cat-blob :$((i > 1 ? i - 1 : 1))" || return 1
+	done >split.stream &&
+	git init split &&
+	git -C split -c fastimport.unpackLimit=0 fast-import \
+		--max-pack-size=1m --write-commit-graph \
+		--export-pack-edges=../split.edges <split.stream >cat.out &&
+	test $(wc -c <cat.out) -gt 2400000 &&
+	ls split/.git/objects/pack/*.pack >packs &&
+	test_line_count = 3 packs &&
+	test_line_count = 3 split.edges &&
+	git -C split fsck &&
+	git -C split commit-graph verify &&
+	git -C split rev-list refs/heads/split >expect &&
+	git -C split -c core.commitGraph=true \
+		rev-list refs/heads/split >actual &&
+	test_line_count = 6 actual &&
+	test_cmp expect actual
+'
+
 test_done
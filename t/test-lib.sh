@@ -415,6 +415,13 @@ export GIT_AUTHOR_EMAIL GIT_AUTHOR_NAME
 export GIT_COMMITTER_EMAIL GIT_COMMITTER_NAME
 export EDITOR
 
+# Run the test repositories on another ref storage backend if asked to
+if test -n "$GIT_TEST_DEFAULT_REF_FORMAT"
+then
+	GIT_DEFAULT_REF_FORMAT=$GIT_TEST_DEFAULT_REF_FORMAT
+	export GIT_DEFAULT_REF_FORMAT
+fi
+
 # Tests using GIT_TRACE typically don't want <timestamp> <file>:<line> output
 GIT_TRACE_BARE=1
 export GIT_TRACE_BARE
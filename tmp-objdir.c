@@ -11,6 +11,7 @@
 struct tmp_objdir {
 	struct strbuf path;
 	struct argv_array env;
+	struct object_directory *prev_odb;
 };
 
 /*
@@ -38,6 +39,12 @@ static int tmp_objdir_destroy_1(struct tmp_objdir *t, int on_signal)
 	if (t == the_tmp_objdir)
 		the_tmp_objdir = NULL;
 
+	/* no need to bother with the object store when we are dying */
+	if (!on_signal && t->prev_odb) {
+		restore_primary_odb(t->prev_odb, t->path.buf);
+		t->prev_odb = NULL;
+	}
+
 	/*
 	 * This may use malloc via strbuf_grow(), but we should
 	 * have pre-grown t->path sufficiently so that this
@@ -129,7 +136,7 @@ struct tmp_objdir *tmp_objdir_create(void)
 	if (the_tmp_objdir)
 		BUG("only one tmp_objdir can be used at a time");
 
-	t = xmalloc(sizeof(*t));
+	t = xcalloc(1, sizeof(*t));
 	strbuf_init(&t->path, 0);
 	argv_array_init(&t->env);
 
@@ -214,6 +221,15 @@ static int read_dir_paths(struct string_list *out, const char *path)
 
 static int migrate_paths(struct strbuf *src, struct strbuf *dst);
 
+/* Is "path" a loose object fan-out directory, "objects/xx"? */
+static int is_loose_object_dir(const char *path)
+{
+	const char *name = strrchr(path, '/');
+
+	return name && strlen(++name) == 2 &&
+	       isxdigit(name[0]) && isxdigit(name[1]);
+}
+
 static int migrate_one(struct strbuf *src, struct strbuf *dst)
 {
 	struct stat st;
@@ -221,6 +237,16 @@ static int migrate_one(struct strbuf *src, struct strbuf *dst)
 	if (stat(src->buf, &st) < 0)
 		return -1;
 	if (S_ISDIR(st.st_mode)) {
+		/*
+		 * A fan-out directory that the primary object directory
+		 * does not have yet, as is common right after a repack,
+		 * is moved over with a single rename instead of one per
+		 * object. If it shows up meanwhile, rename() fails (or
+		 * replaces it while it is still empty) and we move each
+		 * object in turn.
+		 */
+		if (is_loose_object_dir(src->buf) && !rename(src->buf, dst->buf))
+			return adjust_shared_perm(dst->buf);
 		if (!mkdir(dst->buf, 0777)) {
 			if (adjust_shared_perm(dst->buf))
 				return -1;
@@ -267,6 +293,11 @@ int tmp_objdir_migrate(struct tmp_objdir *t)
 	if (!t)
 		return 0;
 
+	if (t->prev_odb) {
+		restore_primary_odb(t->prev_odb, t->path.buf);
+		t->prev_odb = NULL;
+	}
+
 	strbuf_addbuf(&src, &t->path);
 	strbuf_addstr(&dst, get_object_directory());
 
@@ -290,3 +321,10 @@ void tmp_objdir_add_as_alternate(const struct tmp_objdir *t)
 {
 	add_to_alternates_memory(t->path.buf);
 }
+
+void tmp_objdir_replace_primary_odb(struct tmp_objdir *t)
+{
+	if (t->prev_odb)
+		BUG("the primary object database is already replaced");
+	t->prev_odb = set_temporary_primary_odb(t->path.buf);
+}
@@ -51,4 +51,12 @@ int tmp_objdir_destroy(struct tmp_objdir *);
  */
 void tmp_objdir_add_as_alternate(const struct tmp_objdir *);
 
+/*
+ * Make the temporary object directory the one new objects are written to in
+ * the current process, keeping the former one as the first alternate; the
+ * former one becomes the primary again when the temporary object directory
+ * is migrated or destroyed.
+ */
+void tmp_objdir_replace_primary_odb(struct tmp_objdir *);
+
 #endif /* TMP_OBJDIR_H */
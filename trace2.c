@@ -8,14 +8,19 @@
 #include "version.h"
 #include "trace2/tr2_cfg.h"
 #include "trace2/tr2_cmd_name.h"
+#include "trace2/tr2_ctr.h"
 #include "trace2/tr2_dst.h"
+#include "trace2/tr2_mem.h"
 #include "trace2/tr2_sid.h"
 #include "trace2/tr2_sysenv.h"
 #include "trace2/tr2_tgt.h"
 #include "trace2/tr2_tls.h"
+#include "trace2/tr2_tmr.h"
 
 static int trace2_enabled;
 
+int trace2_alloc_accounting;
+
 static int tr2_next_child_id; /* modify under lock */
 static int tr2_next_exec_id; /* modify under lock */
 static int tr2_next_repo_id = 1; /* modify under lock. zero is reserved */
@@ -31,6 +36,7 @@ static struct tr2_tgt *tr2_tgt_builtins[] =
 	&tr2_tgt_normal,
 	&tr2_tgt_perf,
 	&tr2_tgt_event,
+	&tr2_tgt_sample,
 	NULL
 };
 /* clang-format on */
@@ -83,6 +89,47 @@ static void tr2_tgt_disable_builtins(void)
 		tgt_j->pfn_term();
 }
 
+static void tr2_tgt_emit_a_timer(const struct tr2_timer_metadata *meta,
+				 const struct tr2_timer *timer,
+				 int is_final_data)
+{
+	struct tr2_tgt *tgt_j;
+	int j;
+
+	for_each_wanted_builtin (j, tgt_j)
+		if (tgt_j->pfn_timer)
+			tgt_j->pfn_timer(meta, timer, is_final_data);
+}
+
+static void tr2_tgt_emit_a_counter(const struct tr2_counter_metadata *meta,
+				   const struct tr2_counter *counter,
+				   int is_final_data)
+{
+	struct tr2_tgt *tgt_j;
+	int j;
+
+	for_each_wanted_builtin (j, tgt_j)
+		if (tgt_j->pfn_counter)
+			tgt_j->pfn_counter(meta, counter, is_final_data);
+}
+
+/*
+ * Report the timers and counters of the current thread that want
+ * per-thread events, and add them to the process totals.
+ */
+static void tr2_flush_thread_timers_and_counters(void)
+{
+	tr2_emit_per_thread_timers(tr2_tgt_emit_a_timer);
+	tr2_emit_per_thread_counters(tr2_tgt_emit_a_counter);
+
+	tr2tls_lock();
+	tr2_update_final_timers();
+	tr2_update_final_counters();
+	if (trace2_alloc_accounting)
+		tr2_mem_update_final();
+	tr2tls_unlock();
+}
+
 static int tr2main_exit_code;
 
 /*
@@ -110,6 +157,14 @@ static void tr2main_atexit_handler(void)
 	 */
 	tr2tls_pop_unwind_self();
 
+	/*
+	 * Threads that called trace2_thread_exit() have already added
+	 * their timers and counters to the totals; add ours and report.
+	 */
+	tr2_flush_thread_timers_and_counters();
+	tr2_emit_final_timers(tr2_tgt_emit_a_timer);
+	tr2_emit_final_counters(tr2_tgt_emit_a_counter);
+
 	for_each_wanted_builtin (j, tgt_j)
 		if (tgt_j->pfn_atexit)
 			tgt_j->pfn_atexit(us_elapsed_absolute,
@@ -117,6 +172,7 @@ static void tr2main_atexit_handler(void)
 
 	tr2_tgt_disable_builtins();
 
+	trace2_alloc_accounting = 0;
 	tr2tls_release();
 	tr2_sid_release();
 	tr2_cmd_name_release();
@@ -153,6 +209,8 @@ void trace2_initialize_fl(const char *file, int line)
 {
 	struct tr2_tgt *tgt_j;
 	int j;
+	const char *memory;
+	int want_memory;
 
 	if (trace2_enabled)
 		return;
@@ -167,7 +225,14 @@ void trace2_initialize_fl(const char *file, int line)
 
 	atexit(tr2main_atexit_handler);
 	sigchain_push(SIGPIPE, tr2main_signal_handler);
+
+	memory = tr2_sysenv_get(TR2_SYSENV_MEMORY);
+	want_memory = memory && *memory && git_parse_maybe_bool(memory) > 0;
+	if (want_memory)
+		tr2tls_record_region_memory();
+
 	tr2tls_init();
+	trace2_alloc_accounting = want_memory;
 
 	/*
 	 * Emit 'version' message on each active builtin target.
@@ -491,6 +556,8 @@ void trace2_thread_exit_fl(const char *file, int line)
 	tr2tls_pop_unwind_self();
 	us_elapsed_thread = tr2tls_region_elasped_self(us_now);
 
+	tr2_flush_thread_timers_and_counters();
+
 	for_each_wanted_builtin (j, tgt_j)
 		if (tgt_j->pfn_thread_exit_fl)
 			tgt_j->pfn_thread_exit_fl(file, line,
@@ -500,6 +567,44 @@ void trace2_thread_exit_fl(const char *file, int line)
 	tr2tls_unset_self();
 }
 
+void trace2_timer_start(enum trace2_timer_id tid)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (tid < 0 || tid >= TRACE2_NUMBER_OF_TIMERS)
+		BUG("invalid timer id: %d", tid);
+
+	tr2_start_timer(tid);
+}
+
+void trace2_timer_stop(enum trace2_timer_id tid)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (tid < 0 || tid >= TRACE2_NUMBER_OF_TIMERS)
+		BUG("invalid timer id: %d", tid);
+
+	tr2_stop_timer(tid);
+}
+
+void trace2_counter_add(enum trace2_counter_id cid, uint64_t value)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (cid < 0 || cid >= TRACE2_NUMBER_OF_COUNTERS)
+		BUG("invalid counter id: %d", cid);
+
+	tr2_counter_increment(cid, value);
+}
+
+void trace2_alloc_add(size_t size)
+{
+	tr2_mem_count(size);
+}
+
 void trace2_def_param_fl(const char *file, int line, const char *param,
 			 const char *value)
 {
@@ -561,7 +666,7 @@ void trace2_region_enter_printf_va_fl(const char *file, int line,
 				file, line, us_elapsed_absolute, category,
 				label, repo, fmt, ap);
 
-	tr2tls_push_self(us_now);
+	tr2tls_push_self(us_now, category, label);
 }
 
 void trace2_region_enter_fl(const char *file, int line, const char *category,
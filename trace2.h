@@ -387,6 +387,79 @@ void trace2_printf(const char *fmt, ...);
 /* clang-format on */
 #endif
 
+/*
+ * Timers and counters for code that runs too often to be wrapped in
+ * regions.  Each thread accumulates its own intervals and values
+ * without taking a lock; they are added together when the thread
+ * calls trace2_thread_exit() and are reported once, when the process
+ * exits, as "timer" and "counter" events.  Timers and counters that
+ * want it also report their per-thread values as "th_timer" and
+ * "th_counter" events.  Nothing is reported for a timer or counter
+ * that was never used.
+ *
+ * Add new timers and counters to these enums and describe them in
+ * the metadata tables in trace2/tr2_tmr.c and trace2/tr2_ctr.c.
+ */
+enum trace2_timer_id {
+	/*
+	 * Used by t/helper/test-trace2.c; TEST2 also wants per-thread
+	 * events.
+	 */
+	TRACE2_TIMER_ID_TEST1 = 0,
+	TRACE2_TIMER_ID_TEST2,
+
+	/* Time spent in git_inflate(). */
+	TRACE2_TIMER_ID_INFLATE,
+
+	TRACE2_NUMBER_OF_TIMERS
+};
+
+/*
+ * Start or stop a timer on the current thread.  Nested start/stop
+ * pairs on the same timer only count the outermost interval.
+ */
+void trace2_timer_start(enum trace2_timer_id tid);
+void trace2_timer_stop(enum trace2_timer_id tid);
+
+enum trace2_counter_id {
+	/*
+	 * Used by t/helper/test-trace2.c; TEST2 also wants per-thread
+	 * events.
+	 */
+	TRACE2_COUNTER_ID_TEST1 = 0,
+	TRACE2_COUNTER_ID_TEST2,
+
+	/* lstat() calls made while refreshing index entries. */
+	TRACE2_COUNTER_ID_REFRESH_LSTAT,
+
+	TRACE2_NUMBER_OF_COUNTERS
+};
+
+/*
+ * Add a value to a counter on the current thread.
+ */
+void trace2_counter_add(enum trace2_counter_id cid, uint64_t value);
+
+/*
+ * Allocation accounting.  When GIT_TRACE2_MEMORY (trace2.memory) is
+ * set, xmalloc() and friends report the bytes they hand out through
+ * trace2_alloc().  The "region_leave" events of the perf and event
+ * targets then carry the bytes and number of allocations made by
+ * the thread while in the region and the peak RSS of the process,
+ * and the "exit" event the totals of all threads.
+ *
+ * Allocations made outside of xmalloc() and friends are not seen.
+ */
+extern int trace2_alloc_accounting;
+
+void trace2_alloc_add(size_t size);
+
+#define trace2_alloc(size)                         \
+	do {                                       \
+		if (trace2_alloc_accounting)       \
+			trace2_alloc_add((size));  \
+	} while (0)
+
 /*
  * Optional platform-specific code to dump information about the
  * current and any parent process(es).  This is intended to allow
@@ -0,0 +1,74 @@
+#include "cache.h"
+#include "thread-utils.h"
+#include "trace2/tr2_ctr.h"
+#include "trace2/tr2_tls.h"
+
+/*
+ * The process totals, filled in by each thread as it exits.  Modify
+ * under the TLS lock.
+ */
+static struct tr2_counter_block final_counter_block;
+
+/* clang-format off */
+static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTERS] = {
+	[TRACE2_COUNTER_ID_TEST1] = {
+		.category = "test",
+		.name = "test1",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_TEST2] = {
+		.category = "test",
+		.name = "test2",
+		.want_per_thread_events = 1,
+	},
+	[TRACE2_COUNTER_ID_REFRESH_LSTAT] = {
+		.category = "index",
+		.name = "refresh_lstat",
+		.want_per_thread_events = 0,
+	},
+};
+/* clang-format on */
+
+void tr2_counter_increment(enum trace2_counter_id cid, uint64_t value)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+
+	ctx->counter_block.counter[cid].value += value;
+}
+
+void tr2_update_final_counters(void)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	enum trace2_counter_id cid;
+
+	for (cid = 0; cid < TRACE2_NUMBER_OF_COUNTERS; cid++)
+		final_counter_block.counter[cid].value +=
+			ctx->counter_block.counter[cid].value;
+
+	memset(&ctx->counter_block, 0, sizeof(ctx->counter_block));
+}
+
+void tr2_emit_per_thread_counters(tr2_tgt_evt_counter_t *fn)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	enum trace2_counter_id cid;
+
+	for (cid = 0; cid < TRACE2_NUMBER_OF_COUNTERS; cid++) {
+		struct tr2_counter *c = &ctx->counter_block.counter[cid];
+
+		if (c->value && tr2_counter_metadata[cid].want_per_thread_events)
+			fn(&tr2_counter_metadata[cid], c, 0);
+	}
+}
+
+void tr2_emit_final_counters(tr2_tgt_evt_counter_t *fn)
+{
+	enum trace2_counter_id cid;
+
+	for (cid = 0; cid < TRACE2_NUMBER_OF_COUNTERS; cid++) {
+		struct tr2_counter *c = &final_counter_block.counter[cid];
+
+		if (c->value)
+			fn(&tr2_counter_metadata[cid], c, 1);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef TR2_CTR_H
+#define TR2_CTR_H
+
+#include "trace2.h"
+#include "trace2/tr2_tgt.h"
+
+/*
+ * Static description of a counter, from the table in tr2_ctr.c.
+ */
+struct tr2_counter_metadata {
+	const char *category;
+	const char *name;
+
+	/*
+	 * Also emit a "th_counter" event with the value of each thread
+	 * as it exits.
+	 */
+	unsigned int want_per_thread_events:1;
+};
+
+/*
+ * The accumulated value of a counter, either for one thread or for
+ * the whole process.
+ */
+struct tr2_counter {
+	uint64_t value;
+};
+
+struct tr2_counter_block {
+	struct tr2_counter counter[TRACE2_NUMBER_OF_COUNTERS];
+};
+
+/*
+ * Add a value to a counter of the current thread.
+ */
+void tr2_counter_increment(enum trace2_counter_id cid, uint64_t value);
+
+/*
+ * Add the counters of the current thread to the process totals.  The
+ * caller must hold the TLS lock.
+ */
+void tr2_update_final_counters(void);
+
+/*
+ * Call "fn" for each counter of the current thread that wants
+ * per-thread events and is not zero.
+ */
+void tr2_emit_per_thread_counters(tr2_tgt_evt_counter_t *fn);
+
+/*
+ * Call "fn" for each counter of the process that is not zero.
+ */
+void tr2_emit_final_counters(tr2_tgt_evt_counter_t *fn);
+
+#endif /* TR2_CTR_H */
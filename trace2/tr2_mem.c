@@ -0,0 +1,61 @@
+#include "cache.h"
+#include "thread-utils.h"
+#include "trace2/tr2_mem.h"
+#include "trace2/tr2_tls.h"
+
+/*
+ * The process totals, filled in by each thread as it exits.  Modify
+ * under the TLS lock.
+ */
+static struct tr2_mem final_mem;
+
+void tr2_mem_count(size_t size)
+{
+	/*
+	 * Do not create a context for an unknown thread here: that
+	 * would allocate, and call us again.
+	 */
+	struct tr2tls_thread_ctx *ctx = tr2tls_peek_self();
+
+	if (!ctx)
+		return;
+
+	ctx->mem.bytes += size;
+	ctx->mem.count++;
+}
+
+void tr2_mem_update_final(void)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+
+	final_mem.bytes += ctx->mem.bytes;
+	final_mem.count += ctx->mem.count;
+}
+
+void tr2_mem_get_totals(struct tr2_mem *totals)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+
+	tr2tls_lock();
+	totals->bytes = final_mem.bytes + ctx->mem.bytes;
+	totals->count = final_mem.count + ctx->mem.count;
+	tr2tls_unlock();
+}
+
+uintmax_t tr2_mem_peak_rss_kb(void)
+{
+#ifdef RUSAGE_SELF
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+#ifdef __APPLE__
+	/* macOS reports bytes, the others KiB */
+	return (uintmax_t)ru.ru_maxrss / 1024;
+#else
+	return (uintmax_t)ru.ru_maxrss;
+#endif
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef TR2_MEM_H
+#define TR2_MEM_H
+
+/*
+ * Bytes handed out by xmalloc() and friends, and the number of
+ * calls.  Each thread counts in its TLS context; see tr2_tls.h for
+ * the per-region values.
+ */
+struct tr2_mem {
+	uint64_t bytes;
+	uint64_t count;
+};
+
+/*
+ * Add an allocation of "size" bytes to the current thread.
+ */
+void tr2_mem_count(size_t size);
+
+/*
+ * Add the allocations of the current thread to the process totals,
+ * when it exits.  The caller must hold the TLS lock.
+ */
+void tr2_mem_update_final(void);
+
+/*
+ * Get the process totals, including the current thread.
+ */
+void tr2_mem_get_totals(struct tr2_mem *totals);
+
+/*
+ * The peak resident set size of the process in KiB, or 0 if the
+ * platform cannot tell.
+ */
+uintmax_t tr2_mem_peak_rss_kb(void);
+
+#endif /* TR2_MEM_H */
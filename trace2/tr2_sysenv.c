@@ -49,6 +49,14 @@ static struct tr2_sysenv_entry tr2_sysenv_settings[] = {
 				       "trace2.perftarget" },
 	[TR2_SYSENV_PERF_BRIEF]    = { "GIT_TRACE2_PERF_BRIEF",
 				       "trace2.perfbrief" },
+
+	[TR2_SYSENV_SAMPLE]        = { "GIT_TRACE2_SAMPLE",
+				       "trace2.sampletarget" },
+	[TR2_SYSENV_SAMPLE_INTERVAL] = { "GIT_TRACE2_SAMPLE_INTERVAL",
+				       "trace2.sampleinterval" },
+
+	[TR2_SYSENV_MEMORY]        = { "GIT_TRACE2_MEMORY",
+				       "trace2.memory" },
 };
 /* clang-format on */
 
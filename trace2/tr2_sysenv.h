@@ -24,6 +24,11 @@ enum tr2_sysenv_variable {
 	TR2_SYSENV_PERF,
 	TR2_SYSENV_PERF_BRIEF,
 
+	TR2_SYSENV_SAMPLE,
+	TR2_SYSENV_SAMPLE_INTERVAL,
+
+	TR2_SYSENV_MEMORY,
+
 	TR2_SYSENV_MUST_BE_LAST
 };
 
@@ -4,11 +4,14 @@
 #include "run-command.h"
 #include "version.h"
 #include "trace2/tr2_dst.h"
+#include "trace2/tr2_ctr.h"
+#include "trace2/tr2_mem.h"
 #include "trace2/tr2_tbuf.h"
 #include "trace2/tr2_sid.h"
 #include "trace2/tr2_sysenv.h"
 #include "trace2/tr2_tgt.h"
 #include "trace2/tr2_tls.h"
+#include "trace2/tr2_tmr.h"
 
 static struct tr2_dst tr2dst_event = { TR2_SYSENV_EVENT, 0, 0, 0 };
 
@@ -107,6 +110,16 @@ static void event_fmt_prepare(const char *event_name, const char *file,
 		jw_object_intmax(jw, "repo", repo->trace2_repo_id);
 }
 
+static void maybe_add_mem(struct json_writer *jw, const struct tr2_mem *mem)
+{
+	if (!trace2_alloc_accounting)
+		return;
+
+	jw_object_intmax(jw, "alloc_bytes", mem->bytes);
+	jw_object_intmax(jw, "alloc_count", mem->count);
+	jw_object_intmax(jw, "peak_rss_kb", tr2_mem_peak_rss_kb());
+}
+
 static void fn_version_fl(const char *file, int line)
 {
 	const char *event_name = "version";
@@ -152,6 +165,12 @@ static void fn_exit_fl(const char *file, int line, uint64_t us_elapsed_absolute,
 	event_fmt_prepare(event_name, file, line, NULL, &jw);
 	jw_object_double(&jw, "t_abs", 6, t_abs);
 	jw_object_intmax(&jw, "code", code);
+	if (trace2_alloc_accounting) {
+		struct tr2_mem totals;
+
+		tr2_mem_get_totals(&totals);
+		maybe_add_mem(&jw, &totals);
+	}
 	jw_end(&jw);
 
 	tr2_dst_write_line(&tr2dst_event, &jw.json);
@@ -497,6 +516,7 @@ static void fn_region_leave_printf_va_fl(
 		if (label)
 			jw_object_string(&jw, "label", label);
 		maybe_add_string_va(&jw, "msg", fmt, ap);
+		maybe_add_mem(&jw, &ctx->last_region_mem);
 		jw_end(&jw);
 
 		tr2_dst_write_line(&tr2dst_event, &jw.json);
@@ -559,6 +579,46 @@ static void fn_data_json_fl(const char *file, int line,
 	}
 }
 
+static void fn_timer(const struct tr2_timer_metadata *meta,
+		     const struct tr2_timer *timer, int is_final_data)
+{
+	const char *event_name = is_final_data ? "timer" : "th_timer";
+	struct json_writer jw = JSON_WRITER_INIT;
+	double t_total = (double)timer->total_ns / 1000000000.0;
+	double t_min = (double)timer->min_ns / 1000000000.0;
+	double t_max = (double)timer->max_ns / 1000000000.0;
+
+	jw_object_begin(&jw, 0);
+	event_fmt_prepare(event_name, __FILE__, __LINE__, NULL, &jw);
+	jw_object_string(&jw, "category", meta->category);
+	jw_object_string(&jw, "name", meta->name);
+	jw_object_intmax(&jw, "intervals", timer->interval_count);
+	jw_object_double(&jw, "t_total", 6, t_total);
+	jw_object_double(&jw, "t_min", 6, t_min);
+	jw_object_double(&jw, "t_max", 6, t_max);
+	jw_end(&jw);
+
+	tr2_dst_write_line(&tr2dst_event, &jw.json);
+	jw_release(&jw);
+}
+
+static void fn_counter(const struct tr2_counter_metadata *meta,
+		       const struct tr2_counter *counter, int is_final_data)
+{
+	const char *event_name = is_final_data ? "counter" : "th_counter";
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	event_fmt_prepare(event_name, __FILE__, __LINE__, NULL, &jw);
+	jw_object_string(&jw, "category", meta->category);
+	jw_object_string(&jw, "name", meta->name);
+	jw_object_intmax(&jw, "count", counter->value);
+	jw_end(&jw);
+
+	tr2_dst_write_line(&tr2dst_event, &jw.json);
+	jw_release(&jw);
+}
+
 struct tr2_tgt tr2_tgt_event = {
 	&tr2dst_event,
 
@@ -588,4 +648,6 @@ struct tr2_tgt tr2_tgt_event = {
 	fn_data_fl,
 	fn_data_json_fl,
 	NULL, /* printf */
+	fn_timer,
+	fn_counter,
 };
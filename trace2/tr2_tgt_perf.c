@@ -4,12 +4,15 @@
 #include "quote.h"
 #include "version.h"
 #include "json-writer.h"
+#include "trace2/tr2_ctr.h"
 #include "trace2/tr2_dst.h"
+#include "trace2/tr2_mem.h"
 #include "trace2/tr2_sid.h"
 #include "trace2/tr2_sysenv.h"
 #include "trace2/tr2_tbuf.h"
 #include "trace2/tr2_tgt.h"
 #include "trace2/tr2_tls.h"
+#include "trace2/tr2_tmr.h"
 
 static struct tr2_dst tr2dst_perf = { TR2_SYSENV_PERF, 0, 0, 0 };
 
@@ -147,6 +150,17 @@ static void perf_io_write_fl(const char *file, int line, const char *event_name,
 	strbuf_release(&buf_line);
 }
 
+static void maybe_append_mem(struct strbuf *buf, const struct tr2_mem *mem)
+{
+	if (!trace2_alloc_accounting)
+		return;
+
+	if (buf->len && buf->buf[buf->len - 1] != ' ')
+		strbuf_addch(buf, ' ');
+	strbuf_addf(buf, "alloc:%"PRIu64" allocs:%"PRIu64" peak_rss_kb:%"PRIuMAX,
+		    mem->bytes, mem->count, tr2_mem_peak_rss_kb());
+}
+
 static void fn_version_fl(const char *file, int line)
 {
 	const char *event_name = "version";
@@ -179,6 +193,12 @@ static void fn_exit_fl(const char *file, int line, uint64_t us_elapsed_absolute,
 	struct strbuf buf_payload = STRBUF_INIT;
 
 	strbuf_addf(&buf_payload, "code:%d", code);
+	if (trace2_alloc_accounting) {
+		struct tr2_mem totals;
+
+		tr2_mem_get_totals(&totals);
+		maybe_append_mem(&buf_payload, &totals);
+	}
 
 	perf_io_write_fl(file, line, event_name, NULL, &us_elapsed_absolute,
 			 NULL, NULL, &buf_payload);
@@ -452,6 +472,7 @@ static void fn_region_leave_printf_va_fl(
 	if (label)
 		strbuf_addf(&buf_payload, "label:%s ", label);
 	maybe_append_string_va(&buf_payload, fmt, ap);
+	maybe_append_mem(&buf_payload, &tr2tls_get_self()->last_region_mem);
 
 	perf_io_write_fl(file, line, event_name, repo, &us_elapsed_absolute,
 			 &us_elapsed_region, category, &buf_payload);
@@ -503,6 +524,38 @@ static void fn_printf_va_fl(const char *file, int line,
 	strbuf_release(&buf_payload);
 }
 
+static void fn_timer(const struct tr2_timer_metadata *meta,
+		     const struct tr2_timer *timer, int is_final_data)
+{
+	const char *event_name = is_final_data ? "timer" : "th_timer";
+	struct strbuf buf_payload = STRBUF_INIT;
+	double t_total = (double)timer->total_ns / 1000000000.0;
+	double t_min = (double)timer->min_ns / 1000000000.0;
+	double t_max = (double)timer->max_ns / 1000000000.0;
+
+	strbuf_addf(&buf_payload,
+		    "name:%s intervals:%"PRIu64" total:%8.6f min:%8.6f max:%8.6f",
+		    meta->name, timer->interval_count, t_total, t_min, t_max);
+
+	perf_io_write_fl(__FILE__, __LINE__, event_name, NULL, NULL, NULL,
+			 meta->category, &buf_payload);
+	strbuf_release(&buf_payload);
+}
+
+static void fn_counter(const struct tr2_counter_metadata *meta,
+		       const struct tr2_counter *counter, int is_final_data)
+{
+	const char *event_name = is_final_data ? "counter" : "th_counter";
+	struct strbuf buf_payload = STRBUF_INIT;
+
+	strbuf_addf(&buf_payload, "name:%s value:%"PRIu64, meta->name,
+		    counter->value);
+
+	perf_io_write_fl(__FILE__, __LINE__, event_name, NULL, NULL, NULL,
+			 meta->category, &buf_payload);
+	strbuf_release(&buf_payload);
+}
+
 struct tr2_tgt tr2_tgt_perf = {
 	&tr2dst_perf,
 
@@ -532,4 +585,6 @@ struct tr2_tgt tr2_tgt_perf = {
 	fn_data_fl,
 	fn_data_json_fl,
 	fn_printf_va_fl,
+	fn_timer,
+	fn_counter,
 };
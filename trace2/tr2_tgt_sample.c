@@ -0,0 +1,203 @@
+#include "cache.h"
+#include "config.h"
+#include "string-list.h"
+#include "thread-utils.h"
+#include "trace2/tr2_cmd_name.h"
+#include "trace2/tr2_dst.h"
+#include "trace2/tr2_sysenv.h"
+#include "trace2/tr2_tgt.h"
+#include "trace2/tr2_tls.h"
+
+static struct tr2_dst tr2dst_sample = { TR2_SYSENV_SAMPLE, 0, 0, 0 };
+
+/*
+ * The SAMPLE target does not write an event per API call.  A thread
+ * looks at the stack of open regions of every thread every
+ * TR2_SYSENV_SAMPLE_INTERVAL milliseconds, and at exit we write one
+ * line per distinct stack with the number of times it was seen:
+ *
+ *     <command>;<thread>;<category>:<label>;... <count>
+ *
+ * which is the "folded" input of the usual flame graph scripts.
+ * Samples are taken on the wall clock, so a thread waiting for the
+ * network or the disk is counted as well as one using the CPU.
+ */
+#define TR2_SAMPLE_DEFAULT_INTERVAL_MS (10)
+#define TR2_SAMPLE_MAX_INTERVAL_MS (1000)
+
+static int tr2env_sample_interval_ms = TR2_SAMPLE_DEFAULT_INTERVAL_MS;
+
+static pthread_t sampler_thread;
+static int sampler_running;
+static int sampler_stop; /* modify under the TLS lock */
+
+/* "<thread>;<region>;..." -> count in ->util; only used by the sampler */
+static struct string_list sampled_stacks = STRING_LIST_INIT_DUP;
+
+static int fn_init(void)
+{
+	int want;
+	int interval;
+	const char *value;
+
+	if (!HAVE_THREADS)
+		return 0;
+
+	want = tr2_dst_trace_want(&tr2dst_sample);
+	if (!want)
+		return want;
+
+	value = tr2_sysenv_get(TR2_SYSENV_SAMPLE_INTERVAL);
+	if (value && *value && ((interval = atoi(value)) > 0))
+		tr2env_sample_interval_ms =
+			interval < TR2_SAMPLE_MAX_INTERVAL_MS ?
+			interval : TR2_SAMPLE_MAX_INTERVAL_MS;
+
+	tr2tls_record_region_labels();
+
+	return want;
+}
+
+static void fn_term(void)
+{
+	tr2_dst_trace_disable(&tr2dst_sample);
+
+	string_list_clear(&sampled_stacks, 0);
+}
+
+/*
+ * Drop the "thNN:" prefix from the name of a thread, so that the
+ * samples of all threads running the same code are added up.
+ */
+static const char *thread_base_name(const char *name)
+{
+	const char *p;
+
+	if (!skip_prefix(name, "th", &p) || !isdigit(*p))
+		return name;
+	while (isdigit(*p))
+		p++;
+	return *p == ':' ? p + 1 : name;
+}
+
+static void sample_one_stack(const char *thread_name, char **labels, int nr,
+			     void *data)
+{
+	struct strbuf *buf = data;
+	struct string_list_item *item;
+	int k;
+
+	strbuf_reset(buf);
+	strbuf_addstr(buf, thread_base_name(thread_name));
+	for (k = 1; k < nr; k++) {
+		strbuf_addch(buf, ';');
+		strbuf_addstr(buf, labels[k] ? labels[k] : "?");
+	}
+
+	item = string_list_insert(&sampled_stacks, buf->buf);
+	item->util = (void *)((uintptr_t)item->util + 1);
+}
+
+static void *sampler_proc(void *unused)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int stop;
+
+	for (;;) {
+		sleep_millisec(tr2env_sample_interval_ms);
+
+		tr2tls_lock();
+		stop = sampler_stop;
+		tr2tls_unlock();
+		if (stop)
+			break;
+
+		tr2tls_for_each_region_stack(sample_one_stack, &buf);
+	}
+
+	strbuf_release(&buf);
+	return NULL;
+}
+
+/*
+ * The "version" event is the first one, sent once the TLS machinery
+ * that the sampler reads is set up.
+ */
+static void fn_version_fl(const char *file, int line)
+{
+	if (sampler_running)
+		return;
+
+	if (pthread_create(&sampler_thread, NULL, sampler_proc, NULL)) {
+		tr2_dst_trace_disable(&tr2dst_sample);
+		return;
+	}
+	sampler_running = 1;
+}
+
+static void stop_sampler(void)
+{
+	if (!sampler_running)
+		return;
+
+	tr2tls_lock();
+	sampler_stop = 1;
+	tr2tls_unlock();
+
+	pthread_join(sampler_thread, NULL);
+	sampler_running = 0;
+}
+
+static void fn_atexit(uint64_t us_elapsed_absolute, int code)
+{
+	struct strbuf buf_line = STRBUF_INIT;
+	const char *command = tr2_cmd_name_get_hierarchy();
+	struct string_list_item *item;
+
+	stop_sampler();
+
+	if (!command || !*command)
+		command = "git";
+
+	for_each_string_list_item (item, &sampled_stacks) {
+		strbuf_reset(&buf_line);
+		strbuf_addf(&buf_line, "%s;%s %"PRIuMAX, command,
+			    item->string, (uintmax_t)(uintptr_t)item->util);
+		tr2_dst_write_line(&tr2dst_sample, &buf_line);
+	}
+
+	strbuf_release(&buf_line);
+}
+
+struct tr2_tgt tr2_tgt_sample = {
+	&tr2dst_sample,
+
+	fn_init,
+	fn_term,
+
+	fn_version_fl,
+	NULL, /* start */
+	NULL, /* exit */
+	NULL, /* signal */
+	fn_atexit,
+	NULL, /* error */
+	NULL, /* command_path */
+	NULL, /* command_name */
+	NULL, /* command_mode */
+	NULL, /* alias */
+	NULL, /* child_start */
+	NULL, /* child_exit */
+	NULL, /* thread_start */
+	NULL, /* thread_exit */
+	NULL, /* exec */
+	NULL, /* exec_result */
+	NULL, /* param */
+	NULL, /* repo */
+	NULL, /* region_enter */
+	NULL, /* region_leave */
+	NULL, /* data */
+	NULL, /* data_json */
+	NULL, /* printf */
+	NULL, /* timer */
+	NULL, /* counter */
+};
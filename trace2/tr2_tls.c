@@ -17,6 +17,10 @@ static pthread_key_t tr2tls_key;
 
 static int tr2_next_thread_id; /* modify under lock */
 
+static int tr2tls_want_labels;
+static int tr2tls_want_mem;
+static struct tr2tls_thread_ctx *tr2tls_live_threads; /* modify under lock */
+
 void tr2tls_start_process_clock(void)
 {
 	if (tr2tls_us_start_process)
@@ -45,6 +49,16 @@ struct tr2tls_thread_ctx *tr2tls_create_self(const char *thread_name,
 	ctx->array_us_start = (uint64_t *)xcalloc(ctx->alloc, sizeof(uint64_t));
 	ctx->array_us_start[ctx->nr_open_regions++] = us_thread_start;
 
+	if (tr2tls_want_labels) {
+		ctx->labels_alloc = TR2_REGION_NESTING_INITIAL_SIZE;
+		CALLOC_ARRAY(ctx->array_labels, ctx->labels_alloc);
+	}
+
+	if (tr2tls_want_mem) {
+		ctx->mem_alloc = TR2_REGION_NESTING_INITIAL_SIZE;
+		CALLOC_ARRAY(ctx->array_mem_start, ctx->mem_alloc);
+	}
+
 	ctx->thread_id = tr2tls_locked_increment(&tr2_next_thread_id);
 
 	strbuf_init(&ctx->thread_name, 0);
@@ -56,6 +70,11 @@ struct tr2tls_thread_ctx *tr2tls_create_self(const char *thread_name,
 
 	pthread_setspecific(tr2tls_key, ctx);
 
+	pthread_mutex_lock(&tr2tls_mutex);
+	ctx->next_live = tr2tls_live_threads;
+	tr2tls_live_threads = ctx;
+	pthread_mutex_unlock(&tr2tls_mutex);
+
 	return ctx;
 }
 
@@ -79,6 +98,14 @@ struct tr2tls_thread_ctx *tr2tls_get_self(void)
 	return ctx;
 }
 
+struct tr2tls_thread_ctx *tr2tls_peek_self(void)
+{
+	if (!HAVE_THREADS)
+		return tr2tls_thread_main;
+
+	return pthread_getspecific(tr2tls_key);
+}
+
 int tr2tls_is_main_thread(void)
 {
 	if (!HAVE_THREADS)
@@ -90,21 +117,61 @@ int tr2tls_is_main_thread(void)
 void tr2tls_unset_self(void)
 {
 	struct tr2tls_thread_ctx *ctx;
+	struct tr2tls_thread_ctx **pp;
+	int k;
 
 	ctx = tr2tls_get_self();
 
 	pthread_setspecific(tr2tls_key, NULL);
 
+	pthread_mutex_lock(&tr2tls_mutex);
+	for (pp = &tr2tls_live_threads; *pp; pp = &(*pp)->next_live)
+		if (*pp == ctx) {
+			*pp = ctx->next_live;
+			break;
+		}
+	pthread_mutex_unlock(&tr2tls_mutex);
+
+	if (ctx->array_labels)
+		for (k = 0; k < ctx->nr_open_regions; k++)
+			free(ctx->array_labels[k]);
+	free(ctx->array_labels);
+	free(ctx->array_mem_start);
 	free(ctx->array_us_start);
 	free(ctx);
 }
 
-void tr2tls_push_self(uint64_t us_now)
+void tr2tls_push_self(uint64_t us_now, const char *category,
+		      const char *label)
 {
 	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	char *name;
 
 	ALLOC_GROW(ctx->array_us_start, ctx->nr_open_regions + 1, ctx->alloc);
-	ctx->array_us_start[ctx->nr_open_regions++] = us_now;
+	ctx->array_us_start[ctx->nr_open_regions] = us_now;
+
+	if (ctx->array_mem_start) {
+		ALLOC_GROW(ctx->array_mem_start, ctx->nr_open_regions + 1,
+			   ctx->mem_alloc);
+		/* after ALLOC_GROW, which may have allocated */
+		ctx->array_mem_start[ctx->nr_open_regions] = ctx->mem;
+	}
+
+	if (!ctx->array_labels) {
+		ctx->nr_open_regions++;
+		return;
+	}
+
+	if (category && *category)
+		name = xstrfmt("%s:%s", category, label ? label : "");
+	else
+		name = xstrdup(label && *label ? label : "?");
+
+	pthread_mutex_lock(&tr2tls_mutex);
+	ALLOC_GROW(ctx->array_labels, ctx->nr_open_regions + 1,
+		   ctx->labels_alloc);
+	ctx->array_labels[ctx->nr_open_regions++] = name;
+	pthread_mutex_unlock(&tr2tls_mutex);
 }
 
 void tr2tls_pop_self(void)
@@ -114,7 +181,23 @@ void tr2tls_pop_self(void)
 	if (!ctx->nr_open_regions)
 		BUG("no open regions in thread '%s'", ctx->thread_name.buf);
 
+	if (ctx->array_mem_start) {
+		struct tr2_mem *start =
+			&ctx->array_mem_start[ctx->nr_open_regions - 1];
+
+		ctx->last_region_mem.bytes = ctx->mem.bytes - start->bytes;
+		ctx->last_region_mem.count = ctx->mem.count - start->count;
+	}
+
+	if (!ctx->array_labels) {
+		ctx->nr_open_regions--;
+		return;
+	}
+
+	pthread_mutex_lock(&tr2tls_mutex);
 	ctx->nr_open_regions--;
+	FREE_AND_NULL(ctx->array_labels[ctx->nr_open_regions]);
+	pthread_mutex_unlock(&tr2tls_mutex);
 }
 
 void tr2tls_pop_unwind_self(void)
@@ -167,6 +250,38 @@ void tr2tls_release(void)
 	pthread_key_delete(tr2tls_key);
 }
 
+void tr2tls_record_region_labels(void)
+{
+	tr2tls_want_labels = 1;
+}
+
+void tr2tls_record_region_memory(void)
+{
+	tr2tls_want_mem = 1;
+}
+
+void tr2tls_for_each_region_stack(tr2tls_region_stack_fn *fn, void *data)
+{
+	struct tr2tls_thread_ctx *ctx;
+
+	pthread_mutex_lock(&tr2tls_mutex);
+	for (ctx = tr2tls_live_threads; ctx; ctx = ctx->next_live)
+		if (ctx->array_labels)
+			fn(ctx->thread_name.buf, ctx->array_labels,
+			   ctx->nr_open_regions, data);
+	pthread_mutex_unlock(&tr2tls_mutex);
+}
+
+void tr2tls_lock(void)
+{
+	pthread_mutex_lock(&tr2tls_mutex);
+}
+
+void tr2tls_unlock(void)
+{
+	pthread_mutex_unlock(&tr2tls_mutex);
+}
+
 int tr2tls_locked_increment(int *p)
 {
 	int current_value;
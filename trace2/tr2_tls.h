@@ -2,6 +2,9 @@
 #define TR2_TLS_H
 
 #include "strbuf.h"
+#include "trace2/tr2_ctr.h"
+#include "trace2/tr2_mem.h"
+#include "trace2/tr2_tmr.h"
 
 /*
  * Arbitry limit for thread names for column alignment.
@@ -14,6 +17,33 @@ struct tr2tls_thread_ctx {
 	int alloc;
 	int nr_open_regions; /* plays role of "nr" in ALLOC_GROW */
 	int thread_id;
+
+	/*
+	 * "<category>:<label>" of each open region, only kept when
+	 * tr2tls_record_region_labels() was called.  The sampler reads
+	 * them from another thread, so they are changed under the TLS
+	 * lock.  Entry 0 (the thread itself) is NULL.
+	 */
+	char **array_labels;
+	int labels_alloc;
+
+	/*
+	 * Allocations made by this thread, and their value when each
+	 * open region started, only kept when
+	 * tr2tls_record_region_memory() was called.  "last_region_mem"
+	 * is what the innermost region used, set when it is popped.
+	 */
+	struct tr2_mem mem;
+	struct tr2_mem *array_mem_start;
+	int mem_alloc;
+	struct tr2_mem last_region_mem;
+
+	/* list of all live threads, under the TLS lock */
+	struct tr2tls_thread_ctx *next_live;
+
+	/* accumulated without a lock; see tr2_tmr.c and tr2_ctr.c */
+	struct tr2_timer_block timer_block;
+	struct tr2_counter_block counter_block;
 };
 
 /*
@@ -39,6 +69,11 @@ struct tr2tls_thread_ctx *tr2tls_create_self(const char *thread_name,
  */
 struct tr2tls_thread_ctx *tr2tls_get_self(void);
 
+/*
+ * Get our TLS data, or NULL if this thread has none yet.
+ */
+struct tr2tls_thread_ctx *tr2tls_peek_self(void);
+
 /*
  * return true if the current thread is the main thread.
  */
@@ -50,9 +85,11 @@ int tr2tls_is_main_thread(void);
 void tr2tls_unset_self(void);
 
 /*
- * Begin a new nested region and remember the start time.
+ * Begin a new nested region and remember the start time, and the
+ * category and label if we keep them.
  */
-void tr2tls_push_self(uint64_t us_now);
+void tr2tls_push_self(uint64_t us_now, const char *category,
+		      const char *label);
 
 /*
  * End the innermost nested region.
@@ -95,6 +132,35 @@ void tr2tls_release(void);
  */
 int tr2tls_locked_increment(int *p);
 
+/*
+ * Keep the category and label of each open region so that
+ * tr2tls_for_each_region_stack() can report them.  Must be called
+ * before tr2tls_init().
+ */
+void tr2tls_record_region_labels(void);
+
+/*
+ * Remember the allocation totals of the thread when each region
+ * starts, so that the allocations made in the region can be
+ * reported when it ends.  Must be called before tr2tls_init().
+ */
+void tr2tls_record_region_memory(void);
+
+/*
+ * Call "fn" with the name of each live thread and the labels of its
+ * open regions, outermost first.  Holds the TLS lock while doing so.
+ */
+typedef void(tr2tls_region_stack_fn)(const char *thread_name,
+				     char **labels, int nr, void *data);
+void tr2tls_for_each_region_stack(tr2tls_region_stack_fn *fn, void *data);
+
+/*
+ * Take or release the lock that protects data shared by all
+ * threads, such as the process totals of timers and counters.
+ */
+void tr2tls_lock(void);
+void tr2tls_unlock(void);
+
 /*
  * Capture the process start time and do nothing else.
  */
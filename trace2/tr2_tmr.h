@@ -0,0 +1,61 @@
+#ifndef TR2_TMR_H
+#define TR2_TMR_H
+
+#include "trace2.h"
+#include "trace2/tr2_tgt.h"
+
+/*
+ * Static description of a timer, from the table in tr2_tmr.c.
+ */
+struct tr2_timer_metadata {
+	const char *category;
+	const char *name;
+
+	/*
+	 * Also emit a "th_timer" event with the values of each thread
+	 * as it exits.
+	 */
+	unsigned int want_per_thread_events:1;
+};
+
+/*
+ * The accumulated value of a timer, either for one thread or for
+ * the whole process.
+ */
+struct tr2_timer {
+	uint64_t recent_start_ns;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t interval_count;
+	unsigned int recursion_count;
+};
+
+struct tr2_timer_block {
+	struct tr2_timer timer[TRACE2_NUMBER_OF_TIMERS];
+};
+
+/*
+ * Start or stop a timer on the current thread.
+ */
+void tr2_start_timer(enum trace2_timer_id tid);
+void tr2_stop_timer(enum trace2_timer_id tid);
+
+/*
+ * Add the timers of the current thread to the process totals.  The
+ * caller must hold the TLS lock.
+ */
+void tr2_update_final_timers(void);
+
+/*
+ * Call "fn" for each timer of the current thread that wants
+ * per-thread events and was used.
+ */
+void tr2_emit_per_thread_timers(tr2_tgt_evt_timer_t *fn);
+
+/*
+ * Call "fn" for each timer of the process that was used.
+ */
+void tr2_emit_final_timers(tr2_tgt_evt_timer_t *fn);
+
+#endif /* TR2_TMR_H */
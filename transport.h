@@ -98,7 +98,7 @@ struct transport {
 	 */
 	const struct string_list *server_options;
 
-	char *pack_lockfile;
+	struct string_list pack_lockfiles;
 	signed verbose : 3;
 	/**
 	 * Transports should not set this directly, and should use this
@@ -410,10 +410,12 @@ static struct combine_diff_path *ll_diff_tree_paths(
 {
 	struct tree_desc t, *tp;
 	void *ttree, **tptree;
+	unsigned long tsize, *tpsize;
 	int i;
 
 	FAST_ARRAY_ALLOC(tp, nparent);
 	FAST_ARRAY_ALLOC(tptree, nparent);
+	FAST_ARRAY_ALLOC(tpsize, nparent);
 
 	/*
 	 * load parents first, as they are probably already cached.
@@ -421,9 +423,27 @@ static struct combine_diff_path *ll_diff_tree_paths(
 	 * ( log_tree_diff() parses commit->parent before calling here via
 	 *   diff_tree_oid(parent, commit) )
 	 */
-	for (i = 0; i < nparent; ++i)
+	for (i = 0; i < nparent; ++i) {
 		tptree[i] = fill_tree_descriptor(opt->repo, &tp[i], parents_oid[i]);
+		tpsize[i] = tp[i].size;
+	}
 	ttree = fill_tree_descriptor(opt->repo, &t, oid);
+	tsize = t.size;
+
+	/*
+	 * In a partial clone, fetch the subtrees we are going to descend
+	 * into together, instead of one at a time below.
+	 */
+	if (repository_format_partial_clone && opt->flags.recursive &&
+	    !opt->pathspec.nr) {
+		struct tree_desc *all;
+
+		ALLOC_ARRAY(all, nparent + 1);
+		COPY_ARRAY(all, tp, nparent);
+		all[nparent] = t;
+		prefetch_subtrees(nparent + 1, all);
+		free(all);
+	}
 
 	/* Enable recursion indefinitely */
 	opt->pathspec.recursive = opt->flags.recursive;
@@ -538,9 +558,11 @@ static struct combine_diff_path *ll_diff_tree_paths(
 		}
 	}
 
-	free(ttree);
+	/* our tree is likely to be a parent in the next diff */
+	release_tree_descriptor_buffer(oid, ttree, tsize);
 	for (i = nparent-1; i >= 0; i--)
-		free(tptree[i]);
+		release_tree_descriptor_buffer(parents_oid[i], tptree[i], tpsize[i]);
+	FAST_ARRAY_FREE(tpsize, nparent);
 	FAST_ARRAY_FREE(tptree, nparent);
 	FAST_ARRAY_FREE(tp, nparent);
 
@@ -0,0 +1,236 @@
+#include "cache.h"
+#include "object-store.h"
+#include "tree-walk.h"
+#include "ll-merge.h"
+#include "blob.h"
+#include "tree.h"
+#include "tree-merge.h"
+
+struct merged_entry {
+	const char *name;
+	int namelen;
+	unsigned int mode;
+	struct object_id oid;
+};
+
+struct tree_merge {
+	struct repository *r;
+	struct strbuf *path;
+	struct merged_entry *entries;
+	int nr, alloc;
+	int status;
+};
+
+static int merge_tree_level(struct repository *r, struct strbuf *path,
+			    const struct object_id *base,
+			    const struct object_id *ours,
+			    const struct object_id *theirs,
+			    struct object_id *result);
+
+static int same_entry(const struct name_entry *a, const struct name_entry *b)
+{
+	if (!a->path || !b->path)
+		return !a->path && !b->path;
+	return a->mode == b->mode && oideq(&a->oid, &b->oid);
+}
+
+static void add_entry(struct tree_merge *tm, const struct name_entry *e,
+		      unsigned int mode, const struct object_id *oid)
+{
+	struct merged_entry *me;
+
+	ALLOC_GROW(tm->entries, tm->nr + 1, tm->alloc);
+	me = &tm->entries[tm->nr++];
+	me->name = e->path;
+	me->namelen = tree_entry_len(e);
+	me->mode = mode;
+	oidcpy(&me->oid, oid);
+}
+
+static int read_mmfile(struct repository *r, const struct object_id *oid,
+		       mmfile_t *f)
+{
+	enum object_type type;
+	unsigned long size;
+
+	f->ptr = repo_read_object_file(r, oid, &type, &size);
+	if (!f->ptr)
+		return error(_("unable to read %s"), oid_to_hex(oid));
+	if (type != OBJ_BLOB) {
+		FREE_AND_NULL(f->ptr);
+		return error(_("object %s is not a blob"), oid_to_hex(oid));
+	}
+	f->size = size;
+	return 0;
+}
+
+/*
+ * Merge the contents of a regular file changed on both sides.
+ * Returns 0 when the result is clean, 1 on conflicts, -1 on error.
+ */
+static int merge_file(struct tree_merge *tm, const char *path,
+		      const struct name_entry *entry, unsigned int *mode,
+		      struct object_id *oid)
+{
+	const struct name_entry *base = entry, *ours = entry + 1,
+		*theirs = entry + 2;
+	mmfile_t mmfile[3] = { { NULL } };
+	mmbuffer_t result = { NULL };
+	int i, ret;
+
+	if (ours->mode == theirs->mode || base->mode == theirs->mode)
+		*mode = ours->mode;
+	else if (base->mode == ours->mode)
+		*mode = theirs->mode;
+	else
+		return 1;
+
+	for (i = 0; i < 3; i++)
+		if (read_mmfile(tm->r, &entry[i].oid, &mmfile[i])) {
+			ret = -1;
+			goto out;
+		}
+
+	ret = ll_merge(&result, path, &mmfile[0], NULL,
+		       &mmfile[1], "ours", &mmfile[2], "theirs",
+		       tm->r->index, NULL);
+	if (ret > 0)
+		ret = 1;
+	else if (!ret && write_object_file(result.ptr, result.size,
+					   blob_type, oid))
+		ret = error(_("unable to write merged blob for '%s'"), path);
+
+out:
+	for (i = 0; i < 3; i++)
+		free(mmfile[i].ptr);
+	free(result.ptr);
+	return ret;
+}
+
+static int merge_entry(int n, unsigned long mask, unsigned long dirmask,
+		       struct name_entry *entry, struct traverse_info *info)
+{
+	struct tree_merge *tm = info->data;
+	struct name_entry *base = entry, *ours = entry + 1, *theirs = entry + 2;
+	struct object_id oid;
+	unsigned int mode;
+	size_t baselen = tm->path->len;
+	int ret;
+
+	if (same_entry(ours, theirs) || same_entry(base, theirs)) {
+		if (ours->path)
+			add_entry(tm, ours, ours->mode, &ours->oid);
+		return mask;
+	}
+	if (same_entry(base, ours)) {
+		if (theirs->path)
+			add_entry(tm, theirs, theirs->mode, &theirs->oid);
+		return mask;
+	}
+
+	/* changed on both sides */
+	strbuf_add(tm->path, ours->path ? ours->path : base->path,
+		   ours->path ? tree_entry_len(ours) : tree_entry_len(base));
+	if (mask == 7 && dirmask == 7) {
+		strbuf_addch(tm->path, '/');
+		ret = merge_tree_level(tm->r, tm->path, &base->oid,
+				       &ours->oid, &theirs->oid, &oid);
+		mode = S_IFDIR;
+	} else if (mask == 7 && !dirmask &&
+		   S_ISREG(base->mode) && S_ISREG(ours->mode) &&
+		   S_ISREG(theirs->mode)) {
+		ret = merge_file(tm, tm->path->buf, entry, &mode, &oid);
+	} else {
+		ret = 1;
+	}
+	strbuf_setlen(tm->path, baselen);
+
+	if (ret) {
+		tm->status = ret;
+		return -1;
+	}
+	add_entry(tm, ours, mode, &oid);
+	return mask;
+}
+
+static int entry_cmp(const void *a_, const void *b_)
+{
+	const struct merged_entry *a = a_, *b = b_;
+
+	return base_name_compare(a->name, a->namelen, a->mode,
+				 b->name, b->namelen, b->mode);
+}
+
+static int write_merged_tree(struct tree_merge *tm, struct object_id *result)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int i, ret;
+
+	QSORT(tm->entries, tm->nr, entry_cmp);
+	for (i = 0; i < tm->nr; i++) {
+		struct merged_entry *me = &tm->entries[i];
+
+		strbuf_addf(&buf, "%o %.*s%c", me->mode,
+			    me->namelen, me->name, '\0');
+		strbuf_add(&buf, me->oid.hash, the_hash_algo->rawsz);
+	}
+	ret = write_object_file(buf.buf, buf.len, tree_type, result);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int merge_tree_level(struct repository *r, struct strbuf *path,
+			    const struct object_id *base,
+			    const struct object_id *ours,
+			    const struct object_id *theirs,
+			    struct object_id *result)
+{
+	const struct object_id *oids[3] = { base, ours, theirs };
+	struct tree_desc t[3];
+	void *buf[3];
+	unsigned long size[3];
+	struct traverse_info info;
+	struct tree_merge tm = { r, path };
+	int i;
+
+	if (oideq(ours, theirs) || oideq(base, theirs)) {
+		oidcpy(result, ours);
+		return 0;
+	}
+	if (oideq(base, ours)) {
+		oidcpy(result, theirs);
+		return 0;
+	}
+
+	for (i = 0; i < 3; i++) {
+		buf[i] = fill_tree_descriptor(r, &t[i], oids[i]);
+		size[i] = t[i].size;
+	}
+
+	setup_traverse_info(&info, "");
+	info.fn = merge_entry;
+	info.data = &tm;
+	if (traverse_trees(r->index, 3, t, &info) < 0 && !tm.status)
+		tm.status = -1;
+	if (!tm.status && write_merged_tree(&tm, result))
+		tm.status = error(_("unable to write merged tree"));
+
+	for (i = 0; i < 3; i++)
+		release_tree_descriptor_buffer(oids[i], buf[i], size[i]);
+	free(tm.entries);
+	return tm.status;
+}
+
+int merge_trees_in_object_store(struct repository *r,
+				const struct object_id *base,
+				const struct object_id *ours,
+				const struct object_id *theirs,
+				struct object_id *result)
+{
+	struct strbuf path = STRBUF_INIT;
+	int ret;
+
+	ret = merge_tree_level(r, &path, base, ours, theirs, result);
+	strbuf_release(&path);
+	return ret;
+}
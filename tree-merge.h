@@ -0,0 +1,27 @@
+#ifndef TREE_MERGE_H
+#define TREE_MERGE_H
+
+struct object_id;
+struct repository;
+
+/*
+ * Three-way merge of the trees "ours" and "theirs" with the common
+ * ancestor "base", done entirely in the object store: neither the
+ * index nor the working tree is looked at or touched.
+ *
+ * A path takes the side that changed it; paths changed on both sides
+ * are merged only when they are regular files whose contents merge
+ * cleanly.  Anything else (conflicts, a path deleted on one side and
+ * modified on the other, directory/file clashes, submodules, ...)
+ * needs a real merge with rename detection and is left to the caller.
+ *
+ * Returns 0 and stores the merged tree in "result" when every path
+ * merged cleanly, 1 when a real merge is needed, and -1 on error.
+ */
+int merge_trees_in_object_store(struct repository *r,
+				const struct object_id *base,
+				const struct object_id *ours,
+				const struct object_id *theirs,
+				struct object_id *result);
+
+#endif /* TREE_MERGE_H */
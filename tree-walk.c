@@ -5,6 +5,11 @@
 #include "object-store.h"
 #include "tree.h"
 #include "pathspec.h"
+#include "hashmap.h"
+#include "list.h"
+#include "oidset.h"
+#include "sha1-array.h"
+#include "fetch-object.h"
 
 static const char *get_mode(const char *str, unsigned int *modep)
 {
@@ -81,6 +86,112 @@ int init_tree_desc_gently(struct tree_desc *desc, const void *buffer, unsigned l
 	return result;
 }
 
+/*
+ * The trees handed back by release_tree_descriptor_buffer() are kept,
+ * least recently used first, up to core.treeCacheLimit bytes, for
+ * fill_tree_descriptor() to take instead of reading them again. Walking
+ * history diffs each commit against its parent, and then that parent
+ * against its own, so most trees are read twice in a row, and inflating
+ * them (and applying their deltas) is most of the work of a tree diff.
+ *
+ * Objects are named by their contents, so the cache is shared by all
+ * repositories. The object read lock protects it.
+ */
+struct tree_buffer_entry {
+	struct hashmap_entry ent;
+	struct list_head lru;
+	struct object_id oid;
+	unsigned long size;
+	void *buf;
+};
+
+static struct hashmap tree_buffer_cache;
+static LIST_HEAD(tree_buffer_lru);
+static size_t tree_buffer_cached;
+
+static int tree_buffer_entry_cmp(const void *unused_cmp_data,
+				 const void *entry,
+				 const void *entry_or_key,
+				 const void *keydata)
+{
+	const struct tree_buffer_entry *a = entry;
+	const struct tree_buffer_entry *b = entry_or_key;
+
+	return !oideq(&a->oid, keydata ? keydata : &b->oid);
+}
+
+static struct tree_buffer_entry *get_tree_buffer_entry(const struct object_id *oid)
+{
+	struct hashmap_entry key;
+
+	if (!tree_buffer_cache.cmpfn)
+		return NULL;
+	hashmap_entry_init(&key, oidhash(oid));
+	return hashmap_get(&tree_buffer_cache, &key, oid);
+}
+
+static void remove_tree_buffer_entry(struct tree_buffer_entry *ent)
+{
+	list_del(&ent->lru);
+	hashmap_remove(&tree_buffer_cache, ent, &ent->oid);
+	tree_buffer_cached -= ent->size;
+	free(ent);
+}
+
+static void *get_cached_tree_buffer(const struct object_id *oid,
+				    unsigned long *size)
+{
+	struct tree_buffer_entry *ent;
+	void *buf = NULL;
+
+	obj_read_lock();
+	ent = get_tree_buffer_entry(oid);
+	if (ent) {
+		buf = ent->buf;
+		*size = ent->size;
+		remove_tree_buffer_entry(ent);
+	}
+	obj_read_unlock();
+	return buf;
+}
+
+void release_tree_descriptor_buffer(const struct object_id *oid,
+				    void *buf, unsigned long size)
+{
+	struct tree_buffer_entry *ent;
+
+	if (!oid || !tree_cache_limit || size > tree_cache_limit / 4) {
+		free(buf);
+		return;
+	}
+
+	obj_read_lock();
+	if (!tree_buffer_cache.cmpfn)
+		hashmap_init(&tree_buffer_cache, tree_buffer_entry_cmp, NULL, 0);
+	if (get_tree_buffer_entry(oid)) {
+		free(buf); /* another thread was first */
+		goto out;
+	}
+
+	while (tree_buffer_cached + size > tree_cache_limit) {
+		ent = list_first_entry(&tree_buffer_lru,
+				       struct tree_buffer_entry, lru);
+		free(ent->buf);
+		remove_tree_buffer_entry(ent);
+	}
+
+	ent = xmalloc(sizeof(*ent));
+	oidcpy(&ent->oid, oid);
+	ent->size = size;
+	ent->buf = buf;
+	hashmap_entry_init(ent, oidhash(oid));
+	hashmap_add(&tree_buffer_cache, ent);
+	list_add_tail(&ent->lru, &tree_buffer_lru);
+	tree_buffer_cached += size;
+out:
+	obj_read_unlock();
+}
+
 void *fill_tree_descriptor(struct repository *r,
 			   struct tree_desc *desc,
 			   const struct object_id *oid)
@@ -89,7 +200,10 @@ void *fill_tree_descriptor(struct repository *r,
 	void *buf = NULL;
 
 	if (oid) {
-		buf = read_object_with_reference(r, oid, tree_type, &size, NULL);
+		buf = get_cached_tree_buffer(oid, &size);
+		if (!buf)
+			buf = read_object_with_reference(r, oid, tree_type,
+							 &size, NULL);
 		if (!buf)
 			die("unable to read tree %s", oid_to_hex(oid));
 	}
@@ -97,6 +211,51 @@ void *fill_tree_descriptor(struct repository *r,
 	return buf;
 }
 
+static void collect_subtrees(struct tree_desc *t, struct oidset *set)
+{
+	struct tree_desc desc = *t;
+	struct name_entry entry;
+
+	while (tree_entry_gently(&desc, &entry))
+		if (S_ISDIR(entry.mode))
+			oidset_insert(set, &entry.oid);
+}
+
+void prefetch_subtrees(int n, struct tree_desc *t)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	struct oidset *subtrees;
+	int i, j;
+
+	if (!repository_format_partial_clone)
+		return;
+
+	ALLOC_ARRAY(subtrees, n);
+	for (i = 0; i < n; i++) {
+		oidset_init(&subtrees[i], 0);
+		collect_subtrees(&t[i], &subtrees[i]);
+	}
+	for (i = 0; i < n; i++) {
+		struct oidset_iter iter;
+		const struct object_id *oid;
+
+		oidset_iter_init(&subtrees[i], &iter);
+		while ((oid = oidset_iter_next(&iter))) {
+			for (j = 0; j < n; j++)
+				if (!oidset_contains(&subtrees[j], oid))
+					break;
+			if (n == 1 || j < n)
+				oid_array_append(&to_fetch, oid);
+		}
+	}
+	prefetch_objects(&to_fetch);
+
+	oid_array_clear(&to_fetch);
+	for (i = 0; i < n; i++)
+		oidset_clear(&subtrees[i]);
+	free(subtrees);
+}
+
 static void entry_clear(struct name_entry *a)
 {
 	memset(a, 0, sizeof(*a));
@@ -413,10 +572,12 @@ int traverse_trees(struct index_state *istate,
 	struct name_entry *entry = xmalloc(n*sizeof(*entry));
 	int i;
 	struct tree_desc_x *tx = xcalloc(n, sizeof(*tx));
-	struct strbuf base = STRBUF_INIT;
+	char base_buf[256];
+	struct strbuf base;
 	int interesting = 1;
 	char *traverse_path;
 
+	strbuf_init_stack(&base, base_buf, sizeof(base_buf));
 	for (i = 0; i < n; i++)
 		tx[i].d = t[i];
 
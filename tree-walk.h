@@ -49,6 +49,23 @@ void *fill_tree_descriptor(struct repository *r,
 			   struct tree_desc *desc,
 			   const struct object_id *oid);
 
+/*
+ * Free the buffer that fill_tree_descriptor() returned for `oid`, or
+ * keep it (bounded by core.treeCacheLimit) for the next call asking for
+ * the same tree. `size` is the size of the whole buffer.
+ */
+void release_tree_descriptor_buffer(const struct object_id *oid,
+				    void *buf, unsigned long size);
+
+/*
+ * In a partial clone, fetch the missing subtrees of the `n` trees in
+ * `t` in one batch, before the caller descends into them one by one.
+ * When several trees are given, only the subtrees that are not in all
+ * of them are fetched, as walkers usually skip the identical ones.
+ * Does nothing outside of partial clones.
+ */
+void prefetch_subtrees(int n, struct tree_desc *t);
+
 struct traverse_info;
 typedef int (*traverse_callback_t)(int n, unsigned long mask, unsigned long dirmask, struct name_entry *entry, struct traverse_info *);
 int traverse_trees(struct index_state *istate, int n, struct tree_desc *t, struct traverse_info *info);
@@ -121,3 +121,91 @@ int unix_stream_listen(const char *path)
 	errno = saved_errno;
 	return -1;
 }
+
+int unix_stream_send_fds(int fd, const int *fds, int nr)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte = 0;
+	char *control = xcalloc(1, CMSG_SPACE(sizeof(int) * nr));
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nr);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nr);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nr);
+
+	do {
+		ret = sendmsg(fd, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+	free(control);
+	return ret == 1 ? 0 : -1;
+}
+
+int unix_stream_recv_fds(int fd, int *fds, int nr)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte;
+	char *control = xcalloc(1, CMSG_SPACE(sizeof(int) * nr));
+	ssize_t ret;
+	int got = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nr);
+
+	do {
+		ret = recvmsg(fd, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret == 1 && !(msg.msg_flags & MSG_CTRUNC)) {
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET ||
+			    cmsg->cmsg_type != SCM_RIGHTS ||
+			    cmsg->cmsg_len != CMSG_LEN(sizeof(int) * nr))
+				continue;
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nr);
+			got = 0;
+		}
+	}
+	free(control);
+	return got;
+}
+
+int unix_stream_peer_uid(int fd, uid_t *uid)
+{
+#if defined(__linux__)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return -1;
+	*uid = cred.uid;
+	return 0;
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+	defined(__NetBSD__) || defined(__DragonFly__)
+	gid_t gid;
+
+	return getpeereid(fd, uid, &gid);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
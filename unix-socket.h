@@ -4,4 +4,19 @@
 int unix_stream_connect(const char *path);
 int unix_stream_listen(const char *path);
 
+/*
+ * Pass the "nr" file descriptors in "fds" to the other end of the
+ * connection "fd", along with a single byte of data, or receive them
+ * there. Both return 0 on success and -1 on failure.
+ */
+int unix_stream_send_fds(int fd, const int *fds, int nr);
+int unix_stream_recv_fds(int fd, int *fds, int nr);
+
+/*
+ * Find out the user id of the process at the other end of the
+ * connection "fd". Return 0 on success and -1 on failure, which
+ * includes platforms where we do not know how to ask.
+ */
+int unix_stream_peer_uid(int fd, uid_t *uid);
+
 #endif /* UNIX_SOCKET_H */
@@ -11,12 +11,15 @@
 #include "refs.h"
 #include "attr.h"
 #include "split-index.h"
+#include "sparse-index.h"
 #include "dir.h"
 #include "submodule.h"
 #include "submodule-config.h"
 #include "fsmonitor.h"
 #include "object-store.h"
 #include "fetch-object.h"
+#include "parallel-checkout.h"
+#include "thread-utils.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -62,6 +65,54 @@ static const char *unpack_plumbing_errors[NB_UNPACK_TREES_ERROR_TYPES] = {
 	  ? ((o)->msgs[(type)])      \
 	  : (unpack_plumbing_errors[(type)]) )
 
+/*
+ * With index.unpackThreads, the top-level directories of the trees are
+ * unpacked by a pool of threads; see traverse_trees_parallel(). Each
+ * job works on its own copy of the options, with its own result index
+ * and a view of the part of the source index below its directory.
+ */
+struct unpack_trees_job {
+	struct unpack_trees_options o;
+	struct index_state src;
+	struct traverse_info info;
+	struct name_entry names[MAX_UNPACK_TREES];
+	unsigned long dirmask;
+	int n;
+	int start, nr;
+	struct strbuf dir;
+	int ret;
+};
+
+struct unpack_trees_parallel {
+	/* protects the object store and the shared source index */
+	pthread_mutex_t mutex;
+	/* the whole source index, the jobs only see a part of it */
+	struct index_state *src_index;
+	/* set while the top level is traversed and jobs are queued */
+	int collecting;
+	struct unpack_trees_job **jobs;
+	int nr, alloc;
+	int next;
+	int failed;
+};
+
+static inline void unpack_lock(struct unpack_trees_options *o)
+{
+	if (o->parallel)
+		pthread_mutex_lock(&o->parallel->mutex);
+}
+
+static inline void unpack_unlock(struct unpack_trees_options *o)
+{
+	if (o->parallel)
+		pthread_mutex_unlock(&o->parallel->mutex);
+}
+
+static inline struct index_state *full_src_index(struct unpack_trees_options *o)
+{
+	return o->parallel ? o->parallel->src_index : o->src_index;
+}
+
 static const char *super_prefixed(const char *path)
 {
 	/*
@@ -365,7 +416,7 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	trace_performance_enter();
 	state.force = 1;
@@ -400,6 +451,15 @@ static int check_updates(struct unpack_trees_options *o)
 		load_gitmodules_file(index, &state);
 
 	enable_delayed_checkout(&state);
+	for (i = 0; o->update && !o->dry_run && i < index->cache_nr; i++) {
+		if (index->cache[i]->ce_flags & CE_UPDATE) {
+			prestart_filter_processes();
+			break;
+		}
+	}
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	if (repository_format_partial_clone && o->update && !o->dry_run) {
 		/*
 		 * Prefetch the objects that are to be checked out in the loop
@@ -412,15 +472,9 @@ static int check_updates(struct unpack_trees_options *o)
 			if (!(ce->ce_flags & CE_UPDATE) ||
 			    S_ISGITLINK(ce->ce_mode))
 				continue;
-			if (!oid_object_info_extended(the_repository, &ce->oid,
-						      NULL,
-						      OBJECT_INFO_FOR_PREFETCH))
-				continue;
 			oid_array_append(&to_fetch, &ce->oid);
 		}
-		if (to_fetch.nr)
-			fetch_objects(repository_format_partial_clone,
-				      to_fetch.oid, to_fetch.nr);
+		prefetch_objects(&to_fetch);
 		oid_array_clear(&to_fetch);
 	}
 	for (i = 0; i < index->cache_nr; i++) {
@@ -437,6 +491,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state, NULL);
 	if (o->update)
@@ -840,9 +896,16 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 			const struct object_id *oid = NULL;
 			if (dirmask & 1)
 				oid = &names[i].oid;
+			unpack_lock(o);
 			buf[nr_buf++] = fill_tree_descriptor(the_repository, t + i, oid);
+			unpack_unlock(o);
 		}
 	}
+	if (!o->pathspec) {
+		unpack_lock(o);
+		prefetch_subtrees(n, t);
+		unpack_unlock(o);
+	}
 
 	bottom = switch_cache_bottom(&newinfo);
 	ret = traverse_trees(o->src_index, n, t, &newinfo);
@@ -1170,11 +1233,105 @@ static void debug_unpack_callback(int n,
 		debug_name_entry(i, names + i);
 }
 
+/*
+ * While the top level is traversed for traverse_trees_parallel(), queue
+ * a job for the directory being looked at, and mark the index entries
+ * below it as used, so that they are left to the job. Only directories
+ * that are a directory in all trees that have them, and that have no
+ * index entry of the same name, can be unpacked independently of the
+ * rest of the top level.
+ */
+static int queue_unpack_job(int n, unsigned long mask, unsigned long dirmask,
+			    struct cache_entry **src,
+			    const struct name_entry *names,
+			    const struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	struct unpack_trees_parallel *p = o->parallel;
+	struct index_state *index = o->src_index;
+	const struct name_entry *name = names;
+	struct unpack_trees_job *job;
+	int pos;
+
+	if (!p || !p->collecting || info->prev || mask != dirmask || src[0])
+		return 0;
+
+	while (!name->mode)
+		name++;
+	pos = index_name_pos(index, name->path, name->pathlen);
+	if (pos >= 0)
+		return 0;
+	pos = -pos - 1;
+	if (pos < index->cache_nr &&
+	    ce_namelen(index->cache[pos]) == name->pathlen &&
+	    !memcmp(index->cache[pos]->name, name->path, name->pathlen))
+		return 0; /* an unmerged entry */
+
+	job = xcalloc(1, sizeof(*job));
+	job->n = n;
+	job->dirmask = dirmask;
+	COPY_ARRAY(job->names, names, n);
+	job->info = *info;
+	/* valid only during the traversal of the top level */
+	job->info.traverse_path = NULL;
+	strbuf_init(&job->dir, name->pathlen + 1);
+	strbuf_add(&job->dir, name->path, name->pathlen);
+	strbuf_addch(&job->dir, '/');
+
+	pos = index_name_pos(index, job->dir.buf, job->dir.len);
+	job->start = pos < 0 ? -pos - 1 : pos;
+	for (pos = job->start; pos < index->cache_nr; pos++) {
+		struct cache_entry *ce = index->cache[pos];
+
+		if (!starts_with(ce->name, job->dir.buf))
+			break;
+		mark_ce_used(ce, o);
+	}
+	job->nr = pos - job->start;
+
+	ALLOC_GROW(p->jobs, p->nr + 1, p->alloc);
+	p->jobs[p->nr++] = job;
+	return 1;
+}
+
 /*
  * Note that traverse_by_cache_tree() duplicates some logic in this function
  * without actually calling it. If you change the logic here you may need to
  * check and change there as well.
  */
+/*
+ * The index has the sparse directory entry "ce" where the tree has
+ * the directory "names": hand both to the unpack function as a whole
+ * instead of descending into the tree. Only "diff-index --cached"
+ * gets here; unpack_trees() expands the index for anything else.
+ */
+static int unpack_sparse_directory(struct cache_entry *ce,
+				   const struct name_entry *names,
+				   const struct traverse_info *info)
+{
+	struct cache_entry *src[2];
+	struct unpack_trees_options *o = info->data;
+	size_t len = traverse_path_len(info, tree_entry_len(names));
+	int ret;
+
+	src[0] = ce;
+	src[1] = make_empty_transient_cache_entry(len + 1);
+	src[1]->ce_mode = S_IFDIR;
+	src[1]->ce_namelen = len + 1;
+	oidcpy(&src[1]->oid, &names->oid);
+	make_traverse_path(src[1]->name, len + 1, info,
+			   names->path, names->pathlen);
+	src[1]->name[len] = '/';
+	src[1]->name[len + 1] = '\0';
+
+	ret = call_unpack_fn((const struct cache_entry * const *)src, o);
+	discard_cache_entry(src[1]);
+	if (ret < 0)
+		return -1;
+	mark_ce_used(ce, o);
+	return 1;
+}
+
 static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, struct name_entry *names, struct traverse_info *info)
 {
 	struct cache_entry *src[MAX_UNPACK_TREES + 1] = { NULL, };
@@ -1202,6 +1359,15 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 			if (!ce)
 				break;
 			cmp = compare_entry(ce, info, p);
+			if (cmp > 0 && o->diff_index_cached &&
+			    n == 1 && dirmask == 1 &&
+			    S_ISSPARSEDIR(ce->ce_mode) &&
+			    ce_namelen(ce) == traverse_path_len(info, tree_entry_len(p)) + 1 &&
+			    !do_compare_entry(ce, info, p->path, p->pathlen, p->mode)) {
+				if (unpack_sparse_directory(ce, names, info) < 0)
+					return -1;
+				return mask;
+			}
 			if (cmp < 0) {
 				if (unpack_index_entry(ce, o) < 0)
 					return unpack_failed(o, NULL);
@@ -1256,6 +1422,9 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 			}
 		}
 
+		if (queue_unpack_job(n, mask, dirmask, src, names, info))
+			return mask;
+
 		if (traverse_trees_recursive(n, dirmask, mask & ~dirmask,
 					     names, info) < 0)
 			return -1;
@@ -1298,16 +1467,27 @@ static int clear_ce_flags_dir(struct index_state *istate,
 	}
 
 	/*
-	 * TODO: check el, if there are no patterns that may conflict
-	 * with ret (iow, we know in advance the incl/excl
-	 * decision for the entire directory), clear flag here without
-	 * calling clear_ce_flags_1(). That function will call
-	 * the expensive is_excluded_from_list() on every entry.
+	 * In cone mode, we know in advance when the decision is the
+	 * same for the entire directory, and can avoid calling
+	 * is_excluded_from_list() on every entry in clear_ce_flags_1().
+	 * A directory that does not match cannot contain anything that
+	 * does, because all leading directories of the cone match.
 	 */
-	rc = clear_ce_flags_1(istate, cache, cache_end - cache,
-			      prefix,
-			      select_mask, clear_mask,
-			      el, ret);
+	if (el->use_cone_patterns && ret == EXC_MATCHED_RECURSIVE) {
+		struct cache_entry **ce;
+
+		for (ce = cache; ce != cache_end; ce++)
+			if (!select_mask || ((*ce)->ce_flags & select_mask))
+				(*ce)->ce_flags &= ~clear_mask;
+		rc = cache_end - cache;
+	} else if (el->use_cone_patterns && !ret) {
+		rc = cache_end - cache;
+	} else {
+		rc = clear_ce_flags_1(istate, cache, cache_end - cache,
+				      prefix,
+				      select_mask, clear_mask,
+				      el, ret);
+	}
 	strbuf_setlen(prefix, prefix->len - 1);
 	return rc;
 }
@@ -1447,6 +1627,314 @@ static void mark_new_skip_worktree(struct exclude_list *el,
 static int verify_absent(const struct cache_entry *,
 			 enum unpack_trees_error_types,
 			 struct unpack_trees_options *);
+
+static void setup_unpack_result(struct unpack_trees_options *o)
+{
+	memset(&o->result, 0, sizeof(o->result));
+	o->result.initialized = 1;
+	o->result.timestamp.sec = o->src_index->timestamp.sec;
+	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
+	o->result.version = o->src_index->version;
+	if (!o->src_index->split_index) {
+		o->result.split_index = NULL;
+	} else if (o->src_index == o->dst_index) {
+		/*
+		 * o->dst_index (and thus o->src_index) will be discarded
+		 * and overwritten with o->result at the end of unpack_trees(),
+		 * so just use src_index's split_index to avoid having to
+		 * create a new one.
+		 */
+		o->result.split_index = o->src_index->split_index;
+		o->result.split_index->refcount++;
+	} else {
+		o->result.split_index = init_split_index(&o->result);
+	}
+	oidcpy(&o->result.oid, &o->src_index->oid);
+}
+
+/*
+ * Mostly randomly chosen: we want to have at least this many index
+ * entries per thread for it to be worth starting a thread.
+ */
+#define UNPACK_THREAD_COST (2000)
+
+/*
+ * Return the number of threads to unpack the trees with, or 0 if they
+ * are to be unpacked without threads. Only the simple merges done by
+ * read-tree, reset and checkout are supported, and only when nothing
+ * else that is not thread-safe (pathspecs with attributes, the name
+ * hash of a case-insensitive file system, submodules) is involved.
+ */
+static int unpack_threads(struct unpack_trees_options *o)
+{
+	const char *env = getenv("GIT_TEST_UNPACK_THREADS");
+	int threads, is_bool;
+
+	if (!HAVE_THREADS)
+		return 0;
+
+	if (env && *env) {
+		if (strtol_i(env, 10, &threads))
+			die(_("invalid value for GIT_TEST_UNPACK_THREADS: '%s'"),
+			    env);
+		if (threads < 1)
+			threads = online_cpus();
+	} else {
+		if (git_config_get_bool_or_int("index.unpackthreads",
+					       &is_bool, &threads))
+			return 0;
+		if (is_bool)
+			threads = threads ? 0 : 1;
+		if (threads < 1)
+			threads = online_cpus();
+		if (threads > o->src_index->cache_nr / UNPACK_THREAD_COST)
+			threads = o->src_index->cache_nr / UNPACK_THREAD_COST;
+		if (threads < 2)
+			return 0;
+	}
+
+	if (!o->merge || o->prefix || o->diff_index_cached ||
+	    o->debug_unpack || !o->skip_sparse_checkout || o->pathspec ||
+	    (o->fn != oneway_merge && o->fn != twoway_merge) ||
+	    ignore_case || o->src_index->split_index ||
+	    should_update_submodules())
+		return 0;
+	return threads;
+}
+
+static void setup_unpack_job(struct unpack_trees_options *o,
+			     struct unpack_trees_job *job)
+{
+	struct index_state *index = o->src_index;
+	int i;
+
+	job->o = *o;
+	memset(job->o.unpack_rejects, 0, sizeof(job->o.unpack_rejects));
+	setup_unpack_result(&job->o);
+
+	job->src = *index;
+	job->src.cache = index->cache + job->start;
+	job->src.cache_nr = job->src.cache_alloc = job->nr;
+	job->src.cache_changed = 0;
+	/* lookups by name use the whole index, see full_src_index() */
+	job->src.name_hash_initialized = 0;
+	job->src.ce_mem_pool = NULL;
+	job->o.src_index = &job->src;
+	job->o.cache_bottom = 0;
+	job->info.data = &job->o;
+
+	/* marked by queue_unpack_job() */
+	for (i = 0; i < job->nr; i++)
+		job->src.cache[i]->ce_flags &= ~CE_UNPACKED;
+}
+
+static void run_unpack_job(struct unpack_trees_job *job)
+{
+	struct unpack_trees_options *o = &job->o;
+	struct cache_def cache = CACHE_DEF_INIT;
+
+	o->lstat_cache = &cache;
+	job->ret = traverse_trees_recursive(job->n, job->dirmask, 0,
+					    job->names, &job->info);
+
+	/*
+	 * Entries below the directory that are in none of the trees;
+	 * they would be found by the traversal of the top level.
+	 */
+	while (job->ret >= 0) {
+		struct cache_entry *ce = next_cache_entry(o);
+		if (!ce)
+			break;
+		if (unpack_index_entry(ce, o) < 0)
+			job->ret = -1;
+	}
+	o->lstat_cache = NULL;
+	cache_def_clear(&cache);
+}
+
+static void *unpack_worker(void *data)
+{
+	struct unpack_trees_parallel *p = data;
+
+	for (;;) {
+		struct unpack_trees_job *job = NULL;
+
+		pthread_mutex_lock(&p->mutex);
+		if (!p->failed && p->next < p->nr)
+			job = p->jobs[p->next++];
+		pthread_mutex_unlock(&p->mutex);
+		if (!job)
+			break;
+
+		run_unpack_job(job);
+		if (job->ret < 0) {
+			pthread_mutex_lock(&p->mutex);
+			p->failed = 1;
+			pthread_mutex_unlock(&p->mutex);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Move the entries of the jobs' results into o->result. What is there
+ * already comes from the top level, and thus sorts before or after each
+ * job's directory as a whole.
+ */
+static void merge_unpack_jobs(struct unpack_trees_options *o,
+			      struct unpack_trees_parallel *p)
+{
+	struct index_state *result = &o->result;
+	struct cache_entry **cache;
+	unsigned int nr = result->cache_nr, i = 0, j, k = 0;
+	int n;
+
+	for (n = 0; n < p->nr; n++)
+		nr += p->jobs[n]->o.result.cache_nr;
+	ALLOC_ARRAY(cache, nr);
+
+	/* the name hash will be rebuilt if it is needed again */
+	if (result->name_hash_initialized) {
+		free_name_hash(result);
+		for (i = 0; i < result->cache_nr; i++)
+			result->cache[i]->ce_flags &= ~CE_HASHED;
+		i = 0;
+	}
+	if (!result->ce_mem_pool)
+		mem_pool_init(&result->ce_mem_pool, 0);
+
+	for (n = 0; n < p->nr; n++) {
+		struct unpack_trees_job *job = p->jobs[n];
+		struct index_state *r = &job->o.result;
+
+		while (i < result->cache_nr &&
+		       strcmp(result->cache[i]->name, job->dir.buf) < 0)
+			cache[k++] = result->cache[i++];
+		for (j = 0; j < r->cache_nr; j++) {
+			r->cache[j]->ce_flags &= ~CE_HASHED;
+			cache[k++] = r->cache[j];
+		}
+		result->cache_changed |= r->cache_changed;
+		if (r->ce_mem_pool)
+			mem_pool_combine(result->ce_mem_pool, r->ce_mem_pool);
+		r->cache_nr = 0;
+		discard_index(r);
+	}
+	while (i < result->cache_nr)
+		cache[k++] = result->cache[i++];
+
+	free(result->cache);
+	result->cache = cache;
+	result->cache_nr = result->cache_alloc = nr;
+}
+
+static int run_unpack_jobs(struct unpack_trees_options *o,
+			   struct unpack_trees_parallel *p, int threads)
+{
+	pthread_t *workers = NULL;
+	int i, err;
+
+	for (i = 0; i < p->nr; i++)
+		setup_unpack_job(o, p->jobs[i]);
+
+	/* this thread is one of the workers */
+	if (threads > p->nr)
+		threads = p->nr;
+	if (threads > 1)
+		ALLOC_ARRAY(workers, threads - 1);
+	for (i = 0; i < threads - 1; i++) {
+		err = pthread_create(&workers[i], NULL, unpack_worker, p);
+		if (err)
+			die(_("unable to create threaded unpack: %s"),
+			    strerror(err));
+	}
+	unpack_worker(p);
+	for (i = 0; i < threads - 1; i++)
+		if (pthread_join(workers[i], NULL))
+			die("unable to join threaded unpack");
+	free(workers);
+
+	for (i = 0; i < p->nr; i++)
+		o->src_index->cache_changed |= p->jobs[i]->src.cache_changed;
+	if (p->failed)
+		return -1;
+	merge_unpack_jobs(o, p);
+	return 0;
+}
+
+static void free_unpack_job(struct unpack_trees_job *job)
+{
+	int i;
+
+	for (i = 0; i < NB_UNPACK_TREES_ERROR_TYPES; i++)
+		string_list_clear(&job->o.unpack_rejects[i], 0);
+	discard_index(&job->o.result);
+	strbuf_release(&job->dir);
+	free(job);
+}
+
+/*
+ * Traverse the top level of the trees, leaving the directories in it to
+ * a pool of threads. Object access and changes to the cache-tree and the
+ * untracked cache of the source index are serialized, so what runs in
+ * parallel is the comparison of the trees with the index, the lstat()
+ * calls to check the working tree, and building the result.
+ *
+ * If anything fails, we start over without threads, so that the errors
+ * are reported exactly as without threads.
+ */
+static int traverse_trees_parallel(struct unpack_trees_options *o,
+				   unsigned len, struct tree_desc *t,
+				   struct traverse_info *info, int threads)
+{
+	struct unpack_trees_parallel p;
+	unsigned int show_all_errors = o->show_all_errors;
+	int i, ret;
+
+	memset(&p, 0, sizeof(p));
+	pthread_mutex_init(&p.mutex, NULL);
+	p.src_index = o->src_index;
+	o->parallel = &p;
+
+	/*
+	 * read_directory() may need the name hash when it checks for
+	 * untracked files; hashing the index later from one job would
+	 * race with the others marking their entries as used.
+	 */
+	if (o->update)
+		lazy_init_name_hash(o->src_index);
+	o->show_all_errors = 1;
+	info->show_all_errors = 0;
+
+	p.collecting = 1;
+	ret = traverse_trees(o->src_index, len, t, info);
+	p.collecting = 0;
+	if (!ret)
+		ret = run_unpack_jobs(o, &p, threads);
+	trace2_data_intmax("unpack_trees", the_repository,
+			   "parallel/jobs", p.nr);
+
+	for (i = 0; i < p.nr; i++)
+		free_unpack_job(p.jobs[i]);
+	free(p.jobs);
+	o->parallel = NULL;
+	o->show_all_errors = show_all_errors;
+	info->show_all_errors = show_all_errors;
+	pthread_mutex_destroy(&p.mutex);
+
+	if (ret < 0) {
+		trace2_data_intmax("unpack_trees", the_repository,
+				   "parallel/fallback", 1);
+		for (i = 0; i < NB_UNPACK_TREES_ERROR_TYPES; i++)
+			string_list_clear(&o->unpack_rejects[i], 0);
+		discard_index(&o->result);
+		setup_unpack_result(o);
+		mark_all_ce_unused(o->src_index);
+		o->cache_bottom = 0;
+		ret = traverse_trees(o->src_index, len, t, info);
+	}
+	return ret;
+}
 /*
  * N-way merge "len" trees.  Returns 0 on success, -1 on failure to manipulate the
  * resulting index, -2 on failure to reflect the changes to the work tree.
@@ -1464,10 +1952,13 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 	trace_performance_enter();
 	memset(&el, 0, sizeof(el));
+	if (o->src_index->sparse_index && !o->diff_index_cached)
+		ensure_full_index(o->src_index);
 	if (!core_apply_sparse_checkout || !o->update)
 		o->skip_sparse_checkout = 1;
 	if (!o->skip_sparse_checkout) {
 		char *sparse = git_pathdup("info/sparse-checkout");
+		el.use_cone_patterns = core_sparse_checkout_cone;
 		if (add_excludes_from_file_to_list(sparse, "", 0, &el, NULL) < 0)
 			o->skip_sparse_checkout = 1;
 		else
@@ -1475,26 +1966,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		free(sparse);
 	}
 
-	memset(&o->result, 0, sizeof(o->result));
-	o->result.initialized = 1;
-	o->result.timestamp.sec = o->src_index->timestamp.sec;
-	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
-	o->result.version = o->src_index->version;
-	if (!o->src_index->split_index) {
-		o->result.split_index = NULL;
-	} else if (o->src_index == o->dst_index) {
-		/*
-		 * o->dst_index (and thus o->src_index) will be discarded
-		 * and overwritten with o->result at the end of this function,
-		 * so just use src_index's split_index to avoid having to
-		 * create a new one.
-		 */
-		o->result.split_index = o->src_index->split_index;
-		o->result.split_index->refcount++;
-	} else {
-		o->result.split_index = init_split_index(&o->result);
-	}
-	oidcpy(&o->result.oid, &o->src_index->oid);
+	setup_unpack_result(o);
 	o->merge_size = len;
 	mark_all_ce_unused(o->src_index);
 
@@ -1511,6 +1983,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len) {
 		const char *prefix = o->prefix ? o->prefix : "";
 		struct traverse_info info;
+		int threads;
 
 		setup_traverse_info(&info, prefix);
 		info.fn = unpack_callback;
@@ -1536,7 +2009,13 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		}
 
 		trace_performance_enter();
-		ret = traverse_trees(o->src_index, len, t, &info);
+		if (!o->pathspec)
+			prefetch_subtrees(len, t);
+		threads = unpack_threads(o);
+		if (threads)
+			ret = traverse_trees_parallel(o, len, t, &info, threads);
+		else
+			ret = traverse_trees(o->src_index, len, t, &info);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
 			goto return_failed;
@@ -1668,6 +2147,22 @@ static int same(const struct cache_entry *a, const struct cache_entry *b)
 	       oideq(&a->oid, &b->oid);
 }
 
+/*
+ * ie_match_stat() may need to look at the contents of the file, e.g. if
+ * the entry is racily clean, which is not safe to do from several
+ * threads.
+ */
+static unsigned int unpack_match_stat(struct unpack_trees_options *o,
+				      const struct cache_entry *ce,
+				      struct stat *st, unsigned int options)
+{
+	unsigned int changed;
+
+	unpack_lock(o);
+	changed = ie_match_stat(o->src_index, ce, st, options);
+	unpack_unlock(o);
+	return changed;
+}
 
 /*
  * When a CE gets turned into an unmerged entry, we
@@ -1694,7 +2189,7 @@ static int verify_uptodate_1(const struct cache_entry *ce,
 
 	if (!lstat(ce->name, &st)) {
 		int flags = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE;
-		unsigned changed = ie_match_stat(o->src_index, ce, &st, flags);
+		unsigned changed = unpack_match_stat(o, ce, &st, flags);
 
 		if (submodule_from_ce(ce)) {
 			int r = check_submodule_move_head(ce,
@@ -1751,8 +2246,10 @@ static void invalidate_ce_path(const struct cache_entry *ce,
 {
 	if (!ce)
 		return;
+	unpack_lock(o);
 	cache_tree_invalidate_path(o->src_index, ce->name);
 	untracked_cache_invalidate_path(o->src_index, ce->name, 1);
+	unpack_unlock(o);
 }
 
 /*
@@ -1788,7 +2285,11 @@ static int verify_clean_subdirectory(const struct cache_entry *ce,
 
 	if (S_ISGITLINK(ce->ce_mode)) {
 		struct object_id oid;
-		int sub_head = resolve_gitlink_ref(ce->name, "HEAD", &oid);
+		int sub_head;
+
+		unpack_lock(o);
+		sub_head = resolve_gitlink_ref(ce->name, "HEAD", &oid);
+		unpack_unlock(o);
 		/*
 		 * If we are not going to update the submodule, then
 		 * we don't care.
@@ -1836,7 +2337,9 @@ static int verify_clean_subdirectory(const struct cache_entry *ce,
 	memset(&d, 0, sizeof(d));
 	if (o->dir)
 		d.exclude_per_dir = o->dir->exclude_per_dir;
-	i = read_directory(&d, o->src_index, pathbuf, namelen+1, NULL);
+	unpack_lock(o);
+	i = read_directory(&d, full_src_index(o), pathbuf, namelen+1, NULL);
+	unpack_unlock(o);
 	if (i)
 		return add_rejected_path(o, ERROR_NOT_UPTODATE_DIR, ce->name);
 	free(pathbuf);
@@ -1876,13 +2379,19 @@ static int check_ok_to_remove(const char *name, int len, int dtype,
 	if (ignore_case && icase_exists(o, name, len, st))
 		return 0;
 
-	if (o->dir &&
-	    is_excluded(o->dir, o->src_index, name, &dtype))
-		/*
-		 * ce->name is explicitly excluded, so it is Ok to
-		 * overwrite it.
-		 */
-		return 0;
+	if (o->dir) {
+		int excluded;
+
+		unpack_lock(o);
+		excluded = is_excluded(o->dir, full_src_index(o), name, &dtype);
+		unpack_unlock(o);
+		if (excluded)
+			/*
+			 * ce->name is explicitly excluded, so it is Ok to
+			 * overwrite it.
+			 */
+			return 0;
+	}
 	if (S_ISDIR(st->st_mode)) {
 		/*
 		 * We are checking out path "foo" and
@@ -1924,7 +2433,11 @@ static int verify_absent_1(const struct cache_entry *ce,
 	if (o->index_only || o->reset || !o->update)
 		return 0;
 
-	len = check_leading_path(ce->name, ce_namelen(ce));
+	if (o->lstat_cache)
+		len = threaded_check_leading_path(o->lstat_cache, ce->name,
+						  ce_namelen(ce));
+	else
+		len = check_leading_path(ce->name, ce_namelen(ce));
 	if (!len)
 		return 0;
 	else if (len > 0) {
@@ -2381,7 +2894,7 @@ int oneway_merge(const struct cache_entry * const *src,
 		if (o->reset && o->update && !ce_uptodate(old) && !ce_skip_worktree(old)) {
 			struct stat st;
 			if (lstat(old->name, &st) ||
-			    ie_match_stat(o->src_index, old, &st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE))
+			    unpack_match_stat(o, old, &st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE))
 				update |= CE_UPDATE;
 		}
 		if (o->update && S_ISGITLINK(old->ce_mode) &&
@@ -11,6 +11,8 @@
 struct cache_entry;
 struct unpack_trees_options;
 struct exclude_list;
+struct cache_def;
+struct unpack_trees_parallel;
 
 typedef int (*merge_fn_t)(const struct cache_entry * const *src,
 		struct unpack_trees_options *options);
@@ -84,6 +86,8 @@ struct unpack_trees_options {
 	struct index_state result;
 
 	struct exclude_list *el; /* for internal use */
+	struct unpack_trees_parallel *parallel; /* for internal use */
+	struct cache_def *lstat_cache; /* for internal use */
 };
 
 int unpack_trees(unsigned n, struct tree_desc *t,
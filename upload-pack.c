@@ -26,6 +26,10 @@
 #include "serve.h"
 #include "commit-graph.h"
 #include "commit-reach.h"
+#include "packfile.h"
+#include "dir.h"
+#include "tempfile.h"
+#include "pack-bitmap.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -72,6 +76,27 @@ static struct list_objects_filter_options filter_options;
 
 static int allow_sideband_all;
 
+/* "<pack-hash> <uri>" from uploadpack.packfileURI */
+static struct string_list packfile_uris = STRING_LIST_INIT_DUP;
+
+/*
+ * With pack.useBitmaps (the default), whether each want reaches one of
+ * the haves is answered from the reachability bitmaps if there are any:
+ * "want_reach" holds the objects reachable from each want that is not
+ * known to reach a have yet, and the first "reach_haves_checked" haves
+ * were already looked up in them.
+ */
+static int use_bitmaps = 1;
+static int reach_bitmaps_tried;
+static struct bitmap_index *reach_bitmaps;
+static struct bitmap **want_reach;
+static char *want_reaches_have;
+static int reach_haves_checked;
+
+/* uploadpack.responseCache and uploadpack.responseCacheSize */
+static const char *response_cache_dir;
+static unsigned long response_cache_size = 1024 * 1024 * 1024;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -102,17 +127,236 @@ static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 	return 0;
 }
 
+static int hash_oid(const struct object_id *oid, void *data)
+{
+	git_hash_ctx *ctx = data;
+
+	the_hash_algo->update_fn(ctx, oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static void hash_objects(git_hash_ctx *ctx, const char *what,
+			 const struct object_array *objs)
+{
+	struct oid_array oids = OID_ARRAY_INIT;
+	int i;
+
+	for (i = 0; i < objs->nr; i++)
+		oid_array_append(&oids, &objs->objects[i].item->oid);
+	the_hash_algo->update_fn(ctx, what, strlen(what) + 1);
+	oid_array_for_each_unique(&oids, hash_oid, ctx);
+	oid_array_clear(&oids);
+}
+
+static int hash_one_shallow(const struct commit_graft *graft, void *data)
+{
+	if (graft->nr_parent == -1)
+		hash_oid(&graft->oid, data);
+	return 0;
+}
+
+static int hash_ref(const char *refname, const struct object_id *oid,
+		    int flags, void *data)
+{
+	git_hash_ctx *ctx = data;
+
+	the_hash_algo->update_fn(ctx, refname, strlen(refname) + 1);
+	return hash_oid(oid, data);
+}
+
+/*
+ * The file the response to this request is cached in: its name hashes
+ * everything that goes into the pack, i.e. the pack-objects command
+ * line (except for the progress display), the wants, haves and shallow
+ * commits in no particular order, and the refs, so that the entry is
+ * not used any longer when a ref moves (--include-tag looks at them).
+ */
+static void response_cache_path(struct strbuf *path,
+				const struct argv_array *args,
+				const struct object_array *have_obj,
+				const struct object_array *want_obj)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	int i;
+
+	the_hash_algo->init_fn(&ctx);
+	for (i = 0; i < args->argc; i++) {
+		if (!strcmp(args->argv[i], "--progress"))
+			continue;
+		the_hash_algo->update_fn(&ctx, args->argv[i],
+					 strlen(args->argv[i]) + 1);
+	}
+	hash_objects(&ctx, "want", want_obj);
+	hash_objects(&ctx, "have", have_obj);
+	hash_objects(&ctx, "edge", &extra_edge_obj);
+	if (shallow_nr) {
+		the_hash_algo->update_fn(&ctx, "shallow", strlen("shallow") + 1);
+		for_each_commit_graft(hash_one_shallow, &ctx);
+	}
+	the_hash_algo->update_fn(&ctx, "refs", strlen("refs") + 1);
+	for_each_rawref(hash_ref, &ctx);
+	the_hash_algo->final_fn(hash, &ctx);
+
+	strbuf_addf(path, "%s/%s.pack", response_cache_dir, hash_to_hex(hash));
+}
+
+/*
+ * Send the cached response at "path" instead of running pack-objects.
+ * Returns 0 if there is none, 1 if it was sent, and -1 if reading it
+ * failed after part of it might have been sent.
+ */
+static int send_cached_response(const char *path)
+{
+	/* one side-band-64k packet */
+	char data[LARGE_PACKET_DATA_MAX - 1];
+	ssize_t sz;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return 0;
+	/* for pruning, the entry has just been used */
+	utime(path, NULL);
+	while ((sz = xread(fd, data, sizeof(data))) > 0) {
+		reset_timeout();
+		send_client_data(1, data, sz);
+	}
+	close(fd);
+	if (sz < 0)
+		return -1;
+	if (use_sideband)
+		packet_flush(1);
+	return 1;
+}
+
+struct response_cache_entry {
+	char *name;
+	timestamp_t mtime;
+	off_t size;
+};
+
+static int response_cache_entry_cmp(const void *a_, const void *b_)
+{
+	const struct response_cache_entry *a = a_, *b = b_;
+
+	return a->mtime < b->mtime ? -1 : a->mtime > b->mtime;
+}
+
+/*
+ * Remove the least recently used responses until the cache is no
+ * larger than uploadpack.responseCacheSize.
+ */
+static void prune_response_cache(void)
+{
+	struct response_cache_entry *entry = NULL;
+	int nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	struct strbuf path = STRBUF_INIT;
+	size_t baselen;
+	struct dirent *de;
+	DIR *dir = opendir(response_cache_dir);
+
+	if (!dir)
+		return;
+	strbuf_addf(&path, "%s/", response_cache_dir);
+	baselen = path.len;
+	while ((de = readdir(dir))) {
+		struct stat st;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		ALLOC_GROW(entry, nr + 1, alloc);
+		entry[nr].name = xstrdup(de->d_name);
+		entry[nr].mtime = st.st_mtime;
+		entry[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entry, nr, response_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > response_cache_size) {
+			strbuf_setlen(&path, baselen);
+			strbuf_addstr(&path, entry[i].name);
+			if (!unlink(path.buf))
+				total -= entry[i].size;
+		}
+		free(entry[i].name);
+	}
+	free(entry);
+	strbuf_release(&path);
+}
+
+/*
+ * Start caching the response to the request in "path", unless it is
+ * already cached, in which case it is sent and 1 is returned.
+ */
+static int start_response_cache(const char *path, struct tempfile **cache)
+{
+	struct strbuf template = STRBUF_INIT;
+	int ret = send_cached_response(path);
+
+	if (ret < 0)
+		return ret;
+	if (ret) {
+		trace2_data_string("upload-pack", the_repository,
+				   "response-cache", "hit");
+		return 1;
+	}
+	trace2_data_string("upload-pack", the_repository,
+			   "response-cache", "miss");
+
+	strbuf_addf(&template, "%s/tmp_response_XXXXXX", response_cache_dir);
+	if (safe_create_leading_directories(template.buf) != SCLD_FAILED)
+		*cache = mks_tempfile(template.buf);
+	strbuf_release(&template);
+	return 0;
+}
+
+static void write_response_cache(struct tempfile **cache, off_t *cached,
+				 const char *data, ssize_t sz)
+{
+	if (!is_tempfile_active(*cache))
+		return;
+	*cached += sz;
+	/* a response larger than the whole cache is not worth keeping */
+	if (*cached > response_cache_size ||
+	    write_in_full(get_tempfile_fd(*cache), data, sz) < 0)
+		delete_tempfile(cache);
+}
+
+static void finish_response_cache(struct tempfile **cache, const char *path)
+{
+	if (!is_tempfile_active(*cache))
+		return;
+	if (!rename_tempfile(cache, path)) {
+		trace2_data_string("upload-pack", the_repository,
+				   "response-cache", "stored");
+		prune_response_cache();
+	}
+}
+
 static void create_pack_file(const struct object_array *have_obj,
-			     const struct object_array *want_obj)
+			     const struct object_array *want_obj,
+			     const struct string_list *uri_packs)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
-	char data[8193], progress[128];
+	/* one side-band-64k packet, plus the byte we hold back */
+	char data[LARGE_PACKET_DATA_MAX], progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
 	int buffered = -1;
 	ssize_t sz;
 	int i;
 	FILE *pipe_fd;
+	struct strbuf cache_path = STRBUF_INIT;
+	struct tempfile *cache = NULL;
+	off_t cached = 0;
 
 	if (!pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -140,6 +384,9 @@ static void create_pack_file(const struct object_array *have_obj,
 		argv_array_push(&pack_objects.args, "--delta-base-offset");
 	if (use_include_tag)
 		argv_array_push(&pack_objects.args, "--include-tag");
+	for (i = 0; uri_packs && i < uri_packs->nr; i++)
+		argv_array_pushf(&pack_objects.args, "--keep-pack=%s",
+				 uri_packs->items[i].string);
 	if (filter_options.filter_spec) {
 		struct strbuf expanded_filter_spec = STRBUF_INIT;
 		expand_list_objects_filter_spec(&filter_options,
@@ -155,6 +402,21 @@ static void create_pack_file(const struct object_array *have_obj,
 		}
 	}
 
+	if (response_cache_dir) {
+		int ret;
+
+		response_cache_path(&cache_path, &pack_objects.args,
+				    have_obj, want_obj);
+		ret = start_response_cache(cache_path.buf, &cache);
+		if (ret < 0)
+			goto fail;
+		if (ret) {
+			child_process_clear(&pack_objects);
+			strbuf_release(&cache_path);
+			return;
+		}
+	}
+
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
@@ -272,6 +534,7 @@ static void create_pack_file(const struct object_array *have_obj,
 			else
 				buffered = -1;
 			send_client_data(1, data, sz);
+			write_response_cache(&cache, &cached, data, sz);
 		}
 
 		/*
@@ -299,8 +562,11 @@ static void create_pack_file(const struct object_array *have_obj,
 	if (0 <= buffered) {
 		data[0] = buffered;
 		send_client_data(1, data, 1);
+		write_response_cache(&cache, &cached, data, 1);
 		fprintf(stderr, "flushed.\n");
 	}
+	finish_response_cache(&cache, cache_path.buf);
+	strbuf_release(&cache_path);
 	if (use_sideband)
 		packet_flush(1);
 	return;
@@ -345,14 +611,114 @@ static int got_oid(const char *hex, struct object_id *oid,
 	return 0;
 }
 
+static int bitmap_reaches_have(struct bitmap *reachable,
+			       struct object *have)
+{
+	struct commit_list *p;
+
+	if (bitmap_reaches_oid(reach_bitmaps, reachable, &have->oid))
+		return 1;
+	if (have->type != OBJ_COMMIT)
+		return 0;
+	/* like THEY_HAVE, which is set for the parents of a have, too */
+	for (p = ((struct commit *)have)->parents; p; p = p->next)
+		if (bitmap_reaches_oid(reach_bitmaps, reachable,
+				       &p->item->object.oid))
+			return 1;
+	return 0;
+}
+
+/*
+ * Like ok_to_give_up(), using the reachability bitmaps. Each want is
+ * only walked once per request, however many times this is called as
+ * haves keep coming in; every have is then looked up with a single bit
+ * test in the bitmap of each want that does not reach a have yet.
+ * Returns -1 if there are no bitmaps to answer with.
+ */
+static int bitmap_ok_to_give_up(const struct object_array *have_obj,
+				const struct object_array *want_obj)
+{
+	int i, j, ok = 1;
+
+	if (!reach_bitmaps_tried) {
+		reach_bitmaps_tried = 1;
+		if (use_bitmaps)
+			reach_bitmaps = prepare_bitmap_git(the_repository);
+		if (reach_bitmaps) {
+			trace2_data_string("upload-pack", the_repository,
+					   "have-reachability", "bitmap");
+			want_reach = xcalloc(want_obj->nr, sizeof(*want_reach));
+			want_reaches_have = xcalloc(want_obj->nr, 1);
+		}
+	}
+	if (!reach_bitmaps)
+		return -1;
+
+	for (i = 0; i < want_obj->nr; i++) {
+		struct object *want = want_obj->objects[i].item;
+
+		if (want_reaches_have[i])
+			continue;
+		want = deref_tag(the_repository, want, "a from object", 0);
+		if (!want || want->type != OBJ_COMMIT) {
+			/* can_all_from_reach_with_flag() does not ask either */
+			want_reaches_have[i] = 1;
+			continue;
+		}
+		if (!want_reach[i])
+			want_reach[i] = bitmap_reachable_from(the_repository,
+							      reach_bitmaps,
+							      (struct commit *)want);
+	}
+
+	for (i = 0; i < want_obj->nr; i++) {
+		if (want_reaches_have[i])
+			continue;
+		for (j = reach_haves_checked; j < have_obj->nr; j++) {
+			if (bitmap_reaches_have(want_reach[i],
+						have_obj->objects[j].item)) {
+				want_reaches_have[i] = 1;
+				bitmap_free(want_reach[i]);
+				want_reach[i] = NULL;
+				break;
+			}
+		}
+		if (!want_reaches_have[i])
+			ok = 0;
+	}
+	reach_haves_checked = have_obj->nr;
+	return ok;
+}
+
+static void clear_reach_bitmaps(const struct object_array *want_obj)
+{
+	int i;
+
+	if (reach_bitmaps) {
+		for (i = 0; i < want_obj->nr; i++)
+			bitmap_free(want_reach[i]);
+		FREE_AND_NULL(want_reach);
+		FREE_AND_NULL(want_reaches_have);
+		free_bitmap_index(reach_bitmaps);
+		reach_bitmaps = NULL;
+	}
+	reach_bitmaps_tried = 0;
+	reach_haves_checked = 0;
+}
+
 static int ok_to_give_up(const struct object_array *have_obj,
 			 struct object_array *want_obj)
 {
-	uint32_t min_generation = GENERATION_NUMBER_ZERO;
+	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
+	int ret;
 
 	if (!have_obj->nr)
 		return 0;
 
+	ret = bitmap_ok_to_give_up(have_obj, want_obj);
+	if (ret >= 0)
+		return ret;
+
 	return can_all_from_reach_with_flag(want_obj, THEY_HAVE,
 					    COMMON_KNOWN, oldest_have,
 					    min_generation);
@@ -716,14 +1082,26 @@ static void deepen(struct packet_writer *writer, int depth, int deepen_relative,
 }
 
 static void deepen_by_rev_list(struct packet_writer *writer, int ac,
-			       const char **av,
+			       const char **av, timestamp_t deepen_since,
+			       struct string_list *deepen_not,
 			       struct object_array *shallows,
 			       struct object_array *want_obj)
 {
-	struct commit_list *result;
+	struct commit_list *result = NULL;
+	int from_graph;
 
+	/* a cut-off date alone can be answered from the commit-graph */
+	from_graph = deepen_since && !deepen_not->nr &&
+		     !get_shallow_commits_since(want_obj, deepen_since,
+						SHALLOW, NOT_SHALLOW, &result);
+	/*
+	 * The commits about to be registered as shallow must not be
+	 * parsed from the commit-graph from now on.
+	 */
 	close_commit_graph(the_repository->objects);
-	result = get_shallow_commits_by_rev_list(ac, av, SHALLOW, NOT_SHALLOW);
+	if (!from_graph)
+		result = get_shallow_commits_by_rev_list(ac, av, SHALLOW,
+							 NOT_SHALLOW);
 	send_shallow(writer, result);
 	free_commit_list(result);
 	send_unshallow(writer, shallows, want_obj);
@@ -764,7 +1142,8 @@ static int send_shallow_list(struct packet_writer *writer,
 			struct object *o = want_obj->objects[i].item;
 			argv_array_push(&av, oid_to_hex(&o->oid));
 		}
-		deepen_by_rev_list(writer, av.argc, av.argv, shallows, want_obj);
+		deepen_by_rev_list(writer, av.argc, av.argv, deepen_since,
+				   deepen_not, shallows, want_obj);
 		argv_array_clear(&av);
 		ret = 1;
 	} else {
@@ -989,9 +1368,15 @@ static void format_symref_info(struct strbuf *buf, struct string_list *symref)
 		strbuf_addf(buf, " symref=%s:%s", item->string, (char *)item->util);
 }
 
+struct advertise_data {
+	struct string_list *symref;
+	struct packet_writer writer;
+};
+
 static int send_ref(const char *refname, const struct object_id *oid,
 		    int flag, void *cb_data)
 {
+	struct advertise_data *data = cb_data;
 	static const char *capabilities = "multi_ack thin-pack side-band"
 		" side-band-64k ofs-delta shallow deepen-since deepen-not"
 		" deepen-relative no-progress include-tag multi_ack_detailed";
@@ -1004,8 +1389,9 @@ static int send_ref(const char *refname, const struct object_id *oid,
 	if (capabilities) {
 		struct strbuf symref_info = STRBUF_INIT;
 
-		format_symref_info(&symref_info, cb_data);
-		packet_write_fmt(1, "%s %s%c%s%s%s%s%s%s agent=%s\n",
+		format_symref_info(&symref_info, data->symref);
+		packet_writer_write(&data->writer,
+			     "%s %s%c%s%s%s%s%s%s agent=%s\n",
 			     oid_to_hex(oid), refname_nons,
 			     0, capabilities,
 			     (allow_unadvertised_object_request & ALLOW_TIP_SHA1) ?
@@ -1018,11 +1404,13 @@ static int send_ref(const char *refname, const struct object_id *oid,
 			     git_user_agent_sanitized());
 		strbuf_release(&symref_info);
 	} else {
-		packet_write_fmt(1, "%s %s\n", oid_to_hex(oid), refname_nons);
+		packet_writer_write(&data->writer, "%s %s\n",
+				    oid_to_hex(oid), refname_nons);
 	}
 	capabilities = NULL;
 	if (!peel_ref(refname, &peeled))
-		packet_write_fmt(1, "%s %s^{}\n", oid_to_hex(&peeled), refname_nons);
+		packet_writer_write(&data->writer, "%s %s^{}\n",
+				    oid_to_hex(&peeled), refname_nons);
 	return 0;
 }
 
@@ -1069,6 +1457,20 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 		allow_ref_in_want = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowsidebandall", var)) {
 		allow_sideband_all = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packfileuri", var)) {
+		struct object_id oid;
+		const char *uri;
+
+		if (!value)
+			return config_error_nonbool(var);
+		if (parse_oid_hex(value, &oid, &uri) || *uri++ != ' ' || !*uri)
+			return error(_("invalid value for '%s': '%s'"),
+				     var, value);
+		string_list_append(&packfile_uris, value);
+	} else if (!strcmp("pack.usebitmaps", var)) {
+		use_bitmaps = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.responsecachesize", var)) {
+		response_cache_size = git_config_ulong(var, value);
 	} else if (!strcmp("core.precomposeunicode", var)) {
 		precomposed_unicode = git_config_bool(var, value);
 	}
@@ -1076,6 +1478,9 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 	if (current_config_scope() != CONFIG_SCOPE_REPO) {
 		if (!strcmp("uploadpack.packobjectshook", var))
 			return git_config_string(&pack_objects_hook, var, value);
+		if (!strcmp("uploadpack.responsecache", var))
+			return git_config_pathname(&response_cache_dir,
+						   var, value);
 	}
 
 	return parse_hide_refs_config(var, value, "uploadpack");
@@ -1096,9 +1501,14 @@ void upload_pack(struct upload_pack_options *options)
 	head_ref_namespaced(find_symref, &symref);
 
 	if (options->advertise_refs || !stateless_rpc) {
+		struct advertise_data data = { &symref };
+
+		packet_writer_init(&data.writer, 1);
+		packet_writer_buffer(&data.writer);
 		reset_timeout();
-		head_ref_namespaced(send_ref, &symref);
-		for_each_namespaced_ref(send_ref, &symref);
+		head_ref_namespaced(send_ref, &data);
+		for_each_namespaced_ref(send_ref, &data);
+		packet_writer_send(&data.writer);
 		advertise_shallow_grafts(1);
 		packet_flush(1);
 	} else {
@@ -1112,13 +1522,15 @@ void upload_pack(struct upload_pack_options *options)
 	packet_reader_init(&reader, 0, NULL, 0,
 			   PACKET_READ_CHOMP_NEWLINE |
 			   PACKET_READ_DIE_ON_ERR_PACKET);
+	packet_reader_enable_read_ahead(&reader);
 
 	receive_needs(&reader, &want_obj);
 	if (want_obj.nr) {
 		struct object_array have_obj = OBJECT_ARRAY_INIT;
 		get_common_commits(&reader, &have_obj, &want_obj);
-		create_pack_file(&have_obj, &want_obj);
+		create_pack_file(&have_obj, &want_obj, NULL);
 	}
+	packet_reader_release(&reader);
 }
 
 struct upload_pack_data {
@@ -1135,6 +1547,9 @@ struct upload_pack_data {
 
 	struct packet_writer writer;
 
+	/* the URI schemes the client can download packs from */
+	struct string_list uri_protocols;
+
 	unsigned stateless_rpc : 1;
 
 	unsigned use_thin_pack : 1;
@@ -1151,6 +1566,7 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 	struct oid_array haves = OID_ARRAY_INIT;
 	struct object_array shallows = OBJECT_ARRAY_INIT;
 	struct string_list deepen_not = STRING_LIST_INIT_DUP;
+	struct string_list uri_protocols = STRING_LIST_INIT_DUP;
 
 	memset(data, 0, sizeof(*data));
 	data->wants = wants;
@@ -1158,6 +1574,7 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 	data->haves = haves;
 	data->shallows = shallows;
 	data->deepen_not = deepen_not;
+	data->uri_protocols = uri_protocols;
 	packet_writer_init(&data->writer, 1);
 }
 
@@ -1168,6 +1585,7 @@ static void upload_pack_data_clear(struct upload_pack_data *data)
 	oid_array_clear(&data->haves);
 	object_array_clear(&data->shallows);
 	string_list_clear(&data->deepen_not, 0);
+	string_list_clear(&data->uri_protocols, 0);
 }
 
 static int parse_want(struct packet_writer *writer, const char *line,
@@ -1309,6 +1727,12 @@ static void process_args(struct packet_reader *request,
 			continue;
 		}
 
+		if (packfile_uris.nr &&
+		    skip_prefix(arg, "packfile-uris ", &p)) {
+			string_list_split(&data->uri_protocols, p, ',', -1);
+			continue;
+		}
+
 		if ((git_env_bool("GIT_TEST_SIDEBAND_ALL", 0) ||
 		     allow_sideband_all) &&
 		    !strcmp(arg, "sideband-all")) {
@@ -1451,6 +1875,67 @@ static void send_shallow_info(struct upload_pack_data *data,
 	packet_delim(1);
 }
 
+static int has_local_pack(const char *name)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		if (p->pack_local && !fspathcmp(basename(p->pack_name), name))
+			return 1;
+	return 0;
+}
+
+/*
+ * Offer the client to download the packs of uploadpack.packfileURI
+ * instead of receiving their objects in the pack we send, and collect the
+ * names of the packs offered in "uri_packs".  The packs were made ahead
+ * of time for clones, and are offered only to requests that have nothing
+ * in common with us, and want everything reachable from their wants.
+ */
+static void send_packfile_uris(struct upload_pack_data *data,
+			       const struct object_array *have_obj,
+			       struct string_list *uri_packs)
+{
+	const struct string_list_item *item;
+
+	if (!data->uri_protocols.nr || have_obj->nr ||
+	    data->depth || data->deepen_rev_list || data->shallows.nr ||
+	    is_repository_shallow(the_repository) || filter_options.choice)
+		return;
+
+	for_each_string_list_item(item, &packfile_uris) {
+		const char *hex = item->string;
+		const char *uri = hex + the_hash_algo->hexsz + 1;
+		const char *colon = strchr(uri, ':');
+		struct string_list_item *protocol;
+		char *name;
+
+		if (!colon)
+			continue;
+		for_each_string_list_item(protocol, &data->uri_protocols)
+			if (!strncmp(uri, protocol->string, colon - uri) &&
+			    !protocol->string[colon - uri])
+				break;
+		if (protocol == data->uri_protocols.items +
+				data->uri_protocols.nr)
+			continue;
+
+		name = xstrfmt("pack-%.*s.pack",
+			       (int)the_hash_algo->hexsz, hex);
+		if (!has_local_pack(name)) {
+			free(name);
+			continue;
+		}
+		if (!uri_packs->nr)
+			packet_writer_write(&data->writer, "packfile-uris\n");
+		packet_writer_write(&data->writer, "%s\n", hex);
+		string_list_append_nodup(uri_packs, name);
+	}
+
+	if (uri_packs->nr)
+		packet_writer_delim(&data->writer);
+}
+
 enum fetch_state {
 	FETCH_PROCESS_ARGS = 0,
 	FETCH_SEND_ACKS,
@@ -1465,9 +1950,11 @@ int upload_pack_v2(struct repository *r, struct argv_array *keys,
 	struct upload_pack_data data;
 	struct object_array have_obj = OBJECT_ARRAY_INIT;
 	struct object_array want_obj = OBJECT_ARRAY_INIT;
+	struct string_list uri_packs = STRING_LIST_INIT_DUP;
 
 	clear_object_flags(ALL_FLAGS);
 
+	string_list_clear(&packfile_uris, 0);
 	git_config(upload_pack_config, NULL);
 
 	upload_pack_data_init(&data);
@@ -1507,9 +1994,10 @@ int upload_pack_v2(struct repository *r, struct argv_array *keys,
 		case FETCH_SEND_PACK:
 			send_wanted_ref_info(&data);
 			send_shallow_info(&data, &want_obj);
+			send_packfile_uris(&data, &have_obj, &uri_packs);
 
 			packet_writer_write(&data.writer, "packfile\n");
-			create_pack_file(&have_obj, &want_obj);
+			create_pack_file(&have_obj, &want_obj, &uri_packs);
 			state = FETCH_DONE;
 			break;
 		case FETCH_DONE:
@@ -1518,8 +2006,10 @@ int upload_pack_v2(struct repository *r, struct argv_array *keys,
 	}
 
 	upload_pack_data_clear(&data);
+	clear_reach_bitmaps(&want_obj);
 	object_array_clear(&have_obj);
 	object_array_clear(&want_obj);
+	string_list_clear(&uri_packs, 0);
 	return 0;
 }
 
@@ -1551,6 +2041,10 @@ int upload_pack_advertise(struct repository *r,
 					   &allow_sideband_all_value) &&
 		     allow_sideband_all_value))
 			strbuf_addstr(value, " sideband-all");
+
+		if (repo_config_get_value_multi(the_repository,
+						"uploadpack.packfileuri"))
+			strbuf_addstr(value, " packfile-uris");
 	}
 
 	return 1;
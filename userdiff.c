@@ -2,6 +2,7 @@
 #include "config.h"
 #include "userdiff.h"
 #include "attr.h"
+#include "object-store.h"
 
 static struct userdiff_driver *drivers;
 static int ndrivers;
@@ -286,20 +287,26 @@ struct userdiff_driver *userdiff_find_by_path(struct index_state *istate,
 					      const char *path)
 {
 	static struct attr_check *check;
+	const char *value;
 
-	if (!check)
-		check = attr_check_initl("diff", NULL);
 	if (!path)
 		return NULL;
+
+	/* the attribute machinery is not thread-safe */
+	obj_read_lock();
+	if (!check)
+		check = attr_check_initl("diff", NULL);
 	git_check_attr(istate, path, check);
+	value = check->items[0].value;
+	obj_read_unlock();
 
-	if (ATTR_TRUE(check->items[0].value))
+	if (ATTR_TRUE(value))
 		return &driver_true;
-	if (ATTR_FALSE(check->items[0].value))
+	if (ATTR_FALSE(value))
 		return &driver_false;
-	if (ATTR_UNSET(check->items[0].value))
+	if (ATTR_UNSET(value))
 		return NULL;
-	return userdiff_find_by_name(check->items[0].value);
+	return userdiff_find_by_name(value);
 }
 
 struct userdiff_driver *userdiff_get_textconv(struct repository *r,
@@ -48,6 +48,7 @@ char *xstrdup(const char *str)
 		if (!ret)
 			die("Out of memory, strdup failed");
 	}
+	trace2_alloc(strlen(ret) + 1);
 	return ret;
 }
 
@@ -79,6 +80,7 @@ static void *do_xmalloc(size_t size, int gentle)
 #ifdef XMALLOC_POISON
 	memset(ret, 0xA5, size);
 #endif
+	trace2_alloc(size);
 	return ret;
 }
 
@@ -146,6 +148,7 @@ void *xrealloc(void *ptr, size_t size)
 		if (!ret)
 			die("Out of memory, realloc failed");
 	}
+	trace2_alloc(size);
 	return ret;
 }
 
@@ -168,6 +171,7 @@ void *xcalloc(size_t nmemb, size_t size)
 		if (!ret)
 			die("Out of memory, calloc failed");
 	}
+	trace2_alloc(nmemb * size);
 	return ret;
 }
 
@@ -349,6 +353,58 @@ ssize_t write_in_full(int fd, const void *buf, size_t count)
 	return total;
 }
 
+ssize_t writev_in_full(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+
+#ifdef NO_WRITEV
+	for (; iovcnt > 0; iov++, iovcnt--) {
+		if (write_in_full(fd, iov->iov_base, iov->iov_len) < 0)
+			return -1;
+		total += iov->iov_len;
+	}
+#else
+	for (;;) {
+		ssize_t written;
+
+		while (iovcnt > 0 && !iov->iov_len) {
+			iov++;
+			iovcnt--;
+		}
+		if (!iovcnt)
+			break;
+
+		written = writev(fd, iov, iovcnt);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (handle_nonblock(fd, POLLOUT, errno))
+				continue;
+			return -1;
+		}
+		if (!written) {
+			errno = ENOSPC;
+			return -1;
+		}
+		total += written;
+
+		/* skip what was written, which may end mid-buffer */
+		while ((size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+			if (!iovcnt)
+				break;
+		}
+		if (written) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+#endif
+	return total;
+}
+
 ssize_t pread_in_full(int fd, void *buf, size_t count, off_t offset)
 {
 	char *p = buf;
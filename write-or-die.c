@@ -62,6 +62,21 @@ void fsync_or_die(int fd, const char *msg)
 	}
 }
 
+int fsync_writeout_only(int fd)
+{
+#if defined(__APPLE__)
+	/* without F_FULLFSYNC, fsync() does not flush the drive cache */
+	return fsync(fd);
+#elif defined(HAVE_SYNC_FILE_RANGE)
+	return sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE |
+			       SYNC_FILE_RANGE_WRITE |
+			       SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 void write_or_die(int fd, const void *buf, size_t count)
 {
 	if (write_in_full(fd, buf, count) < 0) {
@@ -69,3 +84,11 @@ void write_or_die(int fd, const void *buf, size_t count)
 		die_errno("write error");
 	}
 }
+
+void writev_or_die(int fd, struct iovec *iov, int iovcnt)
+{
+	if (writev_in_full(fd, iov, iovcnt) < 0) {
+		check_pipe(errno);
+		die_errno("write error");
+	}
+}
@@ -5,6 +5,7 @@
  */
 #include "cache.h"
 #include "attr.h"
+#include "object-store.h"
 
 static struct whitespace_rule {
 	const char *rule_name;
@@ -75,11 +76,14 @@ unsigned whitespace_rule(struct index_state *istate, const char *pathname)
 	static struct attr_check *attr_whitespace_rule;
 	const char *value;
 
+	/* the attribute machinery is not thread-safe */
+	obj_read_lock();
 	if (!attr_whitespace_rule)
 		attr_whitespace_rule = attr_check_initl("whitespace", NULL);
 
 	git_check_attr(istate, pathname, attr_whitespace_rule);
 	value = attr_whitespace_rule->items[0].value;
+	obj_read_unlock();
 	if (ATTR_TRUE(value)) {
 		/* true (whitespace) */
 		unsigned all_rule = ws_tab_width(whitespace_rule_cfg);
@@ -2,6 +2,7 @@
 #include "wt-status.h"
 #include "object.h"
 #include "dir.h"
+#include "sparse-index.h"
 #include "commit.h"
 #include "diff.h"
 #include "revision.h"
@@ -659,6 +660,7 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 	struct index_state *istate = s->repo->index;
 	int i;
 
+	ensure_full_index(istate);
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct string_list_item *it;
 		struct wt_status_change_data *d;
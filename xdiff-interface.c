@@ -101,20 +101,66 @@ static void trim_common_tail(mmfile_t *a, mmfile_t *b)
 	b->size -= trimmed - recovered;
 }
 
-int xdi_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg, xdemitcb_t *xecb)
+static xdlcache_t *xdi_cache;
+
+xdlcache_t *xdi_cache_new(void)
+{
+	return xdl_cache_new(diff_cache_limit > LONG_MAX ?
+			     LONG_MAX : (long)diff_cache_limit);
+}
+
+/*
+ * Set up "a", "b" and "xpp_cached" for xdiff to be given "a", "b" and
+ * the returned parameters, or return NULL if the files are too big.
+ */
+static xpparam_t const *prepare_xdi(mmfile_t *mf1, mmfile_t *mf2,
+				    xpparam_t const *xpp,
+				    xdemitconf_t const *xecfg,
+				    mmfile_t *a, mmfile_t *b,
+				    xpparam_t *xpp_cached)
 {
-	mmfile_t a = *mf1;
-	mmfile_t b = *mf2;
+	*a = *mf1;
+	*b = *mf2;
 
 	if (mf1->size > MAX_XDIFF_SIZE || mf2->size > MAX_XDIFF_SIZE)
-		return -1;
+		return NULL;
 
 	if (!xecfg->ctxlen && !(xecfg->flags & XDL_EMIT_FUNCCONTEXT))
-		trim_common_tail(&a, &b);
+		trim_common_tail(a, b);
+
+	if (!xpp->cache && diff_cache_limit) {
+		if (!xdi_cache)
+			xdi_cache = xdi_cache_new();
+		*xpp_cached = *xpp;
+		xpp_cached->cache = xdi_cache;
+		xpp = xpp_cached;
+	}
+	return xpp;
+}
 
+int xdi_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg, xdemitcb_t *xecb)
+{
+	mmfile_t a, b;
+	xpparam_t xpp_cached;
+
+	xpp = prepare_xdi(mf1, mf2, xpp, xecfg, &a, &b, &xpp_cached);
+	if (!xpp)
+		return -1;
 	return xdl_diff(&a, &b, xpp, xecfg, xecb);
 }
 
+int xdi_diff_count(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		   xdemitconf_t const *xecfg, long *removed, long *added)
+{
+	mmfile_t a, b;
+	xpparam_t xpp_cached;
+
+	xpp = prepare_xdi(mf1, mf2, xpp, xecfg, &a, &b, &xpp_cached);
+	if (!xpp)
+		return -1;
+	return xdl_diff_count(&a, &b, xpp, xecfg, removed, added);
+}
+
 void discard_hunk_line(void *priv,
 		       long ob, long on, long nb, long nn,
 		       const char *func, long funclen)
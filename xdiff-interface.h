@@ -17,7 +17,21 @@ typedef void (*xdiff_emit_hunk_fn)(void *data,
 				   long new_begin, long new_nr,
 				   const char *func, long funclen);
 
+/*
+ * Unless xpp->cache is set, xdi_diff() reuses the buffers of earlier
+ * diffs from one cache for the whole process, limited by
+ * core.diffCacheLimit; this is only safe from the main thread. Other
+ * threads need a cache of their own from xdi_cache_new(), to be freed
+ * with xdl_cache_free().
+ */
+xdlcache_t *xdi_cache_new(void);
 int xdi_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg, xdemitcb_t *ecb);
+/*
+ * Count the lines xdi_diff() would show as removed and added, without
+ * making them into a patch.
+ */
+int xdi_diff_count(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		   xdemitconf_t const *xecfg, long *removed, long *added);
 int xdi_diff_outf(mmfile_t *mf1, mmfile_t *mf2,
 		  xdiff_emit_hunk_fn hunk_fn,
 		  xdiff_emit_line_fn line_fn,
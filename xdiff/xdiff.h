@@ -76,12 +76,22 @@ typedef struct s_mmbuffer {
 	long size;
 } mmbuffer_t;
 
+/*
+ * Keeps the buffers of finished diffs for reuse by the next ones,
+ * up to a limit on the bytes it holds. Not thread-safe: each thread
+ * needs its own.
+ */
+typedef struct s_xdlcache xdlcache_t;
+
 typedef struct s_xpparam {
 	unsigned long flags;
 
 	/* See Documentation/diff-options.txt. */
 	char **anchors;
 	size_t anchors_nr;
+
+	/* optional, see xdlcache_t */
+	xdlcache_t *cache;
 } xpparam_t;
 
 typedef struct s_xdemitcb {
@@ -117,12 +127,22 @@ typedef struct s_bdiffparam {
 #define xdl_free(ptr) free(ptr)
 #define xdl_realloc(ptr,x) xrealloc(ptr,x)
 
+xdlcache_t *xdl_cache_new(long limit);
+void xdl_cache_free(xdlcache_t *cache);
+
 void *xdl_mmfile_first(mmfile_t *mmf, long *size);
 long xdl_mmfile_size(mmfile_t *mmf);
 
 int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	     xdemitconf_t const *xecfg, xdemitcb_t *ecb);
 
+/*
+ * Count the lines the diff would show as removed and added, without
+ * emitting it. XDL_EMIT_FUNCCONTEXT is not supported.
+ */
+int xdl_diff_count(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		   xdemitconf_t const *xecfg, long *removed, long *added);
+
 typedef struct s_xmparam {
 	xpparam_t xpp;
 	int marker_size;
@@ -27,6 +27,8 @@
 #define XDL_LINE_MAX (long)((1UL << (CHAR_BIT * sizeof(long) - 1)) - 1)
 #define XDL_SNAKE_CNT 20
 #define XDL_K_HEUR 4
+#define XDL_COST_PER_REC 64
+#define XDL_COST_MIN (1L << 28)
 
 typedef struct s_xdpsplit {
 	long i1, i2;
@@ -40,7 +42,9 @@ typedef struct s_xdpsplit {
  * starting from (lim1, lim2). If the K values on the same diagonal crosses
  * returns the furthest point of reach. We might end up having to expensive
  * cases using this algorithm is full, so a little bit of heuristic is needed
- * to cut the search and to return a suboptimal point.
+ * to cut the search and to return a suboptimal point. Each diagonal scanned
+ * is taken from xenv->budget; once it runs out we return the furthest point
+ * we reached, even when "need_min" is set.
  */
 static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 		      unsigned long const *ha2, long off2, long lim2,
@@ -62,6 +66,8 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 	for (ec = 1;; ec++) {
 		int got_snake = 0;
 
+		xenv->budget -= (fmax - fmin) / 2 + (bmax - bmin) / 2 + 2;
+
 		/*
 		 * We need to extent the diagonal "domain" by one. If the next
 		 * values exits the box boundaries we need to change it in the
@@ -132,7 +138,7 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 			}
 		}
 
-		if (need_min)
+		if (need_min && xenv->budget >= 0)
 			continue;
 
 		/*
@@ -199,7 +205,7 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 		 * Enough is enough. We spent too much time here and now we collect
 		 * the furthest reaching path using the (i1 + i2) measure.
 		 */
-		if (ec >= xenv->mxcost) {
+		if (ec >= xenv->mxcost || xenv->budget < 0) {
 			long fbest, fbest1, bbest, bbest1;
 
 			fbest = fbest1 = -1;
@@ -275,6 +281,17 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1,
 
 		for (; off1 < lim1; off1++)
 			rchg1[rindex1[off1]] = 1;
+	} else if (xenv->budget < 0) {
+		char *rchg1 = dd1->rchg, *rchg2 = dd2->rchg;
+		long *rindex1 = dd1->rindex, *rindex2 = dd2->rindex;
+
+		/*
+		 * Out of budget: the whole box becomes one coarse hunk.
+		 */
+		for (; off1 < lim1; off1++)
+			rchg1[rindex1[off1]] = 1;
+		for (; off2 < lim2; off2++)
+			rchg2[rindex2[off2]] = 1;
 	} else {
 		xdpsplit_t spl;
 		spl.i1 = spl.i2 = 0;
@@ -327,7 +344,7 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	 * One is to store the forward path and one to store the backward path.
 	 */
 	ndiags = xe->xdf1.nreff + xe->xdf2.nreff + 3;
-	if (!(kvd = (long *) xdl_malloc((2 * ndiags + 2) * sizeof(long)))) {
+	if (!(kvd = (long *) xdl_cache_alloc(xpp->cache, (2 * ndiags + 2) * sizeof(long)))) {
 
 		xdl_free_env(xe);
 		return -1;
@@ -343,6 +360,17 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	xenv.snake_cnt = XDL_SNAKE_CNT;
 	xenv.heur_min = XDL_HEUR_MIN_COST;
 
+	/*
+	 * Bound the total work, so that huge inputs with many repeated
+	 * records stay fast; the floor keeps it out of the way of any
+	 * file of ordinary size. --minimal asks for the real thing.
+	 */
+	if ((xpp->flags & XDF_NEED_MINIMAL) ||
+	    ndiags > XDL_LINE_MAX / XDL_COST_PER_REC)
+		xenv.budget = XDL_LINE_MAX;
+	else
+		xenv.budget = XDL_MAX(XDL_COST_MIN, XDL_COST_PER_REC * ndiags);
+
 	dd1.nrec = xe->xdf1.nreff;
 	dd1.ha = xe->xdf1.ha;
 	dd1.rchg = xe->xdf1.rchg;
@@ -355,12 +383,12 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	if (xdl_recs_cmp(&dd1, 0, dd1.nrec, &dd2, 0, dd2.nrec,
 			 kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0, &xenv) < 0) {
 
-		xdl_free(kvd);
+		xdl_cache_release(xpp->cache, kvd);
 		xdl_free_env(xe);
 		return -1;
 	}
 
-	xdl_free(kvd);
+	xdl_cache_release(xpp->cache, kvd);
 
 	return 0;
 }
@@ -1008,27 +1036,35 @@ static void xdl_mark_ignorable(xdchange_t *xscr, xdfenv_t *xe, long flags)
 	}
 }
 
-int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-	     xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
-	xdchange_t *xscr;
-	xdfenv_t xe;
-	emit_func_t ef = xecfg->hunk_func ? xdl_call_hunk_func : xdl_emit_diff;
+static int xdl_diff_script(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			   xdfenv_t *xe, xdchange_t **xscr) {
 
-	if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0) {
+	if (xdl_do_diff(mf1, mf2, xpp, xe) < 0) {
 
 		return -1;
 	}
-	if (xdl_change_compact(&xe.xdf1, &xe.xdf2, xpp->flags) < 0 ||
-	    xdl_change_compact(&xe.xdf2, &xe.xdf1, xpp->flags) < 0 ||
-	    xdl_build_script(&xe, &xscr) < 0) {
+	if (xdl_change_compact(&xe->xdf1, &xe->xdf2, xpp->flags) < 0 ||
+	    xdl_change_compact(&xe->xdf2, &xe->xdf1, xpp->flags) < 0 ||
+	    xdl_build_script(xe, xscr) < 0) {
 
-		xdl_free_env(&xe);
+		xdl_free_env(xe);
 		return -1;
 	}
-	if (xscr) {
-		if (xpp->flags & XDF_IGNORE_BLANK_LINES)
-			xdl_mark_ignorable(xscr, &xe, xpp->flags);
+	if (*xscr && (xpp->flags & XDF_IGNORE_BLANK_LINES))
+		xdl_mark_ignorable(*xscr, xe, xpp->flags);
+
+	return 0;
+}
 
+int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+	     xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
+	xdchange_t *xscr;
+	xdfenv_t xe;
+	emit_func_t ef = xecfg->hunk_func ? xdl_call_hunk_func : xdl_emit_diff;
+
+	if (xdl_diff_script(mf1, mf2, xpp, &xe, &xscr) < 0)
+		return -1;
+	if (xscr) {
 		if (ef(&xe, xscr, ecb, xecfg) < 0) {
 
 			xdl_free_script(xscr);
@@ -1041,3 +1077,20 @@ int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 
 	return 0;
 }
+
+int xdl_diff_count(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		   xdemitconf_t const *xecfg, long *removed, long *added) {
+	xdchange_t *xscr;
+	xdfenv_t xe;
+
+	*removed = *added = 0;
+	if (xdl_diff_script(mf1, mf2, xpp, &xe, &xscr) < 0)
+		return -1;
+	if (xscr) {
+		xdl_count_changes(xscr, xecfg, removed, added);
+		xdl_free_script(xscr);
+	}
+	xdl_free_env(&xe);
+
+	return 0;
+}
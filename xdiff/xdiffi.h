@@ -35,6 +35,7 @@ typedef struct s_xdalgoenv {
 	long mxcost;
 	long snake_cnt;
 	long heur_min;
+	long budget;
 } xdalgoenv_t;
 
 typedef struct s_xdchange {
@@ -164,6 +164,27 @@ static int is_empty_rec(xdfile_t *xdf, long ri)
 	return !len;
 }
 
+/*
+ * Count the lines xdl_emit_diff() would show as removed and added: those
+ * of the changes in each hunk, as some changes may be left out.
+ */
+void xdl_count_changes(xdchange_t *xscr, xdemitconf_t const *xecfg,
+		       long *removed, long *added) {
+	xdchange_t *xch, *xche;
+
+	for (xch = xscr; xch; xch = xche->next) {
+		xche = xdl_get_hunk(&xch, xecfg);
+		if (!xch)
+			break;
+		for (;; xch = xch->next) {
+			*removed += xch->chg1;
+			*added += xch->chg2;
+			if (xch == xche)
+				break;
+		}
+	}
+}
+
 int xdl_emit_diff(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
 		  xdemitconf_t const *xecfg) {
 	long s1, s2, e1, e2, lctx;
@@ -48,12 +48,14 @@ typedef struct s_xdlclassifier {
 	long alloc;
 	long count;
 	long flags;
+	xdlcache_t *cache;
 } xdlclassifier_t;
 
 
 
 
-static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags);
+static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags,
+			       xdlcache_t *cache);
 static void xdl_free_classifier(xdlclassifier_t *cf);
 static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
 			       unsigned int hbits, xrecord_t *rec);
@@ -68,8 +70,10 @@ static int xdl_optimize_ctxs(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2
 
 
 
-static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
+static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags,
+			       xdlcache_t *cache) {
 	cf->flags = flags;
+	cf->cache = cache;
 
 	cf->hbits = xdl_hashbits((unsigned int) size);
 	cf->hsize = 1 << cf->hbits;
@@ -78,7 +82,8 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 
 		return -1;
 	}
-	if (!(cf->rchash = (xdlclass_t **) xdl_malloc(cf->hsize * sizeof(xdlclass_t *)))) {
+	cf->ncha.cache = cache;
+	if (!(cf->rchash = (xdlclass_t **) xdl_cache_alloc(cache, cf->hsize * sizeof(xdlclass_t *)))) {
 
 		xdl_cha_free(&cf->ncha);
 		return -1;
@@ -86,9 +91,9 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 	memset(cf->rchash, 0, cf->hsize * sizeof(xdlclass_t *));
 
 	cf->alloc = size;
-	if (!(cf->rcrecs = (xdlclass_t **) xdl_malloc(cf->alloc * sizeof(xdlclass_t *)))) {
+	if (!(cf->rcrecs = (xdlclass_t **) xdl_cache_alloc(cache, cf->alloc * sizeof(xdlclass_t *)))) {
 
-		xdl_free(cf->rchash);
+		xdl_cache_release(cache, cf->rchash);
 		xdl_cha_free(&cf->ncha);
 		return -1;
 	}
@@ -101,8 +106,8 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 
 static void xdl_free_classifier(xdlclassifier_t *cf) {
 
-	xdl_free(cf->rcrecs);
-	xdl_free(cf->rchash);
+	xdl_cache_release(cf->cache, cf->rcrecs);
+	xdl_cache_release(cf->cache, cf->rchash);
 	xdl_cha_free(&cf->ncha);
 }
 
@@ -130,7 +135,7 @@ static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t
 		rcrec->idx = cf->count++;
 		if (cf->count > cf->alloc) {
 			cf->alloc *= 2;
-			if (!(rcrecs = (xdlclass_t **) xdl_realloc(cf->rcrecs, cf->alloc * sizeof(xdlclass_t *)))) {
+			if (!(rcrecs = (xdlclass_t **) xdl_cache_realloc(cf->cache, cf->rcrecs, cf->alloc * sizeof(xdlclass_t *)))) {
 
 				return -1;
 			}
@@ -169,6 +174,7 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	unsigned long *ha;
 	char *rchg;
 	long *rindex;
+	xdlcache_t *cache = xpp->cache;
 
 	ha = NULL;
 	rindex = NULL;
@@ -176,9 +182,11 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	rhash = NULL;
 	recs = NULL;
 
+	xdf->cache = cache;
 	if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), narec / 4 + 1) < 0)
 		goto abort;
-	if (!(recs = (xrecord_t **) xdl_malloc(narec * sizeof(xrecord_t *))))
+	xdf->rcha.cache = cache;
+	if (!(recs = (xrecord_t **) xdl_cache_alloc(cache, narec * sizeof(xrecord_t *))))
 		goto abort;
 
 	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
@@ -186,7 +194,7 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	else {
 		hbits = xdl_hashbits((unsigned int) narec);
 		hsize = 1 << hbits;
-		if (!(rhash = (xrecord_t **) xdl_malloc(hsize * sizeof(xrecord_t *))))
+		if (!(rhash = (xrecord_t **) xdl_cache_alloc(cache, hsize * sizeof(xrecord_t *))))
 			goto abort;
 		memset(rhash, 0, hsize * sizeof(xrecord_t *));
 	}
@@ -198,7 +206,7 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 			hav = xdl_hash_record(&cur, top, xpp->flags);
 			if (nrec >= narec) {
 				narec *= 2;
-				if (!(rrecs = (xrecord_t **) xdl_realloc(recs, narec * sizeof(xrecord_t *))))
+				if (!(rrecs = (xrecord_t **) xdl_cache_realloc(cache, recs, narec * sizeof(xrecord_t *))))
 					goto abort;
 				recs = rrecs;
 			}
@@ -215,13 +223,13 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 		}
 	}
 
-	if (!(rchg = (char *) xdl_malloc((nrec + 2) * sizeof(char))))
+	if (!(rchg = (char *) xdl_cache_alloc(cache, (nrec + 2) * sizeof(char))))
 		goto abort;
 	memset(rchg, 0, (nrec + 2) * sizeof(char));
 
-	if (!(rindex = (long *) xdl_malloc((nrec + 1) * sizeof(long))))
+	if (!(rindex = (long *) xdl_cache_alloc(cache, (nrec + 1) * sizeof(long))))
 		goto abort;
-	if (!(ha = (unsigned long *) xdl_malloc((nrec + 1) * sizeof(unsigned long))))
+	if (!(ha = (unsigned long *) xdl_cache_alloc(cache, (nrec + 1) * sizeof(unsigned long))))
 		goto abort;
 
 	xdf->nrec = nrec;
@@ -238,11 +246,11 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	return 0;
 
 abort:
-	xdl_free(ha);
-	xdl_free(rindex);
-	xdl_free(rchg);
-	xdl_free(rhash);
-	xdl_free(recs);
+	xdl_cache_release(cache, ha);
+	xdl_cache_release(cache, rindex);
+	xdl_cache_release(cache, rchg);
+	xdl_cache_release(cache, rhash);
+	xdl_cache_release(cache, recs);
 	xdl_cha_free(&xdf->rcha);
 	return -1;
 }
@@ -250,11 +258,11 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 
 static void xdl_free_ctx(xdfile_t *xdf) {
 
-	xdl_free(xdf->rhash);
-	xdl_free(xdf->rindex);
-	xdl_free(xdf->rchg - 1);
-	xdl_free(xdf->ha);
-	xdl_free(xdf->recs);
+	xdl_cache_release(xdf->cache, xdf->rhash);
+	xdl_cache_release(xdf->cache, xdf->rindex);
+	xdl_cache_release(xdf->cache, xdf->rchg - 1);
+	xdl_cache_release(xdf->cache, xdf->ha);
+	xdl_cache_release(xdf->cache, xdf->recs);
 	xdl_cha_free(&xdf->rcha);
 }
 
@@ -280,7 +288,8 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	enl2 = xdl_guess_lines(mf2, sample) + 1;
 
 	if (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF &&
-	    xdl_init_classifier(&cf, enl1 + enl2 + 1, xpp->flags) < 0)
+	    xdl_init_classifier(&cf, enl1 + enl2 + 1, xpp->flags,
+				xpp->cache) < 0)
 		return -1;
 
 	if (xdl_prepare_ctx(1, mf1, enl1, xpp, &cf, &xe->xdf1) < 0) {
@@ -388,7 +397,7 @@ static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xd
 	xdlclass_t *rcrec;
 	char *dis, *dis1, *dis2;
 
-	if (!(dis = (char *) xdl_malloc(xdf1->nrec + xdf2->nrec + 2))) {
+	if (!(dis = (char *) xdl_cache_alloc(cf->cache, xdf1->nrec + xdf2->nrec + 2))) {
 
 		return -1;
 	}
@@ -436,7 +445,7 @@ static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xd
 	}
 	xdf2->nreff = nreff;
 
-	xdl_free(dis);
+	xdl_cache_release(cf->cache, dis);
 
 	return 0;
 }
@@ -36,6 +36,7 @@ typedef struct s_chastore {
 	chanode_t *ancur;
 	chanode_t *sncur;
 	long scurr;
+	xdlcache_t *cache;
 } chastore_t;
 
 typedef struct s_xrecord {
@@ -56,6 +57,7 @@ typedef struct s_xdfile {
 	long *rindex;
 	long nreff;
 	unsigned long *ha;
+	xdlcache_t *cache;
 } xdfile_t;
 
 typedef struct s_xdfenv {
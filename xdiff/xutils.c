@@ -71,6 +71,126 @@ long xdl_mmfile_size(mmfile_t *mmf)
 }
 
 
+#define XDL_CACHE_MAX_BUFS 64
+
+/*
+ * Every buffer handed out by xdl_cache_alloc() is preceded by this
+ * header, which links it into the cache once it is released.
+ */
+typedef struct s_xdlcbuf {
+	struct s_xdlcbuf *next;
+	long size;
+} xdlcbuf_t;
+
+struct s_xdlcache {
+	long limit, size;
+	int nr;
+	xdlcbuf_t *spare;
+};
+
+
+xdlcache_t *xdl_cache_new(long limit) {
+	xdlcache_t *cache;
+
+	if (!(cache = (xdlcache_t *) xdl_malloc(sizeof(*cache))))
+		return NULL;
+	cache->limit = limit;
+	cache->size = 0;
+	cache->nr = 0;
+	cache->spare = NULL;
+
+	return cache;
+}
+
+
+void xdl_cache_free(xdlcache_t *cache) {
+	xdlcbuf_t *cur, *tmp;
+
+	if (!cache)
+		return;
+	for (cur = cache->spare; (tmp = cur) != NULL;) {
+		cur = cur->next;
+		xdl_free(tmp);
+	}
+	xdl_free(cache);
+}
+
+
+/*
+ * Returns a buffer of at least "size" bytes, preferably the smallest
+ * spare one that is not much larger; "cache" may be NULL.
+ */
+void *xdl_cache_alloc(xdlcache_t *cache, long size) {
+	xdlcbuf_t *buf = NULL, **pp, **best = NULL;
+
+	if (cache) {
+		for (pp = &cache->spare; *pp; pp = &(*pp)->next)
+			if ((*pp)->size >= size && (*pp)->size / 4 <= size &&
+			    (!best || (*pp)->size < (*best)->size))
+				best = pp;
+		if (best) {
+			buf = *best;
+			*best = buf->next;
+			cache->size -= buf->size;
+			cache->nr--;
+		}
+	}
+	if (!buf) {
+		if (!(buf = (xdlcbuf_t *) xdl_malloc(sizeof(*buf) + size)))
+			return NULL;
+		buf->size = size;
+	}
+
+	return buf + 1;
+}
+
+
+void *xdl_cache_realloc(xdlcache_t *cache, void *ptr, long size) {
+	xdlcbuf_t *buf;
+	void *data;
+
+	if (!ptr)
+		return xdl_cache_alloc(cache, size);
+	buf = (xdlcbuf_t *) ptr - 1;
+	if (buf->size >= size)
+		return ptr;
+	if (!cache) {
+		if (!(buf = (xdlcbuf_t *) xdl_realloc(buf, sizeof(*buf) + size)))
+			return NULL;
+		buf->size = size;
+		return buf + 1;
+	}
+	if (!(data = xdl_cache_alloc(cache, size)))
+		return NULL;
+	memcpy(data, ptr, buf->size);
+	xdl_cache_release(cache, ptr);
+
+	return data;
+}
+
+
+/*
+ * Gives back a buffer from xdl_cache_alloc(), which is kept for reuse
+ * unless that would take the cache over its limit.
+ */
+void xdl_cache_release(xdlcache_t *cache, void *ptr) {
+	xdlcbuf_t *buf;
+
+	if (!ptr)
+		return;
+	buf = (xdlcbuf_t *) ptr - 1;
+	if (!cache || cache->nr >= XDL_CACHE_MAX_BUFS ||
+	    buf->size > cache->limit - cache->size) {
+		xdl_free(buf);
+		return;
+	}
+	buf->next = cache->spare;
+	cache->spare = buf;
+	cache->size += buf->size;
+	cache->nr++;
+}
+
+
 int xdl_cha_init(chastore_t *cha, long isize, long icount) {
 
 	cha->head = cha->tail = NULL;
@@ -78,6 +198,7 @@ int xdl_cha_init(chastore_t *cha, long isize, long icount) {
 	cha->nsize = icount * isize;
 	cha->ancur = cha->sncur = NULL;
 	cha->scurr = 0;
+	cha->cache = NULL;
 
 	return 0;
 }
@@ -88,7 +209,7 @@ void xdl_cha_free(chastore_t *cha) {
 
 	for (cur = cha->head; (tmp = cur) != NULL;) {
 		cur = cur->next;
-		xdl_free(tmp);
+		xdl_cache_release(cha->cache, tmp);
 	}
 }
 
@@ -98,7 +219,7 @@ void *xdl_cha_alloc(chastore_t *cha) {
 	void *data;
 
 	if (!(ancur = cha->ancur) || ancur->icurr == cha->nsize) {
-		if (!(ancur = (chanode_t *) xdl_malloc(sizeof(chanode_t) + cha->nsize))) {
+		if (!(ancur = (chanode_t *) xdl_cache_alloc(cha->cache, sizeof(chanode_t) + cha->nsize))) {
 
 			return NULL;
 		}
@@ -294,20 +415,41 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 	return ha;
 }
 
+/*
+ * Hash "len" bytes eight at a time. Only equality of records matters,
+ * so the value itself may differ between platforms.
+ */
+static unsigned long xdl_hash_bytes(char const *ptr, size_t len) {
+	uint64_t ha = (uint64_t) len * 0x9e3779b97f4a7c15ULL, w;
+
+	for (; len >= 8; ptr += 8, len -= 8) {
+		memcpy(&w, ptr, 8);
+		ha = (ha ^ w) * 0xbf58476d1ce4e5b9ULL;
+		ha ^= ha >> 31;
+	}
+	if (len) {
+		w = 0;
+		memcpy(&w, ptr, len);
+		ha = (ha ^ w) * 0xbf58476d1ce4e5b9ULL;
+	}
+
+	/* XDL_HASHLONG() uses the low bits */
+	ha ^= ha >> 29;
+	ha *= 0x94d049bb133111ebULL;
+	ha ^= ha >> 32;
+	return (unsigned long) ha;
+}
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
-	char const *ptr = *data;
+	char const *ptr = *data, *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
-	}
-	*data = ptr < top ? ptr + 1: ptr;
+	eol = memchr(ptr, '\n', top - ptr);
+	*data = eol ? eol + 1 : top;
 
-	return ha;
+	return xdl_hash_bytes(ptr, (eol ? eol : top) - ptr);
 }
 
 unsigned int xdl_hashbits(unsigned int size) {
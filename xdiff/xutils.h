@@ -28,6 +28,9 @@
 long xdl_bogosqrt(long n);
 int xdl_emit_diffrec(char const *rec, long size, char const *pre, long psize,
 		     xdemitcb_t *ecb);
+void *xdl_cache_alloc(xdlcache_t *cache, long size);
+void *xdl_cache_realloc(xdlcache_t *cache, void *ptr, long size);
+void xdl_cache_release(xdlcache_t *cache, void *ptr);
 int xdl_cha_init(chastore_t *cha, long isize, long icount);
 void xdl_cha_free(chastore_t *cha);
 void *xdl_cha_alloc(chastore_t *cha);
@@ -3,6 +3,9 @@
  * at init time.
  */
 #include "cache.h"
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 static const char *zerr_to_string(int status)
 {
@@ -112,6 +115,7 @@ int git_inflate(git_zstream *strm, int flush)
 {
 	int status;
 
+	trace2_timer_start(TRACE2_TIMER_ID_INFLATE);
 	for (;;) {
 		zlib_pre_call(strm);
 		/* Never say Z_FINISH unless we are feeding everything */
@@ -131,6 +135,7 @@ int git_inflate(git_zstream *strm, int flush)
 			continue;
 		break;
 	}
+	trace2_timer_stop(TRACE2_TIMER_ID_INFLATE);
 
 	switch (status) {
 	/* Z_BUF_ERROR: normal, needs more space in the output buffer */
@@ -146,6 +151,69 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+#ifdef USE_LIBDEFLATE
+static int inflate_buffer(void *out, unsigned long outlen,
+			  const void *in, unsigned long inlen,
+			  unsigned long *consumed)
+{
+	struct libdeflate_decompressor *d;
+	size_t in_used, out_used;
+	enum libdeflate_result res;
+
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		die("inflate: out of memory");
+	res = libdeflate_zlib_decompress_ex(d, in, inlen, out, outlen,
+					    &in_used, &out_used);
+	libdeflate_free_decompressor(d);
+	if (res != LIBDEFLATE_SUCCESS || out_used != outlen)
+		return -1;
+	if (consumed)
+		*consumed = in_used;
+	return 0;
+}
+#else
+static int inflate_buffer(void *out, unsigned long outlen,
+			  const void *in, unsigned long inlen,
+			  unsigned long *consumed)
+{
+	z_stream z;
+	int status;
+
+	if (outlen >= ZLIB_BUF_MAX)
+		return -1;
+	memset(&z, 0, sizeof(z));
+	if (inflateInit(&z) != Z_OK)
+		die("inflateInit: out of memory");
+	z.next_in = (unsigned char *)in;
+	z.avail_in = zlib_buf_cap(inlen);
+	z.next_out = out;
+	/* one more byte, to notice a payload larger than it should be */
+	z.avail_out = outlen + 1;
+	status = inflate(&z, Z_FINISH);
+	if (status == Z_MEM_ERROR)
+		die("inflate: out of memory");
+	inflateEnd(&z);
+	if (status != Z_STREAM_END || z.total_out != outlen)
+		return -1;
+	if (consumed)
+		*consumed = z.total_in;
+	return 0;
+}
+#endif
+
+int git_inflate_buffer(void *out, unsigned long outlen,
+		       const void *in, unsigned long inlen,
+		       unsigned long *consumed)
+{
+	int ret;
+
+	trace2_timer_start(TRACE2_TIMER_ID_INFLATE);
+	ret = inflate_buffer(out, outlen, in, inlen, consumed);
+	trace2_timer_stop(TRACE2_TIMER_ID_INFLATE);
+	return ret;
+}
+
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
 #define deflateBound(c,s)  ((s) + (((s) + 7) >> 3) + (((s) + 63) >> 6) + 11)
 #endif